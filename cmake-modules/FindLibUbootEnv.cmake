@@ -0,0 +1,30 @@
+# - Find libubootenv
+# Find the native LIBUBOOTENV includes and library
+#
+#  LIBUBOOTENV_INCLUDE_DIR - where to find libuboot.h, etc.
+#  LIBUBOOTENV_LIBRARIES   - List of libraries when using libubootenv.
+#  LIBUBOOTENV_FOUND       - True if libubootenv found.
+
+
+IF (LIBUBOOTENV_INCLUDE_DIR)
+  # Already in cache, be silent
+  SET(LIBUBOOTENV_FIND_QUIETLY TRUE)
+ENDIF (LIBUBOOTENV_INCLUDE_DIR)
+
+FIND_PATH(LIBUBOOTENV_INCLUDE_DIR libuboot.h)
+
+SET(LIBUBOOTENV_NAMES ubootenv libubootenv)
+FIND_LIBRARY(LIBUBOOTENV_LIBRARY NAMES ${LIBUBOOTENV_NAMES} )
+
+# handle the QUIETLY and REQUIRED arguments and set LIBUBOOTENV_FOUND to TRUE if
+# all listed variables are TRUE
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(LibUbootEnv DEFAULT_MSG LIBUBOOTENV_LIBRARY LIBUBOOTENV_INCLUDE_DIR)
+
+IF(LIBUBOOTENV_FOUND)
+  SET( LIBUBOOTENV_LIBRARIES ${LIBUBOOTENV_LIBRARY} )
+ELSE(LIBUBOOTENV_FOUND)
+  SET( LIBUBOOTENV_LIBRARIES )
+ENDIF(LIBUBOOTENV_FOUND)
+
+MARK_AS_ADVANCED( LIBUBOOTENV_LIBRARY LIBUBOOTENV_INCLUDE_DIR )
@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE target_segments(targetname TEXT NOT NULL, segment INTEGER NOT NULL, range_start INTEGER NOT NULL, range_length INTEGER NOT NULL, downloaded INTEGER NOT NULL DEFAULT 0, UNIQUE(targetname, segment));
+
+DELETE FROM version;
+INSERT INTO version VALUES(26);
+
+RELEASE MIGRATION;
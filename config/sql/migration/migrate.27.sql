@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE target_hash_states(targetname TEXT PRIMARY KEY, hashed_length INTEGER NOT NULL, hash_state BLOB NOT NULL);
+
+DELETE FROM version;
+INSERT INTO version VALUES(27);
+
+RELEASE MIGRATION;
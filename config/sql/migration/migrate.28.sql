@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE verified_targets(filename TEXT PRIMARY KEY, size INTEGER NOT NULL, mtime INTEGER NOT NULL, inode INTEGER NOT NULL, hashes TEXT NOT NULL);
+
+DELETE FROM version;
+INSERT INTO version VALUES(28);
+
+RELEASE MIGRATION;
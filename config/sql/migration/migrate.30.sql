@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE background_migrations(name TEXT PRIMARY KEY, last_id INTEGER NOT NULL DEFAULT 0);
+
+DELETE FROM version;
+INSERT INTO version VALUES(30);
+
+RELEASE MIGRATION;
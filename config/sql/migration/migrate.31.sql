@@ -0,0 +1,11 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE INDEX installed_versions_ecu ON installed_versions(ecu_serial, id);
+CREATE INDEX installed_versions_current ON installed_versions(ecu_serial) WHERE is_current = 1;
+CREATE INDEX installed_versions_pending ON installed_versions(ecu_serial) WHERE is_pending = 1;
+
+DELETE FROM version;
+INSERT INTO version VALUES(31);
+
+RELEASE MIGRATION;
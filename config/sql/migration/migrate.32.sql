@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE INDEX target_images_filename ON target_images(filename);
+
+DELETE FROM version;
+INSERT INTO version VALUES(32);
+
+RELEASE MIGRATION;
@@ -0,0 +1,19 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE meta_migrate(meta BLOB NOT NULL, repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, version INTEGER NOT NULL, expires TEXT, meta_file TEXT, UNIQUE(repo, meta_type, version));
+INSERT INTO meta_migrate(meta, repo, meta_type, version, expires) SELECT meta.meta, meta.repo, meta.meta_type, meta.version, meta.expires FROM meta;
+
+DROP TABLE meta;
+ALTER TABLE meta_migrate RENAME TO meta;
+
+CREATE TABLE delegations_migrate(meta BLOB NOT NULL, role_name TEXT NOT NULL, meta_file TEXT, UNIQUE(role_name));
+INSERT INTO delegations_migrate(meta, role_name) SELECT delegations.meta, delegations.role_name FROM delegations;
+
+DROP TABLE delegations;
+ALTER TABLE delegations_migrate RENAME TO delegations;
+
+DELETE FROM version;
+INSERT INTO version VALUES(34);
+
+RELEASE MIGRATION;
@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT ROLLBACK_MIGRATION;
+
+DROP TABLE meta_validators;
+
+DELETE FROM version;
+INSERT INTO version VALUES(28);
+
+RELEASE ROLLBACK_MIGRATION;
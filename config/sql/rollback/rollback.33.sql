@@ -0,0 +1,13 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT ROLLBACK_MIGRATION;
+
+CREATE TABLE meta_migrate(meta BLOB NOT NULL, repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, version INTEGER NOT NULL, UNIQUE(repo, meta_type, version));
+INSERT INTO meta_migrate(meta, repo, meta_type, version) SELECT meta.meta, meta.repo, meta.meta_type, meta.version FROM meta;
+
+DROP TABLE meta;
+ALTER TABLE meta_migrate RENAME TO meta;
+
+DELETE FROM version;
+INSERT INTO version VALUES(32);
+
+RELEASE ROLLBACK_MIGRATION;
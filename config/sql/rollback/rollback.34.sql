@@ -0,0 +1,22 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT ROLLBACK_MIGRATION;
+
+-- metadata kept in files is dropped, and fetched again
+DELETE FROM meta_validators WHERE EXISTS (SELECT 1 FROM meta WHERE meta.repo = meta_validators.repo AND meta.meta_type = meta_validators.meta_type AND meta.meta_file IS NOT NULL);
+
+CREATE TABLE meta_migrate(meta BLOB NOT NULL, repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, version INTEGER NOT NULL, expires TEXT, UNIQUE(repo, meta_type, version));
+INSERT INTO meta_migrate(meta, repo, meta_type, version, expires) SELECT meta.meta, meta.repo, meta.meta_type, meta.version, meta.expires FROM meta WHERE meta.meta_file IS NULL;
+
+DROP TABLE meta;
+ALTER TABLE meta_migrate RENAME TO meta;
+
+CREATE TABLE delegations_migrate(meta BLOB NOT NULL, role_name TEXT NOT NULL, UNIQUE(role_name));
+INSERT INTO delegations_migrate(meta, role_name) SELECT delegations.meta, delegations.role_name FROM delegations WHERE delegations.meta_file IS NULL;
+
+DROP TABLE delegations;
+ALTER TABLE delegations_migrate RENAME TO delegations;
+
+DELETE FROM version;
+INSERT INTO version VALUES(33);
+
+RELEASE ROLLBACK_MIGRATION;
@@ -1,6 +1,7 @@
 #ifndef AKTUALIZR_LIBAKTUALIZRC_H
 #define AKTUALIZR_LIBAKTUALIZRC_H
 
+#include <stddef.h> // for size_t
 #include <stdint.h> // for uint8_t
 
 #ifdef __cplusplus
@@ -10,6 +11,8 @@ using Campaign = campaign::Campaign;
 using Updates = std::vector<Uptane::Target>;
 using Target = Uptane::Target;
 using StorageTargetHandle = std::ifstream;
+using StorageTargetView = TargetFileView;
+struct AsyncOperation;
 
 extern "C" {
 #else
@@ -18,6 +21,8 @@ typedef struct Campaign Campaign;
 typedef struct Updates Updates;
 typedef struct Target Target;
 typedef struct StorageTargetHandle StorageTargetHandle;
+typedef struct StorageTargetView StorageTargetView;
+typedef struct AsyncOperation AsyncOperation;
 #endif
 
 Aktualizr *Aktualizr_create_from_cfg(Config *cfg);
@@ -28,6 +33,37 @@ void Aktualizr_destroy(Aktualizr *a);
 
 int Aktualizr_set_signal_handler(Aktualizr *a, void (*handler)(const char* event_name));
 
+/*
+ * Non-blocking variants of Aktualizr_updates_check, Aktualizr_download_target
+ * and Aktualizr_install_target, for event loops. They return at once with an
+ * operation handle, or NULL if the operation could not be started.
+ *
+ * Completion is notified in two ways, use either:
+ *  - the callback, if not NULL, called from a thread of libaktualizr;
+ *  - the file descriptor of Aktualizr_async_get_fd, which becomes readable
+ *    (POLLIN) once the operation is complete, e.g. to add it to epoll.
+ *
+ * Aktualizr_async_free must be called once the operation is complete, and may
+ * be called from the callback. The Target is copied, it need not outlive the
+ * call.
+ */
+typedef void (*Aktualizr_async_cb)(AsyncOperation *op, void *user_data);
+AsyncOperation *Aktualizr_updates_check_async(Aktualizr *a, Aktualizr_async_cb cb, void *user_data);
+AsyncOperation *Aktualizr_download_target_async(Aktualizr *a, Target *t, Aktualizr_async_cb cb, void *user_data);
+AsyncOperation *Aktualizr_install_target_async(Aktualizr *a, Target *t, Aktualizr_async_cb cb, void *user_data);
+int Aktualizr_async_get_fd(AsyncOperation *op);
+/* 1 once the operation is complete, 0 before */
+int Aktualizr_async_is_done(AsyncOperation *op);
+/* 0 on success, -1 on failure, like the blocking variants; waits for the
+ * operation to complete */
+int Aktualizr_async_result(AsyncOperation *op);
+/* The updates found by Aktualizr_updates_check_async, to free with
+ * Aktualizr_updates_free; NULL if there are none. Waits for the operation to
+ * complete. */
+Updates *Aktualizr_async_take_updates(AsyncOperation *op);
+/* Waits for the operation to complete, unless called from its callback */
+void Aktualizr_async_free(AsyncOperation *op);
+
 Campaign *Aktualizr_campaigns_check(Aktualizr *a);
 int Aktualizr_campaign_accept(Aktualizr *a, Campaign *c);
 int Aktualizr_campaign_postpone(Aktualizr *a, Campaign *c);
@@ -53,6 +89,19 @@ StorageTargetHandle *Aktualizr_open_stored_target(Aktualizr *a, const Target *t)
 size_t Aktualizr_read_stored_target(StorageTargetHandle *handle, uint8_t* buf, size_t size);
 int Aktualizr_close_stored_target(StorageTargetHandle *handle);
 
+/*
+ * Read-only view of a stored target, without copying it: its file descriptor,
+ * e.g. for sendfile(), and the file mapped in memory. Both are owned by the
+ * view and stay valid until Aktualizr_close_stored_target_view() is called;
+ * the caller must not close the descriptor nor unmap the data.
+ */
+StorageTargetView *Aktualizr_open_stored_target_view(Aktualizr *a, const Target *t);
+int Aktualizr_get_stored_target_fd(const StorageTargetView *view);
+/* NULL for an empty target */
+const uint8_t *Aktualizr_get_stored_target_data(const StorageTargetView *view);
+size_t Aktualizr_get_stored_target_size(const StorageTargetView *view);
+int Aktualizr_close_stored_target_view(StorageTargetView *view);
+
 typedef enum {
   kSuccess = 0,
   kAlreadyPaused,
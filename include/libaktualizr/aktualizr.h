@@ -1,22 +1,32 @@
 #ifndef AKTUALIZR_H_
 #define AKTUALIZR_H_
 
+#include <atomic>
 #include <future>
 #include <memory>
+#include <mutex>
 
 #include <boost/signals2.hpp>
 
 #include "libaktualizr/config.h"
 #include "libaktualizr/events.h"
+#include "libaktualizr/packagemanagerinterface.h"
 #include "libaktualizr/secondaryinterface.h"
 
 class SotaUptaneClient;
 class INvStorage;
+class EventDispatcher;
+class HttpInterface;
+class NotificationListener;
 
 namespace api {
 class CommandQueue;
 }
 
+namespace metrics {
+class FileExporter;
+}
+
 /**
  * This class provides the main APIs necessary for launching and controlling
  * libaktualizr.
@@ -63,6 +73,10 @@ class Aktualizr {
 
   /**
    * Asynchronously run aktualizr indefinitely until Shutdown is called.
+   * Between two UptaneCycle() calls, it waits `polling_sec`, or less or more
+   * depending on the options `polling_*` of the Uptane configuration, but
+   * never less than the server asked for with Retry-After. An event
+   * PollScheduled tells how long.
    * @return Empty std::future object
    *
    * @throw SQLException
@@ -150,7 +164,7 @@ class Aktualizr {
    * @throw std::system_error (failure to lock a mutex)
    * @throw SotaUptaneClient::NotProvisionedYet (called before provisioning complete)
    */
-  std::future<result::Download> Download(const std::vector<Uptane::Target>& updates);
+  std::future<result::Download> Download(std::vector<Uptane::Target> updates);
 
   struct InstallationLogEntry {
     Uptane::EcuSerial ecu;
@@ -194,6 +208,17 @@ class Aktualizr {
    */
   void DeleteStoredTarget(const Uptane::Target& target);
 
+  /**
+   * Remove stale targets from storage, at a low I/O priority. The images of
+   * the `pacman.images_retention` most recently installed targets of each ECU
+   * are kept, as well as those of pending installations and of the latest
+   * Director targets. Images that no target refers to are removed too.
+   * @return Empty std::future object
+   *
+   * @throw SQLException
+   */
+  std::future<void> RemoveStaleTargets();
+
   /**
    * Get target downloaded in Download call. Returned target is guaranteed to be verified and up-to-date
    * according to the Uptane metadata downloaded in CheckUpdates call.
@@ -205,6 +230,19 @@ class Aktualizr {
    */
   std::ifstream OpenStoredTarget(const Uptane::Target& target);
 
+  /**
+   * Like OpenStoredTarget, but gives the file descriptor of the stored target
+   * and the file mapped in memory, e.g. to send it with sendfile() or to DMA
+   * from it without copying it first. Both stay valid for as long as the view
+   * exists.
+   * @param target Target object matching the desired target in the storage.
+   * @return Read-only view of the stored binary.
+   *
+   * @throw SQLException
+   * @throw std::runtime_error (target not found, not verified or can't be mapped)
+   */
+  TargetFileView OpenStoredTargetView(const Uptane::Target& target);
+
   /**
    * Install targets.
    * @param updates Vector of targets to install as provided by CheckUpdates or
@@ -217,7 +255,7 @@ class Aktualizr {
    * @throw std::system_error (failure to lock a mutex)
    * @throw SotaUptaneClient::NotProvisionedYet (called before provisioning complete)
    */
-  std::future<result::Install> Install(const std::vector<Uptane::Target>& updates);
+  std::future<result::Install> Install(std::vector<Uptane::Target> updates);
 
   /**
    * SetInstallationRawReport allows setting a custom raw report field in the device installation result.
@@ -251,6 +289,20 @@ class Aktualizr {
    */
   std::future<bool> SendManifest(const Json::Value& custom = Json::nullValue);
 
+  /**
+   * Maintain the storage: give back the space of removed data, fold the
+   * write-ahead log into the database, refresh the statistics of the query
+   * planner and, if StorageConfig::maintenance_integrity_check is set, check
+   * its integrity, in about StorageConfig::maintenance_budget_ms at most. The
+   * outcome is sent as a StorageMaintenanceReport event. Waits until no other
+   * command runs, and RunForever() calls it when a check found no update, at
+   * most every StorageConfig::maintenance_interval_sec.
+   * @return Empty std::future object
+   *
+   * @throw std::system_error (failure to lock a mutex)
+   */
+  std::future<void> MaintainStorage();
+
   /**
    * Pause the library operations.
    * In progress target downloads will be paused and API calls will be deferred.
@@ -265,7 +317,8 @@ class Aktualizr {
   /**
    * Resume the library operations.
    * Target downloads will resume and API calls issued during the pause will
-   * execute in fifo order.
+   * execute in fifo order, except that SendDeviceData, SendManifest and the
+   * campaign calls don't wait for a download to finish.
    *
    * @return Information about resume results.
    *
@@ -275,8 +328,22 @@ class Aktualizr {
   result::Pause Resume();
 
   /**
-   * Aborts the currently running command, if it can be aborted, or waits for it
-   * to finish; then removes all other queued calls.
+   * Limit the total rate of the Target downloads, replacing the limits of the
+   * configuration until ResetDownloadRateLimit() is called. Takes effect on
+   * running downloads as well. Other requests are not throttled.
+   *
+   * @param bytes_per_sec Maximum rate in bytes per second, 0 for no limit.
+   */
+  void SetDownloadRateLimit(uint64_t bytes_per_sec);
+
+  /**
+   * Go back to the download rate limits of the configuration.
+   */
+  void ResetDownloadRateLimit();
+
+  /**
+   * Aborts the currently running commands, if they can be aborted, or waits for
+   * them to finish; then removes all other queued calls.
    * This doesn't reset the `Paused` state, i.e. if the queue was previously
    * paused, it will remain paused, but with an emptied queue.
    * The call is blocking.
@@ -302,6 +369,13 @@ class Aktualizr {
    */
   bool UptaneCycle();
 
+  /**
+   * Trace the next UptaneCycle() whatever the sampling of the configuration.
+   * The trace is written to the `trace_path` of the `[metrics]` section, and
+   * nothing is traced if it isn't set.
+   */
+  void TraceNextCycle();
+
   /**
    * Add new Secondary to aktualizr. Must be called before Initialize.
    * @param secondary An object to perform installation on a Secondary ECU.
@@ -344,6 +418,9 @@ class Aktualizr {
 
   /**
    * Provide a function to receive event notifications.
+   * Events are delivered in order on a thread of their own, by the time the
+   * future of the call that caused them is ready. Download progress reports
+   * may be merged when the handlers are slower than the download.
    * @param handler a function that can receive event objects.
    * @return a signal connection object, which can be disconnected if desired.
    */
@@ -360,15 +437,37 @@ class Aktualizr {
   std::shared_ptr<SotaUptaneClient> uptane_client_;
 
  private:
+  // listens to UptaneConfig::notification_url for RunForever()
+  std::unique_ptr<NotificationListener> listenToNotifications();
+
   struct {
     std::mutex m;
     std::condition_variable cv;
     bool flag = false;
+    // the server notified news, see UptaneConfig::notification_url
+    bool notified = false;
   } exit_cond_;
 
   std::shared_ptr<INvStorage> storage_;
   std::shared_ptr<event::Channel> sig_;
+  // delivers the events of uptane_client_ to sig_
+  std::shared_ptr<EventDispatcher> events_;
   std::unique_ptr<api::CommandQueue> api_queue_;
+  std::shared_ptr<HttpInterface> http_;
+  // writes the metrics to config_.metrics.path, if set
+  std::unique_ptr<metrics::FileExporter> metrics_exporter_;
+  // UptaneCycle() runs so far, for the trace sampling
+  std::atomic<uint64_t> cycles_{0};
+  std::atomic<bool> trace_next_cycle_{false};
+  // what the last UptaneCycle() and CampaignCheck() found, for RunForever()
+  std::atomic<bool> updates_found_{false};
+  std::atomic<bool> campaigns_active_{false};
+  // when RunForever() may call MaintainStorage() again
+  std::chrono::steady_clock::time_point next_maintenance_{std::chrono::steady_clock::time_point::min()};
+  // the CampaignCheck() that has not completed yet, shared with the calls
+  // made in the meantime
+  std::mutex campaign_check_mutex_;
+  std::shared_future<result::CampaignCheck> campaign_check_;
 };
 
 #endif  // AKTUALIZR_H_
@@ -8,6 +8,7 @@
 #include "json/json.h"
 
 class HttpInterface;
+struct HttpCacheValidators;
 
 namespace campaign {
 
@@ -41,6 +42,13 @@ class Campaign {
   static std::vector<Campaign> campaignsFromJson(const Json::Value &json);
   static void JsonFromCampaigns(const std::vector<Campaign> &in, Json::Value &out);
   static std::vector<Campaign> fetchAvailableCampaigns(HttpInterface &http_client, const std::string &tls_server);
+  /**
+   * Fetch and parse the campaigns only if they changed since `validators`
+   * came with `campaigns`, then update both. A failed fetch leaves no
+   * campaigns. Returns false if they did not change.
+   */
+  static bool fetchAvailableCampaignsIfModified(HttpInterface &http_client, const std::string &tls_server,
+                                                HttpCacheValidators *validators, std::vector<Campaign> *campaigns);
 
   Campaign() = default;
   explicit Campaign(const Json::Value &json);
@@ -17,6 +17,10 @@
 
 struct LoggerConfig {
   int loglevel{2};
+  // "console" or "journald"
+  std::string sink{"console"};
+  // write the records from a dedicated thread rather than the logging one
+  bool async{false};
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
 };
@@ -37,6 +41,54 @@ struct P11Config {
   void writeToStream(std::ostream& out_stream) const;
 };
 
+struct CryptoConfig {
+  // name of the registered CryptoProvider to verify, sign and hash with
+  std::string provider{"openssl"};
+
+  void updateFromPropertyTree(const boost::property_tree::ptree& pt);
+  void writeToStream(std::ostream& out_stream) const;
+};
+
+struct MetricsConfig {
+  // file to write the metrics to in the Prometheus text format; empty to not
+  // export them
+  boost::filesystem::path path;
+  // seconds between two writes
+  uint64_t interval{60};
+  // file to write the Chrome trace event JSON of the last traced Uptane
+  // cycle to; empty to not trace
+  boost::filesystem::path trace_path;
+  // trace one Uptane cycle out of trace_sample, 0 for none
+  uint64_t trace_sample{1};
+  // file to append the HTTP requests and their responses to, with their
+  // timing, for HttpReplay; empty to not record them
+  boost::filesystem::path http_recording_path;
+
+  void updateFromPropertyTree(const boost::property_tree::ptree& pt);
+  void writeToStream(std::ostream& out_stream) const;
+};
+
+struct MemoryConfig {
+  // bytes the larger buffers may take together, 0 for no limit, see
+  // MemoryBudget
+  uint64_t budget{0};
+
+  void updateFromPropertyTree(const boost::property_tree::ptree& pt);
+  void writeToStream(std::ostream& out_stream) const;
+};
+
+// CPU and I/O scheduling of the background workers, in the format of
+// ThreadPolicy::parse(), e.g. "nice=10 ioprio=idle cpus=2-3"
+struct SchedulingConfig {
+  std::string download;
+  std::string hasher;
+  std::string commands;
+  std::string secondaries;
+
+  void updateFromPropertyTree(const boost::property_tree::ptree& pt);
+  void writeToStream(std::ostream& out_stream) const;
+};
+
 struct TlsConfig {
   std::string server;
   boost::filesystem::path server_url_path;
@@ -65,13 +117,48 @@ struct ProvisionConfig {
 
 struct UptaneConfig {
   uint64_t polling_sec{10U};
+  // adaptive polling in Aktualizr::RunForever(), 0 to turn each off
+  uint64_t polling_max_sec{0U};
+  uint64_t polling_campaign_sec{0U};
+  uint64_t polling_jitter_percent{0U};
   std::string director_server;
   std::string repo_server;
+  // comma separated mirrors of the Image repository, the fastest one is used
+  std::string repo_mirrors;
   CryptoSource key_source{CryptoSource::kFile};
   KeyType key_type{KeyType::kRSA2048};
   bool force_install_completion{false};
   boost::filesystem::path secondary_config_file;
   uint64_t secondary_preinstall_wait_sec{600U};
+  uint64_t secondary_manifest_timeout_sec{10U};
+  uint64_t max_parallel_downloads{1U};
+  uint64_t max_parallel_delegation_fetches{1U};
+  uint64_t max_parallel_secondaries{8U};
+  // Secondaries, by serial or hardware ID, that get their images first
+  std::string secondary_install_priority;
+  // order of the downloads and of the sends to the Secondaries, see TargetOrder
+  std::string target_order{"director"};
+  // Secondaries get their images as soon as they are downloaded, see
+  // SotaUptaneClient::downloadAndInstall()
+  bool pipeline_installs{false};
+  // download rate limits in bytes per second, 0 for no limit
+  uint64_t download_rate_limit{0U};
+  std::string download_rate_limit_schedule;
+  uint64_t download_rate_limit_metered{0U};
+  std::string metered_interfaces;
+  // don't send a manifest the server already has, or send only what changed
+  bool skip_unchanged_manifest{false};
+  bool partial_manifests{false};
+  // Initialize() returns once the local state is loaded; what needs the
+  // network or the package manager runs as the first command
+  bool deferred_initialization{false};
+  // refresh the Image repo metadata along with the Director's rather than
+  // after it, see SotaUptaneClient::uptaneIteration()
+  bool speculative_image_meta{false};
+  // long-polled by Aktualizr::RunForever() to poll right away when the
+  // server has news, see NotificationListener; empty to only poll
+  std::string notification_url;
+  uint64_t notification_timeout_sec{600U};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -94,8 +181,43 @@ struct PackageConfig {
   std::string os;
   boost::filesystem::path sysroot;
   std::string ostree_server;
+  // OSTree fetcher tuning, 0 keeps OSTree's default for the low speed limits
+  bool ostree_http2{true};
+  uint64_t ostree_low_speed_limit{0};
+  uint64_t ostree_low_speed_time{0};
+  uint64_t ostree_network_retries{5U};
+  // pull the Primary's OSTree commit in the background as soon as the update
+  // check finds it, at no more than the rate limit in bytes per second (0 for
+  // no limit) until a download waits for it
+  bool ostree_prefetch{false};
+  uint64_t ostree_prefetch_rate_limit{0};
+  // stage the new deployment at installation, the bootloader configuration is
+  // only written when ostree-finalize-staged.service finalizes it at shutdown
+  bool ostree_staged_deploy{false};
+  // prune the OSTree repo once an installation has been finalized, keeping
+  // the deployments and the ostree_prune_keep_commits most recent commits
+  bool ostree_prune{false};
+  uint64_t ostree_prune_keep_commits{0};
   boost::filesystem::path images_path{"/var/sota/images"};
   boost::filesystem::path packages_file{"/usr/package.manifest"};
+  // number of byte ranges of a single binary Target downloaded in parallel
+  uint64_t download_segments{1U};
+  // write downloaded binary Targets with O_DIRECT, bypassing the page cache
+  bool download_direct_io{false};
+  // images of the most recently installed Targets kept per ECU, 0 keeps all
+  uint64_t images_retention{2U};
+  // stream binary Targets of IP Secondaries to them during the installation,
+  // as they are downloaded, instead of downloading them beforehand
+  bool secondary_cut_through{false};
+  // also store the images streamed to Secondaries in images_path
+  bool secondary_cut_through_copy{false};
+  // HTTP cache on the Primary that Secondaries pull OSTree commits and images
+  // from, at http://<secondary_cache_address>:<secondary_cache_port>. Disabled
+  // while the address is empty.
+  std::string secondary_cache_address;
+  uint16_t secondary_cache_port{9050};
+  boost::filesystem::path secondary_cache_path{"/var/sota/secondary_cache"};
+  uint64_t secondary_cache_max_size{1024UL * 1024 * 1024};
 
   // Options for simulation
   bool fake_need_reboot{false};
@@ -122,6 +244,17 @@ struct StorageConfig {
 
   // SQLite storage
   utils::BasedPath sqldb_path{"sql.db"};  // based on `/var/sota`
+  bool sqldb_wal{false};
+  // in-memory cache of Uptane metadata, in bytes, 0 to disable
+  uint64_t metadata_cache_size{1U << 20U};
+  // entries of the installation log kept for each ECU, 0 to keep all of them
+  uint64_t installed_versions_retention{100U};
+  // measure the calls to the storage, see ProfilingStorage
+  bool profile{false};
+  // idle-time maintenance of the database by RunForever(), 0 to disable
+  uint64_t maintenance_interval_sec{86400};
+  uint64_t maintenance_budget_ms{1000};
+  bool maintenance_integrity_check{false};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -146,6 +279,8 @@ struct ImportConfig {
 struct TelemetryConfig {
   bool report_network{true};
   bool report_config{true};
+  bool compress_events{true};
+  bool report_performance{false};
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
 };
@@ -222,6 +357,10 @@ class Config : public BaseConfig {
   // while processing the others.
   LoggerConfig logger;
   P11Config p11;
+  CryptoConfig crypto;
+  MetricsConfig metrics;
+  MemoryConfig memory;
+  SchedulingConfig scheduling;
   TlsConfig tls;
   ProvisionConfig provision;
   UptaneConfig uptane;
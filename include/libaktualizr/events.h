@@ -2,6 +2,8 @@
 #define EVENTS_H_
 /** \file */
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -90,6 +92,61 @@ class DownloadProgressReport : public BaseEvent {
   static const unsigned int ProgressCompletedValue{100};
 };
 
+/**
+ * Statistics of an OSTree pull, sent once it is over.
+ */
+class OstreePullReport : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"OstreePullReport"};
+
+  OstreePullReport(Uptane::Target target_in, bool success_in) : target{std::move(target_in)}, success{success_in} {
+    variant = TypeName;
+  }
+
+  Uptane::Target target;
+  bool success;
+  uint64_t bytes_transferred{0};
+  unsigned int objects_fetched{0};
+  unsigned int metadata_objects_fetched{0};
+  unsigned int delta_parts_fetched{0};
+  // most requests queued in the OSTree fetcher at once
+  unsigned int max_outstanding_fetches{0};
+  std::chrono::milliseconds duration{0};
+};
+
+/**
+ * Statistics of the pruning of the OSTree repo after an installation.
+ */
+class OstreePruneReport : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"OstreePruneReport"};
+
+  OstreePruneReport() { variant = TypeName; }
+
+  unsigned int objects_total{0};
+  unsigned int objects_pruned{0};
+  uint64_t bytes_reclaimed{0};
+  std::chrono::milliseconds duration{0};
+};
+
+/**
+ * Statistics of an idle-time maintenance of the storage, see
+ * Aktualizr::MaintainStorage().
+ */
+class StorageMaintenanceReport : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"StorageMaintenanceReport"};
+
+  StorageMaintenanceReport() { variant = TypeName; }
+
+  uint64_t bytes_reclaimed{0};
+  std::chrono::milliseconds duration{0};
+  // false if the time budget ran out before all the steps were done
+  bool complete{false};
+  bool integrity_checked{false};
+  bool integrity_ok{false};
+};
+
 /**
  * A target has been downloaded.
  */
@@ -129,6 +186,22 @@ class InstallStarted : public BaseEvent {
   Uptane::EcuSerial serial;
 };
 
+/**
+ * A report for an installation in progress on a Secondary, in percent.
+ */
+class InstallProgressReport : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"InstallProgressReport"};
+
+  InstallProgressReport(Uptane::EcuSerial serial_in, unsigned int progress_in)
+      : serial(std::move(serial_in)), progress{progress_in} {
+    variant = TypeName;
+  }
+
+  Uptane::EcuSerial serial;
+  unsigned int progress;
+};
+
 /**
  * An installation attempt on an ECU has completed.
  */
@@ -193,6 +266,17 @@ class CampaignPostponeComplete : public BaseEvent {
   CampaignPostponeComplete() { variant = TypeName; }
 };
 
+/**
+ * RunForever() polls the server again after `interval`.
+ */
+class PollScheduled : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"PollScheduled"};
+
+  explicit PollScheduled(std::chrono::milliseconds interval_in) : interval(interval_in) { variant = TypeName; }
+  std::chrono::milliseconds interval;
+};
+
 using Channel = boost::signals2::signal<void(std::shared_ptr<event::BaseEvent>)>;
 
 }  // namespace event
@@ -4,13 +4,17 @@
 #include <fstream>
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "libaktualizr/config.h"
+#include "libaktualizr/events.h"
 
 class Bootloader;
 class HttpInterface;
 class KeyManager;
 class INvStorage;
+class TargetStream;
+struct DownloadSegment;
 
 namespace api {
 class FlowControlToken;
@@ -18,6 +22,7 @@ class FlowControlToken;
 
 namespace Uptane {
 class Fetcher;
+class OfflineBundle;
 }
 
 using FetcherProgressCb = std::function<void(const Uptane::Target&, const std::string&, unsigned int)>;
@@ -40,6 +45,32 @@ enum class TargetStatus {
   kInvalid,
 };
 
+/**
+ * Read-only view of a stored Target file, to send it on without copying it
+ * through stream buffers: the descriptor can be used with sendfile() or
+ * splice(), and the content is mapped in memory.
+ */
+class TargetFileView {
+ public:
+  // throws std::runtime_error if the file can't be opened or mapped
+  explicit TargetFileView(const std::string& path);
+  ~TargetFileView();
+  TargetFileView(const TargetFileView&) = delete;
+  TargetFileView(TargetFileView&& other) noexcept;
+  TargetFileView& operator=(const TargetFileView&) = delete;
+  TargetFileView& operator=(TargetFileView&& other) noexcept;
+
+  int fd() const { return fd_; }
+  uint64_t size() const { return size_; }
+  // nullptr for an empty file
+  const unsigned char* data() const { return static_cast<const unsigned char*>(data_); }
+
+ private:
+  int fd_{-1};
+  void* data_{nullptr};
+  size_t size_{0};
+};
+
 class PackageManagerInterface {
  public:
   PackageManagerInterface(PackageConfig pconfig, const BootloaderConfig& bconfig, std::shared_ptr<INvStorage> storage,
@@ -54,25 +85,72 @@ class PackageManagerInterface {
   PackageManagerInterface& operator=(PackageManagerInterface&&) = delete;
   virtual std::string name() const = 0;
   virtual Json::Value getInstalledPackages() const = 0;
+  // SHA256 of the canonical JSON of getInstalledPackages(), to tell whether
+  // the list changed since it was last reported
+  virtual Hash getInstalledPackagesHash() const;
   virtual Uptane::Target getCurrent() const = 0;
   virtual data::InstallationResult install(const Uptane::Target& target) const = 0;
   virtual void completeInstall() const { throw std::runtime_error("Unimplemented"); }
   virtual data::InstallationResult finalizeInstall(const Uptane::Target& target) = 0;
   virtual void updateNotify() {}
+  // Where package managers send events of their own, e.g. statistics
+  void setEventsChannel(std::shared_ptr<event::Channel> events_channel) { events_channel_ = std::move(events_channel); }
   virtual bool fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher, const KeyManager& keys,
                            const FetcherProgressCb& progress_cb, const api::FlowControlToken* token);
+  // Store the image of a Target from an offline bundle instead of
+  // downloading it. It is verified like a download.
+  virtual bool fetchTargetFromBundle(const Uptane::Target& target, const Uptane::OfflineBundle& bundle,
+                                     const FetcherProgressCb& progress_cb, const api::FlowControlToken* token);
+  // Start fetching a verified Target in the background, ahead of its
+  // download, for package managers that can; fetchTarget() of the same Target
+  // then picks up what was fetched. The token pauses and aborts the fetch.
+  virtual void prefetchTarget(const Uptane::Target& target, std::shared_ptr<KeyManager> keys,
+                              const api::FlowControlToken* token) {
+    (void)target;
+    (void)keys;
+    (void)token;
+  }
+  // Download a binary Target as a stream, to forward it without storing it
+  // first. With secondary_cut_through_copy, the image is stored as well once
+  // it is complete and verified.
+  virtual std::unique_ptr<TargetStream> openTargetStream(const Uptane::Target& target,
+                                                         const std::string& repo_server) const;
   virtual TargetStatus verifyTarget(const Uptane::Target& target) const;
   virtual bool checkAvailableDiskSpace(uint64_t required_bytes) const;
   virtual boost::optional<std::pair<uintmax_t, std::string>> checkTargetFile(const Uptane::Target& target) const;
   virtual std::ofstream createTargetFile(const Uptane::Target& target);
   virtual std::ofstream appendTargetFile(const Uptane::Target& target);
   virtual std::ifstream openTargetFile(const Uptane::Target& target) const;
+  virtual TargetFileView openTargetFileView(const Uptane::Target& target) const;
+  // Drops the Target; the file goes once no other Target refers to it.
   virtual void removeTargetFile(const Uptane::Target& target);
   virtual std::vector<Uptane::Target> getTargetFiles();
+  // Remove the files in images_path that no Target refers to anymore.
+  virtual void removeUnreferencedTargetFiles();
+  // Free what the installed updates don't need anymore, for package managers
+  // that keep more than the Target files. Called once an installation has
+  // been finalized.
+  virtual void pruneAfterFinalize() {}
+
+  // Images are stored by content: Targets with the same content share the
+  // file, whatever their names and ECUs.
+  static std::string contentFilename(const Uptane::Target& target);
 
  protected:
   PackageConfig config;
   std::shared_ptr<INvStorage> storage_;
   std::shared_ptr<HttpInterface> http_;
+  std::shared_ptr<event::Channel> events_channel_;
+
+ private:
+  // Download the Target in several byte ranges in parallel. Returns false if
+  // the server doesn't support ranges and the download should be retried in
+  // one piece, throws on any other error.
+  bool fetchTargetSegments(const Uptane::Target& target, const std::string& target_url,
+                           std::vector<DownloadSegment> segments, const FetcherProgressCb& progress_cb,
+                           const api::FlowControlToken* token);
+  // Refer the Target to a complete image with the same content that is
+  // already stored for another Target. Returns true if there was one.
+  bool linkStoredTargetFile(const Uptane::Target& target);
 };
 #endif  // PACKAGEMANAGERINTERFACE_H_
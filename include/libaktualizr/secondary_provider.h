@@ -1,9 +1,12 @@
 #ifndef UPTANE_SECONDARY_PROVIDER_H
 #define UPTANE_SECONDARY_PROVIDER_H
 
+#include <map>
+#include <mutex>
 #include <string>
 
 #include "libaktualizr/config.h"
+#include "libaktualizr/events.h"
 #include "libaktualizr/packagemanagerinterface.h"
 #include "libaktualizr/types.h"
 
@@ -18,18 +21,42 @@ class SecondaryProvider {
   bool getMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const;
   bool getDirectorMetadata(Uptane::MetaBundle* meta_bundle) const;
   bool getImageRepoMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const;
+  // The TLS credentials and the server URL for OSTree Secondaries, as an
+  // archive. It is built again only when any of them changes.
   std::string getTreehubCredentials() const;
+  // Where Secondaries pull OSTree commits from instead of the Treehub server
+  // of the configuration, like the cache of the Primary. Set before any
+  // Secondary is updated.
+  void setTreehubServer(std::string url) { treehub_server_ = std::move(url); }
   std::ifstream getTargetFileHandle(const Uptane::Target& target) const;
+  // for transports that send the image straight from the page cache
+  TargetFileView getTargetFileView(const Uptane::Target& target) const;
+  // Whether the image is to be streamed from the server while it is sent,
+  // rather than read from a downloaded file (secondary_cut_through).
+  bool streamsTarget(const Uptane::Target& target) const;
+  std::unique_ptr<TargetStream> openTargetStream(const Uptane::Target& target) const;
+  // progress of an installation as reported by the Secondary, in percent
+  void reportInstallProgress(const Uptane::EcuSerial& serial, unsigned int progress) const;
 
  private:
   SecondaryProvider(Config& config_in, std::shared_ptr<const INvStorage> storage_in,
-                    std::shared_ptr<const PackageManagerInterface> package_manager_in)
-      : config_(config_in), storage_(std::move(storage_in)), package_manager_(std::move(package_manager_in)) {}
+                    std::shared_ptr<const PackageManagerInterface> package_manager_in,
+                    std::shared_ptr<event::Channel> events_channel_in)
+      : config_(config_in),
+        storage_(std::move(storage_in)),
+        package_manager_(std::move(package_manager_in)),
+        events_channel_(std::move(events_channel_in)) {}
 
   // NOLINTNEXTLINE(cppcoreguidelines-avoid-const-or-ref-data-members)
   Config& config_;
   std::shared_ptr<const INvStorage> storage_;
   std::shared_ptr<const PackageManagerInterface> package_manager_;
+  std::shared_ptr<event::Channel> events_channel_;
+  std::string treehub_server_;
+  mutable std::mutex treehub_creds_mutex_;
+  // the files of the last archive and the archive itself
+  mutable std::map<std::string, std::string> treehub_creds_files_;
+  mutable std::string treehub_creds_archive_;
 };
 
 #endif  // UPTANE_SECONDARY_PROVIDER_H
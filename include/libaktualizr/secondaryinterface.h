@@ -2,6 +2,7 @@
 #define UPTANE_SECONDARYINTERFACE_H
 
 #include <string>
+#include <vector>
 
 #include "libaktualizr/secondary_provider.h"
 #include "libaktualizr/types.h"
@@ -26,6 +27,20 @@ class SecondaryInterface {
   // return 0 during initialization and -1 for error.
   virtual int32_t getRootVersion(bool director) const = 0;
   virtual data::InstallationResult putRoot(const std::string& root, bool director) = 0;
+  /**
+   * Send consecutive Root metadata versions, oldest first, stopping at the
+   * first one that is rejected. Secondaries that can take them all in one
+   * request override this.
+   */
+  virtual data::InstallationResult putRootChain(const std::vector<std::string>& roots, bool director) {
+    for (const auto& root : roots) {
+      auto result = putRoot(root, director);
+      if (!result.isSuccess()) {
+        return result;
+      }
+    }
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
 
   /**
    * Send firmware to a device. This operation should be both idempotent and
@@ -37,10 +52,34 @@ class SecondaryInterface {
    */
   virtual data::InstallationResult sendFirmware(const Uptane::Target& target,
                                                 const api::FlowControlToken* flow_control) = 0;
+  /**
+   * Whether sendFirmware() can take a binary image as it is downloaded, see
+   * SecondaryProvider::streamsTarget(). The image is then never stored on the
+   * Primary.
+   */
+  virtual bool acceptsTargetStream() const { return false; }
+  /**
+   * Deliver the image of a Target to this Secondary and the other ones in
+   * `group`, which are assigned the same image, all at once, e.g. through a
+   * multicast group. It is called before sendFirmware() is called for each of
+   * them, which may then have nothing left to send.
+   * @return false if the image could not be delivered to any of them this
+   * way.
+   */
+  virtual bool sendFirmwareToGroup(const Uptane::Target& target, const std::vector<SecondaryInterface*>& group) {
+    (void)target;
+    (void)group;
+    return false;
+  }
   /**
    * Commit to installing an update.
    */
   virtual data::InstallationResult install(const Uptane::Target& target, const api::FlowControlToken* flow_control) = 0;
+  /**
+   * Performance metrics of the Secondary, such as the latency of the requests
+   * it handled, in the Prometheus text format. Empty if it doesn't report any.
+   */
+  virtual std::string getMetrics() const { return ""; }
 
  protected:
   SecondaryInterface(const SecondaryInterface&) = default;
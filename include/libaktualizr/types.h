@@ -3,6 +3,7 @@
 /** \file */
 
 #include <algorithm>
+#include <memory>
 #include <stdexcept>
 #include <unordered_map>
 
@@ -128,6 +129,11 @@ inline std::ostream &operator<<(std::ostream &os, CryptoSource cs) {
 class PublicKey {
  public:
   PublicKey() = default;
+  PublicKey(const PublicKey &other);
+  PublicKey(PublicKey &&) = default;
+  PublicKey &operator=(const PublicKey &other);
+  PublicKey &operator=(PublicKey &&) = default;
+  ~PublicKey() = default;
   explicit PublicKey(const boost::filesystem::path &path);
 
   explicit PublicKey(const Json::Value &uptane_json);
@@ -156,8 +162,15 @@ class PublicKey {
   // std::string can be implicitly converted to a Json::Value. Make sure that
   // the Json::Value constructor is not called accidentally.
   PublicKey(std::string);  // NOLINT(google-explicit-constructor, hicpp-explicit-conversions)
+
+  // The key decoded for verification, and its ID; built on first use and
+  // shared with the copies of this key.
+  struct Parsed;
+  std::shared_ptr<const Parsed> parsed() const;
+
   std::string value_;
   KeyType type_{KeyType::kUnknown};
+  mutable std::shared_ptr<const Parsed> parsed_;
 };
 
 /**
@@ -180,14 +193,20 @@ class Hash {
   static std::string TypeString(Type type);
   std::string TypeString() const;
   Type type() const;
-  std::string HashString() const { return hash_; }
+  // upper case hex
+  std::string HashString() const;
   friend std::ostream &operator<<(std::ostream &os, const Hash &h);
 
   static std::string encodeVector(const std::vector<Hash> &hashes);
   static std::vector<Hash> decodeVector(std::string hashes_str);
 
  private:
+  void setValue(const std::string &hash);
+
   Type type_;
+  // the raw digest if the hash was given in hex, which it always is in
+  // practice, the upper cased string otherwise
+  bool binary_{false};
   std::string hash_;
 };
 
@@ -317,7 +336,31 @@ class RepositoryType;
 class Role;
 struct MetaPairHash;
 
-using MetaBundle = std::unordered_map<std::pair<RepositoryType, Role>, std::string, MetaPairHash>;
+/**
+ * The contents of a metadata file, shared read-only: metadata goes from the
+ * storage to every Secondary without being copied. Compared by content.
+ */
+class MetaBuffer {
+ public:
+  MetaBuffer() : data_{std::make_shared<const std::string>()} {}
+  // NOLINTNEXTLINE(google-explicit-constructor, hicpp-explicit-conversions)
+  MetaBuffer(std::string data) : data_{std::make_shared<const std::string>(std::move(data))} {}
+  explicit MetaBuffer(std::shared_ptr<const std::string> data)
+      : data_{data != nullptr ? std::move(data) : std::make_shared<const std::string>()} {}
+
+  const std::string &str() const { return *data_; }
+  // NOLINTNEXTLINE(google-explicit-constructor, hicpp-explicit-conversions)
+  operator const std::string &() const { return *data_; }
+  // whether both hold the same copy of the metadata
+  bool shares(const MetaBuffer &other) const { return data_ == other.data_; }
+  bool operator==(const MetaBuffer &rhs) const { return data_ == rhs.data_ || *data_ == *rhs.data_; }
+  bool operator!=(const MetaBuffer &rhs) const { return !(*this == rhs); }
+
+ private:
+  std::shared_ptr<const std::string> data_;
+};
+
+using MetaBundle = std::unordered_map<std::pair<RepositoryType, Role>, MetaBuffer, MetaPairHash>;
 
 struct InstalledImageInfo {
   InstalledImageInfo() = default;
@@ -328,6 +371,14 @@ struct InstalledImageInfo {
   std::string hash;
 };
 
+/**
+ * Shared storage for an identifier. Equal identifiers share the same string
+ * while any of them is alive, as the same hardware IDs and ECU serials are
+ * repeated in every Target. So identifiers that hold on to their string are
+ * equal if and only if they share it: they are compared and hashed by address.
+ */
+std::shared_ptr<const std::string> internIdentifier(const std::string &id);
+
 class HardwareIdentifier {
  public:
   // https://github.com/uptane/ota-tuf/blob/master/libtuf/src/main/scala/com/advancedtelematic/libtuf/data/TufDataType.scala#L23
@@ -335,26 +386,31 @@ class HardwareIdentifier {
   static const int kMaxLength = 200;
 
   static HardwareIdentifier Unknown() { return HardwareIdentifier("Unknown"); }
-  explicit HardwareIdentifier(const std::string &hwid) : hwid_(hwid) {
+  explicit HardwareIdentifier(const std::string &hwid) {
     /* if (hwid.length() < kMinLength) {
       throw std::out_of_range("Hardware Identifier too short");
     } */
     if (kMaxLength < hwid.length()) {
       throw std::out_of_range("Hardware Identifier too long");
     }
+    hwid_ = internIdentifier(hwid);
   }
+  // No moves: a moved-from identifier would have no value.
+  HardwareIdentifier(const HardwareIdentifier &) = default;
+  HardwareIdentifier &operator=(const HardwareIdentifier &) = default;
+  ~HardwareIdentifier() = default;
 
-  std::string ToString() const { return hwid_; }
+  std::string ToString() const { return *hwid_; }
 
   bool operator==(const HardwareIdentifier &rhs) const { return hwid_ == rhs.hwid_; }
   bool operator!=(const HardwareIdentifier &rhs) const { return !(*this == rhs); }
 
-  bool operator<(const HardwareIdentifier &rhs) const { return hwid_ < rhs.hwid_; }
+  bool operator<(const HardwareIdentifier &rhs) const { return *hwid_ < *rhs.hwid_; }
   friend std::ostream &operator<<(std::ostream &os, const HardwareIdentifier &hwid);
   friend struct std::hash<Uptane::HardwareIdentifier>;
 
  private:
-  std::string hwid_;
+  std::shared_ptr<const std::string> hwid_;
 };
 
 std::ostream &operator<<(std::ostream &os, const HardwareIdentifier &hwid);
@@ -366,26 +422,31 @@ class EcuSerial {
   static const int kMaxLength = 64;
 
   static EcuSerial Unknown() { return EcuSerial("Unknown"); }
-  explicit EcuSerial(const std::string &ecu_serial) : ecu_serial_(ecu_serial) {
+  explicit EcuSerial(const std::string &ecu_serial) {
     if (ecu_serial.length() < kMinLength) {
       throw std::out_of_range("ECU serial identifier is too short");
     }
     if (kMaxLength < ecu_serial.length()) {
       throw std::out_of_range("ECU serial identifier is too long");
     }
+    ecu_serial_ = internIdentifier(ecu_serial);
   }
+  // No moves: a moved-from identifier would have no value.
+  EcuSerial(const EcuSerial &) = default;
+  EcuSerial &operator=(const EcuSerial &) = default;
+  ~EcuSerial() = default;
 
-  std::string ToString() const { return ecu_serial_; }
+  std::string ToString() const { return *ecu_serial_; }
 
   bool operator==(const EcuSerial &rhs) const { return ecu_serial_ == rhs.ecu_serial_; }
   bool operator!=(const EcuSerial &rhs) const { return !(*this == rhs); }
 
-  bool operator<(const EcuSerial &rhs) const { return ecu_serial_ < rhs.ecu_serial_; }
+  bool operator<(const EcuSerial &rhs) const { return *ecu_serial_ < *rhs.ecu_serial_; }
   friend std::ostream &operator<<(std::ostream &os, const EcuSerial &ecu_serial);
   friend struct std::hash<Uptane::EcuSerial>;
 
  private:
-  std::string ecu_serial_;
+  std::shared_ptr<const std::string> ecu_serial_;
 };
 
 std::ostream &operator<<(std::ostream &os, const EcuSerial &ecu_serial);
@@ -394,6 +455,12 @@ using EcuMap = std::map<EcuSerial, HardwareIdentifier>;
 
 using CorrelationId = std::string;
 
+/**
+ * A target from Uptane metadata.
+ *
+ * Targets are copied freely, so copies share the same immutable data. The
+ * few modifiers copy it first if it is shared.
+ */
 class Target {
  public:
   // From Uptane metadata
@@ -402,30 +469,37 @@ class Target {
   // various tests.
   Target(std::string filename, EcuMap ecus, std::vector<Hash> hashes, uint64_t length, std::string type = "UNKNOWN");
 
+  // No moves: a moved-from target would have no data, and copies are cheap.
+  Target(const Target &) = default;
+  Target &operator=(const Target &) = default;
+  ~Target() = default;
+
   static Target Unknown();
 
-  const EcuMap &ecus() const { return ecus_; }
-  std::string filename() const { return filename_; }
+  const EcuMap &ecus() const { return data_->ecus; }
+  std::string filename() const { return data_->filename; }
   std::string sha256Hash() const;
   std::string sha512Hash() const;
-  const std::vector<Hash> &hashes() const { return hashes_; }
-  const std::vector<HardwareIdentifier> &hardwareIds() const { return hwids_; }
+  const std::vector<Hash> &hashes() const { return data_->hashes; }
+  const std::vector<HardwareIdentifier> &hardwareIds() const { return data_->hwids; }
   std::string custom_version() const;
-  Json::Value custom_data() const { return custom_; }
+  Json::Value custom_data() const { return data_->custom; }
   void updateCustom(const Json::Value &custom);
-  uint64_t length() const { return length_; }
-  bool IsValid() const { return valid; }
-  std::string uri() const { return uri_; }
-  void setUri(std::string uri) { uri_ = std::move(uri); }
+  uint64_t length() const { return data_->length; }
+  bool IsValid() const { return data_->valid; }
+  std::string uri() const { return data_->uri; }
+  void setUri(std::string uri) { mutableData().uri = std::move(uri); }
   bool MatchHash(const Hash &hash) const;
+  // Whether there are hashes and all of them match, e.g. one of each type
+  bool MatchHashes(const std::vector<Hash> &hashes) const;
 
-  void InsertEcu(const std::pair<EcuSerial, HardwareIdentifier> &pair) { ecus_.insert(pair); }
+  void InsertEcu(const std::pair<EcuSerial, HardwareIdentifier> &pair) { mutableData().ecus.insert(pair); }
 
   bool IsForEcu(const EcuSerial &ecuIdentifier) const {
-    return (std::find_if(ecus_.cbegin(), ecus_.cend(),
+    return (std::find_if(data_->ecus.cbegin(), data_->ecus.cend(),
                          [&ecuIdentifier](const std::pair<EcuSerial, HardwareIdentifier> &pair) {
                            return pair.first == ecuIdentifier;
-                         }) != ecus_.cend());
+                         }) != data_->ecus.cend());
   }
 
   /**
@@ -435,7 +509,7 @@ class Target {
    * root commit object.
    */
   bool IsOstree() const;
-  std::string type() const { return type_; }
+  std::string type() const { return data_->type; }
 
   // Comparison is usually not meaningful. Use MatchTarget instead.
   bool operator==(const Target &t2) = delete;
@@ -445,17 +519,29 @@ class Target {
   InstalledImageInfo getTargetImageInfo() const { return {filename(), length(), sha256Hash()}; }
 
  private:
-  bool valid{true};
-  std::string filename_;
-  std::string type_;
-  EcuMap ecus_;  // Director only
-  std::vector<Hash> hashes_;
-  std::vector<HardwareIdentifier> hwids_;  // Image repo only
-  Json::Value custom_;
-  uint64_t length_{0};
-  std::string uri_;
+  struct Data {
+    bool valid{true};
+    std::string filename;
+    std::string type;
+    EcuMap ecus;  // Director only
+    std::vector<Hash> hashes;
+    std::vector<HardwareIdentifier> hwids;  // Image repo only
+    Json::Value custom;
+    uint64_t length{0};
+    std::string uri;
+  };
+
+  // copy the data first if other targets share it
+  Data &mutableData() {
+    if (data_.use_count() > 1) {
+      data_ = std::make_shared<Data>(*data_);
+    }
+    return *data_;
+  }
 
   std::string hashString(Hash::Type type) const;
+
+  std::shared_ptr<Data> data_;
 };
 
 std::ostream &operator<<(std::ostream &os, const Target &t);
@@ -1,15 +1,28 @@
 #include "get.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
 #include "crypto/keymanager.h"
 #include "http/httpclient.h"
 #include "storage/invstorage.h"
 
-std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers) {
+static std::unique_ptr<HttpClient> authenticatedClient(Config &config, const std::vector<std::string> &headers) {
   auto storage = INvStorage::newStorage(config.storage);
   storage->importData(config.import);
 
   auto client = std_::make_unique<HttpClient>(&headers);
   KeyManager keys(storage, config.keymanagerConfig());
   keys.copyCertsToCurl(*client);
+  return client;
+}
+
+std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers) {
+  auto client = authenticatedClient(config, headers);
   auto resp = client->get(url, HttpInterface::kNoLimit, nullptr);
   if (resp.http_status_code != 200) {
     throw std::runtime_error("Unable to get " + url + ": HTTP_" + std::to_string(resp.http_status_code) + "\n" +
@@ -17,3 +30,62 @@ std::string aktualizrGet(Config &config, const std::string &url, const std::vect
   }
   return resp.body;
 }
+
+static GetResult getToFile(HttpClient &client, const GetRequest &request) {
+  GetResult result;
+  std::ofstream out(request.output.string(), std::ios::binary | std::ios::trunc);
+  if (!out) {
+    result.error = "Unable to open " + request.output.string();
+    return result;
+  }
+  const HttpBodySink sink = [&out](const char *data, size_t size) {
+    out.write(data, static_cast<std::streamsize>(size));
+    return out.good();
+  };
+  const HttpResponse resp = client.getStream(request.url, HttpInterface::kNoLimit, nullptr, sink);
+  out.close();
+  result.http_status_code = resp.http_status_code;
+  if (!out) {
+    result.error = "Unable to write " + request.output.string();
+  } else if (resp.http_status_code != 200) {
+    result.error = "Unable to get " + request.url + ": " + resp.getStatusStr();
+  }
+  if (!result.ok()) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(request.output, ec);
+  }
+  return result;
+}
+
+std::vector<GetResult> aktualizrGetBatch(Config &config, const std::vector<GetRequest> &requests,
+                                         const std::vector<std::string> &headers, unsigned jobs) {
+  std::vector<GetResult> results(requests.size());
+  if (requests.empty()) {
+    return results;
+  }
+  auto client = authenticatedClient(config, headers);
+
+  // each worker has its own copy of the client, which shares the connections
+  // and the TLS sessions of the first one
+  jobs = static_cast<unsigned>(std::min<size_t>(std::max(jobs, 1U), requests.size()));
+  std::vector<std::unique_ptr<HttpClient>> clients;
+  for (unsigned i = 1; i < jobs; ++i) {
+    clients.push_back(std_::make_unique<HttpClient>(*client));
+  }
+  std::atomic<size_t> next{0};
+  auto worker = [&](HttpClient &worker_client) {
+    for (size_t i = next++; i < requests.size(); i = next++) {
+      results[i] = getToFile(worker_client, requests[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (auto &worker_client : clients) {
+    threads.emplace_back(worker, std::ref(*worker_client));
+  }
+  worker(*client);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  return results;
+}
@@ -1,8 +1,31 @@
 #ifndef AKTUALIZR_GET_HELPERS
 #define AKTUALIZR_GET_HELPERS
 
+#include <boost/filesystem/path.hpp>
+
 #include "libaktualizr/config.h"
 
 std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers);
 
+struct GetRequest {
+  std::string url;
+  boost::filesystem::path output;
+};
+
+struct GetResult {
+  bool ok() const { return error.empty(); }
+  long http_status_code{0};  // NOLINT(google-runtime-int)
+  std::string error;
+};
+
+/**
+ * Fetch all the URLs with the device's credentials, `jobs` of them at a time,
+ * and stream each body to its output file. They share the storage, the keys
+ * and the connections, so that the TLS handshake is done once per server
+ * rather than once per URL. A failed request leaves no output file and does
+ * not stop the others; the results are in the order of the requests.
+ */
+std::vector<GetResult> aktualizrGetBatch(Config &config, const std::vector<GetRequest> &requests,
+                                         const std::vector<std::string> &headers, unsigned jobs);
+
 #endif  // AKTUALIZR_GET_HELPERS
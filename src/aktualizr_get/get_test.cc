@@ -17,6 +17,31 @@ TEST(aktualizr_get, good) {
   EXPECT_EQ("{\"path\": \"/path/1/2/3\"}", body);
 }
 
+TEST(aktualizr_get, batch) {
+  Config config;
+  TemporaryDirectory dir;
+  config.storage.path = dir.Path();
+
+  std::vector<GetRequest> requests;
+  for (int i = 0; i < 10; ++i) {
+    requests.push_back(GetRequest{server + "/batch/" + std::to_string(i), dir / ("out-" + std::to_string(i))});
+  }
+  // nothing listens on port 1
+  requests.push_back(GetRequest{"http://127.0.0.1:1/unreachable", dir / "unreachable"});
+
+  std::vector<std::string> headers;
+  const auto results = aktualizrGetBatch(config, requests, headers, 4);
+  ASSERT_EQ(results.size(), requests.size());
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(results[i].ok()) << results[i].error;
+    EXPECT_EQ(results[i].http_status_code, 200);
+    EXPECT_EQ(Utils::readFile(dir / ("out-" + std::to_string(i))),
+              "{\"path\": \"/batch/" + std::to_string(i) + "\"}");
+  }
+  EXPECT_FALSE(results.back().ok());
+  EXPECT_FALSE(boost::filesystem::exists(dir / "unreachable"));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
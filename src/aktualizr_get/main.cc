@@ -1,5 +1,7 @@
 #include <unistd.h>
 #include <iostream>
+#include <set>
+#include <sstream>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -12,7 +14,7 @@
 namespace bpo = boost::program_options;
 
 void check_info_options(const bpo::options_description &description, const bpo::variables_map &vm) {
-  if (vm.count("help") != 0 || (vm.count("url") == 0 && vm.count("version") == 0)) {
+  if (vm.count("help") != 0 || (vm.count("url") == 0 && vm.count("output-dir") == 0 && vm.count("version") == 0)) {
     std::cout << description << '\n';
     exit(EXIT_SUCCESS);
   }
@@ -34,13 +36,23 @@ bpo::variables_map parse_options(int argc, char **argv) {
       ("config,c", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory, by default /var/sota")
       ("header,H", bpo::value<std::vector<std::string> >()->composing(), "Additional headers to pass")
       ("loglevel", bpo::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
-      ("url,u", bpo::value<std::string>(), "url to get, mandatory");
+      ("url,u", bpo::value<std::string>(), "url to get, mandatory unless in batch mode")
+      ("output-dir,O", bpo::value<boost::filesystem::path>(), "batch mode: get the urls given as arguments, or read from stdin one per line if there are none, into this directory. Each url may be followed by the name of its output file, its last path segment by default.")
+      ("jobs,j", bpo::value<unsigned>()->default_value(4), "number of concurrent requests in batch mode");
+  bpo::options_description hidden;
+  hidden.add_options()
+      ("urls", bpo::value<std::vector<std::string> >()->composing(), "urls to get in batch mode");
   // clang-format on
+  bpo::options_description all_options;
+  all_options.add(description).add(hidden);
+  bpo::positional_options_description positional;
+  positional.add("urls", -1);
 
   bpo::variables_map vm;
   std::vector<std::string> unregistered_options;
   try {
-    bpo::basic_parsed_options<char> parsed_options = bpo::command_line_parser(argc, argv).options(description).run();
+    bpo::basic_parsed_options<char> parsed_options =
+        bpo::command_line_parser(argc, argv).options(all_options).positional(positional).run();
     bpo::store(parsed_options, vm);
     check_info_options(description, vm);
     bpo::notify(vm);
@@ -57,6 +69,65 @@ bpo::variables_map parse_options(int argc, char **argv) {
   return vm;
 }
 
+// "<url> [<output file>]", the output file being the last path segment of the
+// url by default
+static GetRequest parseBatchRequest(const std::string &line, const boost::filesystem::path &output_dir) {
+  std::istringstream stream(line);
+  GetRequest request;
+  std::string output;
+  stream >> request.url >> output;
+  if (output.empty()) {
+    const std::string path = request.url.substr(0, request.url.find_first_of("?#"));
+    const auto slash = path.rfind('/');
+    if (slash != std::string::npos && path.find("://") + 2 != slash) {
+      output = path.substr(slash + 1);
+    }
+  }
+  if (output.empty() || output == "." || output == "..") {
+    throw std::runtime_error("No output file name for " + request.url);
+  }
+  request.output = output_dir / output;
+  return request;
+}
+
+static int getBatch(Config &config, const bpo::variables_map &commandline_map,
+                    const std::vector<std::string> &headers) {
+  const auto output_dir = commandline_map["output-dir"].as<boost::filesystem::path>();
+  std::vector<std::string> lines;
+  if (commandline_map.count("urls") != 0) {
+    lines = commandline_map["urls"].as<std::vector<std::string>>();
+  } else {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      if (line.find_first_not_of(" \t") != std::string::npos) {
+        lines.push_back(line);
+      }
+    }
+  }
+
+  std::vector<GetRequest> requests;
+  std::set<boost::filesystem::path> outputs;
+  for (const auto &line : lines) {
+    requests.push_back(parseBatchRequest(line, output_dir));
+    if (!outputs.insert(requests.back().output).second) {
+      throw std::runtime_error("Several urls would be written to " + requests.back().output.string());
+    }
+  }
+  boost::filesystem::create_directories(output_dir);
+
+  const auto results = aktualizrGetBatch(config, requests, headers, commandline_map["jobs"].as<unsigned>());
+  int r = EXIT_SUCCESS;
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results[i].ok()) {
+      std::cout << requests[i].url << " -> " << requests[i].output.string() << "\n";
+    } else {
+      LOG_ERROR << results[i].error;
+      r = EXIT_FAILURE;
+    }
+  }
+  return r;
+}
+
 int main(int argc, char *argv[]) {
   logger_init(isatty(1) == 1);
   logger_set_threshold(boost::log::trivial::info);
@@ -70,6 +141,9 @@ int main(int argc, char *argv[]) {
     if (commandline_map.count("header") == 1) {
       headers = commandline_map["header"].as<std::vector<std::string>>();
     }
+    if (commandline_map.count("output-dir") != 0) {
+      return getBatch(config, commandline_map, headers);
+    }
     std::string body = aktualizrGet(config, commandline_map["url"].as<std::string>(), headers);
     std::cout << body;
 
@@ -368,6 +368,37 @@ TEST_F(AktualizrInfoTest, PrintDirectorTargetsMetadata) {
   EXPECT_NE(aktualizr_info_output.find(director_targets_str), std::string::npos);
 }
 
+/**
+ * Verifies aktualizr-info output of the metadata expiry
+ *
+ * Checks actions:
+ *
+ *  - [x] Print when the stored metadata of each role expires
+ *  - [x] Tell whether any of it has expired
+ */
+TEST_F(AktualizrInfoTest, PrintMetaExpiry) {
+  db_storage_->storeEcuSerials({{primary_ecu_serial, primary_hw_id}});
+  db_storage_->storeEcuRegistered();
+
+  Json::Value director_root_json;
+  director_root_json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  db_storage_->storeRoot(Utils::jsonToStr(director_root_json), Uptane::RepositoryType::Director(),
+                         Uptane::Version(1));
+
+  Json::Value director_targets_json;
+  director_targets_json["signed"]["expires"] = "2000-01-01T00:00:00Z";
+  db_storage_->storeNonRoot(Utils::jsonToStr(director_targets_json), Uptane::RepositoryType::Director(),
+                            Uptane::Role::Targets());
+
+  aktualizr_info_process_.run({"--meta-expiry"});
+  ASSERT_FALSE(aktualizr_info_output.empty());
+  EXPECT_NE(aktualizr_info_output.find("director root metadata: expires on 2038-01-19T03:14:06Z"), std::string::npos);
+  EXPECT_NE(aktualizr_info_output.find("director targets metadata: expired on 2000-01-01T00:00:00Z"),
+            std::string::npos);
+  EXPECT_NE(aktualizr_info_output.find("image snapshot metadata: not present"), std::string::npos);
+  EXPECT_NE(aktualizr_info_output.find("Expired metadata: yes"), std::string::npos);
+}
+
 /**
  * Verifies aktualizr-info output of the Primary ECU keys
  *
@@ -728,7 +759,7 @@ TEST_F(AktualizrInfoTest, PrintMetadataWarning) {
 
   const std::vector<std::string> args = {"--images-root",     "--images-target",   "--delegation",
                                          "--director-root",   "--director-target", "--images-snapshot",
-                                         "--images-timestamp"};
+                                         "--images-timestamp", "--meta-expiry"};
 
   for (auto arg : args) {
     aktualizr_info_process_.run({arg});
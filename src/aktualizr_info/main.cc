@@ -34,6 +34,32 @@ static int loadAndPrintDelegations(const std::shared_ptr<INvStorage> &storage) {
   return EXIT_SUCCESS;
 }
 
+// from the expiry indexed in storage, without parsing or verifying the metadata
+static void printMetaExpiry(const std::shared_ptr<INvStorage> &storage) {
+  const std::vector<std::pair<Uptane::RepositoryType, Uptane::Role> > roles{
+      {Uptane::RepositoryType::Director(), Uptane::Role::Root()},
+      {Uptane::RepositoryType::Director(), Uptane::Role::Targets()},
+      {Uptane::RepositoryType::Image(), Uptane::Role::Root()},
+      {Uptane::RepositoryType::Image(), Uptane::Role::Timestamp()},
+      {Uptane::RepositoryType::Image(), Uptane::Role::Snapshot()},
+      {Uptane::RepositoryType::Image(), Uptane::Role::Targets()}};
+  const TimeStamp now = TimeStamp::Now();
+  bool expired = false;
+  for (const auto &role : roles) {
+    TimeStamp expiry;
+    std::cout << role.first << " " << role.second << " metadata: ";
+    if (!storage->loadMetaExpiry(role.first, role.second, &expiry)) {
+      std::cout << "not present" << std::endl;
+    } else if (expiry.IsExpiredAt(now)) {
+      std::cout << "expired on " << expiry << std::endl;
+      expired = true;
+    } else {
+      std::cout << "expires on " << expiry << std::endl;
+    }
+  }
+  std::cout << "Expired metadata: " << (expired ? "yes" : "no") << std::endl;
+}
+
 void checkInfoOptions(const bpo::options_description &description, const bpo::variables_map &vm) {
   if (vm.count("help") != 0) {
     std::cout << description << '\n';
@@ -72,6 +98,7 @@ int main(int argc, char **argv) {
     ("delegation",  "Outputs metadata of Image repo Targets' delegations")
     ("director-root",  "Outputs root.json from Director repo, by default the latest")
     ("director-targets",  "Outputs targets.json from Director repo")
+    ("meta-expiry",  "Outputs when the stored metadata of each role expires")
     ("root-version",  bpo::value<int>(), "Use with --image-root or --director-root to specify the version to output")
     ("allow-migrate", "Opens database in read/write mode to make possible to migrate database if needed")
     ("wait-until-provisioned", "Outputs metadata when device already provisioned");
@@ -143,8 +170,13 @@ int main(int argc, char **argv) {
       storage = INvStorage::newStorage(config.storage, readonly);
     }
 
+    // the device and ECU state at once, rather than query by query
+    StorageSnapshot device_state;
+    storage->loadSnapshot(&device_state);
+
     bool deviceid_loaded = false;
-    if (storage->loadDeviceId(&device_id)) {
+    if (!device_state.device_id.empty()) {
+      device_id = device_state.device_id;
       deviceid_loaded = true;
       // Early return if only printing device ID.
       if (vm.count("name-only") != 0U) {
@@ -153,10 +185,8 @@ int main(int argc, char **argv) {
       }
     }
 
-    registered = registered || storage->loadEcuRegistered();
-    std::string temp;
-    has_metadata = has_metadata || storage->loadLatestRoot(&director_root, Uptane::RepositoryType::Director()) ||
-                   storage->loadLatestRoot(&temp, Uptane::RepositoryType::Image());
+    registered = registered || device_state.ecu_registered;
+    has_metadata = has_metadata || device_state.has_root_metadata;
 
     bool tlscred_loaded = false;
     {
@@ -295,7 +325,9 @@ int main(int argc, char **argv) {
         if (vm.count("root-version") != 0U) {
           storage->loadRoot(&director_root, Uptane::RepositoryType::Director(),
                             Uptane::Version(vm["root-version"].as<int>()));
-        }  // else: already loaded above.
+        } else {
+          storage->loadLatestRoot(&director_root, Uptane::RepositoryType::Director());
+        }
         std::cout << director_root << std::endl;
       }
       cmd_trigger = true;
@@ -334,6 +366,15 @@ int main(int argc, char **argv) {
       cmd_trigger = true;
     }
 
+    if (vm.count("meta-expiry") != 0U) {
+      if (!has_metadata) {
+        std::cout << msg_metadata_fail << std::endl;
+      } else {
+        printMetaExpiry(storage);
+      }
+      cmd_trigger = true;
+    }
+
     if (cmd_trigger) {
       return EXIT_SUCCESS;
     }
@@ -352,11 +393,9 @@ int main(int argc, char **argv) {
     }
 
     std::string ecu_name = secondary_db ? "Secondary" : "Primary";
-    EcuSerials serials;
-    if (!storage->loadEcuSerials(&serials)) {
+    const EcuSerials &serials = device_state.serials;
+    if (serials.empty()) {
       std::cout << "Couldn't load ECU serials" << std::endl;
-    } else if (serials.empty()) {
-      std::cout << ecu_name << " serial is not found" << std::endl;
     } else {
       std::cout << ecu_name << " ECU serial ID: " << serials[0].first << std::endl;
       std::cout << ecu_name << " ECU hardware ID: " << serials[0].second << std::endl;
@@ -379,16 +418,12 @@ int main(int argc, char **argv) {
         std::cout << secondary_number++ << ") serial ID: " << serial << std::endl;
         std::cout << "   hardware ID: " << it->second << std::endl;
 
-        boost::optional<Uptane::Target> current_version;
-        boost::optional<Uptane::Target> pending_version;
-        Uptane::CorrelationId correlation_id;
-
-        auto load_installed_version_res =
-            storage->loadInstalledVersions(serial.ToString(), &current_version, &pending_version, &correlation_id);
-
-        if (!load_installed_version_res || (!current_version && !pending_version)) {
+        const auto versions = device_state.versions.find(serial);
+        if (versions == device_state.versions.end()) {
           std::cout << "   no details about installed nor pending images\n";
         } else {
+          const auto &current_version = versions->second.current;
+          const auto &pending_version = versions->second.pending;
           if (!!current_version) {
             std::cout << "   installed image hash: " << current_version->sha256Hash() << "\n";
             std::cout << "   installed image filename: " << current_version->filename() << "\n";
@@ -398,8 +433,8 @@ int main(int argc, char **argv) {
             std::cout << "   pending image filename: " << pending_version->filename() << "\n";
           }
 
-          if (!correlation_id.empty()) {
-            std::cout << "   correlation id: " << correlation_id << "\n";
+          if (!versions->second.correlation_id.empty()) {
+            std::cout << "   correlation id: " << versions->second.correlation_id << "\n";
           }
         }
 
@@ -418,8 +453,7 @@ int main(int argc, char **argv) {
       std::cout << "Failed to load Secondary data!" << std::endl;
     }
 
-    std::vector<MisconfiguredEcu> misconfigured_ecus;
-    storage->loadMisconfiguredEcus(&misconfigured_ecus);
+    const std::vector<MisconfiguredEcu> &misconfigured_ecus = device_state.misconfigured_ecus;
     if (!misconfigured_ecus.empty()) {
       std::cout << "Removed or unregistered ECUs (deprecated):" << std::endl;
       std::vector<MisconfiguredEcu>::const_iterator it;
@@ -444,12 +478,11 @@ int main(int argc, char **argv) {
       std::cout << "No currently running version on " << ecu_name << " ECU" << std::endl;
     }
 
-    std::vector<Uptane::Target> installed_versions;
-    boost::optional<Uptane::Target> pending;
-    storage->loadPrimaryInstalledVersions(nullptr, &pending);
-
-    if (!!pending) {
-      std::cout << "Pending " << ecu_name << " ECU version: " << pending->sha256Hash() << std::endl;
+    if (!serials.empty()) {
+      const auto versions = device_state.versions.find(serials[0].first);
+      if (versions != device_state.versions.end() && !!versions->second.pending) {
+        std::cout << "Pending " << ecu_name << " ECU version: " << versions->second.pending->sha256Hash() << std::endl;
+      }
     }
   } catch (const bpo::error &o) {
     std::cout << o.what() << std::endl << description;
@@ -4,8 +4,12 @@
 #include <boost/asio/placeholders.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
 
 #include <algorithm>
+#include <chrono>
+#include <future>
+#include <thread>
 #include <unordered_map>
 
 #include "ipuptanesecondary.h"
@@ -70,10 +74,9 @@ void initSecondaries(Aktualizr& aktualizr, const boost::filesystem::path& config
 
 class SecondaryWaiter {
  public:
-  SecondaryWaiter(Aktualizr& aktualizr, uint16_t wait_port, int timeout_s, Secondaries& secondaries)
+  SecondaryWaiter(Aktualizr& aktualizr, uint16_t wait_port, Secondaries& secondaries)
       : aktualizr_(aktualizr),
         endpoint_{boost::asio::ip::tcp::v4(), wait_port},
-        timeout_{static_cast<boost::posix_time::seconds>(timeout_s)},
         timer_{io_context_},
         connected_secondaries_{secondaries} {}
 
@@ -81,12 +84,16 @@ class SecondaryWaiter {
     secondaries_to_wait_for_.insert({key(ip, port), verification_type});
   }
 
-  void wait() {
+  // Secondaries that connected before are accepted too, the port is listened
+  // on from the start.
+  void wait(std::chrono::steady_clock::time_point deadline) {
     if (secondaries_to_wait_for_.empty()) {
       return;
     }
 
-    timer_.expires_from_now(timeout_);
+    const auto timeout = std::max(deadline - std::chrono::steady_clock::now(), std::chrono::steady_clock::duration{});
+    timer_.expires_from_now(
+        boost::posix_time::milliseconds(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count()));
     timer_.async_wait([&](const boost::system::error_code& error_code) {
       if (!!error_code) {
         LOG_ERROR << "Wait for Secondaries has failed: " << error_code;
@@ -155,27 +162,60 @@ class SecondaryWaiter {
   boost::asio::ip::tcp::endpoint endpoint_;
   boost::asio::ip::tcp::acceptor acceptor_{io_context_, endpoint_};
   boost::asio::ip::tcp::socket con_socket_{io_context_};
-  boost::posix_time::seconds timeout_;
   boost::asio::deadline_timer timer_;
 
   Secondaries& connected_secondaries_;
   std::unordered_map<std::string, VerificationType> secondaries_to_wait_for_;
 };
 
+// Run `connect` in the background. Unlike the ones of std::async, the future
+// doesn't wait for it when it is destroyed, so that late Secondaries can be
+// given up on.
+static std::future<SecondaryInterface::Ptr> connectInBackground(std::function<SecondaryInterface::Ptr()> connect) {
+  auto promise = std::make_shared<std::promise<SecondaryInterface::Ptr>>();
+  auto future = promise->get_future();
+  std::thread([promise, connect]() {
+    try {
+      promise->set_value(connect());
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+  }).detach();
+  return future;
+}
+
+static void storeSecondaryData(Aktualizr& aktualizr, const Uptane::EcuSerial& serial, const IPSecondaryConfig& cfg) {
+  // set ip/port in the db so that we can match everything later
+  Json::Value d;
+  d["ip"] = cfg.ip;
+  d["port"] = cfg.port;
+  d["verification_type"] = Uptane::VerificationTypeToString(cfg.verification_type);
+  aktualizr.SetSecondaryData(serial, Utils::jsonToCanonicalStr(d));
+}
+
 // Four options for each Secondary:
 // 1. Secondary is configured and stored: nothing to do.
 // 2. Secondary is configured but not stored: it must be new. Try to connect to get information and store it. This will
 // cause re-registration.
-// 3. Same as 2 but cannot connect: abort.
+// 3. Same as 2 but cannot connect: wait for it to connect to the Primary, abort if it doesn't.
 // 4. Secondary is stored but not configured: it must have been removed. Skip it. This will cause re-registration.
+// All the Secondaries are connected to at once. Stored ones that haven't answered by the end of the timeout are used
+// with their stored information, as if they could not be reached.
 static Secondaries createIPSecondaries(const IPSecondariesConfig& config, Aktualizr& aktualizr) {
   Secondaries result;
-  SecondaryWaiter sec_waiter{aktualizr, config.secondaries_wait_port, config.secondaries_timeout_s, result};
+  SecondaryWaiter sec_waiter{aktualizr, config.secondaries_wait_port, result};
   auto secondaries_info = aktualizr.GetSecondaries();
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config.secondaries_timeout_s);
+
+  struct PendingSecondary {
+    const IPSecondaryConfig& cfg;
+    boost::optional<SecondaryInfo> info;
+    std::future<SecondaryInterface::Ptr> secondary;
+  };
+  std::vector<PendingSecondary> pending;
 
   for (const auto& cfg : config.secondaries_cfg) {
-    SecondaryInterface::Ptr secondary;
-    const SecondaryInfo* info = nullptr;
+    boost::optional<SecondaryInfo> info;
 
     // Try to match the configured Secondaries to stored Secondaries.
     auto f = std::find_if(secondaries_info.cbegin(), secondaries_info.cend(), [&cfg](const SecondaryInfo& i) {
@@ -190,48 +230,71 @@ static Secondaries createIPSecondaries(const IPSecondariesConfig& config, Aktual
       // /!\ backward compatibility: if we have just one Secondary in the old
       // storage format (before we had the secondary_ecus table) and the
       // configuration, migrate it to the new format.
-      info = &secondaries_info[0];
-      Json::Value d;
-      d["ip"] = cfg.ip;
-      d["port"] = cfg.port;
-      d["verification_type"] = Uptane::VerificationTypeToString(cfg.verification_type);
-      aktualizr.SetSecondaryData(info->serial, Utils::jsonToCanonicalStr(d));
+      info = secondaries_info[0];
+      storeSecondaryData(aktualizr, info->serial, cfg);
       LOG_INFO << "Migrated a single IP Secondary to new storage format.";
-    } else if (f == secondaries_info.cend()) {
+    } else if (f != secondaries_info.cend()) {
+      // The configured Secondary was found in storage.
+      info = *f;
+    }
+
+    // the configuration and the information are copied, the connection can
+    // outlive this function
+    std::future<SecondaryInterface::Ptr> secondary;
+    if (!info) {
       // Secondary was not found in storage; it must be new.
-      secondary = Uptane::IpUptaneSecondary::connectAndCreate(cfg.ip, cfg.port, cfg.verification_type);
+      secondary = connectInBackground([cfg]() {
+        return Uptane::IpUptaneSecondary::connectAndCreate(cfg.ip, cfg.port, cfg.verification_type);
+      });
+    } else {
+      secondary = connectInBackground([cfg, info]() {
+        return Uptane::IpUptaneSecondary::connectAndCheck(cfg.ip, cfg.port, cfg.verification_type, info->serial,
+                                                          info->hw_id, info->pub_key);
+      });
+    }
+    pending.push_back({cfg, info, std::move(secondary)});
+  }
+
+  for (auto& p : pending) {
+    const IPSecondaryConfig& cfg = p.cfg;
+    const bool answered = p.secondary.wait_until(deadline) == std::future_status::ready;
+    if (!p.info) {
+      SecondaryInterface::Ptr secondary = answered ? p.secondary.get() : nullptr;
       if (secondary == nullptr) {
         LOG_DEBUG << "Could not connect to IP Secondary at " << cfg.ip << ":" << cfg.port
                   << "; now trying to wait for it.";
         sec_waiter.addSecondary(cfg.ip, cfg.port, cfg.verification_type);
       } else {
         result.push_back(secondary);
-        // set ip/port in the db so that we can match everything later
-        Json::Value d;
-        d["ip"] = cfg.ip;
-        d["port"] = cfg.port;
-        d["verification_type"] = Uptane::VerificationTypeToString(cfg.verification_type);
-        aktualizr.SetSecondaryData(secondary->getSerial(), Utils::jsonToCanonicalStr(d));
+        storeSecondaryData(aktualizr, secondary->getSerial(), cfg);
       }
       continue;
-    } else {
-      // The configured Secondary was found in storage.
-      info = &(*f);
     }
 
+    if (!answered) {
+      LOG_WARNING << "IP Secondary at " << cfg.ip << ":" << cfg.port << " did not answer in time, using what we know";
+      result.push_back(std::make_shared<Uptane::IpUptaneSecondary>(cfg.ip, cfg.port, cfg.verification_type,
+                                                                   p.info->serial, p.info->hw_id, p.info->pub_key));
+      continue;
+    }
+    SecondaryInterface::Ptr secondary = p.secondary.get();
     if (secondary == nullptr) {
-      secondary = Uptane::IpUptaneSecondary::connectAndCheck(cfg.ip, cfg.port, cfg.verification_type, info->serial,
-                                                             info->hw_id, info->pub_key);
-      if (secondary == nullptr) {
-        throw std::runtime_error("Unable to connect to or verify IP Secondary at " + cfg.ip + ":" +
-                                 std::to_string(cfg.port));
-      }
+      throw std::runtime_error("Unable to connect to or verify IP Secondary at " + cfg.ip + ":" +
+                               std::to_string(cfg.port));
     }
-
     result.push_back(secondary);
   }
 
-  sec_waiter.wait();
+  sec_waiter.wait(deadline);
+
+  if (!config.multicast_group.empty()) {
+    for (const auto& secondary : result) {
+      auto ip_secondary = std::dynamic_pointer_cast<Uptane::IpUptaneSecondary>(secondary);
+      if (ip_secondary != nullptr) {
+        ip_secondary->setMulticast(config.multicast_group, config.multicast_port, config.multicast_rate);
+      }
+    }
+  }
 
   return result;
 }
@@ -5,6 +5,7 @@
 
 #include <json/json.h>
 
+#include "asn1/asn1_transport.h"
 #include "logging/logging.h"
 #include "secondary_config.h"
 #include "utilities/utils.h"
@@ -38,6 +39,7 @@ config file example
                 "secondaries": [
                         {"addr": "127.0.0.1:9031", "verification_type": "Full"}
                         {"addr": "127.0.0.1:9032", "verification_type": "Tuf"}
+                        {"addr": "unix:/run/aktualizr/secondary.sock", "verification_type": "Full"}
                 ]
   },
   "socketcan": {
@@ -80,6 +82,10 @@ SecondaryConfigParser::Configs JsonConfigParser::parse() {
 }
 
 static std::pair<std::string, uint16_t> getIPAndPort(const std::string& addr) {
+  // a Secondary on the same host, see Asn1Transport
+  if (Asn1Transport::isLocal(addr)) {
+    return std::make_pair(addr, 0);
+  }
   auto del_pos = addr.find_first_of(':');
   if (del_pos == std::string::npos) {
     throw std::invalid_argument("Incorrect address string, couldn't find port delimeter: " + addr);
@@ -95,6 +101,16 @@ void JsonConfigParser::createIPSecondariesCfg(Configs& configs, const Json::Valu
       static_cast<uint16_t>(json_ip_sec_cfg[IPSecondariesConfig::PortField].asUInt()),
       json_ip_sec_cfg[IPSecondariesConfig::TimeoutField].asInt());
   auto secondaries = json_ip_sec_cfg[IPSecondariesConfig::SecondariesField];
+  if (json_ip_sec_cfg.isMember(IPSecondariesConfig::MulticastGroupField)) {
+    resultant_cfg->multicast_group = json_ip_sec_cfg[IPSecondariesConfig::MulticastGroupField].asString();
+  }
+  if (json_ip_sec_cfg.isMember(IPSecondariesConfig::MulticastPortField)) {
+    resultant_cfg->multicast_port =
+        static_cast<uint16_t>(json_ip_sec_cfg[IPSecondariesConfig::MulticastPortField].asUInt());
+  }
+  if (json_ip_sec_cfg.isMember(IPSecondariesConfig::MulticastRateField)) {
+    resultant_cfg->multicast_rate = json_ip_sec_cfg[IPSecondariesConfig::MulticastRateField].asUInt64();
+  }
 
   LOG_INFO << "Found IP secondaries config: " << *resultant_cfg;
 
@@ -37,6 +37,9 @@ class IPSecondariesConfig : public SecondaryConfig {
   static constexpr const char* const PortField{"secondaries_wait_port"};
   static constexpr const char* const TimeoutField{"secondaries_wait_timeout"};
   static constexpr const char* const SecondariesField{"secondaries"};
+  static constexpr const char* const MulticastGroupField{"multicast_group"};
+  static constexpr const char* const MulticastPortField{"multicast_port"};
+  static constexpr const char* const MulticastRateField{"multicast_rate"};
 
   IPSecondariesConfig(const uint16_t wait_port, const int timeout_s)
       : SecondaryConfig(Type), secondaries_wait_port{wait_port}, secondaries_timeout_s{timeout_s} {}
@@ -49,6 +52,11 @@ class IPSecondariesConfig : public SecondaryConfig {
   const uint16_t secondaries_wait_port;
   const int secondaries_timeout_s;
   std::vector<IPSecondaryConfig> secondaries_cfg;
+  // images assigned to several Secondaries are sent to them at once through
+  // this multicast group, at most multicast_rate bytes per second
+  std::string multicast_group;
+  uint16_t multicast_port{9060};
+  uint64_t multicast_rate{8 * 1024 * 1024};
 };
 
 class SecondaryConfigParser {
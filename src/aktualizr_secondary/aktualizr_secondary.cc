@@ -1,23 +1,29 @@
 #include "aktualizr_secondary.h"
 
 #include <sys/types.h>
+#include <algorithm>
+#include <future>
 #include <memory>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
 
+#include "crypto/crypto.h"
+#include "crypto/cryptoprovider.h"
 #include "crypto/keymanager.h"
 #include "libaktualizr/types.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "update_agent.h"
 #include "uptane/manifest.h"
+#include "utilities/metrics.h"
 #include "utilities/utils.h"
 
 AktualizrSecondary::AktualizrSecondary(AktualizrSecondaryConfig config, std::shared_ptr<INvStorage> storage)
     : config_(std::move(config)),
       storage_(std::move(storage)),
       keys_(std::make_shared<KeyManager>(storage_, config_.keymanagerConfig())) {
+  CryptoProviderFactory::select(config_.crypto.provider);
   uptaneInitialize();
   manifest_issuer_ = std::make_shared<Uptane::ManifestIssuer>(keys_, ecu_serial_);
   registerHandlers();
@@ -26,18 +32,34 @@ AktualizrSecondary::AktualizrSecondary(AktualizrSecondaryConfig config, std::sha
 PublicKey AktualizrSecondary::publicKey() const { return keys_->UptanePublicKey(); }
 
 Uptane::Manifest AktualizrSecondary::getManifest() const {
+  std::lock_guard<std::mutex> guard(manifest_mutex_);
+  if (!!signed_manifest_) {
+    return *signed_manifest_;
+  }
+
   Uptane::InstalledImageInfo installed_image_info;
   Uptane::Manifest manifest;
 
   if (getInstalledImageInfo(installed_image_info)) {
     manifest = manifest_issuer_->assembleAndSignManifest(installed_image_info);
+    signed_manifest_ = manifest;
   }
 
   return manifest;
 }
 
+void AktualizrSecondary::invalidateManifest() {
+  std::lock_guard<std::mutex> guard(manifest_mutex_);
+  signed_manifest_ = boost::none;
+}
+
 data::InstallationResult AktualizrSecondary::putMetadata(const Uptane::SecondaryMetadata& metadata) {
-  return verifyMetadata(metadata);
+  stored_meta_ = boost::none;
+  data::InstallationResult result = verifyMetadata(metadata);
+  if (!result.isSuccess()) {
+    cancelPrefetch();
+  }
+  return result;
 }
 
 data::InstallationResult AktualizrSecondary::install() {
@@ -49,6 +71,7 @@ data::InstallationResult AktualizrSecondary::install() {
 
   auto target_name = pending_target_.filename();
   auto result = installPendingTarget(pending_target_);
+  invalidateManifest();
 
   switch (result.result_code.num_code) {
     case data::ResultCode::Numeric::kOk: {
@@ -89,18 +112,31 @@ data::InstallationResult AktualizrSecondary::verifyMetadata(const Uptane::Second
       return data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
                                       std::string("Failed to update Director metadata: ") + e.what());
     }
+
+    const auto targets = director_repo_.getTargets(serial(), hwID());
+    if (targets.size() == 1) {
+      prefetchTarget(targets[0]);
+    }
   }
 
   // 6. Download and check the Root metadata file from the Image repository.
   // 7. Download and check the Timestamp metadata file from the Image repository.
   // 8. Download and check the Snapshot metadata file from the Image repository.
   // 9. Download and check the top-level Targets metadata file from the Image repository.
-  try {
-    image_repo_.updateMeta(*storage_, metadata, nullptr);
-  } catch (const std::exception& e) {
-    LOG_ERROR << "Failed to update Image repo metadata: " << e.what();
-    return data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
-                                    std::string("Failed to update Image repo metadata: ") + e.what());
+  //    Skipped if the metadata is the same as what has been verified already and none of it has expired since.
+  const std::vector<std::string> image_meta = imageMetaDigests(metadata);
+  if (!image_meta.empty() && image_meta == verified_image_meta_ && !image_repo_.metaExpired()) {
+    LOG_DEBUG << "Image repo metadata is unchanged, skipping its verification";
+  } else {
+    verified_image_meta_.clear();
+    try {
+      image_repo_.updateMeta(*storage_, metadata, nullptr);
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Failed to update Image repo metadata: " << e.what();
+      return data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
+                                      std::string("Failed to update Image repo metadata: ") + e.what());
+    }
+    verified_image_meta_ = image_meta;
   }
 
   data::InstallationResult result = findTargets();
@@ -110,7 +146,25 @@ data::InstallationResult AktualizrSecondary::verifyMetadata(const Uptane::Second
   return result;
 }
 
+std::vector<std::string> AktualizrSecondary::imageMetaDigests(const Uptane::SecondaryMetadata& metadata) {
+  std::vector<std::string> digests;
+  try {
+    for (const auto& role : {Uptane::Role::Root(), Uptane::Role::Timestamp(), Uptane::Role::Snapshot(),
+                             Uptane::Role::Targets()}) {
+      std::string json;
+      metadata.fetchLatestRole(&json, Uptane::kMaxImageTargetsSize, Uptane::RepositoryType::Image(), role);
+      digests.push_back(Crypto::sha256digest(json));
+    }
+  } catch (const std::exception&) {
+    // incomplete metadata, which is never considered as verified
+    return {};
+  }
+  return digests;
+}
+
 void AktualizrSecondary::initPendingTargetIfAny() {
+  invalidateManifest();
+  verified_image_meta_.clear();
   try {
     if (config_.uptane.verification_type == VerificationType::kFull) {
       director_repo_.checkMetaOffline(*storage_);
@@ -124,6 +178,31 @@ void AktualizrSecondary::initPendingTargetIfAny() {
   findTargets();
 }
 
+const std::vector<AktualizrSecondary::TargetCandidate>& AktualizrSecondary::targetCandidates() {
+  auto targets = image_repo_.getTargets();
+  if (targets == indexed_targets_) {
+    return target_candidates_;
+  }
+
+  target_candidates_.clear();
+  for (size_t i = 0; i < targets->targets.size(); ++i) {
+    const auto& target = targets->targets[i];
+    const auto hwids = target.hardwareIds();
+    if (std::find(hwids.cbegin(), hwids.cend(), hwID()) == hwids.cend()) {
+      continue;
+    }
+    TargetCandidate candidate{i, boost::none};
+    try {
+      candidate.version = boost::lexical_cast<int>(target.custom_version());
+    } catch (const boost::bad_lexical_cast&) {
+      LOG_TRACE << "Unable to parse Target custom version: " << target.custom_version();
+    }
+    target_candidates_.push_back(candidate);
+  }
+  indexed_targets_ = std::move(targets);
+  return target_candidates_;
+}
+
 data::InstallationResult AktualizrSecondary::findTargets() {
   std::vector<Uptane::Target> targetsForThisEcu;
   if (config_.uptane.verification_type == VerificationType::kFull) {
@@ -137,46 +216,33 @@ data::InstallationResult AktualizrSecondary::findTargets() {
     targetsForThisEcu = director_repo_.getTargets(serial(), hwID());
   } else {
     const auto& targets = image_repo_.getTargets()->targets;
-    for (auto it = targets.begin(); it != targets.end(); ++it) {
-      auto hwids = it->hardwareIds();
-      auto found_loc = std::find(hwids.cbegin(), hwids.cend(), hwID());
-      if (found_loc != hwids.end()) {
-        if (!targetsForThisEcu.empty()) {
-          auto previous = boost::make_optional<int>(false, 0);
-          auto current = boost::make_optional<int>(false, 0);
-          try {
-            previous = boost::lexical_cast<int>(targetsForThisEcu[0].custom_version());
-          } catch (const boost::bad_lexical_cast&) {
-            LOG_TRACE << "Unable to parse Target custom version: " << targetsForThisEcu[0].custom_version();
-          }
-          try {
-            current = boost::lexical_cast<int>(it->custom_version());
-          } catch (const boost::bad_lexical_cast&) {
-            LOG_TRACE << "Unable to parse Target custom version: " << it->custom_version();
-          }
-          if (!previous && !current) {  // NOLINT(bugprone-branch-clone)
-            // No versions: add this to the vector.
-          } else if (!previous) {  // NOLINT(bugprone-branch-clone)
-            // Previous Target didn't have a version but this does; replace existing Targets with this.
-            targetsForThisEcu.clear();
-          } else if (!current) {  // NOLINT(bugprone-branch-clone)
-            // Current Target doesn't have a version but previous does; ignore this.
-            continue;
-          } else if (previous < current) {
-            // Current Target is newer; replace existing Targets with this.
-            targetsForThisEcu.clear();
-          } else if (previous > current) {
-            // Current Target is older; ignore it.
-            continue;
-          } else {
-            // Same version: add it to the vector.
-          }
+    boost::optional<int> latest;
+    for (const auto& candidate : targetCandidates()) {
+      const auto& current = candidate.version;
+      if (!targetsForThisEcu.empty()) {
+        if (!latest && !current) {  // NOLINT(bugprone-branch-clone)
+          // No versions: add this to the vector.
+        } else if (!latest) {  // NOLINT(bugprone-branch-clone)
+          // Previous Target didn't have a version but this does; replace existing Targets with this.
+          targetsForThisEcu.clear();
+        } else if (!current) {  // NOLINT(bugprone-branch-clone)
+          // Current Target doesn't have a version but previous does; ignore this.
+          continue;
+        } else if (latest < current) {
+          // Current Target is newer; replace existing Targets with this.
+          targetsForThisEcu.clear();
+        } else if (latest > current) {
+          // Current Target is older; ignore it.
+          continue;
         } else {
-          // First matching Target found; add it to the vector.
+          // Same version: add it to the vector.
         }
-
-        targetsForThisEcu.push_back(*it);
+      } else {
+        // First matching Target found; add it to the vector.
       }
+
+      targetsForThisEcu.push_back(targets[candidate.index]);
+      latest = current;
     }
   }
 
@@ -241,26 +307,44 @@ void AktualizrSecondary::uptaneInitialize() {
 }
 
 void AktualizrSecondary::registerHandlers() {
+  // these only need what the constructor set up, so that the Primary can
+  // find the Secondary while it is still being initialized
   registerHandler(AKIpUptaneMes_PR_getInfoReq,
-                  std::bind(&AktualizrSecondary::getInfoHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getInfoHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  Access::kStateless);
 
   registerHandler(AKIpUptaneMes_PR_versionReq,
-                  std::bind(&AktualizrSecondary::versionHdlr, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::versionHdlr, std::placeholders::_1, std::placeholders::_2),
+                  Access::kStateless);
 
+  registerHandler(AKIpUptaneMes_PR_metricsReq,
+                  std::bind(&AktualizrSecondary::metricsHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  Access::kStateless);
+
+  // these only read the state, so they can run alongside each other
   registerHandler(AKIpUptaneMes_PR_manifestReq,
-                  std::bind(&AktualizrSecondary::getManifestHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getManifestHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  Access::kRead);
 
   registerHandler(AKIpUptaneMes_PR_rootVerReq,
-                  std::bind(&AktualizrSecondary::getRootVerHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getRootVerHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  Access::kRead);
 
   registerHandler(AKIpUptaneMes_PR_putRootReq,
                   std::bind(&AktualizrSecondary::putRootHdlr, this, std::placeholders::_1, std::placeholders::_2));
 
+  registerHandler(AKIpUptaneMes_PR_putRootChainReq,
+                  std::bind(&AktualizrSecondary::putRootChainHdlr, this, std::placeholders::_1, std::placeholders::_2));
+
   registerHandler(AKIpUptaneMes_PR_putMetaReq2,
                   std::bind(&AktualizrSecondary::putMetaHdlr, this, std::placeholders::_1, std::placeholders::_2));
 
-  registerHandler(AKIpUptaneMes_PR_installReq,
-                  std::bind(&AktualizrSecondary::installHdlr, this, std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_metaVersionsReq,
+                  std::bind(&AktualizrSecondary::metaVersionsHdlr, this, std::placeholders::_1, std::placeholders::_2));
+
+  registerNotifyingHandler(AKIpUptaneMes_PR_installReq,
+                           std::bind(&AktualizrSecondary::installHdlr, this, std::placeholders::_1,
+                                     std::placeholders::_2, std::placeholders::_3));
 }
 
 MsgHandler::ReturnCode AktualizrSecondary::getInfoHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const {
@@ -279,10 +363,14 @@ MsgHandler::ReturnCode AktualizrSecondary::getInfoHdlr(Asn1Message& in_msg, Asn1
 }
 
 MsgHandler::ReturnCode AktualizrSecondary::versionHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
-  const uint32_t version = 2;
+  const uint32_t version = 3;
   auto version_req = in_msg.versionReq();
   const auto primary_version = static_cast<uint32_t>(version_req->version);
-  if (primary_version < version) {
+  // v3 only adds streamed uploads to v2, so a v2 Primary is answered with v2
+  uint32_t used_version = version;
+  if (primary_version == 2) {
+    used_version = primary_version;
+  } else if (primary_version < version) {
     LOG_ERROR << "Primary protocol version is " << primary_version << " but Secondary version is " << version
               << "! Communication will most likely fail!";
   } else if (primary_version > version) {
@@ -291,7 +379,52 @@ MsgHandler::ReturnCode AktualizrSecondary::versionHdlr(Asn1Message& in_msg, Asn1
   }
 
   auto m = out_msg.present(AKIpUptaneMes_PR_versionResp).versionResp();
-  m->version = version;
+  m->version = used_version;
+  if (used_version >= 3) {
+    m->uploadChunkSize = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+    *m->uploadChunkSize = kMaxUploadChunkSize;
+    if (version_req->uploadChunkSize != nullptr && *version_req->uploadChunkSize > 0) {
+      *m->uploadChunkSize = std::min(*m->uploadChunkSize, *version_req->uploadChunkSize);
+    }
+    m->uploadWindow = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+    *m->uploadWindow = kMaxUploadWindow;
+    if (version_req->uploadWindow != nullptr && *version_req->uploadWindow > 0) {
+      *m->uploadWindow = std::min(*m->uploadWindow, *version_req->uploadWindow);
+    }
+    if (version_req->rawUpload != nullptr && *version_req->rawUpload != 0) {
+      m->rawUpload = Asn1Allocation<BOOLEAN_t>();
+      *m->rawUpload = 1;
+    }
+    if (version_req->uploadCompression != nullptr && *version_req->uploadCompression == AKCompression_deflate) {
+      m->uploadCompression = Asn1Allocation<AKCompression_t>();
+      *m->uploadCompression = AKCompression_deflate;
+    }
+    if (version_req->uploadResume != nullptr && *version_req->uploadResume != 0) {
+      m->uploadResume = Asn1Allocation<BOOLEAN_t>();
+      *m->uploadResume = 1;
+    }
+    if (version_req->rootChain != nullptr && *version_req->rootChain != 0) {
+      m->rootChain = Asn1Allocation<BOOLEAN_t>();
+      *m->rootChain = 1;
+    }
+    if (version_req->multicastUpload != nullptr && *version_req->multicastUpload != 0) {
+      m->multicastUpload = Asn1Allocation<BOOLEAN_t>();
+      *m->multicastUpload = 1;
+    }
+    if (version_req->metaVersions != nullptr && *version_req->metaVersions != 0) {
+      m->metaVersions = Asn1Allocation<BOOLEAN_t>();
+      *m->metaVersions = 1;
+    }
+    // only proposed by a Primary that connects through a Unix domain socket
+    if (version_req->fileUpload != nullptr && *version_req->fileUpload != 0) {
+      m->fileUpload = Asn1Allocation<BOOLEAN_t>();
+      *m->fileUpload = 1;
+    }
+    if (version_req->metrics != nullptr && *version_req->metrics != 0) {
+      m->metrics = Asn1Allocation<BOOLEAN_t>();
+      *m->metrics = 1;
+    }
+  }
 
   return ReturnCode::kOk;
 }
@@ -304,13 +437,14 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::getManifestHdlr(Asn1Message&
     LOG_DEBUG << "Received another manifest request message; sending the same manifest.";
   }
 
+  const auto manifest = getManifest();
   out_msg.present(AKIpUptaneMes_PR_manifestResp);
   auto manifest_resp = out_msg.manifestResp();
   manifest_resp->manifest.present = manifest_PR_json;
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
-  SetString(&manifest_resp->manifest.choice.json, Utils::jsonToStr(getManifest()));
+  SetString(&manifest_resp->manifest.choice.json, Utils::jsonToStr(manifest));
 
-  LOG_TRACE << "Manifest: \n" << getManifest();
+  LOG_TRACE << "Manifest: \n" << manifest;
   return ReturnCode::kOk;
 }
 
@@ -343,18 +477,44 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::getRootVerHdlr(Asn1Message& i
 AktualizrSecondary::ReturnCode AktualizrSecondary::putRootHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
   LOG_INFO << "Received a put Root request message; verifying contents...";
   auto pr = in_msg.putRootReq();
+  const data::InstallationResult result = putRoot(pr->repotype, ToString(pr->json));
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_putRootResp).putRootResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
+
+AktualizrSecondary::ReturnCode AktualizrSecondary::putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto pr = in_msg.putRootChainReq();
+  LOG_INFO << "Received a put Root chain request message with " << pr->chain.list.count
+           << " versions; verifying contents...";
+  data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  for (int i = 0; i < pr->chain.list.count && result.isSuccess(); i++) {
+    result = putRoot(pr->repotype, ToString(*pr->chain.list.array[i]));  // NOLINT
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_putRootChainResp).putRootChainResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+  m->version = (pr->repotype == AKRepoType_director) ? director_repo_.rootVersion() : image_repo_.rootVersion();
+
+  return ReturnCode::kOk;
+}
+
+data::InstallationResult AktualizrSecondary::putRoot(AKRepoType_t repotype, const std::string& json) {
   Uptane::RepositoryType repo_type{};
-  if (pr->repotype == AKRepoType_director) {
+  if (repotype == AKRepoType_director) {
     repo_type = Uptane::RepositoryType::Director();
-  } else if (pr->repotype == AKRepoType_image) {
+  } else if (repotype == AKRepoType_image) {
     repo_type = Uptane::RepositoryType::Image();
   } else {
   }
 
-  const std::string json = ToString(pr->json);
   LOG_DEBUG << "Received " << repo_type << " repo Root metadata:\n" << json;
+  stored_meta_ = boost::none;
   data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
-
   if (repo_type == Uptane::RepositoryType::Director()) {
     if (config_.uptane.verification_type == VerificationType::kTuf) {
       LOG_WARNING << "Ignoring new Director Root metadata as it is unnecessary for TUF verification.";
@@ -374,6 +534,7 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::putRootHdlr(Asn1Message& in_m
     }
   } else if (repo_type == Uptane::RepositoryType::Image()) {
     try {
+      verified_image_meta_.clear();
       image_repo_.verifyRoot(json);
       storage_->storeRoot(json, repo_type, Uptane::Version(image_repo_.rootVersion()));
       storage_->clearNonRootMeta(repo_type);
@@ -383,17 +544,13 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::putRootHdlr(Asn1Message& in_m
                                         std::string("Failed to update Image repo Root metadata: ") + e.what());
     }
   } else {
-    LOG_WARNING << "Received Root version request with invalid repo type: " << pr->repotype;
+    LOG_WARNING << "Received Root version request with invalid repo type: " << repotype;
     result = data::InstallationResult(
         data::ResultCode::Numeric::kInternalError,
-        "Received Root version request with invalid repo type: " + std::to_string(pr->repotype));
+        "Received Root version request with invalid repo type: " + std::to_string(repotype));
   }
 
-  auto m = out_msg.present(AKIpUptaneMes_PR_putRootResp).putRootResp();
-  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
-  SetString(&m->description, result.description);
-
-  return ReturnCode::kOk;
+  return result;
 }
 
 void AktualizrSecondary::copyMetadata(Uptane::MetaBundle& meta_bundle, const Uptane::RepositoryType repo,
@@ -454,18 +611,46 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::putMetaHdlr(Asn1Message& in_m
     }
   }
 
-  size_t expected_items;
-  if (config_.uptane.verification_type == VerificationType::kTuf) {
-    expected_items = 4;
-  } else {
-    expected_items = 6;
-  }
-  if (meta_bundle.size() != expected_items) {
-    LOG_WARNING << "Metadata received from Primary is incomplete. Expected size: " << expected_items
-                << " Received: " << meta_bundle.size();
+  // the roles the Primary left out because this ECU holds them already
+  data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  if (md->stored != nullptr) {
+    const auto roles = metaRoles();
+    for (int i = 0; i < md->stored->list.count && result.isSuccess(); i++) {
+      const AKMetaVersion_t& stored = *md->stored->list.array[i];  // NOLINT
+      const auto repo = stored.repotype == AKRepoType_director ? Uptane::RepositoryType::Director()
+                                                                : Uptane::RepositoryType::Image();
+      const std::string role = ToString(stored.role);
+      auto found = std::find_if(roles.cbegin(), roles.cend(), [&repo, &role](const auto& meta) {
+        return meta.first == repo && meta.second.ToString() == role;
+      });
+      std::string json;
+      if (found == roles.cend() || !loadStoredMetadata(repo, found->second, &json) ||
+          Crypto::sha256digestHex(json) != ToString(stored.hash)) {
+        LOG_ERROR << "The stored " << repo << " repo " << role << " metadata is not what the Primary left out.";
+        result = data::InstallationResult(
+            data::ResultCode::Numeric::kInternalError,
+            "The stored " + repo.ToString() + " repo " + role + " metadata is not what the Primary left out.");
+        break;
+      }
+      LOG_DEBUG << "Using the stored " << repo << " repo " << role << " metadata version " << stored.version;
+      copyMetadata(meta_bundle, repo, found->second, json);
+    }
   }
 
-  data::InstallationResult result = putMetadata(meta_bundle);
+  if (result.isSuccess()) {
+    size_t expected_items;
+    if (config_.uptane.verification_type == VerificationType::kTuf) {
+      expected_items = 4;
+    } else {
+      expected_items = 6;
+    }
+    if (meta_bundle.size() != expected_items) {
+      LOG_WARNING << "Metadata received from Primary is incomplete. Expected size: " << expected_items
+                  << " Received: " << meta_bundle.size();
+    }
+
+    result = putMetadata(meta_bundle);
+  }
 
   auto m = out_msg.present(AKIpUptaneMes_PR_putMetaResp2).putMetaResp2();
   m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
@@ -474,10 +659,94 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::putMetaHdlr(Asn1Message& in_m
   return ReturnCode::kOk;
 }
 
-AktualizrSecondary::ReturnCode AktualizrSecondary::installHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+std::vector<std::pair<Uptane::RepositoryType, Uptane::Role>> AktualizrSecondary::metaRoles() const {
+  std::vector<std::pair<Uptane::RepositoryType, Uptane::Role>> roles;
+  if (config_.uptane.verification_type == VerificationType::kFull) {
+    roles.emplace_back(Uptane::RepositoryType::Director(), Uptane::Role::Root());
+    roles.emplace_back(Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  }
+  for (const auto& role :
+       {Uptane::Role::Root(), Uptane::Role::Timestamp(), Uptane::Role::Snapshot(), Uptane::Role::Targets()}) {
+    roles.emplace_back(Uptane::RepositoryType::Image(), role);
+  }
+  return roles;
+}
+
+bool AktualizrSecondary::loadStoredMetadata(const Uptane::RepositoryType repo, const Uptane::Role& role,
+                                            std::string* json) const {
+  if (role == Uptane::Role::Root()) {
+    return storage_->loadLatestRoot(json, repo);
+  }
+  return storage_->loadNonRoot(json, repo, role);
+}
+
+const std::vector<AktualizrSecondary::StoredMeta>& AktualizrSecondary::storedMetadata() {
+  if (!stored_meta_) {
+    std::vector<StoredMeta> stored;
+    for (const auto& meta : metaRoles()) {
+      std::string json;
+      if (!loadStoredMetadata(meta.first, meta.second, &json)) {
+        continue;
+      }
+      const int version = Uptane::extractVersionUntrusted(json);
+      if (version >= 0) {
+        stored.push_back(StoredMeta{meta.first, meta.second, version, Crypto::sha256digestHex(json)});
+      }
+    }
+    stored_meta_ = std::move(stored);
+  }
+  return *stored_meta_;
+}
+
+AktualizrSecondary::ReturnCode AktualizrSecondary::metaVersionsHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
   (void)in_msg;
+  LOG_INFO << "Received a metadata versions request message; sending the versions of the stored metadata.";
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_metaVersionsResp).metaVersionsResp();
+  for (const auto& stored : storedMetadata()) {
+    auto* version = Asn1Allocation<AKMetaVersion_t>();
+    version->repotype = stored.repo == Uptane::RepositoryType::Director() ? AKRepoType_director : AKRepoType_image;
+    SetString(&version->role, stored.role.ToString());
+    version->version = stored.version;
+    SetString(&version->hash, stored.hash);
+    ASN_SEQUENCE_ADD(&m->versions, version);
+  }
+
+  return ReturnCode::kOk;
+}
+
+AktualizrSecondary::ReturnCode AktualizrSecondary::metricsHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const {
+  (void)in_msg;
+  LOG_DEBUG << "Received a metrics request message; sending the metrics.";
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_metricsResp).metricsResp();
+  SetString(&m->metrics, metrics::Registry::instance().prometheus());
+
+  return ReturnCode::kOk;
+}
+
+AktualizrSecondary::ReturnCode AktualizrSecondary::installHdlr(Asn1Message& in_msg, const Notifier& notify,
+                                                               Asn1Message& out_msg) {
   LOG_INFO << "Received an installation request message; attempting installation...";
-  auto result = install();
+  auto req = in_msg.installReq();
+  data::InstallationResult result;
+  if (!notify || req->progress == nullptr || *req->progress == 0) {
+    result = install();
+  } else {
+    // the installation runs on its own while its progress is sent every
+    // kInstallProgressInterval; a Primary that went away doesn't stop it
+    install_progress_ = 0;
+    auto installation = std::async(std::launch::async, [this]() { return install(); });
+    bool notifying = true;
+    do {
+      if (notifying) {
+        Asn1Message::Ptr progress_msg(Asn1Message::Empty());
+        progress_msg->present(AKIpUptaneMes_PR_installProgress).installProgress()->progress = install_progress_.load();
+        notifying = notify(progress_msg);
+      }
+    } while (installation.wait_for(kInstallProgressInterval) != std::future_status::ready);
+    result = installation.get();
+  }
 
   auto m = out_msg.present(AKIpUptaneMes_PR_installResp2).installResp2();
   m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
@@ -1,6 +1,12 @@
 #ifndef AKTUALIZR_SECONDARY_H
 #define AKTUALIZR_SECONDARY_H
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include <boost/optional.hpp>
+
 #include "aktualizr_secondary_config.h"
 #include "msg_handler.h"
 #include "uptane/directorrepository.h"
@@ -39,6 +45,11 @@ class AktualizrSecondary : public MsgDispatcher {
   virtual bool isTargetSupported(const Uptane::Target& target) const = 0;
   virtual data::InstallationResult installPendingTarget(const Uptane::Target& target) = 0;
   virtual data::InstallationResult applyPendingInstall(const Uptane::Target& target) = 0;
+  // With full verification, the Target this ECU is assigned is passed to prefetchTarget() as soon as the Director
+  // metadata is verified, before the Image repo metadata is; cancelPrefetch() is called if the verification fails.
+  // Nothing that is prefetched must be installed before the whole metadata has been verified.
+  virtual void prefetchTarget(const Uptane::Target& target) { (void)target; }
+  virtual void cancelPrefetch() {}
 
   // protected interface to be used by child classes
   std::shared_ptr<INvStorage>& storage() { return storage_; }
@@ -46,12 +57,41 @@ class AktualizrSecondary : public MsgDispatcher {
   std::shared_ptr<KeyManager>& keyMngr() { return keys_; }
 
   void initPendingTargetIfAny();
+  // to be called whenever the installed image may have changed
+  void invalidateManifest();
+  // progress of the running installation in percent, sent to the Primary
+  void reportInstallProgress(unsigned int progress) { install_progress_ = progress; }
+
+  // largest streamed upload chunk and number of chunks in flight accepted from the Primary (v3)
+  static constexpr long kMaxUploadChunkSize{1024 * 1024};  // NOLINT(google-runtime-int)
+  static constexpr long kMaxUploadWindow{16};              // NOLINT(google-runtime-int)
 
  private:
   static void copyMetadata(Uptane::MetaBundle& meta_bundle, Uptane::RepositoryType repo, const Uptane::Role& role,
                            std::string& json);
   data::InstallationResult verifyMetadata(const Uptane::SecondaryMetadata& metadata);
+  static std::vector<std::string> imageMetaDigests(const Uptane::SecondaryMetadata& metadata);
   data::InstallationResult findTargets();
+  // verify and store one new Root version
+  data::InstallationResult putRoot(AKRepoType_t repotype, const std::string& json);
+  // version and SHA256 of the metadata of a role in the storage, reported to
+  // the Primary so that it only sends the roles that changed
+  struct StoredMeta {
+    Uptane::RepositoryType repo;
+    Uptane::Role role;
+    int version;
+    std::string hash;
+  };
+  const std::vector<StoredMeta>& storedMetadata();
+  // the roles sent by the Primary with the verification type of this ECU
+  std::vector<std::pair<Uptane::RepositoryType, Uptane::Role>> metaRoles() const;
+  bool loadStoredMetadata(Uptane::RepositoryType repo, const Uptane::Role& role, std::string* json) const;
+  // Image repo Targets for the hardware ID of this ECU, with their custom version if it is a number
+  struct TargetCandidate {
+    size_t index;
+    boost::optional<int> version;
+  };
+  const std::vector<TargetCandidate>& targetCandidates();
   void uptaneInitialize();
   void registerHandlers();
 
@@ -61,8 +101,11 @@ class AktualizrSecondary : public MsgDispatcher {
   ReturnCode getManifestHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
   ReturnCode getRootVerHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
   ReturnCode putRootHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
   ReturnCode putMetaHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
-  ReturnCode installHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode metaVersionsHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode metricsHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
+  ReturnCode installHdlr(Asn1Message& in_msg, const Notifier& notify, Asn1Message& out_msg);
 
   Uptane::HardwareIdentifier hardware_id_{Uptane::HardwareIdentifier::Unknown()};
   Uptane::EcuSerial ecu_serial_{Uptane::EcuSerial::Unknown()};
@@ -72,10 +115,26 @@ class AktualizrSecondary : public MsgDispatcher {
   std::shared_ptr<KeyManager> keys_;
 
   Uptane::ManifestIssuer::Ptr manifest_issuer_;
+  // the signed manifest is reused until the installed image changes; it is
+  // requested on every polling cycle and getting it may rehash the image
+  mutable std::mutex manifest_mutex_;
+  mutable boost::optional<Uptane::Manifest> signed_manifest_;
 
   Uptane::DirectorRepository director_repo_;
   Uptane::ImageRepository image_repo_;
+  // digests of the Image repo metadata image_repo_ holds, once verified: the
+  // same metadata sent again with an update doesn't need to be verified twice
+  std::vector<std::string> verified_image_meta_;
+  // what storedMetadata() found, until the stored metadata changes
+  boost::optional<std::vector<StoredMeta>> stored_meta_;
+  // index of the Image repo Targets that can be for this ECU, rebuilt whenever image_repo_ gets other Targets
+  std::shared_ptr<const Uptane::Targets> indexed_targets_;
+  std::vector<TargetCandidate> target_candidates_;
   Uptane::Target pending_target_{Uptane::Target::Unknown()};
+
+  // how often the progress of an installation is sent, when the Primary asks for it
+  static constexpr std::chrono::milliseconds kInstallProgressInterval{2000};
+  std::atomic<unsigned int> install_progress_{0};
 };
 
 #endif  // AKTUALIZR_SECONDARY_H
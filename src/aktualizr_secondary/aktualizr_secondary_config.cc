@@ -17,12 +17,16 @@ void AktualizrSecondaryNetConfig::updateFromPropertyTree(const boost::property_t
   CopyFromConfig(port, "port", pt);
   CopyFromConfig(primary_ip, "primary_ip", pt);
   CopyFromConfig(primary_port, "primary_port", pt);
+  CopyFromConfig(max_connections, "max_connections", pt);
+  CopyFromConfig(socket_path, "socket_path", pt);
 }
 
 void AktualizrSecondaryNetConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, port, "port");
   writeOption(out_stream, primary_ip, "primary_ip");
   writeOption(out_stream, primary_port, "primary_port");
+  writeOption(out_stream, max_connections, "max_connections");
+  writeOption(out_stream, socket_path, "socket_path");
 }
 
 void AktualizrSecondaryUptaneConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
@@ -32,6 +36,7 @@ void AktualizrSecondaryUptaneConfig::updateFromPropertyTree(const boost::propert
   CopyFromConfig(key_type, "key_type", pt);
   CopyFromConfig(force_install_completion, "force_install_completion", pt);
   CopyFromConfig(verification_type, "verification_type", pt);
+  CopyFromConfig(ostree_prefetch, "ostree_prefetch", pt);
 }
 
 void AktualizrSecondaryUptaneConfig::writeToStream(std::ostream& out_stream) const {
@@ -41,6 +46,7 @@ void AktualizrSecondaryUptaneConfig::writeToStream(std::ostream& out_stream) con
   writeOption(out_stream, key_type, "key_type");
   writeOption(out_stream, force_install_completion, "force_install_completion");
   writeOption(out_stream, verification_type, "verification_type");
+  writeOption(out_stream, ostree_prefetch, "ostree_prefetch");
 }
 
 AktualizrSecondaryConfig::AktualizrSecondaryConfig(const boost::program_options::variables_map& cmd) {
@@ -108,6 +114,7 @@ void AktualizrSecondaryConfig::updateFromPropertyTree(const boost::property_tree
 
   // from aktualizr config
   CopySubtreeFromConfig(p11, "p11", pt);
+  CopySubtreeFromConfig(crypto, "crypto", pt);
   CopySubtreeFromConfig(pacman, "pacman", pt);
   CopySubtreeFromConfig(storage, "storage", pt);
   CopySubtreeFromConfig(import, "import", pt);
@@ -122,6 +129,7 @@ void AktualizrSecondaryConfig::writeToStream(std::ostream& sink) const {
   WriteSectionToStream(uptane, "uptane", sink);
 
   WriteSectionToStream(p11, "p11", sink);
+  WriteSectionToStream(crypto, "crypto", sink);
   WriteSectionToStream(pacman, "pacman", sink);
   WriteSectionToStream(storage, "storage", sink);
   WriteSectionToStream(import, "import", sink);
@@ -19,6 +19,10 @@ struct AktualizrSecondaryNetConfig {
   in_port_t port{9030};
   std::string primary_ip;
   in_port_t primary_port{9030};
+  // connections served at once, each in its own thread; 1 serves them one after the other
+  uint32_t max_connections{4};
+  // listen on this Unix domain socket instead of the port, for a Primary on the same host
+  boost::filesystem::path socket_path;
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -31,6 +35,8 @@ struct AktualizrSecondaryUptaneConfig {
   KeyType key_type{KeyType::kRSA2048};
   bool force_install_completion{false};
   VerificationType verification_type{VerificationType::kFull};
+  // OSTree: pull the assigned commit as soon as the Director metadata is verified (full verification only)
+  bool ostree_prefetch{false};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -55,6 +61,7 @@ class AktualizrSecondaryConfig : public BaseConfig {
 
   // from Primary config
   P11Config p11;
+  CryptoConfig crypto;
   PackageConfig pacman;
   BootloaderConfig bootloader;
   StorageConfig storage;
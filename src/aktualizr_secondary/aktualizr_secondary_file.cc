@@ -1,9 +1,19 @@
 #include "aktualizr_secondary_file.h"
 
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include "multicast.h"
 #include "storage/invstorage.h"
 #include "update_agent_file.h"
+#include "update_agent_partition.h"
 
 const std::string AktualizrSecondaryFile::FileUpdateDefaultFile{"firmware.txt"};
+const std::string AktualizrSecondaryFile::FilePartitionStateFile{"partition.json"};
+const std::string AktualizrSecondaryFile::FileUploadResumeFile{"upload.json"};
+const std::string AktualizrSecondaryFile::FileMulticastFile{"multicast.part"};
 
 AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& config)
     : AktualizrSecondaryFile(config, INvStorage::newStorage(config.storage)) {}
@@ -11,9 +21,28 @@ AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& c
 AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& config,
                                                std::shared_ptr<INvStorage> storage,
                                                std::shared_ptr<FileUpdateAgent> update_agent)
-    : AktualizrSecondary(config, std::move(storage)), update_agent_{std::move(update_agent)} {
+    : AktualizrSecondary(config, std::move(storage)),
+      update_agent_{std::move(update_agent)},
+      multicast_path_{config.storage.path / FileMulticastFile} {
   registerHandler(AKIpUptaneMes_PR_uploadDataReq, std::bind(&AktualizrSecondaryFile::uploadDataHdlr, this,
                                                             std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_uploadStreamReq, std::bind(&AktualizrSecondaryFile::uploadStreamHdlr, this,
+                                                              std::placeholders::_1, std::placeholders::_2));
+  registerRawHandler(AKIpUptaneMes_PR_uploadRawReq,
+                     std::bind(&AktualizrSecondaryFile::uploadRawHdlr, this, std::placeholders::_1,
+                               std::placeholders::_2, std::placeholders::_3));
+  registerHandler(AKIpUptaneMes_PR_uploadResumeReq, std::bind(&AktualizrSecondaryFile::uploadResumeHdlr, this,
+                                                              std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_multicastStartReq, std::bind(&AktualizrSecondaryFile::multicastStartHdlr, this,
+                                                                std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_multicastStatusReq, std::bind(&AktualizrSecondaryFile::multicastStatusHdlr, this,
+                                                                 std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_multicastEndReq, std::bind(&AktualizrSecondaryFile::multicastEndHdlr, this,
+                                                              std::placeholders::_1, std::placeholders::_2));
+  if (!update_agent_ && config.pacman.type == PACKAGE_MANAGER_PARTITION) {
+    update_agent_ = PartitionUpdateAgent::fromConfig(config.pacman, config.storage.path / FilePartitionStateFile);
+    update_agent_->setResumeFile(config.storage.path / FileUploadResumeFile);
+  }
   if (!update_agent_) {
     std::string current_target_name;
 
@@ -29,6 +58,16 @@ AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& c
     }
 
     update_agent_ = std::make_shared<FileUpdateAgent>(config.storage.path / FileUpdateDefaultFile, current_target_name);
+    update_agent_->setResumeFile(config.storage.path / FileUploadResumeFile);
+  }
+  update_agent_->setInstallProgressCb([this](unsigned int progress) { reportInstallProgress(progress); });
+}
+
+AktualizrSecondaryFile::~AktualizrSecondaryFile() {
+  if (multicast_receiver_) {
+    multicast_receiver_.reset();
+    boost::system::error_code ec;
+    boost::filesystem::remove(multicast_path_, ec);
   }
 }
 
@@ -44,6 +83,188 @@ data::InstallationResult AktualizrSecondaryFile::receiveData(const uint8_t* data
   return update_agent_->receiveData(getPendingTarget(), data, size);
 }
 
+uint64_t AktualizrSecondaryFile::resumableUpload(std::string* hex_digest) {
+  if (!getPendingTarget().IsValid()) {
+    return 0;
+  }
+  return update_agent_->resumableData(getPendingTarget(), hex_digest);
+}
+
+// NOLINTNEXTLINE(google-runtime-int)
+data::InstallationResult AktualizrSecondaryFile::startStreamChunk(long sequence, uint64_t offset) {
+  if (sequence == 0) {
+    next_sequence_ = 0;
+    stream_result_ = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+    if (offset == 0) {
+      update_agent_->restartReceiving();
+    } else if (update_agent_->resumeReceiving(getPendingTarget(), offset)) {
+      LOG_INFO << "Resuming the upload after " << offset << " bytes";
+    } else {
+      LOG_ERROR << "The upload cannot be resumed after " << offset << " bytes";
+      stream_result_ = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                                "The upload cannot be resumed after " + std::to_string(offset) +
+                                                    " bytes");
+      return stream_result_;
+    }
+  }
+  if (!stream_result_.isSuccess()) {
+    return stream_result_;
+  }
+
+  data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  if (sequence != next_sequence_) {
+    LOG_ERROR << "Received upload chunk " << sequence << " but expected chunk " << next_sequence_;
+    result = data::InstallationResult(
+        data::ResultCode::Numeric::kDownloadFailed,
+        "Received upload chunk " + std::to_string(sequence) + " but expected chunk " + std::to_string(next_sequence_));
+    stream_result_ = result;
+  }
+  ++next_sequence_;
+  return result;
+}
+
+// NOLINTNEXTLINE(google-runtime-int)
+data::InstallationResult AktualizrSecondaryFile::receiveStreamData(long sequence, const uint8_t* data, size_t size,
+                                                                   const std::string& running_hash, bool compressed,
+                                                                   uint64_t offset) {
+  auto result = startStreamChunk(sequence, offset);
+  if (!result.isSuccess()) {
+    return result;
+  }
+
+  if (sequence == 0) {
+    inflater_ = compressed ? std::make_unique<InflateStream>() : nullptr;
+  }
+  if (compressed != (inflater_ != nullptr)) {
+    LOG_ERROR << "The compression of upload chunk " << sequence << " doesn't match the one of the upload";
+    result = data::InstallationResult(
+        data::ResultCode::Numeric::kDownloadFailed,
+        "The compression of upload chunk " + std::to_string(sequence) + " doesn't match the one of the upload");
+  } else if (compressed) {
+    const bool inflated = inflater_->decompress(data, size, [this, &result](const uint8_t* piece, size_t piece_size) {
+      result = receiveData(piece, piece_size);
+      return result.isSuccess();
+    });
+    if (!inflated && result.isSuccess()) {
+      LOG_ERROR << "Failed to decompress upload chunk " << sequence << ": " << inflater_->error();
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                        "Failed to decompress upload chunk " + std::to_string(sequence) + ": " +
+                                            inflater_->error());
+    }
+  } else {
+    result = receiveData(data, size);
+  }
+  if (result.isSuccess() && !running_hash.empty() &&
+      !update_agent_->checkReceivedData(getPendingTarget(), running_hash)) {
+    LOG_ERROR << "The image data received up to chunk " << sequence << " doesn't match its hash";
+    result = data::InstallationResult(
+        data::ResultCode::Numeric::kDownloadFailed,
+        "The image data received up to chunk " + std::to_string(sequence) + " doesn't match its hash");
+  }
+  if (!result.isSuccess()) {
+    stream_result_ = result;
+  }
+  return result;
+}
+
+// NOLINTNEXTLINE(google-runtime-int)
+data::InstallationResult AktualizrSecondaryFile::receiveRawData(long sequence, RawDataReader& data,
+                                                                uint64_t offset) {
+  auto result = startStreamChunk(sequence, offset);
+  if (!result.isSuccess()) {
+    return result;
+  }
+
+  // recv() goes straight into the buffer that is written and hashed
+  std::vector<uint8_t> buffer(static_cast<size_t>(std::min<uint64_t>(data.remaining(), kRawReceiveBufferSize)));
+  while (data.remaining() > 0) {
+    const ssize_t received = data.read(buffer.data(), buffer.size());
+    if (received <= 0) {
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Failed to receive image data");
+      break;
+    }
+    result = receiveData(buffer.data(), static_cast<size_t>(received));
+    if (!result.isSuccess()) {
+      break;
+    }
+  }
+  if (!result.isSuccess()) {
+    stream_result_ = result;
+  }
+  return result;
+}
+
+data::InstallationResult AktualizrSecondaryFile::startMulticast(uint32_t session, const std::string& group,
+                                                                in_port_t port, size_t block_size) {
+  if (!getPendingTarget().IsValid()) {
+    LOG_ERROR << "Aborting multicast upload; no valid target found.";
+    return data::InstallationResult(data::ResultCode::Numeric::kGeneralError,
+                                    "Aborting multicast upload; no valid target found.");
+  }
+  // a session left over by a Primary that went away
+  multicast_receiver_.reset();
+  try {
+    multicast_receiver_ = std::make_unique<MulticastReceiver>(group, port, session, getPendingTarget().length(),
+                                                              block_size, multicast_path_);
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Could not receive " << getPendingTarget().filename() << " from " << group << ":" << port << ": "
+              << e.what();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    std::string("Could not receive the image from the multicast group: ") + e.what());
+  }
+  LOG_INFO << "Receiving " << getPendingTarget().filename() << " from " << group << ":" << port;
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+int64_t AktualizrSecondaryFile::multicastMissing(uint32_t session, size_t limit,
+                                                 std::vector<uint32_t>* missing) const {
+  if (!multicast_receiver_ || multicast_receiver_->session() != session) {
+    return -1;
+  }
+  *missing = multicast_receiver_->missing(limit);
+  return static_cast<int64_t>(multicast_receiver_->missingCount());
+}
+
+data::InstallationResult AktualizrSecondaryFile::endMulticast(uint32_t session, bool commit) {
+  if (!multicast_receiver_ || multicast_receiver_->session() != session) {
+    LOG_ERROR << "No multicast upload with session " << session;
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "No multicast upload with session " + std::to_string(session));
+  }
+  multicast_receiver_->stop();
+  const uint64_t missing = multicast_receiver_->missingCount();
+  multicast_receiver_.reset();
+
+  data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  if (commit && missing > 0) {
+    LOG_ERROR << "The multicast upload is missing " << missing << " blocks";
+    result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                      "The multicast upload is missing " + std::to_string(missing) + " blocks");
+  } else if (commit) {
+    // the image goes through the update agent like an upload, which hashes it
+    update_agent_->restartReceiving();
+    std::ifstream file(multicast_path_.string(), std::ios::binary);
+    std::vector<uint8_t> buffer(kRawReceiveBufferSize);
+    uint64_t left = getPendingTarget().length();
+    while (left > 0 && result.isSuccess()) {
+      const auto size = static_cast<std::streamsize>(std::min<uint64_t>(buffer.size(), left));
+      if (!file.read(reinterpret_cast<char*>(buffer.data()), size)) {
+        result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                          "Failed to read the image of the multicast upload");
+        break;
+      }
+      result = receiveData(buffer.data(), static_cast<size_t>(size));
+      left -= static_cast<uint64_t>(size);
+    }
+    if (result.isSuccess()) {
+      LOG_INFO << "Received " << getPendingTarget().filename() << " from the multicast group";
+    }
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove(multicast_path_, ec);
+  return result;
+}
+
 bool AktualizrSecondaryFile::isTargetSupported(const Uptane::Target& target) const {
   return update_agent_->isTargetSupported(target);
 }
@@ -83,3 +304,125 @@ MsgHandler::ReturnCode AktualizrSecondaryFile::uploadDataHdlr(Asn1Message& in_ms
 
   return ReturnCode::kOk;
 }
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::uploadStreamHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto req = in_msg.uploadStreamReq();
+  if (req->sequence == 0) {
+    LOG_INFO << "Received the first chunk of a streamed upload; attempting to receive data...";
+  }
+
+  data::InstallationResult result;
+  if (req->data.size < 0) {
+    LOG_ERROR << "The received data buffer size is negative: " << req->data.size;
+    result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Invalid data buffer size");
+  } else if (req->offset != nullptr && *req->offset < 0) {
+    LOG_ERROR << "The received upload offset is negative: " << *req->offset;
+    result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Invalid upload offset");
+  } else {
+    const bool compressed = req->compression != nullptr && *req->compression == AKCompression_deflate;
+    if (req->compression != nullptr && !compressed) {
+      LOG_ERROR << "Unsupported compression of a streamed upload: " << *req->compression;
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Unsupported compression");
+    } else {
+      const uint64_t offset = (req->offset != nullptr) ? static_cast<uint64_t>(*req->offset) : 0;
+      result = receiveStreamData(req->sequence, req->data.buf, static_cast<size_t>(req->data.size),
+                                 ToString(req->runningHash), compressed, offset);
+    }
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_uploadStreamResp).uploadStreamResp();
+  m->sequence = req->sequence;
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::uploadRawHdlr(Asn1Message& in_msg, RawDataReader& data,
+                                                             Asn1Message& out_msg) {
+  auto req = in_msg.uploadRawReq();
+  if (req->sequence == 0) {
+    LOG_INFO << "Received the first piece of a raw upload; attempting to receive data...";
+  }
+
+  // Whatever isn't read after a failure is skipped by the server
+  data::InstallationResult result;
+  if (req->offset != nullptr && *req->offset < 0) {
+    LOG_ERROR << "The received upload offset is negative: " << *req->offset;
+    result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Invalid upload offset");
+  } else {
+    result = receiveRawData(req->sequence, data, (req->offset != nullptr) ? static_cast<uint64_t>(*req->offset) : 0);
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_uploadRawResp).uploadRawResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::uploadResumeHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  (void)in_msg;
+  std::string hex_digest;
+  uint64_t offset = resumableUpload(&hex_digest);
+  // the offset has to fit in an INTEGER
+  if (offset > static_cast<uint64_t>(std::numeric_limits<long>::max())) {  // NOLINT(google-runtime-int)
+    offset = 0;
+  }
+  if (offset > 0) {
+    LOG_INFO << "The upload of " << getPendingTarget().filename() << " can be resumed after " << offset << " bytes";
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_uploadResumeResp).uploadResumeResp();
+  m->offset = static_cast<long>(offset);  // NOLINT(google-runtime-int)
+  SetString(&m->runningHash, (offset > 0) ? hex_digest : "");
+
+  return ReturnCode::kOk;
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::multicastStartHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto req = in_msg.multicastStartReq();
+  data::InstallationResult result;
+  if (req->port <= 0 || req->port > 65535 || req->blockSize <= 0 ||
+      static_cast<uint64_t>(req->blockSize) > Multicast::kMaxBlockSize) {
+    LOG_ERROR << "Invalid multicast port " << req->port << " or block size " << req->blockSize;
+    result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Invalid multicast parameters");
+  } else {
+    result = startMulticast(static_cast<uint32_t>(req->session), ToString(req->group),
+                            static_cast<in_port_t>(req->port), static_cast<size_t>(req->blockSize));
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_multicastStartResp).multicastStartResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::multicastStatusHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto req = in_msg.multicastStatusReq();
+  const auto limit = static_cast<size_t>(std::max(0L, std::min(req->limit, kMaxMulticastMissing)));
+  std::vector<uint32_t> missing;
+  const int64_t missing_count = multicastMissing(static_cast<uint32_t>(req->session), limit, &missing);
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_multicastStatusResp).multicastStatusResp();
+  m->missingCount = static_cast<long>(missing_count);  // NOLINT(google-runtime-int)
+  for (const auto block : missing) {
+    auto* index = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+    *index = static_cast<long>(block);     // NOLINT(google-runtime-int)
+    ASN_SEQUENCE_ADD(&m->missing, index);
+  }
+
+  return ReturnCode::kOk;
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::multicastEndHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto req = in_msg.multicastEndReq();
+  const auto result = endMulticast(static_cast<uint32_t>(req->session), req->commit != 0);
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_multicastEndResp).multicastEndResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
@@ -1,22 +1,73 @@
 #ifndef AKTUALIZR_SECONDARY_FILE_H
 #define AKTUALIZR_SECONDARY_FILE_H
 
+#include <netinet/in.h>
+
 #include <memory>
+#include <vector>
 
 #include "aktualizr_secondary.h"
+#include "utilities/deflate_stream.h"
 
 class FileUpdateAgent;
+class MulticastReceiver;
 
 class AktualizrSecondaryFile : public AktualizrSecondary {
  public:
   static const std::string FileUpdateDefaultFile;
+  // active slot of the partition update agent
+  static const std::string FilePartitionStateFile;
+  // progress of the upload being received, to resume it after a restart
+  static const std::string FileUploadResumeFile;
+  // blocks of a multicast upload, until it is complete
+  static const std::string FileMulticastFile;
 
   explicit AktualizrSecondaryFile(const AktualizrSecondaryConfig& config);
   AktualizrSecondaryFile(const AktualizrSecondaryConfig& config, std::shared_ptr<INvStorage> storage,
                          std::shared_ptr<FileUpdateAgent> update_agent = nullptr);
+  ~AktualizrSecondaryFile() override;
+  AktualizrSecondaryFile(const AktualizrSecondaryFile&) = delete;
+  AktualizrSecondaryFile(AktualizrSecondaryFile&&) = delete;
+  AktualizrSecondaryFile& operator=(const AktualizrSecondaryFile&) = delete;
+  AktualizrSecondaryFile& operator=(AktualizrSecondaryFile&&) = delete;
 
   void initialize() override;
   data::InstallationResult receiveData(const uint8_t* data, size_t size);
+  /**
+   * Receive a chunk of a streamed upload. Chunk 0 starts the image again, or
+   * resumes it after the first `offset` bytes, as given by resumableUpload().
+   * Once a chunk has failed, e.g. because the data doesn't match the running
+   * hash, the rest of the upload is refused. The chunks of a compressed upload
+   * are the pieces of one deflate stream.
+   */
+  // NOLINTNEXTLINE(google-runtime-int)
+  data::InstallationResult receiveStreamData(long sequence, const uint8_t* data, size_t size,
+                                             const std::string& running_hash, bool compressed = false,
+                                             uint64_t offset = 0);
+  /**
+   * Receive a piece of a raw upload from the connection. Pieces are numbered
+   * like the chunks of a streamed upload.
+   */
+  // NOLINTNEXTLINE(google-runtime-int)
+  data::InstallationResult receiveRawData(long sequence, RawDataReader& data, uint64_t offset = 0);
+  /**
+   * The data of the pending Target kept from an interrupted upload: its size,
+   * and its hex digest in `hex_digest`. 0 if the upload has to start again.
+   */
+  uint64_t resumableUpload(std::string* hex_digest);
+  /**
+   * Receive the image of the pending Target from a multicast group, in blocks
+   * of `block_size` bytes, until endMulticast() is called.
+   */
+  data::InstallationResult startMulticast(uint32_t session, const std::string& group, in_port_t port,
+                                          size_t block_size);
+  // the blocks of the session still missing, -1 if there is no such session
+  int64_t multicastMissing(uint32_t session, size_t limit, std::vector<uint32_t>* missing) const;
+  /**
+   * Stop receiving the image from the multicast group. With `commit`, the
+   * image, which must then be complete, is taken as if it had been uploaded.
+   */
+  data::InstallationResult endMulticast(uint32_t session, bool commit);
 
  protected:
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
@@ -26,9 +77,28 @@ class AktualizrSecondaryFile : public AktualizrSecondary {
   void completeInstall() override;
 
   ReturnCode uploadDataHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode uploadStreamHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode uploadRawHdlr(Asn1Message& in_msg, RawDataReader& data, Asn1Message& out_msg);
+  ReturnCode uploadResumeHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode multicastStartHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode multicastStatusHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode multicastEndHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
 
  private:
+  static constexpr uint64_t kRawReceiveBufferSize{1024 * 1024};
+  // largest number of missing multicast blocks reported at once
+  static constexpr long kMaxMulticastMissing{16 * 1024};  // NOLINT(google-runtime-int)
+
+  // NOLINTNEXTLINE(google-runtime-int)
+  data::InstallationResult startStreamChunk(long sequence, uint64_t offset);
+
   std::shared_ptr<FileUpdateAgent> update_agent_;
+  // state of the streamed upload
+  long next_sequence_{0};  // NOLINT(google-runtime-int)
+  data::InstallationResult stream_result_{data::ResultCode::Numeric::kOk, ""};
+  std::unique_ptr<InflateStream> inflater_;
+  const boost::filesystem::path multicast_path_;
+  std::unique_ptr<MulticastReceiver> multicast_receiver_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_FILE_H
@@ -1,13 +1,18 @@
 #include "aktualizr_secondary_ostree.h"
 #include "package_manager/ostreemanager.h"
 #include "update_agent_ostree.h"
+#include "utilities/utils.h"
+
+const std::string AktualizrSecondaryOstree::TreehubCredsFile{"treehub-creds.tar"};
 
 AktualizrSecondaryOstree::AktualizrSecondaryOstree(const AktualizrSecondaryConfig& config)
     : AktualizrSecondaryOstree(config, INvStorage::newStorage(config.storage)) {}
 
 AktualizrSecondaryOstree::AktualizrSecondaryOstree(const AktualizrSecondaryConfig& config,
                                                    const std::shared_ptr<INvStorage>& storage)
-    : AktualizrSecondary(config, storage) {
+    : AktualizrSecondary(config, storage),
+      treehub_creds_path_(config.storage.path / TreehubCredsFile),
+      prefetch_enabled_(config.uptane.ostree_prefetch && config.uptane.verification_type == VerificationType::kFull) {
   registerHandler(AKIpUptaneMes_PR_downloadOstreeRevReq, std::bind(&AktualizrSecondaryOstree::downloadOstreeRev, this,
                                                                    std::placeholders::_1, std::placeholders::_2));
 
@@ -17,6 +22,8 @@ AktualizrSecondaryOstree::AktualizrSecondaryOstree(const AktualizrSecondaryConfi
       std::make_shared<OstreeUpdateAgent>(config.pacman.sysroot, keyMngr(), pack_man, config.uptane.ecu_hardware_id);
 }
 
+AktualizrSecondaryOstree::~AktualizrSecondaryOstree() { cancelPrefetch(); }
+
 void AktualizrSecondaryOstree::initialize() {
   initPendingTargetIfAny();
 
@@ -34,6 +41,7 @@ void AktualizrSecondaryOstree::initialize() {
       LOG_INFO << "Pending update found; attempting to apply it. Target hash: " << pending_target->sha256Hash();
 
       install_res = applyPendingInstall(*pending_target);
+      invalidateManifest();
 
       if (install_res.result_code != data::ResultCode::Numeric::kNeedCompletion) {
         AktualizrSecondary::storage()->saveEcuInstallationResult(serial(), install_res);
@@ -75,9 +83,62 @@ data::InstallationResult AktualizrSecondaryOstree::downloadOstreeUpdate(const st
                                     "Aborting image download; no valid target found.");
   }
 
+  if (prefetch_enabled_) {
+    try {
+      Utils::writeFile(treehub_creds_path_, packed_tls_creds);
+      boost::filesystem::permissions(treehub_creds_path_,
+                                     boost::filesystem::owner_read | boost::filesystem::owner_write);
+    } catch (const std::exception& e) {
+      LOG_WARNING << "Unable to keep the Treehub credentials for the next prefetch: " << e.what();
+    }
+  }
+
+  if (prefetch_.valid()) {
+    const bool prefetched = prefetch_target_.MatchTarget(getPendingTarget());
+    LOG_INFO << "Waiting for the prefetch of the OSTree commit " << prefetch_target_.sha256Hash() << " to finish";
+    auto result = prefetch_.get();
+    prefetch_target_ = Uptane::Target::Unknown();
+    if (prefetched && result.isSuccess()) {
+      return result;
+    }
+  }
+
   return update_agent_->downloadTargetRev(getPendingTarget(), packed_tls_creds);
 }
 
+void AktualizrSecondaryOstree::prefetchTarget(const Uptane::Target& target) {
+  if (!prefetch_enabled_ || !update_agent_->isTargetSupported(target)) {
+    return;
+  }
+  if (prefetch_.valid() && prefetch_target_.MatchTarget(target)) {
+    return;
+  }
+  cancelPrefetch();
+
+  if (!boost::filesystem::exists(treehub_creds_path_)) {
+    LOG_DEBUG << "No Treehub credentials from a previous download, the OSTree commit is not prefetched";
+    return;
+  }
+  const std::string creds = Utils::readFile(treehub_creds_path_);
+
+  LOG_INFO << "Prefetching the OSTree commit " << target.sha256Hash() << " while the metadata is verified";
+  prefetch_token_.reset();
+  prefetch_target_ = target;
+  prefetch_ = std::async(std::launch::async, [this, target, creds]() {
+    return update_agent_->downloadTargetRev(target, creds, &prefetch_token_);
+  });
+}
+
+void AktualizrSecondaryOstree::cancelPrefetch() {
+  if (!prefetch_.valid()) {
+    return;
+  }
+  LOG_INFO << "Cancelling the prefetch of the OSTree commit " << prefetch_target_.sha256Hash();
+  prefetch_token_.setAbort();
+  prefetch_.get();
+  prefetch_target_ = Uptane::Target::Unknown();
+}
+
 bool AktualizrSecondaryOstree::isTargetSupported(const Uptane::Target& target) const {
   return update_agent_->isTargetSupported(target);
 }
@@ -91,6 +152,8 @@ bool AktualizrSecondaryOstree::getInstalledImageInfo(Uptane::InstalledImageInfo&
 }
 
 data::InstallationResult AktualizrSecondaryOstree::installPendingTarget(const Uptane::Target& target) {
+  // the commit is downloaded by a download request, not by a prefetch that is still going on
+  cancelPrefetch();
   return update_agent_->install(target);
 }
 
@@ -1,15 +1,26 @@
 #ifndef AKTUALIZR_SECONDARY_OSTREE_H
 #define AKTUALIZR_SECONDARY_OSTREE_H
 
+#include <future>
+
 #include "aktualizr_secondary.h"
 #include "storage/invstorage.h"
+#include "utilities/flow_control.h"
 
 class OstreeUpdateAgent;
 
 class AktualizrSecondaryOstree : public AktualizrSecondary {
  public:
+  // Treehub credentials of the last download, kept for the next prefetch
+  static const std::string TreehubCredsFile;
+
   explicit AktualizrSecondaryOstree(const AktualizrSecondaryConfig& config);
   AktualizrSecondaryOstree(const AktualizrSecondaryConfig& config, const std::shared_ptr<INvStorage>& storage);
+  ~AktualizrSecondaryOstree() override;
+  AktualizrSecondaryOstree(const AktualizrSecondaryOstree&) = delete;
+  AktualizrSecondaryOstree(AktualizrSecondaryOstree&&) = delete;
+  AktualizrSecondaryOstree& operator=(const AktualizrSecondaryOstree&) = delete;
+  AktualizrSecondaryOstree& operator=(AktualizrSecondaryOstree&&) = delete;
 
   void initialize() override;
   data::InstallationResult downloadOstreeUpdate(const std::string& packed_tls_creds);
@@ -20,6 +31,8 @@ class AktualizrSecondaryOstree : public AktualizrSecondary {
   data::InstallationResult installPendingTarget(const Uptane::Target& target) override;
   data::InstallationResult applyPendingInstall(const Uptane::Target& target) override;
   void completeInstall() override;
+  void prefetchTarget(const Uptane::Target& target) override;
+  void cancelPrefetch() override;
 
  private:
   bool hasPendingUpdate() { return storage()->hasPendingInstall(); }
@@ -27,6 +40,12 @@ class AktualizrSecondaryOstree : public AktualizrSecondary {
   ReturnCode downloadOstreeRev(Asn1Message& in_msg, Asn1Message& out_msg);
 
   std::shared_ptr<OstreeUpdateAgent> update_agent_;
+
+  const boost::filesystem::path treehub_creds_path_;
+  const bool prefetch_enabled_;
+  api::FlowControlToken prefetch_token_;
+  std::future<data::InstallationResult> prefetch_;
+  Uptane::Target prefetch_target_{Uptane::Target::Unknown()};
 };
 
 #endif  // AKTUALIZR_SECONDARY_OSTREE_H
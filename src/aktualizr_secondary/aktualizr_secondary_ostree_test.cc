@@ -102,7 +102,8 @@ class OstreeRootfs {
 
 class AktualizrSecondaryWrapper {
  public:
-  AktualizrSecondaryWrapper(const OstreeRootfs& sysroot, const Treehub& treehub, const VerificationType vtype) {
+  AktualizrSecondaryWrapper(const OstreeRootfs& sysroot, const Treehub& treehub, const VerificationType vtype,
+                            bool ostree_prefetch = false) {
     config_.pacman.type = PACKAGE_MANAGER_OSTREE;
     config_.pacman.os = sysroot.getOSName();
     config_.pacman.sysroot = sysroot.getPath();
@@ -115,6 +116,7 @@ class AktualizrSecondaryWrapper {
     config_.storage.type = StorageType::kSqlite;
 
     config_.uptane.verification_type = vtype;
+    config_.uptane.ostree_prefetch = ostree_prefetch;
 
     storage_ = INvStorage::newStorage(config_.storage);
     secondary_ = std::make_shared<AktualizrSecondaryOstree>(config_, storage_);
@@ -347,6 +349,24 @@ TEST_P(SecondaryOstreeTest, verifyUpdatePositive) {
   needs_reset_ = true;
 }
 
+/* With ostree_prefetch, the commit is pulled as soon as the Director metadata
+ * is verified, with the Treehub credentials of the previous download. */
+TEST_P(SecondaryOstreeTest, prefetch) {
+  if (GetParam() != VerificationType::kFull) {
+    // the prefetch starts from the verified Director metadata
+    return;
+  }
+  AktualizrSecondaryWrapper secondary{*sysroot_, *treehub_, GetParam(), true};
+  const auto metadata = uptane_repo_.addOstreeRev(treehubCurRev(), secondary.hardwareID(), secondary.serial());
+  // no credentials to prefetch with yet
+  EXPECT_TRUE(secondary->putMetadata(metadata).isSuccess());
+  EXPECT_TRUE(secondary->downloadOstreeUpdate(getCredsToSend()).isSuccess());
+
+  EXPECT_TRUE(secondary->putMetadata(metadata).isSuccess());
+  // the prefetch has used the credentials kept from the previous download
+  EXPECT_TRUE(secondary->downloadOstreeUpdate("invalid credentials").isSuccess());
+}
+
 INSTANTIATE_TEST_SUITE_P(SecondaryTestVerificationType, SecondaryOstreeTest,
                          ::testing::Values(VerificationType::kFull, VerificationType::kTuf));
 
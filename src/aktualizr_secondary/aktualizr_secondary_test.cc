@@ -4,7 +4,12 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/string_file.hpp>
 #include <boost/optional/optional_io.hpp>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <future>
+#include <thread>
 
 #include "aktualizr_secondary_file.h"
 #include "crypto/keymanager.h"
@@ -392,6 +397,58 @@ TEST_F(SecondaryTest, TwoImagesAndOneTarget) {
   EXPECT_TRUE(secondary_->putMetadata(metadata).isSuccess());
 }
 
+/* Image repo metadata that has been verified already is trusted when it comes
+ * again, but a change to it is still caught. */
+TEST_F(SecondaryTest, UnchangedImageMetadata) {
+  auto metadata = uptane_repo_.getCurrentMetadata();
+  ASSERT_TRUE(secondary_->putMetadata(metadata).isSuccess());
+  ASSERT_TRUE(secondary_->putMetadata(metadata).isSuccess());
+  EXPECT_TRUE(secondary_->getPendingTarget().IsValid());
+
+  metadata[std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Targets())][10] = 'f';
+  EXPECT_FALSE(secondary_->putMetadata(metadata).isSuccess());
+  // the original metadata is verified again afterwards
+  EXPECT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+}
+
+/* The signed manifest is reused until an installation changes the image. */
+TEST_F(SecondaryTest, CachedManifest) {
+  const auto manifest = secondary_->getManifest();
+  EXPECT_TRUE(manifest.verifySignature(secondary_->publicKey()));
+  // the image is only expected to change through the Secondary
+  Utils::writeFile(secondary_.targetFilepath(), std::string("not installed by the Secondary"));
+  EXPECT_EQ(secondary_->getManifest(), manifest);
+
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  ASSERT_EQ(sendImageFile(), data::ResultCode::Numeric::kOk);
+  ASSERT_TRUE(secondary_->install().isSuccess());
+  EXPECT_NE(secondary_->getManifest(), manifest);
+  verifyTargetAndManifest();
+}
+
+/* While the Secondary is being initialized, the Primary can already find it,
+ * and its other requests wait. */
+TEST_F(SecondaryTest, HeldRequests) {
+  std::promise<void> initialized;
+  secondary_->holdRequestsUntil(initialized.get_future().share());
+
+  auto info_req = Asn1Message::Empty();
+  info_req->present(AKIpUptaneMes_PR_getInfoReq);
+  auto info_resp = Asn1Message::Empty();
+  EXPECT_EQ(secondary_->handleMsg(info_req, info_resp), MsgHandler::kOk);
+  EXPECT_EQ(info_resp->present(), AKIpUptaneMes_PR_getInfoResp);
+
+  auto manifest = std::async(std::launch::async, [this]() {
+    auto manifest_req = Asn1Message::Empty();
+    manifest_req->present(AKIpUptaneMes_PR_manifestReq);
+    auto manifest_resp = Asn1Message::Empty();
+    return secondary_->handleMsg(manifest_req, manifest_resp);
+  });
+  EXPECT_EQ(manifest.wait_for(std::chrono::milliseconds(200)), std::future_status::timeout);
+  initialized.set_value();
+  EXPECT_EQ(manifest.get(), MsgHandler::kOk);
+}
+
 TEST_F(SecondaryTest, IncorrectTargetQuantity) {
   const std::string hwid{secondary_->hwID().ToString()};
   const std::string serial{secondary_->serial().ToString()};
@@ -458,6 +515,131 @@ TEST_F(SecondaryTest, InvalidImageData) {
   EXPECT_FALSE(secondary_->install().isSuccess());
 }
 
+/* Streamed uploads are received in order and stop at the first chunk that
+ * doesn't match the running hash. Chunk 0 starts the image again. */
+TEST_F(SecondaryTest, StreamedUpload) {
+  EXPECT_CALL(update_agent_, install).Times(1);
+  EXPECT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+
+  const std::string image = Utils::readFile(uptane_repo_.getTargetImagePath(default_target_));
+  auto data = [&image](size_t offset) { return reinterpret_cast<const uint8_t*>(&image[offset]); };
+  const size_t chunk = send_buffer_size;
+  ASSERT_GT(image.size(), 2 * chunk);
+
+  // chunks have to come in order
+  EXPECT_TRUE(secondary_->receiveStreamData(0, data(0), chunk, "").isSuccess());
+  EXPECT_FALSE(secondary_->receiveStreamData(2, data(2 * chunk), chunk, "").isSuccess());
+  EXPECT_FALSE(secondary_->receiveStreamData(1, data(chunk), chunk, "").isSuccess());
+
+  // a wrong running hash stops the upload
+  const std::string wrong_hash(64, '0');
+  EXPECT_FALSE(secondary_->receiveStreamData(0, data(0), chunk, wrong_hash).isSuccess());
+  EXPECT_FALSE(secondary_->receiveStreamData(1, data(chunk), chunk, "").isSuccess());
+
+  const Hash::Type hash_type = secondary_->getPendingTarget().hashes()[0].type();
+  long sequence = 0;  // NOLINT(google-runtime-int)
+  for (size_t offset = 0; offset < image.size(); offset += chunk) {
+    const size_t size = std::min(chunk, image.size() - offset);
+    const std::string running_hash = Hash::generate(hash_type, image.substr(0, offset + size)).HashString();
+    EXPECT_TRUE(secondary_->receiveStreamData(sequence++, data(offset), size, running_hash).isSuccess());
+  }
+  EXPECT_TRUE(secondary_->install().isSuccess());
+  verifyTargetAndManifest();
+}
+
+/* Raw uploads take the data that the server already received along with the
+ * request first, and read the rest from the connection. */
+TEST_F(SecondaryTest, RawUpload) {
+  EXPECT_CALL(update_agent_, install).Times(1);
+  EXPECT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+
+  const std::string image = Utils::readFile(uptane_repo_.getTargetImagePath(default_target_));
+  const size_t buffered = 100;
+  ASSERT_GT(image.size(), buffered);
+
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  std::thread writer([&image, &fds]() {
+    const std::string rest = image.substr(buffered);
+    EXPECT_EQ(write(fds[1], rest.data(), rest.size()), static_cast<ssize_t>(rest.size()));
+  });
+
+  DequeueBuffer buffer;
+  std::memcpy(buffer.Tail(), image.data(), buffered);
+  buffer.HaveEnqueued(buffered);
+  RawDataReader data(fds[0], buffer, image.size());
+
+  // pieces have to come in order, like streamed chunks
+  EXPECT_FALSE(secondary_->receiveRawData(1, data).isSuccess());
+  EXPECT_EQ(data.remaining(), image.size());
+  EXPECT_TRUE(secondary_->receiveRawData(0, data).isSuccess());
+  EXPECT_EQ(data.remaining(), 0);
+  writer.join();
+  close(fds[0]);
+  close(fds[1]);
+
+  EXPECT_TRUE(secondary_->install().isSuccess());
+  verifyTargetAndManifest();
+}
+
+/* An interrupted upload is resumed after the data the Secondary has kept,
+ * and only from there. */
+TEST_F(SecondaryTest, ResumedUpload) {
+  EXPECT_CALL(update_agent_, install).Times(1);
+  EXPECT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+
+  const std::string image = Utils::readFile(uptane_repo_.getTargetImagePath(default_target_));
+  auto data = [&image](size_t offset) { return reinterpret_cast<const uint8_t*>(&image[offset]); };
+  const size_t chunk = send_buffer_size;
+  ASSERT_GT(image.size(), 2 * chunk);
+  const Hash::Type hash_type = secondary_->getPendingTarget().hashes()[0].type();
+
+  std::string hex_digest;
+  EXPECT_EQ(secondary_->resumableUpload(&hex_digest), 0);
+  EXPECT_TRUE(secondary_->receiveStreamData(0, data(0), chunk, "").isSuccess());
+  ASSERT_EQ(secondary_->resumableUpload(&hex_digest), chunk);
+  EXPECT_EQ(Hash(hash_type, hex_digest), Hash::generate(hash_type, image.substr(0, chunk)));
+
+  EXPECT_FALSE(secondary_->receiveStreamData(0, data(2 * chunk), chunk, "", false, 2 * chunk).isSuccess());
+  const std::string running_hash = Hash::generate(hash_type, image).HashString();
+  EXPECT_TRUE(
+      secondary_->receiveStreamData(0, data(chunk), image.size() - chunk, running_hash, false, chunk).isSuccess());
+  EXPECT_TRUE(secondary_->install().isSuccess());
+  verifyTargetAndManifest();
+  EXPECT_EQ(secondary_->resumableUpload(&hex_digest), 0);
+}
+
+/* The data synced to the disk can be resumed after a restart, for the same
+ * Target only. */
+TEST(FileUpdateAgent, ResumeAfterRestart) {
+  TemporaryDirectory temp_dir;
+  const std::string image(3000, 'x');
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = Hash::generate(Hash::Type::kSha256, image).HashString();
+  target_json["length"] = static_cast<Json::UInt64>(image.size());
+  const Uptane::Target target("image", target_json);
+  target_json["hashes"]["sha256"] = Hash::generate(Hash::Type::kSha256, image + "y").HashString();
+  const Uptane::Target other_target("image", target_json);
+
+  {
+    FileUpdateAgent agent(temp_dir / "firmware.txt", "");
+    agent.setResumeFile(temp_dir / "upload.json");
+    ASSERT_TRUE(agent.receiveData(target, reinterpret_cast<const uint8_t*>(image.data()), image.size()).isSuccess());
+  }
+
+  FileUpdateAgent agent(temp_dir / "firmware.txt", "");
+  agent.setResumeFile(temp_dir / "upload.json");
+  std::string hex_digest;
+  EXPECT_EQ(agent.resumableData(other_target, &hex_digest), 0);
+  ASSERT_EQ(agent.resumableData(target, &hex_digest), image.size());
+  EXPECT_EQ(Hash(Hash::Type::kSha256, hex_digest), Hash::generate(Hash::Type::kSha256, image));
+  EXPECT_FALSE(agent.resumeReceiving(target, 10));
+  EXPECT_TRUE(agent.resumeReceiving(target, image.size()));
+  EXPECT_TRUE(agent.install(target).isSuccess());
+  EXPECT_EQ(Utils::readFile(temp_dir / "firmware.txt"), image);
+  EXPECT_FALSE(boost::filesystem::exists(temp_dir / "upload.json"));
+}
+
 class SecondaryTestTuf
     : public SecondaryTest,
       public ::testing::WithParamInterface<std::pair<std::vector<std::string>, boost::optional<std::string>>> {
@@ -523,6 +705,25 @@ INSTANTIATE_TEST_SUITE_P(SecondaryTestTufVersions, SecondaryTestTuf,
                                            std::make_pair(std::vector<std::string>{"invalid1", "invalid2"},
                                                           boost::none)));
 
+class SecondaryTestTufUpdate : public SecondaryTest {
+ public:
+  SecondaryTestTufUpdate() : SecondaryTest(VerificationType::kTuf, false){};
+};
+
+/* Only the Targets for the hardware ID of the Secondary are candidates, and
+ * they are looked up again once the Image repo Targets change. */
+TEST_F(SecondaryTestTufUpdate, NewTargets) {
+  const std::string hwid{secondary_->hwID().ToString()};
+  uptane_repo_.addCustomImageMetadata("v1", hwid, "1");
+  uptane_repo_.addCustomImageMetadata("v5-other", "other-hwid", "5");
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  EXPECT_EQ(secondary_->getPendingTarget().filename(), "v1");
+
+  uptane_repo_.addCustomImageMetadata("v2", hwid, "2");
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  EXPECT_EQ(secondary_->getPendingTarget().filename(), "v2");
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,198 @@
+#include "delta_patch.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <archive.h>
+#include <boost/algorithm/string.hpp>
+
+#include "crypto/crypto.h"
+#include "utilities/utils.h"
+
+static constexpr char kBsdiffMagic[] = "ENDSLEY/BSDIFF43";
+static constexpr size_t kBsdiffMagicSize = sizeof(kBsdiffMagic) - 1;
+static constexpr size_t kChunkSize = 64 * 1024;
+
+boost::optional<DeltaTarget> DeltaTarget::fromTarget(const Uptane::Target& target) {
+  const Json::Value custom = target.custom_data();
+  if (!custom.isObject() || !custom.isMember("delta")) {
+    return boost::none;
+  }
+  const Json::Value& delta = custom["delta"];
+  if (!delta.isObject() || !delta["base_sha256"].isString() || !delta["sha256"].isString() ||
+      !delta["length"].isIntegral() || delta["length"].asInt64() < 0) {
+    throw std::runtime_error("Malformed delta description in Target " + target.filename());
+  }
+  DeltaTarget result;
+  result.base_sha256 = boost::algorithm::to_lower_copy(delta["base_sha256"].asString());
+  result.sha256 = boost::algorithm::to_lower_copy(delta["sha256"].asString());
+  result.length = delta["length"].asUInt64();
+  return result;
+}
+
+// 64-bit sign and magnitude integer, least significant byte first
+static int64_t offtin(const uint8_t* buf) {
+  int64_t y = buf[7] & 0x7F;
+  for (int i = 6; i >= 0; --i) {
+    y = y * 256 + buf[i];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  }
+  if ((buf[7] & 0x80) != 0) {
+    y = -y;
+  }
+  return y;
+}
+
+namespace {
+
+struct PatchStream {
+  std::ifstream file;
+  std::array<char, kChunkSize> buffer{};
+};
+
+ssize_t readPatch(struct archive* a, void* client_data, const void** buff) {
+  auto* s = reinterpret_cast<PatchStream*>(client_data);
+  s->file.read(s->buffer.data(), static_cast<std::streamsize>(s->buffer.size()));
+  if (s->file.bad()) {
+    archive_set_error(a, -1, "unable to read the patch");
+    return -1;
+  }
+  *buff = s->buffer.data();
+  return s->file.gcount();
+}
+
+// fill `buf` from the decompressed patch, which must not end before that
+void readPatchData(struct archive* a, uint8_t* buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const ssize_t r = archive_read_data(a, buf + done, len - done);
+    if (r < 0) {
+      throw std::runtime_error(std::string("Failed to decompress the patch: ") + archive_error_string(a));
+    }
+    if (r == 0) {
+      throw std::runtime_error("The patch is truncated");
+    }
+    done += static_cast<size_t>(r);
+  }
+}
+
+// read `len` bytes of the base image at `pos`; whatever is out of the image
+// reads as zeros, as in bspatch
+void readBase(std::ifstream& base, int64_t base_size, int64_t pos, uint8_t* buf, size_t len) {
+  std::fill_n(buf, len, 0);
+  const int64_t begin = std::max<int64_t>(pos, 0);
+  const int64_t end = std::min<int64_t>(pos + static_cast<int64_t>(len), base_size);
+  if (begin >= end) {
+    return;
+  }
+  base.clear();
+  base.seekg(begin);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  base.read(reinterpret_cast<char*>(buf + (begin - pos)), end - begin);
+  if (!base) {
+    throw std::runtime_error("Failed to read the installed image");
+  }
+}
+
+}  // namespace
+
+uint64_t DeltaPatch::apply(const boost::filesystem::path& base, const boost::filesystem::path& patch,
+                           const boost::filesystem::path& out, MultiPartHasher& hasher,
+                           const ProgressCb& progress) {
+  PatchStream patch_stream;
+  patch_stream.file.open(patch.c_str(), std::ios::binary);
+  std::array<uint8_t, kBsdiffMagicSize + 8> header{};
+  patch_stream.file.read(reinterpret_cast<char*>(header.data()), header.size());
+  if (!patch_stream.file || std::memcmp(header.data(), kBsdiffMagic, kBsdiffMagicSize) != 0) {
+    throw std::runtime_error("Not a bsdiff 4.3 patch: " + patch.string());
+  }
+  const int64_t new_size = offtin(&header[kBsdiffMagicSize]);
+  if (new_size < 0) {
+    throw std::runtime_error("Invalid image size in the patch");
+  }
+
+  std::ifstream base_file(base.c_str(), std::ios::binary);
+  if (!base_file) {
+    throw std::runtime_error("Failed to open the installed image " + base.string());
+  }
+  const auto base_size = static_cast<int64_t>(boost::filesystem::file_size(base));
+
+  std::ofstream out_file(out.c_str(), std::ios::binary | std::ios::trunc);
+  if (!out_file) {
+    throw std::runtime_error("Failed to open " + out.string());
+  }
+
+  StructGuardInt<struct archive> a(archive_read_new(), archive_read_free);
+  if (a == nullptr) {
+    throw std::runtime_error("Failed to initialize the patch decompression");
+  }
+  archive_read_support_filter_bzip2(a.get());
+  archive_read_support_format_raw(a.get());
+  if (archive_read_open(a.get(), &patch_stream, nullptr, readPatch, nullptr) != ARCHIVE_OK) {
+    throw std::runtime_error(std::string("Failed to decompress the patch: ") + archive_error_string(a.get()));
+  }
+  struct archive_entry* entry = nullptr;
+  if (archive_read_next_header(a.get(), &entry) != ARCHIVE_OK) {
+    throw std::runtime_error(std::string("Failed to decompress the patch: ") + archive_error_string(a.get()));
+  }
+
+  std::vector<uint8_t> diff(kChunkSize);
+  std::vector<uint8_t> old(kChunkSize);
+  auto write = [&out_file, &hasher](const uint8_t* data, size_t size) {
+    hasher.update(data, size);
+    out_file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    if (!out_file) {
+      throw std::runtime_error("Failed to write the patched image");
+    }
+  };
+
+  int64_t old_pos = 0;
+  int64_t new_pos = 0;
+  while (new_pos < new_size) {
+    // add `diff_len` bytes to the base image, copy `extra_len` new bytes, and
+    // move in the base image by `seek`
+    std::array<uint8_t, 24> control{};
+    readPatchData(a.get(), control.data(), control.size());
+    const int64_t diff_len = offtin(&control[0]);
+    const int64_t extra_len = offtin(&control[8]);
+    const int64_t seek = offtin(&control[16]);
+    if (diff_len < 0 || extra_len < 0 || diff_len > new_size - new_pos || extra_len > new_size - new_pos - diff_len) {
+      throw std::runtime_error("Corrupted patch");
+    }
+
+    for (int64_t done = 0; done < diff_len;) {
+      const auto len = static_cast<size_t>(std::min(diff_len - done, static_cast<int64_t>(kChunkSize)));
+      readPatchData(a.get(), diff.data(), len);
+      readBase(base_file, base_size, old_pos + done, old.data(), len);
+      for (size_t i = 0; i < len; ++i) {
+        diff[i] = static_cast<uint8_t>(diff[i] + old[i]);
+      }
+      write(diff.data(), len);
+      done += static_cast<int64_t>(len);
+    }
+    new_pos += diff_len;
+    old_pos += diff_len;
+
+    for (int64_t done = 0; done < extra_len;) {
+      const auto len = static_cast<size_t>(std::min(extra_len - done, static_cast<int64_t>(kChunkSize)));
+      readPatchData(a.get(), diff.data(), len);
+      write(diff.data(), len);
+      done += static_cast<int64_t>(len);
+    }
+    new_pos += extra_len;
+    old_pos += seek;
+    if (progress) {
+      progress(static_cast<uint64_t>(new_pos), static_cast<uint64_t>(new_size));
+    }
+  }
+
+  out_file.flush();
+  if (!out_file) {
+    throw std::runtime_error("Failed to write the patched image");
+  }
+  return static_cast<uint64_t>(new_size);
+}
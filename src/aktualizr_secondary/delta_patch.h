@@ -0,0 +1,59 @@
+#ifndef AKTUALIZR_SECONDARY_DELTA_PATCH_H
+#define AKTUALIZR_SECONDARY_DELTA_PATCH_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "libaktualizr/types.h"
+
+class MultiPartHasher;
+
+/**
+ * What a delta Target turns the installed image into, from the `delta` object
+ * of its custom metadata:
+ *
+ *     "delta": {"base_sha256": "...", "sha256": "...", "length": 1234}
+ *
+ * The hashes and length of the Target itself are those of the patch, so that
+ * it is fetched and verified like any other image; `base_sha256` is the image
+ * the patch applies to, `sha256` and `length` describe the result.
+ */
+struct DeltaTarget {
+  std::string base_sha256;
+  std::string sha256;
+  uint64_t length{0};
+
+  /**
+   * @return none if the Target is a full image.
+   * @throws std::runtime_error if its delta object is malformed.
+   */
+  static boost::optional<DeltaTarget> fromTarget(const Uptane::Target& target);
+};
+
+/**
+ * Patches in the bsdiff 4.3 format of Matthew Endsley's bsdiff library
+ * ("ENDSLEY/BSDIFF43" header and a single bzip2 stream), which can be applied
+ * in one pass over the patch.
+ */
+class DeltaPatch {
+ public:
+  /**
+   * Write the result of applying `patch` to `base` into `out`, hashing it on
+   * the way. The base image is only read where the patch refers to it.
+   * `progress` is called with the size written so far and the size of the
+   * result, if given.
+   * @return the size of the result.
+   * @throws std::runtime_error if a file can't be read or written, or if the
+   * patch is malformed.
+   */
+  using ProgressCb = std::function<void(uint64_t written, uint64_t total)>;
+  static uint64_t apply(const boost::filesystem::path& base, const boost::filesystem::path& patch,
+                        const boost::filesystem::path& out, MultiPartHasher& hasher,
+                        const ProgressCb& progress = nullptr);
+};
+
+#endif  // AKTUALIZR_SECONDARY_DELTA_PATCH_H
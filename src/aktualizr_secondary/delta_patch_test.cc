@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "delta_patch.h"
+#include "update_agent_file.h"
+#include "utilities/utils.h"
+
+static std::string offtout(int64_t x) {
+  uint64_t y = static_cast<uint64_t>(x < 0 ? -x : x);
+  std::string buf(8, '\0');
+  for (auto& c : buf) {
+    c = static_cast<char>(y & 0xFFU);
+    y >>= 8;
+  }
+  if (x < 0) {
+    buf[7] = static_cast<char>(buf[7] | 0x80);
+  }
+  return buf;
+}
+
+static std::string bzip2(const std::string& data) {
+  StructGuardInt<struct archive> a(archive_write_new(), archive_write_free);
+  archive_write_add_filter_bzip2(a.get());
+  archive_write_set_format_raw(a.get());
+  archive_write_set_bytes_in_last_block(a.get(), 1);
+  std::string buf(data.size() + 4096, '\0');
+  size_t used = 0;
+  EXPECT_EQ(archive_write_open_memory(a.get(), &buf[0], buf.size(), &used), ARCHIVE_OK);
+  StructGuard<struct archive_entry> entry(archive_entry_new(), archive_entry_free);
+  archive_entry_set_filetype(entry.get(), AE_IFREG);
+  archive_entry_set_size(entry.get(), static_cast<int64_t>(data.size()));
+  EXPECT_EQ(archive_write_header(a.get(), entry.get()), ARCHIVE_OK);
+  EXPECT_EQ(archive_write_data(a.get(), data.data(), data.size()), static_cast<ssize_t>(data.size()));
+  EXPECT_EQ(archive_write_close(a.get()), ARCHIVE_OK);
+  buf.resize(used);
+  return buf;
+}
+
+struct Control {
+  std::string diff;
+  std::string extra;
+  int64_t seek;
+};
+
+// diff bytes are given as they are added to the base image
+static std::string makePatch(int64_t new_size, const std::vector<Control>& controls) {
+  std::string body;
+  for (const auto& control : controls) {
+    body += offtout(static_cast<int64_t>(control.diff.size())) + offtout(static_cast<int64_t>(control.extra.size())) +
+            offtout(control.seek) + control.diff + control.extra;
+  }
+  return "ENDSLEY/BSDIFF43" + offtout(new_size) + bzip2(body);
+}
+
+// the diff bytes that turn `from` into `to`
+static std::string diffBytes(const std::string& from, const std::string& to) {
+  std::string diff(to.size(), '\0');
+  for (size_t i = 0; i < to.size(); ++i) {
+    const int byte = i < from.size() ? static_cast<unsigned char>(from[i]) : 0;
+    diff[i] = static_cast<char>(static_cast<unsigned char>(to[i]) - byte);
+  }
+  return diff;
+}
+
+static Uptane::Target makeTarget(const std::string& name, const std::string& image) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = Hash::generate(Hash::Type::kSha256, image).HashString();
+  target_json["length"] = static_cast<Json::UInt64>(image.size());
+  return Uptane::Target(name, target_json);
+}
+
+static Uptane::Target makeDeltaTarget(const std::string& name, const std::string& patch, const std::string& base,
+                                      const std::string& image) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = Hash::generate(Hash::Type::kSha256, patch).HashString();
+  target_json["length"] = static_cast<Json::UInt64>(patch.size());
+  target_json["custom"]["delta"]["base_sha256"] = Hash::generate(Hash::Type::kSha256, base).HashString();
+  target_json["custom"]["delta"]["sha256"] = Hash::generate(Hash::Type::kSha256, image).HashString();
+  target_json["custom"]["delta"]["length"] = static_cast<Json::UInt64>(image.size());
+  return Uptane::Target(name, target_json);
+}
+
+class DeltaPatchTest : public ::testing::Test {
+ protected:
+  DeltaPatchTest() {
+    // the new image changes the start of the base, adds a new part, and takes
+    // the end of the base from further back
+    new_image_ = "HELLO  " + std::string("brand new part") + base_.substr(10);
+    patch_ = makePatch(static_cast<int64_t>(new_image_.size()),
+                       {{diffBytes(base_.substr(0, 7), "HELLO  "), "brand new part", 3},
+                        {diffBytes(base_.substr(10), base_.substr(10)), "", 0}});
+  }
+
+  TemporaryDirectory temp_dir_;
+  const std::string base_{"hello world, this is the installed image"};
+  std::string new_image_;
+  std::string patch_;
+};
+
+/* A patch rebuilds the new image out of the base image. */
+TEST_F(DeltaPatchTest, Apply) {
+  Utils::writeFile(temp_dir_ / "base", base_);
+  Utils::writeFile(temp_dir_ / "patch", patch_);
+  auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+  std::vector<uint64_t> written;
+  EXPECT_EQ(DeltaPatch::apply(temp_dir_ / "base", temp_dir_ / "patch", temp_dir_ / "out", *hasher,
+                              [this, &written](uint64_t done, uint64_t total) {
+                                EXPECT_EQ(total, new_image_.size());
+                                written.push_back(done);
+                              }),
+            new_image_.size());
+  EXPECT_EQ(Utils::readFile(temp_dir_ / "out"), new_image_);
+  EXPECT_EQ(hasher->getHash(), Hash::generate(Hash::Type::kSha256, new_image_));
+  // the progress is reported after each control block
+  EXPECT_EQ(written, (std::vector<uint64_t>{21, new_image_.size()}));
+}
+
+/* Malformed patches are rejected. */
+TEST_F(DeltaPatchTest, Malformed) {
+  Utils::writeFile(temp_dir_ / "base", base_);
+  auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+
+  Utils::writeFile(temp_dir_ / "patch", std::string("BSDIFF40") + patch_.substr(8));
+  EXPECT_THROW(DeltaPatch::apply(temp_dir_ / "base", temp_dir_ / "patch", temp_dir_ / "out", *hasher),
+               std::runtime_error);
+
+  // the patch claims more data than it has
+  Utils::writeFile(temp_dir_ / "patch", makePatch(100, {{"", "short", 0}}));
+  EXPECT_THROW(DeltaPatch::apply(temp_dir_ / "base", temp_dir_ / "patch", temp_dir_ / "out", *hasher),
+               std::runtime_error);
+
+  // control data going past the new image
+  Utils::writeFile(temp_dir_ / "patch", makePatch(2, {{"", "too long", 0}}));
+  EXPECT_THROW(DeltaPatch::apply(temp_dir_ / "base", temp_dir_ / "patch", temp_dir_ / "out", *hasher),
+               std::runtime_error);
+}
+
+/* FileUpdateAgent installs a delta Target over the image it applies to, and
+ * reports the resulting image. */
+TEST_F(DeltaPatchTest, FileUpdateAgent) {
+  FileUpdateAgent agent(temp_dir_ / "image", "base");
+  const auto base_target = makeTarget("base", base_);
+  ASSERT_TRUE(agent.receiveData(base_target, reinterpret_cast<const uint8_t*>(base_.data()), base_.size()).isSuccess());
+  ASSERT_TRUE(agent.install(base_target).isSuccess());
+
+  std::vector<unsigned int> progress;
+  agent.setInstallProgressCb([&progress](unsigned int p) { progress.push_back(p); });
+  const auto target = makeDeltaTarget("new", patch_, base_, new_image_);
+  ASSERT_TRUE(agent.isTargetSupported(target));
+  ASSERT_TRUE(agent.receiveData(target, reinterpret_cast<const uint8_t*>(patch_.data()), patch_.size()).isSuccess());
+  ASSERT_TRUE(agent.install(target).isSuccess());
+  EXPECT_EQ(Utils::readFile(temp_dir_ / "image"), new_image_);
+  ASSERT_FALSE(progress.empty());
+  EXPECT_TRUE(std::is_sorted(progress.begin(), progress.end()));
+  EXPECT_EQ(progress.back(), 99U);
+
+  Uptane::InstalledImageInfo info;
+  ASSERT_TRUE(agent.getInstalledImageInfo(info));
+  EXPECT_EQ(info.name, "new");
+  EXPECT_EQ(info.len, new_image_.size());
+
+  // the same patch doesn't apply to the new image
+  ASSERT_TRUE(agent.receiveData(target, reinterpret_cast<const uint8_t*>(patch_.data()), patch_.size()).isSuccess());
+  const auto result = agent.install(target);
+  EXPECT_EQ(result.result_code.num_code, data::ResultCode::Numeric::kInstallFailed);
+  EXPECT_EQ(Utils::readFile(temp_dir_ / "image"), new_image_);
+}
+
+/* A delta that doesn't produce the image of its Target is not installed. */
+TEST_F(DeltaPatchTest, FileUpdateAgentBadResult) {
+  Utils::writeFile(temp_dir_ / "image", base_);
+  FileUpdateAgent agent(temp_dir_ / "image", "base");
+
+  const auto target = makeDeltaTarget("new", patch_, base_, new_image_ + "x");
+  ASSERT_TRUE(agent.receiveData(target, reinterpret_cast<const uint8_t*>(patch_.data()), patch_.size()).isSuccess());
+  const auto result = agent.install(target);
+  EXPECT_EQ(result.result_code.num_code, data::ResultCode::Numeric::kInstallFailed);
+  EXPECT_EQ(Utils::readFile(temp_dir_ / "image"), base_);
+  EXPECT_FALSE(boost::filesystem::exists(temp_dir_ / "image.newtarget.patched"));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
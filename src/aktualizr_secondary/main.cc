@@ -1,11 +1,14 @@
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
+#include <atomic>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <thread>
 
 #include "aktualizr_secondary.h"
 #include "aktualizr_secondary_config.h"
+#include "asn1/asn1_transport.h"
 #include "utilities/aktualizr_version.h"
 #include "utilities/utils.h"
 
@@ -106,14 +109,40 @@ int main(int argc, char *argv[]) {
     if (!secondary) {
       throw std::runtime_error("Failed to create IP Secondary of the specified type: " + config.pacman.type);
     }
-    secondary->initialize();
-
-    SecondaryTcpServer tcp_server(*secondary, config.network.primary_ip, config.network.primary_port,
-                                  config.network.port, config.uptane.force_install_completion);
+    std::unique_ptr<SecondaryTcpServer> tcp_server;
+    if (config.network.socket_path.empty()) {
+      tcp_server = std::make_unique<SecondaryTcpServer>(*secondary, config.network.primary_ip,
+                                                        config.network.primary_port, config.network.port,
+                                                        config.uptane.force_install_completion,
+                                                        config.network.max_connections);
+    } else {
+      tcp_server = std::make_unique<SecondaryTcpServer>(*secondary, UnixTransport(config.network.socket_path),
+                                                        config.uptane.force_install_completion,
+                                                        config.network.max_connections);
+    }
 
-    tcp_server.run();
+    // The stored metadata is verified in the background, so that the Primary
+    // can reach the Secondary right away; the requests that need it wait.
+    std::atomic<bool> initialization_failed{false};
+    std::shared_future<void> initialized =
+        std::async(std::launch::async, [&secondary, &tcp_server, &initialization_failed]() {
+          try {
+            secondary->initialize();
+          } catch (const std::exception &exc) {
+            LOG_ERROR << "Initialization failed: " << exc.what();
+            initialization_failed = true;
+            tcp_server->stop();
+          }
+        }).share();
+    secondary->holdRequestsUntil(initialized);
+
+    tcp_server->run();
+    initialized.wait();
+    if (initialization_failed) {
+      throw std::runtime_error("Failed to initialize the IP Secondary");
+    }
 
-    if (tcp_server.exit_reason() == SecondaryTcpServer::ExitReason::kRebootNeeded) {
+    if (tcp_server->exit_reason() == SecondaryTcpServer::ExitReason::kRebootNeeded) {
       secondary->completeInstall();
     }
 
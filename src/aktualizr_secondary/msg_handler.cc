@@ -1,20 +1,192 @@
 #include "msg_handler.h"
 
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
 #include "logging/logging.h"
 
-void MsgDispatcher::clearHandlers() { handler_map_.clear(); }
+ssize_t RawDataReader::read(uint8_t* dest, size_t size) {
+  if (remaining_ == 0) {
+    return 0;
+  }
+  size = static_cast<size_t>(std::min<uint64_t>(size, remaining_));
+  if (file_ != nullptr) {
+    ssize_t res = 0;
+    do {
+      res = pread(**file_, dest, size, static_cast<off_t>(file_offset_));
+    } while (res < 0 && errno == EINTR);
+    if (res <= 0) {
+      LOG_ERROR << "Failed to read raw data from the file passed by Primary: "
+                << (res < 0 ? std::strerror(errno) : "end of file");
+      return -1;
+    }
+    file_offset_ += static_cast<uint64_t>(res);
+    remaining_ -= static_cast<uint64_t>(res);
+    return res;
+  }
+  if (buffer_->Size() > 0) {
+    size = std::min(size, buffer_->Size());
+    std::memcpy(dest, buffer_->Head(), size);
+    buffer_->Consume(size);
+    remaining_ -= size;
+    return static_cast<ssize_t>(size);
+  }
+
+  ssize_t received = 0;
+  do {
+    received = recv(socket_, dest, size, 0);
+  } while (received < 0 && errno == EINTR);
+  if (received <= 0) {
+    LOG_ERROR << "Failed to read raw data from Primary: "
+              << (received < 0 ? std::strerror(errno) : "connection closed");
+    return -1;
+  }
+  remaining_ -= static_cast<uint64_t>(received);
+  return received;
+}
+
+bool RawDataReader::discard() {
+  // nothing of a passed file is on the connection
+  if (file_ != nullptr) {
+    remaining_ = 0;
+    return true;
+  }
+  std::vector<uint8_t> scratch(static_cast<size_t>(std::min<uint64_t>(remaining_, 64 * 1024)));
+  while (remaining_ > 0) {
+    if (read(scratch.data(), scratch.size()) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const RequestMetrics& RequestMetrics::get(AKIpUptaneMes_PR msg_id) {
+  static std::mutex mutex;
+  static std::map<AKIpUptaneMes_PR, std::unique_ptr<RequestMetrics>> by_type;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& entry = by_type[msg_id];
+  if (entry == nullptr) {
+    static const std::string prefix = "AKIpUptaneMes_PR_";
+    std::string message = Asn1Message::name(msg_id);
+    if (message.compare(0, prefix.size(), prefix) == 0) {
+      message.erase(0, prefix.size());
+    }
+    auto& registry = metrics::Registry::instance();
+    const char* help = "Time taken by the requests from the Primary, by phase";
+    entry.reset(new RequestMetrics{
+        registry.counter("aktualizr_secondary_requests_total", "Requests from the Primary", {{"message", message}}),
+        registry.histogram("aktualizr_secondary_request_seconds", help, {{"message", message}, {"phase", "decode"}}),
+        registry.histogram("aktualizr_secondary_request_seconds", help, {{"message", message}, {"phase", "handle"}}),
+        registry.histogram("aktualizr_secondary_request_seconds", help, {{"message", message}, {"phase", "send"}})});
+  }
+  return *entry;
+}
+
+void MsgDispatcher::clearHandlers() {
+  std::lock_guard<std::mutex> lock(handler_map_mutex_);
+  handler_map_.clear();
+  raw_handler_map_.clear();
+}
 
-void MsgDispatcher::registerHandler(AKIpUptaneMes_PR msg_id, Handler handler) {
-  handler_map_[msg_id] = std::move(handler);
+void MsgDispatcher::registerHandler(AKIpUptaneMes_PR msg_id, Handler handler, Access access) {
+  registerNotifyingHandler(
+      msg_id,
+      [handler](Asn1Message& in_msg, const Notifier& notify, Asn1Message& out_msg) {
+        (void)notify;
+        return handler(in_msg, out_msg);
+      },
+      access);
+}
+
+void MsgDispatcher::registerNotifyingHandler(AKIpUptaneMes_PR msg_id, NotifyingHandler handler, Access access) {
+  std::lock_guard<std::mutex> lock(handler_map_mutex_);
+  handler_map_[msg_id] = Entry{std::move(handler), access};
+}
+
+void MsgDispatcher::registerRawHandler(AKIpUptaneMes_PR msg_id, RawHandler handler) {
+  std::lock_guard<std::mutex> lock(handler_map_mutex_);
+  raw_handler_map_[msg_id] = std::move(handler);
+}
+
+void MsgDispatcher::holdRequestsUntil(std::shared_future<void> ready) {
+  std::lock_guard<std::mutex> lock(handler_map_mutex_);
+  ready_ = std::move(ready);
+}
+
+MsgHandler::ReturnCode MsgDispatcher::handleRawMsg(const Asn1Message::Ptr& in_msg, RawDataReader& data,
+                                                   Asn1Message::Ptr& out_msg) {
+  RawHandler handler;
+  std::shared_future<void> ready;
+  {
+    std::lock_guard<std::mutex> lock(handler_map_mutex_);
+    auto find_res_it = raw_handler_map_.find(in_msg->present());
+    if (find_res_it == raw_handler_map_.end()) {
+      return MsgHandler::kUnkownMsg;
+    }
+    handler = find_res_it->second;
+    ready = ready_;
+  }
+  if (ready.valid()) {
+    ready.wait();
+  }
+  const RequestMetrics& request_metrics = RequestMetrics::get(in_msg->present());
+  request_metrics.requests.add();
+  std::unique_lock<std::shared_mutex> state_lock(state_mutex_);
+  MsgHandler::ReturnCode handle_status_code;
+  {
+    metrics::ScopedTimer timer(request_metrics.handle);
+    handle_status_code = handler(*in_msg, data, *out_msg);
+  }
+  LOG_TRACE << "Request handler returned a response: " << out_msg->toStr();
+  last_msg_ = in_msg->present();
+  return handle_status_code;
 }
 
 MsgHandler::ReturnCode MsgDispatcher::handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) {
-  auto find_res_it = handler_map_.find(in_msg->present());
-  if (find_res_it == handler_map_.end()) {
-    return MsgHandler::kUnkownMsg;
+  return handleMsgWithNotifier(in_msg, Notifier(), out_msg);
+}
+
+MsgHandler::ReturnCode MsgDispatcher::handleMsgWithNotifier(const Asn1Message::Ptr& in_msg, const Notifier& notify,
+                                                            Asn1Message::Ptr& out_msg) {
+  Entry entry;
+  std::shared_future<void> ready;
+  {
+    // copied, so that handlers can be registered again while a request is handled
+    std::lock_guard<std::mutex> lock(handler_map_mutex_);
+    auto find_res_it = handler_map_.find(in_msg->present());
+    if (find_res_it == handler_map_.end()) {
+      return MsgHandler::kUnkownMsg;
+    }
+    entry = find_res_it->second;
+    ready = ready_;
+  }
+  if (entry.access != Access::kStateless && ready.valid()) {
+    ready.wait();
   }
   LOG_TRACE << "Found a handler for the request, processing it...";
-  auto handle_status_code = find_res_it->second(*in_msg, *out_msg);
+  const RequestMetrics& request_metrics = RequestMetrics::get(in_msg->present());
+  request_metrics.requests.add();
+  ReturnCode handle_status_code{kUnkownMsg};
+  if (entry.access == Access::kStateless) {
+    metrics::ScopedTimer timer(request_metrics.handle);
+    handle_status_code = entry.handler(*in_msg, notify, *out_msg);
+  } else if (entry.access == Access::kRead) {
+    std::shared_lock<std::shared_mutex> state_lock(state_mutex_);
+    metrics::ScopedTimer timer(request_metrics.handle);
+    handle_status_code = entry.handler(*in_msg, notify, *out_msg);
+  } else {
+    std::unique_lock<std::shared_mutex> state_lock(state_mutex_);
+    metrics::ScopedTimer timer(request_metrics.handle);
+    handle_status_code = entry.handler(*in_msg, notify, *out_msg);
+  }
   LOG_TRACE << "Request handler returned a response: " << out_msg->toStr();
 
   // Track the last message to help cut down on repetitive logging. Ignore the
@@ -1,15 +1,76 @@
 #ifndef MSG_HANDLER_H
 #define MSG_HANDLER_H
 
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
+#include <utility>
 
 #include "AKIpUptaneMes.h"
 #include "asn1/asn1_message.h"
+#include "utilities/dequeue_buffer.h"
+#include "utilities/metrics.h"
+#include "utilities/utils.h"
+
+/**
+ * Raw data that follows a request on the connection, like the image data of
+ * an uploadRawReq. It starts with what the server already received along with
+ * the request, and the rest is read straight from the socket.
+ * Over a Unix domain socket, the Primary may pass the image file instead, and
+ * the data is then read from that file, at the offset given in the request.
+ */
+class RawDataReader {
+ public:
+  RawDataReader(int socket, DequeueBuffer& buffer, uint64_t length)
+      : socket_(socket), buffer_(&buffer), remaining_(length) {}
+  RawDataReader(std::unique_ptr<Socket> file, uint64_t offset, uint64_t length)
+      : file_(std::move(file)), file_offset_(offset), remaining_(length) {}
+
+  /**
+   * Read up to `size` bytes of the data.
+   * @return the number of bytes read, 0 at the end of the data, -1 on error.
+   */
+  ssize_t read(uint8_t* dest, size_t size);
+  uint64_t remaining() const { return remaining_; }
+  // Skip what the handler didn't read, so that the next request can be decoded.
+  bool discard();
+
+ private:
+  int socket_{-1};
+  DequeueBuffer* buffer_{nullptr};
+  std::unique_ptr<Socket> file_;
+  uint64_t file_offset_{0};
+  uint64_t remaining_;
+};
+
+/**
+ * Metrics of the requests of one type, in the metrics::Registry, reported to
+ * the Primary with metricsReq: how many were handled, and how long receiving
+ * and decoding them, handling them, and encoding and sending the response
+ * took.
+ */
+struct RequestMetrics {
+  // looked up once per type
+  static const RequestMetrics& get(AKIpUptaneMes_PR msg_id);
+
+  metrics::Counter& requests;
+  metrics::Histogram& decode;
+  metrics::Histogram& handle;
+  metrics::Histogram& send;
+};
 
 class MsgHandler {
  public:
   enum ReturnCode { kUnkownMsg = -1, kOk, kRebootRequired };
+  // sends a message to the Primary ahead of the response, returns false on failure
+  using Notifier = std::function<bool(const Asn1Message::Ptr&)>;
 
   MsgHandler() = default;
   virtual ~MsgHandler() = default;
@@ -19,22 +80,69 @@ class MsgHandler {
   MsgHandler& operator=(MsgHandler&&) = delete;
 
   virtual ReturnCode handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) = 0;
+  // Same as handleMsg(), for handlers that may send messages with `notify` before their response.
+  virtual ReturnCode handleMsgWithNotifier(const Asn1Message::Ptr& in_msg, const Notifier& notify,
+                                           Asn1Message::Ptr& out_msg) {
+    (void)notify;
+    return handleMsg(in_msg, out_msg);
+  }
+  // Requests followed by raw data are not supported unless this is overridden.
+  virtual ReturnCode handleRawMsg(const Asn1Message::Ptr& in_msg, RawDataReader& data, Asn1Message::Ptr& out_msg) {
+    (void)in_msg;
+    (void)data;
+    (void)out_msg;
+    return kUnkownMsg;
+  }
 };
 
+/**
+ * Dispatches requests to the handlers registered for them. Requests from
+ * several connections may come in at once: handlers registered with
+ * Access::kRead only read the state of the Secondary and run concurrently,
+ * the others (and all raw handlers) run alone. Handlers registered with
+ * Access::kStateless don't use that state at all, and run right away even
+ * while the other requests are held, see holdRequestsUntil().
+ */
 class MsgDispatcher : public MsgHandler {
  public:
+  enum class Access { kStateless, kRead, kWrite };
   using Handler = std::function<ReturnCode(Asn1Message&, Asn1Message&)>;
+  using RawHandler = std::function<ReturnCode(Asn1Message&, RawDataReader&, Asn1Message&)>;
+  // the Notifier is empty when the server can't send messages ahead of the response
+  using NotifyingHandler = std::function<ReturnCode(Asn1Message&, const Notifier&, Asn1Message&)>;
 
-  void registerHandler(AKIpUptaneMes_PR msg_id, Handler handler);
+  void registerHandler(AKIpUptaneMes_PR msg_id, Handler handler, Access access = Access::kWrite);
+  void registerRawHandler(AKIpUptaneMes_PR msg_id, RawHandler handler);
+  void registerNotifyingHandler(AKIpUptaneMes_PR msg_id, NotifyingHandler handler, Access access = Access::kWrite);
   ReturnCode handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) override;
+  ReturnCode handleMsgWithNotifier(const Asn1Message::Ptr& in_msg, const Notifier& notify,
+                                   Asn1Message::Ptr& out_msg) override;
+  ReturnCode handleRawMsg(const Asn1Message::Ptr& in_msg, RawDataReader& data, Asn1Message::Ptr& out_msg) override;
+  /**
+   * Hold the requests that use the state of the Secondary until `ready` is,
+   * e.g. while it is being loaded in the background. An exception stored in
+   * `ready` is not rethrown: the requests are then handled with the state as
+   * it is.
+   */
+  void holdRequestsUntil(std::shared_future<void> ready);
 
  protected:
   void clearHandlers();
 
-  unsigned int last_msg_ = 0;
+  std::atomic<unsigned int> last_msg_{0};
 
  private:
-  std::unordered_map<unsigned int, Handler> handler_map_;
+  struct Entry {
+    NotifyingHandler handler;
+    Access access{Access::kWrite};
+  };
+
+  std::mutex handler_map_mutex_;
+  std::unordered_map<unsigned int, Entry> handler_map_;
+  std::unordered_map<unsigned int, RawHandler> raw_handler_map_;
+  std::shared_future<void> ready_;
+  // taken by the handlers, shared for Access::kRead
+  std::shared_mutex state_mutex_;
 };
 
 #endif  // MSG_HANDLER_H
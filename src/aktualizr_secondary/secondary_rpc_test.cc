@@ -1,10 +1,13 @@
 #include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
 #include <boost/filesystem.hpp>
 
 #include "crypto/crypto.h"
+#include "asn1/asn1_transport.h"
 #include "ipuptanesecondary.h"
 #include "libaktualizr/packagemanagerfactory.h"
 #include "libaktualizr/packagemanagerinterface.h"
@@ -14,8 +17,10 @@
 #include "secondary_tcp_server.h"
 #include "storage/invstorage.h"
 #include "test_utils.h"
+#include "utilities/deflate_stream.h"
+#include "utilities/metrics.h"
 
-enum class HandlerVersion { kV1, kV2, kV2Failure };
+enum class HandlerVersion { kV1, kV2, kV2Failure, kV3, kV3Raw, kV3Deflate, kV3Resume, kV3MetaVersions };
 
 /* This class allows us to divert messages from the regular handlers in
  * AktualizrSecondary to our own test functions. This lets us test only what was
@@ -23,7 +28,8 @@ enum class HandlerVersion { kV1, kV2, kV2Failure };
  *
  * It also has handlers for both the old/v1 and new/v2 versions of the RPC
  * protocol, so this is how we prove that the Primary is still
- * backwards-compatible with older/v1 Secondaries. */
+ * backwards-compatible with older/v1 Secondaries. v3 adds streamed uploads to
+ * the v2 handlers, optionally deflate compressed. */
 class SecondaryMock : public MsgDispatcher {
  public:
   SecondaryMock(const Uptane::EcuSerial& serial, const Uptane::HardwareIdentifier& hdw_id, const PublicKey& pub_key,
@@ -42,6 +48,9 @@ class SecondaryMock : public MsgDispatcher {
  public:
   const std::string verification_failure = "Expected verification test failure";
   const std::string upload_data_failure = "Expected data upload test failure";
+  // small, so that uploads take several windows
+  static constexpr long kStreamChunkSize{4096};  // NOLINT(google-runtime-int)
+  static constexpr long kStreamWindow{3};        // NOLINT(google-runtime-int)
   const std::string ostree_failure = "Expected OSTree download test failure";
   const std::string installation_failure = "Expected installation test failure";
 
@@ -51,6 +60,11 @@ class SecondaryMock : public MsgDispatcher {
   const Uptane::Manifest& manifest() const { return manifest_; }
   const Uptane::MetaBundle& metadata() const { return meta_bundle_; }
   HandlerVersion handlerVersion() const { return handler_version_; }
+  bool isV3() const {
+    return handler_version_ == HandlerVersion::kV3 || handler_version_ == HandlerVersion::kV3Raw ||
+           handler_version_ == HandlerVersion::kV3Deflate || handler_version_ == HandlerVersion::kV3Resume ||
+           handler_version_ == HandlerVersion::kV3MetaVersions;
+  }
   void setHandlerVersion(HandlerVersion handler_version_in) { handler_version_ = handler_version_in; }
   void registerHandlers() {
     registerBaseHandlers();
@@ -58,12 +72,44 @@ class SecondaryMock : public MsgDispatcher {
       registerV1Handlers();
     } else if (handler_version_ == HandlerVersion::kV2) {
       registerV2Handlers();
+    } else if (isV3()) {
+      registerV2Handlers();
+      registerHandler(AKIpUptaneMes_PR_uploadStreamReq,
+                      std::bind(&SecondaryMock::uploadStreamHdlr, this, std::placeholders::_1, std::placeholders::_2));
+      registerRawHandler(AKIpUptaneMes_PR_uploadRawReq, std::bind(&SecondaryMock::uploadRawHdlr, this,
+                                                                  std::placeholders::_1, std::placeholders::_2,
+                                                                  std::placeholders::_3));
+      registerHandler(AKIpUptaneMes_PR_uploadResumeReq,
+                      std::bind(&SecondaryMock::uploadResumeHdlr, this, std::placeholders::_1, std::placeholders::_2));
+      registerHandler(AKIpUptaneMes_PR_putRootChainReq,
+                      std::bind(&SecondaryMock::putRootChainHdlr, this, std::placeholders::_1, std::placeholders::_2));
+      registerHandler(AKIpUptaneMes_PR_metaVersionsReq,
+                      std::bind(&SecondaryMock::metaVersionsHdlr, this, std::placeholders::_1, std::placeholders::_2));
+      registerHandler(AKIpUptaneMes_PR_metricsReq,
+                      std::bind(&SecondaryMock::metricsHdlr, this, std::placeholders::_1, std::placeholders::_2));
     } else {
       registerV2FailureHandlers();
     }
   }
 
-  void resetImageHash() const { hasher_->reset(); }
+  void resetImageHash() {
+    hasher_->reset();
+    next_sequence_ = 0;
+    running_hashes_ = 0;
+    raw_pieces_ = 0;
+    compressed_chunks_ = 0;
+    received_size_ = 0;
+    interrupted_ = false;
+    resumes_ = 0;
+  }
+  int runningHashes() const { return running_hashes_; }
+  int rawPieces() const { return raw_pieces_; }
+  int compressedChunks() const { return compressed_chunks_; }
+  int resumes() const { return resumes_; }
+  const std::vector<std::string>& rootChain() const { return root_chain_; }
+  int rootChains() const { return root_chains_; }
+  // roles sent with the last metadata, the others were taken from meta_bundle_
+  int sentRoles() const { return sent_roles_; }
   Hash getReceivedImageHash() const { return hasher_->getHash(); }
   size_t getReceivedImageSize() const { return boost::filesystem::file_size(image_filepath_); }
 
@@ -143,11 +189,48 @@ class SecondaryMock : public MsgDispatcher {
   }
 
   MsgHandler::ReturnCode versionHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
-    (void)in_msg;
-
     auto m = out_msg.present(AKIpUptaneMes_PR_versionResp).versionResp();
     if (handler_version_ == HandlerVersion::kV1) {
       m->version = 1;
+    } else if (isV3()) {
+      m->version = 3;
+      m->uploadChunkSize = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+      *m->uploadChunkSize = kStreamChunkSize;
+      m->uploadWindow = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+      *m->uploadWindow = kStreamWindow;
+      if (handler_version_ == HandlerVersion::kV3Raw) {
+        m->rawUpload = Asn1Allocation<BOOLEAN_t>();
+        *m->rawUpload = 1;
+      }
+      auto version_req = in_msg.versionReq();
+      if (handler_version_ == HandlerVersion::kV3Deflate && version_req->uploadCompression != nullptr) {
+        EXPECT_EQ(*version_req->uploadCompression, AKCompression_deflate);
+        // also offered raw uploads, which compressed ones take precedence over
+        m->rawUpload = Asn1Allocation<BOOLEAN_t>();
+        *m->rawUpload = 1;
+        m->uploadCompression = Asn1Allocation<AKCompression_t>();
+        *m->uploadCompression = AKCompression_deflate;
+      }
+      if (handler_version_ == HandlerVersion::kV3Resume && version_req->uploadResume != nullptr) {
+        EXPECT_NE(*version_req->uploadResume, 0);
+        m->uploadResume = Asn1Allocation<BOOLEAN_t>();
+        *m->uploadResume = 1;
+      }
+      if (version_req->rootChain != nullptr) {
+        EXPECT_NE(*version_req->rootChain, 0);
+        m->rootChain = Asn1Allocation<BOOLEAN_t>();
+        *m->rootChain = 1;
+      }
+      if (handler_version_ == HandlerVersion::kV3MetaVersions && version_req->metaVersions != nullptr) {
+        EXPECT_NE(*version_req->metaVersions, 0);
+        m->metaVersions = Asn1Allocation<BOOLEAN_t>();
+        *m->metaVersions = 1;
+      }
+      if (version_req->metrics != nullptr) {
+        EXPECT_NE(*version_req->metrics, 0);
+        m->metrics = Asn1Allocation<BOOLEAN_t>();
+        *m->metrics = 1;
+      }
     } else {
       m->version = 2;
     }
@@ -195,11 +278,39 @@ class SecondaryMock : public MsgDispatcher {
     auto md = in_msg.putMetaReq2();
     Uptane::MetaBundle meta_bundle;
 
+    // the roles left out are taken from the last metadata
+    int director_stored = 0;
+    int image_stored = 0;
+    if (md->stored != nullptr) {
+      EXPECT_EQ(handler_version_, HandlerVersion::kV3MetaVersions);
+      for (int i = 0; i < md->stored->list.count; i++) {
+        const AKMetaVersion_t& stored = *md->stored->list.array[i];  // NOLINT
+        const bool director = stored.repotype == AKRepoType_director;
+        const auto key =
+            std::make_pair(director ? Uptane::RepositoryType::Director() : Uptane::RepositoryType::Image(),
+                           Uptane::Role(ToString(stored.role)));
+        const auto held = meta_bundle_.find(key);
+        if (held == meta_bundle_.end()) {
+          ADD_FAILURE() << "Left out metadata that was never sent: " << ToString(stored.role);
+          continue;
+        }
+        EXPECT_EQ(Crypto::sha256digestHex(held->second), ToString(stored.hash));
+        meta_bundle.emplace(key, held->second);
+        if (director) {
+          ++director_stored;
+        } else {
+          ++image_stored;
+        }
+      }
+    }
+    sent_roles_ = 0;
+
     EXPECT_EQ(md->directorRepo.present, directorRepo_PR_collection);
     if (vtype_ == VerificationType::kFull) {
       // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
       const int director_meta_count = md->directorRepo.choice.collection.list.count;
-      EXPECT_EQ(director_meta_count, 2);
+      EXPECT_EQ(director_meta_count + director_stored, 2);
+      sent_roles_ += director_meta_count;
       for (int i = 0; i < director_meta_count; i++) {
         // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic, cppcoreguidelines-pro-type-union-access)
         const AKMetaJson_t object = *md->directorRepo.choice.collection.list.array[i];
@@ -218,7 +329,8 @@ class SecondaryMock : public MsgDispatcher {
     EXPECT_EQ(md->imageRepo.present, imageRepo_PR_collection);
     // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
     const int image_meta_count = md->imageRepo.choice.collection.list.count;
-    EXPECT_EQ(image_meta_count, 4);
+    EXPECT_EQ(image_meta_count + image_stored, 4);
+    sent_roles_ += image_meta_count;
     for (int i = 0; i < image_meta_count; i++) {
       // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic, cppcoreguidelines-pro-type-union-access)
       const AKMetaJson_t object = *md->imageRepo.choice.collection.list.array[i];
@@ -308,6 +420,86 @@ class SecondaryMock : public MsgDispatcher {
     return ReturnCode::kOk;
   }
 
+  MsgHandler::ReturnCode uploadStreamHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    auto req = in_msg.uploadStreamReq();
+    if (handler_version_ == HandlerVersion::kV3Resume && req->sequence == 1 && !interrupted_) {
+      // drop the connection in the middle of the upload
+      interrupted_ = true;
+      return ReturnCode::kUnkownMsg;
+    }
+    if (req->offset != nullptr) {
+      EXPECT_EQ(req->sequence, 0);
+      EXPECT_EQ(static_cast<uint64_t>(*req->offset), received_size_);
+      next_sequence_ = 0;
+      ++resumes_;
+    }
+    EXPECT_EQ(req->sequence, next_sequence_++);
+    EXPECT_GE(req->data.size, 0);
+    EXPECT_LE(req->data.size, kStreamChunkSize);
+    if (req->compression != nullptr) {
+      EXPECT_EQ(*req->compression, AKCompression_deflate);
+      if (req->sequence == 0) {
+        inflater_ = std::make_unique<InflateStream>();
+      }
+      EXPECT_TRUE(inflater_->decompress(req->data.buf, static_cast<size_t>(req->data.size),
+                                        [this](const uint8_t* data, size_t size) {
+                                          return receiveImageData(data, size).isSuccess();
+                                        }));
+      ++compressed_chunks_;
+    } else {
+      receiveImageData(req->data.buf, static_cast<size_t>(req->data.size));
+    }
+
+    const std::string running_hash = ToString(req->runningHash);
+    if (!running_hash.empty()) {
+      auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+      hasher->setState(hasher_->getState());
+      EXPECT_EQ(hasher->getHash(), Hash(Hash::Type::kSha256, running_hash));
+      ++running_hashes_;
+    }
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_uploadStreamResp).uploadStreamResp();
+    m->sequence = req->sequence;
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
+    SetString(&m->description, "");
+
+    return ReturnCode::kOk;
+  }
+
+  MsgHandler::ReturnCode uploadRawHdlr(Asn1Message& in_msg, RawDataReader& data, Asn1Message& out_msg) {
+    auto req = in_msg.uploadRawReq();
+    EXPECT_EQ(req->sequence, next_sequence_++);
+    EXPECT_EQ(data.remaining(), static_cast<uint64_t>(req->length));
+    // read in small, uneven pieces to go through both the server buffer and the socket
+    std::vector<uint8_t> buffer(1000);
+    while (data.remaining() > 0) {
+      const ssize_t received = data.read(buffer.data(), buffer.size());
+      if (received <= 0) {
+        ADD_FAILURE() << "Failed to read the raw data";
+        break;
+      }
+      receiveImageData(buffer.data(), static_cast<size_t>(received));
+    }
+    ++raw_pieces_;
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_uploadRawResp).uploadRawResp();
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
+    SetString(&m->description, "");
+
+    return ReturnCode::kOk;
+  }
+
+  MsgHandler::ReturnCode uploadResumeHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    (void)in_msg;
+    auto m = out_msg.present(AKIpUptaneMes_PR_uploadResumeResp).uploadResumeResp();
+    m->offset = static_cast<long>(received_size_);  // NOLINT(google-runtime-int)
+    auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+    hasher->setState(hasher_->getState());
+    SetString(&m->runningHash, hasher->getHexDigest());
+
+    return ReturnCode::kOk;
+  }
+
   MsgHandler::ReturnCode uploadDataFailureHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
     (void)in_msg;
 
@@ -381,6 +573,48 @@ class SecondaryMock : public MsgDispatcher {
     return ReturnCode::kOk;
   }
 
+  MsgHandler::ReturnCode putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    auto pr = in_msg.putRootChainReq();
+    root_chain_.clear();
+    for (int i = 0; i < pr->chain.list.count; i++) {
+      root_chain_.push_back(ToString(*pr->chain.list.array[i]));  // NOLINT
+    }
+    ++root_chains_;
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_putRootChainResp).putRootChainResp();
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
+    SetString(&m->description, "");
+    m->version = 1 + pr->chain.list.count;
+
+    return ReturnCode::kOk;
+  }
+
+  MsgHandler::ReturnCode metaVersionsHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    (void)in_msg;
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_metaVersionsResp).metaVersionsResp();
+    for (const auto& held : meta_bundle_) {
+      auto* version = Asn1Allocation<AKMetaVersion_t>();
+      version->repotype =
+          held.first.first == Uptane::RepositoryType::Director() ? AKRepoType_director : AKRepoType_image;
+      SetString(&version->role, held.first.second.ToString());
+      version->version = 1;
+      SetString(&version->hash, Crypto::sha256digestHex(held.second));
+      ASN_SEQUENCE_ADD(&m->versions, version);
+    }
+
+    return ReturnCode::kOk;
+  }
+
+  MsgHandler::ReturnCode metricsHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    (void)in_msg;
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_metricsResp).metricsResp();
+    SetString(&m->metrics, metrics::Registry::instance().prometheus());
+
+    return ReturnCode::kOk;
+  }
+
   MsgHandler::ReturnCode putRootFailureHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
     (void)in_msg;
 
@@ -401,6 +635,7 @@ class SecondaryMock : public MsgDispatcher {
 
     target_file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
     hasher_->update(data, size);
+    received_size_ += size;
 
     target_file.close();
     return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
@@ -436,6 +671,17 @@ class SecondaryMock : public MsgDispatcher {
   std::string received_firmware_data_;
   VerificationType vtype_;
   HandlerVersion handler_version_;
+  long next_sequence_{0};  // NOLINT(google-runtime-int)
+  int running_hashes_{0};
+  int raw_pieces_{0};
+  int compressed_chunks_{0};
+  std::unique_ptr<InflateStream> inflater_;
+  uint64_t received_size_{0};
+  bool interrupted_{false};
+  int resumes_{0};
+  std::vector<std::string> root_chain_;
+  int root_chains_{0};
+  int sent_roles_{0};
 };
 
 class TargetFile {
@@ -503,6 +749,7 @@ class SecondaryRpcCommon : public ::testing::Test {
   const std::string director_targets_ = "director-targets";
   const std::string image_root_ = "image-root";
   const std::string image_root_v2_ = "image-root-v2";
+  const std::string image_root_v3_ = "image-root-v3";
   const std::string image_timestamp_ = "image-timestamp";
   const std::string image_snapshot_ = "image-snapshot";
   const std::string image_targets_ = "image-targets";
@@ -600,6 +847,26 @@ class SecondaryRpcCommon : public ::testing::Test {
       EXPECT_TRUE(result.isSuccess());
       EXPECT_EQ(image_file_.hash(), secondary_.getReceivedImageHash());
     }
+    if (handler_version == HandlerVersion::kV3) {
+      // one running hash per window of chunks, plus one with the last chunk
+      const auto chunk_size = static_cast<size_t>(SecondaryMock::kStreamChunkSize);
+      const auto window = static_cast<size_t>(SecondaryMock::kStreamWindow);
+      const size_t chunks = (image_file_.size() + chunk_size - 1) / chunk_size;
+      const size_t expected = chunks / window + ((chunks % window != 0) ? 1 : 0);
+      EXPECT_EQ(static_cast<size_t>(secondary_.runningHashes()), expected);
+    } else if (handler_version == HandlerVersion::kV3Raw) {
+      // the images are smaller than one raw upload piece
+      EXPECT_EQ(secondary_.rawPieces(), 1);
+      EXPECT_EQ(secondary_.runningHashes(), 0);
+    } else if (handler_version == HandlerVersion::kV3Deflate) {
+      EXPECT_EQ(secondary_.rawPieces(), 0);
+      EXPECT_GT(secondary_.compressedChunks(), 0);
+      EXPECT_GT(secondary_.runningHashes(), 0);
+    } else if (handler_version == HandlerVersion::kV3Resume) {
+      // the connection is dropped at the second chunk
+      const auto chunk_size = static_cast<size_t>(SecondaryMock::kStreamChunkSize);
+      EXPECT_EQ(secondary_.resumes(), (image_file_.size() > chunk_size) ? 1 : 0);
+    }
   }
 
   void installOstreeRev() {
@@ -689,6 +956,21 @@ class SecondaryRpcCommon : public ::testing::Test {
       EXPECT_TRUE(iresult.isSuccess());
       verifyMetadata(secondary_.metadata());
     }
+
+    // v3 takes all the missing versions in one request
+    const std::vector<std::string> chain{image_root_v2_, image_root_v3_};
+    iresult = ip_secondary_->putRootChain(chain, false);
+    if (handler_version == HandlerVersion::kV1 || handler_version == HandlerVersion::kV2Failure) {
+      EXPECT_EQ(iresult.result_code, data::ResultCode::Numeric::kVerificationFailed);
+    } else {
+      EXPECT_TRUE(iresult.isSuccess());
+    }
+    if (secondary_.isV3()) {
+      EXPECT_EQ(secondary_.rootChains(), 1);
+      EXPECT_EQ(secondary_.rootChain(), chain);
+    } else {
+      EXPECT_EQ(secondary_.rootChains(), 0);
+    }
   }
 
   SecondaryMock secondary_;
@@ -747,7 +1029,22 @@ INSTANTIATE_TEST_SUITE_P(SecondaryRpcTestCases, SecondaryRpcTest,
                                            std::make_tuple(1024 - 1, HandlerVersion::kV1, VerificationType::kFull),
                                            std::make_tuple(1024 + 1, HandlerVersion::kV1, VerificationType::kFull),
                                            std::make_tuple(1024 * 10 + 1, HandlerVersion::kV1, VerificationType::kFull),
-                                           std::make_tuple(1024, HandlerVersion::kV2Failure, VerificationType::kFull)));
+                                           std::make_tuple(1024, HandlerVersion::kV2Failure, VerificationType::kFull),
+                                           std::make_tuple(1, HandlerVersion::kV3, VerificationType::kFull),
+                                           std::make_tuple(4096, HandlerVersion::kV3, VerificationType::kFull),
+                                           std::make_tuple(4096 * 3, HandlerVersion::kV3, VerificationType::kFull),
+                                           std::make_tuple(4096 * 10 + 1, HandlerVersion::kV3, VerificationType::kFull),
+                                           std::make_tuple(1024 * 1024, HandlerVersion::kV3, VerificationType::kTuf),
+                                           std::make_tuple(1, HandlerVersion::kV3Raw, VerificationType::kFull),
+                                           std::make_tuple(1000, HandlerVersion::kV3Raw, VerificationType::kFull),
+                                           std::make_tuple(100001, HandlerVersion::kV3Raw, VerificationType::kFull),
+                                           std::make_tuple(100000, HandlerVersion::kV3Raw, VerificationType::kTuf),
+                                           std::make_tuple(1, HandlerVersion::kV3Deflate, VerificationType::kFull),
+                                           std::make_tuple(4096, HandlerVersion::kV3Deflate, VerificationType::kFull),
+                                           std::make_tuple(40001, HandlerVersion::kV3Deflate, VerificationType::kFull),
+                                           std::make_tuple(40000, HandlerVersion::kV3Deflate, VerificationType::kTuf),
+                                           std::make_tuple(1, HandlerVersion::kV3Resume, VerificationType::kFull),
+                                           std::make_tuple(40001, HandlerVersion::kV3Resume, VerificationType::kFull)));
 
 class SecondaryRpcUpgrade : public SecondaryRpcCommon {
  protected:
@@ -763,6 +1060,12 @@ TEST_F(SecondaryRpcUpgrade, VersionUpgrade) {
   resetHandlers(HandlerVersion::kV2);
   secondary_.resetImageHash();
   sendAndInstallBinaryImage();
+  resetHandlers(HandlerVersion::kV3);
+  secondary_.resetImageHash();
+  sendAndInstallBinaryImage();
+  resetHandlers(HandlerVersion::kV3Raw);
+  secondary_.resetImageHash();
+  sendAndInstallBinaryImage();
   resetHandlers(HandlerVersion::kV1);
   secondary_.resetImageHash();
   sendAndInstallBinaryImage();
@@ -775,6 +1078,96 @@ TEST_F(SecondaryRpcUpgrade, VersionUpgrade) {
   installOstreeRev();
 }
 
+class SecondaryRpcMetaVersions : public SecondaryRpcCommon {
+ protected:
+  SecondaryRpcMetaVersions() : SecondaryRpcCommon(1024, HandlerVersion::kV3MetaVersions, VerificationType::kFull) {}
+};
+
+/* Only the metadata that the Secondary doesn't hold yet is sent. */
+TEST_F(SecondaryRpcMetaVersions, SendChangedRoles) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  const Uptane::Target target = image_file_.createTarget(package_manager_);
+
+  EXPECT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+  EXPECT_EQ(secondary_.sentRoles(), 6);
+  verifyMetadata(secondary_.metadata());
+
+  EXPECT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+  EXPECT_EQ(secondary_.sentRoles(), 0);
+  verifyMetadata(secondary_.metadata());
+
+  const std::string image_timestamp_v2 = "image-timestamp-v2";
+  storage_->storeNonRoot(image_timestamp_v2, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
+  EXPECT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+  EXPECT_EQ(secondary_.sentRoles(), 1);
+  const auto& metadata = secondary_.metadata();
+  EXPECT_EQ(Uptane::getMetaFromBundle(metadata, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp()),
+            image_timestamp_v2);
+  EXPECT_EQ(Uptane::getMetaFromBundle(metadata, Uptane::RepositoryType::Image(), Uptane::Role::Targets()),
+            image_targets_);
+}
+
+class SecondaryRpcMetrics : public SecondaryRpcCommon {
+ protected:
+  SecondaryRpcMetrics() : SecondaryRpcCommon(1024, HandlerVersion::kV3, VerificationType::kFull) {}
+};
+
+/* The Secondary counts the requests of each type and times their decoding,
+ * handling and response, and reports them to the Primary. */
+TEST_F(SecondaryRpcMetrics, RequestMetrics) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  const Uptane::Target target = image_file_.createTarget(package_manager_);
+  EXPECT_TRUE(ip_secondary_->putMetadata(target).isSuccess());
+
+  const std::string metrics = ip_secondary_->getMetrics();
+  EXPECT_NE(metrics.find("aktualizr_secondary_requests_total{message=\"putMetaReq2\"}"), std::string::npos);
+  for (const std::string phase : {"decode", "handle", "send"}) {
+    const std::string count = "aktualizr_secondary_request_seconds_count{message=\"putMetaReq2\",phase=\"" + phase;
+    EXPECT_NE(metrics.find(count + "\"}"), std::string::npos) << phase;
+  }
+
+  // not answered by Secondaries that don't report metrics
+  resetHandlers(HandlerVersion::kV2);
+  ip_secondary_->getManifest();
+  EXPECT_EQ(ip_secondary_->getMetrics(), "");
+}
+
+/* The Treehub credentials archive is built again when the credentials or the
+ * server change. */
+TEST(SecondaryProvider, TreehubCredentials) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.ostree_server = "ostree-server";
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  storage->storeTlsCreds("ca", "cert", "pkey");
+  std::shared_ptr<PackageManagerInterface> package_manager =
+      PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, nullptr);
+  std::shared_ptr<SecondaryProvider> secondary_provider =
+      SecondaryProviderBuilder::Build(config, storage, package_manager);
+
+  const std::string archive = secondary_provider->getTreehubCredentials();
+  EXPECT_EQ(secondary_provider->getTreehubCredentials(), archive);
+  {
+    std::stringstream as(archive);
+    EXPECT_EQ(Utils::readFileFromArchive(as, "ca.pem"), "ca");
+  }
+
+  storage->storeTlsCreds("ca-v2", "cert", "pkey");
+  {
+    std::stringstream as(secondary_provider->getTreehubCredentials());
+    EXPECT_EQ(Utils::readFileFromArchive(as, "ca.pem"), "ca-v2");
+  }
+
+  secondary_provider->setTreehubServer("http://primary:8080");
+  {
+    std::stringstream as(secondary_provider->getTreehubCredentials());
+    EXPECT_EQ(Utils::readFileFromArchive(as, "server.url", true), "http://primary:8080");
+  }
+}
+
 TEST(SecondaryTcpServer, TestIpSecondaryIfSecondaryIsNotRunning) {
   in_port_t secondary_port = TestUtils::getFreePortAsInt();
   SecondaryInterface::Ptr ip_secondary;
@@ -821,7 +1214,7 @@ TEST(SecondaryTcpServer, TestIpSecondaryIfSecondaryIsNotRunning) {
 class SecondaryRpcTestPositive : public ::testing::Test, public MsgHandler {
  protected:
   SecondaryRpcTestPositive()
-      : secondary_server_{*this, "", 0}, secondary_server_thread_{[&]() { secondary_server_.run(); }} {
+      : secondary_server_{*this, "", 0, 0, false, 2}, secondary_server_thread_{[&]() { secondary_server_.run(); }} {
     secondary_server_.wait_until_running();
   }
 
@@ -837,14 +1230,16 @@ class SecondaryRpcTestPositive : public ::testing::Test, public MsgHandler {
     return ReturnCode::kOk;
   }
 
-  AKIpUptaneMes_PR sendInstallMsg() {
-    // compose and send a valid message
+  static Asn1Message::Ptr installMsg() {
     Asn1Message::Ptr req(Asn1Message::Empty());
     req->present(AKIpUptaneMes_PR_installReq);
+    SetString(&req->installReq()->hash, "target_name");
+    return req;
+  }
 
-    // prepare request message
-    auto req_mes = req->installReq();
-    SetString(&req_mes->hash, "target_name");
+  AKIpUptaneMes_PR sendInstallMsg() {
+    // compose and send a valid message
+    Asn1Message::Ptr req = installMsg();
     // send request and receive response, a request-response type of RPC
     std::pair<std::string, uint16_t> secondary_server_addr{"127.0.0.1", secondary_server_.port()};
     auto resp = Asn1Rpc(req, secondary_server_addr);
@@ -857,16 +1252,117 @@ class SecondaryRpcTestPositive : public ::testing::Test, public MsgHandler {
   std::thread secondary_server_thread_;
 };
 
-/* This test fails because the Secondary TCP server implementation is a
- * single-threaded, synchronous and blocking hence it cannot accept any new
- * connections until the current one is closed. Therefore, if a client/Primary
- * does not close its socket for some reason then Secondary becomes
- * "unavailable" */
-// TEST_F(SecondaryRpcTestPositive, primaryNotClosingSocket) {
-//  ConnectionSocket con_sock{"127.0.0.1", secondary_server_.port()};
-//  con_sock.connect();
-//  ASSERT_EQ(sendInstallMsg(), AKIpUptaneMes_PR_installResp);
-//}
+/* A connection that the Primary doesn't close doesn't make the Secondary
+ * unavailable, as connections are served concurrently. */
+TEST_F(SecondaryRpcTestPositive, primaryNotClosingSocket) {
+  ConnectionSocket con_sock{"127.0.0.1", secondary_server_.port()};
+  con_sock.connect();
+  ASSERT_EQ(sendInstallMsg(), AKIpUptaneMes_PR_installResp);
+  // and neither does one more
+  Asn1Connection connection({"127.0.0.1", secondary_server_.port()});
+  ASSERT_EQ(connection.rpc(installMsg())->present(), AKIpUptaneMes_PR_installResp);
+}
+
+/* Secondaries on the same host as the Primary are reached through a Unix
+ * domain socket, with the same RPCs. */
+TEST(SecondaryTcpServer, UnixDomainSocket) {
+  class InstallHandler : public MsgHandler {
+   public:
+    ReturnCode handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) override {
+      (void)in_msg;
+      out_msg->present(AKIpUptaneMes_PR_installResp).installResp()->result = AKInstallationResultCode_ok;
+      return ReturnCode::kOk;
+    }
+  };
+  auto install_msg = []() {
+    Asn1Message::Ptr req(Asn1Message::Empty());
+    req->present(AKIpUptaneMes_PR_installReq);
+    SetString(&req->installReq()->hash, "target_name");
+    return req;
+  };
+
+  TemporaryDirectory temp_dir;
+  const std::string address = std::string(Asn1Transport::kUnixPrefix) + (temp_dir / "secondary.sock").string();
+  // a socket left by a previous run is replaced
+  UnixTransport(temp_dir / "secondary.sock").bind();
+
+  InstallHandler handler;
+  SecondaryTcpServer server{handler, UnixTransport(temp_dir / "secondary.sock"), false, 2};
+  std::thread server_thread{[&server]() { server.run(); }};
+  server.wait_until_running();
+  EXPECT_EQ(server.port(), 0);
+
+  EXPECT_EQ(Asn1Rpc(install_msg(), {address, 0})->present(), AKIpUptaneMes_PR_installResp);
+
+  Asn1Connection connection({address, 0});
+  EXPECT_EQ(connection.rpc(install_msg())->present(), AKIpUptaneMes_PR_installResp);
+  // pipelined requests
+  int sent = 0;
+  int received = 0;
+  EXPECT_TRUE(connection.stream([&]() { return sent++ < 5 ? install_msg() : nullptr; }, 2,
+                                [&](const Asn1Message::Ptr& resp) {
+                                  received += resp->present() == AKIpUptaneMes_PR_installResp ? 1 : 0;
+                                  return true;
+                                }));
+  EXPECT_EQ(received, 5);
+  connection.close();
+
+  server.stop();
+  server_thread.join();
+}
+
+/* Over a Unix domain socket, raw uploads pass the image file, and the
+ * Secondary reads the piece from it. */
+TEST(SecondaryTcpServer, PassImageFile) {
+  class RawHandler : public MsgHandler {
+   public:
+    ReturnCode handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) override {
+      (void)in_msg;
+      (void)out_msg;
+      return ReturnCode::kUnkownMsg;
+    }
+    ReturnCode handleRawMsg(const Asn1Message::Ptr& in_msg, RawDataReader& data, Asn1Message::Ptr& out_msg) override {
+      (void)in_msg;
+      std::string received(static_cast<size_t>(data.remaining()), '\0');
+      const ssize_t res = data.read(reinterpret_cast<uint8_t*>(&received[0]), received.size());
+      received.resize(res > 0 ? static_cast<size_t>(res) : 0);
+      auto m = out_msg->present(AKIpUptaneMes_PR_uploadRawResp).uploadRawResp();
+      m->result = AKInstallationResultCode_ok;
+      SetString(&m->description, received);
+      return ReturnCode::kOk;
+    }
+  };
+
+  TemporaryDirectory temp_dir;
+  const std::string address = std::string(Asn1Transport::kUnixPrefix) + (temp_dir / "secondary.sock").string();
+  RawHandler handler;
+  SecondaryTcpServer server{handler, UnixTransport(temp_dir / "secondary.sock")};
+  std::thread server_thread{[&server]() { server.run(); }};
+  server.wait_until_running();
+
+  Utils::writeFile(temp_dir / "image", std::string("0123456789"));
+  const int fd = open((temp_dir / "image").c_str(), O_RDONLY | O_CLOEXEC);
+  ASSERT_GE(fd, 0);
+  Socket file(fd);
+
+  Asn1Connection connection({address, 0});
+  EXPECT_TRUE(connection.passesFiles());
+  for (long offset : {3, 6}) {  // NOLINT(google-runtime-int)
+    Asn1Message::Ptr req(Asn1Message::Empty());
+    req->present(AKIpUptaneMes_PR_uploadRawReq);
+    auto m = req->uploadRawReq();
+    m->length = 4;
+    m->fileOffset = Asn1Allocation<long>();  // NOLINT(google-runtime-int)
+    *m->fileOffset = offset;
+    auto resp = connection.rpcPassingFile(req, *file);
+    ASSERT_EQ(resp->present(), AKIpUptaneMes_PR_uploadRawResp);
+    EXPECT_EQ(ToString(resp->uploadRawResp()->description), offset == 3 ? "3456" : "6789");
+  }
+  connection.close();
+
+  server.stop();
+  server_thread.join();
+}
 
 TEST_F(SecondaryRpcTestPositive, primaryConnectAndDisconnect) {
   ConnectionSocket{"127.0.0.1", secondary_server_.port()}.connect();
@@ -913,6 +1409,20 @@ TEST_F(SecondaryRpcTestPositive, primaryConnectAndSendGarbage) {
   ASSERT_EQ(sendInstallMsg(), AKIpUptaneMes_PR_installResp);
 }
 
+/* Requests go through one connection, and a new one is opened once it has been
+ * closed. The Secondary is still available to others afterwards. */
+TEST_F(SecondaryRpcTestPositive, persistentConnection) {
+  {
+    Asn1Connection connection({"127.0.0.1", secondary_server_.port()});
+    for (int i = 0; i < 10; i++) {
+      ASSERT_EQ(connection.rpc(installMsg())->present(), AKIpUptaneMes_PR_installResp);
+    }
+    connection.close();
+    ASSERT_EQ(connection.rpc(installMsg())->present(), AKIpUptaneMes_PR_installResp);
+  }
+  ASSERT_EQ(sendInstallMsg(), AKIpUptaneMes_PR_installResp);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
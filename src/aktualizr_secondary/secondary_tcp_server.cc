@@ -1,26 +1,36 @@
 #include "secondary_tcp_server.h"
 
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
 
 #include "AKInstallationResultCode.h"
 #include "AKIpUptaneMes.h"
 #include "asn1/asn1_message.h"
+#include "asn1/asn1_transport.h"
 #include "logging/logging.h"
 #include "msg_handler.h"
 #include "utilities/dequeue_buffer.h"
 
 SecondaryTcpServer::SecondaryTcpServer(MsgHandler &msg_handler, const std::string &primary_ip, in_port_t primary_port,
-                                       in_port_t port, bool reboot_after_install)
+                                       in_port_t port, bool reboot_after_install, size_t max_connections)
     : msg_handler_(msg_handler),
-      listen_socket_(port),
       keep_running_(true),
       reboot_after_install_(reboot_after_install),
+      max_connections_(std::max<size_t>(max_connections, 1)),
       is_running_(false) {
+  auto listen_socket = std::make_unique<ListenSocket>(port);
+  port_ = listen_socket->port();
+  listen_socket_ = std::move(listen_socket);
+
   if (primary_ip.empty()) {
     return;
   }
 
-  ConnectionSocket conn_socket(primary_ip, primary_port, listen_socket_.port());
+  ConnectionSocket conn_socket(primary_ip, primary_port, port_);
   if (conn_socket.connect() == 0) {
     LOG_INFO << "Connected to Primary, sending info about this Secondary.";
     HandleOneConnection(*conn_socket);
@@ -29,11 +39,24 @@ SecondaryTcpServer::SecondaryTcpServer(MsgHandler &msg_handler, const std::strin
   }
 }
 
+// The Primary on the same host connects when it needs to, it is not told
+// about this Secondary.
+SecondaryTcpServer::SecondaryTcpServer(MsgHandler &msg_handler, const UnixTransport &local, bool reboot_after_install,
+                                       size_t max_connections)
+    : msg_handler_(msg_handler),
+      listen_socket_(local.bind()),
+      local_path_(local.path()),
+      keep_running_(true),
+      reboot_after_install_(reboot_after_install),
+      max_connections_(std::max<size_t>(max_connections, 1)),
+      is_running_(false) {}
+
 void SecondaryTcpServer::run() {
-  if (listen(*listen_socket_, SOMAXCONN) < 0) {
+  if (listen(**listen_socket_, SOMAXCONN) < 0) {
     throw std::system_error(errno, std::system_category(), "listen");
   }
-  LOG_INFO << "Secondary TCP server listening on " << listen_socket_.ToString();
+  LOG_INFO << "Secondary TCP server listening on "
+           << (local_path_.empty() ? listen_socket_->ToString() : UnixTransport(local_path_).toString());
 
   {
     std::unique_lock<std::mutex> lock(running_condition_mutex_);
@@ -44,11 +67,19 @@ void SecondaryTcpServer::run() {
   bool first_connection = true;
 
   while (keep_running_.load()) {
+    if (max_connections_ > 1) {
+      std::unique_lock<std::mutex> lock(sessions_mutex_);
+      sessions_condition_.wait(lock, [this] { return !keep_running_.load() || reapSessions() < max_connections_; });
+      if (!keep_running_.load()) {
+        break;
+      }
+    }
+
     sockaddr_storage peer_sa{};
     socklen_t peer_sa_size = sizeof(sockaddr_storage);
 
     LOG_DEBUG << "Waiting for connection from Primary...";
-    int con_fd = accept(*listen_socket_, reinterpret_cast<sockaddr *>(&peer_sa), &peer_sa_size);
+    int con_fd = accept(**listen_socket_, reinterpret_cast<sockaddr *>(&peer_sa), &peer_sa_size);
     if (con_fd == -1) {
       // Accept can fail if a client closes connection/client socket before a TCP handshake completes or
       // a network connection goes down in the middle of a TCP handshake procedure. At first glance it looks like
@@ -67,6 +98,10 @@ void SecondaryTcpServer::run() {
     } else {
       LOG_DEBUG << "Primary reconnected.";
     }
+    if (max_connections_ > 1) {
+      startSession(con_fd);
+      continue;
+    }
     auto continue_running = HandleOneConnection(*Socket(con_fd));
     if (!continue_running) {
       keep_running_.store(false);
@@ -74,6 +109,10 @@ void SecondaryTcpServer::run() {
     LOG_DEBUG << "Primary disconnected.";
   }
 
+  // the sessions notice within kStopCheckIntervalMs
+  keep_running_.store(false);
+  joinSessions();
+
   {
     std::unique_lock<std::mutex> lock(running_condition_mutex_);
     is_running_ = false;
@@ -83,77 +122,199 @@ void SecondaryTcpServer::run() {
   LOG_INFO << "Secondary TCP server exiting.";
 }
 
+SecondaryTcpServer::~SecondaryTcpServer() {
+  keep_running_.store(false);
+  joinSessions();
+  if (!local_path_.empty()) {
+    unlink(local_path_.c_str());
+  }
+}
+
 void SecondaryTcpServer::stop() {
   LOG_DEBUG << "Stopping Secondary TCP server...";
   keep_running_.store(false);
-  // unblock accept
-  ConnectionSocket("localhost", listen_socket_.port()).connect();
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    sessions_condition_.notify_all();
+  }
+  wakeUpAccept();
+}
+
+void SecondaryTcpServer::wakeUpAccept() const {
+  if (local_path_.empty()) {
+    ConnectionSocket("localhost", port_).connect();
+  } else {
+    UnixTransport(local_path_).connect();
+  }
+}
+
+void SecondaryTcpServer::startSession(int con_fd) {
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  sessions_.emplace_back();
+  Session& session = sessions_.back();
+  // the session can't finish before it is fully set up, as it needs the lock for that
+  session.thread = std::thread([this, con_fd, &session]() {
+    if (!HandleOneConnection(*Socket(con_fd))) {
+      keep_running_.store(false);
+      wakeUpAccept();
+    }
+    LOG_DEBUG << "Primary disconnected.";
+    std::lock_guard<std::mutex> session_lock(sessions_mutex_);
+    session.done = true;
+    sessions_condition_.notify_all();
+  });
+}
+
+size_t SecondaryTcpServer::reapSessions() {
+  for (auto it = sessions_.begin(); it != sessions_.end();) {
+    if (it->done) {
+      it->thread.join();
+      it = sessions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return sessions_.size();
+}
+
+void SecondaryTcpServer::joinSessions() {
+  std::list<Session> sessions;
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    sessions.splice(sessions.end(), sessions_);
+  }
+  for (auto& session : sessions) {
+    session.thread.join();
+  }
 }
 
-in_port_t SecondaryTcpServer::port() const { return listen_socket_.port(); }
+in_port_t SecondaryTcpServer::port() const { return port_; }
 SecondaryTcpServer::ExitReason SecondaryTcpServer::exit_reason() const { return exit_reason_; }
 
-static bool sendResponseMessage(int socket_fd, const Asn1Message::Ptr &resp_msg);
+static bool sendResponseMessage(int socket_fd, Asn1OutputBuffer &out, const Asn1Message::Ptr &resp_msg);
+
+bool SecondaryTcpServer::waitForData(int socket) const {
+  pollfd pfd{};
+  pfd.fd = socket;
+  pfd.events = POLLIN;
+  // wake up from time to time, so that stop() isn't blocked by an idle connection
+  while (keep_running_.load()) {
+    const int res = poll(&pfd, 1, kStopCheckIntervalMs);
+    if (res > 0 || (res < 0 && errno != EINTR)) {
+      return true;
+    }
+  }
+  return false;
+}
 
 bool SecondaryTcpServer::HandleOneConnection(int socket) {
-  // Outside the message loop, because one recv() may have parts of 2 messages
-  // Note that one recv() call returning 2+ messages doesn't work at the
-  // moment. This shouldn't be a problem until we have messages that aren't
-  // strictly request/response
+  // Outside the message loop, because one recv() may have parts of 2 messages.
+  // With streamed uploads, the Primary sends several requests before reading
+  // the responses, so whatever is left in the buffer is decoded before reading
+  // from the socket again. It grows for large messages, like metadata bundles.
   DequeueBuffer buffer;
+  // reused for all the responses of the session
+  Asn1OutputBuffer out_buffer;
+  // image files passed by a Primary on the same host, for raw uploads
+  Asn1PassedFiles files;
   bool keep_running_server = true;
   bool keep_running_current_session = true;
 
+  // Primary keeps the connection open between requests, so responses have to go out right away
+  if (local_path_.empty()) {
+    int no_delay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
+  }
+
   while (keep_running_current_session) {  // Keep reading until we get an error
-    // Read an incoming message
-    AKIpUptaneMes_t *m = nullptr;
-    asn_dec_rval_t res{};
-    asn_codec_ctx_s context{};
-    ssize_t received;
-
-    do {
-      received = recv(socket, buffer.Tail(), buffer.TailSpace(), 0);
-      if (received < 0) {
-        LOG_ERROR << "Failed to read data from a server socket: " << strerror(errno);
-        break;
-      }
-      buffer.HaveEnqueued(static_cast<size_t>(received));
-      res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void **>(&m), buffer.Head(), buffer.Size());
-      buffer.Consume(res.consumed);
-    } while (res.code == RC_WMORE && received > 0);
-    // Note that ber_decode allocates *m even on failure, so this must always be done
-    Asn1Message::Ptr request_msg = Asn1Message::FromRaw(&m);
-
-    if (received == 0) {
+    // Read an incoming message; the time spent waiting for the Primary to
+    // send it isn't part of its decoding
+    Asn1ReceiveStatus status;
+    const auto receive_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration waited{0};
+    Asn1Message::Ptr request_msg = Asn1ReceiveMessage(
+        socket, buffer, &status,
+        [this, socket, &waited]() {
+          const auto wait_start = std::chrono::steady_clock::now();
+          const bool res = waitForData(socket);
+          waited += std::chrono::steady_clock::now() - wait_start;
+          return res;
+        },
+        local_path_.empty() ? nullptr : &files);
+
+    if (!keep_running_.load()) {
+      keep_running_server = false;
+      break;
+    }
+
+    if (status == Asn1ReceiveStatus::kClosed || status == Asn1ReceiveStatus::kAborted) {
       LOG_TRACE << "Primary has closed a connection socket";
       break;
     }
 
-    if (received < 0) {
-      LOG_ERROR << "Error while reading message data from a socket: " << strerror(errno);
+    if (status == Asn1ReceiveStatus::kReadError) {
+      LOG_ERROR << "Error while reading message data from a socket";
       break;
     }
 
-    if (res.code != RC_OK) {
+    if (status != Asn1ReceiveStatus::kOk) {
       LOG_ERROR << "Failed to decode a message received from Primary";
       break;
     }
 
     LOG_DEBUG << "Received a request from Primary: " << request_msg->toStr();
+    const RequestMetrics& request_metrics = RequestMetrics::get(request_msg->present());
+    request_metrics.decode.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - receive_start - waited)
+            .count()));
     Asn1Message::Ptr response_msg = Asn1Message::Empty();
-    MsgHandler::ReturnCode handle_status_code = msg_handler_.handleMsg(request_msg, response_msg);
+    MsgHandler::ReturnCode handle_status_code;
+    if (request_msg->present() == AKIpUptaneMes_PR_uploadRawReq) {
+      // The image data follows the request, without being encoded
+      const long length = request_msg->uploadRawReq()->length;  // NOLINT(google-runtime-int)
+      if (length < 0) {
+        LOG_ERROR << "Invalid raw data length received from Primary: " << length;
+        break;
+      }
+      const long* file_offset = request_msg->uploadRawReq()->fileOffset;  // NOLINT(google-runtime-int)
+      if (file_offset != nullptr && (*file_offset < 0 || files.empty())) {
+        LOG_ERROR << "Invalid image file passed by Primary";
+        break;
+      }
+      // the data is read from the file passed with the request, rather than from the connection
+      std::unique_ptr<RawDataReader> raw_data;
+      if (file_offset != nullptr) {
+        raw_data = std::make_unique<RawDataReader>(std::move(files.front()), static_cast<uint64_t>(*file_offset),
+                                                   static_cast<uint64_t>(length));
+        files.pop_front();
+      } else {
+        raw_data = std::make_unique<RawDataReader>(socket, buffer, static_cast<uint64_t>(length));
+      }
+      handle_status_code = msg_handler_.handleRawMsg(request_msg, *raw_data, response_msg);
+      if (handle_status_code != MsgHandler::ReturnCode::kUnkownMsg && !raw_data->discard()) {
+        break;
+      }
+    } else {
+      // interim messages go out on the connection before the response
+      auto notify = [socket, &out_buffer](const Asn1Message::Ptr& msg) {
+        return sendResponseMessage(socket, out_buffer, msg);
+      };
+      handle_status_code = msg_handler_.handleMsgWithNotifier(request_msg, notify, response_msg);
+    }
 
     switch (handle_status_code) {
       case MsgHandler::ReturnCode::kRebootRequired: {
         exit_reason_ = ExitReason::kRebootNeeded;
-        keep_running_current_session = sendResponseMessage(socket, response_msg);
+        metrics::ScopedTimer timer(request_metrics.send);
+        keep_running_current_session = sendResponseMessage(socket, out_buffer, response_msg);
         if (reboot_after_install_) {
           keep_running_server = keep_running_current_session = false;
         }
         break;
       }
       case MsgHandler::ReturnCode::kOk: {
-        keep_running_current_session = sendResponseMessage(socket, response_msg);
+        metrics::ScopedTimer timer(request_metrics.send);
+        keep_running_current_session = sendResponseMessage(socket, out_buffer, response_msg);
         break;
       }
       case MsgHandler::ReturnCode::kUnkownMsg:
@@ -177,19 +338,15 @@ void SecondaryTcpServer::wait_until_running(int timeout) {
   running_condition_.wait_for(lock, std::chrono::seconds(timeout), [&] { return is_running_; });
 }
 
-bool sendResponseMessage(int socket_fd, const Asn1Message::Ptr &resp_msg) {
+bool sendResponseMessage(int socket_fd, Asn1OutputBuffer &out, const Asn1Message::Ptr &resp_msg) {
   LOG_DEBUG << "Encoding and sending response message";
 
-  int optval = 0;
-  setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(int));
-  asn_enc_rval_t encode_result = der_encode(&asn_DEF_AKIpUptaneMes, &resp_msg->msg_, Asn1SocketWriteCallback,
-                                            reinterpret_cast<void *>(&socket_fd));
-  if (encode_result.encoded == -1) {
+  if (!out.encode(resp_msg)) {
     LOG_ERROR << "Failed to encode a response message";
     return false;  // write error
   }
-  optval = 1;
-  setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(int));
 
-  return true;
+  const bool sent = out.send(socket_fd);
+  out.clear();
+  return sent;
 }
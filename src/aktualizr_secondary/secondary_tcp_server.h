@@ -3,15 +3,27 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <thread>
 
 #include "utilities/utils.h"
 
 class MsgHandler;
+class UnixTransport;
 
 /**
  * Listens on a socket, decodes calls (ASN.1) and forwards them to an Uptane Secondary
  * implementation
+ *
+ * With max_connections > 1, each connection is served in its own thread, so that
+ * a slow or stuck Primary connection doesn't block the others. Further connections
+ * wait in the listen backlog until a session ends. The message handler has to be
+ * thread safe then, like MsgDispatcher.
+ *
+ * It listens on a TCP port, or on a Unix domain socket for a Primary on the
+ * same host, see Asn1Transport.
  */
 class SecondaryTcpServer {
  public:
@@ -22,8 +34,10 @@ class SecondaryTcpServer {
   };
 
   SecondaryTcpServer(MsgHandler& msg_handler, const std::string& primary_ip, in_port_t primary_port, in_port_t port = 0,
-                     bool reboot_after_install = false);
-  ~SecondaryTcpServer() = default;
+                     bool reboot_after_install = false, size_t max_connections = 1);
+  SecondaryTcpServer(MsgHandler& msg_handler, const UnixTransport& local, bool reboot_after_install = false,
+                     size_t max_connections = 1);
+  ~SecondaryTcpServer();
   SecondaryTcpServer(const SecondaryTcpServer&) = delete;
   SecondaryTcpServer(SecondaryTcpServer&&) = delete;
   SecondaryTcpServer& operator=(const SecondaryTcpServer&) = delete;
@@ -37,17 +51,40 @@ class SecondaryTcpServer {
 
   void wait_until_running(int timeout = 10);
 
+  // 0 on a Unix domain socket
   in_port_t port() const;
   ExitReason exit_reason() const;
 
  private:
+  struct Session {
+    std::thread thread;
+    bool done{false};
+  };
+
   bool HandleOneConnection(int socket);
+  // false if the server is being stopped
+  bool waitForData(int socket) const;
+  void startSession(int con_fd);
+  // joins the sessions that are done and returns how many are left, must be called with sessions_mutex_ held
+  size_t reapSessions();
+  void joinSessions();
+  void wakeUpAccept() const;
+
+  static constexpr int kStopCheckIntervalMs{500};
 
   MsgHandler& msg_handler_;
-  ListenSocket listen_socket_;
+  std::unique_ptr<Socket> listen_socket_;
+  in_port_t port_{0};
+  // empty for TCP
+  boost::filesystem::path local_path_;
   std::atomic<bool> keep_running_;
   bool reboot_after_install_;
-  ExitReason exit_reason_{ExitReason::kNotApplicable};
+  const size_t max_connections_;
+  std::atomic<ExitReason> exit_reason_{ExitReason::kNotApplicable};
+
+  std::list<Session> sessions_;
+  std::mutex sessions_mutex_;
+  std::condition_variable sessions_condition_;
 
   bool is_running_;
   std::mutex running_condition_mutex_;
@@ -1,6 +1,8 @@
 #ifndef AKTUALIZR_SECONDARY_UPDATE_AGENT_H
 #define AKTUALIZR_SECONDARY_UPDATE_AGENT_H
 
+#include <functional>
+
 #include "crypto/crypto.h"
 #include "uptane/tuf.h"
 
@@ -21,8 +23,22 @@ class UpdateAgent {
   virtual void completeInstall() = 0;
   virtual data::InstallationResult applyPendingInstall(const Uptane::Target& target) = 0;
 
+  // called with the progress of install() in percent, by the agents that can tell
+  using InstallProgressCb = std::function<void(unsigned int progress)>;
+  void setInstallProgressCb(InstallProgressCb install_progress_cb) {
+    install_progress_cb_ = std::move(install_progress_cb);
+  }
+
  protected:
   UpdateAgent() = default;
+  void reportInstallProgress(unsigned int progress) const {
+    if (install_progress_cb_) {
+      install_progress_cb_(progress);
+    }
+  }
+
+ private:
+  InstallProgressCb install_progress_cb_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_UPDATE_AGENT_H
@@ -2,10 +2,29 @@
 
 #include <boost/filesystem.hpp>
 
+#include <algorithm>
 #include <fstream>
+#include <vector>
+
 #include "crypto/crypto.h"
+#include "delta_patch.h"
 #include "logging/logging.h"
+#include "package_manager/downloadsink.h"
 #include "uptane/manifest.h"
+#include "utilities/utils.h"
+
+FileUpdateAgent::FileUpdateAgent(boost::filesystem::path target_filepath, std::string target_name)
+    : target_filepath_{std::move(target_filepath)},
+      new_target_filepath_{target_filepath_.string() + ".newtarget"},
+      current_target_name_{std::move(target_name)} {}
+
+FileUpdateAgent::FileUpdateAgent(boost::filesystem::path target_filepath, boost::filesystem::path new_target_filepath,
+                                 std::string target_name)
+    : target_filepath_{std::move(target_filepath)},
+      new_target_filepath_{std::move(new_target_filepath)},
+      current_target_name_{std::move(target_name)} {}
+
+FileUpdateAgent::~FileUpdateAgent() = default;
 
 // TODO(OTA-4939): Unify this with the check in
 // SotaUptaneClient::getNewTargets() and make it more generic.
@@ -30,49 +49,144 @@ bool FileUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& installe
 }
 
 data::InstallationResult FileUpdateAgent::install(const Uptane::Target& target) {
-  if (!boost::filesystem::exists(new_target_filepath_)) {
+  auto result = checkReceivedImage(target);
+  if (!result.isSuccess()) {
+    return result;
+  }
+
+  result = applyDelta(target);
+  if (!result.isSuccess()) {
+    return result;
+  }
+
+  boost::filesystem::rename(new_target_filepath_, target_filepath_);
+
+  if (boost::filesystem::exists(new_target_filepath_)) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                    "The target image has not been installed");
+  }
+
+  if (!boost::filesystem::exists(target_filepath_)) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                    "The target image has not been installed");
+  }
+
+  current_target_name_ = target.filename();
+  endReceiving();
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+data::InstallationResult FileUpdateAgent::checkReceivedImage(const Uptane::Target& target) {
+  if (!flushReceived(true)) {
+    restartReceiving();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Failed to write the received target image");
+  }
+
+  if (new_target_hasher_ == nullptr) {
     LOG_ERROR << "The target image has not been received";
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "The target image has not been received");
   }
 
-  auto received_target_image_size = boost::filesystem::file_size(new_target_filepath_);
-  if (received_target_image_size != target.length()) {
-    LOG_ERROR << "Received image size does not match the size specified in Target metadata: "
-              << received_target_image_size << " != " << target.length();
-    boost::filesystem::remove(new_target_filepath_);
+  if (new_target_size_ != target.length()) {
+    LOG_ERROR << "Received image size does not match the size specified in Target metadata: " << new_target_size_
+              << " != " << target.length();
+    const uint64_t received_target_image_size = new_target_size_;
+    restartReceiving();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "Received image size does not match the size specified in Target metadata: " +
                                         std::to_string(received_target_image_size) +
                                         " != " + std::to_string(target.length()));
   }
 
-  if (!target.MatchHash(new_target_hasher_->getHash())) {
+  // a hash can only be finished once
+  const std::vector<Hash> received_hashes = new_target_hasher_->getHashes();
+  if (!target.MatchHashes(received_hashes)) {
     LOG_ERROR << "The received image's hash does not match the hash specified in Target metadata: "
-              << new_target_hasher_->getHash() << " != " << getTargetHash(target).HashString();
+              << received_hashes.front() << " != " << getTargetHash(target).HashString();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "The received image's hash does not match the hash specified in Target metadata: " +
-                                        new_target_hasher_->getHash().HashString() +
+                                        received_hashes.front().HashString() +
                                         " != " + getTargetHash(target).HashString());
   }
 
-  boost::filesystem::rename(new_target_filepath_, target_filepath_);
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
 
-  if (boost::filesystem::exists(new_target_filepath_)) {
+data::InstallationResult FileUpdateAgent::applyDelta(const Uptane::Target& target) {
+  boost::optional<DeltaTarget> delta;
+  try {
+    delta = DeltaTarget::fromTarget(target);
+  } catch (const std::exception& e) {
+    LOG_ERROR << e.what();
+    restartReceiving();
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, e.what());
+  }
+  if (!delta) {
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
+
+  Uptane::InstalledImageInfo installed_image_info;
+  getInstalledImageInfo(installed_image_info);
+  if (installed_image_info.hash != delta->base_sha256) {
+    LOG_ERROR << "The delta image does not apply to the installed image: " << delta->base_sha256
+              << " != " << installed_image_info.hash;
+    restartReceiving();
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
-                                    "The target image has not been installed");
+                                    "The delta image does not apply to the installed image: " + delta->base_sha256 +
+                                        " != " + installed_image_info.hash);
   }
 
-  if (!boost::filesystem::exists(target_filepath_)) {
+  const boost::filesystem::path patched_filepath = new_target_filepath_.string() + ".patched";
+  auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+  uint64_t patched_size = 0;
+  try {
+    unsigned int last_progress = 0;
+    patched_size = DeltaPatch::apply(target_filepath_, new_target_filepath_, patched_filepath, *hasher,
+                                     [this, &last_progress](uint64_t written, uint64_t total) {
+                                       // the rest of the installation is quick next to patching
+                                       const auto progress = static_cast<unsigned int>(written * 99 / total);
+                                       if (progress != last_progress) {
+                                         last_progress = progress;
+                                         reportInstallProgress(progress);
+                                       }
+                                     });
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Failed to apply the delta image: " << e.what();
+    boost::system::error_code ec;
+    boost::filesystem::remove(patched_filepath, ec);
+    restartReceiving();
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
-                                    "The target image has not been installed");
+                                    std::string("Failed to apply the delta image: ") + e.what());
   }
 
-  current_target_name_ = target.filename();
-  new_target_hasher_.reset();
+  if (patched_size != delta->length || hasher->getHash() != Hash(Hash::Type::kSha256, delta->sha256)) {
+    LOG_ERROR << "The patched image does not match the delta Target: " << hasher->getHash() << " != " << delta->sha256;
+    boost::system::error_code ec;
+    boost::filesystem::remove(patched_filepath, ec);
+    restartReceiving();
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                    "The patched image does not match the delta Target: " +
+                                        hasher->getHash().HashString() + " != " + delta->sha256);
+  }
+
+  LOG_INFO << "Applied the delta image, the new image is " << patched_size << " bytes.";
+  boost::filesystem::rename(patched_filepath, new_target_filepath_);
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 }
 
+void FileUpdateAgent::endReceiving() {
+  new_target_hasher_.reset();
+  new_target_size_ = 0;
+  new_target_synced_ = 0;
+  receiving_target_.clear();
+  if (!resume_file_.empty()) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(resume_file_, ec);
+  }
+}
+
 void FileUpdateAgent::completeInstall() {}
 
 data::InstallationResult FileUpdateAgent::applyPendingInstall(const Uptane::Target& target) {
@@ -81,65 +195,216 @@ data::InstallationResult FileUpdateAgent::applyPendingInstall(const Uptane::Targ
                                   "Applying pending updates is not supported by the file update agent");
 }
 
-data::InstallationResult FileUpdateAgent::receiveData(const Uptane::Target& target, const uint8_t* data, size_t size) {
-  std::ofstream target_file(new_target_filepath_.c_str(),
-                            std::ofstream::out | std::ofstream::binary | std::ofstream::app);
-
-  if (!target_file.good()) {
+data::InstallationResult FileUpdateAgent::startReceiving(const Uptane::Target& target) {
+  restartReceiving();
+  if (!createNewTarget()) {
     LOG_ERROR << "Failed to open a new target image file";
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "Failed to open a new target image file");
   }
+  // all the hashes of the Target are checked, in one pass
+  new_target_hasher_ = MultiPartHasher::create(target.hashes());
+  receiving_target_ = receivingId(target);
+  return openNewTarget(target);
+}
 
-  auto current_new_image_size = target_file.tellp();
-  if (-1 == current_new_image_size) {
-    LOG_ERROR << "Failed to obtain a size of the new target image that is being uploaded";
-    target_file.close();
+data::InstallationResult FileUpdateAgent::openNewTarget(const Uptane::Target& target) {
+  try {
+    new_target_sink_ =
+        std_::make_unique<DownloadSink>(new_target_filepath_.string(), new_target_size_, *new_target_hasher_, false);
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Failed to open a new target image file: " << e.what();
+    new_target_hasher_.reset();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "Failed to obtain a size of the new target image that is being uploaded");
+                                    "Failed to open a new target image file");
   }
+  new_target_sink_->reserve(target.length());
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
 
-  if (static_cast<uint64_t>(current_new_image_size) >= target.length()) {
-    LOG_ERROR << "The size of the received image data exceeds the expected Target image size: "
-              << current_new_image_size << " != " << target.length();
-    target_file.close();
-    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "The size of the received image data exceeds the expected Target image size: " +
-                                        std::to_string(current_new_image_size) +
-                                        " != " + std::to_string(target.length()));
+bool FileUpdateAgent::flushReceived(bool end) {
+  if (new_target_sink_ == nullptr) {
+    return true;
   }
-
-  if (current_new_image_size == 0) {
-    new_target_hasher_ = MultiPartHasher::create(getTargetHash(target).type());
+  bool ok = new_target_sink_->finish();
+  if (!ok) {
+    LOG_ERROR << new_target_sink_->error();
   }
+  if (end) {
+    ok = new_target_sink_->sync() && ok;
+    new_target_sink_.reset();
+  }
+  return ok;
+}
 
-  target_file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
-  auto written_data_size = target_file.tellp() - current_new_image_size;
+data::InstallationResult FileUpdateAgent::receiveData(const Uptane::Target& target, const uint8_t* data, size_t size) {
+  if (new_target_sink_ == nullptr && new_target_size_ == 0) {
+    auto result = startReceiving(target);
+    if (!result.isSuccess()) {
+      return result;
+    }
+  } else if (new_target_sink_ == nullptr && new_target_size_ < target.length()) {
+    // resumed after a restart
+    auto result = openNewTarget(target);
+    if (!result.isSuccess()) {
+      restartReceiving();
+      return result;
+    }
+  }
 
-  if (written_data_size < 0 || static_cast<size_t>(written_data_size) != size) {
-    LOG_ERROR << "The size of data written is not equal to the received data size: " << written_data_size
-              << " != " << size;
-    target_file.close();
+  if (new_target_size_ >= target.length()) {
+    LOG_ERROR << "The size of the received image data exceeds the expected Target image size: " << new_target_size_
+              << " != " << target.length();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "The size of data written is not equal to the received data size: " +
-                                        std::to_string(written_data_size) + " != " + std::to_string(size));
+                                    "The size of the received image data exceeds the expected Target image size: " +
+                                        std::to_string(new_target_size_) + " != " + std::to_string(target.length()));
   }
 
-  target_file.close();
+  if (!new_target_sink_->write(reinterpret_cast<const char*>(data), size)) {
+    const std::string error = new_target_sink_->error();
+    LOG_ERROR << "Failed to write the new target image: " << error;
+    restartReceiving();
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Failed to write the new target image: " + error);
+  }
+  new_target_size_ += size;
 
-  auto total_size = current_new_image_size + written_data_size;
   LOG_DEBUG << "Received and stored data of a new target image."
                " Received in this request (bytes): "
-            << size << "; total received so far: " << total_size << "; expected total: " << target.length();
-  if (static_cast<uint64_t>(total_size) == target.length()) {
-    LOG_INFO << "Successfully received and stored new target image of " << total_size << " bytes.";
+            << size << "; total received so far: " << new_target_size_ << "; expected total: " << target.length();
+  if (new_target_size_ >= target.length()) {
+    // the whole image is there, so that it is on the disk before install
+    if (!flushReceived(true)) {
+      restartReceiving();
+      return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                      "Failed to write the new target image");
+    }
+    if (new_target_size_ == target.length()) {
+      LOG_INFO << "Successfully received and stored new target image of " << new_target_size_ << " bytes.";
+      saveResumeState(target, new_target_size_);
+    }
+  } else if (new_target_size_ - new_target_synced_ >= kSyncInterval) {
+    const uint64_t written = new_target_sink_->drain();
+    if (new_target_sink_->sync()) {
+      saveResumeState(target, written);
+    }
+    new_target_synced_ = new_target_size_;
   }
 
-  new_target_hasher_->update(data, size);
-
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 }
 
+void FileUpdateAgent::restartReceiving() {
+  new_target_sink_.reset();
+  removeNewTarget();
+  endReceiving();
+}
+
+bool FileUpdateAgent::createNewTarget() {
+  std::ofstream target_file(new_target_filepath_.c_str(), std::ofstream::out | std::ofstream::binary);
+  return target_file.good();
+}
+
+void FileUpdateAgent::removeNewTarget() {
+  boost::system::error_code ec;
+  boost::filesystem::remove(new_target_filepath_, ec);
+}
+
+bool FileUpdateAgent::checkReceivedData(const Uptane::Target& target, const std::string& hex_digest) {
+  if (new_target_hasher_ == nullptr) {
+    // nothing to compare with
+    return true;
+  }
+  // the data still in the buffers has to be hashed first
+  if (!flushReceived(false)) {
+    return false;
+  }
+  // hash a copy, so that the image can still be hashed further
+  auto hasher = MultiPartHasher::create(target.hashes());
+  if (!hasher->setState(new_target_hasher_->getState())) {
+    return true;
+  }
+  const Hash running = hasher->getHash();
+  return running == Hash(running.type(), hex_digest);
+}
+
+uint64_t FileUpdateAgent::resumableData(const Uptane::Target& target, std::string* hex_digest) {
+  if ((new_target_hasher_ == nullptr || receiving_target_ != receivingId(target)) && !loadResumeState(target)) {
+    return 0;
+  }
+  if (new_target_size_ > target.length() || !flushReceived(false)) {
+    return 0;
+  }
+  auto hasher = MultiPartHasher::create(target.hashes());
+  if (!hasher->setState(new_target_hasher_->getState())) {
+    return 0;
+  }
+  *hex_digest = hasher->getHexDigest();
+  return new_target_size_;
+}
+
+bool FileUpdateAgent::resumeReceiving(const Uptane::Target& target, uint64_t offset) {
+  return new_target_hasher_ != nullptr && receiving_target_ == receivingId(target) && offset == new_target_size_;
+}
+
+bool FileUpdateAgent::loadResumeState(const Uptane::Target& target) {
+  if (resume_file_.empty() || !boost::filesystem::exists(resume_file_)) {
+    return false;
+  }
+  const Json::Value state = Utils::parseJSONFile(resume_file_);
+  if (!state.isObject() || state["target"].asString() != target.filename() ||
+      state["hash"].asString() != getTargetHash(target).HashString() || !state["length"].isIntegral()) {
+    return false;
+  }
+  const uint64_t length = state["length"].asUInt64();
+  if (length == 0 || length > target.length()) {
+    return false;
+  }
+
+  // hashing the data again takes a fraction of the time it takes to receive it
+  auto hasher = MultiPartHasher::create(target.hashes());
+  std::ifstream file(new_target_filepath_.c_str(), std::ios::binary);
+  std::vector<char> buffer(1024 * 1024);
+  uint64_t hashed = 0;
+  while (hashed < length && file) {
+    const auto size = static_cast<size_t>(std::min<uint64_t>(buffer.size(), length - hashed));
+    file.read(buffer.data(), static_cast<std::streamsize>(size));
+    hasher->update(reinterpret_cast<const unsigned char*>(buffer.data()), static_cast<uint64_t>(file.gcount()));
+    hashed += static_cast<uint64_t>(file.gcount());
+  }
+  if (hashed != length) {
+    LOG_WARNING << "The image data received before the restart is missing from " << new_target_filepath_;
+    return false;
+  }
+
+  new_target_sink_.reset();
+  new_target_hasher_ = std::move(hasher);
+  new_target_size_ = length;
+  new_target_synced_ = length;
+  receiving_target_ = receivingId(target);
+  LOG_INFO << "Found " << length << " bytes of target image " << target.filename() << " received before a restart";
+  return true;
+}
+
+void FileUpdateAgent::saveResumeState(const Uptane::Target& target, uint64_t synced_size) {
+  if (resume_file_.empty()) {
+    return;
+  }
+  Json::Value state;
+  state["target"] = target.filename();
+  state["hash"] = getTargetHash(target).HashString();
+  state["length"] = static_cast<Json::UInt64>(synced_size);
+  try {
+    Utils::writeFile(resume_file_, Utils::jsonToCanonicalStr(state));
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Failed to save the upload state: " << e.what();
+  }
+}
+
+std::string FileUpdateAgent::receivingId(const Uptane::Target& target) {
+  return target.filename() + " " + getTargetHash(target).HashString();
+}
+
 Hash FileUpdateAgent::getTargetHash(const Uptane::Target& target) {
   // TODO(OTA-4831): check target.hashes() size.
   return target.hashes()[0];
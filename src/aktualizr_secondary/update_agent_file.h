@@ -1,31 +1,100 @@
 #ifndef AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
 #define AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
 
+#include <memory>
+
 #include "update_agent.h"
 
+class DownloadSink;
+
 class FileUpdateAgent : public UpdateAgent {
  public:
-  FileUpdateAgent(boost::filesystem::path target_filepath, std::string target_name)
-      : target_filepath_{std::move(target_filepath)},
-        new_target_filepath_{target_filepath_.string() + ".newtarget"},
-        current_target_name_{std::move(target_name)} {}
+  FileUpdateAgent(boost::filesystem::path target_filepath, std::string target_name);
+  ~FileUpdateAgent() override;
+  FileUpdateAgent(const FileUpdateAgent&) = delete;
+  FileUpdateAgent(FileUpdateAgent&&) = delete;
+  FileUpdateAgent& operator=(const FileUpdateAgent&) = delete;
+  FileUpdateAgent& operator=(FileUpdateAgent&&) = delete;
 
   bool isTargetSupported(const Uptane::Target& target) const override;
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
 
   virtual data::InstallationResult receiveData(const Uptane::Target& target, const uint8_t* data, size_t size);
+  // drop the data received so far, to receive the image from the start again
+  void restartReceiving();
+  // false if the data received so far doesn't match a running hex digest of the image
+  bool checkReceivedData(const Uptane::Target& target, const std::string& hex_digest);
+  /**
+   * The data of `target` kept from an interrupted upload, that a new upload
+   * can continue from: its size, and its hex digest in `hex_digest`. The data
+   * is either still there from before the connection was lost, or has been
+   * synced to the disk before a restart. Returns 0 if there is no such data.
+   */
+  uint64_t resumableData(const Uptane::Target& target, std::string* hex_digest);
+  // continue receiving `target` after the first `offset` bytes, as given by resumableData()
+  bool resumeReceiving(const Uptane::Target& target, uint64_t offset);
+  // keep track of the data synced to the disk in `resume_file`, to resume uploads after a restart
+  void setResumeFile(boost::filesystem::path resume_file) { resume_file_ = std::move(resume_file); }
   data::InstallationResult install(const Uptane::Target& target) override;
 
   void completeInstall() override;
   data::InstallationResult applyPendingInstall(const Uptane::Target& target) override;
 
- private:
+ protected:
+  // for agents that receive the image somewhere else than next to the installed file
+  FileUpdateAgent(boost::filesystem::path target_filepath, boost::filesystem::path new_target_filepath,
+                  std::string target_name);
+
   static Hash getTargetHash(const Uptane::Target& target);
+  const boost::filesystem::path& newTargetPath() const { return new_target_filepath_; }
+  void setNewTargetPath(boost::filesystem::path new_target_filepath) {
+    new_target_filepath_ = std::move(new_target_filepath);
+  }
+  // prepare the destination of a new image, which is then written from its start
+  virtual bool createNewTarget();
+  // drop the destination of an image that won't be installed
+  virtual void removeNewTarget();
+  /**
+   * Finish receiving and check that the whole image has been received, with
+   * the size and hash given by the Target.
+   */
+  data::InstallationResult checkReceivedImage(const Uptane::Target& target);
+  // forget about the received image once it's installed
+  void endReceiving();
+
+ private:
+  static std::string receivingId(const Uptane::Target& target);
+  data::InstallationResult startReceiving(const Uptane::Target& target);
+  // open the received image to write it after the first new_target_size_ bytes
+  data::InstallationResult openNewTarget(const Uptane::Target& target);
+  // take the data of `target` synced before a restart, as recorded in the resume file
+  bool loadResumeState(const Uptane::Target& target);
+  void saveResumeState(const Uptane::Target& target, uint64_t synced_size);
+  /**
+   * For a delta Target, apply the received patch to the installed image, and
+   * put the result in place of the patch once it has been checked against
+   * the Target.
+   */
+  data::InstallationResult applyDelta(const Uptane::Target& target);
+  // write out and hash everything received so far, and end the transfer when
+  // `end` is set
+  bool flushReceived(bool end);
+
+  // received data is flushed to the disk every this many bytes
+  static constexpr uint64_t kSyncInterval{64 * 1024 * 1024};
 
   const boost::filesystem::path target_filepath_;
-  const boost::filesystem::path new_target_filepath_;
+  boost::filesystem::path new_target_filepath_;
   std::string current_target_name_;
   std::shared_ptr<MultiPartHasher> new_target_hasher_;
+  // The file being received stays open for the whole transfer, and the data
+  // is written through a few large buffers
+  std::unique_ptr<DownloadSink> new_target_sink_;
+  uint64_t new_target_size_{0};
+  uint64_t new_target_synced_{0};
+  // the Target being received, by name and hash
+  std::string receiving_target_;
+  boost::filesystem::path resume_file_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
@@ -1,9 +1,11 @@
 #include "update_agent_ostree.h"
 
+#include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/trim.hpp>
 
 #include "logging/logging.h"
 #include "package_manager/ostreemanager.h"
+#include "utilities/flow_control.h"
 
 // TODO: consider moving this and SecondaryProvider::getTreehubCredentials to
 // encapsulate them in one shared place if possible.
@@ -40,18 +42,22 @@ bool OstreeUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& instal
 }
 
 data::InstallationResult OstreeUpdateAgent::downloadTargetRev(const Uptane::Target& target,
-                                                              const std::string& treehub_tls_creds) {
+                                                              const std::string& treehub_tls_creds,
+                                                              const api::FlowControlToken* token) {
   std::string treehub_server;
 
   try {
-    std::string ca;
-    std::string cert;
-    std::string pkey;
-    std::string server_url;
-    extractCredentialsArchive(treehub_tls_creds, &ca, &cert, &pkey, &server_url);
-    keyMngr_->loadKeys(&pkey, &cert, &ca);
-    boost::trim(server_url);
-    treehub_server = server_url;
+    std::lock_guard<std::mutex> lock(creds_mutex_);
+    if (treehub_tls_creds != creds_archive_) {
+      creds_archive_.clear();
+      extractCredentialsArchive(treehub_tls_creds, &ca_, &cert_, &pkey_, &treehub_server_);
+      boost::trim(treehub_server_);
+      creds_archive_ = treehub_tls_creds;
+    } else {
+      LOG_DEBUG << "Treehub credentials are unchanged";
+    }
+    keyMngr_->loadKeys(&pkey_, &cert_, &ca_);
+    treehub_server = treehub_server_;
   } catch (std::runtime_error& exc) {
     LOG_ERROR << exc.what();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
@@ -64,8 +70,8 @@ data::InstallationResult OstreeUpdateAgent::downloadTargetRev(const Uptane::Targ
   std::chrono::milliseconds wait(500);
 
   for (; tries < max_tries; tries++) {
-    result = OstreeManager::pull(sysrootPath_, treehub_server, *keyMngr_, target);
-    if (result.success) {
+    result = OstreeManager::pull(sysrootPath_, treehub_server, *keyMngr_, target, token);
+    if (result.success || (token != nullptr && token->hasAborted())) {
       break;
     } else if (tries < max_tries - 1) {
       std::this_thread::sleep_for(wait);
@@ -106,20 +112,10 @@ data::InstallationResult OstreeUpdateAgent::applyPendingInstall(const Uptane::Ta
 
 void extractCredentialsArchive(const std::string& archive, std::string* ca, std::string* cert, std::string* pkey,
                                std::string* treehub_server) {
-  {
-    std::stringstream as(archive);
-    *ca = Utils::readFileFromArchive(as, "ca.pem");
-  }
-  {
-    std::stringstream as(archive);
-    *cert = Utils::readFileFromArchive(as, "client.pem");
-  }
-  {
-    std::stringstream as(archive);
-    *pkey = Utils::readFileFromArchive(as, "pkey.pem");
-  }
-  {
-    std::stringstream as(archive);
-    *treehub_server = Utils::readFileFromArchive(as, "server.url", true);
-  }
+  std::stringstream as(archive);
+  auto files = Utils::readFilesFromArchive(as, {"ca.pem", "client.pem", "pkey.pem", "server.url"});
+  *ca = std::move(files["ca.pem"]);
+  *cert = std::move(files["client.pem"]);
+  *pkey = std::move(files["pkey.pem"]);
+  *treehub_server = boost::trim_copy_if(files["server.url"], boost::is_any_of(" \t\r\n"));
 }
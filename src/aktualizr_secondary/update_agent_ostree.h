@@ -1,10 +1,15 @@
 #ifndef AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
 #define AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
 
+#include <mutex>
+
 #include "update_agent.h"
 
 class OstreeManager;
 class KeyManager;
+namespace api {
+class FlowControlToken;
+}
 
 class OstreeUpdateAgent : public UpdateAgent {
  public:
@@ -18,7 +23,9 @@ class OstreeUpdateAgent : public UpdateAgent {
   bool isTargetSupported(const Uptane::Target& target) const override;
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
 
-  data::InstallationResult downloadTargetRev(const Uptane::Target& target, const std::string& treehub_tls_creds);
+  // `token` can abort the download from another thread
+  data::InstallationResult downloadTargetRev(const Uptane::Target& target, const std::string& treehub_tls_creds,
+                                             const api::FlowControlToken* token = nullptr);
 
   data::InstallationResult install(const Uptane::Target& target) override;
 
@@ -31,6 +38,15 @@ class OstreeUpdateAgent : public UpdateAgent {
   std::shared_ptr<KeyManager> keyMngr_;
   std::shared_ptr<OstreeManager> ostreePackMan_;
   const ::std::string targetname_prefix_;
+
+  // the credentials extracted from the last archive, which the Primary sends
+  // again unchanged with each update
+  std::mutex creds_mutex_;
+  std::string creds_archive_;
+  std::string ca_;
+  std::string cert_;
+  std::string pkey_;
+  std::string treehub_server_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
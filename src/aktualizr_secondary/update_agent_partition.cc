@@ -0,0 +1,112 @@
+#include "update_agent_partition.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+static Json::Value loadState(const boost::filesystem::path& state_file) {
+  if (!boost::filesystem::exists(state_file)) {
+    return Json::Value();
+  }
+  try {
+    return Utils::parseJSONFile(state_file);
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Could not read the partition state from " << state_file << ": " << e.what();
+    return Json::Value();
+  }
+}
+
+PartitionUpdateAgent::PartitionUpdateAgent(Slots slots, boost::filesystem::path state_file)
+    : FileUpdateAgent(slots[0], slots[1], "unknown"), slots_{std::move(slots)}, state_file_{std::move(state_file)} {
+  const Json::Value state = loadState(state_file_);
+  if (state.isObject()) {
+    active_slot_ = (state["active_slot"].asUInt() == 1) ? 1 : 0;
+    installed_image_.name = state["name"].asString();
+    installed_image_.len = state["length"].asUInt64();
+    installed_image_.hash = state["sha256"].asString();
+  }
+  setNewTargetPath(slots_[1 - active_slot_]);
+}
+
+std::shared_ptr<PartitionUpdateAgent> PartitionUpdateAgent::fromConfig(const PackageConfig& pacman,
+                                                                       const boost::filesystem::path& state_file) {
+  Slots slots;
+  const std::array<const char*, 2> options{"partition_a", "partition_b"};
+  for (size_t i = 0; i < slots.size(); ++i) {
+    auto option = pacman.extra.find(options[i]);
+    if (option == pacman.extra.end() || option->second.empty()) {
+      throw std::runtime_error(std::string("The partition update agent needs the pacman.") + options[i] + " option");
+    }
+    slots[i] = option->second;
+  }
+  return std::make_shared<PartitionUpdateAgent>(slots, state_file);
+}
+
+bool PartitionUpdateAgent::isTargetSupported(const Uptane::Target& target) const {
+  // a patch would have to be received somewhere else than in the slot
+  const Json::Value custom = target.custom_data();
+  if (custom.isObject() && custom.isMember("delta")) {
+    return false;
+  }
+  return FileUpdateAgent::isTargetSupported(target);
+}
+
+bool PartitionUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const {
+  if (installed_image_.name.empty()) {
+    // mimic the Primary's fake package manager behavior
+    auto unknown_target = Uptane::Target::Unknown();
+    installed_image_info.name = unknown_target.filename();
+    installed_image_info.len = unknown_target.length();
+    installed_image_info.hash = unknown_target.sha256Hash();
+  } else {
+    installed_image_info = installed_image_;
+  }
+  return true;
+}
+
+data::InstallationResult PartitionUpdateAgent::install(const Uptane::Target& target) {
+  auto result = checkReceivedImage(target);
+  if (!result.isSuccess()) {
+    return result;
+  }
+
+  const size_t new_slot = 1 - active_slot_;
+  Json::Value state;
+  state["active_slot"] = static_cast<Json::UInt>(new_slot);
+  state["name"] = target.filename();
+  state["length"] = static_cast<Json::UInt64>(target.length());
+  state["sha256"] = target.sha256Hash();
+  try {
+    Utils::writeFile(state_file_, state);
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Could not write the partition state to " << state_file_ << ": " << e.what();
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                    std::string("Could not switch to the new partition: ") + e.what());
+  }
+
+  LOG_INFO << "Installed " << target.filename() << " on " << slots_[new_slot];
+  active_slot_ = new_slot;
+  installed_image_ = target.getTargetImageInfo();
+  endReceiving();
+  setNewTargetPath(slots_[1 - active_slot_]);
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+bool PartitionUpdateAgent::createNewTarget() {
+  // the image is written over the old content of the slot, without truncating
+  // it, as that is not possible on a block device anyway
+  const int fd = open(newTargetPath().c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_ERROR << "Can't open partition " << newTargetPath() << ": " << std::strerror(errno);
+    return false;
+  }
+  close(fd);
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef AKTUALIZR_SECONDARY_UPDATE_AGENT_PARTITION_H
+#define AKTUALIZR_SECONDARY_UPDATE_AGENT_PARTITION_H
+
+#include <array>
+
+#include "update_agent_file.h"
+
+#define PACKAGE_MANAGER_PARTITION "partition"
+
+struct PackageConfig;
+
+/**
+ * Installs images on A/B partitions (or any two block devices or files).
+ *
+ * The image is received straight into the inactive slot and hashed on the
+ * way, so it is written once and needs no free space on the filesystem. Once
+ * its size and hash have been checked, installing it makes that slot the
+ * active one in a small state file, which the boot integration reads to pick
+ * the slot to boot.
+ */
+class PartitionUpdateAgent : public FileUpdateAgent {
+ public:
+  using Slots = std::array<boost::filesystem::path, 2>;
+
+  PartitionUpdateAgent(Slots slots, boost::filesystem::path state_file);
+
+  /**
+   * Take the slots from the `partition_a` and `partition_b` options of the
+   * pacman section.
+   * @throws std::runtime_error if one of them is missing.
+   */
+  static std::shared_ptr<PartitionUpdateAgent> fromConfig(const PackageConfig& pacman,
+                                                          const boost::filesystem::path& state_file);
+
+  // delta images are not supported
+  bool isTargetSupported(const Uptane::Target& target) const override;
+  bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
+  data::InstallationResult install(const Uptane::Target& target) override;
+
+  size_t activeSlot() const { return active_slot_; }
+
+ protected:
+  bool createNewTarget() override;
+  // the slot is left as it is, it is not used until an image is installed on it
+  void removeNewTarget() override {}
+
+ private:
+  const Slots slots_;
+  const boost::filesystem::path state_file_;
+  size_t active_slot_{0};
+  Uptane::InstalledImageInfo installed_image_;
+};
+
+#endif  // AKTUALIZR_SECONDARY_UPDATE_AGENT_PARTITION_H
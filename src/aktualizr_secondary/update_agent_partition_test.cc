@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "libaktualizr/config.h"
+#include "update_agent_partition.h"
+#include "utilities/utils.h"
+
+static Uptane::Target makeTarget(const std::string& name, const std::string& image) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = Hash::generate(Hash::Type::kSha256, image).HashString();
+  target_json["length"] = static_cast<Json::UInt64>(image.size());
+  return Uptane::Target(name, target_json);
+}
+
+class PartitionUpdateAgentTest : public ::testing::Test {
+ protected:
+  PartitionUpdateAgentTest() {
+    slots_ = {temp_dir_ / "slot_a", temp_dir_ / "slot_b"};
+    for (const auto& slot : slots_) {
+      Utils::writeFile(slot, std::string(4096, 'x'));
+    }
+    state_file_ = temp_dir_ / "partition.json";
+  }
+
+  static void receive(PartitionUpdateAgent& agent, const Uptane::Target& target, const std::string& image) {
+    for (size_t pos = 0; pos < image.size(); pos += 1000) {
+      const std::string piece = image.substr(pos, 1000);
+      ASSERT_TRUE(agent.receiveData(target, reinterpret_cast<const uint8_t*>(piece.data()), piece.size()).isSuccess());
+    }
+  }
+
+  TemporaryDirectory temp_dir_;
+  PartitionUpdateAgent::Slots slots_;
+  boost::filesystem::path state_file_;
+};
+
+/* Images are written to the inactive slot, which becomes the active one once
+ * installed, also for a new agent. */
+TEST_F(PartitionUpdateAgentTest, InstallAlternates) {
+  const std::string image_1(2500, '1');
+  const std::string image_2(3000, '2');
+  {
+    PartitionUpdateAgent agent(slots_, state_file_);
+    Uptane::InstalledImageInfo info;
+    ASSERT_TRUE(agent.getInstalledImageInfo(info));
+    EXPECT_EQ(info.name, Uptane::Target::Unknown().filename());
+    EXPECT_EQ(agent.activeSlot(), 0U);
+
+    const auto target = makeTarget("image-1", image_1);
+    receive(agent, target, image_1);
+    ASSERT_TRUE(agent.install(target).isSuccess());
+    EXPECT_EQ(agent.activeSlot(), 1U);
+    EXPECT_EQ(Utils::readFile(slots_[1]).substr(0, image_1.size()), image_1);
+    EXPECT_EQ(Utils::readFile(slots_[0]), std::string(4096, 'x'));
+  }
+
+  PartitionUpdateAgent agent(slots_, state_file_);
+  Uptane::InstalledImageInfo info;
+  ASSERT_TRUE(agent.getInstalledImageInfo(info));
+  EXPECT_EQ(info.name, "image-1");
+  EXPECT_EQ(info.len, image_1.size());
+  EXPECT_EQ(agent.activeSlot(), 1U);
+
+  const auto target = makeTarget("image-2", image_2);
+  receive(agent, target, image_2);
+  ASSERT_TRUE(agent.install(target).isSuccess());
+  EXPECT_EQ(agent.activeSlot(), 0U);
+  EXPECT_EQ(Utils::readFile(slots_[0]).substr(0, image_2.size()), image_2);
+}
+
+/* An image that doesn't match its Target is not activated, and the slot can
+ * be written again. */
+TEST_F(PartitionUpdateAgentTest, BadImage) {
+  PartitionUpdateAgent agent(slots_, state_file_);
+  const std::string image(2500, '1');
+  const auto target = makeTarget("image-1", image);
+
+  const std::string bad_image(2500, '0');
+  receive(agent, target, bad_image);
+  EXPECT_FALSE(agent.install(target).isSuccess());
+  EXPECT_EQ(agent.activeSlot(), 0U);
+  EXPECT_FALSE(boost::filesystem::exists(state_file_));
+
+  agent.restartReceiving();
+  receive(agent, target, image);
+  EXPECT_TRUE(agent.install(target).isSuccess());
+  EXPECT_EQ(agent.activeSlot(), 1U);
+}
+
+/* Both slots have to be configured. */
+TEST(PartitionUpdateAgent, FromConfig) {
+  TemporaryDirectory temp_dir;
+  PackageConfig pacman;
+  pacman.type = PACKAGE_MANAGER_PARTITION;
+  pacman.extra["partition_a"] = (temp_dir / "slot_a").string();
+  EXPECT_THROW(PartitionUpdateAgent::fromConfig(pacman, temp_dir / "partition.json"), std::runtime_error);
+  pacman.extra["partition_b"] = (temp_dir / "slot_b").string();
+  EXPECT_NE(PartitionUpdateAgent::fromConfig(pacman, temp_dir / "partition.json"), nullptr);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
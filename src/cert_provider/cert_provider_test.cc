@@ -316,6 +316,47 @@ TEST_F(AktualizrCertProviderTest, DeviceCertParams) {
   ASSERT_EQ(openssl.lastStdOut(), str(boost::format("%1%: OK\n") % device_cred_path.certFileFullPath.string()));
 }
 
+/**
+ * Verifies bulk generation: one key and certificate per device, generated in
+ * parallel, each in a subdirectory named after the device ID.
+ */
+TEST_F(AktualizrCertProviderTest, BulkGeneration) {
+  DeviceCredGenerator::ArgSet args;
+
+  args.fleetCA = test_args_.fleet_ca_cert;
+  args.fleetCAKey = test_args_.fleet_ca_private_key;
+  args.localDir = test_args_.test_dir;
+  args.commonName = "bulk";
+  args.rsaBits = "1024";
+  args.count = "4";
+  args.jobs = "2";
+
+  device_cred_gen_.run(args);
+  ASSERT_EQ(device_cred_gen_.lastExitCode(), 0) << device_cred_gen_.lastStdErr();
+
+  Process openssl("/usr/bin/openssl");
+  std::set<std::string> moduli;
+  for (int i = 1; i <= 4; ++i) {
+    const std::string device_id = "bulk-" + std::to_string(i);
+    const auto device_dir = boost::filesystem::path(test_args_.test_dir) / device_id;
+    DeviceCredGenerator::OutputPath device_cred_path(device_dir.string());
+    ASSERT_TRUE(boost::filesystem::exists(device_cred_path.privateKeyFileFullPath))
+        << device_cred_path.privateKeyFileFullPath;
+    ASSERT_TRUE(boost::filesystem::exists(device_cred_path.certFileFullPath)) << device_cred_path.certFileFullPath;
+
+    Cert cert(device_cred_path.certFileFullPath.string());
+    EXPECT_EQ(cert.getSubjectItemValue(NID_commonName), device_id);
+
+    openssl.run({"verify", "-CAfile", test_args_.fleet_ca_cert, device_cred_path.certFileFullPath.string()});
+    EXPECT_EQ(openssl.lastExitCode(), 0) << openssl.lastStdErr();
+    openssl.run({"rsa", "-in", device_cred_path.privateKeyFileFullPath.string(), "-noout", "-modulus"});
+    ASSERT_EQ(openssl.lastExitCode(), 0) << openssl.lastStdErr();
+    moduli.insert(openssl.lastStdOut());
+  }
+  // every device has its own key
+  EXPECT_EQ(moduli.size(), 4);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
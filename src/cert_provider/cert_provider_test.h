@@ -51,6 +51,8 @@ class DeviceCredGenerator : public Process {
     Param commonName{"--certificate-cn", this};
     Param rsaBits{"--bits", this};
     Param credentialFile{"--credentials", this};
+    Param count{"--count", this};
+    Param jobs{"--jobs", this};
 
     Option provideRootCA{"--root-ca", this};
     Option provideServerURL{"--server-url", this};
@@ -1,7 +1,12 @@
+#include <atomic>
 #include <cstdlib>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -51,7 +56,9 @@ bpo::variables_map parseOptions(int argc, char** argv) {
       ("server-url,u", "provide server URL file")
       ("local,l", bpo::value<boost::filesystem::path>(), "local directory to write credentials to")
       ("config,g", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory from which to get file names")
-      ("skip-checks,s", "skip strict host key checking for ssh/scp commands");
+      ("skip-checks,s", "skip strict host key checking for ssh/scp commands")
+      ("count,n", bpo::value<unsigned int>(), "generate credentials for this many devices with the fleet CA, each in a subdirectory of the local directory named after its device ID")
+      ("jobs,j", bpo::value<unsigned int>(), "number of device credentials generated in parallel with --count (default: number of CPU cores)");
   // clang-format on
 
   bpo::variables_map vm;
@@ -141,6 +148,21 @@ class SSHRunner {
   int port_;
 };
 
+// Device IDs for bulk generation: the common name followed by a sequence
+// number if one was given, distinct random names otherwise
+std::vector<std::string> bulkDeviceIds(const std::string& common_name, unsigned int count) {
+  std::vector<std::string> device_ids;
+  std::set<std::string> taken;
+  while (device_ids.size() < count) {
+    std::string device_id =
+        common_name.empty() ? Utils::genPrettyName() : common_name + "-" + std::to_string(device_ids.size() + 1);
+    if (taken.insert(device_id).second) {
+      device_ids.push_back(std::move(device_id));
+    }
+  }
+  return device_ids;
+}
+
 void copyLocal(const boost::filesystem::path& src, const boost::filesystem::path& dest) {
   boost::filesystem::path dest_dir = dest.parent_path();
   if (boost::filesystem::exists(dest_dir)) {
@@ -221,6 +243,21 @@ int main(int argc, char* argv[]) {
       serverUrl = Bootstrap::readServerUrl(credentials_path);
     }
 
+    unsigned int count = 0;
+    if (commandline_map.count("count") != 0) {
+      count = commandline_map["count"].as<unsigned int>();
+      if (count == 0 || fleet_ca_path.empty() || local_dir.empty() || !target.empty()) {
+        std::cerr << "Bulk generation (--count) needs a positive count, a fleet CA and a local directory, and can't "
+                     "copy to a target"
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    unsigned int jobs = std::max(std::thread::hardware_concurrency(), 1U);
+    if (commandline_map.count("jobs") != 0) {
+      jobs = std::max(commandline_map["jobs"].as<unsigned int>(), 1U);
+    }
+
     std::string device_id;
     if (commandline_map.count("certificate-cn") != 0) {
       device_id = (commandline_map["certificate-cn"].as<std::string>());
@@ -228,7 +265,7 @@ int main(int argc, char* argv[]) {
         std::cerr << "Common name (device ID, --certificate-cn) can't be empty" << std::endl;
         return EXIT_FAILURE;
       }
-    } else {
+    } else if (count == 0) {
       device_id = Utils::genPrettyName();
       std::cout << "Random device ID is " << device_id << "\n";
     }
@@ -350,11 +387,6 @@ int main(int argc, char* argv[]) {
         }
       }
 
-      StructGuard<X509> certificate =
-          Crypto::generateCert(rsa_bits, cert_days, newcert_c, newcert_st, newcert_o, device_id);
-      Crypto::signCert(fleet_ca_path.native(), fleet_ca_key_path.native(), certificate.get());
-      Crypto::serializeCert(&pkey, &cert, certificate.get());
-
       if (provide_ca) {
         // Read server root CA from server_ca.pem in archive if found (to support
         // community edition use case). Otherwise, default to the old version of
@@ -368,6 +400,70 @@ int main(int argc, char* argv[]) {
           std::cout << "Server root CA read from server_ca.pem in zipped archive.\n";
         }
       }
+
+      if (count > 0) {
+        // Bulk generation: RSA key generation dominates, so spread the devices
+        // over the cores and write each one's files as soon as they are ready.
+        const std::vector<std::string> device_ids = bulkDeviceIds(device_id, count);
+        boost::filesystem::create_directories(local_dir);
+        std::cout << "Generating credentials for " << count << " devices in " << local_dir << " with " << jobs
+                  << " jobs ...\n";
+
+        std::atomic<size_t> next{0};
+        std::mutex error_mutex;
+        std::string first_error;
+        size_t failed = 0;
+        auto worker = [&]() {
+          for (size_t i = next++; i < device_ids.size(); i = next++) {
+            try {
+              const boost::filesystem::path device_dir = local_dir / device_ids[i];
+              StructGuard<X509> certificate =
+                  Crypto::generateCert(rsa_bits, cert_days, newcert_c, newcert_st, newcert_o, device_ids[i]);
+              Crypto::signCert(fleet_ca_path.native(), fleet_ca_key_path.native(), certificate.get());
+              std::string device_pkey;
+              std::string device_cert;
+              Crypto::serializeCert(&device_pkey, &device_cert, certificate.get());
+              Utils::writeFile(device_dir / pkey_file.get(directory), device_pkey);
+              Utils::writeFile(device_dir / cert_file.get(directory), device_cert);
+              if (provide_ca) {
+                Utils::writeFile(device_dir / ca_file.get(directory), ca);
+              }
+              if (provide_url) {
+                Utils::writeFile(device_dir / url_file.get(directory), serverUrl);
+              }
+            } catch (const std::exception& e) {
+              std::lock_guard<std::mutex> guard(error_mutex);
+              if (failed++ == 0) {
+                first_error = device_ids[i] + ": " + e.what();
+              }
+            }
+          }
+        };
+        std::vector<std::future<void>> workers;
+        for (unsigned int k = 1; k < std::min<size_t>(jobs, device_ids.size()); ++k) {
+          workers.push_back(std::async(std::launch::async, worker));
+        }
+        worker();
+        for (auto& w : workers) {
+          w.get();
+        }
+
+        if (failed > 0) {
+          std::cerr << "Generating credentials failed for " << failed << " devices, first error: " << first_error
+                    << std::endl;
+          return EXIT_FAILURE;
+        }
+        for (const auto& id : device_ids) {
+          std::cout << id << "\n";
+        }
+        std::cout << "...success\n";
+        return EXIT_SUCCESS;
+      }
+
+      StructGuard<X509> certificate =
+          Crypto::generateCert(rsa_bits, cert_days, newcert_c, newcert_st, newcert_o, device_id);
+      Crypto::signCert(fleet_ca_path.native(), fleet_ca_key_path.native(), certificate.get());
+      Crypto::serializeCert(&pkey, &cert, certificate.get());
     }
 
     tmp_pkey_file.PutContents(pkey);
@@ -0,0 +1,250 @@
+#include "fleet_simulator.h"
+
+#include <sodium.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "crypto/cryptoprovider.h"
+#include "http/httpclient.h"
+#include "logging/logging.h"
+#include "primary/sotauptaneclient.h"
+#include "storage/invstorage.h"
+#include "utilities/metrics.h"
+#include "utilities/utils.h"
+
+FleetSimulator::FleetSimulator(Config config, FleetOptions options, HttpFactory http)
+    : config_{std::move(config)},
+      options_{std::move(options)},
+      http_{std::move(http)},
+      random_{std::random_device{}()} {
+  if (options_.dir.empty()) {
+    throw std::invalid_argument("No directory for the devices");
+  }
+  if (options_.threads == 0) {
+    throw std::invalid_argument("At least one thread is needed");
+  }
+  // once for all the devices
+  if (sodium_init() == -1) {
+    throw std::runtime_error("Unable to initialize libsodium");
+  }
+  CryptoProviderFactory::select(config_.crypto.provider);
+  if (!http_) {
+    auto shared = std::make_shared<HttpClient>();
+    http_ = [shared](size_t) { return std::make_shared<HttpClient>(*shared); };
+  }
+  config_.pacman.type = PACKAGE_MANAGER_NONE;
+  Utils::createDirectories(options_.dir, S_IRWXU);
+}
+
+FleetSimulator::~FleetSimulator() = default;
+
+FleetStats FleetSimulator::run() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    cycles_.assign(options_.devices, 0);
+    const auto start = std::chrono::steady_clock::now();
+    const auto ramp_up = std::chrono::duration_cast<std::chrono::steady_clock::duration>(options_.ramp_up);
+    for (size_t device = 0; device < options_.devices; ++device) {
+      queue_.push(Due{start + ramp_up * device / options_.devices, device});
+    }
+  }
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < options_.threads; ++i) {
+    workers.emplace_back(&FleetSimulator::worker, this);
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  return stats_;
+}
+
+void FleetSimulator::stop() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+}
+
+void FleetSimulator::worker() {
+  auto &registry = metrics::Registry::instance();
+  auto &cycle_seconds = registry.histogram("aktualizr_fleet_cycle_seconds", "Duration of the cycles of the devices");
+  auto &cycles_ok = registry.counter("aktualizr_fleet_cycles_total", "Cycles run by the devices", {{"result", "ok"}});
+  auto &cycles_failed =
+      registry.counter("aktualizr_fleet_cycles_total", "Cycles run by the devices", {{"result", "failed"}});
+  auto &installs = registry.counter("aktualizr_fleet_installs_total", "Updates installed by the devices");
+  auto &running = registry.gauge("aktualizr_fleet_running_cycles", "Cycles in progress");
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopped_ && !(queue_.empty() && running_ == 0)) {
+    if (queue_.empty()) {
+      // the running cycles schedule the next ones
+      cv_.wait(lock);
+      continue;
+    }
+    const Due next = queue_.top();
+    if (next.when > std::chrono::steady_clock::now()) {
+      cv_.wait_until(lock, next.when);
+      continue;
+    }
+    queue_.pop();
+    const bool first = cycles_[next.device] == 0;
+    ++running_;
+    running.add(1);
+    lock.unlock();
+
+    CycleResult result = CycleResult::kFailed;
+    {
+      metrics::ScopedTimer timer(cycle_seconds);
+      try {
+        result = cycle(next.device, first);
+      } catch (const std::exception &e) {
+        LOG_ERROR << "Cycle of device " << next.device << " failed: " << e.what();
+      }
+    }
+    (result == CycleResult::kFailed ? cycles_failed : cycles_ok).add();
+    if (result == CycleResult::kInstalled) {
+      installs.add();
+    }
+
+    lock.lock();
+    running.add(-1);
+    --running_;
+    stats_.cycles++;
+    stats_.failed += result == CycleResult::kFailed ? 1 : 0;
+    stats_.updates_installed += result == CycleResult::kInstalled ? 1 : 0;
+    if (++cycles_[next.device] < options_.cycles || options_.cycles == 0) {
+      queue_.push(Due{std::chrono::steady_clock::now() + nextInterval(), next.device});
+    }
+    cv_.notify_all();
+  }
+  // the others may be waiting for the last cycle
+  cv_.notify_all();
+}
+
+// What Aktualizr::UptaneCycle() does, with the client of `aktualizr once`
+FleetSimulator::CycleResult FleetSimulator::cycle(const size_t device, const bool first) {
+  Config config = deviceConfig(device);
+  auto storage = INvStorage::newStorage(config.storage);
+  SotaUptaneClient client(config, storage, http_(device), nullptr, nullptr);
+  for (const auto &secondary : secondaryConfigs(device)) {
+    client.addSecondary(std::make_shared<Primary::VirtualSecondary>(secondary));
+  }
+  // instead of running lshw for each device
+  Json::Value hardware_info;
+  hardware_info["id"] = deviceDir(device).filename().string();
+  hardware_info["class"] = "system";
+  hardware_info["product"] = "aktualizr-fleet-simulator";
+  client.setCustomHardwareInfo(hardware_info);
+
+  client.initialize();
+  if (first) {
+    client.sendDeviceData();
+  }
+  const result::UpdateCheck update_result = client.fetchMeta();
+  if (update_result.status == result::UpdateStatus::kError) {
+    client.putManifest();
+    return CycleResult::kFailed;
+  }
+  if (update_result.updates.empty()) {
+    return CycleResult::kNoUpdates;
+  }
+
+  const result::Download download_result = client.downloadImages(update_result.updates);
+  if (download_result.status != result::DownloadStatus::kSuccess || download_result.updates.empty()) {
+    if (download_result.status == result::DownloadStatus::kNothingToDownload) {
+      return CycleResult::kNoUpdates;
+    }
+    client.putManifest();
+    return CycleResult::kFailed;
+  }
+  client.uptaneInstall(download_result.updates);
+  // an update needing a reboot is finalized by the next cycle, as after one
+  if (!client.isInstallCompletionRequired() && !client.hasPendingUpdates()) {
+    client.putManifest();
+  }
+  return CycleResult::kInstalled;
+}
+
+Config FleetSimulator::deviceConfig(const size_t device) const {
+  Config config = config_;
+  const boost::filesystem::path dir = deviceDir(device);
+  config.storage.path = dir;
+  config.storage.sqldb_path = utils::BasedPath("sql.db");
+  config.pacman.images_path = dir / "images";
+  config.bootloader.reboot_sentinel_dir = dir;
+  // the Secondaries are the simulator's
+  config.uptane.secondary_config_file.clear();
+  const std::string suffix = "-" + std::to_string(device);
+  if (!config.provision.device_id.empty()) {
+    config.provision.device_id += suffix;
+  }
+  if (!config.provision.primary_ecu_serial.empty()) {
+    config.provision.primary_ecu_serial += suffix;
+  }
+  return config;
+}
+
+std::vector<Primary::VirtualSecondaryConfig> FleetSimulator::secondaryConfigs(const size_t device) const {
+  const boost::filesystem::path dir = deviceDir(device);
+  const boost::filesystem::path file = dir / "secondaries.json";
+  std::vector<Primary::VirtualSecondaryConfig> configs;
+  if (boost::filesystem::exists(file)) {
+    configs = Primary::VirtualSecondaryConfig::create_from_file(file);
+    // not kept in the file
+    for (auto &secondary : configs) {
+      secondary.key_type = KeyType::kED25519;
+    }
+    return configs;
+  }
+
+  Utils::createDirectories(dir, S_IRWXU);
+  for (size_t i = 0; i < options_.secondaries; ++i) {
+    Primary::VirtualSecondaryConfig secondary;
+    secondary.ecu_serial = Utils::randomUuid();
+    secondary.ecu_hardware_id = options_.secondary_hardware_id;
+    secondary.full_client_dir = dir / ("secondary-" + std::to_string(i));
+    secondary.ecu_private_key = "sec.private";
+    secondary.ecu_public_key = "sec.public";
+    secondary.firmware_path = secondary.full_client_dir / "firmware.bin";
+    secondary.target_name_path = secondary.full_client_dir / "firmware_name.txt";
+    secondary.metadata_path = secondary.full_client_dir / "metadata";
+    // much faster to generate than RSA keys
+    secondary.key_type = KeyType::kED25519;
+    Utils::createDirectories(secondary.full_client_dir, S_IRWXU);
+    configs.push_back(secondary);
+  }
+  // written at once, so that the Secondaries are created again if interrupted
+  const boost::filesystem::path tmp_file = dir / "secondaries.json.tmp";
+  boost::filesystem::remove(tmp_file);
+  for (const auto &secondary : configs) {
+    secondary.dump(tmp_file);
+  }
+  if (!configs.empty()) {
+    boost::filesystem::rename(tmp_file, file);
+  }
+  return configs;
+}
+
+boost::filesystem::path FleetSimulator::deviceDir(const size_t device) const {
+  std::ostringstream name;
+  name << "device-" << std::setw(6) << std::setfill('0') << device;
+  return options_.dir / name.str();
+}
+
+std::chrono::steady_clock::duration FleetSimulator::nextInterval() {
+  const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(options_.interval);
+  const uint64_t jitter = std::min<uint64_t>(config_.uptane.polling_jitter_percent, 100);
+  if (jitter == 0) {
+    return interval;
+  }
+  std::uniform_real_distribution<double> spread(-static_cast<double>(jitter) / 100, static_cast<double>(jitter) / 100);
+  return interval + std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval * spread(random_));
+}
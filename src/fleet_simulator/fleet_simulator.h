@@ -0,0 +1,116 @@
+#ifndef FLEET_SIMULATOR_H_
+#define FLEET_SIMULATOR_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/config.h"
+#include "virtualsecondary.h"
+
+class HttpInterface;
+
+struct FleetOptions {
+  size_t devices{100};
+  // Virtual Secondaries of each device
+  size_t secondaries{1};
+  std::string secondary_hardware_id{"fleet-simulator-secondary"};
+  // devices running a cycle at the same time
+  size_t threads{16};
+  // one directory per device, kept between runs
+  boost::filesystem::path dir;
+  // between two cycles of a device, give or take uptane.polling_jitter_percent
+  std::chrono::seconds interval{10};
+  // the first cycles of the devices are spread over this time
+  std::chrono::seconds ramp_up{60};
+  // per device, 0 to keep going until stop() is called
+  uint64_t cycles{0};
+};
+
+struct FleetStats {
+  uint64_t cycles{0};
+  // cycles that threw or whose update check failed
+  uint64_t failed{0};
+  uint64_t updates_installed{0};
+};
+
+/**
+ * Many virtual Primaries, each with its Virtual Secondaries, in one process,
+ * to put the load of a fleet on a backend.
+ *
+ * A device is only its directory between its cycles: each cycle opens its
+ * storage, runs a client like `aktualizr once` does (provisioning, device data
+ * on the first cycle, update check, download, installation and manifest) and
+ * closes it again, so the number of threads, connections and open databases
+ * depends on `threads` rather than on the number of devices. The clients share
+ * the HTTP connection pool, DNS and TLS session caches and the download loop of
+ * a single HttpClient, and the crypto libraries are only set up once. The
+ * devices use the fake package manager, and their storage is wherever `dir`
+ * is: on a tmpfs, it is in memory.
+ */
+class FleetSimulator {
+ public:
+  // The client of each cycle of the device, by default a copy of an HttpClient
+  // shared by all of them
+  using HttpFactory = std::function<std::shared_ptr<HttpInterface>(size_t device)>;
+
+  FleetSimulator(Config config, FleetOptions options, HttpFactory http = nullptr);
+  ~FleetSimulator();
+  FleetSimulator(const FleetSimulator &) = delete;
+  FleetSimulator(FleetSimulator &&) = delete;
+  FleetSimulator &operator=(const FleetSimulator &) = delete;
+  FleetSimulator &operator=(FleetSimulator &&) = delete;
+
+  /**
+   * Run the cycles until every device has done options.cycles of them, or
+   * until stop() is called, then wait for the cycles in progress.
+   */
+  FleetStats run();
+  // May be called from any thread
+  void stop();
+
+  // The configuration of a device: the common one with its own directories,
+  // and its own device ID and Primary serial if those were set
+  Config deviceConfig(size_t device) const;
+  // Created on the first cycle of the device, read afterwards
+  std::vector<Primary::VirtualSecondaryConfig> secondaryConfigs(size_t device) const;
+
+ private:
+  struct Due {
+    std::chrono::steady_clock::time_point when;
+    size_t device;
+    bool operator>(const Due &other) const { return when > other.when; }
+  };
+
+  enum class CycleResult { kNoUpdates, kInstalled, kFailed };
+
+  void worker();
+  CycleResult cycle(size_t device, bool first);
+  boost::filesystem::path deviceDir(size_t device) const;
+  std::chrono::steady_clock::duration nextInterval();
+
+  Config config_;
+  const FleetOptions options_;
+  HttpFactory http_;
+
+  // guards all of the below
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::priority_queue<Due, std::vector<Due>, std::greater<Due>> queue_;
+  // cycles done by each device in this run
+  std::vector<uint64_t> cycles_;
+  size_t running_{0};
+  bool stopped_{false};
+  FleetStats stats_;
+  std::mt19937 random_;
+};
+
+#endif  // FLEET_SIMULATOR_H_
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <future>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fleet_simulator.h"
+#include "httpfake.h"
+#include "metafake.h"
+#include "storage/invstorage.h"
+#include "test_utils.h"
+#include "uptane_test_common.h"
+
+boost::filesystem::path fake_meta_dir;
+
+/*
+ * Each device provisions itself with its own Secondaries, which it keeps
+ * between its cycles.
+ */
+TEST(FleetSimulator, Cycles) {
+  TemporaryDirectory temp_dir;
+  // a server per device, to tell their requests apart
+  std::vector<std::shared_ptr<HttpFake>> servers;
+  for (size_t device = 0; device < 3; ++device) {
+    const boost::filesystem::path server_dir = temp_dir / ("server-" + std::to_string(device));
+    boost::filesystem::create_directories(server_dir);
+    servers.push_back(std::make_shared<HttpFake>(server_dir, "noupdates", fake_meta_dir));
+  }
+  Config config = UptaneTestCommon::makeTestConfig(temp_dir, servers[0]->tls_server);
+
+  FleetOptions options;
+  options.devices = servers.size();
+  options.secondaries = 2;
+  options.threads = 2;
+  options.dir = temp_dir / "fleet";
+  options.interval = std::chrono::seconds(0);
+  options.ramp_up = std::chrono::seconds(0);
+  options.cycles = 2;
+  FleetSimulator simulator(config, options, [&servers](size_t device) { return servers.at(device); });
+
+  const FleetStats stats = simulator.run();
+  EXPECT_EQ(stats.cycles, 6);
+  EXPECT_EQ(stats.failed, 0);
+  EXPECT_EQ(stats.updates_installed, 0);
+
+  std::set<std::string> device_ids;
+  std::set<std::string> serials;
+  for (size_t device = 0; device < servers.size(); ++device) {
+    const Config device_config = simulator.deviceConfig(device);
+    EXPECT_EQ(device_config.provision.primary_ecu_serial, "CA:FE:A6:D2:84:9D-" + std::to_string(device));
+    std::string device_id;
+    EXPECT_TRUE(INvStorage::newStorage(device_config.storage, true)->loadDeviceId(&device_id));
+    device_ids.insert(device_id);
+
+    const auto secondaries = simulator.secondaryConfigs(device);
+    ASSERT_EQ(secondaries.size(), 2);
+    std::vector<std::string> expected_ecus{device_config.provision.primary_ecu_serial};
+    for (const auto &secondary : secondaries) {
+      expected_ecus.push_back(secondary.ecu_serial);
+      serials.insert(secondary.ecu_serial);
+      EXPECT_EQ(secondary.ecu_hardware_id, "fleet-simulator-secondary");
+    }
+    const Json::Value ecus =
+        Utils::parseJSONFile(temp_dir / ("server-" + std::to_string(device)) / "post.json")["ecus"];
+    EXPECT_EQ(ecus.size(), 3);
+    for (const Json::Value &ecu : ecus) {
+      EXPECT_NE(std::find(expected_ecus.begin(), expected_ecus.end(), ecu["ecu_serial"].asString()),
+                expected_ecus.end());
+    }
+    EXPECT_EQ(servers[device]->last_manifest["signed"]["ecu_version_manifests"].size(), 3);
+  }
+  EXPECT_EQ(device_ids.size(), 3);
+  EXPECT_EQ(serials.size(), 6);
+}
+
+/*
+ * stop() ends a run that would otherwise go on forever.
+ */
+TEST(FleetSimulator, Stop) {
+  TemporaryDirectory temp_dir;
+  auto server = std::make_shared<HttpFake>(temp_dir.Path(), "noupdates", fake_meta_dir);
+  Config config = UptaneTestCommon::makeTestConfig(temp_dir, server->tls_server);
+
+  FleetOptions options;
+  options.devices = 1;
+  options.secondaries = 0;
+  options.threads = 1;
+  options.dir = temp_dir / "fleet";
+  options.interval = std::chrono::seconds(3600);
+  options.ramp_up = std::chrono::seconds(0);
+  FleetSimulator simulator(config, options, [&server](size_t) { return server; });
+
+  const Config device_config = simulator.deviceConfig(0);
+  const boost::filesystem::path db = device_config.storage.sqldb_path.get(device_config.storage.path);
+  auto run = std::async(std::launch::async, [&simulator] { return simulator.run(); });
+  // the first cycle is run right away, the next one in an hour
+  for (int i = 0; i < 100 && !boost::filesystem::exists(db); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  simulator.stop();
+  ASSERT_EQ(run.wait_for(std::chrono::seconds(20)), std::future_status::ready);
+  EXPECT_EQ(run.get().cycles, 1);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+
+  TemporaryDirectory tmp_dir;
+  fake_meta_dir = tmp_dir.Path();
+  CreateFakeRepoMetaData(fake_meta_dir);
+
+  return RUN_ALL_TESTS();
+}
+#endif
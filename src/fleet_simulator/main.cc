@@ -0,0 +1,104 @@
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "fleet_simulator.h"
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/aktualizr_version.h"
+#include "utilities/metrics.h"
+#include "utilities/sig_handler.h"
+#include "utilities/utils.h"
+
+namespace bpo = boost::program_options;
+
+bpo::variables_map parse_options(int argc, char **argv) {
+  bpo::options_description description(
+      "Simulate a fleet of devices, each a Primary with Virtual Secondaries, in one process, to load test a backend. "
+      "The devices are provisioned with the shared credentials of the configuration.");
+  // clang-format off
+  description.add_options()
+      ("help,h", "print usage")
+      ("version,v", "Current aktualizr-fleet-simulator version")
+      ("config,c", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory common to the devices, by default /var/sota")
+      ("loglevel", bpo::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
+      ("dir,d", bpo::value<boost::filesystem::path>(), "directory of the devices, which keeps them between runs; on a tmpfs, their storage is in memory")
+      ("devices,n", bpo::value<size_t>()->default_value(100), "number of devices")
+      ("secondaries", bpo::value<size_t>()->default_value(1), "number of Virtual Secondaries of each device, when it is created")
+      ("secondary-hardware-id", bpo::value<std::string>()->default_value("fleet-simulator-secondary"), "hardware ID of the Virtual Secondaries")
+      ("threads,j", bpo::value<size_t>()->default_value(16), "number of devices running a cycle at the same time")
+      ("interval", bpo::value<uint64_t>(), "seconds between two cycles of a device, uptane.polling_sec by default, give or take uptane.polling_jitter_percent")
+      ("ramp-up", bpo::value<uint64_t>()->default_value(60), "seconds over which the first cycles of the devices are spread")
+      ("cycles", bpo::value<uint64_t>()->default_value(0), "number of cycles of each device, 0 to run until interrupted");
+  // clang-format on
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::parse_command_line(argc, argv, description), vm);
+    if (vm.count("help") != 0) {
+      std::cout << description << '\n';
+      exit(EXIT_SUCCESS);
+    }
+    if (vm.count("version") != 0) {
+      std::cout << "Current aktualizr-fleet-simulator version is: " << aktualizr_version() << "\n";
+      exit(EXIT_SUCCESS);
+    }
+    bpo::notify(vm);
+    if (vm.count("dir") == 0) {
+      throw bpo::error("the option '--dir' is required");
+    }
+  } catch (const bpo::error &ex) {
+    std::cout << ex.what() << std::endl;
+    std::cout << description;
+    exit(EXIT_FAILURE);
+  }
+  return vm;
+}
+
+int main(int argc, char *argv[]) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+
+  bpo::variables_map commandline_map = parse_options(argc, argv);
+
+  int r = EXIT_FAILURE;
+  try {
+    Config config(commandline_map);
+    FleetOptions options;
+    options.dir = commandline_map["dir"].as<boost::filesystem::path>();
+    options.devices = commandline_map["devices"].as<size_t>();
+    options.secondaries = commandline_map["secondaries"].as<size_t>();
+    options.secondary_hardware_id = commandline_map["secondary-hardware-id"].as<std::string>();
+    options.threads = commandline_map["threads"].as<size_t>();
+    options.interval = std::chrono::seconds(commandline_map.count("interval") != 0
+                                                ? commandline_map["interval"].as<uint64_t>()
+                                                : config.uptane.polling_sec);
+    options.ramp_up = std::chrono::seconds(commandline_map["ramp-up"].as<uint64_t>());
+    options.cycles = commandline_map["cycles"].as<uint64_t>();
+
+    std::unique_ptr<metrics::FileExporter> metrics_exporter;
+    if (!config.metrics.path.empty()) {
+      metrics_exporter = std_::make_unique<metrics::FileExporter>(config.metrics.path,
+                                                                  std::chrono::seconds(config.metrics.interval));
+    }
+
+    FleetSimulator simulator(config, options);
+    SigHandler::get().start([&simulator]() { simulator.stop(); });
+    SigHandler::signal(SIGHUP);
+    SigHandler::signal(SIGINT);
+    SigHandler::signal(SIGTERM);
+
+    const FleetStats stats = simulator.run();
+    const auto &cycle_seconds = metrics::Registry::instance().histogram("aktualizr_fleet_cycle_seconds",
+                                                                        "Duration of the cycles of the devices");
+    std::cout << stats.cycles << " cycles of " << options.devices << " devices, " << stats.failed << " failed, "
+              << stats.updates_installed << " updates installed\n"
+              << "cycle duration: median " << static_cast<double>(cycle_seconds.quantile(0.5)) / 1e6 << " s, 99th "
+              << static_cast<double>(cycle_seconds.quantile(0.99)) / 1e6 << " s\n";
+    r = stats.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch (const std::exception &ex) {
+    LOG_ERROR << ex.what();
+  }
+  return r;
+}
@@ -1,5 +1,13 @@
 #include "libaktualizr-c.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
 #include <fstream>
+#include <future>
+#include <thread>
 
 #include "libaktualizr/events.h"
 #include "utilities/utils.h"
@@ -68,6 +76,156 @@ int Aktualizr_set_signal_handler(Aktualizr *a, void (*handler)(const char *event
   return 0;
 }
 
+// The future of the command is waited for on a thread of its own, which then
+// signals the eventfd and calls the callback.
+struct AsyncOperation {
+  AsyncOperation() = default;
+  ~AsyncOperation() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  AsyncOperation(const AsyncOperation &) = delete;
+  AsyncOperation(AsyncOperation &&) = delete;
+  AsyncOperation &operator=(const AsyncOperation &) = delete;
+  AsyncOperation &operator=(AsyncOperation &&) = delete;
+
+  void wait() {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  int fd{-1};
+  std::thread thread;
+  std::atomic<bool> done{false};
+  // set before done
+  int result{-1};
+  std::unique_ptr<Updates> updates;
+};
+
+// get() returns the result of the operation, and may throw
+template <typename Get>
+static AsyncOperation *startAsync(const char *name, Get get, Aktualizr_async_cb cb, void *user_data) {
+  std::unique_ptr<AsyncOperation> op{new AsyncOperation()};
+  op->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (op->fd < 0) {
+    std::cerr << name << " failed: " << std::strerror(errno) << std::endl;
+    return nullptr;
+  }
+  AsyncOperation *res = op.get();
+  op->thread = std::thread([res, name, get = std::move(get), cb, user_data]() mutable {
+    try {
+      res->result = get(res);
+    } catch (const std::exception &e) {
+      std::cerr << name << " exception: " << e.what() << std::endl;
+      res->result = -1;
+    }
+    res->done = true;
+    const uint64_t one = 1;
+    if (write(res->fd, &one, sizeof(one)) < 0) {
+      std::cerr << name << " could not signal its completion: " << std::strerror(errno) << std::endl;
+    }
+    if (cb != nullptr) {
+      cb(res, user_data);
+    }
+  });
+  return op.release();
+}
+
+AsyncOperation *Aktualizr_updates_check_async(Aktualizr *a, Aktualizr_async_cb cb, void *user_data) {
+  try {
+    // queued here, so that operations started one after the other run in that order
+    auto future = a->CheckUpdates();
+    return startAsync(
+        "Aktualizr_updates_check_async",
+        [future = std::move(future)](AsyncOperation *op) mutable {
+          auto r = future.get();
+          if (!r.updates.empty()) {
+            op->updates.reset(new Updates(std::move(r.updates)));
+          }
+          return 0;
+        },
+        cb, user_data);
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_updates_check_async exception: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+AsyncOperation *Aktualizr_download_target_async(Aktualizr *a, Target *t, Aktualizr_async_cb cb, void *user_data) {
+  try {
+    auto future = a->Download(std::vector<Uptane::Target>({*t}));
+    return startAsync(
+        "Aktualizr_download_target_async",
+        [future = std::move(future)](AsyncOperation *op) mutable {
+          (void)op;
+          future.get();
+          return 0;
+        },
+        cb, user_data);
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_download_target_async exception: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+AsyncOperation *Aktualizr_install_target_async(Aktualizr *a, Target *t, Aktualizr_async_cb cb, void *user_data) {
+  try {
+    auto future = a->Install(std::vector<Uptane::Target>({*t}));
+    return startAsync(
+        "Aktualizr_install_target_async",
+        [future = std::move(future)](AsyncOperation *op) mutable {
+          (void)op;
+          future.get();
+          return 0;
+        },
+        cb, user_data);
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_install_target_async exception: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+int Aktualizr_async_get_fd(AsyncOperation *op) { return (op == nullptr) ? -1 : op->fd; }
+
+int Aktualizr_async_is_done(AsyncOperation *op) { return (op != nullptr && op->done) ? 1 : 0; }
+
+int Aktualizr_async_result(AsyncOperation *op) {
+  if (op == nullptr) {
+    std::cerr << "Aktualizr_async_result failed: no input operation" << std::endl;
+    return -1;
+  }
+  if (!op->done) {
+    op->wait();
+  }
+  return op->result;
+}
+
+Updates *Aktualizr_async_take_updates(AsyncOperation *op) {
+  if (op == nullptr) {
+    std::cerr << "Aktualizr_async_take_updates failed: no input operation" << std::endl;
+    return nullptr;
+  }
+  if (!op->done) {
+    op->wait();
+  }
+  return op->updates.release();
+}
+
+void Aktualizr_async_free(AsyncOperation *op) {
+  if (op == nullptr) {
+    return;
+  }
+  if (op->thread.joinable() && op->thread.get_id() == std::this_thread::get_id()) {
+    // from the callback, which is the last thing the thread does
+    op->thread.detach();
+  } else {
+    op->wait();
+  }
+  delete op;
+}
+
 Campaign *Aktualizr_campaigns_check(Aktualizr *a) {
   try {
     auto r = a->CampaignCheck().get();
@@ -233,6 +391,53 @@ int Aktualizr_close_stored_target(StorageTargetHandle *handle) {
   }
 }
 
+StorageTargetView *Aktualizr_open_stored_target_view(Aktualizr *a, const Target *t) {
+  if (t == nullptr) {
+    std::cerr << "Aktualizr_open_stored_target_view failed: invalid input" << std::endl;
+    return nullptr;
+  }
+
+  try {
+    return new StorageTargetView(a->OpenStoredTargetView(*t));
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_open_stored_target_view exception: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+int Aktualizr_get_stored_target_fd(const StorageTargetView *view) {
+  if (view == nullptr) {
+    std::cerr << "Aktualizr_get_stored_target_fd failed: no input view" << std::endl;
+    return -1;
+  }
+  return view->fd();
+}
+
+const uint8_t *Aktualizr_get_stored_target_data(const StorageTargetView *view) {
+  if (view == nullptr) {
+    std::cerr << "Aktualizr_get_stored_target_data failed: no input view" << std::endl;
+    return nullptr;
+  }
+  return view->data();
+}
+
+size_t Aktualizr_get_stored_target_size(const StorageTargetView *view) {
+  if (view == nullptr) {
+    std::cerr << "Aktualizr_get_stored_target_size failed: no input view" << std::endl;
+    return 0;
+  }
+  return static_cast<size_t>(view->size());
+}
+
+int Aktualizr_close_stored_target_view(StorageTargetView *view) {
+  if (view == nullptr) {
+    std::cerr << "Aktualizr_close_stored_target_view failed: no input view" << std::endl;
+    return -1;
+  }
+  delete view;
+  return 0;
+}
+
 static Pause_Status_C get_Pause_Status_C(result::PauseStatus in) {
   switch (in) {
     case result::PauseStatus::kSuccess: {
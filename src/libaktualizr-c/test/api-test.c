@@ -1,3 +1,4 @@
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +35,11 @@ static void signal_handler(const char *event_name) {
   }
 }
 
+static void async_handler(AsyncOperation *op, void *user_data) {
+  (void)op;
+  ++*(int *)user_data;
+}
+
 int main(int argc, char **argv) {
   Aktualizr *a;
   Campaign *c;
@@ -90,6 +96,25 @@ int main(int argc, char **argv) {
   }
   Aktualizr_campaign_free(c);
 
+  int async_calls = 0;
+  AsyncOperation *op = Aktualizr_updates_check_async(a, &async_handler, &async_calls);
+  if (op == NULL) {
+    printf("Aktualizr_updates_check_async returned NULL\n");
+    CLEANUP_AND_RETURN_FAILED;
+  }
+  struct pollfd pfd = {Aktualizr_async_get_fd(op), POLLIN, 0};
+  if (poll(&pfd, 1, 60000) != 1 || !Aktualizr_async_is_done(op) || Aktualizr_async_result(op) != 0) {
+    printf("Aktualizr_updates_check_async did not complete\n");
+    CLEANUP_AND_RETURN_FAILED;
+  }
+  u = Aktualizr_async_take_updates(op);
+  Aktualizr_async_free(op);
+  if (u == NULL || async_calls != 1) {
+    printf("Aktualizr_updates_check_async found no updates or did not call back\n");
+    CLEANUP_AND_RETURN_FAILED;
+  }
+  Aktualizr_updates_free(u);
+
   u = Aktualizr_updates_check(a);
   if (u == NULL) {
     printf("Aktualizr_updates_check returned NULL\n");
@@ -172,14 +197,32 @@ int main(int argc, char **argv) {
     if (size == bufSize) {
       printf(" ... (end of content skipped)");
     }
-    free(buf);
-    buf = NULL;
 
     err = Aktualizr_close_stored_target(handle);
     if (err) {
       printf("Aktualizr_close_stored_target failed\n");
       CLEANUP_AND_RETURN_FAILED;
     }
+
+    StorageTargetView *view = Aktualizr_open_stored_target_view(a, t);
+    if (!view) {
+      printf("Aktualizr_open_stored_target_view failed\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
+    const uint8_t *data = Aktualizr_get_stored_target_data(view);
+    if (Aktualizr_get_stored_target_fd(view) < 0 || data == NULL ||
+        Aktualizr_get_stored_target_size(view) < size || memcmp(data, buf, size) != 0) {
+      printf("Aktualizr_open_stored_target_view gave another content\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
+    free(buf);
+    buf = NULL;
+
+    err = Aktualizr_close_stored_target_view(view);
+    if (err) {
+      printf("Aktualizr_close_stored_target_view failed\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
   }
 
 #if 0
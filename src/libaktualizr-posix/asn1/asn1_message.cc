@@ -1,20 +1,87 @@
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <vector>
 
 #include "asn1_message.h"
+#include "asn1_transport.h"
 #include "logging/logging.h"
 #include "utilities/dequeue_buffer.h"
+#include "utilities/metrics.h"
 #include "utilities/utils.h"
 
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
 
+// the Primary passes one file with a message
+static constexpr size_t kMaxPassedFiles = 4;
+
+static metrics::Histogram& rpcTime() {
+  static auto& histogram =
+      metrics::Registry::instance().histogram("aktualizr_secondary_rpc_seconds", "Round trip time of Secondary RPCs");
+  return histogram;
+}
+
+namespace {
+// Messages come and go at the same rate on a connection, usually one request
+// and one response at a time, so a few spare ones per thread are enough.
+constexpr size_t kMessagePoolSize = 4;
+
+struct MessagePool {
+  MessagePool() = default;
+  ~MessagePool();
+  MessagePool(const MessagePool&) = delete;
+  MessagePool(MessagePool&&) = delete;
+  MessagePool& operator=(const MessagePool&) = delete;
+  MessagePool& operator=(MessagePool&&) = delete;
+
+  std::vector<Asn1Message*> messages;
+};
+
+// messages released while the thread exits are not pooled anymore
+thread_local bool message_pool_gone = false;
+thread_local MessagePool message_pool;
+
+MessagePool::~MessagePool() {
+  message_pool_gone = true;
+  for (auto* m : messages) {
+    delete m;
+  }
+}
+}  // namespace
+
+Asn1Message::Ptr Asn1Message::Empty() {
+  if (!message_pool_gone && !message_pool.messages.empty()) {
+    Asn1Message* m = message_pool.messages.back();
+    message_pool.messages.pop_back();
+    return m;
+  }
+  return new Asn1Message();
+}
+
+void Asn1Message::Recycle(Asn1Message* m) {
+  if (message_pool_gone || message_pool.messages.size() >= kMessagePoolSize) {
+    delete m;
+    return;
+  }
+  ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_AKIpUptaneMes, &m->msg_);
+  memset(&m->msg_, 0, sizeof(m->msg_));
+  message_pool.messages.push_back(m);
+}
+
 int Asn1StringAppendCallback(const void* buffer, size_t size, void* priv) {
   auto* out_str = static_cast<std::string*>(priv);
-  out_str->append(std::string(static_cast<const char*>(buffer), size));
+  out_str->append(static_cast<const char*>(buffer), size);
   return 0;
 }
 
@@ -52,50 +119,503 @@ void SetString(OCTET_STRING_t* dest, const std::string& str) {
   OCTET_STRING_fromBuf(dest, str.c_str(), static_cast<int>(str.size()));
 }
 
-Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, int con_fd) {
-  der_encode(&asn_DEF_AKIpUptaneMes, &tx->msg_, Asn1SocketWriteCallback, &con_fd);
+bool Asn1Encode(const Asn1Message::Ptr& tx, std::string* out) {
+  out->clear();
+  asn_enc_rval_t encode_result = der_encode(&asn_DEF_AKIpUptaneMes, &tx->msg_, Asn1StringAppendCallback, out);
+  if (encode_result.encoded == -1) {
+    LOG_ERROR << "Failed to encode a message";
+    return false;
+  }
+  return true;
+}
 
-  // Bounce TCP_NODELAY to flush the TCP send buffer
-  int no_delay = 1;
-  setsockopt(con_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
-  no_delay = 0;
-  setsockopt(con_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
+bool Asn1OutputBuffer::encode(const Asn1Message::Ptr& tx) {
+  clear();
+  tx_ = tx;
+  asn_enc_rval_t encode_result = der_encode(&asn_DEF_AKIpUptaneMes, &tx->msg_, append, this);
+  if (encode_result.encoded == -1) {
+    LOG_ERROR << "Failed to encode a message";
+    clear();
+    return false;
+  }
+  return true;
+}
+
+void Asn1OutputBuffer::reference(const std::string& encoded_tx) {
+  clear();
+  fragments_.push_back(Fragment{encoded_tx.data(), 0, encoded_tx.size()});
+  size_ = encoded_tx.size();
+}
+
+void Asn1OutputBuffer::clear() {
+  tx_.reset();
+  gathered_.clear();
+  fragments_.clear();
+  size_ = 0;
+}
+
+int Asn1OutputBuffer::append(const void* buffer, size_t size, void* priv) {
+  static_cast<Asn1OutputBuffer*>(priv)->addFragment(static_cast<const char*>(buffer), size);
+  return 0;
+}
 
-  AKIpUptaneMes_t* m = nullptr;
-  asn_dec_rval_t res;
+void Asn1OutputBuffer::addFragment(const char* data, size_t size) {
+  size_ += size;
+  if (size >= kInPlaceMinSize) {
+    fragments_.push_back(Fragment{data, 0, size});
+    return;
+  }
+  // extend the last gathered fragment if it is still the last one
+  if (!fragments_.empty() && fragments_.back().data == nullptr) {
+    fragments_.back().size += size;
+  } else {
+    fragments_.push_back(Fragment{nullptr, gathered_.size(), size});
+  }
+  gathered_.append(data, size);
+}
+
+std::string Asn1OutputBuffer::str() const {
+  std::string res;
+  res.reserve(size_);
+  for (const auto& fragment : fragments_) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    res.append(fragment.data != nullptr ? fragment.data : gathered_.data() + fragment.offset, fragment.size);
+  }
+  return res;
+}
+
+// sendmsg() rather than writev(), for MSG_NOSIGNAL
+bool Asn1OutputBuffer::send(int fd, int passed_fd) const {
+  std::vector<iovec> iov;
+  iov.reserve(fragments_.size());
+  for (const auto& fragment : fragments_) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const char* data = fragment.data != nullptr ? fragment.data : gathered_.data() + fragment.offset;
+    iov.push_back(iovec{const_cast<char*>(data), fragment.size});
+  }
+
+  size_t next = 0;
+  while (next < iov.size()) {
+    msghdr msg{};
+    msg.msg_iov = &iov[next];
+    msg.msg_iovlen = std::min<size_t>(iov.size() - next, IOV_MAX);
+    // the descriptor goes with the first bytes that are written
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    if (passed_fd >= 0) {
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      std::memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+    }
+    const ssize_t written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written < 0) {
+      LOG_ERROR << "write: " << std::strerror(errno);
+      return false;
+    }
+    passed_fd = -1;
+    // skip what went out, and resume in the middle of a partly written fragment
+    auto left = static_cast<size_t>(written);
+    while (next < iov.size() && left >= iov[next].iov_len) {
+      left -= iov[next].iov_len;
+      ++next;
+    }
+    if (left > 0) {
+      iov[next].iov_base = static_cast<char*>(iov[next].iov_base) + left;
+      iov[next].iov_len -= left;
+    }
+  }
+  return true;
+}
+
+static bool Asn1Send(const Asn1Message::Ptr& tx, int con_fd) {
+  Asn1OutputBuffer out;
+  return out.encode(tx) && out.send(con_fd);
+}
+
+ssize_t Asn1FrameSize(const char* data, size_t size) {
+  const auto* bytes = reinterpret_cast<const uint8_t*>(data);
+  size_t pos = 0;
+  if (size < 2) {
+    return 0;
+  }
+  // tag, with the number in further bytes for the high-tag-number form
+  if ((bytes[pos++] & 0x1FU) == 0x1FU) {  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    while (true) {
+      if (pos == size) {
+        return 0;
+      }
+      if ((bytes[pos++] & 0x80U) == 0) {  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        break;
+      }
+    }
+  }
+  if (pos == size) {
+    return 0;
+  }
+  const uint8_t first_length_byte = bytes[pos++];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  uint64_t length = first_length_byte;
+  if (first_length_byte == 0x80U) {
+    return -1;
+  }
+  if ((first_length_byte & 0x80U) != 0) {
+    const size_t length_bytes = first_length_byte & 0x7FU;
+    if (length_bytes > sizeof(uint32_t)) {
+      return -1;
+    }
+    if (size - pos < length_bytes) {
+      return 0;
+    }
+    length = 0;
+    for (size_t i = 0; i < length_bytes; i++) {
+      length = (length << 8U) | bytes[pos++];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    }
+  }
+  return static_cast<ssize_t>(pos + length);
+}
+
+// recv(), keeping the file descriptors passed along with the data
+static ssize_t receiveWithFiles(int con_fd, char* data, size_t size, Asn1PassedFiles* files) {
+  iovec iov{data, size};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  alignas(cmsghdr) char control[CMSG_SPACE(kMaxPassedFiles * sizeof(int))]{};
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  const ssize_t received = recvmsg(con_fd, &msg, MSG_CMSG_CLOEXEC);
+  if (received < 0) {
+    return received;
+  }
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; ++i) {
+      int fd = -1;
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      files->push_back(std::make_unique<Socket>(fd));
+    }
+  }
+  if ((msg.msg_flags & MSG_CTRUNC) != 0) {
+    LOG_WARNING << "Some file descriptors passed by the Primary were dropped";
+  }
+  return received;
+}
+
+Asn1Message::Ptr Asn1ReceiveMessage(int con_fd, DequeueBuffer& buffer, Asn1ReceiveStatus* status,
+                                    const std::function<bool()>& wait, Asn1PassedFiles* files) {
+  // decoded in place, rather than in a new structure moved over by FromRaw()
+  Asn1Message::Ptr msg = Asn1Message::Empty();
+  AKIpUptaneMes_t* m = &msg->msg_;
+  asn_dec_rval_t res{};
   asn_codec_ctx_s context{};
-  DequeueBuffer buffer;
-  ssize_t received;
-  do {
-    res.code = RC_FAIL;
-    received = recv(con_fd, buffer.Tail(), buffer.TailSpace(), 0);
-    if (received < 0) {
-      LOG_ERROR << "Failed to read data from a connection socket: " << strerror(errno);
+  res.code = RC_WMORE;
+  *status = Asn1ReceiveStatus::kOk;
+  bool incremental = false;
+
+  while (true) {
+    const ssize_t frame_size = incremental ? -1 : Asn1FrameSize(buffer.Head(), buffer.Size());
+    if (frame_size > static_cast<ssize_t>(DequeueBuffer::kMaxSize)) {
+      LOG_ERROR << "Message of " << frame_size << " bytes is too large";
+      res.code = RC_FAIL;
+      break;
+    }
+    if (frame_size > 0 && buffer.Size() >= static_cast<size_t>(frame_size)) {
+      res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void**>(&m), buffer.Head(),
+                       static_cast<size_t>(frame_size));
+      buffer.Consume(res.consumed);
+      break;
+    }
+    if (frame_size < 0 && buffer.Size() > 0) {
+      // the decoder keeps its state in *m between the calls
+      incremental = true;
+      res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void**>(&m), buffer.Head(), buffer.Size());
+      buffer.Consume(res.consumed);
+      if (res.code != RC_WMORE) {
+        break;
+      }
+    }
+    if (frame_size > 0) {
+      buffer.Reserve(static_cast<size_t>(frame_size) - buffer.Size());
+    }
+
+    if (wait && !wait()) {
+      *status = Asn1ReceiveStatus::kAborted;
       break;
     }
-    LOG_TRACE << "Asn1Rpc read " << Utils::toBase64(std::string(buffer.Tail(), static_cast<size_t>(received)));
+    ssize_t received = 0;
+    do {
+      received = files != nullptr ? receiveWithFiles(con_fd, buffer.Tail(), buffer.TailSpace(), files)
+                                  : recv(con_fd, buffer.Tail(), buffer.TailSpace(), 0);
+    } while (received < 0 && errno == EINTR);
+    if (received <= 0) {
+      if (received < 0) {
+        LOG_ERROR << "Failed to read data from a connection socket: " << strerror(errno);
+        *status = Asn1ReceiveStatus::kReadError;
+      } else {
+        *status = Asn1ReceiveStatus::kClosed;
+      }
+      break;
+    }
+    LOG_TRACE << "Asn1 read " << Utils::toBase64(std::string(buffer.Tail(), static_cast<size_t>(received)));
     buffer.HaveEnqueued(static_cast<size_t>(received));
-    res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void**>(&m), buffer.Head(), buffer.Size());
-    buffer.Consume(res.consumed);
-  } while (res.code == RC_WMORE && received > 0);
-  // Note that ber_decode allocates *m even on failure, so this must always be done
-  Asn1Message::Ptr msg = Asn1Message::FromRaw(&m);
+  }
+  if (*status == Asn1ReceiveStatus::kOk && res.code != RC_OK) {
+    *status = Asn1ReceiveStatus::kDecodeError;
+  }
+  if (*status != Asn1ReceiveStatus::kOk) {
+    // freed here, as the contents of a CHOICE are only found through present()
+    ASN_STRUCT_FREE_CONTENTS_ONLY(asn_DEF_AKIpUptaneMes, &msg->msg_);
+    memset(&msg->msg_, 0, sizeof(msg->msg_));
+  }
+  return msg;
+}
 
-  if (res.code != RC_OK) {
+static Asn1Message::Ptr Asn1Receive(int con_fd, DequeueBuffer& buffer) {
+  Asn1ReceiveStatus status;
+  auto msg = Asn1ReceiveMessage(con_fd, buffer, &status);
+  if (status == Asn1ReceiveStatus::kDecodeError) {
     LOG_DEBUG << "Asn1Rpc decoding failed";
-    msg->present(AKIpUptaneMes_PR_NOTHING);
   }
-
   return msg;
 }
 
+Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, int con_fd) {
+  metrics::ScopedTimer timer(rpcTime());
+  int no_delay = 1;
+  setsockopt(con_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
+  if (!Asn1Send(tx, con_fd)) {
+    return Asn1Message::Empty();
+  }
+  DequeueBuffer buffer;
+  return Asn1Receive(con_fd, buffer);
+}
+
 Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const std::pair<std::string, uint16_t>& addr) {
-  ConnectionSocket connection(addr.first, addr.second);
+  const auto transport = Asn1Transport::create(addr.first, addr.second);
+  auto connection = transport->connect();
+  if (connection == nullptr) {
+    LOG_ERROR << "Failed to connect to the Secondary (" << transport->toString() << "): " << std::strerror(errno);
+    return Asn1Message::Empty();
+  }
+  return Asn1Rpc(tx, **connection);
+}
+
+Asn1Connection::Asn1Connection(std::pair<std::string, uint16_t> addr)
+    : transport_(Asn1Transport::create(addr.first, addr.second)) {}
+
+Asn1Connection::~Asn1Connection() = default;
 
-  if (connection.connect() < 0) {
-    LOG_ERROR << "Failed to connect to the Secondary ( " << addr.first << ":" << addr.second
-              << "): " << std::strerror(errno);
+Asn1Message::Ptr Asn1Connection::rpc(const Asn1Message::Ptr& tx) {
+  return rpc(tx, AKIpUptaneMes_PR_NOTHING, nullptr);
+}
+
+Asn1Message::Ptr Asn1Connection::rpc(const std::string& encoded_tx) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  tx_buffer_.reference(encoded_tx);
+  Asn1Message::Ptr rx = exchange(AKIpUptaneMes_PR_NOTHING, nullptr);
+  tx_buffer_.clear();
+  return rx;
+}
+
+Asn1Message::Ptr Asn1Connection::rpc(const Asn1Message::Ptr& tx, AKIpUptaneMes_PR interim,
+                                     const std::function<void(const Asn1Message::Ptr&)>& on_interim) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!tx_buffer_.encode(tx)) {
     return Asn1Message::Empty();
   }
-  return Asn1Rpc(tx, *connection);
+  Asn1Message::Ptr rx = exchange(interim, on_interim);
+  // don't keep the request alive until the next one
+  tx_buffer_.clear();
+  return rx;
+}
+
+Asn1Message::Ptr Asn1Connection::exchange(AKIpUptaneMes_PR interim,
+                                          const std::function<void(const Asn1Message::Ptr&)>& on_interim) {
+  metrics::ScopedTimer timer(rpcTime());
+
+  auto send = [this]() { return tx_buffer_.send(**socket_); };
+  bool reused = (socket_ != nullptr) && !isStale();
+  if (!reused && !connect()) {
+    return Asn1Message::Empty();
+  }
+  if (!send()) {
+    if (!reused || !connect() || !send()) {
+      socket_.reset();
+      return Asn1Message::Empty();
+    }
+  }
+
+  Asn1Message::Ptr rx = Asn1Receive(**socket_, rx_buffer_);
+  while (interim != AKIpUptaneMes_PR_NOTHING && rx->present() == interim) {
+    on_interim(rx);
+    rx = Asn1Receive(**socket_, rx_buffer_);
+  }
+  if (rx->present() == AKIpUptaneMes_PR_NOTHING) {
+    // the stream can't be resynchronized
+    socket_.reset();
+  }
+  return rx;
+}
+
+bool Asn1Connection::stream(const std::function<Asn1Message::Ptr()>& next, size_t window,
+                            const std::function<bool(const Asn1Message::Ptr&)>& on_response) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if ((socket_ == nullptr || isStale()) && !connect()) {
+    return false;
+  }
+
+  window = std::max<size_t>(window, 1);
+  size_t in_flight = 0;
+  bool more = true;
+  bool stopped = false;
+  while (true) {
+    if (more && in_flight < window) {
+      Asn1Message::Ptr tx = next();
+      if (tx != nullptr) {
+        const bool sent = tx_buffer_.encode(tx) && tx_buffer_.send(**socket_);
+        tx_buffer_.clear();
+        if (!sent) {
+          socket_.reset();
+          return false;
+        }
+        ++in_flight;
+        continue;
+      }
+      more = false;
+    }
+    if (in_flight == 0) {
+      break;
+    }
+
+    Asn1Message::Ptr rx = Asn1Receive(**socket_, rx_buffer_);
+    --in_flight;
+    if (rx->present() == AKIpUptaneMes_PR_NOTHING) {
+      socket_.reset();
+      return false;
+    }
+    if (!stopped && !on_response(rx)) {
+      stopped = true;
+      more = false;
+    }
+  }
+  return true;
+}
+
+// sendfile() can't be told not to raise SIGPIPE like send(), so it is blocked
+// in this thread meanwhile, and discarded if the Secondary went away.
+static bool Asn1SendFile(int con_fd, int file_fd, uint64_t offset, uint64_t length) {
+  sigset_t sigpipe;
+  sigset_t old_mask;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+
+  bool ok = true;
+  auto pos = static_cast<off_t>(offset);
+  const auto end = static_cast<off_t>(offset + length);
+  while (pos < end) {
+    const ssize_t sent = sendfile(con_fd, file_fd, &pos, static_cast<size_t>(end - pos));
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      LOG_ERROR << "sendfile: " << (sent < 0 ? std::strerror(errno) : "unexpected end of file");
+      if (sent < 0 && errno == EPIPE) {
+        timespec no_wait{};
+        sigtimedwait(&sigpipe, nullptr, &no_wait);
+      }
+      ok = false;
+      break;
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  return ok;
+}
+
+Asn1Message::Ptr Asn1Connection::rpcWithFile(const Asn1Message::Ptr& tx, int file_fd, uint64_t offset,
+                                             uint64_t length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if ((socket_ == nullptr || isStale()) && !connect()) {
+    return Asn1Message::Empty();
+  }
+  const bool sent = tx_buffer_.encode(tx) && tx_buffer_.send(**socket_);
+  tx_buffer_.clear();
+  if (!sent || !Asn1SendFile(**socket_, file_fd, offset, length)) {
+    socket_.reset();
+    return Asn1Message::Empty();
+  }
+
+  Asn1Message::Ptr rx = Asn1Receive(**socket_, rx_buffer_);
+  if (rx->present() == AKIpUptaneMes_PR_NOTHING) {
+    socket_.reset();
+  }
+  return rx;
+}
+
+Asn1Message::Ptr Asn1Connection::rpcPassingFile(const Asn1Message::Ptr& tx, int file_fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if ((socket_ == nullptr || isStale()) && !connect()) {
+    return Asn1Message::Empty();
+  }
+  const bool sent = tx_buffer_.encode(tx) && tx_buffer_.send(**socket_, file_fd);
+  tx_buffer_.clear();
+  if (!sent) {
+    socket_.reset();
+    return Asn1Message::Empty();
+  }
+
+  Asn1Message::Ptr rx = Asn1Receive(**socket_, rx_buffer_);
+  if (rx->present() == AKIpUptaneMes_PR_NOTHING) {
+    socket_.reset();
+  }
+  return rx;
+}
+
+bool Asn1Connection::passesFiles() const { return transport_->passesFiles(); }
+
+void Asn1Connection::close() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  socket_.reset();
+}
+
+bool Asn1Connection::connect() {
+  socket_ = transport_->connect();
+  rx_buffer_ = DequeueBuffer();
+  if (socket_ == nullptr) {
+    LOG_ERROR << "Failed to connect to the Secondary (" << transport_->toString() << "): " << std::strerror(errno);
+    return false;
+  }
+  LOG_DEBUG << "Connected to the Secondary (" << transport_->toString() << ")";
+  transport_->setOptions(**socket_);
+  return true;
+}
+
+// Nothing is expected from the Secondary between two requests, so anything
+// readable means that it has closed the connection (or sent garbage).
+bool Asn1Connection::isStale() {
+  if (rx_buffer_.Size() > 0) {
+    LOG_WARNING << "Unexpected data from the Secondary (" << transport_->toString() << "), reconnecting";
+    return true;
+  }
+  pollfd pfd{};
+  pfd.fd = **socket_;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, 0) == 0) {
+    return false;
+  }
+  LOG_DEBUG << "Connection to the Secondary (" << transport_->toString() << ") was closed, reconnecting";
+  return true;
 }
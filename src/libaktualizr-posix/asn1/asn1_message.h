@@ -1,12 +1,22 @@
 #ifndef ASN1_MESSAGE_H_
 #define ASN1_MESSAGE_H_
 
+#include <sys/types.h>
+
 #include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/intrusive_ptr.hpp>
 
 #include "AKIpUptaneMes.h"
 #include "AKTlsConfig.h"
+#include "utilities/dequeue_buffer.h"
 
 class Asn1Message;
 
@@ -47,9 +57,11 @@ class Asn1Message {
   Asn1Message operator=(Asn1Message&&) = delete;
 
   /**
-   * Create a new Asn1Message, in order to fill it with data and send it
+   * Create a new Asn1Message, in order to fill it with data and send it.
+   * Released messages are kept for reuse by the next ones created in the same
+   * thread, which is usually the one handling the same connection.
    */
-  static Asn1Message::Ptr Empty() { return new Asn1Message(); }
+  static Asn1Message::Ptr Empty();
 
   /**
    * Destructively copy from a raw msg pointer created by parsing an incomming
@@ -64,7 +76,7 @@ class Asn1Message {
     const int prev_count = m->ref_count_.fetch_sub(1, std::memory_order_release);
     if (prev_count == 1) {
       std::atomic_thread_fence(std::memory_order_acquire);
-      delete m;
+      Recycle(m);
     }
   }
 
@@ -105,12 +117,34 @@ class Asn1Message {
   ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootReqMes_t, putRootReq);
   ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootRespMes_t, putRootResp);
 
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadStreamReqMes_t, uploadStreamReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadStreamRespMes_t, uploadStreamResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadRawReqMes_t, uploadRawReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadRawRespMes_t, uploadRawResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadResumeReqMes_t, uploadResumeReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadResumeRespMes_t, uploadResumeResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKInstallProgressMes_t, installProgress);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootChainReqMes_t, putRootChainReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootChainRespMes_t, putRootChainResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastStartReqMes_t, multicastStartReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastStartRespMes_t, multicastStartResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastStatusReqMes_t, multicastStatusReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastStatusRespMes_t, multicastStatusResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastEndReqMes_t, multicastEndReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMulticastEndRespMes_t, multicastEndResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMetaVersionsReqMes_t, metaVersionsReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMetaVersionsRespMes_t, metaVersionsResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMetricsReqMes_t, metricsReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKMetricsRespMes_t, metricsResp);
+
 #define ASN1_MESSAGE_DEFINE_STR_NAME(MessageID) \
   case MessageID:                               \
     return #MessageID;
 
-  const char* toStr() const {
-    switch (present()) {
+  const char* toStr() const { return name(present()); }
+
+  static const char* name(AKIpUptaneMes_PR id) {
+    switch (id) {
       default:
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_NOTHING);
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_getInfoReq);
@@ -138,6 +172,26 @@ class Asn1Message {
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_rootVerResp);
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootReq);
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootResp);
+
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadStreamReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadStreamResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadRawReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadRawResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadResumeReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadResumeResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_installProgress);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootChainReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootChainResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastStartReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastStartResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastStatusReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastStatusResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastEndReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_multicastEndResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_metaVersionsReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_metaVersionsResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_metricsReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_metricsResp);
     }
     return "Unknown";
   };
@@ -152,6 +206,8 @@ class Asn1Message {
  private:
   std::atomic<int> ref_count_{0};
   Asn1Message() = default;
+  // free the contents and keep the message for Empty(), or delete it
+  static void Recycle(Asn1Message* m);
 
   explicit Asn1Message(AKIpUptaneMes_t** msg) {
     if (msg != nullptr && *msg != nullptr) {
@@ -181,6 +237,86 @@ std::string ToString(const OCTET_STRING_t& octet_str);
 
 void SetString(OCTET_STRING_t* dest, const std::string& str);
 
+/**
+ * DER encode a message, e.g. to send the same one on several connections.
+ * @return false if the message could not be encoded.
+ */
+bool Asn1Encode(const Asn1Message::Ptr& tx, std::string* out);
+
+/**
+ * DER encoded message ready to be sent with one writev() call. The small
+ * fragments written by der_encode (tags, lengths, short fields) are gathered
+ * in a buffer, while large ones (firmware chunks, metadata) are referenced in
+ * place in the message, which is held until the next encode() or clear().
+ * That works because der_encode writes the contents of OCTET STRINGs
+ * straight from the message; the schema must not use SET OF, which is
+ * encoded through temporary buffers.
+ * The buffer is meant to be reused for every message sent on a connection.
+ */
+class Asn1OutputBuffer {
+ public:
+  bool encode(const Asn1Message::Ptr& tx);
+  // reference an already encoded message, which must outlive the buffer
+  void reference(const std::string& encoded_tx);
+  /**
+   * Write the whole message, retrying after partial writes. If `passed_fd` is
+   * set, it is passed along with the message over a Unix domain socket.
+   * @return false on a write error, including a closed connection (without
+   * raising SIGPIPE).
+   */
+  bool send(int fd, int passed_fd = -1) const;
+  void clear();
+  size_t size() const { return size_; }
+  std::string str() const;
+
+  // fragments from this size on are referenced rather than copied
+  static constexpr size_t kInPlaceMinSize = 4096;
+
+ private:
+  static int append(const void* buffer, size_t size, void* priv);
+  void addFragment(const char* data, size_t size);
+
+  // either in place at `data`, or at `offset` in gathered_ if `data` is null
+  struct Fragment {
+    const char* data;
+    size_t offset;
+    size_t size;
+  };
+  Asn1Message::Ptr tx_;
+  std::string gathered_;
+  std::vector<Fragment> fragments_;
+  size_t size_{0};
+};
+
+/**
+ * Size of the DER encoded message at the start of `data`, read from its
+ * outer tag and length.
+ * @return the size of the whole message, 0 if more data is needed to tell,
+ * -1 if it has an indefinite length or the header is invalid.
+ */
+ssize_t Asn1FrameSize(const char* data, size_t size);
+
+enum class Asn1ReceiveStatus { kOk, kClosed, kAborted, kReadError, kDecodeError };
+
+class Socket;
+
+// file descriptors passed along with the received messages, in order
+using Asn1PassedFiles = std::deque<std::unique_ptr<Socket>>;
+
+/**
+ * Receive one message from a socket and decode it. Data left in the buffer by
+ * the previous call is used first, and whatever follows the message is left
+ * in it. A message is received as a whole, as told by Asn1FrameSize(), and
+ * then decoded in one pass. Messages with an indefinite length are decoded
+ * as they come in instead.
+ * `wait` is called before each recv(), and receiving stops if it returns
+ * false.
+ * Over a Unix domain socket, the file descriptors that come with the data are
+ * added to `files`, if given, and closed otherwise.
+ */
+Asn1Message::Ptr Asn1ReceiveMessage(int con_fd, DequeueBuffer& buffer, Asn1ReceiveStatus* status,
+                                    const std::function<bool()>& wait = nullptr, Asn1PassedFiles* files = nullptr);
+
 /**
  * Open a TCP connection to client; send a message and wait for a
  * response.
@@ -188,6 +324,81 @@ void SetString(OCTET_STRING_t* dest, const std::string& str);
 Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, int con_fd);
 Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const std::pair<std::string, uint16_t>& addr);
 
+class Asn1Transport;
+
+/**
+ * Persistent connection to a Secondary, shared by all the RPCs sent to it.
+ * It is made over the transport of the Secondary address, see Asn1Transport.
+ *
+ * The connection is opened on first use and kept open with TCP keepalive.
+ * When the Secondary has closed it in the meantime (e.g. after a restart), it
+ * is reopened before the next request. A request is sent again on a new
+ * connection only if it couldn't be sent at all on a reused one; a failure
+ * while waiting for the response closes the connection and is reported to the
+ * caller, as the Secondary may have processed the request already.
+ */
+class Asn1Connection {
+ public:
+  explicit Asn1Connection(std::pair<std::string, uint16_t> addr);
+  ~Asn1Connection();
+  Asn1Connection(const Asn1Connection&) = delete;
+  Asn1Connection(Asn1Connection&&) = delete;
+  Asn1Connection& operator=(const Asn1Connection&) = delete;
+  Asn1Connection& operator=(Asn1Connection&&) = delete;
+
+  /**
+   * Send a message and wait for the response. Returns an empty message on
+   * failure, like Asn1Rpc().
+   */
+  Asn1Message::Ptr rpc(const Asn1Message::Ptr& tx);
+  // same as rpc(), for a message encoded with Asn1Encode()
+  Asn1Message::Ptr rpc(const std::string& encoded_tx);
+  /**
+   * Same as rpc(), for requests that the Secondary may answer with messages
+   * of type `interim` before the response, like the progress of an
+   * installation. These are passed to on_interim() as they come.
+   */
+  Asn1Message::Ptr rpc(const Asn1Message::Ptr& tx, AKIpUptaneMes_PR interim,
+                       const std::function<void(const Asn1Message::Ptr&)>& on_interim);
+
+  /**
+   * Pipeline requests: send the requests returned by next() until it returns
+   * nullptr, with up to `window` of them waiting for a response, and pass the
+   * responses to on_response() in order. Once on_response() returns false, no
+   * more requests are sent and the responses still due are skipped.
+   * @return false if the connection failed.
+   */
+  bool stream(const std::function<Asn1Message::Ptr()>& next, size_t window,
+              const std::function<bool(const Asn1Message::Ptr&)>& on_response);
+
+  /**
+   * Send a message followed by `length` raw bytes of a file from `offset`,
+   * copied by the kernel with sendfile(), and wait for the response.
+   */
+  Asn1Message::Ptr rpcWithFile(const Asn1Message::Ptr& tx, int file_fd, uint64_t offset, uint64_t length);
+  /**
+   * Send a message along with a file descriptor, which the Secondary reads
+   * from itself, and wait for the response. Only for transports that
+   * passFiles().
+   */
+  Asn1Message::Ptr rpcPassingFile(const Asn1Message::Ptr& tx, int file_fd);
+  bool passesFiles() const;
+  void close();
+
+ private:
+  // must be called with mutex_ held
+  Asn1Message::Ptr exchange(AKIpUptaneMes_PR interim, const std::function<void(const Asn1Message::Ptr&)>& on_interim);
+  bool connect();
+  bool isStale();
+
+  const std::unique_ptr<Asn1Transport> transport_;
+  std::unique_ptr<Socket> socket_;
+  // pipelined responses may arrive together
+  DequeueBuffer rx_buffer_;
+  Asn1OutputBuffer tx_buffer_;
+  std::mutex mutex_;
+};
+
 /*
  * Helper function for creating pointers to ASN.1 types. Note that the encoder
  * will free these objects for you.
@@ -2,10 +2,15 @@
  * \file
  */
 
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <gtest/gtest.h>
 
+#include <future>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "libaktualizr/config.h"
 
@@ -263,6 +268,87 @@ TEST(asn1_common, parse) {
   EXPECT_EQ(AKIpUptaneMes_PR_sendFirmwareReq, msg->present());
 }
 
+/* The size of a message is known from its outer header, also for messages
+ * larger than the initial receive buffer. */
+TEST(asn1_common, Asn1FrameSize) {
+  for (const size_t data_size : {10U, 1000U, 100000U}) {
+    Asn1Message::Ptr original(Asn1Message::Empty());
+    original->present(AKIpUptaneMes_PR_uploadDataReq);
+    SetString(&original->uploadDataReq()->data, std::string(data_size, 'x'));
+    std::string buffer;
+    der_encode(&asn_DEF_AKIpUptaneMes, &original->msg_, Asn1StringAppendCallback, &buffer);
+
+    const auto size = static_cast<ssize_t>(buffer.size());
+    EXPECT_EQ(Asn1FrameSize(buffer.data(), buffer.size()), size);
+    // the start of the next message doesn't matter
+    EXPECT_EQ(Asn1FrameSize((buffer + "\x30").data(), buffer.size() + 1), size);
+    EXPECT_EQ(Asn1FrameSize(buffer.data(), 1), 0);
+  }
+  // indefinite length
+  const char indefinite[] = {'\x30', '\x80'};
+  EXPECT_EQ(Asn1FrameSize(indefinite, sizeof(indefinite)), -1);
+}
+
+/* The vectored output of a message, with the large fields referenced in place,
+ * is the same as the plain encoding, also after partial writes to a socket. */
+TEST(asn1_common, Asn1OutputBuffer) {
+  Asn1OutputBuffer out;
+  for (const size_t data_size : {10U, 1000U, 5000U, 1000000U}) {
+    Asn1Message::Ptr original(Asn1Message::Empty());
+    original->present(AKIpUptaneMes_PR_uploadDataReq);
+    SetString(&original->uploadDataReq()->data, std::string(data_size, 'x'));
+    std::string expected;
+    ASSERT_TRUE(Asn1Encode(original, &expected));
+
+    ASSERT_TRUE(out.encode(original));
+    EXPECT_EQ(out.size(), expected.size());
+    EXPECT_EQ(out.str(), expected);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto sent = std::async(std::launch::async, [&out, &fds]() { return out.send(fds[0]); });
+    std::string received;
+    char buf[65536];
+    while (received.size() < expected.size()) {
+      const ssize_t res = read(fds[1], buf, sizeof(buf));
+      ASSERT_GT(res, 0);
+      received.append(buf, static_cast<size_t>(res));
+    }
+    EXPECT_TRUE(sent.get());
+    EXPECT_EQ(received, expected);
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  // writing to a closed connection fails without raising SIGPIPE
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  close(fds[1]);
+  EXPECT_FALSE(out.send(fds[0]));
+  close(fds[0]);
+}
+
+/* A released message is reused by the next one, with nothing left from its
+ * previous contents. */
+TEST(asn1_common, Asn1MessagePool) {
+  // take whatever the previous tests left in the pool
+  std::vector<Asn1Message::Ptr> held;
+  for (int i = 0; i < 10; ++i) {
+    held.push_back(Asn1Message::Empty());
+  }
+  Asn1Message::Ptr msg(Asn1Message::Empty());
+  msg->present(AKIpUptaneMes_PR_uploadDataReq);
+  SetString(&msg->uploadDataReq()->data, std::string(1000, 'x'));
+  const Asn1Message* released = msg.get();
+  msg.reset();
+
+  msg = Asn1Message::Empty();
+  EXPECT_EQ(msg.get(), released);
+  EXPECT_EQ(msg->present(), AKIpUptaneMes_PR_NOTHING);
+  EXPECT_EQ(msg->uploadDataReq()->data.buf, nullptr);
+  EXPECT_EQ(msg->uploadDataReq()->data.size, 0);
+}
+
 TEST(asn1_common, Asn1MessageFromRawNull) {
   Asn1Message::FromRaw(nullptr);
   AKIpUptaneMes_t* m = nullptr;
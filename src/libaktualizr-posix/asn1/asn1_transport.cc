@@ -0,0 +1,98 @@
+#include "asn1_transport.h"
+
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+std::unique_ptr<Asn1Transport> Asn1Transport::create(const std::string& address, uint16_t port) {
+  if (isLocal(address)) {
+    return std::make_unique<UnixTransport>(address.substr(std::strlen(kUnixPrefix)));
+  }
+  return std::make_unique<TcpTransport>(address, port);
+}
+
+bool Asn1Transport::isLocal(const std::string& address) { return boost::starts_with(address, kUnixPrefix); }
+
+// the socket is closed without changing errno, so that the caller can tell why it failed
+static std::unique_ptr<Socket> failedSocket(std::unique_ptr<Socket> socket) {
+  const int error = errno;
+  socket.reset();
+  errno = error;
+  return nullptr;
+}
+
+std::unique_ptr<Socket> TcpTransport::connect() const {
+  auto socket = std::make_unique<ConnectionSocket>(ip_, port_);
+  if (socket->connect() < 0) {
+    return failedSocket(std::move(socket));
+  }
+  return socket;
+}
+
+void TcpTransport::setOptions(int fd) const {
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int));
+  setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(int));
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &kKeepAliveIdle, sizeof(int));
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &kKeepAliveInterval, sizeof(int));
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &kKeepAliveCount, sizeof(int));
+}
+
+static sockaddr_un unixAddress(const boost::filesystem::path& path) {
+  sockaddr_un sa{};
+  sa.sun_family = AF_UNIX;
+  std::strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+  return sa;
+}
+
+static std::unique_ptr<Socket> unixSocket() {
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return nullptr;
+  }
+  return std::make_unique<Socket>(fd);
+}
+
+UnixTransport::UnixTransport(boost::filesystem::path path) : path_(std::move(path)) {
+  if (path_.empty() || path_.string().size() >= sizeof(sockaddr_un::sun_path)) {
+    throw std::invalid_argument("Invalid Unix domain socket path: " + path_.string());
+  }
+}
+
+std::unique_ptr<Socket> UnixTransport::connect() const {
+  auto socket = unixSocket();
+  if (socket == nullptr) {
+    return nullptr;
+  }
+  const sockaddr_un sa = unixAddress(path_);
+  if (::connect(**socket, reinterpret_cast<const sockaddr*>(&sa), sizeof(sa)) != 0) {
+    return failedSocket(std::move(socket));
+  }
+  return socket;
+}
+
+std::unique_ptr<Socket> UnixTransport::bind() const {
+  auto socket = unixSocket();
+  if (socket == nullptr) {
+    throw std::system_error(errno, std::system_category(), "socket");
+  }
+  // a socket left by a previous run can't be bound again, other files are left alone
+  struct stat st {};
+  if (lstat(path_.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) && unlink(path_.c_str()) != 0) {
+    throw std::system_error(errno, std::system_category(), "unlink " + path_.string());
+  }
+  const sockaddr_un sa = unixAddress(path_);
+  if (::bind(**socket, reinterpret_cast<const sockaddr*>(&sa), sizeof(sa)) != 0) {
+    throw std::system_error(errno, std::system_category(), "bind " + path_.string());
+  }
+  return socket;
+}
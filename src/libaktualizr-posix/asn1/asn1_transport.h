@@ -0,0 +1,89 @@
+#ifndef ASN1_TRANSPORT_H_
+#define ASN1_TRANSPORT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+
+#include "utilities/utils.h"
+
+/**
+ * How the Primary reaches a Secondary. The RPCs (Asn1Connection on the
+ * Primary, SecondaryTcpServer on the Secondary) run the same on any connected
+ * stream socket, the transports only differ in how it is set up:
+ *
+ * - TCP, for Secondaries on the vehicle network. Requests that carry images
+ *   are pipelined, see Asn1Connection::stream(), so that links with a high
+ *   latency are kept busy.
+ * - Unix domain sockets, for Secondaries on the same host as the Primary
+ *   (e.g. in a container). They skip the TCP/IP stack, and their address is
+ *   `unix:<path of the socket>`. Raw uploads pass the image file itself
+ *   rather than its contents, see Asn1Connection::rpcPassingFile().
+ */
+class Asn1Transport {
+ public:
+  static constexpr const char* const kUnixPrefix{"unix:"};
+
+  Asn1Transport() = default;
+  virtual ~Asn1Transport() = default;
+  Asn1Transport(const Asn1Transport&) = delete;
+  Asn1Transport(Asn1Transport&&) = delete;
+  Asn1Transport& operator=(const Asn1Transport&) = delete;
+  Asn1Transport& operator=(Asn1Transport&&) = delete;
+
+  // a connected socket, nullptr on failure with errno set
+  virtual std::unique_ptr<Socket> connect() const = 0;
+  // options of the sockets connected by the Primary
+  virtual void setOptions(int fd) const = 0;
+  virtual std::string toString() const = 0;
+  // whether file descriptors can be passed to the Secondary
+  virtual bool passesFiles() const { return false; }
+
+  // the transport to the address of an IP Secondary, throws std::invalid_argument
+  static std::unique_ptr<Asn1Transport> create(const std::string& address, uint16_t port);
+  static bool isLocal(const std::string& address);
+};
+
+class TcpTransport : public Asn1Transport {
+ public:
+  TcpTransport(std::string ip, uint16_t port) : ip_(std::move(ip)), port_(port) {}
+
+  std::unique_ptr<Socket> connect() const override;
+  void setOptions(int fd) const override;
+  std::string toString() const override { return ip_ + ":" + std::to_string(port_); }
+
+ private:
+  // Detect a dead Secondary within about a minute while the connection is idle
+  static constexpr int kKeepAliveIdle = 30;
+  static constexpr int kKeepAliveInterval = 10;
+  static constexpr int kKeepAliveCount = 3;
+
+  const std::string ip_;
+  const uint16_t port_;
+};
+
+class UnixTransport : public Asn1Transport {
+ public:
+  // throws std::invalid_argument if the path is too long for a socket address
+  explicit UnixTransport(boost::filesystem::path path);
+
+  std::unique_ptr<Socket> connect() const override;
+  void setOptions(int fd) const override { (void)fd; }
+  std::string toString() const override { return kUnixPrefix + path_.string(); }
+  bool passesFiles() const override { return true; }
+
+  /**
+   * A socket bound to the path, for the Secondary to listen on. A socket left
+   * at the path by a previous run is replaced. Throws std::system_error.
+   */
+  std::unique_ptr<Socket> bind() const;
+  const boost::filesystem::path& path() const { return path_; }
+
+ private:
+  const boost::filesystem::path path_;
+};
+
+#endif  // ASN1_TRANSPORT_H_
@@ -3,16 +3,27 @@
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 
-#include <array>
+#include <algorithm>
 #include <fstream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
 
 #include "asn1/asn1_message.h"
+#include "asn1/asn1_transport.h"
+#include "crypto/crypto.h"
 #include "der_encoder.h"
 #include "libaktualizr/secondary_provider.h"
 #include "logging/logging.h"
+#include "multicast.h"
+#include "package_manager/target_stream.h"
 #include "uptane/tuf.h"
+#include "utilities/deflate_stream.h"
 #include "utilities/flow_control.h"
+#include "utilities/memory_budget.h"
 #include "utilities/utils.h"
 
 namespace Uptane {
@@ -21,17 +32,18 @@ SecondaryInterface::Ptr IpUptaneSecondary::connectAndCreate(const std::string& a
                                                             VerificationType verification_type) {
   LOG_INFO << "Connecting to and getting info about IP Secondary: " << address << ":" << port << "...";
 
-  ConnectionSocket con_sock{address, port};
+  const auto transport = Asn1Transport::create(address, port);
+  auto con_sock = transport->connect();
 
-  if (con_sock.connect() == 0) {
+  if (con_sock != nullptr) {
     LOG_INFO << "Connected to IP Secondary: "
-             << "(" << address << ":" << port << ")";
+             << "(" << transport->toString() << ")";
   } else {
     LOG_WARNING << "Failed to connect to a Secondary: " << std::strerror(errno);
     return nullptr;
   }
 
-  return create(address, port, verification_type, *con_sock);
+  return create(address, port, verification_type, **con_sock);
 }
 
 SecondaryInterface::Ptr IpUptaneSecondary::create(const std::string& address, unsigned short port,
@@ -106,7 +118,10 @@ IpUptaneSecondary::IpUptaneSecondary(const std::string& address, unsigned short
       verification_type_{verification_type},
       serial_{std::move(serial)},
       hw_id_{std::move(hw_id)},
-      pub_key_{std::move(pub_key)} {}
+      pub_key_{std::move(pub_key)},
+      connection_{std::make_unique<Asn1Connection>(addr_)} {}
+
+IpUptaneSecondary::~IpUptaneSecondary() = default;
 
 /* Determine the best protocol version to use for this Secondary. This did not
  * exist for v1 and thus only works for v2 and beyond. It would be great if we
@@ -115,12 +130,36 @@ IpUptaneSecondary::IpUptaneSecondary(const std::string& address, unsigned short
  * installation. */
 void IpUptaneSecondary::getSecondaryVersion() const {
   LOG_DEBUG << "Negotiating the protocol version with Secondary " << getSerial();
-  const uint32_t latest_version = 2;
+  const uint32_t latest_version = 3;
   Asn1Message::Ptr req(Asn1Message::Empty());
   req->present(AKIpUptaneMes_PR_versionReq);
   auto m = req->versionReq();
   m->version = latest_version;
-  auto resp = Asn1Rpc(req, getAddr());
+  m->uploadChunkSize = Asn1Allocation<long>();                // NOLINT(google-runtime-int)
+  *m->uploadChunkSize = static_cast<long>(kStreamChunkSize);  // NOLINT(google-runtime-int)
+  m->uploadWindow = Asn1Allocation<long>();                   // NOLINT(google-runtime-int)
+  *m->uploadWindow = static_cast<long>(kStreamWindow);        // NOLINT(google-runtime-int)
+  m->rawUpload = Asn1Allocation<BOOLEAN_t>();
+  *m->rawUpload = 1;
+  m->uploadCompression = Asn1Allocation<AKCompression_t>();
+  *m->uploadCompression = AKCompression_deflate;
+  m->uploadResume = Asn1Allocation<BOOLEAN_t>();
+  *m->uploadResume = 1;
+  m->rootChain = Asn1Allocation<BOOLEAN_t>();
+  *m->rootChain = 1;
+  m->metaVersions = Asn1Allocation<BOOLEAN_t>();
+  *m->metaVersions = 1;
+  m->metrics = Asn1Allocation<BOOLEAN_t>();
+  *m->metrics = 1;
+  if (!multicast_group_.empty()) {
+    m->multicastUpload = Asn1Allocation<BOOLEAN_t>();
+    *m->multicastUpload = 1;
+  }
+  if (connection_->passesFiles()) {
+    m->fileUpload = Asn1Allocation<BOOLEAN_t>();
+    *m->fileUpload = 1;
+  }
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_versionResp) {
     // Bad response probably means v1, but make sure the Secondary is actually
@@ -145,6 +184,37 @@ void IpUptaneSecondary::getSecondaryVersion() const {
               << latest_version << "! Communication will most likely fail!";
     protocol_version = latest_version;
   }
+
+  // the Secondary may only lower the proposed values
+  upload_chunk_size_ = kUploadChunkSize;
+  upload_window_ = 1;
+  raw_upload_ = false;
+  compressed_upload_ = false;
+  resumable_upload_ = false;
+  root_chain_ = false;
+  multicast_upload_ = false;
+  meta_versions_ = false;
+  file_upload_ = false;
+  metrics_ = false;
+  if (protocol_version >= 3) {
+    raw_upload_ = r->rawUpload != nullptr && *r->rawUpload != 0;
+    file_upload_ = raw_upload_ && connection_->passesFiles() && r->fileUpload != nullptr && *r->fileUpload != 0;
+    root_chain_ = r->rootChain != nullptr && *r->rootChain != 0;
+    meta_versions_ = r->metaVersions != nullptr && *r->metaVersions != 0;
+    metrics_ = r->metrics != nullptr && *r->metrics != 0;
+    multicast_upload_ = !multicast_group_.empty() && r->multicastUpload != nullptr && *r->multicastUpload != 0;
+    compressed_upload_ = r->uploadCompression != nullptr && *r->uploadCompression == AKCompression_deflate;
+    resumable_upload_ = r->uploadResume != nullptr && *r->uploadResume != 0;
+    if (r->uploadChunkSize != nullptr && *r->uploadChunkSize > 0) {
+      upload_chunk_size_ = std::min(kStreamChunkSize, static_cast<size_t>(*r->uploadChunkSize));
+    }
+    if (r->uploadWindow != nullptr && *r->uploadWindow > 0) {
+      upload_window_ = std::min(kStreamWindow, static_cast<size_t>(*r->uploadWindow));
+    }
+    LOG_DEBUG << "Streaming uploads to Secondary " << getSerial() << " in chunks of " << upload_chunk_size_
+              << " bytes, " << upload_window_ << " at a time" << (compressed_upload_ ? ", compressed" : "")
+              << (file_upload_ ? ", or by passing the image file" : (raw_upload_ ? ", or as raw data" : ""));
+  }
 }
 
 data::InstallationResult IpUptaneSecondary::putMetadata(const Target& target) {
@@ -164,7 +234,7 @@ data::InstallationResult IpUptaneSecondary::putMetadata(const Target& target) {
 
   LOG_INFO << "Sending Uptane metadata to the Secondary";
   data::InstallationResult put_result;
-  if (protocol_version == 2) {
+  if (protocol_version >= 2) {
     put_result = putMetadata_v2(meta_bundle);
   } else if (protocol_version == 1) {
     put_result = putMetadata_v1(meta_bundle);
@@ -207,7 +277,7 @@ data::InstallationResult IpUptaneSecondary::putMetadata_v1(const Uptane::MetaBun
   SetString(&m->image.choice.json.targets,
             getMetaFromBundle(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_putMetaResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive metadata.";
@@ -226,47 +296,157 @@ data::InstallationResult IpUptaneSecondary::putMetadata_v1(const Uptane::MetaBun
 }
 
 void IpUptaneSecondary::addMetadata(const Uptane::MetaBundle& meta_bundle, const Uptane::RepositoryType repo,
-                                    const Uptane::Role& role, AKMetaCollection_t& collection) {
+                                    const Uptane::Role& role, const HeldMetadata& stored,
+                                    AKMetaCollection_t& collection) {
+  if (stored.count(std::make_pair(repo.ToString(), role.ToString())) > 0) {
+    return;
+  }
   auto* meta_json = Asn1Allocation<AKMetaJson_t>();
   SetString(&meta_json->role, role.ToString());
   SetString(&meta_json->json, getMetaFromBundle(meta_bundle, repo, role));
   ASN_SEQUENCE_ADD(&collection, meta_json);
 }
 
-data::InstallationResult IpUptaneSecondary::putMetadata_v2(const Uptane::MetaBundle& meta_bundle) {
+std::mutex IpUptaneSecondary::encoded_metadata_mutex_;
+std::map<VerificationType, IpUptaneSecondary::EncodedMetadata> IpUptaneSecondary::encoded_metadata_;
+std::deque<std::pair<Uptane::MetaBuffer, std::string>> IpUptaneSecondary::meta_hashes_;
+
+std::shared_ptr<const std::string> IpUptaneSecondary::encodeMetadata_v2(const Uptane::MetaBundle& meta_bundle,
+                                                                         const HeldMetadata& stored) const {
+  // the full request is the same for all the Secondaries
+  if (stored.empty()) {
+    std::lock_guard<std::mutex> lock(encoded_metadata_mutex_);
+    auto cached = encoded_metadata_.find(verification_type_);
+    if (cached != encoded_metadata_.end() && cached->second.meta_bundle == meta_bundle) {
+      return cached->second.request;
+    }
+  }
+
   Asn1Message::Ptr req(Asn1Message::Empty());
   req->present(AKIpUptaneMes_PR_putMetaReq2);
   auto m = req->putMetaReq2();
 
   m->directorRepo.present = directorRepo_PR_collection;
   if (verification_type_ != VerificationType::kTuf) {
-    addMetadata(meta_bundle, Uptane::RepositoryType::Director(), Uptane::Role::Root(),
+    addMetadata(meta_bundle, Uptane::RepositoryType::Director(), Uptane::Role::Root(), stored,
                 m->directorRepo.choice.collection);  // NOLINT(cppcoreguidelines-pro-type-union-access)
-    addMetadata(meta_bundle, Uptane::RepositoryType::Director(), Uptane::Role::Targets(),
+    addMetadata(meta_bundle, Uptane::RepositoryType::Director(), Uptane::Role::Targets(), stored,
                 m->directorRepo.choice.collection);  // NOLINT(cppcoreguidelines-pro-type-union-access)
   }
 
   m->imageRepo.present = imageRepo_PR_collection;
-  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
-  addMetadata(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Root(), m->imageRepo.choice.collection);
-  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
-  addMetadata(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp(), m->imageRepo.choice.collection);
-  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
-  addMetadata(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Snapshot(), m->imageRepo.choice.collection);
-  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
-  addMetadata(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Targets(), m->imageRepo.choice.collection);
+  for (const auto& role :
+       {Uptane::Role::Root(), Uptane::Role::Timestamp(), Uptane::Role::Snapshot(), Uptane::Role::Targets()}) {
+    addMetadata(meta_bundle, Uptane::RepositoryType::Image(), role, stored,
+                m->imageRepo.choice.collection);  // NOLINT(cppcoreguidelines-pro-type-union-access)
+  }
 
-  auto resp = Asn1Rpc(req, getAddr());
+  if (!stored.empty()) {
+    m->stored = Asn1Allocation<AKMetaVersions_t>();
+    for (const auto& held : stored) {
+      auto* version = Asn1Allocation<AKMetaVersion_t>();
+      const bool director = held.first.first == Uptane::RepositoryType::Director().ToString();
+      version->repotype = director ? AKRepoType_director : AKRepoType_image;
+      SetString(&version->role, held.first.second);
+      version->version = static_cast<long>(held.second.version);  // NOLINT(google-runtime-int)
+      SetString(&version->hash, held.second.hash);
+      ASN_SEQUENCE_ADD(m->stored, version);
+    }
+  }
 
-  if (resp->present() != AKIpUptaneMes_PR_putMetaResp2) {
-    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive metadata.";
-    return data::InstallationResult(
-        data::ResultCode::Numeric::kInternalError,
-        "Secondary " + getSerial().ToString() + " failed to respond to a request to receive metadata.");
+  auto encoded = std::make_shared<std::string>();
+  if (!Asn1Encode(req, encoded.get())) {
+    return nullptr;
   }
+  if (stored.empty()) {
+    std::lock_guard<std::mutex> lock(encoded_metadata_mutex_);
+    encoded_metadata_[verification_type_] = EncodedMetadata{meta_bundle, encoded};
+  }
+  return encoded;
+}
 
-  auto r = resp->putMetaResp2();
-  return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+std::string IpUptaneSecondary::metaHash(const Uptane::MetaBuffer& meta) {
+  {
+    std::lock_guard<std::mutex> lock(encoded_metadata_mutex_);
+    for (const auto& hashed : meta_hashes_) {
+      if (hashed.first == meta) {
+        return hashed.second;
+      }
+    }
+  }
+  std::string hash = Crypto::sha256digestHex(meta);
+  std::lock_guard<std::mutex> lock(encoded_metadata_mutex_);
+  if (meta_hashes_.size() >= kMetaHashesKept) {
+    meta_hashes_.pop_front();
+  }
+  meta_hashes_.emplace_back(meta, hash);
+  return hash;
+}
+
+IpUptaneSecondary::HeldMetadata IpUptaneSecondary::getHeldMetadata() const {
+  HeldMetadata held;
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_metaVersionsReq);
+  auto resp = connection_->rpc(req);
+  if (resp->present() != AKIpUptaneMes_PR_metaVersionsResp) {
+    LOG_WARNING << "Secondary " << getSerial() << " failed to respond to a request for the metadata it holds.";
+    return held;
+  }
+
+  auto r = resp->metaVersionsResp();
+  for (int i = 0; i < r->versions.list.count; i++) {
+    const AKMetaVersion_t& version = *r->versions.list.array[i];  // NOLINT
+    const auto repo = version.repotype == AKRepoType_director ? Uptane::RepositoryType::Director()
+                                                               : Uptane::RepositoryType::Image();
+    held[std::make_pair(repo.ToString(), ToString(version.role))] = HeldMeta{version.version, ToString(version.hash)};
+  }
+  return held;
+}
+
+data::InstallationResult IpUptaneSecondary::putMetadata_v2(const Uptane::MetaBundle& meta_bundle) {
+  // the roles the Secondary holds already are left out
+  HeldMetadata stored;
+  if (meta_versions_) {
+    for (const auto& held : getHeldMetadata()) {
+      for (const auto& meta : meta_bundle) {
+        if (meta.first.first.ToString() == held.first.first && meta.first.second.ToString() == held.first.second &&
+            metaHash(meta.second) == held.second.hash) {
+          LOG_DEBUG << "Secondary " << getSerial() << " holds " << held.first.first << " repo "
+                    << held.first.second << " metadata version " << held.second.version << " already";
+          stored.insert(held);
+        }
+      }
+    }
+  }
+
+  auto send = [this, &meta_bundle](const HeldMetadata& left_out) {
+    const auto req = encodeMetadata_v2(meta_bundle, left_out);
+    if (req == nullptr) {
+      return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                      "Unable to encode metadata for Secondary " + getSerial().ToString());
+    }
+
+    auto resp = connection_->rpc(*req);
+
+    if (resp->present() != AKIpUptaneMes_PR_putMetaResp2) {
+      LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive metadata.";
+      return data::InstallationResult(
+          data::ResultCode::Numeric::kInternalError,
+          "Secondary " + getSerial().ToString() + " failed to respond to a request to receive metadata.");
+    }
+
+    auto r = resp->putMetaResp2();
+    return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+  };
+
+  auto result = send(stored);
+  if (!result.isSuccess() && !stored.empty()) {
+    // what the Secondary had stored may have changed meanwhile
+    LOG_WARNING << "Secondary " << getSerial() << " failed to take the metadata it holds: " << result.description
+                << "; sending all of it";
+    result = send(HeldMetadata{});
+  }
+  return result;
 }
 
 int32_t IpUptaneSecondary::getRootVersion(bool director) const {
@@ -283,7 +463,7 @@ int32_t IpUptaneSecondary::getRootVersion(bool director) const {
     m->repotype = AKRepoType_image;
   }
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
   if (resp->present() != AKIpUptaneMes_PR_rootVerResp) {
     // v1 (and v2 until this was added) Secondaries won't understand this.
     // Return 0 to indicate that this is unsupported. Sending intermediate Roots
@@ -313,7 +493,7 @@ data::InstallationResult IpUptaneSecondary::putRoot(const std::string& root, boo
   }
   SetString(&m->json, root);
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
   if (resp->present() != AKIpUptaneMes_PR_putRootResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive Root metadata.";
     return data::InstallationResult(
@@ -325,6 +505,42 @@ data::InstallationResult IpUptaneSecondary::putRoot(const std::string& root, boo
   return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
 }
 
+data::InstallationResult IpUptaneSecondary::putRootChain(const std::vector<std::string>& roots, bool director) {
+  if (!root_chain_ || roots.size() < 2 || (director && verification_type_ == VerificationType::kTuf)) {
+    return SecondaryInterface::putRootChain(roots, director);
+  }
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_putRootChainReq);
+  auto m = req->putRootChainReq();
+
+  if (director) {
+    m->repotype = AKRepoType_director;
+  } else {
+    m->repotype = AKRepoType_image;
+  }
+  for (const auto& root : roots) {
+    auto* json = Asn1Allocation<OCTET_STRING_t>();
+    SetString(json, root);
+    ASN_SEQUENCE_ADD(&m->chain, json);
+  }
+
+  auto resp = connection_->rpc(req);
+  if (resp->present() != AKIpUptaneMes_PR_putRootChainResp) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive Root metadata.";
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kInternalError,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request to receive Root metadata.");
+  }
+
+  auto r = resp->putRootChainResp();
+  const data::InstallationResult result(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+  if (!result.isSuccess()) {
+    LOG_ERROR << "Secondary " << getSerial() << " stopped at Root metadata version " << r->version << ": "
+              << result.description;
+  }
+  return result;
+}
+
 Manifest IpUptaneSecondary::getManifest() const {
   getSecondaryVersion();
 
@@ -332,7 +548,7 @@ Manifest IpUptaneSecondary::getManifest() const {
   Asn1Message::Ptr req(Asn1Message::Empty());
 
   req->present(AKIpUptaneMes_PR_manifestReq);
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_manifestResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a manifest request.";
@@ -354,11 +570,25 @@ bool IpUptaneSecondary::ping() const {
 
   auto m = req->getInfoReq();
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   return resp->present() == AKIpUptaneMes_PR_getInfoResp;
 }
 
+std::string IpUptaneSecondary::getMetrics() const {
+  if (!metrics_) {
+    return "";
+  }
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_metricsReq);
+  auto resp = connection_->rpc(req);
+  if (resp->present() != AKIpUptaneMes_PR_metricsResp) {
+    LOG_WARNING << "Secondary " << getSerial() << " failed to respond to a metrics request.";
+    return "";
+  }
+  return ToString(resp->metricsResp()->metrics);
+}
+
 data::InstallationResult IpUptaneSecondary::sendFirmware(const Uptane::Target& target,
                                                          const api::FlowControlToken* flow_control) {
   if (flow_control != nullptr && flow_control->hasAborted()) {
@@ -367,7 +597,7 @@ data::InstallationResult IpUptaneSecondary::sendFirmware(const Uptane::Target& t
     return data::InstallationResult(data::ResultCode::Numeric::kOperationCancelled, "");
   }
 
-  if (protocol_version == 2) {
+  if (protocol_version >= 2) {
     return sendFirmware_v2(target);
   }
   if (protocol_version == 1) {
@@ -379,25 +609,24 @@ data::InstallationResult IpUptaneSecondary::sendFirmware(const Uptane::Target& t
 }
 
 data::InstallationResult IpUptaneSecondary::sendFirmware_v1(const Uptane::Target& target) {
-  std::string data_to_send;
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_sendFirmwareReq);
+  auto m = req->sendFirmwareReq();
 
   if (target.IsOstree()) {
     // empty firmware means OSTree Secondaries: pack credentials instead
-    data_to_send = secondary_provider_->getTreehubCredentials();
+    const std::string credentials = secondary_provider_->getTreehubCredentials();
+    LOG_INFO << "Sending firmware to the Secondary, size: " << credentials.size();
+    SetString(&m->firmware, credentials);
   } else {
-    std::stringstream sstr;
-    auto str = secondary_provider_->getTargetFileHandle(target);
-    sstr << str.rdbuf();
-    data_to_send = sstr.str();
+    // encoded straight from the mapping of the image
+    const auto image = secondary_provider_->getTargetFileView(target);
+    LOG_INFO << "Sending firmware to the Secondary, size: " << image.size();
+    const char* data = (image.data() != nullptr) ? reinterpret_cast<const char*>(image.data()) : "";
+    OCTET_STRING_fromBuf(&m->firmware, data, static_cast<int>(image.size()));
   }
 
-  LOG_INFO << "Sending firmware to the Secondary, size: " << data_to_send.size();
-  Asn1Message::Ptr req(Asn1Message::Empty());
-  req->present(AKIpUptaneMes_PR_sendFirmwareReq);
-
-  auto m = req->sendFirmwareReq();
-  SetString(&m->firmware, data_to_send);
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_sendFirmwareResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive firmware.";
@@ -414,14 +643,192 @@ data::InstallationResult IpUptaneSecondary::sendFirmware_v1(const Uptane::Target
 }
 
 data::InstallationResult IpUptaneSecondary::sendFirmware_v2(const Uptane::Target& target) {
+  if (!multicast_delivered_.empty() && multicast_delivered_ == target.sha256Hash()) {
+    multicast_delivered_.clear();
+    LOG_INFO << "Secondary " << getSerial() << " already received target " << target.filename()
+             << " from the multicast group";
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
+  multicast_delivered_.clear();
   LOG_INFO << "Instructing Secondary " << getSerial() << " to receive target " << target.filename();
   if (target.IsOstree()) {
     return downloadOstreeRev(target);
+  } else if (protocol_version >= 3) {
+    data::InstallationResult result;
+    for (int attempt = 1;; ++attempt) {
+      // raw uploads save the copies, but compressed ones save the bandwidth,
+      // unless the file itself is passed. Images streamed from the server
+      // can't be sent with sendfile() or passed.
+      result = ((file_upload_ || (raw_upload_ && !compressed_upload_)) && !secondary_provider_->streamsTarget(target))
+                   ? rawUploadFirmware(target)
+                   : streamFirmware(target);
+      // only a lost connection is worth resuming after
+      if (result.result_code.num_code != data::ResultCode::Numeric::kUnknown || !resumable_upload_ ||
+          attempt >= kUploadAttempts) {
+        return result;
+      }
+      LOG_WARNING << "The upload to Secondary " << getSerial() << " was interrupted, resuming it";
+      std::this_thread::sleep_for(kUploadRetryDelay);
+    }
   } else {
     return uploadFirmware(target);
   }
 }
 
+void IpUptaneSecondary::setMulticast(const std::string& group, uint16_t port, uint64_t rate) {
+  multicast_group_ = group;
+  multicast_port_ = port;
+  multicast_rate_ = rate;
+}
+
+/* The image is sent once to the group, in numbered blocks, and each
+ * Secondary keeps the blocks it gets. The Secondaries report the blocks they
+ * have missed, which are sent again, until they all have the image or the
+ * rounds run out. Those that still miss blocks drop them, and get the image
+ * uploaded by sendFirmware() as usual. */
+bool IpUptaneSecondary::sendFirmwareToGroup(const Uptane::Target& target,
+                                            const std::vector<SecondaryInterface*>& group) {
+  if (multicast_group_.empty() || target.IsOstree() || target.length() == 0 ||
+      secondary_provider_->streamsTarget(target)) {
+    return false;
+  }
+  std::vector<IpUptaneSecondary*> members;
+  for (auto* secondary : group) {
+    auto* member = dynamic_cast<IpUptaneSecondary*>(secondary);
+    if (member != nullptr && member->multicast_upload_ && member->multicast_group_ == multicast_group_ &&
+        member->multicast_port_ == multicast_port_) {
+      members.push_back(member);
+    }
+  }
+  if (members.size() < 2) {
+    return false;
+  }
+
+  const auto image = secondary_provider_->getTargetFileView(target);
+  if (image.size() < target.length()) {
+    return false;
+  }
+  const size_t block_size = Multicast::kBlockSize;
+  const uint64_t block_count = Multicast::blockCount(target.length(), block_size);
+  if (block_count > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+  const auto session = static_cast<uint32_t>(std::random_device{}());
+
+  LOG_INFO << "Sending target " << target.filename() << " to " << members.size() << " Secondaries through "
+           << multicast_group_ << ":" << multicast_port_;
+  std::vector<IpUptaneSecondary*> receivers;
+  for (auto* member : members) {
+    member->multicast_delivered_.clear();
+    if (member->startMulticast(session, block_size).isSuccess()) {
+      receivers.push_back(member);
+    }
+  }
+  if (receivers.empty()) {
+    return false;
+  }
+
+  std::set<uint32_t> blocks;
+  for (uint64_t i = 0; i < block_count; ++i) {
+    blocks.insert(static_cast<uint32_t>(i));
+  }
+  std::map<IpUptaneSecondary*, int64_t> missing_counts;
+  try {
+    MulticastSender sender(multicast_group_, multicast_port_, multicast_rate_);
+    for (int round = 0; round <= kMulticastRepairRounds && !blocks.empty(); ++round) {
+      if (round > 0) {
+        LOG_DEBUG << "Sending " << blocks.size() << " missed blocks of " << target.filename() << " again";
+      }
+      for (const auto index : blocks) {
+        const uint64_t offset = static_cast<uint64_t>(index) * block_size;
+        const auto size = static_cast<size_t>(std::min<uint64_t>(block_size, target.length() - offset));
+        sender.sendBlock(session, index, image.data() + offset, size);  // NOLINT
+      }
+      // the last blocks may still be on their way
+      std::this_thread::sleep_for(kMulticastSettleTime);
+      blocks.clear();
+      for (auto* receiver : receivers) {
+        missing_counts[receiver] = receiver->multicastStatus(session, &blocks);
+      }
+    }
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Could not send target " << target.filename() << " to " << multicast_group_ << ": " << e.what();
+  }
+
+  bool delivered = false;
+  for (auto* receiver : receivers) {
+    const bool complete = missing_counts[receiver] == 0;
+    if (receiver->endMulticast(session, complete).isSuccess() && complete) {
+      receiver->multicast_delivered_ = target.sha256Hash();
+      delivered = true;
+    } else {
+      LOG_WARNING << "Secondary " << receiver->getSerial() << " did not receive all of target " << target.filename()
+                  << " from the multicast group, it is uploaded instead";
+    }
+  }
+  return delivered;
+}
+
+data::InstallationResult IpUptaneSecondary::startMulticast(uint32_t session, size_t block_size) {
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_multicastStartReq);
+  auto m = req->multicastStartReq();
+  m->session = static_cast<long>(session);    // NOLINT(google-runtime-int)
+  SetString(&m->group, multicast_group_);
+  m->port = static_cast<long>(multicast_port_);  // NOLINT(google-runtime-int)
+  m->blockSize = static_cast<long>(block_size);  // NOLINT(google-runtime-int)
+  auto resp = connection_->rpc(req);
+
+  if (resp->present() != AKIpUptaneMes_PR_multicastStartResp) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to join a multicast group.";
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kUnknown,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request to join a multicast group.");
+  }
+  auto r = resp->multicastStartResp();
+  return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+}
+
+int64_t IpUptaneSecondary::multicastStatus(uint32_t session, std::set<uint32_t>* missing) {
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_multicastStatusReq);
+  auto m = req->multicastStatusReq();
+  m->session = static_cast<long>(session);  // NOLINT(google-runtime-int)
+  m->limit = kMulticastMissingLimit;
+  auto resp = connection_->rpc(req);
+
+  if (resp->present() != AKIpUptaneMes_PR_multicastStatusResp) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a multicast status request.";
+    return -1;
+  }
+  auto r = resp->multicastStatusResp();
+  for (int i = 0; i < r->missing.list.count; ++i) {
+    const auto index = *r->missing.list.array[i];  // NOLINT
+    if (index >= 0) {
+      missing->insert(static_cast<uint32_t>(index));
+    }
+  }
+  return static_cast<int64_t>(r->missingCount);
+}
+
+data::InstallationResult IpUptaneSecondary::endMulticast(uint32_t session, bool commit) {
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_multicastEndReq);
+  auto m = req->multicastEndReq();
+  m->session = static_cast<long>(session);  // NOLINT(google-runtime-int)
+  m->commit = commit ? 1 : 0;
+  auto resp = connection_->rpc(req);
+
+  if (resp->present() != AKIpUptaneMes_PR_multicastEndResp) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to leave a multicast group.";
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kUnknown,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request to leave a multicast group.");
+  }
+  auto r = resp->multicastEndResp();
+  return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+}
+
 data::InstallationResult IpUptaneSecondary::install(const Uptane::Target& target,
                                                     const api::FlowControlToken* flow_control) {
   if (flow_control != nullptr && flow_control->hasAborted()) {
@@ -431,7 +838,7 @@ data::InstallationResult IpUptaneSecondary::install(const Uptane::Target& target
   }
 
   data::InstallationResult install_result;
-  if (protocol_version == 2) {
+  if (protocol_version >= 2) {
     install_result = install_v2(target);
   } else if (protocol_version == 1) {
     install_result = install_v1(target);
@@ -454,7 +861,7 @@ data::InstallationResult IpUptaneSecondary::install_v1(const Uptane::Target& tar
   auto req_mes = req->installReq();
   SetString(&req_mes->hash, target.filename());
   // send request and receive response, a request-response type of RPC
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   // invalid type of an response message
   if (resp->present() != AKIpUptaneMes_PR_installResp) {
@@ -483,7 +890,7 @@ data::InstallationResult IpUptaneSecondary::downloadOstreeRev(const Uptane::Targ
 
   auto m = req->downloadOstreeRevReq();
   SetString(&m->tlsCred, tls_creds);
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_downloadOstreeRevResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to download an OSTree commit.";
@@ -500,30 +907,268 @@ data::InstallationResult IpUptaneSecondary::uploadFirmware(const Uptane::Target&
   LOG_INFO << "Uploading the target image (" << target.filename() << ") "
            << "to the Secondary (" << getSerial() << ")";
 
-  auto upload_result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "");
+  // the chunks are encoded straight from the mapping of the image, and each of
+  // them costs a round trip
+  const auto image = secondary_provider_->getTargetFileView(target);
 
-  auto image_reader = secondary_provider_->getTargetFileHandle(target);
-
-  uint64_t image_size = target.length();
-  const size_t size = 1024;
-  size_t total_send_data = 0;
-  std::array<uint8_t, size> buf{};
+  const uint64_t image_size = std::min<uint64_t>(target.length(), image.size());
+  uint64_t total_send_data = 0;
   auto upload_data_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 
   while (total_send_data < image_size && upload_data_result.isSuccess()) {
-    image_reader.read(reinterpret_cast<char*>(buf.data()), buf.size());
-    upload_data_result = uploadFirmwareData(buf.data(), static_cast<size_t>(image_reader.gcount()));
-    total_send_data += static_cast<size_t>(image_reader.gcount());
-  }
-  if (upload_data_result.isSuccess() && total_send_data == image_size) {
-    upload_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
-  } else if (!upload_data_result.isSuccess()) {
-    upload_result = upload_data_result;
+    const auto chunk = static_cast<size_t>(std::min<uint64_t>(kUploadChunkSize, image_size - total_send_data));
+    upload_data_result = uploadFirmwareData(image.data() + total_send_data, chunk);  // NOLINT
+    total_send_data += chunk;
+  }
+  if (!upload_data_result.isSuccess()) {
+    return upload_data_result;
+  }
+  if (total_send_data < target.length()) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Incomplete upload");
+  }
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+// Digest of the data hashed so far, without finishing the hash
+static std::string runningHexDigest(const MultiPartHasher& hasher, Hash::Type type) {
+  auto copy = MultiPartHasher::create(type);
+  copy->setState(hasher.getState());
+  return copy->getHexDigest();
+}
+
+uint64_t IpUptaneSecondary::resumeUploadOffset(const Uptane::Target& target, const uint8_t* image,
+                                               uint64_t image_size, MultiPartHasher* hasher) {
+  if (!resumable_upload_ || target.hashes().empty()) {
+    return 0;
+  }
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_uploadResumeReq);
+  auto resp = connection_->rpc(req);
+  if (resp->present() != AKIpUptaneMes_PR_uploadResumeResp) {
+    LOG_WARNING << "Secondary " << getSerial() << " failed to respond to an upload resume request.";
+    return 0;
+  }
+  auto r = resp->uploadResumeResp();
+  if (r->offset <= 0 || static_cast<uint64_t>(r->offset) > image_size) {
+    return 0;
+  }
+
+  // only skip what the Secondary really has
+  const auto offset = static_cast<uint64_t>(r->offset);
+  const Hash::Type hash_type = target.hashes()[0].type();
+  auto prefix_hasher = MultiPartHasher::create(hash_type);
+  prefix_hasher->update(image, offset);
+  if (Hash(hash_type, runningHexDigest(*prefix_hasher, hash_type)) != Hash(hash_type, ToString(r->runningHash))) {
+    LOG_WARNING << "The data Secondary " << getSerial() << " has kept doesn't match the target image";
+    return 0;
+  }
+  if (hasher != nullptr) {
+    hasher->setState(prefix_hasher->getState());
+  }
+  LOG_INFO << "Resuming the upload to Secondary " << getSerial() << " after " << offset << " bytes";
+  return offset;
+}
+
+data::InstallationResult IpUptaneSecondary::streamFirmware(const Uptane::Target& target) {
+  LOG_INFO << "Streaming the target image (" << target.filename() << ") "
+           << "to the Secondary (" << getSerial() << ")";
+
+  // The image is read from the downloaded file, or with cut-through from the
+  // server as it is sent. Streamed images are always sent from the start.
+  std::unique_ptr<TargetStream> stream;
+  std::unique_ptr<TargetFileView> image;
+  std::vector<uint8_t> stream_buffer;
+  if (secondary_provider_->streamsTarget(target)) {
+    LOG_INFO << "Downloading the target image (" << target.filename() << ") while it is sent";
+    stream = secondary_provider_->openTargetStream(target);
   } else {
-    upload_result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Incomplete upload");
+    image = std::make_unique<TargetFileView>(secondary_provider_->getTargetFileView(target));
+  }
+  const uint64_t image_size =
+      stream != nullptr ? target.length() : std::min<uint64_t>(target.length(), image->size());
+  // fewer chunks in flight when the memory budget runs low
+  const MemoryBudget::Reservation memory = MemoryBudget::instance().reserveUpTo(
+      MemoryBudget::User::kSecondaryUpload, upload_window_ * upload_chunk_size_, upload_chunk_size_);
+  const size_t window = std::max<size_t>(static_cast<size_t>(memory.size() / upload_chunk_size_), 1);
+  if (window < upload_window_) {
+    LOG_DEBUG << "The memory budget limits the upload window of Secondary " << getSerial() << " to " << window
+              << " chunks";
+  }
+
+  // Compressed chunks get less input, so that they still fit in the chunk
+  // size the Secondary accepts when the data doesn't shrink.
+  std::unique_ptr<DeflateStream> deflater;
+  size_t chunk_size = upload_chunk_size_;
+  const size_t compression_overhead = DeflateStream::bound(upload_chunk_size_) - upload_chunk_size_;
+  if (compressed_upload_ && upload_chunk_size_ > 2 * compression_overhead) {
+    deflater = std::make_unique<DeflateStream>();
+    chunk_size -= compression_overhead;
+  }
+  uint64_t total_compressed_data = 0;
+
+  // the running hash is sent once per window, and with the last chunk
+  const bool send_hash = !target.hashes().empty();
+  const Hash::Type hash_type = send_hash ? target.hashes()[0].type() : Hash::Type::kUnknownAlgorithm;
+  MultiPartHasher::Ptr hasher = send_hash ? MultiPartHasher::create(hash_type) : nullptr;
+
+  const uint64_t offset =
+      stream != nullptr ? 0 : resumeUploadOffset(target, image->data(), image_size, hasher.get());
+  uint64_t total_send_data = offset;
+  long sequence = 0;  // NOLINT(google-runtime-int)
+  auto upload_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+
+  auto next_chunk = [&]() -> Asn1Message::Ptr {
+    if (total_send_data >= image_size) {
+      return nullptr;
+    }
+    const auto chunk = static_cast<size_t>(std::min<uint64_t>(chunk_size, image_size - total_send_data));
+    const uint8_t* data = nullptr;
+    if (stream != nullptr) {
+      stream_buffer.resize(chunk);
+      // a short read ends the upload, which then fails as incomplete
+      if (stream->read(stream_buffer.data(), chunk) < chunk) {
+        return nullptr;
+      }
+      data = stream_buffer.data();
+    } else {
+      data = image->data() + total_send_data;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    }
+    total_send_data += chunk;
+
+    Asn1Message::Ptr req(Asn1Message::Empty());
+    req->present(AKIpUptaneMes_PR_uploadStreamReq);
+    auto m = req->uploadStreamReq();
+    if (sequence == 0 && offset > 0) {
+      m->offset = Asn1Allocation<long>();      // NOLINT(google-runtime-int)
+      *m->offset = static_cast<long>(offset);  // NOLINT(google-runtime-int)
+    }
+    m->sequence = sequence++;
+    if (deflater != nullptr) {
+      const std::string compressed = deflater->compress(data, chunk);
+      total_compressed_data += compressed.size();
+      // images that are already compressed are sent as they are, after the
+      // first chunk that doesn't shrink enough
+      if (deflater->compressing() && compressed.size() >= chunk - chunk / 16) {
+        LOG_DEBUG << "The target image does not compress well, sending the rest of it uncompressed";
+        deflater->stopCompressing();
+      }
+      m->compression = Asn1Allocation<AKCompression_t>();
+      *m->compression = AKCompression_deflate;
+      SetString(&m->data, compressed);
+    } else {
+      OCTET_STRING_fromBuf(&m->data, reinterpret_cast<const char*>(data), static_cast<int>(chunk));
+    }
+    std::string running_hash;
+    if (hasher != nullptr) {
+      hasher->update(data, chunk);
+      if (static_cast<size_t>(sequence) % window == 0 || total_send_data == image_size) {
+        running_hash = runningHexDigest(*hasher, hash_type);
+      }
+    }
+    SetString(&m->runningHash, running_hash);
+    return req;
+  };
+
+  auto on_response = [&](const Asn1Message::Ptr& resp) {
+    if (resp->present() != AKIpUptaneMes_PR_uploadStreamResp) {
+      LOG_ERROR << "Secondary " << getSerial() << " returned an invalid response to a streamed upload.";
+      upload_result = data::InstallationResult(
+          data::ResultCode::Numeric::kInternalError,
+          "Secondary " + getSerial().ToString() + " returned an invalid response to a streamed upload.");
+      return false;
+    }
+    auto r = resp->uploadStreamResp();
+    if (r->result != AKInstallationResultCode_ok) {
+      LOG_ERROR << "Secondary " << getSerial() << " stopped the streamed upload at chunk " << r->sequence << ": "
+                << ToString(r->description);
+      upload_result =
+          data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+      return false;
+    }
+    return true;
+  };
+
+  if (!connection_->stream(next_chunk, window, on_response)) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a streamed upload.";
+    return data::InstallationResult(data::ResultCode::Numeric::kUnknown,
+                                    "Secondary " + getSerial().ToString() + " failed to respond to a streamed upload.");
+  }
+  if (!upload_result.isSuccess()) {
+    return upload_result;
+  }
+  if (deflater != nullptr) {
+    LOG_INFO << "Sent " << total_send_data - offset << " bytes of target image compressed to "
+             << total_compressed_data << " bytes";
+  }
+  if (stream != nullptr) {
+    // waits for the end of the download, and its verification
+    uint8_t extra = 0;
+    if (stream->read(&extra, 1) != 0 || !stream->ok()) {
+      return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                      "Download of the streamed image failed: " + stream->error());
+    }
+  }
+  if (total_send_data < target.length()) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Incomplete upload");
+  }
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+data::InstallationResult IpUptaneSecondary::rawUploadFirmware(const Uptane::Target& target) {
+  LOG_INFO << "Sending the target image (" << target.filename() << ") "
+           << "to the Secondary (" << getSerial() << ")" << (file_upload_ ? " by passing the file" : " as raw data");
+
+  const auto image = secondary_provider_->getTargetFileView(target);
+  const uint64_t image_size = std::min<uint64_t>(target.length(), image.size());
+
+  const uint64_t offset = resumeUploadOffset(target, image.data(), image_size, nullptr);
+  uint64_t total_send_data = offset;
+  long sequence = 0;  // NOLINT(google-runtime-int)
+  while (total_send_data < image_size) {
+    const uint64_t piece = std::min<uint64_t>(kRawUploadPieceSize, image_size - total_send_data);
+
+    Asn1Message::Ptr req(Asn1Message::Empty());
+    req->present(AKIpUptaneMes_PR_uploadRawReq);
+    auto m = req->uploadRawReq();
+    if (sequence == 0 && offset > 0) {
+      m->offset = Asn1Allocation<long>();      // NOLINT(google-runtime-int)
+      *m->offset = static_cast<long>(offset);  // NOLINT(google-runtime-int)
+    }
+    m->sequence = sequence++;
+    m->length = static_cast<long>(piece);  // NOLINT(google-runtime-int)
+    Asn1Message::Ptr resp;
+    if (file_upload_) {
+      // the Secondary reads the piece from the file, nothing is copied through the socket
+      m->fileOffset = Asn1Allocation<long>();               // NOLINT(google-runtime-int)
+      *m->fileOffset = static_cast<long>(total_send_data);  // NOLINT(google-runtime-int)
+      resp = connection_->rpcPassingFile(req, image.fd());
+    } else {
+      resp = connection_->rpcWithFile(req, image.fd(), total_send_data, piece);
+    }
+
+    if (resp->present() == AKIpUptaneMes_PR_NOTHING) {
+      LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a raw upload.";
+      return data::InstallationResult(data::ResultCode::Numeric::kUnknown,
+                                      "Secondary " + getSerial().ToString() + " failed to respond to a raw upload.");
+    }
+    if (resp->present() != AKIpUptaneMes_PR_uploadRawResp) {
+      LOG_ERROR << "Secondary " << getSerial() << " returned an invalid response to a raw upload.";
+      return data::InstallationResult(
+          data::ResultCode::Numeric::kInternalError,
+          "Secondary " + getSerial().ToString() + " returned an invalid response to a raw upload.");
+    }
+    auto r = resp->uploadRawResp();
+    if (r->result != AKInstallationResultCode_ok) {
+      LOG_ERROR << "Secondary " << getSerial() << " stopped the raw upload: " << ToString(r->description);
+      return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+    }
+    total_send_data += piece;
+  }
+
+  if (total_send_data < target.length()) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Incomplete upload");
   }
-  image_reader.close();
-  return upload_result;
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 }
 
 data::InstallationResult IpUptaneSecondary::uploadFirmwareData(const uint8_t* data, size_t size) {
@@ -532,7 +1177,7 @@ data::InstallationResult IpUptaneSecondary::uploadFirmwareData(const uint8_t* da
 
   auto m = req->uploadDataReq();
   OCTET_STRING_fromBuf(&m->data, reinterpret_cast<const char*>(data), static_cast<int>(size));
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() == AKIpUptaneMes_PR_NOTHING) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive firmware data.";
@@ -558,8 +1203,18 @@ data::InstallationResult IpUptaneSecondary::invokeInstallOnSecondary(const Uptan
   // prepare request message
   auto req_mes = req->installReq();
   SetString(&req_mes->hash, target.filename());
-  // send request and receive response, a request-response type of RPC
-  auto resp = Asn1Rpc(req, getAddr());
+  if (protocol_version >= 3) {
+    req_mes->progress = Asn1Allocation<BOOLEAN_t>();
+    *req_mes->progress = 1;
+  }
+  // send request and receive response, a request-response type of RPC, with
+  // the progress reported meanwhile
+  auto resp = connection_->rpc(req, AKIpUptaneMes_PR_installProgress, [this](const Asn1Message::Ptr& progress_msg) {
+    const auto progress =
+        std::min<int64_t>(std::max<int64_t>(static_cast<int64_t>(progress_msg->installProgress()->progress), 0), 100);
+    LOG_DEBUG << "Secondary " << getSerial() << " installation progress: " << progress << "%";
+    secondary_provider_->reportInstallProgress(getSerial(), static_cast<unsigned int>(progress));
+  });
 
   // invalid type of an response message
   if (resp->present() != AKIpUptaneMes_PR_installResp2) {
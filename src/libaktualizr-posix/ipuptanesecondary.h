@@ -1,11 +1,23 @@
 #ifndef UPTANE_IPUPTANESECONDARY_H_
 #define UPTANE_IPUPTANESECONDARY_H_
 
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "libaktualizr/secondaryinterface.h"
 #include "libaktualizr/types.h"
 
 struct AKMetaCollection;
 using AKMetaCollection_t = struct AKMetaCollection;
+class Asn1Connection;
+class MultiPartHasher;
 
 namespace Uptane {
 
@@ -22,6 +34,11 @@ class IpUptaneSecondary : public SecondaryInterface {
 
   explicit IpUptaneSecondary(const std::string& address, unsigned short port, VerificationType verification_type,
                              EcuSerial serial, HardwareIdentifier hw_id, PublicKey pub_key);
+  ~IpUptaneSecondary() override;
+  IpUptaneSecondary(const IpUptaneSecondary&) = delete;
+  IpUptaneSecondary(IpUptaneSecondary&&) = delete;
+  IpUptaneSecondary& operator=(const IpUptaneSecondary&) = delete;
+  IpUptaneSecondary& operator=(IpUptaneSecondary&&) = delete;
 
   std::string Type() const override { return "IP"; }
   EcuSerial getSerial() const override { return serial_; };
@@ -34,27 +51,79 @@ class IpUptaneSecondary : public SecondaryInterface {
   data::InstallationResult putMetadata(const Target& target) override;
   int32_t getRootVersion(bool director) const override;
   data::InstallationResult putRoot(const std::string& root, bool director) override;
+  data::InstallationResult putRootChain(const std::vector<std::string>& roots, bool director) override;
   Manifest getManifest() const override;
   bool ping() const override;
   data::InstallationResult sendFirmware(const Uptane::Target& target,
                                         const api::FlowControlToken* flow_control) override;
   data::InstallationResult install(const Uptane::Target& target, const api::FlowControlToken* flow_control) override;
+  // with metricsReq (v3), the latency of the requests the Secondary handled
+  std::string getMetrics() const override;
+  // streamed uploads (v3); the version is known once the manifest was fetched
+  bool acceptsTargetStream() const override { return protocol_version >= 3; }
+  // multicast uploads (v3) to the IP Secondaries of the group that can take them
+  bool sendFirmwareToGroup(const Uptane::Target& target, const std::vector<SecondaryInterface*>& group) override;
+  // the group and port multicast uploads are sent to, at most `rate` bytes per second
+  void setMulticast(const std::string& group, uint16_t port, uint64_t rate);
 
  private:
-  const std::pair<std::string, uint16_t>& getAddr() const { return addr_; }
   void getSecondaryVersion() const;
   data::InstallationResult putMetadata_v1(const Uptane::MetaBundle& meta_bundle);
   data::InstallationResult putMetadata_v2(const Uptane::MetaBundle& meta_bundle);
+  // version and SHA256 of the metadata the Secondary holds, by repo and role name
+  struct HeldMeta {
+    int64_t version;
+    std::string hash;
+  };
+  using HeldMetadata = std::map<std::pair<std::string, std::string>, HeldMeta>;
+  HeldMetadata getHeldMetadata() const;
+  // the roles in `stored` are left out, to be taken by the Secondary from its storage
+  std::shared_ptr<const std::string> encodeMetadata_v2(const Uptane::MetaBundle& meta_bundle,
+                                                       const HeldMetadata& stored) const;
+  // SHA256 of metadata, kept while the same metadata is sent
+  static std::string metaHash(const Uptane::MetaBuffer& meta);
   data::InstallationResult sendFirmware_v1(const Uptane::Target& target);
   data::InstallationResult sendFirmware_v2(const Uptane::Target& target);
   data::InstallationResult install_v1(const Uptane::Target& target);
   data::InstallationResult install_v2(const Uptane::Target& target);
   static void addMetadata(const Uptane::MetaBundle& meta_bundle, Uptane::RepositoryType repo, const Uptane::Role& role,
-                          AKMetaCollection_t& collection);
+                          const HeldMetadata& stored, AKMetaCollection_t& collection);
   data::InstallationResult invokeInstallOnSecondary(const Uptane::Target& target);
   data::InstallationResult downloadOstreeRev(const Uptane::Target& target);
   data::InstallationResult uploadFirmware(const Uptane::Target& target);
+  data::InstallationResult streamFirmware(const Uptane::Target& target);
+  data::InstallationResult rawUploadFirmware(const Uptane::Target& target);
+  /**
+   * Ask the Secondary how much of the image it has kept from an interrupted
+   * upload. That much of the image can be skipped if it matches, and is then
+   * fed to `hasher` when there is one.
+   */
+  uint64_t resumeUploadOffset(const Uptane::Target& target, const uint8_t* image, uint64_t image_size,
+                              MultiPartHasher* hasher);
   data::InstallationResult uploadFirmwareData(const uint8_t* data, size_t size);
+  data::InstallationResult startMulticast(uint32_t session, size_t block_size);
+  // the missing blocks are added to `missing`, -1 on errors
+  int64_t multicastStatus(uint32_t session, std::set<uint32_t>* missing);
+  data::InstallationResult endMulticast(uint32_t session, bool commit);
+
+  // Secondaries decode messages incrementally, so the chunks can be larger
+  // than their receive buffer
+  static constexpr size_t kUploadChunkSize{64 * 1024};
+  // proposed for streamed uploads (v3), Secondaries may ask for less
+  static constexpr size_t kStreamChunkSize{512 * 1024};
+  static constexpr size_t kStreamWindow{8};
+  // raw uploads (v3) are sent in pieces of at most this size, which also fit
+  // in the INTEGER length on 32-bit Secondaries
+  static constexpr uint64_t kRawUploadPieceSize{64 * 1024 * 1024};
+  // streamed and raw uploads (v3) are resumed this many times when the
+  // Secondary stops responding
+  static constexpr int kUploadAttempts{3};
+  static constexpr std::chrono::seconds kUploadRetryDelay{2};
+  // missing blocks of multicast uploads are sent again this many times, and
+  // then uploaded to the Secondaries that still miss some
+  static constexpr int kMulticastRepairRounds{5};
+  static constexpr long kMulticastMissingLimit{16 * 1024};  // NOLINT(google-runtime-int)
+  static constexpr std::chrono::milliseconds kMulticastSettleTime{100};
 
   std::shared_ptr<SecondaryProvider> secondary_provider_;
   const std::pair<std::string, uint16_t> addr_;
@@ -63,6 +132,43 @@ class IpUptaneSecondary : public SecondaryInterface {
   const HardwareIdentifier hw_id_;
   const PublicKey pub_key_;
   mutable uint32_t protocol_version{0};
+  mutable size_t upload_chunk_size_{kUploadChunkSize};
+  mutable size_t upload_window_{1};
+  mutable bool raw_upload_{false};
+  // streamed uploads are deflate compressed
+  mutable bool compressed_upload_{false};
+  // interrupted uploads are resumed
+  mutable bool resumable_upload_{false};
+  // missing Root versions are sent in one request
+  mutable bool root_chain_{false};
+  mutable bool multicast_upload_{false};
+  // only the metadata the Secondary doesn't hold is sent
+  mutable bool meta_versions_{false};
+  // raw uploads pass the image file over a Unix domain socket
+  mutable bool file_upload_{false};
+  // the Secondary answers metricsReq
+  mutable bool metrics_{false};
+  std::string multicast_group_;
+  uint16_t multicast_port_{0};
+  uint64_t multicast_rate_{0};
+  // the SHA256 of the image that was delivered through a multicast group
+  std::string multicast_delivered_;
+  // all the RPCs go through one connection, reopened when needed
+  std::unique_ptr<Asn1Connection> connection_;
+
+  // The same metadata is usually sent to all the IP Secondaries of an
+  // installation: the last encoded request is shared by all of them, per
+  // verification type, for as long as the metadata doesn't change.
+  struct EncodedMetadata {
+    Uptane::MetaBundle meta_bundle;
+    std::shared_ptr<const std::string> request;
+  };
+  static std::mutex encoded_metadata_mutex_;
+  static std::map<VerificationType, EncodedMetadata> encoded_metadata_;
+  // with metaVersions, the hashes of the metadata sent are compared with what
+  // each Secondary holds; they are computed once for all the Secondaries
+  static constexpr size_t kMetaHashesKept{8};
+  static std::deque<std::pair<Uptane::MetaBuffer, std::string>> meta_hashes_;
 };
 
 }  // namespace Uptane
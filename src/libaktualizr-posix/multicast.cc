@@ -0,0 +1,207 @@
+#include "multicast.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+#include "logging/logging.h"
+
+static constexpr uint8_t kMagic[4] = {'A', 'K', 'M', 'C'};
+
+static void putU32(uint8_t* buf, uint32_t value) {
+  buf[0] = static_cast<uint8_t>(value >> 24U);
+  buf[1] = static_cast<uint8_t>(value >> 16U);
+  buf[2] = static_cast<uint8_t>(value >> 8U);
+  buf[3] = static_cast<uint8_t>(value);
+}
+
+static uint32_t getU32(const uint8_t* buf) {
+  return (static_cast<uint32_t>(buf[0]) << 24U) | (static_cast<uint32_t>(buf[1]) << 16U) |
+         (static_cast<uint32_t>(buf[2]) << 8U) | static_cast<uint32_t>(buf[3]);
+}
+
+static in_addr parseAddress(const std::string& address) {
+  in_addr res{};
+  if (inet_pton(AF_INET, address.c_str(), &res) != 1) {
+    throw std::runtime_error("Invalid multicast group: " + address);
+  }
+  return res;
+}
+
+MulticastSender::MulticastSender(const std::string& group, in_port_t port, uint64_t rate)
+    : rate_{rate}, next_send_{std::chrono::steady_clock::now()} {
+  address_.sin_family = AF_INET;
+  address_.sin_port = htons(port);  // NOLINT(readability-isolate-declaration)
+  address_.sin_addr = parseAddress(group);
+
+  socket_fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (socket_fd_ < 0) {
+    throw std::system_error(errno, std::system_category(), "socket");
+  }
+  // the Secondaries are on the local network
+  const unsigned char ttl = 1;
+  setsockopt(socket_fd_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+}
+
+MulticastSender::~MulticastSender() { close(socket_fd_); }
+
+bool MulticastSender::sendBlock(uint32_t session, uint32_t index, const uint8_t* data, size_t size) {
+  if (rate_ > 0) {
+    std::this_thread::sleep_until(next_send_);
+    const auto now = std::chrono::steady_clock::now();
+    next_send_ = std::max(next_send_, now) + std::chrono::nanoseconds(size * 1000000000ULL / rate_);
+  }
+
+  datagram_.resize(Multicast::kHeaderSize + size);
+  std::memcpy(datagram_.data(), kMagic, sizeof(kMagic));
+  putU32(datagram_.data() + 4, session);
+  putU32(datagram_.data() + 8, index);
+  std::memcpy(datagram_.data() + Multicast::kHeaderSize, data, size);
+  const ssize_t sent = sendto(socket_fd_, datagram_.data(), datagram_.size(), 0,
+                              reinterpret_cast<const sockaddr*>(&address_), sizeof(address_));
+  if (sent != static_cast<ssize_t>(datagram_.size())) {
+    LOG_ERROR << "Could not send multicast block " << index << ": " << std::strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+MulticastReceiver::MulticastReceiver(const std::string& group, in_port_t port, uint32_t session, uint64_t size,
+                                     size_t block_size, boost::filesystem::path path)
+    : session_{session},
+      size_{size},
+      block_size_{block_size},
+      path_{std::move(path)},
+      received_(static_cast<size_t>(Multicast::blockCount(size, block_size)), false),
+      missing_count_{Multicast::blockCount(size, block_size)} {
+  if (block_size_ == 0 || block_size_ > Multicast::kMaxBlockSize) {
+    throw std::runtime_error("Invalid multicast block size: " + std::to_string(block_size_));
+  }
+  const in_addr group_address = parseAddress(group);
+
+  socket_fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (socket_fd_ < 0) {
+    throw std::system_error(errno, std::system_category(), "socket");
+  }
+  try {
+    const int reuse = 1;
+    setsockopt(socket_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // blocks arrive faster than they are written in bursts
+    const int buffer_size = 4 * 1024 * 1024;
+    setsockopt(socket_fd_, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);               // NOLINT(readability-isolate-declaration)
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);  // NOLINT(readability-isolate-declaration)
+    if (bind(socket_fd_, reinterpret_cast<const sockaddr*>(&sa), sizeof(sa)) != 0) {
+      throw std::system_error(errno, std::system_category(), "bind");
+    }
+    socklen_t sa_len = sizeof(sa);
+    if (getsockname(socket_fd_, reinterpret_cast<sockaddr*>(&sa), &sa_len) == 0) {
+      port_ = ntohs(sa.sin_port);  // NOLINT(readability-isolate-declaration)
+    }
+
+    if (IN_MULTICAST(ntohl(group_address.s_addr))) {  // NOLINT(readability-isolate-declaration)
+      ip_mreq membership{};
+      membership.imr_multiaddr = group_address;
+      membership.imr_interface.s_addr = htonl(INADDR_ANY);  // NOLINT(readability-isolate-declaration)
+      if (setsockopt(socket_fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+        throw std::system_error(errno, std::system_category(), "joining " + group);
+      }
+    }
+
+    file_fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (file_fd_ < 0) {
+      throw std::system_error(errno, std::system_category(), path_.string());
+    }
+  } catch (...) {
+    close(socket_fd_);
+    throw;
+  }
+
+  thread_ = std::thread(&MulticastReceiver::run, this);
+}
+
+MulticastReceiver::~MulticastReceiver() {
+  stop();
+  close(file_fd_);
+  close(socket_fd_);
+}
+
+uint64_t MulticastReceiver::missingCount() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return missing_count_;
+}
+
+std::vector<uint32_t> MulticastReceiver::missing(size_t limit) const {
+  std::vector<uint32_t> res;
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (size_t i = 0; i < received_.size() && res.size() < limit; ++i) {
+    if (!received_[i]) {
+      res.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  return res;
+}
+
+void MulticastReceiver::stop() {
+  keep_running_ = false;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void MulticastReceiver::run() {
+  std::vector<uint8_t> buffer(Multicast::kHeaderSize + block_size_);
+  pollfd fds{socket_fd_, POLLIN, 0};
+  while (keep_running_) {
+    if (poll(&fds, 1, kStopCheckIntervalMs) <= 0) {
+      continue;
+    }
+    // MSG_TRUNC gives the real size of datagrams that don't fit
+    const ssize_t received = recv(socket_fd_, buffer.data(), buffer.size(), MSG_TRUNC);
+    if (received > 0 && static_cast<size_t>(received) <= buffer.size()) {
+      receiveBlock(buffer.data(), static_cast<size_t>(received));
+    }
+  }
+}
+
+void MulticastReceiver::receiveBlock(const uint8_t* datagram, size_t size) {
+  if (size < Multicast::kHeaderSize || std::memcmp(datagram, kMagic, sizeof(kMagic)) != 0 ||
+      getU32(datagram + 4) != session_) {
+    return;
+  }
+  const uint32_t index = getU32(datagram + 8);
+  if (index >= received_.size()) {
+    return;
+  }
+  const uint64_t offset = static_cast<uint64_t>(index) * block_size_;
+  const uint64_t expected = std::min<uint64_t>(block_size_, size_ - offset);
+  if (size - Multicast::kHeaderSize != expected) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (received_[index]) {
+      return;
+    }
+  }
+
+  // only this thread writes and marks blocks
+  const ssize_t written =
+      pwrite(file_fd_, datagram + Multicast::kHeaderSize, static_cast<size_t>(expected), static_cast<off_t>(offset));
+  if (written != static_cast<ssize_t>(expected)) {
+    LOG_ERROR << "Could not write multicast block " << index << " to " << path_ << ": " << std::strerror(errno);
+    return;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  received_[index] = true;
+  --missing_count_;
+}
@@ -0,0 +1,102 @@
+#ifndef MULTICAST_H_
+#define MULTICAST_H_
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/**
+ * Datagrams of multicast uploads: "AKMC", the session and the number of the
+ * block as 32-bit big endian integers, and the data of the block. See the
+ * multicast messages of the IP Secondary protocol.
+ */
+namespace Multicast {
+
+constexpr size_t kHeaderSize{12};
+// fits in one Ethernet frame with the IP and UDP headers
+constexpr size_t kBlockSize{1400};
+// largest block a datagram can hold
+constexpr size_t kMaxBlockSize{65507 - kHeaderSize};
+
+inline uint64_t blockCount(uint64_t size, size_t block_size) { return (size + block_size - 1) / block_size; }
+
+}  // namespace Multicast
+
+/**
+ * Sends blocks of an image to a multicast group, at most `rate` bytes per
+ * second, so that the Secondaries and the network keep up.
+ */
+class MulticastSender {
+ public:
+  MulticastSender(const std::string& group, in_port_t port, uint64_t rate);
+  ~MulticastSender();
+  MulticastSender(const MulticastSender&) = delete;
+  MulticastSender(MulticastSender&&) = delete;
+  MulticastSender& operator=(const MulticastSender&) = delete;
+  MulticastSender& operator=(MulticastSender&&) = delete;
+
+  // false if the datagram could not be sent
+  bool sendBlock(uint32_t session, uint32_t index, const uint8_t* data, size_t size);
+
+ private:
+  int socket_fd_{-1};
+  sockaddr_in address_{};
+  const uint64_t rate_;
+  std::chrono::steady_clock::time_point next_send_;
+  std::vector<uint8_t> datagram_;
+};
+
+/**
+ * Receives the blocks of an image sent to a multicast group into a file, in
+ * the background, until it is stopped. Groups that are no multicast address
+ * are not joined, so that the blocks can also be sent straight to the
+ * Secondary.
+ */
+class MulticastReceiver {
+ public:
+  MulticastReceiver(const std::string& group, in_port_t port, uint32_t session, uint64_t size, size_t block_size,
+                    boost::filesystem::path path);
+  ~MulticastReceiver();
+  MulticastReceiver(const MulticastReceiver&) = delete;
+  MulticastReceiver(MulticastReceiver&&) = delete;
+  MulticastReceiver& operator=(const MulticastReceiver&) = delete;
+  MulticastReceiver& operator=(MulticastReceiver&&) = delete;
+
+  uint32_t session() const { return session_; }
+  in_port_t port() const { return port_; }
+  const boost::filesystem::path& path() const { return path_; }
+  uint64_t missingCount() const;
+  // the first `limit` blocks that are still missing
+  std::vector<uint32_t> missing(size_t limit) const;
+  // leave the group, the blocks received so far stay in the file
+  void stop();
+
+ private:
+  void run();
+  void receiveBlock(const uint8_t* datagram, size_t size);
+
+  static constexpr int kStopCheckIntervalMs{100};
+
+  const uint32_t session_;
+  const uint64_t size_;
+  const size_t block_size_;
+  const boost::filesystem::path path_;
+  int socket_fd_{-1};
+  int file_fd_{-1};
+  in_port_t port_{0};
+
+  mutable std::mutex mutex_;
+  std::vector<bool> received_;
+  uint64_t missing_count_;
+  std::atomic<bool> keep_running_{true};
+  std::thread thread_;
+};
+
+#endif  // MULTICAST_H_
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "multicast.h"
+#include "utilities/utils.h"
+
+static std::string testData(size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    data[i] = static_cast<char>((i * 7 + i / 1000) % 251);
+  }
+  return data;
+}
+
+static const uint8_t* bytes(const std::string& data) { return reinterpret_cast<const uint8_t*>(data.data()); }
+
+// Blocks are received in the background: wait until `count` are missing.
+static bool waitForMissing(const MulticastReceiver& receiver, uint64_t count) {
+  for (int i = 0; i < 200 && receiver.missingCount() != count; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return receiver.missingCount() == count;
+}
+
+/* Lost blocks are reported, and the image is complete once they are sent
+ * again. The blocks are sent straight to the receiver, as a group that is no
+ * multicast address is not joined. */
+TEST(Multicast, Repair) {
+  TemporaryDirectory temp_dir;
+  const std::string data = testData(10 * 1000 + 123);
+  const size_t block_size = 1000;
+  MulticastReceiver receiver("127.0.0.1", 0, 7, data.size(), block_size, temp_dir.Path() / "image");
+  MulticastSender sender("127.0.0.1", receiver.port(), 0);
+  EXPECT_EQ(receiver.missingCount(), 11);
+
+  for (uint32_t i = 0; i < 11; ++i) {
+    if (i != 3 && i != 10) {
+      const size_t offset = i * block_size;
+      EXPECT_TRUE(sender.sendBlock(7, i, bytes(data) + offset, std::min(block_size, data.size() - offset)));
+    }
+  }
+  // other sessions and blocks of the wrong size are ignored
+  EXPECT_TRUE(sender.sendBlock(8, 3, bytes(data) + 3000, block_size));
+  EXPECT_TRUE(sender.sendBlock(7, 10, bytes(data) + 10000, block_size));
+  ASSERT_TRUE(waitForMissing(receiver, 2));
+  EXPECT_EQ(receiver.missing(10), (std::vector<uint32_t>{3, 10}));
+  EXPECT_EQ(receiver.missing(1), (std::vector<uint32_t>{3}));
+
+  EXPECT_TRUE(sender.sendBlock(7, 3, bytes(data) + 3000, block_size));
+  EXPECT_TRUE(sender.sendBlock(7, 10, bytes(data) + 10000, data.size() - 10000));
+  ASSERT_TRUE(waitForMissing(receiver, 0));
+  receiver.stop();
+  EXPECT_EQ(Utils::readFile(receiver.path()), data);
+}
+
+/* Blocks are sent at the given rate. */
+TEST(Multicast, Rate) {
+  TemporaryDirectory temp_dir;
+  const std::string data = testData(1000);
+  MulticastReceiver receiver("127.0.0.1", 0, 1, 20 * data.size(), data.size(), temp_dir.Path() / "image");
+  MulticastSender sender("127.0.0.1", receiver.port(), 100 * 1000);
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < 20; ++i) {
+    EXPECT_TRUE(sender.sendBlock(1, i, bytes(data), data.size()));
+  }
+  // 20 kB at 100 kB/s, the first block goes at once
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(180));
+  EXPECT_TRUE(waitForMissing(receiver, 0));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -7,6 +7,10 @@
 
 #include <boost/filesystem/operations.hpp>
 
+#ifdef BUILD_LIBUBOOTENV
+#include <libuboot.h>
+#endif
+
 #include "storage/invstorage.h"
 #include "utilities/exceptions.h"
 #include "utilities/utils.h"
@@ -25,21 +29,17 @@ Bootloader::Bootloader(BootloaderConfig config, INvStorage& storage) : config_(s
 }
 
 void Bootloader::setBootOK() const {
-  std::string sink;
   switch (config_.rollback_mode) {
     case RollbackMode::kBootloaderNone:
       break;
     case RollbackMode::kUbootGeneric:
-      if (Utils::shell("fw_setenv bootcount 0", &sink) != 0) {
+      if (!setUbootEnv({{"bootcount", "0"}})) {
         LOG_WARNING << "Failed resetting bootcount";
       }
       break;
     case RollbackMode::kUbootMasked:
-      if (Utils::shell("fw_setenv bootcount 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting bootcount";
-      }
-      if (Utils::shell("fw_setenv upgrade_available 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting upgrade_available for u-boot";
+      if (!setUbootEnv({{"bootcount", "0"}, {"upgrade_available", "0"}})) {
+        LOG_WARNING << "Failed resetting bootcount and upgrade_available for u-boot";
       }
       break;
     default:
@@ -48,27 +48,17 @@ void Bootloader::setBootOK() const {
 }
 
 void Bootloader::updateNotify() const {
-  std::string sink;
   switch (config_.rollback_mode) {
     case RollbackMode::kBootloaderNone:
       break;
     case RollbackMode::kUbootGeneric:
-      if (Utils::shell("fw_setenv bootcount 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting bootcount";
-      }
-      if (Utils::shell("fw_setenv rollback 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting rollback flag";
+      if (!setUbootEnv({{"bootcount", "0"}, {"rollback", "0"}})) {
+        LOG_WARNING << "Failed resetting bootcount and rollback flag";
       }
       break;
     case RollbackMode::kUbootMasked:
-      if (Utils::shell("fw_setenv bootcount 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting bootcount";
-      }
-      if (Utils::shell("fw_setenv upgrade_available 1", &sink) != 0) {
-        LOG_WARNING << "Failed setting upgrade_available for u-boot";
-      }
-      if (Utils::shell("fw_setenv rollback 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting rollback flag";
+      if (!setUbootEnv({{"bootcount", "0"}, {"upgrade_available", "1"}, {"rollback", "0"}})) {
+        LOG_WARNING << "Failed resetting bootcount and rollback flag, and setting upgrade_available for u-boot";
       }
       break;
     default:
@@ -76,6 +66,53 @@ void Bootloader::updateNotify() const {
   }
 }
 
+#ifdef BUILD_LIBUBOOTENV
+// same as fw_setenv
+static constexpr const char* kUbootEnvConfig = "/etc/fw_env.config";
+
+bool Bootloader::setUbootEnv(const UbootEnv& vars) {
+  uboot_ctx* ctx = nullptr;
+  if (libuboot_initialize(&ctx, nullptr) < 0) {
+    LOG_ERROR << "Could not initialize libubootenv";
+    return false;
+  }
+  bool ok = false;
+  if (libuboot_read_config(ctx, kUbootEnvConfig) < 0) {
+    LOG_ERROR << "Could not read " << kUbootEnvConfig;
+  } else if (libuboot_open(ctx) < 0) {
+    LOG_ERROR << "Could not read the U-Boot environment";
+  } else {
+    ok = true;
+    for (const auto& var : vars) {
+      if (libuboot_set_env(ctx, var.first.c_str(), var.second.c_str()) < 0) {
+        LOG_ERROR << "Could not set " << var.first << " in the U-Boot environment";
+        ok = false;
+      }
+    }
+    // all the changes go out in one write, which switches to the redundant copy if there is one
+    if (ok && libuboot_env_store(ctx) < 0) {
+      LOG_ERROR << "Could not write the U-Boot environment";
+      ok = false;
+    }
+    libuboot_close(ctx);
+  }
+  libuboot_exit(ctx);
+  return ok;
+}
+#else
+bool Bootloader::setUbootEnv(const UbootEnv& vars) {
+  // one fw_setenv run for all the variables, rather than one per variable
+  std::string script;
+  for (const auto& var : vars) {
+    script += var.first + " " + var.second + "\n";
+  }
+  TemporaryFile script_file("fw_setenv");
+  script_file.PutContents(script);
+  std::string sink;
+  return Utils::shell("fw_setenv -s " + script_file.PathString(), &sink) == 0;
+}
+#endif
+
 bool Bootloader::supportRebootDetection() const { return reboot_detect_supported_; }
 
 bool Bootloader::rebootDetected() const {
@@ -1,6 +1,10 @@
 #ifndef BOOTLOADER_H_
 #define BOOTLOADER_H_
 
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "libaktualizr/config.h"
 
 class INvStorage;
@@ -35,6 +39,11 @@ class Bootloader {
   const BootloaderConfig config_;
 
  private:
+  using UbootEnv = std::vector<std::pair<std::string, std::string>>;
+  // Set the variables of the U-Boot environment in a single write of the
+  // environment, returns false on failure
+  static bool setUbootEnv(const UbootEnv& vars);
+
   // TODO Fix this
   // NOLINTNEXTLINE(cppcoreguidelines-avoid-const-or-ref-data-members)
   INvStorage& storage_;
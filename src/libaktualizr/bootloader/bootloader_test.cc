@@ -2,6 +2,9 @@
 
 #include "bootloader.h"
 
+#include <algorithm>
+#include <cstdlib>
+
 #include <boost/filesystem.hpp>
 
 #include "storage/invstorage.h"
@@ -39,6 +42,35 @@ TEST(bootloader, detectReboot) {
   ASSERT_FALSE(bootloader.rebootDetected());
 }
 
+#ifndef BUILD_LIBUBOOTENV
+/* All the variables are set with a single fw_setenv run. */
+TEST(bootloader, updateNotifyUbootMasked) {
+  TemporaryDirectory temp_dir;
+  // a fw_setenv that logs its arguments and script
+  const auto fw_setenv = temp_dir / "fw_setenv";
+  Utils::writeFile(fw_setenv, "#!/bin/sh\necho \"$@\" >> " + (temp_dir / "calls").string() + "\ncat \"$2\" > " +
+                                  (temp_dir / "script").string() + "\n");
+  boost::filesystem::permissions(fw_setenv, boost::filesystem::owner_all);
+  const std::string path = getenv("PATH");
+  setenv("PATH", (temp_dir.PathString() + ":" + path).c_str(), 1);
+
+  StorageConfig storage_config;
+  storage_config.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(storage_config);
+  BootloaderConfig boot_config;
+  boot_config.reboot_sentinel_dir = temp_dir.Path();
+  boot_config.rollback_mode = RollbackMode::kUbootMasked;
+  Bootloader bootloader(boot_config, *storage);
+  bootloader.updateNotify();
+  setenv("PATH", path.c_str(), 1);
+
+  const std::string calls = Utils::readFile(temp_dir / "calls");
+  EXPECT_EQ(std::count(calls.begin(), calls.end(), '\n'), 1);
+  EXPECT_EQ(calls.rfind("-s ", 0), 0);
+  EXPECT_EQ(Utils::readFile(temp_dir / "script"), "bootcount 0\nupgrade_available 1\nrollback 0\n");
+}
+#endif
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -109,16 +109,39 @@ void Campaign::JsonFromCampaigns(const std::vector<Campaign> &in, Json::Value &o
 }
 
 std::vector<Campaign> Campaign::fetchAvailableCampaigns(HttpInterface &http_client, const std::string &tls_server) {
-  HttpResponse response = http_client.get(tls_server + "/campaigner/campaigns", kMaxCampaignsMetaSize);
-  if (!response.isOk()) {
+  HttpCacheValidators validators;
+  std::vector<Campaign> campaigns;
+  fetchAvailableCampaignsIfModified(http_client, tls_server, &validators, &campaigns);
+  return campaigns;
+}
+
+bool Campaign::fetchAvailableCampaignsIfModified(HttpInterface &http_client, const std::string &tls_server,
+                                                 HttpCacheValidators *validators, std::vector<Campaign> *campaigns) {
+  std::string body;
+  const HttpBodySink sink = [&body](const char *data, size_t size) {
+    body.append(data, size);
+    return true;
+  };
+  HttpResponse response = http_client.getStreamIfModified(tls_server + "/campaigner/campaigns",
+                                                          kMaxCampaignsMetaSize, nullptr, *validators, sink);
+  // there is nothing to compare to without validators
+  if (response.isNotModified() && !validators->empty()) {
+    LOG_DEBUG << "Campaigns not modified";
+    return false;
+  }
+  if (!response.isOk() || response.isNotModified()) {
     LOG_ERROR << "Failed to fetch list of available campaigns";
-    return {};
+    *validators = HttpCacheValidators();
+    campaigns->clear();
+    return true;
   }
 
-  auto json = response.getJson();
+  auto json = Utils::parseJSON(body);
 
   LOG_TRACE << "Campaign: " << json;
 
-  return campaignsFromJson(json);
+  *campaigns = campaignsFromJson(json);
+  *validators = std::move(response.validators);
+  return true;
 }
 }  // namespace campaign
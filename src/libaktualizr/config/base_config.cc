@@ -1,5 +1,9 @@
 #include "libaktualizr/config.h"
 
+#include <sys/stat.h>
+#include <cstdlib>
+#include <fstream>
+
 #include <boost/filesystem.hpp>
 
 #include "logging/logging.h"
@@ -24,6 +28,169 @@ void BaseConfig::updateFromToml(const boost::filesystem::path& filename) {
   updateFromPropertyTree(pt);
 }
 
+namespace {
+
+/*
+ * Binary snapshot of the merged config files, so that the tools which start
+ * often do not have to parse them all again. It starts with the path, size and
+ * modification time of every file it was built from and is only used if all of
+ * them still match.
+ */
+const char kConfigCacheMagic[] = "aktualizr-config-cache-1";
+
+struct ConfigFileStamp {
+  std::string path;
+  uint64_t size{0};
+  int64_t mtime_ns{0};
+
+  bool operator==(const ConfigFileStamp& other) const {
+    return path == other.path && size == other.size && mtime_ns == other.mtime_ns;
+  }
+};
+
+bool stampFile(const boost::filesystem::path& file, ConfigFileStamp* stamp) {
+  struct stat st {};
+  if (stat(file.c_str(), &st) != 0) {
+    return false;
+  }
+  stamp->path = file.string();
+  stamp->size = static_cast<uint64_t>(st.st_size);
+  stamp->mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+void writeInt(std::ostream& out, uint64_t value) { out.write(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+bool readInt(std::istream& in, uint64_t* value) {
+  in.read(reinterpret_cast<char*>(value), sizeof(*value));
+  return in.good();
+}
+
+void writeString(std::ostream& out, const std::string& value) {
+  writeInt(out, value.size());
+  out.write(value.data(), static_cast<std::streamsize>(value.size()));
+}
+
+bool readString(std::istream& in, std::string* value) {
+  uint64_t size;
+  // a damaged file should not make us allocate gigabytes
+  if (!readInt(in, &size) || size > (1U << 20U)) {
+    return false;
+  }
+  value->resize(size);
+  in.read(&(*value)[0], static_cast<std::streamsize>(size));
+  return in.good();
+}
+
+void writeTree(std::ostream& out, const boost::property_tree::ptree& pt) {
+  writeString(out, pt.data());
+  writeInt(out, pt.size());
+  for (const auto& child : pt) {
+    writeString(out, child.first);
+    writeTree(out, child.second);
+  }
+}
+
+bool readTree(std::istream& in, boost::property_tree::ptree* pt, int depth = 0) {
+  uint64_t children;
+  if (depth > 8 || !readString(in, &pt->data()) || !readInt(in, &children)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < children; ++i) {
+    std::string key;
+    boost::property_tree::ptree child;
+    if (!readString(in, &key) || !readTree(in, &child, depth + 1)) {
+      return false;
+    }
+    pt->push_back(std::make_pair(key, std::move(child)));
+  }
+  return true;
+}
+
+// Same result as reading the files one after another: a later file overrides
+// the options it sets and leaves the others alone.
+void mergeTree(boost::property_tree::ptree& dest, const boost::property_tree::ptree& src) {
+  for (const auto& child : src) {
+    auto existing = dest.find(child.first);
+    if (existing == dest.not_found()) {
+      dest.push_back(child);
+    } else {
+      auto& dest_child = dest.to_iterator(existing)->second;
+      if (child.second.empty()) {
+        dest_child.data() = child.second.data();
+      } else {
+        mergeTree(dest_child, child.second);
+      }
+    }
+  }
+}
+
+bool readConfigCache(const boost::filesystem::path& cache_path, const std::vector<ConfigFileStamp>& stamps,
+                     boost::property_tree::ptree* pt) {
+  struct stat st {};
+  if (stat(cache_path.c_str(), &st) != 0) {
+    return false;
+  }
+  if ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+    LOG_WARNING << "Ignoring config cache " << cache_path << " with unsafe permissions";
+    return false;
+  }
+  std::ifstream in(cache_path.string(), std::ios::binary);
+  std::string magic;
+  uint64_t files;
+  if (!readString(in, &magic) || magic != kConfigCacheMagic || !readInt(in, &files) || files != stamps.size()) {
+    return false;
+  }
+  for (const auto& stamp : stamps) {
+    ConfigFileStamp cached;
+    uint64_t mtime_ns;
+    if (!readString(in, &cached.path) || !readInt(in, &cached.size) || !readInt(in, &mtime_ns)) {
+      return false;
+    }
+    cached.mtime_ns = static_cast<int64_t>(mtime_ns);
+    if (!(cached == stamp)) {
+      return false;
+    }
+  }
+  return readTree(in, pt);
+}
+
+void writeConfigCache(const boost::filesystem::path& cache_path, const std::vector<ConfigFileStamp>& stamps,
+                      const boost::property_tree::ptree& pt) {
+  const boost::filesystem::path tmp_path = cache_path.string() + ".new";
+  {
+    std::ofstream out(tmp_path.string(), std::ios::binary | std::ios::trunc);
+    writeString(out, kConfigCacheMagic);
+    writeInt(out, stamps.size());
+    for (const auto& stamp : stamps) {
+      writeString(out, stamp.path);
+      writeInt(out, stamp.size);
+      writeInt(out, static_cast<uint64_t>(stamp.mtime_ns));
+    }
+    writeTree(out, pt);
+    out.close();
+    if (!out.good()) {
+      LOG_WARNING << "Could not write config cache " << cache_path;
+      boost::system::error_code ec;
+      boost::filesystem::remove(tmp_path, ec);
+      return;
+    }
+  }
+  boost::system::error_code ec;
+  using boost::filesystem::perms;
+  boost::filesystem::permissions(
+      tmp_path, perms::owner_read | perms::owner_write | perms::group_read | perms::others_read, ec);
+  if (!ec) {
+    boost::filesystem::rename(tmp_path, cache_path, ec);
+  }
+  if (ec) {
+    LOG_WARNING << "Could not write config cache " << cache_path << ": " << ec.message();
+    boost::filesystem::remove(tmp_path, ec);
+  }
+}
+
+}  // namespace
+
 void BaseConfig::updateFromDirs(const std::vector<boost::filesystem::path>& configs) {
   std::map<std::string, boost::filesystem::path> configs_map;
   for (const auto& config : configs) {
@@ -38,9 +205,39 @@ void BaseConfig::updateFromDirs(const std::vector<boost::filesystem::path>& conf
       configs_map[config.filename().string()] = config;
     }
   }
+
+  const char* cache_env = getenv("AKTUALIZR_CONFIG_CACHE");
+  if (cache_env == nullptr || *cache_env == '\0') {
+    for (const auto& config_file : configs_map) {
+      updateFromToml(config_file.second);
+    }
+    return;
+  }
+
+  const boost::filesystem::path cache_path(cache_env);
+  std::vector<ConfigFileStamp> stamps;
   for (const auto& config_file : configs_map) {
-    updateFromToml(config_file.second);
+    ConfigFileStamp stamp;
+    if (!stampFile(config_file.second, &stamp)) {
+      throw std::runtime_error("Config file " + config_file.second.string() + " does not exist.");
+    }
+    stamps.push_back(stamp);
   }
+
+  boost::property_tree::ptree pt;
+  if (readConfigCache(cache_path, stamps, &pt)) {
+    LOG_DEBUG << "Using cached config " << cache_path;
+  } else {
+    pt.clear();
+    for (const auto& config_file : configs_map) {
+      LOG_INFO << "Reading config: " << config_file.second;
+      boost::property_tree::ptree file_pt;
+      boost::property_tree::ini_parser::read_ini(config_file.second.string(), file_pt);
+      mergeTree(pt, file_pt);
+    }
+    writeConfigCache(cache_path, stamps, pt);
+  }
+  updateFromPropertyTree(pt);
 }
 
 void P11Config::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
@@ -60,3 +257,45 @@ void P11Config::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, tls_pkey_id, "tls_pkey_id");
   writeOption(out_stream, tls_clientcert_id, "tls_clientcert_id");
 }
+
+void CryptoConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
+  CopyFromConfig(provider, "provider", pt);
+}
+
+void CryptoConfig::writeToStream(std::ostream& out_stream) const { writeOption(out_stream, provider, "provider"); }
+
+void MetricsConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
+  CopyFromConfig(path, "path", pt);
+  CopyFromConfig(interval, "interval", pt);
+  CopyFromConfig(trace_path, "trace_path", pt);
+  CopyFromConfig(trace_sample, "trace_sample", pt);
+  CopyFromConfig(http_recording_path, "http_recording_path", pt);
+}
+
+void MetricsConfig::writeToStream(std::ostream& out_stream) const {
+  writeOption(out_stream, path, "path");
+  writeOption(out_stream, interval, "interval");
+  writeOption(out_stream, trace_path, "trace_path");
+  writeOption(out_stream, trace_sample, "trace_sample");
+  writeOption(out_stream, http_recording_path, "http_recording_path");
+}
+
+void MemoryConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
+  CopyFromConfig(budget, "budget", pt);
+}
+
+void MemoryConfig::writeToStream(std::ostream& out_stream) const { writeOption(out_stream, budget, "budget"); }
+
+void SchedulingConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
+  CopyFromConfig(download, "download", pt);
+  CopyFromConfig(hasher, "hasher", pt);
+  CopyFromConfig(commands, "commands", pt);
+  CopyFromConfig(secondaries, "secondaries", pt);
+}
+
+void SchedulingConfig::writeToStream(std::ostream& out_stream) const {
+  writeOption(out_stream, download, "download");
+  writeOption(out_stream, hasher, "hasher");
+  writeOption(out_stream, commands, "commands");
+  writeOption(out_stream, secondaries, "secondaries");
+}
@@ -87,24 +87,66 @@ void ProvisionConfig::writeToStream(std::ostream& out_stream) const {
 
 void UptaneConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopyFromConfig(polling_sec, "polling_sec", pt);
+  CopyFromConfig(polling_max_sec, "polling_max_sec", pt);
+  CopyFromConfig(polling_campaign_sec, "polling_campaign_sec", pt);
+  CopyFromConfig(polling_jitter_percent, "polling_jitter_percent", pt);
   CopyFromConfig(director_server, "director_server", pt);
   CopyFromConfig(repo_server, "repo_server", pt);
+  CopyFromConfig(repo_mirrors, "repo_mirrors", pt);
   CopyFromConfig(key_source, "key_source", pt);
   CopyFromConfig(key_type, "key_type", pt);
   CopyFromConfig(force_install_completion, "force_install_completion", pt);
   CopyFromConfig(secondary_config_file, "secondary_config_file", pt);
   CopyFromConfig(secondary_preinstall_wait_sec, "secondary_preinstall_wait_sec", pt);
+  CopyFromConfig(secondary_manifest_timeout_sec, "secondary_manifest_timeout_sec", pt);
+  CopyFromConfig(max_parallel_downloads, "max_parallel_downloads", pt);
+  CopyFromConfig(max_parallel_delegation_fetches, "max_parallel_delegation_fetches", pt);
+  CopyFromConfig(max_parallel_secondaries, "max_parallel_secondaries", pt);
+  CopyFromConfig(secondary_install_priority, "secondary_install_priority", pt);
+  CopyFromConfig(target_order, "target_order", pt);
+  CopyFromConfig(pipeline_installs, "pipeline_installs", pt);
+  CopyFromConfig(download_rate_limit, "download_rate_limit", pt);
+  CopyFromConfig(download_rate_limit_schedule, "download_rate_limit_schedule", pt);
+  CopyFromConfig(download_rate_limit_metered, "download_rate_limit_metered", pt);
+  CopyFromConfig(metered_interfaces, "metered_interfaces", pt);
+  CopyFromConfig(skip_unchanged_manifest, "skip_unchanged_manifest", pt);
+  CopyFromConfig(partial_manifests, "partial_manifests", pt);
+  CopyFromConfig(deferred_initialization, "deferred_initialization", pt);
+  CopyFromConfig(speculative_image_meta, "speculative_image_meta", pt);
+  CopyFromConfig(notification_url, "notification_url", pt);
+  CopyFromConfig(notification_timeout_sec, "notification_timeout_sec", pt);
 }
 
 void UptaneConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, polling_sec, "polling_sec");
+  writeOption(out_stream, polling_max_sec, "polling_max_sec");
+  writeOption(out_stream, polling_campaign_sec, "polling_campaign_sec");
+  writeOption(out_stream, polling_jitter_percent, "polling_jitter_percent");
   writeOption(out_stream, director_server, "director_server");
   writeOption(out_stream, repo_server, "repo_server");
+  writeOption(out_stream, repo_mirrors, "repo_mirrors");
   writeOption(out_stream, key_source, "key_source");
   writeOption(out_stream, key_type, "key_type");
   writeOption(out_stream, force_install_completion, "force_install_completion");
   writeOption(out_stream, secondary_config_file, "secondary_config_file");
   writeOption(out_stream, secondary_preinstall_wait_sec, "secondary_preinstall_wait_sec");
+  writeOption(out_stream, secondary_manifest_timeout_sec, "secondary_manifest_timeout_sec");
+  writeOption(out_stream, max_parallel_downloads, "max_parallel_downloads");
+  writeOption(out_stream, max_parallel_delegation_fetches, "max_parallel_delegation_fetches");
+  writeOption(out_stream, max_parallel_secondaries, "max_parallel_secondaries");
+  writeOption(out_stream, secondary_install_priority, "secondary_install_priority");
+  writeOption(out_stream, target_order, "target_order");
+  writeOption(out_stream, pipeline_installs, "pipeline_installs");
+  writeOption(out_stream, download_rate_limit, "download_rate_limit");
+  writeOption(out_stream, download_rate_limit_schedule, "download_rate_limit_schedule");
+  writeOption(out_stream, download_rate_limit_metered, "download_rate_limit_metered");
+  writeOption(out_stream, metered_interfaces, "metered_interfaces");
+  writeOption(out_stream, skip_unchanged_manifest, "skip_unchanged_manifest");
+  writeOption(out_stream, partial_manifests, "partial_manifests");
+  writeOption(out_stream, deferred_initialization, "deferred_initialization");
+  writeOption(out_stream, speculative_image_meta, "speculative_image_meta");
+  writeOption(out_stream, notification_url, "notification_url");
+  writeOption(out_stream, notification_timeout_sec, "notification_timeout_sec");
 }
 
 /**
@@ -224,6 +266,10 @@ void Config::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
     logger_set_threshold(logger);
   }
   CopySubtreeFromConfig(p11, "p11", pt);
+  CopySubtreeFromConfig(crypto, "crypto", pt);
+  CopySubtreeFromConfig(metrics, "metrics", pt);
+  CopySubtreeFromConfig(memory, "memory", pt);
+  CopySubtreeFromConfig(scheduling, "scheduling", pt);
   CopySubtreeFromConfig(tls, "tls", pt);
   CopySubtreeFromConfig(provision, "provision", pt);
   CopySubtreeFromConfig(uptane, "uptane", pt);
@@ -264,6 +310,10 @@ void Config::writeToStream(std::ostream& sink) const {
   // Config::updateFromPropertyTree().
   WriteSectionToStream(logger, "logger", sink);
   WriteSectionToStream(p11, "p11", sink);
+  WriteSectionToStream(crypto, "crypto", sink);
+  WriteSectionToStream(metrics, "metrics", sink);
+  WriteSectionToStream(memory, "memory", sink);
+  WriteSectionToStream(scheduling, "scheduling", sink);
   WriteSectionToStream(tls, "tls", sink);
   WriteSectionToStream(provision, "provision", sink);
   WriteSectionToStream(uptane, "uptane", sink);
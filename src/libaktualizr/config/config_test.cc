@@ -224,6 +224,44 @@ TEST(config, TwoDirs) {
   EXPECT_EQ(config.provision.provision_path.string(), "y_prov_path");
 }
 
+/* Cache the merged config files and rebuild the cache when one of them changes. */
+TEST(config, Cache) {
+  TemporaryDirectory temp_dir;
+  std::vector<boost::filesystem::path> dirs = generate_multi_config(temp_dir);
+  const boost::filesystem::path cache_path = temp_dir / "config.cache";
+  setenv("AKTUALIZR_CONFIG_CACHE", cache_path.c_str(), 1);
+
+  {
+    Config config(dirs);
+    EXPECT_EQ(config.storage.path.string(), "path_z");
+    EXPECT_EQ(config.pacman.sysroot.string(), "sysroot_z");
+    EXPECT_EQ(config.provision.provision_path.string(), "y_prov_path");
+  }
+  ASSERT_TRUE(boost::filesystem::exists(cache_path));
+
+  // a new file is picked up, and the cache rebuilt with it is used next time
+  Utils::writeFile(temp_dir / "b_dir/z.toml", std::string("[pacman]\nos = \"os_b\"\n"));
+  {
+    Config config(dirs);
+    EXPECT_EQ(config.storage.path.string(), "path_z");
+    EXPECT_EQ(config.pacman.sysroot.string(), "sysroot_z");
+    EXPECT_EQ(config.pacman.os, "os_b");
+  }
+  {
+    Config config(dirs);
+    EXPECT_EQ(config.pacman.os, "os_b");
+  }
+
+  // a damaged cache is read again from the files
+  Utils::writeFile(cache_path, std::string("garbage"));
+  {
+    Config config(dirs);
+    EXPECT_EQ(config.storage.path.string(), "path_z");
+    EXPECT_EQ(config.pacman.os, "os_b");
+  }
+  unsetenv("AKTUALIZR_CONFIG_CACHE");
+}
+
 void checkConfigExpectations(const Config &conf) {
   EXPECT_EQ(conf.storage.type, StorageType::kSqlite);
   EXPECT_EQ(conf.pacman.type, PACKAGE_MANAGER_NONE);
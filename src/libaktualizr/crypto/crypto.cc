@@ -1,6 +1,10 @@
 #include "crypto.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cctype>
+#include <cstring>
 #include <iostream>
 #include <random>
 #include <string>
@@ -13,15 +17,69 @@
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/scoped_array.hpp>
 
+#include "cryptoprovider.h"
 #include "libaktualizr/types.h"
 #include "logging/logging.h"
 #include "openssl_compat.h"
+#include "signaturecache.h"
 #include "utilities/utils.h"
 
 #if !AKTUALIZR_OPENSSL_PRE_3
 #include <openssl/provider.h>
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+struct PublicKey::Parsed {
+  std::string key_id;
+  // RSA keys
+  StructGuard<RSA> rsa{nullptr, RSA_free};
+  // ED25519 keys, raw
+  std::string ed25519;
+};
+
+PublicKey::PublicKey(const PublicKey &other)
+    : value_(other.value_), type_(other.type_), parsed_(std::atomic_load(&other.parsed_)) {}
+
+PublicKey &PublicKey::operator=(const PublicKey &other) {
+  if (this != &other) {
+    value_ = other.value_;
+    type_ = other.type_;
+    std::atomic_store(&parsed_, std::atomic_load(&other.parsed_));
+  }
+  return *this;
+}
+
+std::shared_ptr<const PublicKey::Parsed> PublicKey::parsed() const {
+  std::shared_ptr<const Parsed> parsed = std::atomic_load(&parsed_);
+  if (parsed != nullptr) {
+    return parsed;
+  }
+  // Two threads may both parse the key, the result is the same
+  auto fresh = std::make_shared<Parsed>();
+  std::string key_content = value_;
+  // NOLINTNEXTLINE(clang-analyzer-cplusplus.NewDeleteLeaks)
+  boost::algorithm::trim_right_if(key_content, boost::algorithm::is_any_of("\n"));
+  fresh->key_id = Utils::toHex(Crypto::sha256digest(Utils::jsonToCanonicalStr(Json::Value(key_content))), true);
+  if (Crypto::IsRsaKeyType(type_)) {
+    fresh->rsa = Crypto::parseRSAPublicKey(value_);
+  } else if (type_ == KeyType::kED25519) {
+    try {
+      fresh->ed25519 = Utils::fromHex(value_);
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Invalid ED25519 public key: " << e.what();
+    }
+  }
+  parsed = std::move(fresh);
+  std::atomic_store(&parsed_, parsed);
+  return parsed;
+}
+
 PublicKey::PublicKey(const boost::filesystem::path &path)
     : value_(Utils::readFile(path)), type_(Crypto::IdentifyRSAKeyType(value_)) {}
 
@@ -78,16 +136,39 @@ PublicKey::PublicKey(const std::string &value, KeyType type) : value_(value), ty
 }
 
 bool PublicKey::VerifySignature(const std::string &signature, const std::string &message) const {
-  switch (type_) {
-    case KeyType::kED25519:
-      return Crypto::ED25519Verify(boost::algorithm::unhex(value_), Utils::fromBase64(signature), message);
-    case KeyType::kRSA2048:
-    case KeyType::kRSA3072:
-    case KeyType::kRSA4096:
-      return Crypto::RSAPSSVerify(value_, Utils::fromBase64(signature), message);
-    default:
-      return false;
+  // the same metadata is often verified again, e.g. when it's loaded from the
+  // storage after it was fetched
+  const std::string digest = Crypto::sha256digest(message);
+  SignatureCache &cache = SignatureCache::instance();
+  if (cache.contains(*this, signature, digest)) {
+    return true;
+  }
+  bool valid = false;
+  const std::shared_ptr<CryptoProvider> provider = CryptoProviderFactory::current();
+  CryptoProvider::Result offloaded = CryptoProvider::Result::kUnsupported;
+  if (provider != nullptr) {
+    offloaded = provider->verify(type_, value_, Utils::fromBase64(signature), message);
+  }
+  if (offloaded != CryptoProvider::Result::kUnsupported) {
+    valid = offloaded == CryptoProvider::Result::kValid;
+  } else {
+    switch (type_) {
+      case KeyType::kED25519:
+        valid = Crypto::ED25519Verify(parsed()->ed25519, Utils::fromBase64(signature), message);
+        break;
+      case KeyType::kRSA2048:
+      case KeyType::kRSA3072:
+      case KeyType::kRSA4096:
+        valid = Crypto::RSAPSSVerify(parsed()->rsa.get(), Utils::fromBase64(signature), message);
+        break;
+      default:
+        return false;
+    }
   }
+  if (valid) {
+    cache.insert(*this, signature, digest);
+  }
+  return valid;
 }
 
 bool PublicKey::operator==(const PublicKey &rhs) const { return value_ == rhs.value_ && type_ == rhs.type_; }
@@ -112,78 +193,90 @@ Json::Value PublicKey::ToUptane() const {
   return res;
 }
 
-std::string PublicKey::KeyId() const {
-  std::string key_content = value_;
-  // NOLINTNEXTLINE(clang-analyzer-cplusplus.NewDeleteLeaks)
-  boost::algorithm::trim_right_if(key_content, boost::algorithm::is_any_of("\n"));
-  std::string keyid = boost::algorithm::hex(Crypto::sha256digest(Utils::jsonToCanonicalStr(Json::Value(key_content))));
-  std::transform(keyid.begin(), keyid.end(), keyid.begin(), ::tolower);
-  return keyid;
-}
+std::string PublicKey::KeyId() const { return parsed()->key_id; }
 
 std::string Crypto::sha256digest(const std::string &text) {
   std::array<unsigned char, crypto_hash_sha256_BYTES> sha256_hash{};
-  crypto_hash_sha256(sha256_hash.data(), reinterpret_cast<const unsigned char *>(text.c_str()), text.size());
+  if (MultiPartHasher::defaultBackend(Hash::Type::kSha256) == HashBackend::kOpenssl) {
+    SHA256(reinterpret_cast<const unsigned char *>(text.c_str()), text.size(), sha256_hash.data());
+  } else {
+    crypto_hash_sha256(sha256_hash.data(), reinterpret_cast<const unsigned char *>(text.c_str()), text.size());
+  }
   return std::string(reinterpret_cast<char *>(sha256_hash.data()), crypto_hash_sha256_BYTES);
 }
 
 std::string Crypto::sha256digestHex(const std::string &text) {
-  return boost::algorithm::to_lower_copy(boost::algorithm::hex(sha256digest(text)));
+  return Utils::toHex(sha256digest(text), true);
 }
 
 std::string Crypto::sha512digest(const std::string &text) {
   std::array<unsigned char, crypto_hash_sha512_BYTES> sha512_hash{};
-  crypto_hash_sha512(sha512_hash.data(), reinterpret_cast<const unsigned char *>(text.c_str()), text.size());
+  if (MultiPartHasher::defaultBackend(Hash::Type::kSha512) == HashBackend::kOpenssl) {
+    SHA512(reinterpret_cast<const unsigned char *>(text.c_str()), text.size(), sha512_hash.data());
+  } else {
+    crypto_hash_sha512(sha512_hash.data(), reinterpret_cast<const unsigned char *>(text.c_str()), text.size());
+  }
   return std::string(reinterpret_cast<char *>(sha512_hash.data()), crypto_hash_sha512_BYTES);
 }
 
 std::string Crypto::sha512digestHex(const std::string &text) {
-  return boost::algorithm::to_lower_copy(boost::algorithm::hex(sha512digest(text)));
+  return Utils::toHex(sha512digest(text), true);
 }
 
 std::string Crypto::RSAPSSSign(ENGINE *engine, const std::string &private_key, const std::string &message) {
-  StructGuard<EVP_PKEY> key(nullptr, EVP_PKEY_free);
-  StructGuard<RSA> rsa(nullptr, RSA_free);
-  if (engine != nullptr) {
-    // TODO(OTA-2138): this call leaks memory somehow...
-    key.reset(ENGINE_load_private_key(engine, private_key.c_str(), nullptr, nullptr));
+  if (engine == nullptr) {
+    StructGuard<RSA> rsa = parseRSAPrivateKey(private_key);
+    return RSAPSSSign(rsa.get(), message);
+  }
 
-    if (key == nullptr) {
-      LOG_ERROR << "ENGINE_load_private_key failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return std::string();
-    }
+  // TODO(OTA-2138): this call leaks memory somehow...
+  StructGuard<EVP_PKEY> key(ENGINE_load_private_key(engine, private_key.c_str(), nullptr, nullptr), EVP_PKEY_free);
+  if (key == nullptr) {
+    LOG_ERROR << "ENGINE_load_private_key failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return std::string();
+  }
 
+  StructGuard<RSA> rsa(EVP_PKEY_get1_RSA(key.get()), RSA_free);
+  if (rsa == nullptr) {
+    LOG_ERROR << "EVP_PKEY_get1_RSA failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return std::string();
+  }
+  return RSAPSSSign(rsa.get(), message);
+}
+
+StructGuard<RSA> Crypto::parseRSAPrivateKey(const std::string &private_key_pem) {
+  StructGuard<RSA> rsa(nullptr, RSA_free);
+  StructGuard<BIO> bio(
+      BIO_new_mem_buf(const_cast<char *>(private_key_pem.c_str()), static_cast<int>(private_key_pem.size())),
+      BIO_vfree);
+  StructGuard<EVP_PKEY> key(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr), EVP_PKEY_free);
+  if (key != nullptr) {
     rsa.reset(EVP_PKEY_get1_RSA(key.get()));
-    if (rsa == nullptr) {
-      LOG_ERROR << "EVP_PKEY_get1_RSA failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return std::string();
-    }
-  } else {
-    StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(private_key.c_str()), static_cast<int>(private_key.size())),
-                         BIO_vfree);
-    key.reset(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr));
-    if (key != nullptr) {
-      rsa.reset(EVP_PKEY_get1_RSA(key.get()));
-    }
+  }
 
-    if (rsa == nullptr) {
-      LOG_ERROR << "PEM_read_bio_PrivateKey failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return std::string();
-    }
+  if (rsa == nullptr) {
+    LOG_ERROR << "PEM_read_bio_PrivateKey failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return rsa;
+  }
 
 #if AKTUALIZR_OPENSSL_PRE_11
-    RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
+  RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
 #else
-    RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
+  RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
 #endif
-  }
+  return rsa;
+}
 
-  const auto sign_size = static_cast<unsigned int>(RSA_size(rsa.get()));
+std::string Crypto::RSAPSSSign(RSA *rsa, const std::string &message) {
+  if (rsa == nullptr) {
+    return std::string();
+  }
+  const auto sign_size = static_cast<unsigned int>(RSA_size(rsa));
   boost::scoped_array<unsigned char> EM(new unsigned char[sign_size]);
   boost::scoped_array<unsigned char> pSignature(new unsigned char[sign_size]);
 
   std::string digest = Crypto::sha256digest(message);
-  int status = RSA_padding_add_PKCS1_PSS(rsa.get(), EM.get(), reinterpret_cast<const unsigned char *>(digest.c_str()),
+  int status = RSA_padding_add_PKCS1_PSS(rsa, EM.get(), reinterpret_cast<const unsigned char *>(digest.c_str()),
                                          EVP_sha256(), -1 /* maximum salt length*/);
   if (status == 0) {
     LOG_ERROR << "RSA_padding_add_PKCS1_PSS failed with error " << ERR_error_string(ERR_get_error(), nullptr);
@@ -191,7 +284,7 @@ std::string Crypto::RSAPSSSign(ENGINE *engine, const std::string &private_key, c
   }
 
   /* perform digital signature */
-  status = RSA_private_encrypt(RSA_size(rsa.get()), EM.get(), pSignature.get(), rsa.get(), RSA_NO_PADDING);
+  status = RSA_private_encrypt(RSA_size(rsa), EM.get(), pSignature.get(), rsa, RSA_NO_PADDING);
   if (status == -1) {
     LOG_ERROR << "RSA_private_encrypt failed with error " << ERR_error_string(ERR_get_error(), nullptr);
     return std::string();
@@ -202,7 +295,7 @@ std::string Crypto::RSAPSSSign(ENGINE *engine, const std::string &private_key, c
 
 std::string Crypto::Sign(KeyType key_type, ENGINE *engine, const std::string &private_key, const std::string &message) {
   if (key_type == KeyType::kED25519) {
-    return Crypto::ED25519Sign(boost::algorithm::unhex(private_key), message);
+    return Crypto::ED25519Sign(Utils::fromHex(private_key), message);
   }
   return Crypto::RSAPSSSign(engine, private_key, message);
 }
@@ -215,14 +308,20 @@ std::string Crypto::ED25519Sign(const std::string &private_key, const std::strin
 }
 
 bool Crypto::RSAPSSVerify(const std::string &public_key, const std::string &signature, const std::string &message) {
+  StructGuard<RSA> rsa = parseRSAPublicKey(public_key);
+  return rsa != nullptr && RSAPSSVerify(rsa.get(), signature, message);
+}
+
+StructGuard<RSA> Crypto::parseRSAPublicKey(const std::string &public_key_pem) {
   StructGuard<RSA> rsa(nullptr, RSA_free);
-  StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(public_key.c_str()), static_cast<int>(public_key.size())),
-                       BIO_vfree);
+  StructGuard<BIO> bio(
+      BIO_new_mem_buf(const_cast<char *>(public_key_pem.c_str()), static_cast<int>(public_key_pem.size())),
+      BIO_vfree);
   {
     RSA *r = nullptr;
     if (PEM_read_bio_RSA_PUBKEY(bio.get(), &r, nullptr, nullptr) == nullptr) {
       LOG_ERROR << "PEM_read_bio_RSA_PUBKEY failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return false;
+      return rsa;
     }
     rsa.reset(r);
   }
@@ -232,15 +331,21 @@ bool Crypto::RSAPSSVerify(const std::string &public_key, const std::string &sign
 #else
   RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
 #endif
+  return rsa;
+}
 
-  const auto size = static_cast<unsigned int>(RSA_size(rsa.get()));
+bool Crypto::RSAPSSVerify(RSA *rsa, const std::string &signature, const std::string &message) {
+  if (rsa == nullptr) {
+    return false;
+  }
+  const auto size = static_cast<unsigned int>(RSA_size(rsa));
   boost::scoped_array<unsigned char> pDecrypted(new unsigned char[size]);
   /* now we will verify the signature
     Start by a RAW decrypt of the signature
   */
   int status =
       RSA_public_decrypt(static_cast<int>(signature.size()), reinterpret_cast<const unsigned char *>(signature.c_str()),
-                         pDecrypted.get(), rsa.get(), RSA_NO_PADDING);
+                         pDecrypted.get(), rsa, RSA_NO_PADDING);
   if (status == -1) {
     LOG_ERROR << "RSA_public_decrypt failed with error " << ERR_error_string(ERR_get_error(), nullptr);
     return false;
@@ -249,11 +354,12 @@ bool Crypto::RSAPSSVerify(const std::string &public_key, const std::string &sign
   std::string digest = Crypto::sha256digest(message);
 
   /* verify the data */
-  status = RSA_verify_PKCS1_PSS(rsa.get(), reinterpret_cast<const unsigned char *>(digest.c_str()), EVP_sha256(),
+  status = RSA_verify_PKCS1_PSS(rsa, reinterpret_cast<const unsigned char *>(digest.c_str()), EVP_sha256(),
                                 pDecrypted.get(), -2 /* salt length recovered from signature*/);
 
   return status == 1;
 }
+
 bool Crypto::ED25519Verify(const std::string &public_key, const std::string &signature, const std::string &message) {
   if (public_key.size() < crypto_sign_PUBLICKEYBYTES || signature.size() < crypto_sign_BYTES) {
     return false;
@@ -683,12 +789,23 @@ void Crypto::serializeCert(std::string *pkey, std::string *cert, X509 *const cer
 }
 
 MultiPartHasher::Ptr MultiPartHasher::create(Hash::Type hash_type) {
+  const std::shared_ptr<CryptoProvider> provider = CryptoProviderFactory::current();
+  if (provider != nullptr) {
+    Ptr hasher = provider->createHasher(hash_type);
+    if (hasher != nullptr) {
+      return hasher;
+    }
+  }
+  return create(hash_type, defaultBackend(hash_type));
+}
+
+MultiPartHasher::Ptr MultiPartHasher::create(Hash::Type hash_type, HashBackend backend) {
   switch (hash_type) {
     case Hash::Type::kSha256: {
-      return std::make_shared<MultiPartSHA256Hasher>();
+      return std::make_shared<MultiPartSHA256Hasher>(backend);
     }
     case Hash::Type::kSha512: {
-      return std::make_shared<MultiPartSHA512Hasher>();
+      return std::make_shared<MultiPartSHA512Hasher>(backend);
     }
     default: {
       LOG_ERROR << "Unsupported type of hashing: " << Hash::TypeString(hash_type);
@@ -697,39 +814,236 @@ MultiPartHasher::Ptr MultiPartHasher::create(Hash::Type hash_type) {
   }
 }
 
+MultiPartHasher::Ptr MultiPartHasher::create(const std::vector<Hash> &hashes) {
+  std::vector<Ptr> hashers;
+  std::vector<Hash::Type> types;
+  for (const auto &hash : hashes) {
+    if (!hash.HaveAlgorithm() || std::find(types.begin(), types.end(), hash.type()) != types.end()) {
+      continue;
+    }
+    Ptr hasher = create(hash.type());
+    if (hasher != nullptr) {
+      types.push_back(hash.type());
+      hashers.push_back(std::move(hasher));
+    }
+  }
+  if (hashers.size() < 2) {
+    return hashers.empty() ? nullptr : hashers.front();
+  }
+  return std::make_shared<MultiPartMultiHasher>(std::move(hashers));
+}
+
+// Whether the CPU has instructions for the hash type that OpenSSL makes use
+// of. Without them, the portable code of libsodium is used as before.
+static bool cpuHasShaInstructions(Hash::Type hash_type) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax = 0;
+  unsigned int ebx = 0;
+  unsigned int ecx = 0;
+  unsigned int edx = 0;
+  if (hash_type != Hash::Type::kSha256 || __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+    return false;
+  }
+  // SHA-NI only covers SHA-1 and SHA-256
+  return (ebx & (1U << 29U)) != 0;
+#elif defined(__aarch64__)
+  const auto hwcap = getauxval(AT_HWCAP);
+  if (hash_type == Hash::Type::kSha256) {
+    return (hwcap & HWCAP_SHA2) != 0;
+  }
+#ifdef HWCAP_SHA512
+  if (hash_type == Hash::Type::kSha512) {
+    return (hwcap & HWCAP_SHA512) != 0;
+  }
+#endif
+  return false;
+#else
+  (void)hash_type;
+  return false;
+#endif
+}
+
+HashBackend MultiPartHasher::defaultBackend(Hash::Type hash_type) {
+  static const HashBackend sha256_backend =
+      cpuHasShaInstructions(Hash::Type::kSha256) ? HashBackend::kOpenssl : HashBackend::kSodium;
+  static const HashBackend sha512_backend =
+      cpuHasShaInstructions(Hash::Type::kSha512) ? HashBackend::kOpenssl : HashBackend::kSodium;
+  return (hash_type == Hash::Type::kSha512) ? sha512_backend : sha256_backend;
+}
+
+// The state is prefixed with the backend, as the states of the backends are
+// not compatible.
+template <typename State>
+static std::string encodeHasherState(HashBackend backend, const State &state) {
+  return std::string(1, static_cast<char>(backend)) +
+         std::string(reinterpret_cast<const char *>(&state), sizeof(state));
+}
+
+template <typename State>
+static bool decodeHasherState(HashBackend backend, const std::string &encoded, State *state) {
+  if (encoded.size() != sizeof(State) + 1 || encoded[0] != static_cast<char>(backend)) {
+    return false;
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  std::memcpy(state, encoded.data() + 1, sizeof(State));
+  return true;
+}
+
+MultiPartSHA512Hasher::MultiPartSHA512Hasher(HashBackend backend) : backend_(backend) { reset(); }
+
+void MultiPartSHA512Hasher::update(const unsigned char *part, uint64_t size) {
+  if (backend_ == HashBackend::kOpenssl) {
+    SHA512_Update(&openssl_state_, part, size);
+  } else {
+    crypto_hash_sha512_update(&sodium_state_, part, size);
+  }
+}
+
+void MultiPartSHA512Hasher::reset() {
+  if (backend_ == HashBackend::kOpenssl) {
+    SHA512_Init(&openssl_state_);
+  } else {
+    crypto_hash_sha512_init(&sodium_state_);
+  }
+}
+
 std::string MultiPartSHA512Hasher::getHexDigest() {
   std::array<unsigned char, crypto_hash_sha512_BYTES> sha512_hash{};
-  crypto_hash_sha512_final(&state_, sha512_hash.data());
-  return boost::algorithm::hex(std::string(reinterpret_cast<char *>(sha512_hash.data()), crypto_hash_sha512_BYTES));
+  if (backend_ == HashBackend::kOpenssl) {
+    SHA512_Final(sha512_hash.data(), &openssl_state_);
+  } else {
+    crypto_hash_sha512_final(&sodium_state_, sha512_hash.data());
+  }
+  return Utils::toHex(std::string(reinterpret_cast<char *>(sha512_hash.data()), crypto_hash_sha512_BYTES));
+}
+
+std::string MultiPartSHA512Hasher::getState() const {
+  return (backend_ == HashBackend::kOpenssl) ? encodeHasherState(backend_, openssl_state_)
+                                             : encodeHasherState(backend_, sodium_state_);
+}
+
+bool MultiPartSHA512Hasher::setState(const std::string &state) {
+  return (backend_ == HashBackend::kOpenssl) ? decodeHasherState(backend_, state, &openssl_state_)
+                                             : decodeHasherState(backend_, state, &sodium_state_);
+}
+
+MultiPartSHA256Hasher::MultiPartSHA256Hasher(HashBackend backend) : backend_(backend) { reset(); }
+
+void MultiPartSHA256Hasher::update(const unsigned char *part, uint64_t size) {
+  if (backend_ == HashBackend::kOpenssl) {
+    SHA256_Update(&openssl_state_, part, size);
+  } else {
+    crypto_hash_sha256_update(&sodium_state_, part, size);
+  }
+}
+
+void MultiPartSHA256Hasher::reset() {
+  if (backend_ == HashBackend::kOpenssl) {
+    SHA256_Init(&openssl_state_);
+  } else {
+    crypto_hash_sha256_init(&sodium_state_);
+  }
 }
 
 std::string MultiPartSHA256Hasher::getHexDigest() {
   std::array<unsigned char, crypto_hash_sha256_BYTES> sha256_hash{};
-  crypto_hash_sha256_final(&state_, sha256_hash.data());
-  return boost::algorithm::hex(std::string(reinterpret_cast<char *>(sha256_hash.data()), crypto_hash_sha256_BYTES));
+  if (backend_ == HashBackend::kOpenssl) {
+    SHA256_Final(sha256_hash.data(), &openssl_state_);
+  } else {
+    crypto_hash_sha256_final(&sodium_state_, sha256_hash.data());
+  }
+  return Utils::toHex(std::string(reinterpret_cast<char *>(sha256_hash.data()), crypto_hash_sha256_BYTES));
 }
 
-Hash Hash::generate(Type type, const std::string &data) {
-  std::string hash;
+std::string MultiPartSHA256Hasher::getState() const {
+  return (backend_ == HashBackend::kOpenssl) ? encodeHasherState(backend_, openssl_state_)
+                                             : encodeHasherState(backend_, sodium_state_);
+}
+
+bool MultiPartSHA256Hasher::setState(const std::string &state) {
+  return (backend_ == HashBackend::kOpenssl) ? decodeHasherState(backend_, state, &openssl_state_)
+                                             : decodeHasherState(backend_, state, &sodium_state_);
+}
+
+void MultiPartMultiHasher::update(const unsigned char *part, uint64_t size) {
+  // the part is still in the cache for the hashers after the first one
+  for (auto &hasher : hashers_) {
+    hasher->update(part, size);
+  }
+}
+
+void MultiPartMultiHasher::reset() {
+  for (auto &hasher : hashers_) {
+    hasher->reset();
+  }
+}
+
+std::vector<Hash> MultiPartMultiHasher::getHashes() {
+  std::vector<Hash> hashes;
+  for (auto &hasher : hashers_) {
+    hashes.push_back(hasher->getHash());
+  }
+  return hashes;
+}
+
+// The states of the hashers, each preceded by its length and a colon
+std::string MultiPartMultiHasher::getState() const {
+  std::string state;
+  for (const auto &hasher : hashers_) {
+    const std::string part = hasher->getState();
+    state += std::to_string(part.size()) + ":" + part;
+  }
+  return state;
+}
 
+bool MultiPartMultiHasher::setState(const std::string &state) {
+  std::vector<std::string> parts;
+  size_t pos = 0;
+  while (pos < state.size()) {
+    const size_t colon = state.find(':', pos);
+    if (colon == std::string::npos || colon == pos || colon - pos > 9 ||
+        state.find_first_not_of("0123456789", pos) != colon) {
+      return false;
+    }
+    const size_t length = std::stoul(state.substr(pos, colon - pos));
+    if (length > state.size() - colon - 1) {
+      return false;
+    }
+    parts.push_back(state.substr(colon + 1, length));
+    pos = colon + 1 + length;
+  }
+  if (parts.size() != hashers_.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < hashers_.size(); ++i) {
+    if (!hashers_[i]->setState(parts[i])) {
+      reset();
+      return false;
+    }
+  }
+  return true;
+}
+
+Hash Hash::generate(Type type, const std::string &data) {
+  Hash hash(type, std::string());
   switch (type) {
     case Type::kSha256: {
-      hash = boost::algorithm::hex(Crypto::sha256digest(data));
+      hash.hash_ = Crypto::sha256digest(data);
       break;
     }
     case Type::kSha512: {
-      hash = boost::algorithm::hex(Crypto::sha512digest(data));
+      hash.hash_ = Crypto::sha512digest(data);
       break;
     }
     default: {
       throw std::invalid_argument("Unsupported hash type");
     }
   }
-
-  return Hash(type, hash);
+  hash.binary_ = true;
+  return hash;
 }
 
-Hash::Hash(const std::string &type, const std::string &hash) : hash_(boost::algorithm::to_upper_copy(hash)) {
+Hash::Hash(const std::string &type, const std::string &hash) {
   if (type == "sha512") {
     type_ = Hash::Type::kSha512;
   } else if (type == "sha256") {
@@ -737,11 +1051,21 @@ Hash::Hash(const std::string &type, const std::string &hash) : hash_(boost::algo
   } else {
     type_ = Hash::Type::kUnknownAlgorithm;
   }
+  setValue(hash);
 }
 
-Hash::Hash(Type type, const std::string &hash) : type_(type), hash_(boost::algorithm::to_upper_copy(hash)) {}
+Hash::Hash(Type type, const std::string &hash) : type_(type) { setValue(hash); }
 
-bool Hash::operator==(const Hash &other) const { return type_ == other.type_ && hash_ == other.hash_; }
+void Hash::setValue(const std::string &hash) {
+  binary_ = !hash.empty() && hash.size() % 2 == 0 && Utils::isHex(hash);
+  hash_ = binary_ ? Utils::fromHex(hash) : boost::algorithm::to_upper_copy(hash);
+}
+
+std::string Hash::HashString() const { return binary_ ? Utils::toHex(hash_) : hash_; }
+
+bool Hash::operator==(const Hash &other) const {
+  return type_ == other.type_ && binary_ == other.binary_ && hash_ == other.hash_;
+}
 
 std::string Hash::TypeString(Type type) {
   switch (type) {
@@ -759,7 +1083,7 @@ std::string Hash::TypeString() const { return TypeString(type_); }
 Hash::Type Hash::type() const { return type_; }
 
 std::ostream &operator<<(std::ostream &os, const Hash &h) {
-  os << "Hash: " << h.hash_;
+  os << "Hash: " << h.HashString();
   return os;
 }
 
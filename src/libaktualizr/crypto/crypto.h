@@ -8,8 +8,10 @@
 #include <algorithm>  // for copy
 #include <array>      // for array
 #include <cstdint>    // for uint64_t
+#include <cstring>    // for memcpy
 #include <memory>     // for shared_ptr
 #include <string>     // for string
+#include <vector>     // for vector
 
 #include "libaktualizr/types.h"  // for Hash, KeyType, Hash::Type
 #include "utilities/utils.h"     // for StructGuard
@@ -18,12 +20,22 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <openssl/sha.h>
 
 // some older versions of openssl have BIO_new_mem_buf defined with first parameter of type (void*)
 //   which is not true and breaks our build
 #undef BIO_new_mem_buf
 BIO *BIO_new_mem_buf(const void *, int);  // NOLINT(readability-redundant-declaration)
 
+/** Implementation used by the multi part hashers. */
+enum class HashBackend {
+  // portable implementation from libsodium
+  kSodium = 0,
+  // OpenSSL, which uses the SHA instructions of the CPU (Intel SHA-NI, ARMv8
+  // crypto extensions) when they are available
+  kOpenssl = 1,
+};
+
 class MultiPartHasher {
  public:
   MultiPartHasher() = default;
@@ -35,46 +47,98 @@ class MultiPartHasher {
 
   using Ptr = std::shared_ptr<MultiPartHasher>;
   static Ptr create(Hash::Type hash_type);
+  static Ptr create(Hash::Type hash_type, HashBackend backend);
+  /**
+   * A hasher for each type of the hashes, e.g. all the hashes of a Target,
+   * fed in a single pass; see getHashes(). Its digest is the one of the
+   * first hash. Unknown types are skipped; nullptr if none is left.
+   */
+  static Ptr create(const std::vector<Hash> &hashes);
+  /**
+   * The backend used by default for the hash type: OpenSSL if the CPU has
+   * instructions for it, libsodium otherwise. Detected once at runtime.
+   */
+  static HashBackend defaultBackend(Hash::Type hash_type);
 
   virtual void update(const unsigned char *part, uint64_t size) = 0;
   virtual void reset() = 0;
   virtual std::string getHexDigest() = 0;
   virtual Hash getHash() = 0;
+  // one per hash type, the type of getHash() first
+  virtual std::vector<Hash> getHashes() { return {getHash()}; }
+  /**
+   * Opaque intermediate state, to continue hashing later with setState(),
+   * e.g. after a restart. Only valid for the same hash type, backend and
+   * library build.
+   */
+  virtual std::string getState() const = 0;
+  virtual bool setState(const std::string &state) = 0;
 };
 
 class MultiPartSHA512Hasher : public MultiPartHasher {
  public:
-  MultiPartSHA512Hasher() { crypto_hash_sha512_init(&state_); }
+  explicit MultiPartSHA512Hasher(HashBackend backend = defaultBackend(Hash::Type::kSha512));
   ~MultiPartSHA512Hasher() override = default;
   MultiPartSHA512Hasher(const MultiPartSHA512Hasher &) = delete;
   MultiPartSHA512Hasher(MultiPartSHA512Hasher &&) = delete;
   MultiPartSHA512Hasher &operator=(const MultiPartSHA512Hasher &) = delete;
   MultiPartSHA512Hasher &operator=(MultiPartSHA512Hasher &&) = delete;
-  void update(const unsigned char *part, uint64_t size) override { crypto_hash_sha512_update(&state_, part, size); }
-  void reset() override { crypto_hash_sha512_init(&state_); }
+  void update(const unsigned char *part, uint64_t size) override;
+  void reset() override;
   std::string getHexDigest() override;
   Hash getHash() override { return Hash(Hash::Type::kSha512, getHexDigest()); }
+  std::string getState() const override;
+  bool setState(const std::string &state) override;
+  HashBackend backend() const { return backend_; }
 
  private:
-  crypto_hash_sha512_state state_{};
+  HashBackend backend_;
+  crypto_hash_sha512_state sodium_state_{};
+  SHA512_CTX openssl_state_{};
 };
 
 class MultiPartSHA256Hasher : public MultiPartHasher {
  public:
-  MultiPartSHA256Hasher() { crypto_hash_sha256_init(&state_); }
+  explicit MultiPartSHA256Hasher(HashBackend backend = defaultBackend(Hash::Type::kSha256));
   ~MultiPartSHA256Hasher() override = default;
   MultiPartSHA256Hasher(const MultiPartSHA256Hasher &) = delete;
   MultiPartSHA256Hasher(MultiPartSHA256Hasher &&) = delete;
   MultiPartSHA256Hasher &operator=(const MultiPartSHA256Hasher &) = delete;
   MultiPartSHA256Hasher &operator=(MultiPartSHA256Hasher &&) = delete;
-  void update(const unsigned char *part, uint64_t size) override { crypto_hash_sha256_update(&state_, part, size); }
-  void reset() override { crypto_hash_sha256_init(&state_); }
+  void update(const unsigned char *part, uint64_t size) override;
+  void reset() override;
   std::string getHexDigest() override;
 
   Hash getHash() override { return Hash(Hash::Type::kSha256, getHexDigest()); }
+  std::string getState() const override;
+  bool setState(const std::string &state) override;
+  HashBackend backend() const { return backend_; }
+
+ private:
+  HashBackend backend_;
+  crypto_hash_sha256_state sodium_state_{};
+  SHA256_CTX openssl_state_{};
+};
+
+// Feeds the data to several hashers at once; see MultiPartHasher::create()
+class MultiPartMultiHasher : public MultiPartHasher {
+ public:
+  explicit MultiPartMultiHasher(std::vector<Ptr> hashers) : hashers_(std::move(hashers)) {}
+  ~MultiPartMultiHasher() override = default;
+  MultiPartMultiHasher(const MultiPartMultiHasher &) = delete;
+  MultiPartMultiHasher(MultiPartMultiHasher &&) = delete;
+  MultiPartMultiHasher &operator=(const MultiPartMultiHasher &) = delete;
+  MultiPartMultiHasher &operator=(MultiPartMultiHasher &&) = delete;
+  void update(const unsigned char *part, uint64_t size) override;
+  void reset() override;
+  std::string getHexDigest() override { return hashers_.front()->getHexDigest(); }
+  Hash getHash() override { return hashers_.front()->getHash(); }
+  std::vector<Hash> getHashes() override;
+  std::string getState() const override;
+  bool setState(const std::string &state) override;
 
  private:
-  crypto_hash_sha256_state state_{};
+  std::vector<Ptr> hashers_;
 };
 
 class Crypto {
@@ -86,6 +150,9 @@ class Crypto {
   /** A lower case, hexadecimal version of sha512digest */
   static std::string sha512digestHex(const std::string &text);
   static std::string RSAPSSSign(ENGINE *engine, const std::string &private_key, const std::string &message);
+  // with a key from parseRSAPrivateKey()
+  static std::string RSAPSSSign(RSA *rsa, const std::string &message);
+  static StructGuard<RSA> parseRSAPrivateKey(const std::string &private_key_pem);
   static std::string Sign(KeyType key_type, ENGINE *engine, const std::string &private_key, const std::string &message);
   static std::string ED25519Sign(const std::string &private_key, const std::string &message);
   static bool parseP12(BIO *p12_bio, const std::string &p12_password, std::string *out_pkey, std::string *out_cert,
@@ -98,6 +165,9 @@ class Crypto {
   static bool generateKeyPair(KeyType key_type, std::string *public_key, std::string *private_key);
 
   static bool RSAPSSVerify(const std::string &public_key, const std::string &signature, const std::string &message);
+  // with a key from parseRSAPublicKey()
+  static bool RSAPSSVerify(RSA *rsa, const std::string &signature, const std::string &message);
+  static StructGuard<RSA> parseRSAPublicKey(const std::string &public_key_pem);
   static bool ED25519Verify(const std::string &public_key, const std::string &signature, const std::string &message);
 
   static bool IsRsaKeyType(KeyType type);
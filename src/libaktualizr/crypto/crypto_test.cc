@@ -12,7 +12,9 @@
 #include <boost/filesystem/path_traits.hpp>
 
 #include "crypto/crypto.h"
+#include "crypto/cryptoprovider.h"
 #include "crypto/p11engine.h"
+#include "crypto/signaturecache.h"
 #include "utilities/utils.h"
 
 #ifdef BUILD_P11
@@ -23,6 +25,36 @@
 
 namespace fs = boost::filesystem;
 
+namespace {
+// Rejects the ED25519 signatures of one message, hashes SHA-512 with the
+// built-in hasher and leaves the rest to the default implementation
+class TestCryptoProvider : public CryptoProvider {
+ public:
+  static const std::string rejected;
+  static int hashers;
+
+  MultiPartHasher::Ptr createHasher(Hash::Type hash_type) override {
+    if (hash_type != Hash::Type::kSha512) {
+      return nullptr;
+    }
+    ++hashers;
+    return MultiPartHasher::create(hash_type, HashBackend::kSodium);
+  }
+  Result verify(KeyType key_type, const std::string &public_key, const std::string &signature,
+                const std::string &message) override {
+    (void)public_key;
+    (void)signature;
+    if (key_type != KeyType::kED25519 || message != rejected) {
+      return Result::kUnsupported;
+    }
+    return Result::kInvalid;
+  }
+};
+const std::string TestCryptoProvider::rejected = "Nobody signed this";
+int TestCryptoProvider::hashers = 0;
+AUTO_REGISTER_CRYPTO_PROVIDER("test", TestCryptoProvider);
+}  // namespace
+
 /* Validate SHA256 hashes. */
 TEST(crypto, Sha256) {
   std::string test_str = "This is string for testing";
@@ -41,6 +73,55 @@ TEST(crypto, Sha512) {
   EXPECT_EQ(expected_result, result);
 }
 
+/* Continue a multi-part hash from a saved intermediate state. */
+TEST(crypto, MultiPartHasherState) {
+  const std::string part1 = "This is string ";
+  const std::string part2 = "for testing";
+  for (const auto type : {Hash::Type::kSha256, Hash::Type::kSha512}) {
+    auto hasher = MultiPartHasher::create(type);
+    hasher->update(reinterpret_cast<const unsigned char*>(part1.data()), part1.size());
+    const std::string state = hasher->getState();
+
+    auto resumed = MultiPartHasher::create(type);
+    ASSERT_TRUE(resumed->setState(state));
+    resumed->update(reinterpret_cast<const unsigned char*>(part2.data()), part2.size());
+    EXPECT_EQ(resumed->getHash(), Hash::generate(type, part1 + part2));
+  }
+
+  // the state of one hash type can't be used for another
+  auto sha256 = MultiPartHasher::create(Hash::Type::kSha256);
+  auto sha512 = MultiPartHasher::create(Hash::Type::kSha512);
+  EXPECT_FALSE(sha512->setState(sha256->getState()));
+}
+
+/* All hasher backends compute the same hashes, but their states can't be
+ * exchanged. */
+TEST(crypto, MultiPartHasherBackends) {
+  std::string data;
+  for (size_t i = 0; i < 300000; i++) {
+    data += static_cast<char>(i % 253);
+  }
+  for (const auto type : {Hash::Type::kSha256, Hash::Type::kSha512}) {
+    const Hash expected = Hash::generate(type, data);
+    for (const auto backend : {HashBackend::kSodium, HashBackend::kOpenssl}) {
+      auto hasher = MultiPartHasher::create(type, backend);
+      // uneven parts, to cross block boundaries
+      size_t pos = 0;
+      for (size_t part = 1; pos < data.size(); part = part * 7 + 3) {
+        const size_t n = std::min(part, data.size() - pos);
+        hasher->update(reinterpret_cast<const unsigned char*>(&data[pos]), n);
+        pos += n;
+      }
+      EXPECT_EQ(hasher->getHash(), expected);
+    }
+
+    auto sodium = MultiPartHasher::create(type, HashBackend::kSodium);
+    auto openssl = MultiPartHasher::create(type, HashBackend::kOpenssl);
+    EXPECT_FALSE(openssl->setState(sodium->getState()));
+    EXPECT_FALSE(sodium->setState(openssl->getState()));
+  }
+}
+
 /* Sign and verify a file with RSA key stored in a file. */
 TEST(crypto, SignVerifyRsaFile) {
   std::string text = "This is text for sign";
@@ -94,6 +175,26 @@ TEST_F(P11Crypto, SignVerifyRsaP11) {
   EXPECT_TRUE(signe_is_ok);
 }
 
+/* The private key on the token is loaded once for all the signatures made
+ * with it. */
+TEST_F(P11Crypto, SignRsaP11KeyKept) {
+  const std::string uptane_key_id{"03"};
+
+  std::string key_content;
+  ASSERT_TRUE((*p11_)->readUptanePublicKey(uptane_key_id, &key_content));
+  PublicKey pkey(key_content, KeyType::kRSA2048);
+  const P11Engine::SignStats before = (*p11_)->signStats();
+  for (int i = 0; i < 3; ++i) {
+    const std::string text = "This is text number " + std::to_string(i);
+    const std::string signature = Utils::toBase64((*p11_)->signRsaPss(uptane_key_id, text));
+    EXPECT_TRUE(pkey.VerifySignature(signature, text));
+  }
+  const P11Engine::SignStats after = (*p11_)->signStats();
+  EXPECT_EQ(after.signatures, before.signatures + 3);
+  EXPECT_LE(after.key_loads, before.key_loads + 1);
+  EXPECT_GE(after.total, after.max);
+}
+
 /* Generate RSA keypairs via PKCS#11. */
 TEST_F(P11Crypto, GenerateRsaKeypairP11) {
   const std::string uptane_key_id{"05"};
@@ -117,6 +218,31 @@ TEST_F(P11Crypto, CertificatePkcs11) {
 }
 #endif
 
+/* A hasher for several hash types gives the same hashes as one hasher per
+ * type, and its state can be restored. */
+TEST(crypto, MultiPartMultiHasher) {
+  const std::string data = "This is text for the hashers";
+  const std::vector<Hash> expected{Hash::generate(Hash::Type::kSha512, data),
+                                   Hash::generate(Hash::Type::kSha256, data)};
+  std::vector<Hash> types = expected;
+  types.emplace_back("unknown", "00");
+  types.push_back(expected[1]);
+
+  auto hasher = MultiPartHasher::create(types);
+  ASSERT_NE(hasher, nullptr);
+  hasher->update(reinterpret_cast<const unsigned char *>(data.c_str()), 10);
+  auto resumed = MultiPartHasher::create(types);
+  EXPECT_FALSE(resumed->setState("1:x"));
+  ASSERT_TRUE(resumed->setState(hasher->getState()));
+  resumed->update(reinterpret_cast<const unsigned char *>(data.c_str()) + 10, data.size() - 10);
+  EXPECT_EQ(resumed->getHashes(), expected);
+
+  // a single type needs no combined hasher
+  auto single = MultiPartHasher::create({expected[1]});
+  EXPECT_NE(std::dynamic_pointer_cast<MultiPartSHA256Hasher>(single), nullptr);
+  EXPECT_EQ(MultiPartHasher::create(std::vector<Hash>{}), nullptr);
+}
+
 /* Refuse to sign with an invalid key. */
 TEST(crypto, SignBadKeyNoCrash) {
   std::string text = "This is text for sign";
@@ -320,6 +446,109 @@ TEST(crypto, parseBadPublicKeyJson) {
   EXPECT_EQ(PublicKey{o}.Type(), KeyType::kUnknown);
 }
 
+/* The signature cache keeps the most recently used entries and forgets the
+ * ones of a key on request. */
+TEST(crypto, SignatureCacheLru) {
+  const PublicKey key1("BB9FFA4DCF35A89F6F40C5FA67998DD38B64A8459598CF3DA93853388FDAC760", KeyType::kED25519);
+  const PublicKey key2("CC9FFA4DCF35A89F6F40C5FA67998DD38B64A8459598CF3DA93853388FDAC760", KeyType::kED25519);
+  SignatureCache cache(2);
+  cache.insert(key1, "sig1", "digest1");
+  cache.insert(key2, "sig2", "digest2");
+  EXPECT_TRUE(cache.contains(key1, "sig1", "digest1"));
+  EXPECT_FALSE(cache.contains(key1, "sig1", "digest2"));
+  EXPECT_FALSE(cache.contains(key2, "sig1", "digest1"));
+
+  // key2's entry is the least recently used one
+  cache.insert(key1, "sig3", "digest3");
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_FALSE(cache.contains(key2, "sig2", "digest2"));
+  EXPECT_TRUE(cache.contains(key1, "sig1", "digest1"));
+  EXPECT_EQ(cache.hits(), 2);
+  EXPECT_EQ(cache.misses(), 3);
+
+  cache.insert(key2, "sig2", "digest2");
+  cache.forgetKey(key1);
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_FALSE(cache.contains(key1, "sig1", "digest1"));
+  EXPECT_TRUE(cache.contains(key2, "sig2", "digest2"));
+}
+
+/* Good signatures are verified once, bad ones every time. */
+TEST(crypto, VerifySignatureCached) {
+  std::string public_key;
+  std::string private_key;
+  ASSERT_TRUE(Crypto::generateEDKeyPair(&public_key, &private_key));
+  const PublicKey pkey(public_key, KeyType::kED25519);
+  const std::string text = "This is text for the signature cache";
+  const std::string signature = Utils::toBase64(Crypto::ED25519Sign(boost::algorithm::unhex(private_key), text));
+
+  SignatureCache &cache = SignatureCache::instance();
+  const uint64_t hits = cache.hits();
+  EXPECT_TRUE(pkey.VerifySignature(signature, text));
+  EXPECT_TRUE(pkey.VerifySignature(signature, text));
+  EXPECT_EQ(cache.hits(), hits + 1);
+
+  EXPECT_FALSE(pkey.VerifySignature(signature, text + "!"));
+  EXPECT_FALSE(pkey.VerifySignature(signature, text + "!"));
+  EXPECT_EQ(cache.hits(), hits + 1);
+
+  cache.forgetKey(pkey);
+  EXPECT_TRUE(pkey.VerifySignature(signature, text));
+  EXPECT_EQ(cache.hits(), hits + 1);
+}
+
+/* A key parsed for a verification still verifies, with the same ID, when it
+ * is copied, and a key assigned over it doesn't keep the parsed old one. */
+TEST(crypto, PublicKeyParsedCopies) {
+  std::string public_key;
+  std::string private_key;
+  ASSERT_TRUE(Crypto::generateRSAKeyPair(KeyType::kRSA2048, &public_key, &private_key));
+  PublicKey pkey(public_key, KeyType::kRSA2048);
+  const std::string text = "This is text for the parsed key";
+  const std::string signature = Utils::toBase64(Crypto::RSAPSSSign(nullptr, private_key, text));
+  EXPECT_TRUE(pkey.VerifySignature(signature, text));
+
+  const PublicKey copy(pkey);  // NOLINT(performance-unnecessary-copy-initialization)
+  EXPECT_EQ(copy.KeyId(), pkey.KeyId());
+  EXPECT_FALSE(copy.VerifySignature(signature, text + " too"));
+  SignatureCache::instance().forgetKey(copy);
+  EXPECT_TRUE(copy.VerifySignature(signature, text));
+
+  const PublicKey other("BB9FFA4DCF35A89F6F40C5FA67998DD38B64A8459598CF3DA93853388FDAC760", KeyType::kED25519);
+  pkey = other;
+  EXPECT_EQ(pkey.KeyId(), other.KeyId());
+  EXPECT_FALSE(pkey.VerifySignature(signature, text));
+}
+
+/* The selected crypto provider does what it supports, and the built-in
+ * implementation the rest. */
+TEST(crypto, CryptoProvider) {
+  EXPECT_THROW(CryptoProviderFactory::select("missing"), std::runtime_error);
+  EXPECT_EQ(CryptoProviderFactory::current(), nullptr);
+
+  std::string public_key;
+  std::string private_key;
+  ASSERT_TRUE(Crypto::generateEDKeyPair(&public_key, &private_key));
+  const PublicKey pkey(public_key, KeyType::kED25519);
+  const std::string other = "Somebody signed this";
+  const std::string signature =
+      Utils::toBase64(Crypto::ED25519Sign(boost::algorithm::unhex(private_key), TestCryptoProvider::rejected));
+  const std::string other_signature =
+      Utils::toBase64(Crypto::ED25519Sign(boost::algorithm::unhex(private_key), other));
+
+  CryptoProviderFactory::select("test");
+  ASSERT_NE(CryptoProviderFactory::current(), nullptr);
+  EXPECT_FALSE(pkey.VerifySignature(signature, TestCryptoProvider::rejected));
+  EXPECT_TRUE(pkey.VerifySignature(other_signature, other));
+  MultiPartHasher::create(Hash::Type::kSha256);
+  MultiPartHasher::create(Hash::Type::kSha512);
+  EXPECT_EQ(TestCryptoProvider::hashers, 1);
+
+  CryptoProviderFactory::select(CryptoProviderFactory::kDefault);
+  EXPECT_EQ(CryptoProviderFactory::current(), nullptr);
+  EXPECT_TRUE(pkey.VerifySignature(signature, TestCryptoProvider::rejected));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
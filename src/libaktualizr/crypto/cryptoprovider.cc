@@ -0,0 +1,56 @@
+#include "crypto/cryptoprovider.h"
+
+#include <atomic>
+#include <map>
+#include <sstream>
+
+#include "logging/logging.h"
+
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+static std::map<std::string, CryptoProviderBuilder> *registered_providers_;
+
+// the selected provider, only accessed with std::atomic_load/atomic_store
+static std::shared_ptr<CryptoProvider> &currentProvider() {
+  static std::shared_ptr<CryptoProvider> provider;
+  return provider;
+}
+
+bool CryptoProviderFactory::registerProvider(const char *name, CryptoProviderBuilder builder) {
+  // this trick is needed so that this object is constructed before any element
+  // is added to it
+  static std::map<std::string, CryptoProviderBuilder> rproviders;
+
+  if (registered_providers_ == nullptr) {
+    registered_providers_ = &rproviders;
+  }
+  if (name == std::string(kDefault) || registered_providers_->find(name) != registered_providers_->end()) {
+    throw std::runtime_error(std::string("fatal: tried to register crypto provider \"") + name + "\" twice");
+  }
+  (*registered_providers_)[name] = std::move(builder);
+  return true;
+}
+
+void CryptoProviderFactory::select(const std::string &name) {
+  std::shared_ptr<CryptoProvider> provider;
+  if (!name.empty() && name != kDefault) {
+    if (registered_providers_ == nullptr || registered_providers_->count(name) == 0) {
+      LOG_ERROR << "Crypto provider \"" << name << "\" does not exist";
+      LOG_ERROR << "Available options are: " << []() {
+        std::stringstream ss;
+        ss << "\n" << kDefault;
+        if (registered_providers_ != nullptr) {
+          for (const auto &b : *registered_providers_) {
+            ss << "\n" << b.first;
+          }
+        }
+        return ss.str();
+      }();
+      throw std::runtime_error(std::string("Unsupported crypto provider: ") + name);
+    }
+    provider.reset(registered_providers_->at(name)());
+    LOG_INFO << "Using crypto provider " << name;
+  }
+  std::atomic_store(&currentProvider(), std::move(provider));
+}
+
+std::shared_ptr<CryptoProvider> CryptoProviderFactory::current() { return std::atomic_load(&currentProvider()); }
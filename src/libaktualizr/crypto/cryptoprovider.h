@@ -0,0 +1,86 @@
+#ifndef CRYPTOPROVIDER_H_
+#define CRYPTOPROVIDER_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "crypto/crypto.h"
+#include "libaktualizr/types.h"
+
+/**
+ * Signature and hash operations done somewhere else than in OpenSSL and
+ * libsodium, e.g. on a crypto accelerator of the ECU.
+ *
+ * A provider only implements what its hardware can do; for anything else it
+ * returns nullptr or kUnsupported and the built-in implementation is used.
+ * The built-in implementation is the provider named "openssl". Providers are
+ * registered with AUTO_REGISTER_CRYPTO_PROVIDER and one of them is selected
+ * for the whole process with the `provider` option of the `[crypto]` section.
+ */
+class CryptoProvider {
+ public:
+  enum class Result {
+    kValid,
+    kInvalid,
+    kUnsupported,
+  };
+
+  CryptoProvider() = default;
+  virtual ~CryptoProvider() = default;
+  CryptoProvider(const CryptoProvider &) = delete;
+  CryptoProvider(CryptoProvider &&) = delete;
+  CryptoProvider &operator=(const CryptoProvider &) = delete;
+  CryptoProvider &operator=(CryptoProvider &&) = delete;
+
+  // Hasher for images and metadata
+  virtual MultiPartHasher::Ptr createHasher(Hash::Type hash_type) {
+    (void)hash_type;
+    return nullptr;
+  }
+  // public_key as in PublicKey::Value(): PEM for RSA, hexadecimal for
+  // ED25519; signature is binary
+  virtual Result verify(KeyType key_type, const std::string &public_key, const std::string &signature,
+                        const std::string &message) {
+    (void)key_type;
+    (void)public_key;
+    (void)signature;
+    (void)message;
+    return Result::kUnsupported;
+  }
+  // private_key as it is stored: PEM for RSA, hexadecimal for ED25519.
+  // Returns the binary signature, or an empty string if unsupported.
+  virtual std::string sign(KeyType key_type, const std::string &private_key, const std::string &message) {
+    (void)key_type;
+    (void)private_key;
+    (void)message;
+    return std::string();
+  }
+};
+
+using CryptoProviderBuilder = std::function<CryptoProvider *()>;
+
+class CryptoProviderFactory {
+ public:
+  static constexpr const char *kDefault = "openssl";
+
+  static bool registerProvider(const char *name, CryptoProviderBuilder builder);
+  // Throws if no provider of this name is registered
+  static void select(const std::string &name);
+  // nullptr for the built-in implementation
+  static std::shared_ptr<CryptoProvider> current();
+};
+
+// macro to auto-register a crypto provider
+// note that static library users will have to call `registerProvider` manually
+
+#define AUTO_REGISTER_CRYPTO_PROVIDER(name, clsname)                                          \
+  class clsname##_CryptoRegister_ {                                                           \
+   public:                                                                                    \
+    clsname##_CryptoRegister_() {                                                             \
+      CryptoProviderFactory::registerProvider(name, []() { return new clsname(); });          \
+    }                                                                                         \
+  };                                                                                          \
+  static clsname##_CryptoRegister_ clsname##_register_
+
+#endif  // CRYPTOPROVIDER_H_
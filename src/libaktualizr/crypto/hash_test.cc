@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <boost/algorithm/string/case_conv.hpp>
+
 #include "crypto.h"
 #include "logging/logging.h"
 
@@ -26,6 +28,24 @@ TEST(Hash, DecodeBad) {
   EXPECT_EQ(Hash::decodeVector(bad4), std::vector<Hash>{});
 }
 
+/* Hex hashes are compared case insensitively, and keep their string form. */
+TEST(Hash, HexString) {
+  const std::string hex = "0123456789abcdef0123456789ABCDEF";
+  const Hash hash(Hash::Type::kSha256, hex);
+  EXPECT_EQ(hash.HashString(), "0123456789ABCDEF0123456789ABCDEF");
+  EXPECT_EQ(hash, Hash("sha256", "0123456789ABCDEF0123456789abcdef"));
+  EXPECT_NE(hash, Hash(Hash::Type::kSha512, hex));
+  EXPECT_NE(hash, Hash(Hash::Type::kSha256, hex.substr(1)));
+
+  const Hash generated = Hash::generate(Hash::Type::kSha256, "test");
+  EXPECT_EQ(generated, Hash(Hash::Type::kSha256, Crypto::sha256digestHex("test")));
+  EXPECT_EQ(generated.HashString(), boost::algorithm::to_upper_copy(Crypto::sha256digestHex("test")));
+
+  // not hex
+  EXPECT_EQ(Hash(Hash::Type::kSha256, "hash_good").HashString(), "HASH_GOOD");
+  EXPECT_EQ(Hash(Hash::Type::kSha256, "hash_good"), Hash(Hash::Type::kSha256, "HASH_GOOD"));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
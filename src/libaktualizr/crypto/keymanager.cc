@@ -3,10 +3,12 @@
 #include <stdexcept>
 #include <utility>
 
+#include <boost/algorithm/hex.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/scoped_array.hpp>
 
 #include "crypto/crypto.h"
+#include "crypto/cryptoprovider.h"
 #include "crypto/openssl_compat.h"
 #include "http/httpinterface.h"
 #include "libaktualizr/types.h"
@@ -263,23 +265,72 @@ void KeyManager::copyCertsToCurl(HttpInterface &http) const {
   }
 }
 
-Json::Value KeyManager::signTuf(const Json::Value &in_data) const {
-  ENGINE *crypto_engine = nullptr;
+struct KeyManager::UptaneSigner {
+  std::string key_id;
+  // as stored, for the crypto provider
   std::string private_key;
+  // RSA keys
+  StructGuard<RSA> rsa{nullptr, RSA_free};
+  // ED25519 keys, raw
+  std::string ed25519;
+};
+
+std::shared_ptr<const KeyManager::UptaneSigner> KeyManager::uptaneSigner() const {
+  std::lock_guard<std::mutex> guard(signer_mutex_);
+  if (signer_ == nullptr) {
+    auto signer = std::make_shared<UptaneSigner>();
+    if (config_.uptane_key_source == CryptoSource::kPkcs11) {
+      // the private key stays on the token
+      signer->key_id = UptanePublicKey().KeyId();
+      signer_ = std::move(signer);
+      return signer_;
+    }
+    std::string primary_public;
+    std::string primary_private;
+    if (!backend_->loadPrimaryKeys(&primary_public, &primary_private)) {
+      throw std::runtime_error("Could not get Uptane keys!");
+    }
+    signer->key_id = PublicKey(primary_public, config_.uptane_key_type).KeyId();
+    signer->private_key = primary_private;
+    if (config_.uptane_key_type == KeyType::kED25519) {
+      signer->ed25519 = boost::algorithm::unhex(primary_private);
+    } else {
+      signer->rsa = Crypto::parseRSAPrivateKey(primary_private);
+    }
+    signer_ = std::move(signer);
+  }
+  return signer_;
+}
+
+Json::Value KeyManager::signTuf(const Json::Value &in_data) const {
+  const std::string message = Utils::jsonToCanonicalStr(in_data);
+  std::string b64sig;
   if (config_.uptane_key_source == CryptoSource::kPkcs11) {
     if (!built_with_p11) {
       throw std::runtime_error("Aktualizr was built without PKCS#11");
     }
-    crypto_engine = (*p11_)->getEngine();
-    private_key = config_.p11.uptane_key_id;
+    if (config_.uptane_key_type == KeyType::kED25519) {
+      b64sig = Utils::toBase64(
+          Crypto::Sign(config_.uptane_key_type, (*p11_)->getEngine(), config_.p11.uptane_key_id, message));
+    } else {
+      b64sig = Utils::toBase64((*p11_)->signRsaPss(config_.p11.uptane_key_id, message));
+    }
   }
-
-  std::string b64sig;
-  if (config_.uptane_key_source == CryptoSource::kFile) {
-    backend_->loadPrimaryPrivate(&private_key);
+  const std::shared_ptr<const UptaneSigner> signer = uptaneSigner();
+  if (config_.uptane_key_source != CryptoSource::kPkcs11) {
+    const std::shared_ptr<CryptoProvider> provider = CryptoProviderFactory::current();
+    std::string offloaded;
+    if (provider != nullptr) {
+      offloaded = provider->sign(config_.uptane_key_type, signer->private_key, message);
+    }
+    if (!offloaded.empty()) {
+      b64sig = Utils::toBase64(offloaded);
+    } else if (config_.uptane_key_type == KeyType::kED25519) {
+      b64sig = Utils::toBase64(Crypto::ED25519Sign(signer->ed25519, message));
+    } else {
+      b64sig = Utils::toBase64(Crypto::RSAPSSSign(signer->rsa.get(), message));
+    }
   }
-  b64sig = Utils::toBase64(
-      Crypto::Sign(config_.uptane_key_type, crypto_engine, private_key, Utils::jsonToCanonicalStr(in_data)));
 
   Json::Value signature;
   switch (config_.uptane_key_type) {
@@ -297,7 +348,7 @@ Json::Value KeyManager::signTuf(const Json::Value &in_data) const {
   signature["sig"] = b64sig;
 
   Json::Value out_data;
-  signature["keyid"] = UptanePublicKey().KeyId();
+  signature["keyid"] = signer->key_id;
   out_data["signed"] = in_data;
   out_data["signatures"] = Json::Value(Json::arrayValue);
   out_data["signatures"].append(signature);
@@ -306,7 +357,6 @@ Json::Value KeyManager::signTuf(const Json::Value &in_data) const {
 
 std::string KeyManager::generateUptaneKeyPair() {
   std::string primary_public;
-
   if (config_.uptane_key_source == CryptoSource::kFile) {
     std::string primary_private;
     if (!backend_->loadPrimaryKeys(&primary_public, &primary_private)) {
@@ -318,6 +368,12 @@ std::string KeyManager::generateUptaneKeyPair() {
     if (primary_public.empty() && primary_private.empty()) {
       throw std::runtime_error("Could not get Uptane keys");
     }
+    // keep the parsed key unless the keys have changed, so that calling this
+    // again on every provisioning attempt is cheap
+    std::lock_guard<std::mutex> guard(signer_mutex_);
+    if (signer_ != nullptr && signer_->private_key != primary_private) {
+      signer_.reset();
+    }
   } else {
     if (!built_with_p11) {
       throw std::runtime_error("Aktualizr was built without PKCS#11 support!");
@@ -325,6 +381,8 @@ std::string KeyManager::generateUptaneKeyPair() {
     // dummy read to check if the key is present
     if (!(*p11_)->readUptanePublicKey(config_.p11.uptane_key_id, &primary_public)) {
       (*p11_)->generateUptaneKeyPair(config_.p11.uptane_key_id);
+      std::lock_guard<std::mutex> guard(signer_mutex_);
+      signer_.reset();
     }
     // really read the key
     if (primary_public.empty() && !(*p11_)->readUptanePublicKey(config_.p11.uptane_key_id, &primary_public)) {
@@ -2,6 +2,7 @@
 #define KEYMANAGER_H_
 
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include "json/json.h"
@@ -45,6 +46,12 @@ class KeyManager {
   std::unique_ptr<TemporaryFile> tmp_pkey_file;
   std::unique_ptr<TemporaryFile> tmp_cert_file;
   std::unique_ptr<TemporaryFile> tmp_ca_file;
+  // The Uptane private key from the storage, decoded for signTuf() on first
+  // use, and its ID; only the ID when the key is on a PKCS#11 token
+  struct UptaneSigner;
+  std::shared_ptr<const UptaneSigner> uptaneSigner() const;
+  mutable std::mutex signer_mutex_;
+  mutable std::shared_ptr<const UptaneSigner> signer_;
 };
 
 #endif  // KEYMANAGER_H_
@@ -1,5 +1,6 @@
 #include "p11engine.h"
 
+#include <algorithm>
 #include <array>
 #include <utility>
 #include <vector>
@@ -130,6 +131,8 @@ P11Engine::P11Engine(boost::filesystem::path module_path, std::string pass)
 }
 
 P11Engine::~P11Engine() {
+  // the keys need the engine
+  rsa_keys_.clear();
   if (ssl_engine_ != nullptr) {
     ENGINE_finish(ssl_engine_);
     ENGINE_free(ssl_engine_);
@@ -248,6 +251,11 @@ bool P11Engine::generateUptaneKeyPair(const std::string& uptane_key_id) {
     return false;
   }
 
+  {
+    // a key of the same ID may be loaded already
+    std::lock_guard<std::mutex> guard(keys_mutex_);
+    rsa_keys_.erase(uptane_key_id);
+  }
   if (PKCS11_store_private_key(slot->token, pkey.get(), nullptr, id_hex.data(), id_hex.size()) != 0) {
     LOG_ERROR << "Could not store private key on the token";
     return false;
@@ -309,3 +317,50 @@ bool P11Engine::readTlsCert(const std::string& id, std::string* cert_out) const
 
   return true;
 }
+
+std::shared_ptr<RSA> P11Engine::rsaKey(const std::string& key_id) {
+  std::lock_guard<std::mutex> guard(keys_mutex_);
+  auto found = rsa_keys_.find(key_id);
+  if (found != rsa_keys_.end()) {
+    return found->second;
+  }
+
+  // TODO(OTA-2138): this call leaks memory somehow...
+  StructGuard<EVP_PKEY> key(ENGINE_load_private_key(ssl_engine_, key_id.c_str(), nullptr, nullptr), EVP_PKEY_free);
+  if (key == nullptr) {
+    LOG_ERROR << "ENGINE_load_private_key failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return nullptr;
+  }
+  std::shared_ptr<RSA> rsa(EVP_PKEY_get1_RSA(key.get()), RSA_free);
+  if (rsa == nullptr) {
+    LOG_ERROR << "EVP_PKEY_get1_RSA failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return nullptr;
+  }
+  ++stats_.key_loads;
+  rsa_keys_.emplace(key_id, rsa);
+  return rsa;
+}
+
+std::string P11Engine::signRsaPss(const std::string& key_id, const std::string& message) {
+  const auto start = std::chrono::steady_clock::now();
+  std::string signature;
+  {
+    const std::shared_ptr<RSA> rsa = rsaKey(key_id);
+    if (rsa != nullptr) {
+      signature = Crypto::RSAPSSSign(rsa.get(), message);
+    }
+  }
+  const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+  LOG_DEBUG << "PKCS#11 signature took " << elapsed.count() / 1000. << " ms";
+
+  std::lock_guard<std::mutex> guard(keys_mutex_);
+  ++stats_.signatures;
+  stats_.total += elapsed;
+  stats_.max = std::max(stats_.max, elapsed);
+  return signature;
+}
+
+P11Engine::SignStats P11Engine::signStats() const {
+  std::lock_guard<std::mutex> guard(keys_mutex_);
+  return stats_;
+}
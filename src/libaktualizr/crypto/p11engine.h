@@ -1,7 +1,10 @@
 #ifndef P11ENGINE_H_
 #define P11ENGINE_H_
 
+#include <chrono>
+#include <map>
 #include <memory>
+#include <mutex>
 
 #include "libaktualizr/config.h"
 
@@ -59,6 +62,21 @@ class P11Engine {
   bool readTlsCert(const std::string &id, std::string *cert_out) const;
   bool generateUptaneKeyPair(const std::string &uptane_key_id);
 
+  // Signs with RSA-PSS and the private key of this ID. The key is loaded
+  // through the engine on first use and kept, and with it the session that
+  // libp11 logged in for it; libp11 serializes the signatures on a session,
+  // so signing from several threads at once is safe.
+  std::string signRsaPss(const std::string &key_id, const std::string &message);
+
+  // Time spent in signRsaPss(), token round-trips included
+  struct SignStats {
+    uint64_t signatures{0};
+    uint64_t key_loads{0};
+    std::chrono::microseconds total{0};
+    std::chrono::microseconds max{0};
+  };
+  SignStats signStats() const;
+
  private:
   const boost::filesystem::path module_path_;
   const std::string pass_;
@@ -66,9 +84,14 @@ class P11Engine {
   std::string uri_prefix_;
   P11ContextWrapper ctx_;
   P11SlotsWrapper wslots_;
+  mutable std::mutex keys_mutex_;
+  // private keys loaded through the engine, by ID
+  std::map<std::string, std::shared_ptr<RSA>> rsa_keys_;
+  SignStats stats_;
 
   static boost::filesystem::path findPkcsLibrary();
   PKCS11_slot_st *findTokenSlot() const;
+  std::shared_ptr<RSA> rsaKey(const std::string &key_id);
 
   explicit P11Engine(boost::filesystem::path module_path, std::string pass);
 
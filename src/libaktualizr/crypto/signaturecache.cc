@@ -0,0 +1,78 @@
+#include "signaturecache.h"
+
+SignatureCache &SignatureCache::instance() {
+  static SignatureCache cache;
+  return cache;
+}
+
+std::string SignatureCache::keyIdentity(const PublicKey &key) {
+  return std::to_string(static_cast<int>(key.Type())) + ":" + key.Value();
+}
+
+bool SignatureCache::contains(const PublicKey &key, const std::string &signature,
+                              const std::string &message_digest) {
+  const std::string id = keyIdentity(key) + '\0' + signature + '\0' + message_digest;
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = index_.find(id);
+  if (it == index_.end()) {
+    ++misses_;
+    return false;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  ++hits_;
+  return true;
+}
+
+void SignatureCache::insert(const PublicKey &key, const std::string &signature, const std::string &message_digest) {
+  if (capacity_ == 0) {
+    return;
+  }
+  std::string key_id = keyIdentity(key);
+  std::string id = key_id + '\0' + signature + '\0' + message_digest;
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = index_.find(id);
+  if (it != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return;
+  }
+  if (lru_.size() >= capacity_) {
+    index_.erase(lru_.back().id);
+    lru_.pop_back();
+  }
+  lru_.push_front(Entry{std::move(key_id), id});
+  index_.emplace(std::move(id), lru_.begin());
+}
+
+void SignatureCache::forgetKey(const PublicKey &key) {
+  const std::string key_id = keyIdentity(key);
+  std::lock_guard<std::mutex> lock(m_);
+  for (auto it = lru_.begin(); it != lru_.end();) {
+    if (it->key_id == key_id) {
+      index_.erase(it->id);
+      it = lru_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void SignatureCache::clear() {
+  std::lock_guard<std::mutex> lock(m_);
+  lru_.clear();
+  index_.clear();
+}
+
+size_t SignatureCache::size() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return lru_.size();
+}
+
+uint64_t SignatureCache::hits() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return hits_;
+}
+
+uint64_t SignatureCache::misses() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return misses_;
+}
@@ -0,0 +1,58 @@
+#ifndef SIGNATURECACHE_H_
+#define SIGNATURECACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "libaktualizr/types.h"
+
+/**
+ * Bounded LRU cache of good signatures, so that metadata loaded again (e.g.
+ * from the storage after it was fetched) doesn't need another public key
+ * operation.
+ *
+ * An entry is the key, the signature and the SHA-256 of the signed message.
+ * Only successful verifications are recorded. Whether the key may sign the
+ * message is still up to the caller; dropping a key with forgetKey() makes
+ * sure that nothing it verified is reused.
+ */
+class SignatureCache {
+ public:
+  static constexpr size_t kDefaultCapacity = 256;
+
+  explicit SignatureCache(size_t capacity = kDefaultCapacity) : capacity_(capacity) {}
+
+  // the cache PublicKey::VerifySignature() uses
+  static SignatureCache &instance();
+
+  bool contains(const PublicKey &key, const std::string &signature, const std::string &message_digest);
+  void insert(const PublicKey &key, const std::string &signature, const std::string &message_digest);
+  // forget all the signatures of a key, e.g. when it is revoked
+  void forgetKey(const PublicKey &key);
+  void clear();
+
+  size_t size() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+
+ private:
+  struct Entry {
+    std::string key_id;
+    std::string id;
+  };
+
+  static std::string keyIdentity(const PublicKey &key);
+
+  const size_t capacity_;
+  mutable std::mutex m_;
+  // most recently used first
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+};
+
+#endif  // SIGNATURECACHE_H_
@@ -0,0 +1,182 @@
+#include "curlmultiloop.h"
+
+#include <algorithm>
+
+#include "logging/logging.h"
+#include "utilities/thread_policy.h"
+
+// Upper bound on how long a new transfer can wait to be picked up while other
+// transfers are running.
+static constexpr int kMultiWaitMs = 100;
+
+static HttpResponse cancelledResponse() {
+  return HttpResponse("", 0, CURLE_FAILED_INIT, "Transfer cancelled: the HTTP client was destroyed");
+}
+
+CurlMultiLoop::CurlMultiLoop(std::shared_ptr<CurlShare> share) : share_(std::move(share)) {
+  multi_ = curl_multi_init();
+  if (multi_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl multi handle");
+  }
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+}
+
+CurlMultiLoop::~CurlMultiLoop() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    shutdown_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  // the thread has already cancelled the running transfers
+  for (auto &t : pending_) {
+    t.promise.set_value(cancelledResponse());
+  }
+  curl_multi_cleanup(multi_);
+}
+
+std::future<HttpResponse> CurlMultiLoop::add(CurlHandler handle) { return add(std::move(handle), nullptr, nullptr); }
+
+std::future<HttpResponse> CurlMultiLoop::add(CurlHandler handle, curl_write_callback write_cb, void *write_data) {
+  Transfer transfer{std::move(handle), std::promise<HttpResponse>(), write_cb, write_data, nullptr};
+  auto future = transfer.promise.get_future();
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    if (shutdown_) {
+      transfer.promise.set_value(cancelledResponse());
+      return future;
+    }
+    pending_.push_back(std::move(transfer));
+    if (!thread_.joinable()) {
+      thread_ = std::thread(&CurlMultiLoop::run, this);
+    }
+  }
+  cv_.notify_all();
+  return future;
+}
+
+void CurlMultiLoop::setRateLimiter(std::shared_ptr<RateLimiter> limiter) {
+  std::lock_guard<std::mutex> lock(m_);
+  limiter_ = std::move(limiter);
+}
+
+std::shared_ptr<RateLimiter> CurlMultiLoop::rateLimiter() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return limiter_;
+}
+
+size_t CurlMultiLoop::throttledWrite(char *contents, size_t size, size_t nmemb, void *userp) {
+  auto *t = static_cast<Transfer *>(userp);
+  if (t->limiter != nullptr && !t->limiter->consume(size * nmemb)) {
+    t->paused = true;
+    return CURL_WRITEFUNC_PAUSE;
+  }
+  return t->write_cb(contents, size, nmemb, t->write_data);
+}
+
+void CurlMultiLoop::run() {
+  ThreadPolicies::instance().apply(ThreadPolicies::Worker::kDownload);
+  std::unique_lock<std::mutex> lock(m_);
+  while (!shutdown_) {
+    if (pending_.empty() && running_.empty()) {
+      cv_.wait(lock, [this] { return shutdown_ || !pending_.empty(); });
+      continue;
+    }
+    startPending();
+
+    // Transfer callbacks are called from curl_multi_perform(), don't hold the
+    // lock while they run.
+    lock.unlock();
+    int still_running = 0;
+    CURLMcode mc = curl_multi_perform(multi_, &still_running);
+    if (mc != CURLM_OK) {
+      LOG_ERROR << "curl_multi_perform failed: " << curl_multi_strerror(mc);
+    }
+    collectFinished();
+    const int wait_ms = resumeThrottled();
+    if (still_running > 0) {
+      mc = curl_multi_wait(multi_, nullptr, 0, wait_ms, nullptr);
+      if (mc != CURLM_OK) {
+        LOG_ERROR << "curl_multi_wait failed: " << curl_multi_strerror(mc);
+      }
+    }
+    lock.lock();
+  }
+
+  for (auto &t : running_) {
+    curl_multi_remove_handle(multi_, t.first);
+    t.second.promise.set_value(cancelledResponse());
+  }
+  running_.clear();
+}
+
+// must be called with m_ held
+void CurlMultiLoop::startPending() {
+  while (!pending_.empty()) {
+    Transfer t = std::move(pending_.front());
+    pending_.pop_front();
+    CURL *easy = t.handle.get();
+    // wait for an existing HTTP/2 connection to the same host rather than
+    // opening a new one
+    curlEasySetoptWrapper(easy, CURLOPT_PIPEWAIT, 1L);
+    // map nodes are stable, the transfer can be handed to the callback
+    Transfer &running = running_.emplace(easy, std::move(t)).first->second;
+    if (running.write_cb != nullptr) {
+      running.limiter = limiter_;
+      curlEasySetoptWrapper(easy, CURLOPT_WRITEFUNCTION, throttledWrite);
+      curlEasySetoptWrapper(easy, CURLOPT_WRITEDATA, &running);
+    }
+    const CURLMcode mc = curl_multi_add_handle(multi_, easy);
+    if (mc != CURLM_OK) {
+      running.promise.set_value(HttpResponse("", 0, CURLE_FAILED_INIT, curl_multi_strerror(mc)));
+      running_.erase(easy);
+    }
+  }
+}
+
+void CurlMultiLoop::collectFinished() {
+  int msgs_left = 0;
+  CURLMsg *msg;
+  while ((msg = curl_multi_info_read(multi_, &msgs_left)) != nullptr) {
+    if (msg->msg != CURLMSG_DONE) {
+      continue;
+    }
+    CURL *easy = msg->easy_handle;
+    const CURLcode result = msg->data.result;
+    long http_code = 0;  // NOLINT(google-runtime-int)
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+    if (share_ != nullptr) {
+      share_->recordTransfer(easy);
+    }
+    curl_multi_remove_handle(multi_, easy);
+
+    auto it = running_.find(easy);
+    if (it == running_.end()) {
+      LOG_ERROR << "Finished transfer is unknown to the curl multi loop";
+      continue;
+    }
+    it->second.promise.set_value(
+        HttpResponse("", http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : ""));
+    running_.erase(it);
+  }
+}
+
+int CurlMultiLoop::resumeThrottled() {
+  int64_t wait_ms = kMultiWaitMs;
+  for (auto &t : running_) {
+    if (!t.second.paused) {
+      continue;
+    }
+    const int64_t limiter_wait = t.second.limiter->waitTime().count();
+    if (limiter_wait > 0) {
+      wait_ms = std::min(wait_ms, limiter_wait);
+      continue;
+    }
+    t.second.paused = false;
+    // may call the write callback right away, which can pause it again
+    curl_easy_pause(t.first, CURLPAUSE_CONT);
+  }
+  return static_cast<int>(wait_ms);
+}
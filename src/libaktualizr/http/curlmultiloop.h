@@ -0,0 +1,88 @@
+#ifndef CURLMULTILOOP_H_
+#define CURLMULTILOOP_H_
+
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <curl/curl.h>
+
+#include "curlshare.h"
+#include "httpinterface.h"
+#include "ratelimiter.h"
+
+/**
+ * Drives any number of curl easy handles from a single thread with a CURLM
+ * multi handle.
+ *
+ * All transfers added to the same loop share its connection cache, so TLS
+ * sessions and connections are reused between them, and HTTP/2 transfers to
+ * the same server are multiplexed over a single connection. The thread is only
+ * started when the first transfer is added and is stopped on destruction;
+ * transfers still running at that point are cancelled. If a share is given,
+ * finished transfers are recorded in its connection statistics.
+ *
+ * With a rate limiter, transfers are paused (CURL_WRITEFUNC_PAUSE) while its
+ * bucket is empty, and resumed by the loop once tokens are available again.
+ */
+class CurlMultiLoop {
+ public:
+  explicit CurlMultiLoop(std::shared_ptr<CurlShare> share = nullptr);
+  ~CurlMultiLoop();
+  CurlMultiLoop(const CurlMultiLoop &) = delete;
+  CurlMultiLoop(CurlMultiLoop &&) = delete;
+  CurlMultiLoop &operator=(const CurlMultiLoop &) = delete;
+  CurlMultiLoop &operator=(CurlMultiLoop &&) = delete;
+
+  /**
+   * Start a transfer. The handle is kept alive until the transfer is done.
+   * @return The response, without body (the data goes to the write callback of
+   *         the handle).
+   */
+  std::future<HttpResponse> add(CurlHandler handle);
+  /**
+   * Start a transfer whose data goes to `write_cb`, throttled by the rate
+   * limiter if there is one.
+   */
+  std::future<HttpResponse> add(CurlHandler handle, curl_write_callback write_cb, void *write_data);
+
+  void setRateLimiter(std::shared_ptr<RateLimiter> limiter);
+  std::shared_ptr<RateLimiter> rateLimiter() const;
+
+ private:
+  struct Transfer {
+    CurlHandler handle;
+    std::promise<HttpResponse> promise;
+    curl_write_callback write_cb{nullptr};
+    void *write_data{nullptr};
+    // set when the transfer is started
+    std::shared_ptr<RateLimiter> limiter;
+    bool paused{false};
+  };
+
+  static size_t throttledWrite(char *contents, size_t size, size_t nmemb, void *userp);
+  void run();
+  void startPending();
+  void collectFinished();
+  // resume paused transfers if possible, returns how long the loop may wait
+  int resumeThrottled();
+
+  CURLM *multi_;
+  std::shared_ptr<CurlShare> share_;
+  std::shared_ptr<RateLimiter> limiter_;
+  std::thread thread_;
+  mutable std::mutex m_;
+  std::condition_variable cv_;
+  bool shutdown_{false};
+  // transfers added by add() but not yet handed over to the multi handle
+  std::list<Transfer> pending_;
+  // only accessed from the loop thread
+  std::map<CURL *, Transfer> running_;
+};
+
+#endif  // CURLMULTILOOP_H_
@@ -0,0 +1,69 @@
+#include "curlshare.h"
+
+#include <stdexcept>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+CurlShare::CurlShare() {
+  share_ = curl_share_init();
+  if (share_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl share handle");
+  }
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &CurlShare::lock);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &CurlShare::unlock);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  // sharing the connection pool is only supported since curl 7.57.0
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+CurlShare::~CurlShare() {
+  const ConnectionStats s = stats();
+  if (s.transfers > 0) {
+    LOG_DEBUG << "HTTP connections reused for " << s.reused << " of " << s.transfers << " transfers";
+  }
+  curl_share_cleanup(share_);
+}
+
+void CurlShare::attach(CURL *handle) { curlEasySetoptWrapper(handle, CURLOPT_SHARE, share_); }
+
+void CurlShare::recordTransfer(CURL *handle) {
+  long new_connections = 0;  // NOLINT(google-runtime-int)
+  if (curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &new_connections) != CURLE_OK) {
+    return;
+  }
+  ++transfers_;
+  if (new_connections == 0) {
+    ++reused_;
+  }
+}
+
+ConnectionStats CurlShare::stats() const {
+  ConnectionStats s;
+  s.transfers = transfers_;
+  s.reused = reused_;
+  return s;
+}
+
+void CurlShare::recordRetryAfter(const std::chrono::seconds delay) {
+  retry_after_ = (std::chrono::steady_clock::now() + delay).time_since_epoch().count();
+}
+
+std::chrono::steady_clock::time_point CurlShare::retryAfter() const {
+  return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(retry_after_.load()));
+}
+
+void CurlShare::lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+  (void)handle;
+  (void)access;
+  static_cast<CurlShare *>(userptr)->locks_.at(static_cast<size_t>(data)).lock();
+}
+
+void CurlShare::unlock(CURL *handle, curl_lock_data data, void *userptr) {
+  (void)handle;
+  static_cast<CurlShare *>(userptr)->locks_.at(static_cast<size_t>(data)).unlock();
+}
@@ -0,0 +1,59 @@
+#ifndef CURLSHARE_H_
+#define CURLSHARE_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include <curl/curl.h>
+
+struct ConnectionStats {
+  uint64_t transfers{0};
+  // transfers that went over an already open connection
+  uint64_t reused{0};
+
+  double reuseRate() const {
+    return transfers == 0 ? 0. : static_cast<double>(reused) / static_cast<double>(transfers);
+  }
+};
+
+/**
+ * Wrapper around a CURLSH share handle.
+ *
+ * Easy handles attached to the same share use a common DNS cache, TLS session
+ * cache and connection pool, so consecutive requests to the same server, even
+ * from different copies of an HttpClient, can skip the TCP and TLS handshakes.
+ * Also counts how many of the transfers reused a connection, and keeps the
+ * latest Retry-After of the server.
+ */
+class CurlShare {
+ public:
+  CurlShare();
+  ~CurlShare();
+  CurlShare(const CurlShare &) = delete;
+  CurlShare(CurlShare &&) = delete;
+  CurlShare &operator=(const CurlShare &) = delete;
+  CurlShare &operator=(CurlShare &&) = delete;
+
+  void attach(CURL *handle);
+  // to be called once a transfer on a handle attached to this share is done
+  void recordTransfer(CURL *handle);
+  ConnectionStats stats() const;
+  // the server asked not to be sent requests for `delay` from now on
+  void recordRetryAfter(std::chrono::seconds delay);
+  std::chrono::steady_clock::time_point retryAfter() const;
+
+ private:
+  static void lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+  static void unlock(CURL *handle, curl_lock_data data, void *userptr);
+
+  CURLSH *share_;
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> locks_;
+  std::atomic<uint64_t> transfers_{0};
+  std::atomic<uint64_t> reused_{0};
+  std::atomic<std::chrono::steady_clock::rep> retry_after_{0};
+};
+
+#endif  // CURLSHARE_H_
@@ -1,13 +1,27 @@
 #include "httpclient.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <ctime>
 #include <sstream>
+#include <thread>
 
+#include <boost/algorithm/string.hpp>
+
+#include "utilities/memory_budget.h"
 #include "utilities/utils.h"
 
 struct WriteStringArg {
   std::string out;
   int64_t limit{0};
+  // if set, the data goes there instead of `out`
+  const HttpBodySink* sink{nullptr};
+  uint64_t received{0};
+  // what `out` takes while it is received
+  MemoryBudget::Reservation memory{MemoryBudget::instance().reservation(MemoryBudget::User::kHttp)};
+  HttpCacheValidators validators;
+  std::chrono::seconds retry_after{0};
 };
 
 /*****************************************************************************/
@@ -24,16 +38,70 @@ static size_t writeString(void* contents, size_t size, size_t nmemb, void* userp
   // append the writeback data to the provided string
   auto* arg = static_cast<WriteStringArg*>(userp);
   if (arg->limit > 0) {
-    if (arg->out.length() + size * nmemb > static_cast<uint64_t>(arg->limit)) {
+    if (arg->received + size * nmemb > static_cast<uint64_t>(arg->limit)) {
       return 0;
     }
   }
-  (static_cast<WriteStringArg*>(userp))->out.append(static_cast<char*>(contents), size * nmemb);
+  arg->received += size * nmemb;
+  if (arg->sink != nullptr) {
+    return (*arg->sink)(static_cast<char*>(contents), size * nmemb) ? size * nmemb : 0;
+  }
+  if (!arg->memory.grow(size * nmemb)) {
+    LOG_WARNING << "HTTP response exceeds the memory budget";
+    return 0;
+  }
+  arg->out.append(static_cast<char*>(contents), size * nmemb);
 
   // return size of written data
   return size * nmemb;
 }
 
+// Retry-After is either a number of seconds or an HTTP date (RFC 7231).
+static std::chrono::seconds parseRetryAfter(const std::string& value) {
+  if (!value.empty() && std::all_of(value.begin(), value.end(), ::isdigit)) {
+    try {
+      return std::chrono::seconds(std::stoll(value));
+    } catch (const std::out_of_range&) {
+      return std::chrono::seconds(0);
+    }
+  }
+  const time_t date = curl_getdate(value.c_str(), nullptr);
+  const time_t now = time(nullptr);
+  return std::chrono::seconds(date > now ? date - now : 0);
+}
+
+// Pick the cache validators and the Retry-After out of the response headers.
+static size_t readHeader(char* buffer, size_t size, size_t nitems, void* userp) {
+  auto* arg = static_cast<WriteStringArg*>(userp);
+  const std::string line(buffer, size * nitems);
+  const auto colon = line.find(':');
+  if (colon != std::string::npos) {
+    const std::string name = boost::algorithm::to_lower_copy(line.substr(0, colon));
+    if (name == "etag") {
+      arg->validators.etag = boost::algorithm::trim_copy(line.substr(colon + 1));
+    } else if (name == "last-modified") {
+      arg->validators.last_modified = boost::algorithm::trim_copy(line.substr(colon + 1));
+    } else if (name == "retry-after") {
+      arg->retry_after = parseRetryAfter(boost::algorithm::trim_copy(line.substr(colon + 1)));
+    }
+  } else if (line.compare(0, 5, "HTTP/") == 0) {
+    // a new response starts, e.g. after a redirect
+    arg->validators = HttpCacheValidators();
+    arg->retry_after = std::chrono::seconds(0);
+  }
+  return size * nitems;
+}
+
+#ifdef CURL_HAS_TLS_BLOBS
+// curl keeps a copy of the data, which goes along to the handles duplicated
+// from this one.
+static void setBlob(CURL* handle, CURLoption option, const std::string& data) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+  curl_blob blob{const_cast<char*>(data.data()), data.size(), CURL_BLOB_COPY};
+  curlEasySetoptWrapper(handle, option, &blob);
+}
+#endif
+
 static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
   (void)dltotal;
   (void)dlnow;
@@ -58,12 +126,14 @@ static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
   return 0;
 }
 
-HttpClient::HttpClient(const std::vector<std::string>* extra_headers) {
+HttpClient::HttpClient(const std::vector<std::string>* extra_headers)
+    : share_(std::make_shared<CurlShare>()),
+      multi_loop_(std::make_shared<CurlMultiLoop>(share_)),
+      retry_policy_(std::make_shared<RetryPolicy>()) {
   curl = curl_easy_init();
   if (curl == nullptr) {
     throw std::runtime_error("Could not initialize curl");
   }
-  headers = nullptr;
 
   curlEasySetoptWrapper(curl, CURLOPT_NOSIGNAL, 1L);
   curlEasySetoptWrapper(curl, CURLOPT_TIMEOUT, 60L);
@@ -80,14 +150,16 @@ HttpClient::HttpClient(const std::vector<std::string>* extra_headers) {
 
   curlEasySetoptWrapper(curl, CURLOPT_VERBOSE, get_curlopt_verbose());
 
-  headers = curl_slist_append(headers, "Accept: */*");
+  curl_slist* header_list = curl_slist_append(nullptr, "Accept: */*");
 
   if (extra_headers != nullptr) {
     for (const auto& header : *extra_headers) {
-      headers = curl_slist_append(headers, header.c_str());
+      header_list = curl_slist_append(header_list, header.c_str());
     }
   }
+  headers = std::shared_ptr<curl_slist>(header_list, curl_slist_free_all);
   curlEasySetoptWrapper(curl, CURLOPT_USERAGENT, Utils::getUserAgent());
+  share_->attach(curl);
 }
 
 HttpClient::HttpClient(const std::string& socket) : HttpClient() {
@@ -95,20 +167,69 @@ HttpClient::HttpClient(const std::string& socket) : HttpClient() {
 }
 
 HttpClient::HttpClient(const HttpClient& curl_in)
-    : HttpInterface(curl_in), pkcs11_key(curl_in.pkcs11_key), pkcs11_cert(curl_in.pkcs11_key) {
+    : HttpInterface(curl_in),
+      share_(curl_in.share_),
+      multi_loop_(curl_in.multi_loop_),
+      retry_policy_(curl_in.retry_policy_),
+      pkcs11_key(curl_in.pkcs11_key),
+      pkcs11_cert(curl_in.pkcs11_key) {
+  std::lock_guard<std::mutex> guard(curl_in.mutex_);
   curl = curl_easy_duphandle(curl_in.curl);
-  headers = curl_slist_dup(curl_in.headers);
+  share_->attach(curl);
+  headers = curl_in.headers;
 }
 
 const CurlGlobalInitWrapper HttpClient::manageCurlGlobalInit_{};
 
 HttpClient::~HttpClient() {
-  curl_slist_free_all(headers);
+  for (CURL* handle : idle_handles_) {
+    curl_easy_cleanup(handle);
+  }
   curl_easy_cleanup(curl);
 }
 
+HttpClient::PooledHandle::PooledHandle(const HttpClient& client) : client_(client) {
+  std::lock_guard<std::mutex> guard(client_.mutex_);
+  generation_ = client_.generation_;
+  headers_ = client_.headers;
+  if (client_.idle_handles_.empty()) {
+    handle_ = client_.dupHandle();
+  } else {
+    handle_ = client_.idle_handles_.back();
+    client_.idle_handles_.pop_back();
+  }
+}
+
+HttpClient::PooledHandle::~PooledHandle() {
+  // Back to how the template is set up; the connection, DNS and TLS session
+  // caches stay, which is the point of keeping the handle.
+  curl_easy_setopt(handle_, CURLOPT_HTTPGET, 1L);
+  curl_easy_setopt(handle_, CURLOPT_CUSTOMREQUEST, nullptr);
+  curl_easy_setopt(handle_, CURLOPT_POSTFIELDS, nullptr);
+  curl_easy_setopt(handle_, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(-1));
+  curl_easy_setopt(handle_, CURLOPT_HTTPHEADER, nullptr);
+  curl_easy_setopt(handle_, CURLOPT_ACCEPT_ENCODING, nullptr);
+  curl_easy_setopt(handle_, CURLOPT_MAXFILESIZE_LARGE, static_cast<curl_off_t>(0));
+  curl_easy_setopt(handle_, CURLOPT_NOPROGRESS, 1L);
+  curl_easy_setopt(handle_, CURLOPT_XFERINFOFUNCTION, nullptr);
+  curl_easy_setopt(handle_, CURLOPT_XFERINFODATA, nullptr);
+  curl_easy_setopt(handle_, CURLOPT_WRITEDATA, nullptr);
+  curl_easy_setopt(handle_, CURLOPT_HEADERFUNCTION, nullptr);
+  curl_easy_setopt(handle_, CURLOPT_HEADERDATA, nullptr);
+  {
+    std::lock_guard<std::mutex> guard(client_.mutex_);
+    if (generation_ == client_.generation_ && client_.idle_handles_.size() < kMaxIdleHandles) {
+      client_.idle_handles_.push_back(handle_);
+      return;
+    }
+  }
+  curl_easy_cleanup(handle_);
+}
+
 void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert,
                           CryptoSource cert_source, const std::string& pkey, CryptoSource pkey_source) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  dropIdleHandles();
   curlEasySetoptWrapper(curl, CURLOPT_SSL_VERIFYPEER, 1);
   curlEasySetoptWrapper(curl, CURLOPT_SSL_VERIFYHOST, 2);
   curlEasySetoptWrapper(curl, CURLOPT_USE_SSL, CURLUSESSL_ALL);
@@ -116,20 +237,28 @@ void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const s
   if (ca_source == CryptoSource::kPkcs11) {
     throw std::runtime_error("Accessing CA certificate on PKCS11 devices isn't currently supported");
   }
+#ifdef CURL_HAS_TLS_BLOBS
+  setBlob(curl, CURLOPT_CAINFO_BLOB, ca);
+#else
   std::unique_ptr<TemporaryFile> tmp_ca_file = std_::make_unique<TemporaryFile>("tls-ca");
   tmp_ca_file->PutContents(ca);
   curlEasySetoptWrapper(curl, CURLOPT_CAINFO, tmp_ca_file->Path().c_str());
   tls_ca_file = std::move_if_noexcept(tmp_ca_file);
+#endif
 
   if (cert_source == CryptoSource::kPkcs11) {
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERT, cert.c_str());
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERTTYPE, "ENG");
   } else {  // cert_source == CryptoSource::kFile
+#ifdef CURL_HAS_TLS_BLOBS
+    setBlob(curl, CURLOPT_SSLCERT_BLOB, cert);
+#else
     std::unique_ptr<TemporaryFile> tmp_cert_file = std_::make_unique<TemporaryFile>("tls-cert");
     tmp_cert_file->PutContents(cert);
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERT, tmp_cert_file->Path().c_str());
-    curlEasySetoptWrapper(curl, CURLOPT_SSLCERTTYPE, "PEM");
     tls_cert_file = std::move_if_noexcept(tmp_cert_file);
+#endif
+    curlEasySetoptWrapper(curl, CURLOPT_SSLCERTTYPE, "PEM");
   }
   pkcs11_cert = (cert_source == CryptoSource::kPkcs11);
 
@@ -139,19 +268,51 @@ void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const s
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEY, pkey.c_str());
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEYTYPE, "ENG");
   } else {  // pkey_source == CryptoSource::kFile
+#ifdef CURL_HAS_TLS_BLOBS
+    setBlob(curl, CURLOPT_SSLKEY_BLOB, pkey);
+#else
     std::unique_ptr<TemporaryFile> tmp_pkey_file = std_::make_unique<TemporaryFile>("tls-pkey");
     tmp_pkey_file->PutContents(pkey);
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEY, tmp_pkey_file->Path().c_str());
-    curlEasySetoptWrapper(curl, CURLOPT_SSLKEYTYPE, "PEM");
     tls_pkey_file = std::move_if_noexcept(tmp_pkey_file);
+#endif
+    curlEasySetoptWrapper(curl, CURLOPT_SSLKEYTYPE, "PEM");
   }
   pkcs11_key = (pkey_source == CryptoSource::kPkcs11);
 }
 
 HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control) {
-  CURL* curl_get = Utils::curlDupHandleWrapper(curl, pkcs11_key);
+  return performGet(url, maxsize, flow_control, nullptr);
+}
+
+HttpResponse HttpClient::getStream(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control,
+                                   const HttpBodySink& sink) {
+  return performGet(url, maxsize, flow_control, &sink);
+}
 
-  curlEasySetoptWrapper(curl_get, CURLOPT_HTTPHEADER, headers);
+HttpResponse HttpClient::getStreamIfModified(const std::string& url, int64_t maxsize,
+                                             const api::FlowControlToken* flow_control,
+                                             const HttpCacheValidators& validators, const HttpBodySink& sink) {
+  return performGet(url, maxsize, flow_control, &sink, &validators);
+}
+
+HttpResponse HttpClient::performGet(const std::string& url, int64_t maxsize,
+                                    const api::FlowControlToken* flow_control, const HttpBodySink* sink,
+                                    const HttpCacheValidators* validators) {
+  PooledHandle handle(*this);
+  CURL* curl_get = handle.get();
+
+  curl_slist* req_headers = nullptr;
+  if (validators != nullptr && !validators->empty()) {
+    req_headers = curl_slist_dup(handle.headers());
+    if (!validators->etag.empty()) {
+      req_headers = curl_slist_append(req_headers, ("If-None-Match: " + validators->etag).c_str());
+    }
+    if (!validators->last_modified.empty()) {
+      req_headers = curl_slist_append(req_headers, ("If-Modified-Since: " + validators->last_modified).c_str());
+    }
+  }
+  curlEasySetoptWrapper(curl_get, CURLOPT_HTTPHEADER, (req_headers != nullptr) ? req_headers : handle.headers());
 
   if (pkcs11_cert) {
     curlEasySetoptWrapper(curl_get, CURLOPT_SSLCERTTYPE, "ENG");
@@ -162,6 +323,9 @@ HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api:
   curlEasySetoptWrapper(curl_get, CURLOPT_POSTFIELDS, "");
   curlEasySetoptWrapper(curl_get, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_get, CURLOPT_HTTPGET, 1L);
+  // any encoding curl can decode, metadata compresses well; the size limit
+  // applies to the decoded body
+  curlEasySetoptWrapper(curl_get, CURLOPT_ACCEPT_ENCODING, "");
   if (flow_control != nullptr) {
     // Handle cancellation
     curlEasySetoptWrapper(curl_get, CURLOPT_NOPROGRESS, 0);
@@ -170,21 +334,31 @@ HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api:
   }
 
   LOG_DEBUG << "GET " << url;
-  HttpResponse response = perform(curl_get, RETRY_TIMES, maxsize);
-  curl_easy_cleanup(curl_get);
+  HttpResponse response = perform(curl_get, true, maxsize, sink);
+  curl_slist_free_all(req_headers);
   return response;
 }
 
 HttpResponse HttpClient::post(const std::string& url, const std::string& content_type, const std::string& data) {
-  CURL* curl_post = Utils::curlDupHandleWrapper(curl, pkcs11_key);
-  curl_slist* req_headers = curl_slist_dup(headers);
+  return postEncoded(url, content_type, "", data);
+}
+
+HttpResponse HttpClient::postEncoded(const std::string& url, const std::string& content_type,
+                                     const std::string& content_encoding, const std::string& data) {
+  PooledHandle handle(*this);
+  CURL* curl_post = handle.get();
+  curl_slist* req_headers = curl_slist_dup(handle.headers());
   req_headers = curl_slist_append(req_headers, (std::string("Content-Type: ") + content_type).c_str());
+  if (!content_encoding.empty()) {
+    req_headers = curl_slist_append(req_headers, (std::string("Content-Encoding: ") + content_encoding).c_str());
+  }
   curlEasySetoptWrapper(curl_post, CURLOPT_HTTPHEADER, req_headers);
   curlEasySetoptWrapper(curl_post, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_post, CURLOPT_POST, 1);
+  // encoded data may contain null bytes
+  curlEasySetoptWrapper(curl_post, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(data.size()));
   curlEasySetoptWrapper(curl_post, CURLOPT_POSTFIELDS, data.c_str());
-  auto result = perform(curl_post, RETRY_TIMES, HttpInterface::kPostRespLimit);
-  curl_easy_cleanup(curl_post);
+  auto result = perform(curl_post, false, HttpInterface::kPostRespLimit);
   curl_slist_free_all(req_headers);
   return result;
 }
@@ -196,15 +370,15 @@ HttpResponse HttpClient::post(const std::string& url, const Json::Value& data) {
 }
 
 HttpResponse HttpClient::put(const std::string& url, const std::string& content_type, const std::string& data) {
-  CURL* curl_put = Utils::curlDupHandleWrapper(curl, pkcs11_key);
-  curl_slist* req_headers = curl_slist_dup(headers);
+  PooledHandle handle(*this);
+  CURL* curl_put = handle.get();
+  curl_slist* req_headers = curl_slist_dup(handle.headers());
   req_headers = curl_slist_append(req_headers, (std::string("Content-Type: ") + content_type).c_str());
   curlEasySetoptWrapper(curl_put, CURLOPT_HTTPHEADER, req_headers);
   curlEasySetoptWrapper(curl_put, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_put, CURLOPT_POSTFIELDS, data.c_str());
   curlEasySetoptWrapper(curl_put, CURLOPT_CUSTOMREQUEST, "PUT");
-  HttpResponse result = perform(curl_put, RETRY_TIMES, HttpInterface::kPutRespLimit);
-  curl_easy_cleanup(curl_put);
+  HttpResponse result = perform(curl_put, true, HttpInterface::kPutRespLimit);
   curl_slist_free_all(req_headers);
   return result;
 }
@@ -215,8 +389,17 @@ HttpResponse HttpClient::put(const std::string& url, const Json::Value& data) {
   return put(url, "application/json", data_str);
 }
 
-// NOLINTNEXTLINE(misc-no-recursion)
-HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t size_limit) {
+HttpResponse HttpClient::perform(CURL* curl_handler, bool idempotent, int64_t size_limit, const HttpBodySink* sink) {
+  // throttled downloads leave some room for this request
+  const std::shared_ptr<RateLimiter> limiter = multi_loop_->rateLimiter();
+  if (limiter != nullptr) {
+    limiter->beginInteractive();
+  }
+  std::shared_ptr<void> interactive_guard(nullptr, [&limiter](void*) {
+    if (limiter != nullptr) {
+      limiter->endInteractive();
+    }
+  });
   if (size_limit >= 0) {
     // it will only take effect if the server declares the size in advance,
     //    writeString callback takes care of the other case
@@ -225,27 +408,44 @@ HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t si
   curlEasySetoptWrapper(curl_handler, CURLOPT_LOW_SPEED_TIME, speed_limit_time_interval_);
   curlEasySetoptWrapper(curl_handler, CURLOPT_LOW_SPEED_LIMIT, speed_limit_bytes_per_sec_);
 
-  WriteStringArg response_arg;
-  response_arg.limit = size_limit;
-  curlEasySetoptWrapper(curl_handler, CURLOPT_WRITEDATA, static_cast<void*>(&response_arg));
-  CURLcode result = curl_easy_perform(curl_handler);
-  long http_code;  // NOLINT(google-runtime-int)
-  curl_easy_getinfo(curl_handler, CURLINFO_RESPONSE_CODE, &http_code);
-  HttpResponse response(response_arg.out, http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
-  if (response.curl_code != CURLE_OK || response.http_status_code >= 500) {
-    std::ostringstream error_message;
-    error_message << "curl error " << response.curl_code << " (http code " << response.http_status_code
-                  << "): " << response.error_message;
-    LOG_ERROR << error_message.str();
-    if (retry_times != 0) {
-      sleep(1);
-      // NOLINTNEXTLINE(misc-no-recursion)
-      response = perform(curl_handler, --retry_times, size_limit);
+  retry_policy_->onRequest();
+  for (int retries = 0;; ++retries) {
+    WriteStringArg response_arg;
+    response_arg.limit = size_limit;
+    response_arg.sink = sink;
+    curlEasySetoptWrapper(curl_handler, CURLOPT_WRITEDATA, static_cast<void*>(&response_arg));
+    curlEasySetoptWrapper(curl_handler, CURLOPT_HEADERFUNCTION, readHeader);
+    curlEasySetoptWrapper(curl_handler, CURLOPT_HEADERDATA, static_cast<void*>(&response_arg));
+    CURLcode result = curl_easy_perform(curl_handler);
+    long http_code;  // NOLINT(google-runtime-int)
+    curl_easy_getinfo(curl_handler, CURLINFO_RESPONSE_CODE, &http_code);
+    share_->recordTransfer(curl_handler);
+    HttpResponse response(std::move(response_arg.out), http_code, result,
+                          (result != CURLE_OK) ? curl_easy_strerror(result) : "");
+    response.validators = std::move(response_arg.validators);
+    response.retry_after = response_arg.retry_after;
+    if (response.retry_after.count() > 0) {
+      share_->recordRetryAfter(response.retry_after);
+    }
+    if (response.curl_code != CURLE_OK || response.http_status_code >= 500) {
+      std::ostringstream error_message;
+      error_message << "curl error " << response.curl_code << " (http code " << response.http_status_code
+                    << "): " << response.error_message;
+      LOG_ERROR << error_message.str();
     }
+    // a sink can't take the same data twice
+    if ((sink == nullptr || response_arg.received == 0) &&
+        retry_policy_->allowRetry(retries, response.curl_code, response.http_status_code, idempotent,
+                                  response.retry_after)) {
+      const std::chrono::milliseconds wait = retry_policy_->delay(retries, response.retry_after);
+      LOG_DEBUG << "Retrying in " << wait.count() << " ms";
+      std::this_thread::sleep_for(wait);
+      continue;
+    }
+    LOG_TRACE << "response http code: " << response.http_status_code;
+    LOG_TRACE << "response: " << response.body;
+    return response;
   }
-  LOG_TRACE << "response http code: " << response.http_status_code;
-  LOG_TRACE << "response: " << response.body;
-  return response;
 }
 
 HttpResponse HttpClient::download(const std::string& url, curl_write_callback write_cb,
@@ -256,15 +456,46 @@ HttpResponse HttpClient::download(const std::string& url, curl_write_callback wr
 std::future<HttpResponse> HttpClient::downloadAsync(const std::string& url, curl_write_callback write_cb,
                                                     curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
                                                     CurlHandler* easyp) {
-  CURL* curl_download = Utils::curlDupHandleWrapper(curl, pkcs11_key);
+  CurlHandler curlp;
+  CURL* curl_download = prepareDownload(url, write_cb, progress_cb, userp, easyp, &curlp);
+  curlEasySetoptWrapper(curl_download, CURLOPT_RESUME_FROM_LARGE, from);
+  return multi_loop_->add(curlp, write_cb, userp);
+}
+
+std::future<HttpResponse> HttpClient::downloadRangeAsync(const std::string& url, curl_write_callback write_cb,
+                                                         curl_xferinfo_callback progress_cb, void* userp,
+                                                         curl_off_t from, curl_off_t to, CurlHandler* easyp) {
+  CurlHandler curlp;
+  CURL* curl_download = prepareDownload(url, write_cb, progress_cb, userp, easyp, &curlp);
+  const std::string range = std::to_string(from) + "-" + std::to_string(to);
+  // CURLOPT_RANGE copies the string
+  curlEasySetoptWrapper(curl_download, CURLOPT_RANGE, range.c_str());
+  return multi_loop_->add(curlp, write_cb, userp);
+}
+
+CURL* HttpClient::prepareDownload(const std::string& url, curl_write_callback write_cb,
+                                  curl_xferinfo_callback progress_cb, void* userp, CurlHandler* easyp,
+                                  CurlHandler* curlp) const {
+  // downloads run long enough for setting up a handle of their own not to
+  // matter
+  CURL* curl_download;
+  curl_slist* req_headers;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    curl_download = dupHandle();
+    req_headers = curl_slist_dup(headers.get());
+  }
 
-  CurlHandler curlp = CurlHandler(curl_download, curl_easy_cleanup);
+  *curlp = CurlHandler(curl_download, [req_headers](CURL* handle) {
+    curl_easy_cleanup(handle);
+    curl_slist_free_all(req_headers);
+  });
 
   if (easyp != nullptr) {
-    *easyp = curlp;
+    *easyp = *curlp;
   }
 
-  curlEasySetoptWrapper(curl_download, CURLOPT_HTTPHEADER, headers);
+  curlEasySetoptWrapper(curl_download, CURLOPT_HTTPHEADER, req_headers);
   curlEasySetoptWrapper(curl_download, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_download, CURLOPT_HTTPGET, 1L);
   curlEasySetoptWrapper(curl_download, CURLOPT_WRITEFUNCTION, write_cb);
@@ -276,38 +507,40 @@ std::future<HttpResponse> HttpClient::downloadAsync(const std::string& url, curl
   }
   curlEasySetoptWrapper(curl_download, CURLOPT_TIMEOUT, 0);
   curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_TIME, speed_limit_time_interval_);
-  curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_LIMIT, speed_limit_bytes_per_sec_);
-  curlEasySetoptWrapper(curl_download, CURLOPT_RESUME_FROM_LARGE, from);
+  long low_speed_limit = speed_limit_bytes_per_sec_;  // NOLINT(google-runtime-int)
+  const std::shared_ptr<RateLimiter> limiter = multi_loop_->rateLimiter();
+  if (limiter != nullptr && limiter->lowestRate() != 0) {
+    // don't take a throttled download for a stalled one
+    const auto throttled = static_cast<long>(std::max<uint64_t>(limiter->lowestRate() / 4, 1));  // NOLINT
+    low_speed_limit = std::min(low_speed_limit, throttled);
+  }
+  curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_LIMIT, low_speed_limit);
 
-  std::promise<HttpResponse> resp_promise;
-  auto resp_future = resp_promise.get_future();
-  std::thread(
-      [curlp](std::promise<HttpResponse> promise) {
-        CURLcode result = curl_easy_perform(curlp.get());
-        long http_code;  // NOLINT(google-runtime-int)
-        curl_easy_getinfo(curlp.get(), CURLINFO_RESPONSE_CODE, &http_code);
-        HttpResponse response("", http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
-        promise.set_value(response);
-      },
-      std::move(resp_promise))
-      .detach();
-  return resp_future;
+  // Use HTTP/2 where the server supports it, so that parallel downloads from
+  // the same server are multiplexed over a single connection.
+  curlEasySetoptWrapper(curl_download, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  return curl_download;
 }
 
 bool HttpClient::updateHeader(const std::string& name, const std::string& value) {
-  curl_slist* item = headers;
-  std::string lookfor(name + ": ");
-
-  while (item != nullptr) {
-    if (strncmp(lookfor.c_str(), item->data, lookfor.length()) == 0) {
-      free(item->data);  // NOLINT(cppcoreguidelines-no-malloc, hicpp-no-malloc)
-      lookfor += value;
-      item->data = strdup(lookfor.c_str());
-      return true;
+  const std::string lookfor(name + ": ");
+  std::lock_guard<std::mutex> guard(mutex_);
+  curl_slist* updated = nullptr;
+  bool found = false;
+  for (curl_slist* item = headers.get(); item != nullptr; item = item->next) {
+    if (!found && strncmp(lookfor.c_str(), item->data, lookfor.length()) == 0) {
+      updated = curl_slist_append(updated, (lookfor + value).c_str());
+      found = true;
+    } else {
+      updated = curl_slist_append(updated, item->data);
     }
-    item = item->next;
   }
-  return false;
+  if (!found) {
+    curl_slist_free_all(updated);
+    return false;
+  }
+  headers = std::shared_ptr<curl_slist>(updated, curl_slist_free_all);
+  return true;
 }
 
 void HttpClient::timeout(int64_t ms) {
@@ -315,10 +548,27 @@ void HttpClient::timeout(int64_t ms) {
   // whatever the platform ABI thinks is a long, while keeping the external
   // interface a clang-tidy preferred int64
   auto ms_long = static_cast<long>(ms);  // NOLINT(google-runtime-int)
+  std::lock_guard<std::mutex> guard(mutex_);
+  dropIdleHandles();
   curlEasySetoptWrapper(curl, CURLOPT_TIMEOUT_MS, ms_long);
   curlEasySetoptWrapper(curl, CURLOPT_CONNECTTIMEOUT_MS, ms_long);
 }
 
+CURL* HttpClient::dupHandle() const {
+  CURL* handle = Utils::curlDupHandleWrapper(curl, pkcs11_key);
+  // curl_easy_duphandle() does not carry over the share handle
+  share_->attach(handle);
+  return handle;
+}
+
+void HttpClient::dropIdleHandles() {
+  for (CURL* handle : idle_handles_) {
+    curl_easy_cleanup(handle);
+  }
+  idle_handles_.clear();
+  ++generation_;
+}
+
 curl_slist* HttpClient::curl_slist_dup(curl_slist* sl) {
   curl_slist* new_list = nullptr;
 
@@ -330,3 +580,7 @@ curl_slist* HttpClient::curl_slist_dup(curl_slist* sl) {
 }
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
+
+void HttpClient::setDownloadRateLimiter(std::shared_ptr<RateLimiter> limiter) {
+  multi_loop_->setRateLimiter(std::move(limiter));
+}
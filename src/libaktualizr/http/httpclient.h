@@ -3,12 +3,23 @@
 
 #include <future>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include <curl/curl.h>
 #include "gtest/gtest_prod.h"
 #include "json/json.h"
 
+#include "curlmultiloop.h"
+#include "curlshare.h"
 #include "httpinterface.h"
+#include "retrypolicy.h"
+
+// curl can take the TLS credentials from memory since 7.77.0; before, they
+// go through temporary files.
+#if LIBCURL_VERSION_NUM >= 0x074D00
+#define CURL_HAS_TLS_BLOBS
+#endif
 
 /**
  * Helper class to manage curl_global_init/curl_global_cleanup calls
@@ -23,18 +34,32 @@ class CurlGlobalInitWrapper {
   CurlGlobalInitWrapper &operator=(CurlGlobalInitWrapper &&) = delete;
 };
 
+/**
+ * HTTP client on top of libcurl.
+ *
+ * A client may be used from several threads at once. Each request runs on its
+ * own easy handle, set up like the template handle `curl`; synchronous
+ * requests take one from a small pool of idle handles, so that they skip
+ * duplicating the template and keep their connection between requests.
+ */
 class HttpClient : public HttpInterface {
  public:
   explicit HttpClient(const std::vector<std::string> *extra_headers = nullptr);
   explicit HttpClient(const std::string &socket);
   HttpClient(const HttpClient &curl_in);  // non-default!
   ~HttpClient() override;
-  HttpClient(HttpClient &&) = default;
+  HttpClient(HttpClient &&) = delete;
   HttpClient &operator=(const HttpClient &) = delete;
-  HttpClient &operator=(HttpClient &&) = default;
+  HttpClient &operator=(HttpClient &&) = delete;
   HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override;
+  HttpResponse getStream(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                         const HttpBodySink &sink) override;
+  HttpResponse getStreamIfModified(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                                   const HttpCacheValidators &validators, const HttpBodySink &sink) override;
   HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) override;
   HttpResponse post(const std::string &url, const Json::Value &data) override;
+  HttpResponse postEncoded(const std::string &url, const std::string &content_type,
+                           const std::string &content_encoding, const std::string &data) override;
   HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) override;
   HttpResponse put(const std::string &url, const Json::Value &data) override;
 
@@ -43,24 +68,82 @@ class HttpClient : public HttpInterface {
   std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
                                           curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
                                           CurlHandler *easyp) override;
+  std::future<HttpResponse> downloadRangeAsync(const std::string &url, curl_write_callback write_cb,
+                                               curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                               curl_off_t to, CurlHandler *easyp) override;
   void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
                 const std::string &pkey, CryptoSource pkey_source) override;
+  void setDownloadRateLimiter(std::shared_ptr<RateLimiter> limiter) override;
+  std::chrono::steady_clock::time_point retryAfter() const override { return share_->retryAfter(); }
   bool updateHeader(const std::string &name, const std::string &value);
   void timeout(int64_t ms);
+  // connection reuse of this client and all its copies
+  ConnectionStats connectionStats() const { return share_->stats(); }
 
  private:
   FRIEND_TEST(HttpClient, DownloadSpeedLimit);
 
+  // An easy handle out of the pool for one synchronous request, given back
+  // when done.
+  class PooledHandle {
+   public:
+    explicit PooledHandle(const HttpClient &client);
+    ~PooledHandle();
+    PooledHandle(const PooledHandle &) = delete;
+    PooledHandle(PooledHandle &&) = delete;
+    PooledHandle &operator=(const PooledHandle &) = delete;
+    PooledHandle &operator=(PooledHandle &&) = delete;
+
+    CURL *get() const { return handle_; }
+    // the headers of the client when the request started
+    curl_slist *headers() const { return headers_.get(); }
+
+   private:
+    const HttpClient &client_;
+    CURL *handle_{nullptr};
+    uint64_t generation_{0};
+    std::shared_ptr<curl_slist> headers_;
+  };
+
   static const CurlGlobalInitWrapper manageCurlGlobalInit_;
+  // idle handles kept per client; more concurrent requests are served by
+  // handles that are released when done
+  static constexpr size_t kMaxIdleHandles = 8;
+
+  // guards curl, headers, idle_handles_ and generation_
+  mutable std::mutex mutex_;
   CURL *curl;
-  curl_slist *headers;
-  HttpResponse perform(CURL *curl_handler, int retry_times, int64_t size_limit);
+  // never modified once set, updateHeader() replaces the list, so that
+  // requests in flight keep theirs
+  std::shared_ptr<curl_slist> headers;
+  mutable std::vector<CURL *> idle_handles_;
+  // bumped whenever `curl` changes, idle handles of older generations are
+  // dropped
+  uint64_t generation_{0};
+  // DNS/TLS session cache and connection pool, shared with the copies of this
+  // client
+  std::shared_ptr<CurlShare> share_;
+  // drives the downloads, shared with the copies of this client
+  std::shared_ptr<CurlMultiLoop> multi_loop_;
+  // retries of the requests of this client and all its copies
+  std::shared_ptr<RetryPolicy> retry_policy_;
+  // to be called with mutex_ held
+  CURL *dupHandle() const;
+  // `curl` changed, to be called with mutex_ held
+  void dropIdleHandles();
+  CURL *prepareDownload(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void *userp, CurlHandler *easyp, CurlHandler *curlp) const;
+  HttpResponse performGet(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                          const HttpBodySink *sink, const HttpCacheValidators *validators = nullptr);
+  // the request is sent again on transient failures, see RetryPolicy
+  HttpResponse perform(CURL *curl_handler, bool idempotent, int64_t size_limit, const HttpBodySink *sink = nullptr);
   static curl_slist *curl_slist_dup(curl_slist *sl);
 
+#ifndef CURL_HAS_TLS_BLOBS
   std::unique_ptr<TemporaryFile> tls_ca_file;
   std::unique_ptr<TemporaryFile> tls_cert_file;
   std::unique_ptr<TemporaryFile> tls_pkey_file;
-  static const int RETRY_TIMES = 2;
+#endif
   static const long kSpeedLimitTimeInterval = 60L;   // NOLINT(google-runtime-int)
   static const long kSpeedLimitBytesPerSec = 5000L;  // NOLINT(google-runtime-int)
 
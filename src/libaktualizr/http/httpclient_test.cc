@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
 
 #include "http/httpclient.h"
+#include "http/ratelimiter.h"
 
+#include <array>
 #include <atomic>
 #include <boost/filesystem/operations.hpp>
 #include <boost/process.hpp>
@@ -19,6 +21,12 @@
 // NOLINTNEXTLINE(*non-const*)
 static std::string server = "http://127.0.0.1:";
 
+static size_t discardBytes(char* contents, size_t size, size_t nmemb, void* userp) {
+  (void)contents;
+  (void)userp;
+  return size * nmemb;
+}
+
 // NOLINTNEXTLINE(*non-const*)
 TEST(HttpClient, CopyConstructorTest) {
   HttpClient http;
@@ -28,6 +36,24 @@ TEST(HttpClient, CopyConstructorTest) {
   EXPECT_EQ(resp["path"].asString(), path);
 }
 
+/* Transfers of a client and its copies are counted together. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, ConnectionStats) {
+  HttpClient http;
+  HttpClient http_copy(http);
+  EXPECT_EQ(http.connectionStats().transfers, 0);
+
+  std::string path = "/path/1/2/3";
+  EXPECT_TRUE(http.get(server + path, HttpInterface::kNoLimit, nullptr).isOk());
+  EXPECT_TRUE(http_copy.get(server + path, HttpInterface::kNoLimit, nullptr).isOk());
+  EXPECT_TRUE(http_copy.download(server + "/large_file", discardBytes, nullptr, nullptr, 0).isOk());
+
+  const ConnectionStats stats = http.connectionStats();
+  EXPECT_EQ(stats.transfers, 3);
+  EXPECT_EQ(http_copy.connectionStats().transfers, 3);
+  EXPECT_LE(stats.reused, stats.transfers);
+}
+
 // NOLINTNEXTLINE(*non-const*)
 TEST(HttpClient, Get) {
   HttpClient http;
@@ -36,6 +62,81 @@ TEST(HttpClient, Get) {
   EXPECT_EQ(response["path"].asString(), path);
 }
 
+/* The body of a streamed response goes to the sink in pieces, which can abort
+ * the transfer. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, GetStream) {
+  HttpClient http;
+  std::string path = "/path/1/2/3";
+  std::string body;
+  HttpResponse resp =
+      http.getStream(server + path, HttpInterface::kNoLimit, nullptr, [&body](const char* data, size_t size) {
+        body.append(data, size);
+        return true;
+      });
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_TRUE(resp.body.empty());
+  EXPECT_EQ(Utils::parseJSON(body)["path"].asString(), path);
+
+  size_t received = 0;
+  size_t calls = 0;
+  resp = http.getStream(server + "/large_file", HttpInterface::kNoLimit, nullptr,
+                        [&received, &calls](const char* data, size_t size) {
+                          (void)data;
+                          received += size;
+                          return ++calls < 10;
+                        });
+  EXPECT_EQ(resp.curl_code, CURLE_WRITE_ERROR);
+  EXPECT_EQ(calls, 10);
+  EXPECT_LT(received, 100 * (1 << 20));
+}
+
+/* Conditional requests are answered with 304 if the resource didn't change. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, GetStreamIfModified) {
+  HttpClient http;
+  std::string body;
+  const HttpBodySink sink = [&body](const char* data, size_t size) {
+    body.append(data, size);
+    return true;
+  };
+  HttpResponse resp =
+      http.getStreamIfModified(server + "/conditional", HttpInterface::kNoLimit, nullptr, HttpCacheValidators(), sink);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_FALSE(resp.isNotModified());
+  EXPECT_EQ(body, "{\"version\": 1}");
+  EXPECT_EQ(resp.validators.etag, "\"v1\"");
+  EXPECT_EQ(resp.validators.last_modified, "Wed, 21 Oct 2015 07:28:00 GMT");
+
+  body.clear();
+  HttpCacheValidators etag_only;
+  etag_only.etag = resp.validators.etag;
+  resp = http.getStreamIfModified(server + "/conditional", HttpInterface::kNoLimit, nullptr, etag_only, sink);
+  EXPECT_TRUE(resp.isNotModified());
+  EXPECT_TRUE(body.empty());
+
+  HttpCacheValidators stale;
+  stale.etag = "\"v0\"";
+  resp = http.getStreamIfModified(server + "/conditional", HttpInterface::kNoLimit, nullptr, stale, sink);
+  EXPECT_FALSE(resp.isNotModified());
+  EXPECT_EQ(body, "{\"version\": 1}");
+}
+
+/* The Retry-After of the server is kept for all the copies of the client. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, RetryAfter) {
+  HttpClient http;
+  HttpClient http_copy(http);
+  EXPECT_LE(http_copy.retryAfter(), std::chrono::steady_clock::now());
+
+  HttpResponse resp = http.get(server + "/path/1/2/3", HttpInterface::kNoLimit, nullptr);
+  EXPECT_EQ(resp.retry_after.count(), 0);
+  resp = http.get(server + "/retry_after", HttpInterface::kNoLimit, nullptr);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_EQ(resp.retry_after, std::chrono::seconds(120));
+  EXPECT_GT(http_copy.retryAfter(), std::chrono::steady_clock::now() + std::chrono::seconds(100));
+}
+
 // NOLINTNEXTLINE(*non-const*)
 TEST(HttpClient, GetWithHeaders) {
   std::vector<std::string> headers = {"Authorization: Bearer token"};
@@ -55,6 +156,19 @@ TEST(HttpClient, DownloadSizeLimit) {
   EXPECT_EQ(resp.curl_code, CURLE_FILESIZE_EXCEEDED);
 }
 
+/* Compressed responses are decoded, the size limit applies to the decoded
+ * body. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, GetCompressed) {
+  HttpClient http;
+  HttpResponse resp = http.get(server + "/gzip", HttpInterface::kNoLimit, nullptr);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_EQ(resp.getJson()["data"].asString().size(), 100000);
+
+  resp = http.get(server + "/gzip", 10000, nullptr);
+  EXPECT_EQ(resp.curl_code, CURLE_WRITE_ERROR);
+}
+
 /* Reject http GET responses that do not meet speed limit. */
 // NOLINTNEXTLINE(*non-const*)
 TEST(HttpClient, DownloadSpeedLimit) {
@@ -91,6 +205,55 @@ TEST(HttpClient, Cancellation) {
   abort_thread.join();
 }
 
+static size_t countBytes(char* contents, size_t size, size_t nmemb, void* userp) {
+  (void)contents;
+  *static_cast<size_t*>(userp) += size * nmemb;
+  return size * nmemb;
+}
+
+/* Several downloads run at the same time on the shared transfer loop,
+ * including the ones started from a copy of the client. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, DownloadAsyncConcurrent) {
+  HttpClient http;
+  HttpClient http_copy(http);
+  std::array<size_t, 3> received{};
+  std::vector<std::future<HttpResponse>> futures;
+  futures.push_back(http.downloadAsync(server + "/large_file", countBytes, nullptr, &received[0], 0, nullptr));
+  futures.push_back(http.downloadAsync(server + "/large_file", countBytes, nullptr, &received[1], 0, nullptr));
+  futures.push_back(http_copy.downloadAsync(server + "/large_file", countBytes, nullptr, &received[2], 1024, nullptr));
+
+  for (auto& f : futures) {
+    HttpResponse resp = f.get();
+    EXPECT_TRUE(resp.isOk()) << resp.getStatusStr();
+  }
+  EXPECT_EQ(received[0], 100 * (1 << 20));
+  EXPECT_EQ(received[1], 100 * (1 << 20));
+  EXPECT_EQ(received[2], 100 * (1 << 20) - 1024);
+}
+
+/* Downloads are throttled by the rate limiter, other requests are not. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, DownloadRateLimit) {
+  HttpClient http;
+  auto limiter = std::make_shared<RateLimiter>(RateLimitPolicy{});
+  http.setDownloadRateLimiter(limiter);
+  HttpClient http_copy(http);
+  limiter->setOverride(512 * 1024);
+
+  size_t received = 0;
+  const auto start = std::chrono::steady_clock::now();
+  HttpResponse resp =
+      http_copy.downloadRangeAsync(server + "/large_file", countBytes, nullptr, &received, 0, (1 << 20) - 1, nullptr)
+          .get();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  EXPECT_TRUE(resp.isOk()) << resp.getStatusStr();
+  EXPECT_EQ(received, 1 << 20);
+  EXPECT_GE(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), 1500);
+
+  EXPECT_TRUE(http.get(server + "/path/1/2/3", HttpInterface::kNoLimit, nullptr).isOk());
+}
+
 // NOLINTNEXTLINE(*non-const*)
 TEST(HttpClient, Post) {
   HttpClient http;
@@ -153,6 +316,41 @@ TEST(HttpClient, UpdateHeader) {
   EXPECT_EQ(response["status"].asString(), "good");
 }
 
+/* A single client serves requests from several threads at once, also while
+ * its headers change. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, Concurrent) {
+  std::vector<std::string> headers = {"Authorization: Bearer token"};
+  HttpClient http(&headers);
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&http, &failures, t]() {
+      for (int i = 0; i < 10; ++i) {
+        const std::string path = "/path/" + std::to_string(t) + "/" + std::to_string(i);
+        Json::Value data;
+        data["key"] = path;
+        const Json::Value response = (i % 2 == 0) ? http.get(server + path, HttpInterface::kNoLimit, nullptr).getJson()
+                                                  : http.post(server + path, data).getJson();
+        if (response["path"].asString() != path || (i % 2 != 0 && response["data"]["key"].asString() != path)) {
+          ++failures;
+        }
+        if (http.get(server + "/auth_call", HttpInterface::kNoLimit, nullptr).getJson()["status"] != "good") {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_TRUE(http.updateHeader("Authorization", "Bearer token"));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(failures, 0);
+  EXPECT_EQ(http.connectionStats().transfers, 160);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
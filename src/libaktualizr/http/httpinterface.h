@@ -1,7 +1,10 @@
 #ifndef HTTPINTERFACE_H_
 #define HTTPINTERFACE_H_
 
+#include <chrono>
+#include <functional>
 #include <future>
+#include <memory>
 #include <string>
 #include <utility>
 
@@ -15,6 +18,20 @@
 
 using CurlHandler = std::shared_ptr<CURL>;
 
+class RateLimiter;
+
+// Receives the body of a response piece by piece. Returns false to abort the
+// transfer.
+using HttpBodySink = std::function<bool(const char *data, size_t size)>;
+
+// Validators of a response, to ask the server later whether it has changed
+// (RFC 7232). Empty if the server didn't send any.
+struct HttpCacheValidators {
+  std::string etag;
+  std::string last_modified;
+  bool empty() const { return etag.empty() && last_modified.empty(); }
+};
+
 struct HttpResponse {
   HttpResponse() = default;
   HttpResponse(std::string body_in, const long http_status_code_in,  //  NOLINT(google-runtime-int)
@@ -27,8 +44,14 @@ struct HttpResponse {
   long http_status_code{0};  // NOLINT(google-runtime-int)
   CURLcode curl_code{CURLE_OK};
   std::string error_message;
+  HttpCacheValidators validators;
+  // how long the server asked to wait before the next request (Retry-After),
+  // zero if it didn't say
+  std::chrono::seconds retry_after{0};
   bool isOk() const { return (curl_code == CURLE_OK && http_status_code >= 200 && http_status_code < 400); }
   bool wasInterrupted() const { return curl_code == CURLE_ABORTED_BY_CALLBACK; };
+  // the resource is still the one of the validators of a conditional request
+  bool isNotModified() const { return curl_code == CURLE_OK && http_status_code == 304; }
   std::string getStatusStr() const {
     return std::to_string(curl_code) + " " + error_message + " HTTP " + std::to_string(http_status_code);
   }
@@ -42,8 +65,48 @@ class HttpInterface {
   virtual ~HttpInterface() = default;
   virtual HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) = 0;
   HttpResponse get(const std::string &url, int64_t maxsize) { return get(url, maxsize, nullptr); }
+  /**
+   * Like get(), but hand the body to `sink` as it arrives instead of
+   * collecting it, so that it is never held in memory twice. The body of the
+   * returned response is empty. If the sink aborts, the result has
+   * CURLE_WRITE_ERROR. Implementations without streaming support pass the
+   * whole body at once.
+   */
+  virtual HttpResponse getStream(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                                 const HttpBodySink &sink) {
+    HttpResponse response = get(url, maxsize, flow_control);
+    if (!response.body.empty() && !sink(response.body.data(), response.body.size())) {
+      response.curl_code = CURLE_WRITE_ERROR;
+    }
+    response.body.clear();
+    return response;
+  }
+  /**
+   * Like getStream(), but only send the body if the resource changed since
+   * the response `validators` came with. If it didn't, the response is
+   * isNotModified() and nothing is passed to the sink. Implementations
+   * without conditional requests always send the body.
+   */
+  virtual HttpResponse getStreamIfModified(const std::string &url, int64_t maxsize,
+                                           const api::FlowControlToken *flow_control,
+                                           const HttpCacheValidators &validators, const HttpBodySink &sink) {
+    (void)validators;
+    return getStream(url, maxsize, flow_control, sink);
+  }
   virtual HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) = 0;
   virtual HttpResponse post(const std::string &url, const Json::Value &data) = 0;
+  /**
+   * Like post(), but `data` is encoded with `content_encoding` (e.g. "gzip").
+   * Implementations that can't send it answer 415 Unsupported Media Type,
+   * like a server that doesn't accept the encoding could.
+   */
+  virtual HttpResponse postEncoded(const std::string &url, const std::string &content_type,
+                                   const std::string &content_encoding, const std::string &data) {
+    (void)url;
+    (void)content_type;
+    (void)data;
+    return HttpResponse("", 415, CURLE_OK, "Content-Encoding " + content_encoding + " is not supported");
+  }
   virtual HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) = 0;
   virtual HttpResponse put(const std::string &url, const Json::Value &data) = 0;
 
@@ -52,8 +115,31 @@ class HttpInterface {
   virtual std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
                                                   curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
                                                   CurlHandler *easyp) = 0;
+  /**
+   * Download the bytes from `from` to `to` (inclusive) of a file. The server
+   * may ignore the range and send the whole file with status 200 instead of
+   * 206, the caller has to check. Implementations without range support fall
+   * back to downloadAsync(), which sends everything from `from` on.
+   */
+  virtual std::future<HttpResponse> downloadRangeAsync(const std::string &url, curl_write_callback write_cb,
+                                                       curl_xferinfo_callback progress_cb, void *userp,
+                                                       curl_off_t from, curl_off_t to, CurlHandler *easyp) {
+    (void)to;
+    return downloadAsync(url, write_cb, progress_cb, userp, from, easyp);
+  }
   virtual void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert,
                         CryptoSource cert_source, const std::string &pkey, CryptoSource pkey_source) = 0;
+  /**
+   * Throttle the downloads (not the other requests) with a rate limiter.
+   * Implementations without rate limiting ignore it.
+   */
+  virtual void setDownloadRateLimiter(std::shared_ptr<RateLimiter> limiter) { (void)limiter; }
+  /**
+   * The time before which the server asked not to be sent any more requests,
+   * with the Retry-After header of its latest response that had one. In the
+   * past if it never did. Implementations that don't read headers never do.
+   */
+  virtual std::chrono::steady_clock::time_point retryAfter() const { return {}; }
   static constexpr int64_t kNoLimit = 0;  // no limit the size of downloaded data
   static constexpr int64_t kPostRespLimit = 64L * 1024;
   static constexpr int64_t kPutRespLimit = 64L * 1024;
@@ -0,0 +1,265 @@
+#include "httprecorder.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+Json::Value HttpExchange::toJson() const {
+  Json::Value json;
+  json["method"] = method;
+  json["url"] = url;
+  if (!range.empty()) {
+    json["range"] = range;
+  }
+  json["request_size"] = Json::UInt64(request_size);
+  json["start_ms"] = start_ms;
+  json["latency_ms"] = latency_ms;
+  json["status"] = Json::Int64(response.http_status_code);
+  json["curl_code"] = static_cast<int>(response.curl_code);
+  if (!response.error_message.empty()) {
+    json["error"] = response.error_message;
+  }
+  if (!response.validators.etag.empty()) {
+    json["etag"] = response.validators.etag;
+  }
+  if (!response.validators.last_modified.empty()) {
+    json["last_modified"] = response.validators.last_modified;
+  }
+  if (response.retry_after.count() != 0) {
+    json["retry_after"] = Json::Int64(response.retry_after.count());
+  }
+  json["response_size"] = Json::UInt64(response_size);
+  if (body_recorded) {
+    // bodies may be binary
+    json["body"] = Utils::toBase64(response.body);
+  }
+  return json;
+}
+
+HttpExchange HttpExchange::fromJson(const Json::Value &json) {
+  if (!json.isObject() || !json["method"].isString() || !json["url"].isString()) {
+    throw std::runtime_error("Invalid HTTP exchange: " + Utils::jsonToStr(json));
+  }
+  HttpExchange exchange;
+  exchange.method = json["method"].asString();
+  exchange.url = json["url"].asString();
+  exchange.range = json["range"].asString();
+  exchange.request_size = json["request_size"].asUInt64();
+  exchange.start_ms = json["start_ms"].asDouble();
+  exchange.latency_ms = json["latency_ms"].asDouble();
+  exchange.response.http_status_code = json["status"].asInt();
+  exchange.response.curl_code = static_cast<CURLcode>(json["curl_code"].asInt());
+  exchange.response.error_message = json["error"].asString();
+  exchange.response.validators.etag = json["etag"].asString();
+  exchange.response.validators.last_modified = json["last_modified"].asString();
+  exchange.response.retry_after = std::chrono::seconds(json["retry_after"].asInt64());
+  exchange.response_size = json["response_size"].asUInt64();
+  exchange.body_recorded = json.isMember("body");
+  if (exchange.body_recorded) {
+    exchange.response.body = Utils::fromBase64(json["body"].asString());
+  }
+  return exchange;
+}
+
+std::string HttpExchange::key(const std::string &method, const std::string &url, const std::string &range) {
+  return range.empty() ? method + " " + url : method + " " + url + " " + range;
+}
+
+struct HttpRecorder::Download {
+  curl_write_callback write_cb;
+  curl_xferinfo_callback progress_cb;
+  void *userp;
+  int64_t max_body_size;
+  std::string body;
+  uint64_t size{0};
+  bool kept{true};
+};
+
+HttpRecorder::HttpRecorder(std::shared_ptr<HttpInterface> inner, const boost::filesystem::path &path,
+                           int64_t max_body_size)
+    : inner_{std::move(inner)},
+      max_body_size_{max_body_size},
+      started_{std::chrono::steady_clock::now()},
+      out_{path.string(), std::ios::out | std::ios::app} {
+  if (!out_) {
+    throw std::runtime_error("Can't open HTTP recording " + path.string());
+  }
+  LOG_INFO << "Recording the HTTP requests to " << path;
+}
+
+HttpExchange HttpRecorder::begin(const std::string &method, const std::string &url, uint64_t request_size) const {
+  HttpExchange exchange;
+  exchange.method = method;
+  exchange.url = url;
+  exchange.request_size = request_size;
+  exchange.start_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started_).count();
+  return exchange;
+}
+
+void HttpRecorder::finish(HttpExchange exchange, HttpResponse response, std::string body, uint64_t body_size) {
+  const double now_ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started_).count();
+  exchange.latency_ms = now_ms - exchange.start_ms;
+  exchange.response = std::move(response);
+  exchange.response_size = body_size;
+  exchange.body_recorded =
+      body.size() == body_size && (max_body_size_ == kNoLimit || body_size <= static_cast<uint64_t>(max_body_size_));
+  exchange.response.body = exchange.body_recorded ? std::move(body) : std::string();
+
+  const std::string line = Utils::jsonToCanonicalStr(exchange.toJson());
+  std::lock_guard<std::mutex> guard(mutex_);
+  // flushed each time, to keep what was recorded if the device is turned off
+  out_ << line << std::endl;
+}
+
+HttpResponse HttpRecorder::get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) {
+  HttpExchange exchange = begin("GET", url, 0);
+  HttpResponse response = inner_->get(url, maxsize, flow_control);
+  finish(std::move(exchange), response, response.body, response.body.size());
+  return response;
+}
+
+HttpResponse HttpRecorder::getStreamRecorded(const std::string &url, const HttpBodySink &sink,
+                                             const std::function<HttpResponse(const HttpBodySink &)> &request) {
+  HttpExchange exchange = begin("GET", url, 0);
+  std::string body;
+  uint64_t body_size = 0;
+  HttpResponse response = request([this, &sink, &body, &body_size](const char *data, size_t size) {
+    body_size += size;
+    if (max_body_size_ == kNoLimit || body_size <= static_cast<uint64_t>(max_body_size_)) {
+      body.append(data, size);
+    }
+    return sink(data, size);
+  });
+  finish(std::move(exchange), response, std::move(body), body_size);
+  return response;
+}
+
+HttpResponse HttpRecorder::getStream(const std::string &url, int64_t maxsize,
+                                     const api::FlowControlToken *flow_control, const HttpBodySink &sink) {
+  return getStreamRecorded(url, sink, [&](const HttpBodySink &recording_sink) {
+    return inner_->getStream(url, maxsize, flow_control, recording_sink);
+  });
+}
+
+HttpResponse HttpRecorder::getStreamIfModified(const std::string &url, int64_t maxsize,
+                                               const api::FlowControlToken *flow_control,
+                                               const HttpCacheValidators &validators, const HttpBodySink &sink) {
+  return getStreamRecorded(url, sink, [&](const HttpBodySink &recording_sink) {
+    return inner_->getStreamIfModified(url, maxsize, flow_control, validators, recording_sink);
+  });
+}
+
+HttpResponse HttpRecorder::post(const std::string &url, const std::string &content_type, const std::string &data) {
+  HttpExchange exchange = begin("POST", url, data.size());
+  HttpResponse response = inner_->post(url, content_type, data);
+  finish(std::move(exchange), response, response.body, response.body.size());
+  return response;
+}
+
+HttpResponse HttpRecorder::post(const std::string &url, const Json::Value &data) {
+  HttpExchange exchange = begin("POST", url, Utils::jsonToStr(data).size());
+  HttpResponse response = inner_->post(url, data);
+  finish(std::move(exchange), response, response.body, response.body.size());
+  return response;
+}
+
+HttpResponse HttpRecorder::postEncoded(const std::string &url, const std::string &content_type,
+                                       const std::string &content_encoding, const std::string &data) {
+  HttpExchange exchange = begin("POST", url, data.size());
+  HttpResponse response = inner_->postEncoded(url, content_type, content_encoding, data);
+  finish(std::move(exchange), response, response.body, response.body.size());
+  return response;
+}
+
+HttpResponse HttpRecorder::put(const std::string &url, const std::string &content_type, const std::string &data) {
+  HttpExchange exchange = begin("PUT", url, data.size());
+  HttpResponse response = inner_->put(url, content_type, data);
+  finish(std::move(exchange), response, response.body, response.body.size());
+  return response;
+}
+
+HttpResponse HttpRecorder::put(const std::string &url, const Json::Value &data) {
+  HttpExchange exchange = begin("PUT", url, Utils::jsonToStr(data).size());
+  HttpResponse response = inner_->put(url, data);
+  finish(std::move(exchange), response, response.body, response.body.size());
+  return response;
+}
+
+size_t HttpRecorder::writeDownload(char *data, size_t size, size_t nmemb, void *userp) {
+  auto *download = static_cast<Download *>(userp);
+  const size_t written = download->write_cb(data, size, nmemb, download->userp);
+  const size_t kept = std::min(written, size * nmemb);
+  download->size += kept;
+  if (download->kept) {
+    if (download->max_body_size == kNoLimit || download->size <= static_cast<uint64_t>(download->max_body_size)) {
+      download->body.append(data, kept);
+    } else {
+      download->kept = false;
+      download->body.clear();
+    }
+  }
+  return written;
+}
+
+int HttpRecorder::progressDownload(void *userp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                   curl_off_t ulnow) {
+  auto *download = static_cast<Download *>(userp);
+  return download->progress_cb(download->userp, dltotal, dlnow, ultotal, ulnow);
+}
+
+std::future<HttpResponse> HttpRecorder::downloadRecorded(
+    HttpExchange exchange, curl_write_callback write_cb, curl_xferinfo_callback progress_cb, void *userp,
+    const std::function<std::future<HttpResponse>(curl_write_callback, curl_xferinfo_callback, void *)> &request) {
+  auto download = std::make_shared<Download>(Download{write_cb, progress_cb, userp, max_body_size_, {}, 0, true});
+  std::future<HttpResponse> response =
+      request(&HttpRecorder::writeDownload, progress_cb != nullptr ? &HttpRecorder::progressDownload : nullptr,
+              download.get());
+  // the download is recorded once it is over, whoever waits for it
+  return std::async(std::launch::async,
+                    [this, download](HttpExchange ex, std::future<HttpResponse> pending) {
+                      HttpResponse result = pending.get();
+                      finish(std::move(ex), result, std::move(download->body), download->size);
+                      return result;
+                    },
+                    std::move(exchange), std::move(response));
+}
+
+HttpResponse HttpRecorder::download(const std::string &url, curl_write_callback write_cb,
+                                    curl_xferinfo_callback progress_cb, void *userp, curl_off_t from) {
+  return downloadAsync(url, write_cb, progress_cb, userp, from, nullptr).get();
+}
+
+std::future<HttpResponse> HttpRecorder::downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                                      curl_xferinfo_callback progress_cb, void *userp,
+                                                      curl_off_t from, CurlHandler *easyp) {
+  HttpExchange exchange = begin("DOWNLOAD", url, 0);
+  if (from > 0) {
+    exchange.range = "bytes=" + std::to_string(from) + "-";
+  }
+  return downloadRecorded(std::move(exchange), write_cb, progress_cb, userp,
+                          [&](curl_write_callback write, curl_xferinfo_callback progress, void *data) {
+                            return inner_->downloadAsync(url, write, progress, data, from, easyp);
+                          });
+}
+
+std::future<HttpResponse> HttpRecorder::downloadRangeAsync(const std::string &url, curl_write_callback write_cb,
+                                                           curl_xferinfo_callback progress_cb, void *userp,
+                                                           curl_off_t from, curl_off_t to, CurlHandler *easyp) {
+  HttpExchange exchange = begin("DOWNLOAD", url, 0);
+  exchange.range = "bytes=" + std::to_string(from) + "-" + std::to_string(to);
+  return downloadRecorded(std::move(exchange), write_cb, progress_cb, userp,
+                          [&](curl_write_callback write, curl_xferinfo_callback progress, void *data) {
+                            return inner_->downloadRangeAsync(url, write, progress, data, from, to, easyp);
+                          });
+}
+
+void HttpRecorder::setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert,
+                            CryptoSource cert_source, const std::string &pkey, CryptoSource pkey_source) {
+  inner_->setCerts(ca, ca_source, cert, cert_source, pkey, pkey_source);
+}
+
+void HttpRecorder::setDownloadRateLimiter(std::shared_ptr<RateLimiter> limiter) {
+  inner_->setDownloadRateLimiter(std::move(limiter));
+}
+
+std::chrono::steady_clock::time_point HttpRecorder::retryAfter() const { return inner_->retryAfter(); }
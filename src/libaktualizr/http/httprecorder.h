@@ -0,0 +1,110 @@
+#ifndef HTTPRECORDER_H_
+#define HTTPRECORDER_H_
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "httpinterface.h"
+
+/**
+ * A request and its response as seen by an HttpRecorder, one JSON object per
+ * line of a recording.
+ */
+struct HttpExchange {
+  // GET, POST, PUT or DOWNLOAD
+  std::string method;
+  std::string url;
+  // bytes=from-to of a download that doesn't start at the beginning, or only
+  // wants part of the file
+  std::string range;
+  uint64_t request_size{0};
+  // milliseconds since the recording started
+  double start_ms{0};
+  // from the request until the whole response was received
+  double latency_ms{0};
+  HttpResponse response;
+  uint64_t response_size{0};
+  // false if the body was too large to be kept: only its size is known
+  bool body_recorded{true};
+
+  Json::Value toJson() const;
+  static HttpExchange fromJson(const Json::Value &json);
+  static std::string key(const std::string &method, const std::string &url, const std::string &range);
+  std::string key() const { return key(method, url, range); }
+};
+
+/**
+ * Passes the requests on to another HttpInterface and appends each of them
+ * with its response, its size and how long it took to a recording that an
+ * HttpReplay can serve again.
+ *
+ * Bodies larger than `max_body_size` are recorded by size only, which is
+ * enough to replay the timing of image downloads but not to install them.
+ */
+class HttpRecorder : public HttpInterface {
+ public:
+  HttpRecorder(std::shared_ptr<HttpInterface> inner, const boost::filesystem::path &path,
+               int64_t max_body_size = kDefaultMaxBodySize);
+  ~HttpRecorder() override = default;
+  HttpRecorder(const HttpRecorder &) = delete;
+  HttpRecorder(HttpRecorder &&) = delete;
+  HttpRecorder &operator=(const HttpRecorder &) = delete;
+  HttpRecorder &operator=(HttpRecorder &&) = delete;
+
+  using HttpInterface::get;
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override;
+  HttpResponse getStream(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                         const HttpBodySink &sink) override;
+  HttpResponse getStreamIfModified(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                                   const HttpCacheValidators &validators, const HttpBodySink &sink) override;
+  HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse post(const std::string &url, const Json::Value &data) override;
+  HttpResponse postEncoded(const std::string &url, const std::string &content_type,
+                           const std::string &content_encoding, const std::string &data) override;
+  HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse put(const std::string &url, const Json::Value &data) override;
+  HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void *userp, curl_off_t from) override;
+  std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                          CurlHandler *easyp) override;
+  std::future<HttpResponse> downloadRangeAsync(const std::string &url, curl_write_callback write_cb,
+                                               curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                               curl_off_t to, CurlHandler *easyp) override;
+  void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
+                const std::string &pkey, CryptoSource pkey_source) override;
+  void setDownloadRateLimiter(std::shared_ptr<RateLimiter> limiter) override;
+  std::chrono::steady_clock::time_point retryAfter() const override;
+
+  const std::shared_ptr<HttpInterface> &inner() const { return inner_; }
+
+  static constexpr int64_t kDefaultMaxBodySize = 1024L * 1024;
+
+ private:
+  struct Download;
+
+  HttpExchange begin(const std::string &method, const std::string &url, uint64_t request_size) const;
+  void finish(HttpExchange exchange, HttpResponse response, std::string body, uint64_t body_size);
+  HttpResponse getStreamRecorded(const std::string &url, const HttpBodySink &sink,
+                                 const std::function<HttpResponse(const HttpBodySink &)> &request);
+  std::future<HttpResponse> downloadRecorded(
+      HttpExchange exchange, curl_write_callback write_cb, curl_xferinfo_callback progress_cb, void *userp,
+      const std::function<std::future<HttpResponse>(curl_write_callback, curl_xferinfo_callback, void *)> &request);
+  static size_t writeDownload(char *data, size_t size, size_t nmemb, void *userp);
+  static int progressDownload(void *userp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                              curl_off_t ulnow);
+
+  std::shared_ptr<HttpInterface> inner_;
+  const int64_t max_body_size_;
+  const std::chrono::steady_clock::time_point started_;
+  std::mutex mutex_;
+  std::ofstream out_;
+};
+
+#endif  // HTTPRECORDER_H_
@@ -0,0 +1,211 @@
+#include "httpreplay.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+constexpr size_t HttpReplay::kChunkSize;
+
+HttpReplay::HttpReplay(const boost::filesystem::path &path, const double time_scale) : time_scale_{time_scale} {
+  std::ifstream in(path.string());
+  if (!in) {
+    throw std::runtime_error("Can't open HTTP recording " + path.string());
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    auto exchange = std::make_shared<const HttpExchange>(HttpExchange::fromJson(Utils::parseJSON(line)));
+    queues_[exchange->key()].exchanges.push_back(exchange);
+    ++exchanges_count_;
+  }
+  LOG_DEBUG << "Replaying " << exchanges_count_ << " HTTP requests from " << path;
+}
+
+HttpReplay::Exchange HttpReplay::next(const std::string &method, const std::string &url, const std::string &range) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    const auto it = queues_.find(HttpExchange::key(method, url, range));
+    if (it != queues_.end()) {
+      Queue &queue = it->second;
+      const size_t index = std::min(queue.next, queue.exchanges.size() - 1);
+      ++queue.next;
+      return queue.exchanges[index];
+    }
+  }
+  LOG_WARNING << "No recorded response to " << HttpExchange::key(method, url, range);
+  ++unmatched_;
+  auto missing = std::make_shared<HttpExchange>();
+  missing->method = method;
+  missing->url = url;
+  missing->range = range;
+  missing->response = HttpResponse("", 404, CURLE_OK, "Not recorded");
+  return missing;
+}
+
+CURLcode HttpReplay::deliver(const HttpExchange &exchange, const HttpBodySink &sink,
+                             const std::function<bool(uint64_t)> &progress) const {
+  const auto start = std::chrono::steady_clock::now();
+  const std::chrono::duration<double, std::milli> latency(exchange.latency_ms * time_scale_);
+  const uint64_t size = exchange.body_recorded ? exchange.response.body.size() : exchange.response_size;
+  if (size == 0) {
+    std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(latency));
+    return CURLE_OK;
+  }
+  // stands in for the bodies that were too large to be recorded
+  const std::string filler(exchange.body_recorded ? 0 : kChunkSize, '\0');
+  for (uint64_t sent = 0; sent < size;) {
+    const auto chunk = static_cast<size_t>(std::min<uint64_t>(kChunkSize, size - sent));
+    const auto due = latency * (static_cast<double>(sent + chunk) / static_cast<double>(size));
+    std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(due));
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const char *data = exchange.body_recorded ? exchange.response.body.data() + sent : filler.data();
+    if (!sink(data, chunk)) {
+      return CURLE_WRITE_ERROR;
+    }
+    sent += chunk;
+    if (progress && !progress(sent)) {
+      return CURLE_ABORTED_BY_CALLBACK;
+    }
+  }
+  return CURLE_OK;
+}
+
+HttpResponse HttpReplay::respond(const std::string &method, const std::string &url,
+                                 const api::FlowControlToken *flow_control) {
+  const Exchange exchange = next(method, url);
+  HttpResponse response = exchange->response;
+  response.body.clear();
+  const CURLcode code = deliver(
+      *exchange,
+      [&response](const char *data, size_t size) {
+        response.body.append(data, size);
+        return true;
+      },
+      [flow_control](uint64_t) { return flow_control == nullptr || !flow_control->hasAborted(); });
+  if (code != CURLE_OK) {
+    return HttpResponse("", 0, code, "Replay aborted");
+  }
+  return response;
+}
+
+HttpResponse HttpReplay::get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) {
+  // the recorded responses were within the limits
+  (void)maxsize;
+  return respond("GET", url, flow_control);
+}
+
+HttpResponse HttpReplay::getStream(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                                   const HttpBodySink &sink) {
+  (void)maxsize;
+  const Exchange exchange = next("GET", url);
+  HttpResponse response = exchange->response;
+  response.body.clear();
+  const CURLcode code = deliver(*exchange, sink, [flow_control](uint64_t) {
+    return flow_control == nullptr || !flow_control->hasAborted();
+  });
+  if (code != CURLE_OK) {
+    return HttpResponse("", 0, code, "Replay aborted");
+  }
+  return response;
+}
+
+HttpResponse HttpReplay::getStreamIfModified(const std::string &url, int64_t maxsize,
+                                             const api::FlowControlToken *flow_control,
+                                             const HttpCacheValidators &validators, const HttpBodySink &sink) {
+  // the recording says whether the resource had changed
+  (void)validators;
+  return getStream(url, maxsize, flow_control, sink);
+}
+
+HttpResponse HttpReplay::post(const std::string &url, const std::string &content_type, const std::string &data) {
+  (void)content_type;
+  (void)data;
+  return respond("POST", url);
+}
+
+HttpResponse HttpReplay::post(const std::string &url, const Json::Value &data) {
+  (void)data;
+  return respond("POST", url);
+}
+
+HttpResponse HttpReplay::postEncoded(const std::string &url, const std::string &content_type,
+                                     const std::string &content_encoding, const std::string &data) {
+  (void)content_type;
+  (void)content_encoding;
+  (void)data;
+  return respond("POST", url);
+}
+
+HttpResponse HttpReplay::put(const std::string &url, const std::string &content_type, const std::string &data) {
+  (void)content_type;
+  (void)data;
+  return respond("PUT", url);
+}
+
+HttpResponse HttpReplay::put(const std::string &url, const Json::Value &data) {
+  (void)data;
+  return respond("PUT", url);
+}
+
+std::future<HttpResponse> HttpReplay::replayDownload(Exchange exchange, curl_write_callback write_cb,
+                                                     curl_xferinfo_callback progress_cb, void *userp) const {
+  return std::async(std::launch::async, [this, exchange, write_cb, progress_cb, userp]() {
+    HttpResponse response = exchange->response;
+    // the body went to the write callback
+    response.body.clear();
+    const auto total = static_cast<curl_off_t>(exchange->body_recorded ? exchange->response.body.size()
+                                                                       : exchange->response_size);
+    std::function<bool(uint64_t)> progress;
+    if (progress_cb != nullptr) {
+      progress = [progress_cb, userp, total](uint64_t sent) {
+        return progress_cb(userp, total, static_cast<curl_off_t>(sent), 0, 0) == 0;
+      };
+    }
+    const CURLcode code = deliver(
+        *exchange,
+        [write_cb, userp](const char *data, size_t size) {
+          // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+          return write_cb(const_cast<char *>(data), 1, size, userp) == size;
+        },
+        progress);
+    if (code != CURLE_OK) {
+      response.curl_code = code;
+    }
+    return response;
+  });
+}
+
+HttpResponse HttpReplay::download(const std::string &url, curl_write_callback write_cb,
+                                  curl_xferinfo_callback progress_cb, void *userp, curl_off_t from) {
+  return downloadAsync(url, write_cb, progress_cb, userp, from, nullptr).get();
+}
+
+std::future<HttpResponse> HttpReplay::downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                                    curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                                    CurlHandler *easyp) {
+  // the replayed transfers can't be paused
+  (void)easyp;
+  const std::string range = from > 0 ? "bytes=" + std::to_string(from) + "-" : "";
+  return replayDownload(next("DOWNLOAD", url, range), write_cb, progress_cb, userp);
+}
+
+std::future<HttpResponse> HttpReplay::downloadRangeAsync(const std::string &url, curl_write_callback write_cb,
+                                                         curl_xferinfo_callback progress_cb, void *userp,
+                                                         curl_off_t from, curl_off_t to, CurlHandler *easyp) {
+  (void)easyp;
+  const std::string range = "bytes=" + std::to_string(from) + "-" + std::to_string(to);
+  return replayDownload(next("DOWNLOAD", url, range), write_cb, progress_cb, userp);
+}
+
+void HttpReplay::setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert,
+                          CryptoSource cert_source, const std::string &pkey, CryptoSource pkey_source) {
+  (void)ca;
+  (void)ca_source;
+  (void)cert;
+  (void)cert_source;
+  (void)pkey;
+  (void)pkey_source;
+}
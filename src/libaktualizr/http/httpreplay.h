@@ -0,0 +1,92 @@
+#ifndef HTTPREPLAY_H_
+#define HTTPREPLAY_H_
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "httpinterface.h"
+#include "httprecorder.h"
+
+/**
+ * Serves the responses of an HttpRecorder recording again, each after the
+ * time it took when it was recorded multiplied by `time_scale` (0 to answer
+ * right away). Bodies are passed on in pieces spread over that time, so that
+ * the progress of downloads is reported as it was.
+ *
+ * The requests for a URL get the responses recorded for it in turn, the last
+ * one again once they have all been served. A request that was never recorded
+ * gets 404 Not Found.
+ */
+class HttpReplay : public HttpInterface {
+ public:
+  // throws std::runtime_error if the recording can't be read
+  explicit HttpReplay(const boost::filesystem::path &path, double time_scale = 1.0);
+  ~HttpReplay() override = default;
+  HttpReplay(const HttpReplay &) = delete;
+  HttpReplay(HttpReplay &&) = delete;
+  HttpReplay &operator=(const HttpReplay &) = delete;
+  HttpReplay &operator=(HttpReplay &&) = delete;
+
+  using HttpInterface::get;
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override;
+  HttpResponse getStream(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                         const HttpBodySink &sink) override;
+  HttpResponse getStreamIfModified(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                                   const HttpCacheValidators &validators, const HttpBodySink &sink) override;
+  HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse post(const std::string &url, const Json::Value &data) override;
+  HttpResponse postEncoded(const std::string &url, const std::string &content_type,
+                           const std::string &content_encoding, const std::string &data) override;
+  HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse put(const std::string &url, const Json::Value &data) override;
+  HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void *userp, curl_off_t from) override;
+  std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                          CurlHandler *easyp) override;
+  std::future<HttpResponse> downloadRangeAsync(const std::string &url, curl_write_callback write_cb,
+                                               curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                               curl_off_t to, CurlHandler *easyp) override;
+  void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
+                const std::string &pkey, CryptoSource pkey_source) override;
+
+  size_t exchangesCount() const { return exchanges_count_; }
+  // requests that weren't recorded, a sign that the recording is not the one
+  // of the session being replayed
+  size_t unmatched() const { return unmatched_; }
+
+  // pieces in which bodies are passed on
+  static constexpr size_t kChunkSize = 16 * 1024;
+
+ private:
+  using Exchange = std::shared_ptr<const HttpExchange>;
+  struct Queue {
+    std::vector<Exchange> exchanges;
+    size_t next{0};
+  };
+
+  Exchange next(const std::string &method, const std::string &url, const std::string &range = "");
+  // waits the scaled latency, passing the body on to the sink on the way;
+  // `progress` is told how much was passed on, and aborts if it returns false
+  CURLcode deliver(const HttpExchange &exchange, const HttpBodySink &sink,
+                   const std::function<bool(uint64_t)> &progress) const;
+  HttpResponse respond(const std::string &method, const std::string &url,
+                       const api::FlowControlToken *flow_control = nullptr);
+  std::future<HttpResponse> replayDownload(Exchange exchange, curl_write_callback write_cb,
+                                           curl_xferinfo_callback progress_cb, void *userp) const;
+
+  const double time_scale_;
+  size_t exchanges_count_{0};
+  std::mutex mutex_;
+  std::map<std::string, Queue> queues_;
+  std::atomic<size_t> unmatched_{0};
+};
+
+#endif  // HTTPREPLAY_H_
@@ -0,0 +1,211 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/httprecorder.h"
+#include "http/httpreplay.h"
+#include "httpfake.h"
+#include "test_utils.h"
+#include "utilities/utils.h"
+
+// the progress and body of a download
+struct Received {
+  std::string body;
+  std::vector<curl_off_t> progress;
+  bool abort{false};
+};
+
+static size_t writeReceived(char *data, size_t size, size_t nmemb, void *userp) {
+  static_cast<Received *>(userp)->body.append(data, size * nmemb);
+  return size * nmemb;
+}
+
+static int progressReceived(void *userp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+  (void)dltotal;
+  (void)ultotal;
+  (void)ulnow;
+  auto *received = static_cast<Received *>(userp);
+  received->progress.push_back(dlnow);
+  return received->abort ? 1 : 0;
+}
+
+class SlowServer : public HttpFake {
+ public:
+  using HttpFake::HttpFake;
+  using HttpFake::get;
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return HttpFake::get(url, maxsize, flow_control);
+  }
+};
+
+static double elapsedMs(const std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * What was recorded is served again, with the same bodies, and the time the
+ * requests took.
+ */
+TEST(HttpReplay, RecordReplay) {
+  TemporaryDirectory temp_dir;
+  const std::string root = "{\"signed\":{\"version\":1}}";
+  std::string image(100000, 'i');
+  image[10] = '\0';
+  Utils::writeFile(temp_dir / "meta/director/1.root.json", root);
+  Utils::writeFile(temp_dir / "meta/targets/image.bin", image);
+  auto server = std::make_shared<SlowServer>(temp_dir.Path(), "", temp_dir / "meta");
+  const std::string url = server->tls_server;
+  const boost::filesystem::path recording = temp_dir / "session.jsonl";
+
+  {
+    HttpRecorder recorder(server, recording);
+    EXPECT_EQ(recorder.get(url + "/director/1.root.json", HttpInterface::kNoLimit).body, root);
+    std::string streamed;
+    const HttpResponse response =
+        recorder.getStream(url + "/director/1.root.json", HttpInterface::kNoLimit, nullptr,
+                           [&streamed](const char *data, size_t size) {
+                             streamed.append(data, size);
+                             return true;
+                           });
+    EXPECT_TRUE(response.isOk());
+    EXPECT_EQ(streamed, root);
+    EXPECT_EQ(recorder.get(url + "/director/2.root.json", HttpInterface::kNoLimit).http_status_code, 404);
+    EXPECT_TRUE(recorder.put(url + "/director/manifest", Json::Value("manifest")).isOk());
+    Received received;
+    EXPECT_TRUE(recorder.download(url + "/targets/image.bin", writeReceived, progressReceived, &received, 0).isOk());
+    EXPECT_EQ(received.body, image);
+  }
+
+  const std::vector<std::string> lines = [&recording] {
+    std::vector<std::string> result;
+    std::istringstream in(Utils::readFile(recording));
+    for (std::string line; std::getline(in, line);) {
+      result.push_back(line);
+    }
+    return result;
+  }();
+  ASSERT_EQ(lines.size(), 5);
+  const HttpExchange first = HttpExchange::fromJson(Utils::parseJSON(lines[0]));
+  EXPECT_EQ(first.method, "GET");
+  EXPECT_EQ(first.response_size, root.size());
+  EXPECT_GE(first.latency_ms, 50);
+  const HttpExchange put = HttpExchange::fromJson(Utils::parseJSON(lines[3]));
+  EXPECT_EQ(put.method, "PUT");
+  EXPECT_EQ(put.request_size, Utils::jsonToStr(Json::Value("manifest")).size());
+  const HttpExchange download = HttpExchange::fromJson(Utils::parseJSON(lines[4]));
+  EXPECT_EQ(download.method, "DOWNLOAD");
+  EXPECT_TRUE(download.body_recorded);
+  EXPECT_EQ(download.response.body, image);
+
+  HttpReplay replay(recording, 0);
+  EXPECT_EQ(replay.exchangesCount(), 5);
+  EXPECT_EQ(replay.get(url + "/director/1.root.json", HttpInterface::kNoLimit).body, root);
+  std::string streamed;
+  replay.getStream(url + "/director/1.root.json", HttpInterface::kNoLimit, nullptr,
+                   [&streamed](const char *data, size_t size) {
+                     streamed.append(data, size);
+                     return true;
+                   });
+  EXPECT_EQ(streamed, root);
+  // all served, the last one again
+  EXPECT_EQ(replay.get(url + "/director/1.root.json", HttpInterface::kNoLimit).body, root);
+  EXPECT_EQ(replay.get(url + "/director/2.root.json", HttpInterface::kNoLimit).http_status_code, 404);
+  EXPECT_TRUE(replay.put(url + "/director/manifest", Json::Value("manifest")).isOk());
+  Received received;
+  EXPECT_TRUE(replay.download(url + "/targets/image.bin", writeReceived, progressReceived, &received, 0).isOk());
+  EXPECT_EQ(received.body, image);
+  ASSERT_FALSE(received.progress.empty());
+  EXPECT_EQ(received.progress.back(), image.size());
+  EXPECT_EQ(replay.unmatched(), 0);
+
+  EXPECT_EQ(replay.get(url + "/director/3.root.json", HttpInterface::kNoLimit).http_status_code, 404);
+  EXPECT_EQ(replay.unmatched(), 1);
+}
+
+/*
+ * Bodies over the limit are recorded by size, and replayed as that many
+ * bytes.
+ */
+TEST(HttpReplay, BodyLimit) {
+  TemporaryDirectory temp_dir;
+  Utils::writeFile(temp_dir / "meta/targets/image.bin", std::string(100000, 'i'));
+  auto server = std::make_shared<HttpFake>(temp_dir.Path(), "", temp_dir / "meta");
+  const std::string url = server->tls_server + "/targets/image.bin";
+  {
+    HttpRecorder recorder(server, temp_dir / "session.jsonl", 1000);
+    Received received;
+    EXPECT_TRUE(recorder.download(url, writeReceived, progressReceived, &received, 0).isOk());
+  }
+  const HttpExchange download = HttpExchange::fromJson(Utils::parseJSON(Utils::readFile(temp_dir / "session.jsonl")));
+  EXPECT_FALSE(download.body_recorded);
+  EXPECT_EQ(download.response_size, 100000);
+
+  HttpReplay replay(temp_dir / "session.jsonl", 0);
+  Received received;
+  EXPECT_TRUE(replay.download(url, writeReceived, progressReceived, &received, 0).isOk());
+  EXPECT_EQ(received.body, std::string(100000, '\0'));
+}
+
+/*
+ * The recorded latency is reproduced, scaled.
+ */
+TEST(HttpReplay, Timing) {
+  TemporaryFile recording;
+  Json::Value get;
+  get["method"] = "GET";
+  get["url"] = "https://example.com/meta";
+  get["latency_ms"] = 200;
+  get["status"] = 200;
+  get["curl_code"] = 0;
+  get["response_size"] = 5;
+  get["body"] = Utils::toBase64("hello");
+  Json::Value download;
+  download["method"] = "DOWNLOAD";
+  download["url"] = "https://example.com/image";
+  download["latency_ms"] = 300;
+  download["status"] = 200;
+  download["curl_code"] = 0;
+  download["response_size"] = 100000;
+  recording.PutContents(Utils::jsonToCanonicalStr(get) + "\n" + Utils::jsonToCanonicalStr(download) + "\n");
+
+  HttpReplay replay(recording.Path(), 0.5);
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(replay.get("https://example.com/meta", HttpInterface::kNoLimit).body, "hello");
+  EXPECT_GE(elapsedMs(start), 100);
+
+  start = std::chrono::steady_clock::now();
+  Received received;
+  auto pending = replay.downloadAsync("https://example.com/image", writeReceived, progressReceived, &received, 0,
+                                      nullptr);
+  EXPECT_TRUE(pending.get().isOk());
+  EXPECT_GE(elapsedMs(start), 150);
+  EXPECT_EQ(received.body.size(), 100000);
+  const size_t chunks = (100000 + HttpReplay::kChunkSize - 1) / HttpReplay::kChunkSize;
+  EXPECT_EQ(received.progress.size(), chunks);
+
+  // answered right away
+  HttpReplay fast(recording.Path(), 0);
+  start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(fast.get("https://example.com/meta", HttpInterface::kNoLimit).isOk());
+  EXPECT_LT(elapsedMs(start), 100);
+
+  Received aborted;
+  aborted.abort = true;
+  EXPECT_EQ(fast.download("https://example.com/image", writeReceived, progressReceived, &aborted, 0).curl_code,
+            CURLE_ABORTED_BY_CALLBACK);
+  EXPECT_EQ(aborted.body.size(), HttpReplay::kChunkSize);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,68 @@
+#include "http/notification_listener.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "logging/logging.h"
+
+// notifications have no use for a body
+static constexpr int64_t kMaxNotificationSize = 64 * 1024;
+
+NotificationListener::NotificationListener(std::shared_ptr<HttpInterface> http, std::string url,
+                                           std::function<void()> on_notify, std::chrono::milliseconds max_retry_wait)
+    : http_(std::move(http)),
+      url_(std::move(url)),
+      on_notify_(std::move(on_notify)),
+      max_retry_wait_(std::max(max_retry_wait, kMinRetryWait)),
+      thread_([this]() { run(); }) {}
+
+NotificationListener::~NotificationListener() { stop(); }
+
+void NotificationListener::stop() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  token_.setAbort();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool NotificationListener::waitFor(std::chrono::milliseconds wait) {
+  std::unique_lock<std::mutex> lock(m_);
+  return !cv_.wait_for(lock, wait, [this] { return stopped_; });
+}
+
+void NotificationListener::run() {
+  LOG_DEBUG << "Listening to update notifications at " << url_;
+  std::chrono::milliseconds retry_wait = kMinRetryWait;
+  while (!token_.hasAborted()) {
+    const auto start = std::chrono::steady_clock::now();
+    const HttpResponse response = http_->get(url_, kMaxNotificationSize, &token_);
+    if (token_.hasAborted()) {
+      break;
+    }
+    std::chrono::milliseconds wait{0};
+    if (response.http_status_code == 200 || response.http_status_code == 204 ||
+        response.curl_code == CURLE_OPERATION_TIMEDOUT) {
+      if (response.http_status_code == 200) {
+        LOG_INFO << "The server notified that there may be updates";
+        on_notify_();
+      }
+      retry_wait = kMinRetryWait;
+      // a server that answers right away is not asked more than once per kMinRetryWait
+      wait = std::chrono::duration_cast<std::chrono::milliseconds>(start + kMinRetryWait -
+                                                                   std::chrono::steady_clock::now());
+    } else {
+      LOG_DEBUG << "Update notifications failed (" << response.getStatusStr() << "), listening again in "
+                << retry_wait.count() << " ms";
+      wait = retry_wait;
+      retry_wait = std::min(retry_wait * 2, max_retry_wait_);
+    }
+    if (wait.count() > 0 && !waitFor(wait)) {
+      break;
+    }
+  }
+}
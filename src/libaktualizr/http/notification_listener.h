@@ -0,0 +1,59 @@
+#ifndef HTTP_NOTIFICATION_LISTENER_H_
+#define HTTP_NOTIFICATION_LISTENER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "http/httpinterface.h"
+#include "utilities/flow_control.h"
+
+/**
+ * Long-polls a URL of the server, so that new updates and campaigns are
+ * noticed without waiting for the next poll of Aktualizr::RunForever().
+ *
+ * The server holds each GET until it has something to tell or its own
+ * timeout:
+ * - 200: something changed, e.g. the Director has new targets for the device,
+ *   and `on_notify` is called. The body is not used.
+ * - 204, or a client side timeout: nothing changed.
+ * Either way, the next GET is sent right away. After any other response, the
+ * listener waits longer and longer before trying again, so a server without
+ * notifications costs next to nothing; polling keeps working meanwhile.
+ */
+class NotificationListener {
+ public:
+  NotificationListener(std::shared_ptr<HttpInterface> http, std::string url, std::function<void()> on_notify,
+                       std::chrono::milliseconds max_retry_wait = std::chrono::minutes(10));
+  ~NotificationListener();
+  NotificationListener(const NotificationListener&) = delete;
+  NotificationListener(NotificationListener&&) = delete;
+  NotificationListener& operator=(const NotificationListener&) = delete;
+  NotificationListener& operator=(NotificationListener&&) = delete;
+
+  // Abort the GET in flight and wait for the listener to finish
+  void stop();
+
+  static constexpr std::chrono::milliseconds kMinRetryWait{1000};
+
+ private:
+  void run();
+  // returns false if stopped meanwhile
+  bool waitFor(std::chrono::milliseconds wait);
+
+  const std::shared_ptr<HttpInterface> http_;
+  const std::string url_;
+  const std::function<void()> on_notify_;
+  const std::chrono::milliseconds max_retry_wait_;
+  api::FlowControlToken token_;
+  std::mutex m_;
+  std::condition_variable cv_;
+  bool stopped_{false};
+  std::thread thread_;
+};
+
+#endif  // HTTP_NOTIFICATION_LISTENER_H_
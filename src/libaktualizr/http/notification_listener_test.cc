@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "http/notification_listener.h"
+#include "httpfake.h"
+
+// answers the notification GETs with the given statuses, then holds them until aborted
+class HttpNotifications : public HttpFake {
+ public:
+  HttpNotifications(const boost::filesystem::path &test_dir_in, std::vector<long> statuses)  // NOLINT
+      : HttpFake(test_dir_in), statuses_(std::move(statuses)) {}
+
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override {
+    (void)url;
+    (void)maxsize;
+    const size_t request = requests++;
+    if (request < statuses_.size()) {
+      return HttpResponse("", statuses_[request], CURLE_OK, "");
+    }
+    while (!flow_control->hasAborted()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return HttpResponse("", 0, CURLE_ABORTED_BY_CALLBACK, "aborted");
+  }
+
+  std::atomic<size_t> requests{0};
+
+ private:
+  std::vector<long> statuses_;  // NOLINT(google-runtime-int)
+};
+
+/* Only a 200 is a notification, failures are retried after a while, and
+ * stopping aborts the GET that is held by the server. */
+TEST(NotificationListener, Notify) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpNotifications>(temp_dir.Path(), std::vector<long>{204, 500, 200});  // NOLINT
+  std::mutex m;
+  std::condition_variable cv;
+  int notifications = 0;
+
+  const auto start = std::chrono::steady_clock::now();
+  NotificationListener listener(http, "https://example.com/notifications", [&]() {
+    std::lock_guard<std::mutex> lock(m);
+    ++notifications;
+    cv.notify_all();
+  });
+  {
+    std::unique_lock<std::mutex> lock(m);
+    EXPECT_TRUE(cv.wait_for(lock, std::chrono::seconds(20), [&]() { return notifications > 0; }));
+  }
+  // it waited after the 204, which came right away, and after the failure
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 2 * NotificationListener::kMinRetryWait);
+  listener.stop();
+  EXPECT_EQ(notifications, 1);
+  EXPECT_GE(http->requests, 3);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
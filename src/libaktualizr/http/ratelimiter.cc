@@ -0,0 +1,224 @@
+#include "ratelimiter.h"
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+
+// How often the time of the day and the network type are checked.
+static constexpr std::chrono::seconds kPolicyCheckInterval{10};
+// Smallest bucket, so that a low rate still lets whole network reads through.
+static constexpr double kMinBucketSize = 16 * 1024;
+
+bool RateLimitWindow::contains(int minute_of_day) const {
+  if (start_minute <= end_minute) {
+    return minute_of_day >= start_minute && minute_of_day < end_minute;
+  }
+  return minute_of_day >= start_minute || minute_of_day < end_minute;
+}
+
+static int parseTimeOfDay(const std::string &time) {
+  int hours = 0;
+  int minutes = 0;
+  char sep = 0;
+  std::istringstream in(time);
+  if (!(in >> hours >> sep >> minutes) || sep != ':' || !in.eof() || hours < 0 || hours > 24 || minutes < 0 ||
+      minutes > 59 || (hours == 24 && minutes != 0)) {
+    throw std::invalid_argument("Invalid time of the day: " + time);
+  }
+  return hours * 60 + minutes;
+}
+
+std::vector<RateLimitWindow> RateLimitPolicy::parseSchedule(const std::string &schedule) {
+  std::vector<RateLimitWindow> windows;
+  std::vector<std::string> entries;
+  boost::split(entries, schedule, boost::is_any_of(","));
+  for (auto &entry : entries) {
+    boost::trim(entry);
+    if (entry.empty()) {
+      continue;
+    }
+    const auto dash = entry.find('-');
+    const auto equal = entry.find('=');
+    if (dash == std::string::npos || equal == std::string::npos || equal < dash) {
+      throw std::invalid_argument("Invalid rate limit schedule entry: " + entry);
+    }
+    RateLimitWindow window;
+    window.start_minute = parseTimeOfDay(boost::trim_copy(entry.substr(0, dash)));
+    window.end_minute = parseTimeOfDay(boost::trim_copy(entry.substr(dash + 1, equal - dash - 1)));
+    const std::string rate = boost::trim_copy(entry.substr(equal + 1));
+    if (rate.empty() || rate.find_first_not_of("0123456789") != std::string::npos) {
+      throw std::invalid_argument("Invalid rate in rate limit schedule entry: " + entry);
+    }
+    window.rate = std::stoull(rate);
+    windows.push_back(window);
+  }
+  return windows;
+}
+
+RateLimitPolicy RateLimitPolicy::fromConfig(uint64_t rate, const std::string &schedule, uint64_t metered_rate,
+                                            const std::string &metered_interfaces) {
+  RateLimitPolicy policy;
+  policy.rate = rate;
+  policy.schedule = parseSchedule(schedule);
+  policy.metered_rate = metered_rate;
+  boost::split(policy.metered_interfaces, metered_interfaces, boost::is_any_of(", "), boost::token_compress_on);
+  policy.metered_interfaces.erase(
+      std::remove(policy.metered_interfaces.begin(), policy.metered_interfaces.end(), std::string()),
+      policy.metered_interfaces.end());
+  return policy;
+}
+
+static uint64_t lowerLimit(uint64_t a, uint64_t b) {
+  if (a == 0) {
+    return b;
+  }
+  if (b == 0) {
+    return a;
+  }
+  return std::min(a, b);
+}
+
+uint64_t RateLimitPolicy::rateAt(int minute_of_day, bool metered) const {
+  uint64_t result = rate;
+  for (const auto &window : schedule) {
+    if (window.contains(minute_of_day)) {
+      result = window.rate;
+      break;
+    }
+  }
+  if (metered) {
+    result = lowerLimit(result, metered_rate);
+  }
+  return result;
+}
+
+uint64_t RateLimitPolicy::lowestRate() const {
+  uint64_t result = lowerLimit(rate, metered_rate);
+  for (const auto &window : schedule) {
+    result = lowerLimit(result, window.rate);
+  }
+  return result;
+}
+
+RateLimiter::RateLimiter(RateLimitPolicy policy)
+    : policy_(std::move(policy)), tokens_(kMinBucketSize), last_refill_(std::chrono::steady_clock::now()) {
+  // evaluate the policy on first use
+  policy_checked_ = last_refill_ - kPolicyCheckInterval;
+}
+
+bool RateLimiter::consume(size_t bytes) {
+  std::lock_guard<std::mutex> lock(m_);
+  const auto now = std::chrono::steady_clock::now();
+  refill(now);
+  if (effectiveRate(now) == 0) {
+    return true;
+  }
+  if (tokens_ <= 0) {
+    return false;
+  }
+  tokens_ -= static_cast<double>(bytes);
+  return true;
+}
+
+std::chrono::milliseconds RateLimiter::waitTime() {
+  std::lock_guard<std::mutex> lock(m_);
+  const auto now = std::chrono::steady_clock::now();
+  refill(now);
+  const uint64_t rate = effectiveRate(now);
+  if (rate == 0 || tokens_ > 0) {
+    return std::chrono::milliseconds(0);
+  }
+  return std::chrono::milliseconds(static_cast<int64_t>(-tokens_ * 1000. / static_cast<double>(rate)) + 1);
+}
+
+uint64_t RateLimiter::currentRate() {
+  std::lock_guard<std::mutex> lock(m_);
+  return effectiveRate(std::chrono::steady_clock::now());
+}
+
+uint64_t RateLimiter::lowestRate() {
+  std::lock_guard<std::mutex> lock(m_);
+  if (override_) {
+    return *override_;
+  }
+  return policy_.lowestRate();
+}
+
+void RateLimiter::setOverride(uint64_t rate) {
+  std::lock_guard<std::mutex> lock(m_);
+  LOG_INFO << "Download rate limit set to " << rate << " bytes/s";
+  override_ = rate;
+  tokens_ = std::min(tokens_, 0.);
+}
+
+void RateLimiter::clearOverride() {
+  std::lock_guard<std::mutex> lock(m_);
+  LOG_INFO << "Download rate limit reset to the configured policy";
+  override_ = boost::none;
+}
+
+std::string RateLimiter::defaultRouteInterface(const std::string &route_file) {
+  std::ifstream routes(route_file);
+  std::string line;
+  // skip the header
+  std::getline(routes, line);
+  while (std::getline(routes, line)) {
+    std::istringstream fields(line);
+    std::string iface;
+    std::string destination;
+    if (fields >> iface >> destination && destination == "00000000") {
+      return iface;
+    }
+  }
+  return std::string();
+}
+
+uint64_t RateLimiter::effectiveRate(std::chrono::steady_clock::time_point now) {
+  uint64_t rate = 0;
+  if (override_) {
+    rate = *override_;
+  } else if (!policy_.empty()) {
+    if (now - policy_checked_ >= kPolicyCheckInterval) {
+      const std::time_t t = std::time(nullptr);
+      std::tm local{};
+      localtime_r(&t, &local);
+      bool metered = false;
+      if (policy_.metered_rate != 0 && !policy_.metered_interfaces.empty()) {
+        const std::string iface = defaultRouteInterface();
+        metered = std::find(policy_.metered_interfaces.begin(), policy_.metered_interfaces.end(), iface) !=
+                  policy_.metered_interfaces.end();
+      }
+      const uint64_t new_rate = policy_.rateAt(local.tm_hour * 60 + local.tm_min, metered);
+      if (new_rate != policy_rate_) {
+        LOG_DEBUG << "Download rate limit is now " << new_rate << " bytes/s" << (metered ? " (metered network)" : "");
+      }
+      policy_rate_ = new_rate;
+      policy_checked_ = now;
+    }
+    rate = policy_rate_;
+  }
+  if (rate != 0 && interactive_ > 0) {
+    rate = std::max<uint64_t>(rate / 2, 1);
+  }
+  return rate;
+}
+
+void RateLimiter::refill(std::chrono::steady_clock::time_point now) {
+  const uint64_t rate = effectiveRate(now);
+  const std::chrono::duration<double> elapsed = now - last_refill_;
+  last_refill_ = now;
+  if (rate == 0) {
+    // start with a small burst once a limit applies
+    tokens_ = kMinBucketSize;
+    return;
+  }
+  const double bucket_size = std::max(static_cast<double>(rate), kMinBucketSize);
+  tokens_ = std::min(tokens_ + elapsed.count() * static_cast<double>(rate), bucket_size);
+}
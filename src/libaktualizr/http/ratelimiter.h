@@ -0,0 +1,110 @@
+#ifndef RATELIMITER_H_
+#define RATELIMITER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+/**
+ * A download rate limit that applies during a time of the day, in local time.
+ * The window may wrap around midnight (e.g. 22:00-06:00).
+ */
+struct RateLimitWindow {
+  // minutes since midnight, the end is excluded
+  int start_minute{0};
+  int end_minute{0};
+  // bytes per second, 0 for no limit
+  uint64_t rate{0};
+
+  bool contains(int minute_of_day) const;
+};
+
+/**
+ * Which download rate limit applies when.
+ *
+ * Outside of the schedule windows, `rate` applies; inside, the rate of the
+ * window does instead. When the default route goes through one of the metered
+ * interfaces, `metered_rate` applies on top of that. The lowest limit wins; a
+ * limit of 0 means no limit.
+ */
+struct RateLimitPolicy {
+  uint64_t rate{0};
+  std::vector<RateLimitWindow> schedule;
+  uint64_t metered_rate{0};
+  std::vector<std::string> metered_interfaces;
+
+  /**
+   * Parse a schedule like "08:00-18:00=65536,22:00-06:00=0".
+   * @throws std::invalid_argument if it is malformed.
+   */
+  static std::vector<RateLimitWindow> parseSchedule(const std::string &schedule);
+  static RateLimitPolicy fromConfig(uint64_t rate, const std::string &schedule, uint64_t metered_rate,
+                                    const std::string &metered_interfaces);
+
+  bool empty() const { return rate == 0 && metered_rate == 0 && schedule.empty(); }
+  // limit at a given time of the day, in bytes per second, 0 for no limit
+  uint64_t rateAt(int minute_of_day, bool metered) const;
+  // lowest limit that can apply, 0 if there is none
+  uint64_t lowestRate() const;
+};
+
+/**
+ * Token bucket shared by all the downloads of an HttpClient and its copies.
+ *
+ * Downloads take tokens for the data they receive and wait while the bucket
+ * is empty. The bucket holds at most one second worth of data. The rate
+ * follows the policy and can be overridden at runtime.
+ *
+ * While an interactive request (anything that isn't a download) is running,
+ * downloads only get half of the rate, so that they don't starve it.
+ */
+class RateLimiter {
+ public:
+  explicit RateLimiter(RateLimitPolicy policy);
+
+  /**
+   * Take tokens for `bytes` of received data. The bucket may go into debt, so
+   * that data of any size can be taken as soon as some tokens are available.
+   * @return false if the bucket is empty and the download has to wait.
+   */
+  bool consume(size_t bytes);
+  // how long until tokens are available again
+  std::chrono::milliseconds waitTime();
+  // current limit in bytes per second, 0 for no limit
+  uint64_t currentRate();
+  // lowest limit that can apply, 0 if there is none
+  uint64_t lowestRate();
+
+  // replace the policy by a fixed limit, 0 for no limit
+  void setOverride(uint64_t rate);
+  // go back to the policy
+  void clearOverride();
+
+  void beginInteractive() { ++interactive_; }
+  void endInteractive() { --interactive_; }
+
+  // interface of the default route, empty if unknown
+  static std::string defaultRouteInterface(const std::string &route_file = "/proc/net/route");
+
+ private:
+  // must be called with m_ held
+  uint64_t effectiveRate(std::chrono::steady_clock::time_point now);
+  void refill(std::chrono::steady_clock::time_point now);
+
+  const RateLimitPolicy policy_;
+  std::mutex m_;
+  boost::optional<uint64_t> override_;
+  double tokens_{0};
+  std::chrono::steady_clock::time_point last_refill_;
+  // the policy rate is only re-evaluated from time to time
+  uint64_t policy_rate_{0};
+  std::chrono::steady_clock::time_point policy_checked_;
+  std::atomic<int> interactive_{0};
+};
+
+#endif  // RATELIMITER_H_
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "http/ratelimiter.h"
+#include "utilities/utils.h"
+
+TEST(RateLimiter, ParseSchedule) {
+  const auto windows = RateLimitPolicy::parseSchedule(" 08:00-18:30=65536, 22:00-06:00=0,");
+  ASSERT_EQ(windows.size(), 2);
+  EXPECT_EQ(windows[0].start_minute, 8 * 60);
+  EXPECT_EQ(windows[0].end_minute, 18 * 60 + 30);
+  EXPECT_EQ(windows[0].rate, 65536);
+  EXPECT_EQ(windows[1].start_minute, 22 * 60);
+  EXPECT_EQ(windows[1].end_minute, 6 * 60);
+  EXPECT_EQ(windows[1].rate, 0);
+
+  EXPECT_TRUE(RateLimitPolicy::parseSchedule("").empty());
+  EXPECT_THROW(RateLimitPolicy::parseSchedule("08:00=100"), std::invalid_argument);
+  EXPECT_THROW(RateLimitPolicy::parseSchedule("08:00-25:00=100"), std::invalid_argument);
+  EXPECT_THROW(RateLimitPolicy::parseSchedule("08:00-09:00=fast"), std::invalid_argument);
+}
+
+/* The schedule replaces the default limit, the metered limit applies on top. */
+TEST(RateLimiter, PolicyRate) {
+  const RateLimitPolicy policy =
+      RateLimitPolicy::fromConfig(1000, "08:00-18:00=5000,22:00-06:00=0", 2000, "wwan0, ppp0");
+  ASSERT_EQ(policy.metered_interfaces.size(), 2);
+  EXPECT_EQ(policy.metered_interfaces[1], "ppp0");
+
+  EXPECT_EQ(policy.rateAt(7 * 60, false), 1000);
+  EXPECT_EQ(policy.rateAt(8 * 60, false), 5000);
+  EXPECT_EQ(policy.rateAt(18 * 60, false), 1000);
+  EXPECT_EQ(policy.rateAt(23 * 60, false), 0);
+  EXPECT_EQ(policy.rateAt(3 * 60, false), 0);
+
+  EXPECT_EQ(policy.rateAt(7 * 60, true), 1000);
+  EXPECT_EQ(policy.rateAt(8 * 60, true), 2000);
+  EXPECT_EQ(policy.rateAt(23 * 60, true), 2000);
+  EXPECT_EQ(policy.lowestRate(), 1000);
+
+  EXPECT_TRUE(RateLimitPolicy::fromConfig(0, "", 0, "").empty());
+}
+
+TEST(RateLimiter, DefaultRouteInterface) {
+  TemporaryFile routes;
+  routes.PutContents(
+      "Iface\tDestination\tGateway \tFlags\tRefCnt\tUse\tMetric\tMask\t\tMTU\tWindow\tIRTT\n"
+      "eth0\t0002A8C0\t00000000\t0001\t0\t0\t100\t00FFFFFF\t0\t0\t0\n"
+      "wwan0\t00000000\t0102A8C0\t0003\t0\t0\t100\t00000000\t0\t0\t0\n");
+  EXPECT_EQ(RateLimiter::defaultRouteInterface(routes.PathString()), "wwan0");
+  EXPECT_EQ(RateLimiter::defaultRouteInterface("/nonexistent"), "");
+}
+
+/* Tokens run out and come back with time; the override replaces the policy. */
+TEST(RateLimiter, TokenBucket) {
+  RateLimiter limiter(RateLimitPolicy{});
+  EXPECT_EQ(limiter.currentRate(), 0);
+  EXPECT_TRUE(limiter.consume(100 << 20));
+
+  limiter.setOverride(100000);
+  EXPECT_EQ(limiter.currentRate(), 100000);
+  EXPECT_EQ(limiter.lowestRate(), 100000);
+  // the bucket may go into debt once
+  while (limiter.consume(50000)) {
+  }
+  EXPECT_GT(limiter.waitTime().count(), 0);
+  EXPECT_LE(limiter.waitTime().count(), 1001);
+
+  // interactive requests get half of the rate
+  limiter.beginInteractive();
+  EXPECT_EQ(limiter.currentRate(), 50000);
+  limiter.endInteractive();
+  EXPECT_EQ(limiter.currentRate(), 100000);
+
+  limiter.clearOverride();
+  EXPECT_EQ(limiter.currentRate(), 0);
+  EXPECT_EQ(limiter.waitTime().count(), 0);
+  EXPECT_TRUE(limiter.consume(1));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
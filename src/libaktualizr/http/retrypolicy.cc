@@ -0,0 +1,77 @@
+#include "retrypolicy.h"
+
+#include <algorithm>
+
+#include "logging/logging.h"
+
+RetryPolicy::RetryPolicy(int max_retries, std::chrono::milliseconds base_delay, std::chrono::milliseconds max_delay)
+    : max_retries_{max_retries}, base_delay_{base_delay}, max_delay_{max_delay}, random_{std::random_device{}()} {}
+
+void RetryPolicy::onRequest() {
+  std::lock_guard<std::mutex> guard(m_);
+  budget_ = std::min(kMaxBudget, budget_ + kBudgetPerRequest);
+}
+
+// NOLINTNEXTLINE(google-runtime-int)
+bool RetryPolicy::allowRetry(int retries, CURLcode curl_code, long http_code, bool idempotent,
+                             std::chrono::seconds retry_after) {
+  if (!isTransient(curl_code, http_code) || (!idempotent && !notSent(curl_code)) || retry_after > max_delay_) {
+    return false;
+  }
+  return allowRetry(retries);
+}
+
+bool RetryPolicy::allowRetry(int retries) {
+  if (retries >= max_retries_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(m_);
+  if (budget_ < 1) {
+    LOG_WARNING << "Too many failed requests, not retrying";
+    return false;
+  }
+  budget_ -= 1;
+  return true;
+}
+
+std::chrono::milliseconds RetryPolicy::delay(int retries, std::chrono::seconds retry_after) {
+  const std::chrono::milliseconds ceiling =
+      std::min<std::chrono::milliseconds>(max_delay_, base_delay_ * (int64_t{1} << std::min(retries, 30)));
+  std::chrono::milliseconds res;
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    std::uniform_int_distribution<int64_t> jitter(0, ceiling.count());
+    res = std::chrono::milliseconds(jitter(random_));
+  }
+  if (retry_after <= max_delay_) {
+    res = std::max<std::chrono::milliseconds>(res, retry_after);
+  }
+  return res;
+}
+
+// NOLINTNEXTLINE(google-runtime-int)
+bool RetryPolicy::isTransient(CURLcode curl_code, long http_code) {
+  switch (curl_code) {
+    case CURLE_OK:
+      return http_code == 408 || http_code == 429 || http_code == 500 || http_code == 502 || http_code == 503 ||
+             http_code == 504;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool RetryPolicy::notSent(CURLcode curl_code) {
+  return curl_code == CURLE_COULDNT_RESOLVE_HOST || curl_code == CURLE_COULDNT_CONNECT ||
+         curl_code == CURLE_SSL_CONNECT_ERROR;
+}
@@ -0,0 +1,65 @@
+#ifndef RETRYPOLICY_H_
+#define RETRYPOLICY_H_
+
+#include <chrono>
+#include <mutex>
+#include <random>
+
+#include <curl/curl.h>
+
+/**
+ * When failed requests are sent again, shared by an HttpClient and its copies.
+ *
+ * Only transient failures are retried: network errors and timeouts, and the
+ * HTTP codes that say the server may answer later. Requests that are not
+ * idempotent are only retried if they could not have reached the server.
+ *
+ * Retries wait longer and longer, with full jitter so that many devices that
+ * failed together don't retry together. They also draw from a budget that
+ * each request adds to, so that when the server is down the clients stop
+ * piling retries onto it.
+ */
+class RetryPolicy {
+ public:
+  explicit RetryPolicy(int max_retries = 2, std::chrono::milliseconds base_delay = std::chrono::milliseconds(500),
+                       std::chrono::milliseconds max_delay = std::chrono::seconds(8));
+
+  // count a request, it adds to the retry budget
+  void onRequest();
+  /**
+   * Whether a request may be sent again after `retries` retries, and takes a
+   * retry from the budget if so. Not if the server asked to wait for longer
+   * than max_delay with Retry-After.
+   */
+  // NOLINTNEXTLINE(google-runtime-int)
+  bool allowRetry(int retries, CURLcode curl_code, long http_code, bool idempotent,
+                  std::chrono::seconds retry_after = std::chrono::seconds(0));
+  // for failures known to be transient
+  bool allowRetry(int retries);
+  /**
+   * How long to wait before the next try: up to base_delay * 2^retries, at
+   * most max_delay, but at least what the server asked for with Retry-After
+   * if that isn't longer than max_delay.
+   */
+  std::chrono::milliseconds delay(int retries, std::chrono::seconds retry_after = std::chrono::seconds(0));
+
+  // NOLINTNEXTLINE(google-runtime-int)
+  static bool isTransient(CURLcode curl_code, long http_code);
+  // the request could not have reached the server
+  static bool notSent(CURLcode curl_code);
+
+  // the budget holds at most kMaxBudget retries, each request adds
+  // kBudgetPerRequest
+  static constexpr double kMaxBudget{10};
+  static constexpr double kBudgetPerRequest{0.2};
+
+ private:
+  const int max_retries_;
+  const std::chrono::milliseconds base_delay_;
+  const std::chrono::milliseconds max_delay_;
+  std::mutex m_;
+  double budget_{kMaxBudget};
+  std::mt19937 random_;
+};
+
+#endif  // RETRYPOLICY_H_
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include "http/retrypolicy.h"
+
+/* Only transient failures are retried, and requests that are not idempotent
+ * only if they were not sent. */
+TEST(RetryPolicy, Transient) {
+  RetryPolicy policy;
+  EXPECT_TRUE(policy.allowRetry(0, CURLE_OK, 503, true));
+  EXPECT_TRUE(policy.allowRetry(0, CURLE_OPERATION_TIMEDOUT, 0, true));
+  EXPECT_FALSE(policy.allowRetry(0, CURLE_OK, 404, true));
+  EXPECT_FALSE(policy.allowRetry(0, CURLE_OK, 501, true));
+  EXPECT_FALSE(policy.allowRetry(0, CURLE_PEER_FAILED_VERIFICATION, 0, true));
+
+  EXPECT_FALSE(policy.allowRetry(0, CURLE_OK, 503, false));
+  EXPECT_FALSE(policy.allowRetry(0, CURLE_RECV_ERROR, 0, false));
+  EXPECT_TRUE(policy.allowRetry(0, CURLE_COULDNT_CONNECT, 0, false));
+
+  EXPECT_FALSE(policy.allowRetry(2, CURLE_OK, 503, true));
+  // the server asked to come back much later
+  EXPECT_FALSE(policy.allowRetry(0, CURLE_OK, 503, true, std::chrono::seconds(60)));
+}
+
+/* Retries stop when the budget is spent, requests add to it again. */
+TEST(RetryPolicy, Budget) {
+  RetryPolicy policy;
+  for (int i = 0; i < static_cast<int>(RetryPolicy::kMaxBudget); ++i) {
+    EXPECT_TRUE(policy.allowRetry(0));
+  }
+  EXPECT_FALSE(policy.allowRetry(0));
+  for (int i = 0; i < static_cast<int>(1 / RetryPolicy::kBudgetPerRequest); ++i) {
+    policy.onRequest();
+  }
+  EXPECT_TRUE(policy.allowRetry(0));
+  EXPECT_FALSE(policy.allowRetry(0));
+}
+
+/* Delays grow with the retries, with jitter, up to the maximum. */
+TEST(RetryPolicy, Delay) {
+  using std::chrono::milliseconds;
+  RetryPolicy policy(5, milliseconds(100), milliseconds(1000));
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_LE(policy.delay(0), milliseconds(100));
+    EXPECT_LE(policy.delay(2), milliseconds(400));
+    EXPECT_LE(policy.delay(10), milliseconds(1000));
+    EXPECT_GE(policy.delay(0, std::chrono::seconds(1)), milliseconds(1000));
+  }
+  milliseconds total{0};
+  for (int i = 0; i < 100; ++i) {
+    total += policy.delay(10);
+  }
+  EXPECT_GT(total, milliseconds(100 * 200));
+  EXPECT_LT(total, milliseconds(100 * 800));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
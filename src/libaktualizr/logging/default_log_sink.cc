@@ -1,8 +1,26 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
 
+#include <boost/log/core/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/sinks/sync_frontend.hpp>
 #include <boost/log/trivial.hpp>
-#include <boost/log/utility/setup/console.hpp>
+
+using boost::log::trivial::severity_level;
 
 static void color_fmt(boost::log::record_view const& rec, boost::log::formatting_ostream& strm) {
   auto severity = rec[boost::log::trivial::severity];
@@ -29,14 +47,234 @@ static void color_fmt(boost::log::record_view const& rec, boost::log::formatting
   }
 }
 
-void logger_init_sink(bool use_colors = false) {
-  auto* stream = &std::cerr;
-  if (getenv("LOG_STDERR") == nullptr) {
-    stream = &std::cout;
+namespace {
+
+// Where the formatted records end up
+class LogOutput {
+ public:
+  LogOutput() = default;
+  virtual ~LogOutput() = default;
+  LogOutput(const LogOutput&) = delete;
+  LogOutput(LogOutput&&) = delete;
+  LogOutput& operator=(const LogOutput&) = delete;
+  LogOutput& operator=(LogOutput&&) = delete;
+
+  virtual void write(severity_level severity, const std::string& message) = 0;
+};
+
+class ConsoleOutput : public LogOutput {
+ public:
+  explicit ConsoleOutput(std::ostream& stream) : stream_(stream) {}
+  void write(severity_level severity, const std::string& message) override {
+    (void)severity;
+    stream_ << message << std::endl;
   }
-  auto sink = boost::log::add_console_log(*stream, boost::log::keywords::format = "%Message%",
-                                          boost::log::keywords::auto_flush = true);
-  if (use_colors) {
-    sink->set_formatter(&color_fmt);
+
+ private:
+  std::ostream& stream_;
+};
+
+// Sends records to the systemd journal with its native protocol, see
+// systemd.journal-fields(7); falls back to stderr if the journal can't be
+// reached.
+class JournaldOutput : public LogOutput {
+ public:
+  JournaldOutput() : fd_(socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) {
+    address_.sun_family = AF_UNIX;
+    std::strncpy(address_.sun_path, "/run/systemd/journal/socket", sizeof(address_.sun_path) - 1);
   }
+  ~JournaldOutput() override {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+  JournaldOutput(const JournaldOutput&) = delete;
+  JournaldOutput(JournaldOutput&&) = delete;
+  JournaldOutput& operator=(const JournaldOutput&) = delete;
+  JournaldOutput& operator=(JournaldOutput&&) = delete;
+
+  void write(severity_level severity, const std::string& message) override {
+    std::string datagram = "PRIORITY=" + std::to_string(priority(severity)) +
+                           "\nSYSLOG_IDENTIFIER=" + program_invocation_short_name + "\nMESSAGE\n";
+    // the binary form of the field, as the message may contain newlines
+    uint64_t length = message.size();
+    for (int i = 0; i < 8; ++i) {
+      datagram.push_back(static_cast<char>(length & 0xffU));
+      length >>= 8U;
+    }
+    datagram += message;
+    datagram.push_back('\n');
+    if (fd_ < 0 || sendto(fd_, datagram.data(), datagram.size(), MSG_NOSIGNAL,
+                          reinterpret_cast<const struct sockaddr*>(&address_), sizeof(address_)) < 0) {
+      std::cerr << message << std::endl;
+    }
+  }
+
+ private:
+  static int priority(severity_level severity) {
+    switch (severity) {
+      case boost::log::trivial::fatal:
+        return 2;  // LOG_CRIT
+      case boost::log::trivial::error:
+        return 3;  // LOG_ERR
+      case boost::log::trivial::warning:
+        return 4;  // LOG_WARNING
+      case boost::log::trivial::info:
+        return 6;  // LOG_INFO
+      default:
+        return 7;  // LOG_DEBUG
+    }
+  }
+
+  int fd_;
+  struct sockaddr_un address_ {};
+};
+
+// Hands the formatted records to the output, either directly or through a
+// bounded queue emptied by a writer thread. When the queue is full, logging
+// waits for room rather than dropping records.
+class OutputBackend
+    : public boost::log::sinks::basic_formatted_sink_backend<char, boost::log::sinks::synchronized_feeding> {
+ public:
+  static constexpr size_t kQueueSize = 1024;
+
+  OutputBackend(std::unique_ptr<LogOutput> output, bool async) : output_(std::move(output)) {
+    if (async) {
+      writer_ = std::thread(&OutputBackend::run, this);
+    }
+  }
+  ~OutputBackend() {
+    if (writer_.joinable()) {
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stopping_ = true;
+      }
+      queued_cv_.notify_one();
+      writer_.join();
+    }
+  }
+  OutputBackend(const OutputBackend&) = delete;
+  OutputBackend(OutputBackend&&) = delete;
+  OutputBackend& operator=(const OutputBackend&) = delete;
+  OutputBackend& operator=(OutputBackend&&) = delete;
+
+  void consume(boost::log::record_view const& rec, string_type const& message) {
+    const auto severity_value = rec[boost::log::trivial::severity];
+    const severity_level severity = severity_value ? severity_value.get() : boost::log::trivial::info;
+    if (!writer_.joinable()) {
+      output_->write(severity, message);
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    room_cv_.wait(lock, [this] { return queue_.size() < kQueueSize; });
+    queue_.emplace_back(severity, message);
+    queued_cv_.notify_one();
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      queued_cv_.wait(lock, [this] { return !queue_.empty() || stopping_; });
+      if (queue_.empty()) {
+        break;
+      }
+      // write everything queued so far in one go, outside of the lock
+      std::deque<std::pair<severity_level, std::string>> records;
+      records.swap(queue_);
+      room_cv_.notify_all();
+      lock.unlock();
+      for (const auto& record : records) {
+        output_->write(record.first, record.second);
+      }
+      lock.lock();
+    }
+  }
+
+  std::unique_ptr<LogOutput> output_;
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::condition_variable room_cv_;
+  std::deque<std::pair<severity_level, std::string>> queue_;
+  bool stopping_{false};
+  std::thread writer_;
+};
+
+using OutputSink = boost::log::sinks::synchronous_sink<OutputBackend>;
+
+// The sink in use. It is removed from the core, which flushes an
+// asynchronous one, before the core is destroyed at exit.
+struct CurrentSink {
+  CurrentSink() : core(boost::log::core::get()) {}
+  ~CurrentSink() { replace(nullptr, std::string(), false); }
+  CurrentSink(const CurrentSink&) = delete;
+  CurrentSink(CurrentSink&&) = delete;
+  CurrentSink& operator=(const CurrentSink&) = delete;
+  CurrentSink& operator=(CurrentSink&&) = delete;
+
+  void replace(boost::shared_ptr<OutputSink> new_sink, std::string new_name, bool new_async) {
+    if (sink != nullptr) {
+      core->remove_sink(sink);
+    }
+    if (new_sink != nullptr) {
+      core->add_sink(new_sink);
+    }
+    sink = std::move(new_sink);
+    name = std::move(new_name);
+    async = new_async;
+  }
+
+  boost::log::core_ptr core;
+  boost::shared_ptr<OutputSink> sink;
+  std::string name;
+  bool async{false};
+  bool use_colors{false};
+};
+
+CurrentSink& currentSink() {
+  static CurrentSink current;
+  return current;
+}
+
+}  // namespace
+
+void logger_config_sink(const std::string& sink, bool async) {
+  auto& current = currentSink();
+  const bool journald = (sink == "journald");
+  if (!journald && sink != "console") {
+    std::cerr << "Unknown log sink \"" << sink << "\", using the console" << std::endl;
+  }
+  const std::string name = journald ? "journald" : "console";
+  if (current.sink != nullptr && current.name == name && current.async == async) {
+    return;
+  }
+
+  std::unique_ptr<LogOutput> output;
+  if (journald) {
+    output = std::unique_ptr<LogOutput>(new JournaldOutput());
+  } else {
+    auto* stream = &std::cerr;
+    if (getenv("LOG_STDERR") == nullptr) {
+      stream = &std::cout;
+    }
+    output = std::unique_ptr<LogOutput>(new ConsoleOutput(*stream));
+  }
+
+  auto new_sink = boost::make_shared<OutputSink>(boost::make_shared<OutputBackend>(std::move(output), async));
+  if (journald) {
+    // the journal records the severity itself
+    new_sink->set_formatter(boost::log::expressions::stream << boost::log::expressions::smessage);
+  } else if (current.use_colors) {
+    new_sink->set_formatter(&color_fmt);
+  } else {
+    new_sink->set_formatter(boost::log::expressions::stream << boost::log::expressions::smessage);
+  }
+  current.replace(new_sink, name, async);
+}
+
+void logger_init_sink(bool use_colors = false) {
+  currentSink().use_colors = use_colors;
+  // recreate the sink, as the colors may have changed
+  currentSink().replace(nullptr, std::string(), false);
+  logger_config_sink("console", false);
 }
@@ -7,23 +7,22 @@
 
 using boost::log::trivial::severity_level;
 
-static severity_level gLoggingThreshold;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+// NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
+std::atomic<int> logging_detail::threshold{boost::log::trivial::trace};
 
 extern void logger_init_sink(bool use_colors = false);
+extern void logger_config_sink(const std::string& sink, bool async);
 
-int64_t get_curlopt_verbose() { return gLoggingThreshold <= boost::log::trivial::trace ? 1L : 0L; }
+int64_t get_curlopt_verbose() { return loggerGetSeverity() <= boost::log::trivial::trace ? 1L : 0L; }
 
 void logger_init(bool use_colors) {
-  gLoggingThreshold = boost::log::trivial::info;
-
   logger_init_sink(use_colors);
-
-  boost::log::core::get()->set_filter(boost::log::trivial::severity >= gLoggingThreshold);
+  logger_set_threshold(boost::log::trivial::info);
 }
 
 void logger_set_threshold(const severity_level threshold) {
-  gLoggingThreshold = threshold;
-  boost::log::core::get()->set_filter(boost::log::trivial::severity >= gLoggingThreshold);
+  logging_detail::threshold = threshold;
+  boost::log::core::get()->set_filter(boost::log::trivial::severity >= threshold);
 }
 
 void logger_set_threshold(const LoggerConfig& lconfig) {
@@ -37,10 +36,11 @@ void logger_set_threshold(const LoggerConfig& lconfig) {
     loglevel = boost::log::trivial::fatal;
   }
   logger_set_threshold(static_cast<boost::log::trivial::severity_level>(loglevel));
+  logger_config_sink(lconfig.sink, lconfig.async);
 }
 
 void logger_set_enable(bool enabled) { boost::log::core::get()->set_logging_enabled(enabled); }
 
-int loggerGetSeverity() { return static_cast<int>(gLoggingThreshold); }
+int loggerGetSeverity() { return logging_detail::threshold; }
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
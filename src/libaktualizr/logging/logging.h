@@ -2,28 +2,42 @@
 #define SOTA_CLIENT_TOOLS_LOGGING_H_
 
 #include <boost/log/trivial.hpp>
+#include <atomic>
 #include <cstdint>
 
 struct LoggerConfig;
 
+namespace logging_detail {
+// The current threshold. Records below it are dropped before Boost.Log is
+// asked to open them, so that disabled statements cost one comparison and
+// their arguments are never evaluated.
+extern std::atomic<int> threshold;
+}  // namespace logging_detail
+
+#define LOG_AT_LEVEL_(level)                                                                            \
+  if (static_cast<int>(boost::log::trivial::level) <                                                   \
+      logging_detail::threshold.load(std::memory_order_relaxed)) {                                      \
+  } else                                                                                                \
+    BOOST_LOG_TRIVIAL(level)
+
 /** Log an unrecoverable error */
-#define LOG_FATAL BOOST_LOG_TRIVIAL(fatal)
+#define LOG_FATAL LOG_AT_LEVEL_(fatal)
 
 /** Log that something has definitely gone wrong */
-#define LOG_ERROR BOOST_LOG_TRIVIAL(error)
+#define LOG_ERROR LOG_AT_LEVEL_(error)
 
 /** Warn about behaviour that is probably bad, but hasn't yet caused the system
  * to operate out of spec. */
-#define LOG_WARNING BOOST_LOG_TRIVIAL(warning)
+#define LOG_WARNING LOG_AT_LEVEL_(warning)
 
 /** Report a user-visible message about operation */
-#define LOG_INFO BOOST_LOG_TRIVIAL(info)
+#define LOG_INFO LOG_AT_LEVEL_(info)
 
 /** Report a message for developer debugging */
-#define LOG_DEBUG BOOST_LOG_TRIVIAL(debug)
+#define LOG_DEBUG LOG_AT_LEVEL_(debug)
 
 /** Report very-verbose debugging information */
-#define LOG_TRACE BOOST_LOG_TRIVIAL(trace)
+#define LOG_TRACE LOG_AT_LEVEL_(trace)
 
 // Use like:
 // curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, get_curlopt_verbose());
@@ -33,6 +47,7 @@ void logger_init(bool use_colors = false);
 
 void logger_set_threshold(boost::log::trivial::severity_level threshold);
 
+// Also sets up the sink configured in lconfig, if it is not the current one
 void logger_set_threshold(const LoggerConfig& lconfig);
 
 void logger_set_enable(bool enabled);
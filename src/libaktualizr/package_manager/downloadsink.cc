@@ -0,0 +1,231 @@
+#include "downloadsink.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "utilities/thread_policy.h"
+
+DownloadSink::DownloadSink(const std::string &path, uint64_t offset, MultiPartHasher &hasher, bool direct_io)
+    : path_(path),
+      hasher_(hasher),
+      offset_(offset),
+      done_offset_(offset),
+      memory_(MemoryBudget::instance().reserveUpTo(MemoryBudget::User::kDownload, kBufferCount * kBufferSize,
+                                                   kBufferSize)),
+      buffers_(static_cast<size_t>(memory_.size() / kBufferSize)) {
+  // whole buffers only
+  memory_.shrink(memory_.size() % kBufferSize);
+  fd_ = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::runtime_error("Can't open file " + path + ": " + std::strerror(errno));
+  }
+  if (direct_io) {
+    direct_fd_ = open(path.c_str(), O_WRONLY | O_CLOEXEC | O_DIRECT);
+    if (direct_fd_ < 0) {
+      LOG_WARNING << "Direct I/O is not available for " << path << ": " << std::strerror(errno);
+    }
+  }
+
+  for (auto &buffer : buffers_) {
+    void *data = nullptr;
+    if (posix_memalign(&data, kAlignment, kBufferSize) != 0) {
+      if (direct_fd_ >= 0) {
+        close(direct_fd_);
+      }
+      close(fd_);
+      throw std::runtime_error("Can't allocate download buffers");
+    }
+    buffer.data = std::unique_ptr<unsigned char, void (*)(void *)>(static_cast<unsigned char *>(data),
+                                                                   free);  // NOLINT(cppcoreguidelines-no-malloc)
+    free_.push_back(&buffer);
+  }
+
+  writer_ = std::thread(&DownloadSink::writeLoop, this);
+  hasher_thread_ = std::thread(&DownloadSink::hashLoop, this);
+}
+
+DownloadSink::~DownloadSink() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    shutdown_ = true;
+  }
+  cv_.notify_all();
+  writer_.join();
+  hasher_thread_.join();
+  if (direct_fd_ >= 0) {
+    close(direct_fd_);
+  }
+  close(fd_);
+}
+
+void DownloadSink::reserve(uint64_t total_size) {
+  if (total_size <= offset_) {
+    return;
+  }
+  if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset_), static_cast<off_t>(total_size - offset_)) !=
+      0) {
+    LOG_DEBUG << "Could not reserve space for " << path_ << ": " << std::strerror(errno);
+  }
+}
+
+bool DownloadSink::write(const char *data, size_t size) {
+  while (size > 0) {
+    if (current_ == nullptr) {
+      current_ = takeBuffer();
+      if (current_ == nullptr) {
+        return false;
+      }
+    }
+    const size_t n = std::min(size, current_->capacity - current_->used);
+    std::memcpy(current_->data.get() + current_->used, data, n);  // NOLINT
+    current_->used += n;
+    offset_ += n;
+    data += n;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    size -= n;
+    if (current_->used == current_->capacity) {
+      submit(current_);
+      current_ = nullptr;
+    }
+  }
+  return !failed_.load(std::memory_order_relaxed);
+}
+
+uint64_t DownloadSink::drain() {
+  std::unique_lock<std::mutex> lock(m_);
+  cv_.wait(lock, [this] { return free_.size() + (current_ != nullptr ? 1 : 0) == buffers_.size(); });
+  return done_offset_;
+}
+
+bool DownloadSink::finish() {
+  if (current_ != nullptr) {
+    if (current_->used > 0) {
+      submit(current_);
+    } else {
+      std::lock_guard<std::mutex> lock(m_);
+      release(current_);
+    }
+    current_ = nullptr;
+  }
+  drain();
+  std::lock_guard<std::mutex> lock(m_);
+  return !failed_;
+}
+
+bool DownloadSink::sync() {
+  if (fdatasync(fd_) != 0) {
+    LOG_WARNING << "Could not sync " << path_ << ": " << std::strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+std::string DownloadSink::error() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return error_;
+}
+
+DownloadSink::Buffer *DownloadSink::takeBuffer() {
+  std::unique_lock<std::mutex> lock(m_);
+  cv_.wait(lock, [this] { return failed_ || !free_.empty(); });
+  if (failed_) {
+    return nullptr;
+  }
+  Buffer *buffer = free_.back();
+  free_.pop_back();
+  buffer->offset = offset_;
+  buffer->used = 0;
+  // end the buffer on an aligned offset, so that the next ones can be written
+  // with direct I/O
+  buffer->capacity = kBufferSize - static_cast<size_t>(offset_ % kAlignment);
+  return buffer;
+}
+
+void DownloadSink::submit(Buffer *buffer) {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    buffer->pending = 2;
+    write_queue_.push_back(buffer);
+    hash_queue_.push_back(buffer);
+  }
+  cv_.notify_all();
+}
+
+// must be called with m_ held, or for a buffer that is not shared yet
+void DownloadSink::release(Buffer *buffer) {
+  if (buffer->pending == 0) {
+    free_.push_back(buffer);
+    return;
+  }
+  if (--buffer->pending == 0) {
+    // buffers are written and hashed in order, so they also complete in order
+    done_offset_ = buffer->offset + buffer->used;
+    free_.push_back(buffer);
+  }
+}
+
+void DownloadSink::writeLoop() {
+  ThreadPolicies::instance().apply(ThreadPolicies::Worker::kDownload);
+  std::unique_lock<std::mutex> lock(m_);
+  for (;;) {
+    cv_.wait(lock, [this] { return shutdown_ || !write_queue_.empty(); });
+    if (write_queue_.empty()) {
+      return;
+    }
+    Buffer *buffer = write_queue_.front();
+    write_queue_.pop_front();
+    const bool skip = failed_;
+    lock.unlock();
+    const bool ok = skip || writeBuffer(*buffer);
+    lock.lock();
+    if (!ok) {
+      failed_ = true;
+      error_ = std::string("Could not write to ") + path_ + ": " + std::strerror(errno);
+      LOG_ERROR << error_;
+    }
+    release(buffer);
+    cv_.notify_all();
+  }
+}
+
+void DownloadSink::hashLoop() {
+  ThreadPolicies::instance().apply(ThreadPolicies::Worker::kHasher);
+  std::unique_lock<std::mutex> lock(m_);
+  for (;;) {
+    cv_.wait(lock, [this] { return shutdown_ || !hash_queue_.empty(); });
+    if (hash_queue_.empty()) {
+      return;
+    }
+    Buffer *buffer = hash_queue_.front();
+    hash_queue_.pop_front();
+    lock.unlock();
+    hasher_.update(buffer->data.get(), buffer->used);
+    lock.lock();
+    release(buffer);
+    cv_.notify_all();
+  }
+}
+
+bool DownloadSink::writeBuffer(const Buffer &buffer) {
+  const bool aligned = buffer.offset % kAlignment == 0 && buffer.used % kAlignment == 0;
+  const int fd = (direct_fd_ >= 0 && aligned) ? direct_fd_ : fd_;
+  size_t written = 0;
+  while (written < buffer.used) {
+    const ssize_t res = pwrite(fd, buffer.data.get() + written, buffer.used - written,  // NOLINT
+                               static_cast<off_t>(buffer.offset + written));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += static_cast<size_t>(res);
+  }
+  return true;
+}
@@ -0,0 +1,116 @@
+#ifndef DOWNLOADSINK_H_
+#define DOWNLOADSINK_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utilities/memory_budget.h"
+
+class MultiPartHasher;
+
+/**
+ * Writes downloaded data to a file and feeds it to a hasher, off the thread
+ * that receives the data.
+ *
+ * Data is collected in a few large, page aligned buffers. Full buffers are
+ * written with pwrite() by a writer thread and hashed by a separate hasher
+ * thread, so that neither disk writes nor hashing block the download, and do
+ * not wait on each other. The caller only blocks when all buffers are in use.
+ * There are fewer buffers, but at least one, when the memory budget runs low
+ * (see MemoryBudget).
+ *
+ * With direct I/O, aligned buffers are written with O_DIRECT, bypassing the
+ * page cache. Unaligned pieces (e.g. the end of the file) fall back to normal
+ * writes, as does the whole file if the filesystem doesn't support O_DIRECT.
+ */
+class DownloadSink {
+ public:
+  DownloadSink(const std::string &path, uint64_t offset, MultiPartHasher &hasher, bool direct_io);
+  ~DownloadSink();
+  DownloadSink(const DownloadSink &) = delete;
+  DownloadSink(DownloadSink &&) = delete;
+  DownloadSink &operator=(const DownloadSink &) = delete;
+  DownloadSink &operator=(DownloadSink &&) = delete;
+
+  /**
+   * Reserve disk space for the file up to `total_size` bytes, without changing
+   * its size.
+   */
+  void reserve(uint64_t total_size);
+  /**
+   * Append data. Returns false if writing to the file has failed.
+   */
+  bool write(const char *data, size_t size);
+  /**
+   * Wait until all full buffers have been written and hashed.
+   * @return The length of the file content that has been written and hashed
+   *         so far. The data still collected in a partial buffer is not part
+   *         of it.
+   */
+  uint64_t drain();
+  /**
+   * Write and hash all the data given so far, including a partial buffer.
+   * Returns false if writing to the file has failed.
+   */
+  bool finish();
+  /**
+   * Flush the written data to the disk.
+   */
+  bool sync();
+  std::string error() const;
+
+  static constexpr size_t kBufferSize = 1U << 20U;
+  static constexpr size_t kBufferCount = 4;
+  static constexpr size_t kAlignment = 4096;
+
+ private:
+  struct Buffer {
+    std::unique_ptr<unsigned char, void (*)(void *)> data{nullptr, nullptr};
+    // file offset of the first byte
+    uint64_t offset{0};
+    size_t used{0};
+    size_t capacity{0};
+    // number of threads (writer and hasher) that still need the buffer
+    int pending{0};
+  };
+
+  Buffer *takeBuffer();
+  void submit(Buffer *buffer);
+  void release(Buffer *buffer);
+  void writeLoop();
+  void hashLoop();
+  bool writeBuffer(const Buffer &buffer);
+
+  std::string path_;
+  int fd_{-1};
+  int direct_fd_{-1};
+  MultiPartHasher &hasher_;
+  // offset of the next byte given to write()
+  uint64_t offset_;
+  // next byte that is not written and hashed yet
+  uint64_t done_offset_;
+
+  MemoryBudget::Reservation memory_;
+  std::vector<Buffer> buffers_;
+  Buffer *current_{nullptr};
+  std::vector<Buffer *> free_;
+  std::deque<Buffer *> write_queue_;
+  std::deque<Buffer *> hash_queue_;
+  bool shutdown_{false};
+  // set with m_ held, read without it by write() for each chunk
+  std::atomic<bool> failed_{false};
+  std::string error_;
+  mutable std::mutex m_;
+  std::condition_variable cv_;
+  std::thread writer_;
+  std::thread hasher_thread_;
+};
+
+#endif  // DOWNLOADSINK_H_
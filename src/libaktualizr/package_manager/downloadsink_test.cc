@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "package_manager/downloadsink.h"
+#include "utilities/utils.h"
+
+static std::string testData(size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    data[i] = static_cast<char>((i * 7 + i / 4096) % 251);
+  }
+  return data;
+}
+
+// Write data in uneven pieces, so that buffers are filled across calls.
+static void writeInPieces(DownloadSink& sink, const std::string& data, size_t from) {
+  size_t piece = 1000;
+  while (from < data.size()) {
+    const size_t n = std::min(piece, data.size() - from);
+    ASSERT_TRUE(sink.write(&data[from], n));
+    from += n;
+    piece = piece * 3 % 70001 + 1;
+  }
+}
+
+/* Downloaded data ends up in the file and in the hasher, with and without
+ * direct I/O. */
+TEST(DownloadSink, WriteAndHash) {
+  const std::string data = testData(5 * DownloadSink::kBufferSize + 12345);
+  for (const bool direct_io : {false, true}) {
+    TemporaryDirectory temp_dir;
+    const std::string path = (temp_dir.Path() / "image").string();
+    Utils::writeFile(path, std::string());
+
+    MultiPartSHA256Hasher hasher;
+    {
+      DownloadSink sink(path, 0, hasher, direct_io);
+      sink.reserve(data.size());
+      writeInPieces(sink, data, 0);
+      EXPECT_TRUE(sink.finish());
+      EXPECT_EQ(sink.drain(), data.size());
+      EXPECT_TRUE(sink.sync());
+    }
+    EXPECT_EQ(boost::filesystem::file_size(path), data.size());
+    EXPECT_EQ(Utils::readFile(path), data);
+    EXPECT_EQ(hasher.getHash(), Hash::generate(Hash::Type::kSha256, data));
+  }
+}
+
+/* Appending to a partial file at an unaligned offset. drain() only reports
+ * the data of completed buffers. */
+TEST(DownloadSink, Append) {
+  const std::string data = testData(3 * DownloadSink::kBufferSize);
+  const size_t offset = 1234;
+  TemporaryDirectory temp_dir;
+  const std::string path = (temp_dir.Path() / "image").string();
+  Utils::writeFile(path, data.substr(0, offset));
+
+  MultiPartSHA256Hasher hasher;
+  hasher.update(reinterpret_cast<const unsigned char*>(data.data()), offset);
+  {
+    DownloadSink sink(path, offset, hasher, true);
+    ASSERT_TRUE(sink.write(&data[offset], 10));
+    EXPECT_EQ(sink.drain(), offset);
+
+    writeInPieces(sink, data, offset + 10);
+    const uint64_t drained = sink.drain();
+    EXPECT_GT(drained, offset);
+    // the first buffer ends on an aligned offset
+    EXPECT_EQ(drained % DownloadSink::kAlignment, 0);
+    EXPECT_TRUE(sink.finish());
+    EXPECT_EQ(sink.drain(), data.size());
+  }
+  EXPECT_EQ(Utils::readFile(path), data);
+  EXPECT_EQ(hasher.getHash(), Hash::generate(Hash::Type::kSha256, data));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
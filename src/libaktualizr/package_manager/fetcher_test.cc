@@ -9,6 +9,7 @@
 
 #include <boost/process.hpp>
 
+#include "crypto/crypto.h"
 #include "crypto/keymanager.h"
 #include "http/httpclient.h"
 #include "httpfake.h"
@@ -132,6 +133,143 @@ TEST(Fetcher, PauseBinary) {
   test_pause(target);
 }
 
+static Uptane::Target largeFileTarget() {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "dd7bd1c37a3226e520b8d6939c30991b1c08772d5dab62b381c3a63541dc629a";
+  target_json["length"] = 100 * (1 << 20);
+  return Uptane::Target("large_file", target_json);
+}
+
+/* Download a binary Target in several byte ranges in parallel.
+ * Verify the whole file afterwards. */
+TEST(Fetcher, DownloadSegmented) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.download_segments = 4;
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpClient>();
+  auto pacman = PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  const Uptane::Target target = largeFileTarget();
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  EXPECT_FALSE(storage->loadDownloadSegments(target.filename(), nullptr));
+  config.pacman.download_segments = 1;
+}
+
+/* Progress is reported in increasing percents, at most every 100 ms until
+ * the download is complete, which is always reported. */
+TEST(Fetcher, ProgressRateLimited) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpClient>();
+  auto pacman = PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  std::vector<std::pair<unsigned int, std::chrono::steady_clock::time_point>> reports;
+  auto record = [&reports](const Uptane::Target& target, const std::string& description, unsigned int progress) {
+    (void)target;
+    (void)description;
+    reports.emplace_back(progress, std::chrono::steady_clock::now());
+  };
+  EXPECT_TRUE(pacman->fetchTarget(largeFileTarget(), fetcher, keys, record, nullptr));
+
+  ASSERT_FALSE(reports.empty());
+  EXPECT_EQ(reports.back().first, 100);
+  for (size_t i = 1; i < reports.size(); i++) {
+    EXPECT_GT(reports[i].first, reports[i - 1].first);
+    if (reports[i].first < 100) {
+      // some slack for the time taken to record them
+      EXPECT_GE(reports[i].second - reports[i - 1].second, std::chrono::milliseconds(90));
+    }
+  }
+}
+
+/* Resume each segment of a segmented download from the progress recorded in
+ * the storage, e.g. after a reboot. */
+TEST(Fetcher, ResumeSegmented) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.download_segments = 4;
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpClient>();
+  auto pacman = PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  // preallocated file with the first MiBs of every segment but the first one
+  const Uptane::Target target = largeFileTarget();
+  const uint64_t segment_length = target.length() / 4;
+  std::string content(target.length(), '\0');
+  std::vector<DownloadSegment> segments;
+  for (uint64_t i = 0; i < 4; i++) {
+    const uint64_t downloaded = i * (1 << 20);
+    segments.emplace_back(i * segment_length, segment_length, downloaded);
+    content.replace(i * segment_length, downloaded, downloaded, '@');
+  }
+  const std::string filename = target.hashes()[0].HashString();
+  Utils::writeFile(config.pacman.images_path / filename, content);
+  storage->storeTargetFilename(target.filename(), filename);
+  storage->storeDownloadSegments(target.filename(), segments);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kIncomplete);
+
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  EXPECT_FALSE(storage->loadDownloadSegments(target.filename(), nullptr));
+  config.pacman.download_segments = 1;
+}
+
+/* Resume a download from the hasher state checkpointed in the storage,
+ * without hashing the already downloaded part of the file again. */
+TEST(Fetcher, ResumeHashCheckpoint) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpClient>();
+  auto pacman = PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  // The checkpoint is made for the expected content, while the file itself
+  // has different bytes: if they were hashed, the verification would fail.
+  const Uptane::Target target = largeFileTarget();
+  const size_t downloaded = 3 << 20;
+  const std::string expected(downloaded, '@');
+  MultiPartSHA256Hasher hasher;
+  hasher.update(reinterpret_cast<const unsigned char*>(expected.data()), expected.size());
+  const std::string filename = target.hashes()[0].HashString();
+  Utils::writeFile(config.pacman.images_path / filename, std::string(downloaded, '#'));
+  storage->storeTargetFilename(target.filename(), filename);
+  storage->storeTargetHashState(target.filename(), downloaded, hasher.getState());
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kIncomplete);
+
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  uint64_t hashed_length = 0;
+  EXPECT_TRUE(storage->loadTargetHashState(target.filename(), &hashed_length, nullptr));
+  EXPECT_EQ(hashed_length, target.length());
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+}
+
 class HttpCustomUri : public HttpFake {
  public:
   HttpCustomUri(const boost::filesystem::path& test_dir_in) : HttpFake(test_dir_in) {}
@@ -282,6 +420,80 @@ TEST(Fetcher, DownloadLengthZero) {
   EXPECT_EQ(http->counter, 1);
 }
 
+/* Don't hash a verified Target again unless the file was changed. */
+TEST(Fetcher, VerifiedFileCache) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpZeroLength>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9";
+  target_json["length"] = 1;
+  Uptane::Target target("fake_file", target_json);
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  const std::string filename = storage->getTargetFilename(target.filename());
+  EXPECT_FALSE(storage->loadVerifiedFile(filename, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  VerifiedFile verified;
+  ASSERT_TRUE(storage->loadVerifiedFile(filename, &verified));
+  EXPECT_EQ(verified.size, 1);
+  EXPECT_EQ(verified.hashes, Hash::encodeVector(target.hashes()));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+
+  // same size, different content
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  Utils::writeFile(config.pacman.images_path / filename, std::string("1"));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kHashMismatch);
+}
+
+/* Targets with the same content share one image, which is only downloaded
+ * once and is removed with the last of them. */
+TEST(Fetcher, SharedContent) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpZeroLength>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9";
+  target_json["length"] = 1;
+  Uptane::Target target("fake_file", target_json);
+  Uptane::Target other_target("other_file", target_json);
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_TRUE(pacman->fetchTarget(other_target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->counter, 1);
+  const std::string filename = storage->getTargetFilename(target.filename());
+  EXPECT_EQ(filename, PackageManagerInterface::contentFilename(target));
+  EXPECT_EQ(storage->getTargetFilename(other_target.filename()), filename);
+  EXPECT_EQ(pacman->verifyTarget(other_target), TargetStatus::kGood);
+
+  pacman->removeTargetFile(target);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kNotFound);
+  EXPECT_EQ(pacman->verifyTarget(other_target), TargetStatus::kGood);
+  pacman->removeTargetFile(other_target);
+  EXPECT_FALSE(boost::filesystem::exists(config.pacman.images_path / filename));
+
+  // left over by an interrupted download of a Target that was replaced
+  Utils::writeFile(config.pacman.images_path / "stale", std::string("stale"));
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  pacman->removeUnreferencedTargetFiles();
+  EXPECT_FALSE(boost::filesystem::exists(config.pacman.images_path / "stale"));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+}
+
 /* Don't bother downloading a target that is larger than the available disk
  * space. */
 TEST(Fetcher, NotEnoughDiskSpace) {
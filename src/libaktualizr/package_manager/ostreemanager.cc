@@ -1,8 +1,18 @@
 #include "ostreemanager.h"
 
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include <gio/gio.h>
 #include <json/json.h>
@@ -16,6 +26,7 @@
 #include "libaktualizr/packagemanagerfactory.h"
 
 #include "bootloader/bootloader.h"
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "utilities/utils.h"
@@ -23,15 +34,39 @@
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 AUTO_REGISTER_PACKAGE_MANAGER(PACKAGE_MANAGER_OSTREE, OstreeManager);
 
+// Holds a pull in the background under its rate limit by not handing control
+// back to the pull until the bytes transferred so far are due. Sleeps for at
+// most a second at a time so that cancelling the pull still gets noticed.
+static void throttle_background_pull(OstreeAsyncProgress *progress, const PullMetaStruct &mt) {
+  const BackgroundPull &background = *mt.background;
+  if (background.max_rate == 0 || background.urgent) {
+    return;
+  }
+  const guint64 bytes = ostree_async_progress_get_uint64(progress, "bytes-transferred");
+  const auto due = mt.start_time + std::chrono::milliseconds(bytes * 1000 / background.max_rate);
+  const auto now = std::chrono::steady_clock::now();
+  if (due > now) {
+    std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(due - now, std::chrono::seconds(1)));
+  }
+}
+
 static void aktualizr_progress_cb(OstreeAsyncProgress *progress, gpointer data) {
   auto *mt = static_cast<PullMetaStruct *>(data);
   if (mt->token != nullptr && !mt->token->canContinue()) {
     g_cancellable_cancel(mt->cancellable.get());
   }
+  if (mt->background != nullptr) {
+    if (mt->background->cancel_token.hasAborted()) {
+      g_cancellable_cancel(mt->cancellable.get());
+    } else {
+      throttle_background_pull(progress, *mt);
+    }
+  }
 
   g_autofree char *status = ostree_async_progress_get_status(progress);
   guint scanning = ostree_async_progress_get_uint(progress, "scanning");
   guint outstanding_fetches = ostree_async_progress_get_uint(progress, "outstanding-fetches");
+  mt->max_outstanding_fetches = std::max(mt->max_outstanding_fetches, outstanding_fetches);
   guint outstanding_metadata_fetches = ostree_async_progress_get_uint(progress, "outstanding-metadata-fetches");
   guint outstanding_writes = ostree_async_progress_get_uint(progress, "outstanding-writes");
   guint n_scanned_metadata = ostree_async_progress_get_uint(progress, "scanned-metadata");
@@ -68,6 +103,141 @@ static void aktualizr_progress_cb(OstreeAsyncProgress *progress, gpointer data)
   }
 }
 
+// Local ref of the remote used to pull from the commit a device is on, see
+// OstreeManager::pullIntoRepo()
+static constexpr const char *delta_ref = "aktualizr-delta-start";
+
+static GVariant *pull_options(const std::string &refhash, const bool via_delta_ref,
+                             const boost::optional<std::unordered_map<std::string, std::string>> &headers,
+                             const PackageConfig &tuning) {
+  // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
+  const char *const commit_ids[] = {refhash.c_str()};
+  // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
+  const char *const delta_refs[] = {delta_ref};
+  GVariantBuilder builder;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+  g_variant_builder_add(&builder, "{s@v}", "flags", g_variant_new_variant(g_variant_new_int32(0)));
+
+  if (via_delta_ref) {
+    g_variant_builder_add(&builder, "{s@v}", "refs", g_variant_new_variant(g_variant_new_strv(delta_refs, 1)));
+    g_variant_builder_add(&builder, "{s@v}", "override-commit-ids",
+                          g_variant_new_variant(g_variant_new_strv(commit_ids, 1)));
+    // The commit is not bound to our temporary ref. Ignored by OSTree versions
+    // without the option.
+    g_variant_builder_add(&builder, "{s@v}", "disable-verify-bindings",
+                          g_variant_new_variant(g_variant_new_boolean(TRUE)));
+  } else {
+    g_variant_builder_add(&builder, "{s@v}", "refs", g_variant_new_variant(g_variant_new_strv(commit_ids, 1)));
+  }
+
+  // Options unknown to the OSTree version at hand are ignored
+  if (tuning.ostree_low_speed_limit != 0) {
+    g_variant_builder_add(&builder, "{s@v}", "low-speed-limit-bytes",
+                          g_variant_new_variant(g_variant_new_uint32(static_cast<guint32>(
+                              std::min<uint64_t>(tuning.ostree_low_speed_limit, G_MAXUINT32)))));
+  }
+  if (tuning.ostree_low_speed_time != 0) {
+    g_variant_builder_add(&builder, "{s@v}", "low-speed-time-seconds",
+                          g_variant_new_variant(g_variant_new_uint32(static_cast<guint32>(
+                              std::min<uint64_t>(tuning.ostree_low_speed_time, G_MAXUINT32)))));
+  }
+  g_variant_builder_add(
+      &builder, "{s@v}", "n-network-retries",
+      g_variant_new_variant(g_variant_new_uint32(
+          static_cast<guint32>(std::min<uint64_t>(tuning.ostree_network_retries, G_MAXUINT32)))));
+
+  if (!!headers && !(*headers).empty()) {
+    GVariantBuilder hdr_builder;
+    g_variant_builder_init(&hdr_builder, G_VARIANT_TYPE("a(ss)"));
+
+    for (const auto &kv : *headers) {
+      g_variant_builder_add(&hdr_builder, "(ss)", kv.first.c_str(), kv.second.c_str());
+    }
+    g_variant_builder_add(&builder, "{s@v}", "http-headers",
+                          g_variant_new_variant(g_variant_builder_end(&hdr_builder)));
+  }
+
+  return g_variant_builder_end(&builder);
+}
+
+// Lets the calling thread, and the threads it starts from now on, only use
+// the disk and the CPU when nothing else needs them
+static void lower_thread_priority() {
+  // ioprio_set() has no glibc wrapper. IOPRIO_WHO_PROCESS with 0 is the
+  // calling thread, the class goes into the upper bits.
+  const int ioprio_who_process = 1;
+  const int ioprio_class_idle = 3;
+  const int ioprio_class_shift = 13;
+  if (syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift) != 0) {
+    LOG_WARNING << "Could not lower the I/O priority of the OSTree prefetch: " << std::strerror(errno);
+  }
+  // the nice value is per thread on Linux
+  if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19) != 0) {
+    LOG_WARNING << "Could not lower the CPU priority of the OSTree prefetch: " << std::strerror(errno);
+  }
+}
+
+// Whether the repo has the full commit. A direct lookup of the object, rather
+// than listing all the commits that start with the hash.
+static bool has_commit(OstreeRepo *repo, const std::string &refhash) {
+  if (ostree_validate_checksum_string(refhash.c_str(), nullptr) == 0) {
+    return false;
+  }
+  gboolean has_object = FALSE;
+  GError *error = nullptr;
+  if (ostree_repo_has_object(repo, OSTREE_OBJECT_TYPE_COMMIT, refhash.c_str(), &has_object, nullptr, &error) == 0) {
+    LOG_WARNING << "Could not look up OSTree commit " << refhash << ": " << error->message;
+    g_error_free(error);
+    return false;
+  }
+  return has_object != FALSE;
+}
+
+// The commit of the booted deployment, or else of the most recent one
+static std::string deployed_commit(OstreeSysroot *sysroot) {
+  OstreeDeployment *deployment = ostree_sysroot_get_booted_deployment(sysroot);
+  g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments(sysroot);
+  if (deployment == nullptr && deployments != nullptr && deployments->len > 0) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    deployment = static_cast<OstreeDeployment *>(deployments->pdata[0]);
+  }
+  return deployment == nullptr ? std::string() : std::string(ostree_deployment_get_csum(deployment));
+}
+
+// The count most recent commits of the repo, by their timestamps
+static std::vector<std::string> recent_commits(OstreeRepo *repo, uint64_t count) {
+  std::vector<std::pair<guint64, std::string>> commits;
+  GHashTable *objects = nullptr;
+  GError *error = nullptr;
+  if (ostree_repo_list_commit_objects_starting_with(repo, "", &objects, nullptr, &error) == 0) {
+    LOG_WARNING << "Could not list the OSTree commits: " << error->message;
+    g_error_free(error);
+    return {};
+  }
+  GHashTableIter iter;
+  gpointer key = nullptr;
+  g_hash_table_iter_init(&iter, objects);
+  while (g_hash_table_iter_next(&iter, &key, nullptr) != 0) {
+    const char *checksum = nullptr;
+    OstreeObjectType type = OSTREE_OBJECT_TYPE_COMMIT;
+    ostree_object_name_deserialize(static_cast<GVariant *>(key), &checksum, &type);
+    GVariant *commit = nullptr;
+    if (ostree_repo_load_commit(repo, checksum, &commit, nullptr, nullptr) != 0) {
+      commits.emplace_back(ostree_commit_get_timestamp(commit), checksum);
+      g_variant_unref(commit);
+    }
+  }
+  g_hash_table_destroy(objects);
+
+  std::sort(commits.begin(), commits.end(), std::greater<>());
+  std::vector<std::string> res;
+  for (auto it = commits.cbegin(); it != commits.cend() && res.size() < count; ++it) {
+    res.push_back(it->second);
+  }
+  return res;
+}
+
 data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysroot_path,
                                              const std::string &ostree_server, const KeyManager &keys,
                                              const Uptane::Target &target, const api::FlowControlToken *token,
@@ -77,14 +247,7 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
     throw std::logic_error("Invalid type of Target, got " + target.type() + ", expected OSTREE");
   }
 
-  const std::string refhash = target.sha256Hash();
-  // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
-  const char *const commit_ids[] = {refhash.c_str()};
   GError *error = nullptr;
-  GVariantBuilder builder;
-  GVariant *options;
-  GObjectUniquePtr<OstreeAsyncProgress> progress = nullptr;
-
   GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(sysroot_path);
   GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
   if (error != nullptr) {
@@ -92,20 +255,23 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
     g_error_free(error);
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "Could not get OSTree repo");
   }
+  return pullIntoRepo(repo.get(), deployed_commit(sysroot.get()), ostree_server, keys, target, token,
+                      std::move(progress_cb), alt_remote, std::move(headers), PackageConfig(), nullptr, nullptr);
+}
 
-  GHashTable *ref_list = nullptr;
-  if (ostree_repo_list_commit_objects_starting_with(repo.get(), refhash.c_str(), &ref_list, nullptr, &error) != 0) {
-    guint length = g_hash_table_size(ref_list);
-    g_hash_table_destroy(ref_list);  // OSTree creates the table with destroy notifiers, so no memory leaks expected
-    // should never be greater than 1, but use >= for robustness
-    if (length >= 1) {
-      LOG_DEBUG << "refhash already pulled";
-      return data::InstallationResult(true, data::ResultCode::Numeric::kAlreadyProcessed, "Refhash was already pulled");
-    }
-  }
-  if (error != nullptr) {
-    g_error_free(error);
-    error = nullptr;
+data::InstallationResult OstreeManager::pullIntoRepo(
+    OstreeRepo *repo, const std::string &delta_from, const std::string &ostree_server, const KeyManager &keys,
+    const Uptane::Target &target, const api::FlowControlToken *token, OstreeProgressCb progress_cb,
+    const char *alt_remote, boost::optional<std::unordered_map<std::string, std::string>> headers,
+    const PackageConfig &tuning, event::OstreePullReport *report, const BackgroundPull *background) {
+  const std::string refhash = target.sha256Hash();
+  GError *error = nullptr;
+  GVariant *options;
+  GObjectUniquePtr<OstreeAsyncProgress> progress = nullptr;
+
+  if (has_commit(repo, refhash)) {
+    LOG_DEBUG << "refhash already pulled";
+    return data::InstallationResult(true, data::ResultCode::Numeric::kAlreadyProcessed, "Refhash was already pulled");
   }
 
   if (alt_remote == nullptr) {
@@ -118,42 +284,73 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
       ostree_remote_uri = uri_override;
     }
     // addRemote overwrites any previous ostree remote that was set
-    if (!OstreeManager::addRemote(repo.get(), ostree_remote_uri, keys)) {
+    if (!OstreeManager::addRemote(repo, ostree_remote_uri, keys, tuning.ostree_http2)) {
       return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
                                       std::string("Error adding a default OSTree remote: ") + remote);
     }
   }
 
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
-  g_variant_builder_add(&builder, "{s@v}", "flags", g_variant_new_variant(g_variant_new_int32(0)));
-
-  g_variant_builder_add(&builder, "{s@v}", "refs", g_variant_new_variant(g_variant_new_strv(commit_ids, 1)));
-
-  if (!!headers && !(*headers).empty()) {
-    GVariantBuilder hdr_builder;
-    g_variant_builder_init(&hdr_builder, G_VARIANT_TYPE("a(ss)"));
-
-    for (const auto &kv : *headers) {
-      g_variant_builder_add(&hdr_builder, "(ss)", kv.first.c_str(), kv.second.c_str());
+  const char *remote_name = alt_remote == nullptr ? remote : alt_remote;
+  PullMetaStruct mt(target, token, g_cancellable_new(), std::move(progress_cb));
+  mt.background = background;
+  progress.reset(ostree_async_progress_new_and_connect(aktualizr_progress_cb, &mt));
+  const auto start_time = std::chrono::steady_clock::now();
+
+  bool pulled = false;
+  if (!delta_from.empty() && delta_from != refhash) {
+    // OSTree only looks for a static delta from a commit we have when the
+    // server has no summary listing them if it pulls a ref, starting from the
+    // local copy of that ref. Pull the commit through a temporary ref which
+    // points to the commit we are on, falling back to objects when there is no
+    // delta.
+    if (ostree_repo_set_ref_immediate(repo, remote_name, delta_ref, delta_from.c_str(), nullptr, &error) != 0) {
+      options = pull_options(refhash, true, headers, tuning);
+      pulled = ostree_repo_pull_with_options(repo, remote_name, options, progress.get(), mt.cancellable.get(),
+                                             &error) != 0;
+      g_variant_unref(options);
+      GError *ref_error = nullptr;
+      if (ostree_repo_set_ref_immediate(repo, remote_name, delta_ref, nullptr, nullptr, &ref_error) == 0) {
+        g_error_free(ref_error);
+      }
+      if (!pulled && g_cancellable_is_cancelled(mt.cancellable.get()) == 0) {
+        // e.g. an OSTree version which insists on the ref being bound to the
+        // commit; the objects pulled so far are kept
+        LOG_WARNING << "Could not pull image from commit " << delta_from << ", pulling it in full: " << error->message;
+        g_error_free(error);
+        error = nullptr;
+      }
+    } else {
+      LOG_WARNING << "Could not set up a static delta pull: " << error->message;
+      g_error_free(error);
+      error = nullptr;
     }
-    g_variant_builder_add(&builder, "{s@v}", "http-headers",
-                          g_variant_new_variant(g_variant_builder_end(&hdr_builder)));
   }
 
-  options = g_variant_builder_end(&builder);
+  if (!pulled && error == nullptr) {
+    options = pull_options(refhash, false, headers, tuning);
+    pulled =
+        ostree_repo_pull_with_options(repo, remote_name, options, progress.get(), mt.cancellable.get(), &error) != 0;
+    g_variant_unref(options);
+  }
 
-  PullMetaStruct mt(target, token, g_cancellable_new(), std::move(progress_cb));
-  progress.reset(ostree_async_progress_new_and_connect(aktualizr_progress_cb, &mt));
-  if (ostree_repo_pull_with_options(repo.get(), alt_remote == nullptr ? remote : alt_remote, options, progress.get(),
-                                    mt.cancellable.get(), &error) == 0) {
+  if (report != nullptr) {
+    report->success = pulled;
+    report->bytes_transferred = ostree_async_progress_get_uint64(progress.get(), "bytes-transferred");
+    report->objects_fetched = ostree_async_progress_get_uint(progress.get(), "fetched");
+    report->metadata_objects_fetched = ostree_async_progress_get_uint(progress.get(), "metadata-fetched");
+    report->delta_parts_fetched = ostree_async_progress_get_uint(progress.get(), "fetched-delta-parts");
+    report->max_outstanding_fetches = mt.max_outstanding_fetches;
+    report->duration =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+  }
+
+  if (!pulled) {
     LOG_ERROR << "Error while pulling image: " << error->code << " " << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
-    g_variant_unref(options);
     return install_res;
   }
   ostree_async_progress_finish(progress.get());
-  g_variant_unref(options);
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "Pulling OSTree image was successful");
 }
 
@@ -167,8 +364,9 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
     opt_osname = config.os.c_str();
   }
 
-  GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.sysroot);
-  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
+  OstreeSysroot *sysroot = this->sysroot();
+  OstreeRepo *repo = this->repo(&error);
 
   if (error != nullptr) {
     LOG_ERROR << "could not get repo";
@@ -177,21 +375,21 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
   }
 
   auto origin = StructGuard<GKeyFile>(
-      ostree_sysroot_origin_new_from_refspec(sysroot.get(), target.sha256Hash().c_str()), g_key_file_free);
-  if (ostree_repo_resolve_rev(repo.get(), target.sha256Hash().c_str(), FALSE, &revision, &error) == 0) {
+      ostree_sysroot_origin_new_from_refspec(sysroot, target.sha256Hash().c_str()), g_key_file_free);
+  if (ostree_repo_resolve_rev(repo, target.sha256Hash().c_str(), FALSE, &revision, &error) == 0) {
     LOG_ERROR << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
     return install_res;
   }
 
-  GObjectUniquePtr<OstreeDeployment> merge_deployment(ostree_sysroot_get_merge_deployment(sysroot.get(), opt_osname));
+  GObjectUniquePtr<OstreeDeployment> merge_deployment(ostree_sysroot_get_merge_deployment(sysroot, opt_osname));
   if (merge_deployment == nullptr) {
     LOG_ERROR << "No merge deployment";
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "No merge deployment");
   }
 
-  if (ostree_sysroot_prepare_cleanup(sysroot.get(), cancellable, &error) == 0) {
+  if (ostree_sysroot_prepare_cleanup(sysroot, cancellable, &error) == 0) {
     LOG_ERROR << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
@@ -213,24 +411,47 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
   kargs_strv_vector[args_vector.size()] = nullptr;
   auto *kargs_strv = const_cast<char **>(&kargs_strv_vector[0]);
 
-  OstreeDeployment *new_deployment_raw = nullptr;
-  if (ostree_sysroot_deploy_tree(sysroot.get(), opt_osname, revision, origin.get(), merge_deployment.get(), kargs_strv,
-                                 &new_deployment_raw, cancellable, &error) == 0) {
-    LOG_ERROR << "ostree_sysroot_deploy_tree: " << error->message;
-    data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
-    g_error_free(error);
-    return install_res;
+  // Only a system booted from OSTree finalizes staged deployments at shutdown
+  const bool stage = config.ostree_staged_deploy && ostree_sysroot_get_booted_deployment(sysroot) != nullptr;
+  if (config.ostree_staged_deploy && !stage) {
+    LOG_WARNING << "Not booted from OSTree, writing out the deployment instead of staging it";
   }
-  GObjectUniquePtr<OstreeDeployment> new_deployment = GObjectUniquePtr<OstreeDeployment>(new_deployment_raw);
 
-  if (ostree_sysroot_simple_write_deployment(sysroot.get(), nullptr, new_deployment.get(), merge_deployment.get(),
-                                             OSTREE_SYSROOT_SIMPLE_WRITE_DEPLOYMENT_FLAGS_NONE, cancellable,
-                                             &error) == 0) {
-    LOG_ERROR << "ostree_sysroot_simple_write_deployment:" << error->message;
-    data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
-    g_error_free(error);
-    return install_res;
+  OstreeDeployment *new_deployment_raw = nullptr;
+  if (stage) {
+    // Checks out the commit, the bootloader configuration is written when the deployment is finalized
+    if (ostree_sysroot_stage_tree(sysroot, opt_osname, revision, origin.get(), merge_deployment.get(), kargs_strv,
+                                  &new_deployment_raw, cancellable, &error) == 0) {
+      LOG_ERROR << "ostree_sysroot_stage_tree: " << error->message;
+      data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
+      g_error_free(error);
+      sysroot_.reset();
+      return install_res;
+    }
+    GObjectUniquePtr<OstreeDeployment> new_deployment = GObjectUniquePtr<OstreeDeployment>(new_deployment_raw);
+    LOG_INFO << "Staged the deployment of " << revision << ", it is finalized at shutdown";
+  } else {
+    if (ostree_sysroot_deploy_tree(sysroot, opt_osname, revision, origin.get(), merge_deployment.get(), kargs_strv,
+                                   &new_deployment_raw, cancellable, &error) == 0) {
+      LOG_ERROR << "ostree_sysroot_deploy_tree: " << error->message;
+      data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
+      g_error_free(error);
+      return install_res;
+    }
+    GObjectUniquePtr<OstreeDeployment> new_deployment = GObjectUniquePtr<OstreeDeployment>(new_deployment_raw);
+
+    if (ostree_sysroot_simple_write_deployment(sysroot, nullptr, new_deployment.get(), merge_deployment.get(),
+                                               OSTREE_SYSROOT_SIMPLE_WRITE_DEPLOYMENT_FLAGS_NONE, cancellable,
+                                               &error) == 0) {
+      LOG_ERROR << "ostree_sysroot_simple_write_deployment:" << error->message;
+      data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
+      g_error_free(error);
+      sysroot_.reset();
+      return install_res;
+    }
   }
+  // The deployments have changed, load them again when they are needed
+  sysroot_.reset();
 
   // set reboot flag to be notified later
   if (bootloader_ != nullptr) {
@@ -276,8 +497,8 @@ OstreeManager::OstreeManager(const PackageConfig &pconfig, const BootloaderConfi
                              Bootloader *bootloader)
     : PackageManagerInterface(pconfig, BootloaderConfig(), storage, http),
       bootloader_(bootloader == nullptr ? new Bootloader(bconfig, *storage) : bootloader) {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
-  if (sysroot_smart == nullptr) {
+  sysroot_ = OstreeManager::LoadSysroot(config.sysroot);
+  if (sysroot_ == nullptr) {
     throw std::runtime_error("Could not find OSTree sysroot at: " + config.sysroot.string());
   }
 
@@ -288,7 +509,13 @@ OstreeManager::OstreeManager(const PackageConfig &pconfig, const BootloaderConfi
   }
 }
 
-OstreeManager::~OstreeManager() { bootloader_.reset(nullptr); }
+OstreeManager::~OstreeManager() {
+  {
+    std::lock_guard<std::mutex> guard(prefetch_mutex_);
+    cancelPrefetch();
+  }
+  bootloader_.reset(nullptr);
+}
 
 bool OstreeManager::fetchTarget(const Uptane::Target &target, Uptane::Fetcher &fetcher, const KeyManager &keys,
                                 const FetcherProgressCb &progress_cb, const api::FlowControlToken *token) {
@@ -297,7 +524,199 @@ bool OstreeManager::fetchTarget(const Uptane::Target &target, Uptane::Fetcher &f
     // while the target is aimed for a Secondary ECU that is configured with another/non-OSTree package manager
     return PackageManagerInterface::fetchTarget(target, fetcher, keys, progress_cb, token);
   }
-  return OstreeManager::pull(config.sysroot, config.ostree_server, keys, target, token, progress_cb).success;
+  if (awaitPrefetch(target, token)) {
+    return true;
+  }
+  GError *error = nullptr;
+  GObjectUniquePtr<OstreeRepo> repo = repoRef(&error);
+  if (error != nullptr) {
+    LOG_ERROR << "Could not get OSTree repo";
+    g_error_free(error);
+    return false;
+  }
+  std::string delta_from;
+  {
+    std::lock_guard<std::mutex> guard(sysroot_mutex_);
+    delta_from = deployed_commit(sysroot());
+  }
+  auto report = std::make_shared<event::OstreePullReport>(target, false);
+  const data::InstallationResult result = pullIntoRepo(repo.get(), delta_from, config.ostree_server, keys, target,
+                                                       token, progress_cb, nullptr, boost::none, config, report.get(),
+                                                       nullptr);
+  // Nothing was pulled if the commit was there already
+  if (events_channel_ && result.result_code.num_code != data::ResultCode::Numeric::kAlreadyProcessed) {
+    (*events_channel_)(report);
+  }
+  return result.success;
+}
+
+void OstreeManager::prefetchTarget(const Uptane::Target &target, std::shared_ptr<KeyManager> keys,
+                                   const api::FlowControlToken *token) {
+  if (!target.IsOstree()) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(prefetch_mutex_);
+  if (prefetch_.valid() && prefetch_target_.MatchTarget(target)) {
+    return;
+  }
+  cancelPrefetch();
+
+  GError *error = nullptr;
+  GObjectUniquePtr<OstreeRepo> repo = repoRef(&error);
+  if (error != nullptr) {
+    LOG_WARNING << "Could not get OSTree repo, the OSTree commit is not prefetched";
+    g_error_free(error);
+    return;
+  }
+  std::string delta_from;
+  {
+    std::lock_guard<std::mutex> sysroot_guard(sysroot_mutex_);
+    delta_from = deployed_commit(sysroot());
+  }
+
+  LOG_INFO << "Prefetching the OSTree commit " << target.sha256Hash() << " in the background";
+  prefetch_pull_ = std_::make_unique<BackgroundPull>();
+  prefetch_pull_->max_rate = config.ostree_prefetch_rate_limit;
+  prefetch_target_ = target;
+  prefetch_report_ = std::make_shared<event::OstreePullReport>(target, false);
+  const BackgroundPull *background = prefetch_pull_.get();
+  event::OstreePullReport *report = prefetch_report_.get();
+  prefetch_ = std::async(std::launch::async, [this, target, keys, token, delta_from, background, report,
+                                              prefetch_repo = std::move(repo)]() {
+    lower_thread_priority();
+    return pullIntoRepo(prefetch_repo.get(), delta_from, config.ostree_server, *keys, target, token, nullptr, nullptr,
+                        boost::none, config, report, background);
+  });
+}
+
+bool OstreeManager::awaitPrefetch(const Uptane::Target &target, const api::FlowControlToken *token) {
+  std::lock_guard<std::mutex> guard(prefetch_mutex_);
+  if (!prefetch_.valid()) {
+    return false;
+  }
+  if (!prefetch_target_.MatchTarget(target)) {
+    cancelPrefetch();
+    return false;
+  }
+
+  LOG_INFO << "Waiting for the prefetch of the OSTree commit " << target.sha256Hash() << " to finish";
+  prefetch_pull_->urgent = true;
+  // the download may still be aborted in the meantime
+  while (prefetch_.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+    if (token != nullptr && token->hasAborted()) {
+      prefetch_pull_->cancel_token.setAbort();
+    }
+  }
+  const data::InstallationResult result = prefetch_.get();
+  if (events_channel_ && result.result_code.num_code != data::ResultCode::Numeric::kAlreadyProcessed) {
+    (*events_channel_)(prefetch_report_);
+  }
+  prefetch_target_ = Uptane::Target::Unknown();
+  prefetch_pull_.reset();
+  prefetch_report_.reset();
+  return result.isSuccess();
+}
+
+void OstreeManager::cancelPrefetch() {
+  if (!prefetch_.valid()) {
+    return;
+  }
+  LOG_INFO << "Cancelling the prefetch of the OSTree commit " << prefetch_target_.sha256Hash();
+  prefetch_pull_->cancel_token.setAbort();
+  prefetch_.get();
+  prefetch_target_ = Uptane::Target::Unknown();
+  prefetch_pull_.reset();
+  prefetch_report_.reset();
+}
+
+void OstreeManager::pruneAfterFinalize() {
+  if (!config.ostree_prune) {
+    return;
+  }
+  // A pull in the background writes objects that nothing refers to yet
+  std::lock_guard<std::mutex> prefetch_guard(prefetch_mutex_);
+  if (prefetch_.valid() && prefetch_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    LOG_INFO << "Not pruning the OSTree repo while a commit is prefetched";
+    return;
+  }
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
+  IdleIoPriority idle_io;
+  const auto start = std::chrono::steady_clock::now();
+  GError *error = nullptr;
+  OstreeSysroot *sysroot = this->sysroot();
+  OstreeRepo *repo = this->repo(&error);
+  if (repo == nullptr) {
+    LOG_WARNING << "Could not get OSTree repo, not pruning it";
+    g_clear_error(&error);
+    return;
+  }
+
+  // The booted, pending and rollback deployments
+  std::set<std::string> keep;
+  g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments(sysroot);
+  for (guint i = 0; deployments != nullptr && i < deployments->len; ++i) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    keep.insert(ostree_deployment_get_csum(static_cast<OstreeDeployment *>(deployments->pdata[i])));
+  }
+  if (prefetch_.valid()) {
+    keep.insert(prefetch_target_.sha256Hash());
+  }
+  for (const auto &commit : recent_commits(repo, config.ostree_prune_keep_commits)) {
+    keep.insert(commit);
+  }
+  GHashTable *refs = nullptr;
+  if (ostree_repo_list_refs(repo, nullptr, &refs, nullptr, &error) == 0) {
+    LOG_WARNING << "Could not list the OSTree refs, not pruning the repo: " << error->message;
+    g_error_free(error);
+    return;
+  }
+  GHashTableIter iter;
+  gpointer value = nullptr;
+  g_hash_table_iter_init(&iter, refs);
+  while (g_hash_table_iter_next(&iter, nullptr, &value) != 0) {
+    keep.insert(static_cast<const char *>(value));
+  }
+  g_hash_table_destroy(refs);
+
+  // Only the kept commits themselves, not their parents
+  GHashTable *reachable = ostree_repo_traverse_new_reachable();
+  for (const auto &commit : keep) {
+    if (has_commit(repo, commit) &&
+        ostree_repo_traverse_commit_union(repo, commit.c_str(), 0, reachable, nullptr, &error) == 0) {
+      LOG_WARNING << "Could not traverse OSTree commit " << commit << ", not pruning the repo: " << error->message;
+      g_error_free(error);
+      g_hash_table_unref(reachable);
+      return;
+    }
+  }
+  OstreeRepoPruneOptions options{};
+  options.flags = OSTREE_REPO_PRUNE_FLAGS_NONE;
+  options.reachable = reachable;
+  gint objects_total = 0;
+  gint objects_pruned = 0;
+  guint64 bytes_pruned = 0;
+  const gboolean pruned = ostree_repo_prune_from_reachable(repo, &options, &objects_total, &objects_pruned,
+                                                           &bytes_pruned, nullptr, &error);
+  g_hash_table_unref(reachable);
+  if (pruned == 0) {
+    LOG_WARNING << "Could not prune the OSTree repo: " << error->message;
+    g_error_free(error);
+    return;
+  }
+  // The pruned commits may have been verified
+  verified_commits_.clear();
+
+  auto report = std::make_shared<event::OstreePruneReport>();
+  report->objects_total = static_cast<unsigned int>(objects_total);
+  report->objects_pruned = static_cast<unsigned int>(objects_pruned);
+  report->bytes_reclaimed = bytes_pruned;
+  report->duration =
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  LOG_INFO << "Pruned " << objects_pruned << " of " << objects_total << " OSTree objects, reclaimed " << bytes_pruned
+           << " bytes in " << report->duration.count() << " ms";
+  if (events_channel_) {
+    (*events_channel_)(report);
+  }
 }
 
 TargetStatus OstreeManager::verifyTarget(const Uptane::Target &target) const {
@@ -311,40 +730,59 @@ TargetStatus OstreeManager::verifyTarget(const Uptane::Target &target) const {
 
 TargetStatus OstreeManager::verifyTargetInternal(const Uptane::Target &target) const {
   const std::string refhash = target.sha256Hash();
+  {
+    std::lock_guard<std::mutex> guard(sysroot_mutex_);
+    // Forgets the commits if the deployments have changed since, as a cleanup may have pruned them
+    sysroot();
+    if (verified_commits_.count(refhash) != 0) {
+      return TargetStatus::kGood;
+    }
+  }
   GError *error = nullptr;
 
-  GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.sysroot);
-  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
+  GObjectUniquePtr<OstreeRepo> repo = repoRef(&error);
   if (error != nullptr) {
     LOG_ERROR << "Could not get OSTree repo";
     g_error_free(error);
     return TargetStatus::kNotFound;
   }
 
-  GHashTable *ref_list = nullptr;
-  if (ostree_repo_list_commit_objects_starting_with(repo.get(), refhash.c_str(), &ref_list, nullptr, &error) != 0) {
-    guint length = g_hash_table_size(ref_list);
-    g_hash_table_destroy(ref_list);  // OSTree creates the table with destroy notifiers, so no memory leaks expected
-    // should never be greater than 1, but use >= for robustness
-    if (length >= 1) {
-      return TargetStatus::kGood;
-    }
-  }
-  if (error != nullptr) {
-    g_error_free(error);
-    error = nullptr;
+  if (has_commit(repo.get(), refhash)) {
+    std::lock_guard<std::mutex> guard(sysroot_mutex_);
+    verified_commits_.insert(refhash);
+    return TargetStatus::kGood;
   }
 
   LOG_ERROR << "Could not find OSTree commit";
   return TargetStatus::kNotFound;
 }
 
-Json::Value OstreeManager::getInstalledPackages() const {
+Json::Value OstreeManager::getInstalledPackages() const { return installedPackages()->packages; }
+
+Hash OstreeManager::getInstalledPackagesHash() const { return installedPackages()->hash; }
+
+std::shared_ptr<const OstreeManager::InstalledPackages> OstreeManager::installedPackages() const {
+  std::lock_guard<std::mutex> guard(packages_mutex_);
+  struct stat st {};
+  const bool have_status = stat(config.packages_file.c_str(), &st) == 0;
+  if (have_status && packages_ != nullptr) {
+    const struct stat &cached = packages_->file_status;
+    if (st.st_dev == cached.st_dev && st.st_ino == cached.st_ino && st.st_size == cached.st_size &&
+        st.st_mtim.tv_sec == cached.st_mtim.tv_sec && st.st_mtim.tv_nsec == cached.st_mtim.tv_nsec) {
+      return packages_;
+    }
+  }
+
+  auto parsed = std::make_shared<InstalledPackages>();
   std::string packages_str = Utils::readFile(config.packages_file);
   std::vector<std::string> package_lines;
   // NOLINTNEXTLINE(clang-analyzer-cplusplus.NewDeleteLeaks)
   boost::split(package_lines, packages_str, boost::is_any_of("\n"));
-  Json::Value packages(Json::arrayValue);
+  parsed->packages = Json::Value(Json::arrayValue);
+  // hash the canonical JSON of the list as it is built, see
+  // PackageManagerInterface::getInstalledPackagesHash()
+  MultiPartSHA256Hasher hasher;
+  std::string canonical("[");
   for (auto it = package_lines.begin(); it != package_lines.end(); ++it) {
     if (it->empty()) {
       continue;
@@ -356,18 +794,33 @@ Json::Value OstreeManager::getInstalledPackages() const {
     Json::Value package;
     package["name"] = it->substr(0, pos);
     package["version"] = it->substr(pos + 1);
-    packages.append(package);
+    if (!parsed->packages.empty()) {
+      canonical.push_back(',');
+    }
+    canonical += Utils::jsonToCanonicalStr(package);
+    hasher.update(reinterpret_cast<const unsigned char *>(canonical.data()), canonical.size());
+    canonical.clear();
+    parsed->packages.append(package);
+  }
+  hasher.update(reinterpret_cast<const unsigned char *>("]"), 1);
+  parsed->hash = hasher.getHash();
+
+  // a file that changed while it was read is parsed again on the next call
+  if (have_status) {
+    parsed->file_status = st;
   }
-  return packages;
+  packages_ = parsed;
+  return packages_;
 }
 
 std::string OstreeManager::getCurrentHash() const {
   OstreeDeployment *deployment = nullptr;
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
+  OstreeSysroot *sysroot = this->sysroot();
   if (config.booted == BootedType::kBooted) {
-    deployment = ostree_sysroot_get_booted_deployment(sysroot_smart.get());
+    deployment = ostree_sysroot_get_booted_deployment(sysroot);
   } else {
-    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments(sysroot_smart.get());
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments(sysroot);
     if (deployments != nullptr && deployments->len > 0) {
       // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
       deployment = static_cast<OstreeDeployment *>(deployments->pdata[0]);
@@ -395,19 +848,14 @@ Uptane::Target OstreeManager::getCurrent() const {
   LOG_ERROR << "Current versions in storage and reported by OSTree do not match";
 
   // Look into installation log to find a possible candidate. Again, despite the
-  // name, this will work for Secondaries as well.
-  std::vector<Uptane::Target> installed_versions;
-  storage_->loadPrimaryInstallationLog(&installed_versions, false);
-
+  // empty serial, this will work for Secondaries as well.
+  //
   // Version should be in installed versions. It's possible that multiple
   // targets could have the same sha256Hash. In this case the safest assumption
-  // is that the most recent (the reverse of the vector) target is what we
-  // should return.
-  std::vector<Uptane::Target>::reverse_iterator it;
-  for (it = installed_versions.rbegin(); it != installed_versions.rend(); it++) {
-    if (it->sha256Hash() == current_hash) {
-      return *it;
-    }
+  // is that the most recent target is what we should return.
+  boost::optional<Uptane::Target> installed_version;
+  if (storage_->loadInstalledVersionByHash("", current_hash, &installed_version) && !!installed_version) {
+    return *installed_version;
   }
   // We haven't found a matching target. This can occur when a device is
   // freshly manufactured and the factory image is in a delegated target.
@@ -424,13 +872,14 @@ Uptane::Target OstreeManager::getCurrent() const {
 
 // used for bootloader rollback
 bool OstreeManager::imageUpdated() {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
+  OstreeSysroot *sysroot = this->sysroot();
 
   // image updated if no pending deployment in the list of deployments
-  GPtrArray *deployments = ostree_sysroot_get_deployments(sysroot_smart.get());
+  GPtrArray *deployments = ostree_sysroot_get_deployments(sysroot);
 
   OstreeDeployment *pending_deployment = nullptr;
-  ostree_sysroot_query_deployments_for(sysroot_smart.get(), nullptr, &pending_deployment, nullptr);
+  ostree_sysroot_query_deployments_for(sysroot, nullptr, &pending_deployment, nullptr);
 
   bool pending_found = false;
   for (guint i = 0; i < deployments->len; i++) {
@@ -446,12 +895,12 @@ bool OstreeManager::imageUpdated() {
 }
 
 GObjectUniquePtr<OstreeDeployment> OstreeManager::getStagedDeployment() const {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
 
   GPtrArray *deployments = nullptr;
   OstreeDeployment *res = nullptr;
 
-  deployments = ostree_sysroot_get_deployments(sysroot_smart.get());
+  deployments = ostree_sysroot_get_deployments(sysroot());
 
   if (deployments->len > 0) {
     // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
@@ -485,6 +934,43 @@ GObjectUniquePtr<OstreeSysroot> OstreeManager::LoadSysroot(const boost::filesyst
   return sysroot;
 }
 
+OstreeSysroot *OstreeManager::sysroot() const {
+  if (sysroot_ != nullptr) {
+    gboolean changed = FALSE;
+    GError *error = nullptr;
+    // Only a stat() of the deployments unless they have changed
+    if (ostree_sysroot_load_if_changed(sysroot_.get(), &changed, nullptr, &error) != 0) {
+      if (changed != FALSE) {
+        LOG_DEBUG << "OSTree deployments have changed, reloaded sysroot";
+        verified_commits_.clear();
+      }
+      return sysroot_.get();
+    }
+    LOG_WARNING << "Could not reload OSTree sysroot: " << error->message;
+    g_error_free(error);
+  }
+  sysroot_ = LoadSysroot(config.sysroot);
+  verified_commits_.clear();
+  return sysroot_.get();
+}
+
+OstreeRepo *OstreeManager::repo(GError **error) const {
+  // The repo doesn't depend on the deployments, keep it when they change
+  if (repo_ == nullptr) {
+    repo_ = LoadRepo(sysroot(), error);
+  }
+  return repo_.get();
+}
+
+GObjectUniquePtr<OstreeRepo> OstreeManager::repoRef(GError **error) const {
+  std::lock_guard<std::mutex> guard(sysroot_mutex_);
+  OstreeRepo *repo = this->repo(error);
+  if (repo == nullptr) {
+    return nullptr;
+  }
+  return GObjectUniquePtr<OstreeRepo>(static_cast<OstreeRepo *>(g_object_ref(repo)));
+}
+
 GObjectUniquePtr<OstreeRepo> OstreeManager::LoadRepo(OstreeSysroot *sysroot, GError **error) {
   OstreeRepo *repo = nullptr;
 
@@ -495,7 +981,7 @@ GObjectUniquePtr<OstreeRepo> OstreeManager::LoadRepo(OstreeSysroot *sysroot, GEr
   return GObjectUniquePtr<OstreeRepo>(repo);
 }
 
-bool OstreeManager::addRemote(OstreeRepo *repo, const std::string &url, const KeyManager &keys) {
+bool OstreeManager::addRemote(OstreeRepo *repo, const std::string &url, const KeyManager &keys, const bool http2) {
   GCancellable *cancellable = nullptr;
   GError *error = nullptr;
   GVariantBuilder b;
@@ -503,6 +989,9 @@ bool OstreeManager::addRemote(OstreeRepo *repo, const std::string &url, const Ke
 
   g_variant_builder_init(&b, G_VARIANT_TYPE("a{sv}"));
   g_variant_builder_add(&b, "{s@v}", "gpg-verify", g_variant_new_variant(g_variant_new_boolean(FALSE)));
+  if (!http2) {
+    g_variant_builder_add(&b, "{s@v}", "http2", g_variant_new_variant(g_variant_new_boolean(FALSE)));
+  }
 
   std::string cert_file = keys.getCertFile();
   std::string pkey_file = keys.getPkeyFile();
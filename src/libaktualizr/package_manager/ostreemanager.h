@@ -2,10 +2,17 @@
 #define OSTREE_H_
 
 #include <boost/optional/optional.hpp>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
 
+#include <sys/stat.h>
+
 #include <glib/gi18n.h>
 #include <ostree.h>
 
@@ -25,6 +32,16 @@ template <typename T>
 using GObjectUniquePtr = std::unique_ptr<T, GObjectFinalizer<T>>;
 using OstreeProgressCb = std::function<void(const Uptane::Target &, const std::string &, unsigned int)>;
 
+// How a pull in the background is held back, see OstreeManager::prefetchTarget()
+struct BackgroundPull {
+  // aborts the pull, next to the token it was started with
+  api::FlowControlToken cancel_token;
+  // bytes per second, 0 for no limit
+  uint64_t max_rate{0};
+  // set once a download waits for the pull, lifts the rate limit
+  std::atomic<bool> urgent{false};
+};
+
 struct PullMetaStruct {
   PullMetaStruct(Uptane::Target target_in, const api::FlowControlToken *token_in, GCancellable *cancellable_in,
                  OstreeProgressCb progress_cb_in)
@@ -34,9 +51,13 @@ struct PullMetaStruct {
         progress_cb{std::move(progress_cb_in)} {}
   Uptane::Target target;
   unsigned int percent_complete{0};
+  // sampled on every progress update
+  unsigned int max_outstanding_fetches{0};
   const api::FlowControlToken *token;
   GObjectUniquePtr<GCancellable> cancellable;
   OstreeProgressCb progress_cb;
+  const BackgroundPull *background{nullptr};
+  std::chrono::steady_clock::time_point start_time{std::chrono::steady_clock::now()};
 };
 
 class OstreeManager : public PackageManagerInterface {
@@ -51,6 +72,7 @@ class OstreeManager : public PackageManagerInterface {
   OstreeManager &operator=(OstreeManager &&) = delete;
   std::string name() const override { return "ostree"; }
   Json::Value getInstalledPackages() const override;
+  Hash getInstalledPackagesHash() const override;
   virtual std::string getCurrentHash() const;
   Uptane::Target getCurrent() const override;
   bool imageUpdated();
@@ -60,12 +82,17 @@ class OstreeManager : public PackageManagerInterface {
   void updateNotify() override;
   bool fetchTarget(const Uptane::Target &target, Uptane::Fetcher &fetcher, const KeyManager &keys,
                    const FetcherProgressCb &progress_cb, const api::FlowControlToken *token) override;
+  void prefetchTarget(const Uptane::Target &target, std::shared_ptr<KeyManager> keys,
+                      const api::FlowControlToken *token) override;
+  // With ostree_prune, removes the objects that neither the deployments, the
+  // refs, a prefetched commit nor the most recent commits need
+  void pruneAfterFinalize() override;
   TargetStatus verifyTarget(const Uptane::Target &target) const override;
 
   GObjectUniquePtr<OstreeDeployment> getStagedDeployment() const;
   static GObjectUniquePtr<OstreeSysroot> LoadSysroot(const boost::filesystem::path &path);
   static GObjectUniquePtr<OstreeRepo> LoadRepo(OstreeSysroot *sysroot, GError **error);
-  static bool addRemote(OstreeRepo *repo, const std::string &url, const KeyManager &keys);
+  static bool addRemote(OstreeRepo *repo, const std::string &url, const KeyManager &keys, bool http2 = true);
   static data::InstallationResult pull(
       const boost::filesystem::path &sysroot_path, const std::string &ostree_server, const KeyManager &keys,
       const Uptane::Target &target, const api::FlowControlToken *token = nullptr,
@@ -74,8 +101,55 @@ class OstreeManager : public PackageManagerInterface {
 
  private:
   TargetStatus verifyTargetInternal(const Uptane::Target &target) const;
+  // Pulls a static delta from delta_from to the target instead of its objects
+  // if the server has one. The fetcher is set up with the OSTree options of
+  // tuning, and the statistics of the pull are filled into report, if any.
+  // A pull in the background is also held back by background.
+  static data::InstallationResult pullIntoRepo(OstreeRepo *repo, const std::string &delta_from,
+                                               const std::string &ostree_server, const KeyManager &keys,
+                                               const Uptane::Target &target, const api::FlowControlToken *token,
+                                               OstreeProgressCb progress_cb, const char *alt_remote,
+                                               boost::optional<std::unordered_map<std::string, std::string>> headers,
+                                               const PackageConfig &tuning, event::OstreePullReport *report,
+                                               const BackgroundPull *background);
+  // Waits for the prefetch of the Target, and cancels the prefetch of any
+  // other one. True if the prefetch pulled the Target.
+  bool awaitPrefetch(const Uptane::Target &target, const api::FlowControlToken *token);
+  // with prefetch_mutex_ held
+  void cancelPrefetch();
+
+  // The packages file as it was parsed last, with the file status it had
+  struct InstalledPackages {
+    struct stat file_status {};
+    Json::Value packages;
+    Hash hash{Hash::Type::kSha256, ""};
+  };
+  // Parses the packages file again only if it has changed since the last call
+  std::shared_ptr<const InstalledPackages> installedPackages() const;
+
+  // The sysroot, loaded once and then only reloaded when its deployments
+  // change. Must be called with sysroot_mutex_ held.
+  OstreeSysroot *sysroot() const;
+  // The repo of the sysroot, with sysroot_mutex_ held
+  OstreeRepo *repo(GError **error) const;
+  // A reference to the repo of the sysroot, to be used without holding the lock
+  GObjectUniquePtr<OstreeRepo> repoRef(GError **error) const;
 
   std::unique_ptr<Bootloader> bootloader_;
+  mutable std::mutex sysroot_mutex_;
+  mutable GObjectUniquePtr<OstreeSysroot> sysroot_;
+  mutable GObjectUniquePtr<OstreeRepo> repo_;
+  // The commits verifyTarget() has found, until the deployments change. With sysroot_mutex_ held.
+  mutable std::set<std::string> verified_commits_;
+
+  mutable std::mutex packages_mutex_;
+  mutable std::shared_ptr<const InstalledPackages> packages_;
+
+  std::mutex prefetch_mutex_;
+  std::unique_ptr<BackgroundPull> prefetch_pull_;
+  std::future<data::InstallationResult> prefetch_;
+  Uptane::Target prefetch_target_{Uptane::Target::Unknown()};
+  std::shared_ptr<event::OstreePullReport> prefetch_report_;
 };
 
 #endif  // OSTREE_H_
@@ -3,12 +3,14 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
 #include "libaktualizr/config.h"
 #include "package_manager/ostreemanager.h"
 #include "storage/invstorage.h"
+#include "uptane/fetcher.h"
 #include "utilities/utils.h"
 
 boost::filesystem::path test_sysroot;
@@ -125,6 +127,36 @@ TEST(OstreeManager, ParseInstalledPackages) {
   EXPECT_EQ(packages[2]["version"].asString(), "1.1");
 }
 
+/* The parsed packages file is kept until the file changes, and its hash is
+ * that of the canonical JSON of the list. */
+TEST(OstreeManager, CachedInstalledPackages) {
+  TemporaryDirectory temp_dir;
+  boost::filesystem::path packages_file = temp_dir / "package.manifest";
+  Utils::writeFile(packages_file, std::string("vim 1.0\nemacs 2.0\n"));
+
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.pacman.packages_file = packages_file;
+  config.storage.path = temp_dir.Path();
+
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  OstreeManager ostree(config.pacman, config.bootloader, storage, nullptr);
+  for (int i = 0; i < 2; ++i) {
+    const Json::Value packages = ostree.getInstalledPackages();
+    ASSERT_EQ(packages.size(), 2U);
+    EXPECT_EQ(ostree.getInstalledPackagesHash(),
+              Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(packages)));
+  }
+
+  Utils::writeFile(packages_file, std::string("vim 1.1\nemacs 2.0\nbash 1.1\n"));
+  const Json::Value packages = ostree.getInstalledPackages();
+  ASSERT_EQ(packages.size(), 3U);
+  EXPECT_EQ(packages[0]["version"].asString(), "1.1");
+  EXPECT_EQ(ostree.getInstalledPackagesHash(),
+            Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(packages)));
+}
+
 /**
  * Check that OstreeManager::getCurrent() returns a sensible result, even if it
  * can't match the currently booted OSTree commit against a known target.
@@ -149,6 +181,95 @@ TEST(OstreeManager, GetCurrentTarget) {
   EXPECT_EQ(dut.getCurrentHash(), current_target.sha256Hash()) << "hash should match";
 }
 
+/* The sysroot and repo kept between calls give the same results as loading them
+ * for every call. */
+TEST(OstreeManager, ReuseSysroot) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.storage.path = temp_dir.Path();
+  config.pacman.booted = BootedType::kStaged;
+  auto storage = INvStorage::newStorage(config.storage);
+  OstreeManager dut(config.pacman, config.bootloader, storage, nullptr);
+
+  GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.pacman.sysroot);
+  g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments(sysroot.get());
+  ASSERT_GT(deployments->len, 0);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  const std::string hash = ostree_deployment_get_csum(static_cast<OstreeDeployment *>(deployments->pdata[0]));
+
+  const auto current_target = dut.getCurrent();
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(dut.getCurrentHash(), hash);
+    GObjectUniquePtr<OstreeDeployment> staged = dut.getStagedDeployment();
+    ASSERT_NE(staged, nullptr);
+    EXPECT_EQ(std::string(ostree_deployment_get_csum(staged.get())), hash);
+    EXPECT_EQ(dut.verifyTarget(current_target), TargetStatus::kGood);
+  }
+}
+
+/* A Target is verified by a lookup of its full commit, also when the answer
+ * is remembered from an earlier call. */
+TEST(OstreeManager, VerifyTarget) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.storage.path = temp_dir.Path();
+  config.pacman.booted = BootedType::kStaged;
+  auto storage = INvStorage::newStorage(config.storage);
+  OstreeManager dut(config.pacman, config.bootloader, storage, nullptr);
+
+  const auto current_target = dut.getCurrent();
+  EXPECT_EQ(dut.verifyTarget(current_target), TargetStatus::kGood);
+  EXPECT_EQ(dut.verifyTarget(current_target), TargetStatus::kGood);
+
+  auto target_json = [](const std::string &hash) {
+    Json::Value json;
+    json["hashes"]["sha256"] = hash;
+    json["length"] = 0;
+    return json;
+  };
+  const std::string missing(64, 'a');
+  EXPECT_EQ(dut.verifyTarget(Uptane::Target("missing", target_json(missing))), TargetStatus::kNotFound);
+  // only full hashes are looked up
+  const std::string prefix = current_target.sha256Hash().substr(0, 8);
+  EXPECT_EQ(dut.verifyTarget(Uptane::Target("prefix", target_json(prefix))), TargetStatus::kNotFound);
+}
+
+/* The download picks up a commit prefetched in the background, and cancels
+ * the prefetch of any other commit. */
+TEST(OstreeManager, PrefetchTarget) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.pacman.ostree_server = "bad-url";
+  config.pacman.ostree_prefetch = true;
+  config.pacman.ostree_prefetch_rate_limit = 1;
+  config.storage.path = temp_dir.Path();
+  config.pacman.booted = BootedType::kStaged;
+  auto storage = INvStorage::newStorage(config.storage);
+  OstreeManager dut(config.pacman, config.bootloader, storage, nullptr);
+  Uptane::Fetcher fetcher(config, nullptr);
+  auto keys = std::make_shared<KeyManager>(storage, config.keymanagerConfig());
+  keys->loadKeys();
+
+  const Uptane::Target current = dut.getCurrent();
+  dut.prefetchTarget(current, keys, nullptr);
+  EXPECT_TRUE(dut.fetchTarget(current, fetcher, *keys, nullptr, nullptr));
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = std::string(64, 'a');
+  target_json["length"] = 0;
+  target_json["custom"]["targetFormat"] = "OSTREE";
+  const Uptane::Target other("other", target_json);
+  dut.prefetchTarget(other, keys, nullptr);
+  EXPECT_TRUE(dut.fetchTarget(current, fetcher, *keys, nullptr, nullptr));
+  EXPECT_FALSE(dut.fetchTarget(other, fetcher, *keys, nullptr, nullptr));
+}
+
 /* Communicate with a remote OSTree server without credentials. */
 TEST(OstreeManager, AddRemoteNoCreds) {
   TemporaryDirectory temp_dir;
@@ -235,6 +356,32 @@ TEST(OstreeManager, AddRemoteWithCreds) {
   g_object_unref(repo);
 }
 
+/* Pruning keeps the deployed commit and reports what it reclaimed. Last, as
+ * it prunes the sysroot the other tests use. */
+TEST(OstreeManager, PruneAfterFinalize) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.pacman.ostree_prune = true;
+  config.storage.path = temp_dir.Path();
+  config.pacman.booted = BootedType::kStaged;
+  auto storage = INvStorage::newStorage(config.storage);
+  OstreeManager dut(config.pacman, config.bootloader, storage, nullptr);
+  std::vector<std::shared_ptr<event::BaseEvent>> events;
+  auto channel = std::make_shared<event::Channel>();
+  channel->connect([&events](std::shared_ptr<event::BaseEvent> event) { events.push_back(std::move(event)); });
+  dut.setEventsChannel(channel);
+
+  dut.pruneAfterFinalize();
+  ASSERT_EQ(events.size(), 1U);
+  ASSERT_TRUE(events[0]->isTypeOf<event::OstreePruneReport>());
+  const auto report = std::static_pointer_cast<event::OstreePruneReport>(events[0]);
+  EXPECT_GT(report->objects_total, 0U);
+  EXPECT_LE(report->objects_pruned, report->objects_total);
+  EXPECT_EQ(dut.verifyTarget(dut.getCurrent()), TargetStatus::kGood);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -11,10 +11,46 @@ void PackageConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt
       CopyFromConfig(sysroot, cp.first, pt);
     } else if (cp.first == "ostree_server") {
       CopyFromConfig(ostree_server, cp.first, pt);
+    } else if (cp.first == "ostree_http2") {
+      CopyFromConfig(ostree_http2, cp.first, pt);
+    } else if (cp.first == "ostree_low_speed_limit") {
+      CopyFromConfig(ostree_low_speed_limit, cp.first, pt);
+    } else if (cp.first == "ostree_low_speed_time") {
+      CopyFromConfig(ostree_low_speed_time, cp.first, pt);
+    } else if (cp.first == "ostree_network_retries") {
+      CopyFromConfig(ostree_network_retries, cp.first, pt);
+    } else if (cp.first == "ostree_prefetch") {
+      CopyFromConfig(ostree_prefetch, cp.first, pt);
+    } else if (cp.first == "ostree_prefetch_rate_limit") {
+      CopyFromConfig(ostree_prefetch_rate_limit, cp.first, pt);
+    } else if (cp.first == "ostree_staged_deploy") {
+      CopyFromConfig(ostree_staged_deploy, cp.first, pt);
+    } else if (cp.first == "ostree_prune") {
+      CopyFromConfig(ostree_prune, cp.first, pt);
+    } else if (cp.first == "ostree_prune_keep_commits") {
+      CopyFromConfig(ostree_prune_keep_commits, cp.first, pt);
     } else if (cp.first == "images_path") {
       CopyFromConfig(images_path, cp.first, pt);
     } else if (cp.first == "packages_file") {
       CopyFromConfig(packages_file, cp.first, pt);
+    } else if (cp.first == "download_segments") {
+      CopyFromConfig(download_segments, cp.first, pt);
+    } else if (cp.first == "download_direct_io") {
+      CopyFromConfig(download_direct_io, cp.first, pt);
+    } else if (cp.first == "images_retention") {
+      CopyFromConfig(images_retention, cp.first, pt);
+    } else if (cp.first == "secondary_cut_through") {
+      CopyFromConfig(secondary_cut_through, cp.first, pt);
+    } else if (cp.first == "secondary_cut_through_copy") {
+      CopyFromConfig(secondary_cut_through_copy, cp.first, pt);
+    } else if (cp.first == "secondary_cache_address") {
+      CopyFromConfig(secondary_cache_address, cp.first, pt);
+    } else if (cp.first == "secondary_cache_port") {
+      CopyFromConfig(secondary_cache_port, cp.first, pt);
+    } else if (cp.first == "secondary_cache_path") {
+      CopyFromConfig(secondary_cache_path, cp.first, pt);
+    } else if (cp.first == "secondary_cache_max_size") {
+      CopyFromConfig(secondary_cache_max_size, cp.first, pt);
     } else if (cp.first == "fake_need_reboot") {
       CopyFromConfig(fake_need_reboot, cp.first, pt);
     } else if (cp.first == "booted") {
@@ -30,8 +66,26 @@ void PackageConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, os, "os");
   writeOption(out_stream, sysroot, "sysroot");
   writeOption(out_stream, ostree_server, "ostree_server");
+  writeOption(out_stream, ostree_http2, "ostree_http2");
+  writeOption(out_stream, ostree_low_speed_limit, "ostree_low_speed_limit");
+  writeOption(out_stream, ostree_low_speed_time, "ostree_low_speed_time");
+  writeOption(out_stream, ostree_network_retries, "ostree_network_retries");
+  writeOption(out_stream, ostree_prefetch, "ostree_prefetch");
+  writeOption(out_stream, ostree_prefetch_rate_limit, "ostree_prefetch_rate_limit");
+  writeOption(out_stream, ostree_staged_deploy, "ostree_staged_deploy");
+  writeOption(out_stream, ostree_prune, "ostree_prune");
+  writeOption(out_stream, ostree_prune_keep_commits, "ostree_prune_keep_commits");
   writeOption(out_stream, images_path, "images_path");
   writeOption(out_stream, packages_file, "packages_file");
+  writeOption(out_stream, download_segments, "download_segments");
+  writeOption(out_stream, download_direct_io, "download_direct_io");
+  writeOption(out_stream, images_retention, "images_retention");
+  writeOption(out_stream, secondary_cut_through, "secondary_cut_through");
+  writeOption(out_stream, secondary_cut_through_copy, "secondary_cut_through_copy");
+  writeOption(out_stream, secondary_cache_address, "secondary_cache_address");
+  writeOption(out_stream, secondary_cache_port, "secondary_cache_port");
+  writeOption(out_stream, secondary_cache_path, "secondary_cache_path");
+  writeOption(out_stream, secondary_cache_max_size, "secondary_cache_max_size");
   writeOption(out_stream, fake_need_reboot, "fake_need_reboot");
   writeOption(out_stream, booted, "booted");
 
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <boost/property_tree/ini_parser.hpp>
+
 #include "libaktualizr/config.h"
 #include "logging/logging.h"
 
@@ -17,6 +19,37 @@ TEST(PackageManagerConfig, WriteToStream) {
   ASSERT_NE(std::string::npos, cfg.find("foo = \"bar\""));
 }
 
+/* The OSTree fetcher options survive a round trip through the config file. */
+TEST(PackageManagerConfig, OstreeTuning) {
+  PackageConfig config;
+  config.ostree_http2 = false;
+  config.ostree_low_speed_limit = 100;
+  config.ostree_low_speed_time = 60;
+  config.ostree_network_retries = 2;
+  config.ostree_prefetch = true;
+  config.ostree_prefetch_rate_limit = 1000;
+  config.ostree_staged_deploy = true;
+  config.ostree_prune = true;
+  config.ostree_prune_keep_commits = 3;
+  std::stringstream out;
+  config.writeToStream(out);
+
+  boost::property_tree::ptree pt;
+  boost::property_tree::ini_parser::read_ini(out, pt);
+  PackageConfig read;
+  read.updateFromPropertyTree(pt);
+  EXPECT_FALSE(read.ostree_http2);
+  EXPECT_EQ(read.ostree_low_speed_limit, 100U);
+  EXPECT_EQ(read.ostree_low_speed_time, 60U);
+  EXPECT_EQ(read.ostree_network_retries, 2U);
+  EXPECT_TRUE(read.ostree_prefetch);
+  EXPECT_EQ(read.ostree_prefetch_rate_limit, 1000U);
+  EXPECT_TRUE(read.ostree_staged_deploy);
+  EXPECT_TRUE(read.ostree_prune);
+  EXPECT_EQ(read.ostree_prune_keep_commits, 3U);
+  EXPECT_TRUE(read.extra.empty());
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <unistd.h>
 #include <iostream>
 #include <memory>
 #include <sstream>
@@ -52,6 +53,12 @@ TEST(PackageManagerFake, Binary) {
     ss << in.rdbuf();
     ASSERT_EQ(ss.str(), "aa");
   }
+  {
+    const auto view = pacman.openTargetFileView(target);
+    ASSERT_EQ(view.size(), 2);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view.data()), view.size()), "aa");
+    EXPECT_EQ(lseek(view.fd(), 0, SEEK_END), 2);
+  }
   // Test overwriting
   {
     auto out = pacman.createTargetFile(target);
@@ -67,6 +74,7 @@ TEST(PackageManagerFake, Binary) {
   pacman.removeTargetFile(target);
   EXPECT_THROW(pacman.appendTargetFile(target), std::runtime_error);
   EXPECT_THROW(pacman.openTargetFile(target), std::runtime_error);
+  EXPECT_THROW(pacman.openTargetFileView(target), std::runtime_error);
 }
 
 // Test listing and removing binary targets
@@ -159,6 +167,36 @@ TEST(PackageManagerFake, Verify) {
   EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kGood);
 }
 
+/* All the hashes of a target are checked: a good SHA-256 hash doesn't make up
+ * for a bad SHA-512 one. */
+TEST(PackageManagerFake, VerifyAllHashes) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.storage.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, nullptr);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  const std::string content = "good";
+  const Hash sha256 = Hash::generate(Hash::Type::kSha256, content);
+  const Hash sha512 = Hash::generate(Hash::Type::kSha512, content);
+  const Hash bad_sha512 = Hash::generate(Hash::Type::kSha512, "bad");
+
+  const Uptane::Target bad_target("bad-pkg", primary_ecu, {sha256, bad_sha512}, content.size());
+  auto whandle = fakepm.createTargetFile(bad_target);
+  whandle.write(content.c_str(), static_cast<std::streamsize>(content.size()));
+  whandle.close();
+  EXPECT_EQ(fakepm.verifyTarget(bad_target), TargetStatus::kHashMismatch);
+
+  const Uptane::Target good_target("good-pkg", primary_ecu, {sha256, sha512}, content.size());
+  whandle = fakepm.createTargetFile(good_target);
+  whandle.write(content.c_str(), static_cast<std::streamsize>(content.size()));
+  whandle.close();
+  EXPECT_EQ(fakepm.verifyTarget(good_target), TargetStatus::kGood);
+}
+
 TEST(PackageManagerFake, FinalizeAfterReboot) {
   TemporaryDirectory temp_dir;
   Config config;
@@ -1,51 +1,144 @@
 #include "libaktualizr/packagemanagerinterface.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <unistd.h>
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
 
 #include "crypto/crypto.h"
 #include "crypto/keymanager.h"
+#include "downloadsink.h"
 #include "http/httpclient.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
+#include "target_stream.h"
 #include "uptane/exceptions.h"
 #include "uptane/fetcher.h"
+#include "uptane/offline_bundle.h"
 #include "utilities/apiqueue.h"
+#include "utilities/metrics.h"
+
+// Download progress is reported each time it moves by a percent, and at most
+// every kProgressReportInterval: the report runs on the transfer thread and
+// sends an event. The last report of a download is never held back.
+static constexpr std::chrono::milliseconds kProgressReportInterval{100};
+// each LogProgressInterval msec log dowload progress for big files
+static constexpr std::chrono::milliseconds LogProgressInterval{15000};
+
+struct DownloadProgress {
+  DownloadProgress() : time_lastlog{std::chrono::steady_clock::now()} {}
+
+  static unsigned int percent(const Uptane::Target& target, uintmax_t downloaded) {
+    const uint64_t expected = target.length();
+    return expected == 0 ? 100 : static_cast<unsigned int>((downloaded * 100) / expected);
+  }
+  // Cheap enough for every progress callback of curl, and may be called
+  // concurrently with report()
+  bool due(const Uptane::Target& target, uintmax_t downloaded) const {
+    return percent(target, downloaded) > last_progress.load(std::memory_order_relaxed);
+  }
+  // Not thread-safe
+  void report(const Uptane::Target& target, const FetcherProgressCb& progress_cb, uintmax_t downloaded);
+
+  std::atomic<unsigned int> last_progress{0};
+  std::chrono::steady_clock::time_point time_lastreport{};
+  std::chrono::steady_clock::time_point time_lastlog;
+};
+
+void DownloadProgress::report(const Uptane::Target& target, const FetcherProgressCb& progress_cb,
+                              uintmax_t downloaded) {
+  const unsigned int progress = percent(target, downloaded);
+  if (!progress_cb || progress <= last_progress.load(std::memory_order_relaxed)) {
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  // what is held back here goes with the next callback, curl calls it at
+  // least once a second
+  if (progress < 100 && now - time_lastreport < kProgressReportInterval) {
+    return;
+  }
+  last_progress.store(progress, std::memory_order_relaxed);
+  time_lastreport = now;
+  progress_cb(target, "Downloading", progress);
+  // OTA-4864:Improve binary file download progress logging. Report each XX sec report event that notify user
+  if (now - time_lastlog > LogProgressInterval) {
+    LOG_INFO << "Download progress for file " << target.filename() << ": " << progress << "%";
+    time_lastlog = now;
+  }
+}
 
 struct DownloadMetaStruct {
  public:
   DownloadMetaStruct(Uptane::Target target_in, FetcherProgressCb progress_cb_in, const api::FlowControlToken* token_in)
-      : hash_type{target_in.hashes()[0].type()},
-        target{std::move(target_in)},
+      : target{std::move(target_in)},
         token{token_in},
         progress_cb{std::move(progress_cb_in)},
-        time_lastreport{std::chrono::steady_clock::now()} {}
+        hasher_{MultiPartHasher::create(target.hashes())} {}
+  ~DownloadMetaStruct() {
+    // the sink still uses the hasher until it is destroyed
+    sink.reset();
+  }
+  DownloadMetaStruct(const DownloadMetaStruct&) = delete;
+  DownloadMetaStruct(DownloadMetaStruct&&) = delete;
+  DownloadMetaStruct& operator=(const DownloadMetaStruct&) = delete;
+  DownloadMetaStruct& operator=(DownloadMetaStruct&&) = delete;
   uintmax_t downloaded_length{0};
-  unsigned int last_progress{0};
-  std::ofstream fhandle;
-  const Hash::Type hash_type;
+  DownloadProgress progress;
+  std::unique_ptr<DownloadSink> sink;
+  // where to checkpoint the hasher state while downloading, if set
+  const INvStorage* storage{nullptr};
+  uintmax_t checkpointed_length{0};
   MultiPartHasher& hasher() {
-    switch (hash_type) {
-      case Hash::Type::kSha256:
-        return sha256_hasher;
-      case Hash::Type::kSha512:
-        return sha512_hasher;
-      default:
-        throw std::runtime_error("Unknown hash algorithm");
+    if (hasher_ == nullptr) {
+      throw std::runtime_error("Unknown hash algorithm");
     }
+    return *hasher_;
   }
   Uptane::Target target;
   const api::FlowControlToken* token;
   FetcherProgressCb progress_cb;
-  // each LogProgressInterval msec log dowload progress for big files
-  std::chrono::time_point<std::chrono::steady_clock> time_lastreport;
 
  private:
-  MultiPartSHA256Hasher sha256_hasher;
-  MultiPartSHA512Hasher sha512_hasher;
+  // all the hashes of the Target in one pass
+  MultiPartHasher::Ptr hasher_;
 };
 
+// The hasher state is stored each time this many bytes have been downloaded,
+// so that resuming doesn't need to hash the whole file again.
+static constexpr uintmax_t kHashCheckpointInterval = 16U << 20U;
+
+// Store the hasher state for the data written so far. The data is synced to
+// disk first: a checkpoint must never cover bytes that might still be lost.
+static void checkpointHasherState(DownloadMetaStruct& ds) {
+  if (ds.storage == nullptr || ds.sink == nullptr || ds.checkpointed_length == ds.downloaded_length) {
+    return;
+  }
+  // once drained, the hasher is idle and matches the data written so far
+  const uintmax_t length = ds.sink->drain();
+  if (length == ds.checkpointed_length || !ds.sink->sync()) {
+    return;
+  }
+  try {
+    ds.storage->storeTargetHashState(ds.target.filename(), length, ds.hasher().getState());
+    ds.checkpointed_length = length;
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not store hash state of " << ds.target.filename() << ": " << e.what();
+  }
+}
+
+static metrics::Counter& downloadedBytes() {
+  static auto& counter =
+      metrics::Registry::instance().counter("aktualizr_image_downloaded_bytes_total", "Bytes of images downloaded");
+  return counter;
+}
+
 static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* userp) {
   assert(userp);
   auto* ds = static_cast<DownloadMetaStruct*>(userp);
@@ -55,14 +148,17 @@ static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* u
     return downloaded + 1;  // curl will abort if return unexpected size;
   }
 
-  ds->fhandle.write(contents, static_cast<std::streamsize>(downloaded));
-  ds->hasher().update(reinterpret_cast<const unsigned char*>(contents), downloaded);
+  if (!ds->sink->write(contents, downloaded)) {
+    return 0;
+  }
   ds->downloaded_length += downloaded;
+  downloadedBytes().add(downloaded);
+  if (ds->downloaded_length - ds->checkpointed_length >= kHashCheckpointInterval) {
+    checkpointHasherState(*ds);
+  }
   return downloaded;
 }
 
-static constexpr int64_t LogProgressInterval = 15000;
-
 static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
   (void)dltotal;
   (void)dlnow;
@@ -70,38 +166,230 @@ static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
   (void)ulnow;
   auto* ds = static_cast<DownloadMetaStruct*>(clientp);
 
-  uint64_t expected = ds->target.length();
-  auto progress = static_cast<unsigned int>((ds->downloaded_length * 100) / expected);
-  if (ds->progress_cb && progress > ds->last_progress) {
-    ds->last_progress = progress;
-    ds->progress_cb(ds->target, "Downloading", progress);
-    // OTA-4864:Improve binary file download progress logging. Report each XX sec report event that notify user
-    auto now = std::chrono::steady_clock::now();
-    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(now - ds->time_lastreport);
-    if (milliseconds.count() > LogProgressInterval) {
-      LOG_INFO << "Download progress for file " << ds->target.filename() << ": " << progress << "%";
-      ds->time_lastreport = now;
+  ds->progress.report(ds->target, ds->progress_cb, ds->downloaded_length);
+  if (ds->token != nullptr && ds->token->hasAborted()) {
+    return 1;
+  }
+  return 0;
+}
+
+bool PackageManagerInterface::fetchTargetFromBundle(const Uptane::Target& target, const Uptane::OfflineBundle& bundle,
+                                                    const FetcherProgressCb& progress_cb,
+                                                    const api::FlowControlToken* token) {
+  bool result = false;
+  try {
+    if (target.hashes().empty()) {
+      throw Uptane::Exception("image", "No hash defined for the target");
+    }
+    if (verifyTarget(target) == TargetStatus::kGood) {
+      LOG_INFO << "Image already stored; skipping " << target.filename();
+      return true;
+    }
+    if (target.IsOstree()) {
+      throw Uptane::Exception("image", "OSTree Target " + target.filename() + " can't be stored from a bundle");
+    }
+    const auto image = bundle.target(target.filename());
+    if (!image) {
+      throw Uptane::Exception("image", "No image of " + target.filename() + " in " + bundle.path().string());
+    }
+    if (image->size != target.length()) {
+      throw Uptane::Exception("image", "Image of " + target.filename() + " in " + bundle.path().string() +
+                                           " doesn't have the length of the target");
+    }
+    if (!checkAvailableDiskSpace(target.length())) {
+      throw std::runtime_error("Insufficient disk space available to store target");
+    }
+
+    createTargetFile(target).close();
+    const std::string path = checkTargetFile(target)->second;
+    DownloadMetaStruct ds(target, progress_cb, token);
+    // written and hashed on two threads, straight from the mapped bundle
+    ds.sink = std_::make_unique<DownloadSink>(path, 0, ds.hasher(), config.download_direct_io);
+    ds.sink->reserve(target.length());
+    while (ds.downloaded_length < image->size) {
+      if (token != nullptr && token->hasAborted()) {
+        ds.sink->finish();
+        removeTargetFile(target);
+        throw Uptane::Exception("image", "Storing of a target was aborted");
+      }
+      const auto size =
+          static_cast<size_t>(std::min<uint64_t>(DownloadSink::kBufferSize, image->size - ds.downloaded_length));
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast, cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      if (!ds.sink->write(reinterpret_cast<const char*>(image->data + ds.downloaded_length), size)) {
+        break;
+      }
+      ds.downloaded_length += size;
+      ds.progress.report(target, progress_cb, ds.downloaded_length);
+    }
+    if (!ds.sink->finish()) {
+      throw Uptane::Exception("image", ds.sink->error());
+    }
+    ds.sink.reset();
+    if (!target.MatchHashes(ds.hasher().getHashes())) {
+      removeTargetFile(target);
+      throw Uptane::TargetHashMismatch(target.filename());
     }
+    result = true;
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Error while storing a target from " << bundle.path() << ": " << e.what();
   }
-  if (ds->token != nullptr && ds->token->hasAborted()) {
+  return result;
+}
+
+// Segments smaller than this are not worth an extra connection.
+static constexpr uint64_t kMinSegmentSize = 8U << 20U;
+// Progress of a segment is written to the storage each time this many bytes
+// have been downloaded for it.
+static constexpr uint64_t kSegmentSyncInterval = 4U << 20U;
+
+// State shared by all segments of a Target.
+struct SegmentedDownload {
+  SegmentedDownload(Uptane::Target target_in, FetcherProgressCb progress_cb_in, const api::FlowControlToken* token_in,
+                    std::shared_ptr<INvStorage> storage_in, int fd_in)
+      : target{std::move(target_in)},
+        token{token_in},
+        progress_cb{std::move(progress_cb_in)},
+        storage{std::move(storage_in)},
+        fd{fd_in} {}
+  Uptane::Target target;
+  const api::FlowControlToken* token;
+  FetcherProgressCb progress_cb;
+  std::shared_ptr<INvStorage> storage;
+  const int fd;
+  std::atomic<uintmax_t> downloaded_length{0};
+  // taken only when a report may be due
+  std::mutex progress_mutex;
+  DownloadProgress progress;
+};
+
+struct SegmentState {
+  SegmentState(SegmentedDownload* download_in, size_t index_in, DownloadSegment segment_in)
+      : download{download_in}, index{index_in}, segment{segment_in}, stored{segment_in.downloaded} {}
+  SegmentedDownload* download;
+  size_t index;
+  DownloadSegment segment;
+  // number of bytes of the segment that are recorded in the storage
+  uint64_t stored;
+};
+
+// Make the downloaded data of the segment durable, then record it in the
+// storage, so that a restart resumes from there.
+static void storeSegmentProgress(SegmentState& s) {
+  if (s.segment.downloaded == s.stored) {
+    return;
+  }
+  if (fdatasync(s.download->fd) != 0) {
+    LOG_WARNING << "Could not sync " << s.download->target.filename() << ": " << std::strerror(errno);
+    return;
+  }
+  try {
+    s.download->storage->updateDownloadSegment(s.download->target.filename(), s.index, s.segment.downloaded);
+    s.stored = s.segment.downloaded;
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not store download progress of " << s.download->target.filename() << ": " << e.what();
+  }
+}
+
+static size_t SegmentDownloadHandler(char* contents, size_t size, size_t nmemb, void* userp) {
+  assert(userp);
+  auto* s = static_cast<SegmentState*>(userp);
+  size_t downloaded = size * nmemb;
+  if ((s->segment.downloaded + downloaded) > s->segment.length) {
+    return downloaded + 1;  // curl will abort if return unexpected size;
+  }
+
+  size_t written = 0;
+  while (written < downloaded) {
+    const auto offset = static_cast<off_t>(s->segment.start + s->segment.downloaded + written);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const ssize_t res = pwrite(s->download->fd, contents + written, downloaded - written, offset);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR << "Could not write to " << s->download->target.filename() << ": " << std::strerror(errno);
+      return 0;
+    }
+    written += static_cast<size_t>(res);
+  }
+  s->segment.downloaded += downloaded;
+  s->download->downloaded_length += downloaded;
+  downloadedBytes().add(downloaded);
+
+  if (s->segment.isComplete() || s->segment.downloaded - s->stored >= kSegmentSyncInterval) {
+    storeSegmentProgress(*s);
+  }
+  return downloaded;
+}
+
+static int SegmentProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                  curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  auto* dl = static_cast<SegmentState*>(clientp)->download;
+
+  const uintmax_t downloaded = dl->downloaded_length;
+  if (dl->progress.due(dl->target, downloaded)) {
+    std::lock_guard<std::mutex> guard(dl->progress_mutex);
+    dl->progress.report(dl->target, dl->progress_cb, downloaded);
+  }
+  if (dl->token != nullptr && dl->token->hasAborted()) {
     return 1;
   }
   return 0;
 }
 
 static void restoreHasherState(MultiPartHasher& hasher, std::ifstream data) {
-  static constexpr size_t buf_len = 1024;
-  std::array<uint8_t, buf_len> buf{};
+  // as large as the buffers hashed while downloading: the hashers are called
+  // once per buffer and the reads bypass the stream buffer
+  std::vector<char> buf(DownloadSink::kBufferSize);
   do {
-    data.read(reinterpret_cast<char*>(buf.data()), buf.size());
-    hasher.update(buf.data(), static_cast<uint64_t>(data.gcount()));
+    data.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    hasher.update(reinterpret_cast<const unsigned char*>(buf.data()), static_cast<uint64_t>(data.gcount()));
   } while (data.gcount() != 0);
 }
 
+// Restore the hasher state from the last checkpoint of the Target file, if
+// any, and hash the rest of the file.
+static void restoreHasherState(MultiPartHasher& hasher, std::ifstream data, const INvStorage& storage,
+                               const Uptane::Target& target, uintmax_t file_size) {
+  uint64_t hashed_length = 0;
+  std::string state;
+  if (storage.loadTargetHashState(target.filename(), &hashed_length, &state)) {
+    if (hashed_length <= file_size && hasher.setState(state)) {
+      LOG_DEBUG << "Resuming hash of " << target.filename() << " from byte " << hashed_length;
+      data.seekg(static_cast<std::streamoff>(hashed_length));
+    } else {
+      LOG_WARNING << "Ignoring invalid hash state of " << target.filename();
+      hasher.reset();
+    }
+  }
+  restoreHasherState(hasher, std::move(data));
+}
+
+static boost::optional<VerifiedFile> statVerifiedFile(const std::string& path, const Uptane::Target& target) {
+  struct stat st {};
+  if (stat(path.c_str(), &st) != 0) {
+    LOG_WARNING << "Could not stat " << path << ": " << std::strerror(errno);
+    return boost::none;
+  }
+  VerifiedFile file;
+  file.size = static_cast<uint64_t>(st.st_size);
+  file.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  file.inode = st.st_ino;
+  file.hashes = Hash::encodeVector(target.hashes());
+  return file;
+}
+
 bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher,
                                           const KeyManager& keys, const FetcherProgressCb& progress_cb,
                                           const api::FlowControlToken* token) {
   (void)keys;
+  static auto& fetch_time = metrics::Registry::instance().histogram(
+      "aktualizr_image_fetch_seconds", "Time to fetch an image, including resumed and skipped downloads");
+  metrics::ScopedTimer timer(fetch_time);
   bool result = false;
   try {
     if (target.hashes().empty()) {
@@ -112,23 +400,52 @@ bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::
       LOG_INFO << "Image already downloaded; skipping download";
       return true;
     }
+    if (exists == TargetStatus::kNotFound && linkStoredTargetFile(target)) {
+      LOG_INFO << "Image already downloaded for another target; skipping download";
+      return true;
+    }
     std::unique_ptr<DownloadMetaStruct> ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
     if (target.length() == 0) {
       LOG_INFO << "Skipping download of target with length 0";
-      ds->fhandle = createTargetFile(target);
+      createTargetFile(target).close();
       return true;
     }
+
+    // a custom URI has no mirrors
+    std::vector<std::string> servers;
+    size_t server_index = 0;
+    std::string target_url = target.uri();
+    if (target_url.empty()) {
+      servers = fetcher.getRepoServers(target.length());
+      target_url = servers[0] + "/targets/" + Utils::urlEncode(target.filename());
+    }
+
+    std::vector<DownloadSegment> segments;
+    if (exists == TargetStatus::kIncomplete && storage_->loadDownloadSegments(target.filename(), &segments)) {
+      LOG_INFO << "Continuing incomplete download of file " << target.filename() << " in " << segments.size()
+               << " segments";
+      if (fetchTargetSegments(target, target_url, segments, progress_cb, token)) {
+        return true;
+      }
+      exists = TargetStatus::kNotFound;
+    } else if (exists != TargetStatus::kIncomplete &&
+               std::min<uint64_t>(config.download_segments, target.length() / kMinSegmentSize) > 1) {
+      LOG_DEBUG << "Initiating segmented download of file " << target.filename();
+      if (fetchTargetSegments(target, target_url, segments, progress_cb, token)) {
+        return true;
+      }
+    }
+
     if (exists == TargetStatus::kIncomplete) {
       LOG_INFO << "Continuing incomplete download of file " << target.filename();
       auto target_check = checkTargetFile(target);
       ds->downloaded_length = target_check->first;
-      ::restoreHasherState(ds->hasher(), openTargetFile(target));
-      ds->fhandle = appendTargetFile(target);
+      ::restoreHasherState(ds->hasher(), openTargetFile(target), *storage_, target, target_check->first);
     } else {
       // If the target was found, but is oversized or the hash doesn't match,
       // just start over.
       LOG_DEBUG << "Initiating download of file " << target.filename();
-      ds->fhandle = createTargetFile(target);
+      createTargetFile(target).close();
     }
 
     const uint64_t required_bytes = target.length() - ds->downloaded_length;
@@ -136,48 +453,88 @@ bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::
       throw std::runtime_error("Insufficient disk space available to download target");
     }
 
-    std::string target_url = target.uri();
-    if (target_url.empty()) {
-      target_url = fetcher.getRepoServer() + "/targets/" + Utils::urlEncode(target.filename());
-    }
+    const std::string path = checkTargetFile(target)->second;
+    auto startDownload = [&]() {
+      ds->storage = storage_.get();
+      ds->checkpointed_length = ds->downloaded_length;
+      ds->sink = std_::make_unique<DownloadSink>(path, ds->downloaded_length, ds->hasher(), config.download_direct_io);
+      ds->sink->reserve(target.length());
+    };
+    startDownload();
 
     HttpResponse response;
     for (;;) {
+      const uintmax_t attempt_start = ds->downloaded_length;
+      const auto attempt_time = std::chrono::steady_clock::now();
       response = http_->download(target_url, DownloadHandler, ProgressHandler, ds.get(),
                                  static_cast<curl_off_t>(ds->downloaded_length));
+      if (!servers.empty() && !response.wasInterrupted()) {
+        fetcher.recordRepoTransfer(
+            servers[server_index], response.isOk(), ds->downloaded_length - attempt_start,
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - attempt_time));
+      }
 
       if (response.curl_code == CURLE_RANGE_ERROR) {
         LOG_WARNING << "The image server doesn't support byte range requests,"
                        " try to download the image from the beginning: "
                     << target_url;
         ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
-        ds->fhandle = createTargetFile(target);
+        createTargetFile(target).close();
+        startDownload();
+        continue;
+      }
+
+      // the image is signed, the next mirror goes on from where this one
+      // stopped
+      if (!response.isOk() && !response.wasInterrupted() && response.curl_code != CURLE_WRITE_ERROR &&
+          server_index + 1 < servers.size()) {
+        LOG_WARNING << "Could not download " << target.filename() << " from " << servers[server_index] << ": "
+                    << response.getStatusStr() << ", trying " << servers[server_index + 1];
+        ++server_index;
+        target_url = servers[server_index] + "/targets/" + Utils::urlEncode(target.filename());
+        if (response.http_status_code >= 400) {
+          // what was written is an error page
+          ds->sink->finish();
+          ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
+          boost::filesystem::resize_file(path, attempt_start);
+          ds->downloaded_length = attempt_start;
+          ::restoreHasherState(ds->hasher(), openTargetFile(target), *storage_, target, attempt_start);
+        } else {
+          ds->sink->finish();
+          checkpointHasherState(*ds);
+        }
+        startDownload();
         continue;
       }
 
       if (!response.wasInterrupted()) {
         break;
       }
-      ds->fhandle.close();
+      ds->sink->finish();
+      checkpointHasherState(*ds);
       // sleep if paused or abort the download
       if (!token->canContinue()) {
         throw Uptane::Exception("image", "Download of a target was aborted");
       }
-      ds->fhandle = appendTargetFile(target);
     }
+    const bool written = ds->sink->finish();
+    // don't lose the progress of the hasher when the download stops here
+    checkpointHasherState(*ds);
     LOG_TRACE << "Download status: " << response.getStatusStr() << std::endl;
+    if (!written) {
+      throw Uptane::Exception("image", ds->sink->error());
+    }
     if (!response.isOk()) {
       if (response.curl_code == CURLE_WRITE_ERROR) {
         throw Uptane::OversizedTarget(target.filename());
       }
       throw Uptane::Exception("image", "Could not download file, error: " + response.error_message);
     }
-    if (!target.MatchHash(Hash(ds->hash_type, ds->hasher().getHexDigest()))) {
-      ds->fhandle.close();
+    ds->sink.reset();
+    if (!target.MatchHashes(ds->hasher().getHashes())) {
       removeTargetFile(target);
       throw Uptane::TargetHashMismatch(target.filename());
     }
-    ds->fhandle.close();
     result = true;
   } catch (const std::exception& e) {
     LOG_WARNING << "Error while downloading a target: " << e.what();
@@ -185,11 +542,35 @@ bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::
   return result;
 }
 
+std::unique_ptr<TargetStream> PackageManagerInterface::openTargetStream(const Uptane::Target& target,
+                                                                        const std::string& repo_server) const {
+  std::string target_url = target.uri();
+  if (target_url.empty()) {
+    target_url = repo_server + "/targets/" + Utils::urlEncode(target.filename());
+  }
+
+  std::string copy_path;
+  std::function<void()> on_copied;
+  if (config.secondary_cut_through_copy) {
+    const std::string filename = contentFilename(target);
+    boost::filesystem::create_directories(config.images_path);
+    copy_path = (config.images_path / filename).string();
+    on_copied = [storage = storage_, name = target.filename(), filename]() {
+      storage->storeTargetFilename(name, filename);
+    };
+  }
+  return std_::make_unique<TargetStream>(http_, target_url, target, copy_path, on_copied);
+}
+
 TargetStatus PackageManagerInterface::verifyTarget(const Uptane::Target& target) const {
   auto target_exists = checkTargetFile(target);
   if (!target_exists) {
     LOG_DEBUG << "File " << target.filename() << " with expected hash not found in the database.";
     return TargetStatus::kNotFound;
+  } else if (storage_->loadDownloadSegments(target.filename(), nullptr)) {
+    // the file is preallocated, its size says nothing about the progress
+    LOG_DEBUG << "File " << target.filename() << " was found in the database, but its segments are incomplete.";
+    return TargetStatus::kIncomplete;
   } else if (target_exists->first < target.length()) {
     LOG_DEBUG << "File " << target.filename() << " was found in the database, but is incomplete.";
     return TargetStatus::kIncomplete;
@@ -198,18 +579,168 @@ TargetStatus PackageManagerInterface::verifyTarget(const Uptane::Target& target)
     return TargetStatus::kOversized;
   }
 
+  // Skip hashing if the file hasn't changed since it was last verified
+  // against the same hashes.
+  const std::string filename = boost::filesystem::path(target_exists->second).filename().string();
+  boost::optional<VerifiedFile> current = statVerifiedFile(target_exists->second, target);
+  VerifiedFile cached;
+  const bool have_cached = storage_->loadVerifiedFile(filename, &cached);
+  if (current && have_cached && cached == *current) {
+    LOG_TRACE << "File " << target.filename() << " is unchanged since it was verified";
+    return TargetStatus::kGood;
+  }
+
   // Even if the file exists and the length matches, recheck the hash.
   DownloadMetaStruct ds(target, nullptr, nullptr);
   ds.downloaded_length = target_exists->first;
-  ::restoreHasherState(ds.hasher(), openTargetFile(target));
-  if (!target.MatchHash(Hash(ds.hash_type, ds.hasher().getHexDigest()))) {
+  std::vector<Hash> hashes;
+  {
+    static auto& hash_time =
+        metrics::Registry::instance().histogram("aktualizr_image_hash_seconds", "Time to hash a stored image");
+    metrics::ScopedTimer timer(hash_time);
+    if (have_cached && current &&
+        (cached.size != current->size || cached.mtime_ns != current->mtime_ns || cached.inode != current->inode)) {
+      // the file was modified since the last verification, the hasher
+      // checkpoint may not describe its content anymore
+      ::restoreHasherState(ds.hasher(), openTargetFile(target));
+    } else {
+      ::restoreHasherState(ds.hasher(), openTargetFile(target), *storage_, target, target_exists->first);
+    }
+    hashes = ds.hasher().getHashes();
+  }
+  if (!target.MatchHashes(hashes)) {
     LOG_ERROR << "Target exists with expected length, but hash does not match metadata! " << target;
     return TargetStatus::kHashMismatch;
   }
 
+  if (current) {
+    try {
+      storage_->storeVerifiedFile(filename, *current);
+    } catch (const std::exception& e) {
+      LOG_WARNING << "Could not store verification result of " << target.filename() << ": " << e.what();
+    }
+  }
   return TargetStatus::kGood;
 }
 
+bool PackageManagerInterface::fetchTargetSegments(const Uptane::Target& target, const std::string& target_url,
+                                                  std::vector<DownloadSegment> segments,
+                                                  const FetcherProgressCb& progress_cb,
+                                                  const api::FlowControlToken* token) {
+  if (!segments.empty()) {
+    auto file = checkTargetFile(target);
+    if (!file || file->first != target.length()) {
+      LOG_WARNING << "File " << target.filename() << " doesn't match its download segments, starting over";
+      segments.clear();
+    }
+  }
+
+  if (segments.empty()) {
+    if (!checkAvailableDiskSpace(target.length())) {
+      throw std::runtime_error("Insufficient disk space available to download target");
+    }
+    createTargetFile(target).close();
+  }
+
+  const std::string path = checkTargetFile(target)->second;
+  const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Can't open file " + path + ": " + std::strerror(errno));
+  }
+  std::shared_ptr<void> fd_closer(nullptr, [fd](void*) { close(fd); });
+
+  if (segments.empty()) {
+    // reserve the space up front, so that the download can't fail half-way
+    // for lack of disk space
+    const int res = posix_fallocate(fd, 0, static_cast<off_t>(target.length()));
+    if (res != 0) {
+      throw std::runtime_error("Can't allocate " + std::to_string(target.length()) + " bytes for " + path + ": " +
+                               std::strerror(res));
+    }
+    const uint64_t count = std::min<uint64_t>(config.download_segments, target.length() / kMinSegmentSize);
+    const uint64_t segment_length = target.length() / count;
+    for (uint64_t i = 0; i < count; i++) {
+      const uint64_t start = i * segment_length;
+      segments.emplace_back(start, (i == count - 1) ? target.length() - start : segment_length);
+    }
+    storage_->storeDownloadSegments(target.filename(), segments);
+  }
+
+  SegmentedDownload download(target, progress_cb, token, storage_, fd);
+  std::vector<SegmentState> states;
+  states.reserve(segments.size());
+  for (size_t i = 0; i < segments.size(); i++) {
+    states.emplace_back(&download, i, segments[i]);
+    download.downloaded_length += segments[i].downloaded;
+  }
+
+  for (;;) {
+    std::vector<std::pair<SegmentState*, std::future<HttpResponse>>> transfers;
+    for (auto& state : states) {
+      if (state.segment.isComplete()) {
+        continue;
+      }
+      const auto from = static_cast<curl_off_t>(state.segment.start + state.segment.downloaded);
+      const auto to = static_cast<curl_off_t>(state.segment.start + state.segment.length - 1);
+      transfers.emplace_back(&state, http_->downloadRangeAsync(target_url, SegmentDownloadHandler,
+                                                               SegmentProgressHandler, &state, from, to, nullptr));
+    }
+    if (transfers.empty()) {
+      break;
+    }
+
+    // wait for all of them before acting on failures: they all write to `states`
+    bool interrupted = false;
+    bool ranges_supported = true;
+    std::string error;
+    for (auto& transfer : transfers) {
+      const HttpResponse response = transfer.second.get();
+      SegmentState& state = *transfer.first;
+      storeSegmentProgress(state);
+      LOG_TRACE << "Download status of segment " << state.index << ": " << response.getStatusStr();
+      if (response.wasInterrupted()) {
+        interrupted = true;
+      } else if (response.http_status_code == 200) {
+        ranges_supported = false;
+      } else if (!response.isOk()) {
+        error = response.error_message.empty() ? response.getStatusStr() : response.error_message;
+      } else if (!state.segment.isComplete()) {
+        error = "segment " + std::to_string(state.index) + " is incomplete";
+      }
+    }
+
+    if (!ranges_supported) {
+      LOG_WARNING << "The image server doesn't support byte range requests,"
+                     " download the image in one piece: "
+                  << target_url;
+      storage_->clearDownloadSegments(target.filename());
+      return false;
+    }
+    if (!error.empty()) {
+      throw Uptane::Exception("image", "Could not download file, error: " + error);
+    }
+    // sleep if paused or abort the download
+    if (interrupted && !token->canContinue()) {
+      throw Uptane::Exception("image", "Download of a target was aborted");
+    }
+  }
+
+  DownloadMetaStruct ds(target, nullptr, nullptr);
+  ::restoreHasherState(ds.hasher(), openTargetFile(target));
+  const std::string hash_state = ds.hasher().getState();
+  if (!target.MatchHashes(ds.hasher().getHashes())) {
+    removeTargetFile(target);
+    throw Uptane::TargetHashMismatch(target.filename());
+  }
+  storage_->storeTargetHashState(target.filename(), target.length(), hash_state);
+  storage_->clearDownloadSegments(target.filename());
+  return true;
+}
+
+Hash PackageManagerInterface::getInstalledPackagesHash() const {
+  return Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(getInstalledPackages()));
+}
+
 bool PackageManagerInterface::checkAvailableDiskSpace(const uint64_t required_bytes) const {
   struct statvfs stvfsbuf {};
   const int stat_res = statvfs(config.images_path.c_str(), &stvfsbuf);
@@ -253,8 +784,100 @@ std::ifstream PackageManagerInterface::openTargetFile(const Uptane::Target& targ
   return stream;
 }
 
+TargetFileView PackageManagerInterface::openTargetFileView(const Uptane::Target& target) const {
+  auto file = checkTargetFile(target);
+  if (!file) {
+    throw std::runtime_error("File doesn't exist for target " + target.filename());
+  }
+  return TargetFileView(file->second);
+}
+
+TargetFileView::TargetFileView(const std::string& path) {
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::runtime_error("Can't open file " + path + ": " + std::strerror(errno));
+  }
+  struct stat st {};
+  if (fstat(fd_, &st) != 0) {
+    const std::string error = std::strerror(errno);
+    ::close(fd_);
+    throw std::runtime_error("Can't get the size of " + path + ": " + error);
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ == 0) {
+    // empty files can't be mapped
+    return;
+  }
+  data_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (data_ == MAP_FAILED) {  // NOLINT(cppcoreguidelines-pro-type-cstyle-cast)
+    const std::string error = std::strerror(errno);
+    data_ = nullptr;
+    ::close(fd_);
+    throw std::runtime_error("Can't map file " + path + ": " + error);
+  }
+  // the views are read from start to end, the pages can be read ahead
+  madvise(data_, size_, MADV_SEQUENTIAL);
+}
+
+TargetFileView::~TargetFileView() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+TargetFileView::TargetFileView(TargetFileView&& other) noexcept
+    : fd_(other.fd_), data_(other.data_), size_(other.size_) {
+  other.fd_ = -1;
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+TargetFileView& TargetFileView::operator=(TargetFileView&& other) noexcept {
+  std::swap(fd_, other.fd_);
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  return *this;
+}
+
+std::string PackageManagerInterface::contentFilename(const Uptane::Target& target) {
+  // prefer the same hash type for all the Targets, whatever the order of
+  // their hashes in the metadata
+  const auto& hashes = target.hashes();
+  const auto sha256 = std::find_if(hashes.cbegin(), hashes.cend(),
+                                   [](const Hash& hash) { return hash.type() == Hash::Type::kSha256; });
+  return (sha256 != hashes.cend()) ? sha256->HashString() : hashes.at(0).HashString();
+}
+
+bool PackageManagerInterface::linkStoredTargetFile(const Uptane::Target& target) {
+  for (const auto& hash : target.hashes()) {
+    const std::string filename = hash.HashString();
+    const auto path = config.images_path / filename;
+    boost::system::error_code ec;
+    if (boost::filesystem::file_size(path, ec) != target.length() || ec) {
+      continue;
+    }
+    // skip files still being downloaded for another Target
+    const auto names = storage_->getTargetNamesForFile(filename);
+    if (names.empty() || std::any_of(names.cbegin(), names.cend(), [this](const std::string& name) {
+          return storage_->loadDownloadSegments(name, nullptr);
+        })) {
+      continue;
+    }
+    storage_->linkTargetFilename(target.filename(), filename);
+    if (verifyTarget(target) == TargetStatus::kGood) {
+      LOG_DEBUG << "File " << target.filename() << " shares its content with " << names.front();
+      return true;
+    }
+    storage_->deleteTargetInfo(target.filename());
+  }
+  return false;
+}
+
 std::ofstream PackageManagerInterface::createTargetFile(const Uptane::Target& target) {
-  std::string filename = target.hashes()[0].HashString();
+  std::string filename = contentFilename(target);
   std::string filepath = (config.images_path / filename).string();
   boost::filesystem::create_directories(config.images_path);
   std::ofstream stream(filepath, std::ios::binary | std::ios::ate);
@@ -282,8 +905,11 @@ void PackageManagerInterface::removeTargetFile(const Uptane::Target& target) {
   if (!file) {
     throw std::runtime_error("File doesn't exist for target " + target.filename());
   }
-  boost::filesystem::remove(file->second);
+  const std::string filename = boost::filesystem::path(file->second).filename().string();
   storage_->deleteTargetInfo(target.filename());
+  if (storage_->getTargetNamesForFile(filename).empty()) {
+    boost::filesystem::remove(file->second);
+  }
 }
 
 std::vector<Uptane::Target> PackageManagerInterface::getTargetFiles() {
@@ -295,3 +921,23 @@ std::vector<Uptane::Target> PackageManagerInterface::getTargetFiles() {
   }
   return v;
 }
+
+void PackageManagerInterface::removeUnreferencedTargetFiles() {
+  boost::system::error_code ec;
+  if (!boost::filesystem::is_directory(config.images_path, ec)) {
+    return;
+  }
+  for (const auto& entry : boost::filesystem::directory_iterator(config.images_path, ec)) {
+    if (!boost::filesystem::is_regular_file(entry.status())) {
+      continue;
+    }
+    const std::string filename = entry.path().filename().string();
+    if (storage_->getTargetNamesForFile(filename).empty()) {
+      LOG_INFO << "Removing unreferenced image " << filename;
+      boost::filesystem::remove(entry.path(), ec);
+      if (ec) {
+        LOG_WARNING << "Could not remove " << entry.path() << ": " << ec.message();
+      }
+    }
+  }
+}
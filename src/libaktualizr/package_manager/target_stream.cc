@@ -0,0 +1,191 @@
+#include "target_stream.h"
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstring>
+
+#include "crypto/crypto.h"
+#include "http/httpinterface.h"
+#include "logging/logging.h"
+#include "utilities/thread_policy.h"
+
+// Small pieces, as curl may hand them over, are gathered up to this size to
+// keep the queue short.
+static constexpr size_t kPieceSize = 64U << 10U;
+
+TargetStream::TargetStream(std::shared_ptr<HttpInterface> http, std::string url, Uptane::Target target,
+                           std::string copy_path, std::function<void()> on_copied)
+    : http_(std::move(http)),
+      url_(std::move(url)),
+      target_(std::move(target)),
+      copy_path_(std::move(copy_path)),
+      on_copied_(std::move(on_copied)),
+      hasher_(MultiPartHasher::create(target_.hashes())) {
+  thread_ = std::thread(&TargetStream::run, this);
+}
+
+TargetStream::~TargetStream() {
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    cancelled_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+size_t TargetStream::read(uint8_t *data, size_t size) {
+  size_t copied = 0;
+  std::unique_lock<std::mutex> lock(m_);
+  while (copied < size) {
+    cv_.wait(lock, [this]() { return queued_ > 0 || done_; });
+    if (queued_ == 0) {
+      break;
+    }
+    const std::string &front = queue_.front();
+    const size_t n = std::min(size - copied, front.size() - front_offset_);
+    std::memcpy(data + copied, front.data() + front_offset_, n);
+    copied += n;
+    front_offset_ += n;
+    queued_ -= n;
+    if (front_offset_ == front.size()) {
+      queue_.pop_front();
+      front_offset_ = 0;
+    }
+    // room for the download
+    cv_.notify_all();
+  }
+  return copied;
+}
+
+bool TargetStream::ok() const {
+  std::lock_guard<std::mutex> guard(m_);
+  return done_ && error_.empty();
+}
+
+std::string TargetStream::error() const {
+  std::lock_guard<std::mutex> guard(m_);
+  return error_;
+}
+
+size_t TargetStream::writeCallback(char *contents, size_t size, size_t nmemb, void *userp) {
+  auto *stream = static_cast<TargetStream *>(userp);
+  const size_t length = size * nmemb;
+  // returning anything but the length makes curl abort the transfer
+  if (stream->received_ + length > stream->target_.length()) {
+    stream->received_ += length;
+    return 0;
+  }
+  if (!stream->push(contents, length)) {
+    return 0;
+  }
+  return length;
+}
+
+int TargetStream::progressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                   curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  auto *stream = static_cast<TargetStream *>(clientp);
+  std::lock_guard<std::mutex> guard(stream->m_);
+  return stream->cancelled_ ? 1 : 0;
+}
+
+bool TargetStream::push(const char *data, size_t size) {
+  {
+    std::unique_lock<std::mutex> lock(m_);
+    // a piece larger than the whole queue still goes through once it is empty
+    cv_.wait(lock, [this, size]() { return cancelled_ || queued_ + size <= kQueueSize || queued_ == 0; });
+    if (cancelled_) {
+      return false;
+    }
+  }
+
+  hasher_->update(reinterpret_cast<const unsigned char *>(data), size);
+  if (copy_.is_open()) {
+    copy_.write(data, static_cast<std::streamsize>(size));
+    if (!copy_.good()) {
+      LOG_WARNING << "Could not write the copy of " << target_.filename() << ", the image is only streamed";
+      copy_.close();
+      boost::system::error_code ec;
+      boost::filesystem::remove(copy_path_ + ".part", ec);
+    }
+  }
+  received_ += size;
+
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    // the first piece may be being read, but appending keeps its offset valid
+    if (!queue_.empty() && queue_.back().size() + size <= kPieceSize) {
+      queue_.back().append(data, size);
+    } else {
+      queue_.emplace_back(data, size);
+    }
+    queued_ += size;
+  }
+  cv_.notify_all();
+  return true;
+}
+
+void TargetStream::run() {
+  ThreadPolicies::instance().apply(ThreadPolicies::Worker::kDownload);
+  if (hasher_ == nullptr) {
+    finish("Unknown hash algorithm for " + target_.filename());
+    return;
+  }
+
+  const std::string part_path = copy_path_.empty() ? std::string() : copy_path_ + ".part";
+  if (!part_path.empty()) {
+    copy_.open(part_path, std::ios::binary | std::ios::trunc);
+    if (!copy_.good()) {
+      LOG_WARNING << "Could not write the copy of " << target_.filename() << " to " << part_path;
+      copy_.close();
+    }
+  }
+
+  std::string error;
+  try {
+    const HttpResponse response = http_->download(url_, writeCallback, progressCallback, this, 0);
+    if (received_ > target_.length()) {
+      error = "Target " + target_.filename() + " is larger than expected";
+    } else if (!response.isOk()) {
+      error = "Could not download " + target_.filename() + ": " + response.getStatusStr();
+    } else if (received_ != target_.length()) {
+      error = "Target " + target_.filename() + " is incomplete";
+    } else if (!target_.MatchHashes(hasher_->getHashes())) {
+      error = "Target " + target_.filename() + " does not match its hashes";
+    }
+  } catch (const std::exception &e) {
+    error = "Could not download " + target_.filename() + ": " + e.what();
+  }
+
+  if (copy_.is_open()) {
+    copy_.close();
+    boost::system::error_code ec;
+    if (error.empty() && !copy_.fail()) {
+      boost::filesystem::rename(part_path, copy_path_, ec);
+      if (!ec) {
+        if (on_copied_) {
+          on_copied_();
+        }
+      } else {
+        LOG_WARNING << "Could not store the copy of " << target_.filename() << ": " << ec.message();
+      }
+    }
+    boost::filesystem::remove(part_path, ec);
+  }
+  finish(error);
+}
+
+void TargetStream::finish(const std::string &error) {
+  if (!error.empty()) {
+    LOG_ERROR << error;
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_);
+    done_ = true;
+    error_ = error;
+  }
+  cv_.notify_all();
+}
@@ -0,0 +1,85 @@
+#ifndef TARGET_STREAM_H_
+#define TARGET_STREAM_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <curl/curl.h>
+
+#include "libaktualizr/types.h"
+
+class HttpInterface;
+class MultiPartHasher;
+
+/**
+ * Download of a Target image that is read while it arrives, so that it can be
+ * forwarded to a Secondary without being stored first (cut-through).
+ *
+ * The download runs on a thread of its own and hashes the data as it arrives.
+ * The data waits in a bounded queue until it is read: the download blocks
+ * while the queue is full, so that a slow Secondary slows the download down
+ * instead of filling the memory. With a copy path, the image is also written
+ * there, under a temporary name until it is complete and matches its hashes.
+ */
+class TargetStream {
+ public:
+  TargetStream(std::shared_ptr<HttpInterface> http, std::string url, Uptane::Target target, std::string copy_path,
+               std::function<void()> on_copied);
+  ~TargetStream();
+  TargetStream(const TargetStream &) = delete;
+  TargetStream(TargetStream &&) = delete;
+  TargetStream &operator=(const TargetStream &) = delete;
+  TargetStream &operator=(TargetStream &&) = delete;
+
+  /**
+   * Read the next bytes of the image, waiting for them to arrive.
+   * @return The number of bytes read, less than `size` only at the end of the
+   *         download, whether it succeeded or not.
+   */
+  size_t read(uint8_t *data, size_t size);
+  /**
+   * Whether the whole image arrived and matches its hashes. Only meaningful
+   * once read() has returned less than asked for.
+   */
+  bool ok() const;
+  std::string error() const;
+
+  static constexpr size_t kQueueSize = 4U << 20U;
+
+ private:
+  static size_t writeCallback(char *contents, size_t size, size_t nmemb, void *userp);
+  static int progressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                              curl_off_t ulnow);
+  bool push(const char *data, size_t size);
+  void run();
+  void finish(const std::string &error);
+
+  std::shared_ptr<HttpInterface> http_;
+  const std::string url_;
+  const Uptane::Target target_;
+  const std::string copy_path_;
+  const std::function<void()> on_copied_;
+  std::shared_ptr<MultiPartHasher> hasher_;
+  std::ofstream copy_;
+  uint64_t received_{0};
+
+  std::deque<std::string> queue_;
+  size_t queued_{0};
+  // read offset in the first queued piece
+  size_t front_offset_{0};
+  bool done_{false};
+  bool cancelled_{false};
+  std::string error_;
+  mutable std::mutex m_;
+  std::condition_variable cv_;
+  std::thread thread_;
+};
+
+#endif  // TARGET_STREAM_H_
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "httpfake.h"
+#include "package_manager/target_stream.h"
+#include "utilities/utils.h"
+
+static std::string testData(size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    data[i] = static_cast<char>((i * 7 + i / 4096) % 251);
+  }
+  return data;
+}
+
+static Uptane::Target testTarget(const std::string& data) {
+  return Uptane::Target("image.bin", Uptane::EcuMap{}, {Hash::generate(Hash::Type::kSha256, data)},
+                        static_cast<uint64_t>(data.size()));
+}
+
+// Read the stream in uneven pieces until it ends.
+static std::string readAll(TargetStream& stream) {
+  std::string res;
+  std::vector<uint8_t> buf(70001);
+  size_t piece = 1000;
+  while (true) {
+    const size_t n = stream.read(buf.data(), piece);
+    res.append(reinterpret_cast<const char*>(buf.data()), n);
+    if (n < piece) {
+      return res;
+    }
+    piece = piece * 3 % buf.size() + 1;
+  }
+}
+
+class TargetStreamTest : public ::testing::Test {
+ protected:
+  TargetStreamTest() : http(std::make_shared<HttpFake>(temp_dir.Path(), "", temp_dir.Path() / "repo")) {
+    boost::filesystem::create_directories(temp_dir.Path() / "repo/targets");
+    Utils::writeFile(temp_dir.Path() / "repo/targets/image.bin", data);
+  }
+
+  std::string url() const { return http->tls_server + "/targets/image.bin"; }
+
+  const std::string data{testData(300000)};
+  TemporaryDirectory temp_dir;
+  std::shared_ptr<HttpFake> http;
+};
+
+/* The image is read as it arrives and checked against its hashes. */
+TEST_F(TargetStreamTest, Read) {
+  TargetStream stream(http, url(), testTarget(data), "", nullptr);
+  EXPECT_EQ(readAll(stream), data);
+  EXPECT_TRUE(stream.ok());
+  EXPECT_TRUE(stream.error().empty());
+}
+
+/* An image that doesn't match its hashes is read to the end, but fails. */
+TEST_F(TargetStreamTest, HashMismatch) {
+  std::string other = data;
+  other[1000] = static_cast<char>(other[1000] + 1);
+  TargetStream stream(http, url(), testTarget(other), "", nullptr);
+  EXPECT_EQ(readAll(stream).size(), data.size());
+  EXPECT_FALSE(stream.ok());
+  EXPECT_FALSE(stream.error().empty());
+}
+
+/* An image larger than expected fails. */
+TEST_F(TargetStreamTest, Oversized) {
+  TargetStream stream(http, url(), testTarget(data.substr(0, 1000)), "", nullptr);
+  EXPECT_LE(readAll(stream).size(), 1000);
+  EXPECT_FALSE(stream.ok());
+}
+
+/* The copy is stored once the image is complete and verified, and only
+ * then. */
+TEST_F(TargetStreamTest, Copy) {
+  const std::string copy_path = (temp_dir.Path() / "copy").string();
+  bool copied = false;
+  {
+    TargetStream stream(http, url(), testTarget(data), copy_path, [&copied]() { copied = true; });
+    EXPECT_EQ(readAll(stream), data);
+    EXPECT_TRUE(stream.ok());
+  }
+  EXPECT_TRUE(copied);
+  EXPECT_EQ(Utils::readFile(copy_path), data);
+  EXPECT_FALSE(boost::filesystem::exists(copy_path + ".part"));
+
+  boost::filesystem::remove(copy_path);
+  copied = false;
+  std::string other = data;
+  other[0] = static_cast<char>(other[0] + 1);
+  {
+    TargetStream stream(http, url(), testTarget(other), copy_path, [&copied]() { copied = true; });
+    readAll(stream);
+    EXPECT_FALSE(stream.ok());
+  }
+  EXPECT_FALSE(copied);
+  EXPECT_FALSE(boost::filesystem::exists(copy_path));
+  EXPECT_FALSE(boost::filesystem::exists(copy_path + ".part"));
+}
+
+/* Dropping the stream before the end of the download aborts it. */
+TEST_F(TargetStreamTest, Cancel) {
+  TargetStream stream(http, url(), testTarget(data), "", nullptr);
+  std::vector<uint8_t> buf(1000);
+  EXPECT_EQ(stream.read(buf.data(), buf.size()), buf.size());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -5,37 +5,154 @@
 
 #include "libaktualizr/aktualizr.h"
 #include "libaktualizr/events.h"
+#include "crypto/cryptoprovider.h"
+#include "http/httpclient.h"
+#include "http/httpinterface.h"
+#include "http/httprecorder.h"
+#include "http/notification_listener.h"
+#include "primary/event_dispatcher.h"
+#include "primary/polling_schedule.h"
 #include "primary/sotauptaneclient.h"
 #include "utilities/apiqueue.h"
+#include "utilities/memory_budget.h"
+#include "utilities/metrics.h"
+#include "utilities/thread_policy.h"
 #include "utilities/timer.h"
+#include "utilities/tracing.h"
 
 using std::shared_ptr;
 
+namespace {
+// Waits for the events sent by a call to be delivered when it returns, so
+// that they are by the time its future is ready
+class EventsDelivered {
+ public:
+  explicit EventsDelivered(EventDispatcher &events) : events_(events) {}
+  ~EventsDelivered() { events_.flush(); }
+  EventsDelivered(const EventsDelivered &) = delete;
+  EventsDelivered(EventsDelivered &&) = delete;
+  EventsDelivered &operator=(const EventsDelivered &) = delete;
+  EventsDelivered &operator=(EventsDelivered &&) = delete;
+
+ private:
+  EventDispatcher &events_;
+};
+
+// Traces what happens while it exists and writes the trace to a file
+class CycleTrace {
+ public:
+  explicit CycleTrace(boost::filesystem::path path) : path_(std::move(path)) { tracing::Tracer::instance().start(); }
+  ~CycleTrace() {
+    try {
+      Utils::writeFile(path_, tracing::Tracer::instance().stop());
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Could not write the trace to " << path_ << ": " << e.what();
+    }
+  }
+  CycleTrace(const CycleTrace &) = delete;
+  CycleTrace(CycleTrace &&) = delete;
+  CycleTrace &operator=(const CycleTrace &) = delete;
+  CycleTrace &operator=(CycleTrace &&) = delete;
+
+ private:
+  boost::filesystem::path path_;
+};
+}  // namespace
+
 Aktualizr::Aktualizr(const Config &config)
     : Aktualizr(config, INvStorage::newStorage(config.storage), std::make_shared<HttpClient>()) {}
 
 Aktualizr::Aktualizr(Config config, std::shared_ptr<INvStorage> storage_in,
                      const std::shared_ptr<HttpInterface> &http_in)
-    : config_{std::move(config)}, sig_{new event::Channel()}, api_queue_{new api::CommandQueue()} {
+    : config_{std::move(config)}, sig_{new event::Channel()}, api_queue_{new api::CommandQueue()}, http_{http_in} {
+  if (!config_.metrics.http_recording_path.empty()) {
+    http_ = std::make_shared<HttpRecorder>(http_in, config_.metrics.http_recording_path);
+  }
   if (sodium_init() == -1) {  // Note that sodium_init doesn't require a matching 'sodium_deinit'
     throw std::runtime_error("Unable to initialize libsodium");
   }
+  CryptoProviderFactory::select(config_.crypto.provider);
+  MemoryBudget::instance().setLimit(config_.memory.budget);
+  // before the threads they apply to start
+  auto &policies = ThreadPolicies::instance();
+  policies.set(ThreadPolicies::Worker::kDownload, ThreadPolicy::parse(config_.scheduling.download));
+  policies.set(ThreadPolicies::Worker::kHasher, ThreadPolicy::parse(config_.scheduling.hasher));
+  policies.set(ThreadPolicies::Worker::kCommands, ThreadPolicy::parse(config_.scheduling.commands));
+  policies.set(ThreadPolicies::Worker::kSecondaries, ThreadPolicy::parse(config_.scheduling.secondaries));
 
   storage_ = std::move(storage_in);
   storage_->importData(config_.import);
 
-  uptane_client_ = std::make_shared<SotaUptaneClient>(config_, storage_, http_in, sig_, api_queue_->FlowControlToken());
+  events_ = std::make_shared<EventDispatcher>(sig_);
+  // the slot keeps the dispatcher for as long as the client may send events
+  auto client_events = std::make_shared<event::Channel>();
+  client_events->connect(
+      [events = events_](std::shared_ptr<event::BaseEvent> event) { events->post(std::move(event)); });
+  uptane_client_ =
+      std::make_shared<SotaUptaneClient>(config_, storage_, http_, client_events, api_queue_->FlowControlToken());
+
+  if (!config_.metrics.path.empty()) {
+    metrics_exporter_ = std_::make_unique<metrics::FileExporter>(
+        config_.metrics.path, std::chrono::seconds(config_.metrics.interval));
+  }
 }
 
-Aktualizr::~Aktualizr() { api_queue_.reset(nullptr); }
+Aktualizr::~Aktualizr() {
+  api_queue_.reset(nullptr);
+  // last write, after the queued commands are done
+  metrics_exporter_.reset();
+}
 
 void Aktualizr::Initialize() {
-  uptane_client_->initialize();
+  const auto start = std::chrono::steady_clock::now();
+  if (config_.uptane.deferred_initialization) {
+    uptane_client_->initializeLocal();
+    uptane_client_->prefetchHardwareInfo();
+    // the first command, which every other one waits for
+    api_queue_->enqueue([this] {
+      EventsDelivered delivered(*events_);
+      try {
+        uptane_client_->finishInitialization();
+      } catch (const std::exception &e) {
+        // nobody waits for this command
+        LOG_ERROR << "Initialization failed: " << e.what();
+      }
+    });
+  } else {
+    EventsDelivered delivered(*events_);
+    uptane_client_->initialize();
+  }
+  // after the initialization, which finalizes a pending update
+  api_queue_->enqueue(
+      [this] {
+        EventsDelivered delivered(*events_);
+        uptane_client_->pruneAfterFinalize();
+      },
+      api::Lane::kDownload);
   api_queue_->run();
+
+  const auto elapsed =
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  metrics::Registry::instance()
+      .histogram("aktualizr_startup_seconds", "Time taken by the phases of the startup", {{"phase", "initialize"}})
+      .record(static_cast<uint64_t>(elapsed));
+  LOG_INFO << "Initialized in " << elapsed / 1000 << " ms";
 }
 
+void Aktualizr::TraceNextCycle() { trace_next_cycle_ = true; }
+
 bool Aktualizr::UptaneCycle() {
+  const uint64_t cycle = cycles_++;
+  const uint64_t sample = config_.metrics.trace_sample;
+  std::unique_ptr<CycleTrace> trace;
+  const bool traced = trace_next_cycle_.exchange(false) || (sample != 0 && cycle % sample == 0);
+  if (traced && !config_.metrics.trace_path.empty()) {
+    trace = std_::make_unique<CycleTrace>(config_.metrics.trace_path);
+  }
+  tracing::Span span("UptaneCycle");
+
   result::UpdateCheck update_result = CheckUpdates().get();
+  updates_found_ = !update_result.updates.empty();
   if (update_result.updates.empty()) {
     if (update_result.status == result::UpdateStatus::kError) {
       // If the metadata verification failed, inform the backend immediately.
@@ -44,16 +161,33 @@ bool Aktualizr::UptaneCycle() {
     return true;
   }
 
-  result::Download download_result = Download(update_result.updates).get();
-  if (download_result.status != result::DownloadStatus::kSuccess || download_result.updates.empty()) {
-    if (download_result.status != result::DownloadStatus::kNothingToDownload) {
-      // If the download failed, inform the backend immediately.
+  if (config_.uptane.pipeline_installs) {
+    // Each ECU installs as soon as its image is there, so a failed download
+    // doesn't hold back the others.
+    auto task = [this, updates = std::move(update_result.updates)] {
+      EventsDelivered delivered(*events_);
+      return uptane_client_->downloadAndInstall(updates);
+    };
+    const auto res = api_queue_->enqueue(std::move(task), api::Lane::kInstall).get();
+    if (res.first.status == result::DownloadStatus::kNothingToDownload) {
+      return true;
+    }
+    if (res.second.ecu_reports.empty()) {
       SendManifest().get();
+      return true;
+    }
+  } else {
+    result::Download download_result = Download(update_result.updates).get();
+    if (download_result.status != result::DownloadStatus::kSuccess || download_result.updates.empty()) {
+      if (download_result.status != result::DownloadStatus::kNothingToDownload) {
+        // If the download failed, inform the backend immediately.
+        SendManifest().get();
+      }
+      return true;
     }
-    return true;
-  }
 
-  Install(download_result.updates).get();
+    Install(download_result.updates).get();
+  }
 
   if (uptane_client_->isInstallCompletionRequired()) {
     // If there are some pending updates then effectively either reboot (OSTree) or aktualizr restart (fake pack mngr)
@@ -73,8 +207,11 @@ bool Aktualizr::UptaneCycle() {
 
 std::future<void> Aktualizr::RunForever() {
   std::future<void> future = std::async(std::launch::async, [this]() {
+    // stopped after `l` is released, as it notifies under exit_cond_.m
+    std::unique_ptr<NotificationListener> notifications;
     std::unique_lock<std::mutex> l(exit_cond_.m);
     bool have_sent_device_data = false;
+    PollingSchedule schedule(config_.uptane);
     while (true) {
       try {
         if (!have_sent_device_data) {
@@ -82,24 +219,62 @@ std::future<void> Aktualizr::RunForever() {
           SendDeviceData().get();
           have_sent_device_data = true;
         }
+        // once provisioned, as the server authenticates the device
+        if (notifications == nullptr && !config_.uptane.notification_url.empty()) {
+          notifications = listenToNotifications();
+        }
 
         if (!UptaneCycle()) {
           break;
         }
+        const uint64_t maintenance_interval = config_.storage.maintenance_interval_sec;
+        if (!updates_found_ && maintenance_interval != 0 && std::chrono::steady_clock::now() >= next_maintenance_) {
+          next_maintenance_ = std::chrono::steady_clock::now() + std::chrono::seconds(maintenance_interval);
+          MaintainStorage();
+        }
       } catch (SotaUptaneClient::ProvisioningFailed &e) {
         LOG_DEBUG << "Not provisioned yet:" << e.what();
       }
 
-      if (exit_cond_.cv.wait_for(l, std::chrono::seconds(config_.uptane.polling_sec),
-                                 [this] { return exit_cond_.flag; })) {
-        break;
+      const auto server_wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+          http_->retryAfter() - std::chrono::steady_clock::now());
+      const std::chrono::milliseconds interval = schedule.next(updates_found_, campaigns_active_, server_wait);
+      LOG_DEBUG << "Polling again in " << interval.count() << " ms";
+      events_->post(std::make_shared<event::PollScheduled>(interval));
+      if (exit_cond_.cv.wait_for(l, interval, [this] { return exit_cond_.flag || exit_cond_.notified; })) {
+        if (exit_cond_.flag) {
+          break;
+        }
+        LOG_DEBUG << "Polling right away after a notification";
       }
+      exit_cond_.notified = false;
     }
     uptane_client_->completeInstall();
   });
   return future;
 }
 
+std::unique_ptr<NotificationListener> Aktualizr::listenToNotifications() {
+  // a client of its own, as the answers take much longer than the usual timeout
+  std::shared_ptr<HttpInterface> http = http_;
+  // the long polls are left out of the recorded session
+  if (auto recorder = std::dynamic_pointer_cast<HttpRecorder>(http)) {
+    http = recorder->inner();
+  }
+  if (auto client = std::dynamic_pointer_cast<HttpClient>(http)) {
+    auto own = std::make_shared<HttpClient>(*client);
+    own->timeout(static_cast<int64_t>(config_.uptane.notification_timeout_sec) * 1000);
+    http = own;
+  }
+  return std_::make_unique<NotificationListener>(http, config_.uptane.notification_url, [this]() {
+    {
+      std::lock_guard<std::mutex> g(exit_cond_.m);
+      exit_cond_.notified = true;
+    }
+    exit_cond_.cv.notify_all();
+  });
+}
+
 void Aktualizr::Shutdown() {
   {
     std::lock_guard<std::mutex> g(exit_cond_.m);
@@ -124,12 +299,34 @@ std::vector<SecondaryInfo> Aktualizr::GetSecondaries() const {
 }
 
 std::future<result::CampaignCheck> Aktualizr::CampaignCheck() {
-  std::function<result::CampaignCheck()> task([this] { return uptane_client_->campaignCheck(); });
-  return api_queue_->enqueue(std::move(task));
+  std::lock_guard<std::mutex> guard(campaign_check_mutex_);
+  // a check queued or running already gets its answer from the server late
+  // enough for this call too
+  if (campaign_check_.valid() && campaign_check_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    auto pending = campaign_check_;
+    return api_queue_->enqueue([pending] { return pending.get(); }, api::Lane::kReporting);
+  }
+
+  auto shared = std::make_shared<std::promise<result::CampaignCheck>>();
+  campaign_check_ = shared->get_future().share();
+  auto task = [this, shared] {
+    try {
+      EventsDelivered delivered(*events_);
+      result::CampaignCheck result = uptane_client_->campaignCheck();
+      campaigns_active_ = !result.campaigns.empty();
+      shared->set_value(result);
+      return result;
+    } catch (...) {
+      shared->set_exception(std::current_exception());
+      throw;
+    }
+  };
+  return api_queue_->enqueue(std::move(task), api::Lane::kReporting);
 }
 
 std::future<void> Aktualizr::CampaignControl(const std::string &campaign_id, campaign::Cmd cmd) {
-  std::function<void()> task([this, campaign_id, cmd] {
+  auto task = [this, campaign_id, cmd] {
+    EventsDelivered delivered(*events_);
     switch (cmd) {
       case campaign::Cmd::Accept:
         uptane_client_->campaignAccept(campaign_id);
@@ -143,29 +340,50 @@ std::future<void> Aktualizr::CampaignControl(const std::string &campaign_id, cam
       default:
         break;
     }
-  });
-  return api_queue_->enqueue(std::move(task));
+  };
+  return api_queue_->enqueue(std::move(task), api::Lane::kReporting);
 }
 
 void Aktualizr::SetCustomHardwareInfo(Json::Value hwinfo) { uptane_client_->setCustomHardwareInfo(std::move(hwinfo)); }
 std::future<void> Aktualizr::SendDeviceData() {
-  std::function<void()> task([this] { uptane_client_->sendDeviceData(); });
-  return api_queue_->enqueue(std::move(task));
+  auto task = [this] {
+    EventsDelivered delivered(*events_);
+    uptane_client_->sendDeviceData();
+  };
+  return api_queue_->enqueue(std::move(task), api::Lane::kReporting);
+}
+
+std::future<void> Aktualizr::MaintainStorage() {
+  auto task = [this] {
+    EventsDelivered delivered(*events_);
+    uptane_client_->maintainStorage();
+  };
+  // the storage can't be used meanwhile, so wait until every other lane is idle
+  return api_queue_->enqueue(std::move(task), api::Lane::kMetadata);
 }
 
 std::future<result::UpdateCheck> Aktualizr::CheckUpdates() {
-  std::function<result::UpdateCheck()> task([this] { return uptane_client_->fetchMeta(); });
-  return api_queue_->enqueue(std::move(task));
+  auto task = [this] {
+    EventsDelivered delivered(*events_);
+    return uptane_client_->fetchMeta();
+  };
+  return api_queue_->enqueue(std::move(task), api::Lane::kMetadata);
 }
 
-std::future<result::Download> Aktualizr::Download(const std::vector<Uptane::Target> &updates) {
-  std::function<result::Download()> task([this, updates]() { return uptane_client_->downloadImages(updates); });
-  return api_queue_->enqueue(std::move(task));
+std::future<result::Download> Aktualizr::Download(std::vector<Uptane::Target> updates) {
+  auto task = [this, updates = std::move(updates)]() {
+    EventsDelivered delivered(*events_);
+    return uptane_client_->downloadImages(updates);
+  };
+  return api_queue_->enqueue(std::move(task), api::Lane::kDownload);
 }
 
-std::future<result::Install> Aktualizr::Install(const std::vector<Uptane::Target> &updates) {
-  std::function<result::Install()> task([this, updates] { return uptane_client_->uptaneInstall(updates); });
-  return api_queue_->enqueue(std::move(task));
+std::future<result::Install> Aktualizr::Install(std::vector<Uptane::Target> updates) {
+  auto task = [this, updates = std::move(updates)] {
+    EventsDelivered delivered(*events_);
+    return uptane_client_->uptaneInstall(updates);
+  };
+  return api_queue_->enqueue(std::move(task), api::Lane::kInstall);
 }
 
 bool Aktualizr::SetInstallationRawReport(const std::string &custom_raw_report) {
@@ -173,8 +391,11 @@ bool Aktualizr::SetInstallationRawReport(const std::string &custom_raw_report) {
 }
 
 std::future<bool> Aktualizr::SendManifest(const Json::Value &custom) {
-  std::function<bool()> task([this, custom]() { return uptane_client_->putManifest(custom); });
-  return api_queue_->enqueue(std::move(task));
+  auto task = [this, custom]() {
+    EventsDelivered delivered(*events_);
+    return uptane_client_->putManifest(custom);
+  };
+  return api_queue_->enqueue(std::move(task), api::Lane::kReporting);
 }
 
 result::Pause Aktualizr::Pause() {
@@ -195,6 +416,10 @@ result::Pause Aktualizr::Resume() {
   }
 }
 
+void Aktualizr::SetDownloadRateLimit(uint64_t bytes_per_sec) { uptane_client_->setDownloadRateLimit(bytes_per_sec); }
+
+void Aktualizr::ResetDownloadRateLimit() { uptane_client_->resetDownloadRateLimit(); }
+
 void Aktualizr::Abort() { api_queue_->abort(); }
 
 boost::signals2::connection Aktualizr::SetSignalHandler(
@@ -228,6 +453,18 @@ std::vector<Uptane::Target> Aktualizr::GetStoredTargets() { return uptane_client
 
 void Aktualizr::DeleteStoredTarget(const Uptane::Target &target) { uptane_client_->deleteStoredTarget(target); }
 
+std::future<void> Aktualizr::RemoveStaleTargets() {
+  auto task = [this] {
+    EventsDelivered delivered(*events_);
+    uptane_client_->removeStaleTargets();
+  };
+  return api_queue_->enqueue(std::move(task), api::Lane::kDownload);
+}
+
 std::ifstream Aktualizr::OpenStoredTarget(const Uptane::Target &target) {
   return uptane_client_->openStoredTarget(target);
 }
+
+TargetFileView Aktualizr::OpenStoredTargetView(const Uptane::Target &target) {
+  return uptane_client_->openStoredTargetView(target);
+}
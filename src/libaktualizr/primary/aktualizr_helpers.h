@@ -9,7 +9,8 @@ class BaseEvent;
 }
 
 /*
- * Signal handler to remove old targets just after an installation completes
+ * Signal handler to remove old targets just after an installation completes,
+ * see Aktualizr::RemoveStaleTargets
  *
  * To be attached with Aktualizr::SetSignalHandler
  */
@@ -2,6 +2,8 @@
 
 #include <chrono>
 #include <future>
+#include <mutex>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -113,6 +115,25 @@ TEST(Aktualizr, FullNoUpdates) {
   verifyNothingInstalled(aktualizr.uptane_client()->AssembleManifest());
 }
 
+/*
+ * With deferred initialization, provisioning runs as the first command and
+ * the commands queued after Initialize() wait for it.
+ */
+TEST(Aktualizr, DeferredInitialization) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "noupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.deferred_initialization = true;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  result::UpdateCheck result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(result.status, result::UpdateStatus::kNoUpdatesAvailable);
+  EXPECT_TRUE(storage->loadEcuRegistered());
+}
+
 /*
  * Compute device installation failure code as concatenation of ECU failure
  * codes during installation.
@@ -1336,6 +1357,33 @@ TEST(Aktualizr, CheckNoUpdates) {
   verifyNothingInstalled(aktualizr.uptane_client()->AssembleManifest());
 }
 
+/* The Image repo metadata may be refreshed along with the Director's. It is
+ * used when there are updates, and its failures don't matter otherwise. */
+TEST(Aktualizr, SpeculativeImageMeta) {
+  for (const std::string flavor : {"hasupdates", "noupdates"}) {
+    TemporaryDirectory temp_dir;
+    auto http = std::make_shared<HttpFake>(temp_dir.Path(), flavor, fake_meta_dir);
+    Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+    conf.uptane.speculative_image_meta = true;
+    if (flavor == "noupdates") {
+      conf.uptane.repo_server = http->tls_server + "/no-image-repo";
+    }
+
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+    aktualizr.Initialize();
+    result::UpdateCheck result = aktualizr.CheckUpdates().get();
+    if (flavor == "hasupdates") {
+      EXPECT_EQ(result.status, result::UpdateStatus::kUpdatesAvailable);
+      EXPECT_EQ(result.updates.size(), 2u);
+      std::string image_targets;
+      EXPECT_TRUE(storage->loadNonRoot(&image_targets, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+    } else {
+      EXPECT_EQ(result.status, result::UpdateStatus::kNoUpdatesAvailable);
+    }
+  }
+}
+
 /*
  * Initialize -> Download -> nothing to download.
  *
@@ -1429,6 +1477,50 @@ TEST(Aktualizr, DownloadWithUpdates) {
   verifyNothingInstalled(aktualizr.uptane_client()->AssembleManifest());
 }
 
+/*
+ * Download several targets concurrently.
+ * Send a DownloadTargetComplete event for each of them and a single
+ * AllDownloadsComplete event at the end.
+ */
+TEST(Aktualizr, DownloadParallel) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.max_parallel_downloads = 2;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  std::mutex events_mutex;
+  std::set<std::string> completed;
+  size_t all_complete_count = 0;
+  auto f_cb = [&](const std::shared_ptr<event::BaseEvent>& event) {
+    std::lock_guard<std::mutex> guard(events_mutex);
+    if (event->isTypeOf<event::DownloadTargetComplete>()) {
+      const auto download_event = dynamic_cast<event::DownloadTargetComplete*>(event.get());
+      EXPECT_TRUE(download_event->success);
+      completed.insert(download_event->update.filename());
+    } else if (event->isTypeOf<event::AllDownloadsComplete>()) {
+      ++all_complete_count;
+    }
+  };
+  boost::signals2::connection conn = aktualizr.SetSignalHandler(f_cb);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  ASSERT_EQ(update_result.updates.size(), 2);
+  result::Download download_result = aktualizr.Download(update_result.updates).get();
+  EXPECT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+  ASSERT_EQ(download_result.updates.size(), 2);
+  // The order of the requested targets is preserved.
+  EXPECT_EQ(download_result.updates[0].filename(), "primary_firmware.txt");
+  EXPECT_EQ(download_result.updates[1].filename(), "secondary_firmware.txt");
+
+  std::lock_guard<std::mutex> guard(events_mutex);
+  EXPECT_EQ(completed, (std::set<std::string>{"primary_firmware.txt", "secondary_firmware.txt"}));
+  EXPECT_EQ(all_complete_count, 1);
+}
+
 class HttpDownloadFailure : public HttpFake {
  public:
   using Responses = std::vector<std::pair<std::string, HttpResponse>>;
@@ -1614,6 +1706,8 @@ TEST(Aktualizr, TargetAutoremove) {
 
     result::Install install_result = aktualizr.Install(update_result.updates).get();
     EXPECT_TRUE(install_result.dev_report.success);
+    // wait for the clean-up queued by the handler
+    aktualizr.RemoveStaleTargets().get();
 
     std::vector<Uptane::Target> targets = aktualizr.GetStoredTargets();
     ASSERT_EQ(targets.size(), 1);
@@ -1634,6 +1728,8 @@ TEST(Aktualizr, TargetAutoremove) {
 
     result::Install install_result = aktualizr.Install(update_result.updates).get();
     EXPECT_TRUE(install_result.dev_report.success);
+    // wait for the clean-up queued by the handler
+    aktualizr.RemoveStaleTargets().get();
 
     // all targets are kept (current and previous)
     std::vector<Uptane::Target> targets = aktualizr.GetStoredTargets();
@@ -1654,6 +1750,8 @@ TEST(Aktualizr, TargetAutoremove) {
 
     result::Install install_result = aktualizr.Install(update_result.updates).get();
     EXPECT_TRUE(install_result.dev_report.success);
+    // wait for the clean-up queued by the handler
+    aktualizr.RemoveStaleTargets().get();
 
     // all targets are kept again (current and previous)
     std::vector<Uptane::Target> targets = aktualizr.GetStoredTargets();
@@ -1670,10 +1768,15 @@ TEST(Aktualizr, TargetAutoremove) {
     result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
     aktualizr.Download(update_result.updates).get();
 
+    EXPECT_EQ(aktualizr.GetStoredTargets().size(), 3);
+    // the new image is kept until it is installed
+    aktualizr.RemoveStaleTargets().get();
     EXPECT_EQ(aktualizr.GetStoredTargets().size(), 3);
 
     result::Install install_result = aktualizr.Install(update_result.updates).get();
     EXPECT_TRUE(install_result.dev_report.success);
+    // wait for the clean-up queued by the handler
+    aktualizr.RemoveStaleTargets().get();
 
     // only two targets are left: dummy_firmware has been cleaned up
     std::vector<Uptane::Target> targets = aktualizr.GetStoredTargets();
@@ -2046,6 +2149,56 @@ TEST(Aktualizr, CampaignCheckAndControl) {
   EXPECT_TRUE(campaign_events.campaignpostpone_seen);
 }
 
+class HttpFakeCampaignEtag : public HttpFakeCampaign {
+ public:
+  HttpFakeCampaignEtag(const boost::filesystem::path& test_dir_in, const boost::filesystem::path& meta_dir_in)
+      : HttpFakeCampaign(test_dir_in, meta_dir_in) {}
+
+  HttpResponse getStreamIfModified(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control,
+                                   const HttpCacheValidators& validators, const HttpBodySink& sink) override {
+    if (validators.etag == "\"campaigns-1\"") {
+      ++not_modified;
+      return HttpResponse("", 304, CURLE_OK, "");
+    }
+    ++full;
+    HttpResponse response = getStream(url, maxsize, flow_control, sink);
+    response.validators.etag = "\"campaigns-1\"";
+    return response;
+  }
+
+  std::atomic<int> full{0};
+  std::atomic<int> not_modified{0};
+};
+
+/* Campaigns are only fetched again if they changed, and checks made while one
+ * is pending share its result. */
+TEST(Aktualizr, CampaignCheckConditional) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeCampaignEtag>(temp_dir.Path(), fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  std::vector<std::future<result::CampaignCheck>> checks;
+  for (int i = 0; i < 5; ++i) {
+    checks.push_back(aktualizr.CampaignCheck());
+  }
+  for (auto& check : checks) {
+    auto result = check.get();
+    ASSERT_EQ(result.campaigns.size(), 1);
+    EXPECT_EQ(result.campaigns[0].id, "c2eb7e8d-8aa0-429d-883f-5ed8fdb2a493");
+  }
+  EXPECT_EQ(http->full, 1);
+
+  auto result = aktualizr.CampaignCheck().get();
+  ASSERT_EQ(result.campaigns.size(), 1);
+  EXPECT_EQ(result.campaigns[0].name, "campaign1");
+  EXPECT_EQ(http->full, 1);
+  EXPECT_GE(http->not_modified, 1);
+}
+
 class HttpFakeNoCorrelationId : public HttpFake {
  public:
   HttpFakeNoCorrelationId(const boost::filesystem::path& test_dir_in, const boost::filesystem::path& meta_dir_in)
@@ -2113,6 +2266,60 @@ TEST(Aktualizr, ManifestCustom) {
   }
 }
 
+class HttpFakePartialManifest : public HttpFake {
+ public:
+  HttpFakePartialManifest(const boost::filesystem::path& test_dir_in, const boost::filesystem::path& meta_dir_in)
+      : HttpFake(test_dir_in, "", meta_dir_in) {}
+
+  HttpResponse put(const std::string& url, const Json::Value& data) override {
+    if (url.find("/manifest") != std::string::npos) {
+      manifests.push_back(data["signed"]);
+      if (!accept_partial && data["signed"]["partial"].asBool()) {
+        return HttpResponse(url, 400, CURLE_OK, "");
+      }
+    }
+    return HttpFake::put(url, data);
+  }
+
+  bool accept_partial{true};
+  std::vector<Json::Value> manifests;
+};
+
+/* A manifest the server already has is not sent again, and partial manifests
+ * only have the ECU manifests that changed, until the server rejects one. */
+TEST(Aktualizr, ManifestUnchanged) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakePartialManifest>(temp_dir.Path(), fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.skip_unchanged_manifest = true;
+  conf.uptane.partial_manifests = true;
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  EXPECT_TRUE(aktualizr.SendManifest().get());
+  const size_t sent = http->manifests.size();
+  ASSERT_GT(sent, 0U);
+  const std::string primary_serial = http->manifests.back()["primary_ecu_serial"].asString();
+  const Json::Value::ArrayIndex ecus = http->manifests.back()["ecu_version_manifests"].size();
+  ASSERT_EQ(ecus, 2U);
+
+  EXPECT_TRUE(aktualizr.SendManifest().get());
+  EXPECT_EQ(http->manifests.size(), sent);
+
+  EXPECT_TRUE(aktualizr.SendManifest(Utils::parseJSON(R"({"test_field":"test_value"})")).get());
+  ASSERT_EQ(http->manifests.size(), sent + 1);
+  EXPECT_TRUE(http->manifests.back()["partial"].asBool());
+  EXPECT_EQ(http->manifests.back()["ecu_version_manifests"].size(), 1U);
+  EXPECT_TRUE(http->manifests.back()["ecu_version_manifests"].isMember(primary_serial));
+
+  http->accept_partial = false;
+  EXPECT_TRUE(aktualizr.SendManifest(Utils::parseJSON(R"({"test_field":"other_value"})")).get());
+  ASSERT_EQ(http->manifests.size(), sent + 3);
+  EXPECT_FALSE(http->manifests.back().isMember("partial"));
+  EXPECT_EQ(http->manifests.back()["ecu_version_manifests"].size(), ecus);
+}
+
 TEST(Aktualizr, CustomInstallationRawReport) {
   TemporaryDirectory temp_dir;
   auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
@@ -0,0 +1,116 @@
+#include "event_dispatcher.h"
+
+#include <algorithm>
+
+#include "logging/logging.h"
+
+EventDispatcher::EventDispatcher(std::shared_ptr<event::Channel> subscribers, const size_t capacity)
+    : subscribers_(std::move(subscribers)), ring_(std::max<size_t>(capacity, 1)) {
+  thread_ = std::thread(&EventDispatcher::run, this);
+}
+
+EventDispatcher::~EventDispatcher() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  queued_cv_.notify_all();
+  thread_.join();
+}
+
+void EventDispatcher::post(std::shared_ptr<event::BaseEvent> event) {
+  if (std::this_thread::get_id() == thread_.get_id()) {
+    // waiting for room would wait for ourselves
+    (*subscribers_)(std::move(event));
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (event->variant == event::DownloadProgressReport::TypeName) {
+    auto report = std::static_pointer_cast<event::DownloadProgressReport>(event);
+    if (!event::DownloadProgressReport::isDownloadCompleted(*report)) {
+      if (coalesce(report)) {
+        return;
+      }
+      if (full() || !overflow_.empty()) {
+        auto &kept = overflow_[report->target.filename()];
+        if (kept == nullptr) {
+          ++posted_;
+        }
+        kept = std::move(report);
+        return;
+      }
+    }
+  }
+  room_cv_.wait(lock, [this] { return !full() && overflow_.empty(); });
+  ++posted_;
+  push(std::move(event));
+}
+
+void EventDispatcher::flush() {
+  if (std::this_thread::get_id() == thread_.get_id()) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  const uint64_t posted = posted_;
+  delivered_cv_.wait(lock, [this, posted] { return delivered_ >= posted; });
+}
+
+void EventDispatcher::push(std::shared_ptr<event::BaseEvent> event) {
+  ring_[(head_ + size_) % ring_.size()] = std::move(event);
+  ++size_;
+  queued_cv_.notify_one();
+}
+
+bool EventDispatcher::coalesce(const std::shared_ptr<event::DownloadProgressReport> &report) {
+  auto kept = overflow_.find(report->target.filename());
+  if (kept != overflow_.end()) {
+    kept->second = report;
+    return true;
+  }
+  // Look back over the progress reports queued last; a report can't be moved
+  // ahead of any other event.
+  for (size_t i = size_; i > 0; --i) {
+    auto &queued = ring_[(head_ + i - 1) % ring_.size()];
+    if (queued->variant != event::DownloadProgressReport::TypeName) {
+      return false;
+    }
+    auto &queued_report = static_cast<event::DownloadProgressReport &>(*queued);
+    if (event::DownloadProgressReport::isDownloadCompleted(queued_report)) {
+      return false;
+    }
+    if (queued_report.target.filename() == report->target.filename()) {
+      queued = report;
+      return true;
+    }
+  }
+  return false;
+}
+
+void EventDispatcher::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    queued_cv_.wait(lock, [this] { return size_ > 0 || stopping_; });
+    if (size_ == 0) {
+      break;
+    }
+    auto event = std::move(ring_[head_]);
+    head_ = (head_ + 1) % ring_.size();
+    --size_;
+    if (!overflow_.empty()) {
+      push(std::move(overflow_.begin()->second));
+      overflow_.erase(overflow_.begin());
+    }
+    room_cv_.notify_all();
+
+    lock.unlock();
+    try {
+      (*subscribers_)(event);
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Event handler for " << event->variant << " failed: " << e.what();
+    }
+    lock.lock();
+    ++delivered_;
+    delivered_cv_.notify_all();
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef EVENT_DISPATCHER_H_
+#define EVENT_DISPATCHER_H_
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libaktualizr/events.h"
+
+/**
+ * Delivers events to the subscribers of a channel on a thread of its own, so
+ * that a slow subscriber doesn't hold up whoever sent the event, e.g. the
+ * progress callback of a download.
+ *
+ * Events wait in a ring buffer of bounded size and are delivered in the order
+ * they were posted. Download progress reports never wait: a report replaces
+ * the report of the same Target that is still queued, if nothing but other
+ * progress reports was posted after it, and is kept aside while the buffer is
+ * full. All other events, including the final progress report of a download,
+ * are always delivered; posting one waits for room in the buffer.
+ */
+class EventDispatcher {
+ public:
+  static constexpr size_t kDefaultCapacity = 256;
+
+  explicit EventDispatcher(std::shared_ptr<event::Channel> subscribers, size_t capacity = kDefaultCapacity);
+  // Delivers what is still queued first
+  ~EventDispatcher();
+  EventDispatcher(const EventDispatcher &) = delete;
+  EventDispatcher(EventDispatcher &&) = delete;
+  EventDispatcher &operator=(const EventDispatcher &) = delete;
+  EventDispatcher &operator=(EventDispatcher &&) = delete;
+
+  // Events posted by a subscriber, from the dispatch thread, are delivered
+  // right away.
+  void post(std::shared_ptr<event::BaseEvent> event);
+  // Waits until the events posted so far are delivered
+  void flush();
+
+ private:
+  void run();
+  // with mutex_ held
+  bool full() const { return size_ == ring_.size(); }
+  void push(std::shared_ptr<event::BaseEvent> event);
+  bool coalesce(const std::shared_ptr<event::DownloadProgressReport> &report);
+
+  const std::shared_ptr<event::Channel> subscribers_;
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::condition_variable room_cv_;
+  std::condition_variable delivered_cv_;
+  std::vector<std::shared_ptr<event::BaseEvent>> ring_;
+  size_t head_{0};
+  size_t size_{0};
+  // progress reports that found the buffer full, by Target; they go into the
+  // buffer before anything else does
+  std::map<std::string, std::shared_ptr<event::DownloadProgressReport>> overflow_;
+  uint64_t posted_{0};
+  uint64_t delivered_{0};
+  bool stopping_{false};
+  std::thread thread_;
+};
+
+#endif  // EVENT_DISPATCHER_H_
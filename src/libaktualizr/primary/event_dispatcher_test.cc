@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "primary/event_dispatcher.h"
+
+namespace {
+// Records what it is sent, and holds up the first event until released
+class Subscriber {
+ public:
+  Subscriber() : channel(std::make_shared<event::Channel>()), release_future_(release_.get_future().share()) {
+    channel->connect([this](const std::shared_ptr<event::BaseEvent> &event) {
+      std::string name = event->variant;
+      if (event->variant == event::DownloadProgressReport::TypeName) {
+        const auto &report = static_cast<const event::DownloadProgressReport &>(*event);
+        name = report.target.filename() + " " + std::to_string(report.progress);
+      }
+      bool first;
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        first = received_.empty();
+        received_.push_back(name);
+      }
+      if (first) {
+        release_future_.wait();
+      }
+    });
+  }
+
+  void release() { release_.set_value(); }
+  std::vector<std::string> received() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return received_;
+  }
+
+  std::shared_ptr<event::Channel> channel;
+
+ private:
+  std::promise<void> release_;
+  std::shared_future<void> release_future_;
+  std::mutex mutex_;
+  std::vector<std::string> received_;
+};
+
+std::shared_ptr<event::DownloadProgressReport> progress(const std::string &name, unsigned int percent) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = std::string(64, '0');
+  target_json["length"] = 1;
+  return std::make_shared<event::DownloadProgressReport>(Uptane::Target(name, target_json), "Downloading", percent);
+}
+}  // namespace
+
+/* Events are delivered in order, and flush() waits for them. */
+TEST(EventDispatcher, Order) {
+  Subscriber subscriber;
+  subscriber.release();
+  EventDispatcher dut(subscriber.channel);
+  dut.post(std::make_shared<event::SendDeviceDataComplete>());
+  dut.post(progress("a", 10));
+  dut.post(std::make_shared<event::PutManifestComplete>(true));
+  dut.flush();
+  EXPECT_EQ(subscriber.received(),
+            std::vector<std::string>({"SendDeviceDataComplete", "a 10", "PutManifestComplete"}));
+}
+
+/* Progress reports queued for a slow subscriber are merged, the latest one
+ * winning, and never wait; other events wait for room and are all delivered
+ * after the progress reports posted before them. */
+TEST(EventDispatcher, CoalesceProgress) {
+  Subscriber subscriber;
+  EventDispatcher dut(subscriber.channel, 1);
+  dut.post(std::make_shared<event::SendDeviceDataComplete>());
+  // wait for the subscriber to hold on to it, with the buffer empty
+  while (subscriber.received().empty()) {
+    std::this_thread::yield();
+  }
+
+  dut.post(progress("a", 10));
+  dut.post(progress("b", 10));
+  dut.post(progress("b", 20));
+  dut.post(progress("a", 20));
+  auto terminal = std::async(std::launch::async, [&dut] { dut.post(progress("a", 100)); });
+  EXPECT_EQ(terminal.wait_for(std::chrono::milliseconds(100)), std::future_status::timeout);
+
+  subscriber.release();
+  ASSERT_EQ(terminal.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+  dut.flush();
+  EXPECT_EQ(subscriber.received(), std::vector<std::string>({"SendDeviceDataComplete", "a 20", "b 20", "a 100"}));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
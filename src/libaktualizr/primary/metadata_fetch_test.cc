@@ -1,10 +1,14 @@
 #include <gtest/gtest.h>
 
+#include <mutex>
 #include <string>
 
+#include "crypto/crypto.h"
 #include "httpfake.h"
 #include "libaktualizr/aktualizr.h"
 #include "test_utils.h"
+#include "uptane/fetcher.h"
+#include "uptane/imagerepository.h"
 #include "uptane_repo.h"
 #include "uptane_test_common.h"
 
@@ -14,6 +18,24 @@ class HttpFakeMetaCounter : public HttpFake {
       : HttpFake(test_dir_in, "", meta_dir_in) {}
 
   HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override {
+    countRequest(url);
+    return HttpFake::get(url, maxsize, flow_control);
+  }
+
+  int director_1root_count{0};
+  int director_2root_count{0};
+  int director_targets_count{0};
+  int image_1root_count{0};
+  int image_2root_count{0};
+  int image_versioned_root_count{0};
+  int image_timestamp_count{0};
+  int image_snapshot_count{0};
+  int image_targets_count{0};
+
+ private:
+  // Root versions may be fetched in parallel
+  void countRequest(const std::string &url) {
+    std::lock_guard<std::mutex> guard(mutex_);
     if (url.find("director/1.root.json") != std::string::npos) {
       ++director_1root_count;
     }
@@ -38,18 +60,12 @@ class HttpFakeMetaCounter : public HttpFake {
     if (url.find("repo/targets.json") != std::string::npos) {
       ++image_targets_count;
     }
-
-    return HttpFake::get(url, maxsize, flow_control);
+    if (url.find("/repo/") != std::string::npos && url.find(".root.json") != std::string::npos) {
+      ++image_versioned_root_count;
+    }
   }
 
-  int director_1root_count{0};
-  int director_2root_count{0};
-  int director_targets_count{0};
-  int image_1root_count{0};
-  int image_2root_count{0};
-  int image_timestamp_count{0};
-  int image_snapshot_count{0};
-  int image_targets_count{0};
+  std::mutex mutex_;
 };
 
 /*
@@ -140,6 +156,159 @@ TEST(Aktualizr, MetadataFetch) {
   EXPECT_EQ(http->image_targets_count, 1);
 }
 
+/* Answers conditional requests with 304 while the metadata stays the same. */
+class HttpFakeConditional : public HttpFake {
+ public:
+  HttpFakeConditional(const boost::filesystem::path &test_dir_in, const boost::filesystem::path &meta_dir_in)
+      : HttpFake(test_dir_in, "", meta_dir_in) {}
+
+  HttpResponse getStreamIfModified(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                                   const HttpCacheValidators &validators, const HttpBodySink &sink) override {
+    HttpResponse response = HttpFake::get(url, maxsize, flow_control);
+    const std::string etag = "\"" + Crypto::sha256digestHex(response.body) + "\"";
+    if (response.isOk() && validators.etag == etag) {
+      if (url.find("director/targets.json") != std::string::npos) {
+        ++director_targets_not_modified;
+      } else if (url.find("repo/timestamp.json") != std::string::npos) {
+        ++image_timestamp_not_modified;
+      }
+      return HttpResponse("", 304, CURLE_OK, "");
+    }
+    response.validators.etag = etag;
+    if (!sink(response.body.data(), response.body.size())) {
+      response.curl_code = CURLE_WRITE_ERROR;
+    }
+    response.body.clear();
+    return response;
+  }
+
+  int director_targets_not_modified{0};
+  int image_timestamp_not_modified{0};
+};
+
+/*
+ * Director Targets and Image repo Timestamp metadata are fetched
+ * conditionally; unchanged metadata is taken from the storage.
+ */
+TEST(Aktualizr, MetadataFetchNotModified) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFakeConditional>(temp_dir.Path(), meta_dir.Path() / "repo");
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  UptaneRepo uptane_repo_{meta_dir.PathString(), "", ""};
+  uptane_repo_.generateRepo(KeyType::kED25519);
+  uptane_repo_.addImage("tests/test_data/firmware.txt", "firmware.txt", "primary_hw");
+  uptane_repo_.addTarget("firmware.txt", "primary_hw", "CA:FE:A6:D2:84:9D");
+  uptane_repo_.signTargets();
+
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(http->director_targets_not_modified, 0);
+  EXPECT_EQ(http->image_timestamp_not_modified, 0);
+
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  ASSERT_EQ(update_result.updates.size(), 1);
+  EXPECT_EQ(update_result.updates[0].filename(), "firmware.txt");
+  EXPECT_EQ(http->director_targets_not_modified, 1);
+  EXPECT_EQ(http->image_timestamp_not_modified, 1);
+
+  // changed metadata is fetched as usual
+  uptane_repo_.addImage("tests/test_data/firmware_name.txt", "firmware_name.txt", "primary_hw");
+  uptane_repo_.emptyTargets();
+  uptane_repo_.addTarget("firmware_name.txt", "primary_hw", "CA:FE:A6:D2:84:9D");
+  uptane_repo_.signTargets();
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  ASSERT_EQ(update_result.updates.size(), 1);
+  EXPECT_EQ(update_result.updates[0].filename(), "firmware_name.txt");
+  EXPECT_EQ(http->director_targets_not_modified, 1);
+  EXPECT_EQ(http->image_timestamp_not_modified, 1);
+}
+
+/*
+ * While the Image repo Timestamp doesn't change, the Snapshot and Targets
+ * metadata verified by the previous update are used as they are.
+ */
+TEST(Aktualizr, ImageMetaTimestampUnchanged) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFakeMetaCounter>(temp_dir.Path(), meta_dir.Path() / "repo");
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  auto storage = INvStorage::newStorage(conf.storage);
+  Uptane::Fetcher fetcher(conf, http);
+
+  UptaneRepo uptane_repo_{meta_dir.PathString(), "", ""};
+  uptane_repo_.generateRepo(KeyType::kED25519);
+  uptane_repo_.addImage("tests/test_data/firmware.txt", "firmware.txt", "primary_hw");
+
+  Uptane::ImageRepository image_repo;
+  image_repo.updateMeta(*storage, fetcher, nullptr);
+  EXPECT_EQ(image_repo.timestampUnchangedCount(), 0);
+  const auto targets = image_repo.getTargets();
+  ASSERT_NE(targets, nullptr);
+  EXPECT_EQ(targets->targets.size(), 1);
+
+  image_repo.updateMeta(*storage, fetcher, nullptr);
+  EXPECT_EQ(image_repo.timestampUnchangedCount(), 1);
+  EXPECT_EQ(image_repo.getTargets(), targets);
+  EXPECT_EQ(http->image_timestamp_count, 2);
+  EXPECT_EQ(http->image_snapshot_count, 1);
+  EXPECT_EQ(http->image_targets_count, 1);
+
+  // a new Timestamp goes through the whole verification again
+  uptane_repo_.addImage("tests/test_data/firmware_name.txt", "firmware_name.txt", "primary_hw");
+  image_repo.updateMeta(*storage, fetcher, nullptr);
+  EXPECT_EQ(image_repo.timestampUnchangedCount(), 1);
+  ASSERT_NE(image_repo.getTargets(), nullptr);
+  EXPECT_EQ(image_repo.getTargets()->targets.size(), 2);
+  EXPECT_EQ(http->image_targets_count, 2);
+
+  // the storage doesn't have the metadata anymore, don't trust the previous update
+  storage->clearNonRootMeta(Uptane::RepositoryType::Image());
+  image_repo.updateMeta(*storage, fetcher, nullptr);
+  EXPECT_EQ(image_repo.timestampUnchangedCount(), 1);
+  ASSERT_TRUE(storage->loadNonRoot(nullptr, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+}
+
+/*
+ * After a rotation, the following Root versions are fetched a window at a
+ * time, without more requests than fetching them one by one.
+ */
+TEST(Aktualizr, RootRotationWindow) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFakeMetaCounter>(temp_dir.Path(), meta_dir.Path() / "repo");
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  auto storage = INvStorage::newStorage(conf.storage);
+  Uptane::Fetcher fetcher(conf, http);
+
+  UptaneRepo uptane_repo_{meta_dir.PathString(), "", ""};
+  uptane_repo_.generateRepo(KeyType::kED25519);
+  Uptane::ImageRepository image_repo;
+  image_repo.updateMeta(*storage, fetcher, nullptr);
+  // 1.root.json and the missing 2.root.json
+  EXPECT_EQ(http->image_versioned_root_count, 2);
+
+  const int rotations = 20;
+  for (int i = 0; i < rotations; ++i) {
+    uptane_repo_.rotate(Uptane::RepositoryType::Image(), Uptane::Role::Root(), KeyType::kED25519);
+  }
+  image_repo.updateMeta(*storage, fetcher, nullptr);
+
+  std::string root;
+  ASSERT_TRUE(storage->loadLatestRoot(&root, Uptane::RepositoryType::Image()));
+  EXPECT_EQ(Uptane::extractVersionUntrusted(root), 1 + rotations);
+  // versions 2 to 22, the last one missing
+  EXPECT_EQ(http->image_versioned_root_count, 2 + rotations + 1);
+  ASSERT_NE(image_repo.getTargets(), nullptr);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
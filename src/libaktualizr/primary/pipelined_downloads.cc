@@ -0,0 +1,38 @@
+#include "primary/pipelined_downloads.h"
+
+void PipelinedDownloads::setChecked(result::UpdateStatus status) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    checked_ = status;
+  }
+  cv_.notify_all();
+}
+
+result::UpdateStatus PipelinedDownloads::waitChecked() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return !!checked_ || finished_; });
+  return checked_ ? *checked_ : result::UpdateStatus::kError;
+}
+
+void PipelinedDownloads::setDone(const Uptane::Target &target, bool downloaded) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    done_[target.filename()] = downloaded;
+  }
+  cv_.notify_all();
+}
+
+bool PipelinedDownloads::waitDone(const Uptane::Target &target) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this, &target]() { return finished_ || done_.count(target.filename()) != 0; });
+  const auto it = done_.find(target.filename());
+  return it != done_.end() && it->second;
+}
+
+void PipelinedDownloads::finish() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    finished_ = true;
+  }
+  cv_.notify_all();
+}
@@ -0,0 +1,41 @@
+#ifndef PIPELINED_DOWNLOADS_H_
+#define PIPELINED_DOWNLOADS_H_
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <boost/optional.hpp>
+
+#include "libaktualizr/results.h"
+#include "libaktualizr/types.h"
+
+/**
+ * Progress of the downloads of a pipelined installation, which waits for each
+ * image as it gets to it (see SotaUptaneClient::downloadAndInstall()).
+ *
+ * The downloads first recheck the stored metadata and report the outcome.
+ * Each image is then reported once its download ended. Images that were not
+ * reported when the downloads finish count as failed.
+ */
+class PipelinedDownloads {
+ public:
+  void setChecked(result::UpdateStatus status);
+  // kError if the downloads finished without checking the metadata
+  result::UpdateStatus waitChecked();
+  void setDone(const Uptane::Target &target, bool downloaded);
+  // false if the image could not be downloaded
+  bool waitDone(const Uptane::Target &target);
+  void finish();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  boost::optional<result::UpdateStatus> checked_;
+  // downloaded images, by filename
+  std::map<std::string, bool> done_;
+  bool finished_{false};
+};
+
+#endif  // PIPELINED_DOWNLOADS_H_
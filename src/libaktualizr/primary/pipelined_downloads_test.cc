@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+
+#include <future>
+
+#include "primary/pipelined_downloads.h"
+
+static Uptane::Target target(const std::string &filename) {
+  return Uptane::Target(filename, Uptane::EcuMap{}, {Hash(Hash::Type::kSha256, std::string(64, '0'))}, 1);
+}
+
+/* Each image is waited for until its download ends. */
+TEST(PipelinedDownloads, WaitDone) {
+  PipelinedDownloads downloads;
+  auto checked = std::async(std::launch::async, [&downloads]() { return downloads.waitChecked(); });
+  auto first = std::async(std::launch::async, [&downloads]() { return downloads.waitDone(target("first")); });
+  auto second = std::async(std::launch::async, [&downloads]() { return downloads.waitDone(target("second")); });
+
+  downloads.setChecked(result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(checked.get(), result::UpdateStatus::kUpdatesAvailable);
+  downloads.setDone(target("second"), false);
+  EXPECT_FALSE(second.get());
+  EXPECT_EQ(first.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+  downloads.setDone(target("first"), true);
+  EXPECT_TRUE(first.get());
+  EXPECT_TRUE(downloads.waitDone(target("first")));
+}
+
+/* Whatever was not reported when the downloads finish failed. */
+TEST(PipelinedDownloads, Finish) {
+  PipelinedDownloads downloads;
+  auto other = std::async(std::launch::async, [&downloads]() { return downloads.waitDone(target("other")); });
+  downloads.finish();
+  EXPECT_FALSE(other.get());
+  EXPECT_EQ(downloads.waitChecked(), result::UpdateStatus::kError);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
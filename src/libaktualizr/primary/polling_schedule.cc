@@ -0,0 +1,34 @@
+#include "polling_schedule.h"
+
+#include <algorithm>
+
+PollingSchedule::PollingSchedule(const UptaneConfig &config, const uint32_t seed)
+    : interval_(std::chrono::seconds(config.polling_sec)),
+      max_interval_(std::chrono::seconds(std::max(config.polling_max_sec, config.polling_sec))),
+      campaign_interval_(std::chrono::seconds(config.polling_campaign_sec)),
+      jitter_percent_(std::min<uint64_t>(config.polling_jitter_percent, 100)),
+      idle_interval_(interval_),
+      random_(seed) {}
+
+std::chrono::milliseconds PollingSchedule::next(const bool found_updates, const bool campaigns_active,
+                                                const std::chrono::milliseconds server_wait) {
+  std::chrono::milliseconds interval;
+  if (found_updates) {
+    idle_interval_ = interval_;
+    interval = interval_;
+  } else {
+    interval = idle_interval_;
+    // doubles until it gets to the maximum, which is then kept
+    idle_interval_ = std::min(idle_interval_ * 2, max_interval_);
+  }
+  if (campaigns_active && campaign_interval_.count() > 0 && campaign_interval_ < interval) {
+    idle_interval_ = interval_;
+    interval = campaign_interval_;
+  }
+
+  if (jitter_percent_ > 0) {
+    const auto spread = interval.count() * static_cast<int64_t>(jitter_percent_) / 100;
+    interval += std::chrono::milliseconds(std::uniform_int_distribution<int64_t>(-spread, spread)(random_));
+  }
+  return std::max(interval, server_wait);
+}
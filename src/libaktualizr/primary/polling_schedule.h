@@ -0,0 +1,41 @@
+#ifndef POLLING_SCHEDULE_H_
+#define POLLING_SCHEDULE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+#include "libaktualizr/config.h"
+
+/**
+ * Picks how long Aktualizr::RunForever() waits before polling the server
+ * again, from the options `polling_*` of the Uptane configuration.
+ *
+ * The interval is `polling_sec`, doubled after each poll that found no update
+ * up to `polling_max_sec`, or `polling_campaign_sec` while the server reports
+ * campaigns. It is then moved randomly by up to `polling_jitter_percent`, so
+ * that the devices of a fleet don't all poll at the same time, and made at
+ * least as long as the server asked to wait.
+ */
+class PollingSchedule {
+ public:
+  explicit PollingSchedule(const UptaneConfig &config, uint32_t seed = std::random_device()());
+
+  /**
+   * @param found_updates whether the last poll found updates
+   * @param campaigns_active whether the server reports campaigns
+   * @param server_wait how long the server asked to wait, e.g. with Retry-After
+   */
+  std::chrono::milliseconds next(bool found_updates, bool campaigns_active, std::chrono::milliseconds server_wait);
+
+ private:
+  const std::chrono::milliseconds interval_;
+  const std::chrono::milliseconds max_interval_;
+  const std::chrono::milliseconds campaign_interval_;
+  const uint64_t jitter_percent_;
+  // the current interval of the back-off
+  std::chrono::milliseconds idle_interval_;
+  std::mt19937 random_;
+};
+
+#endif  // POLLING_SCHEDULE_H_
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include "primary/polling_schedule.h"
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+/* By default, the server is polled every polling_sec. */
+TEST(PollingSchedule, Fixed) {
+  UptaneConfig config;
+  config.polling_sec = 10;
+  PollingSchedule dut(config);
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(10));
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(10));
+  EXPECT_EQ(dut.next(true, true, milliseconds(0)), seconds(10));
+}
+
+/* The interval doubles while no update is found, and is reset by an update or
+ * by campaigns. */
+TEST(PollingSchedule, BackOff) {
+  UptaneConfig config;
+  config.polling_sec = 10;
+  config.polling_max_sec = 60;
+  config.polling_campaign_sec = 5;
+  PollingSchedule dut(config);
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(10));
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(20));
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(40));
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(60));
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(60));
+  EXPECT_EQ(dut.next(true, false, milliseconds(0)), seconds(10));
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(10));
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(20));
+  EXPECT_EQ(dut.next(false, true, milliseconds(0)), seconds(5));
+  EXPECT_EQ(dut.next(false, false, milliseconds(0)), seconds(10));
+}
+
+/* The jitter stays within its bounds, and the server can always ask for more
+ * time. */
+TEST(PollingSchedule, JitterAndServerWait) {
+  UptaneConfig config;
+  config.polling_sec = 100;
+  config.polling_jitter_percent = 10;
+  PollingSchedule dut(config, 42);
+  bool moved = false;
+  for (int i = 0; i < 100; ++i) {
+    const milliseconds interval = dut.next(false, false, milliseconds(0));
+    EXPECT_GE(interval, seconds(90));
+    EXPECT_LE(interval, seconds(110));
+    moved = moved || interval != seconds(100);
+  }
+  EXPECT_TRUE(moved);
+  EXPECT_EQ(dut.next(false, false, seconds(300)), seconds(300));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -156,7 +156,11 @@ std::string Provisioner::DeviceId() {
 
 bool Provisioner::loadSetTlsCreds() {
   key_manager_->copyCertsToCurl(*http_client_);
-  return key_manager_->isOk();
+  if (!key_manager_->isOk()) {
+    return false;
+  }
+  ++tls_creds_generation_;
+  return true;
 }
 
 // Postcondition:
@@ -174,10 +178,13 @@ void Provisioner::initTlsCreds() {
   // Shared credential provisioning is required and possible => (automatically)
   // provision with shared credentials.
 
-  // Set bootstrap (shared) credentials.
-  Bootstrap boot(config_.provision_path, config_.p12_password);
-  http_client_->setCerts(boot.getCa(), CryptoSource::kFile, boot.getCert(), CryptoSource::kFile, boot.getPkey(),
-                         CryptoSource::kFile);
+  // Set bootstrap (shared) credentials. They are read from the archive and
+  // parsed once, and kept for the next attempts if this one fails.
+  if (bootstrap_ == nullptr) {
+    bootstrap_ = std_::make_unique<Bootstrap>(config_.provision_path, config_.p12_password);
+  }
+  http_client_->setCerts(bootstrap_->getCa(), CryptoSource::kFile, bootstrap_->getCert(), CryptoSource::kFile,
+                         bootstrap_->getPkey(), CryptoSource::kFile);
 
   Json::Value data;
   data["deviceId"] = DeviceId();
@@ -209,6 +216,7 @@ void Provisioner::initTlsCreds() {
     throw ServerError("Received malformed device credentials from the server");
   }
   storage_->storeTlsCreds(ca, cert, pkey);
+  bootstrap_.reset();
 
   // Set provisioned (device) credentials.
   if (!loadSetTlsCreds()) {
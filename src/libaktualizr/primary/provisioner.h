@@ -1,10 +1,15 @@
 #ifndef INITIALIZER_H_
 #define INITIALIZER_H_
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <string>
 
+#include "gtest/gtest_prod.h"
 #include "libaktualizr/secondaryinterface.h"
 
+#include "bootstrap/bootstrap.h"
 #include "crypto/keymanager.h"
 #include "http/httpinterface.h"
 #include "libaktualizr/config.h"
@@ -88,7 +93,15 @@ class Provisioner {
    */
   std::string DeviceId();
 
+  /**
+   * Goes up each time TLS credentials are loaded into the HTTP client, i.e.
+   * whenever they may have changed.
+   */
+  uint64_t TlsCredsGeneration() const { return tls_creds_generation_; }
+
  private:
+  FRIEND_TEST(Uptane, TlsKeysReused);
+
   class Error : public std::runtime_error {
    public:
     explicit Error(const std::string& what) : std::runtime_error(std::string("Initializer error: ") + what) {}
@@ -173,6 +186,9 @@ class Provisioner {
   std::shared_ptr<INvStorage> storage_;
   std::shared_ptr<HttpInterface> http_client_;
   std::shared_ptr<KeyManager> key_manager_;
+  // Shared credentials, kept between attempts until device credentials are
+  // received
+  std::unique_ptr<Bootstrap> bootstrap_;
   // Lazily initialized by DeviceId()
   std::string device_id_;
   // Lazily initialized by PrimaryEcuSerial()
@@ -185,6 +201,7 @@ class Provisioner {
   bool register_ecus_{false};
   State current_state_{State::kUnknown};
   std::string last_error_;
+  std::atomic<uint64_t> tls_creds_generation_{0};
 };
 
 #endif  // INITIALIZER_H_
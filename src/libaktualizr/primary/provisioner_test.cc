@@ -326,6 +326,42 @@ TEST(Provisioner, DeviceRegistration) {
   }
 }
 
+/* Retries after a failed device registration reuse the Uptane key and the
+ * shared credentials of the first attempt. */
+TEST(Provisioner, RetryReusesCredentials) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeDeviceRegistration>(temp_dir.Path());
+  Config conf("tests/config/basic.toml");
+  conf.uptane.director_server = http->tls_server + "/director";
+  conf.uptane.repo_server = http->tls_server + "/repo";
+  conf.tls.server = http->tls_server;
+  conf.storage.path = temp_dir.Path();
+  conf.provision.primary_ecu_serial = "testecuserial";
+  conf.provision.provision_path = temp_dir / "cred.zip";
+  boost::filesystem::copy_file("tests/test_data/cred.zip", conf.provision.provision_path);
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  auto keys = std::make_shared<KeyManager>(storage, conf.keymanagerConfig());
+  Provisioner dut(conf.provision, storage, http, keys, {});
+
+  http->retcode = InitRetCode::kServerFailure;
+  EXPECT_FALSE(dut.Attempt());
+  std::string public_key1;
+  std::string private_key1;
+  EXPECT_TRUE(storage->loadPrimaryKeys(&public_key1, &private_key1));
+
+  // the shared credentials are not read again
+  boost::filesystem::remove(conf.provision.provision_path);
+  http->retcode = InitRetCode::kOk;
+  EXPECT_TRUE(dut.Attempt()) << dut.LastError();
+
+  std::string public_key2;
+  std::string private_key2;
+  EXPECT_TRUE(storage->loadPrimaryKeys(&public_key2, &private_key2));
+  EXPECT_EQ(public_key1, public_key2);
+  EXPECT_EQ(private_key1, private_key2);
+}
+
 class HttpFakeEcuRegistration : public HttpFake {
  public:
   explicit HttpFakeEcuRegistration(const boost::filesystem::path& test_dir_in) : HttpFake(test_dir_in) {}
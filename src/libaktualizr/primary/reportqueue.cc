@@ -1,11 +1,17 @@
 #include "reportqueue.h"
 
+#include <algorithm>
 #include <chrono>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string_view>
 
 #include "http/httpclient.h"
 #include "libaktualizr/config.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
+#include "utilities/memory_budget.h"
 
 ReportQueue::ReportQueue(const Config& config_in, std::shared_ptr<HttpInterface> http_client,
                          std::shared_ptr<INvStorage> storage_in, int run_pause_s, int event_number_limit)
@@ -14,11 +20,13 @@ ReportQueue::ReportQueue(const Config& config_in, std::shared_ptr<HttpInterface>
       storage(std::move(storage_in)),
       run_pause_s_{run_pause_s},
       event_number_limit_{event_number_limit},
-      cur_event_number_limit_{event_number_limit_} {
+      cur_event_number_limit_{event_number_limit_},
+      compress_{config.telemetry.compress_events} {
   if (event_number_limit == 0) {
     throw std::invalid_argument("Event number limit is set to 0 what leads to event accumulation in DB");
   }
   thread_ = std::thread(std::bind(&ReportQueue::run, this));
+  writer_ = std::thread(std::bind(&ReportQueue::writeLoop, this));
 }
 
 ReportQueue::~ReportQueue() {
@@ -28,8 +36,19 @@ ReportQueue::~ReportQueue() {
   }
   cv_.notify_all();
   thread_.join();
+  {
+    std::lock_guard<std::mutex> lock(staged_m_);
+    writer_shutdown_ = true;
+  }
+  staged_cv_.notify_all();
+  writer_.join();
 
   LOG_TRACE << "Flushing report queue";
+  try {
+    persistStaged();
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Failed to store report events: " << e.what();
+  }
   flushQueue();
 }
 
@@ -45,26 +64,120 @@ void ReportQueue::run() {
 }
 
 void ReportQueue::enqueue(std::unique_ptr<ReportEvent> event) {
+  std::vector<std::unique_ptr<ReportEvent>> events;
+  events.push_back(std::move(event));
+  enqueue(std::move(events));
+}
+
+void ReportQueue::enqueue(std::vector<std::unique_ptr<ReportEvent>> events) {
+  if (events.empty()) {
+    return;
+  }
+  bool durable = false;
   {
-    std::lock_guard<std::mutex> lock(m_);
-    storage->saveReportEvent(event->toJson());
+    std::lock_guard<std::mutex> lock(staged_m_);
+    for (const auto& event : events) {
+      staged_.push_back(event->toJson());
+      durable = durable || event->durable;
+    }
+  }
+  if (durable) {
+    persistStaged();
+    cv_.notify_all();
+  } else {
+    staged_cv_.notify_all();
+  }
+}
+
+void ReportQueue::writeLoop() {
+  std::unique_lock<std::mutex> lock(staged_m_);
+  while (!writer_shutdown_) {
+    staged_cv_.wait(lock, [this] { return writer_shutdown_ || !staged_.empty(); });
+    // let the rest of a burst of events arrive, to write them together
+    staged_cv_.wait_for(lock, kStagingDelay, [this] {
+      return writer_shutdown_ || staged_.size() >= kMaxStagedEvents || MemoryBudget::instance().underPressure();
+    });
+    lock.unlock();
+    bool stored = true;
+    try {
+      persistStaged();
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Failed to store report events: " << e.what();
+      stored = false;
+    }
+    cv_.notify_all();
+    lock.lock();
+    if (!stored) {
+      // don't retry in a loop
+      staged_cv_.wait_for(lock, kStagingDelay, [this] { return writer_shutdown_; });
+    }
+  }
+}
+
+void ReportQueue::persistStaged() {
+  std::lock_guard<std::mutex> persist_lock(persist_m_);
+  std::vector<Json::Value> events;
+  {
+    std::lock_guard<std::mutex> lock(staged_m_);
+    events.swap(staged_);
+  }
+  if (events.empty()) {
+    return;
+  }
+  try {
+    auto batch = storage->beginBatch();
+    for (const auto& event : events) {
+      storage->saveReportEvent(event);
+    }
+    batch->commit();
+  } catch (...) {
+    // keep them for the next attempt, in front of the ones staged meanwhile
+    std::lock_guard<std::mutex> lock(staged_m_);
+    staged_.insert(staged_.begin(), std::make_move_iterator(events.begin()), std::make_move_iterator(events.end()));
+    throw;
   }
-  cv_.notify_all();
 }
 
 void ReportQueue::flushQueue() {
   int64_t max_id = 0;
-  Json::Value report_array{Json::arrayValue};
-  storage->loadReportEvents(&report_array, &max_id, cur_event_number_limit_);
+  // The events are sent as they are stored, they are never parsed.
+  std::vector<std::string> events;
+  // the events, and the body made of them
+  const MemoryBudget::Reservation memory =
+      MemoryBudget::instance().reserveUpTo(MemoryBudget::User::kReports, 2 * kMaxBatchSize, 2 * kMinBatchSize);
+  storage->loadReportEventsRaw(&events, &max_id, cur_event_number_limit_, static_cast<size_t>(memory.size() / 2));
 
   if (config.tls.server.empty()) {
     // Prevent a lot of unnecessary garbage output in uptane vector tests.
     LOG_TRACE << "No server specified. Clearing report queue.";
-    report_array.clear();
+    events.clear();
   }
 
-  if (!report_array.empty()) {
-    HttpResponse response = http->post(config.tls.server + "/events", report_array);
+  if (!events.empty()) {
+    // the limit applies to the stored events, before coalescing
+    const size_t loaded = events.size();
+    coalesceEvents(&events);
+
+    size_t body_size = 1;
+    for (const auto& event : events) {
+      body_size += event.size() + 1;
+    }
+    std::string body;
+    body.reserve(body_size);
+    body += '[';
+    for (size_t i = 0; i < events.size(); ++i) {
+      if (i > 0) {
+        body += ',';
+      }
+      body += events[i];
+    }
+    body += ']';
+
+    size_t payload_size = 0;
+    const auto start = std::chrono::steady_clock::now();
+    HttpResponse response = postEvents(body, &payload_size);
+    const auto latency =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
 
     bool delete_events{response.isOk()};
     // 404 implies the server does not support this feature. Nothing we can
@@ -73,14 +186,15 @@ void ReportQueue::flushQueue() {
       LOG_DEBUG << "Server does not support event reports. Clearing report queue.";
       delete_events = true;
     } else if (response.http_status_code == 413) {
-      if (report_array.size() > 1) {
+      if (loaded > 1) {
         // if 413 is received to posting of more than one event then try sending less events next time
-        cur_event_number_limit_ = report_array.size() > 2 ? static_cast<int>(report_array.size() / 2U) : 1;
-        LOG_DEBUG << "Got 413 response to request that contains " << report_array.size() << " events. Will try to send "
+        cur_event_number_limit_ = loaded > 2 ? static_cast<int>(loaded / 2U) : 1;
+        LOG_DEBUG << "Got 413 response to request that contains " << loaded << " events. Will try to send "
                   << cur_event_number_limit_ << " events.";
       } else {
         // An event is too big to be accepted by the server, let's drop it
-        LOG_WARNING << "Dropping a report event " << report_array[0].get("id", "unknown") << " since the server `"
+        const std::string_view id = rawMember(events[0], "id");
+        LOG_WARNING << "Dropping a report event " << (id.empty() ? "unknown" : id) << " since the server `"
                     << config.tls.server << "` cannot digest it (413).";
         delete_events = true;
       }
@@ -88,11 +202,152 @@ void ReportQueue::flushQueue() {
       LOG_WARNING << "Failed to post update events: " << response.getStatusStr();
     }
     if (delete_events) {
-      report_array.clear();
       storage->deleteReportEvents(max_id);
-      cur_event_number_limit_ = event_number_limit_;
+      if (response.isOk()) {
+        cur_event_number_limit_ =
+            nextEventNumberLimit(cur_event_number_limit_, event_number_limit_, loaded, payload_size, latency);
+      } else {
+        cur_event_number_limit_ = event_number_limit_;
+      }
+    }
+  }
+}
+
+HttpResponse ReportQueue::postEvents(const std::string& body, size_t* payload_size) {
+  const std::string url = config.tls.server + "/events";
+  *payload_size = body.size();
+  if (!compress_ || body.size() < kMinCompressedSize) {
+    return http->post(url, "application/json", body);
+  }
+
+  std::string compressed;
+  try {
+    compressed = Utils::gzipCompress(body);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not compress report events, sending them uncompressed: " << e.what();
+    compress_ = false;
+    return http->post(url, "application/json", body);
+  }
+  HttpResponse response = http->postEncoded(url, "application/json", "gzip", compressed);
+  const long code = response.http_status_code;  // NOLINT(google-runtime-int)
+  if (code < 400 || code >= 500 || code == 413) {
+    *payload_size = compressed.size();
+    return response;
+  }
+
+  // The server may not understand the encoding. If it accepts the same events
+  // uncompressed, that was the problem.
+  response = http->post(url, "application/json", body);
+  if (response.isOk()) {
+    LOG_INFO << "Server does not accept compressed report events, sending them uncompressed from now on";
+    compress_ = false;
+  }
+  return response;
+}
+
+int ReportQueue::nextEventNumberLimit(int current, int configured, size_t sent, size_t payload_size,
+                                      std::chrono::milliseconds latency) {
+  if (latency > kSlowPost || payload_size > kMaxPayloadSize) {
+    return sent > 2 ? static_cast<int>(sent / 2U) : 1;
+  }
+  const bool full = current > 0 && sent >= static_cast<size_t>(current);
+  if (!full || latency >= kFastPost || current == configured) {
+    return current;
+  }
+  const int next = current * 2;
+  if (configured > 0) {
+    return std::min(next, configured);
+  }
+  return next > kMaxAdaptiveEventNumber ? configured : next;
+}
+
+// index just past the string starting at `pos`
+static size_t stringEnd(std::string_view json, size_t pos) {
+  for (++pos; pos < json.size() && json[pos] != '"'; ++pos) {
+    if (json[pos] == '\\') {
+      ++pos;
     }
   }
+  return pos + 1;
+}
+
+// index of the comma or bracket that ends the value starting at `pos`
+static size_t valueEnd(std::string_view json, size_t pos) {
+  int depth = 0;
+  while (pos < json.size()) {
+    const char c = json[pos];
+    if (c == '"') {
+      pos = stringEnd(json, pos);
+      continue;
+    }
+    if (c == '{' || c == '[') {
+      ++depth;
+    } else if ((c == '}' || c == ']') && depth-- == 0) {
+      return pos;
+    } else if (c == ',' && depth == 0) {
+      return pos;
+    }
+    ++pos;
+  }
+  return pos;
+}
+
+std::string_view ReportQueue::rawMember(std::string_view object, std::string_view key) {
+  if (object.size() < 2 || object[0] != '{') {
+    return {};
+  }
+  size_t pos = 1;
+  while (pos < object.size() && object[pos] == '"') {
+    const size_t key_end = stringEnd(object, pos);
+    if (key_end >= object.size() || object[key_end] != ':') {
+      return {};
+    }
+    const size_t value_end = valueEnd(object, key_end + 1);
+    if (object.substr(pos + 1, key_end - pos - 2) == key) {
+      return object.substr(key_end + 1, value_end - key_end - 1);
+    }
+    if (value_end >= object.size() || object[value_end] != ',') {
+      break;
+    }
+    pos = value_end + 1;
+  }
+  return {};
+}
+
+void ReportQueue::coalesceEvents(std::vector<std::string>* events) {
+  static const std::set<std::string_view> progress_types{R"("EcuDownloadStarted")", R"("EcuInstallationStarted")",
+                                                         R"("DevicePaused")", R"("DeviceResumed")"};
+  const size_t size = events->size();
+  std::vector<bool> dropped(size, false);
+  // the next kept event of each ECU, going backwards
+  std::map<std::string_view, size_t> next_event;
+  for (size_t i = size; i-- > 0;) {
+    const std::string_view event = rawMember((*events)[i], "event");
+    const std::string_view event_type = rawMember((*events)[i], "eventType");
+    const std::string_view ecu = rawMember(event, "ecu");
+    auto next = next_event.find(ecu);
+    if (next != next_event.end() && progress_types.count(rawMember(event_type, "id")) != 0) {
+      // canonical JSON: equal values are equal strings
+      const std::string& later = (*events)[next->second];
+      if (rawMember(later, "eventType") == event_type && rawMember(later, "event") == event) {
+        dropped[i] = true;
+        continue;
+      }
+    }
+    next_event[ecu] = i;
+  }
+  if (std::find(dropped.begin(), dropped.end(), true) == dropped.end()) {
+    return;
+  }
+
+  std::vector<std::string> coalesced;
+  for (size_t i = 0; i < size; ++i) {
+    if (!dropped[i]) {
+      coalesced.push_back(std::move((*events)[i]));
+    }
+  }
+  LOG_DEBUG << "Coalesced " << (size - coalesced.size()) << " redundant report events";
+  *events = std::move(coalesced);
 }
 
 void ReportEvent::setEcu(const Uptane::EcuSerial& ecu) { custom["ecu"] = ecu.ToString(); }
@@ -116,15 +371,18 @@ Json::Value ReportEvent::toJson() const {
 
 CampaignAcceptedReport::CampaignAcceptedReport(const std::string& campaign_id) : ReportEvent("campaign_accepted", 0) {
   custom["campaignId"] = campaign_id;
+  durable = true;
 }
 
 CampaignDeclinedReport::CampaignDeclinedReport(const std::string& campaign_id) : ReportEvent("campaign_declined", 0) {
   custom["campaignId"] = campaign_id;
+  durable = true;
 }
 
 CampaignPostponedReport::CampaignPostponedReport(const std::string& campaign_id)
     : ReportEvent("campaign_postponed", 0) {
   custom["campaignId"] = campaign_id;
+  durable = true;
 }
 
 DevicePausedReport::DevicePausedReport(const std::string& correlation_id) : ReportEvent("DevicePaused", 0) {
@@ -161,6 +419,7 @@ EcuInstallationAppliedReport::EcuInstallationAppliedReport(const Uptane::EcuSeri
     : ReportEvent("EcuInstallationApplied", 0) {
   setEcu(ecu);
   setCorrelationId(correlation_id);
+  durable = true;
 }
 
 EcuInstallationCompletedReport::EcuInstallationCompletedReport(const Uptane::EcuSerial& ecu,
@@ -169,4 +428,11 @@ EcuInstallationCompletedReport::EcuInstallationCompletedReport(const Uptane::Ecu
   setEcu(ecu);
   setCorrelationId(correlation_id);
   custom["success"] = success;
+  durable = true;
+}
+
+UpdatePerformanceReport::UpdatePerformanceReport(const std::string& correlation_id, Json::Value summary)
+    : ReportEvent("UpdatePerformance", 0) {
+  custom = std::move(summary);
+  setCorrelationId(correlation_id);
 }
@@ -2,18 +2,23 @@
 #define REPORTQUEUE_H_
 
 #include <json/json.h>
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <utility>  // for move
+#include <vector>
 
 #include "libaktualizr/types.h"  // for EcuSerial (ptr only), TimeStamp
 #include "utilities/utils.h"     // for Utils
 
 class Config;
 class HttpInterface;
+struct HttpResponse;
 class INvStorage;
 
 class ReportEvent {
@@ -23,6 +28,9 @@ class ReportEvent {
   int version;
   Json::Value custom;
   TimeStamp timestamp;
+  // written to the storage before enqueue() returns, as it ends an operation
+  // that can be followed by a reboot
+  bool durable{false};
 
   Json::Value toJson() const;
 
@@ -84,6 +92,12 @@ class EcuInstallationCompletedReport : public ReportEvent {
   EcuInstallationCompletedReport(const Uptane::EcuSerial& ecu, const std::string& correlation_id, bool success);
 };
 
+// The durations of the steps of an update, see UpdatePerformance
+class UpdatePerformanceReport : public ReportEvent {
+ public:
+  UpdatePerformanceReport(const std::string& correlation_id, Json::Value summary);
+};
+
 class ReportQueue {
  public:
   ReportQueue(const Config& config_in, std::shared_ptr<HttpInterface> http_client,
@@ -95,9 +109,51 @@ class ReportQueue {
   ReportQueue& operator=(ReportQueue&&) = delete;
   void run();
   void enqueue(std::unique_ptr<ReportEvent> event);
+  // store several events at once, in one storage transaction
+  void enqueue(std::vector<std::unique_ptr<ReportEvent>> events);
+
+  // Events are staged in memory and written to the storage together, after a
+  // short delay or once enough of them are waiting. Durable events are written
+  // right away, with the ones staged before them, and so are all events when
+  // the memory budget runs low.
+  static constexpr std::chrono::milliseconds kStagingDelay{500};
+  static constexpr size_t kMaxStagedEvents{64};
+
+  // Batches are sent compressed unless they are tiny. Their size adapts: it
+  // grows while the server accepts full batches quickly, and shrinks as soon
+  // as a batch is slow to send or too large.
+  static constexpr size_t kMinCompressedSize{512};
+  static constexpr std::chrono::milliseconds kFastPost{1000};
+  static constexpr std::chrono::milliseconds kSlowPost{5000};
+  static constexpr size_t kMaxPayloadSize{256 * 1024};
+  // above this, the limit is dropped again if there was none configured
+  static constexpr int kMaxAdaptiveEventNumber{1024};
+  // stored size of the events of a batch, unless it is a single event. A
+  // batch takes about twice that in memory, it is smaller when the memory
+  // budget runs low.
+  static constexpr size_t kMaxBatchSize{1024 * 1024};
+  static constexpr size_t kMinBatchSize{64 * 1024};
+
+  // Number of events for the next batch, after `sent` events in `payload_size`
+  // bytes took `latency` to be accepted. -1 means no limit.
+  static int nextEventNumberLimit(int current, int configured, size_t sent, size_t payload_size,
+                                  std::chrono::milliseconds latency);
+  // Drop the progress events (download or installation started, paused,
+  // resumed) that are repeated later for the same ECU, with no other event of
+  // that ECU in between. Only the last one is kept. The events are canonical
+  // JSON strings, as stored.
+  static void coalesceEvents(std::vector<std::string>* events);
+  // The raw value of member `key` of a JSON object in canonical form (no
+  // whitespace), or an empty string. It points into `object`.
+  static std::string_view rawMember(std::string_view object, std::string_view key);
 
  private:
   void flushQueue();
+  // post a batch of events, compressed if possible
+  HttpResponse postEvents(const std::string& body, size_t* payload_size);
+  void writeLoop();
+  // write the staged events to the storage in one transaction
+  void persistStaged();
 
   const Config& config;
   std::shared_ptr<HttpInterface> http;
@@ -106,10 +162,19 @@ class ReportQueue {
   std::mutex m_;
   std::queue<std::unique_ptr<ReportEvent>> report_queue_;
   bool shutdown_{false};
+  std::thread writer_;
+  std::condition_variable staged_cv_;
+  std::mutex staged_m_;
+  std::vector<Json::Value> staged_;
+  bool writer_shutdown_{false};
+  // keeps the staged events in order when several threads write them
+  std::mutex persist_m_;
   std::shared_ptr<INvStorage> storage;
   const int run_pause_s_;
   const int event_number_limit_;
   int cur_event_number_limit_;
+  // cleared if the server does not accept compressed events
+  bool compress_;
 };
 
 #endif  // REPORTQUEUE_H_
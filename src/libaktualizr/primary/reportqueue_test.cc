@@ -202,8 +202,9 @@ TEST(ReportQueue, StoreEvents) {
       report_queue.enqueue(std_::make_unique<EcuDownloadCompletedReport>(
           Uptane::EcuSerial("StoreEvents" + std::to_string(i)), "", true));
     }
-    check_sql(num_events);
   }
+  // staged events are written when the queue is destroyed at the latest
+  check_sql(num_events);
 
   config.tls.server = "reportqueue/StoreEvents";
   auto http = std::make_shared<HttpFakeRq>(temp_dir.Path(), num_events);
@@ -215,6 +216,136 @@ TEST(ReportQueue, StoreEvents) {
   check_sql(0);
 }
 
+/* Durable events are in the storage as soon as they are enqueued, together
+ * with the events staged before them. */
+TEST(ReportQueue, DurableEvents) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  config.tls.server = "";
+
+  auto sql_storage = std::make_shared<SQLStorage>(config.storage, false);
+  auto http = std::make_shared<HttpFakeRq>(temp_dir.Path(), 0);
+  ReportQueue report_queue(config, http, sql_storage);
+  for (int i = 0; i < 5; ++i) {
+    report_queue.enqueue(
+        std_::make_unique<EcuDownloadCompletedReport>(Uptane::EcuSerial("DurableEvents"), "", true));
+  }
+  report_queue.enqueue(std_::make_unique<EcuInstallationCompletedReport>(Uptane::EcuSerial("DurableEvents"), "", true));
+
+  int64_t max_id = 0;
+  Json::Value report_array{Json::arrayValue};
+  sql_storage->loadReportEvents(&report_array, &max_id, -1);
+  ASSERT_EQ(report_array.size(), 6);
+  EXPECT_EQ(report_array[0]["eventType"]["id"], "EcuDownloadCompleted");
+  EXPECT_EQ(report_array[5]["eventType"]["id"], "EcuInstallationCompleted");
+}
+
+class HttpFakeCompressedRq : public HttpFake {
+ public:
+  explicit HttpFakeCompressedRq(const boost::filesystem::path &test_dir_in) : HttpFake(test_dir_in, "") {}
+
+  HttpResponse postEncoded(const std::string &url, const std::string &content_type,
+                           const std::string &content_encoding, const std::string &data) override {
+    EXPECT_EQ(url, "reportqueue/Compressed/events");
+    EXPECT_EQ(content_type, "application/json");
+    EXPECT_EQ(content_encoding, "gzip");
+    TemporaryFile file("events.gz");
+    Utils::writeFile(file.Path(), data);
+    std::string output;
+    EXPECT_EQ(Utils::shell("gzip -dc " + file.PathString(), &output), 0);
+    events_seen += Utils::parseJSON(output).size();
+    if (events_seen == 10) {
+      expected_events_received.set_value(true);
+    }
+    return HttpResponse("", 200, CURLE_OK, "");
+  }
+
+  HttpResponse handle_event(const std::string &url, const Json::Value &data) override {
+    (void)url;
+    (void)data;
+    ++uncompressed_posts;
+    return HttpResponse("", 200, CURLE_OK, "");
+  }
+
+  size_t events_seen{0};
+  int uncompressed_posts{0};
+  std::promise<bool> expected_events_received{};
+};
+
+/* Batches of events are sent compressed. */
+TEST(ReportQueue, Compressed) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  config.tls.server = "reportqueue/Compressed";
+
+  auto http = std::make_shared<HttpFakeCompressedRq>(temp_dir.Path());
+  auto sql_storage = std::make_shared<SQLStorage>(config.storage, false);
+  for (int i = 0; i < 10; ++i) {
+    sql_storage->saveReportEvent(
+        EcuDownloadCompletedReport(Uptane::EcuSerial("Compressed" + std::to_string(i)), "", true).toJson());
+  }
+  ReportQueue report_queue(config, http, sql_storage);
+
+  http->expected_events_received.get_future().wait_for(std::chrono::seconds(20));
+  EXPECT_EQ(http->events_seen, 10);
+  EXPECT_EQ(http->uncompressed_posts, 0);
+}
+
+/* Only the last of repeated progress events of an ECU is sent. */
+TEST(ReportQueue, CoalesceEvents) {
+  std::vector<Json::Value> reports;
+  reports.push_back(EcuDownloadStartedReport(Uptane::EcuSerial("A"), "id").toJson());
+  reports.push_back(EcuDownloadStartedReport(Uptane::EcuSerial("B"), "id").toJson());
+  reports.push_back(EcuDownloadStartedReport(Uptane::EcuSerial("A"), "id").toJson());
+  reports.push_back(EcuDownloadCompletedReport(Uptane::EcuSerial("A"), "id", false).toJson());
+  reports.push_back(EcuDownloadStartedReport(Uptane::EcuSerial("A"), "id").toJson());
+  reports.push_back(EcuDownloadCompletedReport(Uptane::EcuSerial("A"), "id", true).toJson());
+  reports.push_back(EcuDownloadCompletedReport(Uptane::EcuSerial("A"), "id", true).toJson());
+  reports.push_back(Utils::parseJSON(R"({"id": "some ID", "eventType": "some Event"})"));
+  std::vector<std::string> events;
+  for (const auto &report : reports) {
+    events.push_back(Utils::jsonToCanonicalStr(report));
+  }
+
+  ReportQueue::coalesceEvents(&events);
+  ASSERT_EQ(events.size(), 7);
+  EXPECT_EQ(Utils::parseJSON(events[0])["event"]["ecu"], "B");
+  EXPECT_EQ(events[1], Utils::jsonToCanonicalStr(reports[2]));
+  EXPECT_EQ(Utils::parseJSON(events[2])["eventType"]["id"], "EcuDownloadCompleted");
+  EXPECT_EQ(Utils::parseJSON(events[3])["eventType"]["id"], "EcuDownloadStarted");
+  // completion events are never dropped
+  EXPECT_EQ(Utils::parseJSON(events[5])["eventType"]["id"], "EcuDownloadCompleted");
+}
+
+/* Members of stored events are found without parsing them. */
+TEST(ReportQueue, RawMember) {
+  const std::string event = R"({"a":[1,{"b":"}"}],"b":{"c":"x\",\"d\":1","d":2},"e":"y"})";
+  EXPECT_EQ(ReportQueue::rawMember(event, "a"), R"([1,{"b":"}"}])");
+  EXPECT_EQ(ReportQueue::rawMember(event, "b"), R"({"c":"x\",\"d\":1","d":2})");
+  EXPECT_EQ(ReportQueue::rawMember(ReportQueue::rawMember(event, "b"), "d"), "2");
+  EXPECT_EQ(ReportQueue::rawMember(event, "e"), R"("y")");
+  EXPECT_EQ(ReportQueue::rawMember(event, "c"), "");
+  EXPECT_EQ(ReportQueue::rawMember("[]", "a"), "");
+}
+
+/* The batch size grows while full batches are sent quickly, up to the
+ * configured limit, and shrinks when a batch is slow or too large. */
+TEST(ReportQueue, AdaptEventNumberLimit) {
+  using std::chrono::milliseconds;
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(-1, -1, 100, 1000, milliseconds(100)), -1);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(-1, -1, 100, 1000, milliseconds(10000)), 50);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(-1, -1, 100, 1024 * 1024, milliseconds(100)), 50);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(50, -1, 50, 1000, milliseconds(100)), 100);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(50, -1, 20, 1000, milliseconds(100)), 50);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(50, -1, 50, 1000, milliseconds(3000)), 50);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(1000, -1, 1000, 1000, milliseconds(100)), -1);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(8, 10, 8, 1000, milliseconds(100)), 10);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(10, 10, 10, 1000, milliseconds(100)), 10);
+  EXPECT_EQ(ReportQueue::nextEventNumberLimit(1, 10, 1, 1000, milliseconds(10000)), 1);
+}
+
 TEST(ReportQueue, LimitEventNumber) {
   TemporaryDirectory temp_dir;
   Config config;
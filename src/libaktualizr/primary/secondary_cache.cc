@@ -0,0 +1,529 @@
+#include "secondary_cache.h"
+
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+#include "crypto/crypto.h"
+#include "http/httpinterface.h"
+#include "logging/logging.h"
+
+namespace {
+
+const char *reasonPhrase(long status) {  // NOLINT(google-runtime-int)
+  switch (status) {
+    case 200:
+      return "OK";
+    case 400:
+      return "Bad Request";
+    case 404:
+      return "Not Found";
+    case 405:
+      return "Method Not Allowed";
+    case 501:
+      return "Not Implemented";
+    default:
+      return "Bad Gateway";
+  }
+}
+
+std::string responseHead(long status, uint64_t length, bool keep_alive) {  // NOLINT(google-runtime-int)
+  std::ostringstream head;
+  head << "HTTP/1.1 " << status << " " << reasonPhrase(status) << "\r\n"
+       << "Content-Length: " << length << "\r\n"
+       << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n\r\n";
+  return head.str();
+}
+
+bool sendAll(int socket, const std::string &data) {
+  size_t pos = 0;
+  while (pos < data.size()) {
+    const ssize_t sent = send(socket, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    pos += static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+// sendfile() can't be told not to raise SIGPIPE like send(), so it is blocked
+// in this thread meanwhile, and discarded if the Secondary went away.
+bool sendFile(int socket, int file_fd, uint64_t length) {
+  sigset_t sigpipe;
+  sigset_t old_mask;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+
+  bool ok = true;
+  off_t pos = 0;
+  const auto end = static_cast<off_t>(length);
+  while (pos < end) {
+    const ssize_t sent = sendfile(socket, file_fd, &pos, static_cast<size_t>(end - pos));
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      if (sent < 0 && errno == EPIPE) {
+        timespec no_wait{};
+        sigtimedwait(&sigpipe, nullptr, &no_wait);
+      }
+      ok = false;
+      break;
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  return ok;
+}
+
+// A status without a body, false if the connection has to be closed.
+bool sendStatus(int socket, long status, bool keep_alive) {  // NOLINT(google-runtime-int)
+  return sendAll(socket, responseHead(status, 0, keep_alive)) && keep_alive;
+}
+
+bool sendFileResponse(int socket, const boost::filesystem::path &path, bool head, bool keep_alive) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return sendStatus(socket, 404, keep_alive);
+  }
+  struct stat st {};
+  bool ok = fstat(fd, &st) == 0;
+  if (ok) {
+    const auto length = static_cast<uint64_t>(st.st_size);
+    ok = sendAll(socket, responseHead(200, length, keep_alive)) && (head || sendFile(socket, fd, length));
+  }
+  close(fd);
+  return ok && keep_alive;
+}
+
+// OSTree objects and static deltas are named after their content, the refs,
+// the config and the summary aren't.
+bool isContentAddressed(const std::string &path) {
+  return boost::starts_with(path, "/objects/") || boost::starts_with(path, "/deltas/");
+}
+
+struct ObjectDownload {
+  std::ofstream file;
+  const std::atomic<bool> *keep_running;
+};
+
+size_t objectWriteCallback(char *contents, size_t size, size_t nmemb, void *userp) {
+  auto *download = static_cast<ObjectDownload *>(userp);
+  download->file.write(contents, static_cast<std::streamsize>(size * nmemb));
+  return download->file.good() ? size * nmemb : 0;
+}
+
+int objectProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                           curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  return static_cast<ObjectDownload *>(clientp)->keep_running->load() ? 0 : 1;
+}
+
+}  // namespace
+
+SecondaryCache::SecondaryCache(std::shared_ptr<HttpInterface> http, std::string treehub_server,
+                               boost::filesystem::path cache_dir, uint64_t max_size,
+                               boost::filesystem::path images_dir, in_port_t port)
+    : http_(std::move(http)),
+      treehub_server_(boost::trim_right_copy_if(treehub_server, boost::is_any_of("/"))),
+      cache_dir_(std::move(cache_dir)),
+      max_size_(max_size),
+      images_dir_(std::move(images_dir)),
+      listen_socket_(port) {
+  boost::filesystem::create_directories(cache_dir_);
+  if (listen(*listen_socket_, SOMAXCONN) < 0) {
+    throw std::system_error(errno, std::system_category(), "listen");
+  }
+  thread_ = std::thread(&SecondaryCache::run, this);
+}
+
+SecondaryCache::~SecondaryCache() {
+  keep_running_.store(false);
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    sessions_condition_.notify_all();
+  }
+  ConnectionSocket("127.0.0.1", port()).connect();
+  thread_.join();
+  joinSessions();
+}
+
+void SecondaryCache::run() {
+  {
+    const uint64_t size = scanCache();
+    std::lock_guard<std::mutex> lock(fetch_mutex_);
+    cached_size_ = size;
+    if (cached_size_ > max_size_) {
+      evict();
+    }
+  }
+  LOG_INFO << "Secondary cache listening on " << listen_socket_.ToString() << ", caching " << treehub_server_;
+
+  while (keep_running_.load()) {
+    {
+      std::unique_lock<std::mutex> lock(sessions_mutex_);
+      sessions_condition_.wait(lock, [this] { return !keep_running_.load() || reapSessions() < kMaxConnections; });
+    }
+    const int socket = accept(*listen_socket_, nullptr, nullptr);
+    if (!keep_running_.load()) {
+      if (socket >= 0) {
+        close(socket);
+      }
+      break;
+    }
+    if (socket < 0) {
+      // the Secondary may have given up before the handshake completed
+      LOG_DEBUG << "Secondary cache could not accept a connection: " << std::strerror(errno);
+      continue;
+    }
+    startSession(socket);
+  }
+}
+
+void SecondaryCache::startSession(int socket) {
+  std::lock_guard<std::mutex> lock(sessions_mutex_);
+  sessions_.emplace_back();
+  Session &session = sessions_.back();
+  // the session can't finish before it is fully set up, as it needs the lock for that
+  session.thread = std::thread([this, socket, &session]() {
+    handleConnection(*Socket(socket));
+    std::lock_guard<std::mutex> session_lock(sessions_mutex_);
+    session.done = true;
+    sessions_condition_.notify_all();
+  });
+}
+
+size_t SecondaryCache::reapSessions() {
+  for (auto it = sessions_.begin(); it != sessions_.end();) {
+    if (it->done) {
+      it->thread.join();
+      it = sessions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return sessions_.size();
+}
+
+void SecondaryCache::joinSessions() {
+  std::list<Session> sessions;
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    sessions.splice(sessions.end(), sessions_);
+  }
+  for (auto &session : sessions) {
+    session.thread.join();
+  }
+}
+
+bool SecondaryCache::waitForData(int socket) const {
+  pollfd pfd{};
+  pfd.fd = socket;
+  pfd.events = POLLIN;
+  // wake up from time to time, so that the destructor isn't blocked by an idle connection
+  for (int waited = 0; keep_running_.load() && waited < kIdleTimeoutMs; waited += kStopCheckIntervalMs) {
+    const int res = poll(&pfd, 1, kStopCheckIntervalMs);
+    if (res > 0 || (res < 0 && errno != EINTR)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void SecondaryCache::handleConnection(int socket) {
+  int no_delay = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
+
+  std::string buffer;
+  std::vector<char> chunk(4096);
+  while (keep_running_.load()) {
+    size_t head_end;
+    while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+      if (buffer.size() > kMaxHeaderSize || !waitForData(socket)) {
+        return;
+      }
+      const ssize_t received = recv(socket, chunk.data(), chunk.size(), 0);
+      if (received < 0 && errno == EINTR) {
+        continue;
+      }
+      if (received <= 0) {
+        return;
+      }
+      buffer.append(chunk.data(), static_cast<size_t>(received));
+    }
+    std::istringstream head(buffer.substr(0, head_end));
+    buffer.erase(0, head_end + 4);
+
+    std::string request_line;
+    std::getline(head, request_line);
+    std::string method;
+    std::string target;
+    std::string version;
+    std::istringstream(request_line) >> method >> target >> version;
+    boost::trim(version);
+    bool keep_alive = version == "HTTP/1.1";
+    bool has_body = false;
+    for (std::string line; std::getline(head, line);) {
+      const auto colon = line.find(':');
+      if (colon == std::string::npos) {
+        continue;
+      }
+      const std::string name = boost::to_lower_copy(boost::trim_copy(line.substr(0, colon)));
+      const std::string value = boost::to_lower_copy(boost::trim_copy(line.substr(colon + 1)));
+      if (name == "connection") {
+        keep_alive = value == "keep-alive" || (keep_alive && value != "close");
+      } else if ((name == "content-length" && value != "0") || name == "transfer-encoding") {
+        has_body = true;
+      }
+    }
+
+    if (method.empty() || target.empty() || !boost::starts_with(version, "HTTP/1.")) {
+      sendStatus(socket, 400, false);
+      return;
+    }
+    // no request of a Secondary has a body, so there is no need to skip one
+    if (has_body) {
+      sendStatus(socket, 501, false);
+      return;
+    }
+    if (!respond(socket, method, target, keep_alive)) {
+      return;
+    }
+  }
+}
+
+bool SecondaryCache::respond(int socket, const std::string &method, const std::string &target, bool keep_alive) {
+  const bool head = method == "HEAD";
+  if (method != "GET" && !head) {
+    return sendStatus(socket, 405, false);
+  }
+  const std::string path = target.substr(0, target.find('?'));
+  if (path.empty() || path[0] != '/' || path.find("..") != std::string::npos) {
+    return sendStatus(socket, 404, keep_alive);
+  }
+
+  static const std::string images_prefix = "/images/";
+  if (boost::starts_with(path, images_prefix)) {
+    return serveImage(socket, path.substr(images_prefix.size()), head, keep_alive);
+  }
+  return serveTreehub(socket, path, head, keep_alive);
+}
+
+bool SecondaryCache::serveTreehub(int socket, const std::string &path, bool head, bool keep_alive) {
+  if (isContentAddressed(path)) {
+    const long status = fetchObject(path);  // NOLINT(google-runtime-int)
+    if (status != 200) {
+      return sendStatus(socket, status == 404 ? 404 : 502, keep_alive);
+    }
+    const auto object = cache_dir_ / path;
+    boost::system::error_code ec;
+    // the modification time tells the least recently used objects apart
+    boost::filesystem::last_write_time(object, std::time(nullptr), ec);
+    return sendFileResponse(socket, object, head, keep_alive);
+  }
+
+  const HttpResponse response = http_->get(treehub_server_ + path, HttpInterface::kNoLimit);
+  if (!response.isOk()) {
+    return sendStatus(socket, response.http_status_code == 404 ? 404 : 502, keep_alive);
+  }
+  return sendAll(socket, responseHead(200, response.body.size(), keep_alive)) &&
+         (head || sendAll(socket, response.body)) && keep_alive;
+}
+
+long SecondaryCache::fetchObject(const std::string &path) {  // NOLINT(google-runtime-int)
+  std::promise<long> promise;         // NOLINT(google-runtime-int)
+  std::shared_future<long> pending;  // NOLINT(google-runtime-int)
+  {
+    std::lock_guard<std::mutex> lock(fetch_mutex_);
+    if (boost::filesystem::exists(cache_dir_ / path)) {
+      return 200;
+    }
+    const auto fetch = fetches_.find(path);
+    if (fetch != fetches_.end()) {
+      pending = fetch->second;
+    } else {
+      fetches_.emplace(path, promise.get_future().share());
+    }
+  }
+  if (pending.valid()) {
+    return pending.get();
+  }
+
+  long status = 502;  // NOLINT(google-runtime-int)
+  try {
+    status = downloadObject(path);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Secondary cache could not fetch " << path << ": " << e.what();
+  }
+  {
+    std::lock_guard<std::mutex> lock(fetch_mutex_);
+    fetches_.erase(path);
+  }
+  promise.set_value(status);
+  return status;
+}
+
+long SecondaryCache::downloadObject(const std::string &path) {  // NOLINT(google-runtime-int)
+  const auto object = cache_dir_ / path;
+  const auto part = boost::filesystem::path(object.string() + ".part");
+  boost::filesystem::create_directories(object.parent_path());
+
+  ObjectDownload download{std::ofstream(part.string(), std::ios::binary | std::ios::trunc), &keep_running_};
+  if (!download.file.good()) {
+    throw std::runtime_error("can't write " + part.string());
+  }
+  const HttpResponse response =
+      http_->download(treehub_server_ + path, objectWriteCallback, objectProgressCallback, &download, 0);
+  download.file.close();
+  if (!response.isOk() || download.file.fail()) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(part, ec);
+    if (response.curl_code != CURLE_OK) {
+      LOG_WARNING << "Secondary cache could not fetch " << path << ": " << response.getStatusStr();
+      return 502;
+    }
+    return response.isOk() ? 502 : response.http_status_code;
+  }
+
+  const uint64_t size = boost::filesystem::file_size(part);
+  boost::filesystem::rename(part, object);
+  LOG_DEBUG << "Secondary cache fetched " << path << " (" << size << " bytes)";
+
+  std::lock_guard<std::mutex> lock(fetch_mutex_);
+  cached_size_ += size;
+  if (cached_size_ > max_size_) {
+    evict();
+  }
+  return 200;
+}
+
+uint64_t SecondaryCache::scanCache() const {
+  uint64_t size = 0;
+  boost::system::error_code ec;
+  for (boost::filesystem::recursive_directory_iterator it(cache_dir_, ec), end; !ec && it != end; it.increment(ec)) {
+    if (!boost::filesystem::is_regular_file(it->status())) {
+      continue;
+    }
+    if (it->path().extension() == ".part") {
+      boost::system::error_code remove_ec;
+      boost::filesystem::remove(it->path(), remove_ec);
+      continue;
+    }
+    boost::system::error_code size_ec;
+    const uint64_t file_size = boost::filesystem::file_size(it->path(), size_ec);
+    if (!size_ec) {
+      size += file_size;
+    }
+  }
+  return size;
+}
+
+void SecondaryCache::evict() {
+  // oldest first
+  std::vector<std::tuple<std::time_t, uint64_t, boost::filesystem::path>> objects;
+  boost::system::error_code ec;
+  for (boost::filesystem::recursive_directory_iterator it(cache_dir_, ec), end; !ec && it != end; it.increment(ec)) {
+    if (!boost::filesystem::is_regular_file(it->status()) || it->path().extension() == ".part") {
+      continue;
+    }
+    boost::system::error_code stat_ec;
+    const std::time_t mtime = boost::filesystem::last_write_time(it->path(), stat_ec);
+    const uint64_t size = boost::filesystem::file_size(it->path(), stat_ec);
+    if (!stat_ec) {
+      objects.emplace_back(mtime, size, it->path());
+    }
+  }
+  std::sort(objects.begin(), objects.end());
+
+  uint64_t size = 0;
+  for (const auto &object : objects) {
+    size += std::get<1>(object);
+  }
+  // make room for more than the object that went over the limit
+  const uint64_t target_size = max_size_ - max_size_ / 10;
+  size_t removed = 0;
+  for (const auto &object : objects) {
+    if (size <= target_size) {
+      break;
+    }
+    boost::system::error_code remove_ec;
+    // objects being sent stay readable until they are closed
+    if (boost::filesystem::remove(std::get<2>(object), remove_ec)) {
+      size -= std::get<1>(object);
+      ++removed;
+    }
+  }
+  cached_size_ = size;
+  LOG_DEBUG << "Secondary cache removed " << removed << " objects, " << size << " bytes left";
+}
+
+bool SecondaryCache::serveImage(int socket, const std::string &name, bool head, bool keep_alive) {
+  // images are stored under the hex SHA256 of their content
+  const auto is_hex = [](char c) { return std::isxdigit(static_cast<unsigned char>(c)) != 0; };
+  if (name.size() != 64 || !std::all_of(name.cbegin(), name.cend(), is_hex)) {
+    return sendStatus(socket, 404, keep_alive);
+  }
+  const auto path = images_dir_ / boost::to_lower_copy(name);
+  if (!checkImage(name, path)) {
+    return sendStatus(socket, 404, keep_alive);
+  }
+  return sendFileResponse(socket, path, head, keep_alive);
+}
+
+bool SecondaryCache::checkImage(const std::string &name, const boost::filesystem::path &path) {
+  boost::system::error_code ec;
+  const uint64_t size = boost::filesystem::file_size(path, ec);
+  if (ec) {
+    return false;
+  }
+  const std::time_t mtime = boost::filesystem::last_write_time(path, ec);
+  if (ec) {
+    return false;
+  }
+  const auto stamp = std::make_pair(size, mtime);
+  {
+    std::lock_guard<std::mutex> lock(fetch_mutex_);
+    const auto checked = checked_images_.find(name);
+    if (checked != checked_images_.end() && checked->second == stamp) {
+      return true;
+    }
+  }
+
+  // an image still being downloaded doesn't match yet
+  MultiPartSHA256Hasher hasher;
+  std::ifstream file(path.string(), std::ios::binary);
+  std::vector<char> buf(64 * 1024);
+  while (file.read(buf.data(), static_cast<std::streamsize>(buf.size())) || file.gcount() > 0) {
+    hasher.update(reinterpret_cast<const unsigned char *>(buf.data()), static_cast<uint64_t>(file.gcount()));
+  }
+  if (!boost::iequals(hasher.getHexDigest(), name)) {
+    LOG_DEBUG << "Secondary cache does not serve image " << name << ", its content doesn't match yet";
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(fetch_mutex_);
+  checked_images_[name] = stamp;
+  return true;
+}
@@ -0,0 +1,108 @@
+#ifndef PRIMARY_SECONDARY_CACHE_H_
+#define PRIMARY_SECONDARY_CACHE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "utilities/utils.h"
+
+class HttpInterface;
+
+/**
+ * HTTP server on the Primary that Secondaries pull OSTree commits and images
+ * from, so that each of them crosses the link to the servers only once.
+ *
+ * Treehub objects and static deltas are named after their content: each is
+ * fetched from Treehub once, through the HTTP client of the Primary, and then
+ * served from the cache directory. The least recently used ones are removed
+ * when the cache grows over its maximum size. The refs, the config and the
+ * summary change over time, so they are forwarded on each request.
+ *
+ * Images downloaded by the Primary are served at /images/<sha256>, once their
+ * content has been checked against the name.
+ *
+ * Like the IP Secondary protocol, the server speaks plain HTTP on the
+ * in-vehicle network. It only handles GET and HEAD requests without a body,
+ * with keep-alive.
+ */
+class SecondaryCache {
+ public:
+  SecondaryCache(std::shared_ptr<HttpInterface> http, std::string treehub_server, boost::filesystem::path cache_dir,
+                 uint64_t max_size, boost::filesystem::path images_dir, in_port_t port = 0);
+  ~SecondaryCache();
+  SecondaryCache(const SecondaryCache&) = delete;
+  SecondaryCache(SecondaryCache&&) = delete;
+  SecondaryCache& operator=(const SecondaryCache&) = delete;
+  SecondaryCache& operator=(SecondaryCache&&) = delete;
+
+  in_port_t port() const { return listen_socket_.port(); }
+
+ private:
+  struct Session {
+    std::thread thread;
+    bool done{false};
+  };
+
+  void run();
+  void handleConnection(int socket);
+  // false on an idle timeout or if the server is being stopped
+  bool waitForData(int socket) const;
+  // false if the connection has to be closed
+  bool respond(int socket, const std::string& method, const std::string& path, bool keep_alive);
+  bool serveTreehub(int socket, const std::string& path, bool head, bool keep_alive);
+  bool serveImage(int socket, const std::string& name, bool head, bool keep_alive);
+  /**
+   * Fetch a Treehub object into the cache, unless it is there already.
+   * Requests for an object that is being fetched wait for that fetch.
+   * @return The HTTP status of the fetch, 200 for a cached object.
+   */
+  long fetchObject(const std::string& path);  // NOLINT(google-runtime-int)
+  long downloadObject(const std::string& path);  // NOLINT(google-runtime-int)
+  // Size of the cached objects, after removing leftovers of interrupted fetches.
+  uint64_t scanCache() const;
+  // Remove the least recently used objects, must be called with fetch_mutex_ held.
+  void evict();
+  bool checkImage(const std::string& name, const boost::filesystem::path& path);
+
+  void startSession(int socket);
+  // joins the sessions that are done and returns how many are left, must be called with sessions_mutex_ held
+  size_t reapSessions();
+  void joinSessions();
+
+  static constexpr size_t kMaxConnections{16};
+  static constexpr size_t kMaxHeaderSize{16 * 1024};
+  static constexpr int kStopCheckIntervalMs{500};
+  static constexpr int kIdleTimeoutMs{60 * 1000};
+
+  std::shared_ptr<HttpInterface> http_;
+  const std::string treehub_server_;
+  const boost::filesystem::path cache_dir_;
+  const uint64_t max_size_;
+  const boost::filesystem::path images_dir_;
+  ListenSocket listen_socket_;
+  std::atomic<bool> keep_running_{true};
+
+  std::mutex fetch_mutex_;
+  std::map<std::string, std::shared_future<long>> fetches_;  // NOLINT(google-runtime-int)
+  uint64_t cached_size_{0};
+  // images whose content was checked, with the size and modification time they had then
+  std::map<std::string, std::pair<uint64_t, std::time_t>> checked_images_;
+
+  std::list<Session> sessions_;
+  std::mutex sessions_mutex_;
+  std::condition_variable sessions_condition_;
+  std::thread thread_;
+};
+
+#endif  // PRIMARY_SECONDARY_CACHE_H_
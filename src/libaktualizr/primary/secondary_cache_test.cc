@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "httpfake.h"
+#include "primary/secondary_cache.h"
+#include "utilities/utils.h"
+
+class HttpFakeTreehub : public HttpFake {
+ public:
+  explicit HttpFakeTreehub(const boost::filesystem::path &test_dir) : HttpFake(test_dir, "", test_dir / "servers") {}
+
+  HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void *userp, curl_off_t from) override {
+    ++downloads;
+    return HttpFake::download(url, write_cb, progress_cb, userp, from);
+  }
+
+  std::atomic<int> downloads{0};
+};
+
+// Send the requests on one connection, the last one closing it, and return
+// everything the cache sent back.
+static std::string exchange(in_port_t port, const std::vector<std::string> &paths) {
+  ConnectionSocket socket("127.0.0.1", port);
+  EXPECT_EQ(socket.connect(), 0);
+  std::string requests;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    requests += "GET " + paths[i] + " HTTP/1.1\r\nHost: primary\r\n";
+    requests += (i + 1 == paths.size()) ? "Connection: close\r\n\r\n" : "\r\n";
+  }
+  EXPECT_EQ(send(*socket, requests.data(), requests.size(), 0), static_cast<ssize_t>(requests.size()));
+
+  std::string res;
+  std::vector<char> buf(4096);
+  ssize_t received;
+  while ((received = recv(*socket, buf.data(), buf.size(), 0)) > 0) {
+    res.append(buf.data(), static_cast<size_t>(received));
+  }
+  return res;
+}
+
+static std::string response(const std::string &body) {
+  return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" +
+         body;
+}
+
+class SecondaryCacheTest : public ::testing::Test {
+ protected:
+  SecondaryCacheTest() : http(std::make_shared<HttpFakeTreehub>(temp_dir.Path())) {
+    boost::filesystem::create_directories(temp_dir.Path() / "servers/treehub/objects/ab");
+    boost::filesystem::create_directories(temp_dir.Path() / "servers/treehub/refs/heads");
+    boost::filesystem::create_directories(temp_dir.Path() / "images");
+    Utils::writeFile(temp_dir.Path() / "servers/treehub/objects/ab/cdef.filez", object);
+    Utils::writeFile(temp_dir.Path() / "servers/treehub/refs/heads/main", std::string("commit-1"));
+  }
+
+  std::unique_ptr<SecondaryCache> makeCache(uint64_t max_size = 1024 * 1024) {
+    return std_::make_unique<SecondaryCache>(http, http->tls_server + "/treehub/", temp_dir.Path() / "cache",
+                                             max_size, temp_dir.Path() / "images");
+  }
+
+  TemporaryDirectory temp_dir;
+  const std::string object{"an OSTree object"};
+  std::shared_ptr<HttpFakeTreehub> http;
+};
+
+/* Objects are fetched from Treehub once, refs on each request. */
+TEST_F(SecondaryCacheTest, TreehubObjects) {
+  auto cache = makeCache();
+  EXPECT_EQ(exchange(cache->port(), {"/objects/ab/cdef.filez"}), response(object));
+  EXPECT_EQ(http->downloads, 1);
+  EXPECT_TRUE(boost::filesystem::exists(temp_dir.Path() / "cache/objects/ab/cdef.filez"));
+
+  // served from the cache, also after a restart
+  Utils::writeFile(temp_dir.Path() / "servers/treehub/objects/ab/cdef.filez", std::string("changed"));
+  EXPECT_EQ(exchange(cache->port(), {"/objects/ab/cdef.filez"}), response(object));
+  cache = makeCache();
+  EXPECT_EQ(exchange(cache->port(), {"/objects/ab/cdef.filez"}), response(object));
+  EXPECT_EQ(http->downloads, 1);
+
+  EXPECT_EQ(exchange(cache->port(), {"/refs/heads/main"}), response("commit-1"));
+  Utils::writeFile(temp_dir.Path() / "servers/treehub/refs/heads/main", std::string("commit-2"));
+  EXPECT_EQ(exchange(cache->port(), {"/refs/heads/main"}), response("commit-2"));
+  EXPECT_FALSE(boost::filesystem::exists(temp_dir.Path() / "cache/refs"));
+}
+
+/* Several requests on a connection, and errors. */
+TEST_F(SecondaryCacheTest, KeepAlive) {
+  auto cache = makeCache();
+  const std::string res =
+      exchange(cache->port(), {"/objects/ab/cdef.filez", "/objects/ab/missing.filez", "/refs/heads/main"});
+  EXPECT_EQ(res, "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(object.size()) +
+                     "\r\nConnection: keep-alive\r\n\r\n" + object +
+                     "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: keep-alive\r\n\r\n" +
+                     response("commit-1"));
+  EXPECT_FALSE(boost::filesystem::exists(temp_dir.Path() / "cache/objects/ab/missing.filez"));
+
+  EXPECT_EQ(exchange(cache->port(), {"/objects/../../servers/treehub/refs/heads/main"}),
+            "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+}
+
+/* The least recently used objects go when the cache is full. */
+TEST_F(SecondaryCacheTest, Eviction) {
+  for (int i = 0; i < 4; ++i) {
+    Utils::writeFile(temp_dir.Path() / ("servers/treehub/objects/ab/" + std::to_string(i)), std::string(100, 'x'));
+  }
+  auto cache = makeCache(250);
+  for (int i = 0; i < 4; ++i) {
+    exchange(cache->port(), {"/objects/ab/" + std::to_string(i)});
+  }
+  size_t left = 0;
+  for (int i = 0; i < 4; ++i) {
+    left += boost::filesystem::exists(temp_dir.Path() / ("cache/objects/ab/" + std::to_string(i))) ? 1 : 0;
+  }
+  EXPECT_EQ(left, 2);
+  EXPECT_TRUE(boost::filesystem::exists(temp_dir.Path() / "cache/objects/ab/3"));
+}
+
+/* Images are served by their SHA256, only once their content matches. */
+TEST_F(SecondaryCacheTest, Images) {
+  const std::string image = "a complete image";
+  const std::string sha256 = Hash::generate(Hash::Type::kSha256, image).HashString();
+  auto cache = makeCache();
+
+  Utils::writeFile(temp_dir.Path() / "images" / sha256, std::string("a compl"));
+  EXPECT_EQ(exchange(cache->port(), {"/images/" + sha256}),
+            "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+  Utils::writeFile(temp_dir.Path() / "images" / sha256, image);
+  EXPECT_EQ(exchange(cache->port(), {"/images/" + sha256}), response(image));
+  EXPECT_EQ(http->downloads, 0);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,54 @@
+#include "secondary_health.h"
+
+#include <algorithm>
+
+#include "logging/logging.h"
+
+bool SecondaryHealth::available(const Uptane::EcuSerial &serial, Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(serial);
+  if (it == entries_.end() || it->second.state == State::kUp) {
+    return true;
+  }
+  Entry &entry = it->second;
+  if (entry.state == State::kDown && now >= entry.retry_at) {
+    LOG_DEBUG << "Probing Secondary " << serial << " again";
+    entry.state = State::kProbing;
+    return true;
+  }
+  return false;
+}
+
+void SecondaryHealth::reportSuccess(const Uptane::EcuSerial &serial) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(serial);
+  if (it == entries_.end()) {
+    return;
+  }
+  if (it->second.state != State::kUp) {
+    LOG_INFO << "Secondary " << serial << " is reachable again";
+  }
+  entries_.erase(it);
+}
+
+void SecondaryHealth::reportFailure(const Uptane::EcuSerial &serial, Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry &entry = entries_[serial];
+  // 1, 2, 4... times the initial backoff, without overflowing the shift
+  const unsigned int shift = std::min(entry.failures, 20U);
+  const auto backoff = std::min<std::chrono::milliseconds>(initial_backoff_ * (1U << shift), max_backoff_);
+  ++entry.failures;
+  if (entry.state == State::kUp) {
+    LOG_WARNING << "Secondary " << serial << " is unreachable, retrying in " << backoff.count() << " ms";
+  } else {
+    LOG_DEBUG << "Secondary " << serial << " is still unreachable, retrying in " << backoff.count() << " ms";
+  }
+  entry.state = State::kDown;
+  entry.retry_at = now + backoff;
+}
+
+SecondaryHealth::State SecondaryHealth::state(const Uptane::EcuSerial &serial) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(serial);
+  return (it == entries_.end()) ? State::kUp : it->second.state;
+}
@@ -0,0 +1,57 @@
+#ifndef SECONDARY_HEALTH_H_
+#define SECONDARY_HEALTH_H_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include "libaktualizr/types.h"
+
+/**
+ * Reachability of the Secondaries, shared by all the parts of an update cycle
+ * that talk to them.
+ *
+ * A Secondary is up until a request to it fails. It is then down and nothing
+ * is sent to it until its backoff has elapsed; the backoff doubles with every
+ * further failure, up to a limit. Once it has elapsed, one request is let
+ * through as a probe (the Secondary is probing until its result is
+ * reported): a success brings the Secondary back up, a failure takes it down
+ * again for longer.
+ */
+class SecondaryHealth {
+ public:
+  enum class State { kUp, kDown, kProbing };
+
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::milliseconds kInitialBackoff{std::chrono::seconds(1)};
+  static constexpr std::chrono::milliseconds kMaxBackoff{std::chrono::seconds(60)};
+
+  explicit SecondaryHealth(std::chrono::milliseconds initial_backoff = kInitialBackoff,
+                           std::chrono::milliseconds max_backoff = kMaxBackoff)
+      : initial_backoff_(initial_backoff), max_backoff_(max_backoff) {}
+
+  /**
+   * Whether a request may be sent to the Secondary now. Returns true for the
+   * first caller once the backoff of a down Secondary has elapsed, which
+   * then has to report the result.
+   */
+  bool available(const Uptane::EcuSerial &serial, Clock::time_point now = Clock::now());
+  void reportSuccess(const Uptane::EcuSerial &serial);
+  void reportFailure(const Uptane::EcuSerial &serial, Clock::time_point now = Clock::now());
+  State state(const Uptane::EcuSerial &serial) const;
+
+ private:
+  struct Entry {
+    State state{State::kUp};
+    unsigned int failures{0};
+    Clock::time_point retry_at;
+  };
+
+  const std::chrono::milliseconds initial_backoff_;
+  const std::chrono::milliseconds max_backoff_;
+  mutable std::mutex mutex_;
+  std::map<Uptane::EcuSerial, Entry> entries_;
+};
+
+#endif  // SECONDARY_HEALTH_H_
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+
+#include "primary/secondary_health.h"
+
+using std::chrono::milliseconds;
+
+/* A failed Secondary is skipped until its backoff has elapsed, and then
+ * probed by a single caller. */
+TEST(SecondaryHealth, Backoff) {
+  SecondaryHealth health(milliseconds(100), milliseconds(300));
+  const Uptane::EcuSerial serial("secondary");
+  const auto start = SecondaryHealth::Clock::now();
+
+  EXPECT_TRUE(health.available(serial, start));
+  EXPECT_EQ(health.state(serial), SecondaryHealth::State::kUp);
+
+  health.reportFailure(serial, start);
+  EXPECT_EQ(health.state(serial), SecondaryHealth::State::kDown);
+  EXPECT_FALSE(health.available(serial, start + milliseconds(99)));
+  EXPECT_TRUE(health.available(serial, start + milliseconds(100)));
+  EXPECT_EQ(health.state(serial), SecondaryHealth::State::kProbing);
+  // only one probe at a time
+  EXPECT_FALSE(health.available(serial, start + milliseconds(100)));
+
+  // the backoff doubles up to the limit
+  health.reportFailure(serial, start);
+  EXPECT_FALSE(health.available(serial, start + milliseconds(199)));
+  EXPECT_TRUE(health.available(serial, start + milliseconds(200)));
+  health.reportFailure(serial, start);
+  health.reportFailure(serial, start);
+  EXPECT_FALSE(health.available(serial, start + milliseconds(299)));
+  EXPECT_TRUE(health.available(serial, start + milliseconds(300)));
+
+  health.reportSuccess(serial);
+  EXPECT_EQ(health.state(serial), SecondaryHealth::State::kUp);
+  EXPECT_TRUE(health.available(serial, start));
+
+  // back to the initial backoff after a success
+  health.reportFailure(serial, start);
+  EXPECT_TRUE(health.available(serial, start + milliseconds(100)));
+}
+
+/* Secondaries are tracked separately. */
+TEST(SecondaryHealth, Independent) {
+  SecondaryHealth health;
+  const Uptane::EcuSerial down("down");
+  const Uptane::EcuSerial up("up");
+
+  health.reportFailure(down);
+  EXPECT_FALSE(health.available(down));
+  EXPECT_TRUE(health.available(up));
+  health.reportSuccess(up);
+  EXPECT_EQ(health.state(down), SecondaryHealth::State::kDown);
+  EXPECT_EQ(health.state(up), SecondaryHealth::State::kUp);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
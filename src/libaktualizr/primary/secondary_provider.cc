@@ -1,8 +1,10 @@
 #include "libaktualizr/secondary_provider.h"
 
 #include <fstream>
+#include <utility>
 
 #include "logging/logging.h"
+#include "package_manager/target_stream.h"
 #include "storage/invstorage.h"
 #include "uptane/tuf.h"
 #include "utilities/utils.h"
@@ -18,14 +20,14 @@ bool SecondaryProvider::getMetadata(Uptane::MetaBundle* meta_bundle, const Uptan
 }
 
 bool SecondaryProvider::getDirectorMetadata(Uptane::MetaBundle* meta_bundle) const {
-  std::string root;
-  std::string targets;
+  Uptane::MetaBuffer root;
+  Uptane::MetaBuffer targets;
 
-  if (!storage_->loadLatestRoot(&root, Uptane::RepositoryType::Director())) {
+  if (!storage_->loadLatestRootBuffer(&root, Uptane::RepositoryType::Director())) {
     LOG_ERROR << "No Director Root metadata to send";
     return false;
   }
-  if (!storage_->loadNonRoot(&targets, Uptane::RepositoryType::Director(), Uptane::Role::Targets())) {
+  if (!storage_->loadNonRootBuffer(&targets, Uptane::RepositoryType::Director(), Uptane::Role::Targets())) {
     LOG_ERROR << "No Director Targets metadata to send";
     return false;
   }
@@ -36,24 +38,24 @@ bool SecondaryProvider::getDirectorMetadata(Uptane::MetaBundle* meta_bundle) con
 }
 
 bool SecondaryProvider::getImageRepoMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const {
-  std::string root;
-  std::string timestamp;
-  std::string snapshot;
-  std::string targets;
+  Uptane::MetaBuffer root;
+  Uptane::MetaBuffer timestamp;
+  Uptane::MetaBuffer snapshot;
+  Uptane::MetaBuffer targets;
 
-  if (!storage_->loadLatestRoot(&root, Uptane::RepositoryType::Image())) {
+  if (!storage_->loadLatestRootBuffer(&root, Uptane::RepositoryType::Image())) {
     LOG_ERROR << "No Image repo Root metadata to send";
     return false;
   }
-  if (!storage_->loadNonRoot(&timestamp, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp())) {
+  if (!storage_->loadNonRootBuffer(&timestamp, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp())) {
     LOG_ERROR << "No Image repo Timestamp metadata to send";
     return false;
   }
-  if (!storage_->loadNonRoot(&snapshot, Uptane::RepositoryType::Image(), Uptane::Role::Snapshot())) {
+  if (!storage_->loadNonRootBuffer(&snapshot, Uptane::RepositoryType::Image(), Uptane::Role::Snapshot())) {
     LOG_ERROR << "No Image repo Snapshot metadata to send";
     return false;
   }
-  if (!storage_->loadNonRoot(&targets, Uptane::RepositoryType::Image(), Uptane::Role::Targets())) {
+  if (!storage_->loadNonRootBuffer(&targets, Uptane::RepositoryType::Image(), Uptane::Role::Targets())) {
     LOG_ERROR << "No Image repo Targets metadata to send";
     return false;
   }
@@ -84,15 +86,21 @@ std::string SecondaryProvider::getTreehubCredentials() const {
     return "";
   }
 
-  const std::string treehub_url = config_.pacman.ostree_server;
+  const std::string treehub_url = treehub_server_.empty() ? config_.pacman.ostree_server : treehub_server_;
   std::map<std::string, std::string> archive_map = {
       {"ca.pem", ca}, {"client.pem", cert}, {"pkey.pem", pkey}, {"server.url", treehub_url}};
 
+  std::lock_guard<std::mutex> lock(treehub_creds_mutex_);
+  if (!treehub_creds_archive_.empty() && archive_map == treehub_creds_files_) {
+    return treehub_creds_archive_;
+  }
   try {
     std::stringstream as;
     Utils::writeArchive(archive_map, as);
 
-    return as.str();
+    treehub_creds_archive_ = as.str();
+    treehub_creds_files_ = std::move(archive_map);
+    return treehub_creds_archive_;
   } catch (std::runtime_error& exc) {
     LOG_ERROR << "Could not create credentials archive: " << exc.what();
     return "";
@@ -102,3 +110,21 @@ std::string SecondaryProvider::getTreehubCredentials() const {
 std::ifstream SecondaryProvider::getTargetFileHandle(const Uptane::Target& target) const {
   return package_manager_->openTargetFile(target);
 }
+
+TargetFileView SecondaryProvider::getTargetFileView(const Uptane::Target& target) const {
+  return package_manager_->openTargetFileView(target);
+}
+
+bool SecondaryProvider::streamsTarget(const Uptane::Target& target) const {
+  return config_.pacman.secondary_cut_through && package_manager_->verifyTarget(target) != TargetStatus::kGood;
+}
+
+std::unique_ptr<TargetStream> SecondaryProvider::openTargetStream(const Uptane::Target& target) const {
+  return package_manager_->openTargetStream(target, config_.uptane.repo_server);
+}
+
+void SecondaryProvider::reportInstallProgress(const Uptane::EcuSerial& serial, unsigned int progress) const {
+  if (events_channel_) {
+    (*events_channel_)(std::make_shared<event::InstallProgressReport>(serial, progress));
+  }
+}
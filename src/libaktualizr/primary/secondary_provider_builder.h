@@ -9,8 +9,11 @@ class SecondaryProviderBuilder {
  public:
   static std::shared_ptr<SecondaryProvider> Build(
       Config &config, const std::shared_ptr<const INvStorage> &storage,
-      const std::shared_ptr<const PackageManagerInterface> &package_manager) {
-    return std::make_shared<SecondaryProvider>(SecondaryProvider(config, storage, package_manager));
+      const std::shared_ptr<const PackageManagerInterface> &package_manager,
+      const std::shared_ptr<event::Channel> &events_channel = nullptr) {
+    // the constructor is private, so std::make_shared can't call it
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+    return std::shared_ptr<SecondaryProvider>(new SecondaryProvider(config, storage, package_manager, events_channel));
   }
   ~SecondaryProviderBuilder() = default;
   SecondaryProviderBuilder(const SecondaryProviderBuilder &) = delete;
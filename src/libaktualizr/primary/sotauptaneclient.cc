@@ -1,9 +1,18 @@
 #include "primary/sotauptaneclient.h"
 
 #include <fnmatch.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <memory>
+#include <numeric>
+#include <set>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "crypto/crypto.h"
 #include "crypto/keymanager.h"
@@ -12,29 +21,42 @@
 #include "logging/logging.h"
 #include "provisioner.h"
 #include "uptane/exceptions.h"
+#include "utilities/metrics.h"
+#include "utilities/thread_policy.h"
+#include "utilities/tracing.h"
 #include "utilities/utils.h"
 
 static void report_progress_cb(event::Channel *channel, const Uptane::Target &target, const std::string &description,
                                unsigned int progress) {
-  if (channel == nullptr) {
+  // nobody to copy the Target for
+  if (channel == nullptr || channel->empty()) {
     return;
   }
   auto event = std::make_shared<event::DownloadProgressReport>(target, description, progress);
   (*channel)(event);
 }
 
-/**
- * A utility class to compare targets between Image and Director repositories.
- * The definition of 'sameness' is in Target::MatchTarget().
- */
-class TargetCompare {
- public:
-  explicit TargetCompare(const Uptane::Target &target_in) : target(target_in) {}
-  bool operator()(const Uptane::Target &in) const { return (in.MatchTarget(target)); }
+static std::chrono::milliseconds millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+}
 
- private:
-  const Uptane::Target &target;
-};
+static metrics::Histogram &startupTime(const char *phase) {
+  return metrics::Registry::instance().histogram("aktualizr_startup_seconds", "Time taken by the phases of the startup",
+                                                 {{"phase", phase}});
+}
+
+// Digests of the ECU manifests of a vehicle manifest, by ECU serial. The
+// report counter is left out, it changes with every manifest.
+static std::map<std::string, std::string> ecu_manifest_digests(const Json::Value &ecu_version_manifests) {
+  std::map<std::string, std::string> digests;
+  for (auto it = ecu_version_manifests.begin(); it != ecu_version_manifests.end(); ++it) {
+    Json::Value body = (*it)["signed"];
+    body.removeMember("report_counter");
+    digests.emplace(it.key().asString(),
+                    Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(body)).HashString());
+  }
+  return digests;
+}
 
 SotaUptaneClient::SotaUptaneClient(Config &config_in, std::shared_ptr<INvStorage> storage_in,
                                    std::shared_ptr<HttpInterface> http_in,
@@ -43,14 +65,20 @@ SotaUptaneClient::SotaUptaneClient(Config &config_in, std::shared_ptr<INvStorage
     : config(config_in),
       storage(std::move(storage_in)),
       http(std::move(http_in)),
+      rate_limiter_(std::make_shared<RateLimiter>(RateLimitPolicy::fromConfig(
+          config.uptane.download_rate_limit, config.uptane.download_rate_limit_schedule,
+          config.uptane.download_rate_limit_metered, config.uptane.metered_interfaces))),
       package_manager_(PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, http)),
       key_manager_(std::make_shared<KeyManager>(storage, config.keymanagerConfig())),
       uptane_fetcher(new Uptane::Fetcher(config, http)),
       events_channel(std::move(events_channel_in)),
       provisioner_(config.provision, storage, http, key_manager_, secondaries),
-      flow_control_(flow_control) {
+      flow_control_(flow_control),
+      target_order_(config.uptane) {
+  http->setDownloadRateLimiter(rate_limiter_);
+  package_manager_->setEventsChannel(events_channel);
   report_queue = std_::make_unique<ReportQueue>(config, http, storage);
-  secondary_provider_ = SecondaryProviderBuilder::Build(config, storage, package_manager_);
+  secondary_provider_ = SecondaryProviderBuilder::Build(config, storage, package_manager_, events_channel);
 }
 
 void SotaUptaneClient::addSecondary(const std::shared_ptr<SecondaryInterface> &sec) {
@@ -151,6 +179,7 @@ void SotaUptaneClient::finalizeAfterReboot() {
                                   correlation_id);
 
     report_queue->enqueue(std_::make_unique<EcuInstallationCompletedReport>(primary_ecu_serial, correlation_id, true));
+    finalized_update_ = true;
   } else {
     // finalize failed, unset pending flag so that the rest of the Uptane process can go forward again
     storage->saveInstalledVersion(primary_ecu_serial.ToString(), *pending_target, InstalledVersionUpdateMode::kNone,
@@ -167,6 +196,37 @@ void SotaUptaneClient::finalizeAfterReboot() {
   putManifestSimple();
 }
 
+void SotaUptaneClient::pruneAfterFinalize() {
+  if (!finalized_update_.exchange(false)) {
+    return;
+  }
+  try {
+    package_manager_->pruneAfterFinalize();
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not prune after the installation: " << e.what();
+  }
+}
+
+void SotaUptaneClient::maintainStorage() {
+  StorageMaintenance maintenance;
+  try {
+    maintenance = storage->maintain(std::chrono::milliseconds(config.storage.maintenance_budget_ms),
+                                    config.storage.maintenance_integrity_check);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not maintain the storage: " << e.what();
+    return;
+  }
+  auto report = std::make_shared<event::StorageMaintenanceReport>();
+  report->bytes_reclaimed = maintenance.bytes_reclaimed;
+  report->duration = maintenance.duration;
+  report->complete = maintenance.complete;
+  report->integrity_checked = !!maintenance.integrity_ok;
+  report->integrity_ok = maintenance.integrity_ok.value_or(false);
+  if (events_channel) {
+    (*events_channel)(report);
+  }
+}
+
 data::InstallationResult SotaUptaneClient::PackageInstallSetResult(const Uptane::Target &target,
                                                                    const Uptane::CorrelationId &correlation_id) {
   data::InstallationResult result;
@@ -211,7 +271,7 @@ void SotaUptaneClient::reportHwInfo() {
       LOG_TRACE << "Not reporting default hardware information because it has already been reported";
       return;
     }
-    hw_info = Utils::getHardwareInfo();
+    hw_info = hardware_info_.valid() ? hardware_info_.get() : Utils::getHardwareInfo(hardwareInfoCache());
     if (hw_info.empty()) {
       LOG_WARNING << "Unable to fetch hardware information from host system.";
       return;
@@ -236,14 +296,13 @@ void SotaUptaneClient::reportHwInfo() {
   }
 }
 
-void SotaUptaneClient::reportInstalledPackages() {
-  const Json::Value packages = package_manager_->getInstalledPackages();
-  const Hash new_hash = Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(packages));
+void SotaUptaneClient::reportInstalledPackages(const Hash &new_hash) {
   std::string stored_hash;
   if (!(storage->loadDeviceDataHash("installed_packages", &stored_hash) &&
         new_hash == Hash(Hash::Type::kSha256, stored_hash))) {
     LOG_DEBUG << "Reporting installed packages";
-    const HttpResponse response = http->put(config.tls.server + "/core/installed", packages);
+    const HttpResponse response =
+        http->put(config.tls.server + "/core/installed", package_manager_->getInstalledPackages());
     if (response.isOk()) {
       storage->storeDeviceDataHash("installed_packages", new_hash.HashString());
     }
@@ -252,17 +311,24 @@ void SotaUptaneClient::reportInstalledPackages() {
   }
 }
 
-void SotaUptaneClient::reportNetworkInfo() {
+void SotaUptaneClient::reportNetworkInfo() { reportNetworkInfo(collectNetworkInfo()); }
+
+Json::Value SotaUptaneClient::collectNetworkInfo() const {
   if (!config.telemetry.report_network) {
     LOG_TRACE << "Not reporting network information because telemetry is disabled";
-    return;
+    return Json::nullValue;
   }
 
-  Json::Value network_info;
   try {
-    network_info = Utils::getNetworkInfo();
+    return Utils::getNetworkInfo();
   } catch (const std::exception &ex) {
     LOG_ERROR << "Failed to get network info: " << ex.what();
+    return Json::nullValue;
+  }
+}
+
+void SotaUptaneClient::reportNetworkInfo(const Json::Value &network_info) {
+  if (network_info.isNull()) {
     return;
   }
   const Hash new_hash = Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(network_info));
@@ -302,6 +368,27 @@ void SotaUptaneClient::reportAktualizrConfiguration() {
   }
 }
 
+SotaUptaneClient::SecondaryManifest SotaUptaneClient::getSecondaryManifest(const SecondaryInterface::Ptr &secondary) {
+  SecondaryManifest result;
+  try {
+    result.manifest = secondary->getManifest();
+  } catch (const std::exception &ex) {
+    // Not critical; it might just be temporarily offline.
+    LOG_DEBUG << "Failed to get manifest from Secondary with serial " << secondary->getSerial() << ": " << ex.what();
+    return result;
+  }
+  if (result.manifest.empty()) {
+    return result;
+  }
+  try {
+    result.verified = result.manifest.verifySignature(secondary->getPublicKey());
+  } catch (const std::exception &ex) {
+    LOG_ERROR << "Failed to get public key from Secondary with serial " << secondary->getSerial() << ": "
+              << ex.what();
+  }
+  return result;
+}
+
 Json::Value SotaUptaneClient::AssembleManifest() {
   Json::Value manifest;  // signed top-level
   Uptane::EcuSerial primary_ecu_serial = primaryEcuSerial();
@@ -322,45 +409,73 @@ Json::Value SotaUptaneClient::AssembleManifest() {
   }
   version_manifest[primary_ecu_serial.ToString()] = uptane_manifest->sign(primary_manifest, report_counter);
 
-  for (auto it = secondaries.begin(); it != secondaries.end(); it++) {
-    const Uptane::EcuSerial &ecu_serial = it->first;
-    Uptane::Manifest secmanifest;
-    try {
-      secmanifest = it->second->getManifest();
-    } catch (const std::exception &ex) {
-      // Not critical; it might just be temporarily offline.
-      LOG_DEBUG << "Failed to get manifest from Secondary with serial " << ecu_serial << ": " << ex.what();
+  // Ask all the Secondaries at once, so that unreachable ones don't hold up
+  // the others, and wait for each of them until the same deadline. Secondaries
+  // that are still busy with a request that missed an earlier deadline are
+  // not asked again.
+  for (auto it = late_manifest_requests_.begin(); it != late_manifest_requests_.end();) {
+    if (it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      it = late_manifest_requests_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  std::vector<std::pair<Uptane::EcuSerial, std::future<SecondaryManifest>>> requests;
+  for (const auto &sec : secondaries) {
+    if (late_manifest_requests_.count(sec.first) != 0 || !secondary_health_.available(sec.first)) {
+      requests.emplace_back(sec.first, std::future<SecondaryManifest>());
+      continue;
+    }
+    requests.emplace_back(sec.first, std::async(std::launch::async, getSecondaryManifest, sec.second));
+  }
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(config.uptane.secondary_manifest_timeout_sec);
+
+  for (auto &request : requests) {
+    const Uptane::EcuSerial &ecu_serial = request.first;
+    SecondaryManifest secmanifest;
+    if (request.second.valid()) {
+      if (request.second.wait_until(deadline) == std::future_status::ready) {
+        secmanifest = request.second.get();
+      } else {
+        LOG_DEBUG << "Secondary with serial " << ecu_serial << " did not send its manifest in time";
+        late_manifest_requests_.emplace(ecu_serial, std::move(request.second));
+      }
+      if (secmanifest.manifest.empty()) {
+        secondary_health_.reportFailure(ecu_serial);
+      } else {
+        secondary_health_.reportSuccess(ecu_serial);
+      }
     }
 
     bool from_cache = false;
-    if (secmanifest.empty()) {
+    if (secmanifest.manifest.empty()) {
       // Could not get the Secondary manifest directly, so just use a cached value.
       std::string cached;
       if (storage->loadCachedEcuManifest(ecu_serial, &cached)) {
         LOG_WARNING << "Could not reach Secondary " << ecu_serial << ", sending a cached version of its manifest";
-        secmanifest = Utils::parseJSON(cached);
+        secmanifest.manifest = Utils::parseJSON(cached);
         from_cache = true;
+        try {
+          secmanifest.verified = secmanifest.manifest.verifySignature(secondaries.at(ecu_serial)->getPublicKey());
+        } catch (const std::exception &ex) {
+          LOG_ERROR << "Failed to get public key from Secondary with serial " << ecu_serial << ": " << ex.what();
+        }
       } else {
         LOG_ERROR << "Failed to get a valid manifest from Secondary with serial " << ecu_serial << " or from cache!";
         continue;
       }
     }
 
-    bool verified = false;
-    try {
-      verified = secmanifest.verifySignature(it->second->getPublicKey());
-    } catch (const std::exception &ex) {
-      LOG_ERROR << "Failed to get public key from Secondary with serial " << ecu_serial << ": " << ex.what();
-    }
-    if (verified) {
-      version_manifest[ecu_serial.ToString()] = secmanifest;
+    if (secmanifest.verified) {
+      version_manifest[ecu_serial.ToString()] = secmanifest.manifest;
       if (!from_cache) {
-        storage->storeCachedEcuManifest(ecu_serial, Utils::jsonToCanonicalStr(secmanifest));
+        storage->storeCachedEcuManifest(ecu_serial, Utils::jsonToCanonicalStr(secmanifest.manifest));
       }
     } else {
       // TODO(OTA-4305): send a corresponding event/report in this case
       LOG_ERROR << "Invalid manifest or signature reported by Secondary: "
-                << " serial: " << ecu_serial << " manifest: " << secmanifest;
+                << " serial: " << ecu_serial << " manifest: " << secmanifest.manifest;
     }
   }
   manifest["ecu_version_manifests"] = version_manifest;
@@ -407,13 +522,58 @@ Json::Value SotaUptaneClient::AssembleManifest() {
 bool SotaUptaneClient::hasPendingUpdates() const { return storage->hasPendingInstall(); }
 
 void SotaUptaneClient::initialize() {
+  initializeLocal();
+  finishInitialization();
+}
+
+void SotaUptaneClient::initializeLocal() {
+  metrics::ScopedTimer timer(startupTime("prepare"));
   provisioner_.Prepare();
 
   uptane_manifest = std::make_shared<Uptane::ManifestIssuer>(key_manager_, provisioner_.PrimaryEcuSerial());
+}
+
+void SotaUptaneClient::finishInitialization() {
+  {
+    metrics::ScopedTimer timer(startupTime("finalize_after_reboot"));
+    finalizeAfterReboot();
+  }
+  {
+    metrics::ScopedTimer timer(startupTime("provision"));
+    attemptProvision();
+  }
+  startSecondaryCache();
+}
 
-  finalizeAfterReboot();
+void SotaUptaneClient::startSecondaryCache() {
+  const PackageConfig &pacman = config.pacman;
+  if (pacman.secondary_cache_address.empty() || secondary_cache_ != nullptr) {
+    return;
+  }
+  try {
+    secondary_cache_ =
+        std_::make_unique<SecondaryCache>(http, pacman.ostree_server, pacman.secondary_cache_path,
+                                          pacman.secondary_cache_max_size, pacman.images_path,
+                                          pacman.secondary_cache_port);
+    secondary_provider_->setTreehubServer("http://" + pacman.secondary_cache_address + ":" +
+                                          std::to_string(secondary_cache_->port()));
+  } catch (const std::exception &e) {
+    LOG_ERROR << "Could not start the Secondary cache, Secondaries pull from Treehub directly: " << e.what();
+  }
+}
 
-  attemptProvision();
+void SotaUptaneClient::prefetchHardwareInfo() {
+  std::string stored_hash;
+  if (hardware_info_.valid() || !custom_hardware_info_.empty() ||
+      storage->loadDeviceDataHash("hardware_info", &stored_hash)) {
+    return;
+  }
+  hardware_info_ = std::async(std::launch::async, Utils::getHardwareInfo, hardwareInfoCache());
+}
+
+// lshw is only run once per boot, until the hardware information has been reported
+boost::filesystem::path SotaUptaneClient::hardwareInfoCache() const {
+  return config.storage.path / "hardware_info.json";
 }
 
 void SotaUptaneClient::requiresProvision() {
@@ -428,10 +588,27 @@ void SotaUptaneClient::requiresAlreadyProvisioned() {
   }
 }
 
+void SotaUptaneClient::setOfflineBundle(std::shared_ptr<const Uptane::OfflineBundle> bundle) {
+  if (bundle == nullptr) {
+    bundle_fetcher_.reset();
+    return;
+  }
+  LOG_INFO << "Taking updates from the offline bundle " << bundle->path();
+  bundle_fetcher_ = std::make_shared<Uptane::BundleFetcher>(std::move(bundle));
+}
+
+Uptane::IMetadataFetcher &SotaUptaneClient::metadataFetcher() {
+  if (bundle_fetcher_ != nullptr) {
+    return *bundle_fetcher_;
+  }
+  return *uptane_fetcher;
+}
+
 void SotaUptaneClient::updateDirectorMeta() {
+  tracing::Span span("updateDirectorMeta");
   requiresProvision();
   try {
-    director_repo.updateMeta(*storage, *uptane_fetcher, flow_control_);
+    director_repo.updateMeta(*storage, metadataFetcher(), flow_control_);
   } catch (const std::exception &e) {
     LOG_ERROR << "Director metadata update failed: " << e.what();
     throw;
@@ -439,19 +616,22 @@ void SotaUptaneClient::updateDirectorMeta() {
 }
 
 void SotaUptaneClient::updateImageMeta() {
+  tracing::Span span("updateImageMeta");
   requiresProvision();
   try {
-    image_repo.updateMeta(*storage, *uptane_fetcher, flow_control_);
+    image_repo.updateMeta(*storage, metadataFetcher(), flow_control_);
   } catch (const std::exception &e) {
     LOG_ERROR << "Failed to update Image repo metadata: " << e.what();
     throw;
   }
 }
 
+// Only metadata that changed in storage since it was last verified (by
+// fetchMeta() usually) is verified again, the rest is only checked for expiry.
 void SotaUptaneClient::checkDirectorMetaOffline() {
   requiresAlreadyProvisioned();
   try {
-    director_repo.checkMetaOffline(*storage);
+    director_repo.checkMetaOfflineIfChanged(*storage);
   } catch (const std::exception &e) {
     LOG_ERROR << "Failed to check Director metadata: " << e.what();
     throw;
@@ -461,7 +641,7 @@ void SotaUptaneClient::checkDirectorMetaOffline() {
 void SotaUptaneClient::checkImageMetaOffline() {
   requiresAlreadyProvisioned();
   try {
-    image_repo.checkMetaOffline(*storage);
+    image_repo.checkMetaOfflineIfChanged(*storage);
   } catch (const std::exception &e) {
     LOG_ERROR << "Failed to check Image repo metadata: " << e.what();
   }
@@ -540,6 +720,7 @@ void SotaUptaneClient::computeDeviceInstallationResult(data::InstallationResult
 }
 
 void SotaUptaneClient::getNewTargets(std::vector<Uptane::Target> *new_targets, unsigned int *ecus_count) {
+  tracing::Span span("getNewTargets");
   const std::vector<Uptane::Target> targets = director_repo.getTargets().targets;
   const Uptane::EcuSerial primary_ecu_serial = primaryEcuSerial();
   if (ecus_count != nullptr) {
@@ -610,42 +791,25 @@ void SotaUptaneClient::getNewTargets(std::vector<Uptane::Target> *new_targets, u
 
 // NOLINTNEXTLINE(misc-no-recursion)
 std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetHelper(const Uptane::Targets &cur_targets,
+                                                                   const std::string &cur_path,
                                                                    const Uptane::Target &queried_target,
                                                                    const int level, const bool terminating,
                                                                    const bool offline) {
-  TargetCompare target_comp(queried_target);
-  const auto it = std::find_if(cur_targets.targets.cbegin(), cur_targets.targets.cend(), target_comp);
-  if (it != cur_targets.targets.cend()) {
-    return std_::make_unique<Uptane::Target>(*it);
+  const Uptane::Target *found = cur_targets.findMatchingTarget(queried_target);
+  if (found != nullptr) {
+    return std_::make_unique<Uptane::Target>(*found);
   }
 
   if (terminating || level >= Uptane::kDelegationsMaxDepth) {
     return std::unique_ptr<Uptane::Target>(nullptr);
   }
 
-  for (const auto &delegate_name : cur_targets.delegated_role_names_) {
+  // only the delegations with a path pattern that matches the target name
+  for (const auto &delegate_name : cur_targets.delegationsFor(queried_target.filename())) {
     Uptane::Role delegate_role = Uptane::Role::Delegation(delegate_name);
-    auto patterns = cur_targets.paths_for_role_.find(delegate_role);
-    if (patterns == cur_targets.paths_for_role_.end()) {
-      continue;
-    }
-
-    bool match = false;
-    for (const auto &pattern : patterns->second) {
-      if (fnmatch(pattern.c_str(), queried_target.filename().c_str(), 0) == 0) {
-        match = true;
-        break;
-      }
-    }
-    if (!match) {
-      continue;
-    }
-
-    // Target name matches one of the patterns
-
-    auto delegation = Uptane::getTrustedDelegation(delegate_role, cur_targets, image_repo, *storage, *uptane_fetcher,
-                                                   offline, flow_control_);
-    if (delegation.isExpired(TimeStamp::Now())) {
+    auto delegation = Uptane::getTrustedDelegation(delegate_role, cur_targets, cur_path, image_repo, *storage,
+                                                   metadataFetcher(), offline, flow_control_);
+    if (delegation->isExpired(TimeStamp::Now())) {
       continue;
     }
 
@@ -655,7 +819,8 @@ std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetHelper(const Uptane:
     }
 
     // NOLINTNEXTLINE(misc-no-recursion)
-    auto found_target = findTargetHelper(delegation, queried_target, level + 1, is_terminating->second, offline);
+    auto found_target = findTargetHelper(*delegation, cur_path + "/" + delegate_name, queried_target, level + 1,
+                                         is_terminating->second, offline);
     if (found_target != nullptr) {
       return found_target;
     }
@@ -671,10 +836,12 @@ std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetInDelegationTree(con
     return std::unique_ptr<Uptane::Target>(nullptr);
   }
 
-  return findTargetHelper(*toplevel_targets, target, 0, false, offline);
+  return findTargetHelper(*toplevel_targets, Uptane::Role::Targets().ToString(), target, 0, false, offline);
 }
 
-result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Target> &targets) {
+result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Target> &targets,
+                                                  PipelinedDownloads *pipeline) {
+  tracing::Span span("downloadImages");
   requiresAlreadyProvisioned();
   // Uptane step 4 - download all the images and verify them against the metadata (for OSTree - pull without
   // deploying)
@@ -689,6 +856,9 @@ result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Targ
     last_exception = std::current_exception();
     update_status = result::UpdateStatus::kError;
   }
+  if (pipeline != nullptr) {
+    pipeline->setChecked(update_status);
+  }
 
   if (update_status == result::UpdateStatus::kNoUpdatesAvailable) {
     result = result::Download({}, result::DownloadStatus::kNothingToDownload, "");
@@ -703,10 +873,64 @@ result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Targ
     return result;
   }
 
-  for (const auto &target : targets) {
-    auto res = downloadImage(target);
-    if (res.first) {
-      downloaded_targets.push_back(res.second);
+  try {
+    package_manager_->removeUnreferencedTargetFiles();
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not remove unreferenced images: " << e.what();
+  }
+
+  // Targets with the same content share the stored image. Only the first of
+  // them is downloaded, the others refer to its image afterwards, so that
+  // they don't write the same file concurrently.
+  std::vector<size_t> unique_targets;
+  std::vector<size_t> duplicate_targets;
+  std::set<std::pair<std::string, uint64_t>> contents;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (targets[i].hashes().empty() ||
+        contents.emplace(PackageManagerInterface::contentFilename(targets[i]), targets[i].length()).second) {
+      unique_targets.push_back(i);
+    } else {
+      duplicate_targets.push_back(i);
+    }
+  }
+
+  // Run up to max_parallel_downloads downloads at once. Each worker picks the
+  // next pending target, in the order of target_order_, until none are left.
+  // The results are collected in the original order of the targets.
+  unique_targets = target_order_.sort(targets, unique_targets);
+  const size_t workers_num = std::max<size_t>(
+      1U, std::min<size_t>(static_cast<size_t>(config.uptane.max_parallel_downloads), unique_targets.size()));
+  std::atomic<size_t> next_target{0};
+  // Not std::vector<bool>: the entries are written concurrently.
+  std::vector<uint8_t> succeeded(targets.size(), 0);
+  auto worker = [this, &targets, &unique_targets, &next_target, &succeeded, pipeline]() {
+    for (size_t i = next_target++; i < unique_targets.size(); i = next_target++) {
+      const Uptane::Target &target = targets[unique_targets[i]];
+      succeeded[unique_targets[i]] = downloadImage(target).first ? 1 : 0;
+      if (pipeline != nullptr) {
+        pipeline->setDone(target, succeeded[unique_targets[i]] != 0);
+      }
+    }
+  };
+
+  std::vector<std::future<void>> workers;
+  for (size_t i = 1; i < workers_num; ++i) {
+    workers.push_back(std::async(std::launch::async, worker));
+  }
+  worker();
+  for (auto &w : workers) {
+    w.get();
+  }
+  for (const size_t i : duplicate_targets) {
+    succeeded[i] = downloadImage(targets[i]).first ? 1 : 0;
+    if (pipeline != nullptr) {
+      pipeline->setDone(targets[i], succeeded[i] != 0);
+    }
+  }
+
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (succeeded[i] != 0) {
+      downloaded_targets.push_back(targets[i]);
     }
   }
 
@@ -728,6 +952,55 @@ result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Targ
   return result;
 }
 
+void SotaUptaneClient::removeStaleTargets() {
+  if (config.pacman.images_retention == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(download_mutex);
+  // don't compete with foreground work for the disk
+  IdleIoPriority io_priority;
+
+  // Targets of the Director may have been downloaded and not be installed yet
+  std::set<std::string> keep;
+  for (const auto &target : director_repo.getTargets().targets) {
+    keep.insert(target.filename());
+  }
+  EcuSerials serials;
+  storage->loadEcuSerials(&serials);
+  for (const auto &ecu : serials) {
+    const std::string serial = ecu.first.ToString();
+    boost::optional<Uptane::Target> current_version;
+    boost::optional<Uptane::Target> pending_version;
+    storage->loadInstalledVersions(serial, &current_version, &pending_version);
+    if (current_version) {
+      keep.insert(current_version->filename());
+    }
+    if (pending_version) {
+      keep.insert(pending_version->filename());
+    }
+    std::vector<Uptane::Target> log;
+    storage->loadInstallationLog(serial, &log, true);
+    std::set<std::string> recent;
+    for (auto it = log.crbegin(); it != log.crend() && recent.size() < config.pacman.images_retention; ++it) {
+      recent.insert(it->filename());
+    }
+    keep.insert(recent.cbegin(), recent.cend());
+  }
+
+  for (const auto &target : package_manager_->getTargetFiles()) {
+    if (keep.count(target.filename()) != 0) {
+      continue;
+    }
+    LOG_INFO << "Removing the stale image of " << target.filename();
+    try {
+      package_manager_->removeTargetFile(target);
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Could not remove the image of " << target.filename() << ": " << e.what();
+    }
+  }
+  package_manager_->removeUnreferencedTargetFiles();
+}
+
 void SotaUptaneClient::reportPause() {
   auto correlation_id = director_repo.getCorrelationId();
   report_queue->enqueue(std_::make_unique<DevicePausedReport>(correlation_id));
@@ -738,12 +1011,27 @@ void SotaUptaneClient::reportResume() {
   report_queue->enqueue(std_::make_unique<DeviceResumedReport>(correlation_id));
 }
 
+std::shared_ptr<KeyManager> SotaUptaneClient::tlsKeys() {
+  std::lock_guard<std::mutex> guard(tls_keys_mutex_);
+  const uint64_t generation = provisioner_.TlsCredsGeneration();
+  if (tls_keys_ == nullptr || generation != tls_keys_generation_) {
+    // a download that still uses the previous ones keeps them until it is done
+    auto keys = std::make_shared<KeyManager>(storage, config.keymanagerConfig());
+    keys->loadKeys();
+    tls_keys_ = std::move(keys);
+    tls_keys_generation_ = generation;
+  }
+  return tls_keys_;
+}
+
 std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Target &target) {
   auto correlation_id = director_repo.getCorrelationId();
   // send an event for all ECUs that are touched by this target
+  std::vector<std::unique_ptr<ReportEvent>> started_reports;
   for (const auto &ecu : target.ecus()) {
-    report_queue->enqueue(std_::make_unique<EcuDownloadStartedReport>(ecu.first, correlation_id));
+    started_reports.push_back(std_::make_unique<EcuDownloadStartedReport>(ecu.first, correlation_id));
   }
+  report_queue->enqueue(std::move(started_reports));
 
   // Note: handle exceptions from here so that we can send reports and
   // DownloadTargetComplete events in all cases. We might want to move these to
@@ -751,32 +1039,42 @@ std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Ta
 
   bool success = false;
   try {
-    KeyManager keys(storage, config.keymanagerConfig());
-    keys.loadKeys();
+    const std::shared_ptr<KeyManager> keys = tlsKeys();
     auto prog_cb = [this](const Uptane::Target &t, const std::string &description, unsigned int progress) {
       report_progress_cb(events_channel.get(), t, description, progress);
     };
 
     const Uptane::EcuSerial &primary_ecu_serial = primaryEcuSerial();
 
-    if (target.IsForEcu(primary_ecu_serial) || !target.IsOstree()) {
-      const int max_tries = 3;
+    if (bundle_fetcher_ != nullptr) {
+      const auto start = std::chrono::steady_clock::now();
+      success = package_manager_->fetchTargetFromBundle(target, bundle_fetcher_->bundle(), prog_cb, flow_control_);
+      update_performance_.recordDownload(correlation_id, target, millisecondsSince(start), 1, success);
+      if (!success) {
+        throw Uptane::TargetHashMismatch(target.filename());
+      }
+    } else if (isCutThrough(target) && package_manager_->verifyTarget(target) != TargetStatus::kGood) {
+      LOG_INFO << "Target " << target.filename() << " will be streamed to its Secondary during the installation";
+      success = true;
+    } else if (target.IsForEcu(primary_ecu_serial) || !target.IsOstree()) {
       int tries = 0;
-      std::chrono::milliseconds wait(500);
+      const auto start = std::chrono::steady_clock::now();
 
-      for (; tries < max_tries; tries++) {
-        success = package_manager_->fetchTarget(target, *uptane_fetcher, keys, prog_cb, flow_control_);
+      download_retries_.onRequest();
+      for (;;) {
+        success = package_manager_->fetchTarget(target, *uptane_fetcher, *keys, prog_cb, flow_control_);
         // Skip trying to fetch the 'target' if control flow token transaction
         // was set to the 'abort' or 'pause' state, see the CommandQueue and FlowControlToken.
-        if (success || (flow_control_ != nullptr && flow_control_->hasAborted())) {
+        if (success || (flow_control_ != nullptr && flow_control_->hasAborted()) ||
+            !download_retries_.allowRetry(tries)) {
           break;
-        } else if (tries < max_tries - 1) {
-          std::this_thread::sleep_for(wait);
-          wait *= 2;
         }
+        std::this_thread::sleep_for(download_retries_.delay(tries));
+        ++tries;
       }
+      update_performance_.recordDownload(correlation_id, target, millisecondsSince(start), tries + 1, success);
       if (!success) {
-        LOG_ERROR << "Download unsuccessful after " << tries << " attempts.";
+        LOG_ERROR << "Download unsuccessful after " << (tries + 1) << " attempts.";
         // TODO: Throw more meaningful exceptions. Failure can be caused by more
         // than just a hash mismatch. However, this is purely internal and
         // mostly just relevant for testing.
@@ -788,20 +1086,44 @@ std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Ta
     }
   } catch (const std::exception &e) {
     LOG_ERROR << "Error downloading image: " << e.what();
+    // Several downloads may be running at the same time.
+    std::lock_guard<std::mutex> guard(last_exception_mutex);
     last_exception = std::current_exception();
   }
 
   // send this asynchronously before `sendEvent`, so that the report timestamp
   // would not be delayed by callbacks on events
+  std::vector<std::unique_ptr<ReportEvent>> completed_reports;
   for (const auto &ecu : target.ecus()) {
-    report_queue->enqueue(std_::make_unique<EcuDownloadCompletedReport>(ecu.first, correlation_id, success));
+    completed_reports.push_back(std_::make_unique<EcuDownloadCompletedReport>(ecu.first, correlation_id, success));
   }
+  report_queue->enqueue(std::move(completed_reports));
 
   sendEvent<event::DownloadTargetComplete>(target, success);
   return {success, target};
 }
 
+bool SotaUptaneClient::isCutThrough(const Uptane::Target &target) const {
+  if (!config.pacman.secondary_cut_through || target.IsOstree() || target.ecus().size() != 1) {
+    return false;
+  }
+  const auto sec = secondaries.find(target.ecus().cbegin()->first);
+  return sec != secondaries.cend() && sec->second->acceptsTargetStream();
+}
+
 void SotaUptaneClient::uptaneIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count) {
+  // The Image repo metadata is verified on its own, so it may be refreshed
+  // while the Director metadata is. It is only used if there are new targets,
+  // and a failure is reported only then.
+  std::future<void> image_meta;
+  if (config.uptane.speculative_image_meta) {
+    requiresProvision();
+    image_meta = std::async(std::launch::async, [this]() {
+      tracing::Span span("updateImageMeta");
+      image_repo.updateMeta(*storage, metadataFetcher(), flow_control_);
+    });
+  }
+
   updateDirectorMeta();
   if (flow_control_ != nullptr && flow_control_->hasAborted()) {
     return;
@@ -818,7 +1140,16 @@ void SotaUptaneClient::uptaneIteration(std::vector<Uptane::Target> *targets, uns
 
   if (!tmp_targets.empty()) {
     LOG_INFO << "New updates found in Director metadata. Checking Image repo metadata...";
-    updateImageMeta();
+    if (image_meta.valid()) {
+      try {
+        image_meta.get();
+      } catch (const std::exception &e) {
+        LOG_ERROR << "Failed to update Image repo metadata: " << e.what();
+        throw;
+      }
+    } else {
+      updateImageMeta();
+    }
   }
 
   if (targets != nullptr) {
@@ -857,9 +1188,17 @@ void SotaUptaneClient::uptaneOfflineIteration(std::vector<Uptane::Target> *targe
 void SotaUptaneClient::sendDeviceData() {
   requiresProvision();
 
+  // Collecting the data takes longer than reporting it (lshw, the package
+  // database): do it for all the sections at once, then report them in turn.
+  // Only what changed since the last report is sent.
+  prefetchHardwareInfo();
+  auto packages_hash =
+      std::async(std::launch::async, [this] { return package_manager_->getInstalledPackagesHash(); });
+  auto network_info = std::async(std::launch::async, [this] { return collectNetworkInfo(); });
+
   reportHwInfo();
-  reportInstalledPackages();
-  reportNetworkInfo();
+  reportInstalledPackages(packages_hash.get());
+  reportNetworkInfo(network_info.get());
   reportAktualizrConfiguration();
   sendEvent<event::SendDeviceDataComplete>();
 }
@@ -869,7 +1208,9 @@ result::UpdateCheck SotaUptaneClient::fetchMeta() {
 
   result::UpdateCheck result;
 
-  reportNetworkInfo();
+  if (bundle_fetcher_ == nullptr) {
+    reportNetworkInfo();
+  }
 
   if (hasPendingUpdates()) {
     // if there are some pending updates check if the Secondaries' pending updates have been applied
@@ -886,7 +1227,7 @@ result::UpdateCheck SotaUptaneClient::fetchMeta() {
   }
 
   // Uptane step 1 (build the vehicle version manifest):
-  if (!putManifestSimple()) {
+  if (bundle_fetcher_ == nullptr && !putManifestSimple()) {
     LOG_ERROR << "Error sending manifest!";
   }
   result = checkUpdates();
@@ -956,6 +1297,19 @@ result::UpdateCheck SotaUptaneClient::checkUpdates() {
   } else {
     LOG_INFO << updates.size() << " new updates found in both Director and Image repo metadata.";
   }
+
+  if (config.pacman.ostree_prefetch) {
+    for (const auto &target : updates) {
+      if (!target.IsForEcu(primaryEcuSerial()) || !target.IsOstree()) {
+        continue;
+      }
+      try {
+        package_manager_->prefetchTarget(target, tlsKeys(), flow_control_);
+      } catch (const std::exception &e) {
+        LOG_WARNING << "Could not start the prefetch of " << target.filename() << ": " << e.what();
+      }
+    }
+  }
   return result;
 }
 
@@ -986,13 +1340,20 @@ result::UpdateStatus SotaUptaneClient::checkUpdatesOffline(const std::vector<Upt
     return result::UpdateStatus::kNoUpdatesAvailable;
   }
 
+  // Matching targets have the same filename (see Target::MatchTarget()), so
+  // only that one has to be compared.
+  std::unordered_map<std::string, const Uptane::Target *> director_index;
+  director_index.reserve(director_targets.size());
+  for (const auto &director_target : director_targets) {
+    director_index.emplace(director_target.filename(), &director_target);
+  }
+
   // For every target in the Director Targets metadata, walk the delegation
   // tree (if necessary) and find a matching target in the Image repo
   // metadata.
   for (const auto &target : targets) {
-    TargetCompare target_comp(target);
-    const auto it = std::find_if(director_targets.cbegin(), director_targets.cend(), target_comp);
-    if (it == director_targets.cend()) {
+    const auto it = director_index.find(target.filename());
+    if (it == director_index.cend() || !it->second->MatchTarget(target)) {
       LOG_ERROR << "No matching target in Director Targets metadata for " << target;
       throw Uptane::Exception(Uptane::RepositoryType::Director(), "No matching target in Director Targets metadata");
     }
@@ -1007,7 +1368,8 @@ result::UpdateStatus SotaUptaneClient::checkUpdatesOffline(const std::vector<Upt
   return result::UpdateStatus::kUpdatesAvailable;
 }
 
-result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target> &updates) {
+result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target> &updates,
+                                                PipelinedDownloads *pipeline) {
   requiresAlreadyProvisioned();
   auto correlation_id = director_repo.getCorrelationId();
 
@@ -1016,14 +1378,15 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
   result::Install r;
   std::string raw_report;
 
-  std::tie(r, raw_report) = [this, &updates, &correlation_id]() -> std::tuple<result::Install, std::string> {
+  std::tie(r, raw_report) = [this, &updates, &correlation_id,
+                              pipeline]() -> std::tuple<result::Install, std::string> {
     result::Install result;
 
     // Recheck the Uptane metadata and make sure the requested updates are
     // consistent with the stored metadata.
     result::UpdateStatus update_status;
     try {
-      update_status = checkUpdatesOffline(updates);
+      update_status = (pipeline != nullptr) ? pipeline->waitChecked() : checkUpdatesOffline(updates);
     } catch (const std::exception &e) {
       last_exception = std::current_exception();
       update_status = result::UpdateStatus::kError;
@@ -1039,15 +1402,11 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
     }
 
     Uptane::EcuSerial primary_ecu_serial = primaryEcuSerial();
-    // Recheck the downloaded update hashes.
-    for (const auto &update : updates) {
-      if (update.IsForEcu(primary_ecu_serial) || !update.IsOstree()) {
-        // download binary images for any target, for both Primary and Secondary
-        // download an OSTree revision just for Primary, Secondary will do it by itself
-        // Primary cannot verify downloaded OSTree targets for Secondaries,
-        // Downloading of Secondary's OSTree repo revision to the Primary's can fail
-        // if they differ signficantly as OSTree has a certain cap/limit of the diff it pulls
-        if (package_manager_->verifyTarget(update) != TargetStatus::kGood) {
+    // Recheck the downloaded update hashes. Pipelined images are checked one
+    // by one as their download ends.
+    if (pipeline == nullptr) {
+      for (const auto &update : updates) {
+        if (!verifyDownloadedTarget(update, nullptr).isSuccess()) {
           result.dev_report = {false, data::ResultCode::Numeric::kInternalError, ""};
           return std::make_tuple(result, "Downloaded target is invalid");
         }
@@ -1076,18 +1435,30 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
     }
 
     //   7 - send images to ECUs (deploy for OSTree)
-    if (!primary_updates.empty()) {
+    auto install_primary = [this, &result, &primary_updates, &primary_ecu_serial, &correlation_id, pipeline]() {
+      if (primary_updates.empty()) {
+        LOG_INFO << "No update to install on Primary";
+        return;
+      }
       // assuming one OSTree OS per Primary => there can be only one OSTree update
       Uptane::Target primary_update = primary_updates[0];
 
       report_queue->enqueue(std_::make_unique<EcuInstallationStartedReport>(primary_ecu_serial, correlation_id));
       sendEvent<event::InstallStarted>(primary_ecu_serial);
 
-      data::InstallationResult install_res;
-      // notify the bootloader before installation happens, because installation is not atomic and
-      //   a false notification doesn't hurt when rollbacks are implemented
-      package_manager_->updateNotify();
-      install_res = PackageInstallSetResult(primary_update, correlation_id);
+      data::InstallationResult install_res(data::ResultCode::Numeric::kOk, "");
+      if (pipeline != nullptr) {
+        install_res = verifyDownloadedTarget(primary_update, pipeline);
+      }
+      if (install_res.isSuccess()) {
+        // notify the bootloader before installation happens, because installation is not atomic and
+        //   a false notification doesn't hurt when rollbacks are implemented
+        package_manager_->updateNotify();
+        const auto start = std::chrono::steady_clock::now();
+        install_res = PackageInstallSetResult(primary_update, correlation_id);
+        update_performance_.recordInstall(correlation_id, primary_ecu_serial, primary_update,
+                                          millisecondsSince(start), install_res.result_code);
+      }
       if (install_res.result_code.num_code == data::ResultCode::Numeric::kNeedCompletion) {
         // update needs a reboot, send distinct EcuInstallationApplied event
         report_queue->enqueue(std_::make_unique<EcuInstallationAppliedReport>(primary_ecu_serial, correlation_id));
@@ -1105,12 +1476,17 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
         sendEvent<event::InstallTargetComplete>(primary_ecu_serial, false);
       }
       result.ecu_reports.emplace(result.ecu_reports.begin(), primary_update, primary_ecu_serial, install_res);
-    } else {
-      LOG_INFO << "No update to install on Primary";
-    }
+    };
 
-    auto sec_reports = sendImagesToEcus(updates);
+    // the Secondaries don't wait for the download of the Primary's update
+    if (pipeline == nullptr) {
+      install_primary();
+    }
+    auto sec_reports = sendImagesToEcus(updates, pipeline);
     result.ecu_reports.insert(result.ecu_reports.end(), sec_reports.begin(), sec_reports.end());
+    if (pipeline != nullptr) {
+      install_primary();
+    }
     computeDeviceInstallationResult(&result.dev_report, &rr);
 
     return std::make_tuple(result, rr);
@@ -1118,21 +1494,56 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
 
   storage->storeDeviceInstallationResult(r.dev_report, raw_report, correlation_id);
 
+  Json::Value performance = update_performance_.take(correlation_id);
+  if (config.telemetry.report_performance && !performance.isNull()) {
+    report_queue->enqueue(std_::make_unique<UpdatePerformanceReport>(correlation_id, std::move(performance)));
+  }
+
   sendEvent<event::AllInstallsComplete>(r);
 
   return r;
 }
 
+std::pair<result::Download, result::Install> SotaUptaneClient::downloadAndInstall(
+    const std::vector<Uptane::Target> &updates) {
+  PipelinedDownloads pipeline;
+  auto download = std::async(std::launch::async, [this, &updates, &pipeline]() {
+    try {
+      result::Download res = downloadImages(updates, &pipeline);
+      pipeline.finish();
+      return res;
+    } catch (...) {
+      pipeline.finish();
+      throw;
+    }
+  });
+
+  // the installation runs alongside the downloads, and the future waits for
+  // them if it throws
+  result::Install install;
+  if (pipeline.waitChecked() == result::UpdateStatus::kUpdatesAvailable) {
+    install = uptaneInstall(updates, &pipeline);
+  }
+  return {download.get(), install};
+}
+
 result::CampaignCheck SotaUptaneClient::campaignCheck() {
   requiresProvision();
 
-  auto campaigns = campaign::Campaign::fetchAvailableCampaigns(*http, config.tls.server);
-  for (const auto &c : campaigns) {
-    LOG_INFO << "Campaign: " << c.name;
-    LOG_INFO << "Campaign id: " << c.id;
-    LOG_INFO << "Campaign size: " << c.size;
-    LOG_INFO << "CampaignAccept required: " << (c.autoAccept ? "no" : "yes");
-    LOG_INFO << "Message: " << c.description;
+  std::vector<campaign::Campaign> campaigns;
+  {
+    std::lock_guard<std::mutex> guard(campaigns_mutex_);
+    if (campaign::Campaign::fetchAvailableCampaignsIfModified(*http, config.tls.server, &campaigns_validators_,
+                                                              &campaigns_)) {
+      for (const auto &c : campaigns_) {
+        LOG_INFO << "Campaign: " << c.name;
+        LOG_INFO << "Campaign id: " << c.id;
+        LOG_INFO << "Campaign size: " << c.size;
+        LOG_INFO << "CampaignAccept required: " << (c.autoAccept ? "no" : "yes");
+        LOG_INFO << "Message: " << c.description;
+      }
+    }
+    campaigns = campaigns_;
   }
   result::CampaignCheck result(campaigns);
   sendEvent<event::CampaignCheckComplete>(result);
@@ -1192,14 +1603,53 @@ bool SotaUptaneClient::putManifestSimple(const Json::Value &custom) {
   if (!custom.empty()) {
     manifest["custom"] = custom;
   }
-  auto signed_manifest = uptane_manifest->sign(manifest);
-  HttpResponse response = http->put(config.uptane.director_server + "/manifest", signed_manifest);
+  auto ecu_digests = ecu_manifest_digests(manifest["ecu_version_manifests"]);
+  const std::string custom_str = custom.empty() ? std::string() : Utils::jsonToCanonicalStr(custom);
+  const bool has_report = manifest.isMember("installation_report");
+
+  std::lock_guard<std::mutex> guard(manifest_mutex_);
+  if (config.uptane.skip_unchanged_manifest && !has_report && ecu_digests == sent_ecu_manifests_ &&
+      custom_str == sent_custom_) {
+    LOG_DEBUG << "The manifest has not changed since the server accepted it, not sending it again";
+    return true;
+  }
+
+  // Only the ECU manifests that changed, and always the Primary's, if the
+  // server has the others already
+  bool partial = config.uptane.partial_manifests && partial_manifests_supported_ && !sent_ecu_manifests_.empty() &&
+                 std::all_of(sent_ecu_manifests_.cbegin(), sent_ecu_manifests_.cend(),
+                             [&ecu_digests](const std::pair<const std::string, std::string> &sent) {
+                               return ecu_digests.count(sent.first) != 0;
+                             });
+  HttpResponse response;
+  if (partial) {
+    Json::Value partial_manifest = manifest;
+    const std::string primary_serial = primaryEcuSerial().ToString();
+    for (const auto &digest : ecu_digests) {
+      if (digest.first != primary_serial && sent_ecu_manifests_[digest.first] == digest.second) {
+        partial_manifest["ecu_version_manifests"].removeMember(digest.first);
+      }
+    }
+    partial_manifest["partial"] = true;
+    response = http->put(config.uptane.director_server + "/manifest", uptane_manifest->sign(partial_manifest));
+    if (response.curl_code == CURLE_OK && response.http_status_code >= 400 && response.http_status_code < 500) {
+      LOG_INFO << "The server does not take partial manifests (HTTP " << response.http_status_code
+               << "), sending full ones from now on";
+      partial_manifests_supported_ = false;
+      partial = false;
+    }
+  }
+  if (!partial) {
+    response = http->put(config.uptane.director_server + "/manifest", uptane_manifest->sign(manifest));
+  }
   if (response.isOk()) {
     if (!connected) {
       LOG_INFO << "Connectivity is restored.";
     }
     connected = true;
     storage->clearInstallationResults();
+    sent_ecu_manifests_ = std::move(ecu_digests);
+    sent_custom_ = custom_str;
 
     return true;
   } else {
@@ -1211,6 +1661,7 @@ bool SotaUptaneClient::putManifestSimple(const Json::Value &custom) {
 }
 
 bool SotaUptaneClient::putManifest(const Json::Value &custom) {
+  tracing::Span span("putManifest");
   requiresProvision();
 
   bool success = putManifestSimple(custom);
@@ -1249,12 +1700,9 @@ bool SotaUptaneClient::waitSecondariesReachable(const std::vector<Uptane::Target
     }
 
     for (auto sec_it = targeted_secondaries.begin(); sec_it != targeted_secondaries.end();) {
-      bool connected = false;
-      try {
-        connected = sec_it->second->ping();
-      } catch (const std::exception &ex) {
-        LOG_DEBUG << "Failed to ping Secondary with serial " << sec_it->first << ": " << ex.what();
-      }
+      // Secondaries that are known to be down are only pinged again once
+      // their backoff has elapsed
+      const bool connected = secondary_health_.available(sec_it->first) && pingSecondary(*sec_it->second);
       if (connected) {
         sec_it = targeted_secondaries.erase(sec_it);
       } else {
@@ -1305,14 +1753,16 @@ data::InstallationResult SotaUptaneClient::rotateSecondaryRoot(Uptane::Repositor
   }
 
   // Only send intermediate Roots that would otherwise be skipped. The latest
-  // will be sent with the complete set of the latest metadata.
+  // will be sent with the complete set of the latest metadata. They all go in
+  // one request to the Secondaries that support it.
+  std::vector<std::string> roots;
   for (int version_to_send = sec_root_version + 1; version_to_send < last_root_version; version_to_send++) {
     std::string root;
     if (!storage->loadRoot(&root, repo, Uptane::Version(version_to_send))) {
       LOG_WARNING << "Couldn't find Root metadata in the storage, trying remote repo";
       try {
-        uptane_fetcher->fetchRole(&root, Uptane::kMaxRootSize, repo, Uptane::Role::Root(),
-                                  Uptane::Version(version_to_send), flow_control_);
+        metadataFetcher().fetchRole(&root, Uptane::kMaxRootSize, repo, Uptane::Role::Root(),
+                                    Uptane::Version(version_to_send), flow_control_);
       } catch (const std::exception &e) {
         LOG_ERROR << "Root metadata could not be fetched for Secondary with serial " << secondary.getSerial()
                   << ", skipping to the next Secondary";
@@ -1321,8 +1771,15 @@ data::InstallationResult SotaUptaneClient::rotateSecondaryRoot(Uptane::Repositor
                     ", skipping to the next Secondary"};
       }
     }
-    try {
-      auto result = secondary.putRoot(root, repo == Uptane::RepositoryType::Director());
+    roots.push_back(std::move(root));
+  }
+  if (roots.empty()) {
+    return {data::ResultCode::Numeric::kOk, ""};
+  }
+
+  try {
+    if (sec_root_version == 0) {
+      auto result = secondary.putRoot(roots.front(), repo == Uptane::RepositoryType::Director());
       if (!result.isSuccess()) {
         // Old (pre 2024-07-XX) versions would assume that if sec_root_version
         // is 0, either the Secondary doesn't have Root metadata or doesn't
@@ -1334,62 +1791,155 @@ data::InstallationResult SotaUptaneClient::rotateSecondaryRoot(Uptane::Repositor
         // defending against: the secondary can't rotate root, and treat this
         // as a success. The previous code would have returned success in this
         // case anyway.
-        if (version_to_send == 1) {
-          LOG_WARNING
-              << "Sending root.1.json to a secondary failed. Assuming it doesn't allow root rotation and continuing.";
-          return {data::ResultCode::Numeric::kOk, ""};
-        }
-        LOG_ERROR << "Sending Root metadata to Secondary with serial " << secondary.getSerial()
-                  << " failed: " << result.result_code << " " << result.description;
-        return result;
+        LOG_WARNING
+            << "Sending root.1.json to a secondary failed. Assuming it doesn't allow root rotation and continuing.";
+        return {data::ResultCode::Numeric::kOk, ""};
       }
-    } catch (const std::exception &ex) {
-      return {data::ResultCode::Numeric::kInternalError, ex.what()};
+      roots.erase(roots.begin());
     }
+    auto result = secondary.putRootChain(roots, repo == Uptane::RepositoryType::Director());
+    if (!result.isSuccess()) {
+      LOG_ERROR << "Sending Root metadata to Secondary with serial " << secondary.getSerial()
+                << " failed: " << result.result_code << " " << result.description;
+    }
+    return result;
+  } catch (const std::exception &ex) {
+    return {data::ResultCode::Numeric::kInternalError, ex.what()};
   }
-  return {data::ResultCode::Numeric::kOk, ""};
+}
+
+// Runs `worker` in `count` threads. The calling thread is one of them, unless
+// the Secondary transfers have a scheduling policy of their own.
+static void runSecondaryWorkers(size_t count, const std::function<void()> &worker) {
+  const bool own_threads = ThreadPolicies::instance().has(ThreadPolicies::Worker::kSecondaries);
+  std::vector<std::future<void>> workers;
+  for (size_t i = own_threads ? 0 : 1; i < count; ++i) {
+    workers.push_back(std::async(std::launch::async, [&worker]() {
+      ThreadPolicies::instance().apply(ThreadPolicies::Worker::kSecondaries);
+      worker();
+    }));
+  }
+  if (!own_threads) {
+    worker();
+  }
+  for (auto &w : workers) {
+    w.get();
+  }
+}
+
+static data::InstallationResult secondaryUnreachable(const SecondaryInterface &secondary) {
+  return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                  "Secondary " + secondary.getSerial().ToString() + " is unreachable");
+}
+
+bool SotaUptaneClient::pingSecondary(SecondaryInterface &secondary) {
+  bool connected = false;
+  try {
+    connected = secondary.ping();
+  } catch (const std::exception &ex) {
+    LOG_DEBUG << "Failed to ping Secondary with serial " << secondary.getSerial() << ": " << ex.what();
+  }
+  if (connected) {
+    secondary_health_.reportSuccess(secondary.getSerial());
+  } else {
+    secondary_health_.reportFailure(secondary.getSerial());
+  }
+  return connected;
+}
+
+void SotaUptaneClient::updateSecondaryHealth(SecondaryInterface &secondary, const data::InstallationResult &result) {
+  // A failed request may just have been rejected, so ask the Secondary
+  // whether it is still there.
+  if (result.isSuccess() || result.needCompletion()) {
+    secondary_health_.reportSuccess(secondary.getSerial());
+  } else {
+    pingSecondary(secondary);
+  }
+}
+
+data::InstallationResult SotaUptaneClient::sendMetadataToSecondary(SecondaryInterface &secondary,
+                                                                   const Uptane::Target &target) {
+  tracing::Span span("sendMetadataToSecondary", secondary.getSerial().ToString());
+  if (!secondary_health_.available(secondary.getSerial())) {
+    return secondaryUnreachable(secondary);
+  }
+
+  auto send = [this, &secondary, &target]() {
+    /* Root rotation if necessary */
+    auto result = rotateSecondaryRoot(Uptane::RepositoryType::Director(), secondary);
+    if (!result.isSuccess()) {
+      return result;
+    }
+    result = rotateSecondaryRoot(Uptane::RepositoryType::Image(), secondary);
+    if (!result.isSuccess()) {
+      return result;
+    }
+    try {
+      return secondary.putMetadata(target);
+    } catch (const std::exception &ex) {
+      return data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+    }
+  };
+  auto result = send();
+  updateSecondaryHealth(secondary, result);
+  return result;
 }
 
 // TODO: the function blocks until it updates all the Secondaries. Consider non-blocking operation.
 void SotaUptaneClient::sendMetadataToEcus(const std::vector<Uptane::Target> &targets, data::InstallationResult *result,
                                           std::string *raw_installation_report) {
+  tracing::Span span("sendMetadataToEcus");
   data::InstallationResult final_result{data::ResultCode::Numeric::kOk, ""};
   std::string result_code_err_str;
+
+  struct EcuMetadata {
+    const Uptane::Target *target;
+    Uptane::HardwareIdentifier hw_id;
+    std::map<Uptane::EcuSerial, SecondaryInterface::Ptr>::iterator sec;
+    data::InstallationResult result;
+  };
+  std::vector<EcuMetadata> sends;
+  // Indexes into sends, grouped by Secondary: one Secondary gets its metadata
+  // in the order of the targets, while different ones are served in parallel.
+  std::vector<std::vector<size_t>> secondary_sends;
+  std::map<Uptane::EcuSerial, size_t> secondary_index;
   for (const auto &target : targets) {
     for (const auto &ecu : target.ecus()) {
-      const Uptane::EcuSerial ecu_serial = ecu.first;
-      const Uptane::HardwareIdentifier hw_id = ecu.second;
-      auto sec = secondaries.find(ecu_serial);
+      auto sec = secondaries.find(ecu.first);
       if (sec == secondaries.end()) {
         continue;
       }
+      auto index = secondary_index.emplace(ecu.first, secondary_sends.size());
+      if (index.second) {
+        secondary_sends.emplace_back();
+      }
+      secondary_sends[index.first->second].push_back(sends.size());
+      sends.push_back(EcuMetadata{&target, ecu.second, sec, data::InstallationResult()});
+    }
+  }
 
-      data::InstallationResult local_result{data::ResultCode::Numeric::kOk, ""};
-      do {
-        /* Root rotation if necessary */
-        local_result = rotateSecondaryRoot(Uptane::RepositoryType::Director(), *(sec->second));
-        if (!local_result.isSuccess()) {
-          final_result = local_result;
-          break;
-        }
-        local_result = rotateSecondaryRoot(Uptane::RepositoryType::Image(), *(sec->second));
-        if (!local_result.isSuccess()) {
-          final_result = local_result;
-          break;
-        }
-        try {
-          local_result = sec->second->putMetadata(target);
-        } catch (const std::exception &ex) {
-          local_result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
-        }
-      } while (false);
-      if (!local_result.isSuccess()) {
-        LOG_ERROR << "Sending metadata to " << sec->first << " failed: " << local_result.result_code << " "
-                  << local_result.description;
-        const std::string ecu_code_str = hw_id.ToString() + ":" + local_result.result_code.ToString();
-        result_code_err_str += (!result_code_err_str.empty() ? "|" : "") + ecu_code_str;
+  // Up to max_parallel_secondaries workers pick the next pending Secondary,
+  // like the downloads do.
+  const size_t workers_num = std::max<size_t>(
+      1U, std::min<size_t>(static_cast<size_t>(config.uptane.max_parallel_secondaries), secondary_sends.size()));
+  std::atomic<size_t> next_secondary{0};
+  auto worker = [this, &sends, &secondary_sends, &next_secondary]() {
+    for (size_t i = next_secondary++; i < secondary_sends.size(); i = next_secondary++) {
+      for (const size_t send : secondary_sends[i]) {
+        sends[send].result = sendMetadataToSecondary(*sends[send].sec->second, *sends[send].target);
       }
     }
+  };
+  runSecondaryWorkers(workers_num, worker);
+
+  for (const auto &send : sends) {
+    const data::InstallationResult &local_result = send.result;
+    if (!local_result.isSuccess()) {
+      LOG_ERROR << "Sending metadata to " << send.sec->first << " failed: " << local_result.result_code << " "
+                << local_result.description;
+      const std::string ecu_code_str = send.hw_id.ToString() + ":" + local_result.result_code.ToString();
+      result_code_err_str += (!result_code_err_str.empty() ? "|" : "") + ecu_code_str;
+    }
   }
 
   if (!result_code_err_str.empty()) {
@@ -1407,41 +1957,107 @@ void SotaUptaneClient::sendMetadataToEcus(const std::vector<Uptane::Target> &tar
   }
 }
 
-std::future<data::InstallationResult> SotaUptaneClient::sendFirmwareAsync(SecondaryInterface &secondary,
-                                                                          const Uptane::Target &target) {
-  auto f = [this, &secondary, target]() {
-    auto correlation_id = director_repo.getCorrelationId();
+data::InstallationResult SotaUptaneClient::checkDeltaBase(const Uptane::EcuSerial &serial,
+                                                          const Uptane::Target &target) {
+  const Json::Value custom = target.custom_data();
+  if (!custom.isObject() || !custom.isMember("delta")) {
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
+  std::string cached;
+  if (!storage->loadCachedEcuManifest(serial, &cached)) {
+    // nothing to compare with; the Secondary checks it anyway
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
+  const Hash installed = Uptane::Manifest(Utils::parseJSON(cached)).installedImageHash();
+  const Hash base(Hash::Type::kSha256, custom["delta"]["base_sha256"].asString());
+  if (installed != base) {
+    LOG_ERROR << "Delta image " << target.filename() << " does not apply to the image installed on Secondary "
+              << serial << ": " << base << " != " << installed;
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                    "The delta image does not apply to the installed image: " + base.HashString() +
+                                        " != " + installed.HashString());
+  }
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
 
-    sendEvent<event::InstallStarted>(secondary.getSerial());
-    report_queue->enqueue(std_::make_unique<EcuInstallationStartedReport>(secondary.getSerial(), correlation_id));
+data::InstallationResult SotaUptaneClient::verifyDownloadedTarget(const Uptane::Target &target,
+                                                                  PipelinedDownloads *pipeline) {
+  if (pipeline != nullptr && !pipeline->waitDone(target)) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Target download failed.");
+  }
+  if (target.IsForEcu(primaryEcuSerial()) || !target.IsOstree()) {
+    // download binary images for any target, for both Primary and Secondary
+    // download an OSTree revision just for Primary, Secondary will do it by itself
+    // Primary cannot verify downloaded OSTree targets for Secondaries,
+    // Downloading of Secondary's OSTree repo revision to the Primary's can fail
+    // if they differ signficantly as OSTree has a certain cap/limit of the diff it pulls
+    const auto cpu_start = UpdatePerformance::threadCpuTime();
+    const TargetStatus status = package_manager_->verifyTarget(target);
+    update_performance_.recordVerification(director_repo.getCorrelationId(), target,
+                                           UpdatePerformance::threadCpuTime() - cpu_start);
+    // images streamed to their Secondary are verified while they are sent
+    if (status != TargetStatus::kGood && !isCutThrough(target)) {
+      return data::InstallationResult(data::ResultCode::Numeric::kInternalError, "Downloaded target is invalid");
+    }
+  }
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
 
-    data::InstallationResult result;
+data::InstallationResult SotaUptaneClient::sendFirmwareToSecondary(SecondaryInterface &secondary,
+                                                                   const Uptane::Target &target) {
+  tracing::Span span("sendFirmwareToSecondary", secondary.getSerial().ToString());
+  auto correlation_id = director_repo.getCorrelationId();
+
+  sendEvent<event::InstallStarted>(secondary.getSerial());
+  report_queue->enqueue(std_::make_unique<EcuInstallationStartedReport>(secondary.getSerial(), correlation_id));
+
+  data::InstallationResult result;
+  if (!secondary_health_.available(secondary.getSerial())) {
+    result = secondaryUnreachable(secondary);
+  } else {
     try {
+      auto start = std::chrono::steady_clock::now();
       result = secondary.sendFirmware(target, flow_control_);
+      update_performance_.recordSecondaryTransfer(correlation_id, secondary.getSerial(), target,
+                                                  millisecondsSince(start), result.result_code);
       if (result.isSuccess()) {
+        start = std::chrono::steady_clock::now();
         result = secondary.install(target, flow_control_);
+        update_performance_.recordInstall(correlation_id, secondary.getSerial(), target, millisecondsSince(start),
+                                          result.result_code);
+      }
+      // only asked for when it is reported, as it's another request
+      if (config.telemetry.report_performance) {
+        const std::string metrics = secondary.getMetrics();
+        if (!metrics.empty()) {
+          update_performance_.recordSecondaryMetrics(correlation_id, secondary.getSerial(), metrics);
+        }
       }
     } catch (const std::exception &ex) {
       result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
     }
+    updateSecondaryHealth(secondary, result);
+  }
 
-    if (result.result_code == data::ResultCode::Numeric::kNeedCompletion) {
-      report_queue->enqueue(std_::make_unique<EcuInstallationAppliedReport>(secondary.getSerial(), correlation_id));
-    } else {
-      report_queue->enqueue(
-          std_::make_unique<EcuInstallationCompletedReport>(secondary.getSerial(), correlation_id, result.isSuccess()));
-    }
-
-    sendEvent<event::InstallTargetComplete>(secondary.getSerial(), result.isSuccess());
-    return result;
-  };
+  if (result.result_code == data::ResultCode::Numeric::kNeedCompletion) {
+    report_queue->enqueue(std_::make_unique<EcuInstallationAppliedReport>(secondary.getSerial(), correlation_id));
+  } else {
+    report_queue->enqueue(
+        std_::make_unique<EcuInstallationCompletedReport>(secondary.getSerial(), correlation_id, result.isSuccess()));
+  }
 
-  return std::async(std::launch::async, f);
+  sendEvent<event::InstallTargetComplete>(secondary.getSerial(), result.isSuccess());
+  return result;
 }
 
-std::vector<result::Install::EcuReport> SotaUptaneClient::sendImagesToEcus(const std::vector<Uptane::Target> &targets) {
+std::vector<result::Install::EcuReport> SotaUptaneClient::sendImagesToEcus(const std::vector<Uptane::Target> &targets,
+                                                                           PipelinedDownloads *pipeline) {
+  tracing::Span span("sendImagesToEcus");
   std::vector<result::Install::EcuReport> reports;
-  std::vector<std::pair<result::Install::EcuReport, std::future<data::InstallationResult>>> firmwareFutures;
+  std::vector<result::Install::EcuReport> firmware_sends;
+  std::vector<SecondaryInterface *> firmware_secondaries;
+  // delta images that don't match what the Secondary runs are not sent at all
+  std::vector<result::Install::EcuReport> rejected_sends;
 
   const Uptane::EcuSerial &primary_ecu_serial = primaryEcuSerial();
   // target images should already have been downloaded to metadata_path/targets/
@@ -1459,88 +2075,203 @@ std::vector<result::Install::EcuReport> SotaUptaneClient::sendImagesToEcus(const
         continue;
       }
 
-      SecondaryInterface &sec = *f->second;
-      firmwareFutures.emplace_back(result::Install::EcuReport(*targets_it, ecu_serial, data::InstallationResult()),
-                                   sendFirmwareAsync(sec, *targets_it));
+      auto delta_check = checkDeltaBase(ecu_serial, *targets_it);
+      if (!delta_check.isSuccess()) {
+        rejected_sends.emplace_back(*targets_it, ecu_serial, delta_check);
+        continue;
+      }
+
+      firmware_sends.emplace_back(*targets_it, ecu_serial, data::InstallationResult());
+      firmware_secondaries.push_back(f->second.get());
     }
   }
 
-  for (auto &f : firmwareFutures) {
-    data::InstallationResult fut_result = f.second.get();
+  // Secondaries listed in secondary_install_priority, by serial or hardware
+  // ID, are served first, in the order of the list; the others follow in the
+  // order of the downloads, see TargetOrder.
+  auto rank = [this, &firmware_secondaries](size_t send) {
+    const SecondaryInterface &sec = *firmware_secondaries[send];
+    return target_order_.rank(sec.getSerial(), sec.getHwId());
+  };
+  std::vector<size_t> order(firmware_sends.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this, &rank, &firmware_sends](size_t a, size_t b) {
+    const size_t rank_a = rank(a);
+    const size_t rank_b = rank(b);
+    if (rank_a != rank_b) {
+      return rank_a < rank_b;
+    }
+    return target_order_.before(firmware_sends[a].update, firmware_sends[b].update);
+  });
+
+  // Secondaries assigned the same image may get it all at once, e.g. through a
+  // multicast group. Each of them is still sent the Target and installs it on
+  // its own below, with nothing left to upload if it got the image. Pipelined
+  // images are not all there yet.
+  std::map<std::string, std::vector<size_t>> groups;
+  for (const size_t send : (pipeline == nullptr) ? order : std::vector<size_t>{}) {
+    const Uptane::Target &target = firmware_sends[send].update;
+    if (!target.IsOstree() && secondary_health_.available(firmware_secondaries[send]->getSerial())) {
+      groups[target.sha256Hash()].push_back(send);
+    }
+  }
+  for (const auto &group : groups) {
+    if (group.second.size() < 2 || (flow_control_ != nullptr && flow_control_->hasAborted())) {
+      continue;
+    }
+    std::vector<SecondaryInterface *> members;
+    for (const size_t send : group.second) {
+      members.push_back(firmware_secondaries[send]);
+    }
+    // each type of Secondary picks the members it can send to
+    const Uptane::Target &target = firmware_sends[group.second.front()].update;
+    std::set<std::string> types;
+    for (auto *member : members) {
+      if (!types.insert(member->Type()).second) {
+        continue;
+      }
+      try {
+        member->sendFirmwareToGroup(target, members);
+      } catch (const std::exception &ex) {
+        LOG_WARNING << "Could not send " << target.filename() << " to a group of Secondaries: " << ex.what();
+      }
+    }
+  }
 
-    if (fut_result.isSuccess() || fut_result.result_code == data::ResultCode::Numeric::kNeedCompletion) {
+  // Up to max_parallel_secondaries workers pick the next pending send, like
+  // the metadata is sent.
+  const size_t workers_num = std::max<size_t>(
+      1U, std::min<size_t>(static_cast<size_t>(config.uptane.max_parallel_secondaries), order.size()));
+  std::atomic<size_t> next_send{0};
+  auto worker = [this, &firmware_sends, &firmware_secondaries, &order, &next_send, pipeline]() {
+    for (size_t i = next_send++; i < order.size(); i = next_send++) {
+      const size_t send = order[i];
+      if (pipeline != nullptr) {
+        firmware_sends[send].install_res = verifyDownloadedTarget(firmware_sends[send].update, pipeline);
+        if (!firmware_sends[send].install_res.isSuccess()) {
+          continue;
+        }
+      }
+      firmware_sends[send].install_res =
+          sendFirmwareToSecondary(*firmware_secondaries[send], firmware_sends[send].update);
+    }
+  };
+  runSecondaryWorkers(workers_num, worker);
+
+  // Only store the results once all the Secondaries are done, so that they are
+  // all written at once, without keeping the storage from the sending threads.
+  auto batch = storage->beginBatch();
+  for (const auto &send : firmware_sends) {
+    const data::InstallationResult &send_result = send.install_res;
+    if (send_result.isSuccess() || send_result.result_code == data::ResultCode::Numeric::kNeedCompletion) {
       auto update_mode =
-          fut_result.isSuccess() ? InstalledVersionUpdateMode::kCurrent : InstalledVersionUpdateMode::kPending;
-      storage->saveInstalledVersion(f.first.serial.ToString(), f.first.update, update_mode,
+          send_result.isSuccess() ? InstalledVersionUpdateMode::kCurrent : InstalledVersionUpdateMode::kPending;
+      storage->saveInstalledVersion(send.serial.ToString(), send.update, update_mode,
                                     director_repo.getCorrelationId());
     }
 
-    f.first.install_res = fut_result;
-    storage->saveEcuInstallationResult(f.first.serial, f.first.install_res);
-    reports.push_back(f.first);
+    storage->saveEcuInstallationResult(send.serial, send.install_res);
+    reports.push_back(send);
+  }
+  for (const auto &send : rejected_sends) {
+    storage->saveEcuInstallationResult(send.serial, send.install_res);
+    reports.push_back(send);
   }
+  batch->commit();
   return reports;
 }
 
 Uptane::LazyTargetsList SotaUptaneClient::allTargets() const {
-  return Uptane::LazyTargetsList(image_repo, storage, uptane_fetcher, flow_control_);
+  return Uptane::LazyTargetsList(image_repo, storage, uptane_fetcher, flow_control_,
+                                 static_cast<size_t>(config.uptane.max_parallel_delegation_fetches));
 }
 
 void SotaUptaneClient::checkAndUpdatePendingSecondaries() {
   std::vector<std::pair<Uptane::EcuSerial, Hash>> pending_ecus;
   storage->getPendingEcus(&pending_ecus);
 
+  // Ask only the Secondaries with a pending update, all at once, like in
+  // AssembleManifest(). Those that are down are left until their backoff has
+  // elapsed.
+  std::vector<std::pair<const std::pair<Uptane::EcuSerial, Hash> *, std::future<SecondaryManifest>>> requests;
   for (const auto &pending_ecu : pending_ecus) {
     if (primaryEcuSerial() == pending_ecu.first) {
       continue;
     }
-    auto &sec = secondaries[pending_ecu.first];
-    Uptane::Manifest manifest;
-    try {
-      manifest = sec->getManifest();
-    } catch (const std::exception &ex) {
-      LOG_DEBUG << "Failed to get manifest from Secondary with serial " << pending_ecu.first << ": " << ex.what();
+    const auto sec = secondaries.find(pending_ecu.first);
+    if (sec == secondaries.end()) {
+      LOG_WARNING << "No Secondary with serial " << pending_ecu.first << " for its pending update";
       continue;
     }
-    if (manifest.empty()) {
-      LOG_DEBUG << "Failed to get manifest from Secondary with serial " << pending_ecu.first;
+    if (late_manifest_requests_.count(pending_ecu.first) != 0 || !secondary_health_.available(pending_ecu.first)) {
+      LOG_DEBUG << "Secondary with serial " << pending_ecu.first << " is unreachable, not checking its pending update";
       continue;
     }
-    bool verified = false;
-    try {
-      verified = manifest.verifySignature(sec->getPublicKey());
-    } catch (const std::exception &ex) {
-      LOG_ERROR << "Failed to get public key from Secondary with serial " << pending_ecu.first << ": " << ex.what();
+    requests.emplace_back(&pending_ecu, std::async(std::launch::async, getSecondaryManifest, sec->second));
+  }
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(config.uptane.secondary_manifest_timeout_sec);
+
+  std::vector<Uptane::EcuSerial> installed;
+  for (auto &request : requests) {
+    const Uptane::EcuSerial &ecu_serial = request.first->first;
+    SecondaryManifest secmanifest;
+    if (request.second.wait_until(deadline) == std::future_status::ready) {
+      secmanifest = request.second.get();
+    } else {
+      LOG_DEBUG << "Secondary with serial " << ecu_serial << " did not send its manifest in time";
+      late_manifest_requests_.emplace(ecu_serial, std::move(request.second));
+    }
+    if (secmanifest.manifest.empty()) {
+      LOG_DEBUG << "Failed to get manifest from Secondary with serial " << ecu_serial;
+      secondary_health_.reportFailure(ecu_serial);
+      continue;
     }
-    if (!verified) {
+    secondary_health_.reportSuccess(ecu_serial);
+    if (!secmanifest.verified) {
       LOG_ERROR << "Invalid manifest or signature reported by Secondary: "
-                << " serial: " << pending_ecu.first << " manifest: " << manifest;
+                << " serial: " << ecu_serial << " manifest: " << secmanifest.manifest;
       continue;
     }
 
-    auto current_ecu_hash = manifest.installedImageHash();
-    if (pending_ecu.second == current_ecu_hash) {
-      LOG_INFO << "The pending update " << current_ecu_hash << " has been installed on " << pending_ecu.first;
+    auto current_ecu_hash = secmanifest.manifest.installedImageHash();
+    if (request.first->second == current_ecu_hash) {
+      LOG_INFO << "The pending update " << current_ecu_hash << " has been installed on " << ecu_serial;
+      installed.push_back(ecu_serial);
+    } else {
+      LOG_DEBUG << "The pending update for ECU " << ecu_serial << " has not been installed ("
+                << request.first->second << " != " << current_ecu_hash << ")";
+    }
+  }
+  if (installed.empty()) {
+    return;
+  }
+
+  // the versions and results of all the Secondaries that are done are
+  // written at once
+  std::vector<std::pair<Uptane::EcuSerial, Uptane::CorrelationId>> completed;
+  {
+    auto batch = storage->beginBatch();
+    for (const auto &ecu_serial : installed) {
       boost::optional<Uptane::Target> pending_version;
       Uptane::CorrelationId correlation_id;
-      if (storage->loadInstalledVersions(pending_ecu.first.ToString(), nullptr, &pending_version, &correlation_id)) {
-        storage->saveEcuInstallationResult(pending_ecu.first,
-                                           data::InstallationResult(data::ResultCode::Numeric::kOk, ""));
-        storage->saveInstalledVersion(pending_ecu.first.ToString(), *pending_version,
-                                      InstalledVersionUpdateMode::kCurrent, correlation_id);
-
-        report_queue->enqueue(
-            std_::make_unique<EcuInstallationCompletedReport>(pending_ecu.first, correlation_id, true));
-
-        data::InstallationResult ir;
-        std::string raw_report;
-        computeDeviceInstallationResult(&ir, &raw_report);
-        storage->storeDeviceInstallationResult(ir, raw_report, correlation_id);
+      if (storage->loadInstalledVersions(ecu_serial.ToString(), nullptr, &pending_version, &correlation_id)) {
+        storage->saveEcuInstallationResult(ecu_serial, data::InstallationResult(data::ResultCode::Numeric::kOk, ""));
+        storage->saveInstalledVersion(ecu_serial.ToString(), *pending_version, InstalledVersionUpdateMode::kCurrent,
+                                      correlation_id);
+        completed.emplace_back(ecu_serial, correlation_id);
       }
-    } else {
-      LOG_DEBUG << "The pending update for ECU " << pending_ecu.first << " has not been installed ("
-                << pending_ecu.second << " != " << current_ecu_hash << ")";
     }
+    if (!completed.empty()) {
+      data::InstallationResult ir;
+      std::string raw_report;
+      computeDeviceInstallationResult(&ir, &raw_report);
+      storage->storeDeviceInstallationResult(ir, raw_report, completed.back().second);
+    }
+    batch->commit();
+  }
+  for (const auto &ecu : completed) {
+    report_queue->enqueue(std_::make_unique<EcuInstallationCompletedReport>(ecu.first, ecu.second, true));
   }
 }
 
@@ -1570,3 +2301,10 @@ std::ifstream SotaUptaneClient::openStoredTarget(const Uptane::Target &target) {
     throw std::runtime_error("Failed to open Target");
   }
 }
+
+TargetFileView SotaUptaneClient::openStoredTargetView(const Uptane::Target &target) {
+  if (package_manager_->verifyTarget(target) != TargetStatus::kGood) {
+    throw std::runtime_error("Failed to open Target");
+  }
+  return package_manager_->openTargetFileView(target);
+}
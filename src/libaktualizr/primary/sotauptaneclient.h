@@ -1,6 +1,8 @@
 #ifndef SOTA_UPTANE_CLIENT_H_
 #define SOTA_UPTANE_CLIENT_H_
 
+#include <atomic>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
@@ -21,7 +23,14 @@
 
 #include "bootloader/bootloader.h"
 #include "http/httpclient.h"
+#include "http/ratelimiter.h"
+#include "http/retrypolicy.h"
+#include "primary/pipelined_downloads.h"
+#include "primary/secondary_cache.h"
+#include "primary/secondary_health.h"
 #include "primary/secondary_provider_builder.h"
+#include "primary/target_order.h"
+#include "primary/update_performance.h"
 #include "provisioner.h"
 #include "reportqueue.h"
 #include "uptane/directorrepository.h"
@@ -30,6 +39,7 @@
 #include "uptane/imagerepository.h"
 #include "uptane/iterator.h"
 #include "uptane/manifest.h"
+#include "uptane/offline_bundle.h"
 #include "uptane/tuf.h"
 #include "utilities/flow_control.h"
 
@@ -59,7 +69,14 @@ class SotaUptaneClient {
   SotaUptaneClient(Config &config_in, const std::shared_ptr<INvStorage> &storage_in)
       : SotaUptaneClient(config_in, storage_in, std::make_shared<HttpClient>(), nullptr, nullptr) {}
 
+  // initializeLocal() and finishInitialization()
   void initialize();
+  // What the client needs before it can take commands, without the network
+  void initializeLocal();
+  // Finalizes a pending update after a reboot and makes an attempt at provisioning
+  void finishInitialization();
+  // Runs lshw in the background, if the default hardware info is to be reported
+  void prefetchHardwareInfo();
   void addSecondary(const std::shared_ptr<SecondaryInterface> &sec);
 
   /**
@@ -69,16 +86,46 @@ class SotaUptaneClient {
    */
   bool attemptProvision();
 
-  result::Download downloadImages(const std::vector<Uptane::Target> &targets);
+  // With `pipeline`, each image is reported to it once downloaded.
+  result::Download downloadImages(const std::vector<Uptane::Target> &targets,
+                                  PipelinedDownloads *pipeline = nullptr);
 
   /** See Aktualizr::SetCustomHardwareInfo(Json::Value) */
   void setCustomHardwareInfo(Json::Value hwinfo) { custom_hardware_info_ = std::move(hwinfo); }
   void reportPause();
   void reportResume();
+  /** See Aktualizr::SetDownloadRateLimit(uint64_t) */
+  void setDownloadRateLimit(uint64_t bytes_per_sec) { rate_limiter_->setOverride(bytes_per_sec); }
+  /** See Aktualizr::ResetDownloadRateLimit() */
+  void resetDownloadRateLimit() { rate_limiter_->clearOverride(); }
+  /**
+   * Take the metadata and the images of the updates from an offline bundle
+   * instead of the servers, until it is set back to nullptr. fetchMeta()
+   * doesn't send the manifest while a bundle is set. Not to be called while an
+   * update is checked or downloaded.
+   */
+  void setOfflineBundle(std::shared_ptr<const Uptane::OfflineBundle> bundle);
+  /**
+   * Download the images and send them to the Secondaries in another order than
+   * the one of `target_order`, see TargetOrder. Not to be called while an
+   * update is downloaded or installed.
+   */
+  void setTargetOrder(TargetOrder::Compare compare) { target_order_ = TargetOrder(config.uptane, std::move(compare)); }
   void sendDeviceData();
   result::UpdateCheck fetchMeta();
   bool putManifest(const Json::Value &custom = Json::nullValue);
-  result::Install uptaneInstall(const std::vector<Uptane::Target> &updates);
+  // With `pipeline`, the stored metadata was checked by the downloads, and
+  // each image is waited for as it is needed.
+  result::Install uptaneInstall(const std::vector<Uptane::Target> &updates, PipelinedDownloads *pipeline = nullptr);
+  /**
+   * Download the images and install them at the same time (pipeline_installs):
+   * each Secondary is sent its image as soon as it is downloaded and verified,
+   * while the others are still being downloaded. The Primary installs its own
+   * update last.
+   * @return The results of the download and of the installation, which is
+   * empty if the stored metadata didn't check out.
+   */
+  std::pair<result::Download, result::Install> downloadAndInstall(const std::vector<Uptane::Target> &updates);
   result::CampaignCheck campaignCheck();
   void campaignAccept(const std::string &campaign_id);
   void campaignDecline(const std::string &campaign_id);
@@ -88,7 +135,16 @@ class SotaUptaneClient {
   void completeInstall();
   std::vector<Uptane::Target> getStoredTargets() const { return package_manager_->getTargetFiles(); }
   void deleteStoredTarget(const Uptane::Target &target) { package_manager_->removeTargetFile(target); }
+  // Remove the images of all but the pacman.images_retention most recently
+  // installed Targets of each ECU, keeping pending installations.
+  void removeStaleTargets();
+  // Let the package manager free what the update finalized at startup made
+  // unnecessary, if any
+  void pruneAfterFinalize();
+  // Idle-time maintenance of the storage, as set in config.storage
+  void maintainStorage();
   std::ifstream openStoredTarget(const Uptane::Target &target);
+  TargetFileView openStoredTargetView(const Uptane::Target &target);
 
  private:
   FRIEND_TEST(Aktualizr, FullNoUpdates);
@@ -111,6 +167,7 @@ class SotaUptaneClient {
   FRIEND_TEST(Uptane, offlineIteration);
   FRIEND_TEST(Uptane, IgnoreUnknownUpdate);
   FRIEND_TEST(Uptane, kRejectAllTest);
+  FRIEND_TEST(Uptane, TlsKeysReused);
   FRIEND_TEST(UptaneCI, ProvisionAndPutManifest);
   FRIEND_TEST(UptaneCI, CheckKeys);
   FRIEND_TEST(UptaneKey, Check);  // Note hacky name
@@ -123,6 +180,8 @@ class SotaUptaneClient {
   FRIEND_TEST(MetadataExpirationTest, MetadataExpirationAfterInstallationAndBeforeReboot);
   FRIEND_TEST(MetadataExpirationTest, MetadataExpirationBeforeInstallation);
   FRIEND_TEST(Delegation, IterateAll);
+  FRIEND_TEST(Delegation, IterateAllPrefetch);
+  FRIEND_TEST(Delegation, IterateAllCached);
 
   /**
    * This operation requires that the device is provisioned.
@@ -140,6 +199,12 @@ class SotaUptaneClient {
 
   data::InstallationResult PackageInstall(const Uptane::Target &target);
   std::pair<bool, Uptane::Target> downloadImage(const Uptane::Target &target);
+  // Whether the binary image goes to its Secondary straight from the server
+  // during the installation, instead of being downloaded first. Only for
+  // Targets of a single Secondary that accepts streamed images.
+  bool isCutThrough(const Uptane::Target &target) const;
+  // Start the HTTP cache for Secondaries, if configured (secondary_cache_address).
+  void startSecondaryCache();
   void uptaneIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count);
   void uptaneOfflineIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count);
   result::UpdateCheck checkUpdates();
@@ -155,19 +220,40 @@ class SotaUptaneClient {
   void finalizeAfterReboot();
   // Part of sendDeviceData()
   void reportHwInfo();
-  // Part of sendDeviceData()
-  void reportInstalledPackages();
+  boost::filesystem::path hardwareInfoCache() const;
+  // Part of sendDeviceData(), with the hash of the installed packages
+  void reportInstalledPackages(const Hash &new_hash);
   // Called by sendDeviceData() and fetchMeta()
   void reportNetworkInfo();
+  void reportNetworkInfo(const Json::Value &network_info);
+  // null if it is not to be reported
+  Json::Value collectNetworkInfo() const;
   // Part of sendDeviceData()
   void reportAktualizrConfiguration();
   bool waitSecondariesReachable(const std::vector<Uptane::Target> &updates);
+  struct SecondaryManifest {
+    Uptane::Manifest manifest;
+    bool verified{false};
+  };
+  // Get the manifest of a Secondary and verify its signature; runs on its own
+  // thread and may outlive the call of AssembleManifest()
+  static SecondaryManifest getSecondaryManifest(const SecondaryInterface::Ptr &secondary);
   void storeInstallationFailure(const data::InstallationResult &result);
+  // ping a Secondary and update its health
+  bool pingSecondary(SecondaryInterface &secondary);
+  void updateSecondaryHealth(SecondaryInterface &secondary, const data::InstallationResult &result);
   data::InstallationResult rotateSecondaryRoot(Uptane::RepositoryType repo, SecondaryInterface &secondary);
+  data::InstallationResult sendMetadataToSecondary(SecondaryInterface &secondary, const Uptane::Target &target);
   void sendMetadataToEcus(const std::vector<Uptane::Target> &targets, data::InstallationResult *result,
                           std::string *raw_installation_report);
-  std::future<data::InstallationResult> sendFirmwareAsync(SecondaryInterface &secondary, const Uptane::Target &target);
-  std::vector<result::Install::EcuReport> sendImagesToEcus(const std::vector<Uptane::Target> &targets);
+  // a delta image can only be sent to a Secondary that runs the image it applies to
+  data::InstallationResult checkDeltaBase(const Uptane::EcuSerial &serial, const Uptane::Target &target);
+  data::InstallationResult sendFirmwareToSecondary(SecondaryInterface &secondary, const Uptane::Target &target);
+  std::vector<result::Install::EcuReport> sendImagesToEcus(const std::vector<Uptane::Target> &targets,
+                                                           PipelinedDownloads *pipeline = nullptr);
+  // Verify the stored image of an update again before it is installed, once
+  // it is downloaded with `pipeline`.
+  data::InstallationResult verifyDownloadedTarget(const Uptane::Target &target, PipelinedDownloads *pipeline);
 
   bool putManifestSimple(const Json::Value &custom = Json::nullValue);
   void getNewTargets(std::vector<Uptane::Target> *new_targets, unsigned int *ecus_count = nullptr);
@@ -178,12 +264,17 @@ class SotaUptaneClient {
 
   void computeDeviceInstallationResult(data::InstallationResult *result, std::string *raw_installation_report);
   std::unique_ptr<Uptane::Target> findTargetInDelegationTree(const Uptane::Target &target, bool offline);
-  std::unique_ptr<Uptane::Target> findTargetHelper(const Uptane::Targets &cur_targets,
+  std::unique_ptr<Uptane::Target> findTargetHelper(const Uptane::Targets &cur_targets, const std::string &cur_path,
                                                    const Uptane::Target &queried_target, int level, bool terminating,
                                                    bool offline);
   Uptane::LazyTargetsList allTargets() const;
+  // the offline bundle if one is set, the servers otherwise
+  Uptane::IMetadataFetcher &metadataFetcher();
   void checkAndUpdatePendingSecondaries();
   Uptane::EcuSerial primaryEcuSerial() { return provisioner_.PrimaryEcuSerial(); }
+  // TLS credentials for the package manager, in files; shared by the
+  // downloads and only loaded again when the credentials changed
+  std::shared_ptr<KeyManager> tlsKeys();
   boost::optional<Uptane::HardwareIdentifier> getEcuHwId(const Uptane::EcuSerial &serial);
 
   template <class T, class... Args>
@@ -202,19 +293,49 @@ class SotaUptaneClient {
   Uptane::ManifestIssuer::Ptr uptane_manifest;
   std::shared_ptr<INvStorage> storage;
   std::shared_ptr<HttpInterface> http;
+  std::shared_ptr<RateLimiter> rate_limiter_;
   std::shared_ptr<PackageManagerInterface> package_manager_;
   std::shared_ptr<KeyManager> key_manager_;
   std::shared_ptr<Uptane::Fetcher> uptane_fetcher;
+  // set by setOfflineBundle()
+  std::shared_ptr<Uptane::BundleFetcher> bundle_fetcher_;
   std::unique_ptr<ReportQueue> report_queue;
   std::shared_ptr<SecondaryProvider> secondary_provider_;
   std::shared_ptr<event::Channel> events_channel;
   std::exception_ptr last_exception;
+  std::mutex last_exception_mutex;
+  // failed image downloads are tried again, see RetryPolicy
+  RetryPolicy download_retries_;
   // ecu_serial => secondary*
   std::map<Uptane::EcuSerial, SecondaryInterface::Ptr> secondaries;
+  SecondaryHealth secondary_health_;
+  UpdatePerformance update_performance_;
   std::mutex download_mutex;
   Provisioner provisioner_;
   Json::Value custom_hardware_info_{Json::nullValue};
+  std::future<Json::Value> hardware_info_;
   const api::FlowControlToken *flow_control_;
+  TargetOrder target_order_;
+  // manifest requests to Secondaries that missed their deadline, still running
+  std::map<Uptane::EcuSerial, std::future<SecondaryManifest>> late_manifest_requests_;
+  // what the last manifest accepted by the server had, to skip or trim the
+  // next one: digests of the ECU manifests by serial, and the custom part
+  std::mutex manifest_mutex_;
+  std::map<std::string, std::string> sent_ecu_manifests_;
+  std::string sent_custom_;
+  bool partial_manifests_supported_{true};
+  // an update of the Primary was finalized successfully at startup
+  std::atomic<bool> finalized_update_{false};
+  std::mutex tls_keys_mutex_;
+  std::shared_ptr<KeyManager> tls_keys_;
+  uint64_t tls_keys_generation_{0};
+  // campaigns of the last check and the validators they came with, to only
+  // ask the server whether they changed
+  std::mutex campaigns_mutex_;
+  std::vector<campaign::Campaign> campaigns_;
+  HttpCacheValidators campaigns_validators_;
+  // destroyed first, as its sessions use the HTTP client
+  std::unique_ptr<SecondaryCache> secondary_cache_;
 };
 
 #endif  // SOTA_UPTANE_CLIENT_H_
@@ -0,0 +1,64 @@
+#include "target_order.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+
+namespace {
+
+size_t rankIn(const std::vector<std::string> &priority, const Uptane::EcuSerial &serial,
+              const Uptane::HardwareIdentifier &hwid) {
+  const auto it = std::find_if(priority.cbegin(), priority.cend(), [&serial, &hwid](const std::string &entry) {
+    return entry == serial.ToString() || entry == hwid.ToString();
+  });
+  return static_cast<size_t>(it - priority.cbegin());
+}
+
+size_t rankIn(const std::vector<std::string> &priority, const Uptane::Target &target) {
+  size_t best = priority.size();
+  for (const auto &ecu : target.ecus()) {
+    best = std::min(best, rankIn(priority, ecu.first, ecu.second));
+  }
+  return best;
+}
+
+}  // namespace
+
+TargetOrder::TargetOrder(const UptaneConfig &config, Compare compare) : compare_(std::move(compare)) {
+  boost::split(priority_, config.secondary_install_priority, boost::is_any_of(", "), boost::token_compress_on);
+  priority_.erase(std::remove(priority_.begin(), priority_.end(), std::string()), priority_.end());
+}
+
+TargetOrder::TargetOrder(const UptaneConfig &config) : TargetOrder(config, nullptr) {
+  const std::string &policy = config.target_order;
+  auto smaller = [](const Uptane::Target &a, const Uptane::Target &b) { return a.length() < b.length(); };
+  if (policy == "smallest_first") {
+    compare_ = smaller;
+  } else if (policy == "priority") {
+    // copied, the order may outlive this object
+    compare_ = [priority = priority_, smaller](const Uptane::Target &a, const Uptane::Target &b) {
+      const size_t rank_a = rankIn(priority, a);
+      const size_t rank_b = rankIn(priority, b);
+      return rank_a != rank_b ? rank_a < rank_b : smaller(a, b);
+    };
+  } else if (!policy.empty() && policy != "director") {
+    throw std::invalid_argument("Invalid target order: " + policy);
+  }
+}
+
+std::vector<size_t> TargetOrder::sort(const std::vector<Uptane::Target> &targets,
+                                      const std::vector<size_t> &indexes) const {
+  std::vector<size_t> result = indexes;
+  if (compare_ != nullptr) {
+    std::stable_sort(result.begin(), result.end(),
+                     [this, &targets](size_t a, size_t b) { return compare_(targets[a], targets[b]); });
+  }
+  return result;
+}
+
+size_t TargetOrder::rank(const Uptane::EcuSerial &serial, const Uptane::HardwareIdentifier &hwid) const {
+  return rankIn(priority_, serial, hwid);
+}
+
+size_t TargetOrder::rank(const Uptane::Target &target) const { return rankIn(priority_, target); }
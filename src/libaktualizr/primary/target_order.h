@@ -0,0 +1,50 @@
+#ifndef TARGET_ORDER_H_
+#define TARGET_ORDER_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "libaktualizr/config.h"
+#include "libaktualizr/types.h"
+
+/**
+ * The order in which SotaUptaneClient downloads the images of an update and
+ * sends them to the Secondaries, from the options `target_order` and
+ * `secondary_install_priority` of the Uptane configuration:
+ * - "director", the default: as listed by the Director;
+ * - "smallest_first": the smallest images first, so that a large image
+ *   doesn't hold back the updates of the ECUs with small ones;
+ * - "priority": the images of the ECUs in `secondary_install_priority` first,
+ *   in the order of the list, then the others smallest first.
+ *
+ * Targets that compare equal keep the order of the Director. Secondaries in
+ * `secondary_install_priority` get their images first whatever the order.
+ */
+class TargetOrder {
+ public:
+  // true if the first Target goes before the second one
+  using Compare = std::function<bool(const Uptane::Target &, const Uptane::Target &)>;
+
+  // throws std::invalid_argument for an unknown target_order
+  explicit TargetOrder(const UptaneConfig &config);
+  // another policy, e.g. by deadline; nullptr for the order of the Director
+  TargetOrder(const UptaneConfig &config, Compare compare);
+
+  bool before(const Uptane::Target &a, const Uptane::Target &b) const {
+    return compare_ != nullptr && compare_(a, b);
+  }
+  // the indexes of the given targets, in order
+  std::vector<size_t> sort(const std::vector<Uptane::Target> &targets, const std::vector<size_t> &indexes) const;
+  // the position of an ECU in secondary_install_priority, the length of the
+  // list if it isn't there
+  size_t rank(const Uptane::EcuSerial &serial, const Uptane::HardwareIdentifier &hwid) const;
+  // the best rank of the ECUs of a Target
+  size_t rank(const Uptane::Target &target) const;
+
+ private:
+  std::vector<std::string> priority_;
+  Compare compare_;
+};
+
+#endif  // TARGET_ORDER_H_
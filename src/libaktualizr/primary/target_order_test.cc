@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "primary/target_order.h"
+
+static Uptane::Target makeTarget(const std::string &name, uint64_t length, const std::string &serial,
+                                 const std::string &hwid) {
+  Uptane::EcuMap ecus{{Uptane::EcuSerial(serial), Uptane::HardwareIdentifier(hwid)}};
+  return Uptane::Target(name, ecus, {Hash(Hash::Type::kSha256, std::string(64, 'a'))}, length);
+}
+
+static std::vector<std::string> names(const std::vector<Uptane::Target> &targets, const std::vector<size_t> &order) {
+  std::vector<std::string> result;
+  for (const size_t i : order) {
+    result.push_back(targets[i].filename());
+  }
+  return result;
+}
+
+static const std::vector<Uptane::Target> kTargets{
+    makeTarget("infotainment", 3000000000, "ecu1", "infotainment-hw"),
+    makeTarget("brakes", 2000000, "ecu2", "brakes-hw"),
+    makeTarget("doors", 500000, "ecu3", "doors-hw"),
+    makeTarget("seats", 2000000, "ecu4", "seats-hw"),
+};
+static const std::vector<size_t> kAll{0, 1, 2, 3};
+
+/* By default, the order of the Director is kept. */
+TEST(TargetOrder, Director) {
+  UptaneConfig config;
+  TargetOrder dut(config);
+  EXPECT_EQ(dut.sort(kTargets, kAll), kAll);
+  EXPECT_FALSE(dut.before(kTargets[2], kTargets[0]));
+}
+
+/* The smallest images go first, images of the same size in the order of the
+ * Director. */
+TEST(TargetOrder, SmallestFirst) {
+  UptaneConfig config;
+  config.target_order = "smallest_first";
+  TargetOrder dut(config);
+  EXPECT_EQ(names(kTargets, dut.sort(kTargets, kAll)),
+            (std::vector<std::string>{"doors", "brakes", "seats", "infotainment"}));
+  EXPECT_EQ(names(kTargets, dut.sort(kTargets, {3, 0, 1})),
+            (std::vector<std::string>{"seats", "brakes", "infotainment"}));
+}
+
+/* The ECUs of secondary_install_priority go first, by serial or hardware ID,
+ * then the others smallest first. */
+TEST(TargetOrder, Priority) {
+  UptaneConfig config;
+  config.target_order = "priority";
+  config.secondary_install_priority = "brakes-hw, ecu1";
+  TargetOrder dut(config);
+  EXPECT_EQ(names(kTargets, dut.sort(kTargets, kAll)),
+            (std::vector<std::string>{"brakes", "infotainment", "doors", "seats"}));
+  EXPECT_EQ(dut.rank(kTargets[1]), 0);
+  EXPECT_EQ(dut.rank(kTargets[0]), 1);
+  EXPECT_EQ(dut.rank(kTargets[3]), 2);
+}
+
+/* Other policies can be plugged in. */
+TEST(TargetOrder, Custom) {
+  UptaneConfig config;
+  TargetOrder dut(config, [](const Uptane::Target &a, const Uptane::Target &b) { return a.filename() < b.filename(); });
+  EXPECT_EQ(names(kTargets, dut.sort(kTargets, kAll)),
+            (std::vector<std::string>{"brakes", "doors", "infotainment", "seats"}));
+
+  config.target_order = "largest_first";
+  EXPECT_THROW(TargetOrder{config}, std::invalid_argument);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
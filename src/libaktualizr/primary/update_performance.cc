@@ -0,0 +1,93 @@
+#include "primary/update_performance.h"
+
+#include <ctime>
+
+Json::Value &UpdatePerformance::section(const std::string &correlation_id, const char *name) {
+  if (correlation_id != correlation_id_) {
+    correlation_id_ = correlation_id;
+    summary_ = Json::nullValue;
+  }
+  Json::Value &res = summary_[name];
+  if (res.isNull()) {
+    res = Json::arrayValue;
+  }
+  return res;
+}
+
+void UpdatePerformance::recordDownload(const std::string &correlation_id, const Uptane::Target &target,
+                                       std::chrono::milliseconds duration, int tries, bool success) {
+  Json::Value entry;
+  entry["target"] = target.filename();
+  entry["bytes"] = Json::UInt64(target.length());
+  entry["duration_ms"] = Json::Int64(duration.count());
+  entry["tries"] = tries;
+  entry["success"] = success;
+  std::lock_guard<std::mutex> guard(mutex_);
+  section(correlation_id, "downloads").append(entry);
+}
+
+void UpdatePerformance::recordVerification(const std::string &correlation_id, const Uptane::Target &target,
+                                           std::chrono::microseconds cpu_time) {
+  Json::Value entry;
+  entry["target"] = target.filename();
+  entry["cpu_ms"] = Json::Int64(std::chrono::duration_cast<std::chrono::milliseconds>(cpu_time).count());
+  std::lock_guard<std::mutex> guard(mutex_);
+  section(correlation_id, "verifications").append(entry);
+}
+
+void UpdatePerformance::recordSecondaryTransfer(const std::string &correlation_id, const Uptane::EcuSerial &ecu,
+                                                const Uptane::Target &target, std::chrono::milliseconds duration,
+                                                const data::ResultCode &result) {
+  Json::Value entry;
+  entry["ecu"] = ecu.ToString();
+  entry["target"] = target.filename();
+  entry["bytes"] = Json::UInt64(target.length());
+  entry["duration_ms"] = Json::Int64(duration.count());
+  if (duration.count() > 0) {
+    entry["bytes_per_second"] = Json::UInt64(target.length() * 1000 / static_cast<uint64_t>(duration.count()));
+  }
+  entry["result"] = result.ToString();
+  std::lock_guard<std::mutex> guard(mutex_);
+  section(correlation_id, "secondary_transfers").append(entry);
+}
+
+void UpdatePerformance::recordInstall(const std::string &correlation_id, const Uptane::EcuSerial &ecu,
+                                      const Uptane::Target &target, std::chrono::milliseconds duration,
+                                      const data::ResultCode &result) {
+  Json::Value entry;
+  entry["ecu"] = ecu.ToString();
+  entry["target"] = target.filename();
+  entry["duration_ms"] = Json::Int64(duration.count());
+  entry["result"] = result.ToString();
+  std::lock_guard<std::mutex> guard(mutex_);
+  section(correlation_id, "installs").append(entry);
+}
+
+void UpdatePerformance::recordSecondaryMetrics(const std::string &correlation_id, const Uptane::EcuSerial &ecu,
+                                               const std::string &metrics) {
+  Json::Value entry;
+  entry["ecu"] = ecu.ToString();
+  entry["metrics"] = metrics;
+  std::lock_guard<std::mutex> guard(mutex_);
+  section(correlation_id, "secondary_metrics").append(entry);
+}
+
+Json::Value UpdatePerformance::take(const std::string &correlation_id) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (correlation_id != correlation_id_) {
+    return Json::nullValue;
+  }
+  Json::Value res;
+  res.swap(summary_);
+  correlation_id_.clear();
+  return res;
+}
+
+std::chrono::microseconds UpdatePerformance::threadCpuTime() {
+  struct timespec ts {};
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return std::chrono::microseconds(0);
+  }
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::duration_cast<std::chrono::microseconds>(
+                                                std::chrono::nanoseconds(ts.tv_nsec));
+}
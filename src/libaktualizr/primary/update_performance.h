@@ -0,0 +1,56 @@
+#ifndef UPDATE_PERFORMANCE_H_
+#define UPDATE_PERFORMANCE_H_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "libaktualizr/types.h"
+
+/**
+ * How long the steps of an update took, for the UpdatePerformance report
+ * sent at the end of the installation when telemetry.report_performance is
+ * set.
+ *
+ * What is recorded belongs to one update, identified by its correlation ID;
+ * recording something for another update drops what was recorded before.
+ * It only lives in memory, so an update interrupted by a reboot only reports
+ * what happened after it.
+ */
+class UpdatePerformance {
+ public:
+  void recordDownload(const std::string &correlation_id, const Uptane::Target &target,
+                      std::chrono::milliseconds duration, int tries, bool success);
+  // CPU time spent checking the hashes of a downloaded image before installing it
+  void recordVerification(const std::string &correlation_id, const Uptane::Target &target,
+                          std::chrono::microseconds cpu_time);
+  // Sending an image to a Secondary, including its installation there
+  void recordSecondaryTransfer(const std::string &correlation_id, const Uptane::EcuSerial &ecu,
+                               const Uptane::Target &target, std::chrono::milliseconds duration,
+                               const data::ResultCode &result);
+  void recordInstall(const std::string &correlation_id, const Uptane::EcuSerial &ecu, const Uptane::Target &target,
+                     std::chrono::milliseconds duration, const data::ResultCode &result);
+  // What the Secondary reports with SecondaryInterface::getMetrics() after its installation
+  void recordSecondaryMetrics(const std::string &correlation_id, const Uptane::EcuSerial &ecu,
+                              const std::string &metrics);
+
+  // The summary of the update, and nothing recorded for it anymore. Null if
+  // nothing was recorded for it.
+  Json::Value take(const std::string &correlation_id);
+
+  // CPU time of the calling thread
+  static std::chrono::microseconds threadCpuTime();
+
+ private:
+  // with mutex_ held
+  Json::Value &section(const std::string &correlation_id, const char *name);
+
+  std::mutex mutex_;
+  std::string correlation_id_;
+  Json::Value summary_{Json::nullValue};
+};
+
+#endif  // UPDATE_PERFORMANCE_H_
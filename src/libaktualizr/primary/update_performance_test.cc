@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include "primary/update_performance.h"
+
+static Uptane::Target makeTarget(const std::string &name, uint64_t length) {
+  return Uptane::Target(name, Uptane::EcuMap{}, {Hash(Hash::Type::kSha256, std::string(64, 'a'))}, length);
+}
+
+TEST(UpdatePerformance, Summary) {
+  UpdatePerformance performance;
+  const auto target = makeTarget("image", 4000);
+  const Uptane::EcuSerial secondary("secondary");
+  performance.recordDownload("id", target, std::chrono::milliseconds(1500), 2, true);
+  performance.recordVerification("id", target, std::chrono::microseconds(12000));
+  performance.recordSecondaryTransfer("id", secondary, target, std::chrono::milliseconds(2000),
+                                      data::ResultCode(data::ResultCode::Numeric::kOk));
+  performance.recordInstall("id", secondary, target, std::chrono::milliseconds(300),
+                            data::ResultCode(data::ResultCode::Numeric::kNeedCompletion));
+  performance.recordSecondaryMetrics("id", secondary, "aktualizr_secondary_requests_total 3\n");
+
+  EXPECT_TRUE(performance.take("other").isNull());
+  const Json::Value summary = performance.take("id");
+  ASSERT_EQ(summary["downloads"].size(), 1);
+  EXPECT_EQ(summary["downloads"][0]["target"].asString(), "image");
+  EXPECT_EQ(summary["downloads"][0]["bytes"].asUInt64(), 4000);
+  EXPECT_EQ(summary["downloads"][0]["duration_ms"].asInt64(), 1500);
+  EXPECT_EQ(summary["downloads"][0]["tries"].asInt(), 2);
+  EXPECT_TRUE(summary["downloads"][0]["success"].asBool());
+  EXPECT_EQ(summary["verifications"][0]["cpu_ms"].asInt64(), 12);
+  EXPECT_EQ(summary["secondary_transfers"][0]["ecu"].asString(), "secondary");
+  EXPECT_EQ(summary["secondary_transfers"][0]["bytes_per_second"].asUInt64(), 2000);
+  EXPECT_EQ(summary["secondary_transfers"][0]["result"].asString(), "OK");
+  EXPECT_EQ(summary["installs"][0]["duration_ms"].asInt64(), 300);
+  EXPECT_EQ(summary["installs"][0]["result"].asString(), "NEED_COMPLETION");
+  EXPECT_EQ(summary["secondary_metrics"][0]["ecu"].asString(), "secondary");
+  EXPECT_EQ(summary["secondary_metrics"][0]["metrics"].asString(), "aktualizr_secondary_requests_total 3\n");
+
+  // taken only once
+  EXPECT_TRUE(performance.take("id").isNull());
+}
+
+/* What was recorded for an earlier update is dropped. */
+TEST(UpdatePerformance, NewUpdate) {
+  UpdatePerformance performance;
+  performance.recordDownload("first", makeTarget("a", 1), std::chrono::milliseconds(1), 1, false);
+  performance.recordDownload("second", makeTarget("b", 1), std::chrono::milliseconds(1), 1, true);
+  EXPECT_TRUE(performance.take("first").isNull());
+  const Json::Value summary = performance.take("second");
+  ASSERT_EQ(summary["downloads"].size(), 1);
+  EXPECT_EQ(summary["downloads"][0]["target"].asString(), "b");
+}
+
+TEST(UpdatePerformance, ThreadCpuTime) {
+  const auto start = UpdatePerformance::threadCpuTime();
+  volatile uint64_t sum = 0;
+  for (uint64_t i = 0; i < 10000000; ++i) {
+    sum += i;
+  }
+  EXPECT_GT(UpdatePerformance::threadCpuTime(), start);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
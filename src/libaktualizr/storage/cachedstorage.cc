@@ -0,0 +1,595 @@
+#include "cachedstorage.h"
+
+#include "utilities/utils.h"
+
+namespace {
+enum class MetaKind { kRoot = 0, kNonRoot, kDelegation };
+
+MetadataCache::Key rootKey(Uptane::RepositoryType repo, Uptane::Version version) {
+  return MetadataCache::Key{static_cast<int>(MetaKind::kRoot), static_cast<int>(repo), version.version(), ""};
+}
+
+MetadataCache::Key nonRootKey(Uptane::RepositoryType repo, const Uptane::Role& role) {
+  return MetadataCache::Key{static_cast<int>(MetaKind::kNonRoot), static_cast<int>(repo), role.ToInt(), ""};
+}
+
+MetadataCache::Key delegationKey(const Uptane::Role& role) {
+  return MetadataCache::Key{static_cast<int>(MetaKind::kDelegation), 0, 0, role.ToString()};
+}
+
+// Clears the cache if the batch is not committed, as it may hold writes that
+// are rolled back.
+class CachedStorageBatch : public StorageBatch {
+ public:
+  CachedStorageBatch(std::unique_ptr<StorageBatch> batch, std::shared_ptr<MetadataCache> cache)
+      : batch_(std::move(batch)), cache_(std::move(cache)) {}
+  ~CachedStorageBatch() override {
+    if (!committed_) {
+      cache_->clear();
+    }
+  }
+  CachedStorageBatch(const CachedStorageBatch&) = delete;
+  CachedStorageBatch(CachedStorageBatch&&) = delete;
+  CachedStorageBatch& operator=(const CachedStorageBatch&) = delete;
+  CachedStorageBatch& operator=(CachedStorageBatch&&) = delete;
+
+  void commit() override {
+    batch_->commit();
+    committed_ = true;
+  }
+
+ private:
+  std::unique_ptr<StorageBatch> batch_;
+  std::shared_ptr<MetadataCache> cache_;
+  bool committed_{false};
+};
+}  // namespace
+
+std::list<MetadataCache::Entry>::iterator MetadataCache::find(const Key& key) {
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    ++stats_.misses;
+    return entries_.end();
+  }
+  ++stats_.hits;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second;
+}
+
+bool MetadataCache::load(const Key& key, std::string* data) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = find(key);
+  if (it == entries_.end()) {
+    return false;
+  }
+  if (data != nullptr) {
+    *data = it->second.str();
+  }
+  return true;
+}
+
+bool MetadataCache::load(const Key& key, Uptane::MetaBuffer* data) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = find(key);
+  if (it == entries_.end()) {
+    return false;
+  }
+  if (data != nullptr) {
+    *data = it->second;
+  }
+  return true;
+}
+
+void MetadataCache::store(const Key& key, const Uptane::MetaBuffer& data) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    eraseEntry(it->second);
+  }
+  const size_t size = data.str().size();
+  if (size > budget_) {
+    return;
+  }
+  while (stats_.bytes + size > budget_ || !memory_.grow(size)) {
+    if (entries_.empty()) {
+      return;
+    }
+    eraseEntry(std::prev(entries_.end()));
+    ++stats_.evictions;
+  }
+  entries_.emplace_front(key, data);
+  index_.emplace(key, entries_.begin());
+  stats_.bytes += size;
+  stats_.entries = entries_.size();
+}
+
+void MetadataCache::erase(const Key& key) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    eraseEntry(it->second);
+  }
+}
+
+void MetadataCache::eraseKind(int kind, int repo) {
+  std::lock_guard<std::mutex> lock(m_);
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    const auto current = it++;
+    if (std::get<0>(current->first) == kind && (repo < 0 || std::get<1>(current->first) == repo)) {
+      eraseEntry(current);
+    }
+  }
+}
+
+void MetadataCache::clear() {
+  std::lock_guard<std::mutex> lock(m_);
+  entries_.clear();
+  index_.clear();
+  memory_.release();
+  stats_.bytes = 0;
+  stats_.entries = 0;
+}
+
+MetadataCacheStats MetadataCache::stats() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return stats_;
+}
+
+void MetadataCache::eraseEntry(std::list<Entry>::iterator it) {
+  stats_.bytes -= it->second.str().size();
+  memory_.shrink(it->second.str().size());
+  index_.erase(it->first);
+  entries_.erase(it);
+  stats_.entries = entries_.size();
+}
+
+CachedStorage::CachedStorage(std::shared_ptr<INvStorage> storage, size_t budget, const StorageConfig& config)
+    : INvStorage(config), storage_(std::move(storage)), cache_(std::make_shared<MetadataCache>(budget)) {}
+
+void CachedStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) {
+  storage_->storeRoot(data, repo, version);
+  cache_->store(rootKey(repo, version), data);
+  // the latest version may have changed
+  cache_->erase(rootKey(repo, Uptane::Version()));
+}
+
+bool CachedStorage::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const {
+  const auto key = rootKey(repo, version);
+  if (cache_->load(key, data)) {
+    return true;
+  }
+  std::string loaded;
+  if (!storage_->loadRoot(&loaded, repo, version)) {
+    return false;
+  }
+  cache_->store(key, loaded);
+  if (data != nullptr) {
+    *data = std::move(loaded);
+  }
+  return true;
+}
+
+void CachedStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Role role) {
+  storage_->storeNonRoot(data, repo, role);
+  cache_->store(nonRootKey(repo, role), data);
+}
+
+bool CachedStorage::loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const {
+  const auto key = nonRootKey(repo, role);
+  if (cache_->load(key, data)) {
+    return true;
+  }
+  std::string loaded;
+  if (!storage_->loadNonRoot(&loaded, repo, role)) {
+    return false;
+  }
+  cache_->store(key, loaded);
+  if (data != nullptr) {
+    *data = std::move(loaded);
+  }
+  return true;
+}
+
+bool CachedStorage::loadRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo,
+                                   Uptane::Version version) const {
+  const auto key = rootKey(repo, version);
+  if (cache_->load(key, data)) {
+    return true;
+  }
+  Uptane::MetaBuffer loaded;
+  if (!storage_->loadRootBuffer(&loaded, repo, version)) {
+    return false;
+  }
+  cache_->store(key, loaded);
+  if (data != nullptr) {
+    *data = loaded;
+  }
+  return true;
+}
+
+bool CachedStorage::loadNonRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo,
+                                      Uptane::Role role) const {
+  const auto key = nonRootKey(repo, role);
+  if (cache_->load(key, data)) {
+    return true;
+  }
+  Uptane::MetaBuffer loaded;
+  if (!storage_->loadNonRootBuffer(&loaded, repo, role)) {
+    return false;
+  }
+  cache_->store(key, loaded);
+  if (data != nullptr) {
+    *data = loaded;
+  }
+  return true;
+}
+
+void CachedStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
+  storage_->clearNonRootMeta(repo);
+  cache_->eraseKind(static_cast<int>(MetaKind::kNonRoot), static_cast<int>(repo));
+}
+
+bool CachedStorage::loadMetaExpiry(Uptane::RepositoryType repo, Uptane::Role role, TimeStamp* expiry) const {
+  return storage_->loadMetaExpiry(repo, role, expiry);
+}
+
+void CachedStorage::clearMetadata() {
+  storage_->clearMetadata();
+  cache_->eraseKind(static_cast<int>(MetaKind::kRoot));
+  cache_->eraseKind(static_cast<int>(MetaKind::kNonRoot));
+}
+
+void CachedStorage::storeDelegation(const std::string& data, Uptane::Role role) {
+  storage_->storeDelegation(data, role);
+  cache_->store(delegationKey(role), data);
+}
+
+bool CachedStorage::loadDelegation(std::string* data, Uptane::Role role) const {
+  const auto key = delegationKey(role);
+  if (cache_->load(key, data)) {
+    return true;
+  }
+  std::string loaded;
+  if (!storage_->loadDelegation(&loaded, role)) {
+    return false;
+  }
+  cache_->store(key, loaded);
+  if (data != nullptr) {
+    *data = std::move(loaded);
+  }
+  return true;
+}
+
+void CachedStorage::deleteDelegation(Uptane::Role role) {
+  storage_->deleteDelegation(role);
+  cache_->erase(delegationKey(role));
+}
+
+void CachedStorage::clearDelegations() {
+  storage_->clearDelegations();
+  cache_->eraseKind(static_cast<int>(MetaKind::kDelegation));
+}
+
+std::unique_ptr<StorageBatch> CachedStorage::beginBatch() {
+  return std_::make_unique<CachedStorageBatch>(storage_->beginBatch(), cache_);
+}
+
+void CachedStorage::loadSnapshot(StorageSnapshot* snapshot) const { storage_->loadSnapshot(snapshot); }
+
+StorageMaintenance CachedStorage::maintain(std::chrono::milliseconds budget, bool integrity_check) {
+  return storage_->maintain(budget, integrity_check);
+}
+
+void CachedStorage::storePrimaryKeys(const std::string& public_key, const std::string& private_key) {
+  storage_->storePrimaryKeys(public_key, private_key);
+}
+
+bool CachedStorage::loadPrimaryKeys(std::string* public_key, std::string* private_key) const {
+  return storage_->loadPrimaryKeys(public_key, private_key);
+}
+
+bool CachedStorage::loadPrimaryPublic(std::string* public_key) const {
+  return storage_->loadPrimaryPublic(public_key);
+}
+
+bool CachedStorage::loadPrimaryPrivate(std::string* private_key) const {
+  return storage_->loadPrimaryPrivate(private_key);
+}
+
+void CachedStorage::clearPrimaryKeys() {
+  storage_->clearPrimaryKeys();
+}
+
+void CachedStorage::saveSecondaryInfo(const Uptane::EcuSerial& ecu_serial, const std::string& sec_type,
+                                      const PublicKey& public_key) {
+  storage_->saveSecondaryInfo(ecu_serial, sec_type, public_key);
+}
+
+void CachedStorage::saveSecondaryData(const Uptane::EcuSerial& ecu_serial, const std::string& data) {
+  storage_->saveSecondaryData(ecu_serial, data);
+}
+
+bool CachedStorage::loadSecondaryInfo(const Uptane::EcuSerial& ecu_serial, SecondaryInfo* secondary) const {
+  return storage_->loadSecondaryInfo(ecu_serial, secondary);
+}
+
+bool CachedStorage::loadSecondariesInfo(std::vector<SecondaryInfo>* secondaries) const {
+  return storage_->loadSecondariesInfo(secondaries);
+}
+
+void CachedStorage::storeTlsCreds(const std::string& ca, const std::string& cert, const std::string& pkey) {
+  storage_->storeTlsCreds(ca, cert, pkey);
+}
+
+void CachedStorage::storeTlsCa(const std::string& ca) {
+  storage_->storeTlsCa(ca);
+}
+
+void CachedStorage::storeTlsCert(const std::string& cert) {
+  storage_->storeTlsCert(cert);
+}
+
+void CachedStorage::storeTlsPkey(const std::string& pkey) {
+  storage_->storeTlsPkey(pkey);
+}
+
+bool CachedStorage::loadTlsCreds(std::string* ca, std::string* cert, std::string* pkey) const {
+  return storage_->loadTlsCreds(ca, cert, pkey);
+}
+
+bool CachedStorage::loadTlsCa(std::string* ca) const {
+  return storage_->loadTlsCa(ca);
+}
+
+bool CachedStorage::loadTlsCert(std::string* cert) const {
+  return storage_->loadTlsCert(cert);
+}
+
+bool CachedStorage::loadTlsPkey(std::string* cert) const {
+  return storage_->loadTlsPkey(cert);
+}
+
+void CachedStorage::clearTlsCreds() {
+  storage_->clearTlsCreds();
+}
+
+void CachedStorage::storeMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, const std::string& etag,
+                                        const std::string& last_modified) {
+  storage_->storeMetaValidators(repo, role, etag, last_modified);
+}
+
+bool CachedStorage::loadMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, std::string* etag,
+                                       std::string* last_modified) const {
+  return storage_->loadMetaValidators(repo, role, etag, last_modified);
+}
+
+bool CachedStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const {
+  return storage_->loadAllDelegations(data);
+}
+
+void CachedStorage::storeDeviceId(const std::string& device_id) {
+  storage_->storeDeviceId(device_id);
+}
+
+bool CachedStorage::loadDeviceId(std::string* device_id) const {
+  return storage_->loadDeviceId(device_id);
+}
+
+void CachedStorage::clearDeviceId() {
+  storage_->clearDeviceId();
+}
+
+void CachedStorage::storeEcuSerials(const EcuSerials& serials) {
+  storage_->storeEcuSerials(serials);
+}
+
+bool CachedStorage::loadEcuSerials(EcuSerials* serials) const {
+  return storage_->loadEcuSerials(serials);
+}
+
+void CachedStorage::clearEcuSerials() {
+  storage_->clearEcuSerials();
+}
+
+void CachedStorage::storeCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, const std::string& manifest) {
+  storage_->storeCachedEcuManifest(ecu_serial, manifest);
+}
+
+bool CachedStorage::loadCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, std::string* manifest) const {
+  return storage_->loadCachedEcuManifest(ecu_serial, manifest);
+}
+
+void CachedStorage::saveMisconfiguredEcu(const MisconfiguredEcu& ecu) {
+  storage_->saveMisconfiguredEcu(ecu);
+}
+
+bool CachedStorage::loadMisconfiguredEcus(std::vector<MisconfiguredEcu>* ecus) const {
+  return storage_->loadMisconfiguredEcus(ecus);
+}
+
+void CachedStorage::clearMisconfiguredEcus() {
+  storage_->clearMisconfiguredEcus();
+}
+
+void CachedStorage::storeEcuRegistered() {
+  storage_->storeEcuRegistered();
+}
+
+bool CachedStorage::loadEcuRegistered() const {
+  return storage_->loadEcuRegistered();
+}
+
+void CachedStorage::clearEcuRegistered() {
+  storage_->clearEcuRegistered();
+}
+
+void CachedStorage::storeNeedReboot() {
+  storage_->storeNeedReboot();
+}
+
+bool CachedStorage::loadNeedReboot(bool* need_reboot) const {
+  return storage_->loadNeedReboot(need_reboot);
+}
+
+void CachedStorage::clearNeedReboot() {
+  storage_->clearNeedReboot();
+}
+
+void CachedStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptane::Target& target,
+                                         InstalledVersionUpdateMode update_mode,
+                                         const Uptane::CorrelationId& correlation_id) {
+  storage_->saveInstalledVersion(ecu_serial, target, update_mode, correlation_id);
+}
+
+bool CachedStorage::loadInstalledVersions(const std::string& ecu_serial,
+                                          boost::optional<Uptane::Target>* current_version,
+                                          boost::optional<Uptane::Target>* pending_version,
+                                          Uptane::CorrelationId* correlation_id) const {
+  return storage_->loadInstalledVersions(ecu_serial, current_version, pending_version, correlation_id);
+}
+
+bool CachedStorage::loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
+                                        bool only_installed) const {
+  return storage_->loadInstallationLog(ecu_serial, log, only_installed);
+}
+
+bool CachedStorage::loadInstalledVersionByHash(const std::string& ecu_serial, const std::string& sha256,
+                                               boost::optional<Uptane::Target>* version) const {
+  return storage_->loadInstalledVersionByHash(ecu_serial, sha256, version);
+}
+
+bool CachedStorage::hasPendingInstall() {
+  return storage_->hasPendingInstall();
+}
+
+void CachedStorage::getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) {
+  storage_->getPendingEcus(pendingEcus);
+}
+
+void CachedStorage::clearInstalledVersions() {
+  storage_->clearInstalledVersions();
+}
+
+void CachedStorage::saveEcuInstallationResult(const Uptane::EcuSerial& ecu_serial,
+                                              const data::InstallationResult& result) {
+  storage_->saveEcuInstallationResult(ecu_serial, result);
+}
+
+bool CachedStorage::loadEcuInstallationResults(
+    std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>>* results) const {
+  return storage_->loadEcuInstallationResults(results);
+}
+
+void CachedStorage::storeDeviceInstallationResult(const data::InstallationResult& result, const std::string& raw_report,
+                                                  const std::string& correlation_id) {
+  storage_->storeDeviceInstallationResult(result, raw_report, correlation_id);
+}
+
+bool CachedStorage::storeDeviceInstallationRawReport(const std::string& raw_report) {
+  return storage_->storeDeviceInstallationRawReport(raw_report);
+}
+
+bool CachedStorage::loadDeviceInstallationResult(data::InstallationResult* result, std::string* raw_report,
+                                                 std::string* correlation_id) const {
+  return storage_->loadDeviceInstallationResult(result, raw_report, correlation_id);
+}
+
+void CachedStorage::clearInstallationResults() {
+  storage_->clearInstallationResults();
+}
+
+void CachedStorage::saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, int64_t counter) {
+  storage_->saveEcuReportCounter(ecu_serial, counter);
+}
+
+bool CachedStorage::loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const {
+  return storage_->loadEcuReportCounter(results);
+}
+
+void CachedStorage::saveReportEvent(const Json::Value& json_value) {
+  storage_->saveReportEvent(json_value);
+}
+
+bool CachedStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const {
+  return storage_->loadReportEvents(report_array, id_max, limit);
+}
+
+bool CachedStorage::loadReportEventsRaw(std::vector<std::string>* events, int64_t* id_max, int limit,
+                                        size_t max_size) const {
+  return storage_->loadReportEventsRaw(events, id_max, limit, max_size);
+}
+
+void CachedStorage::deleteReportEvents(int64_t id_max) {
+  storage_->deleteReportEvents(id_max);
+}
+
+void CachedStorage::storeDeviceDataHash(const std::string& data_type, const std::string& hash) {
+  storage_->storeDeviceDataHash(data_type, hash);
+}
+
+bool CachedStorage::loadDeviceDataHash(const std::string& data_type, std::string* hash) const {
+  return storage_->loadDeviceDataHash(data_type, hash);
+}
+
+void CachedStorage::clearDeviceData() {
+  storage_->clearDeviceData();
+}
+
+void CachedStorage::storeTargetFilename(const std::string& targetname, const std::string& filename) const {
+  storage_->storeTargetFilename(targetname, filename);
+}
+
+std::string CachedStorage::getTargetFilename(const std::string& targetname) const {
+  return storage_->getTargetFilename(targetname);
+}
+
+std::vector<std::string> CachedStorage::getAllTargetNames() const {
+  return storage_->getAllTargetNames();
+}
+
+void CachedStorage::linkTargetFilename(const std::string& targetname, const std::string& filename) const {
+  storage_->linkTargetFilename(targetname, filename);
+}
+
+std::vector<std::string> CachedStorage::getTargetNamesForFile(const std::string& filename) const {
+  return storage_->getTargetNamesForFile(filename);
+}
+
+void CachedStorage::deleteTargetInfo(const std::string& targetname) const {
+  storage_->deleteTargetInfo(targetname);
+}
+
+void CachedStorage::storeDownloadSegments(const std::string& targetname,
+                                          const std::vector<DownloadSegment>& segments) const {
+  storage_->storeDownloadSegments(targetname, segments);
+}
+
+bool CachedStorage::loadDownloadSegments(const std::string& targetname, std::vector<DownloadSegment>* segments) const {
+  return storage_->loadDownloadSegments(targetname, segments);
+}
+
+void CachedStorage::updateDownloadSegment(const std::string& targetname, size_t segment, uint64_t downloaded) const {
+  storage_->updateDownloadSegment(targetname, segment, downloaded);
+}
+
+void CachedStorage::clearDownloadSegments(const std::string& targetname) const {
+  storage_->clearDownloadSegments(targetname);
+}
+
+void CachedStorage::storeTargetHashState(const std::string& targetname, uint64_t hashed_length,
+                                         const std::string& state) const {
+  storage_->storeTargetHashState(targetname, hashed_length, state);
+}
+
+bool CachedStorage::loadTargetHashState(const std::string& targetname, uint64_t* hashed_length,
+                                        std::string* state) const {
+  return storage_->loadTargetHashState(targetname, hashed_length, state);
+}
+
+void CachedStorage::storeVerifiedFile(const std::string& filename, const VerifiedFile& file) const {
+  storage_->storeVerifiedFile(filename, file);
+}
+
+bool CachedStorage::loadVerifiedFile(const std::string& filename, VerifiedFile* file) const {
+  return storage_->loadVerifiedFile(filename, file);
+}
@@ -0,0 +1,198 @@
+#ifndef CACHEDSTORAGE_H_
+#define CACHEDSTORAGE_H_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "invstorage.h"
+#include "utilities/memory_budget.h"
+
+struct MetadataCacheStats {
+  uint64_t hits{0};
+  uint64_t misses{0};
+  uint64_t evictions{0};
+  // size of the cached metadata
+  size_t bytes{0};
+  size_t entries{0};
+};
+
+/**
+ * Least recently used metadata, up to a number of bytes. Metadata larger than
+ * the whole budget is not cached. Entries are also evicted when the process
+ * memory budget runs out (see MemoryBudget).
+ */
+class MetadataCache {
+ public:
+  // kind of metadata, repository, Root version or role, delegation name
+  using Key = std::tuple<int, int, int, std::string>;
+
+  explicit MetadataCache(size_t budget)
+      : budget_(budget), memory_(MemoryBudget::instance().reservation(MemoryBudget::User::kMetadataCache)) {}
+  bool load(const Key& key, std::string* data);
+  bool load(const Key& key, Uptane::MetaBuffer* data);
+  // the cache keeps a reference to the buffer, it is not copied
+  void store(const Key& key, const Uptane::MetaBuffer& data);
+  void erase(const Key& key);
+  // erase the entries of a kind, and of a repository unless it is negative
+  void eraseKind(int kind, int repo = -1);
+  void clear();
+  MetadataCacheStats stats() const;
+
+ private:
+  using Entry = std::pair<Key, Uptane::MetaBuffer>;
+  // must be called with m_ held
+  std::list<Entry>::iterator find(const Key& key);
+  // must be called with m_ held
+  void eraseEntry(std::list<Entry>::iterator it);
+
+  const size_t budget_;
+  mutable std::mutex m_;
+  // most recently used first
+  std::list<Entry> entries_;
+  std::map<Key, std::list<Entry>::iterator> index_;
+  MetadataCacheStats stats_;
+  MemoryBudget::Reservation memory_;
+};
+
+/**
+ * Storage that keeps the metadata it reads and writes in memory, so that
+ * repeated reads don't go to the database. Everything else is passed to the
+ * wrapped storage, and so are all the writes.
+ *
+ * The cache assumes that nobody else writes the metadata of the wrapped
+ * storage meanwhile. Writes made in a batch that is rolled back clear it.
+ */
+class CachedStorage : public INvStorage {
+ public:
+  CachedStorage(std::shared_ptr<INvStorage> storage, size_t budget, const StorageConfig& config);
+  ~CachedStorage() override = default;
+  CachedStorage(const CachedStorage&) = delete;
+  CachedStorage(CachedStorage&&) = delete;
+  CachedStorage& operator=(const CachedStorage&) = delete;
+  CachedStorage& operator=(CachedStorage&&) = delete;
+
+  MetadataCacheStats cacheStats() const { return cache_->stats(); }
+
+  StorageType type() override { return storage_->type(); }
+  void storePrimaryKeys(const std::string& public_key, const std::string& private_key) override;
+  bool loadPrimaryKeys(std::string* public_key, std::string* private_key) const override;
+  bool loadPrimaryPublic(std::string* public_key) const override;
+  bool loadPrimaryPrivate(std::string* private_key) const override;
+  void clearPrimaryKeys() override;
+  void saveSecondaryInfo(const Uptane::EcuSerial& ecu_serial, const std::string& sec_type,
+                         const PublicKey& public_key) override;
+  void saveSecondaryData(const Uptane::EcuSerial& ecu_serial, const std::string& data) override;
+  bool loadSecondaryInfo(const Uptane::EcuSerial& ecu_serial, SecondaryInfo* secondary) const override;
+  bool loadSecondariesInfo(std::vector<SecondaryInfo>* secondaries) const override;
+  void storeTlsCreds(const std::string& ca, const std::string& cert, const std::string& pkey) override;
+  void storeTlsCa(const std::string& ca) override;
+  void storeTlsCert(const std::string& cert) override;
+  void storeTlsPkey(const std::string& pkey) override;
+  bool loadTlsCreds(std::string* ca, std::string* cert, std::string* pkey) const override;
+  bool loadTlsCa(std::string* ca) const override;
+  bool loadTlsCert(std::string* cert) const override;
+  bool loadTlsPkey(std::string* cert) const override;
+  void clearTlsCreds() override;
+  void storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) override;
+  bool loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const override;
+  void storeNonRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Role role) override;
+  bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const override;
+  bool loadRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo, Uptane::Version version) const override;
+  bool loadNonRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo, Uptane::Role role) const override;
+  void clearNonRootMeta(Uptane::RepositoryType repo) override;
+  bool loadMetaExpiry(Uptane::RepositoryType repo, Uptane::Role role, TimeStamp* expiry) const override;
+  void storeMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, const std::string& etag,
+                           const std::string& last_modified) override;
+  bool loadMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, std::string* etag,
+                          std::string* last_modified) const override;
+  void clearMetadata() override;
+  void storeDelegation(const std::string& data, Uptane::Role role) override;
+  bool loadDelegation(std::string* data, Uptane::Role role) const override;
+  bool loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const override;
+  void deleteDelegation(Uptane::Role role) override;
+  void clearDelegations() override;
+  void storeDeviceId(const std::string& device_id) override;
+  bool loadDeviceId(std::string* device_id) const override;
+  void clearDeviceId() override;
+  void storeEcuSerials(const EcuSerials& serials) override;
+  bool loadEcuSerials(EcuSerials* serials) const override;
+  void clearEcuSerials() override;
+  void storeCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, const std::string& manifest) override;
+  bool loadCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, std::string* manifest) const override;
+  void saveMisconfiguredEcu(const MisconfiguredEcu& ecu) override;
+  bool loadMisconfiguredEcus(std::vector<MisconfiguredEcu>* ecus) const override;
+  void clearMisconfiguredEcus() override;
+  void storeEcuRegistered() override;
+  bool loadEcuRegistered() const override;
+  void clearEcuRegistered() override;
+  void storeNeedReboot() override;
+  bool loadNeedReboot(bool* need_reboot) const override;
+  void clearNeedReboot() override;
+  void saveInstalledVersion(const std::string& ecu_serial, const Uptane::Target& target,
+                            InstalledVersionUpdateMode update_mode,
+                            const Uptane::CorrelationId& correlation_id) override;
+  bool loadInstalledVersions(const std::string& ecu_serial, boost::optional<Uptane::Target>* current_version,
+                             boost::optional<Uptane::Target>* pending_version,
+                             Uptane::CorrelationId* correlation_id) const override;
+  bool loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
+                           bool only_installed) const override;
+  bool loadInstalledVersionByHash(const std::string& ecu_serial, const std::string& sha256,
+                                  boost::optional<Uptane::Target>* version) const override;
+  bool hasPendingInstall() override;
+  void getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) override;
+  void clearInstalledVersions() override;
+  void saveEcuInstallationResult(const Uptane::EcuSerial& ecu_serial, const data::InstallationResult& result) override;
+  bool loadEcuInstallationResults(
+      std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>>* results) const override;
+  void storeDeviceInstallationResult(const data::InstallationResult& result, const std::string& raw_report,
+                                     const std::string& correlation_id) override;
+  bool storeDeviceInstallationRawReport(const std::string& raw_report) override;
+  bool loadDeviceInstallationResult(data::InstallationResult* result, std::string* raw_report,
+                                    std::string* correlation_id) const override;
+  void clearInstallationResults() override;
+  void saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, int64_t counter) override;
+  bool loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const override;
+  void saveReportEvent(const Json::Value& json_value) override;
+  bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const override;
+  bool loadReportEventsRaw(std::vector<std::string>* events, int64_t* id_max, int limit,
+                           size_t max_size) const override;
+  void deleteReportEvents(int64_t id_max) override;
+  void storeDeviceDataHash(const std::string& data_type, const std::string& hash) override;
+  bool loadDeviceDataHash(const std::string& data_type, std::string* hash) const override;
+  void clearDeviceData() override;
+  void storeTargetFilename(const std::string& targetname, const std::string& filename) const override;
+  std::string getTargetFilename(const std::string& targetname) const override;
+  std::vector<std::string> getAllTargetNames() const override;
+  void linkTargetFilename(const std::string& targetname, const std::string& filename) const override;
+  std::vector<std::string> getTargetNamesForFile(const std::string& filename) const override;
+  void deleteTargetInfo(const std::string& targetname) const override;
+  void storeDownloadSegments(const std::string& targetname,
+                             const std::vector<DownloadSegment>& segments) const override;
+  bool loadDownloadSegments(const std::string& targetname, std::vector<DownloadSegment>* segments) const override;
+  void updateDownloadSegment(const std::string& targetname, size_t segment, uint64_t downloaded) const override;
+  void clearDownloadSegments(const std::string& targetname) const override;
+  void storeTargetHashState(const std::string& targetname, uint64_t hashed_length,
+                            const std::string& state) const override;
+  bool loadTargetHashState(const std::string& targetname, uint64_t* hashed_length, std::string* state) const override;
+  void storeVerifiedFile(const std::string& filename, const VerifiedFile& file) const override;
+  bool loadVerifiedFile(const std::string& filename, VerifiedFile* file) const override;
+  std::unique_ptr<StorageBatch> beginBatch() override;
+  void loadSnapshot(StorageSnapshot* snapshot) const override;
+  uint64_t metadataGeneration(Uptane::RepositoryType repo) const override {
+    return storage_->metadataGeneration(repo);
+  }
+  StorageMaintenance maintain(std::chrono::milliseconds budget, bool integrity_check) override;
+
+ private:
+  std::shared_ptr<INvStorage> storage_;
+  std::shared_ptr<MetadataCache> cache_;
+};
+
+#endif  // CACHEDSTORAGE_H_
@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "storage/cachedstorage.h"
+#include "storage/sqlstorage.h"
+#include "utilities/memory_budget.h"
+#include "utilities/utils.h"
+
+class CachedStorageTest : public ::testing::Test {
+ protected:
+  CachedStorageTest() {
+    config_.path = temp_dir_.Path();
+    sql_storage_ = std::make_shared<SQLStorage>(config_, false);
+  }
+
+  TemporaryDirectory temp_dir_;
+  StorageConfig config_;
+  std::shared_ptr<SQLStorage> sql_storage_;
+};
+
+/* Stored metadata is served from memory, and the latest Root follows new
+ * versions. */
+TEST_F(CachedStorageTest, LoadStore) {
+  CachedStorage storage(sql_storage_, 1024, config_);
+  std::string data;
+
+  storage.storeRoot("root 1", Uptane::RepositoryType::Director(), Uptane::Version(1));
+  EXPECT_TRUE(storage.loadRoot(&data, Uptane::RepositoryType::Director(), Uptane::Version(1)));
+  EXPECT_EQ(data, "root 1");
+  EXPECT_EQ(storage.cacheStats().hits, 1);
+  EXPECT_EQ(storage.cacheStats().misses, 0);
+
+  EXPECT_TRUE(storage.loadLatestRoot(&data, Uptane::RepositoryType::Director()));
+  EXPECT_EQ(data, "root 1");
+  EXPECT_TRUE(storage.loadLatestRoot(&data, Uptane::RepositoryType::Director()));
+  EXPECT_EQ(storage.cacheStats().hits, 2);
+  EXPECT_EQ(storage.cacheStats().misses, 1);
+
+  storage.storeRoot("root 2", Uptane::RepositoryType::Director(), Uptane::Version(2));
+  EXPECT_TRUE(storage.loadLatestRoot(&data, Uptane::RepositoryType::Director()));
+  EXPECT_EQ(data, "root 2");
+
+  // missing metadata is not cached
+  EXPECT_FALSE(storage.loadRoot(&data, Uptane::RepositoryType::Image(), Uptane::Version(1)));
+  EXPECT_FALSE(storage.loadRoot(nullptr, Uptane::RepositoryType::Image(), Uptane::Version(1)));
+
+  storage.storeNonRoot("targets", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  storage.storeDelegation("delegated", Uptane::Role::Delegation("role"));
+  EXPECT_TRUE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, "targets");
+  EXPECT_TRUE(storage.loadDelegation(&data, Uptane::Role::Delegation("role")));
+  EXPECT_EQ(data, "delegated");
+  EXPECT_EQ(storage.cacheStats().entries, 5);
+}
+
+/* The cache evicts when the memory budget runs out, before its own limit. */
+TEST_F(CachedStorageTest, MemoryBudget) {
+  CachedStorage storage(sql_storage_, 1024, config_);
+  MemoryBudget::instance().setLimit(MemoryBudget::instance().used() + 25);
+
+  storage.storeNonRoot("0123456789", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  storage.storeNonRoot("0123456789", Uptane::RepositoryType::Image(), Uptane::Role::Snapshot());
+  storage.storeNonRoot("0123456789", Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
+  EXPECT_EQ(storage.cacheStats().evictions, 1);
+  EXPECT_EQ(storage.cacheStats().bytes, 20);
+  MemoryBudget::instance().setLimit(0);
+}
+
+/* Metadata loaded as a buffer is shared with the cache, not copied. */
+TEST_F(CachedStorageTest, SharedBuffer) {
+  CachedStorage storage(sql_storage_, 1024, config_);
+  sql_storage_->storeNonRoot("targets", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+
+  Uptane::MetaBuffer first;
+  Uptane::MetaBuffer second;
+  EXPECT_TRUE(storage.loadNonRootBuffer(&first, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_TRUE(storage.loadNonRootBuffer(&second, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_EQ(first.str(), "targets");
+  EXPECT_TRUE(first.shares(second));
+
+  // the buffers handed out stay valid when the metadata changes
+  storage.storeNonRoot("new targets", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  EXPECT_TRUE(storage.loadNonRootBuffer(&second, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_EQ(first.str(), "targets");
+  EXPECT_EQ(second.str(), "new targets");
+
+  // storages without a cache give a buffer of their own
+  sql_storage_->storeRoot("root", Uptane::RepositoryType::Image(), Uptane::Version(1));
+  EXPECT_TRUE(sql_storage_->loadLatestRootBuffer(&first, Uptane::RepositoryType::Image()));
+  EXPECT_EQ(first.str(), "root");
+  EXPECT_FALSE(sql_storage_->loadLatestRootBuffer(&first, Uptane::RepositoryType::Director()));
+}
+
+/* Removed metadata is not served from memory anymore. */
+TEST_F(CachedStorageTest, Invalidate) {
+  CachedStorage storage(sql_storage_, 1024, config_);
+  std::string data;
+
+  storage.storeRoot("root", Uptane::RepositoryType::Image(), Uptane::Version(1));
+  storage.storeNonRoot("targets", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  storage.storeNonRoot("director targets", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  storage.storeDelegation("delegated", Uptane::Role::Delegation("role"));
+
+  storage.clearNonRootMeta(Uptane::RepositoryType::Image());
+  EXPECT_FALSE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_TRUE(storage.loadNonRoot(&data, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+  EXPECT_TRUE(storage.loadRoot(&data, Uptane::RepositoryType::Image(), Uptane::Version(1)));
+
+  storage.deleteDelegation(Uptane::Role::Delegation("role"));
+  EXPECT_FALSE(storage.loadDelegation(&data, Uptane::Role::Delegation("role")));
+
+  storage.clearMetadata();
+  EXPECT_FALSE(storage.loadNonRoot(&data, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+  EXPECT_FALSE(storage.loadRoot(&data, Uptane::RepositoryType::Image(), Uptane::Version(1)));
+  EXPECT_EQ(storage.cacheStats().entries, 0);
+}
+
+/* The least recently used metadata goes first when the budget is exceeded. */
+TEST_F(CachedStorageTest, Evict) {
+  CachedStorage storage(sql_storage_, 20, config_);
+  std::string data;
+
+  storage.storeNonRoot("0123456789", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  storage.storeNonRoot("0123456789", Uptane::RepositoryType::Image(), Uptane::Role::Snapshot());
+  EXPECT_TRUE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  storage.storeNonRoot("0123456789", Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
+  EXPECT_EQ(storage.cacheStats().evictions, 1);
+  EXPECT_EQ(storage.cacheStats().bytes, 20);
+
+  // Snapshot was evicted, but is still in the database
+  const auto misses = storage.cacheStats().misses;
+  EXPECT_TRUE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Snapshot()));
+  EXPECT_EQ(data, "0123456789");
+  EXPECT_EQ(storage.cacheStats().misses, misses + 1);
+
+  // too large to be cached at all
+  storage.storeDelegation(std::string(21, 'x'), Uptane::Role::Delegation("role"));
+  EXPECT_TRUE(storage.loadDelegation(&data, Uptane::Role::Delegation("role")));
+  EXPECT_EQ(data, std::string(21, 'x'));
+  EXPECT_LE(storage.cacheStats().bytes, 20);
+}
+
+/* Metadata written in a batch that is rolled back is not served either. */
+TEST_F(CachedStorageTest, Batch) {
+  CachedStorage storage(sql_storage_, 1024, config_);
+  std::string data;
+
+  {
+    auto batch = storage.beginBatch();
+    storage.storeNonRoot("targets", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+    batch->commit();
+  }
+  {
+    auto batch = storage.beginBatch();
+    storage.storeNonRoot("snapshot", Uptane::RepositoryType::Image(), Uptane::Role::Snapshot());
+  }
+  EXPECT_FALSE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Snapshot()));
+  EXPECT_TRUE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, "targets");
+}
+
+/* newStorage() only adds the cache when it has a budget. */
+TEST_F(CachedStorageTest, NewStorage) {
+  EXPECT_NE(std::dynamic_pointer_cast<CachedStorage>(INvStorage::newStorage(config_)), nullptr);
+  config_.metadata_cache_size = 0;
+  EXPECT_EQ(std::dynamic_pointer_cast<CachedStorage>(INvStorage::newStorage(config_)), nullptr);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
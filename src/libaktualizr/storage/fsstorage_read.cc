@@ -4,6 +4,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <utility>
@@ -35,8 +36,8 @@ FSStorageRead::FSStorageRead(const StorageConfig& config) : config_(config) {
     }
   }
 
-  latest_director_root = findMaxVersion(director_path, Uptane::Role::Root());
-  latest_image_root = findMaxVersion(image_path, Uptane::Role::Root());
+  director_root_versions = scanRootVersions(director_path);
+  image_root_versions = scanRootVersions(image_path);
 }
 
 bool FSStorageRead::loadPrimaryKeys(std::string* public_key, std::string* private_key) const {
@@ -110,13 +111,13 @@ bool FSStorageRead::loadTlsPkey(std::string* pkey) const { return loadTlsCommon(
 bool FSStorageRead::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const {
   boost::filesystem::path metafile;
   if (repo == Uptane::RepositoryType::Director()) {
-    if (version.version() < 0) {
-      version = latest_director_root;
+    if (version.version() < 0 && !director_root_versions.empty()) {
+      version = Uptane::Version(director_root_versions.back());
     }
     metafile = config_.uptane_metadata_path.get(config_.path) / "director" / version.RoleFileName(Uptane::Role::Root());
   } else if (repo == Uptane::RepositoryType::Image()) {
-    if (version.version() < 0) {
-      version = latest_image_root;
+    if (version.version() < 0 && !image_root_versions.empty()) {
+      version = Uptane::Version(image_root_versions.back());
     }
     metafile = config_.uptane_metadata_path.get(config_.path) / "repo" / version.RoleFileName(Uptane::Role::Root());
   } else {
@@ -157,6 +158,17 @@ bool FSStorageRead::loadNonRoot(std::string* data, Uptane::RepositoryType repo,
   return true;
 }
 
+std::vector<Uptane::Version> FSStorageRead::rootVersions(Uptane::RepositoryType repo) const {
+  std::vector<Uptane::Version> versions;
+  if (repo == Uptane::RepositoryType::Director() || repo == Uptane::RepositoryType::Image()) {
+    for (const int version :
+         repo == Uptane::RepositoryType::Director() ? director_root_versions : image_root_versions) {
+      versions.emplace_back(version);
+    }
+  }
+  return versions;
+}
+
 bool FSStorageRead::loadDeviceId(std::string* device_id) const {
   if (!boost::filesystem::exists(Utils::absolutePath(config_.path, "device_id").string())) {
     return false;
@@ -269,12 +281,13 @@ bool FSStorageRead::splitNameRoleVersion(const std::string& full_name, std::stri
   return true;
 }
 
-Uptane::Version FSStorageRead::findMaxVersion(const boost::filesystem::path& meta_directory, const Uptane::Role& role) {
-  int version = -1;
+std::vector<int> FSStorageRead::scanRootVersions(const boost::filesystem::path& meta_directory) {
+  std::vector<int> versions;
   if (!boost::filesystem::exists(meta_directory)) {
-    return {};
+    return versions;
   }
 
+  const std::string root_name = Uptane::Version().RoleFileName(Uptane::Role::Root());
   boost::filesystem::directory_iterator it{meta_directory};
   for (; it != boost::filesystem::directory_iterator(); ++it) {
     if (!boost::filesystem::is_regular_file(it->path())) {
@@ -283,14 +296,13 @@ Uptane::Version FSStorageRead::findMaxVersion(const boost::filesystem::path& met
     std::string name = it->path().filename().native();
     int file_version;
     std::string file_role;
-    if (splitNameRoleVersion(name, &file_role, &file_version)) {
-      if (file_role == Uptane::Version().RoleFileName(role) && file_version > version) {
-        version = file_version;
-      }
+    if (splitNameRoleVersion(name, &file_role, &file_version) && file_role == root_name && file_version >= 0) {
+      versions.push_back(file_version);
     }
   }
 
-  return Uptane::Version(version);
+  std::sort(versions.begin(), versions.end());
+  return versions;
 }
 
 // clear methods, to clean the storage files after a migration
@@ -387,6 +399,34 @@ void FSStorageRead::cleanUpAll() {
   boost::filesystem::remove_all(config_.path / "targets");
 }
 
+static boost::filesystem::path migrationMarker(const StorageConfig& config) {
+  return Utils::absolutePath(config.path, "fs_migration");
+}
+
+FSStorageRead::MigrationStep FSStorageRead::loadMigrationStep(const StorageConfig& config) {
+  const boost::filesystem::path marker = migrationMarker(config);
+  if (!boost::filesystem::exists(marker)) {
+    return MigrationStep::kNone;
+  }
+  return Utils::readFile(marker) == "cleanup" ? MigrationStep::kCleanUp : MigrationStep::kCopy;
+}
+
+void FSStorageRead::storeMigrationStep(MigrationStep step) {
+  const boost::filesystem::path marker = migrationMarker(config_);
+  switch (step) {
+    case MigrationStep::kCopy:
+      Utils::writeFile(marker, std::string("copy"));
+      break;
+    case MigrationStep::kCleanUp:
+      Utils::writeFile(marker, std::string("cleanup"));
+      break;
+    case MigrationStep::kNone:
+    default:
+      boost::filesystem::remove(marker);
+      break;
+  }
+}
+
 bool FSStorageRead::FSStoragePresent(const StorageConfig& config) {
   return boost::filesystem::exists(Utils::absolutePath(config.path, "is_registered").string());
 }
@@ -1,6 +1,8 @@
 #ifndef FSSTORAGE_READ_H_
 #define FSSTORAGE_READ_H_
 
+#include <vector>
+
 #include <boost/filesystem/path.hpp>
 #include "invstorage.h"
 
@@ -26,6 +28,8 @@ class FSStorageRead {
     return loadRoot(data, repo, Uptane::Version());
   };
   bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, const Uptane::Role& role) const;
+  // versions of the stored Root metadata, in ascending order
+  std::vector<Uptane::Version> rootVersions(Uptane::RepositoryType repo) const;
 
   bool loadDeviceId(std::string* device_id) const;
   bool loadEcuSerials(EcuSerials* serials) const;
@@ -38,16 +42,25 @@ class FSStorageRead {
 
   static bool FSStoragePresent(const StorageConfig& config);
 
+  // Progress of the migration to the SQL storage, kept in a marker file so
+  // that an interrupted migration is resumed: the data is copied until it is
+  // committed to the SQL storage, then the old files are cleaned up.
+  enum class MigrationStep { kNone = 0, kCopy, kCleanUp };
+  static MigrationStep loadMigrationStep(const StorageConfig& config);
+  MigrationStep loadMigrationStep() const { return loadMigrationStep(config_); }
+  void storeMigrationStep(MigrationStep step);
+
  private:
   const StorageConfig& config_;
 
-  Uptane::Version latest_director_root;
-  Uptane::Version latest_image_root;
+  // indexed by a single scan of each metadata directory
+  std::vector<int> director_root_versions;
+  std::vector<int> image_root_versions;
 
   bool loadTlsCommon(std::string* data, const utils::BasedPath& path_in) const;
 
   static bool splitNameRoleVersion(const std::string& full_name, std::string* role_name, int* version);
-  static Uptane::Version findMaxVersion(const boost::filesystem::path& meta_directory, const Uptane::Role& role);
+  static std::vector<int> scanRootVersions(const boost::filesystem::path& meta_directory);
 
   void clearPrimaryKeys();
   void clearTlsCreds();
@@ -1,176 +1,327 @@
 #include "invstorage.h"
 
 #include <unistd.h>
+#include <chrono>
+#include <exception>
+#include <future>
+
 #include <boost/filesystem.hpp>
 
+#include "cachedstorage.h"
 #include "crypto/crypto.h"
 #include "fsstorage_read.h"
 #include "logging/logging.h"
+#include "profilingstorage.h"
 #include "sqlstorage.h"
 #include "uptane/exceptions.h"
 #include "utilities/utils.h"
 
-void INvStorage::importUpdateSimple(const boost::filesystem::path& base_path, store_data_t store_func,
-                                    load_data_t load_func, const utils::BasedPath& imported_data_path,
-                                    const std::string& data_name) {
-  std::string prev_content;
-  std::string content;
-  bool update = false;
-  if (!(this->*load_func)(&prev_content)) {
-    update = true;
-  } else if (!imported_data_path.empty()) {
-    content = Utils::readFile(imported_data_path.get(base_path).string());
-    if (Crypto::sha256digest(content) != Crypto::sha256digest(prev_content)) {
-      update = true;
-    }
+bool INvStorage::loadRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo,
+                                Uptane::Version version) const {
+  std::string loaded;
+  if (!loadRoot(&loaded, repo, version)) {
+    return false;
+  }
+  if (data != nullptr) {
+    *data = Uptane::MetaBuffer(std::move(loaded));
   }
+  return true;
+}
 
-  if (update && !imported_data_path.empty()) {
-    boost::filesystem::path abs_path = imported_data_path.get(base_path);
-    if (!boost::filesystem::exists(abs_path)) {
-      LOG_ERROR << "Couldn't import " << data_name << ": " << abs_path << " doesn't exist.";
-      return;
-    }
-    if (content.empty()) {
-      content = Utils::readFile(abs_path.string());
-    }
-    (this->*store_func)(content);
-    LOG_DEBUG << "Successfully imported " << data_name << " from " << abs_path;
+bool INvStorage::loadNonRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo, Uptane::Role role) const {
+  std::string loaded;
+  if (!loadNonRoot(&loaded, repo, role)) {
+    return false;
+  }
+  if (data != nullptr) {
+    *data = Uptane::MetaBuffer(std::move(loaded));
   }
+  return true;
 }
 
-void INvStorage::importUpdateCertificate(const boost::filesystem::path& base_path,
-                                         const utils::BasedPath& imported_data_path) {
-  std::string prev_content;
+namespace {
+
+// A file to import, read before the storage is touched
+struct ImportSource {
+  boost::filesystem::path path;
+  bool exists{false};
   std::string content;
-  bool update = false;
-  if (!loadTlsCert(&prev_content)) {
-    update = true;
-  } else if (!imported_data_path.empty()) {
-    content = Utils::readFile(imported_data_path.get(base_path).string());
-    if (Crypto::sha256digest(content) != Crypto::sha256digest(prev_content)) {
-      update = true;
-    }
+};
+
+// The client certificate, with the CN that may be used as device ID
+struct ImportCert {
+  ImportSource source;
+  std::string device_id;
+  std::exception_ptr error;
+};
+
+// Initial root metadata, validated against itself
+struct ImportRoot {
+  ImportSource source;
+  boost::optional<Uptane::Version> version;
+  std::string error;
+};
+
+struct ImportInstalledVersions {
+  boost::filesystem::path path;
+  std::vector<Uptane::Target> versions;
+  size_t current{SIZE_MAX};
+};
+
+using ImportClock = std::chrono::steady_clock;
+
+int64_t elapsedMs(ImportClock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(ImportClock::now() - since).count();
+}
+
+ImportSource readImportSource(const boost::filesystem::path& abs_path) {
+  ImportSource source;
+  source.path = abs_path;
+  source.exists = boost::filesystem::exists(abs_path);
+  if (source.exists) {
+    source.content = Utils::readFile(abs_path.string());
   }
+  return source;
+}
 
-  if (update && !imported_data_path.empty()) {
-    boost::filesystem::path abs_path = imported_data_path.get(base_path);
-    if (!boost::filesystem::exists(abs_path)) {
-      LOG_ERROR << "Couldn't import client certificate: " << abs_path << " doesn't exist.";
-      return;
-    }
-    if (content.empty()) {
-      content = Utils::readFile(abs_path.string());
-    }
+// Nothing is read for an empty path
+std::future<ImportSource> readImportSourceAsync(const boost::filesystem::path& base_path,
+                                                const utils::BasedPath& path) {
+  if (path.empty()) {
+    std::promise<ImportSource> none;
+    none.set_value(ImportSource());
+    return none.get_future();
+  }
+  return std::async(std::launch::async, readImportSource, path.get(base_path));
+}
 
-    // Make sure the device ID of the new cert hasn't changed.
-    const std::string new_device_id = Crypto::extractSubjectCN(content);
-    std::string old_device_id;
-    if (!loadDeviceId(&old_device_id)) {
-      LOG_DEBUG << "Unable to load previous device ID.";
-    } else if (new_device_id != old_device_id) {
-      LOG_WARNING << "Certificate at " << abs_path.string() << " has a CN that may be used as device ID of "
-                  << new_device_id << " but the device currently is identified as " << old_device_id;
+ImportCert readImportCert(const boost::filesystem::path& abs_path) {
+  ImportCert cert;
+  cert.source = readImportSource(abs_path);
+  if (cert.source.exists) {
+    try {
+      cert.device_id = Crypto::extractSubjectCN(cert.source.content);
+    } catch (...) {
+      // only an error if the certificate is imported
+      cert.error = std::current_exception();
     }
+  }
+  return cert;
+}
 
-    storeTlsCert(content);
-    LOG_DEBUG << "Successfully imported client certificate from " << abs_path;
+ImportRoot readImportRoot(const boost::filesystem::path& abs_path, Uptane::RepositoryType repo_type) {
+  ImportRoot root;
+  root.source.path = abs_path;
+  if (!boost::filesystem::is_regular_file(abs_path)) {
+    return root;
+  }
+  root.source.exists = true;
+  try {
+    root.source.content = Utils::readFile(abs_path);
+    Uptane::Root orig_root(Uptane::Root::Policy::kAcceptAll);
+    Uptane::Root new_root(repo_type, Utils::parseJSON(root.source.content), orig_root);
+    root.version = Uptane::Version(new_root.version());
+  } catch (Uptane::Exception& e) {
+    root.error = e.what();
   }
+  return root;
 }
 
-void INvStorage::importPrimaryKeys(const boost::filesystem::path& base_path, const utils::BasedPath& import_pubkey_path,
-                                   const utils::BasedPath& import_privkey_path) {
-  if (import_pubkey_path.empty() || import_privkey_path.empty()) {
-    LOG_ERROR << "Couldn`t import data: empty path received";
+ImportInstalledVersions readImportInstalledVersions(const boost::filesystem::path& abs_path) {
+  ImportInstalledVersions installed;
+  installed.path = abs_path;
+  INvStorage::fsReadInstalledVersions(abs_path, &installed.versions, &installed.current);
+  return installed;
+}
+
+void importUpdateSimple(INvStorage& storage, store_data_t store_func, load_data_t load_func,
+                        const ImportSource& source, const std::string& data_name) {
+  if (source.path.empty()) {
     return;
   }
-  if (loadPrimaryKeys(nullptr, nullptr)) {
-    LOG_INFO << "Couldn`t import data: primary keys already in storage";
+  std::string prev_content;
+  if ((storage.*load_func)(&prev_content) &&
+      Crypto::sha256digest(source.content) == Crypto::sha256digest(prev_content)) {
     return;
   }
-  const boost::filesystem::path pubkey_abs_path = import_pubkey_path.get(base_path);
-  const boost::filesystem::path privkey_abs_path = import_privkey_path.get(base_path);
-  if (!boost::filesystem::exists(pubkey_abs_path)) {
-    LOG_ERROR << "Couldn't import data: " << pubkey_abs_path << " doesn't exist.";
+  if (!source.exists) {
+    LOG_ERROR << "Couldn't import " << data_name << ": " << source.path << " doesn't exist.";
     return;
   }
-  if (!boost::filesystem::exists(privkey_abs_path)) {
-    LOG_ERROR << "Couldn't import data: " << privkey_abs_path << " doesn't exist.";
+  (storage.*store_func)(source.content);
+  LOG_DEBUG << "Successfully imported " << data_name << " from " << source.path;
+}
+
+void importUpdateCertificate(INvStorage& storage, const ImportCert& cert) {
+  if (cert.source.path.empty()) {
     return;
   }
-  const std::string pub_content = Utils::readFile(pubkey_abs_path.string());
-  const std::string priv_content = Utils::readFile(privkey_abs_path.string());
-  storePrimaryKeys(pub_content, priv_content);
-  LOG_DEBUG << "Successfully imported Uptane keys from " << pubkey_abs_path << " and " << privkey_abs_path;
+  std::string prev_content;
+  if (storage.loadTlsCert(&prev_content) &&
+      Crypto::sha256digest(cert.source.content) == Crypto::sha256digest(prev_content)) {
+    return;
+  }
+  if (!cert.source.exists) {
+    LOG_ERROR << "Couldn't import client certificate: " << cert.source.path << " doesn't exist.";
+    return;
+  }
+  if (cert.error) {
+    std::rethrow_exception(cert.error);
+  }
+
+  // Make sure the device ID of the new cert hasn't changed.
+  std::string old_device_id;
+  if (!storage.loadDeviceId(&old_device_id)) {
+    LOG_DEBUG << "Unable to load previous device ID.";
+  } else if (cert.device_id != old_device_id) {
+    LOG_WARNING << "Certificate at " << cert.source.path.string() << " has a CN that may be used as device ID of "
+                << cert.device_id << " but the device currently is identified as " << old_device_id;
+  }
+
+  storage.storeTlsCert(cert.source.content);
+  LOG_DEBUG << "Successfully imported client certificate from " << cert.source.path;
 }
 
-void INvStorage::importInstalledVersions(const boost::filesystem::path& base_path) {
-  std::vector<Uptane::Target> installed_versions;
-  const boost::filesystem::path file_path = utils::BasedPath("installed_versions").get(base_path);
-  loadPrimaryInstallationLog(&installed_versions, false);
-  if (!installed_versions.empty()) {
+void importPrimaryKeys(INvStorage& storage, const ImportSource& pubkey, const ImportSource& privkey) {
+  if (pubkey.path.empty() || privkey.path.empty()) {
+    LOG_ERROR << "Couldn`t import data: empty path received";
     return;
   }
-  size_t current_index = SIZE_MAX;
-  fsReadInstalledVersions(file_path, &installed_versions, &current_index);
-  if (current_index < installed_versions.size()) {
-    // installed versions in legacy fs storage are all for primary
-    savePrimaryInstalledVersion(installed_versions[current_index], InstalledVersionUpdateMode::kCurrent, "");
-    boost::filesystem::remove(file_path);
-    LOG_DEBUG << "Successfully imported installed versions from " << file_path;
+  if (storage.loadPrimaryKeys(nullptr, nullptr)) {
+    LOG_INFO << "Couldn`t import data: primary keys already in storage";
+    return;
   }
+  if (!pubkey.exists) {
+    LOG_ERROR << "Couldn't import data: " << pubkey.path << " doesn't exist.";
+    return;
+  }
+  if (!privkey.exists) {
+    LOG_ERROR << "Couldn't import data: " << privkey.path << " doesn't exist.";
+    return;
+  }
+  storage.storePrimaryKeys(pubkey.content, privkey.content);
+  LOG_DEBUG << "Successfully imported Uptane keys from " << pubkey.path << " and " << privkey.path;
 }
 
-void INvStorage::importInitialRoot(const boost::filesystem::path& base_path) {
-  importInitialRootFile(base_path / "repo/root.json", Uptane::RepositoryType::Image());
-  importInitialRootFile(base_path / "director/root.json", Uptane::RepositoryType::Director());
+// true if the file can be removed once the import is committed
+bool importCurrentVersion(INvStorage& storage, const ImportInstalledVersions& installed) {
+  std::vector<Uptane::Target> log;
+  storage.loadPrimaryInstallationLog(&log, false);
+  if (!log.empty() || installed.current >= installed.versions.size()) {
+    return false;
+  }
+  // installed versions in legacy fs storage are all for primary
+  storage.savePrimaryInstalledVersion(installed.versions[installed.current], InstalledVersionUpdateMode::kCurrent,
+                                      "");
+  LOG_DEBUG << "Successfully imported installed versions from " << installed.path;
+  return true;
 }
 
-void INvStorage::importInitialRootFile(const boost::filesystem::path& root_path, Uptane::RepositoryType repo_type) {
+void importInitialRoot(INvStorage& storage, const ImportRoot& root, Uptane::RepositoryType repo_type) {
   std::string root_tmp;  // Only needed for loadLatestRoot
-  if (!loadLatestRoot(&root_tmp, repo_type)) {
-    if (boost::filesystem::is_regular_file(root_path)) {
-      try {
-        std::string root_str = Utils::readFile(root_path);
-        Uptane::Root orig_root(Uptane::Root::Policy::kAcceptAll);
-        Uptane::Root new_root(repo_type, Utils::parseJSON(root_str), orig_root);
-        // No exception. Save it
-        storeRoot(root_str, repo_type, Uptane::Version(new_root.version()));
-        LOG_INFO << "Imported initial " << repo_type << " root keys from " << root_path;
-      } catch (Uptane::Exception& e) {
-        LOG_WARNING << "Couldn't import initial " << repo_type << " root keys from " << root_path << " " << e.what();
-      }
-    } else {
-      LOG_DEBUG << "Not importing " << root_path << " because it doesn't exist";
-    }
-  } else {
+  if (storage.loadLatestRoot(&root_tmp, repo_type)) {
     LOG_TRACE << "Root for " << repo_type << " already present, not importing";
+  } else if (!root.source.exists) {
+    LOG_DEBUG << "Not importing " << root.source.path << " because it doesn't exist";
+  } else if (!root.version) {
+    LOG_WARNING << "Couldn't import initial " << repo_type << " root keys from " << root.source.path << " "
+                << root.error;
+  } else {
+    storage.storeRoot(root.source.content, repo_type, *root.version);
+    LOG_INFO << "Imported initial " << repo_type << " root keys from " << root.source.path;
+  }
+}
+
+}  // namespace
+
+void INvStorage::importInstalledVersions(const boost::filesystem::path& base_path) {
+  const auto installed = readImportInstalledVersions(utils::BasedPath("installed_versions").get(base_path));
+  if (importCurrentVersion(*this, installed)) {
+    boost::filesystem::remove(installed.path);
   }
 }
 
 void INvStorage::importData(const ImportConfig& import_config) {
-  importPrimaryKeys(import_config.base_path, import_config.uptane_public_key_path,
-                    import_config.uptane_private_key_path);
-  importUpdateCertificate(import_config.base_path, import_config.tls_clientcert_path);
-  importUpdateSimple(import_config.base_path, &INvStorage::storeTlsCa, &INvStorage::loadTlsCa,
-                     import_config.tls_cacert_path, "server CA certificate");
-  importUpdateSimple(import_config.base_path, &INvStorage::storeTlsPkey, &INvStorage::loadTlsPkey,
-                     import_config.tls_pkey_path, "client TLS key");
-  importInstalledVersions(import_config.base_path);
-  importInitialRoot(import_config.base_path);
+  const boost::filesystem::path& base_path = import_config.base_path;
+  const auto start = ImportClock::now();
+
+  // The files are read and validated in parallel, before the storage is locked
+  auto pubkey = readImportSourceAsync(base_path, import_config.uptane_public_key_path);
+  auto privkey = readImportSourceAsync(base_path, import_config.uptane_private_key_path);
+  auto ca = readImportSourceAsync(base_path, import_config.tls_cacert_path);
+  auto pkey = readImportSourceAsync(base_path, import_config.tls_pkey_path);
+  std::future<ImportCert> cert;
+  if (!import_config.tls_clientcert_path.empty()) {
+    cert = std::async(std::launch::async, readImportCert, import_config.tls_clientcert_path.get(base_path));
+  }
+  auto installed = std::async(std::launch::async, readImportInstalledVersions,
+                              utils::BasedPath("installed_versions").get(base_path));
+  auto image_root = std::async(std::launch::async, readImportRoot, base_path / "repo/root.json",
+                               Uptane::RepositoryType::Image());
+  auto director_root = std::async(std::launch::async, readImportRoot, base_path / "director/root.json",
+                                  Uptane::RepositoryType::Director());
+  const ImportSource pubkey_source = pubkey.get();
+  const ImportSource privkey_source = privkey.get();
+  const ImportSource ca_source = ca.get();
+  const ImportSource pkey_source = pkey.get();
+  const ImportCert cert_source = cert.valid() ? cert.get() : ImportCert();
+  const ImportInstalledVersions installed_source = installed.get();
+  const ImportRoot image_root_source = image_root.get();
+  const ImportRoot director_root_source = director_root.get();
+  const int64_t read_ms = elapsedMs(start);
+
+  // Everything that changed is then stored in one transaction
+  auto store_start = ImportClock::now();
+  bool remove_installed_versions = false;
+  {
+    auto batch = beginBatch();
+    importPrimaryKeys(*this, pubkey_source, privkey_source);
+    importUpdateCertificate(*this, cert_source);
+    importUpdateSimple(*this, &INvStorage::storeTlsCa, &INvStorage::loadTlsCa, ca_source, "server CA certificate");
+    importUpdateSimple(*this, &INvStorage::storeTlsPkey, &INvStorage::loadTlsPkey, pkey_source, "client TLS key");
+    remove_installed_versions = importCurrentVersion(*this, installed_source);
+    importInitialRoot(*this, image_root_source, Uptane::RepositoryType::Image());
+    importInitialRoot(*this, director_root_source, Uptane::RepositoryType::Director());
+    const int64_t store_ms = elapsedMs(store_start);
+    store_start = ImportClock::now();
+    batch->commit();
+    LOG_DEBUG << "Import: read and validated the files in " << read_ms << " ms, stored them in " << store_ms
+              << " ms and committed in " << elapsedMs(store_start) << " ms";
+  }
+  if (remove_installed_versions) {
+    boost::filesystem::remove(installed_source.path);
+  }
+  LOG_INFO << "Imported data from " << base_path << " in " << elapsedMs(start) << " ms";
+}
+
+static std::shared_ptr<INvStorage> withMetadataCache(std::shared_ptr<INvStorage> storage,
+                                                    const StorageConfig& config) {
+  if (config.metadata_cache_size == 0) {
+    return storage;
+  }
+  return std::make_shared<CachedStorage>(std::move(storage), static_cast<size_t>(config.metadata_cache_size), config);
+}
+
+// below the cache, so that only the calls that reach the database are measured
+static std::shared_ptr<INvStorage> withProfiling(std::shared_ptr<INvStorage> storage, const StorageConfig& config) {
+  if (!config.profile) {
+    return storage;
+  }
+  return std::make_shared<ProfilingStorage>(std::move(storage), config);
 }
 
 std::shared_ptr<INvStorage> INvStorage::newStorage(const StorageConfig& config, const bool readonly) {
   switch (config.type) {
     case StorageType::kSqlite: {
       boost::filesystem::path db_path = config.sqldb_path.get(config.path);
-      if (!boost::filesystem::exists(db_path) && FSStorageRead::FSStoragePresent(config)) {
+      const bool resume = FSStorageRead::loadMigrationStep(config) != FSStorageRead::MigrationStep::kNone;
+      if (resume || (!boost::filesystem::exists(db_path) && FSStorageRead::FSStoragePresent(config))) {
         if (readonly) {
           throw StorageException(
               "Migration from FS is not possible because the SQL database is configured to be readonly");
         }
 
-        LOG_INFO << "Starting FS to SQL storage migration";
+        LOG_INFO << (resume ? "Resuming" : "Starting") << " FS to SQL storage migration";
         if (access(config.path.c_str(), R_OK | W_OK | X_OK) != 0) {
           throw StorageException(std::string("Cannot read prior filesystem configuration from ") +
                                  config.path.string() + " due to insufficient permissions.");
@@ -182,14 +333,14 @@ std::shared_ptr<INvStorage> INvStorage::newStorage(const StorageConfig& config,
         auto sql_storage = std::make_shared<SQLStorage>(config, readonly);
         FSStorageRead fs_storage(old_config);
         INvStorage::FSSToSQLS(fs_storage, *sql_storage);
-        return sql_storage;
+        return withMetadataCache(withProfiling(sql_storage, config), config);
       }
       if (!boost::filesystem::exists(db_path)) {
         LOG_INFO << "Bootstrap empty SQL storage";
       } else {
         LOG_INFO << "Use existing SQL storage: " << db_path;
       }
-      return std::make_shared<SQLStorage>(config, readonly);
+      return withMetadataCache(withProfiling(std::make_shared<SQLStorage>(config, readonly), config), config);
     }
     case StorageType::kFileSystem:
     default:
@@ -198,6 +349,21 @@ std::shared_ptr<INvStorage> INvStorage::newStorage(const StorageConfig& config,
 }
 
 void INvStorage::FSSToSQLS(FSStorageRead& fs_storage, SQLStorage& sql_storage) {
+  if (fs_storage.loadMigrationStep() != FSStorageRead::MigrationStep::kCleanUp) {
+    fs_storage.storeMigrationStep(FSStorageRead::MigrationStep::kCopy);
+    // everything is committed at once, or copied again when resumed
+    auto batch = sql_storage.beginBatch();
+    FSSToSQLSCopy(fs_storage, sql_storage);
+    batch->commit();
+    fs_storage.storeMigrationStep(FSStorageRead::MigrationStep::kCleanUp);
+  }
+
+  // if everything is ok, remove old files.
+  fs_storage.cleanUpAll();
+  fs_storage.storeMigrationStep(FSStorageRead::MigrationStep::kNone);
+}
+
+void INvStorage::FSSToSQLSCopy(const FSStorageRead& fs_storage, SQLStorage& sql_storage) {
   std::string public_key;
   std::string private_key;
   if (fs_storage.loadPrimaryKeys(&public_key, &private_key)) {
@@ -263,21 +429,14 @@ void INvStorage::FSSToSQLS(FSStorageRead& fs_storage, SQLStorage& sql_storage) {
     }
   }
   // additionally migrate the whole Root metadata chain
-  std::string latest_root;
   for (auto repo : {Uptane::RepositoryType::Director(), Uptane::RepositoryType::Image()}) {
-    if (fs_storage.loadLatestRoot(&latest_root, repo)) {
-      int latest_version = Uptane::extractVersionUntrusted(latest_root);
-      for (int version = 0; version <= latest_version; ++version) {
-        std::string root;
-        if (fs_storage.loadRoot(&root, repo, Uptane::Version(version))) {
-          sql_storage.storeRoot(root, repo, Uptane::Version(version));
-        }
+    for (const auto& version : fs_storage.rootVersions(repo)) {
+      std::string root;
+      if (fs_storage.loadRoot(&root, repo, version)) {
+        sql_storage.storeRoot(root, repo, version);
       }
     }
   }
-
-  // if everything is ok, remove old files.
-  fs_storage.cleanUpAll();
 }
 
 bool INvStorage::fsReadInstalledVersions(const boost::filesystem::path& filename,
@@ -1,6 +1,8 @@
 #ifndef INVSTORAGE_H_
 #define INVSTORAGE_H_
 
+#include <chrono>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -36,10 +38,83 @@ struct MisconfiguredEcu {
 
 enum class InstalledVersionUpdateMode { kNone, kCurrent, kPending };
 
+// Metadata of a Target file at the time its hashes were verified. If the
+// file still has the same metadata, it doesn't need to be hashed again.
+struct VerifiedFile {
+  uint64_t size{0};
+  int64_t mtime_ns{0};
+  uint64_t inode{0};
+  // hashes the file was verified against, as encoded by Hash::encodeVector()
+  std::string hashes;
+  bool operator==(const VerifiedFile& other) const {
+    return size == other.size && mtime_ns == other.mtime_ns && inode == other.inode && hashes == other.hashes;
+  }
+  bool operator!=(const VerifiedFile& other) const { return !operator==(other); }
+};
+
+// Byte range of a Target that is downloaded in several parts, and how much of
+// it has already been written to the Target file.
+struct DownloadSegment {
+  DownloadSegment(uint64_t start_in, uint64_t length_in, uint64_t downloaded_in = 0)
+      : start(start_in), length(length_in), downloaded(downloaded_in) {}
+  uint64_t start;
+  uint64_t length;
+  uint64_t downloaded;
+  bool isComplete() const { return downloaded >= length; }
+};
+
+// Provisioning and installation state of the device, read at once for
+// diagnostics, see INvStorage::loadSnapshot().
+struct StorageSnapshot {
+  struct EcuVersions {
+    boost::optional<Uptane::Target> current;
+    boost::optional<Uptane::Target> pending;
+    // of the pending version if there is one, of the current one otherwise
+    Uptane::CorrelationId correlation_id;
+  };
+
+  // empty if the device is not provisioned
+  std::string device_id;
+  bool ecu_registered{false};
+  // whether a Root of either repository is stored
+  bool has_root_metadata{false};
+  // in the same order as loadEcuSerials(), Primary first
+  EcuSerials serials;
+  // ECUs without current nor pending version are left out
+  std::map<Uptane::EcuSerial, EcuVersions> versions;
+  std::vector<MisconfiguredEcu> misconfigured_ecus;
+};
+
+// What an idle-time maintenance of the storage did, see INvStorage::maintain().
+struct StorageMaintenance {
+  // shrinkage of the storage files, 0 if they grew
+  uint64_t bytes_reclaimed{0};
+  std::chrono::milliseconds duration{0};
+  // false if the budget ran out before all the steps were done
+  bool complete{false};
+  // result of the integrity check, none if it wasn't run or didn't finish
+  boost::optional<bool> integrity_ok;
+};
+
 // Functions loading/storing multiple pieces of data are supposed to do so
 // atomically as far as implementation makes it possible.
 //
 // store* functions normally write the complete content. save* functions just add an entry.
+// Writes made while a batch is alive are grouped in one transaction, so that
+// they are committed together with a single sync. They are rolled back if the
+// batch is destroyed without commit(). Other threads wait for the storage
+// until then, so don't hold a batch while waiting for one that uses it.
+class StorageBatch {
+ public:
+  StorageBatch() = default;
+  virtual ~StorageBatch() = default;
+  StorageBatch(const StorageBatch&) = delete;
+  StorageBatch(StorageBatch&&) = delete;
+  StorageBatch& operator=(const StorageBatch&) = delete;
+  StorageBatch& operator=(StorageBatch&&) = delete;
+  virtual void commit() = 0;
+};
+
 class INvStorage {
  public:
   explicit INvStorage(StorageConfig config) : config_(std::move(config)) {}
@@ -78,7 +153,25 @@ class INvStorage {
   };
   virtual void storeNonRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Role role) = 0;
   virtual bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const = 0;
+  // Same as loadRoot and loadNonRoot, but storages that keep metadata in
+  // memory hand out their own copy instead of a new one.
+  virtual bool loadRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo, Uptane::Version version) const;
+  bool loadLatestRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo) const {
+    return loadRootBuffer(data, repo, Uptane::Version());
+  }
+  virtual bool loadNonRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo, Uptane::Role role) const;
   virtual void clearNonRootMeta(Uptane::RepositoryType repo) = 0;
+  // The expiry of the stored metadata of a role (the latest version for
+  // Root), indexed when it is stored. It is neither parsed nor verified, so
+  // it only tells that the metadata has expired, not that it is valid.
+  virtual bool loadMetaExpiry(Uptane::RepositoryType repo, Uptane::Role role, TimeStamp* expiry) const = 0;
+  // HTTP validators (ETag and Last-Modified) that came with the stored
+  // metadata of a role, for conditional fetches. Reset when the metadata is
+  // stored or cleared; empty validators are not stored.
+  virtual void storeMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, const std::string& etag,
+                                   const std::string& last_modified) = 0;
+  virtual bool loadMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, std::string* etag,
+                                  std::string* last_modified) const = 0;
   virtual void clearMetadata() = 0;
   virtual void storeDelegation(const std::string& data, Uptane::Role role) = 0;
   virtual bool loadDelegation(std::string* data, Uptane::Role role) const = 0;
@@ -117,6 +210,9 @@ class INvStorage {
                                      Uptane::CorrelationId* correlation_id) const = 0;
   virtual bool loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
                                    bool only_installed) const = 0;
+  // latest entry of the installation log with this hash, none if there is none
+  virtual bool loadInstalledVersionByHash(const std::string& ecu_serial, const std::string& sha256,
+                                          boost::optional<Uptane::Target>* version) const = 0;
   virtual bool hasPendingInstall() = 0;
   virtual void getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) = 0;
   virtual void clearInstalledVersions() = 0;
@@ -137,6 +233,10 @@ class INvStorage {
 
   virtual void saveReportEvent(const Json::Value& json_value) = 0;
   virtual bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const = 0;
+  // The events as they are stored, as JSON strings: at most `limit` of them
+  // (-1 for no limit) and `max_size` bytes together, but at least one.
+  virtual bool loadReportEventsRaw(std::vector<std::string>* events, int64_t* id_max, int limit,
+                                   size_t max_size) const = 0;
   virtual void deleteReportEvents(int64_t id_max) = 0;
 
   virtual void storeDeviceDataHash(const std::string& data_type, const std::string& hash) = 0;
@@ -147,7 +247,45 @@ class INvStorage {
   virtual void storeTargetFilename(const std::string& targetname, const std::string& filename) const = 0;
   virtual std::string getTargetFilename(const std::string& targetname) const = 0;
   virtual std::vector<std::string> getAllTargetNames() const = 0;
+  // Images are stored by content, several Targets can refer to the same file.
+  // Unlike storeTargetFilename(), linking keeps the state of the file.
+  virtual void linkTargetFilename(const std::string& targetname, const std::string& filename) const = 0;
+  virtual std::vector<std::string> getTargetNamesForFile(const std::string& filename) const = 0;
   virtual void deleteTargetInfo(const std::string& targetname) const = 0;
+  virtual void storeDownloadSegments(const std::string& targetname,
+                                     const std::vector<DownloadSegment>& segments) const = 0;
+  virtual bool loadDownloadSegments(const std::string& targetname, std::vector<DownloadSegment>* segments) const = 0;
+  virtual void updateDownloadSegment(const std::string& targetname, size_t segment, uint64_t downloaded) const = 0;
+  virtual void clearDownloadSegments(const std::string& targetname) const = 0;
+  // Intermediate hasher state of the first hashed_length bytes of a Target
+  // file. Reset when the file is recreated with storeTargetFilename().
+  virtual void storeTargetHashState(const std::string& targetname, uint64_t hashed_length,
+                                    const std::string& state) const = 0;
+  virtual bool loadTargetHashState(const std::string& targetname, uint64_t* hashed_length,
+                                   std::string* state) const = 0;
+  // Cache of verified Target files, by file name. Reset when the file is
+  // recreated with storeTargetFilename() or when its last Target is removed
+  // with deleteTargetInfo().
+  virtual void storeVerifiedFile(const std::string& filename, const VerifiedFile& file) const = 0;
+  virtual bool loadVerifiedFile(const std::string& filename, VerifiedFile* file) const = 0;
+
+  virtual std::unique_ptr<StorageBatch> beginBatch() = 0;
+
+  // Everything in StorageSnapshot, consistently and with a few queries whatever
+  // the number of ECUs.
+  virtual void loadSnapshot(StorageSnapshot* snapshot) const = 0;
+
+  // Changes after each write to the Uptane metadata of a repository (Roots,
+  // other roles and delegations) made through this object, so that metadata
+  // verified at some generation doesn't have to be verified again as long as
+  // it stays the same. Writes made by other processes are not counted.
+  virtual uint64_t metadataGeneration(Uptane::RepositoryType repo) const = 0;
+
+  // Give back the space of removed data, fold the write-ahead log into the
+  // database and refresh the statistics of the query planner, and check the
+  // integrity of the database if asked to, in about `budget` at most. Meant
+  // to run when the client is idle, as the storage can't be used meanwhile.
+  virtual StorageMaintenance maintain(std::chrono::milliseconds budget, bool integrity_check) = 0;
 
   // Special constructors and utilities
   static std::shared_ptr<INvStorage> newStorage(const StorageConfig& config, bool readonly = false);
@@ -156,6 +294,15 @@ class INvStorage {
                                       std::vector<Uptane::Target>* installed_versions, size_t* current_version);
 
   // Not purely virtual
+
+  /**
+   * Import the keys, certificates and installed versions provisioned on the
+   * filesystem, and the initial image and director root.json, found at
+   * well-known locations such as /var/sota/import/repo/root.json (image repo)
+   * and /var/sota/import/director/root.json (director repo). The files are
+   * read and validated in parallel, then what changed is stored in a single
+   * transaction.
+   */
   void importData(const ImportConfig& import_config);
   bool loadPrimaryInstalledVersions(boost::optional<Uptane::Target>* current_version,
                                     boost::optional<Uptane::Target>* pending_version,
@@ -180,22 +327,7 @@ class INvStorage {
   void importInstalledVersions(const boost::filesystem::path& base_path);
 
  private:
-  void importUpdateSimple(const boost::filesystem::path& base_path, store_data_t store_func, load_data_t load_func,
-                          const utils::BasedPath& imported_data_path, const std::string& data_name);
-  void importUpdateCertificate(const boost::filesystem::path& base_path, const utils::BasedPath& imported_data_path);
-  void importPrimaryKeys(const boost::filesystem::path& base_path, const utils::BasedPath& import_pubkey_path,
-                         const utils::BasedPath& import_privkey_path);
-
-  /**
-   * Import initial image and director root.json from the filesystem.
-   * These would be loaded onto the device during provisioning at a well-known
-   * location such as /var/sota/import/repo/root.json (image repo) and
-   * /var/sota/import/director/root.json for the director repo.
-   *
-   * @param base_path e.g. '/var/sota/import'
-   */
-  void importInitialRoot(const boost::filesystem::path& base_path);
-  void importInitialRootFile(const boost::filesystem::path& root_path, Uptane::RepositoryType repo_type);
+  static void FSSToSQLSCopy(const FSStorageRead& fs_storage, SQLStorage& sql_storage);
 
  protected:
   const StorageConfig config_;
@@ -0,0 +1,581 @@
+#include "profilingstorage.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "logging/logging.h"
+
+// Measures one call from its construction to its destruction
+class ProfilingStorage::Call {
+ public:
+  Call(const ProfilingStorage& storage, const char* method, size_t bytes = 0)
+      : storage_(storage), stats_(storage.stats(method)), timer_(stats_.seconds) {
+    addBytes(bytes);
+  }
+  ~Call() { storage_.maybeLogSummary(); }
+  Call(const Call&) = delete;
+  Call(Call&&) = delete;
+  Call& operator=(const Call&) = delete;
+  Call& operator=(Call&&) = delete;
+
+  void addBytes(size_t bytes) { stats_.bytes.add(bytes); }
+  // the bytes of what was loaded, if anything
+  bool read(bool found, const std::string* data) {
+    if (found && data != nullptr) {
+      addBytes(data->size());
+    }
+    return found;
+  }
+  bool read(bool found, const Uptane::MetaBuffer* data) {
+    return read(found, data != nullptr ? &data->str() : nullptr);
+  }
+
+ private:
+  const ProfilingStorage& storage_;
+  MethodStats& stats_;
+  metrics::ScopedTimer timer_;
+};
+
+static int64_t steadyNow() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+ProfilingStorage::ProfilingStorage(std::shared_ptr<INvStorage> storage, const StorageConfig& config,
+                                   std::chrono::seconds summary_interval)
+    : INvStorage(config),
+      storage_(std::move(storage)),
+      summary_interval_(summary_interval),
+      next_summary_(steadyNow() + summary_interval.count()) {}
+
+ProfilingStorage::~ProfilingStorage() {
+  const std::string text = summary();
+  if (!text.empty()) {
+    LOG_INFO << "Storage calls:\n" << text;
+  }
+}
+
+ProfilingStorage::MethodStats& ProfilingStorage::stats(const char* method) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = methods_.find(method);
+  if (it == methods_.end()) {
+    auto& registry = metrics::Registry::instance();
+    const metrics::Labels labels{{"method", method}};
+    MethodStats stats{registry.histogram("aktualizr_storage_call_seconds", "Duration of the storage calls", labels),
+                      registry.counter("aktualizr_storage_bytes_total",
+                                       "Bytes read or written by the storage calls", labels)};
+    it = methods_.emplace(method, stats).first;
+  }
+  return it->second;
+}
+
+std::string ProfilingStorage::summary() const {
+  std::vector<std::pair<std::string, MethodStats*>> methods;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& method : methods_) {
+      methods.emplace_back(method.first, &method.second);
+    }
+  }
+  std::sort(methods.begin(), methods.end(), [](const std::pair<std::string, MethodStats*>& a,
+                                               const std::pair<std::string, MethodStats*>& b) {
+    return a.second->seconds.sum() > b.second->seconds.sum();
+  });
+
+  std::ostringstream out;
+  for (const auto& method : methods) {
+    const metrics::Histogram& seconds = method.second->seconds;
+    if (seconds.count() == 0) {
+      continue;
+    }
+    out << "  " << method.first << ": " << seconds.count() << " calls, " << seconds.sum() / 1000 << " ms, p99 "
+        << seconds.quantile(0.99) << " us, " << method.second->bytes.value() << " bytes\n";
+  }
+  return out.str();
+}
+
+void ProfilingStorage::maybeLogSummary() const {
+  const int64_t now = steadyNow();
+  int64_t next = next_summary_.load();
+  // only one of the concurrent callers logs
+  if (now < next || !next_summary_.compare_exchange_strong(next, now + summary_interval_.count())) {
+    return;
+  }
+  LOG_INFO << "Storage calls:\n" << summary();
+}
+
+void ProfilingStorage::storePrimaryKeys(const std::string& public_key, const std::string& private_key) {
+  Call call(*this, "storePrimaryKeys", public_key.size() + private_key.size());
+  storage_->storePrimaryKeys(public_key, private_key);
+}
+
+bool ProfilingStorage::loadPrimaryKeys(std::string* public_key, std::string* private_key) const {
+  Call call(*this, "loadPrimaryKeys");
+  return storage_->loadPrimaryKeys(public_key, private_key);
+}
+
+bool ProfilingStorage::loadPrimaryPublic(std::string* public_key) const {
+  Call call(*this, "loadPrimaryPublic");
+  return call.read(storage_->loadPrimaryPublic(public_key), public_key);
+}
+
+bool ProfilingStorage::loadPrimaryPrivate(std::string* private_key) const {
+  Call call(*this, "loadPrimaryPrivate");
+  return call.read(storage_->loadPrimaryPrivate(private_key), private_key);
+}
+
+void ProfilingStorage::clearPrimaryKeys() {
+  Call call(*this, "clearPrimaryKeys");
+  storage_->clearPrimaryKeys();
+}
+
+void ProfilingStorage::saveSecondaryInfo(const Uptane::EcuSerial& ecu_serial, const std::string& sec_type,
+                                         const PublicKey& public_key) {
+  Call call(*this, "saveSecondaryInfo");
+  storage_->saveSecondaryInfo(ecu_serial, sec_type, public_key);
+}
+
+void ProfilingStorage::saveSecondaryData(const Uptane::EcuSerial& ecu_serial, const std::string& data) {
+  Call call(*this, "saveSecondaryData", data.size());
+  storage_->saveSecondaryData(ecu_serial, data);
+}
+
+bool ProfilingStorage::loadSecondaryInfo(const Uptane::EcuSerial& ecu_serial, SecondaryInfo* secondary) const {
+  Call call(*this, "loadSecondaryInfo");
+  return storage_->loadSecondaryInfo(ecu_serial, secondary);
+}
+
+bool ProfilingStorage::loadSecondariesInfo(std::vector<SecondaryInfo>* secondaries) const {
+  Call call(*this, "loadSecondariesInfo");
+  return storage_->loadSecondariesInfo(secondaries);
+}
+
+void ProfilingStorage::storeTlsCreds(const std::string& ca, const std::string& cert, const std::string& pkey) {
+  Call call(*this, "storeTlsCreds", ca.size() + cert.size() + pkey.size());
+  storage_->storeTlsCreds(ca, cert, pkey);
+}
+
+void ProfilingStorage::storeTlsCa(const std::string& ca) {
+  Call call(*this, "storeTlsCa", ca.size());
+  storage_->storeTlsCa(ca);
+}
+
+void ProfilingStorage::storeTlsCert(const std::string& cert) {
+  Call call(*this, "storeTlsCert", cert.size());
+  storage_->storeTlsCert(cert);
+}
+
+void ProfilingStorage::storeTlsPkey(const std::string& pkey) {
+  Call call(*this, "storeTlsPkey", pkey.size());
+  storage_->storeTlsPkey(pkey);
+}
+
+bool ProfilingStorage::loadTlsCreds(std::string* ca, std::string* cert, std::string* pkey) const {
+  Call call(*this, "loadTlsCreds");
+  return storage_->loadTlsCreds(ca, cert, pkey);
+}
+
+bool ProfilingStorage::loadTlsCa(std::string* ca) const {
+  Call call(*this, "loadTlsCa");
+  return call.read(storage_->loadTlsCa(ca), ca);
+}
+
+bool ProfilingStorage::loadTlsCert(std::string* cert) const {
+  Call call(*this, "loadTlsCert");
+  return call.read(storage_->loadTlsCert(cert), cert);
+}
+
+bool ProfilingStorage::loadTlsPkey(std::string* cert) const {
+  Call call(*this, "loadTlsPkey");
+  return call.read(storage_->loadTlsPkey(cert), cert);
+}
+
+void ProfilingStorage::clearTlsCreds() {
+  Call call(*this, "clearTlsCreds");
+  storage_->clearTlsCreds();
+}
+
+void ProfilingStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) {
+  Call call(*this, "storeRoot", data.size());
+  storage_->storeRoot(data, repo, version);
+}
+
+bool ProfilingStorage::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const {
+  Call call(*this, "loadRoot");
+  return call.read(storage_->loadRoot(data, repo, version), data);
+}
+
+void ProfilingStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Role role) {
+  Call call(*this, "storeNonRoot", data.size());
+  storage_->storeNonRoot(data, repo, role);
+}
+
+bool ProfilingStorage::loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const {
+  Call call(*this, "loadNonRoot");
+  return call.read(storage_->loadNonRoot(data, repo, role), data);
+}
+
+bool ProfilingStorage::loadRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo,
+                                      Uptane::Version version) const {
+  Call call(*this, "loadRoot");
+  return call.read(storage_->loadRootBuffer(data, repo, version), data);
+}
+
+bool ProfilingStorage::loadNonRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo,
+                                         Uptane::Role role) const {
+  Call call(*this, "loadNonRoot");
+  return call.read(storage_->loadNonRootBuffer(data, repo, role), data);
+}
+
+void ProfilingStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
+  Call call(*this, "clearNonRootMeta");
+  storage_->clearNonRootMeta(repo);
+}
+
+bool ProfilingStorage::loadMetaExpiry(Uptane::RepositoryType repo, Uptane::Role role, TimeStamp* expiry) const {
+  Call call(*this, "loadMetaExpiry");
+  return storage_->loadMetaExpiry(repo, role, expiry);
+}
+
+void ProfilingStorage::storeMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, const std::string& etag,
+                                           const std::string& last_modified) {
+  Call call(*this, "storeMetaValidators");
+  storage_->storeMetaValidators(repo, role, etag, last_modified);
+}
+
+bool ProfilingStorage::loadMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, std::string* etag,
+                                          std::string* last_modified) const {
+  Call call(*this, "loadMetaValidators");
+  return storage_->loadMetaValidators(repo, role, etag, last_modified);
+}
+
+void ProfilingStorage::clearMetadata() {
+  Call call(*this, "clearMetadata");
+  storage_->clearMetadata();
+}
+
+void ProfilingStorage::storeDelegation(const std::string& data, Uptane::Role role) {
+  Call call(*this, "storeDelegation", data.size());
+  storage_->storeDelegation(data, role);
+}
+
+bool ProfilingStorage::loadDelegation(std::string* data, Uptane::Role role) const {
+  Call call(*this, "loadDelegation");
+  return call.read(storage_->loadDelegation(data, role), data);
+}
+
+bool ProfilingStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const {
+  Call call(*this, "loadAllDelegations");
+  const bool res = storage_->loadAllDelegations(data);
+  for (const auto& delegation : data) {
+    call.addBytes(delegation.second.size());
+  }
+  return res;
+}
+
+void ProfilingStorage::deleteDelegation(Uptane::Role role) {
+  Call call(*this, "deleteDelegation");
+  storage_->deleteDelegation(role);
+}
+
+void ProfilingStorage::clearDelegations() {
+  Call call(*this, "clearDelegations");
+  storage_->clearDelegations();
+}
+
+void ProfilingStorage::storeDeviceId(const std::string& device_id) {
+  Call call(*this, "storeDeviceId");
+  storage_->storeDeviceId(device_id);
+}
+
+bool ProfilingStorage::loadDeviceId(std::string* device_id) const {
+  Call call(*this, "loadDeviceId");
+  return storage_->loadDeviceId(device_id);
+}
+
+void ProfilingStorage::clearDeviceId() {
+  Call call(*this, "clearDeviceId");
+  storage_->clearDeviceId();
+}
+
+void ProfilingStorage::storeEcuSerials(const EcuSerials& serials) {
+  Call call(*this, "storeEcuSerials");
+  storage_->storeEcuSerials(serials);
+}
+
+bool ProfilingStorage::loadEcuSerials(EcuSerials* serials) const {
+  Call call(*this, "loadEcuSerials");
+  return storage_->loadEcuSerials(serials);
+}
+
+void ProfilingStorage::clearEcuSerials() {
+  Call call(*this, "clearEcuSerials");
+  storage_->clearEcuSerials();
+}
+
+void ProfilingStorage::storeCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, const std::string& manifest) {
+  Call call(*this, "storeCachedEcuManifest", manifest.size());
+  storage_->storeCachedEcuManifest(ecu_serial, manifest);
+}
+
+bool ProfilingStorage::loadCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, std::string* manifest) const {
+  Call call(*this, "loadCachedEcuManifest");
+  return call.read(storage_->loadCachedEcuManifest(ecu_serial, manifest), manifest);
+}
+
+void ProfilingStorage::saveMisconfiguredEcu(const MisconfiguredEcu& ecu) {
+  Call call(*this, "saveMisconfiguredEcu");
+  storage_->saveMisconfiguredEcu(ecu);
+}
+
+bool ProfilingStorage::loadMisconfiguredEcus(std::vector<MisconfiguredEcu>* ecus) const {
+  Call call(*this, "loadMisconfiguredEcus");
+  return storage_->loadMisconfiguredEcus(ecus);
+}
+
+void ProfilingStorage::clearMisconfiguredEcus() {
+  Call call(*this, "clearMisconfiguredEcus");
+  storage_->clearMisconfiguredEcus();
+}
+
+void ProfilingStorage::storeEcuRegistered() {
+  Call call(*this, "storeEcuRegistered");
+  storage_->storeEcuRegistered();
+}
+
+bool ProfilingStorage::loadEcuRegistered() const {
+  Call call(*this, "loadEcuRegistered");
+  return storage_->loadEcuRegistered();
+}
+
+void ProfilingStorage::clearEcuRegistered() {
+  Call call(*this, "clearEcuRegistered");
+  storage_->clearEcuRegistered();
+}
+
+void ProfilingStorage::storeNeedReboot() {
+  Call call(*this, "storeNeedReboot");
+  storage_->storeNeedReboot();
+}
+
+bool ProfilingStorage::loadNeedReboot(bool* need_reboot) const {
+  Call call(*this, "loadNeedReboot");
+  return storage_->loadNeedReboot(need_reboot);
+}
+
+void ProfilingStorage::clearNeedReboot() {
+  Call call(*this, "clearNeedReboot");
+  storage_->clearNeedReboot();
+}
+
+void ProfilingStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptane::Target& target,
+                                            InstalledVersionUpdateMode update_mode,
+                                            const Uptane::CorrelationId& correlation_id) {
+  Call call(*this, "saveInstalledVersion");
+  storage_->saveInstalledVersion(ecu_serial, target, update_mode, correlation_id);
+}
+
+bool ProfilingStorage::loadInstalledVersions(const std::string& ecu_serial,
+                                             boost::optional<Uptane::Target>* current_version,
+                                             boost::optional<Uptane::Target>* pending_version,
+                                             Uptane::CorrelationId* correlation_id) const {
+  Call call(*this, "loadInstalledVersions");
+  return storage_->loadInstalledVersions(ecu_serial, current_version, pending_version, correlation_id);
+}
+
+bool ProfilingStorage::loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
+                                           bool only_installed) const {
+  Call call(*this, "loadInstallationLog");
+  return storage_->loadInstallationLog(ecu_serial, log, only_installed);
+}
+
+bool ProfilingStorage::loadInstalledVersionByHash(const std::string& ecu_serial, const std::string& sha256,
+                                                  boost::optional<Uptane::Target>* version) const {
+  Call call(*this, "loadInstalledVersionByHash");
+  return storage_->loadInstalledVersionByHash(ecu_serial, sha256, version);
+}
+
+bool ProfilingStorage::hasPendingInstall() {
+  Call call(*this, "hasPendingInstall");
+  return storage_->hasPendingInstall();
+}
+
+void ProfilingStorage::getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) {
+  Call call(*this, "getPendingEcus");
+  storage_->getPendingEcus(pendingEcus);
+}
+
+void ProfilingStorage::clearInstalledVersions() {
+  Call call(*this, "clearInstalledVersions");
+  storage_->clearInstalledVersions();
+}
+
+void ProfilingStorage::saveEcuInstallationResult(const Uptane::EcuSerial& ecu_serial,
+                                                 const data::InstallationResult& result) {
+  Call call(*this, "saveEcuInstallationResult");
+  storage_->saveEcuInstallationResult(ecu_serial, result);
+}
+
+bool ProfilingStorage::loadEcuInstallationResults(
+    std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>>* results) const {
+  Call call(*this, "loadEcuInstallationResults");
+  return storage_->loadEcuInstallationResults(results);
+}
+
+void ProfilingStorage::storeDeviceInstallationResult(const data::InstallationResult& result,
+                                                     const std::string& raw_report, const std::string& correlation_id) {
+  Call call(*this, "storeDeviceInstallationResult", raw_report.size());
+  storage_->storeDeviceInstallationResult(result, raw_report, correlation_id);
+}
+
+bool ProfilingStorage::storeDeviceInstallationRawReport(const std::string& raw_report) {
+  Call call(*this, "storeDeviceInstallationRawReport", raw_report.size());
+  return storage_->storeDeviceInstallationRawReport(raw_report);
+}
+
+bool ProfilingStorage::loadDeviceInstallationResult(data::InstallationResult* result, std::string* raw_report,
+                                                    std::string* correlation_id) const {
+  Call call(*this, "loadDeviceInstallationResult");
+  return call.read(storage_->loadDeviceInstallationResult(result, raw_report, correlation_id), raw_report);
+}
+
+void ProfilingStorage::clearInstallationResults() {
+  Call call(*this, "clearInstallationResults");
+  storage_->clearInstallationResults();
+}
+
+void ProfilingStorage::saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, int64_t counter) {
+  Call call(*this, "saveEcuReportCounter");
+  storage_->saveEcuReportCounter(ecu_serial, counter);
+}
+
+bool ProfilingStorage::loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const {
+  Call call(*this, "loadEcuReportCounter");
+  return storage_->loadEcuReportCounter(results);
+}
+
+void ProfilingStorage::saveReportEvent(const Json::Value& json_value) {
+  Call call(*this, "saveReportEvent");
+  storage_->saveReportEvent(json_value);
+}
+
+bool ProfilingStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const {
+  Call call(*this, "loadReportEvents");
+  return storage_->loadReportEvents(report_array, id_max, limit);
+}
+
+bool ProfilingStorage::loadReportEventsRaw(std::vector<std::string>* events, int64_t* id_max, int limit,
+                                           size_t max_size) const {
+  Call call(*this, "loadReportEventsRaw");
+  return storage_->loadReportEventsRaw(events, id_max, limit, max_size);
+}
+
+void ProfilingStorage::deleteReportEvents(int64_t id_max) {
+  Call call(*this, "deleteReportEvents");
+  storage_->deleteReportEvents(id_max);
+}
+
+void ProfilingStorage::storeDeviceDataHash(const std::string& data_type, const std::string& hash) {
+  Call call(*this, "storeDeviceDataHash");
+  storage_->storeDeviceDataHash(data_type, hash);
+}
+
+bool ProfilingStorage::loadDeviceDataHash(const std::string& data_type, std::string* hash) const {
+  Call call(*this, "loadDeviceDataHash");
+  return storage_->loadDeviceDataHash(data_type, hash);
+}
+
+void ProfilingStorage::clearDeviceData() {
+  Call call(*this, "clearDeviceData");
+  storage_->clearDeviceData();
+}
+
+void ProfilingStorage::storeTargetFilename(const std::string& targetname, const std::string& filename) const {
+  Call call(*this, "storeTargetFilename");
+  storage_->storeTargetFilename(targetname, filename);
+}
+
+std::string ProfilingStorage::getTargetFilename(const std::string& targetname) const {
+  Call call(*this, "getTargetFilename");
+  return storage_->getTargetFilename(targetname);
+}
+
+std::vector<std::string> ProfilingStorage::getAllTargetNames() const {
+  Call call(*this, "getAllTargetNames");
+  return storage_->getAllTargetNames();
+}
+
+void ProfilingStorage::linkTargetFilename(const std::string& targetname, const std::string& filename) const {
+  Call call(*this, "linkTargetFilename");
+  storage_->linkTargetFilename(targetname, filename);
+}
+
+std::vector<std::string> ProfilingStorage::getTargetNamesForFile(const std::string& filename) const {
+  Call call(*this, "getTargetNamesForFile");
+  return storage_->getTargetNamesForFile(filename);
+}
+
+void ProfilingStorage::deleteTargetInfo(const std::string& targetname) const {
+  Call call(*this, "deleteTargetInfo");
+  storage_->deleteTargetInfo(targetname);
+}
+
+void ProfilingStorage::storeDownloadSegments(const std::string& targetname,
+                                             const std::vector<DownloadSegment>& segments) const {
+  Call call(*this, "storeDownloadSegments");
+  storage_->storeDownloadSegments(targetname, segments);
+}
+
+bool ProfilingStorage::loadDownloadSegments(const std::string& targetname,
+                                            std::vector<DownloadSegment>* segments) const {
+  Call call(*this, "loadDownloadSegments");
+  return storage_->loadDownloadSegments(targetname, segments);
+}
+
+void ProfilingStorage::updateDownloadSegment(const std::string& targetname, size_t segment, uint64_t downloaded) const {
+  Call call(*this, "updateDownloadSegment");
+  storage_->updateDownloadSegment(targetname, segment, downloaded);
+}
+
+void ProfilingStorage::clearDownloadSegments(const std::string& targetname) const {
+  Call call(*this, "clearDownloadSegments");
+  storage_->clearDownloadSegments(targetname);
+}
+
+void ProfilingStorage::storeTargetHashState(const std::string& targetname, uint64_t hashed_length,
+                                            const std::string& state) const {
+  Call call(*this, "storeTargetHashState", state.size());
+  storage_->storeTargetHashState(targetname, hashed_length, state);
+}
+
+bool ProfilingStorage::loadTargetHashState(const std::string& targetname, uint64_t* hashed_length,
+                                           std::string* state) const {
+  Call call(*this, "loadTargetHashState");
+  return call.read(storage_->loadTargetHashState(targetname, hashed_length, state), state);
+}
+
+void ProfilingStorage::storeVerifiedFile(const std::string& filename, const VerifiedFile& file) const {
+  Call call(*this, "storeVerifiedFile");
+  storage_->storeVerifiedFile(filename, file);
+}
+
+bool ProfilingStorage::loadVerifiedFile(const std::string& filename, VerifiedFile* file) const {
+  Call call(*this, "loadVerifiedFile");
+  return storage_->loadVerifiedFile(filename, file);
+}
+
+std::unique_ptr<StorageBatch> ProfilingStorage::beginBatch() {
+  Call call(*this, "beginBatch");
+  return storage_->beginBatch();
+}
+
+void ProfilingStorage::loadSnapshot(StorageSnapshot* snapshot) const {
+  Call call(*this, "loadSnapshot");
+  storage_->loadSnapshot(snapshot);
+}
+
+StorageMaintenance ProfilingStorage::maintain(std::chrono::milliseconds budget, bool integrity_check) {
+  Call call(*this, "maintain");
+  return storage_->maintain(budget, integrity_check);
+}
+
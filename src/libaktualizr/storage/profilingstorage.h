@@ -0,0 +1,167 @@
+#ifndef PROFILINGSTORAGE_H_
+#define PROFILINGSTORAGE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "invstorage.h"
+#include "utilities/metrics.h"
+
+/**
+ * Storage that measures the calls made to the wrapped storage: the number of
+ * calls, their duration and the bytes read or written by each method, in the
+ * aktualizr_storage_call_seconds and aktualizr_storage_bytes_total metrics.
+ * The methods that took the most time are also logged at regular intervals
+ * and when the storage is destroyed.
+ *
+ * Enabled with storage.profile, to find out which storage calls dominate a
+ * workload; it costs a clock reading and a map lookup per call.
+ */
+class ProfilingStorage : public INvStorage {
+ public:
+  ProfilingStorage(std::shared_ptr<INvStorage> storage, const StorageConfig& config,
+                   std::chrono::seconds summary_interval = std::chrono::minutes(10));
+  ~ProfilingStorage() override;
+  ProfilingStorage(const ProfilingStorage&) = delete;
+  ProfilingStorage(ProfilingStorage&&) = delete;
+  ProfilingStorage& operator=(const ProfilingStorage&) = delete;
+  ProfilingStorage& operator=(ProfilingStorage&&) = delete;
+
+  // The methods called so far, those that took the most time first
+  std::string summary() const;
+
+  StorageType type() override { return storage_->type(); }
+  void storePrimaryKeys(const std::string& public_key, const std::string& private_key) override;
+  bool loadPrimaryKeys(std::string* public_key, std::string* private_key) const override;
+  bool loadPrimaryPublic(std::string* public_key) const override;
+  bool loadPrimaryPrivate(std::string* private_key) const override;
+  void clearPrimaryKeys() override;
+  void saveSecondaryInfo(const Uptane::EcuSerial& ecu_serial, const std::string& sec_type,
+                         const PublicKey& public_key) override;
+  void saveSecondaryData(const Uptane::EcuSerial& ecu_serial, const std::string& data) override;
+  bool loadSecondaryInfo(const Uptane::EcuSerial& ecu_serial, SecondaryInfo* secondary) const override;
+  bool loadSecondariesInfo(std::vector<SecondaryInfo>* secondaries) const override;
+  void storeTlsCreds(const std::string& ca, const std::string& cert, const std::string& pkey) override;
+  void storeTlsCa(const std::string& ca) override;
+  void storeTlsCert(const std::string& cert) override;
+  void storeTlsPkey(const std::string& pkey) override;
+  bool loadTlsCreds(std::string* ca, std::string* cert, std::string* pkey) const override;
+  bool loadTlsCa(std::string* ca) const override;
+  bool loadTlsCert(std::string* cert) const override;
+  bool loadTlsPkey(std::string* cert) const override;
+  void clearTlsCreds() override;
+  void storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) override;
+  bool loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const override;
+  void storeNonRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Role role) override;
+  bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const override;
+  bool loadRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo, Uptane::Version version) const override;
+  bool loadNonRootBuffer(Uptane::MetaBuffer* data, Uptane::RepositoryType repo, Uptane::Role role) const override;
+  void clearNonRootMeta(Uptane::RepositoryType repo) override;
+  bool loadMetaExpiry(Uptane::RepositoryType repo, Uptane::Role role, TimeStamp* expiry) const override;
+  void storeMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, const std::string& etag,
+                           const std::string& last_modified) override;
+  bool loadMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, std::string* etag,
+                          std::string* last_modified) const override;
+  void clearMetadata() override;
+  void storeDelegation(const std::string& data, Uptane::Role role) override;
+  bool loadDelegation(std::string* data, Uptane::Role role) const override;
+  bool loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const override;
+  void deleteDelegation(Uptane::Role role) override;
+  void clearDelegations() override;
+  void storeDeviceId(const std::string& device_id) override;
+  bool loadDeviceId(std::string* device_id) const override;
+  void clearDeviceId() override;
+  void storeEcuSerials(const EcuSerials& serials) override;
+  bool loadEcuSerials(EcuSerials* serials) const override;
+  void clearEcuSerials() override;
+  void storeCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, const std::string& manifest) override;
+  bool loadCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, std::string* manifest) const override;
+  void saveMisconfiguredEcu(const MisconfiguredEcu& ecu) override;
+  bool loadMisconfiguredEcus(std::vector<MisconfiguredEcu>* ecus) const override;
+  void clearMisconfiguredEcus() override;
+  void storeEcuRegistered() override;
+  bool loadEcuRegistered() const override;
+  void clearEcuRegistered() override;
+  void storeNeedReboot() override;
+  bool loadNeedReboot(bool* need_reboot) const override;
+  void clearNeedReboot() override;
+  void saveInstalledVersion(const std::string& ecu_serial, const Uptane::Target& target,
+                            InstalledVersionUpdateMode update_mode,
+                            const Uptane::CorrelationId& correlation_id) override;
+  bool loadInstalledVersions(const std::string& ecu_serial, boost::optional<Uptane::Target>* current_version,
+                             boost::optional<Uptane::Target>* pending_version,
+                             Uptane::CorrelationId* correlation_id) const override;
+  bool loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
+                           bool only_installed) const override;
+  bool loadInstalledVersionByHash(const std::string& ecu_serial, const std::string& sha256,
+                                  boost::optional<Uptane::Target>* version) const override;
+  bool hasPendingInstall() override;
+  void getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) override;
+  void clearInstalledVersions() override;
+  void saveEcuInstallationResult(const Uptane::EcuSerial& ecu_serial, const data::InstallationResult& result) override;
+  bool loadEcuInstallationResults(
+      std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>>* results) const override;
+  void storeDeviceInstallationResult(const data::InstallationResult& result, const std::string& raw_report,
+                                     const std::string& correlation_id) override;
+  bool storeDeviceInstallationRawReport(const std::string& raw_report) override;
+  bool loadDeviceInstallationResult(data::InstallationResult* result, std::string* raw_report,
+                                    std::string* correlation_id) const override;
+  void clearInstallationResults() override;
+  void saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, int64_t counter) override;
+  bool loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const override;
+  void saveReportEvent(const Json::Value& json_value) override;
+  bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const override;
+  bool loadReportEventsRaw(std::vector<std::string>* events, int64_t* id_max, int limit,
+                           size_t max_size) const override;
+  void deleteReportEvents(int64_t id_max) override;
+  void storeDeviceDataHash(const std::string& data_type, const std::string& hash) override;
+  bool loadDeviceDataHash(const std::string& data_type, std::string* hash) const override;
+  void clearDeviceData() override;
+  void storeTargetFilename(const std::string& targetname, const std::string& filename) const override;
+  std::string getTargetFilename(const std::string& targetname) const override;
+  std::vector<std::string> getAllTargetNames() const override;
+  void linkTargetFilename(const std::string& targetname, const std::string& filename) const override;
+  std::vector<std::string> getTargetNamesForFile(const std::string& filename) const override;
+  void deleteTargetInfo(const std::string& targetname) const override;
+  void storeDownloadSegments(const std::string& targetname,
+                             const std::vector<DownloadSegment>& segments) const override;
+  bool loadDownloadSegments(const std::string& targetname, std::vector<DownloadSegment>* segments) const override;
+  void updateDownloadSegment(const std::string& targetname, size_t segment, uint64_t downloaded) const override;
+  void clearDownloadSegments(const std::string& targetname) const override;
+  void storeTargetHashState(const std::string& targetname, uint64_t hashed_length,
+                            const std::string& state) const override;
+  bool loadTargetHashState(const std::string& targetname, uint64_t* hashed_length, std::string* state) const override;
+  void storeVerifiedFile(const std::string& filename, const VerifiedFile& file) const override;
+  bool loadVerifiedFile(const std::string& filename, VerifiedFile* file) const override;
+  std::unique_ptr<StorageBatch> beginBatch() override;
+  void loadSnapshot(StorageSnapshot* snapshot) const override;
+  uint64_t metadataGeneration(Uptane::RepositoryType repo) const override {
+    return storage_->metadataGeneration(repo);
+  }
+  StorageMaintenance maintain(std::chrono::milliseconds budget, bool integrity_check) override;
+
+ private:
+  struct MethodStats {
+    metrics::Histogram& seconds;
+    metrics::Counter& bytes;
+  };
+  class Call;
+
+  MethodStats& stats(const char* method) const;
+  void maybeLogSummary() const;
+
+  std::shared_ptr<INvStorage> storage_;
+  const std::chrono::seconds summary_interval_;
+  mutable std::mutex mutex_;
+  mutable std::map<std::string, MethodStats> methods_;
+  mutable std::atomic<int64_t> next_summary_;
+};
+
+#endif  // PROFILINGSTORAGE_H_
@@ -0,0 +1,40 @@
+#include <gtest/gtest.h>
+
+#include "storage/profilingstorage.h"
+#include "storage/sqlstorage.h"
+#include "utilities/metrics.h"
+#include "utilities/utils.h"
+
+/* Calls are counted per method, with the bytes they read or write, and
+ * passed to the wrapped storage. */
+TEST(ProfilingStorage, CountsCalls) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto sql_storage = std::make_shared<SQLStorage>(config, false);
+  ProfilingStorage storage(sql_storage, config);
+
+  std::string data;
+  EXPECT_FALSE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  storage.storeNonRoot("targets", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  EXPECT_TRUE(storage.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  EXPECT_EQ(data, "targets");
+  EXPECT_TRUE(sql_storage->loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+
+  const std::string text = metrics::Registry::instance().prometheus();
+  EXPECT_NE(text.find("aktualizr_storage_call_seconds_count{method=\"loadNonRoot\"} 2\n"), std::string::npos);
+  EXPECT_NE(text.find("aktualizr_storage_call_seconds_count{method=\"storeNonRoot\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("aktualizr_storage_bytes_total{method=\"loadNonRoot\"} 7\n"), std::string::npos);
+  EXPECT_NE(text.find("aktualizr_storage_bytes_total{method=\"storeNonRoot\"} 7\n"), std::string::npos);
+
+  const std::string summary = storage.summary();
+  EXPECT_NE(summary.find("loadNonRoot: 2 calls"), std::string::npos);
+  EXPECT_EQ(summary.find("loadRoot"), std::string::npos);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -1,11 +1,13 @@
 #ifndef SQL_UTILS_H_
 #define SQL_UTILS_H_
 
+#include <cstring>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/optional.hpp>
@@ -13,6 +15,7 @@
 #include <sqlite3.h>
 
 #include "logging/logging.h"
+#include "utilities/metrics.h"
 
 // Unique ownership SQLite3 statement creation
 
@@ -31,24 +34,54 @@ class SQLInternalException : public SQLException {
   explicit SQLInternalException(const std::string& what = "SQL internal error") : SQLException(what) {}
 };
 
+class SQLiteStatementCache;
+
+// Gives a statement back to its cache, or finalizes it if it has none
+class SQLiteStatementDeleter {
+ public:
+  SQLiteStatementDeleter() = default;
+  SQLiteStatementDeleter(std::shared_ptr<SQLiteStatementCache> cache, bool* in_use)
+      : cache_(std::move(cache)), in_use_(in_use) {}
+  void operator()(sqlite3_stmt* stmt) const;
+
+ private:
+  std::shared_ptr<SQLiteStatementCache> cache_;
+  bool* in_use_{nullptr};
+};
+
+using SQLiteStatementPtr = std::unique_ptr<sqlite3_stmt, SQLiteStatementDeleter>;
+
+inline sqlite3_stmt* prepareSQLiteStatement(sqlite3* db, const char* zSql) {
+  sqlite3_stmt* statement;
+  if (sqlite3_prepare_v2(db, zSql, -1, &statement, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Could not prepare statement: " << sqlite3_errmsg(db);
+    throw SQLInternalException(std::string("Could not prepare statement: ") + sqlite3_errmsg(db));
+  }
+  return statement;
+}
+
 class SQLiteStatement {
  public:
   template <typename... Types>
   SQLiteStatement(sqlite3* db, const std::string& zSql, const Types&... args)
-      : db_(db), stmt_(nullptr, sqlite3_finalize), bind_cnt_(1) {
-    sqlite3_stmt* statement;
-
-    if (sqlite3_prepare_v2(db_, zSql.c_str(), -1, &statement, nullptr) != SQLITE_OK) {
-      LOG_ERROR << "Could not prepare statement: " << sqlite3_errmsg(db_);
-      throw SQLInternalException(std::string("Could not prepare statement: ") + sqlite3_errmsg(db_));
-    }
-    stmt_.reset(statement);
+      : db_(db), stmt_(prepareSQLiteStatement(db, zSql.c_str())), bind_cnt_(1) {
+    bindArguments(args...);
+  }
 
+  // A statement that is already prepared, e.g. one from a cache
+  template <typename... Types>
+  SQLiteStatement(sqlite3* db, SQLiteStatementPtr stmt, const Types&... args)
+      : db_(db), stmt_(std::move(stmt)), bind_cnt_(1) {
     bindArguments(args...);
   }
 
   inline sqlite3_stmt* get() const { return stmt_.get(); }
-  inline int step() const { return sqlite3_step(stmt_.get()); }
+  inline int step() const {
+    static auto& latency =
+        metrics::Registry::instance().histogram("aktualizr_sqlite_step_seconds", "Time to step an SQLite statement");
+    metrics::ScopedTimer timer(latency);
+    return sqlite3_step(stmt_.get());
+  }
 
   // get results
   inline boost::optional<std::string> get_result_col_blob(int iCol) {
@@ -119,55 +152,172 @@ class SQLiteStatement {
   }
 
   sqlite3* db_;
-  std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt*)> stmt_;
-  int bind_cnt_;  // NOLINT
   // copies of data that need to persist for the object duration
   // (avoid vector because of resizing issues)
   std::list<std::string> owned_data_;
+  // declared after owned_data_, so that its bindings are cleared first
+  SQLiteStatementPtr stmt_;
+  int bind_cnt_;  // NOLINT
+};
+
+/**
+ * Prepared statements of a connection, so that the SQL of frequent queries
+ * is only compiled once. Statements are reset and their bindings cleared
+ * when they are given back.
+ *
+ * A statement that is still in use when the same SQL is asked for again is
+ * not shared: another one is prepared, and finalized after use.
+ */
+class SQLiteStatementCache : public std::enable_shared_from_this<SQLiteStatementCache> {
+ public:
+  explicit SQLiteStatementCache(std::shared_ptr<sqlite3> db) : db_(std::move(db)) {}
+  ~SQLiteStatementCache() {
+    for (auto& entry : by_text_) {
+      sqlite3_finalize(entry.second.stmt);
+    }
+    for (auto& entry : by_address_) {
+      sqlite3_finalize(entry.second.stmt);
+    }
+  }
+  SQLiteStatementCache(const SQLiteStatementCache&) = delete;
+  SQLiteStatementCache& operator=(const SQLiteStatementCache&) = delete;
+  SQLiteStatementCache(SQLiteStatementCache&&) = delete;
+  SQLiteStatementCache& operator=(SQLiteStatementCache&&) = delete;
+
+  SQLiteStatementPtr get(const std::string& zSql) {
+    std::lock_guard<std::mutex> lock(m_);
+    return checkout(by_text_[zSql], zSql.c_str(), false);
+  }
+
+  // Look up SQL that has a static address, i.e. a string literal, without
+  // hashing it. The text is still compared, in case the address was reused.
+  SQLiteStatementPtr getStatic(const char* zSql) {
+    std::lock_guard<std::mutex> lock(m_);
+    return checkout(by_address_[zSql], zSql, true);
+  }
+
+  void release(sqlite3_stmt* stmt, bool* in_use) {
+    std::lock_guard<std::mutex> lock(m_);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    *in_use = false;
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(m_);
+    return by_text_.size() + by_address_.size();
+  }
+
+ private:
+  struct Entry {
+    sqlite3_stmt* stmt{nullptr};
+    bool in_use{false};
+  };
+
+  // must be called with m_ held
+  SQLiteStatementPtr checkout(Entry& entry, const char* zSql, bool compare) {
+    if (entry.stmt != nullptr && (entry.in_use || (compare && std::strcmp(sqlite3_sql(entry.stmt), zSql) != 0))) {
+      return SQLiteStatementPtr(prepareSQLiteStatement(db_.get(), zSql));
+    }
+    if (entry.stmt == nullptr) {
+      entry.stmt = prepareSQLiteStatement(db_.get(), zSql);
+    }
+    entry.in_use = true;
+    return SQLiteStatementPtr(entry.stmt, SQLiteStatementDeleter(shared_from_this(), &entry.in_use));
+  }
+
+  std::mutex m_;
+  std::shared_ptr<sqlite3> db_;
+  // std::unordered_map nodes don't move, the deleters point to them
+  std::unordered_map<std::string, Entry> by_text_;
+  std::unordered_map<const char*, Entry> by_address_;
 };
 
-// Unique ownership SQLite3 connection
+inline void SQLiteStatementDeleter::operator()(sqlite3_stmt* stmt) const {
+  if (cache_) {
+    cache_->release(stmt, in_use_);
+  } else {
+    sqlite3_finalize(stmt);
+  }
+}
+
+// SQLite3 connection, owned by the guard or shared with a long-lived owner
 const extern std::mutex sql_mutex;
 class SQLite3Guard {
  public:
   sqlite3* get() { return handle_.get(); }
   int get_rc() const { return rc_; }
 
-  explicit SQLite3Guard(const char* path, bool readonly, std::shared_ptr<std::mutex> mutex = nullptr)
-      : handle_(nullptr, sqlite3_close), rc_(0), m_(std::move(mutex)) {
+  explicit SQLite3Guard(const char* path, bool readonly,
+                        std::shared_ptr<std::recursive_mutex> mutex = nullptr)
+      : rc_(0), m_(std::move(mutex)) {
+    if (m_) {
+      m_->lock();
+    }
+    handle_ = open(path, readonly, &rc_);
+  }
+
+  explicit SQLite3Guard(const boost::filesystem::path& path, bool readonly = false,
+                        std::shared_ptr<std::recursive_mutex> mutex = nullptr)
+      : SQLite3Guard(path.c_str(), readonly, std::move(mutex)) {}
+  // Use a connection that its owner keeps open, while holding `mutex`
+  SQLite3Guard(std::shared_ptr<sqlite3> handle, std::shared_ptr<std::recursive_mutex> mutex,
+               std::shared_ptr<SQLiteStatementCache> statements = nullptr)
+      : handle_(std::move(handle)), rc_(SQLITE_OK), m_(std::move(mutex)), statements_(std::move(statements)) {
     if (m_) {
       m_->lock();
     }
+  }
+  SQLite3Guard(SQLite3Guard&& guard) noexcept
+      : handle_(std::move(guard.handle_)),
+        rc_(guard.rc_),
+        m_(std::move(guard.m_)),
+        statements_(std::move(guard.statements_)),
+        transaction_(guard.transaction_) {
+    guard.transaction_ = Transaction::kNone;
+  }
+  ~SQLite3Guard() {
+    // A shared connection stays open, so roll back what closing it would
+    if (handle_ && transaction_ != Transaction::kNone && sqlite3_get_autocommit(handle_.get()) == 0) {
+      try {
+        rollbackTransaction();
+      } catch (const SQLException&) {
+      }
+    }
+    handle_.reset();
+    if (m_) {
+      m_->unlock();
+    }
+  }
+
+  /**
+   * Open a connection. The handle is returned even on failure, so that the
+   * error message can be read from it.
+   */
+  static std::shared_ptr<sqlite3> open(const char* path, bool readonly, int* rc) {
     if (sqlite3_threadsafe() == 0) {
       throw SQLInternalException("sqlite3 has been compiled without multitheading support");
     }
-    sqlite3* h;
+    sqlite3* h = nullptr;
     if (readonly) {
-      rc_ = sqlite3_open_v2(path, &h, SQLITE_OPEN_READONLY, nullptr);
+      *rc = sqlite3_open_v2(path, &h, SQLITE_OPEN_READONLY, nullptr);
     } else {
-      rc_ = sqlite3_open_v2(path, &h, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr);
+      *rc = sqlite3_open_v2(path, &h, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr);
     }
 
     /* retry operations for 2 seconds before returning SQLITE_BUSY */
     sqlite3_busy_timeout(h, 2000);
 
-    handle_.reset(h);
-  }
-
-  explicit SQLite3Guard(const boost::filesystem::path& path, bool readonly = false,
-                        std::shared_ptr<std::mutex> mutex = nullptr)
-      : SQLite3Guard(path.c_str(), readonly, std::move(mutex)) {}
-  SQLite3Guard(SQLite3Guard&& guard) noexcept : handle_(std::move(guard.handle_)), rc_(guard.rc_) {}
-  ~SQLite3Guard() {
-    if (m_) {
-      m_->unlock();
-    }
+    return std::shared_ptr<sqlite3>(h, sqlite3_close);
   }
   SQLite3Guard(const SQLite3Guard& guard) = delete;
   SQLite3Guard& operator=(const SQLite3Guard& guard) = delete;
   SQLite3Guard& operator=(SQLite3Guard&&) = delete;
 
   int exec(const char* sql, int (*callback)(void*, int, char**, char**), void* cb_arg) {
+    static auto& latency =
+        metrics::Registry::instance().histogram("aktualizr_sqlite_exec_seconds", "Time to execute an SQLite query");
+    metrics::ScopedTimer timer(latency);
     return sqlite3_exec(handle_.get(), sql, callback, cb_arg, nullptr);
   }
 
@@ -177,9 +327,21 @@ class SQLite3Guard {
 
   template <typename... Types>
   SQLiteStatement prepareStatement(const std::string& zSql, const Types&... args) {
+    if (statements_) {
+      return SQLiteStatement(handle_.get(), statements_->get(zSql), args...);
+    }
     return SQLiteStatement(handle_.get(), zSql, args...);
   }
 
+  // String literals are looked up in the statement cache by their address
+  template <typename... Types, size_t N>
+  SQLiteStatement prepareStatement(const char (&zSql)[N], const Types&... args) {
+    if (statements_) {
+      return SQLiteStatement(handle_.get(), statements_->getStatic(zSql), args...);
+    }
+    return SQLiteStatement(handle_.get(), std::string(zSql), args...);
+  }
+
   std::string errmsg() const { return sqlite3_errmsg(handle_.get()); }
 
   // Transaction handling
@@ -189,34 +351,54 @@ class SQLite3Guard {
   // the destruction of the `SQLite3Guard` (and thus the SQLite connection) or
   // if `rollbackTransaction()` is called explicitely, the changes will be
   // rolled back
+  //
+  // If a transaction is already open on the connection (e.g. a batch of the
+  // storage), a savepoint is used instead, so that only the changes of this
+  // guard are rolled back and the rest is committed with the outer transaction.
 
   void beginTransaction() {
-    // Note: transaction cannot be nested and this will fail if another
-    // transaction was open on the same connection
+    if (sqlite3_get_autocommit(handle_.get()) == 0) {
+      if (exec("SAVEPOINT guard;", nullptr, nullptr) != SQLITE_OK) {
+        LOG_ERROR << "Can't begin transaction: " << errmsg();
+        throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
+      }
+      transaction_ = Transaction::kSavepoint;
+      return;
+    }
     if (exec("BEGIN TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't begin transaction: " << errmsg();
       throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
     }
+    transaction_ = Transaction::kTransaction;
   }
 
   void commitTransaction() {
-    if (exec("COMMIT TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
+    const char* sql = (transaction_ == Transaction::kSavepoint) ? "RELEASE guard;" : "COMMIT TRANSACTION;";
+    if (exec(sql, nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't commit transaction: " << errmsg();
-      throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
+      throw SQLInternalException(std::string("Can't commit transaction: ") + errmsg());
     }
+    transaction_ = Transaction::kNone;
   }
 
   void rollbackTransaction() {
-    if (exec("ROLLBACK TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
+    const char* sql =
+        (transaction_ == Transaction::kSavepoint) ? "ROLLBACK TO guard; RELEASE guard;" : "ROLLBACK TRANSACTION;";
+    transaction_ = Transaction::kNone;
+    if (exec(sql, nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't rollback transaction: " << errmsg();
-      throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
+      throw SQLInternalException(std::string("Can't rollback transaction: ") + errmsg());
     }
   }
 
  private:
-  std::unique_ptr<sqlite3, int (*)(sqlite3*)> handle_;
+  std::shared_ptr<sqlite3> handle_;
   int rc_;
-  std::shared_ptr<std::mutex> m_ = nullptr;
+  std::shared_ptr<std::recursive_mutex> m_ = nullptr;
+  std::shared_ptr<SQLiteStatementCache> statements_;
+  enum class Transaction { kNone, kTransaction, kSavepoint };
+  // what this guard has started, if anything
+  Transaction transaction_{Transaction::kNone};
 };
 
 #endif  // SQL_UTILS_H_
@@ -16,6 +16,105 @@ TEST(sql_utils, PrepareRvalue) {
   EXPECT_EQ(statement.step(), SQLITE_DONE);
 }
 
+/* A shared connection stays open across guards, but a transaction that was not
+ * committed is rolled back like it would be when closing the connection. */
+TEST(sql_utils, SharedConnection) {
+  TemporaryDirectory temp_dir;
+  auto mutex = std::make_shared<std::recursive_mutex>();
+  int rc = SQLITE_ERROR;
+  auto handle = SQLite3Guard::open((temp_dir.Path() / "test.db").c_str(), false, &rc);
+  ASSERT_EQ(rc, SQLITE_OK);
+
+  {
+    SQLite3Guard db(handle, mutex);
+    EXPECT_EQ(db.exec("CREATE TABLE example(ex1 INTEGER);", nullptr, nullptr), SQLITE_OK);
+    db.beginTransaction();
+    auto statement = db.prepareStatement("INSERT INTO example(ex1) VALUES (?);", 1);
+    EXPECT_EQ(statement.step(), SQLITE_DONE);
+  }
+  EXPECT_TRUE(mutex->try_lock());
+  mutex->unlock();
+
+  SQLite3Guard db(handle, mutex);
+  EXPECT_EQ(db.get(), handle.get());
+  auto statement = db.prepareStatement("SELECT count(*) FROM example;");
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_int(0), 0);
+}
+
+/* A transaction begun while another one is open on the connection is a
+ * savepoint: rolling it back keeps the changes of the outer transaction. */
+TEST(sql_utils, NestedTransaction) {
+  TemporaryDirectory temp_dir;
+  auto mutex = std::make_shared<std::recursive_mutex>();
+  int rc = SQLITE_ERROR;
+  auto handle = SQLite3Guard::open((temp_dir.Path() / "test.db").c_str(), false, &rc);
+  ASSERT_EQ(rc, SQLITE_OK);
+
+  {
+    SQLite3Guard outer(handle, mutex);
+    EXPECT_EQ(outer.exec("CREATE TABLE example(ex1 INTEGER);", nullptr, nullptr), SQLITE_OK);
+    outer.beginTransaction();
+    EXPECT_EQ(outer.exec("INSERT INTO example(ex1) VALUES (1);", nullptr, nullptr), SQLITE_OK);
+    {
+      SQLite3Guard inner(handle, mutex);
+      inner.beginTransaction();
+      EXPECT_EQ(inner.exec("INSERT INTO example(ex1) VALUES (2);", nullptr, nullptr), SQLITE_OK);
+      inner.commitTransaction();
+    }
+    {
+      SQLite3Guard inner(handle, mutex);
+      inner.beginTransaction();
+      EXPECT_EQ(inner.exec("INSERT INTO example(ex1) VALUES (3);", nullptr, nullptr), SQLITE_OK);
+    }
+    {
+      // no transaction of its own, nothing to roll back
+      SQLite3Guard inner(handle, mutex);
+      EXPECT_EQ(inner.exec("INSERT INTO example(ex1) VALUES (4);", nullptr, nullptr), SQLITE_OK);
+    }
+    outer.commitTransaction();
+  }
+
+  SQLite3Guard db(handle, mutex);
+  auto statement = db.prepareStatement("SELECT sum(ex1) FROM example;");
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_int(0), 7);
+}
+
+/* Statements are prepared once per SQL text and reused with new bindings. A
+ * statement that is still in use is not shared. */
+TEST(sql_utils, StatementCache) {
+  TemporaryDirectory temp_dir;
+  auto mutex = std::make_shared<std::recursive_mutex>();
+  int rc = SQLITE_ERROR;
+  auto handle = SQLite3Guard::open((temp_dir.Path() / "test.db").c_str(), false, &rc);
+  ASSERT_EQ(rc, SQLITE_OK);
+  auto statements = std::make_shared<SQLiteStatementCache>(handle);
+
+  SQLite3Guard db(handle, mutex, statements);
+  EXPECT_EQ(db.exec("CREATE TABLE example(ex1 INTEGER, ex2 TEXT);", nullptr, nullptr), SQLITE_OK);
+  for (int i = 0; i < 10; ++i) {
+    auto statement = db.prepareStatement<int, std::string>("INSERT INTO example(ex1, ex2) VALUES (?,?);", i,
+                                                           std::to_string(i));
+    EXPECT_EQ(statement.step(), SQLITE_DONE);
+  }
+  EXPECT_EQ(statements->size(), 1);
+
+  const std::string query = "SELECT ex2 FROM example WHERE ex1 = ?;";
+  {
+    auto statement = db.prepareStatement(query, 3);
+    auto in_use = db.prepareStatement(query, 4);
+    ASSERT_EQ(statement.step(), SQLITE_ROW);
+    ASSERT_EQ(in_use.step(), SQLITE_ROW);
+    EXPECT_EQ(statement.get_result_col_str(0).value(), "3");
+    EXPECT_EQ(in_use.get_result_col_str(0).value(), "4");
+  }
+  auto statement = db.prepareStatement(query, 5);
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_str(0).value(), "5");
+  EXPECT_EQ(statements->size(), 2);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -1,16 +1,46 @@
 #include "sqlstorage.h"
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <utility>
 
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "sql_utils.h"
 #include "utilities/utils.h"
 
+// Copies of large tables to a new layout that are not done by the schema
+// migrations, see BackgroundMigration. They are only removed from here once no
+// device can have them pending anymore.
+const std::vector<BackgroundMigration> libaktualizr_background_migrations{};
+
+namespace {
+// Bumps the metadata generation once a write to the metadata is over, also
+// when it failed half-way.
+class MetadataWrite {
+ public:
+  explicit MetadataWrite(std::atomic<uint64_t>& generation) : generation_(generation) {}
+  ~MetadataWrite() { generation_.fetch_add(1); }
+  MetadataWrite(const MetadataWrite&) = delete;
+  MetadataWrite(MetadataWrite&&) = delete;
+  MetadataWrite& operator=(const MetadataWrite&) = delete;
+  MetadataWrite& operator=(MetadataWrite&&) = delete;
+
+ private:
+  std::atomic<uint64_t>& generation_;
+};
+}  // namespace
+
 // Find metadata with version set to -1 (e.g. after migration) and assign proper version to it.
 void SQLStorage::cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Role& role) {
   SQLite3Guard db = dbConnection();
@@ -61,14 +91,145 @@ void SQLStorage::cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Rol
 SQLStorage::SQLStorage(const StorageConfig& config, bool readonly)
     : SQLStorageBase(config.sqldb_path.get(config.path), readonly, libaktualizr_schema_migrations,
                      libaktualizr_schema_rollback_migrations, libaktualizr_current_schema,
-                     libaktualizr_current_schema_version),
-      INvStorage(config) {
+                     libaktualizr_current_schema_version, config.sqldb_wal, libaktualizr_background_migrations),
+      INvStorage(config),
+      meta_dir_(config.sqldb_path.get(config.path).string() + "-meta") {
+  if (readonly) {
+    // the database can't be written, the next writer cleans up
+    return;
+  }
   try {
     cleanMetaVersion(Uptane::RepositoryType::Director(), Uptane::Role::Root());
     cleanMetaVersion(Uptane::RepositoryType::Image(), Uptane::Role::Root());
   } catch (...) {
     LOG_ERROR << "SQLite database metadata version migration failed";
   }
+  try {
+    // files of metadata that was replaced just before a crash
+    SQLite3Guard db = dbConnection();
+    removeUnusedMetaFiles(db);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Failed to clean up the metadata files: " << e.what();
+  }
+}
+
+std::string SQLStorage::storeMetaFile(const std::string& data) const {
+  if (data.size() < kMetaFileThreshold) {
+    return "";
+  }
+  const std::string name = Crypto::sha256digestHex(data);
+  const boost::filesystem::path path = meta_dir_ / name;
+  boost::system::error_code ec;
+  if (boost::filesystem::exists(path, ec)) {
+    // the same metadata, e.g. stored again after a 304
+    return name;
+  }
+  boost::filesystem::create_directories(meta_dir_, ec);
+
+  // the file is complete on disk before any row refers to it
+  const boost::filesystem::path tmp_path = meta_dir_ / (name + ".new");
+  const int fd =
+      open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  bool written = fd >= 0;
+  for (size_t done = 0; written && done < data.size();) {
+    const ssize_t res = write(fd, data.data() + done, data.size() - done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    written = res > 0;
+    done += written ? static_cast<size_t>(res) : 0;
+  }
+  written = written && fsync(fd) == 0;
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    LOG_WARNING << "Failed to write metadata file " << path << ", keeping the metadata in the database: "
+                << std::strerror(errno);
+    unlink(tmp_path.c_str());
+    return "";
+  }
+  const int dir_fd = open(meta_dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return name;
+}
+
+bool SQLStorage::loadMetaFile(const std::string& name, std::string* data) const {
+  const boost::filesystem::path path = meta_dir_ / name;
+  if (data == nullptr) {
+    boost::system::error_code ec;
+    return boost::filesystem::exists(path, ec);
+  }
+  // straight into the string, which is all the copying there is
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st {};
+  bool read_ok = fd >= 0 && fstat(fd, &st) == 0;
+  std::string contents;
+  if (read_ok) {
+    contents.resize(static_cast<size_t>(st.st_size));
+  }
+  for (size_t done = 0; read_ok && done < contents.size();) {
+    const ssize_t res = read(fd, &contents[done], contents.size() - done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    read_ok = res > 0;
+    done += read_ok ? static_cast<size_t>(res) : 0;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (!read_ok) {
+    LOG_ERROR << "Failed to read metadata file " << path << ": " << std::strerror(errno);
+    return false;
+  }
+  *data = std::move(contents);
+  return true;
+}
+
+bool SQLStorage::loadMeta(SQLiteStatement& statement, const int meta_col, const int file_col,
+                          std::string* data) const {
+  const auto meta_file = statement.get_result_col_str(file_col);
+  if (!!meta_file) {
+    return loadMetaFile(*meta_file, data);
+  }
+  if (data != nullptr) {
+    *data = statement.get_result_col_blob(meta_col).value_or("");
+  }
+  return true;
+}
+
+void SQLStorage::removeUnusedMetaFiles(SQLite3Guard& db) const {
+  if (sqlite3_get_autocommit(db.get()) == 0) {
+    return;
+  }
+  boost::system::error_code ec;
+  if (!boost::filesystem::is_directory(meta_dir_, ec)) {
+    return;
+  }
+
+  std::set<std::string> used;
+  auto statement = db.prepareStatement(
+      "SELECT meta_file FROM meta WHERE meta_file IS NOT NULL UNION "
+      "SELECT meta_file FROM delegations WHERE meta_file IS NOT NULL;");
+  int result;
+  while ((result = statement.step()) == SQLITE_ROW) {
+    used.insert(statement.get_result_col_str(0).value());
+  }
+  if (result != SQLITE_DONE) {
+    LOG_ERROR << "Failed to get the metadata files: " << db.errmsg();
+    return;
+  }
+
+  for (boost::filesystem::directory_iterator it(meta_dir_, ec), end; !ec && it != end; it.increment(ec)) {
+    if (used.count(it->path().filename().string()) == 0) {
+      LOG_TRACE << "Removing unused metadata file " << it->path();
+      boost::filesystem::remove(it->path(), ec);
+    }
+  }
 }
 
 void SQLStorage::storePrimaryKeys(const std::string& public_key, const std::string& private_key) {
@@ -507,6 +668,7 @@ bool SQLStorage::loadTlsPkey(std::string* pkey) const {
 }
 
 void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) {
+  MetadataWrite write(metadataGenerationRef(repo));
   SQLite3Guard db = dbConnection();
 
   db.beginTransaction();
@@ -520,9 +682,10 @@ void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo,
     return;
   }
 
-  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int>("INSERT INTO meta VALUES (?, ?, ?, ?);",
-                                                                   SQLBlob(data), static_cast<int>(repo),
-                                                                   Uptane::Role::Root().ToInt(), version.version());
+  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int, std::string>(
+      "INSERT INTO meta(meta, repo, meta_type, version, expires) VALUES (?, ?, ?, ?, ?);", SQLBlob(data),
+      static_cast<int>(repo), Uptane::Role::Root().ToInt(), version.version(),
+      Uptane::extractExpiryUntrusted(data).ToString());
 
   if (ins_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to store Root metadata: " << db.errmsg();
@@ -533,8 +696,12 @@ void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo,
 }
 
 void SQLStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType repo, const Uptane::Role role) {
+  MetadataWrite write(metadataGenerationRef(repo));
   SQLite3Guard db = dbConnection();
 
+  const std::string meta_file = storeMetaFile(data);
+  const std::string in_file;
+
   db.beginTransaction();
 
   auto del_statement = db.prepareStatement<int, int>("DELETE FROM meta WHERE (repo=? AND meta_type=?);",
@@ -545,16 +712,26 @@ void SQLStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType re
     return;
   }
 
-  auto ins_statement =
-      db.prepareStatement<SQLBlob, int, int, int>("INSERT INTO meta VALUES (?, ?, ?, ?);", SQLBlob(data),
-                                                  static_cast<int>(repo), role.ToInt(), Uptane::Version().version());
+  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int, std::string, std::string>(
+      "INSERT INTO meta(meta, repo, meta_type, version, expires, meta_file) VALUES (?, ?, ?, ?, ?, NULLIF(?, ''));",
+      SQLBlob(meta_file.empty() ? data : in_file), static_cast<int>(repo), role.ToInt(),
+      Uptane::Version().version(), Uptane::extractExpiryUntrusted(data).ToString(), meta_file);
 
   if (ins_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to add " << role << "metadata: " << db.errmsg();
     return;
   }
 
+  // the validators belong to the previous metadata
+  auto val_statement = db.prepareStatement<int, int>("DELETE FROM meta_validators WHERE (repo=? AND meta_type=?);",
+                                                     static_cast<int>(repo), role.ToInt());
+  if (val_statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear " << role << " metadata validators: " << db.errmsg();
+    return;
+  }
+
   db.commitTransaction();
+  removeUnusedMetaFiles(db);
 }
 
 bool SQLStorage::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const {
@@ -610,8 +787,8 @@ bool SQLStorage::loadNonRoot(std::string* data, Uptane::RepositoryType repo, con
   SQLite3Guard db = dbConnection();
 
   auto statement = db.prepareStatement<int, int>(
-      "SELECT meta FROM meta WHERE (repo=? AND meta_type=?) ORDER BY version DESC LIMIT 1;", static_cast<int>(repo),
-      role.ToInt());
+      "SELECT meta, meta_file FROM meta WHERE (repo=? AND meta_type=?) ORDER BY version DESC LIMIT 1;",
+      static_cast<int>(repo), role.ToInt());
   int result = statement.step();
 
   if (result == SQLITE_DONE) {
@@ -621,14 +798,52 @@ bool SQLStorage::loadNonRoot(std::string* data, Uptane::RepositoryType repo, con
     LOG_ERROR << "Failed to get " << role << " metadata: " << db.errmsg();
     return false;
   }
-  if (data != nullptr) {
-    *data = std::string(reinterpret_cast<const char*>(sqlite3_column_blob(statement.get(), 0)));
+  return loadMeta(statement, 0, 1, data);
+}
+
+bool SQLStorage::loadMetaExpiry(Uptane::RepositoryType repo, const Uptane::Role role, TimeStamp* expiry) const {
+  SQLite3Guard db = dbConnection();
+
+  // the latest version, for Root
+  auto statement = db.prepareStatement<int, int>(
+      "SELECT expires, meta, meta_file FROM meta WHERE (repo=? AND meta_type=?) ORDER BY version DESC LIMIT 1;",
+      static_cast<int>(repo), role.ToInt());
+
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    LOG_TRACE << role << " metadata not found in database";
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get " << role << " metadata expiry: " << db.errmsg();
+    return false;
   }
 
+  TimeStamp res;
+  auto expires = statement.get_result_col_str(0);
+  if (!!expires && !expires->empty()) {
+    try {
+      res = TimeStamp(*expires);
+    } catch (const TimeStamp::InvalidTimeStamp&) {
+      LOG_WARNING << "Invalid " << repo << " " << role << " metadata expiry in database: " << *expires;
+    }
+  } else {
+    // stored before the expiry was indexed
+    std::string meta;
+    if (loadMeta(statement, 1, 2, &meta)) {
+      res = Uptane::extractExpiryUntrusted(meta);
+    }
+  }
+  if (!res.IsValid()) {
+    return false;
+  }
+  if (expiry != nullptr) {
+    *expiry = res;
+  }
   return true;
 }
 
 void SQLStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
+  MetadataWrite write(metadataGenerationRef(repo));
   SQLite3Guard db = dbConnection();
 
   auto del_statement =
@@ -637,33 +852,101 @@ void SQLStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
   if (del_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to clear metadata: " << db.errmsg();
   }
+
+  auto val_statement = db.prepareStatement<int>("DELETE FROM meta_validators WHERE repo=?;", static_cast<int>(repo));
+
+  if (val_statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear metadata validators: " << db.errmsg();
+  }
+  removeUnusedMetaFiles(db);
+}
+
+void SQLStorage::storeMetaValidators(Uptane::RepositoryType repo, const Uptane::Role role, const std::string& etag,
+                                     const std::string& last_modified) {
+  SQLite3Guard db = dbConnection();
+
+  if (etag.empty() && last_modified.empty()) {
+    auto statement = db.prepareStatement<int, int>("DELETE FROM meta_validators WHERE (repo=? AND meta_type=?);",
+                                                   static_cast<int>(repo), role.ToInt());
+    if (statement.step() != SQLITE_DONE) {
+      LOG_ERROR << "Failed to clear " << role << " metadata validators: " << db.errmsg();
+      throw SQLException(std::string("Failed to clear metadata validators: ") + db.errmsg());
+    }
+    return;
+  }
+
+  auto statement = db.prepareStatement<int, int, std::string, std::string>(
+      "INSERT OR REPLACE INTO meta_validators(repo, meta_type, etag, last_modified) VALUES (?,?,?,?);",
+      static_cast<int>(repo), role.ToInt(), etag, last_modified);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store " << role << " metadata validators: " << db.errmsg();
+    throw SQLException(std::string("Failed to store metadata validators: ") + db.errmsg());
+  }
+}
+
+bool SQLStorage::loadMetaValidators(Uptane::RepositoryType repo, const Uptane::Role role, std::string* etag,
+                                    std::string* last_modified) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<int, int>(
+      "SELECT etag, last_modified FROM meta_validators WHERE (repo=? AND meta_type=?);", static_cast<int>(repo),
+      role.ToInt());
+
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    LOG_TRACE << role << " metadata validators not found in database";
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get " << role << " metadata validators: " << db.errmsg();
+    return false;
+  }
+
+  if (etag != nullptr) {
+    *etag = statement.get_result_col_str(0).value();
+  }
+  if (last_modified != nullptr) {
+    *last_modified = statement.get_result_col_str(1).value();
+  }
+  return true;
 }
 
 void SQLStorage::clearMetadata() {
+  MetadataWrite director_write(metadataGenerationRef(Uptane::RepositoryType::Director()));
+  MetadataWrite image_write(metadataGenerationRef(Uptane::RepositoryType::Image()));
   SQLite3Guard db = dbConnection();
 
   if (db.exec("DELETE FROM meta;", nullptr, nullptr) != SQLITE_OK) {
     LOG_ERROR << "Failed to clear metadata: " << db.errmsg();
     return;
   }
+  if (db.exec("DELETE FROM meta_validators;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Failed to clear metadata validators: " << db.errmsg();
+    return;
+  }
+  removeUnusedMetaFiles(db);
 }
 
 void SQLStorage::storeDelegation(const std::string& data, const Uptane::Role role) {
+  MetadataWrite write(metadataGenerationRef(Uptane::RepositoryType::Image()));
   SQLite3Guard db = dbConnection();
 
-  auto statement = db.prepareStatement<SQLBlob, std::string>("INSERT OR REPLACE INTO delegations VALUES (?, ?);",
-                                                             SQLBlob(data), role.ToString());
+  const std::string meta_file = storeMetaFile(data);
+  const std::string in_file;
+  auto statement = db.prepareStatement<SQLBlob, std::string, std::string>(
+      "INSERT OR REPLACE INTO delegations(meta, role_name, meta_file) VALUES (?, ?, NULLIF(?, ''));",
+      SQLBlob(meta_file.empty() ? data : in_file), role.ToString(), meta_file);
   if (statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to store delegation metadata: " << db.errmsg();
     return;
   }
+  removeUnusedMetaFiles(db);
 }
 
 bool SQLStorage::loadDelegation(std::string* data, const Uptane::Role role) const {
   SQLite3Guard db = dbConnection();
 
-  auto statement =
-      db.prepareStatement<std::string>("SELECT meta FROM delegations WHERE role_name=? LIMIT 1;", role.ToString());
+  auto statement = db.prepareStatement<std::string>(
+      "SELECT meta, meta_file FROM delegations WHERE role_name=? LIMIT 1;", role.ToString());
   int result = statement.step();
 
   if (result == SQLITE_DONE) {
@@ -673,11 +956,7 @@ bool SQLStorage::loadDelegation(std::string* data, const Uptane::Role role) cons
     LOG_ERROR << "Failed to get delegations metadata: " << db.errmsg();
     return false;
   }
-  if (data != nullptr) {
-    *data = std::string(reinterpret_cast<const char*>(sqlite3_column_blob(statement.get(), 0)));
-  }
-
-  return true;
+  return loadMeta(statement, 0, 1, data);
 }
 
 bool SQLStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const {
@@ -686,7 +965,7 @@ bool SQLStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::str
   try {
     SQLite3Guard db = dbConnection();
 
-    auto statement = db.prepareStatement("SELECT meta, role_name FROM delegations;");
+    auto statement = db.prepareStatement("SELECT meta, role_name, meta_file FROM delegations;");
     auto statement_state = statement.step();
 
     if (statement_state == SQLITE_DONE) {
@@ -698,8 +977,11 @@ bool SQLStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::str
     }
 
     do {
-      data.emplace_back(Uptane::Role::Delegation(statement.get_result_col_str(1).value()),
-                        statement.get_result_col_blob(0).value());
+      std::string meta;
+      if (!loadMeta(statement, 0, 2, &meta)) {
+        return false;
+      }
+      data.emplace_back(Uptane::Role::Delegation(statement.get_result_col_str(1).value()), std::move(meta));
     } while ((statement_state = statement.step()) == SQLITE_ROW);
 
     if (statement_state != SQLITE_DONE) {
@@ -716,18 +998,22 @@ bool SQLStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::str
 }
 
 void SQLStorage::deleteDelegation(const Uptane::Role role) {
+  MetadataWrite write(metadataGenerationRef(Uptane::RepositoryType::Image()));
   SQLite3Guard db = dbConnection();
 
   auto statement = db.prepareStatement<std::string>("DELETE FROM delegations WHERE role_name=?;", role.ToString());
   statement.step();
+  removeUnusedMetaFiles(db);
 }
 
 void SQLStorage::clearDelegations() {
+  MetadataWrite write(metadataGenerationRef(Uptane::RepositoryType::Image()));
   SQLite3Guard db = dbConnection();
 
   if (db.exec("DELETE FROM delegations;", nullptr, nullptr) != SQLITE_OK) {
     LOG_ERROR << "Failed to clear delegations metadata: " << db.errmsg();
   }
+  removeUnusedMetaFiles(db);
 }
 
 void SQLStorage::storeDeviceId(const std::string& device_id) {
@@ -1054,6 +1340,27 @@ void SQLStorage::clearMisconfiguredEcus() {
   }
 }
 
+// Remove the oldest entries of the installation log of an ECU beyond the
+// retention, except the current and pending versions. Only a few of them are
+// removed at a time, so that a long log left by an older version is shortened
+// over the next updates instead of all at once.
+// at most this many entries are removed on each update
+static constexpr int64_t kInstalledVersionsPruneRows{16};
+
+static void pruneInstalledVersions(SQLite3Guard& db, const std::string& ecu_serial, uint64_t retention) {
+  if (retention == 0) {
+    return;
+  }
+  auto statement = db.prepareStatement<std::string, int64_t, int64_t>(
+      "DELETE FROM installed_versions WHERE id IN (SELECT id FROM installed_versions WHERE ecu_serial = ?1 AND "
+      "is_current = 0 AND is_pending = 0 AND id < (SELECT id FROM installed_versions WHERE ecu_serial = ?1 ORDER BY "
+      "id DESC LIMIT 1 OFFSET ?2) ORDER BY id LIMIT ?3);",
+      ecu_serial, static_cast<int64_t>(retention - 1), kInstalledVersionsPruneRows);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_WARNING << "Failed to prune installed versions: " << db.errmsg();
+  }
+}
+
 void SQLStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptane::Target& target,
                                       InstalledVersionUpdateMode update_mode,
                                       const Uptane::CorrelationId& correlation_id) {
@@ -1101,7 +1408,9 @@ void SQLStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptan
   if (update_mode == InstalledVersionUpdateMode::kCurrent) {
     // unset 'current' and 'pending' on all versions for this ecu
     auto statement = db.prepareStatement<std::string>(
-        "UPDATE installed_versions SET is_current = 0, is_pending = 0 WHERE ecu_serial = ?", ecu_serial_real);
+        "UPDATE installed_versions SET is_current = 0, is_pending = 0 WHERE ecu_serial = ? AND (is_current = 1 OR "
+        "is_pending = 1);",
+        ecu_serial_real);
     if (statement.step() != SQLITE_DONE) {
       LOG_ERROR << "Failed to save installed versions: " << db.errmsg();
       return;
@@ -1109,7 +1418,7 @@ void SQLStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptan
   } else if (update_mode == InstalledVersionUpdateMode::kPending) {
     // unset 'pending' on all versions for this ecu
     auto statement = db.prepareStatement<std::string>(
-        "UPDATE installed_versions SET is_pending = 0 WHERE ecu_serial = ?", ecu_serial_real);
+        "UPDATE installed_versions SET is_pending = 0 WHERE ecu_serial = ? AND is_pending = 1;", ecu_serial_real);
     if (statement.step() != SQLITE_DONE) {
       LOG_ERROR << "Failed to save installed versions: " << db.errmsg();
       return;
@@ -1145,6 +1454,8 @@ void SQLStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptan
     }
   }
 
+  pruneInstalledVersions(db, ecu_serial_real, config_.installed_versions_retention);
+
   db.commitTransaction();
 }
 
@@ -1254,6 +1565,39 @@ bool SQLStorage::loadInstallationLog(const std::string& ecu_serial, std::vector<
   return true;
 }
 
+// Expects the columns sha256, name, hashes, length, correlation_id, custom_meta
+static Uptane::Target readInstalledTarget(SQLiteStatement& statement, const Uptane::EcuMap& ecu_map) {
+  auto sha256 = statement.get_result_col_str(0).value();
+  auto filename = statement.get_result_col_str(1).value();
+  auto hashes_str = statement.get_result_col_str(2).value();
+  auto length = statement.get_result_col_int(3);
+  auto custom_str = statement.get_result_col_str(5).value();
+
+  // note: sha256 should always be present and is used to uniquely identify
+  // a version. It should normally be part of the hash list as well.
+  std::vector<Hash> hashes = Hash::decodeVector(hashes_str);
+
+  auto find_sha256 =
+      std::find_if(hashes.cbegin(), hashes.cend(), [](const Hash& h) { return h.type() == Hash::Type::kSha256; });
+  if (find_sha256 == hashes.cend()) {
+    LOG_WARNING << "No sha256 in hashes list";
+    hashes.emplace_back(Hash::Type::kSha256, sha256);
+  }
+  Uptane::Target t(filename, ecu_map, hashes, static_cast<uint64_t>(length));
+  if (!custom_str.empty()) {
+    std::istringstream css(custom_str);
+    Json::Value custom;
+    std::string errs;
+    if (Json::parseFromStream(Json::CharReaderBuilder(), css, &custom, &errs)) {
+      t.updateCustom(custom);
+    } else {
+      LOG_ERROR << "Unable to parse custom data: " << errs;
+    }
+  }
+
+  return t;
+}
+
 bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::optional<Uptane::Target>* current_version,
                                        boost::optional<Uptane::Target>* pending_version,
                                        Uptane::CorrelationId* correlation_id) const {
@@ -1263,38 +1607,6 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
   Uptane::EcuMap ecu_map;
   loadEcuMap(db, ecu_serial_real, ecu_map);
 
-  auto read_target = [&ecu_map](SQLiteStatement& statement) -> Uptane::Target {
-    auto sha256 = statement.get_result_col_str(0).value();
-    auto filename = statement.get_result_col_str(1).value();
-    auto hashes_str = statement.get_result_col_str(2).value();
-    auto length = statement.get_result_col_int(3);
-    auto custom_str = statement.get_result_col_str(5).value();
-
-    // note: sha256 should always be present and is used to uniquely identify
-    // a version. It should normally be part of the hash list as well.
-    std::vector<Hash> hashes = Hash::decodeVector(hashes_str);
-
-    auto find_sha256 =
-        std::find_if(hashes.cbegin(), hashes.cend(), [](const Hash& h) { return h.type() == Hash::Type::kSha256; });
-    if (find_sha256 == hashes.cend()) {
-      LOG_WARNING << "No sha256 in hashes list";
-      hashes.emplace_back(Hash::Type::kSha256, sha256);
-    }
-    Uptane::Target t(filename, ecu_map, hashes, static_cast<uint64_t>(length));
-    if (!custom_str.empty()) {
-      std::istringstream css(custom_str);
-      Json::Value custom;
-      std::string errs;
-      if (Json::parseFromStream(Json::CharReaderBuilder(), css, &custom, &errs)) {
-        t.updateCustom(custom);
-      } else {
-        LOG_ERROR << "Unable to parse custom data: " << errs;
-      }
-    }
-
-    return t;
-  };
-
   if (current_version != nullptr) {
     auto statement = db.prepareStatement<std::string>(
         "SELECT sha256, name, hashes, length, correlation_id, custom_meta FROM installed_versions WHERE "
@@ -1303,7 +1615,7 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
 
     if (statement.step() == SQLITE_ROW) {
       try {
-        *current_version = read_target(statement);
+        *current_version = readInstalledTarget(statement, ecu_map);
         if (correlation_id != nullptr) {
           *correlation_id = statement.get_result_col_str(4).value();
         }
@@ -1325,7 +1637,7 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
 
     if (statement.step() == SQLITE_ROW) {
       try {
-        *pending_version = read_target(statement);
+        *pending_version = readInstalledTarget(statement, ecu_map);
         if (correlation_id != nullptr) {
           *correlation_id = statement.get_result_col_str(4).value();
         }
@@ -1342,6 +1654,42 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
   return true;
 }
 
+bool SQLStorage::loadInstalledVersionByHash(const std::string& ecu_serial, const std::string& sha256,
+                                            boost::optional<Uptane::Target>* version) const {
+  SQLite3Guard db = dbConnection();
+
+  std::string ecu_serial_real = ecu_serial;
+  Uptane::EcuMap ecu_map;
+  loadEcuMap(db, ecu_serial_real, ecu_map);
+
+  auto statement = db.prepareStatement<std::string, std::string>(
+      "SELECT sha256, name, hashes, length, correlation_id, custom_meta FROM installed_versions WHERE "
+      "ecu_serial = ? AND sha256 = ? ORDER BY id DESC LIMIT 1;",
+      ecu_serial_real, sha256);
+
+  const int result = statement.step();
+  if (result == SQLITE_DONE) {
+    if (version != nullptr) {
+      *version = boost::none;
+    }
+    return true;
+  }
+  if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get installed version: " << db.errmsg();
+    return false;
+  }
+  try {
+    auto target = readInstalledTarget(statement, ecu_map);
+    if (version != nullptr) {
+      *version = std::move(target);
+    }
+  } catch (const boost::bad_optional_access&) {
+    LOG_ERROR << "Could not read installed version";
+    return false;
+  }
+  return true;
+}
+
 bool SQLStorage::hasPendingInstall() {
   SQLite3Guard db = dbConnection();
 
@@ -1612,6 +1960,39 @@ bool SQLStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, in
   return true;
 }
 
+bool SQLStorage::loadReportEventsRaw(std::vector<std::string>* events, int64_t* id_max, int limit,
+                                     size_t max_size) const {
+  SQLite3Guard db = dbConnection();
+  auto statement = db.prepareStatement<int>("SELECT id, json_string FROM report_events LIMIT ?;", limit);
+  int statement_result = statement.step();
+  if (statement_result != SQLITE_DONE && statement_result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get report events: " << db.errmsg();
+    return false;
+  }
+  if (statement_result == SQLITE_DONE) {
+    // if there are not any records in the DB
+    return false;
+  }
+  *id_max = 0;
+  size_t size = 0;
+  for (; statement_result != SQLITE_DONE; statement_result = statement.step()) {
+    try {
+      const int64_t id = statement.get_result_col_int(0);
+      std::string json_string = statement.get_result_col_str(1).value();
+      if (!events->empty() && size + json_string.size() > max_size) {
+        break;
+      }
+      size += json_string.size();
+      events->push_back(std::move(json_string));
+      *id_max = (*id_max) > id ? (*id_max) : id;
+    } catch (const boost::bad_optional_access&) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 void SQLStorage::deleteReportEvents(int64_t id_max) {
   SQLite3Guard db = dbConnection();
 
@@ -1683,6 +2064,9 @@ void SQLStorage::clearDeviceData() {
 
 void SQLStorage::storeTargetFilename(const std::string& targetname, const std::string& filename) const {
   SQLite3Guard db = dbConnection();
+
+  db.beginTransaction();
+
   auto statement = db.prepareStatement<std::string, std::string>(
       "INSERT OR REPLACE INTO target_images (targetname, filename) VALUES (?, ?);", targetname, filename);
 
@@ -1690,6 +2074,25 @@ void SQLStorage::storeTargetFilename(const std::string& targetname, const std::s
     LOG_ERROR << "Failed to store Target filename: " << db.errmsg();
     throw SQLException(std::string("Failed to store Target filename: ") + db.errmsg());
   }
+
+  // the file is written from scratch, previous hasher state does not apply
+  auto statement_state =
+      db.prepareStatement<std::string>("DELETE FROM target_hash_states WHERE targetname=?;", targetname);
+
+  if (statement_state.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear Target hash state: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear Target hash state: ") + db.errmsg());
+  }
+
+  auto statement_verified =
+      db.prepareStatement<std::string>("DELETE FROM verified_targets WHERE filename=?;", filename);
+
+  if (statement_verified.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear verified Target file: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear verified Target file: ") + db.errmsg());
+  }
+
+  db.commitTransaction();
 }
 
 std::string SQLStorage::getTargetFilename(const std::string& targetname) const {
@@ -1727,13 +2130,459 @@ std::vector<std::string> SQLStorage::getAllTargetNames() const {
   return names;
 }
 
+void SQLStorage::linkTargetFilename(const std::string& targetname, const std::string& filename) const {
+  SQLite3Guard db = dbConnection();
+
+  db.beginTransaction();
+
+  auto statement = db.prepareStatement<std::string, std::string>(
+      "INSERT OR REPLACE INTO target_images (targetname, filename) VALUES (?, ?);", targetname, filename);
+
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to link Target filename: " << db.errmsg();
+    throw SQLException(std::string("Failed to link Target filename: ") + db.errmsg());
+  }
+
+  // progress of an earlier download of this Target doesn't apply to the file
+  auto statement_segments =
+      db.prepareStatement<std::string>("DELETE FROM target_segments WHERE targetname=?;", targetname);
+
+  if (statement_segments.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear Target download segments: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear Target download segments: ") + db.errmsg());
+  }
+
+  auto statement_state =
+      db.prepareStatement<std::string>("DELETE FROM target_hash_states WHERE targetname=?;", targetname);
+
+  if (statement_state.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear Target hash state: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear Target hash state: ") + db.errmsg());
+  }
+
+  db.commitTransaction();
+}
+
+std::vector<std::string> SQLStorage::getTargetNamesForFile(const std::string& filename) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement =
+      db.prepareStatement<std::string>("SELECT targetname FROM target_images WHERE filename = ?;", filename);
+
+  std::vector<std::string> names;
+
+  int result = statement.step();
+  while (result != SQLITE_DONE) {
+    if (result != SQLITE_ROW) {
+      LOG_ERROR << "Failed to get Target names of a file: " << db.errmsg();
+      throw SQLException(std::string("Failed to get Target names of a file: ") + db.errmsg());
+    }
+    names.push_back(statement.get_result_col_str(0).value());
+    result = statement.step();
+  }
+  return names;
+}
+
 void SQLStorage::deleteTargetInfo(const std::string& targetname) const {
   SQLite3Guard db = dbConnection();
 
+  db.beginTransaction();
+
+  // the file stays verified as long as another Target refers to it
+  auto statement_verified = db.prepareStatement<std::string, std::string>(
+      "DELETE FROM verified_targets WHERE filename IN (SELECT filename FROM target_images WHERE targetname=?) AND "
+      "filename NOT IN (SELECT filename FROM target_images WHERE targetname<>?);",
+      targetname, targetname);
+
+  if (statement_verified.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear verified Target file: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear verified Target file: ") + db.errmsg());
+  }
+
   auto statement = db.prepareStatement<std::string>("DELETE FROM target_images WHERE targetname=?;", targetname);
 
   if (statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to clear Target filenames: " << db.errmsg();
     throw SQLException(std::string("Failed to clear Target filenames: ") + db.errmsg());
   }
+
+  auto statement_segments =
+      db.prepareStatement<std::string>("DELETE FROM target_segments WHERE targetname=?;", targetname);
+
+  if (statement_segments.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear Target download segments: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear Target download segments: ") + db.errmsg());
+  }
+
+  auto statement_state =
+      db.prepareStatement<std::string>("DELETE FROM target_hash_states WHERE targetname=?;", targetname);
+
+  if (statement_state.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear Target hash state: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear Target hash state: ") + db.errmsg());
+  }
+
+  db.commitTransaction();
+}
+
+void SQLStorage::storeDownloadSegments(const std::string& targetname,
+                                       const std::vector<DownloadSegment>& segments) const {
+  SQLite3Guard db = dbConnection();
+
+  db.beginTransaction();
+
+  auto statement_clear =
+      db.prepareStatement<std::string>("DELETE FROM target_segments WHERE targetname=?;", targetname);
+  if (statement_clear.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear Target download segments: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear Target download segments: ") + db.errmsg());
+  }
+
+  for (size_t i = 0; i < segments.size(); i++) {
+    const auto& segment = segments[i];
+    auto statement = db.prepareStatement<std::string, int64_t, int64_t, int64_t, int64_t>(
+        "INSERT INTO target_segments(targetname, segment, range_start, range_length, downloaded) VALUES "
+        "(?,?,?,?,?);",
+        targetname, static_cast<int64_t>(i), static_cast<int64_t>(segment.start), static_cast<int64_t>(segment.length),
+        static_cast<int64_t>(segment.downloaded));
+    if (statement.step() != SQLITE_DONE) {
+      LOG_ERROR << "Failed to store Target download segments: " << db.errmsg();
+      throw SQLException(std::string("Failed to store Target download segments: ") + db.errmsg());
+    }
+  }
+
+  db.commitTransaction();
+}
+
+bool SQLStorage::loadDownloadSegments(const std::string& targetname, std::vector<DownloadSegment>* segments) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<std::string>(
+      "SELECT range_start, range_length, downloaded FROM target_segments WHERE targetname = ? ORDER BY segment;",
+      targetname);
+
+  std::vector<DownloadSegment> loaded;
+  int result = statement.step();
+  while (result != SQLITE_DONE) {
+    if (result != SQLITE_ROW) {
+      LOG_ERROR << "Failed to get Target download segments: " << db.errmsg();
+      return false;
+    }
+    loaded.emplace_back(static_cast<uint64_t>(statement.get_result_col_int(0)),
+                        static_cast<uint64_t>(statement.get_result_col_int(1)),
+                        static_cast<uint64_t>(statement.get_result_col_int(2)));
+    result = statement.step();
+  }
+
+  if (loaded.empty()) {
+    return false;
+  }
+  if (segments != nullptr) {
+    *segments = std::move(loaded);
+  }
+  return true;
+}
+
+void SQLStorage::updateDownloadSegment(const std::string& targetname, size_t segment, uint64_t downloaded) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<int64_t, std::string, int64_t>(
+      "UPDATE target_segments SET downloaded = ? WHERE targetname = ? AND segment = ?;",
+      static_cast<int64_t>(downloaded), targetname, static_cast<int64_t>(segment));
+  if (statement.step() != SQLITE_DONE || sqlite3_changes(db.get()) != 1) {
+    LOG_ERROR << "Failed to update Target download segment: " << db.errmsg();
+    throw SQLException(std::string("Failed to update Target download segment: ") + db.errmsg());
+  }
+}
+
+void SQLStorage::clearDownloadSegments(const std::string& targetname) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<std::string>("DELETE FROM target_segments WHERE targetname=?;", targetname);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear Target download segments: " << db.errmsg();
+    throw SQLException(std::string("Failed to clear Target download segments: ") + db.errmsg());
+  }
+}
+
+void SQLStorage::storeTargetHashState(const std::string& targetname, uint64_t hashed_length,
+                                      const std::string& state) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<std::string, int64_t, SQLBlob>(
+      "INSERT OR REPLACE INTO target_hash_states(targetname, hashed_length, hash_state) VALUES (?,?,?);", targetname,
+      static_cast<int64_t>(hashed_length), SQLBlob(state));
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store Target hash state: " << db.errmsg();
+    throw SQLException(std::string("Failed to store Target hash state: ") + db.errmsg());
+  }
+}
+
+bool SQLStorage::loadTargetHashState(const std::string& targetname, uint64_t* hashed_length,
+                                     std::string* state) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<std::string>(
+      "SELECT hashed_length, hash_state FROM target_hash_states WHERE targetname = ?;", targetname);
+
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    LOG_TRACE << "No hash state for Target " << targetname;
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get Target hash state: " << db.errmsg();
+    return false;
+  }
+
+  if (hashed_length != nullptr) {
+    *hashed_length = static_cast<uint64_t>(statement.get_result_col_int(0));
+  }
+  if (state != nullptr) {
+    *state = statement.get_result_col_blob(1).value();
+  }
+  return true;
+}
+
+void SQLStorage::storeVerifiedFile(const std::string& filename, const VerifiedFile& file) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<std::string, int64_t, int64_t, int64_t, std::string>(
+      "INSERT OR REPLACE INTO verified_targets(filename, size, mtime, inode, hashes) VALUES (?,?,?,?,?);", filename,
+      static_cast<int64_t>(file.size), file.mtime_ns, static_cast<int64_t>(file.inode), file.hashes);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store verified Target file: " << db.errmsg();
+    throw SQLException(std::string("Failed to store verified Target file: ") + db.errmsg());
+  }
+}
+
+bool SQLStorage::loadVerifiedFile(const std::string& filename, VerifiedFile* file) const {
+  SQLite3Guard db = dbConnection();
+
+  auto statement = db.prepareStatement<std::string>(
+      "SELECT size, mtime, inode, hashes FROM verified_targets WHERE filename = ?;", filename);
+
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    LOG_TRACE << "Target file " << filename << " not verified yet";
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get verified Target file: " << db.errmsg();
+    return false;
+  }
+
+  if (file != nullptr) {
+    file->size = static_cast<uint64_t>(statement.get_result_col_int(0));
+    file->mtime_ns = statement.get_result_col_int(1);
+    file->inode = static_cast<uint64_t>(statement.get_result_col_int(2));
+    file->hashes = statement.get_result_col_str(3).value();
+  }
+  return true;
+}
+
+// Keeps a connection, and with it the storage mutex, for the whole transaction.
+// The transactions of the storage methods called meanwhile become savepoints.
+class SQLStorageBatch : public StorageBatch {
+ public:
+  explicit SQLStorageBatch(SQLite3Guard db) : db_(std::move(db)) { db_.beginTransaction(); }
+  void commit() override { db_.commitTransaction(); }
+
+ private:
+  SQLite3Guard db_;
+};
+
+std::unique_ptr<StorageBatch> SQLStorage::beginBatch() {
+  return std_::make_unique<SQLStorageBatch>(dbConnection());
+}
+
+void SQLStorage::loadSnapshot(StorageSnapshot* snapshot) const {
+  SQLite3Guard db = dbConnection();
+  StorageSnapshot result;
+
+  // one read transaction, so that aktualizr can't change the state in between
+  db.beginTransaction();
+
+  auto statement_device = db.prepareStatement("SELECT device_id, is_registered FROM device_info LIMIT 1;");
+  int state = statement_device.step();
+  if (state == SQLITE_ROW) {
+    result.device_id = statement_device.get_result_col_str(0).value_or("");
+    result.ecu_registered = statement_device.get_result_col_int(1) != 0;
+  } else if (state != SQLITE_DONE) {
+    throw SQLException(db.errmsg().insert(0, "Failed to get device info: "));
+  }
+
+  auto statement_root =
+      db.prepareStatement<int>("SELECT EXISTS(SELECT 1 FROM meta WHERE meta_type = ?);", Uptane::Role::Root().ToInt());
+  if (statement_root.step() != SQLITE_ROW) {
+    throw SQLException(db.errmsg().insert(0, "Failed to check Root metadata: "));
+  }
+  result.has_root_metadata = statement_root.get_result_col_int(0) != 0;
+
+  // order by auto-incremented Primary key, like loadEcuSerials()
+  auto statement_ecus = db.prepareStatement("SELECT serial, hardware_id FROM ecus ORDER BY id;");
+  std::map<std::string, Uptane::HardwareIdentifier> hardware_ids;
+  while ((state = statement_ecus.step()) == SQLITE_ROW) {
+    result.serials.emplace_back(Uptane::EcuSerial(statement_ecus.get_result_col_str(0).value()),
+                                Uptane::HardwareIdentifier(statement_ecus.get_result_col_str(1).value()));
+    hardware_ids.emplace(result.serials.back().first.ToString(), result.serials.back().second);
+  }
+  if (state != SQLITE_DONE) {
+    throw SQLException(db.errmsg().insert(0, "Failed to get ECU serials: "));
+  }
+
+  // current versions first, so that correlation ids of pending ones win
+  auto statement_versions = db.prepareStatement(
+      "SELECT sha256, name, hashes, length, correlation_id, custom_meta, ecu_serial, is_pending FROM "
+      "installed_versions WHERE is_current = 1 OR is_pending = 1 ORDER BY is_pending;");
+  while ((state = statement_versions.step()) == SQLITE_ROW) {
+    const std::string serial = statement_versions.get_result_col_str(6).value();
+    Uptane::EcuMap ecu_map;
+    const auto hardware_id = hardware_ids.find(serial);
+    if (hardware_id != hardware_ids.end()) {
+      ecu_map.emplace(Uptane::EcuSerial(serial), hardware_id->second);
+    }
+    auto& versions = result.versions[Uptane::EcuSerial(serial)];
+    if (statement_versions.get_result_col_int(7) != 0) {
+      versions.pending = readInstalledTarget(statement_versions, ecu_map);
+    } else {
+      versions.current = readInstalledTarget(statement_versions, ecu_map);
+    }
+    versions.correlation_id = statement_versions.get_result_col_str(4).value();
+  }
+  if (state != SQLITE_DONE) {
+    throw SQLException(db.errmsg().insert(0, "Failed to get installed versions: "));
+  }
+
+  auto statement_misconfigured = db.prepareStatement("SELECT serial, hardware_id, state FROM misconfigured_ecus;");
+  while ((state = statement_misconfigured.step()) == SQLITE_ROW) {
+    Uptane::EcuSerial serial(statement_misconfigured.get_result_col_str(0).value());
+    Uptane::HardwareIdentifier hardware_id(statement_misconfigured.get_result_col_str(1).value());
+    result.misconfigured_ecus.emplace_back(std::move(serial), std::move(hardware_id),
+                                           static_cast<EcuState>(statement_misconfigured.get_result_col_int(2)));
+  }
+  if (state != SQLITE_DONE) {
+    throw SQLException(db.errmsg().insert(0, "Failed to get misconfigured ECUs: "));
+  }
+
+  db.commitTransaction();
+  *snapshot = std::move(result);
+}
+
+namespace {
+// virtual machine instructions between two checks of the maintenance deadline
+constexpr int kMaintenanceProgressOps{1000};
+// pages given back to the file system at once by the incremental vacuum
+constexpr int kMaintenanceVacuumPages{64};
+
+int interruptAfterDeadline(void* deadline) {
+  return std::chrono::steady_clock::now() >= *static_cast<std::chrono::steady_clock::time_point*>(deadline) ? 1 : 0;
+}
+
+int64_t pragmaValue(SQLite3Guard& db, const std::string& pragma) {
+  auto statement = db.prepareStatement("PRAGMA " + pragma + ";");
+  if (statement.step() != SQLITE_ROW) {
+    throw SQLException("Can't read " + pragma + ": " + db.errmsg());
+  }
+  return statement.get_result_col_int(0);
+}
+
+uint64_t fileSize(const boost::filesystem::path& path) {
+  boost::system::error_code ec;
+  const auto size = boost::filesystem::file_size(path, ec);
+  return ec ? 0 : static_cast<uint64_t>(size);
+}
+}  // namespace
+
+// A step interrupted when the budget ran out is rolled back, and the next
+// maintenance starts over with it.
+StorageMaintenance SQLStorage::maintain(std::chrono::milliseconds budget, bool integrity_check) {
+  StorageMaintenance report;
+  if (readonly_) {
+    return report;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  auto deadline = start + budget;
+  const boost::filesystem::path wal_path = dbPath().string() + "-wal";
+
+  SQLite3Guard db = dbConnection();
+  // VACUUM and checkpoints can't run within a transaction
+  if (sqlite3_get_autocommit(db.get()) == 0) {
+    LOG_DEBUG << "Storage maintenance skipped, a batch is open";
+    return report;
+  }
+  const uint64_t size_before = fileSize(dbPath()) + fileSize(wal_path);
+
+  // interrupted by SQLite once the deadline is passed
+  auto step = [&db, &deadline](const std::string& sql) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    sqlite3_progress_handler(db.get(), kMaintenanceProgressOps, interruptAfterDeadline, &deadline);
+    const int rc = db.exec(sql, nullptr, nullptr);
+    sqlite3_progress_handler(db.get(), 0, nullptr, nullptr);
+    if (rc == SQLITE_INTERRUPT) {
+      return false;
+    }
+    if (rc != SQLITE_OK) {
+      throw SQLException("Can't run " + sql + " " + db.errmsg());
+    }
+    return true;
+  };
+  auto quick_check = [&db, &deadline](std::string* result) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    sqlite3_progress_handler(db.get(), kMaintenanceProgressOps, interruptAfterDeadline, &deadline);
+    auto statement = db.prepareStatement("PRAGMA quick_check;");
+    const int rc = statement.step();
+    sqlite3_progress_handler(db.get(), 0, nullptr, nullptr);
+    if (rc != SQLITE_ROW) {
+      return false;
+    }
+    *result = statement.get_result_col_str(0).value_or("");
+    return true;
+  };
+
+  bool complete = true;
+  try {
+    if (pragmaValue(db, "freelist_count") > 0) {
+      if (pragmaValue(db, "auto_vacuum") != 2) {
+        // databases created before incremental vacuuming need a full one first
+        complete = step("PRAGMA auto_vacuum=INCREMENTAL; VACUUM;");
+      }
+      for (int64_t free_pages = pragmaValue(db, "freelist_count"); complete && free_pages > 0;) {
+        complete = step("PRAGMA incremental_vacuum(" + std::to_string(kMaintenanceVacuumPages) + ");");
+        const int64_t left = pragmaValue(db, "freelist_count");
+        if (left >= free_pages) {
+          break;
+        }
+        free_pages = left;
+      }
+    }
+    // refreshes the statistics of the tables that need it
+    complete = complete && step("PRAGMA optimize;");
+    if (wal_) {
+      complete = complete && step("PRAGMA wal_checkpoint(TRUNCATE);");
+    }
+    if (integrity_check) {
+      std::string result;
+      complete = complete && quick_check(&result);
+      if (complete) {
+        report.integrity_ok = result == "ok";
+        if (!*report.integrity_ok) {
+          LOG_ERROR << "The database failed the integrity check: " << result;
+        }
+      }
+    }
+  } catch (const SQLException& e) {
+    LOG_WARNING << "Storage maintenance failed: " << e.what();
+    complete = false;
+  }
+
+  const uint64_t size_after = fileSize(dbPath()) + fileSize(wal_path);
+  report.bytes_reclaimed = size_before > size_after ? size_before - size_after : 0;
+  report.complete = complete;
+  report.duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  LOG_INFO << "Storage maintenance " << (complete ? "done" : "stopped") << ", reclaimed " << report.bytes_reclaimed
+           << " bytes in " << report.duration.count() << " ms";
+  return report;
 }
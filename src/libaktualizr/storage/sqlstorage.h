@@ -1,6 +1,9 @@
 #ifndef SQLSTORAGE_H_
 #define SQLSTORAGE_H_
 
+#include <array>
+#include <atomic>
+
 #include <boost/optional.hpp>
 
 #include <sqlite3.h>
@@ -12,6 +15,7 @@ extern const std::vector<std::string> libaktualizr_schema_migrations;
 extern const std::vector<std::string> libaktualizr_schema_rollback_migrations;
 extern const std::string libaktualizr_current_schema;
 extern const int libaktualizr_current_schema_version;
+extern const std::vector<BackgroundMigration> libaktualizr_background_migrations;
 
 class SQLTargetRHandle;
 class SQLStorage : public SQLStorageBase, public INvStorage {
@@ -51,6 +55,11 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
   void storeNonRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Role role) override;
   bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const override;
   void clearNonRootMeta(Uptane::RepositoryType repo) override;
+  bool loadMetaExpiry(Uptane::RepositoryType repo, Uptane::Role role, TimeStamp* expiry) const override;
+  void storeMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, const std::string& etag,
+                           const std::string& last_modified) override;
+  bool loadMetaValidators(Uptane::RepositoryType repo, Uptane::Role role, std::string* etag,
+                          std::string* last_modified) const override;
   void clearMetadata() override;
   void storeDelegation(const std::string& data, Uptane::Role role) override;
   bool loadDelegation(std::string* data, Uptane::Role role) const override;
@@ -83,6 +92,8 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
                              Uptane::CorrelationId* correlation_id) const override;
   bool loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
                            bool only_installed) const override;
+  bool loadInstalledVersionByHash(const std::string& ecu_serial, const std::string& sha256,
+                                  boost::optional<Uptane::Target>* version) const override;
   bool hasPendingInstall() override;
   void getPendingEcus(std::vector<std::pair<Uptane::EcuSerial, Hash>>* pendingEcus) override;
   void clearInstalledVersions() override;
@@ -99,6 +110,8 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
   bool loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const override;
   void saveReportEvent(const Json::Value& json_value) override;
   bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const override;
+  bool loadReportEventsRaw(std::vector<std::string>* events, int64_t* id_max, int limit,
+                           size_t max_size) const override;
   void deleteReportEvents(int64_t id_max) override;
   void clearInstallationResults() override;
 
@@ -109,12 +122,56 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
   void storeTargetFilename(const std::string& targetname, const std::string& filename) const override;
   std::string getTargetFilename(const std::string& targetname) const override;
   std::vector<std::string> getAllTargetNames() const override;
+  void linkTargetFilename(const std::string& targetname, const std::string& filename) const override;
+  std::vector<std::string> getTargetNamesForFile(const std::string& filename) const override;
   void deleteTargetInfo(const std::string& targetname) const override;
+  void storeDownloadSegments(const std::string& targetname,
+                             const std::vector<DownloadSegment>& segments) const override;
+  bool loadDownloadSegments(const std::string& targetname, std::vector<DownloadSegment>* segments) const override;
+  void updateDownloadSegment(const std::string& targetname, size_t segment, uint64_t downloaded) const override;
+  void clearDownloadSegments(const std::string& targetname) const override;
+  void storeTargetHashState(const std::string& targetname, uint64_t hashed_length,
+                            const std::string& state) const override;
+  bool loadTargetHashState(const std::string& targetname, uint64_t* hashed_length, std::string* state) const override;
+  void storeVerifiedFile(const std::string& filename, const VerifiedFile& file) const override;
+  bool loadVerifiedFile(const std::string& filename, VerifiedFile* file) const override;
+
+  std::unique_ptr<StorageBatch> beginBatch() override;
+  void loadSnapshot(StorageSnapshot* snapshot) const override;
+  uint64_t metadataGeneration(Uptane::RepositoryType repo) const override {
+    return metadata_generations_.at(static_cast<size_t>(static_cast<int>(repo))).load();
+  }
+  StorageMaintenance maintain(std::chrono::milliseconds budget, bool integrity_check) override;
 
   StorageType type() override { return StorageType::kSqlite; };
 
+  // Non-Root and delegated metadata from this size on is kept in a file of
+  // meta_dir_, named after its SHA-256, and the database only refers to it:
+  // replacing a large Targets metadata then doesn't churn the database pages
+  // and its journal.
+  static constexpr size_t kMetaFileThreshold = 64 * 1024;
+
  private:
   void cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Role& role);
+  // Returns the name of the file `data` was written to, or "" if it goes in
+  // the database.
+  std::string storeMetaFile(const std::string& data) const;
+  bool loadMetaFile(const std::string& name, std::string* data) const;
+  // the metadata of the current row, from the database or from its file
+  bool loadMeta(SQLiteStatement& statement, int meta_col, int file_col, std::string* data) const;
+  // Removes the files no row refers to anymore. Not done within a batch, which
+  // may still be rolled back to rows that do.
+  void removeUnusedMetaFiles(SQLite3Guard& db) const;
+
+  std::atomic<uint64_t>& metadataGenerationRef(Uptane::RepositoryType repo) {
+    return metadata_generations_.at(static_cast<size_t>(static_cast<int>(repo)));
+  }
+
+  // by repository, bumped when a write to its metadata is over, whether it
+  // succeeded or not
+  std::array<std::atomic<uint64_t>, 2> metadata_generations_{};
+  // next to the database, e.g. /var/sota/sql.db-meta
+  const boost::filesystem::path meta_dir_;
 };
 
 #endif  // SQLSTORAGE_H_
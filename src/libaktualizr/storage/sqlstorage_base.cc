@@ -33,14 +33,17 @@ StorageLock::~StorageLock() {
 SQLStorageBase::SQLStorageBase(boost::filesystem::path sqldb_path, bool readonly,
                                std::vector<std::string> schema_migrations,
                                std::vector<std::string> schema_rollback_migrations, std::string current_schema,
-                               int current_schema_version)
+                               int current_schema_version, bool wal,
+                               std::vector<BackgroundMigration> background_migrations)
     : sqldb_path_(std::move(sqldb_path)),
       readonly_(readonly),
-      mutex_(new std::mutex()),
+      wal_(wal),
+      mutex_(new std::recursive_mutex()),
       schema_migrations_(std::move(schema_migrations)),
       schema_rollback_migrations_(std::move(schema_rollback_migrations)),
       current_schema_(std::move(current_schema)),
-      current_schema_version_(current_schema_version) {
+      current_schema_version_(current_schema_version),
+      background_migrations_(std::move(background_migrations)) {
   boost::filesystem::path db_parent_path = dbPath().parent_path();
   if (!boost::filesystem::is_directory(db_parent_path)) {
     Utils::createDirectories(db_parent_path, S_IRWXU);
@@ -76,14 +79,83 @@ SQLStorageBase::SQLStorageBase(boost::filesystem::path sqldb_path, bool readonly
   if (!dbMigrate()) {
     throw StorageException("SQLite database migration failed");
   }
+
+  if (!readonly) {
+    for (const auto& migration : background_migrations_) {
+      if (backgroundMigrationPending(migration.name)) {
+        background_thread_ = std::thread(&SQLStorageBase::backgroundMigrationLoop, this);
+        break;
+      }
+    }
+  }
 }
 
+SQLStorageBase::~SQLStorageBase() {
+  if (background_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> guard(background_m_);
+      background_shutdown_ = true;
+    }
+    background_cv_.notify_all();
+    background_thread_.join();
+  }
+}
+
+// The connection is opened once and reused, as opening it costs more than most
+// of the queries, and so are its prepared statements. It is only opened again
+// if the database file was removed or replaced in the meantime.
 SQLite3Guard SQLStorageBase::dbConnection() const {
-  SQLite3Guard db(dbPath(), readonly_, mutex_);
-  if (db.get_rc() != SQLITE_OK) {
-    throw SQLInternalException(std::string("Can't open database: ") + db.errmsg());
+  std::shared_ptr<sqlite3> handle;
+  std::shared_ptr<SQLiteStatementCache> statements;
+  {
+    std::lock_guard<std::recursive_mutex> guard(*mutex_);
+    struct stat st {};
+    const bool exists = stat(dbPath().c_str(), &st) == 0;
+    if (connection_ && (!exists || st.st_dev != connection_dev_ || st.st_ino != connection_ino_)) {
+      statements_.reset();
+      connection_.reset();
+    }
+    if (!connection_) {
+      int rc = SQLITE_OK;
+      auto new_connection = SQLite3Guard::open(dbPath().c_str(), readonly_, &rc);
+      if (rc != SQLITE_OK) {
+        throw SQLInternalException(std::string("Can't open database: ") + sqlite3_errmsg(new_connection.get()));
+      }
+      if (!readonly_) {
+        setJournalMode(new_connection.get());
+      }
+      // SQLite only creates the file on first write
+      if (stat(dbPath().c_str(), &st) == 0) {
+        connection_ = std::move(new_connection);
+        statements_ = std::make_shared<SQLiteStatementCache>(connection_);
+        connection_dev_ = st.st_dev;
+        connection_ino_ = st.st_ino;
+      } else {
+        handle = std::move(new_connection);
+      }
+    }
+    if (!handle) {
+      handle = connection_;
+      statements = statements_;
+    }
+  }
+  return SQLite3Guard(std::move(handle), mutex_, std::move(statements));
+}
+
+// The journal mode is stored in the database file, so it is set both ways.
+// With a write-ahead log, a commit only syncs the log and not the database, so
+// a batch of writes costs a single sync. Readers need write access to the
+// directory of the database for the shared memory index of the log.
+// Incremental vacuuming, which lets SQLStorage::maintain() give the space of
+// removed rows back a little at a time, can only be turned on before the
+// database file is written to, so it comes first; afterwards it only takes
+// effect with the next VACUUM.
+void SQLStorageBase::setJournalMode(sqlite3* db) const {
+  const char* sql = wal_ ? "PRAGMA auto_vacuum=INCREMENTAL; PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;"
+                         : "PRAGMA auto_vacuum=INCREMENTAL; PRAGMA journal_mode=DELETE;";
+  if (sqlite3_exec(db, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+    LOG_WARNING << "Can't set the journal mode of the database: " << sqlite3_errmsg(db);
   }
-  return db;
 }
 
 std::string SQLStorageBase::getTableSchemaFromDb(const std::string& tablename) {
@@ -275,3 +347,97 @@ DbVersion SQLStorageBase::getVersion() {
     return DbVersion::kInvalid;
   }
 }
+
+bool SQLStorageBase::backgroundMigrationPending(const std::string& name) const {
+  SQLite3Guard db = dbConnection();
+
+  try {
+    auto statement = db.prepareStatement<std::string>("SELECT 1 FROM background_migrations WHERE name = ?;", name);
+    return statement.step() == SQLITE_ROW;
+  } catch (const SQLException&) {
+    // an older schema, without background migrations
+    return false;
+  }
+}
+
+bool SQLStorageBase::backgroundMigrationStep(int64_t max_rows) {
+  for (const auto& migration : background_migrations_) {
+    if (!backgroundMigrationPending(migration.name)) {
+      continue;
+    }
+
+    SQLite3Guard db = dbConnection();
+    db.beginTransaction();
+
+    int64_t last_id = 0;
+    {
+      auto statement =
+          db.prepareStatement<std::string>("SELECT last_id FROM background_migrations WHERE name = ?;", migration.name);
+      if (statement.step() != SQLITE_ROW) {
+        throw SQLException("Can't get the progress of background migration " + migration.name + ": " + db.errmsg());
+      }
+      last_id = statement.get_result_col_int(0);
+    }
+
+    int64_t next_id = last_id;
+    {
+      const std::string sql = "SELECT IFNULL(MAX(id), ?1) FROM (SELECT id FROM " + migration.source_table +
+                              " WHERE id > ?1 ORDER BY id LIMIT ?2);";
+      auto statement = db.prepareStatement<int64_t>(sql, last_id, max_rows);
+      if (statement.step() != SQLITE_ROW) {
+        throw SQLException("Can't get the next rows of background migration " + migration.name + ": " + db.errmsg());
+      }
+      next_id = statement.get_result_col_int(0);
+    }
+
+    if (next_id == last_id) {
+      if (db.exec(migration.finish, nullptr, nullptr) != SQLITE_OK) {
+        throw SQLException("Can't finish background migration " + migration.name + ": " + db.errmsg());
+      }
+      auto statement =
+          db.prepareStatement<std::string>("DELETE FROM background_migrations WHERE name = ?;", migration.name);
+      if (statement.step() != SQLITE_DONE) {
+        throw SQLException("Can't finish background migration " + migration.name + ": " + db.errmsg());
+      }
+      db.commitTransaction();
+      LOG_INFO << "Background migration " << migration.name << " finished";
+      return true;
+    }
+
+    {
+      auto statement = db.prepareStatement<int64_t>(migration.copy_step, last_id, next_id);
+      if (statement.step() != SQLITE_DONE) {
+        throw SQLException("Can't copy rows of background migration " + migration.name + ": " + db.errmsg());
+      }
+    }
+    auto statement = db.prepareStatement<int64_t>("UPDATE background_migrations SET last_id = ? WHERE name = ?;",
+                                                  next_id, migration.name);
+    if (statement.step() != SQLITE_DONE) {
+      throw SQLException("Can't save the progress of background migration " + migration.name + ": " + db.errmsg());
+    }
+    db.commitTransaction();
+    LOG_TRACE << "Background migration " << migration.name << " copied rows up to " << next_id;
+    return true;
+  }
+  return false;
+}
+
+void SQLStorageBase::backgroundMigrationLoop() {
+  std::unique_lock<std::mutex> guard(background_m_);
+  std::chrono::milliseconds wait = kBackgroundMigrationDelay;
+  while (!background_cv_.wait_for(guard, wait, [this] { return background_shutdown_; })) {
+    guard.unlock();
+    bool more = false;
+    try {
+      more = backgroundMigrationStep();
+    } catch (const std::exception& e) {
+      // tried again on the next start
+      LOG_ERROR << e.what();
+    }
+    guard.lock();
+    if (!more) {
+      return;
+    }
+    wait = kBackgroundMigrationPause;
+  }
+}
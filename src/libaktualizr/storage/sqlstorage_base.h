@@ -1,6 +1,11 @@
 #ifndef SQLSTORAGE_BASE_H_
 #define SQLSTORAGE_BASE_H_
 
+#include <sys/types.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <boost/filesystem/path.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
@@ -30,11 +35,38 @@ class StorageLock {
   boost::interprocess::file_lock fl_;
 };
 
+/**
+ * Copy of the rows of a large table to a new layout, in small steps that run
+ * in the background once the client is up, instead of in a schema migration.
+ *
+ * The schema migration creates the new table and registers the migration in
+ * `background_migrations`. Until the migration is finished, the data is still
+ * read from and written to the old table, so the schema migration also has to
+ * create triggers that apply the changes of already copied rows to the new
+ * table. Steps are committed one by one, so the migration resumes where it
+ * stopped after a restart.
+ */
+struct BackgroundMigration {
+  std::string name;
+  // table that is copied, with an integer primary key `id`
+  std::string source_table;
+  // single statement copying the rows with ?1 < id <= ?2
+  std::string copy_step;
+  // switch to the new layout, e.g. drop the old table and rename the new one
+  std::string finish;
+};
+
 class SQLStorageBase {
  public:
   explicit SQLStorageBase(boost::filesystem::path sqldb_path, bool readonly, std::vector<std::string> schema_migrations,
                           std::vector<std::string> schema_rollback_migrations, std::string current_schema,
-                          int current_schema_version);
+                          int current_schema_version, bool wal = false,
+                          std::vector<BackgroundMigration> background_migrations = {});
+  ~SQLStorageBase();
+  SQLStorageBase(const SQLStorageBase &other) = delete;
+  SQLStorageBase(SQLStorageBase &&other) = delete;
+  SQLStorageBase &operator=(const SQLStorageBase &other) = delete;
+  SQLStorageBase &operator=(SQLStorageBase &&other) = delete;
   std::string getTableSchemaFromDb(const std::string &tablename);
   bool dbMigrateForward(int version_from, int version_to = 0);
   bool dbMigrateBackward(int version_from, int version_to = 0);
@@ -42,20 +74,51 @@ class SQLStorageBase {
   DbVersion getVersion();  // non-negative integer on success or -1 on error
   boost::filesystem::path dbPath() const;
 
+  // whether the data is still in the old layout
+  bool backgroundMigrationPending(const std::string &name) const;
+  /**
+   * Run one step of the background migrations, of at most `max_rows` rows.
+   * @return true if there is more to do.
+   * @throws SQLException on failure, the step is then rolled back.
+   */
+  bool backgroundMigrationStep(int64_t max_rows = kBackgroundMigrationRows);
+
+  static constexpr int64_t kBackgroundMigrationRows{500};
+  // wait after startup and between the steps, so that the client isn't slowed down
+  static constexpr std::chrono::seconds kBackgroundMigrationDelay{30};
+  static constexpr std::chrono::milliseconds kBackgroundMigrationPause{200};
+
  protected:
   boost::filesystem::path sqldb_path_;
   bool readonly_{false};
+  // use a write-ahead log instead of a rollback journal
+  bool wal_{false};
 
   StorageLock lock;
-  std::shared_ptr<std::mutex> mutex_;
+  // recursive, so that a batch can hold it across storage calls
+  std::shared_ptr<std::recursive_mutex> mutex_;
+  // opened on first use and kept open, used under mutex_
+  mutable std::shared_ptr<sqlite3> connection_;
+  mutable std::shared_ptr<SQLiteStatementCache> statements_;
+  // the database file of the connection, to notice if it is replaced
+  mutable dev_t connection_dev_{0};
+  mutable ino_t connection_ino_{0};
 
   const std::vector<std::string> schema_migrations_;
   std::vector<std::string> schema_rollback_migrations_;
   const std::string current_schema_;
   const int current_schema_version_;
+  const std::vector<BackgroundMigration> background_migrations_;
+
+  std::thread background_thread_;
+  std::mutex background_m_;
+  std::condition_variable background_cv_;
+  bool background_shutdown_{false};
 
   SQLite3Guard dbConnection() const;
+  void setJournalMode(sqlite3 *db) const;
   bool dbInsertBackMigrations(SQLite3Guard &db, int version_latest);
+  void backgroundMigrationLoop();
 };
 
 #endif  // SQLSTORAGE_BASE_H_
@@ -3,6 +3,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/tokenizer.hpp>
 
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "storage/sql_utils.h"
 #include "storage/sqlstorage.h"
@@ -17,7 +18,16 @@ typedef boost::tokenizer<boost::char_separator<char> > sql_tokenizer;
 static std::map<std::string, std::string> parseSchema() {
   std::map<std::string, std::string> result;
   std::vector<std::string> tokens;
-  enum { STATE_INIT, STATE_CREATE, STATE_INSERT, STATE_TABLE, STATE_NAME, STATE_TRIGGER, STATE_TRIGGER_END };
+  enum {
+    STATE_INIT,
+    STATE_CREATE,
+    STATE_INSERT,
+    STATE_INDEX,
+    STATE_TABLE,
+    STATE_NAME,
+    STATE_TRIGGER,
+    STATE_TRIGGER_END
+  };
   boost::char_separator<char> sep(" \"\t\r\n", "(),;");
   std::string schema(libaktualizr_current_schema);
   sql_tokenizer tok(schema, sep);
@@ -47,11 +57,14 @@ static std::map<std::string, std::string> parseSchema() {
           parsing_state = STATE_TABLE;
         } else if (token == "TRIGGER") {
           parsing_state = STATE_TRIGGER;
+        } else if (token == "INDEX") {
+          parsing_state = STATE_INDEX;
         } else {
           return {};
         }
         break;
       case STATE_INSERT:
+      case STATE_INDEX:
         // do not take these into account
         if (token == ";") {
           key.clear();
@@ -543,6 +556,247 @@ TEST(sqlstorage, store_and_load_report_events) {
   }
 }
 
+/* Raw events are loaded as stored, up to a total size but at least one. */
+TEST(sqlstorage, load_raw_report_events) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config);
+
+  for (int ii = 0; ii < 5; ++ii) {
+    storage->saveReportEvent(Utils::parseJSON(R"({"id": ")" + std::to_string(ii) + R"(", "eventType": "some Event"})"));
+  }
+  const std::string first = R"({"eventType":"some Event","id":"0"})";
+  int64_t max_id = 0;
+  std::vector<std::string> events;
+  storage->loadReportEventsRaw(&events, &max_id, -1, 3 * first.size());
+  EXPECT_EQ(events.size(), 3);
+  EXPECT_EQ(events[0], first);
+  EXPECT_EQ(max_id, 3);
+
+  events.clear();
+  storage->loadReportEventsRaw(&events, &max_id, 2, 1);
+  EXPECT_EQ(events.size(), 1);
+  events.clear();
+  storage->loadReportEventsRaw(&events, &max_id, 2, 100 * first.size());
+  EXPECT_EQ(events.size(), 2);
+}
+
+/* Writes in a batch are committed together, or rolled back together if the
+ * batch is not committed. The transactions of the storage methods are nested
+ * in the one of the batch. */
+TEST(sqlstorage, Batch) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.sqldb_wal = true;
+  auto storage = INvStorage::newStorage(config);
+
+  {
+    auto batch = storage->beginBatch();
+    for (int ii = 0; ii < 3; ++ii) {
+      storage->saveReportEvent(Utils::parseJSON(R"({"id": "some ID", "eventType": "some Event"})"));
+    }
+    storage->storeTlsCa("ca");
+    batch->commit();
+  }
+  {
+    auto batch = storage->beginBatch();
+    storage->saveReportEvent(Utils::parseJSON(R"({"id": "another ID", "eventType": "some Event"})"));
+    storage->storeTlsCa("another ca");
+  }
+
+  Json::Value events{Json::arrayValue};
+  int64_t max_id = 0;
+  EXPECT_TRUE(storage->loadReportEvents(&events, &max_id, -1));
+  EXPECT_EQ(events.size(), 3);
+  std::string ca;
+  EXPECT_TRUE(storage->loadTlsCa(&ca));
+  EXPECT_EQ(ca, "ca");
+
+  SQLite3Guard db(config.sqldb_path.get(config.path));
+  auto statement = db.prepareStatement("PRAGMA journal_mode;");
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_str(0).value(), "wal");
+}
+
+/* Rows are copied to the new layout in steps, and the data is in the old layout
+ * until the migration is finished. */
+TEST(sqlstorage, BackgroundMigration) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path db_path = temp_dir.Path() / "test.db";
+  const std::string schema =
+      "CREATE TABLE version(version INTEGER); INSERT INTO version VALUES(0);"
+      "CREATE TABLE background_migrations(name TEXT PRIMARY KEY, last_id INTEGER NOT NULL DEFAULT 0);"
+      "CREATE TABLE items(id INTEGER PRIMARY KEY, value TEXT NOT NULL);";
+  const std::string migration =
+      "CREATE TABLE items_new(id INTEGER PRIMARY KEY, value TEXT NOT NULL, length INTEGER NOT NULL);"
+      "CREATE TRIGGER items_update AFTER UPDATE ON items BEGIN "
+      "UPDATE items_new SET value = NEW.value, length = length(NEW.value) WHERE id = NEW.id; END;"
+      "INSERT INTO background_migrations(name) VALUES('items');"
+      "DELETE FROM version; INSERT INTO version VALUES(1);";
+  const BackgroundMigration background_migration{
+      "items", "items", "INSERT INTO items_new SELECT id, value, length(value) FROM items WHERE id > ?1 AND id <= ?2;",
+      "DROP TABLE items; ALTER TABLE items_new RENAME TO items;"};
+
+  {
+    SQLStorageBase storage(db_path, false, {schema}, {}, schema, 0);
+    SQLite3Guard db(db_path.c_str());
+    for (int ii = 1; ii <= 10; ++ii) {
+      ASSERT_EQ(db.exec("INSERT INTO items(value) VALUES('" + std::string(static_cast<size_t>(ii), 'x') + "');",
+                        nullptr, nullptr),
+                SQLITE_OK);
+    }
+  }
+
+  SQLStorageBase storage(db_path, false, {schema, migration}, {}, schema, 1, false, {background_migration});
+  EXPECT_TRUE(storage.backgroundMigrationPending("items"));
+  EXPECT_TRUE(storage.backgroundMigrationStep(4));
+
+  SQLite3Guard db(db_path.c_str());
+  // changes of already copied rows and new rows are migrated as well
+  ASSERT_EQ(db.exec("UPDATE items SET value = 'updated' WHERE id = 2;", nullptr, nullptr), SQLITE_OK);
+  ASSERT_EQ(db.exec("INSERT INTO items(value) VALUES('new');", nullptr, nullptr), SQLITE_OK);
+  {
+    auto statement = db.prepareStatement("SELECT count(*) FROM items;");
+    ASSERT_EQ(statement.step(), SQLITE_ROW);
+    EXPECT_EQ(statement.get_result_col_int(0), 11);
+  }
+
+  int steps = 0;
+  while (storage.backgroundMigrationStep(4)) {
+    ++steps;
+  }
+  // two steps to copy the remaining rows, one to finish
+  EXPECT_EQ(steps, 3);
+  EXPECT_FALSE(storage.backgroundMigrationPending("items"));
+
+  auto statement = db.prepareStatement("SELECT id, value, length FROM items ORDER BY id;");
+  for (int ii = 1; ii <= 11; ++ii) {
+    ASSERT_EQ(statement.step(), SQLITE_ROW);
+    EXPECT_EQ(statement.get_result_col_int(0), ii);
+    const std::string value = statement.get_result_col_str(1).value();
+    EXPECT_EQ(statement.get_result_col_int(2), value.size());
+    if (ii == 2) {
+      EXPECT_EQ(value, "updated");
+    } else if (ii == 11) {
+      EXPECT_EQ(value, "new");
+    }
+  }
+  EXPECT_EQ(statement.step(), SQLITE_DONE);
+}
+
+static std::string largeMetadata(const char padding) {
+  Json::Value json;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["padding"] = std::string(SQLStorage::kMetaFileThreshold, padding);
+  return Utils::jsonToCanonicalStr(json);
+}
+
+static size_t countFiles(const boost::filesystem::path& dir) {
+  if (!boost::filesystem::is_directory(dir)) {
+    return 0;
+  }
+  return static_cast<size_t>(
+      std::distance(boost::filesystem::directory_iterator(dir), boost::filesystem::directory_iterator()));
+}
+
+/* Large metadata is kept in files next to the database, which are removed once
+ * no metadata refers to them anymore. */
+TEST(sqlstorage, MetaFiles) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  const boost::filesystem::path meta_dir = config.sqldb_path.get(config.path).string() + "-meta";
+  const std::string targets = largeMetadata('a');
+  const std::string delegation = largeMetadata('b');
+  {
+    SQLStorage storage(config, false);
+    storage.storeNonRoot("{\"small\": true}", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+    EXPECT_EQ(countFiles(meta_dir), 0);
+
+    storage.storeNonRoot(targets, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+    storage.storeDelegation(delegation, Uptane::Role::Delegation("delegated"));
+    EXPECT_EQ(countFiles(meta_dir), 2);
+
+    std::string loaded;
+    EXPECT_TRUE(storage.loadNonRoot(&loaded, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+    EXPECT_EQ(loaded, targets);
+    EXPECT_TRUE(storage.loadDelegation(&loaded, Uptane::Role::Delegation("delegated")));
+    EXPECT_EQ(loaded, delegation);
+    std::vector<std::pair<Uptane::Role, std::string>> delegations;
+    EXPECT_TRUE(storage.loadAllDelegations(delegations));
+    ASSERT_EQ(delegations.size(), 1);
+    EXPECT_EQ(delegations[0].second, delegation);
+    TimeStamp expiry;
+    EXPECT_TRUE(storage.loadMetaExpiry(Uptane::RepositoryType::Image(), Uptane::Role::Targets(), &expiry));
+    EXPECT_EQ(expiry.ToString(), "2038-01-19T03:14:06Z");
+    EXPECT_TRUE(storage.loadNonRoot(&loaded, Uptane::RepositoryType::Director(), Uptane::Role::Targets()));
+    EXPECT_EQ(loaded, "{\"small\": true}");
+
+    {
+      // the database only refers to the file
+      SQLite3Guard db(config.sqldb_path.get(config.path));
+      auto statement = db.prepareStatement<int>("SELECT length(meta), meta_file FROM meta WHERE repo=?;",
+                                                static_cast<int>(Uptane::RepositoryType::Image()));
+      ASSERT_EQ(statement.step(), SQLITE_ROW);
+      EXPECT_EQ(statement.get_result_col_int(0), 0);
+      EXPECT_EQ(statement.get_result_col_str(1).value(), Crypto::sha256digestHex(targets));
+    }
+
+    // replaced metadata
+    storage.storeNonRoot(largeMetadata('c'), Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+    EXPECT_EQ(countFiles(meta_dir), 2);
+    EXPECT_FALSE(boost::filesystem::exists(meta_dir / Crypto::sha256digestHex(targets)));
+    storage.deleteDelegation(Uptane::Role::Delegation("delegated"));
+    EXPECT_EQ(countFiles(meta_dir), 1);
+  }
+
+  // left over by a crash
+  Utils::writeFile(meta_dir / "orphan", std::string("{}"));
+  {
+    SQLStorage storage(config, false);
+    EXPECT_EQ(countFiles(meta_dir), 1);
+    EXPECT_FALSE(boost::filesystem::exists(meta_dir / "orphan"));
+    storage.clearMetadata();
+    EXPECT_EQ(countFiles(meta_dir), 0);
+  }
+}
+
+TEST(sqlstorage, Maintenance) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.sqldb_wal = true;
+  SQLStorage storage(config, false);
+
+  Json::Value event;
+  event["payload"] = std::string(4096, 'x');
+  for (int k = 0; k < 500; ++k) {
+    storage.saveReportEvent(event);
+  }
+  Json::Value events;
+  int64_t id_max = 0;
+  EXPECT_TRUE(storage.loadReportEvents(&events, &id_max, -1));
+  storage.deleteReportEvents(id_max);
+
+  // no time for anything
+  StorageMaintenance maintenance = storage.maintain(std::chrono::milliseconds(0), true);
+  EXPECT_FALSE(maintenance.complete);
+  EXPECT_FALSE(maintenance.integrity_ok.is_initialized());
+
+  maintenance = storage.maintain(std::chrono::seconds(60), true);
+  EXPECT_TRUE(maintenance.complete);
+  EXPECT_GT(maintenance.bytes_reclaimed, 500 * 4096);
+  ASSERT_TRUE(maintenance.integrity_ok);
+  EXPECT_TRUE(*maintenance.integrity_ok);
+  EXPECT_EQ(boost::filesystem::file_size(config.sqldb_path.get(config.path).string() + "-wal"), 0);
+
+  // not within a batch
+  auto batch = storage.beginBatch();
+  EXPECT_FALSE(storage.maintain(std::chrono::seconds(60), false).complete);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
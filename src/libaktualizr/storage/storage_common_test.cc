@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
 
@@ -170,6 +171,69 @@ TEST(StorageCommon, LoadStoreMetadata) {
 }
 
 /* Load and store Uptane roots. */
+/* Load and store the HTTP validators of metadata. */
+TEST(StorageCommon, MetaValidators) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  EXPECT_FALSE(storage->loadMetaValidators(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), nullptr,
+                                           nullptr));
+
+  storage->storeNonRoot("targets", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  storage->storeMetaValidators(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), "\"abc\"",
+                               "Wed, 21 Oct 2015 07:28:00 GMT");
+  storage->storeMetaValidators(Uptane::RepositoryType::Image(), Uptane::Role::Timestamp(), "", "");
+
+  std::string etag;
+  std::string last_modified;
+  ASSERT_TRUE(storage->loadMetaValidators(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), &etag,
+                                          &last_modified));
+  EXPECT_EQ(etag, "\"abc\"");
+  EXPECT_EQ(last_modified, "Wed, 21 Oct 2015 07:28:00 GMT");
+  // empty validators are not stored
+  EXPECT_FALSE(
+      storage->loadMetaValidators(Uptane::RepositoryType::Image(), Uptane::Role::Timestamp(), nullptr, nullptr));
+
+  // new metadata doesn't have the validators of the previous one
+  storage->storeNonRoot("targets2", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  EXPECT_FALSE(storage->loadMetaValidators(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), nullptr,
+                                           nullptr));
+
+  storage->storeMetaValidators(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), "\"def\"", "");
+  storage->clearNonRootMeta(Uptane::RepositoryType::Director());
+  EXPECT_FALSE(storage->loadMetaValidators(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), nullptr,
+                                           nullptr));
+}
+
+/* The expiry of the stored metadata is indexed. */
+TEST(StorageCommon, MetaExpiry) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  EXPECT_FALSE(storage->loadMetaExpiry(Uptane::RepositoryType::Director(), Uptane::Role::Root(), nullptr));
+
+  Json::Value meta;
+  meta["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  storage->storeRoot(Utils::jsonToStr(meta), Uptane::RepositoryType::Director(), Uptane::Version(2));
+  meta["signed"]["expires"] = "2030-01-01T00:00:00Z";
+  storage->storeRoot(Utils::jsonToStr(meta), Uptane::RepositoryType::Director(), Uptane::Version(1));
+  meta["signed"]["expires"] = "2000-01-01T00:00:00Z";
+  storage->storeNonRoot(Utils::jsonToStr(meta), Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  // not metadata
+  storage->storeNonRoot("5", Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
+
+  TimeStamp expiry;
+  // the latest Root version
+  ASSERT_TRUE(storage->loadMetaExpiry(Uptane::RepositoryType::Director(), Uptane::Role::Root(), &expiry));
+  EXPECT_EQ(expiry, TimeStamp("2038-01-19T03:14:06Z"));
+  ASSERT_TRUE(storage->loadMetaExpiry(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), &expiry));
+  EXPECT_TRUE(expiry.IsExpiredAt(TimeStamp::Now()));
+  EXPECT_FALSE(storage->loadMetaExpiry(Uptane::RepositoryType::Image(), Uptane::Role::Timestamp(), nullptr));
+
+  storage->clearNonRootMeta(Uptane::RepositoryType::Director());
+  EXPECT_FALSE(storage->loadMetaExpiry(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), nullptr));
+}
+
 TEST(StorageCommon, LoadStoreRoot) {
   TemporaryDirectory temp_dir;
   std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
@@ -416,6 +480,143 @@ TEST(StorageCommon, LoadStoreInstalledVersions) {
   }
 }
 
+/*
+ * Prune old entries of the installation log, a few at a time, but keep the
+ * current version.
+ */
+TEST(StorageCommon, InstalledVersionsRetention) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.installed_versions_retention = 0;
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  auto target = [&primary_ecu](int ii) {
+    return Uptane::Target{"update" + std::to_string(ii) + ".bin", primary_ecu,
+                          {Hash{Hash::Type::kSha256, "25" + std::to_string(ii)}}, 1};
+  };
+  {
+    SQLStorage storage(config, false);
+    storage.storeEcuSerials({{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}});
+    storage.savePrimaryInstalledVersion(target(0), InstalledVersionUpdateMode::kCurrent, "");
+    for (int ii = 1; ii <= 40; ++ii) {
+      storage.savePrimaryInstalledVersion(target(ii), InstalledVersionUpdateMode::kNone, "");
+    }
+    std::vector<Uptane::Target> log;
+    EXPECT_TRUE(storage.loadInstallationLog("primary", &log, false));
+    EXPECT_EQ(log.size(), 41);
+  }
+
+  config.installed_versions_retention = 3;
+  SQLStorage storage(config, false);
+  storage.savePrimaryInstalledVersion(target(41), InstalledVersionUpdateMode::kNone, "");
+  std::vector<Uptane::Target> log;
+  EXPECT_TRUE(storage.loadInstallationLog("primary", &log, false));
+  // only some of the entries are removed at once
+  EXPECT_GT(log.size(), 4);
+  EXPECT_LT(log.size(), 42);
+
+  for (int ii = 42; ii <= 45; ++ii) {
+    storage.savePrimaryInstalledVersion(target(ii), InstalledVersionUpdateMode::kNone, "");
+  }
+  EXPECT_TRUE(storage.loadInstallationLog("primary", &log, false));
+  ASSERT_EQ(log.size(), 4);
+  EXPECT_EQ(log[0].filename(), "update0.bin");
+  EXPECT_EQ(log[1].filename(), "update43.bin");
+  EXPECT_EQ(log[3].filename(), "update45.bin");
+
+  boost::optional<Uptane::Target> current;
+  EXPECT_TRUE(storage.loadPrimaryInstalledVersions(&current, nullptr));
+  ASSERT_TRUE(!!current);
+  EXPECT_EQ(current->filename(), "update0.bin");
+}
+
+/*
+ * Find the latest entry of the installation log with a given hash.
+ */
+TEST(StorageCommon, LoadInstalledVersionByHash) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+  storage->storeEcuSerials({{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}});
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  Uptane::Target t1{"update.bin", primary_ecu, {Hash{Hash::Type::kSha256, "2561"}}, 1};
+  Uptane::Target t2{"update2.bin", primary_ecu, {Hash{Hash::Type::kSha256, "2562"}}, 2};
+  Uptane::Target t3{"update3.bin", primary_ecu, {Hash{Hash::Type::kSha256, "2561"}}, 3};
+  storage->savePrimaryInstalledVersion(t1, InstalledVersionUpdateMode::kCurrent, "");
+  storage->savePrimaryInstalledVersion(t2, InstalledVersionUpdateMode::kCurrent, "");
+  storage->savePrimaryInstalledVersion(t3, InstalledVersionUpdateMode::kNone, "");
+
+  boost::optional<Uptane::Target> version;
+  EXPECT_TRUE(storage->loadInstalledVersionByHash("", "2561", &version));
+  ASSERT_TRUE(!!version);
+  EXPECT_EQ(version->filename(), "update3.bin");
+  EXPECT_TRUE(storage->loadInstalledVersionByHash("primary", "2562", &version));
+  ASSERT_TRUE(!!version);
+  EXPECT_EQ(version->filename(), "update2.bin");
+  EXPECT_TRUE(storage->loadInstalledVersionByHash("primary", "2563", &version));
+  EXPECT_FALSE(!!version);
+}
+
+/*
+ * Load the device and ECU state at once.
+ */
+TEST(StorageCommon, LoadSnapshot) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  StorageSnapshot snapshot;
+  storage->loadSnapshot(&snapshot);
+  EXPECT_TRUE(snapshot.device_id.empty());
+  EXPECT_FALSE(snapshot.ecu_registered);
+  EXPECT_FALSE(snapshot.has_root_metadata);
+  EXPECT_TRUE(snapshot.serials.empty());
+
+  storage->storeDeviceId("device_id");
+  storage->storeEcuRegistered();
+  storage->storeRoot("root", Uptane::RepositoryType::Image(), Uptane::Version(1));
+  const Uptane::EcuSerial primary("primary");
+  const Uptane::EcuSerial secondary("secondary");
+  storage->storeEcuSerials({{primary, Uptane::HardwareIdentifier("primary_hw")},
+                            {secondary, Uptane::HardwareIdentifier("secondary_hw")},
+                            {Uptane::EcuSerial("other"), Uptane::HardwareIdentifier("other_hw")}});
+  storage->saveMisconfiguredEcu({Uptane::EcuSerial("old"), Uptane::HardwareIdentifier("old_hw"), EcuState::kOld});
+
+  Uptane::EcuMap primary_ecu{{primary, Uptane::HardwareIdentifier("primary_hw")}};
+  Uptane::EcuMap secondary_ecu{{secondary, Uptane::HardwareIdentifier("secondary_hw")}};
+  Uptane::Target t1{"update.bin", primary_ecu, {Hash{Hash::Type::kSha256, "2561"}}, 1};
+  Uptane::Target t2{"secondary.bin", secondary_ecu, {Hash{Hash::Type::kSha256, "2562"}}, 2};
+  Uptane::Target t3{"secondary2.bin", secondary_ecu, {Hash{Hash::Type::kSha256, "2563"}}, 3};
+  storage->savePrimaryInstalledVersion(t1, InstalledVersionUpdateMode::kCurrent, "corrid-1");
+  storage->saveInstalledVersion(secondary.ToString(), t2, InstalledVersionUpdateMode::kCurrent, "corrid-2");
+  storage->saveInstalledVersion(secondary.ToString(), t3, InstalledVersionUpdateMode::kPending, "corrid-3");
+
+  storage->loadSnapshot(&snapshot);
+  EXPECT_EQ(snapshot.device_id, "device_id");
+  EXPECT_TRUE(snapshot.ecu_registered);
+  EXPECT_TRUE(snapshot.has_root_metadata);
+  ASSERT_EQ(snapshot.serials.size(), 3);
+  EXPECT_EQ(snapshot.serials[0].first, primary);
+  EXPECT_EQ(snapshot.serials[1].second, Uptane::HardwareIdentifier("secondary_hw"));
+  ASSERT_EQ(snapshot.misconfigured_ecus.size(), 1);
+  EXPECT_EQ(snapshot.misconfigured_ecus[0].serial, Uptane::EcuSerial("old"));
+
+  // same as loadInstalledVersions()
+  EXPECT_EQ(snapshot.versions.size(), 2);
+  const auto& primary_versions = snapshot.versions.at(primary);
+  ASSERT_TRUE(!!primary_versions.current);
+  EXPECT_TRUE(primary_versions.current->MatchTarget(t1));
+  EXPECT_FALSE(!!primary_versions.pending);
+  EXPECT_EQ(primary_versions.correlation_id, "corrid-1");
+  const auto& secondary_versions = snapshot.versions.at(secondary);
+  ASSERT_TRUE(!!secondary_versions.current);
+  ASSERT_TRUE(!!secondary_versions.pending);
+  EXPECT_EQ(secondary_versions.current->filename(), "secondary.bin");
+  EXPECT_EQ(secondary_versions.pending->filename(), "secondary2.bin");
+  EXPECT_EQ(secondary_versions.pending->ecus(), secondary_ecu);
+  EXPECT_EQ(secondary_versions.correlation_id, "corrid-3");
+}
+
 /*
  * Load and store an ECU installation result in an SQL database.
  * Load and store a device installation result in an SQL database.
@@ -483,6 +684,131 @@ TEST(StorageCommon, DownloadedFilesInfo) {
   ASSERT_EQ(names.at(0), "target2");
 }
 
+/* Several Targets can share a file. It stays verified until the last of them
+ * is removed. */
+TEST(StorageCommon, SharedTargetFiles) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  VerifiedFile file;
+  file.size = 1024;
+  file.hashes = "sha256:abcd";
+  storage->storeTargetFilename("target1", "file1");
+  storage->storeVerifiedFile("file1", file);
+  storage->storeTargetHashState("target2", 42, "state");
+
+  storage->linkTargetFilename("target2", "file1");
+  EXPECT_EQ(storage->getTargetFilename("target2"), "file1");
+  EXPECT_TRUE(storage->loadVerifiedFile("file1", nullptr));
+  EXPECT_FALSE(storage->loadTargetHashState("target2", nullptr, nullptr));
+  auto names = storage->getTargetNamesForFile("file1");
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ(names, (std::vector<std::string>{"target1", "target2"}));
+  EXPECT_TRUE(storage->getTargetNamesForFile("file2").empty());
+
+  storage->deleteTargetInfo("target1");
+  EXPECT_EQ(storage->getTargetNamesForFile("file1"), std::vector<std::string>{"target2"});
+  EXPECT_TRUE(storage->loadVerifiedFile("file1", nullptr));
+
+  storage->deleteTargetInfo("target2");
+  EXPECT_TRUE(storage->getTargetNamesForFile("file1").empty());
+  EXPECT_FALSE(storage->loadVerifiedFile("file1", nullptr));
+}
+
+/* Load and store progress of segmented downloads. */
+TEST(StorageCommon, DownloadSegments) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  EXPECT_FALSE(storage->loadDownloadSegments("target1", nullptr));
+
+  storage->storeTargetFilename("target1", "file1");
+  storage->storeDownloadSegments("target1", {DownloadSegment(0, 10), DownloadSegment(10, 15, 5)});
+  storage->storeDownloadSegments("target2", {DownloadSegment(0, 100)});
+  storage->updateDownloadSegment("target1", 0, 7);
+
+  std::vector<DownloadSegment> segments;
+  ASSERT_TRUE(storage->loadDownloadSegments("target1", &segments));
+  ASSERT_EQ(segments.size(), 2);
+  EXPECT_EQ(segments[0].start, 0);
+  EXPECT_EQ(segments[0].length, 10);
+  EXPECT_EQ(segments[0].downloaded, 7);
+  EXPECT_EQ(segments[1].start, 10);
+  EXPECT_EQ(segments[1].length, 15);
+  EXPECT_EQ(segments[1].downloaded, 5);
+  EXPECT_THROW(storage->updateDownloadSegment("target1", 2, 1), std::runtime_error);
+
+  // storing replaces the previous segments
+  storage->storeDownloadSegments("target1", {DownloadSegment(0, 25, 25)});
+  ASSERT_TRUE(storage->loadDownloadSegments("target1", &segments));
+  ASSERT_EQ(segments.size(), 1);
+  EXPECT_TRUE(segments[0].isComplete());
+
+  // segments are removed along with the Target
+  storage->deleteTargetInfo("target1");
+  EXPECT_FALSE(storage->loadDownloadSegments("target1", nullptr));
+
+  storage->clearDownloadSegments("target2");
+  EXPECT_FALSE(storage->loadDownloadSegments("target2", nullptr));
+}
+
+/* Load and store intermediate hasher states of Targets. */
+TEST(StorageCommon, TargetHashState) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  uint64_t hashed_length = 0;
+  std::string state;
+  EXPECT_FALSE(storage->loadTargetHashState("target1", &hashed_length, &state));
+
+  storage->storeTargetFilename("target1", "file1");
+  storage->storeTargetHashState("target1", 42, std::string("st\0ate", 6));
+  ASSERT_TRUE(storage->loadTargetHashState("target1", &hashed_length, &state));
+  EXPECT_EQ(hashed_length, 42);
+  EXPECT_EQ(state, std::string("st\0ate", 6));
+
+  storage->storeTargetHashState("target1", 43, "state2");
+  ASSERT_TRUE(storage->loadTargetHashState("target1", &hashed_length, &state));
+  EXPECT_EQ(hashed_length, 43);
+  EXPECT_EQ(state, "state2");
+
+  // the file is created again
+  storage->storeTargetFilename("target1", "file1");
+  EXPECT_FALSE(storage->loadTargetHashState("target1", nullptr, nullptr));
+
+  storage->storeTargetHashState("target1", 42, "state");
+  storage->deleteTargetInfo("target1");
+  EXPECT_FALSE(storage->loadTargetHashState("target1", nullptr, nullptr));
+}
+
+/* Load and store the cache of verified Target files. */
+TEST(StorageCommon, VerifiedFiles) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+
+  EXPECT_FALSE(storage->loadVerifiedFile("file1", nullptr));
+
+  VerifiedFile file;
+  file.size = 1024;
+  file.mtime_ns = 1600000000123456789;
+  file.inode = 42;
+  file.hashes = "sha256:abcd";
+  storage->storeTargetFilename("target1", "file1");
+  storage->storeVerifiedFile("file1", file);
+
+  VerifiedFile loaded;
+  ASSERT_TRUE(storage->loadVerifiedFile("file1", &loaded));
+  EXPECT_EQ(loaded, file);
+
+  // the file is created again
+  storage->storeTargetFilename("target1", "file1");
+  EXPECT_FALSE(storage->loadVerifiedFile("file1", nullptr));
+
+  storage->storeVerifiedFile("file1", file);
+  storage->deleteTargetInfo("target1");
+  EXPECT_FALSE(storage->loadVerifiedFile("file1", nullptr));
+}
+
 TEST(StorageCommon, LoadStoreSecondaryInfo) {
   TemporaryDirectory temp_dir;
   std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
@@ -645,6 +971,32 @@ TEST(StorageImport, ImportData) {
   EXPECT_EQ(tls_pkey, tls_pkey_in3);
 }
 
+/* A failed import stores nothing, not even what was imported before the failing step. */
+TEST(StorageImport, ImportDataAtomic) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+  fs::create_directories(temp_dir / "import");
+
+  ImportConfig import_config;
+  import_config.base_path = temp_dir.Path() / "import";
+  import_config.uptane_private_key_path = utils::BasedPath("private");
+  import_config.uptane_public_key_path = utils::BasedPath("public");
+  import_config.tls_cacert_path = utils::BasedPath("ca");
+  import_config.tls_clientcert_path = utils::BasedPath("cert");
+
+  Utils::writeFile(import_config.uptane_private_key_path.get(import_config.base_path).string(),
+                   std::string("uptane_private_1"));
+  Utils::writeFile(import_config.uptane_public_key_path.get(import_config.base_path).string(),
+                   std::string("uptane_public_1"));
+  Utils::writeFile(import_config.tls_cacert_path.get(import_config.base_path).string(), std::string("tls_cacert_1"));
+  Utils::writeFile(import_config.tls_clientcert_path.get(import_config.base_path).string(), std::string("not a cert"));
+
+  EXPECT_THROW(storage->importData(import_config), std::runtime_error);
+  EXPECT_FALSE(storage->loadPrimaryKeys(nullptr, nullptr));
+  EXPECT_FALSE(storage->loadTlsCa(nullptr));
+  EXPECT_FALSE(storage->loadTlsCert(nullptr));
+}
+
 TEST(StorageImport, ImportInitialRoot) {
   TemporaryDirectory temp_dir;
   std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
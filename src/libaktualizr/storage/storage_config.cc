@@ -5,6 +5,13 @@ void StorageConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt
   CopyFromConfig(type, "type", pt);
   CopyFromConfig(path, "path", pt);
   CopyFromConfig(sqldb_path, "sqldb_path", pt);
+  CopyFromConfig(sqldb_wal, "sqldb_wal", pt);
+  CopyFromConfig(metadata_cache_size, "metadata_cache_size", pt);
+  CopyFromConfig(installed_versions_retention, "installed_versions_retention", pt);
+  CopyFromConfig(profile, "profile", pt);
+  CopyFromConfig(maintenance_interval_sec, "maintenance_interval_sec", pt);
+  CopyFromConfig(maintenance_budget_ms, "maintenance_budget_ms", pt);
+  CopyFromConfig(maintenance_integrity_check, "maintenance_integrity_check", pt);
   CopyFromConfig(uptane_metadata_path, "uptane_metadata_path", pt);
   CopyFromConfig(uptane_private_key_path, "uptane_private_key_path", pt);
   CopyFromConfig(uptane_public_key_path, "uptane_public_key_path", pt);
@@ -17,6 +24,13 @@ void StorageConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, type, "type");
   writeOption(out_stream, path, "path");
   writeOption(out_stream, sqldb_path.get(""), "sqldb_path");
+  writeOption(out_stream, sqldb_wal, "sqldb_wal");
+  writeOption(out_stream, metadata_cache_size, "metadata_cache_size");
+  writeOption(out_stream, installed_versions_retention, "installed_versions_retention");
+  writeOption(out_stream, profile, "profile");
+  writeOption(out_stream, maintenance_interval_sec, "maintenance_interval_sec");
+  writeOption(out_stream, maintenance_budget_ms, "maintenance_budget_ms");
+  writeOption(out_stream, maintenance_integrity_check, "maintenance_integrity_check");
   writeOption(out_stream, uptane_metadata_path.get(""), "uptane_metadata_path");
   writeOption(out_stream, uptane_private_key_path.get(""), "uptane_private_key_path");
   writeOption(out_stream, uptane_public_key_path.get(""), "uptane_public_key_path");
@@ -5,9 +5,13 @@
 void TelemetryConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopyFromConfig(report_network, "report_network", pt);
   CopyFromConfig(report_config, "report_config", pt);
+  CopyFromConfig(compress_events, "compress_events", pt);
+  CopyFromConfig(report_performance, "report_performance", pt);
 }
 
 void TelemetryConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, report_network, "report_network");
   writeOption(out_stream, report_config, "report_config");
+  writeOption(out_stream, compress_events, "compress_events");
+  writeOption(out_stream, report_performance, "report_performance");
 }
@@ -2,7 +2,9 @@
 
 #include "directorrepository.h"
 #include "logging/logging.h"
+#include "storage/sqlstorage.h"
 #include "test_utils.h"
+#include "uptane/exceptions.h"
 #include "utilities/utils.h"
 
 boost::filesystem::path uptane_generator_path;
@@ -48,6 +50,52 @@ TEST(Director, EmptyTargets) {
   EXPECT_TRUE(director.latest_targets.targets.empty());
 }
 
+/*
+ * Stored metadata that has been verified is only checked for expiry again, as
+ * long as no Director metadata is written through the same storage.
+ */
+TEST(Director, CheckMetaOfflineIfChanged) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory storage_dir;
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  uptane_gen.run({"image", "--path", meta_dir.PathString(), "--filename", "tests/test_data/firmware.txt",
+                  "--targetname", "firmware.txt", "--hwid", "primary_hw"});
+  uptane_gen.run({"addtarget", "--path", meta_dir.PathString(), "--targetname", "firmware.txt", "--hwid", "primary_hw",
+                  "--serial", "CA:FE:A6:D2:84:9D"});
+  uptane_gen.run({"signtargets", "--path", meta_dir.PathString()});
+  const std::string root = Utils::readFile(meta_dir.Path() / "repo/director/root.json");
+
+  StorageConfig config;
+  config.path = storage_dir.Path();
+  SQLStorage storage(config, false);
+  storage.storeRoot(root, RepositoryType::Director(), Version(1));
+  storage.storeNonRoot(Utils::readFile(meta_dir.Path() / "repo/director/targets.json"), RepositoryType::Director(),
+                       Role::Targets());
+
+  DirectorRepository director;
+  EXPECT_NO_THROW(director.checkMetaOfflineIfChanged(storage));
+  EXPECT_EQ(director.getTargets().targets.size(), 1);
+
+  // not seen by the generation of the first storage, so not verified
+  {
+    SQLStorage other_storage(config, false);
+    other_storage.storeNonRoot(root, RepositoryType::Director(), Role::Targets());
+  }
+  EXPECT_NO_THROW(director.checkMetaOfflineIfChanged(storage));
+  EXPECT_EQ(director.getTargets().targets.size(), 1);
+
+  // Image repo metadata doesn't matter
+  storage.storeNonRoot(root, RepositoryType::Image(), Role::Targets());
+  EXPECT_NO_THROW(director.checkMetaOfflineIfChanged(storage));
+
+  storage.storeNonRoot(root, RepositoryType::Director(), Role::Targets());
+  EXPECT_THROW(director.checkMetaOfflineIfChanged(storage), Uptane::Exception);
+  // and neither is a failed check remembered
+  EXPECT_THROW(director.checkMetaOfflineIfChanged(storage), Uptane::Exception);
+}
+
 }  // namespace Uptane
 
 #ifndef __NO_MAIN__
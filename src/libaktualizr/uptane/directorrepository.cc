@@ -14,6 +14,13 @@ void DirectorRepository::resetMeta() {
   latest_targets = Targets();
 }
 
+void DirectorRepository::checkMetaExpired() {
+  if (rootExpired()) {
+    throw Uptane::ExpiredMetadata(RepositoryType::Director(), Role::ROOT);
+  }
+  checkTargetsExpired();
+}
+
 void DirectorRepository::checkTargetsExpired() {
   if (latest_targets.isExpired(TimeStamp::Now())) {
     throw Uptane::ExpiredMetadata(type, Role::TARGETS);
@@ -64,6 +71,8 @@ void DirectorRepository::verifyTargets(const std::string& targets_raw) {
 
 void DirectorRepository::checkMetaOffline(INvStorage& storage) {
   resetMeta();
+  // expired metadata doesn't need to be verified to be rejected
+  checkStoredExpiry(storage, {Role::Root(), Role::Targets()});
   // Load Director Root Metadata
   {
     std::string director_root;
@@ -110,18 +119,16 @@ void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher&
 
   // Update Director Targets Metadata
   {
-    std::string director_targets;
-
-    fetcher.fetchLatestRole(&director_targets, kMaxDirectorTargetsSize, RepositoryType::Director(), Role::Targets(),
-                            flow_control);
-    int remote_version = extractVersionUntrusted(director_targets);
-
     int local_version;
+    bool stored_valid = false;
+    // whether the verified Targets are the stored ones, as checkMetaOffline() would load them
+    bool verified_stored = false;
     std::string director_targets_stored;
     if (storage.loadNonRoot(&director_targets_stored, RepositoryType::Director(), Role::Targets())) {
       local_version = extractVersionUntrusted(director_targets_stored);
       try {
         verifyTargets(director_targets_stored);
+        stored_valid = true;
       } catch (const std::exception& e) {
         LOG_WARNING << "Unable to verify stored Director Targets metadata.";
       }
@@ -129,20 +136,46 @@ void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher&
       local_version = -1;
     }
 
-    verifyTargets(director_targets);
-
-    // TODO(OTA-4940): check if versions are equal but content is different. In
-    // that case, the member variable targets is updated, but it isn't stored in
-    // the database, which can cause some minor confusion.
-    if (local_version > remote_version) {
-      throw Uptane::SecurityException(RepositoryType::Director(), "Rollback attempt");
-    } else if (local_version < remote_version && !usePreviousTargets()) {
-      storage.storeNonRoot(director_targets, RepositoryType::Director(), Role::Targets());
+    // If the stored metadata is what the Director still serves, it has just
+    // been verified and there's nothing more to do.
+    HttpCacheValidators validators;
+    if (stored_valid) {
+      storage.loadMetaValidators(RepositoryType::Director(), Role::Targets(), &validators.etag,
+                                 &validators.last_modified);
+    }
+    std::string director_targets;
+    if (fetcher.fetchLatestRoleIfModified(&director_targets, kMaxDirectorTargetsSize, RepositoryType::Director(),
+                                          Role::Targets(), &validators, flow_control)) {
+      int remote_version = extractVersionUntrusted(director_targets);
+
+      verifyTargets(director_targets);
+
+      // TODO(OTA-4940): check if versions are equal but content is different. In
+      // that case, the member variable targets is updated, but it isn't stored in
+      // the database, which can cause some minor confusion.
+      if (local_version > remote_version) {
+        throw Uptane::SecurityException(RepositoryType::Director(), "Rollback attempt");
+      } else if (local_version < remote_version && !usePreviousTargets()) {
+        storage.storeNonRoot(director_targets, RepositoryType::Director(), Role::Targets());
+        storage.storeMetaValidators(RepositoryType::Director(), Role::Targets(), validators.etag,
+                                    validators.last_modified);
+        verified_stored = true;
+      } else if (director_targets == director_targets_stored) {
+        storage.storeMetaValidators(RepositoryType::Director(), Role::Targets(), validators.etag,
+                                    validators.last_modified);
+        verified_stored = true;
+      }
+    } else {
+      verified_stored = stored_valid;
     }
 
     checkTargetsExpired();
 
     targetsSanityCheck();
+
+    if (verified_stored) {
+      setVerified(storage);
+    }
   }
 }
 
@@ -166,15 +199,8 @@ bool DirectorRepository::matchTargetsWithImageTargets(
   if (image_targets == nullptr) {
     return false;
   }
-  const auto& image_target_array = image_targets->targets;
-  const auto& director_target_array = targets.targets;
-
-  for (const auto& director_target : director_target_array) {
-    auto found_it = std::find_if(
-        image_target_array.begin(), image_target_array.end(),
-        [&director_target](const Target& image_target) { return director_target.MatchTarget(image_target); });
-
-    if (found_it == image_target_array.end()) {
+  for (const auto& director_target : targets.targets) {
+    if (image_targets->findMatchingTarget(director_target) == nullptr) {
       return false;
     }
   }
@@ -32,6 +32,7 @@ class DirectorRepository : public RepositoryCommon {
   FRIEND_TEST(Director, EmptyTargets);
 
   void resetMeta();
+  void checkMetaExpired() override;
   void checkTargetsExpired();
   void targetsSanityCheck();
   bool usePreviousTargets() const;
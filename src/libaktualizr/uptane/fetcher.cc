@@ -1,24 +1,148 @@
 #include "fetcher.h"
 
+#include <algorithm>
+#include <future>
+
 #include "uptane/exceptions.h"
+#include "utilities/metrics.h"
 
 namespace Uptane {
 
 void Fetcher::fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
                         Version version, const api::FlowControlToken* flow_control) const {
-  std::string url = (repo == RepositoryType::Director()) ? director_server : repo_server;
-  if (role.IsDelegation()) {
-    url += "/delegations";
+  fetch(result, maxsize, repo, role, version, nullptr, flow_control);
+}
+
+bool Fetcher::fetchLatestRoleIfModified(std::string* result, int64_t maxsize, RepositoryType repo,
+                                        const Uptane::Role& role, HttpCacheValidators* validators,
+                                        const api::FlowControlToken* flow_control) const {
+  HttpResponse response = fetch(result, maxsize, repo, role, Version(), validators, flow_control);
+  if (response.isNotModified()) {
+    LOG_DEBUG << repo << " " << role << " metadata not modified";
+    result->clear();
+    return false;
   }
-  url += "/" + version.RoleFileName(role);
-  HttpResponse response = http->get(url, maxsize, flow_control);
+  *validators = std::move(response.validators);
+  return true;
+}
+
+std::vector<std::string> IMetadataFetcher::fetchRoleVersions(int64_t maxsize, RepositoryType repo,
+                                                             const Uptane::Role& role, int first, int count,
+                                                             const api::FlowControlToken* flow_control) const {
+  std::vector<std::string> results;
+  for (int version = first; version < first + count; ++version) {
+    std::string result;
+    try {
+      fetchRole(&result, maxsize, repo, role, Version(version), flow_control);
+    } catch (const std::exception& e) {
+      break;
+    }
+    results.push_back(std::move(result));
+  }
+  return results;
+}
+
+std::vector<std::string> Fetcher::fetchRoleVersions(int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                                                    int first, int count,
+                                                    const api::FlowControlToken* flow_control) const {
+  std::vector<std::future<std::string>> fetches;
+  fetches.reserve(static_cast<size_t>(std::max(count, 0)));
+  for (int version = first; version < first + count; ++version) {
+    fetches.push_back(std::async(std::launch::async, [this, maxsize, repo, role, version, flow_control]() {
+      std::string result;
+      fetch(&result, maxsize, repo, role, Version(version), nullptr, flow_control);
+      return result;
+    }));
+  }
+
+  std::vector<std::string> results;
+  for (auto& f : fetches) {
+    try {
+      results.push_back(f.get());
+    } catch (const std::exception& e) {
+      // the later ones are no use without this one, the futures wait for them
+      break;
+    }
+  }
+  return results;
+}
+
+int Fetcher::latestRootVersionHint(RepositoryType repo, const api::FlowControlToken* flow_control) const {
+  std::string result;
+  try {
+    fetch(&result, kMaxRootSize, repo, Role::Root(), Version(), nullptr, flow_control);
+  } catch (const std::exception& e) {
+    return -1;
+  }
+  return extractVersionUntrusted(result);
+}
+
+HttpResponse Fetcher::fetch(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                            Version version, const HttpCacheValidators* validators,
+                            const api::FlowControlToken* flow_control) const {
+  // delegations share a label, there can be any number of them
+  metrics::ScopedTimer timer(metrics::Registry::instance().histogram(
+      "aktualizr_metadata_fetch_seconds", "Time to fetch a metadata file, successfully or not",
+      {{"repo", repo.ToString()}, {"role", role.IsDelegation() ? "delegation" : role.ToString()}}));
+  HttpResponse response;
+  if (repo == RepositoryType::Director() || !repo_mirrors_->hasMirrors()) {
+    response = fetchFrom((repo == RepositoryType::Director()) ? director_server : repo_server, result, maxsize, role,
+                         version, validators, flow_control);
+  } else {
+    // The Image repository metadata is signed, any mirror will do. The next
+    // one is tried when one fails, a missing file is an answer though: new
+    // Root versions are looked for that way.
+    const std::vector<std::string> servers = repo_mirrors_->ranked(0);
+    for (size_t i = 0; i < servers.size(); ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      response = fetchFrom(servers[i], result, maxsize, role, version, validators, flow_control);
+      if (flow_control != nullptr && flow_control->hasAborted()) {
+        break;
+      }
+      const bool ok = response.isOk() || response.http_status_code == 404;
+      repo_mirrors_->record(
+          servers[i], ok, result->size(),
+          std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start));
+      if (ok) {
+        break;
+      }
+      if (i + 1 < servers.size()) {
+        LOG_WARNING << "Could not fetch " << role << " metadata from " << servers[i] << ": " << response.getStatusStr()
+                    << ", trying " << servers[i + 1];
+      }
+    }
+  }
+
   if (flow_control != nullptr && flow_control->hasAborted()) {
     throw Uptane::LocallyAborted(repo);
   }
   if (!response.isOk()) {
     throw Uptane::MetadataFetchFailure(repo, role.ToString());
   }
-  *result = response.body;
+  // there is nothing to compare to without validators
+  if (response.isNotModified() && (validators == nullptr || validators->empty())) {
+    throw Uptane::MetadataFetchFailure(repo, role.ToString());
+  }
+  return response;
+}
+
+HttpResponse Fetcher::fetchFrom(const std::string& server, std::string* result, int64_t maxsize,
+                                const Uptane::Role& role, Version version, const HttpCacheValidators* validators,
+                                const api::FlowControlToken* flow_control) const {
+  std::string url = server;
+  if (role.IsDelegation()) {
+    url += "/delegations";
+  }
+  url += "/" + version.RoleFileName(role);
+  // collect the body right in the result, large Targets metadata would
+  // otherwise be copied around several times
+  result->clear();
+  const HttpBodySink sink = [result](const char* data, size_t size) {
+    result->append(data, size);
+    return true;
+  };
+  return (validators != nullptr) ? http->getStreamIfModified(url, maxsize, flow_control, *validators, sink)
+                                 : http->getStream(url, maxsize, flow_control, sink);
 }
 
 }  // namespace Uptane
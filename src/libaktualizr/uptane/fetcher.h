@@ -1,8 +1,12 @@
 #ifndef UPTANE_FETCHER_H_
 #define UPTANE_FETCHER_H_
 
+#include <string>
+#include <vector>
+
 #include "http/httpinterface.h"
 #include "libaktualizr/config.h"
+#include "mirrorselector.h"
 #include "tuf.h"
 #include "utilities/flow_control.h"
 
@@ -47,6 +51,46 @@ class IMetadataFetcher {
     fetchRole(result, maxsize, repo, role, Version(), flow_control);
   }
 
+  /**
+   * Fetch the latest version of a role, unless it is still the same as at a
+   * previous fetch.
+   *
+   * Fetchers that can't tell always fetch the role and return empty
+   * validators.
+   * @param validators The validators of the previous fetch (may be empty) on
+   * input, the ones of this fetch on output. Unchanged if the role is.
+   * @return false if the role didn't change; `result` is empty then.
+   * @throws The same exceptions as fetchRole()
+   */
+  virtual bool fetchLatestRoleIfModified(std::string* result, int64_t maxsize, RepositoryType repo,
+                                         const Uptane::Role& role, HttpCacheValidators* validators,
+                                         const api::FlowControlToken* flow_control) const {
+    fetchLatestRole(result, maxsize, repo, role, flow_control);
+    *validators = HttpCacheValidators();
+    return true;
+  }
+
+  /**
+   * Fetch up to `count` consecutive versions of a role from `first` on,
+   * stopping at the first one that can't be fetched. Fetchers may fetch them
+   * in parallel, but they are returned in order.
+   * @return the versions fetched, possibly none
+   */
+  virtual std::vector<std::string> fetchRoleVersions(int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                                                     int first, int count,
+                                                     const api::FlowControlToken* flow_control) const;
+
+  /**
+   * Version of the latest Root metadata, as claimed by the server without any
+   * verification, so only good as a hint.
+   * @return -1 if the fetcher can't tell
+   */
+  virtual int latestRootVersionHint(RepositoryType repo, const api::FlowControlToken* flow_control) const {
+    (void)repo;
+    (void)flow_control;
+    return -1;
+  }
+
  protected:
   IMetadataFetcher() = default;
   IMetadataFetcher(IMetadataFetcher&&) = default;
@@ -55,20 +99,49 @@ class IMetadataFetcher {
 class Fetcher : public IMetadataFetcher {
  public:
   Fetcher(const Config& config_in, std::shared_ptr<HttpInterface> http_in)
-      : Fetcher(config_in.uptane.repo_server, config_in.uptane.director_server, std::move(http_in)) {}
-  Fetcher(std::string repo_server_in, std::string director_server_in, std::shared_ptr<HttpInterface> http_in)
+      : Fetcher(config_in.uptane.repo_server, config_in.uptane.director_server, std::move(http_in),
+                config_in.uptane.repo_mirrors) {}
+  Fetcher(std::string repo_server_in, std::string director_server_in, std::shared_ptr<HttpInterface> http_in,
+          const std::string& repo_mirrors = "")
       : http(std::move(http_in)),
         repo_server(std::move(repo_server_in)),
-        director_server(std::move(director_server_in)) {}
+        director_server(std::move(director_server_in)),
+        repo_mirrors_(std::make_shared<MirrorSelector>(repo_server, repo_mirrors)) {}
   void fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role, Version version,
                  const api::FlowControlToken* flow_control) const override;
+  bool fetchLatestRoleIfModified(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                                 HttpCacheValidators* validators,
+                                 const api::FlowControlToken* flow_control) const override;
+  // all at once, over the connection pool of the HTTP client
+  std::vector<std::string> fetchRoleVersions(int64_t maxsize, RepositoryType repo, const Uptane::Role& role, int first,
+                                             int count, const api::FlowControlToken* flow_control) const override;
+  // from the unversioned root.json
+  int latestRootVersionHint(RepositoryType repo, const api::FlowControlToken* flow_control) const override;
 
   std::string getRepoServer() const { return repo_server; }
+  // the Image repository server and its mirrors, best first for a file of
+  // `size` bytes
+  std::vector<std::string> getRepoServers(uint64_t size) const { return repo_mirrors_->ranked(size); }
+  // measure of a transfer from one of them
+  void recordRepoTransfer(const std::string& server, bool ok, uint64_t bytes,
+                          std::chrono::milliseconds elapsed) const {
+    repo_mirrors_->record(server, ok, bytes, elapsed);
+  }
 
  private:
+  // a conditional request if `validators` is set
+  HttpResponse fetch(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                     Version version, const HttpCacheValidators* validators,
+                     const api::FlowControlToken* flow_control) const;
+  // one request, the response is not checked
+  HttpResponse fetchFrom(const std::string& server, std::string* result, int64_t maxsize, const Uptane::Role& role,
+                         Version version, const HttpCacheValidators* validators,
+                         const api::FlowControlToken* flow_control) const;
+
   std::shared_ptr<HttpInterface> http;
   std::string repo_server;
   std::string director_server;
+  std::shared_ptr<MirrorSelector> repo_mirrors_;
 };
 
 }  // namespace Uptane
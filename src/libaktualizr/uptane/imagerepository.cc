@@ -13,6 +13,13 @@ void ImageRepository::resetMeta() {
   targets.reset();
   snapshot = Snapshot();
   timestamp = TimestampMeta();
+  verified_timestamp_raw.clear();
+}
+
+bool ImageRepository::metaExpired() const {
+  const TimeStamp now(TimeStamp::Now());
+  return rootExpired() || timestamp.isExpired(now) || snapshot.isExpired(now) || targets == nullptr ||
+         targets->isExpired(now);
 }
 
 void ImageRepository::verifyTimestamp(const std::string& timestamp_raw) {
@@ -26,6 +33,15 @@ void ImageRepository::verifyTimestamp(const std::string& timestamp_raw) {
   }
 }
 
+void ImageRepository::checkMetaExpired() {
+  if (rootExpired()) {
+    throw Uptane::ExpiredMetadata(RepositoryType::Image(), Role::Root().ToString());
+  }
+  checkTimestampExpired();
+  checkSnapshotExpired();
+  checkTargetsExpired();
+}
+
 void ImageRepository::checkTimestampExpired() {
   if (timestamp.isExpired(TimeStamp::Now())) {
     throw Uptane::ExpiredMetadata(type, Role::TIMESTAMP);
@@ -118,9 +134,9 @@ void ImageRepository::fetchTargets(INvStorage& storage, const IMetadataFetcher&
 
   fetcher.fetchLatestRole(&image_targets, targets_size, RepositoryType::Image(), targets_role, flow_control);
 
-  const int remote_version = extractVersionUntrusted(image_targets);
-
+  // the metadata can be large, only parse it once, while verifying it
   verifyTargets(image_targets, false);
+  const int remote_version = targets->version();
 
   if (local_version > remote_version) {
     throw Uptane::SecurityException(RepositoryType::Image(), "Rollback attempt");
@@ -130,13 +146,30 @@ void ImageRepository::fetchTargets(INvStorage& storage, const IMetadataFetcher&
 }
 
 void ImageRepository::verifyRoleHashes(const std::string& role_data, const Uptane::Role& role, bool prefetch) const {
-  const std::string canonical = Utils::jsonToCanonicalStr(Utils::parseJSON(role_data));
+  verifyRoleHashes(role_data, nullptr, role, prefetch);
+}
+
+// role_json, if given, is role_data already parsed.
+void ImageRepository::verifyRoleHashes(const std::string& role_data, const Json::Value* role_json,
+                                       const Uptane::Role& role, bool prefetch) const {
+  // The metadata is usually sent in canonical form already. If the raw data
+  // matches, there is no need to build the canonical form.
+  std::string canonical;
+  bool have_canonical = false;
+  auto canonicalData = [&]() -> const std::string& {
+    if (!have_canonical) {
+      canonical = Utils::jsonToCanonicalStr(role_json != nullptr ? *role_json : Utils::parseJSON(role_data));
+      have_canonical = true;
+    }
+    return canonical;
+  };
   // Hashes are not required in snapshot metadata. If present, however, we may as well check them.
   // This provides no security benefit, but may help with fault detection.
   for (const auto& it : snapshot.role_hashes(role)) {
     switch (it.type()) {
       case Hash::Type::kSha256:
-        if (Hash(Hash::Type::kSha256, Crypto::sha256digestHex(canonical)) != it) {
+        if (Hash(Hash::Type::kSha256, Crypto::sha256digestHex(role_data)) != it &&
+            Hash(Hash::Type::kSha256, Crypto::sha256digestHex(canonicalData())) != it) {
           // If prefetch is true, it means we're checking a local copy of the metadata.
           // Failures in that case just indicate we need to refresh it from the server, so
           // we only actually log the error if the metadata comes directly from the server.
@@ -148,7 +181,8 @@ void ImageRepository::verifyRoleHashes(const std::string& role_data, const Uptan
         }
         break;
       case Hash::Type::kSha512:
-        if (Hash(Hash::Type::kSha512, Crypto::sha512digestHex(canonical)) != it) {
+        if (Hash(Hash::Type::kSha512, Crypto::sha512digestHex(role_data)) != it &&
+            Hash(Hash::Type::kSha512, Crypto::sha512digestHex(canonicalData())) != it) {
           if (!prefetch) {
             LOG_ERROR << "Hash verification for " << role << " metadata failed";
           }
@@ -166,16 +200,38 @@ int ImageRepository::getRoleVersion(const Uptane::Role& role) const { return sna
 
 int64_t ImageRepository::getRoleSize(const Uptane::Role& role) const { return snapshot.role_size(role); }
 
+std::shared_ptr<const Uptane::Targets> ImageRepository::getCachedDelegation(const std::string& path) const {
+  std::lock_guard<std::mutex> guard(delegations_mutex);
+  if (targets == nullptr || delegations_targets != targets || delegations_snapshot_version != snapshot.version()) {
+    return nullptr;
+  }
+  auto it = delegations.find(path);
+  return (it != delegations.end()) ? it->second : nullptr;
+}
+
+void ImageRepository::cacheDelegation(const std::string& path,
+                                      std::shared_ptr<const Uptane::Targets> delegation) const {
+  std::lock_guard<std::mutex> guard(delegations_mutex);
+  if (targets == nullptr) {
+    return;
+  }
+  // the Snapshot or Targets metadata changed since the others were verified
+  if (delegations_targets != targets || delegations_snapshot_version != snapshot.version()) {
+    delegations.clear();
+    delegations_targets = targets;
+    delegations_snapshot_version = snapshot.version();
+  }
+  delegations[path] = std::move(delegation);
+}
+
 void ImageRepository::verifyTargets(const std::string& targets_raw, bool prefetch) {
   try {
-    verifyRoleHashes(targets_raw, Uptane::Role::Targets(), prefetch);
-
-    auto targets_json = Utils::parseJSON(targets_raw);
+    const Json::Value targets_json = Utils::parseJSON(targets_raw);
+    verifyRoleHashes(targets_raw, &targets_json, Uptane::Role::Targets(), prefetch);
 
     // Verify the signature:
     auto signer = std::make_shared<MetaWithKeys>(root);
-    targets = std::make_shared<Uptane::Targets>(
-        Targets(RepositoryType::Image(), Uptane::Role::Targets(), targets_json, signer));
+    targets = std::make_shared<Uptane::Targets>(RepositoryType::Image(), Uptane::Role::Targets(), targets_json, signer);
 
     if (targets->version() != snapshot.role_version(Uptane::Role::Targets())) {
       throw Uptane::VersionMismatch(RepositoryType::Image(), Uptane::Role::TARGETS);
@@ -216,40 +272,94 @@ void ImageRepository::checkTargetsExpired() {
 
 void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fetcher,
                                  const api::FlowControlToken* flow_control) {
+  // The metadata verified by the previous update is still good as long as the
+  // Timestamp and the Root stay the same.
+  const std::string prev_timestamp_raw = verified_timestamp_raw;
+  const int prev_root_version = rootVersion();
+  TimestampMeta prev_timestamp = std::move(timestamp);
+  Snapshot prev_snapshot = std::move(snapshot);
+  std::shared_ptr<Uptane::Targets> prev_targets = std::move(targets);
   resetMeta();
 
   updateRoot(storage, fetcher, RepositoryType::Image());
 
   // Update Image repo Timestamp metadata
+  std::string image_timestamp_current;
+  bool unchanged = false;
   {
-    std::string image_timestamp;
-
-    fetcher.fetchLatestRole(&image_timestamp, kMaxTimestampSize, RepositoryType::Image(), Role::Timestamp());
-    int remote_version = extractVersionUntrusted(image_timestamp);
-
     int local_version;
     std::string image_timestamp_stored;
+    HttpCacheValidators validators;
     if (storage.loadNonRoot(&image_timestamp_stored, RepositoryType::Image(), Role::Timestamp())) {
       local_version = extractVersionUntrusted(image_timestamp_stored);
+      storage.loadMetaValidators(RepositoryType::Image(), Role::Timestamp(), &validators.etag,
+                                 &validators.last_modified);
     } else {
       local_version = -1;
     }
 
-    const auto timestamp_stored_signature{timestamp.isInitialized() ? timestamp.signature() : ""};
-    verifyTimestamp(image_timestamp);
+    // only trust the previous update if the storage still has what it stored
+    unchanged = prev_targets != nullptr && rootVersion() == prev_root_version && !prev_timestamp_raw.empty() &&
+                image_timestamp_stored == prev_timestamp_raw;
+
+    std::string image_timestamp;
+    bool modified = fetcher.fetchLatestRoleIfModified(&image_timestamp, kMaxTimestampSize, RepositoryType::Image(),
+                                                      Role::Timestamp(), &validators, nullptr);
+    if (!modified && unchanged) {
+      // the stored copy is still the latest one, and it has been verified
+      timestamp = std::move(prev_timestamp);
+    } else if (!modified) {
+      // the stored copy is still the latest one
+      try {
+        verifyTimestamp(image_timestamp_stored);
+      } catch (const Uptane::Exception& e) {
+        LOG_WARNING << "Fetching Image repo Timestamp metadata again because the stored copy is not valid anymore";
+        validators = HttpCacheValidators();
+        modified = fetcher.fetchLatestRoleIfModified(&image_timestamp, kMaxTimestampSize, RepositoryType::Image(),
+                                                     Role::Timestamp(), &validators, nullptr);
+      }
+    }
+    if (modified) {
+      int remote_version = extractVersionUntrusted(image_timestamp);
 
-    if (local_version > remote_version) {
-      throw Uptane::SecurityException(RepositoryType::Image(), "Rollback attempt");
-    } else if (local_version < remote_version || timestamp_stored_signature != timestamp.signature()) {
+      const auto timestamp_stored_signature{timestamp.isInitialized() ? timestamp.signature() : ""};
+      verifyTimestamp(image_timestamp);
+
+      if (local_version > remote_version) {
+        throw Uptane::SecurityException(RepositoryType::Image(), "Rollback attempt");
+      }
       // If local and remote versions are the same but their content actually differ then store/update the metadata in
       // DB We assume that the metadata contains just one signature, otherwise the comparison might not always work
       // correctly.
-      storage.storeNonRoot(image_timestamp, RepositoryType::Image(), Role::Timestamp());
+      const bool store = local_version < remote_version || timestamp_stored_signature != timestamp.signature();
+      if (store) {
+        storage.storeNonRoot(image_timestamp, RepositoryType::Image(), Role::Timestamp());
+      }
+      // the validators are only good for the stored copy
+      if (store || image_timestamp == image_timestamp_stored) {
+        storage.storeMetaValidators(RepositoryType::Image(), Role::Timestamp(), validators.etag,
+                                    validators.last_modified);
+      }
     }
+    image_timestamp_current = modified ? std::move(image_timestamp) : std::move(image_timestamp_stored);
 
     checkTimestampExpired();
   }
 
+  if (unchanged && image_timestamp_current == prev_timestamp_raw) {
+    // nothing changed since the previous update, Snapshot and Targets don't
+    // have to be loaded and verified again
+    LOG_DEBUG << "Image repo Timestamp metadata unchanged, reusing verified Snapshot and Targets metadata";
+    ++timestamp_unchanged_count;
+    snapshot = std::move(prev_snapshot);
+    targets = std::move(prev_targets);
+    checkSnapshotExpired();
+    checkTargetsExpired();
+    verified_timestamp_raw = std::move(image_timestamp_current);
+    setVerified(storage);
+    return;
+  }
+
   // Update Image repo Snapshot metadata
   {
     // First check if we already have the latest version according to the
@@ -307,10 +417,15 @@ void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fe
 
     checkTargetsExpired();
   }
+
+  verified_timestamp_raw = std::move(image_timestamp_current);
+  setVerified(storage);
 }
 
 void ImageRepository::checkMetaOffline(INvStorage& storage) {
   resetMeta();
+  // expired metadata doesn't need to be verified to be rejected
+  checkStoredExpiry(storage, {Role::Root(), Role::Timestamp(), Role::Snapshot(), Role::Targets()});
   // Load Image repo Root metadata
   {
     std::string image_root;
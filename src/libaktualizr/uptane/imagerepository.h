@@ -1,7 +1,9 @@
 #ifndef IMAGE_REPOSITORY_H_
 #define IMAGE_REPOSITORY_H_
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include "uptanerepository.h"
@@ -27,14 +29,27 @@ class ImageRepository : public RepositoryCommon {
   std::shared_ptr<const Uptane::Targets> getTargets() const { return targets; }
 
   void verifyRoleHashes(const std::string& role_data, const Uptane::Role& role, bool prefetch) const;
+  void verifyRoleHashes(const std::string& role_data, const Json::Value* role_json, const Uptane::Role& role,
+                        bool prefetch) const;
   int getRoleVersion(const Uptane::Role& role) const;
   int64_t getRoleSize(const Uptane::Role& role) const;
+  // Delegations verified for the current Snapshot and Targets metadata, by
+  // their path in the delegation tree, like "targets/a/b": the same role can
+  // be delegated by several parents, with different keys.
+  std::shared_ptr<const Uptane::Targets> getCachedDelegation(const std::string& path) const;
+  void cacheDelegation(const std::string& path, std::shared_ptr<const Uptane::Targets> delegation) const;
 
   void checkMetaOffline(INvStorage& storage) override;
   void updateMeta(INvStorage& storage, const IMetadataFetcher& fetcher,
                   const api::FlowControlToken* flow_control) override;
+  // number of updateMeta() calls that reused the Snapshot and Targets
+  // metadata of the previous one because the Timestamp didn't change
+  uint64_t timestampUnchangedCount() const { return timestamp_unchanged_count; }
+  // whether any of the metadata verified by updateMeta() has expired since
+  bool metaExpired() const;
 
  private:
+  void checkMetaExpired() override;
   void checkTimestampExpired();
   void checkSnapshotExpired();
   int64_t snapshotSize() const { return timestamp.snapshot_size(); }
@@ -47,6 +62,16 @@ class ImageRepository : public RepositoryCommon {
   std::shared_ptr<Uptane::Targets> targets;
   Uptane::TimestampMeta timestamp;
   Uptane::Snapshot snapshot;
+  // Timestamp metadata the current Snapshot and Targets were verified with by
+  // updateMeta(), empty if they weren't
+  std::string verified_timestamp_raw;
+  uint64_t timestamp_unchanged_count{0};
+
+  mutable std::mutex delegations_mutex;
+  mutable std::map<std::string, std::shared_ptr<const Uptane::Targets>> delegations;
+  // what the cached delegations were verified for
+  mutable std::shared_ptr<const Uptane::Targets> delegations_targets;
+  mutable int delegations_snapshot_version{-1};
 };
 
 }  // namespace Uptane
@@ -1,14 +1,25 @@
 #include "iterator.h"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+
 #include "libaktualizr/types.h"
 #include "storage/invstorage.h"
 #include "uptane/exceptions.h"
 
 namespace Uptane {
 
-Targets getTrustedDelegation(const Role &delegate_role, const Targets &parent_targets,
-                             const ImageRepository &image_repo, INvStorage &storage, IMetadataFetcher &fetcher,
-                             const bool offline, const api::FlowControlToken *flow_control) {
+std::shared_ptr<const Targets> getTrustedDelegation(const Role &delegate_role, const Targets &parent_targets,
+                                                    const std::string &parent_path, const ImageRepository &image_repo,
+                                                    INvStorage &storage, IMetadataFetcher &fetcher, const bool offline,
+                                                    const api::FlowControlToken *flow_control) {
+  const std::string path = parent_path + "/" + delegate_role.ToString();
+  auto cached = image_repo.getCachedDelegation(path);
+  if (cached != nullptr) {
+    return cached;
+  }
+
   std::string delegation_meta;
   auto version_in_snapshot = image_repo.getRoleVersion(delegate_role);
 
@@ -57,18 +68,95 @@ Targets getTrustedDelegation(const Role &delegate_role, const Targets &parent_ta
     storage.storeDelegation(delegation_meta, delegate_role);
   }
 
-  return *delegation;
+  image_repo.cacheDelegation(path, delegation);
+  return delegation;
+}
+
+void prefetchDelegations(const Targets &parent_targets, const std::string &parent_path,
+                         const ImageRepository &image_repo, INvStorage &storage, const IMetadataFetcher &fetcher,
+                         const size_t parallelism, const api::FlowControlToken *flow_control) {
+  std::vector<Role> roles;
+  for (const auto &name : parent_targets.delegated_role_names_) {
+    const Role role(name, true);
+    if (image_repo.getCachedDelegation(parent_path + "/" + name) != nullptr) {
+      continue;
+    }
+    std::string stored;
+    // a newer stored version is a rollback attempt, getTrustedDelegation() deals with it
+    if (!storage.loadDelegation(&stored, role) || extractVersionUntrusted(stored) < image_repo.getRoleVersion(role)) {
+      roles.push_back(role);
+    }
+  }
+  if (roles.size() < 2 || parallelism < 2) {
+    return;
+  }
+
+  // Fetch like downloadImages() does: each worker picks the next role until
+  // none are left. Only the fetching runs concurrently.
+  std::vector<std::string> fetched(roles.size());
+  std::atomic<size_t> next_role{0};
+  auto worker = [&roles, &fetched, &next_role, &fetcher, flow_control]() {
+    for (size_t i = next_role++; i < roles.size(); i = next_role++) {
+      if (flow_control != nullptr && flow_control->hasAborted()) {
+        return;
+      }
+      try {
+        fetcher.fetchLatestRole(&fetched[i], Uptane::kMaxImageTargetsSize, RepositoryType::Image(), roles[i],
+                                flow_control);
+      } catch (const std::exception &e) {
+        LOG_DEBUG << "Could not prefetch " << roles[i] << ": " << e.what();
+        fetched[i].clear();
+      }
+    }
+  };
+  std::vector<std::future<void>> workers;
+  const size_t workers_num = std::min(parallelism, roles.size());
+  for (size_t i = 1; i < workers_num; ++i) {
+    workers.push_back(std::async(std::launch::async, worker));
+  }
+  worker();
+  for (auto &w : workers) {
+    w.get();
+  }
+
+  for (size_t i = 0; i < roles.size(); ++i) {
+    if (fetched[i].empty()) {
+      continue;
+    }
+    try {
+      image_repo.verifyRoleHashes(fetched[i], roles[i], true);
+      auto delegation = ImageRepository::verifyDelegation(fetched[i], roles[i], parent_targets);
+      if (delegation == nullptr || delegation->version() != image_repo.getRoleVersion(roles[i])) {
+        LOG_DEBUG << "Prefetched " << roles[i] << " metadata does not match the snapshot";
+        continue;
+      }
+      storage.storeDelegation(fetched[i], roles[i]);
+    } catch (const std::exception &e) {
+      LOG_DEBUG << "Prefetched " << roles[i] << " metadata is invalid: " << e.what();
+    }
+  }
+}
+
+// "targets/a/b" for the delegation b of the delegation a
+static std::string treePath(const LazyTargetsList::DelegatedTargetTreeNode *node) {
+  std::string path = node->role.ToString();
+  for (node = node->parent; node != nullptr; node = node->parent) {
+    path.insert(0, node->role.ToString() + "/");
+  }
+  return path;
 }
 
 LazyTargetsList::DelegationIterator::DelegationIterator(const ImageRepository &repo,
                                                         std::shared_ptr<INvStorage> storage,
                                                         std::shared_ptr<Fetcher> fetcher,
-                                                        const api::FlowControlToken *flow_control, bool is_end)
+                                                        const api::FlowControlToken *flow_control, bool is_end,
+                                                        size_t prefetch)
     : repo_{repo},
       storage_{std::move(storage)},
       fetcher_{std::move(fetcher)},
       flow_control_{flow_control},
-      is_end_{is_end} {
+      is_end_{is_end},
+      prefetch_{prefetch} {
   tree_ = std::make_shared<DelegatedTargetTreeNode>();
   tree_node_ = tree_.get();
 
@@ -91,16 +179,18 @@ void LazyTargetsList::DelegationIterator::renewTargetsData() {
     }
 
     auto parent_targets = repo_.getTargets();
+    std::string parent_path = Role::Targets().ToString();
     while (!indices.empty()) {
       auto idx = indices.top();
       indices.pop();
 
       auto fetched_role = Role(parent_targets->delegated_role_names_[idx], true);
-      parent_targets = std::make_shared<const Targets>(
-          getTrustedDelegation(fetched_role, *parent_targets, repo_, *storage_, *fetcher_, false, flow_control_));
+      parent_targets = getTrustedDelegation(fetched_role, *parent_targets, parent_path, repo_, *storage_, *fetcher_,
+                                            false, flow_control_);
+      parent_path += "/" + fetched_role.ToString();
     }
-    cur_targets_ = std::make_shared<Targets>(
-        getTrustedDelegation(role, *parent_targets, repo_, *storage_, *fetcher_, false, flow_control_));
+    cur_targets_ =
+        getTrustedDelegation(role, *parent_targets, parent_path, repo_, *storage_, *fetcher_, false, flow_control_);
   }
 }
 
@@ -165,6 +255,10 @@ LazyTargetsList::DelegationIterator LazyTargetsList::DelegationIterator::operato
 
       tree_node_->children.push_back(new_node);
     }
+
+    if (prefetch_ > 1) {
+      prefetchDelegations(*cur_targets_, treePath(tree_node_), repo_, *storage_, *fetcher_, prefetch_, flow_control_);
+    }
   }
 
   if (children_idx_ < tree_node_->children.size()) {
@@ -7,10 +7,33 @@
 
 namespace Uptane {
 
-Targets getTrustedDelegation(const Role &delegate_role, const Targets &parent_targets,
-                             const ImageRepository &image_repo, INvStorage &storage, IMetadataFetcher &fetcher,
-                             bool offline, const api::FlowControlToken *flow_control);
+/**
+ * The delegation of `parent_targets` to `delegate_role`, verified. It is kept
+ * in `image_repo` until the Snapshot or Targets metadata change, the parent is
+ * told apart by its path in the delegation tree, `parent_path`, "targets" for
+ * the top-level Targets.
+ */
+std::shared_ptr<const Targets> getTrustedDelegation(const Role &delegate_role, const Targets &parent_targets,
+                                                    const std::string &parent_path, const ImageRepository &image_repo,
+                                                    INvStorage &storage, IMetadataFetcher &fetcher, bool offline,
+                                                    const api::FlowControlToken *flow_control);
 
+/**
+ * Fetch the delegations of `parent_targets` that are not stored yet, up to
+ * `parallelism` at once, and store the ones that verify against the snapshot
+ * and the parent. Errors are only logged: getTrustedDelegation() fetches the
+ * role again when it gets to it, and reports them then.
+ */
+void prefetchDelegations(const Targets &parent_targets, const std::string &parent_path,
+                         const ImageRepository &image_repo, INvStorage &storage, const IMetadataFetcher &fetcher,
+                         size_t parallelism, const api::FlowControlToken *flow_control);
+
+/**
+ * All the targets of the Image repo, in delegation tree order. Delegated
+ * targets are only fetched when the iteration gets to them. With a
+ * `prefetch` above 1, the sibling delegations of a role are fetched together
+ * though, that many at once, when the iteration gets to the first of them.
+ */
 class LazyTargetsList {
  public:
   struct DelegatedTargetTreeNode {
@@ -30,7 +53,7 @@ class LazyTargetsList {
    public:
     explicit DelegationIterator(const ImageRepository &repo, std::shared_ptr<INvStorage> storage,
                                 std::shared_ptr<Uptane::Fetcher> fetcher, const api::FlowControlToken *flow_control,
-                                bool is_end = false);
+                                bool is_end = false, size_t prefetch = 1);
     DelegationIterator operator++();
     bool operator==(const DelegationIterator &other) const;
     bool operator!=(const DelegationIterator &other) const { return !(*this == other); }
@@ -51,19 +74,26 @@ class LazyTargetsList {
     bool terminating_{false};
     int level_{0};
     bool is_end_;
+    size_t prefetch_;
   };
 
   explicit LazyTargetsList(const ImageRepository &repo, std::shared_ptr<INvStorage> storage,
-                           std::shared_ptr<Fetcher> fetcher, const api::FlowControlToken *flow_control)
-      : repo_{repo}, storage_{std::move(storage)}, fetcher_{std::move(fetcher)}, flow_control_{flow_control} {}
-  DelegationIterator begin() { return DelegationIterator(repo_, storage_, fetcher_, flow_control_); }
-  DelegationIterator end() { return DelegationIterator(repo_, storage_, fetcher_, flow_control_, true); }
+                           std::shared_ptr<Fetcher> fetcher, const api::FlowControlToken *flow_control,
+                           size_t prefetch = 1)
+      : repo_{repo},
+        storage_{std::move(storage)},
+        fetcher_{std::move(fetcher)},
+        flow_control_{flow_control},
+        prefetch_{prefetch} {}
+  DelegationIterator begin() { return DelegationIterator(repo_, storage_, fetcher_, flow_control_, false, prefetch_); }
+  DelegationIterator end() { return DelegationIterator(repo_, storage_, fetcher_, flow_control_, true, prefetch_); }
 
  private:
   const ImageRepository &repo_;
   std::shared_ptr<INvStorage> storage_;
   std::shared_ptr<Uptane::Fetcher> fetcher_;
   const api::FlowControlToken *flow_control_;
+  size_t prefetch_;
 };
 }  // namespace Uptane
 
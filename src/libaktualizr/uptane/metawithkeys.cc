@@ -1,5 +1,10 @@
 #include "uptane/tuf.h"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+
 #include <boost/algorithm/string/case_conv.hpp>
 
 #include "logging/logging.h"
@@ -76,8 +81,10 @@ void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const R
   const std::string canonical = Utils::jsonToCanonicalStr(signed_object["signed"]);
   // NOLINTNEXTLINE(performance-unnecessary-copy-initialization)
   const Json::Value signatures = signed_object["signatures"];
-  int valid_signatures = 0;
 
+  // Check the form of all the signatures first, then verify the ones by keys
+  // of the role.
+  std::vector<std::pair<const PublicKey *, std::string>> candidates;
   std::set<std::string> used_keyids;
   for (auto sig = signatures.begin(); sig != signatures.end(); ++sig) {
     const std::string keyid = (*sig)["keyid"].asString();
@@ -102,17 +109,14 @@ void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const R
       LOG_WARNING << "KeyId " << keyid << " is not valid to sign for this role (" << role << ").";
       continue;
     }
-    const std::string signature = (*sig)["sig"].asString();
-    if (keys_[keyid].VerifySignature(signature, canonical)) {
-      valid_signatures++;
-    } else {
-      LOG_WARNING << "Signature was present but invalid: " << signature << " with KeyId: " << keyid;
-    }
+    candidates.emplace_back(&keys_[keyid], (*sig)["sig"].asString());
   }
+
   const int64_t threshold = thresholds_for_role_[role];
   if (threshold < kMinSignatures || kMaxSignatures < threshold) {
     throw IllegalThreshold(repo, "Invalid signature threshold");
   }
+  const auto valid_signatures = static_cast<int64_t>(verifySignatures(candidates, canonical, threshold));
   // One signature and it is bad: throw bad key ID.
   // Multiple signatures but not enough good ones to pass threshold: throw unmet threshold.
   if (signatures.size() == 1 && valid_signatures == 0) {
@@ -122,3 +126,39 @@ void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const R
     throw UnmetThreshold(repo, role.ToString());
   }
 }
+
+size_t Uptane::MetaWithKeys::verifySignatures(const std::vector<std::pair<const PublicKey *, std::string>> &candidates,
+                                              const std::string &canonical, const int64_t threshold) {
+  // Each worker verifies the next signature until the threshold is met or
+  // can't be met anymore by the signatures left, like downloadImages() picks
+  // the next Target.
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> valid{0};
+  std::atomic<size_t> invalid{0};
+  const auto threshold_size = static_cast<size_t>(threshold);
+  auto decided = [&]() { return valid >= threshold_size || candidates.size() - invalid < threshold_size; };
+  auto worker = [&]() {
+    for (size_t i = next++; i < candidates.size() && !decided(); i = next++) {
+      const std::string &signature = candidates[i].second;
+      if (candidates[i].first->VerifySignature(signature, canonical)) {
+        ++valid;
+      } else {
+        LOG_WARNING << "Signature was present but invalid: " << signature
+                    << " with KeyId: " << candidates[i].first->KeyId();
+        ++invalid;
+      }
+    }
+  };
+
+  std::vector<std::future<void>> workers;
+  const size_t workers_num =
+      std::min<size_t>({kMaxVerifyThreads, std::max(std::thread::hardware_concurrency(), 1U), candidates.size()});
+  for (size_t i = 1; i < workers_num; ++i) {
+    workers.push_back(std::async(std::launch::async, worker));
+  }
+  worker();
+  for (auto &w : workers) {
+    w.get();
+  }
+  return valid;
+}
@@ -0,0 +1,92 @@
+#include "mirrorselector.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include <boost/algorithm/string.hpp>
+
+namespace Uptane {
+
+// weight of the latest measure in the averages
+static constexpr double kAlpha = 0.3;
+
+static void average(double* value, double sample) {
+  *value = (*value < 0) ? sample : (1 - kAlpha) * *value + kAlpha * sample;
+}
+
+MirrorSelector::MirrorSelector(const std::string& server, const std::string& mirrors) {
+  servers_.push_back(server);
+  std::vector<std::string> urls;
+  boost::split(urls, mirrors, boost::is_any_of(","));
+  for (auto& url : urls) {
+    boost::trim(url);
+    boost::trim_right_if(url, boost::is_any_of("/"));
+    if (!url.empty() && std::find(servers_.begin(), servers_.end(), url) == servers_.end()) {
+      servers_.push_back(url);
+    }
+  }
+}
+
+std::vector<std::string> MirrorSelector::ranked(uint64_t size) const {
+  if (servers_.size() == 1) {
+    return servers_;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> guard(m_);
+
+  // servers with an unknown throughput are assumed to be as fast as the others
+  double throughput_sum = 0;
+  int throughput_count = 0;
+  for (const auto& s : stats_) {
+    if (s.second.bytes_per_ms > 0) {
+      throughput_sum += s.second.bytes_per_ms;
+      ++throughput_count;
+    }
+  }
+  const double default_throughput = throughput_count > 0 ? throughput_sum / throughput_count : -1;
+
+  // failed, then measured, then expected time
+  std::vector<std::tuple<bool, bool, double, size_t>> keys;
+  for (size_t i = 0; i < servers_.size(); ++i) {
+    auto it = stats_.find(servers_[i]);
+    if (it == stats_.end()) {
+      keys.emplace_back(false, false, 0, i);
+      continue;
+    }
+    const Stats& s = it->second;
+    double expected_ms = std::max(s.rtt_ms, 0.0);
+    const double throughput = s.bytes_per_ms > 0 ? s.bytes_per_ms : default_throughput;
+    if (throughput > 0) {
+      expected_ms += static_cast<double>(size) / throughput;
+    }
+    keys.emplace_back(s.failed_until > now, true, expected_ms, i);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<std::string> res;
+  res.reserve(keys.size());
+  for (const auto& k : keys) {
+    res.push_back(servers_[std::get<3>(k)]);
+  }
+  return res;
+}
+
+void MirrorSelector::record(const std::string& server, bool ok, uint64_t bytes, std::chrono::milliseconds elapsed) {
+  if (servers_.size() == 1) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(m_);
+  Stats& s = stats_[server];
+  if (!ok) {
+    s.failed_until = std::chrono::steady_clock::now() + kFailurePenalty;
+    return;
+  }
+  const auto ms = static_cast<double>(std::max<int64_t>(elapsed.count(), 1));
+  if (bytes < kThroughputMinSize) {
+    average(&s.rtt_ms, ms);
+  } else {
+    average(&s.bytes_per_ms, static_cast<double>(bytes) / ms);
+  }
+}
+
+}  // namespace Uptane
@@ -0,0 +1,52 @@
+#ifndef UPTANE_MIRRORSELECTOR_H_
+#define UPTANE_MIRRORSELECTOR_H_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Uptane {
+
+/**
+ * Servers of the Image repository, the configured one and its mirrors, in
+ * the order they are best tried.
+ *
+ * The transfers from each server are measured: small ones give its round trip
+ * time, large ones its throughput. Servers are ranked by how long they are
+ * expected to take for a file of a given size. Servers that haven't been
+ * measured yet come first, so that they are; servers that just failed come
+ * last for a while.
+ */
+class MirrorSelector {
+ public:
+  // `mirrors` is a comma separated list of URLs
+  MirrorSelector(const std::string& server, const std::string& mirrors);
+
+  const std::string& server() const { return servers_[0]; }
+  bool hasMirrors() const { return servers_.size() > 1; }
+  // all the servers, best first for a file of `size` bytes
+  std::vector<std::string> ranked(uint64_t size) const;
+  void record(const std::string& server, bool ok, uint64_t bytes, std::chrono::milliseconds elapsed);
+
+  // transfers smaller than this only measure the round trip time
+  static constexpr uint64_t kThroughputMinSize{256 * 1024};
+  static constexpr std::chrono::seconds kFailurePenalty{60};
+
+ private:
+  struct Stats {
+    // exponential moving averages, negative until measured
+    double rtt_ms{-1};
+    double bytes_per_ms{-1};
+    std::chrono::steady_clock::time_point failed_until;
+  };
+
+  std::vector<std::string> servers_;
+  mutable std::mutex m_;
+  std::map<std::string, Stats> stats_;
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_MIRRORSELECTOR_H_
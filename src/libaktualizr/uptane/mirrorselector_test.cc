@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "uptane/mirrorselector.h"
+
+using Uptane::MirrorSelector;
+using Servers = std::vector<std::string>;
+
+/* The mirrors are parsed, duplicates and the main server are dropped. */
+TEST(MirrorSelector, Parse) {
+  MirrorSelector none("https://repo", "");
+  EXPECT_FALSE(none.hasMirrors());
+  EXPECT_EQ(none.ranked(0), Servers{"https://repo"});
+
+  MirrorSelector selector("https://repo", " https://a/, https://repo,,https://b ,https://a");
+  EXPECT_TRUE(selector.hasMirrors());
+  EXPECT_EQ(selector.server(), "https://repo");
+  EXPECT_EQ(selector.ranked(0), (Servers{"https://repo", "https://a", "https://b"}));
+}
+
+/* Servers that haven't been measured come first, then the ones expected to
+ * be the fastest for the size of the file. */
+TEST(MirrorSelector, Ranking) {
+  MirrorSelector selector("https://repo", "https://a,https://b");
+  selector.record("https://repo", true, 1000, std::chrono::milliseconds(50));
+  EXPECT_EQ(selector.ranked(0), (Servers{"https://a", "https://b", "https://repo"}));
+
+  // a: close but slow, b: far but fast
+  selector.record("https://a", true, 1000, std::chrono::milliseconds(10));
+  selector.record("https://a", true, 10 << 20, std::chrono::milliseconds(10000));
+  selector.record("https://b", true, 1000, std::chrono::milliseconds(100));
+  selector.record("https://b", true, 10 << 20, std::chrono::milliseconds(1000));
+  EXPECT_EQ(selector.ranked(0), (Servers{"https://a", "https://repo", "https://b"}));
+  // the throughput of the main server is assumed to be the average one
+  EXPECT_EQ(selector.ranked(100 << 20), (Servers{"https://b", "https://repo", "https://a"}));
+}
+
+/* Servers that failed come last. */
+TEST(MirrorSelector, Failure) {
+  MirrorSelector selector("https://repo", "https://a");
+  selector.record("https://repo", true, 1000, std::chrono::milliseconds(10));
+  selector.record("https://a", true, 1000, std::chrono::milliseconds(100));
+  EXPECT_EQ(selector.ranked(0), (Servers{"https://repo", "https://a"}));
+  selector.record("https://repo", false, 0, std::chrono::milliseconds(0));
+  EXPECT_EQ(selector.ranked(0), (Servers{"https://a", "https://repo"}));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,262 @@
+#include "offline_bundle.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+#include "logging/logging.h"
+#include "uptane/exceptions.h"
+#include "utilities/utils.h"
+
+namespace Uptane {
+
+constexpr const char *OfflineBundle::kMagic;
+constexpr uint32_t OfflineBundle::kFormatVersion;
+constexpr uint64_t OfflineBundle::kHeaderSize;
+constexpr uint64_t OfflineBundle::kAlignment;
+
+// magic, format version, reserved, index offset and length
+static constexpr size_t kHeaderFieldsSize = 8 + 4 + 4 + 8 + 8;
+static_assert(kHeaderFieldsSize <= OfflineBundle::kHeaderSize, "the header fields must fit in the header");
+
+static uint64_t readLittleEndian(const unsigned char *data, size_t size) {
+  uint64_t value = 0;
+  for (size_t i = size; i > 0; --i) {
+    value = (value << 8U) | data[i - 1];  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  }
+  return value;
+}
+
+static void writeLittleEndian(unsigned char *data, uint64_t value, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<unsigned char>(value >> (8 * i));  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  }
+}
+
+OfflineBundle::OfflineBundle(const boost::filesystem::path &path) : path_(path), view_(path.string()) {
+  auto invalid = [&path](const std::string &reason) {
+    return std::runtime_error("Invalid offline bundle " + path.string() + ": " + reason);
+  };
+  if (view_.size() < kHeaderSize) {
+    throw invalid("too short");
+  }
+  const unsigned char *header = view_.data();
+  if (std::memcmp(header, kMagic, 8) != 0) {
+    throw invalid("no bundle header");
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  const auto format_version = static_cast<uint32_t>(readLittleEndian(header + 8, 4));
+  if (format_version != kFormatVersion) {
+    throw invalid("unsupported format version " + std::to_string(format_version));
+  }
+  Json::Value index_entry;
+  index_entry["offset"] = Json::UInt64(readLittleEndian(header + 16, 8));  // NOLINT
+  index_entry["length"] = Json::UInt64(readLittleEndian(header + 24, 8));  // NOLINT
+  const Region index_region = region(index_entry);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  const Json::Value index = Utils::parseJSON(
+      std::string(reinterpret_cast<const char *>(index_region.data), static_cast<size_t>(index_region.size)));
+  if (!index.isObject()) {
+    throw invalid("unreadable index");
+  }
+
+  try {
+    for (const auto &entry : index["metadata"]) {
+      const RepositoryType repo(entry["repo"].asString());
+      const MetaKey key{static_cast<int>(repo), entry["role"].asString(), entry["version"].asInt()};
+      if (!metadata_.emplace(key, region(entry)).second) {
+        throw invalid("duplicate " + repo.ToString() + " " + std::get<1>(key) + " metadata");
+      }
+    }
+    for (const auto &entry : index["targets"]) {
+      const std::string filename = entry["filename"].asString();
+      if (!targets_.emplace(filename, region(entry)).second) {
+        throw invalid("duplicate image " + filename);
+      }
+    }
+  } catch (const Json::Exception &e) {
+    throw invalid(std::string("malformed index: ") + e.what());
+  }
+}
+
+OfflineBundle::Region OfflineBundle::region(const Json::Value &entry) const {
+  if (!entry["offset"].isIntegral() || !entry["length"].isIntegral()) {
+    throw std::runtime_error("Invalid offline bundle " + path_.string() + ": entry without offset or length");
+  }
+  const uint64_t offset = entry["offset"].asUInt64();
+  const uint64_t length = entry["length"].asUInt64();
+  if (offset < kHeaderSize || offset % kAlignment != 0 || offset > view_.size() || length > view_.size() - offset) {
+    throw std::runtime_error("Invalid offline bundle " + path_.string() + ": entry out of bounds");
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  return Region{view_.data() + offset, length};
+}
+
+bool OfflineBundle::metadata(RepositoryType repo, const Role &role, Version version, std::string *result) const {
+  const int repo_int = static_cast<int>(repo);
+  const std::string role_name = role.ToString();
+  auto it = metadata_.end();
+  if (version == Version()) {
+    // the versions of a role are sorted, the latest comes last
+    const auto upper = metadata_.upper_bound(MetaKey{repo_int, role_name, std::numeric_limits<int>::max()});
+    if (upper != metadata_.begin()) {
+      const auto last = std::prev(upper);
+      if (std::get<0>(last->first) == repo_int && std::get<1>(last->first) == role_name) {
+        it = last;
+      }
+    }
+  } else {
+    it = metadata_.find(MetaKey{repo_int, role_name, version.version()});
+  }
+  if (it == metadata_.end()) {
+    return false;
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  result->assign(reinterpret_cast<const char *>(it->second.data), static_cast<size_t>(it->second.size));
+  return true;
+}
+
+int OfflineBundle::latestRootVersion(RepositoryType repo) const {
+  std::string root;
+  if (!metadata(repo, Role::Root(), Version(), &root)) {
+    return -1;
+  }
+  return extractVersionUntrusted(root);
+}
+
+boost::optional<OfflineBundle::Region> OfflineBundle::target(const std::string &filename) const {
+  const auto it = targets_.find(filename);
+  if (it == targets_.end()) {
+    return boost::none;
+  }
+  return it->second;
+}
+
+OfflineBundleWriter::OfflineBundleWriter(const boost::filesystem::path &path) : path_(path) {
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd_ < 0) {
+    throw std::runtime_error("Can't create offline bundle " + path.string() + ": " + std::strerror(errno));
+  }
+  index_["metadata"] = Json::arrayValue;
+  index_["targets"] = Json::arrayValue;
+}
+
+OfflineBundleWriter::~OfflineBundleWriter() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+static void writeAll(int fd, const unsigned char *data, uint64_t size, uint64_t offset,
+                     const boost::filesystem::path &path) {
+  uint64_t written = 0;
+  while (written < size) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const ssize_t res = pwrite(fd, data + written, static_cast<size_t>(size - written),
+                               static_cast<off_t>(offset + written));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Can't write offline bundle " + path.string() + ": " + std::strerror(errno));
+    }
+    written += static_cast<uint64_t>(res);
+  }
+}
+
+Json::Value OfflineBundleWriter::append(const unsigned char *data, uint64_t size) {
+  if (fd_ < 0) {
+    throw std::logic_error("Offline bundle " + path_.string() + " is already finished");
+  }
+  // the padding is left as a hole
+  const uint64_t alignment = OfflineBundle::kAlignment;
+  const uint64_t offset = (end_ + alignment - 1) / alignment * alignment;
+  writeAll(fd_, data, size, offset, path_);
+  end_ = offset + size;
+  Json::Value entry;
+  entry["offset"] = Json::UInt64(offset);
+  entry["length"] = Json::UInt64(size);
+  return entry;
+}
+
+void OfflineBundleWriter::addMetadata(RepositoryType repo, const Role &role, const std::string &content) {
+  const int version = extractVersionUntrusted(content);
+  if (version < 0) {
+    throw std::runtime_error("No version in " + repo.ToString() + " " + role.ToString() + " metadata");
+  }
+  for (const auto &entry : index_["metadata"]) {
+    if (entry["repo"].asString() == repo.ToString() && entry["role"].asString() == role.ToString() &&
+        entry["version"].asInt() == version) {
+      throw std::runtime_error("Version " + std::to_string(version) + " of " + repo.ToString() + " " +
+                               role.ToString() + " metadata is added more than once");
+    }
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  Json::Value entry = append(reinterpret_cast<const unsigned char *>(content.data()), content.size());
+  entry["repo"] = repo.ToString();
+  entry["role"] = role.ToString();
+  entry["version"] = version;
+  index_["metadata"].append(entry);
+}
+
+void OfflineBundleWriter::addTarget(const std::string &filename, const boost::filesystem::path &image) {
+  for (const auto &entry : index_["targets"]) {
+    if (entry["filename"].asString() == filename) {
+      throw std::runtime_error("Image " + filename + " is added more than once");
+    }
+  }
+  const TargetFileView view(image.string());
+  Json::Value entry = append(view.data(), view.size());
+  entry["filename"] = filename;
+  index_["targets"].append(entry);
+}
+
+void OfflineBundleWriter::finish() {
+  const std::string index = Utils::jsonToCanonicalStr(index_);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  const Json::Value index_entry = append(reinterpret_cast<const unsigned char *>(index.data()), index.size());
+
+  std::array<unsigned char, OfflineBundle::kHeaderSize> header{};
+  std::memcpy(header.data(), OfflineBundle::kMagic, 8);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  writeLittleEndian(header.data() + 8, OfflineBundle::kFormatVersion, 4);
+  writeLittleEndian(header.data() + 16, index_entry["offset"].asUInt64(), 8);  // NOLINT
+  writeLittleEndian(header.data() + 24, index_entry["length"].asUInt64(), 8);  // NOLINT
+  if (fdatasync(fd_) != 0) {
+    throw std::runtime_error("Can't sync offline bundle " + path_.string() + ": " + std::strerror(errno));
+  }
+  // only valid with all the rest on the disk
+  writeAll(fd_, header.data(), header.size(), 0, path_);
+  const int fd = fd_;
+  fd_ = -1;
+  if (close(fd) != 0) {
+    throw std::runtime_error("Can't write offline bundle " + path_.string() + ": " + std::strerror(errno));
+  }
+}
+
+void BundleFetcher::fetchRole(std::string *result, int64_t maxsize, RepositoryType repo, const Uptane::Role &role,
+                              Version version, const api::FlowControlToken *flow_control) const {
+  if (flow_control != nullptr && flow_control->hasAborted()) {
+    throw LocallyAborted(repo);
+  }
+  if (!bundle_->metadata(repo, role, version, result)) {
+    LOG_DEBUG << "No " << repo << " " << role << " metadata " << version << " in " << bundle_->path();
+    throw MetadataFetchFailure(repo, role.ToString());
+  }
+  if (static_cast<int64_t>(result->size()) > maxsize) {
+    result->clear();
+    throw MetadataFetchFailure(repo, role.ToString());
+  }
+}
+
+int BundleFetcher::latestRootVersionHint(RepositoryType repo, const api::FlowControlToken *flow_control) const {
+  (void)flow_control;
+  return bundle_->latestRootVersion(repo);
+}
+
+}  // namespace Uptane
@@ -0,0 +1,123 @@
+#ifndef UPTANE_OFFLINE_BUNDLE_H_
+#define UPTANE_OFFLINE_BUNDLE_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "fetcher.h"
+#include "libaktualizr/packagemanagerinterface.h"
+#include "tuf.h"
+
+namespace Uptane {
+
+/**
+ * The Uptane metadata and images of an update in a single file, to update
+ * devices without network access, e.g. from a USB drive.
+ *
+ * The file starts with a header of kHeaderSize bytes: the magic, the format
+ * version as a 32 bit integer, 4 reserved bytes, then the offset and length of
+ * the index as 64 bit integers, all little endian. Each metadata file and
+ * image follows at an offset aligned on kAlignment, and the index comes last:
+ * a JSON object with a "metadata" list of {"repo", "role", "version",
+ * "offset", "length"} and a "targets" list of {"filename", "offset",
+ * "length"}. The header is written last, so that an incomplete bundle is
+ * rejected.
+ *
+ * The bundle is mapped in memory: images are hashed and stored straight from
+ * the mapping, by several threads at once. Nothing in it is trusted, the
+ * metadata is verified like fetched metadata and the images against it.
+ */
+class OfflineBundle {
+ public:
+  // throws std::runtime_error if the file can't be mapped or isn't a bundle
+  explicit OfflineBundle(const boost::filesystem::path &path);
+
+  struct Region {
+    const unsigned char *data;
+    uint64_t size;
+  };
+
+  /**
+   * A metadata file, the one with the highest version for Version().
+   * @return false if the bundle doesn't have it
+   */
+  bool metadata(RepositoryType repo, const Role &role, Version version, std::string *result) const;
+  // -1 if there is no Root metadata of the repository
+  int latestRootVersion(RepositoryType repo) const;
+  // The content of an image, valid as long as the bundle is
+  boost::optional<Region> target(const std::string &filename) const;
+  size_t targetsCount() const { return targets_.size(); }
+  const boost::filesystem::path &path() const { return path_; }
+
+  static constexpr const char *kMagic{"AKBUNDLE"};
+  static constexpr uint32_t kFormatVersion{1};
+  static constexpr uint64_t kHeaderSize{4096};
+  static constexpr uint64_t kAlignment{4096};
+
+ private:
+  // repository, role name, version
+  using MetaKey = std::tuple<int, std::string, int>;
+
+  Region region(const Json::Value &entry) const;
+
+  boost::filesystem::path path_;
+  TargetFileView view_;
+  std::map<MetaKey, Region> metadata_;
+  std::map<std::string, Region> targets_;
+};
+
+/**
+ * Writes an OfflineBundle. The metadata and images can be added in any order;
+ * the bundle is only valid once finish() has been called.
+ */
+class OfflineBundleWriter {
+ public:
+  // throws std::runtime_error if the file can't be created
+  explicit OfflineBundleWriter(const boost::filesystem::path &path);
+  ~OfflineBundleWriter();
+  OfflineBundleWriter(const OfflineBundleWriter &) = delete;
+  OfflineBundleWriter(OfflineBundleWriter &&) = delete;
+  OfflineBundleWriter &operator=(const OfflineBundleWriter &) = delete;
+  OfflineBundleWriter &operator=(OfflineBundleWriter &&) = delete;
+
+  // with the version of the signed metadata
+  void addMetadata(RepositoryType repo, const Role &role, const std::string &content);
+  void addTarget(const std::string &filename, const boost::filesystem::path &image);
+  void finish();
+
+ private:
+  // writes at the next aligned offset, returns the index entry
+  Json::Value append(const unsigned char *data, uint64_t size);
+
+  boost::filesystem::path path_;
+  int fd_{-1};
+  uint64_t end_{OfflineBundle::kHeaderSize};
+  Json::Value index_;
+};
+
+/**
+ * Metadata from an OfflineBundle instead of the servers. Fetching a role the
+ * bundle doesn't have fails like a network error does.
+ */
+class BundleFetcher : public IMetadataFetcher {
+ public:
+  explicit BundleFetcher(std::shared_ptr<const OfflineBundle> bundle) : bundle_(std::move(bundle)) {}
+  using IMetadataFetcher::fetchRole;
+  void fetchRole(std::string *result, int64_t maxsize, RepositoryType repo, const Uptane::Role &role, Version version,
+                 const api::FlowControlToken *flow_control) const override;
+  int latestRootVersionHint(RepositoryType repo, const api::FlowControlToken *flow_control) const override;
+
+  const OfflineBundle &bundle() const { return *bundle_; }
+
+ private:
+  std::shared_ptr<const OfflineBundle> bundle_;
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_OFFLINE_BUNDLE_H_
@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "httpfake.h"
+#include "logging/logging.h"
+#include "test_utils.h"
+#include "uptane/exceptions.h"
+#include "uptane/offline_bundle.h"
+#include "uptane_repo.h"
+#include "uptane_test_common.h"
+#include "utilities/utils.h"
+
+boost::filesystem::path uptane_generator_path;
+
+static std::string meta(int version) { return "{\"signed\":{\"version\":" + std::to_string(version) + "}}"; }
+
+/*
+ * Metadata and images are read back as written, at aligned offsets, and the
+ * fetcher takes the latest version of a role unless it is given one.
+ */
+TEST(OfflineBundle, WriteRead) {
+  TemporaryDirectory temp_dir;
+  const std::string image(10000, 'x');
+  Utils::writeFile(temp_dir / "image.bin", image);
+  Utils::writeFile(temp_dir / "empty.bin", std::string());
+
+  Uptane::OfflineBundleWriter writer(temp_dir / "update.bundle");
+  writer.addMetadata(Uptane::RepositoryType::Director(), Uptane::Role::Root(), meta(1));
+  writer.addTarget("image.bin", temp_dir / "image.bin");
+  writer.addMetadata(Uptane::RepositoryType::Director(), Uptane::Role::Root(), meta(2));
+  writer.addMetadata(Uptane::RepositoryType::Image(), Uptane::Role::Delegation("role-abc"), meta(3));
+  writer.addTarget("empty.bin", temp_dir / "empty.bin");
+  EXPECT_THROW(writer.addTarget("image.bin", temp_dir / "image.bin"), std::runtime_error);
+  EXPECT_THROW(writer.addMetadata(Uptane::RepositoryType::Director(), Uptane::Role::Root(), meta(2)),
+               std::runtime_error);
+  writer.finish();
+
+  auto bundle = std::make_shared<Uptane::OfflineBundle>(temp_dir / "update.bundle");
+  EXPECT_EQ(bundle->targetsCount(), 2);
+  const auto region = bundle->target("image.bin");
+  ASSERT_TRUE(!!region);
+  EXPECT_EQ(std::string(reinterpret_cast<const char *>(region->data), region->size), image);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(region->data) % Uptane::OfflineBundle::kAlignment, 0);
+  ASSERT_TRUE(!!bundle->target("empty.bin"));
+  EXPECT_EQ(bundle->target("empty.bin")->size, 0);
+  EXPECT_FALSE(!!bundle->target("other.bin"));
+  EXPECT_EQ(bundle->latestRootVersion(Uptane::RepositoryType::Director()), 2);
+  EXPECT_EQ(bundle->latestRootVersion(Uptane::RepositoryType::Image()), -1);
+
+  Uptane::BundleFetcher fetcher(bundle);
+  std::string result;
+  fetcher.fetchLatestRole(&result, Uptane::kMaxRootSize, Uptane::RepositoryType::Director(), Uptane::Role::Root());
+  EXPECT_EQ(result, meta(2));
+  fetcher.fetchRole(&result, Uptane::kMaxRootSize, Uptane::RepositoryType::Director(), Uptane::Role::Root(),
+                    Uptane::Version(1));
+  EXPECT_EQ(result, meta(1));
+  fetcher.fetchLatestRole(&result, Uptane::kMaxImageTargetsSize, Uptane::RepositoryType::Image(),
+                          Uptane::Role::Delegation("role-abc"));
+  EXPECT_EQ(result, meta(3));
+  EXPECT_THROW(fetcher.fetchRole(&result, Uptane::kMaxRootSize, Uptane::RepositoryType::Director(),
+                                 Uptane::Role::Root(), Uptane::Version(3)),
+               Uptane::MetadataFetchFailure);
+  EXPECT_THROW(fetcher.fetchLatestRole(&result, Uptane::kMaxRootSize, Uptane::RepositoryType::Image(),
+                                       Uptane::Role::Root()),
+               Uptane::MetadataFetchFailure);
+  EXPECT_THROW(fetcher.fetchLatestRole(&result, 4, Uptane::RepositoryType::Director(), Uptane::Role::Root()),
+               Uptane::MetadataFetchFailure);
+  EXPECT_EQ(fetcher.latestRootVersionHint(Uptane::RepositoryType::Director(), nullptr), 2);
+}
+
+/*
+ * Bundles that weren't finished or were cut short are rejected.
+ */
+TEST(OfflineBundle, Invalid) {
+  TemporaryDirectory temp_dir;
+  Utils::writeFile(temp_dir / "image.bin", std::string(10000, 'x'));
+  {
+    Uptane::OfflineBundleWriter writer(temp_dir / "unfinished.bundle");
+    writer.addTarget("image.bin", temp_dir / "image.bin");
+  }
+  EXPECT_THROW(Uptane::OfflineBundle(temp_dir / "unfinished.bundle"), std::runtime_error);
+
+  {
+    Uptane::OfflineBundleWriter writer(temp_dir / "update.bundle");
+    writer.addTarget("image.bin", temp_dir / "image.bin");
+    writer.finish();
+  }
+  EXPECT_NO_THROW(Uptane::OfflineBundle(temp_dir / "update.bundle"));
+  boost::filesystem::resize_file(temp_dir / "update.bundle", 3 * Uptane::OfflineBundle::kAlignment);
+  EXPECT_THROW(Uptane::OfflineBundle(temp_dir / "update.bundle"), std::runtime_error);
+  EXPECT_THROW(Uptane::OfflineBundle(temp_dir / "image.bin"), std::runtime_error);
+}
+
+class OfflineUpdate : public ::testing::Test {
+ protected:
+  OfflineUpdate()
+      : repo_dir_{temp_dir_ / "repo"},
+        bundle_path_{temp_dir_ / "update.bundle"},
+        // no metadata on the server, it can only come from the bundle
+        http_{std::make_shared<HttpFake>(temp_dir_.Path(), "", temp_dir_ / "no-metadata")},
+        config_{UptaneTestCommon::makeTestConfig(temp_dir_, http_->tls_server)} {
+    UptaneRepo repo(repo_dir_, "", "id0");
+    repo.generateRepo(KeyType::kED25519);
+    Utils::writeFile(temp_dir_ / "firmware.bin", image_);
+    repo.addImage(temp_dir_ / "firmware.bin", "firmware.bin", "primary_hw");
+    repo.addTarget("firmware.bin", "primary_hw", "CA:FE:A6:D2:84:9D");
+    repo.signTargets();
+
+    std::string output;
+    const int result = Utils::shell(uptane_generator_path.string() + " bundle --path " + repo_dir_.string() +
+                                        " --bundle " + bundle_path_.string(),
+                                    &output, true);
+    EXPECT_EQ(result, EXIT_SUCCESS) << output;
+  }
+
+  TemporaryDirectory temp_dir_;
+  boost::filesystem::path repo_dir_;
+  boost::filesystem::path bundle_path_;
+  std::shared_ptr<HttpFake> http_;
+  Config config_;
+  const std::string image_{"firmware from a USB drive " + std::string(3 << 20, 'f')};
+};
+
+/*
+ * A provisioned device checks, stores and installs an update from a bundle
+ * generated by uptane-generator.
+ */
+TEST_F(OfflineUpdate, Install) {
+  auto storage = INvStorage::newStorage(config_.storage);
+  UptaneTestCommon::TestUptaneClient client(config_, storage, http_);
+  client.initialize();
+  client.setOfflineBundle(std::make_shared<Uptane::OfflineBundle>(bundle_path_));
+
+  const result::UpdateCheck update_result = client.fetchMeta();
+  ASSERT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  ASSERT_EQ(update_result.updates.size(), 1);
+  EXPECT_EQ(update_result.updates[0].filename(), "firmware.bin");
+
+  const result::Download download_result = client.downloadImages(update_result.updates);
+  ASSERT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+  std::ifstream stored = client.openStoredTarget(update_result.updates[0]);
+  EXPECT_EQ(std::string(std::istreambuf_iterator<char>(stored), std::istreambuf_iterator<char>()), image_);
+
+  const result::Install install_result = client.uptaneInstall(download_result.updates);
+  EXPECT_TRUE(install_result.dev_report.success);
+
+  // back to the servers, which have no metadata
+  client.setOfflineBundle(nullptr);
+  EXPECT_EQ(client.fetchMeta().status, result::UpdateStatus::kError);
+}
+
+/*
+ * An image that doesn't match its metadata is not stored.
+ */
+TEST_F(OfflineUpdate, TamperedImage) {
+  std::string bundle = Utils::readFile(bundle_path_);
+  const size_t image_offset = bundle.find("firmware from a USB drive");
+  ASSERT_NE(image_offset, std::string::npos);
+  bundle[image_offset] = 'F';
+  Utils::writeFile(bundle_path_, bundle);
+
+  auto storage = INvStorage::newStorage(config_.storage);
+  UptaneTestCommon::TestUptaneClient client(config_, storage, http_);
+  client.initialize();
+  client.setOfflineBundle(std::make_shared<Uptane::OfflineBundle>(bundle_path_));
+
+  const result::UpdateCheck update_result = client.fetchMeta();
+  ASSERT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  const result::Download download_result = client.downloadImages(update_result.updates);
+  EXPECT_EQ(download_result.status, result::DownloadStatus::kError);
+  EXPECT_TRUE(client.getStoredTargets().empty());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (argc != 2) {
+    std::cerr << "Error: " << argv[0] << " requires the path to the uptane-generator utility\n";
+    return EXIT_FAILURE;
+  }
+  uptane_generator_path = argv[1];
+
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -15,28 +15,50 @@ const std::string Role::TIMESTAMP = "timestamp";
 Role::Role(const std::string &role_name, const bool delegation) {
   std::string role_name_lower;
   std::transform(role_name.begin(), role_name.end(), std::back_inserter(role_name_lower), ::tolower);
-  name_ = role_name_lower;
   if (delegation) {
-    if (IsReserved(name_)) {
+    if (IsReserved(role_name_lower)) {
       throw Uptane::Exception("", "Delegated role name " + role_name + " is reserved.");
     }
     role_ = RoleEnum::kDelegation;
-    name_ = role_name;
-  } else if (role_name_lower == ROOT) {
-    role_ = RoleEnum::kRoot;
+    name_ = internIdentifier(role_name);
+    return;
+  }
+  if (role_name_lower == ROOT) {
+    *this = Root();
   } else if (role_name_lower == SNAPSHOT) {
-    role_ = RoleEnum::kSnapshot;
+    *this = Snapshot();
   } else if (role_name_lower == TARGETS) {
-    role_ = RoleEnum::kTargets;
+    *this = Targets();
   } else if (role_name_lower == TIMESTAMP) {
-    role_ = RoleEnum::kTimestamp;
+    *this = Timestamp();
+  } else {
+    *this = InvalidRole();
+  }
+}
+
+// The names of the standard roles stay interned for good, they are used all
+// the time. Literals, as roles may be made before ROOT and the others are.
+Role::Role(RoleEnum role) : role_(role) {
+  static const auto root = internIdentifier("root");
+  static const auto snapshot = internIdentifier("snapshot");
+  static const auto targets = internIdentifier("targets");
+  static const auto timestamp = internIdentifier("timestamp");
+  static const auto invalid = internIdentifier("invalidrole");
+  if (role_ == RoleEnum::kRoot) {
+    name_ = root;
+  } else if (role_ == RoleEnum::kSnapshot) {
+    name_ = snapshot;
+  } else if (role_ == RoleEnum::kTargets) {
+    name_ = targets;
+  } else if (role_ == RoleEnum::kTimestamp) {
+    name_ = timestamp;
   } else {
     role_ = RoleEnum::kInvalidRole;
-    name_ = "invalidrole";
+    name_ = invalid;
   }
 }
 
-std::string Role::ToString() const { return name_; }
+std::string Role::ToString() const { return *name_; }
 
 std::ostream &Uptane::operator<<(std::ostream &os, const Role &role) {
   os << role.ToString();
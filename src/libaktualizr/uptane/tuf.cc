@@ -1,5 +1,7 @@
 #include "uptane/tuf.h"
 
+#include <fnmatch.h>
+#include <algorithm>
 #include <ctime>
 #include <ostream>
 #include <sstream>
@@ -75,63 +77,69 @@ std::vector<Hash> Hash::decodeVector(std::string hashes_str) {
   return hash_v;
 }
 
-Target::Target(std::string filename, const Json::Value &content) : filename_(std::move(filename)) {
+Target::Target(std::string filename, const Json::Value &content) : data_(std::make_shared<Data>()) {
+  data_->filename = std::move(filename);
   if (content.isMember("custom")) {
     updateCustom(content["custom"]);
   }
 
-  length_ = content["length"].asUInt64();
+  data_->length = content["length"].asUInt64();
 
   const auto &hashes = content["hashes"];
   for (auto i = hashes.begin(); i != hashes.end(); ++i) {
     Hash h(i.key().asString(), (*i).asString());
     if (h.HaveAlgorithm()) {
-      hashes_.push_back(h);
+      data_->hashes.push_back(h);
     }
   }
   // sort hashes so that higher priority hash algorithm goes first
-  std::sort(hashes_.begin(), hashes_.end(), [](const Hash &l, const Hash &r) { return l.type() < r.type(); });
+  std::sort(data_->hashes.begin(), data_->hashes.end(),
+            [](const Hash &l, const Hash &r) { return l.type() < r.type(); });
 }
 
 void Target::updateCustom(const Json::Value &custom) {
-  custom_ = custom;
+  Data &data = mutableData();
+  data.custom = custom;
 
   // Image repo provides an array of hardware IDs.
-  if (custom_.isMember("hardwareIds")) {
-    Json::Value hwids = custom_["hardwareIds"];
+  if (data.custom.isMember("hardwareIds")) {
+    const Json::Value &hwids = data.custom["hardwareIds"];
+    data.hwids.reserve(data.hwids.size() + hwids.size());
     for (auto i = hwids.begin(); i != hwids.end(); ++i) {
-      hwids_.emplace_back((*i).asString());
+      data.hwids.emplace_back((*i).asString());
     }
   }
 
   // Director provides a map of ECU serials to hardware IDs.
-  Json::Value ecus = custom_["ecuIdentifiers"];
+  const Json::Value &ecus = data.custom["ecuIdentifiers"];
   for (auto i = ecus.begin(); i != ecus.end(); ++i) {
-    ecus_.insert({EcuSerial(i.key().asString()), HardwareIdentifier((*i)["hardwareId"].asString())});
+    data.ecus.insert({EcuSerial(i.key().asString()), HardwareIdentifier((*i)["hardwareId"].asString())});
   }
 
-  if (custom_.isMember("targetFormat")) {
-    type_ = custom_["targetFormat"].asString();
+  if (data.custom.isMember("targetFormat")) {
+    data.type = data.custom["targetFormat"].asString();
   }
 
-  if (custom_.isMember("uri")) {
-    std::string custom_uri = custom_["uri"].asString();
+  if (data.custom.isMember("uri")) {
+    std::string custom_uri = data.custom["uri"].asString();
     // Ignore this exact URL for backwards compatibility with old defaults that inserted it.
     if (custom_uri != "https://example.com/") {
-      uri_ = std::move(custom_uri);
+      data.uri = std::move(custom_uri);
     }
   }
 }
 
 // Internal use only.
 Target::Target(std::string filename, EcuMap ecus, std::vector<Hash> hashes, uint64_t length, std::string type)
-    : filename_(std::move(filename)),
-      type_(std::move(type)),
-      ecus_(std::move(ecus)),
-      hashes_(std::move(hashes)),
-      length_(length) {
+    : data_(std::make_shared<Data>()) {
+  data_->filename = std::move(filename);
+  data_->type = std::move(type);
+  data_->ecus = std::move(ecus);
+  data_->hashes = std::move(hashes);
+  data_->length = length;
   // sort hashes so that higher priority hash algorithm goes first
-  std::sort(hashes_.begin(), hashes_.end(), [](const Hash &l, const Hash &r) { return l.type() < r.type(); });
+  std::sort(data_->hashes.begin(), data_->hashes.end(),
+            [](const Hash &l, const Hash &r) { return l.type() < r.type(); });
 }
 
 Target Target::Unknown() {
@@ -140,18 +148,23 @@ Target Target::Unknown() {
   t_json["length"] = 0;
   Uptane::Target target{"unknown", t_json};
 
-  target.valid = false;
+  target.data_->valid = false;
 
   return target;
 }
 
 bool Target::MatchHash(const Hash &hash) const {
-  return (std::find(hashes_.begin(), hashes_.end(), hash) != hashes_.end());
+  return (std::find(data_->hashes.begin(), data_->hashes.end(), hash) != data_->hashes.end());
+}
+
+bool Target::MatchHashes(const std::vector<Hash> &hashes) const {
+  return !hashes.empty() &&
+         std::all_of(hashes.begin(), hashes.end(), [this](const Hash &hash) { return MatchHash(hash); });
 }
 
 std::string Target::hashString(Hash::Type type) const {
   std::vector<Hash>::const_iterator it;
-  for (it = hashes_.begin(); it != hashes_.end(); it++) {
+  for (it = data_->hashes.begin(); it != data_->hashes.end(); it++) {
     if (it->type() == type) {
       return boost::algorithm::to_lower_copy(it->HashString());
     }
@@ -165,7 +178,7 @@ std::string Target::sha512Hash() const { return hashString(Hash::Type::kSha512);
 
 std::string Target::custom_version() const {
   try {
-    return custom_["version"].asString();
+    return data_->custom["version"].asString();
   } catch (const std::exception &ex) {
     LOG_ERROR << "Unable to parse custom version: " << ex.what();
     return "";
@@ -174,10 +187,10 @@ std::string Target::custom_version() const {
 
 bool Target::IsOstree() const {
   // NOLINTNEXTLINE(bugprone-branch-clone)
-  if (type_ == "OSTREE") {
+  if (data_->type == "OSTREE") {
     // Modern servers explicitly specify the type of the target
     return true;
-  } else if (type_.empty() && length() == 0) {
+  } else if (data_->type.empty() && length() == 0) {
     // Older servers don't specify the type of the target. Assume that it is
     // an OSTree target if the length is zero.
     return true;
@@ -189,16 +202,18 @@ bool Target::IsOstree() const {
 }
 
 bool Target::MatchTarget(const Target &t2) const {
-  // type_ (targetFormat) is only provided by the Image repo.
-  // ecus_ is only provided by the Image repo.
+  // type (targetFormat) is only provided by the Image repo.
+  // ecus is only provided by the Image repo.
   // correlation_id_ is only provided by the Director.
-  // uri_ is not matched. If the Director provides it, we use that. If not, but
+  // uri is not matched. If the Director provides it, we use that. If not, but
   // the Image repository does, use that. Otherwise, leave it empty and use the
   // default.
-  if (filename_ != t2.filename_) {
+  const Data &d1 = *data_;
+  const Data &d2 = *t2.data_;
+  if (d1.filename != d2.filename) {
     return false;
   }
-  if (length_ != t2.length_) {
+  if (d1.length != d2.length) {
     return false;
   }
 
@@ -207,15 +222,15 @@ bool Target::MatchTarget(const Target &t2) const {
   // empty) and a Target from the Image repo (HWID vector populated,
   // ECU->HWID map empty). Figure out which Target has the map, and then for
   // every item in the map, make sure it's in the other Target's HWID vector.
-  if (hwids_ != t2.hwids_ || ecus_ != t2.ecus_) {
-    std::shared_ptr<EcuMap> ecu_map;                               // Director
-    std::shared_ptr<std::vector<HardwareIdentifier>> hwid_vector;  // Image repo
-    if (!hwids_.empty() && ecus_.empty() && t2.hwids_.empty() && !t2.ecus_.empty()) {
-      ecu_map = std::make_shared<EcuMap>(t2.ecus_);
-      hwid_vector = std::make_shared<std::vector<HardwareIdentifier>>(hwids_);
-    } else if (!t2.hwids_.empty() && t2.ecus_.empty() && hwids_.empty() && !ecus_.empty()) {
-      ecu_map = std::make_shared<EcuMap>(ecus_);
-      hwid_vector = std::make_shared<std::vector<HardwareIdentifier>>(t2.hwids_);
+  if (d1.hwids != d2.hwids || d1.ecus != d2.ecus) {
+    const EcuMap *ecu_map = nullptr;                               // Director
+    const std::vector<HardwareIdentifier> *hwid_vector = nullptr;  // Image repo
+    if (!d1.hwids.empty() && d1.ecus.empty() && d2.hwids.empty() && !d2.ecus.empty()) {
+      ecu_map = &d2.ecus;
+      hwid_vector = &d1.hwids;
+    } else if (!d2.hwids.empty() && d2.ecus.empty() && d1.hwids.empty() && !d1.ecus.empty()) {
+      ecu_map = &d1.ecus;
+      hwid_vector = &d2.hwids;
     } else {
       return false;
     }
@@ -231,8 +246,8 @@ bool Target::MatchTarget(const Target &t2) const {
   // - all hashes of the same type should match
   // - at least one pair of hashes should match
   bool oneMatchingHash = false;
-  for (const Hash &hash : hashes_) {
-    for (const Hash &hash2 : t2.hashes_) {
+  for (const Hash &hash : d1.hashes) {
+    for (const Hash &hash2 : d2.hashes) {
       if (hash.type() == hash2.type() && !(hash == hash2)) {
         return false;
       }
@@ -246,40 +261,40 @@ bool Target::MatchTarget(const Target &t2) const {
 
 Json::Value Target::toDebugJson() const {
   Json::Value res;
-  for (const auto &ecu : ecus_) {
+  for (const auto &ecu : data_->ecus) {
     res["custom"]["ecuIdentifiers"][ecu.first.ToString()]["hardwareId"] = ecu.second.ToString();
   }
-  if (!hwids_.empty()) {
+  if (!data_->hwids.empty()) {
     Json::Value hwids;
-    for (Json::Value::ArrayIndex i = 0; i < static_cast<Json::Value::ArrayIndex>(hwids_.size()); ++i) {
-      hwids[i] = hwids_[i].ToString();
+    for (Json::Value::ArrayIndex i = 0; i < static_cast<Json::Value::ArrayIndex>(data_->hwids.size()); ++i) {
+      hwids[i] = data_->hwids[i].ToString();
     }
     res["custom"]["hardwareIds"] = hwids;
   }
-  res["custom"]["targetFormat"] = type_;
+  res["custom"]["targetFormat"] = data_->type;
 
-  for (const auto &hash : hashes_) {
+  for (const auto &hash : data_->hashes) {
     res["hashes"][hash.TypeString()] = hash.HashString();
   }
-  res["length"] = Json::Value(static_cast<Json::Value::Int64>(length_));
+  res["length"] = Json::Value(static_cast<Json::Value::Int64>(data_->length));
   return res;
 }
 
 std::ostream &Uptane::operator<<(std::ostream &os, const Target &t) {
-  os << "Target(" << t.filename_;
+  os << "Target(" << t.data_->filename;
   os << " ecu_identifiers: (";
-  for (const auto &ecu : t.ecus_) {
+  for (const auto &ecu : t.data_->ecus) {
     os << ecu.first << " (hw_id: " << ecu.second << "), ";
   }
   os << ")"
      << " hw_ids: (";
-  for (const auto &hwid : t.hwids_) {
+  for (const auto &hwid : t.data_->hwids) {
     os << hwid << ", ";
   }
   os << ")"
      << " length:" << t.length();
   os << " hashes: (";
-  for (const auto &hash : t.hashes_) {
+  for (const auto &hash : t.data_->hashes) {
     os << hash << ", ";
   }
   os << "))";
@@ -340,10 +355,12 @@ void Uptane::Targets::init(const Json::Value &json) {
     throw Uptane::InvalidMetadata("invalid targets.json");
   }
 
-  const Json::Value target_list = json["signed"]["targets"];
+  const Json::Value &target_list = json["signed"]["targets"];
+  targets.reserve(target_list.size());
+  target_index_.reserve(target_list.size());
   for (auto t_it = target_list.begin(); t_it != target_list.end(); t_it++) {
-    Target t(t_it.key().asString(), *t_it);
-    targets.push_back(t);
+    targets.emplace_back(t_it.key().asString(), *t_it);
+    target_index_.emplace(targets.back().filename(), targets.size() - 1);
   }
 
   if (json["signed"]["delegations"].isObject()) {
@@ -362,7 +379,8 @@ void Uptane::Targets::init(const Json::Value &json) {
       for (auto p_it = paths_list.begin(); p_it != paths_list.end(); p_it++) {
         paths.emplace_back((*p_it).asString());
       }
-      paths_for_role_[role] = paths;
+      indexPaths(delegated_role_names_.size() - 1, paths);
+      paths_for_role_[role] = std::move(paths);
 
       terminating_role_[role] = (*it)["terminating"].asBool();
     }
@@ -375,6 +393,112 @@ void Uptane::Targets::init(const Json::Value &json) {
   }
 }
 
+const Uptane::Target *Uptane::Targets::findTarget(const std::string &filename) const {
+  // `targets` is public, so only trust the index while it still describes it
+  if (target_index_.size() == targets.size()) {
+    const auto it = target_index_.find(filename);
+    if (it == target_index_.end()) {
+      return nullptr;
+    }
+    if (it->second < targets.size() && targets[it->second].filename() == filename) {
+      return &targets[it->second];
+    }
+  }
+  const auto it = std::find_if(targets.cbegin(), targets.cend(),
+                               [&filename](const Target &target) { return target.filename() == filename; });
+  return (it != targets.cend()) ? &*it : nullptr;
+}
+
+const Uptane::Target *Uptane::Targets::findMatchingTarget(const Target &target) const {
+  const Target *found = findTarget(target.filename());
+  return (found != nullptr && found->MatchTarget(target)) ? found : nullptr;
+}
+
+void Uptane::Targets::indexPaths(const size_t role, const std::vector<std::string> &paths) {
+  if (path_trie_.empty()) {
+    path_trie_.emplace_back();
+  }
+  for (const auto &pattern : paths) {
+    // fnmatch() without flags: only these are special, `*` also matches `/`
+    const size_t wildcard = pattern.find_first_of("*?[\\");
+    PathPattern::Kind kind = PathPattern::Kind::kGlob;
+    if (wildcard == std::string::npos) {
+      kind = PathPattern::Kind::kExact;
+    } else if (wildcard == pattern.size() - 1 && pattern[wildcard] == '*') {
+      kind = PathPattern::Kind::kPrefix;
+    }
+
+    size_t node = 0;
+    const size_t prefix_length = std::min(wildcard, pattern.size());
+    for (size_t i = 0; i < prefix_length; ++i) {
+      auto child = path_trie_[node].children.find(pattern[i]);
+      if (child == path_trie_[node].children.end()) {
+        path_trie_.emplace_back();
+        child = path_trie_[node].children.emplace(pattern[i], path_trie_.size() - 1).first;
+      }
+      node = child->second;
+    }
+    path_trie_[node].patterns.push_back(path_patterns_.size());
+    path_patterns_.push_back(PathPattern{role, pattern, kind});
+  }
+  indexed_roles_ = role + 1;
+}
+
+std::vector<std::string> Uptane::Targets::delegationsFor(const std::string &filename) const {
+  std::vector<bool> matched(delegated_role_names_.size(), false);
+  if (indexed_roles_ == delegated_role_names_.size()) {
+    // all the patterns whose prefix is a prefix of `filename` are on the way
+    // down the trie
+    size_t node = 0;
+    for (size_t depth = 0; !path_trie_.empty(); ++depth) {
+      for (const size_t p : path_trie_[node].patterns) {
+        const PathPattern &pattern = path_patterns_[p];
+        if (pattern.role >= matched.size() || matched[pattern.role]) {
+          continue;
+        }
+        switch (pattern.kind) {
+          case PathPattern::Kind::kExact:
+            matched[pattern.role] = depth == filename.size();
+            break;
+          case PathPattern::Kind::kPrefix:
+            matched[pattern.role] = true;
+            break;
+          case PathPattern::Kind::kGlob:
+            matched[pattern.role] = fnmatch(pattern.pattern.c_str(), filename.c_str(), 0) == 0;
+            break;
+        }
+      }
+      if (depth == filename.size()) {
+        break;
+      }
+      const auto child = path_trie_[node].children.find(filename[depth]);
+      if (child == path_trie_[node].children.end()) {
+        break;
+      }
+      node = child->second;
+    }
+  } else {
+    // the delegations are public, and have been changed since
+    for (size_t i = 0; i < delegated_role_names_.size(); ++i) {
+      const auto paths = paths_for_role_.find(Role::Delegation(delegated_role_names_[i]));
+      if (paths == paths_for_role_.end()) {
+        continue;
+      }
+      matched[i] = std::any_of(paths->second.begin(), paths->second.end(), [&filename](const std::string &pattern) {
+        return fnmatch(pattern.c_str(), filename.c_str(), 0) == 0;
+      });
+    }
+  }
+
+  std::vector<std::string> result;
+  for (size_t i = 0; i < delegated_role_names_.size(); ++i) {
+    if (matched[i]) {
+      result.push_back(delegated_role_names_[i]);
+    }
+  }
+  return result;
+}
+
 Uptane::Targets::Targets(const Json::Value &json) : MetaWithKeys(json) { init(json); }
 
 Uptane::Targets::Targets(RepositoryType repo, const Role &role, const Json::Value &json,
@@ -492,7 +616,20 @@ int Uptane::extractVersionUntrusted(const std::string &meta) {
   }
 }
 
-std::string Uptane::getMetaFromBundle(const MetaBundle &bundle, const RepositoryType repo, const Role &role) {
+TimeStamp Uptane::extractExpiryUntrusted(const std::string &meta) {
+  const Json::Value json = Utils::parseJSON(meta);
+  if (!json.isObject() || !json["signed"].isObject() || !json["signed"]["expires"].isString()) {
+    return TimeStamp();
+  }
+  try {
+    return TimeStamp(json["signed"]["expires"].asString());
+  } catch (const TimeStamp::InvalidTimeStamp &) {
+    return TimeStamp();
+  }
+}
+
+const std::string &Uptane::getMetaFromBundle(const MetaBundle &bundle, const RepositoryType repo,
+                                             const Role &role) {
   auto it = bundle.find(std::make_pair(repo, role));
   if (it == bundle.end()) {
     throw std::runtime_error("Metadata not found for " + role.ToString() + " role from the " + repo.ToString() +
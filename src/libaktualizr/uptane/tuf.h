@@ -7,8 +7,10 @@
 
 #include <functional>
 #include <map>
+#include <memory>
 #include <ostream>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 #include "libaktualizr/types.h"
@@ -80,41 +82,46 @@ class Role {
   }
 
   explicit Role(const std::string &role_name, bool delegation = false);
+  // No moves: a moved-from role would have no name.
+  Role(const Role &) = default;
+  Role &operator=(const Role &) = default;
+  ~Role() = default;
   std::string ToString() const;
   int ToInt() const { return static_cast<int>(role_); }
   bool IsDelegation() const { return role_ == RoleEnum::kDelegation; }
+  // the name is interned, see internIdentifier()
   bool operator==(const Role &other) const { return name_ == other.name_; }
   bool operator!=(const Role &other) const { return !(*this == other); }
-  bool operator<(const Role &other) const { return name_ < other.name_; }
+  bool operator<(const Role &other) const { return *name_ < *other.name_; }
 
   friend std::ostream &operator<<(std::ostream &os, const Role &role);
+  friend struct std::hash<Uptane::Role>;
 
  private:
   /** The four standard roles must match the meta_types table in sqlstorage.
    *  Delegations are special and handled differently. */
   enum class RoleEnum { kRoot = 0, kSnapshot = 1, kTargets = 2, kTimestamp = 3, kDelegation = 4, kInvalidRole = -1 };
 
-  explicit Role(RoleEnum role) : role_(role) {
-    if (role_ == RoleEnum::kRoot) {
-      name_ = ROOT;
-    } else if (role_ == RoleEnum::kSnapshot) {
-      name_ = SNAPSHOT;
-    } else if (role_ == RoleEnum::kTargets) {
-      name_ = TARGETS;
-    } else if (role_ == RoleEnum::kTimestamp) {
-      name_ = TIMESTAMP;
-    } else {
-      role_ = RoleEnum::kInvalidRole;
-      name_ = "invalidrole";
-    }
-  }
+  explicit Role(RoleEnum role);
 
   RoleEnum role_;
-  std::string name_;
+  std::shared_ptr<const std::string> name_;
 };
 
 std::ostream &operator<<(std::ostream &os, const Role &role);
 
+}  // namespace Uptane
+
+namespace std {
+// the name is interned
+template <>
+struct hash<Uptane::Role> {
+  size_t operator()(const Uptane::Role &role) const { return std::hash<const std::string *>()(role.name_.get()); }
+};
+}  // namespace std
+
+namespace Uptane {
+
 /**
  * Metadata version numbers
  */
@@ -207,6 +214,8 @@ class MetaWithKeys : public BaseMeta {
    */
   virtual void UnpackSignedObject(RepositoryType repo, const Role &role, const Json::Value &signed_object);
 
+  const std::map<KeyId, PublicKey> &keys() const { return keys_; }
+
   bool operator==(const MetaWithKeys &rhs) const {
     return version_ == rhs.version_ && expiry_ == rhs.expiry_ && keys_ == rhs.keys_ &&
            keys_for_role_ == rhs.keys_for_role_ && thresholds_for_role_ == rhs.thresholds_for_role_;
@@ -219,6 +228,13 @@ class MetaWithKeys : public BaseMeta {
 
   static const int64_t kMinSignatures = 1;
   static const int64_t kMaxSignatures = 1000;
+  // Signatures of a role are verified by up to this many threads at once
+  static const size_t kMaxVerifyThreads = 4;
+
+  // Returns the number of good signatures, stopping early when the threshold
+  // is met or can no longer be met.
+  static size_t verifySignatures(const std::vector<std::pair<const PublicKey *, std::string>> &candidates,
+                                 const std::string &canonical, int64_t threshold);
 
   std::map<KeyId, PublicKey> keys_;
   std::set<std::pair<Role, KeyId>> keys_for_role_;
@@ -300,9 +316,13 @@ class Targets : public MetaWithKeys {
 
   void clear() {
     targets.clear();
+    target_index_.clear();
     delegated_role_names_.clear();
     paths_for_role_.clear();
     terminating_role_.clear();
+    path_patterns_.clear();
+    path_trie_.clear();
+    indexed_roles_ = 0;
   }
 
   // Only makes sense for Targets from the Director repo; the Image repo doesn't
@@ -323,6 +343,30 @@ class Targets : public MetaWithKeys {
     return result;
   }
 
+  /**
+   * Find a target by its filename, without scanning the whole list.
+   * Filenames are unique within a Targets metadata, as they are the keys of
+   * its `targets` object.
+   * @return nullptr if there is no such target.
+   */
+  const Target *findTarget(const std::string &filename) const;
+
+  /**
+   * Find the target that matches `target`, as defined by
+   * Target::MatchTarget(). That requires the same filename, so there is at
+   * most one candidate, found through the filename index.
+   * @return nullptr if there is no such target.
+   */
+  const Target *findMatchingTarget(const Target &target) const;
+
+  /**
+   * The delegated roles whose path patterns match `filename`, in the order of
+   * the delegations. The patterns are indexed by their literal prefix when the
+   * metadata is parsed, so only the ones that share a prefix with `filename`
+   * are matched against it.
+   */
+  std::vector<std::string> delegationsFor(const std::string &filename) const;
+
   std::vector<Uptane::Target> targets;
   std::vector<std::string> delegated_role_names_;
   std::map<Role, std::vector<std::string>> paths_for_role_;
@@ -330,9 +374,33 @@ class Targets : public MetaWithKeys {
 
  private:
   void init(const Json::Value &json);
+  void indexPaths(size_t role, const std::vector<std::string> &paths);
 
   std::string name_;
   std::string correlation_id_;  // custom non-tuf
+  // filename -> position in `targets`, built from the metadata
+  std::unordered_map<std::string, size_t> target_index_;
+
+  struct PathPattern {
+    enum class Kind {
+      kExact,   // no wildcards
+      kPrefix,  // a single `*` at the end, matched by the prefix alone
+      kGlob,
+    };
+    size_t role;  // position in delegated_role_names_
+    std::string pattern;
+    Kind kind;
+  };
+  struct PathNode {
+    std::map<char, size_t> children;
+    // the patterns whose literal prefix ends here
+    std::vector<size_t> patterns;
+  };
+  // the path patterns of the delegations, in a trie of their literal
+  // prefixes, built from the metadata
+  std::vector<PathPattern> path_patterns_;
+  std::vector<PathNode> path_trie_;
+  size_t indexed_roles_{0};
 };
 
 class TimestampMeta : public BaseMeta {
@@ -374,26 +442,30 @@ class Snapshot : public BaseMeta {
 
 struct MetaPairHash {
   std::size_t operator()(const std::pair<RepositoryType, Role> &pair) const {
-    return std::hash<std::string>()(pair.first.ToString()) ^ std::hash<std::string>()(pair.second.ToString());
+    return std::hash<std::string>()(pair.first.ToString()) ^ std::hash<Role>()(pair.second);
   }
 };
 
-std::string getMetaFromBundle(const MetaBundle &bundle, RepositoryType repo, const Role &role);
+const std::string &getMetaFromBundle(const MetaBundle &bundle, RepositoryType repo, const Role &role);
 
 int extractVersionUntrusted(const std::string &meta);  // returns negative number if parsing fails
+TimeStamp extractExpiryUntrusted(const std::string &meta);  // returns an invalid TimeStamp if parsing fails
 
 }  // namespace Uptane
 
 namespace std {
+// identifiers are interned, see Uptane::internIdentifier()
 template <>
 struct hash<Uptane::HardwareIdentifier> {
-  size_t operator()(const Uptane::HardwareIdentifier &hwid) const { return std::hash<std::string>()(hwid.hwid_); }
+  size_t operator()(const Uptane::HardwareIdentifier &hwid) const {
+    return std::hash<const std::string *>()(hwid.hwid_.get());
+  }
 };
 
 template <>
 struct hash<Uptane::EcuSerial> {
   size_t operator()(const Uptane::EcuSerial &ecu_serial) const {
-    return std::hash<std::string>()(ecu_serial.ecu_serial_);
+    return std::hash<const std::string *>()(ecu_serial.ecu_serial_.get());
   }
 };
 }  // namespace std
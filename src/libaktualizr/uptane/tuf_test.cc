@@ -3,8 +3,10 @@
 #include <map>
 #include <vector>
 
+#include <boost/algorithm/hex.hpp>
 #include <json/json.h>
 
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
 #include "uptane/tuf.h"
@@ -60,6 +62,48 @@ TEST(Root, RootJsonRsassaPssSha256) {
   EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director(), initial_root, root));
 }
 
+/* A Root signed by several keys validates when enough of its signatures are
+ * good, whichever they are, and fails when too few are. */
+TEST(Root, SignatureThreshold) {
+  const size_t keys_num = 6;
+  const int threshold = 4;
+  std::vector<std::string> private_keys;
+  Json::Value root_json;
+  root_json["signed"]["_type"] = "Root";
+  root_json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  root_json["signed"]["version"] = 1;
+  for (size_t i = 0; i < keys_num; ++i) {
+    std::string public_key;
+    std::string private_key;
+    ASSERT_TRUE(Crypto::generateKeyPair(KeyType::kED25519, &public_key, &private_key));
+    const PublicKey key(public_key, KeyType::kED25519);
+    root_json["signed"]["keys"][key.KeyId()] = key.ToUptane();
+    root_json["signed"]["roles"]["root"]["keyids"].append(key.KeyId());
+    private_keys.push_back(boost::algorithm::unhex(private_key));
+  }
+  root_json["signed"]["roles"]["root"]["threshold"] = threshold;
+  const std::string canonical = Utils::jsonToCanonicalStr(root_json["signed"]);
+
+  auto sign = [&](size_t good) {
+    Json::Value signed_json = root_json;
+    for (size_t i = 0; i < keys_num; ++i) {
+      // the bad signatures come first
+      const std::string message = (i < keys_num - good) ? canonical + "x" : canonical;
+      Json::Value signature;
+      signature["keyid"] = root_json["signed"]["roles"]["root"]["keyids"][static_cast<int>(i)];
+      signature["method"] = "ed25519";
+      signature["sig"] = Utils::toBase64(Crypto::ED25519Sign(private_keys[i], message));
+      signed_json["signatures"].append(signature);
+    }
+    return signed_json;
+  };
+
+  Uptane::Root accept_all(Uptane::Root::Policy::kAcceptAll);
+  Uptane::Root root(Uptane::RepositoryType::Director(), sign(keys_num), accept_all);
+  EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director(), sign(threshold), root));
+  EXPECT_THROW(Uptane::Root(Uptane::RepositoryType::Director(), sign(threshold - 1), root), Uptane::UnmetThreshold);
+}
+
 /* Validate TUF roles. */
 TEST(Role, ValidateRoles) {
   Uptane::Role root = Uptane::Role::Root();
@@ -90,6 +134,26 @@ TEST(Role, ValidDelegationName) {
   EXPECT_EQ(delegated.IsDelegation(), true);
 }
 
+/* Equal roles and identifiers are equal however they are made, and hash the
+ * same. */
+TEST(Role, Interned) {
+  EXPECT_EQ(Uptane::Role("Targets"), Uptane::Role::Targets());
+  EXPECT_EQ(Uptane::Role("whatever", true), Uptane::Role::Delegation(std::string("what") + "ever"));
+  EXPECT_NE(Uptane::Role::Delegation("whatever"), Uptane::Role::Delegation("Whatever"));
+  EXPECT_NE(Uptane::Role::Root(), Uptane::Role::Targets());
+  EXPECT_LT(Uptane::Role::Root(), Uptane::Role::Targets());
+  EXPECT_EQ(std::hash<Uptane::Role>()(Uptane::Role("timestamp")),
+            std::hash<Uptane::Role>()(Uptane::Role::Timestamp()));
+
+  const Uptane::EcuSerial serial("ecu1");
+  EXPECT_EQ(serial, Uptane::EcuSerial(std::string("ecu") + "1"));
+  EXPECT_NE(serial, Uptane::EcuSerial("ecu2"));
+  EXPECT_EQ(std::hash<Uptane::EcuSerial>()(serial), std::hash<Uptane::EcuSerial>()(Uptane::EcuSerial("ecu1")));
+  const Uptane::HardwareIdentifier hwid("hw");
+  EXPECT_EQ(std::hash<Uptane::HardwareIdentifier>()(hwid),
+            std::hash<Uptane::HardwareIdentifier>()(Uptane::HardwareIdentifier("hw")));
+}
+
 /* Reject delegated role names that are identical to reserved role names. */
 TEST(Role, InvalidDelegationName) {
   EXPECT_THROW(Uptane::Role::Delegation("root"), Uptane::Exception);
@@ -283,6 +347,128 @@ TEST(Target, HashMismatch) {
   EXPECT_FALSE(target2.MatchTarget(target1));
 }
 
+/* Targets can be looked up by filename, also after the list has been changed
+ * directly. */
+TEST(Targets, FindTarget) {
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  for (int i = 0; i < 100; ++i) {
+    json["signed"]["targets"]["target-" + std::to_string(i)] = generateTarget("hash" + std::to_string(i), i);
+  }
+  Uptane::Targets targets(json);
+  ASSERT_EQ(targets.targets.size(), 100);
+
+  const Uptane::Target* found = targets.findTarget("target-42");
+  ASSERT_NE(found, nullptr);
+  EXPECT_EQ(found->filename(), "target-42");
+  EXPECT_EQ(found->length(), 42);
+  EXPECT_EQ(targets.findTarget("target-100"), nullptr);
+
+  const Uptane::Targets copy = targets;
+  found = copy.findTarget("target-7");
+  ASSERT_NE(found, nullptr);
+  // the copy points to its own targets
+  EXPECT_NE(found, targets.findTarget("target-7"));
+  EXPECT_EQ(found->length(), 7);
+
+  targets.targets.emplace_back("extra", generateTarget("hash_extra", 1000));
+  found = targets.findTarget("extra");
+  ASSERT_NE(found, nullptr);
+  EXPECT_EQ(found->length(), 1000);
+
+  targets.clear();
+  EXPECT_EQ(targets.findTarget("target-42"), nullptr);
+}
+
+/* A target is matched with the one of the same filename only if that one
+ * also has the same length and hashes. */
+TEST(Targets, FindMatchingTarget) {
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  for (int i = 0; i < 100; ++i) {
+    json["signed"]["targets"]["target-" + std::to_string(i)] = generateTarget("hash" + std::to_string(i), i);
+  }
+  const Uptane::Targets targets(json);
+
+  const Uptane::Target* found = targets.findMatchingTarget(Uptane::Target("target-42", generateTarget("hash42", 42)));
+  ASSERT_NE(found, nullptr);
+  EXPECT_EQ(found, targets.findTarget("target-42"));
+  EXPECT_EQ(targets.findMatchingTarget(Uptane::Target("target-42", generateTarget("hash43", 42))), nullptr);
+  EXPECT_EQ(targets.findMatchingTarget(Uptane::Target("target-42", generateTarget("hash42", 43))), nullptr);
+  EXPECT_EQ(targets.findMatchingTarget(Uptane::Target("target-100", generateTarget("hash100", 100))), nullptr);
+}
+
+/* The delegations of a target are found through the index of their path
+ * patterns, with the same matching as fnmatch() and in the order of the
+ * delegations. */
+TEST(Targets, DelegationsFor) {
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["targets"] = Json::objectValue;
+  json["signed"]["delegations"]["keys"] = Json::objectValue;
+  const std::vector<std::pair<std::string, std::vector<std::string>>> roles{
+      {"exact", {"supplier-a/firmware.bin"}},
+      {"prefix", {"supplier-a/*"}},
+      {"glob", {"supplier-?/*.bin", "other/[0-9]*"}},
+      {"everything", {"*"}},
+      {"none", {}},
+  };
+  for (const auto& role : roles) {
+    Json::Value json_role;
+    json_role["name"] = role.first;
+    json_role["keyids"] = Json::arrayValue;
+    json_role["threshold"] = 1;
+    json_role["terminating"] = false;
+    json_role["paths"] = Json::arrayValue;
+    for (const auto& path : role.second) {
+      json_role["paths"].append(path);
+    }
+    json["signed"]["delegations"]["roles"].append(json_role);
+  }
+  Uptane::Targets targets(json);
+
+  using Names = std::vector<std::string>;
+  EXPECT_EQ(targets.delegationsFor("supplier-a/firmware.bin"), (Names{"exact", "prefix", "glob", "everything"}));
+  EXPECT_EQ(targets.delegationsFor("supplier-a/firmware.bin.sig"), (Names{"prefix", "everything"}));
+  EXPECT_EQ(targets.delegationsFor("supplier-b/sub/dir.bin"), (Names{"glob", "everything"}));
+  EXPECT_EQ(targets.delegationsFor("other/1.txt"), (Names{"glob", "everything"}));
+  EXPECT_EQ(targets.delegationsFor("other/a.txt"), (Names{"everything"}));
+  EXPECT_EQ(targets.delegationsFor(""), (Names{"everything"}));
+
+  // changed directly
+  targets.delegated_role_names_.emplace_back("added");
+  targets.paths_for_role_[Uptane::Role::Delegation("added")] = {"other/*"};
+  EXPECT_EQ(targets.delegationsFor("other/a.txt"), (Names{"everything", "added"}));
+
+  targets.clear();
+  EXPECT_TRUE(targets.delegationsFor("supplier-a/firmware.bin").empty());
+}
+
+/* Copies of a target share its data until one of them is changed. */
+TEST(Target, CopyOnWrite) {
+  Uptane::EcuMap ecu_map{{Uptane::EcuSerial("serial"), Uptane::HardwareIdentifier("fake-test")}};
+  const Uptane::Target target("abc", generateDirectorTarget("hash_good", 739, ecu_map));
+  Uptane::Target copy = target;
+  EXPECT_EQ(&copy.hashes(), &target.hashes());
+  EXPECT_TRUE(copy.MatchTarget(target));
+
+  copy.setUri("https://example.com/abc");
+  EXPECT_NE(&copy.hashes(), &target.hashes());
+  EXPECT_EQ(copy.uri(), "https://example.com/abc");
+  EXPECT_EQ(target.uri(), "");
+  EXPECT_TRUE(copy.MatchTarget(target));
+
+  copy.InsertEcu({Uptane::EcuSerial("serial2"), Uptane::HardwareIdentifier("fake-test")});
+  EXPECT_EQ(copy.ecus().size(), 2);
+  EXPECT_EQ(target.ecus().size(), 1);
+}
+
 /* RepositoryType roundtrips via a string, and has the name we expect */
 TEST(RepositoryType, StringRoundTrip) {
   auto d = Uptane::RepositoryType::Director();
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <map>
+#include <mutex>
 #include <string>
 
 #include <boost/filesystem.hpp>
@@ -237,6 +239,97 @@ TEST(Delegation, IterateAll) {
   EXPECT_TRUE(expected_target_names.empty());
 }
 
+class HttpFakeDelegationCount : public HttpFakeDelegation {
+ public:
+  using HttpFakeDelegation::HttpFakeDelegation;
+
+  HttpResponse get(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control) override {
+    if (url.find("/role-") != std::string::npos || url.find("/delegation-") != std::string::npos) {
+      std::lock_guard<std::mutex> lock(m);
+      ++fetches[url];
+    }
+    return HttpFakeDelegation::get(url, maxsize, flow_control);
+  }
+
+  std::mutex m;
+  std::map<std::string, int> fetches;
+};
+
+/* Iterate over targets in delegation tree, with sibling delegations prefetched
+ * in parallel. The order is the same, and each delegation is only fetched
+ * once. */
+TEST(Delegation, IterateAllPrefetch) {
+  TemporaryDirectory temp_dir;
+  auto delegation_path = temp_dir.Path() / "delegation_test";
+  delegation_nested(delegation_path, false);
+  auto http = std::make_shared<HttpFakeDelegationCount>(temp_dir.Path());
+
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.max_parallel_delegation_fetches = 4;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+
+  storage->clearDelegations();
+  http->fetches.clear();
+
+  std::vector<std::string> expected_target_names = {"primary.txt", "abracadabra", "abc/secondary.txt", "abc/target0",
+                                                    "abc/target1", "abc/target2", "bcd/target0",       "cde/target0",
+                                                    "cde/target1", "def/target0"};
+  for (auto& target : aktualizr.uptane_client()->allTargets()) {
+    EXPECT_EQ(target.filename(), expected_target_names[0]);
+    expected_target_names.erase(expected_target_names.begin());
+  }
+  EXPECT_TRUE(expected_target_names.empty());
+
+  std::vector<std::pair<Uptane::Role, std::string>> delegations;
+  ASSERT_TRUE(storage->loadAllDelegations(delegations));
+  EXPECT_EQ(http->fetches.size(), delegations.size());
+  for (const auto& fetch : http->fetches) {
+    EXPECT_EQ(fetch.second, 1) << fetch.first;
+  }
+}
+
+/* Verified delegations are kept in memory: iterating again fetches nothing,
+ * even with the stored delegations gone. */
+TEST(Delegation, IterateAllCached) {
+  TemporaryDirectory temp_dir;
+  auto delegation_path = temp_dir.Path() / "delegation_test";
+  delegation_nested(delegation_path, false);
+  auto http = std::make_shared<HttpFakeDelegationCount>(temp_dir.Path());
+
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.max_parallel_delegation_fetches = 4;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+
+  size_t count = 0;
+  for (auto& target : aktualizr.uptane_client()->allTargets()) {
+    (void)target;
+    ++count;
+  }
+  EXPECT_EQ(count, 10);
+
+  storage->clearDelegations();
+  http->fetches.clear();
+  size_t count_cached = 0;
+  for (auto& target : aktualizr.uptane_client()->allTargets()) {
+    (void)target;
+    ++count_cached;
+  }
+  EXPECT_EQ(count_cached, count);
+  EXPECT_TRUE(http->fetches.empty());
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
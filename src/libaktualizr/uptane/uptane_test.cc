@@ -22,6 +22,7 @@
 #include "primary/sotauptaneclient.h"
 #include "storage/fsstorage_read.h"
 #include "storage/invstorage.h"
+#include "storage/sqlstorage.h"
 #include "test_utils.h"
 #include "uptane/tuf.h"
 #include "uptane/uptanerepository.h"
@@ -245,6 +246,36 @@ TEST(Uptane, PutManifest) {
             "test-package");
 }
 
+/* The TLS credentials are written to files once for all the downloads, and
+ * again only when they are loaded into the HTTP client again. */
+TEST(Uptane, TlsKeysReused) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config = config_common();
+  config.storage.path = temp_dir.Path();
+  boost::filesystem::copy_file("tests/test_data/cred.zip", (temp_dir / "cred.zip").string());
+  config.provision.provision_path = temp_dir / "cred.zip";
+  config.provision.mode = ProvisionMode::kSharedCred;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+
+  auto storage = INvStorage::newStorage(config.storage);
+  auto sota_client = std_::make_unique<UptaneTestCommon::TestUptaneClient>(config, storage, http);
+  EXPECT_NO_THROW(sota_client->initialize());
+
+  const std::shared_ptr<KeyManager> keys = sota_client->tlsKeys();
+  ASSERT_NE(keys, nullptr);
+  EXPECT_FALSE(keys->getCertFile().empty());
+  EXPECT_FALSE(keys->getPkeyFile().empty());
+  EXPECT_EQ(sota_client->tlsKeys(), keys);
+
+  EXPECT_TRUE(sota_client->provisioner_.loadSetTlsCreds());
+  const std::shared_ptr<KeyManager> reloaded = sota_client->tlsKeys();
+  EXPECT_NE(reloaded, keys);
+  EXPECT_EQ(reloaded->getCert(), keys->getCert());
+  // the previous files stay until their last user is done
+  EXPECT_TRUE(boost::filesystem::exists(keys->getCertFile()));
+}
+
 class HttpPutManifestFail : public HttpFake {
  public:
   HttpPutManifestFail(const boost::filesystem::path &test_dir_in, std::string flavor = "")
@@ -549,15 +580,19 @@ class SecondaryInterfaceMock : public SecondaryInterface {
       throw std::runtime_error("Key generation failure");
     }
     public_key_ = PublicKey(public_key, sconfig.key_type);
+    private_key_ = private_key;
     Json::Value manifest_unsigned;
     manifest_unsigned["key"] = "value";
-
+    signManifest(manifest_unsigned);
+  }
+  void signManifest(const Json::Value &manifest_unsigned) {
     std::string b64sig = Utils::toBase64(
-        Crypto::Sign(sconfig.key_type, nullptr, private_key, Utils::jsonToCanonicalStr(manifest_unsigned)));
+        Crypto::Sign(sconfig.key_type, nullptr, private_key_, Utils::jsonToCanonicalStr(manifest_unsigned)));
     Json::Value signature;
     signature["method"] = "rsassa-pss";
     signature["sig"] = b64sig;
     signature["keyid"] = public_key_.KeyId();
+    manifest_ = Json::Value();
     manifest_["signed"] = manifest_unsigned;
     manifest_["signatures"].append(signature);
   }
@@ -597,12 +632,14 @@ class SecondaryInterfaceMock : public SecondaryInterface {
     return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
   }
   virtual data::InstallationResult install(const Uptane::Target &, const api::FlowControlToken *) override {
-    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+    return install_result_;
   }
 
   std::shared_ptr<SecondaryProvider> secondary_provider_;
   PublicKey public_key_;
+  std::string private_key_;
   Json::Value manifest_;
+  data::InstallationResult install_result_{data::ResultCode::Numeric::kOk, ""};
 
   Primary::VirtualSecondaryConfig sconfig;
 };
@@ -668,6 +705,72 @@ TEST(Uptane, SendMetadataToSecondary) {
   EXPECT_TRUE(EcuInstallationStartedReportGot);
 }
 
+/*
+ * Complete the pending update of a Secondary once its manifest reports the
+ * new image.
+ */
+TEST(Uptane, PendingSecondaryCompleted) {
+  Config conf("tests/config/basic.toml");
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates");
+  conf.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  conf.provision.primary_ecu_hardware_id = "primary_hw";
+  conf.uptane.director_server = http->tls_server + "/director";
+  conf.uptane.repo_server = http->tls_server + "/repo";
+  conf.pacman.images_path = temp_dir.Path() / "images";
+  conf.storage.path = temp_dir.Path();
+  conf.tls.server = http->tls_server;
+
+  Primary::VirtualSecondaryConfig ecu_config;
+  ecu_config.partial_verifying = false;
+  ecu_config.full_client_dir = temp_dir.Path();
+  ecu_config.ecu_serial = "secondary_ecu_serial";
+  ecu_config.ecu_hardware_id = "secondary_hw";
+  ecu_config.ecu_private_key = "sec.priv";
+  ecu_config.ecu_public_key = "sec.pub";
+  ecu_config.firmware_path = temp_dir / "firmware.txt";
+  ecu_config.target_name_path = temp_dir / "firmware_name.txt";
+  ecu_config.metadata_path = temp_dir / "secondary_metadata";
+
+  auto sec = std::make_shared<SecondaryInterfaceMock>(ecu_config);
+  sec->install_result_ = data::InstallationResult(data::ResultCode::Numeric::kNeedCompletion, "");
+  EXPECT_CALL(*sec, putMetadataMock(::testing::_)).Times(::testing::AnyNumber());
+  auto storage = INvStorage::newStorage(conf.storage);
+  auto up = std_::make_unique<UptaneTestCommon::TestUptaneClient>(conf, storage, http);
+  up->addSecondary(sec);
+  EXPECT_NO_THROW(up->initialize());
+  result::UpdateCheck update_result = up->fetchMeta();
+  ASSERT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  result::Download download_result = up->downloadImages(update_result.updates);
+  ASSERT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+  up->uptaneInstall(download_result.updates);
+  EXPECT_TRUE(up->hasPendingUpdates());
+
+  // not installed yet
+  up->fetchMeta();
+  EXPECT_TRUE(up->hasPendingUpdates());
+
+  std::string sha256;
+  for (const auto &target : update_result.updates) {
+    if (target.ecus().count(Uptane::EcuSerial("secondary_ecu_serial")) != 0) {
+      sha256 = target.sha256Hash();
+    }
+  }
+  ASSERT_FALSE(sha256.empty());
+  Json::Value manifest_unsigned;
+  manifest_unsigned["installed_image"]["fileinfo"]["hashes"]["sha256"] = sha256;
+  sec->signManifest(manifest_unsigned);
+  up->fetchMeta();
+  EXPECT_FALSE(up->hasPendingUpdates());
+
+  boost::optional<Uptane::Target> current_version;
+  boost::optional<Uptane::Target> pending_version;
+  ASSERT_TRUE(storage->loadInstalledVersions("secondary_ecu_serial", &current_version, &pending_version));
+  ASSERT_TRUE(!!current_version);
+  EXPECT_EQ(current_version->sha256Hash(), sha256);
+  EXPECT_FALSE(!!pending_version);
+}
+
 /* Register Secondary ECUs with Director. */
 TEST(Uptane, UptaneSecondaryAdd) {
   TemporaryDirectory temp_dir;
@@ -742,6 +845,8 @@ class HttpFakeProv : public HttpFake {
       config.writeToStream(conf_ss);
       EXPECT_EQ(data, conf_ss.str());
       EXPECT_EQ(content_type, "application/toml");
+    } else if (url.find("/events") != std::string::npos) {
+      EXPECT_EQ(content_type, "application/json");
     } else {
       EXPECT_EQ(0, 1) << "Unexpected post to URL: " << url;
     }
@@ -1179,6 +1284,44 @@ TEST(Uptane, FsToSqlFull) {
   EXPECT_EQ(sql_image_snapshot, image_snapshot);
 }
 
+/* Resume a migration from the legacy filesystem storage that was interrupted
+ * after the SQL database was created. */
+TEST(Uptane, FsToSqlResume) {
+  TemporaryDirectory temp_dir;
+  Utils::copyDir("tests/test_data/prov", temp_dir.Path());
+  ASSERT_GE(chmod(temp_dir.Path().c_str(), S_IRWXU), 0);
+  StorageConfig config;
+  config.type = StorageType::kSqlite;
+  config.path = temp_dir.Path();
+
+  std::string device_id;
+  std::string director_root;
+  {
+    FSStorageRead fs_storage(config);
+    EXPECT_TRUE(fs_storage.loadDeviceId(&device_id));
+    EXPECT_TRUE(fs_storage.loadLatestRoot(&director_root, Uptane::RepositoryType::Director()));
+    ASSERT_EQ(fs_storage.rootVersions(Uptane::RepositoryType::Director()).size(), 1);
+    fs_storage.storeMigrationStep(FSStorageRead::MigrationStep::kCopy);
+  }
+  {
+    // the database was created, but nothing was committed to it
+    SQLStorage created(config, false);
+  }
+  EXPECT_TRUE(boost::filesystem::exists(config.sqldb_path.get(config.path)));
+
+  auto sql_storage = INvStorage::newStorage(config);
+  EXPECT_EQ(FSStorageRead::loadMigrationStep(config), FSStorageRead::MigrationStep::kNone);
+  EXPECT_FALSE(boost::filesystem::exists(Utils::absolutePath(config.path, "device_id")));
+  EXPECT_FALSE(boost::filesystem::exists(Utils::absolutePath(config.path, "is_registered")));
+
+  std::string sql_device_id;
+  std::string sql_director_root;
+  EXPECT_TRUE(sql_storage->loadDeviceId(&sql_device_id));
+  EXPECT_TRUE(sql_storage->loadLatestRoot(&sql_director_root, Uptane::RepositoryType::Director()));
+  EXPECT_EQ(sql_device_id, device_id);
+  EXPECT_EQ(sql_director_root, director_root);
+}
+
 /* Import a list of installed packages into the storage. */
 TEST(Uptane, InstalledVersionImport) {
   Config config = config_common();
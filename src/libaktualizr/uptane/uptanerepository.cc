@@ -1,7 +1,11 @@
 #include "uptane/uptanerepository.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <boost/algorithm/string/trim.hpp>
 
+#include "crypto/signaturecache.h"
 #include "fetcher.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
@@ -23,6 +27,7 @@ void RepositoryCommon::initRoot(RepositoryType repo_type, const std::string& roo
 void RepositoryCommon::verifyRoot(const std::string& root_raw) {
   try {
     int prev_version = rootVersion();
+    const std::map<KeyId, PublicKey> prev_keys = root.keys();
     // 5.4.4.3.2.3. Version N+1 of the Root metadata file MUST have been signed
     // by the following: (1) a threshold of keys specified in the latest Root
     // metadata file (version N), and (2) a threshold of keys specified in the
@@ -37,13 +42,49 @@ void RepositoryCommon::verifyRoot(const std::string& root_raw) {
                 << prev_version + 1;
       throw Uptane::RootRotationError(type);
     }
+    // the keys the new Root doesn't have anymore are revoked
+    for (const auto& key : prev_keys) {
+      if (root.keys().count(key.first) == 0 || root.keys().at(key.first) != key.second) {
+        SignatureCache::instance().forgetKey(key.second);
+      }
+    }
   } catch (const std::exception& e) {
     LOG_ERROR << "Signature verification for Root metadata failed: " << e.what();
     throw;
   }
 }
 
-void RepositoryCommon::resetRoot() { root = Root(Root::Policy::kAcceptAll); }
+void RepositoryCommon::resetRoot() {
+  root = Root(Root::Policy::kAcceptAll);
+  verified_ = false;
+}
+
+void RepositoryCommon::setVerified(const INvStorage& storage) {
+  verified_ = true;
+  verified_generation_ = storage.metadataGeneration(type);
+}
+
+void RepositoryCommon::checkMetaOfflineIfChanged(INvStorage& storage) {
+  // read first, a write made while checking makes the next call check again
+  const uint64_t generation = storage.metadataGeneration(type);
+  if (verified_ && verified_generation_ == generation) {
+    checkMetaExpired();
+    return;
+  }
+  checkMetaOffline(storage);
+  verified_ = true;
+  verified_generation_ = generation;
+}
+
+void RepositoryCommon::checkStoredExpiry(const INvStorage& storage, const std::vector<Role>& roles) const {
+  const TimeStamp now = TimeStamp::Now();
+  for (const auto& role : roles) {
+    TimeStamp expiry;
+    if (storage.loadMetaExpiry(type, role, &expiry) && expiry.IsExpiredAt(now)) {
+      throw Uptane::ExpiredMetadata(type, role.ToString());
+    }
+  }
+}
 
 void RepositoryCommon::updateRoot(INvStorage& storage, const IMetadataFetcher& fetcher,
                                   const RepositoryType repo_type) {
@@ -60,21 +101,44 @@ void RepositoryCommon::updateRoot(INvStorage& storage, const IMetadataFetcher& f
   }
 
   // 5.4.4.3.2. Update to the latest Root metadata file.
-  for (int version = rootVersion() + 1; version < kMaxRotations; ++version) {
+  // There is usually no new version, so the next one is tried alone first.
+  // After a rotation, the following ones are fetched a window at a time, in
+  // parallel where the fetcher can, as many as the latest Root claims to be
+  // left or otherwise twice as many as the previous window. Whatever is
+  // fetched is still verified strictly in order.
+  int version = rootVersion() + 1;
+  int window = 1;
+  int latest = -1;
+  bool hinted = false;
+  while (version < kMaxRotations) {
     // 5.4.4.3.2.2. Try downloading a new version N+1 of the Root metadata file.
-    std::string root_raw;
-    try {
-      fetcher.fetchRole(&root_raw, kMaxRootSize, repo_type, Role::Root(), Version(version));
-    } catch (const std::exception& e) {
+    window = std::min(window, static_cast<int>(kMaxRotations) - version);
+    const std::vector<std::string> roots =
+        fetcher.fetchRoleVersions(kMaxRootSize, repo_type, Role::Root(), version, window, nullptr);
+    for (const auto& root_raw : roots) {
+      verifyRoot(root_raw);
+
+      // 5.4.4.3.2.5. Set the latest Root metadata file to the new Root metadata
+      // file.
+      storage.storeRoot(root_raw, repo_type, Version(version));
+      storage.clearNonRootMeta(repo_type);
+      ++version;
+    }
+    if (roots.size() < static_cast<size_t>(window)) {
       break;
     }
 
-    verifyRoot(root_raw);
-
-    // 5.4.4.3.2.5. Set the latest Root metadata file to the new Root metadata
-    // file.
-    storage.storeRoot(root_raw, repo_type, Version(version));
-    storage.clearNonRootMeta(repo_type);
+    if (!hinted) {
+      latest = fetcher.latestRootVersionHint(repo_type, nullptr);
+      hinted = true;
+    }
+    if (latest >= version - 1) {
+      // one more, as there may be a newer version by now
+      window = latest - version + 2;
+    } else {
+      window *= 2;
+    }
+    window = std::min(window, kRootFetchWindow);
   }
 
   // 5.4.4.3.3. Check that the current (or latest securely attested) time is
@@ -3,6 +3,7 @@
 
 #include <cstdint>               // for int64_t
 #include <string>                // for string
+#include <vector>                // for vector
 #include "libaktualizr/types.h"  // for TimeStamp
 #include "uptane/tuf.h"          // for Root, RepositoryType
 #include "utilities/flow_control.h"
@@ -40,17 +41,38 @@ class RepositoryCommon {
    * @throws UptaneException if the local metadata is stale (this is not a failure)
    */
   virtual void checkMetaOffline(INvStorage &storage) = 0;
+  /**
+   * Same as checkMetaOffline(), unless the metadata in storage hasn't changed
+   * since it was verified by the previous call or by updateMeta(), as told by
+   * INvStorage::metadataGeneration(). Then only the expiration of the verified
+   * metadata is checked again.
+   */
+  void checkMetaOfflineIfChanged(INvStorage &storage);
   virtual void updateMeta(INvStorage &storage, const IMetadataFetcher &fetcher,
                           const api::FlowControlToken *flow_control) = 0;
 
  protected:
   void resetRoot();
   void updateRoot(INvStorage &storage, const IMetadataFetcher &fetcher, RepositoryType repo_type);
+  // the metadata in memory is what the storage has now, and it is valid
+  void setVerified(const INvStorage &storage);
+  // throws ExpiredMetadata like checkMetaOffline() if any verified role has expired
+  virtual void checkMetaExpired() = 0;
+  // throws ExpiredMetadata if the stored metadata of a role has expired, as
+  // told by the expiry indexed in storage, before anything is parsed
+  void checkStoredExpiry(const INvStorage &storage, const std::vector<Role> &roles) const;
 
   static const int64_t kMaxRotations = 1000;
+  // most Root versions fetched at once
+  static constexpr int kRootFetchWindow = 16;
 
   Root root{Root::Policy::kRejectAll};
   RepositoryType type;
+
+ private:
+  // storage metadata generation of the verified metadata, reset with the Root
+  bool verified_{false};
+  uint64_t verified_generation_{0};
 };
 }  // namespace Uptane
 
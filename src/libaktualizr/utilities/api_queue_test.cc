@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
+#include <future>
+#include <memory>
 #include <string>
 #include "utilities/apiqueue.h"
 
@@ -46,6 +49,55 @@ TEST(ApiQueue, Simple) {
   EXPECT_EQ(result.get(), 100);
 }
 
+/* Commands can be move-only, and are run with the token of their lane. */
+TEST(ApiQueue, MoveOnlyCommands) {
+  api::CommandQueue dut;
+  dut.run();
+  auto value = std::unique_ptr<int>(new int(42));
+  future<int> result = dut.enqueue([value = std::move(value)] { return *value; }, api::Lane::kDownload);
+  future<bool> token_result = dut.enqueue(
+      [&dut](const api::FlowControlToken* token) { return token == dut.FlowControlToken(api::Lane::kReporting); },
+      api::Lane::kReporting);
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_EQ(result.get(), 42);
+  ASSERT_EQ(token_result.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_TRUE(token_result.get());
+}
+
+/* Reporting commands run while a download is going on; metadata commands wait
+ * for it, and so do the reporting commands queued after them. */
+TEST(ApiQueue, Lanes) {
+  api::CommandQueue dut;
+  dut.run();
+  std::promise<void> download_can_finish;
+  std::shared_future<void> download_blocker = download_can_finish.get_future().share();
+  std::atomic<bool> download_done{false};
+
+  std::function<void()> download([download_blocker, &download_done] {
+    download_blocker.wait();
+    download_done = true;
+  });
+  future<void> download_result = dut.enqueue(std::move(download), api::Lane::kDownload);
+  std::function<bool()> report([&download_done] { return download_done.load(); });
+  future<bool> report_result = dut.enqueue(std::move(report), api::Lane::kReporting);
+  ASSERT_EQ(report_result.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_FALSE(report_result.get());
+
+  std::function<bool()> check([&download_done] { return download_done.load(); });
+  future<bool> check_result = dut.enqueue(std::move(check), api::Lane::kMetadata);
+  std::function<bool()> late_report([&download_done] { return download_done.load(); });
+  future<bool> late_report_result = dut.enqueue(std::move(late_report), api::Lane::kReporting);
+  EXPECT_EQ(check_result.wait_for(std::chrono::milliseconds(100)), future_status::timeout);
+  EXPECT_EQ(late_report_result.wait_for(std::chrono::milliseconds(0)), future_status::timeout);
+
+  download_can_finish.set_value();
+  ASSERT_EQ(check_result.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_TRUE(check_result.get());
+  ASSERT_EQ(late_report_result.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_TRUE(late_report_result.get());
+  download_result.get();
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
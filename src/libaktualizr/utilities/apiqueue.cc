@@ -1,5 +1,7 @@
 #include "apiqueue.h"
 #include "logging/logging.h"
+#include "utilities/metrics.h"
+#include "utilities/thread_policy.h"
 
 namespace api {
 
@@ -13,24 +15,70 @@ CommandQueue::~CommandQueue() {
   }
 }
 
+bool CommandQueue::canRunAlongside(const Lane a, const Lane b) {
+  return (a == Lane::kDownload && b == Lane::kReporting) || (a == Lane::kReporting && b == Lane::kDownload);
+}
+
 void CommandQueue::run() {
   std::lock_guard<std::mutex> g(thread_m_);
-  if (!thread_.joinable()) {
-    thread_ = std::thread([this] {
-      Context ctx{.flow_control = &token_};
-      std::unique_lock<std::mutex> lock(m_);
-      for (;;) {
-        cv_.wait(lock, [this] { return (!queue_.empty() && !paused_) || shutdown_; });
-        if (shutdown_) {
-          break;
-        }
-        auto task = std::move(queue_.front());
-        queue_.pop();
-        lock.unlock();
-        task->PerformTask(&ctx);
-        lock.lock();
+  for (size_t i = 0; i < kLanes; ++i) {
+    if (!threads_[i].joinable()) {
+      threads_[i] = std::thread(&CommandQueue::runLane, this, static_cast<Lane>(i));
+    }
+  }
+}
+
+std::deque<CommandQueue::QueuedCommand>::iterator CommandQueue::nextCommand(const Lane lane) {
+  for (size_t i = 0; i < kLanes; ++i) {
+    if (running_[i] && !canRunAlongside(static_cast<Lane>(i), lane)) {
+      return queue_.end();
+    }
+  }
+  for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+    if (it->lane == lane) {
+      return it;
+    }
+    if (!canRunAlongside(it->lane, lane)) {
+      // it goes first
+      return queue_.end();
+    }
+  }
+  return queue_.end();
+}
+
+void CommandQueue::runLane(const Lane lane) {
+  ThreadPolicies::instance().apply(ThreadPolicies::Worker::kCommands);
+  Context ctx{.flow_control = lane == Lane::kReporting ? &reporting_token_ : &token_};
+  auto& running = running_[static_cast<size_t>(lane)];
+  static const std::array<const char*, kLanes> lane_names{"metadata", "download", "install", "reporting"};
+  auto& wait_time = metrics::Registry::instance().histogram(
+      "aktualizr_command_wait_seconds", "Time commands spend queued before they start",
+      {{"lane", lane_names[static_cast<size_t>(lane)]}});
+  std::unique_lock<std::mutex> lock(m_);
+  for (;;) {
+    auto next = queue_.end();
+    cv_.wait(lock, [this, lane, &next] {
+      if (shutdown_) {
+        return true;
       }
+      next = paused_ ? queue_.end() : nextCommand(lane);
+      return next != queue_.end();
     });
+    if (shutdown_) {
+      break;
+    }
+    wait_time.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - next->queued_at)
+            .count()));
+    auto task = std::move(next->task);
+    queue_.erase(next);
+    running = true;
+    lock.unlock();
+    task->PerformTask(&ctx);
+    lock.lock();
+    running = false;
+    // the other lanes may be able to go on now
+    cv_.notify_all();
   }
 }
 
@@ -41,6 +89,7 @@ bool CommandQueue::pause(bool do_pause) {
     has_effect = paused_ != do_pause;
     paused_ = do_pause;
     token_.setPause(do_pause);
+    reporting_token_.setPause(do_pause);
   }
   cv_.notify_all();
 
@@ -53,17 +102,21 @@ void CommandQueue::abort(bool restart_thread) {
     {
       std::lock_guard<std::mutex> g(m_);
       token_.setAbort();
+      reporting_token_.setAbort();
       shutdown_ = true;
     }
     cv_.notify_all();
-    if (thread_.joinable()) {
-      thread_.join();
+    for (auto& thread : threads_) {
+      if (thread.joinable()) {
+        thread.join();
+      }
     }
     {
       // Flush the queue and reset to initial state
       std::lock_guard<std::mutex> g(m_);
-      std::queue<ICommand::Ptr>().swap(queue_);
+      std::deque<QueuedCommand>().swap(queue_);
       token_.reset();
+      reporting_token_.reset();
       shutdown_ = false;
     }
   }
@@ -72,10 +125,10 @@ void CommandQueue::abort(bool restart_thread) {
   }
 }
 
-void CommandQueue::enqueue(ICommand::Ptr&& task) {
+void CommandQueue::enqueue(ICommand::Ptr&& task, const Lane lane) {
   {
     std::lock_guard<std::mutex> lock(m_);
-    queue_.push(std::move(task));
+    queue_.push_back(QueuedCommand{lane, std::move(task), std::chrono::steady_clock::now()});
   }
   cv_.notify_all();
 }
@@ -1,13 +1,17 @@
 #ifndef AKTUALIZR_APIQUEUE_H
 #define AKTUALIZR_APIQUEUE_H
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <type_traits>
 #include <utility>
 
 #include "utilities/flow_control.h"
@@ -20,7 +24,7 @@ struct Context {
 
 class ICommand {
  public:
-  using Ptr = std::shared_ptr<ICommand>;
+  using Ptr = std::unique_ptr<ICommand>;
   ICommand() = default;
   virtual ~ICommand() = default;
   // Non-movable-non-copyable
@@ -73,27 +77,47 @@ class CommandBase<void> : public ICommand {
   std::promise<void> result_;
 };
 
-template <class T>
+// Runs a callable of type F, which is kept in the command itself instead of a
+// std::function, so that queueing a command allocates it and its result only.
+// F may be move-only.
+template <class T, class F>
 class Command : public CommandBase<T> {
  public:
-  explicit Command(std::function<T()>&& func) : f_{std::move(func)} {}
+  explicit Command(F&& func) : f_{std::move(func)} {}
   T TaskImplementation(Context* ctx) override {
     (void)ctx;
     return f_();
   }
 
  private:
-  std::function<T()> f_;
+  F f_;
 };
 
-template <class T>
+template <class T, class F>
 class CommandFlowControl : public CommandBase<T> {
  public:
-  explicit CommandFlowControl(std::function<T(const api::FlowControlToken*)>&& func) : f_{std::move(func)} {}
+  explicit CommandFlowControl(F&& func) : f_{std::move(func)} {}
   T TaskImplementation(Context* ctx) override { return f_(ctx->flow_control); }
 
  private:
-  std::function<T(const api::FlowControlToken*)> f_;
+  F f_;
+};
+
+/**
+ * Lanes of the CommandQueue. Each lane runs its commands one at a time, in the
+ * order they were queued, on a thread of its own. Only download and reporting
+ * commands run alongside each other: metadata and install commands change
+ * what the others work with, and wait for every other lane to be idle. A
+ * command never overtakes an earlier one it can't run alongside.
+ */
+enum class Lane {
+  // checking for updates, and anything that isn't queued in another lane
+  kMetadata,
+  // downloads, and the removal of stored images
+  kDownload,
+  kInstall,
+  // device data, manifests and campaigns
+  kReporting,
 };
 
 class CommandQueue {
@@ -114,35 +138,58 @@ class CommandQueue {
    */
   void abort(bool restart_thread = true);
 
+  // The token of the metadata, download and install lanes, which never run at
+  // the same time and share it
   const api::FlowControlToken* FlowControlToken() const { return &token_; }
+  const api::FlowControlToken* FlowControlToken(Lane lane) const {
+    return lane == Lane::kReporting ? &reporting_token_ : &token_;
+  }
 
-  template <class R>
-  std::future<R> enqueue(std::function<R()>&& function) {
-    auto task = std::make_shared<Command<R>>(std::move(function));
-    enqueue(task);
-    return task->GetFuture();
+  template <class F, std::enable_if_t<std::is_invocable_v<F&>, int> = 0>
+  auto enqueue(F&& function, Lane lane = Lane::kMetadata) {
+    using R = std::invoke_result_t<F&>;
+    auto task = std::make_unique<Command<R, std::decay_t<F>>>(std::forward<F>(function));
+    auto result = task->GetFuture();
+    enqueue(std::move(task), lane);
+    return result;
   }
 
-  template <class R>
-  std::future<R> enqueue(std::function<R(const api::FlowControlToken*)>&& function) {
-    auto task = std::make_shared<CommandFlowControl<R>>(std::move(function));
-    enqueue(task);
-    return task->GetFuture();
+  template <class F, std::enable_if_t<std::is_invocable_v<F&, const api::FlowControlToken*>, int> = 0>
+  auto enqueue(F&& function, Lane lane = Lane::kMetadata) {
+    using R = std::invoke_result_t<F&, const api::FlowControlToken*>;
+    auto task = std::make_unique<CommandFlowControl<R, std::decay_t<F>>>(std::forward<F>(function));
+    auto result = task->GetFuture();
+    enqueue(std::move(task), lane);
+    return result;
   }
 
-  void enqueue(ICommand::Ptr&& task);
+  void enqueue(ICommand::Ptr&& task, Lane lane = Lane::kMetadata);
 
  private:
+  static constexpr size_t kLanes = 4;
+  struct QueuedCommand {
+    Lane lane;
+    ICommand::Ptr task;
+    std::chrono::steady_clock::time_point queued_at;
+  };
+
+  static bool canRunAlongside(Lane a, Lane b);
+  void runLane(Lane lane);
+  // The next command the lane can start, with m_ held
+  std::deque<QueuedCommand>::iterator nextCommand(Lane lane);
+
   std::atomic_bool shutdown_{false};
   std::atomic_bool paused_{false};
 
-  std::thread thread_;
+  std::array<std::thread, kLanes> threads_;
   std::mutex thread_m_;
 
-  std::queue<ICommand::Ptr> queue_;
+  std::deque<QueuedCommand> queue_;
+  std::array<bool, kLanes> running_{};
   std::mutex m_;
   std::condition_variable cv_;
   class api::FlowControlToken token_;
+  class api::FlowControlToken reporting_token_;
 };
 
 }  // namespace api
@@ -0,0 +1,143 @@
+#include "utilities/child_process.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#include "logging/logging.h"
+
+extern char** environ;  // NOLINT(readability-redundant-declaration)
+
+using std::chrono::steady_clock;
+
+// how often a program that has closed its output is checked for exit
+static constexpr std::chrono::milliseconds kExitPollInterval{10};
+
+static int remainingMs(steady_clock::time_point deadline) {
+  const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - steady_clock::now()).count();
+  return left > 0 ? static_cast<int>(left) : 0;
+}
+
+// read the output until the end, the deadline or the limit
+static void readOutput(int fd, steady_clock::time_point deadline, size_t max_output, ChildProcess::Result* result) {
+  std::array<char, 4096> buffer{};
+  while (true) {
+    const int timeout_ms = remainingMs(deadline);
+    if (timeout_ms == 0) {
+      result->timed_out = true;
+      return;
+    }
+    pollfd pfd{};
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    const int res = poll(&pfd, 1, timeout_ms);
+    if (res < 0 && errno != EINTR) {
+      return;
+    }
+    if (res <= 0) {
+      continue;
+    }
+    const ssize_t received = read(fd, buffer.data(), buffer.size());
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return;
+    }
+    const auto size = static_cast<size_t>(received);
+    if (result->output.size() + size > max_output) {
+      result->output.append(buffer.data(), max_output - result->output.size());
+      result->truncated = true;
+      return;
+    }
+    result->output.append(buffer.data(), size);
+  }
+}
+
+// a program may still run after closing its output, so it gets until the deadline to exit
+static int waitForExit(pid_t pid, steady_clock::time_point deadline, bool kill_now, bool* timed_out) {
+  int status = 0;
+  while (!kill_now) {
+    const pid_t res = waitpid(pid, &status, WNOHANG);
+    if (res == pid) {
+      return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+    if (res < 0 && errno != EINTR) {
+      return -1;
+    }
+    if (remainingMs(deadline) == 0) {
+      *timed_out = true;
+      break;
+    }
+    std::this_thread::sleep_for(kExitPollInterval);
+  }
+  kill(pid, SIGKILL);
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  return -1;
+}
+
+ChildProcess::Result ChildProcess::run(const std::vector<std::string>& argv, std::chrono::milliseconds timeout,
+                                       size_t max_output) {
+  Result result;
+  if (argv.empty()) {
+    return result;
+  }
+  std::array<int, 2> fds{};
+  if (pipe2(fds.data(), O_CLOEXEC) != 0) {
+    LOG_ERROR << "Could not create a pipe for " << argv[0] << ": " << std::strerror(errno);
+    return result;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  // dup2() clears O_CLOEXEC on the copy
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+  std::vector<char*> args;
+  args.reserve(argv.size() + 1);
+  for (const auto& arg : argv) {
+    args.push_back(const_cast<char*>(arg.c_str()));
+  }
+  args.push_back(nullptr);
+
+  const auto deadline = steady_clock::now() + timeout;
+  pid_t pid = 0;
+  const int error = posix_spawnp(&pid, args[0], &actions, nullptr, args.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+  if (error != 0) {
+    LOG_WARNING << "Could not run " << argv[0] << ": " << std::strerror(error);
+    close(fds[0]);
+    return result;
+  }
+
+  readOutput(fds[0], deadline, max_output, &result);
+  close(fds[0]);
+  const int exit_code = waitForExit(pid, deadline, result.timed_out || result.truncated, &result.timed_out);
+  if (result.timed_out) {
+    LOG_WARNING << argv[0] << " did not finish within " << timeout.count() << " ms and was killed";
+  } else if (result.truncated) {
+    LOG_WARNING << argv[0] << " wrote more than " << max_output << " bytes and was killed";
+  } else {
+    result.exit_code = exit_code;
+  }
+  return result;
+}
+
+std::future<ChildProcess::Result> ChildProcess::runAsync(std::vector<std::string> argv,
+                                                         std::chrono::milliseconds timeout, size_t max_output) {
+  return std::async(std::launch::async, [argv = std::move(argv), timeout, max_output]() {
+    return ChildProcess::run(argv, timeout, max_output);
+  });
+}
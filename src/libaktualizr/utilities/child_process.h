@@ -0,0 +1,36 @@
+#ifndef UTILITIES_CHILD_PROCESS_H_
+#define UTILITIES_CHILD_PROCESS_H_
+
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <string>
+#include <vector>
+
+/**
+ * Runs a program with posix_spawn(), without a shell, and collects its
+ * standard output. Unlike Utils::shell(), a program that hangs or floods its
+ * output is killed: after `timeout`, or once it has written more than
+ * `max_output` bytes. Its standard input and error are /dev/null.
+ */
+class ChildProcess {
+ public:
+  struct Result {
+    // exit code, -1 if the program could not be started or was killed
+    int exit_code{-1};
+    std::string output;
+    bool timed_out{false};
+    // the output went beyond the limit, and is cut there
+    bool truncated{false};
+
+    bool ok() const { return exit_code == 0 && !timed_out && !truncated; }
+  };
+
+  // `argv[0]` is looked up in PATH
+  static Result run(const std::vector<std::string>& argv, std::chrono::milliseconds timeout, size_t max_output);
+  // same as run(), in a thread of its own
+  static std::future<Result> runAsync(std::vector<std::string> argv, std::chrono::milliseconds timeout,
+                                      size_t max_output);
+};
+
+#endif  // UTILITIES_CHILD_PROCESS_H_
@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+#include "utilities/child_process.h"
+
+using std::chrono::milliseconds;
+
+TEST(ChildProcess, Output) {
+  auto result = ChildProcess::run({"sh", "-c", "echo out; echo err >&2; exit 3"}, milliseconds(10000), 1024);
+  EXPECT_EQ(result.exit_code, 3);
+  EXPECT_EQ(result.output, "out\n");
+  EXPECT_FALSE(result.ok());
+
+  auto future = ChildProcess::runAsync({"echo", "async"}, milliseconds(10000), 1024);
+  result = future.get();
+  EXPECT_TRUE(result.ok());
+  EXPECT_EQ(result.output, "async\n");
+
+  EXPECT_EQ(ChildProcess::run({"/nonexistent/program"}, milliseconds(10000), 1024).exit_code, -1);
+}
+
+/* Programs that hang or write too much are killed. */
+TEST(ChildProcess, Limits) {
+  const auto start = std::chrono::steady_clock::now();
+  auto result = ChildProcess::run({"sleep", "30"}, milliseconds(200), 1024);
+  EXPECT_TRUE(result.timed_out);
+  EXPECT_EQ(result.exit_code, -1);
+  // also when the output is closed early
+  result = ChildProcess::run({"sh", "-c", "exec >&-; sleep 30"}, milliseconds(200), 1024);
+  EXPECT_TRUE(result.timed_out);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+
+  result = ChildProcess::run({"yes"}, milliseconds(10000), 1000);
+  EXPECT_TRUE(result.truncated);
+  EXPECT_EQ(result.output.size(), 1000);
+  EXPECT_FALSE(result.ok());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,102 @@
+#include "utilities/deflate_stream.h"
+
+#include <limits>
+#include <stdexcept>
+
+#include <zlib.h>
+
+DeflateStream::DeflateStream(int level) : strm_{new z_stream{}} {
+  if (deflateInit(strm_.get(), level) != Z_OK) {
+    throw std::runtime_error("Failed to initialize the deflate compression");
+  }
+}
+
+DeflateStream::~DeflateStream() { deflateEnd(strm_.get()); }
+
+size_t DeflateStream::bound(size_t size) {
+  // deflateBound() plus the flush markers, and stored blocks once the data
+  // isn't compressed anymore
+  return size + (size >> 11U) + 64;
+}
+
+std::string DeflateStream::compress(const uint8_t* data, size_t size) {
+  if (size > std::numeric_limits<uInt>::max()) {
+    throw std::runtime_error("Data too large to be compressed at once");
+  }
+  std::string out;
+  if (!compressing_ && level_changed_) {
+    // everything before has been flushed, so that this only emits the end
+    // of the last block, if anything
+    out.resize(64);
+    strm_->next_in = nullptr;
+    strm_->avail_in = 0;
+    strm_->next_out = reinterpret_cast<Bytef*>(&out[0]);
+    strm_->avail_out = static_cast<uInt>(out.size());
+    deflateParams(strm_.get(), Z_NO_COMPRESSION, Z_DEFAULT_STRATEGY);
+    out.resize(out.size() - strm_->avail_out);
+    level_changed_ = false;
+  }
+
+  strm_->next_in = const_cast<Bytef*>(data);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+  strm_->avail_in = static_cast<uInt>(size);
+  do {
+    const size_t used = out.size();
+    out.resize(used + bound(strm_->avail_in));
+    strm_->next_out = reinterpret_cast<Bytef*>(&out[used]);
+    strm_->avail_out = static_cast<uInt>(out.size() - used);
+    const int r = deflate(strm_.get(), Z_SYNC_FLUSH);
+    if (r != Z_OK && r != Z_BUF_ERROR) {
+      throw std::runtime_error("Failed to compress data");
+    }
+    out.resize(out.size() - strm_->avail_out);
+  } while (strm_->avail_out == 0);
+  return out;
+}
+
+void DeflateStream::stopCompressing() {
+  if (compressing_) {
+    compressing_ = false;
+    level_changed_ = true;
+  }
+}
+
+InflateStream::InflateStream() : strm_{new z_stream{}} {
+  if (inflateInit(strm_.get()) != Z_OK) {
+    throw std::runtime_error("Failed to initialize the deflate decompression");
+  }
+}
+
+InflateStream::~InflateStream() { inflateEnd(strm_.get()); }
+
+bool InflateStream::decompress(const uint8_t* data, size_t size, const Sink& sink) {
+  if (size > std::numeric_limits<uInt>::max()) {
+    error_ = "Data too large to be decompressed at once";
+    return false;
+  }
+  output_.resize(kOutputSize);
+  strm_->next_in = const_cast<Bytef*>(data);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+  strm_->avail_in = static_cast<uInt>(size);
+  while (true) {
+    strm_->next_out = reinterpret_cast<Bytef*>(&output_[0]);
+    strm_->avail_out = static_cast<uInt>(output_.size());
+    const int r = inflate(strm_.get(), Z_SYNC_FLUSH);
+    if (r != Z_OK && r != Z_BUF_ERROR && r != Z_STREAM_END) {
+      error_ = (strm_->msg != nullptr) ? strm_->msg : "Invalid compressed data";
+      return false;
+    }
+    const size_t produced = output_.size() - strm_->avail_out;
+    if (produced > 0 && !sink(reinterpret_cast<const uint8_t*>(output_.data()), produced)) {
+      return false;
+    }
+    if (r == Z_STREAM_END) {
+      if (strm_->avail_in != 0) {
+        error_ = "Unexpected data after the end of the compressed stream";
+        return false;
+      }
+      return true;
+    }
+    if (strm_->avail_in == 0 && strm_->avail_out != 0) {
+      return true;
+    }
+  }
+}
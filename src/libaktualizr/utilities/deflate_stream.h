@@ -0,0 +1,77 @@
+#ifndef DEFLATE_STREAM_H_
+#define DEFLATE_STREAM_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+struct z_stream_s;
+
+/**
+ * Deflate (zlib format) compression of a stream that is sent in pieces.
+ *
+ * Every piece is flushed, so that the receiver can decompress it as soon as
+ * it gets it, and the compression state carries over from one piece to the
+ * next.
+ */
+class DeflateStream {
+ public:
+  // favour speed by default: the data is compressed on the fly
+  explicit DeflateStream(int level = 1);
+  ~DeflateStream();
+  DeflateStream(const DeflateStream&) = delete;
+  DeflateStream(DeflateStream&&) = delete;
+  DeflateStream& operator=(const DeflateStream&) = delete;
+  DeflateStream& operator=(DeflateStream&&) = delete;
+
+  /**
+   * Compress and flush a piece of the stream.
+   * @throws std::runtime_error on failure.
+   */
+  std::string compress(const uint8_t* data, size_t size);
+  // store the following pieces as they are, e.g. when they don't shrink
+  void stopCompressing();
+  bool compressing() const { return compressing_; }
+
+  // largest output for `size` bytes of input
+  static size_t bound(size_t size);
+
+ private:
+  std::unique_ptr<z_stream_s> strm_;
+  bool compressing_{true};
+  // the compression level is changed before the next piece
+  bool level_changed_{false};
+};
+
+/**
+ * Decompression of a DeflateStream, piece by piece.
+ */
+class InflateStream {
+ public:
+  using Sink = std::function<bool(const uint8_t* data, size_t size)>;
+
+  InflateStream();
+  ~InflateStream();
+  InflateStream(const InflateStream&) = delete;
+  InflateStream(InflateStream&&) = delete;
+  InflateStream& operator=(const InflateStream&) = delete;
+  InflateStream& operator=(InflateStream&&) = delete;
+
+  /**
+   * Decompress a piece of the stream and pass the output to `sink`, in parts
+   * of at most kOutputSize bytes.
+   * @return false if the data is invalid, or as soon as `sink` returns false.
+   */
+  bool decompress(const uint8_t* data, size_t size, const Sink& sink);
+  const std::string& error() const { return error_; }
+
+  static constexpr size_t kOutputSize{256 * 1024};
+
+ private:
+  std::unique_ptr<z_stream_s> strm_;
+  std::string output_;
+  std::string error_;
+};
+
+#endif  // DEFLATE_STREAM_H_
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "utilities/deflate_stream.h"
+
+static std::string inflateAll(InflateStream& inflater, const std::string& data) {
+  std::string out;
+  EXPECT_TRUE(inflater.decompress(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                                  [&out](const uint8_t* piece, size_t size) {
+                                    out.append(reinterpret_cast<const char*>(piece), size);
+                                    return true;
+                                  }));
+  return out;
+}
+
+/* Every compressed piece decompresses on its own, after the previous ones. */
+TEST(DeflateStream, Pieces) {
+  DeflateStream deflater;
+  InflateStream inflater;
+  const std::string piece_1(100000, 'a');
+  const std::string piece_2 = "some more data " + std::string(50000, 'b');
+
+  const std::string compressed_1 = deflater.compress(reinterpret_cast<const uint8_t*>(piece_1.data()), piece_1.size());
+  EXPECT_LT(compressed_1.size(), piece_1.size() / 10);
+  EXPECT_EQ(inflateAll(inflater, compressed_1), piece_1);
+
+  const std::string compressed_2 = deflater.compress(reinterpret_cast<const uint8_t*>(piece_2.data()), piece_2.size());
+  EXPECT_EQ(inflateAll(inflater, compressed_2), piece_2);
+}
+
+/* Once compression is stopped, the data is stored, within the bound. */
+TEST(DeflateStream, Stored) {
+  DeflateStream deflater;
+  InflateStream inflater;
+  const std::string piece_1(10000, 'a');
+  std::string piece_2(InflateStream::kOutputSize * 2 + 17, '\0');
+  for (size_t i = 0; i < piece_2.size(); ++i) {
+    piece_2[i] = static_cast<char>((i * 7919) >> 3);
+  }
+
+  EXPECT_EQ(inflateAll(inflater,
+                       deflater.compress(reinterpret_cast<const uint8_t*>(piece_1.data()), piece_1.size())),
+            piece_1);
+  deflater.stopCompressing();
+  EXPECT_FALSE(deflater.compressing());
+  const std::string compressed_2 = deflater.compress(reinterpret_cast<const uint8_t*>(piece_2.data()), piece_2.size());
+  EXPECT_LE(compressed_2.size(), DeflateStream::bound(piece_2.size()));
+  EXPECT_GE(compressed_2.size(), piece_2.size());
+  EXPECT_EQ(inflateAll(inflater, compressed_2), piece_2);
+}
+
+/* Invalid data is reported, and a sink can stop the decompression. */
+TEST(DeflateStream, Errors) {
+  InflateStream inflater;
+  const std::string garbage = "not compressed at all";
+  EXPECT_FALSE(inflater.decompress(reinterpret_cast<const uint8_t*>(garbage.data()), garbage.size(),
+                                   [](const uint8_t*, size_t) { return true; }));
+  EXPECT_FALSE(inflater.error().empty());
+
+  DeflateStream deflater;
+  InflateStream inflater_2;
+  const std::string data(1000, 'x');
+  const std::string compressed = deflater.compress(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+  EXPECT_FALSE(inflater_2.decompress(reinterpret_cast<const uint8_t*>(compressed.data()), compressed.size(),
+                                     [](const uint8_t*, size_t) { return false; }));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
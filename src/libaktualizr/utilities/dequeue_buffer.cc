@@ -1,53 +1,61 @@
 #include "utilities/dequeue_buffer.h"
 
-#include <cassert>
-#include <cstring>
+#include <algorithm>
 #include <stdexcept>
 
-char* DequeueBuffer::Head() {
-  assert(sentinel_ == kSentinel);
-  return buffer_.data();
-}
+char* DequeueBuffer::Head() { return buffer_.data() + head_; }  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
 
-size_t DequeueBuffer::Size() const {
-  assert(sentinel_ == kSentinel);
-  return written_bytes_;
-}
+size_t DequeueBuffer::Size() const { return tail_ - head_; }
 
 void DequeueBuffer::Consume(size_t bytes) {
-  assert(sentinel_ == kSentinel);
-  // It would be possible to have a smarter algorithm here that
-  // only shuffles bytes down when Tail() is called and we are getting
-  // close to the end of the buffer, or when the buffer is nearly empty
-  // the memmove operation is cheap. This isn't performance critical code.
-  if (written_bytes_ < bytes) {
+  if (Size() < bytes) {
     throw std::logic_error("Attempt to DequeueBuffer::Consume() more bytes than are valid");
   }
-  // Shuffle up the buffer
-  auto* next_unconsumed_byte = buffer_.begin() + bytes;
-  auto* end_of_written_area = buffer_.begin() + written_bytes_;
-  std::copy(next_unconsumed_byte, end_of_written_area, buffer_.begin());
-  written_bytes_ -= bytes;
+  head_ += bytes;
+  if (head_ == tail_) {
+    // Nothing has to be moved to start from the beginning again
+    head_ = tail_ = 0;
+    if (buffer_.size() > kShrinkSize) {
+      std::vector<char>(kInitialSize).swap(buffer_);
+    }
+  }
 }
 
-char* DequeueBuffer::Tail() {
-  assert(sentinel_ == kSentinel);
-  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-  return buffer_.data() + written_bytes_;
-}
+char* DequeueBuffer::Tail() { return buffer_.data() + tail_; }  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
 
 size_t DequeueBuffer::TailSpace() {
-  assert(sentinel_ == kSentinel);
-  return buffer_.size() - written_bytes_;
+  if (buffer_.size() - tail_ < kMinTailSpace) {
+    Reserve(std::min(kMinTailSpace, kMaxSize - Size()));
+  }
+  return buffer_.size() - tail_;
 }
 
 void DequeueBuffer::HaveEnqueued(size_t bytes) {
-  // Assert first. If we have corrupted memory, there is
-  // no amount of exception handling that will save us. Abort rather
-  // than risk a security hole
-  assert(sentinel_ == kSentinel);
-  if (buffer_.size() < written_bytes_ + bytes) {
+  if (buffer_.size() < tail_ + bytes) {
     throw std::logic_error("Wrote bytes beyond the end of the buffer");
   }
-  written_bytes_ += bytes;
+  tail_ += bytes;
+}
+
+void DequeueBuffer::Reserve(size_t bytes) {
+  const size_t size = Size();
+  if (bytes > kMaxSize - size) {
+    throw std::length_error("DequeueBuffer can't hold more than " + std::to_string(kMaxSize) + " bytes");
+  }
+  if (buffer_.size() - tail_ >= bytes) {
+    return;
+  }
+
+  const auto head = buffer_.begin() + static_cast<std::ptrdiff_t>(head_);
+  const auto tail = buffer_.begin() + static_cast<std::ptrdiff_t>(tail_);
+  if (buffer_.size() - size >= bytes) {
+    // Shuffle the unconsumed bytes down
+    std::copy(head, tail, buffer_.begin());
+  } else {
+    std::vector<char> grown(std::min(std::max(2 * buffer_.size(), size + bytes), kMaxSize));
+    std::copy(head, tail, grown.begin());
+    buffer_.swap(grown);
+  }
+  head_ = 0;
+  tail_ = size;
 }
@@ -1,15 +1,21 @@
 #ifndef UPTANE_DEQUEUE_BUFFER_H_
 #define UPTANE_DEQUEUE_BUFFER_H_
 
-#include <array>
 #include <cstddef>
+#include <vector>
 
 /**
  * A dequeue based on a contiguous buffer in memory. Used for buffering
  * data between recv() and ber_decode()
+ *
+ * The buffer grows when a message doesn't fit, up to kMaxSize. Consumed bytes
+ * are only moved out of the way when the space is needed at the tail.
  */
 class DequeueBuffer {
  public:
+  // Largest amount of data the buffer holds
+  static constexpr size_t kMaxSize{64 * 1024 * 1024};
+
   /**
    * A pointer to the first element that has not been Consumed().
    */
@@ -33,6 +39,8 @@ class DequeueBuffer {
 
   /**
    * The number of bytes beyond Tail() that are allocated and may be written to.
+   * Makes room for at least kMinTailSpace bytes unless the buffer is at kMaxSize.
+   * Invalidates the pointers returned by Head() and Tail().
    */
   size_t TailSpace();
 
@@ -42,16 +50,26 @@ class DequeueBuffer {
    */
   void HaveEnqueued(size_t bytes);
 
+  /**
+   * Make room for at least `bytes` after Tail(), e.g. for the rest of a
+   * message whose size is known. Invalidates the pointers returned by Head()
+   * and Tail().
+   * @throws std::length_error if the buffer would hold more than kMaxSize bytes
+   */
+  void Reserve(size_t bytes);
+
  private:
-  static constexpr int kSentinel = 1337161494;
+  static constexpr size_t kInitialSize{4096};
+  static constexpr size_t kMinTailSpace{1024};
+  // A buffer that has grown larger than this goes back to kInitialSize once it is empty
+  static constexpr size_t kShrinkSize{1024 * 1024};
 
   /**
-   * buffer_[0..written_bytes_] contains to contents of this dequeue
+   * buffer_[head_..tail_] contains to contents of this dequeue
    */
-  size_t written_bytes_{0};
-  std::array<char, 4096> buffer_{};  // Zero initialise as a security pesimisation
-  // NOLINTNEXTLINE (should be just for clang-diagnostic-unused-private-field but it won't work)
-  int sentinel_{kSentinel};  // Sentinel to check for writers overflowing buffer_
+  size_t head_{0};
+  size_t tail_{0};
+  std::vector<char> buffer_ = std::vector<char>(kInitialSize);  // Zero initialise as a security pesimisation
 };
 
 #endif  // UPTANE_DEQUEUE_BUFFER_H_
@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <cstring>
+#include <stdexcept>
 #include <string>
+
 #include "utilities/dequeue_buffer.h"
 
 TEST(DequeueBuffer, Simple) {
@@ -20,6 +23,45 @@ TEST(DequeueBuffer, Simple) {
   EXPECT_EQ(std::string(dut.Head(), dut.Size()), "lo world");
 }
 
+/* The buffer grows for data that doesn't fit, and keeps what hasn't been
+ * consumed when it moves or grows. */
+TEST(DequeueBuffer, Grow) {
+  DequeueBuffer dut;
+  std::string expected;
+  for (int i = 0; i < 20000; i++) {
+    const std::string part = std::to_string(i) + ",";
+    ASSERT_GE(dut.TailSpace(), part.size());
+    memcpy(dut.Tail(), part.data(), part.size());
+    dut.HaveEnqueued(part.size());
+    expected += part;
+    if (i % 7 == 6) {
+      dut.Consume(3);
+      expected.erase(0, 3);
+    }
+  }
+  EXPECT_GT(dut.Size(), 4096);
+  EXPECT_EQ(std::string(dut.Head(), dut.Size()), expected);
+
+  dut.Consume(dut.Size());
+  EXPECT_EQ(dut.Size(), 0);
+  EXPECT_GT(dut.TailSpace(), 0);
+}
+
+/* Reserve() makes room for a whole message, but not beyond the maximum size. */
+TEST(DequeueBuffer, Reserve) {
+  DequeueBuffer dut;
+  memcpy(dut.Tail(), "header", 6);
+  dut.HaveEnqueued(6);
+  dut.Consume(2);
+
+  dut.Reserve(100000);
+  EXPECT_GE(dut.TailSpace(), 100000);
+  EXPECT_EQ(std::string(dut.Head(), dut.Size()), "ader");
+  EXPECT_THROW(dut.Reserve(DequeueBuffer::kMaxSize), std::length_error);
+  EXPECT_THROW(dut.HaveEnqueued(dut.TailSpace() + 1), std::logic_error);
+  EXPECT_THROW(dut.Consume(5), std::logic_error);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,113 @@
+#include "utilities/memory_budget.h"
+
+#include <algorithm>
+
+#include "utilities/metrics.h"
+
+static const char *userName(MemoryBudget::User user) {
+  switch (user) {
+    case MemoryBudget::User::kHttp:
+      return "http";
+    case MemoryBudget::User::kMetadataCache:
+      return "metadata_cache";
+    case MemoryBudget::User::kDownload:
+      return "download";
+    case MemoryBudget::User::kReports:
+      return "reports";
+    case MemoryBudget::User::kSecondaryUpload:
+      return "secondary_upload";
+    default:
+      return "unknown";
+  }
+}
+
+MemoryBudget::Reservation::Reservation(Reservation &&other) noexcept
+    : budget_(other.budget_), user_(other.user_), size_(other.size_) {
+  other.size_ = 0;
+}
+
+MemoryBudget::Reservation &MemoryBudget::Reservation::operator=(Reservation &&other) noexcept {
+  if (this != &other) {
+    release();
+    budget_ = other.budget_;
+    user_ = other.user_;
+    size_ = other.size_;
+    other.size_ = 0;
+  }
+  return *this;
+}
+
+bool MemoryBudget::Reservation::grow(uint64_t bytes) {
+  if (budget_ == nullptr || !budget_->tryTake(user_, bytes)) {
+    return false;
+  }
+  size_ += bytes;
+  return true;
+}
+
+void MemoryBudget::Reservation::shrink(uint64_t bytes) {
+  bytes = std::min(bytes, size_);
+  if (bytes > 0) {
+    budget_->give(user_, bytes);
+    size_ -= bytes;
+  }
+}
+
+MemoryBudget &MemoryBudget::instance() {
+  static MemoryBudget budget;
+  return budget;
+}
+
+MemoryBudget::MemoryBudget() {
+  auto &registry = metrics::Registry::instance();
+  for (size_t i = 0; i < gauges_.size(); ++i) {
+    gauges_[i] = &registry.gauge("aktualizr_memory_budget_bytes", "Memory reserved by each kind of buffer",
+                                 {{"user", userName(static_cast<User>(i))}});
+  }
+  limit_gauge_ = &registry.gauge("aktualizr_memory_budget_limit_bytes", "Memory budget, 0 for no limit");
+}
+
+void MemoryBudget::setLimit(uint64_t bytes) {
+  limit_.store(bytes, std::memory_order_relaxed);
+  limit_gauge_->set(static_cast<int64_t>(bytes));
+}
+
+bool MemoryBudget::underPressure() const {
+  const uint64_t max = limit();
+  return max > 0 && used() > max - max / 4;
+}
+
+MemoryBudget::Reservation MemoryBudget::reserveUpTo(User user, uint64_t bytes, uint64_t min) {
+  Reservation res(this, user);
+  min = std::min(min, bytes);
+  const uint64_t max = limit();
+  uint64_t used_now = used_.load(std::memory_order_relaxed);
+  while (true) {
+    uint64_t size = bytes;
+    if (max > 0) {
+      size = std::max(min, std::min(bytes, used_now < max ? max - used_now : 0));
+    }
+    if (used_.compare_exchange_weak(used_now, used_now + size, std::memory_order_relaxed)) {
+      gauges_[static_cast<size_t>(user)]->add(static_cast<int64_t>(size));
+      res.size_ = size;
+      return res;
+    }
+  }
+}
+
+bool MemoryBudget::tryTake(User user, uint64_t bytes) {
+  const uint64_t max = limit();
+  uint64_t used_now = used_.load(std::memory_order_relaxed);
+  do {
+    if (max > 0 && used_now + bytes > max) {
+      return false;
+    }
+  } while (!used_.compare_exchange_weak(used_now, used_now + bytes, std::memory_order_relaxed));
+  gauges_[static_cast<size_t>(user)]->add(static_cast<int64_t>(bytes));
+  return true;
+}
+
+void MemoryBudget::give(User user, uint64_t bytes) {
+  used_.fetch_sub(bytes, std::memory_order_relaxed);
+  gauges_[static_cast<size_t>(user)]->add(-static_cast<int64_t>(bytes));
+}
@@ -0,0 +1,91 @@
+#ifndef UTILITIES_MEMORY_BUDGET_H_
+#define UTILITIES_MEMORY_BUDGET_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace metrics {
+class Gauge;
+}
+
+/**
+ * Process-wide cap on the memory taken by the larger buffers of aktualizr:
+ * HTTP responses kept in memory, the metadata cache, download buffers,
+ * batches of report events and the chunks of images sent to Secondaries in
+ * flight.
+ *
+ * Buffers reserve their size before they are filled. When the budget is
+ * used up, they get smaller (fewer download buffers, smaller report batches,
+ * narrower Secondary upload windows), the metadata cache evicts, and HTTP
+ * responses that don't fit fail like responses that are too large. The use
+ * of each kind of buffer is exported as the `aktualizr_memory_budget_bytes`
+ * gauge. Without a limit, the buffers are only counted.
+ */
+class MemoryBudget {
+ public:
+  enum class User { kHttp = 0, kMetadataCache, kDownload, kReports, kSecondaryUpload, kCount };
+
+  /**
+   * Memory reserved by one user. It is given back when the reservation is
+   * destroyed.
+   */
+  class Reservation {
+   public:
+    Reservation() = default;
+    ~Reservation() { release(); }
+    Reservation(const Reservation &) = delete;
+    Reservation(Reservation &&other) noexcept;
+    Reservation &operator=(const Reservation &) = delete;
+    Reservation &operator=(Reservation &&other) noexcept;
+
+    uint64_t size() const { return size_; }
+    // reserve `bytes` more, false if they don't fit
+    bool grow(uint64_t bytes);
+    void shrink(uint64_t bytes);
+    void release() { shrink(size_); }
+
+   private:
+    friend class MemoryBudget;
+    Reservation(MemoryBudget *budget, User user) : budget_(budget), user_(user) {}
+
+    MemoryBudget *budget_{nullptr};
+    User user_{User::kHttp};
+    uint64_t size_{0};
+  };
+
+  static MemoryBudget &instance();
+
+  // 0 for no limit
+  void setLimit(uint64_t bytes);
+  uint64_t limit() const { return limit_.load(std::memory_order_relaxed); }
+  uint64_t used() const { return used_.load(std::memory_order_relaxed); }
+  // less than a quarter of the budget is left
+  bool underPressure() const;
+
+  // an empty reservation, to grow as the buffer is filled
+  Reservation reservation(User user) { return Reservation(this, user); }
+  // as much as fits up to `bytes`, but at least `min` so that the buffer can
+  // be used at all, even beyond the limit
+  Reservation reserveUpTo(User user, uint64_t bytes, uint64_t min);
+
+  MemoryBudget(const MemoryBudget &) = delete;
+  MemoryBudget(MemoryBudget &&) = delete;
+  MemoryBudget &operator=(const MemoryBudget &) = delete;
+  MemoryBudget &operator=(MemoryBudget &&) = delete;
+
+ private:
+  MemoryBudget();
+  ~MemoryBudget() = default;
+
+  bool tryTake(User user, uint64_t bytes);
+  void give(User user, uint64_t bytes);
+
+  std::atomic<uint64_t> limit_{0};
+  std::atomic<uint64_t> used_{0};
+  std::array<metrics::Gauge *, static_cast<size_t>(User::kCount)> gauges_{};
+  metrics::Gauge *limit_gauge_{nullptr};
+};
+
+#endif  // UTILITIES_MEMORY_BUDGET_H_
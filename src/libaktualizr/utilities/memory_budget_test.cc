@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <utility>
+
+#include "utilities/memory_budget.h"
+#include "utilities/metrics.h"
+
+using User = MemoryBudget::User;
+
+/* Reservations fail beyond the limit, and are given back when destroyed. */
+TEST(MemoryBudget, Reserve) {
+  auto &budget = MemoryBudget::instance();
+  budget.setLimit(1000);
+  {
+    auto http = budget.reservation(User::kHttp);
+    EXPECT_TRUE(http.grow(600));
+    EXPECT_FALSE(budget.underPressure());
+    EXPECT_TRUE(http.grow(200));
+    EXPECT_TRUE(budget.underPressure());
+    auto cache = budget.reservation(User::kMetadataCache);
+    EXPECT_FALSE(cache.grow(300));
+    EXPECT_TRUE(cache.grow(200));
+    EXPECT_EQ(budget.used(), 1000);
+    http.shrink(500);
+    EXPECT_TRUE(cache.grow(300));
+
+    auto moved = std::move(cache);
+    EXPECT_EQ(cache.size(), 0);  // NOLINT(bugprone-use-after-move)
+    EXPECT_EQ(moved.size(), 500);
+    EXPECT_EQ(budget.used(), 800);
+  }
+  EXPECT_EQ(budget.used(), 0);
+  EXPECT_NE(metrics::Registry::instance().prometheus().find("aktualizr_memory_budget_bytes{user=\"http\"} 0"),
+            std::string::npos);
+  budget.setLimit(0);
+}
+
+/* Buffers get what is left, but never less than their minimum. */
+TEST(MemoryBudget, ReserveUpTo) {
+  auto &budget = MemoryBudget::instance();
+  budget.setLimit(1000);
+  auto download = budget.reserveUpTo(User::kDownload, 800, 100);
+  EXPECT_EQ(download.size(), 800);
+  auto upload = budget.reserveUpTo(User::kSecondaryUpload, 800, 100);
+  EXPECT_EQ(upload.size(), 200);
+  auto reports = budget.reserveUpTo(User::kReports, 800, 100);
+  EXPECT_EQ(reports.size(), 100);
+  EXPECT_EQ(budget.used(), 1100);
+  reports.release();
+  upload.release();
+  download.release();
+
+  // without a limit, everything fits
+  budget.setLimit(0);
+  EXPECT_EQ(budget.reserveUpTo(User::kDownload, 1 << 30, 1).size(), 1 << 30);
+  auto http = budget.reservation(User::kHttp);
+  EXPECT_TRUE(http.grow(1ULL << 40));
+  EXPECT_FALSE(budget.underPressure());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
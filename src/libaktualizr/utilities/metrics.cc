@@ -0,0 +1,204 @@
+#include "utilities/metrics.h"
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace metrics {
+
+void Histogram::record(uint64_t value) {
+  buckets_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+size_t Histogram::bucketIndex(uint64_t value) {
+  if (value < kSubBuckets) {
+    return value;
+  }
+  const auto magnitude = static_cast<unsigned int>(63 - __builtin_clzll(value));
+  const unsigned int shift = magnitude - kSubBucketBits;
+  return kSubBuckets + shift * kSubBuckets + ((value >> shift) - kSubBuckets);
+}
+
+uint64_t Histogram::bucketMax(size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  const auto shift = static_cast<unsigned int>((index - kSubBuckets) / kSubBuckets);
+  const uint64_t lowest = (kSubBuckets + (index - kSubBuckets) % kSubBuckets) << shift;
+  return lowest + ((uint64_t{1} << shift) - 1);
+}
+
+uint64_t Histogram::quantile(double q) const {
+  const uint64_t total = count();
+  if (total == 0) {
+    return 0;
+  }
+  const auto rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(q * static_cast<double>(total))), 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return bucketMax(i);
+    }
+  }
+  // values recorded while counting
+  return bucketMax(kBuckets - 1);
+}
+
+Registry &Registry::instance() {
+  static Registry registry;
+  return registry;
+}
+
+Registry::Family &Registry::family(const std::string &name, Kind kind, const std::string &help) {
+  auto it = families_.find(name);
+  if (it == families_.end()) {
+    it = families_.emplace(name, Family{kind, help}).first;
+  } else if (it->second.kind != kind) {
+    throw std::logic_error("Metric " + name + " is already registered as another kind of metric");
+  }
+  return it->second;
+}
+
+Counter &Registry::counter(const std::string &name, const std::string &help, const Labels &labels) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto &metric = family(name, Kind::kCounter, help).counters[labels];
+  if (metric == nullptr) {
+    metric = std_::make_unique<Counter>();
+  }
+  return *metric;
+}
+
+Gauge &Registry::gauge(const std::string &name, const std::string &help, const Labels &labels) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto &metric = family(name, Kind::kGauge, help).gauges[labels];
+  if (metric == nullptr) {
+    metric = std_::make_unique<Gauge>();
+  }
+  return *metric;
+}
+
+Histogram &Registry::histogram(const std::string &name, const std::string &help, const Labels &labels,
+                               double scale) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto &f = family(name, Kind::kHistogram, help);
+  f.scale = scale;
+  auto &metric = f.histograms[labels];
+  if (metric == nullptr) {
+    metric = std_::make_unique<Histogram>();
+  }
+  return *metric;
+}
+
+static std::string escape(const std::string &value) {
+  std::string escaped;
+  for (const char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+static std::string labelString(const Labels &labels, const std::string &extra = std::string()) {
+  if (labels.empty() && extra.empty()) {
+    return std::string();
+  }
+  std::string res = "{";
+  for (const auto &label : labels) {
+    if (res.size() > 1) {
+      res += ',';
+    }
+    res += label.first + "=\"" + escape(label.second) + "\"";
+  }
+  if (!extra.empty()) {
+    if (res.size() > 1) {
+      res += ',';
+    }
+    res += extra;
+  }
+  return res + "}";
+}
+
+static const std::array<std::pair<const char *, double>, 3> kQuantiles{{{"0.5", 0.5}, {"0.9", 0.9}, {"0.99", 0.99}}};
+
+std::string Registry::prometheus() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::ostringstream out;
+  for (const auto &named : families_) {
+    const std::string &name = named.first;
+    const Family &f = named.second;
+    out << "# HELP " << name << " " << f.help << "\n";
+    switch (f.kind) {
+      case Kind::kCounter:
+        out << "# TYPE " << name << " counter\n";
+        for (const auto &m : f.counters) {
+          out << name << labelString(m.first) << " " << m.second->value() << "\n";
+        }
+        break;
+      case Kind::kGauge:
+        out << "# TYPE " << name << " gauge\n";
+        for (const auto &m : f.gauges) {
+          out << name << labelString(m.first) << " " << m.second->value() << "\n";
+        }
+        break;
+      case Kind::kHistogram:
+        out << "# TYPE " << name << " summary\n";
+        for (const auto &m : f.histograms) {
+          const Histogram &h = *m.second;
+          for (const auto &q : kQuantiles) {
+            out << name << labelString(m.first, std::string("quantile=\"") + q.first + "\"") << " "
+                << static_cast<double>(h.quantile(q.second)) * f.scale << "\n";
+          }
+          out << name << "_sum" << labelString(m.first) << " " << static_cast<double>(h.sum()) * f.scale << "\n";
+          out << name << "_count" << labelString(m.first) << " " << h.count() << "\n";
+        }
+        break;
+    }
+  }
+  return out.str();
+}
+
+FileExporter::FileExporter(boost::filesystem::path path, std::chrono::seconds interval)
+    : path_(std::move(path)), interval_(std::max(interval, std::chrono::seconds(1))) {
+  thread_ = std::thread(&FileExporter::run, this);
+}
+
+FileExporter::~FileExporter() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  write();
+}
+
+void FileExporter::write() const {
+  try {
+    Utils::writeFile(path_, Registry::instance().prometheus());
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not write the metrics to " << path_ << ": " << e.what();
+  }
+}
+
+void FileExporter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [this] { return stopping_; })) {
+    lock.unlock();
+    write();
+    lock.lock();
+  }
+}
+
+}  // namespace metrics
@@ -0,0 +1,161 @@
+#ifndef UTILITIES_METRICS_H_
+#define UTILITIES_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * Counters, gauges and histograms of what aktualizr is doing, exported in the
+ * Prometheus text format.
+ *
+ * Metrics are created once in the process-wide Registry and live as long as
+ * the process; updating them takes no lock. Look a metric up once and keep
+ * the reference where it is updated often.
+ */
+namespace metrics {
+
+using Labels = std::map<std::string, std::string>;
+
+class Counter {
+ public:
+  void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+class Gauge {
+ public:
+  void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+  void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+/**
+ * Distribution of integer values, e.g. durations in microseconds.
+ *
+ * Buckets are log-linear like in HdrHistogram: values below kSubBuckets have
+ * a bucket each, and every power of two above is split in kSubBuckets
+ * buckets, so that a quantile is off by at most 1/kSubBuckets of its value
+ * whatever the range.
+ */
+class Histogram {
+ public:
+  static constexpr unsigned int kSubBucketBits = 3;
+  static constexpr uint64_t kSubBuckets = 1U << kSubBucketBits;
+  static constexpr size_t kBuckets = kSubBuckets * (64 - kSubBucketBits + 1);
+
+  void record(uint64_t value);
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  // Upper bound of the bucket holding quantile q (0 to 1), 0 when empty
+  uint64_t quantile(double q) const;
+
+  static size_t bucketIndex(uint64_t value);
+  // Largest value of the bucket
+  static uint64_t bucketMax(size_t index);
+
+ private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+};
+
+/**
+ * Records the time from its construction to its destruction in a histogram,
+ * in microseconds.
+ */
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Histogram &histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    histogram_.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count()));
+  }
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer(ScopedTimer &&) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(ScopedTimer &&) = delete;
+
+ private:
+  Histogram &histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+class Registry {
+ public:
+  static Registry &instance();
+
+  // The same name and labels always give the same metric. A name can only
+  // be used for one kind of metric.
+  Counter &counter(const std::string &name, const std::string &help, const Labels &labels = Labels());
+  Gauge &gauge(const std::string &name, const std::string &help, const Labels &labels = Labels());
+  // scale converts the recorded values to the exported unit, e.g. 1e-6 for
+  // durations recorded in microseconds and exported in seconds. Histograms
+  // are exported as summaries.
+  Histogram &histogram(const std::string &name, const std::string &help, const Labels &labels = Labels(),
+                       double scale = 1e-6);
+
+  std::string prometheus() const;
+
+ private:
+  enum class Kind { kCounter, kGauge, kHistogram };
+  struct Family {
+    Kind kind;
+    std::string help;
+    double scale{1.};
+    std::map<Labels, std::unique_ptr<Counter>> counters;
+    std::map<Labels, std::unique_ptr<Gauge>> gauges;
+    std::map<Labels, std::unique_ptr<Histogram>> histograms;
+  };
+
+  Family &family(const std::string &name, Kind kind, const std::string &help);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
+
+/**
+ * Writes the metrics to a file at a regular interval and when destroyed, for
+ * example for the textfile collector of the Prometheus node exporter. The
+ * file is replaced atomically.
+ */
+class FileExporter {
+ public:
+  FileExporter(boost::filesystem::path path, std::chrono::seconds interval);
+  ~FileExporter();
+  FileExporter(const FileExporter &) = delete;
+  FileExporter(FileExporter &&) = delete;
+  FileExporter &operator=(const FileExporter &) = delete;
+  FileExporter &operator=(FileExporter &&) = delete;
+
+  void write() const;
+
+ private:
+  void run();
+
+  const boost::filesystem::path path_;
+  const std::chrono::seconds interval_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+  std::thread thread_;
+};
+
+}  // namespace metrics
+
+#endif  // UTILITIES_METRICS_H_
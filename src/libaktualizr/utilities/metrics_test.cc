@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "utilities/metrics.h"
+#include "utilities/utils.h"
+
+using metrics::Histogram;
+
+/* Every value falls in a bucket whose upper bound is at most 1/8 above it. */
+TEST(Metrics, HistogramBuckets) {
+  for (uint64_t value = 0; value < 10000; ++value) {
+    const size_t index = Histogram::bucketIndex(value);
+    ASSERT_LT(index, Histogram::kBuckets);
+    EXPECT_GE(Histogram::bucketMax(index), value);
+    EXPECT_LE(Histogram::bucketMax(index), value + value / Histogram::kSubBuckets);
+    if (index > 0) {
+      EXPECT_LT(Histogram::bucketMax(index - 1), value);
+    }
+  }
+  EXPECT_EQ(Histogram::bucketIndex(UINT64_MAX), Histogram::kBuckets - 1);
+  EXPECT_EQ(Histogram::bucketMax(Histogram::kBuckets - 1), UINT64_MAX);
+}
+
+TEST(Metrics, HistogramQuantiles) {
+  Histogram histogram;
+  EXPECT_EQ(histogram.quantile(0.5), 0);
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    histogram.record(value);
+  }
+  EXPECT_EQ(histogram.count(), 1000);
+  EXPECT_EQ(histogram.sum(), 500500);
+  EXPECT_GE(histogram.quantile(0.5), 500);
+  EXPECT_LE(histogram.quantile(0.5), 500 + 500 / 8);
+  EXPECT_GE(histogram.quantile(0.99), 990);
+  EXPECT_LE(histogram.quantile(0.99), 990 + 990 / 8);
+  EXPECT_GE(histogram.quantile(1.), 1000);
+}
+
+/* The same name and labels give the same metric, other labels another one. */
+TEST(Metrics, Registry) {
+  auto &registry = metrics::Registry::instance();
+  auto &a = registry.counter("test_registry_total", "Test counter", {{"kind", "a"}});
+  auto &b = registry.counter("test_registry_total", "Test counter", {{"kind", "b"}});
+  EXPECT_NE(&a, &b);
+  EXPECT_EQ(&a, &registry.counter("test_registry_total", "Test counter", {{"kind", "a"}}));
+  EXPECT_THROW(registry.gauge("test_registry_total", "Test gauge"), std::logic_error);
+}
+
+TEST(Metrics, Prometheus) {
+  auto &registry = metrics::Registry::instance();
+  registry.counter("test_prometheus_total", "Test counter", {{"path", "a\"b"}}).add(3);
+  registry.gauge("test_prometheus_gauge", "Test gauge").set(-2);
+  registry.histogram("test_prometheus_seconds", "Test histogram").record(1000000);
+
+  const std::string text = registry.prometheus();
+  EXPECT_NE(text.find("# HELP test_prometheus_total Test counter\n# TYPE test_prometheus_total counter\n"
+                      "test_prometheus_total{path=\"a\\\"b\"} 3\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("# TYPE test_prometheus_gauge gauge\ntest_prometheus_gauge -2\n"), std::string::npos);
+  EXPECT_NE(text.find("# TYPE test_prometheus_seconds summary\n"), std::string::npos);
+  EXPECT_NE(text.find("test_prometheus_seconds_sum 1\n"), std::string::npos);
+  EXPECT_NE(text.find("test_prometheus_seconds_count 1\n"), std::string::npos);
+}
+
+TEST(Metrics, FileExporter) {
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "aktualizr.prom";
+  metrics::Registry::instance().counter("test_exporter_total", "Test counter").add();
+  {
+    metrics::FileExporter exporter(path, std::chrono::seconds(3600));
+    EXPECT_FALSE(boost::filesystem::exists(path));
+  }
+  // written when the exporter goes away
+  EXPECT_NE(Utils::readFile(path).find("test_exporter_total 1\n"), std::string::npos);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
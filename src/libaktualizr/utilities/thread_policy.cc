@@ -0,0 +1,146 @@
+#include "utilities/thread_policy.h"
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include "logging/logging.h"
+
+// from linux/ioprio.h; glibc has no wrappers for these system calls
+static constexpr int kIoprioWhoProcess = 1;
+static constexpr int kIoprioClassShift = 13;
+static constexpr int kIoprioClassRealTime = 1;
+static constexpr int kIoprioClassBestEffort = 2;
+static constexpr int kIoprioClassIdle = 3;
+
+static int parseInt(const std::string &value, int min, int max, const std::string &setting) {
+  size_t end = 0;
+  int res = 0;
+  try {
+    res = std::stoi(value, &end);
+  } catch (const std::logic_error &) {
+    end = 0;
+  }
+  if (value.empty() || end != value.size() || res < min || res > max) {
+    throw std::invalid_argument("Invalid thread policy setting: " + setting);
+  }
+  return res;
+}
+
+ThreadPolicy ThreadPolicy::parse(const std::string &settings) {
+  ThreadPolicy policy;
+  std::vector<std::string> entries;
+  boost::split(entries, settings, boost::is_any_of(" \t"), boost::token_compress_on);
+  for (const auto &entry : entries) {
+    if (entry.empty()) {
+      continue;
+    }
+    const auto equal = entry.find('=');
+    if (equal == std::string::npos) {
+      throw std::invalid_argument("Invalid thread policy setting: " + entry);
+    }
+    const std::string key = entry.substr(0, equal);
+    const std::string value = entry.substr(equal + 1);
+    if (key == "nice") {
+      policy.nice = parseInt(value, -20, 19, entry);
+    } else if (key == "ioprio") {
+      const auto colon = value.find(':');
+      const std::string io_class = value.substr(0, colon);
+      if (io_class == "idle" && colon == std::string::npos) {
+        policy.ioprio_class = kIoprioClassIdle;
+      } else if ((io_class == "be" || io_class == "rt") && colon != std::string::npos) {
+        policy.ioprio_class = io_class == "be" ? kIoprioClassBestEffort : kIoprioClassRealTime;
+        policy.ioprio_level = parseInt(value.substr(colon + 1), 0, 7, entry);
+      } else {
+        throw std::invalid_argument("Invalid thread policy setting: " + entry);
+      }
+    } else if (key == "cpus") {
+      std::vector<std::string> ranges;
+      boost::split(ranges, value, boost::is_any_of(","));
+      for (const auto &range : ranges) {
+        const auto dash = range.find('-');
+        const int first = parseInt(range.substr(0, dash), 0, CPU_SETSIZE - 1, entry);
+        const int last =
+            dash == std::string::npos ? first : parseInt(range.substr(dash + 1), first, CPU_SETSIZE - 1, entry);
+        for (int cpu = first; cpu <= last; ++cpu) {
+          policy.cpus.push_back(cpu);
+        }
+      }
+    } else if (key == "cgroup" && !value.empty()) {
+      policy.cgroup = value;
+    } else {
+      throw std::invalid_argument("Invalid thread policy setting: " + entry);
+    }
+  }
+  return policy;
+}
+
+void ThreadPolicy::apply(const std::string &worker) const {
+  const auto tid = static_cast<pid_t>(syscall(SYS_gettid));
+  // the nice value is per thread on Linux
+  if (nice && setpriority(PRIO_PROCESS, static_cast<id_t>(tid), *nice) != 0) {
+    LOG_WARNING << "Could not set the CPU priority of the " << worker << " thread: " << std::strerror(errno);
+  }
+  // with IOPRIO_WHO_PROCESS, 0 is the calling thread
+  if (ioprio_class &&
+      syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, (*ioprio_class << kIoprioClassShift) | ioprio_level) != 0) {
+    LOG_WARNING << "Could not set the I/O priority of the " << worker << " thread: " << std::strerror(errno);
+  }
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+      CPU_SET(static_cast<size_t>(cpu), &set);
+    }
+    if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+      LOG_WARNING << "Could not set the CPU affinity of the " << worker << " thread: " << std::strerror(errno);
+    }
+  }
+  if (!cgroup.empty()) {
+    // threaded cgroups v2 take threads, cgroups v1 take tasks
+    const boost::filesystem::path threads = cgroup / "cgroup.threads";
+    std::ofstream file((boost::filesystem::exists(threads) ? threads : cgroup / "tasks").string());
+    file << tid << std::endl;
+    if (!file) {
+      LOG_WARNING << "Could not move the " << worker << " thread to cgroup " << cgroup;
+    }
+  }
+}
+
+ThreadPolicies &ThreadPolicies::instance() {
+  static ThreadPolicies policies;
+  return policies;
+}
+
+void ThreadPolicies::set(Worker worker, ThreadPolicy policy) {
+  std::lock_guard<std::mutex> lock(m_);
+  policies_[static_cast<size_t>(worker)] = std::move(policy);
+}
+
+bool ThreadPolicies::has(Worker worker) const {
+  std::lock_guard<std::mutex> lock(m_);
+  return !policies_[static_cast<size_t>(worker)].empty();
+}
+
+void ThreadPolicies::apply(Worker worker) const {
+  static const std::array<const char *, static_cast<size_t>(Worker::kCount)> names{"download", "hasher", "command",
+                                                                                   "Secondary transfer"};
+  ThreadPolicy policy;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    policy = policies_[static_cast<size_t>(worker)];
+  }
+  if (!policy.empty()) {
+    policy.apply(names[static_cast<size_t>(worker)]);
+  }
+}
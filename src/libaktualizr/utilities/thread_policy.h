@@ -0,0 +1,78 @@
+#ifndef UTILITIES_THREAD_POLICY_H_
+#define UTILITIES_THREAD_POLICY_H_
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/optional.hpp>
+
+/**
+ * CPU and I/O scheduling of a thread, parsed from space separated settings:
+ *
+ * - `nice=<-20..19>`: CPU niceness
+ * - `ioprio=idle`, `ioprio=be:<0..7>` or `ioprio=rt:<0..7>`: I/O scheduling
+ *   class and level, as with ionice
+ * - `cpus=<list>`: CPUs it may run on, e.g. `2,3` or `0-1,4`
+ * - `cgroup=<path>`: cgroup it is moved to, e.g. a threaded cgroup v2 like
+ *   `/sys/fs/cgroup/aktualizr/background`
+ */
+struct ThreadPolicy {
+  boost::optional<int> nice;
+  // class and level of the I/O priority, see ioprio_set(2)
+  boost::optional<int> ioprio_class;
+  int ioprio_level{0};
+  std::vector<int> cpus;
+  boost::filesystem::path cgroup;
+
+  // throws std::invalid_argument
+  static ThreadPolicy parse(const std::string &settings);
+  bool empty() const { return !nice && !ioprio_class && cpus.empty() && cgroup.empty(); }
+  // Apply to the calling thread, failures are logged
+  void apply(const std::string &worker) const;
+};
+
+/**
+ * The policies of the threads that do the background work of an update, so
+ * that they don't slow down what the vehicle does meanwhile. They are set
+ * once from the configuration, before these threads start, and each thread
+ * applies its policy when it starts.
+ */
+class ThreadPolicies {
+ public:
+  enum class Worker {
+    // network transfers and writing the downloaded files
+    kDownload = 0,
+    // hashing the downloaded files
+    kHasher,
+    // the commands of the Aktualizr API, including the checks of the
+    // downloaded files
+    kCommands,
+    // sending metadata and images to Secondaries
+    kSecondaries,
+    kCount
+  };
+
+  static ThreadPolicies &instance();
+
+  void set(Worker worker, ThreadPolicy policy);
+  bool has(Worker worker) const;
+  void apply(Worker worker) const;
+
+  ThreadPolicies(const ThreadPolicies &) = delete;
+  ThreadPolicies(ThreadPolicies &&) = delete;
+  ThreadPolicies &operator=(const ThreadPolicies &) = delete;
+  ThreadPolicies &operator=(ThreadPolicies &&) = delete;
+
+ private:
+  ThreadPolicies() = default;
+  ~ThreadPolicies() = default;
+
+  mutable std::mutex m_;
+  std::array<ThreadPolicy, static_cast<size_t>(Worker::kCount)> policies_;
+};
+
+#endif  // UTILITIES_THREAD_POLICY_H_
@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <thread>
+
+#include "utilities/thread_policy.h"
+
+TEST(ThreadPolicy, Parse) {
+  EXPECT_TRUE(ThreadPolicy::parse("").empty());
+
+  const ThreadPolicy policy = ThreadPolicy::parse(" nice=10  ioprio=be:7 cpus=0-2,5 cgroup=/sys/fs/cgroup/ota ");
+  EXPECT_EQ(*policy.nice, 10);
+  EXPECT_EQ(*policy.ioprio_class, 2);
+  EXPECT_EQ(policy.ioprio_level, 7);
+  EXPECT_EQ(policy.cpus, (std::vector<int>{0, 1, 2, 5}));
+  EXPECT_EQ(policy.cgroup, "/sys/fs/cgroup/ota");
+  EXPECT_EQ(*ThreadPolicy::parse("ioprio=idle").ioprio_class, 3);
+
+  for (const auto* invalid : {"nice", "nice=20", "nice=1x", "ioprio=be", "ioprio=idle:1", "ioprio=rt:8", "cpus=3-1",
+                              "cpus=", "cgroup=", "affinity=1"}) {
+    EXPECT_THROW(ThreadPolicy::parse(invalid), std::invalid_argument) << invalid;
+  }
+}
+
+/* The policy only applies to the thread that applies it. Lowering the
+ * priority doesn't need privileges. */
+TEST(ThreadPolicy, Apply) {
+  ThreadPolicies::instance().set(ThreadPolicies::Worker::kHasher, ThreadPolicy::parse("nice=19 ioprio=idle cpus=0"));
+  EXPECT_TRUE(ThreadPolicies::instance().has(ThreadPolicies::Worker::kHasher));
+  EXPECT_FALSE(ThreadPolicies::instance().has(ThreadPolicies::Worker::kDownload));
+  const int nice_before = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+
+  int nice = 0;
+  bool on_cpu0 = false;
+  std::thread thread([&nice, &on_cpu0]() {
+    ThreadPolicies::instance().apply(ThreadPolicies::Worker::kHasher);
+    nice = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+    cpu_set_t set;
+    on_cpu0 = sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set);
+  });
+  thread.join();
+  EXPECT_EQ(nice, 19);
+  EXPECT_TRUE(on_cpu0);
+  EXPECT_EQ(getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid))), nice_before);
+  ThreadPolicies::instance().set(ThreadPolicies::Worker::kHasher, ThreadPolicy());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
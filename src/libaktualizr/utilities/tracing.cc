@@ -0,0 +1,74 @@
+#include "utilities/tracing.h"
+
+#include <unistd.h>
+
+#include <json/json.h>
+
+#include "utilities/utils.h"
+
+namespace tracing {
+
+Tracer &Tracer::instance() {
+  static Tracer tracer;
+  return tracer;
+}
+
+void Tracer::start() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  events_.clear();
+  origin_ = std::chrono::steady_clock::now();
+  recording_ = true;
+}
+
+// Small thread numbers are easier to follow in a trace than std::thread::id
+static unsigned int threadNumber() {
+  static std::atomic<unsigned int> next{1};
+  thread_local const unsigned int number = next++;
+  return number;
+}
+
+void Tracer::record(const char *name, std::string ecu, std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point end) {
+  const unsigned int thread = threadNumber();
+  std::lock_guard<std::mutex> guard(mutex_);
+  // the trace may have been restarted since the span began
+  if (!recording_ || start < origin_ || events_.size() >= kMaxEvents) {
+    return;
+  }
+  events_.push_back(Event{name, std::move(ecu),
+                          std::chrono::duration_cast<std::chrono::microseconds>(start - origin_).count(),
+                          std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(), thread});
+}
+
+std::string Tracer::stop() {
+  std::vector<Event> events;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    recording_ = false;
+    events.swap(events_);
+  }
+
+  Json::Value trace;
+  trace["displayTimeUnit"] = "ms";
+  Json::Value &trace_events = trace["traceEvents"];
+  trace_events = Json::arrayValue;
+  const int pid = getpid();
+  for (const auto &event : events) {
+    Json::Value json;
+    json["name"] = event.name;
+    json["cat"] = "aktualizr";
+    // complete event, with its duration
+    json["ph"] = "X";
+    json["ts"] = Json::Int64(event.start_us);
+    json["dur"] = Json::Int64(event.duration_us);
+    json["pid"] = pid;
+    json["tid"] = event.thread;
+    if (!event.ecu.empty()) {
+      json["args"]["ecu"] = event.ecu;
+    }
+    trace_events.append(json);
+  }
+  return Utils::jsonToCanonicalStr(trace);
+}
+
+}  // namespace tracing
@@ -0,0 +1,81 @@
+#ifndef UTILITIES_TRACING_H_
+#define UTILITIES_TRACING_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Spans of what aktualizr does, in the Chrome trace event format that
+ * chrome://tracing and Perfetto load.
+ *
+ * Nothing is recorded unless the process-wide Tracer was started; until then
+ * a Span costs an atomic load. Spans nest by time on each thread; the
+ * per-Secondary spans, which run on worker threads, carry the ECU serial.
+ */
+namespace tracing {
+
+class Tracer {
+ public:
+  // Spans beyond that are dropped, in case the trace is never stopped
+  static constexpr size_t kMaxEvents = 100000;
+
+  static Tracer &instance();
+
+  // Starts recording, dropping what was recorded before
+  void start();
+  // Stops recording and returns the trace as JSON
+  std::string stop();
+  bool recording() const { return recording_.load(std::memory_order_relaxed); }
+
+  void record(const char *name, std::string ecu, std::chrono::steady_clock::time_point start,
+              std::chrono::steady_clock::time_point end);
+
+ private:
+  struct Event {
+    const char *name;
+    std::string ecu;
+    int64_t start_us;
+    int64_t duration_us;
+    unsigned int thread;
+  };
+
+  std::atomic<bool> recording_{false};
+  std::mutex mutex_;
+  std::chrono::steady_clock::time_point origin_;
+  std::vector<Event> events_;
+};
+
+class Span {
+ public:
+  // name must outlive the trace, e.g. a string literal
+  explicit Span(const char *name, std::string ecu = std::string())
+      : recording_(Tracer::instance().recording()), name_(name), ecu_(std::move(ecu)) {
+    if (recording_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~Span() {
+    if (recording_) {
+      Tracer::instance().record(name_, std::move(ecu_), start_, std::chrono::steady_clock::now());
+    }
+  }
+  Span(const Span &) = delete;
+  Span(Span &&) = delete;
+  Span &operator=(const Span &) = delete;
+  Span &operator=(Span &&) = delete;
+
+ private:
+  const bool recording_;
+  const char *name_;
+  std::string ecu_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace tracing
+
+#endif  // UTILITIES_TRACING_H_
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "utilities/tracing.h"
+#include "utilities/utils.h"
+
+/* Spans are only recorded while the tracer is started. */
+TEST(Tracing, Recording) {
+  auto &tracer = tracing::Tracer::instance();
+  { tracing::Span span("before"); }
+  tracer.start();
+  {
+    tracing::Span outer("outer");
+    std::thread([] { tracing::Span inner("inner", "ecu1"); }).join();
+  }
+  const Json::Value trace = Utils::parseJSON(tracer.stop());
+  { tracing::Span span("after"); }
+
+  const Json::Value &events = trace["traceEvents"];
+  ASSERT_EQ(events.size(), 2);
+  // in the order they ended
+  EXPECT_EQ(events[0]["name"].asString(), "inner");
+  EXPECT_EQ(events[0]["args"]["ecu"].asString(), "ecu1");
+  EXPECT_EQ(events[1]["name"].asString(), "outer");
+  EXPECT_FALSE(events[1].isMember("args"));
+  EXPECT_NE(events[0]["tid"].asUInt(), events[1]["tid"].asUInt());
+  for (const auto &event : events) {
+    EXPECT_EQ(event["ph"].asString(), "X");
+  }
+  EXPECT_LE(events[1]["ts"].asInt64(), events[0]["ts"].asInt64());
+  EXPECT_GE(events[1]["ts"].asInt64() + events[1]["dur"].asInt64(),
+            events[0]["ts"].asInt64() + events[0]["dur"].asInt64());
+
+  EXPECT_EQ(Utils::parseJSON(tracer.stop())["traceEvents"].size(), 0);
+}
+
+/* A span started before the trace was restarted is left out. */
+TEST(Tracing, Restart) {
+  auto &tracer = tracing::Tracer::instance();
+  tracer.start();
+  {
+    tracing::Span span("old");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    tracer.start();
+  }
+  EXPECT_EQ(Utils::parseJSON(tracer.stop())["traceEvents"].size(), 0);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
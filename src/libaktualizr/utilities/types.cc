@@ -1,6 +1,8 @@
 #include <array>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
 #include <utility>
 
 #include "libaktualizr/types.h"
@@ -23,6 +25,49 @@ std::ostream &operator<<(std::ostream &os, const StorageType stype) {
   return os;
 }
 
+namespace {
+struct IdentifierPool {
+  std::mutex m;
+  // the keys point into the strings of the identifiers
+  std::unordered_map<std::string_view, std::weak_ptr<const std::string>> ids;
+};
+
+IdentifierPool &identifierPool() {
+  // never destroyed, as identifiers in static objects may outlive it
+  static auto *pool = new IdentifierPool();  // NOLINT(cppcoreguidelines-owning-memory)
+  return *pool;
+}
+
+void releaseIdentifier(const std::string *id) {
+  {
+    auto &pool = identifierPool();
+    std::lock_guard<std::mutex> lock(pool.m);
+    const auto it = pool.ids.find(std::string_view(*id));
+    // a new string for the same identifier may have replaced this one already
+    if (it != pool.ids.end() && it->first.data() == id->data()) {
+      pool.ids.erase(it);
+    }
+  }
+  delete id;  // NOLINT(cppcoreguidelines-owning-memory)
+}
+}  // namespace
+
+std::shared_ptr<const std::string> Uptane::internIdentifier(const std::string &id) {
+  auto &pool = identifierPool();
+  std::lock_guard<std::mutex> lock(pool.m);
+  const auto it = pool.ids.find(std::string_view(id));
+  if (it != pool.ids.end()) {
+    auto existing = it->second.lock();
+    if (existing) {
+      return existing;
+    }
+    pool.ids.erase(it);
+  }
+  std::shared_ptr<const std::string> result(new std::string(id), releaseIdentifier);
+  pool.ids.emplace(std::string_view(*result), result);
+  return result;
+}
+
 std::ostream &Uptane::operator<<(std::ostream &os, const HardwareIdentifier &hwid) {
   os << hwid.ToString();
   return os;
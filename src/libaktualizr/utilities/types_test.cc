@@ -48,6 +48,35 @@ TEST(Types, ResultCode) {
   EXPECT_EQ(data::ResultCode::fromRepr("OK"), data::ResultCode(data::ResultCode::Numeric::kUnknown, "OK"));
 }
 
+/* Equal identifiers share their storage while any of them is alive. */
+TEST(Types, InternIdentifier) {
+  auto id1 = Uptane::internIdentifier("test-hwid");
+  auto id2 = Uptane::internIdentifier(std::string("test-") + "hwid");
+  EXPECT_EQ(id1, id2);
+  EXPECT_EQ(*id1, "test-hwid");
+  EXPECT_NE(id1, Uptane::internIdentifier("other-hwid"));
+
+  Uptane::HardwareIdentifier hwid1("test-hwid");
+  Uptane::HardwareIdentifier hwid2 = hwid1;
+  EXPECT_EQ(hwid1, Uptane::HardwareIdentifier("test-hwid"));
+  EXPECT_EQ(hwid2.ToString(), "test-hwid");
+  EXPECT_LT(Uptane::EcuSerial("a"), Uptane::EcuSerial("b"));
+
+  id1.reset();
+  id2.reset();
+  // still used by the hardware identifiers
+  EXPECT_EQ(*Uptane::internIdentifier("test-hwid"), "test-hwid");
+
+  // a released identifier can be created again
+  {
+    auto tmp = Uptane::internIdentifier("released-id");
+    EXPECT_EQ(tmp.use_count(), 1);
+  }
+  auto again = Uptane::internIdentifier("released-id");
+  EXPECT_EQ(*again, "released-id");
+  EXPECT_EQ(again.use_count(), 1);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -2,8 +2,12 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cctype>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -20,18 +24,18 @@
 #include <ifaddrs.h>
 #include <netinet/in.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/archive/iterators/base64_from_binary.hpp>
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/remove_whitespace.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
+#include <boost/archive/iterators/dataflow_exception.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/uuid/random_generator.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
 #include "aktualizr_version.h"
+#include "child_process.h"
 #include "logging/logging.h"
 
 static const std::array<const char *, 132> adverbs = {
@@ -182,28 +186,147 @@ static const std::array<const char *, 128> names = {"Allerlei",
                                                     "Zwetschkenroester",
                                                     "Zwiebelkuchen"};
 
-using base64_text = boost::archive::iterators::base64_from_binary<
-    boost::archive::iterators::transform_width<std::string::const_iterator, 6, 8> >;
+namespace {
+constexpr const char *kBase64Alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+constexpr const char *kHexDigits = "0123456789ABCDEF";
+constexpr uint8_t kInvalid = 0xff;
+constexpr uint8_t kWhitespace = 0xfe;
+
+// Reverse lookup tables, one entry per input byte
+struct DecodeTables {
+  DecodeTables() {
+    base64.fill(kInvalid);
+    hex.fill(kInvalid);
+    for (uint8_t i = 0; i < 64; ++i) {
+      base64[static_cast<unsigned char>(kBase64Alphabet[i])] = i;
+    }
+    for (const char c : {' ', '\t', '\n', '\r'}) {
+      base64[static_cast<unsigned char>(c)] = kWhitespace;
+    }
+    for (uint8_t i = 0; i < 16; ++i) {
+      hex[static_cast<unsigned char>(kHexDigits[i])] = i;
+      hex[static_cast<unsigned char>(std::tolower(kHexDigits[i]))] = i;
+    }
+  }
+  std::array<uint8_t, 256> base64{};
+  std::array<uint8_t, 256> hex{};
+};
+
+const DecodeTables &decodeTables() {
+  static const DecodeTables tables;
+  return tables;
+}
 
-using base64_to_bin = boost::archive::iterators::transform_width<
-    boost::archive::iterators::binary_from_base64<
-        boost::archive::iterators::remove_whitespace<std::string::const_iterator> >,
-    8, 6>;
+[[noreturn]] void invalidBase64() {
+  throw boost::archive::iterators::dataflow_exception(
+      boost::archive::iterators::dataflow_exception::invalid_base64_character);
+}
+}  // namespace
 
+// Accepts the same input as the boost base64 iterators used to: whitespace is
+// skipped, padding is optional but at most two '=' may end the string.
 std::string Utils::fromBase64(std::string base64_string) {
-  std::ptrdiff_t paddingChars = std::count(base64_string.begin(), base64_string.end(), '=');
-  std::replace(base64_string.begin(), base64_string.end(), '=', 'A');
-  std::string result(base64_to_bin(base64_string.begin()), base64_to_bin(base64_string.end()));
-  result.erase(result.end() - paddingChars, result.end());
+  const auto &table = decodeTables().base64;
+  std::string result;
+  result.reserve(base64_string.size() / 4 * 3 + 2);
+
+  uint32_t bits = 0;
+  size_t digits = 0;
+  size_t padding = 0;
+  for (const char c : base64_string) {
+    const uint8_t value = table[static_cast<unsigned char>(c)];
+    if (value == kWhitespace) {
+      continue;
+    }
+    if (c == '=') {
+      ++padding;
+      continue;
+    }
+    if (value == kInvalid || padding > 0) {
+      invalidBase64();
+    }
+    bits = (bits << 6) | value;
+    if (++digits % 4 == 0) {
+      result.push_back(static_cast<char>(bits >> 16));
+      result.push_back(static_cast<char>((bits >> 8) & 0xff));
+      result.push_back(static_cast<char>(bits & 0xff));
+      bits = 0;
+    }
+  }
+
+  const size_t tail = digits % 4;
+  if (tail == 1 || padding > 2 || (padding > 0 && (tail + padding) % 4 != 0)) {
+    invalidBase64();
+  }
+  if (tail == 2) {
+    result.push_back(static_cast<char>(bits >> 4));
+  } else if (tail == 3) {
+    result.push_back(static_cast<char>(bits >> 10));
+    result.push_back(static_cast<char>((bits >> 2) & 0xff));
+  }
   return result;
 }
 
 std::string Utils::toBase64(const std::string &tob64) {
-  std::string b64sig(base64_text(tob64.begin()), base64_text(tob64.end()));
-  b64sig.append((3 - tob64.length() % 3) % 3, '=');
+  std::string b64sig;
+  b64sig.reserve((tob64.size() + 2) / 3 * 4);
+  const auto *in = reinterpret_cast<const unsigned char *>(tob64.data());
+  size_t i = 0;
+  for (; i + 2 < tob64.size(); i += 3) {
+    const uint32_t bits = (static_cast<uint32_t>(in[i]) << 16) | (static_cast<uint32_t>(in[i + 1]) << 8) | in[i + 2];
+    b64sig.push_back(kBase64Alphabet[bits >> 18]);
+    b64sig.push_back(kBase64Alphabet[(bits >> 12) & 0x3f]);
+    b64sig.push_back(kBase64Alphabet[(bits >> 6) & 0x3f]);
+    b64sig.push_back(kBase64Alphabet[bits & 0x3f]);
+  }
+  if (i < tob64.size()) {
+    uint32_t bits = static_cast<uint32_t>(in[i]) << 16;
+    if (i + 1 < tob64.size()) {
+      bits |= static_cast<uint32_t>(in[i + 1]) << 8;
+    }
+    b64sig.push_back(kBase64Alphabet[bits >> 18]);
+    b64sig.push_back(kBase64Alphabet[(bits >> 12) & 0x3f]);
+    b64sig.push_back(i + 1 < tob64.size() ? kBase64Alphabet[(bits >> 6) & 0x3f] : '=');
+    b64sig.push_back('=');
+  }
   return b64sig;
 }
 
+std::string Utils::toHex(const std::string &bin, bool lower_case) {
+  static constexpr const char *kLowerHexDigits = "0123456789abcdef";
+  const char *digits = lower_case ? kLowerHexDigits : kHexDigits;
+  std::string hex(bin.size() * 2, '\0');
+  for (size_t i = 0; i < bin.size(); ++i) {
+    const auto byte = static_cast<unsigned char>(bin[i]);
+    hex[2 * i] = digits[byte >> 4];
+    hex[2 * i + 1] = digits[byte & 0x0f];
+  }
+  return hex;
+}
+
+std::string Utils::fromHex(const std::string &hex) {
+  const auto &table = decodeTables().hex;
+  if (hex.size() % 2 != 0) {
+    throw std::invalid_argument("Hexadecimal string of odd length");
+  }
+  std::string bin(hex.size() / 2, '\0');
+  for (size_t i = 0; i < bin.size(); ++i) {
+    const uint8_t high = table[static_cast<unsigned char>(hex[2 * i])];
+    const uint8_t low = table[static_cast<unsigned char>(hex[2 * i + 1])];
+    if (high == kInvalid || low == kInvalid) {
+      throw std::invalid_argument("Invalid hexadecimal string");
+    }
+    bin[i] = static_cast<char>((high << 4) | low);
+  }
+  return bin;
+}
+
+bool Utils::isHex(const std::string &hex) {
+  const auto &table = decodeTables().hex;
+  return std::all_of(hex.cbegin(), hex.cend(),
+                     [&table](char c) { return table[static_cast<unsigned char>(c)] != kInvalid; });
+}
+
 // Strip leading and trailing quotes
 std::string Utils::stripQuotes(const std::string &value) {
   std::string res = value;
@@ -242,9 +365,12 @@ std::string Utils::extractField(const std::string &in, unsigned int field_id) {
 }
 
 Json::Value Utils::parseJSON(const std::string &json_str) {
-  std::istringstream strs(json_str);
+  // Parse right from the string: going through a stream copies large
+  // documents (Image repo Targets metadata) once more, and a reader costs
+  // less to reuse than to create.
+  static thread_local std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
   Json::Value json_value;
-  parseFromStream(Json::CharReaderBuilder(), strs, &json_value, nullptr);
+  reader->parse(json_str.data(), json_str.data() + json_str.size(), &json_value, nullptr);
   return json_value;
 }
 
@@ -349,25 +475,156 @@ std::string Utils::jsonToStr(const Json::Value &json) {
   return ss.str();
 }
 
-std::string Utils::jsonToCanonicalStr(const Json::Value &json) {
-  static Json::StreamWriterBuilder wbuilder = []() {
+static const Json::StreamWriterBuilder &canonicalWriterBuilder() {
+  static const Json::StreamWriterBuilder wbuilder = []() {
     Json::StreamWriterBuilder w;
-    wbuilder["indentation"] = "";
+    w["indentation"] = "";
     return w;
   }();
-  return Json::writeString(wbuilder, json);
+  return wbuilder;
 }
 
-Json::Value Utils::getHardwareInfo() {
-  std::string result;
-  const int exit_code = shell("lshw -json", &result);
+// Characters that jsoncpp writes as they are in every version.
+static bool isPlainJsonString(const char *str, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    const auto c = static_cast<unsigned char>(str[i]);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void writeCanonicalString(const char *str, size_t length, std::string *out) {
+  if (isPlainJsonString(str, length)) {
+    out->push_back('"');
+    out->append(str, length);
+    out->push_back('"');
+  } else if (std::memchr(str, '\0', length) == nullptr) {
+    // escaping and UTF-8 handling differ between jsoncpp versions, stay
+    // consistent with the installed one
+    out->append(Json::valueToQuotedString(std::string(str, length).c_str()));
+  } else {
+    out->append(Json::writeString(canonicalWriterBuilder(), Json::Value(str, str + length)));
+  }
+}
+
+// NOLINTNEXTLINE(misc-no-recursion)
+static void writeCanonicalJson(const Json::Value &json, std::string *out) {
+  switch (json.type()) {
+    case Json::nullValue:
+      out->append("null");
+      break;
+    case Json::intValue:
+      out->append(std::to_string(json.asLargestInt()));
+      break;
+    case Json::uintValue:
+      out->append(std::to_string(json.asLargestUInt()));
+      break;
+    case Json::realValue:
+      out->append(Json::valueToString(json.asDouble()));
+      break;
+    case Json::booleanValue:
+      out->append(json.asBool() ? "true" : "false");
+      break;
+    case Json::stringValue: {
+      const char *begin = nullptr;
+      const char *end = nullptr;
+      json.getString(&begin, &end);
+      writeCanonicalString(begin, static_cast<size_t>(end - begin), out);
+      break;
+    }
+    case Json::arrayValue:
+      out->push_back('[');
+      for (Json::ArrayIndex i = 0; i < json.size(); i++) {
+        if (i != 0) {
+          out->push_back(',');
+        }
+        writeCanonicalJson(json[i], out);
+      }
+      out->push_back(']');
+      break;
+    case Json::objectValue: {
+      // members are sorted by name, byte by byte
+      out->push_back('{');
+      bool first = true;
+      for (auto it = json.begin(); it != json.end(); ++it) {
+        if (!first) {
+          out->push_back(',');
+        }
+        first = false;
+        const char *name_end = nullptr;
+        const char *name = it.memberName(&name_end);
+        writeCanonicalString(name, static_cast<size_t>(name_end - name), out);
+        out->push_back(':');
+        writeCanonicalJson(*it, out);
+      }
+      out->push_back('}');
+      break;
+    }
+    default:
+      throw std::runtime_error("Unknown JSON value type");
+  }
+}
 
-  if (exit_code != 0) {
+std::string Utils::jsonToCanonicalStr(const Json::Value &json) {
+  std::string out;
+  jsonToCanonicalStr(json, &out);
+  return out;
+}
+
+void Utils::jsonToCanonicalStr(const Json::Value &json, std::string *out) {
+  // A compact jsoncpp writer gives the same result, but creates a stream
+  // writer and copies the output around on each call; this is called for
+  // every signature check, including large Targets metadata.
+  out->clear();
+  writeCanonicalJson(json, out);
+}
+
+// lshw takes seconds on some boards, but it should not take forever
+static constexpr std::chrono::seconds kLshwTimeout{120};
+static constexpr size_t kLshwMaxOutput = 16 * 1024 * 1024;
+
+static std::string bootId() {
+  try {
+    return Utils::readFile("/proc/sys/kernel/random/boot_id", true);
+  } catch (const std::exception &) {
+    return "";
+  }
+}
+
+Json::Value Utils::getHardwareInfo(const boost::filesystem::path &cache) {
+  const std::string boot_id = cache.empty() ? "" : bootId();
+  if (!boot_id.empty() && boost::filesystem::exists(cache)) {
+    try {
+      const Json::Value cached = Utils::parseJSONFile(cache);
+      if (cached["boot_id"].asString() == boot_id && cached.isMember("hardware_info")) {
+        return cached["hardware_info"];
+      }
+    } catch (const std::exception &e) {
+      LOG_DEBUG << "Ignoring the cached hardware information: " << e.what();
+    }
+  }
+
+  const auto lshw = ChildProcess::run({"lshw", "-json"}, kLshwTimeout, kLshwMaxOutput);
+  if (!lshw.ok()) {
     LOG_WARNING << "Could not execute lshw (is it installed?).";
     return Json::Value();
   }
-  const Json::Value parsed = Utils::parseJSON(result);
-  return (parsed.isArray()) ? parsed[0] : parsed;
+  const Json::Value parsed = Utils::parseJSON(lshw.output);
+  Json::Value hw_info = (parsed.isArray()) ? parsed[0] : parsed;
+
+  if (!boot_id.empty() && !hw_info.empty()) {
+    Json::Value cached;
+    cached["boot_id"] = boot_id;
+    cached["hardware_info"] = hw_info;
+    try {
+      Utils::writeFile(cache, cached);
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Could not cache the hardware information in " << cache << ": " << e.what();
+    }
+  }
+  return hw_info;
 }
 
 Json::Value Utils::getNetworkInfo() {
@@ -471,7 +728,7 @@ void Utils::copyDir(const boost::filesystem::path &from, const boost::filesystem
   }
 }
 
-std::string Utils::readFileFromArchive(std::istream &as, const std::string &filename, const bool trim) {
+std::set<std::string> Utils::streamFilesFromArchive(std::istream &as, const std::map<std::string, ArchiveSink> &sinks) {
   StructGuardInt<struct archive> a(archive_read_new(), archive_read_free);
   if (a == nullptr) {
     LOG_ERROR << "archive error: could not initialize archive object";
@@ -486,11 +743,11 @@ std::string Utils::readFileFromArchive(std::istream &as, const std::string &file
     throw std::runtime_error("archive error");
   }
 
-  bool found = false;
-  std::stringstream out_stream;
+  std::set<std::string> found;
   struct archive_entry *entry;
-  while (archive_read_next_header(a.get(), &entry) == ARCHIVE_OK) {
-    if (filename != archive_entry_pathname(entry)) {
+  while (found.size() < sinks.size() && archive_read_next_header(a.get(), &entry) == ARCHIVE_OK) {
+    const auto sink = sinks.find(archive_entry_pathname(entry));
+    if (sink == sinks.end() || found.count(sink->first) != 0) {
       archive_read_data_skip(a.get());
       continue;
     }
@@ -502,14 +759,14 @@ std::string Utils::readFileFromArchive(std::istream &as, const std::string &file
     for (;;) {
       r = archive_read_data_block(a.get(), reinterpret_cast<const void **>(&buff), &size, &offset);
       if (r == ARCHIVE_EOF) {
-        found = true;
+        found.insert(sink->first);
         break;
       } else if (r != ARCHIVE_OK) {
         LOG_ERROR << "archive error: " << archive_error_string(a.get());
         break;
       }
       if (size > 0 && buff != nullptr) {
-        out_stream.write(buff, static_cast<ssize_t>(size));
+        sink->second(buff, size);
       }
     }
   }
@@ -518,16 +775,33 @@ std::string Utils::readFileFromArchive(std::istream &as, const std::string &file
   if (r != ARCHIVE_OK) {
     LOG_ERROR << "archive error: " << archive_error_string(a.get());
   }
+  return found;
+}
 
-  if (!found) {
-    throw std::runtime_error("could not extract " + filename + " from archive");
+std::map<std::string, std::string> Utils::readFilesFromArchive(std::istream &as,
+                                                               const std::vector<std::string> &filenames,
+                                                               const bool trim) {
+  std::map<std::string, std::string> res;
+  std::map<std::string, ArchiveSink> sinks;
+  for (const auto &filename : filenames) {
+    std::string &content = res[filename];
+    sinks[filename] = [&content](const char *data, size_t size) { content.append(data, size); };
   }
 
-  std::string result = out_stream.str();
-  if (trim) {
-    boost::trim_if(result, boost::is_any_of(" \t\r\n"));
+  const auto found = streamFilesFromArchive(as, sinks);
+  for (auto &file : res) {
+    if (found.count(file.first) == 0) {
+      throw std::runtime_error("could not extract " + file.first + " from archive");
+    }
+    if (trim) {
+      boost::trim_if(file.second, boost::is_any_of(" \t\r\n"));
+    }
   }
-  return result;
+  return res;
+}
+
+std::string Utils::readFileFromArchive(std::istream &as, const std::string &filename, const bool trim) {
+  return readFilesFromArchive(as, std::vector<std::string>{filename}, trim)[filename];
 }
 
 static ssize_t write_cb(struct archive *a, void *client_data, const void *buffer, size_t length) {
@@ -578,6 +852,38 @@ void Utils::writeArchive(const std::map<std::string, std::string> &entries, std:
   }
 }
 
+std::string Utils::gzipCompress(const std::string &data) {
+  StructGuardInt<struct archive> a(archive_write_new(), archive_write_free);
+  if (a == nullptr) {
+    LOG_ERROR << "archive error: could not initialize archive object";
+    throw std::runtime_error("archive error");
+  }
+  // a single entry without any header, and no padding after the gzip stream
+  archive_write_set_format_raw(a.get());
+  archive_write_add_filter_gzip(a.get());
+  archive_write_set_bytes_in_last_block(a.get(), 1);
+
+  std::ostringstream out;
+  int r = archive_write_open(a.get(), reinterpret_cast<void *>(&out), nullptr, write_cb, nullptr);
+  if (r != ARCHIVE_OK) {
+    LOG_ERROR << "archive error: " << archive_error_string(a.get());
+    throw std::runtime_error("archive error");
+  }
+
+  StructGuard<struct archive_entry> entry(archive_entry_new(), archive_entry_free);
+  archive_entry_set_filetype(entry.get(), AE_IFREG);
+  archive_entry_set_size(entry.get(), static_cast<ssize_t>(data.size()));
+  if (archive_write_header(a.get(), entry.get()) != 0 || archive_write_data(a.get(), data.c_str(), data.size()) < 0) {
+    LOG_ERROR << "archive error: " << archive_error_string(a.get());
+    throw std::runtime_error("archive error");
+  }
+  if (archive_write_close(a.get()) != ARCHIVE_OK) {
+    LOG_ERROR << "archive error: " << archive_error_string(a.get());
+    throw std::runtime_error("archive error");
+  }
+  return out.str();
+}
+
 /* Removing a file from an archive isn't possible in the obvious sense. The only
  * way to do so in practice is to create a new archive, copy everything you
  * _don't_ want to remove, and then replace the old archive with the new one.
@@ -1003,3 +1309,23 @@ CurlEasyWrapper::~CurlEasyWrapper() {
     curl_easy_cleanup(handle);
   }
 }
+
+// from linux/ioprio.h; glibc has no wrappers for these system calls
+static constexpr int kIoprioWhoProcess = 1;
+static constexpr int kIoprioClassShift = 13;
+static constexpr int kIoprioClassIdle = 3;
+
+IdleIoPriority::IdleIoPriority() {
+  // with IOPRIO_WHO_PROCESS, 0 is the calling thread
+  previous_ = static_cast<int>(syscall(SYS_ioprio_get, kIoprioWhoProcess, 0));
+  if (previous_ < 0 || syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, kIoprioClassIdle << kIoprioClassShift) != 0) {
+    LOG_DEBUG << "Could not lower the I/O priority: " << std::strerror(errno);
+    previous_ = -1;
+  }
+}
+
+IdleIoPriority::~IdleIoPriority() {
+  if (previous_ >= 0) {
+    syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, previous_);
+  }
+}
@@ -2,8 +2,12 @@
 #define UTILS_H_
 
 #include <boost/filesystem/path.hpp>
+#include <functional>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <curl/curl.h>
 #include <netinet/in.h>
@@ -13,6 +17,11 @@
 struct Utils {
   static std::string fromBase64(std::string base64_string);
   static std::string toBase64(const std::string &tob64);
+  // Upper case unless asked otherwise, like boost::algorithm::hex
+  static std::string toHex(const std::string &bin, bool lower_case = false);
+  // Throws std::invalid_argument on odd length or non-hexadecimal characters
+  static std::string fromHex(const std::string &hex);
+  static bool isHex(const std::string &hex);
   static std::string stripQuotes(const std::string &value);
   static std::string addQuotes(const std::string &value);
   static std::string extractField(const std::string &in, unsigned int field_id);
@@ -20,6 +29,8 @@ struct Utils {
   static Json::Value parseJSONFile(const boost::filesystem::path &filename);
   static std::string jsonToStr(const Json::Value &json);
   static std::string jsonToCanonicalStr(const Json::Value &json);
+  // Same as above, but write into `out`, so that its buffer can be reused.
+  static void jsonToCanonicalStr(const Json::Value &json, std::string *out);
   static std::string genPrettyName();
   static std::string readFile(const boost::filesystem::path &filename, bool trim = false);
 
@@ -30,9 +41,26 @@ struct Utils {
                         bool create_directories = true);
   static void copyDir(const boost::filesystem::path &from, const boost::filesystem::path &to);
   static std::string readFileFromArchive(std::istream &as, const std::string &filename, bool trim = false);
+  // Gets the data of an archive member block by block
+  using ArchiveSink = std::function<void(const char *data, size_t size)>;
+  // Extracts the members that have a sink in a single pass, which stops once
+  // they are all extracted. Returns the names of those that were found.
+  static std::set<std::string> streamFilesFromArchive(std::istream &as,
+                                                      const std::map<std::string, ArchiveSink> &sinks);
+  // Same in memory; throws std::runtime_error if one of them is missing
+  static std::map<std::string, std::string> readFilesFromArchive(std::istream &as,
+                                                                 const std::vector<std::string> &filenames,
+                                                                 bool trim = false);
   static void writeArchive(const std::map<std::string, std::string> &entries, std::ostream &as);
   static void removeFileFromArchive(const boost::filesystem::path &archive_path, const std::string &filename);
-  static Json::Value getHardwareInfo();
+  // gzip stream of `data`, e.g. for a `Content-Encoding: gzip` request body
+  static std::string gzipCompress(const std::string &data);
+  /**
+   * The hardware information reported by lshw. With a `cache` file, it is
+   * collected at most once per boot, and read from the file until the next
+   * boot.
+   */
+  static Json::Value getHardwareInfo(const boost::filesystem::path &cache = "");
   static Json::Value getNetworkInfo();
   static std::string getHostname();
   static std::string randomUuid();
@@ -164,6 +192,21 @@ class CurlEasyWrapper {
   CURL *handle;
 };
 
+// Lowers the I/O priority of the calling thread to the idle class while it
+// lives, for housekeeping that shouldn't slow down other disk access.
+class IdleIoPriority {
+ public:
+  IdleIoPriority();
+  ~IdleIoPriority();
+  IdleIoPriority(const IdleIoPriority &) = delete;
+  IdleIoPriority(IdleIoPriority &&) = delete;
+  IdleIoPriority &operator=(const IdleIoPriority &) = delete;
+  IdleIoPriority &operator=(IdleIoPriority &&) = delete;
+
+ private:
+  int previous_{-1};
+};
+
 template <typename... T>
 static void curlEasySetoptWrapper(CURL *curl_handle, CURLoption option, T &&...args) {
   const CURLcode retval = curl_easy_setopt(curl_handle, option, std::forward<T>(args)...);
@@ -65,6 +65,34 @@ TEST(Utils, jsonToCanonicalStr) {
   EXPECT_EQ(Utils::jsonToCanonicalStr(parsed), "0");
 }
 
+/* The canonical form is the one of a compact jsoncpp writer, whatever the
+ * values are. */
+TEST(Utils, jsonToCanonicalStrLikeJsoncpp) {
+  Json::Value value;
+  value["plain"] = "a/b c~";
+  value["escapes"] = "\"\\\n\t\x01\x7f";
+  value["utf8"] = "ma\xc5\x82" "ecki \xf0\x9f\x98\x80";
+  value["invalid utf8"] = "\xff\xc3";
+  value["nul"] = Json::Value(std::string("a\0b", 3));
+  value["numbers"].append(-5);
+  value["numbers"].append(Json::UInt64(18446744073709551615U));
+  value["numbers"].append(0.1);
+  value["numbers"].append(1e300);
+  value["\xc3\xa9"] = Json::Value(Json::objectValue);
+  value["list"] = Json::Value(Json::arrayValue);
+  value["other"].append(Json::Value());
+  value["other"].append(true);
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  const std::string expected = Json::writeString(builder, value);
+
+  std::string out = "left over";
+  Utils::jsonToCanonicalStr(value, &out);
+  EXPECT_EQ(out, expected);
+  EXPECT_EQ(Utils::jsonToCanonicalStr(value), expected);
+}
+
 /* Read hardware info from the system. */
 TEST(Utils, getHardwareInfo) {
   Json::Value hwinfo = Utils::getHardwareInfo();
@@ -72,6 +100,28 @@ TEST(Utils, getHardwareInfo) {
   EXPECT_FALSE(hwinfo.isArray());
 }
 
+/* Hardware info is collected once per boot, and cached until the next one. */
+TEST(Utils, getHardwareInfoCached) {
+  TemporaryDirectory temp_dir;
+  const auto cache = temp_dir / "hardware_info.json";
+  const Json::Value hwinfo = Utils::getHardwareInfo(cache);
+  EXPECT_NE(hwinfo, Json::Value());
+  const Json::Value cached = Utils::parseJSONFile(cache);
+  EXPECT_EQ(cached["boot_id"].asString(), Utils::readFile("/proc/sys/kernel/random/boot_id", true));
+  EXPECT_EQ(cached["hardware_info"], hwinfo);
+
+  // read from the cache during the same boot
+  Json::Value fake = cached;
+  fake["hardware_info"]["id"] = "cached";
+  Utils::writeFile(cache, fake);
+  EXPECT_EQ(Utils::getHardwareInfo(cache)["id"].asString(), "cached");
+
+  // but not after a reboot
+  fake["boot_id"] = "previous boot";
+  Utils::writeFile(cache, fake);
+  EXPECT_EQ(Utils::getHardwareInfo(cache), hwinfo);
+}
+
 /* Read networking info from the system. */
 TEST(Utils, getNetworkInfo) {
   Json::Value netinfo = Utils::getNetworkInfo();
@@ -138,6 +188,28 @@ TEST(Utils, FromBase64Wrong) {
   EXPECT_THROW(Utils::fromBase64("CQ==="), boost::archive::iterators::dataflow_exception);
 }
 
+/* Whitespace is skipped and padding is optional, as with the former boost
+ * decoder. */
+TEST(Utils, FromBase64Lenient) {
+  EXPECT_EQ(Utils::fromBase64("aGVs\nbG8="), "hello");
+  EXPECT_EQ(Utils::fromBase64("aGVsbG8"), "hello");
+  EXPECT_EQ(Utils::fromBase64("YQ"), "a");
+  EXPECT_THROW(Utils::fromBase64("YQ=a"), boost::archive::iterators::dataflow_exception);
+  EXPECT_THROW(Utils::fromBase64("YWJjZ"), boost::archive::iterators::dataflow_exception);
+}
+
+TEST(Utils, Hex) {
+  EXPECT_EQ(Utils::toHex(std::string("\x01\xab\xff", 3)), "01ABFF");
+  EXPECT_EQ(Utils::toHex(std::string("\x01\xab\xff", 3), true), "01abff");
+  EXPECT_EQ(Utils::toHex(""), "");
+  EXPECT_EQ(Utils::fromHex("01abFF"), std::string("\x01\xab\xff", 3));
+  EXPECT_EQ(Utils::fromHex(""), "");
+  EXPECT_TRUE(Utils::isHex("0123456789abcdefABCDEF"));
+  EXPECT_FALSE(Utils::isHex("0g"));
+  EXPECT_THROW(Utils::fromHex("abc"), std::invalid_argument);
+  EXPECT_THROW(Utils::fromHex("0g"), std::invalid_argument);
+}
+
 TEST(Utils, Base64RoundTrip) {
   std::mt19937 gen;
   std::uniform_int_distribution<char> chars(std::numeric_limits<char>::min(), std::numeric_limits<char>::max());
@@ -189,7 +261,62 @@ TEST(Utils, ArchiveWrite) {
   }
 }
 
+/* Extract several members in one pass, in memory or through sinks. */
+TEST(Utils, ArchiveReadFiles) {
+  std::string archive_bytes;
+  {
+    std::map<std::string, std::string> fm{{"a", "A"}, {"b", " B\n"}, {"c", std::string(100000, 'c')}};
+    std::stringstream as;
+    Utils::writeArchive(fm, as);
+    archive_bytes = as.str();
+  }
+
+  {
+    std::stringstream as(archive_bytes);
+    const auto files = Utils::readFilesFromArchive(as, {"a", "b"}, true);
+    EXPECT_EQ(files.size(), 2);
+    EXPECT_EQ(files.at("a"), "A");
+    EXPECT_EQ(files.at("b"), "B");
+  }
+  {
+    std::stringstream as(archive_bytes);
+    EXPECT_THROW(Utils::readFilesFromArchive(as, {"a", "bogus_filename"}), std::runtime_error);
+  }
+  {
+    std::stringstream as(archive_bytes);
+    size_t c_size = 0;
+    std::map<std::string, Utils::ArchiveSink> sinks{{"c", [&c_size](const char *data, size_t size) {
+                                                       (void)data;
+                                                       c_size += size;
+                                                     }},
+                                                    {"bogus_filename", [](const char *data, size_t size) {
+                                                       (void)data;
+                                                       (void)size;
+                                                     }}};
+    EXPECT_EQ(Utils::streamFilesFromArchive(as, sinks), std::set<std::string>{"c"});
+    EXPECT_EQ(c_size, 100000);
+  }
+}
+
 /* Remove credentials from a provided archive. */
+/* A gzip stream that gzip can read back. */
+TEST(Utils, GzipCompress) {
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    data += "event " + std::to_string(i % 10) + "\n";
+  }
+  const std::string compressed = Utils::gzipCompress(data);
+  ASSERT_GE(compressed.size(), 2);
+  EXPECT_EQ(compressed.substr(0, 2), "\x1f\x8b");
+  EXPECT_LT(compressed.size(), data.size() / 10);
+
+  TemporaryFile file("gz");
+  Utils::writeFile(file.Path(), compressed);
+  std::string output;
+  EXPECT_EQ(Utils::shell("gzip -dc " + file.PathString(), &output), 0);
+  EXPECT_EQ(output, data);
+}
+
 TEST(Utils, ArchiveRemoveFile) {
   const boost::filesystem::path old_path = "tests/test_data/credentials.zip";
   TemporaryDirectory temp_dir;
@@ -1,26 +1,54 @@
 #include "authenticate.h"
 
+#include <chrono>
+#include <memory>
+
 #include "logging/logging.h"
 #include "oauth2.h"
+#include "token_cache.h"
 
 using std::string;
 
-int authenticate(const string &cacerts, const ServerCredentials &creds, TreehubServer &treehub) {
+int authenticate(const string &cacerts, const ServerCredentials &creds, TreehubServer &treehub,
+                 const boost::filesystem::path &token_cache) {
   switch (creds.GetMethod()) {
     case AuthMethod::kBasic: {
       treehub.SetAuthBasic(creds.GetAuthUser(), creds.GetAuthPassword());
       break;
     }
     case AuthMethod::kOauth2: {
-      OAuth2 oauth2(creds.GetAuthServer(), creds.GetClientId(), creds.GetClientSecret(), creds.GetScope(), cacerts);
-
       if (!creds.GetClientId().empty()) {
-        if (oauth2.Authenticate() != AuthenticationResult::kSuccess) {
+        auto oauth2 = std::make_shared<OAuth2>(creds.GetAuthServer(), creds.GetClientId(), creds.GetClientSecret(),
+                                               creds.GetScope(), cacerts);
+        std::shared_ptr<TokenCache> cache;
+        if (!token_cache.empty()) {
+          cache = std::make_shared<TokenCache>(token_cache, creds.GetAuthServer(), creds.GetClientId(),
+                                               creds.GetScope());
+        }
+        auto fetch_token = [oauth2, cache](std::string *token, std::chrono::system_clock::time_point *expiry) {
+          if (oauth2->Authenticate() != AuthenticationResult::kSuccess) {
+            return false;
+          }
+          *token = oauth2->token();
+          *expiry = oauth2->expiry();
+          if (cache) {
+            cache->Store(*token, *expiry);
+          }
+          return true;
+        };
+
+        std::string token;
+        std::chrono::system_clock::time_point expiry;
+        if (cache && cache->Load(&token, &expiry)) {
+          LOG_INFO << "Using cached oauth2 authentication token";
+        } else if (fetch_token(&token, &expiry)) {
+          LOG_INFO << "Using oauth2 authentication token";
+        } else {
           LOG_FATAL << "Authentication with oauth2 failed";
           return EXIT_FAILURE;
         }
-        LOG_INFO << "Using oauth2 authentication token";
-        treehub.SetToken(oauth2.token());
+        treehub.SetToken(token);
+        treehub.SetTokenRefresh(expiry, fetch_token);
 
       } else {
         LOG_INFO << "Skipping Authentication";
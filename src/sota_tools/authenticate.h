@@ -3,10 +3,15 @@
 
 #include <string>
 
+#include <boost/filesystem/path.hpp>
+
 #include "server_credentials.h"
 #include "treehub_server.h"
 
-int authenticate(const std::string &cacerts, const ServerCredentials &creds, TreehubServer &treehub);
+// With OAuth2, tokens are reused from token_cache, if any, and the token is
+// refreshed once it expires
+int authenticate(const std::string &cacerts, const ServerCredentials &creds, TreehubServer &treehub,
+                 const boost::filesystem::path &token_cache = "");
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
 #endif  // SOTA_CLIENT_TOOLS_AUTHENTICATE_H_
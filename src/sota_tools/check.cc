@@ -1,3 +1,7 @@
+#include <chrono>
+#include <set>
+#include <utility>
+
 #include <curl/curl.h>
 
 #include "authenticate.h"
@@ -23,55 +27,84 @@ static size_t writeString(void *contents, size_t size, size_t nmemb, void *userp
   return size * nmemb;
 }
 
+// Seconds elapsed since a phase has started, for the report
+static double SecondsSince(const std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode, int max_curl_requests,
                   const boost::filesystem::path &tree_dir) {
-  // Check if the ref is present on treehub. The traditional use case is that it
-  // should be a commit object, but we allow walking the tree given any OSTree
-  // ref.
+  return CheckRefsValid(treehub, {ref}, mode, max_curl_requests, tree_dir);
+}
+
+int CheckRefsValid(TreehubServer &treehub, const std::vector<std::string> &refs, RunMode mode, int max_curl_requests,
+                   const boost::filesystem::path &tree_dir, PresenceIndex *presence_index) {
   CurlEasyWrapper curl;
   if (curl.get() == nullptr) {
     LOG_FATAL << "Error initializing curl";
     return EXIT_FAILURE;
   }
-  curlEasySetoptWrapper(curl.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
-  curlEasySetoptWrapper(curl.get(), CURLOPT_NOBODY, 1L);  // HEAD
+  int exit_code = EXIT_SUCCESS;
+
+  // Check if the refs are present on treehub. The traditional use case is that
+  // they should be commit objects, but we allow walking the tree given any
+  // OSTree ref.
+  auto phase_start = std::chrono::steady_clock::now();
+  std::vector<std::pair<std::string, OstreeObjectType>> found;
+  std::set<std::string> seen;
+  for (const std::string &ref : refs) {
+    if (!seen.insert(ref).second) {
+      continue;
+    }
+    curlEasySetoptWrapper(curl.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
+    curlEasySetoptWrapper(curl.get(), CURLOPT_NOBODY, 1L);  // HEAD
 
-  treehub.InjectIntoCurl("objects/" + ref.substr(0, 2) + "/" + ref.substr(2) + ".commit", curl.get());
+    treehub.InjectIntoCurl("objects/" + ref.substr(0, 2) + "/" + ref.substr(2) + ".commit", curl.get());
 
-  CURLcode result = curl_easy_perform(curl.get());
-  if (result != CURLE_OK) {
-    LOG_FATAL << "Error connecting to treehub: " << result << ": " << curl_easy_strerror(result);
-    return EXIT_FAILURE;
-  }
+    CURLcode result = curl_easy_perform(curl.get());
+    if (result != CURLE_OK) {
+      LOG_FATAL << "Error connecting to treehub: " << result << ": " << curl_easy_strerror(result);
+      return EXIT_FAILURE;
+    }
 
-  long http_code;  // NOLINT(google-runtime-int)
-  OstreeObjectType type = OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT;
-  curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
-  if (http_code == 404) {
-    if (mode != RunMode::kWalkTree) {
-      LOG_FATAL << "OSTree commit " << ref << " is missing in treehub";
+    long http_code;  // NOLINT(google-runtime-int)
+    OstreeObjectType type = OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT;
+    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code == 404) {
+      if (mode != RunMode::kWalkTree) {
+        LOG_FATAL << "OSTree commit " << ref << " is missing in treehub";
+        exit_code = EXIT_FAILURE;
+        continue;
+      } else {
+        type = OSTREE_OBJECT_TYPE_UNKNOWN;
+      }
+    } else if (http_code != 200) {
+      LOG_FATAL << "Error " << http_code << " getting OSTree ref " << ref << " from treehub";
       return EXIT_FAILURE;
-    } else {
-      type = OSTREE_OBJECT_TYPE_UNKNOWN;
     }
-  } else if (http_code != 200) {
-    LOG_FATAL << "Error " << http_code << " getting OSTree ref " << ref << " from treehub";
-    return EXIT_FAILURE;
-  }
-  if (mode != RunMode::kWalkTree) {
-    LOG_INFO << "OSTree commit " << ref << " is found on treehub";
+    if (mode != RunMode::kWalkTree) {
+      LOG_INFO << "OSTree commit " << ref << " is found on treehub";
+    }
+    found.emplace_back(ref, type);
   }
+  LOG_INFO << "Looked up " << seen.size() << " refs on treehub in " << SecondsSince(phase_start) << " seconds.";
 
-  if (mode == RunMode::kWalkTree) {
-    // Walk the entire tree and check for all objects.
+  if (mode == RunMode::kWalkTree && !found.empty()) {
+    // Walk the entire trees and check for all objects. The trees share one
+    // repository, so that objects they have in common are only checked once.
+    phase_start = std::chrono::steady_clock::now();
     OSTreeHttpRepo dest_repo(&treehub, tree_dir);
-    OSTreeHash hash = OSTreeHash::Parse(ref);
-    OSTreeObject::ptr input_object = dest_repo.GetObject(hash, type);
+    // The fetcher only reads from treehub, like the presence checks.
+    dest_repo.FetchInParallel(max_curl_requests);
 
-    RequestPool request_pool(treehub, max_curl_requests, mode, false);
+    RequestPool request_pool(treehub, max_curl_requests, mode, false, presence_index);
 
-    // Add input object to the queue.
-    request_pool.AddQuery(input_object);
+    // Add input objects to the queue.
+    std::vector<OSTreeObject::ptr> input_objects;
+    for (const auto &ref : found) {
+      input_objects.push_back(dest_repo.GetObject(OSTreeHash::Parse(ref.first), ref.second));
+      request_pool.AddQuery(input_objects.back());
+    }
 
     // Main curl event loop.
     // request_pool takes care of holding number of outstanding requests below.
@@ -81,56 +114,86 @@ int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode,
       request_pool.Loop();
     } while (!request_pool.is_idle() && !request_pool.is_stopped());
 
-    if (input_object->is_on_server() == PresenceOnServer::kObjectPresent) {
-      LOG_INFO << "Dry run. No objects uploaded.";
+    for (size_t i = 0; i < found.size(); ++i) {
+      if (input_objects[i]->is_on_server() == PresenceOnServer::kObjectPresent) {
+        LOG_INFO << "Checked the tree of " << found[i].first;
+      } else {
+        LOG_ERROR << "One or more errors while checking " << found[i].first;
+      }
+    }
+    LOG_INFO << "Walked the trees of " << found.size() << " refs in " << SecondsSince(phase_start) << " seconds, with "
+             << request_pool.head_requests_made() << " HEAD requests and " << request_pool.batch_requests_made()
+             << " batched queries.";
+    if (presence_index != nullptr) {
+      LOG_INFO << request_pool.indexed_objects() << " objects and their subtrees were found in the presence index.";
+      presence_index->Save();
+    }
+    if (request_pool.put_requests_made() > 0) {
+      LOG_WARNING << request_pool.put_requests_made() << " objects are missing on treehub.";
+    }
+  }
+
+  // If we have commit objects, check if the refs are present in targets.json.
+  bool have_commits = false;
+  for (const auto &ref : found) {
+    if (ref.second == OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT) {
+      have_commits = true;
     } else {
-      LOG_ERROR << "One or more errors while pushing";
+      LOG_INFO << "OSTree ref " << ref.first << " is not a commit object. Skipping targets.json check.";
     }
   }
+  if (!have_commits) {
+    return exit_code;
+  }
 
-  // If we have a commit object, check if the ref is present in targets.json.
-  if (type == OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT) {
-    curlEasySetoptWrapper(curl.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
-    curlEasySetoptWrapper(curl.get(), CURLOPT_HTTPGET, 1L);
-    curlEasySetoptWrapper(curl.get(), CURLOPT_NOBODY, 0L);
-    treehub.InjectIntoCurl("/api/v1/user_repo/targets.json", curl.get(), true);
+  phase_start = std::chrono::steady_clock::now();
+  curlEasySetoptWrapper(curl.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
+  curlEasySetoptWrapper(curl.get(), CURLOPT_HTTPGET, 1L);
+  curlEasySetoptWrapper(curl.get(), CURLOPT_NOBODY, 0L);
+  treehub.InjectIntoCurl("/api/v1/user_repo/targets.json", curl.get(), true);
 
-    std::string targets_str;
-    curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEFUNCTION, writeString);
-    curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEDATA, static_cast<void *>(&targets_str));
-    result = curl_easy_perform(curl.get());
+  std::string targets_str;
+  curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEFUNCTION, writeString);
+  curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEDATA, static_cast<void *>(&targets_str));
+  CURLcode result = curl_easy_perform(curl.get());
 
-    if (result != CURLE_OK) {
-      LOG_FATAL << "Error connecting to TUF repo: " << result << ": " << curl_easy_strerror(result);
-      return EXIT_FAILURE;
-    }
+  if (result != CURLE_OK) {
+    LOG_FATAL << "Error connecting to TUF repo: " << result << ": " << curl_easy_strerror(result);
+    return EXIT_FAILURE;
+  }
 
-    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
-    if (http_code != 200) {
-      LOG_FATAL << "Error " << http_code << " getting targets.json from TUF repo: " << targets_str;
-      return EXIT_FAILURE;
-    }
+  long http_code;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
+  if (http_code != 200) {
+    LOG_FATAL << "Error " << http_code << " getting targets.json from TUF repo: " << targets_str;
+    return EXIT_FAILURE;
+  }
 
-    Json::Value targets_json = Utils::parseJSON(targets_str);
-    std::string expiry_time_str = targets_json["signed"]["expires"].asString();
-    TimeStamp timestamp(expiry_time_str);
+  Json::Value targets_json = Utils::parseJSON(targets_str);
+  std::string expiry_time_str = targets_json["signed"]["expires"].asString();
+  TimeStamp timestamp(expiry_time_str);
 
-    if (timestamp.IsExpiredAt(TimeStamp::Now())) {
-      LOG_FATAL << "targets.json has been expired.";
-      return EXIT_FAILURE;
-    }
+  if (timestamp.IsExpiredAt(TimeStamp::Now())) {
+    LOG_FATAL << "targets.json has been expired.";
+    return EXIT_FAILURE;
+  }
 
-    Json::Value target_list = targets_json["signed"]["targets"];
-    for (auto t_it = target_list.begin(); t_it != target_list.end(); t_it++) {
-      if ((*t_it)["hashes"]["sha256"].asString() == ref) {
-        LOG_INFO << "OSTree commit " << ref << " is found in targets.json";
-        return EXIT_SUCCESS;
-      }
+  std::set<std::string> target_hashes;
+  Json::Value target_list = targets_json["signed"]["targets"];
+  for (auto t_it = target_list.begin(); t_it != target_list.end(); t_it++) {
+    target_hashes.insert((*t_it)["hashes"]["sha256"].asString());
+  }
+  for (const auto &ref : found) {
+    if (ref.second != OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT) {
+      continue;
+    }
+    if (target_hashes.count(ref.first) != 0) {
+      LOG_INFO << "OSTree commit " << ref.first << " is found in targets.json";
+    } else {
+      LOG_FATAL << "OSTree ref " << ref.first << " was not found in targets.json";
+      exit_code = EXIT_FAILURE;
     }
-    LOG_FATAL << "OSTree ref " << ref << " was not found in targets.json";
-    return EXIT_FAILURE;
-  } else {
-    LOG_INFO << "OSTree ref " << ref << " is not a commit object. Skipping targets.json check.";
-    return EXIT_SUCCESS;
   }
+  LOG_INFO << "Checked targets.json in " << SecondsSince(phase_start) << " seconds.";
+  return exit_code;
 }
@@ -2,10 +2,12 @@
 #define SOTA_CLIENT_TOOLS_CHECK_H_
 
 #include <string>
+#include <vector>
 
 #include "garage_common.h"
 #include "ostree_ref.h"
 #include "ostree_repo.h"
+#include "presence_index.h"
 #include "server_credentials.h"
 
 /**
@@ -14,4 +16,15 @@
 int CheckRefValid(TreehubServer& treehub, const std::string& ref, RunMode mode, int max_curl_requests,
                   const boost::filesystem::path& tree_dir = "");
 
+/**
+ * Check if several refs are present on the server and in targets.json, and
+ * report how long each phase took. With RunMode::kWalkTree, the trees of all
+ * the refs are walked together, so that the subtrees they share are only
+ * checked once. Objects in presence_index, if any, are known to be on the
+ * server with their whole subtree, and are neither queried nor walked. The
+ * index is updated with the objects found on the server.
+ */
+int CheckRefsValid(TreehubServer& treehub, const std::vector<std::string>& refs, RunMode mode, int max_curl_requests,
+                   const boost::filesystem::path& tree_dir = "", PresenceIndex* presence_index = nullptr);
+
 #endif
@@ -1,5 +1,11 @@
 #include "deploy.h"
 
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <glib.h>
+#include <ostree.h>
 #include <boost/filesystem.hpp>
 #include <boost/intrusive_ptr.hpp>
 
@@ -8,6 +14,7 @@
 #include "ostree_object.h"
 #include "rate_controller.h"
 #include "request_pool.h"
+#include "tree_walker.h"
 #include "treehub_server.h"
 #include "utilities/utils.h"
 
@@ -24,7 +31,9 @@ bool CheckPoolState(const OSTreeObject::ptr &root_object, const RequestPool &req
 }
 
 bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server, const OSTreeHash &ostree_commit,
-                     const RunMode mode, const int max_curl_requests, const bool fsck_on_upload) {
+                     const RunMode mode, const int max_curl_requests, const bool fsck_on_upload,
+                     PresenceIndex *presence_index, const CongestionControl congestion_control,
+                     const TreehubServer *copy_source) {
   assert(max_curl_requests > 0);
 
   OSTreeObject::ptr root_object;
@@ -35,7 +44,20 @@ bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server
     return false;
   }
 
-  RequestPool request_pool(push_server, max_curl_requests, mode, fsck_on_upload);
+  if (presence_index != nullptr && (mode == RunMode::kWalkTree || mode == RunMode::kPushTree)) {
+    // every object gets checked anyway
+    presence_index->Clear();
+  }
+  // Parse the tree of a local repository on other cores while the pool waits
+  // for the server
+  std::unique_ptr<TreeWalker> tree_walker;
+  const unsigned int parse_threads = std::min(std::thread::hardware_concurrency(), 8U);
+  if (src_repo->IsLocal() && parse_threads > 1) {
+    tree_walker = std_::make_unique<TreeWalker>(src_repo->root(), parse_threads);
+    tree_walker->Walk(ostree_commit, OSTREE_OBJECT_TYPE_COMMIT);
+  }
+  RequestPool request_pool(push_server, max_curl_requests, mode, fsck_on_upload, presence_index, tree_walker.get(),
+                           congestion_control, copy_source);
 
   // Add commit object to the queue.
   request_pool.AddQuery(root_object);
@@ -48,10 +70,20 @@ bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server
     request_pool.Loop();
   } while (CheckPoolState(root_object, request_pool));
 
+  if (presence_index != nullptr) {
+    // only holds objects confirmed by the server, also worth keeping on errors
+    LOG_INFO << request_pool.indexed_objects() << " objects were found in the presence index.";
+    presence_index->Save();
+  }
+
   if (root_object->is_on_server() == PresenceOnServer::kObjectPresent) {
     if (mode == RunMode::kDefault || mode == RunMode::kPushTree) {
-      LOG_INFO << "Upload to Treehub complete after " << request_pool.head_requests_made() << " HEAD requests and "
-               << request_pool.put_requests_made() << " PUT requests.";
+      LOG_INFO << "Upload to Treehub complete after " << request_pool.head_requests_made() << " HEAD requests, "
+               << request_pool.batch_requests_made() << " batched queries, " << request_pool.put_requests_made()
+               << " PUT requests and " << request_pool.bundle_uploads_made() << " bundle uploads.";
+      if (copy_source != nullptr) {
+        LOG_INFO << request_pool.copied_objects() << " objects were copied by the server from the source.";
+      }
       LOG_INFO << "Total size of uploaded objects: " << request_pool.total_object_size() << " bytes.";
     } else {
       LOG_INFO << "Dry run. No objects uploaded.";
@@ -63,6 +95,109 @@ bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server
   return root_object->is_on_server() == PresenceOnServer::kObjectPresent;
 }
 
+// Where OSTree keeps a delta, relative to the root of a repository
+static boost::filesystem::path StaticDeltaPath(const OSTreeHash &from, const OSTreeHash &to) {
+  char *from_b64 = ostree_checksum_b64_from_bytes(from.bytes().data());
+  char *to_b64 = ostree_checksum_b64_from_bytes(to.bytes().data());
+  const std::string from_str(from_b64);
+  const std::string to_str(to_b64);
+  g_free(from_b64);
+  g_free(to_b64);
+  return boost::filesystem::path("deltas") / from_str.substr(0, 2) / (from_str.substr(2) + "-" + to_str);
+}
+
+static bool GenerateStaticDelta(const boost::filesystem::path &repo_path, const OSTreeHash &from,
+                                const OSTreeHash &to) {
+  GFile *repo_path_file = g_file_new_for_path(repo_path.c_str());  // Never fails
+  OstreeRepo *repo = ostree_repo_new(repo_path_file);
+  g_object_unref(repo_path_file);
+  GError *err = nullptr;
+  bool ok = ostree_repo_open(repo, nullptr, &err) != FALSE;
+  if (ok) {
+    GVariantBuilder params;
+    g_variant_builder_init(&params, G_VARIANT_TYPE("a{sv}"));
+    ok = ostree_repo_static_delta_generate(repo, OSTREE_STATIC_DELTA_GENERATE_OPT_MAJOR, from.string().c_str(),
+                                           to.string().c_str(), nullptr, g_variant_builder_end(&params), nullptr,
+                                           &err) != FALSE;
+  }
+  g_object_unref(repo);
+  if (!ok) {
+    LOG_ERROR << "Could not generate a static delta from " << from << " to " << to << ": "
+              << (err != nullptr ? err->message : "unknown error");
+    if (err != nullptr) {
+      g_error_free(err);
+    }
+  }
+  return ok;
+}
+
+static bool UploadDeltaFile(const TreehubServer &push_server, const boost::filesystem::path &repo_path,
+                            const boost::filesystem::path &path) {
+  const std::string contents = Utils::readFile(repo_path / path);
+  CurlEasyWrapper easy_handle;
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
+  push_server.InjectIntoCurl(path.string(), easy_handle.get());
+  struct curl_slist *headers = push_server.CopyHeaders("Content-Type: application/octet-stream");
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_HTTPHEADER, headers);
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_USERAGENT, Utils::getUserAgent());
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_POST, 1);
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_POSTFIELDS, contents.data());
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(contents.size()));
+  const CURLcode err = curl_easy_perform(easy_handle.get());
+  curl_slist_free_all(headers);
+  if (err != CURLE_OK) {
+    LOG_ERROR << "Error uploading " << path.string() << ": " << curl_easy_strerror(err);
+    return false;
+  }
+  long rescode;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(easy_handle.get(), CURLINFO_RESPONSE_CODE, &rescode);
+  if (rescode < 200 || rescode >= 300) {
+    LOG_ERROR << "Error uploading " << path.string() << ", got " << rescode << " HTTP response";
+    return false;
+  }
+  return true;
+}
+
+bool UploadStaticDelta(const OSTreeRepo::ptr &src_repo, const TreehubServer &push_server, const OSTreeHash &from,
+                       const OSTreeHash &to, const RunMode mode) {
+  if (!src_repo->IsLocal()) {
+    LOG_ERROR << "Static deltas can only be generated in a local repository";
+    return false;
+  }
+  const boost::filesystem::path repo_path = src_repo->root();
+  const boost::filesystem::path delta_path = StaticDeltaPath(from, to);
+  if (!boost::filesystem::is_regular_file(repo_path / delta_path / "superblock")) {
+    LOG_INFO << "Generating static delta from " << from << " to " << to;
+    if (!GenerateStaticDelta(repo_path, from, to)) {
+      return false;
+    }
+  }
+
+  // The superblock goes last, so that clients never find a delta with parts
+  // that haven't been uploaded yet
+  std::vector<boost::filesystem::path> parts;
+  for (boost::filesystem::directory_iterator it(repo_path / delta_path), end; it != end; ++it) {
+    const std::string name = it->path().filename().string();
+    if (boost::filesystem::is_regular_file(it->path()) && name != "superblock") {
+      parts.push_back(delta_path / name);
+    }
+  }
+  std::sort(parts.begin(), parts.end());
+  parts.push_back(delta_path / "superblock");
+
+  for (const auto &part : parts) {
+    if (mode == RunMode::kDryRun || mode == RunMode::kWalkTree) {
+      LOG_INFO << "Would upload " << part.string();
+      continue;
+    }
+    LOG_INFO << "Uploading " << part.string();
+    if (!UploadDeltaFile(push_server, repo_path, part)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool OfflineSignRepo(const ServerCredentials &push_credentials, const std::string &name, const OSTreeHash &hash,
                      const std::string &hardwareids) {
   const boost::filesystem::path local_repo{"./tuf/aktualizr"};
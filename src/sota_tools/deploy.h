@@ -6,6 +6,8 @@
 #include "garage_common.h"
 #include "ostree_ref.h"
 #include "ostree_repo.h"
+#include "presence_index.h"
+#include "rate_controller.h"
 #include "server_credentials.h"
 
 /*
@@ -26,9 +28,34 @@ bool CheckPoolState(const OSTreeObject::ptr& root_object, const RequestPool& req
  * \param mode
  * \param max_curl_requests
  * \param fsck_on_upload Validate objects on disk before uploading them
+ * \param presence_index Objects known to be on push_server, which are not
+ *                       queried again. It is updated and saved with the
+ *                       objects found there, and rebuilt when walking the
+ *                       entire tree.
+ * \param congestion_control How to adapt the number of parallel requests,
+ *                           up to max_curl_requests
+ * \param copy_source The server src_repo fetches objects from, if any.
+ *                    push_server is asked to copy objects from it directly,
+ *                    if it can. Objects copied that way are not validated.
  */
 bool UploadToTreehub(const OSTreeRepo::ptr& src_repo, TreehubServer& push_server, const OSTreeHash& ostree_commit,
-                     RunMode mode, int max_curl_requests, bool fsck_on_upload);
+                     RunMode mode, int max_curl_requests, bool fsck_on_upload,
+                     PresenceIndex* presence_index = nullptr,
+                     CongestionControl congestion_control = CongestionControl::kAimd,
+                     const TreehubServer* copy_source = nullptr);
+
+/**
+ * Generate an OSTree static delta from one commit to another in a local
+ * repository and upload it to Treehub. Devices on the first commit pull the
+ * delta instead of the objects of the second one.
+ * \param src_repo A local repository containing both commits in full
+ * \param push_server
+ * \param from The commit devices are expected to be on
+ * \param to The commit devices will pull
+ * \param mode Nothing is uploaded in dry runs
+ */
+bool UploadStaticDelta(const OSTreeRepo::ptr& src_repo, const TreehubServer& push_server, const OSTreeHash& from,
+                       const OSTreeHash& to, RunMode mode);
 
 /**
  * Use the garage-sign tool and the Image repo targets.json keys in credentials.zip
@@ -1,4 +1,7 @@
+#include <chrono>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <curl/curl.h>
 #include <boost/filesystem.hpp>
@@ -12,6 +15,7 @@
 #include "logging/logging.h"
 #include "ostree_http_repo.h"
 #include "ostree_object.h"
+#include "presence_index.h"
 #include "request_pool.h"
 #include "treehub_server.h"
 #include "utilities/utils.h"
@@ -21,12 +25,15 @@ namespace po = boost::program_options;
 int main(int argc, char **argv) {
   logger_init();
 
-  std::string ref;
+  std::vector<std::string> refs;
   boost::filesystem::path credentials_path;
   std::string cacerts;
   int max_curl_requests;
   RunMode mode = RunMode::kDefault;
   boost::filesystem::path tree_dir;
+  boost::filesystem::path presence_index_dir;
+  boost::filesystem::path token_cache;
+  int presence_index_max_age;
   po::options_description desc("garage-check command line options");
   // clang-format off
   desc.add_options()
@@ -35,12 +42,15 @@ int main(int argc, char **argv) {
     ("verbose,v", "Verbose logging (loglevel 1)")
     ("quiet,q", "Quiet mode (loglevel 3)")
     ("loglevel", po::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
-    ("ref,r", po::value<std::string>(&ref)->required(), "refhash to check")
+    ("ref,r", po::value<std::vector<std::string>>(&refs)->required()->composing(), "refhash to check, can be given several times to check all of them in one run")
     ("credentials,j", po::value<boost::filesystem::path>(&credentials_path)->required(), "credentials (json or zip containing json)")
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests (only relevant with --walk-tree)")
     ("walk-tree,w", "walk entire tree and check presence of all objects")
-    ("tree-dir,t", po::value<boost::filesystem::path>(&tree_dir), "directory to which to write the tree (only used with --walk-tree)");
+    ("tree-dir,t", po::value<boost::filesystem::path>(&tree_dir), "directory to which to write the tree (only used with --walk-tree)")
+    ("token-cache", po::value<boost::filesystem::path>(&token_cache), "directory keeping OAuth2 tokens between runs, to only authenticate again once they expire; only accessible to the user")
+    ("presence-index", po::value<boost::filesystem::path>(&presence_index_dir), "directory keeping an index of the objects known to be on the server between runs, to skip checking them and their subtrees again (only used with --walk-tree)")
+    ("presence-index-max-age", po::value<int>(&presence_index_max_age)->default_value(168), "number of hours after which the presence index is rebuilt from scratch");
   // clang-format on
 
   po::variables_map vm;
@@ -89,13 +99,24 @@ int main(int argc, char **argv) {
       return EXIT_FAILURE;
     }
 
+    if (presence_index_max_age < 0) {
+      LOG_FATAL << "--presence-index-max-age must not be negative";
+      return EXIT_FAILURE;
+    }
+
     TreehubServer treehub;
-    if (authenticate(cacerts, ServerCredentials(credentials_path), treehub) != EXIT_SUCCESS) {
+    if (authenticate(cacerts, ServerCredentials(credentials_path), treehub, token_cache) != EXIT_SUCCESS) {
       LOG_FATAL << "Authentication failed";
       return EXIT_FAILURE;
     }
 
-    if (CheckRefValid(treehub, ref, mode, max_curl_requests, tree_dir) != EXIT_SUCCESS) {
+    std::unique_ptr<PresenceIndex> presence_index;
+    if (!presence_index_dir.empty() && mode == RunMode::kWalkTree) {
+      presence_index = std_::make_unique<PresenceIndex>(presence_index_dir, treehub.root_url(),
+                                                        std::chrono::hours(presence_index_max_age));
+    }
+
+    if (CheckRefsValid(treehub, refs, mode, max_curl_requests, tree_dir, presence_index.get()) != EXIT_SUCCESS) {
       LOG_FATAL << "Check if the ref is present on the server or in targets.json failed";
       return EXIT_FAILURE;
     }
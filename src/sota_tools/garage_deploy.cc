@@ -25,6 +25,7 @@ int main(int argc, char **argv) {
   boost::filesystem::path push_cred;
   std::string hardwareids;
   std::string cacerts;
+  boost::filesystem::path token_cache;
   int max_curl_requests;
   RunMode mode = RunMode::kDefault;
   po::options_description desc("garage-deploy command line options");
@@ -41,9 +42,11 @@ int main(int argc, char **argv) {
     ("push-credentials,p", po::value<boost::filesystem::path>(&push_cred)->required(), "path to destination credentials")
     ("hardwareids,h", po::value<std::string>(&hardwareids)->required(), "list of hardware ids")
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
+    ("token-cache", po::value<boost::filesystem::path>(&token_cache), "directory keeping OAuth2 tokens between runs, to only authenticate again once they expire; only accessible to the user")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests")
     ("dry-run,n", "check arguments and authenticate but don't upload")
-    ("disable-integrity-checks", "Don't validate the checksums of objects before uploading them");
+    ("disable-integrity-checks", "Don't validate the checksums of objects before uploading them")
+    ("disable-server-copy", "Don't ask the destination server to copy objects from the source server, fetch and upload all of them");
   // clang-format on
 
   po::variables_map vm;
@@ -98,26 +101,35 @@ int main(int argc, char **argv) {
 
   ServerCredentials fetch_credentials(fetch_cred);
   TreehubServer fetch_server;
-  if (authenticate(cacerts, fetch_credentials, fetch_server) != EXIT_SUCCESS) {
+  if (authenticate(cacerts, fetch_credentials, fetch_server, token_cache) != EXIT_SUCCESS) {
     LOG_FATAL << "Authentication with fetch server failed";
     return EXIT_FAILURE;
   }
 
   ServerCredentials push_credentials(push_cred);
   TreehubServer push_server;
-  if (authenticate(cacerts, push_credentials, push_server) != EXIT_SUCCESS) {
+  if (authenticate(cacerts, push_credentials, push_server, token_cache) != EXIT_SUCCESS) {
     LOG_FATAL << "Authentication with push server failed";
     return EXIT_FAILURE;
   }
 
-  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeHttpRepo>(&fetch_server);
+  auto http_repo = std::make_shared<OSTreeHttpRepo>(&fetch_server);
+  // Objects are fetched on a thread of their own while others are uploaded,
+  // with as many requests in parallel as the uploads.
+  http_repo->FetchInParallel(max_curl_requests);
+  // When both servers are part of the same Treehub deployment, the destination
+  // can copy objects from the source, and only the ones it can't copy need to
+  // go through here.
+  const bool server_copy = vm.count("disable-server-copy") == 0;
+  if (server_copy) {
+    http_repo->FetchFilesOnDemand();
+  }
+  OSTreeRepo::ptr src_repo = http_repo;
   try {
     OSTreeHash commit(OSTreeHash::Parse(ostree_commit));
     bool fsck = vm.count("disable-integrity-checks") == 0;
-    // Since the fetches happen on a single thread in OSTreeHttpRepo, there
-    // isn't much reason to upload in parallel, but why hold the system back if
-    // the fetching is faster than the uploading?
-    if (!UploadToTreehub(src_repo, push_server, commit, mode, max_curl_requests, fsck)) {
+    if (!UploadToTreehub(src_repo, push_server, commit, mode, max_curl_requests, fsck, nullptr,
+                         CongestionControl::kAimd, server_copy ? &fetch_server : nullptr)) {
       LOG_FATAL << "Upload to treehub failed";
       return EXIT_FAILURE;
     }
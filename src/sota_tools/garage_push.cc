@@ -19,10 +19,15 @@ int main(int argc, char **argv) {
 
   boost::filesystem::path repo_path;
   std::string ref;
+  std::string delta_from;
   boost::filesystem::path credentials_path;
   std::string cacerts;
   boost::filesystem::path manifest_path;
   int max_curl_requests;
+  boost::filesystem::path presence_index_dir;
+  boost::filesystem::path token_cache;
+  int presence_index_max_age;
+  std::string congestion_control_name;
   RunMode mode = RunMode::kDefault;
   po::options_description desc("garage-push command line options");
   // clang-format off
@@ -34,10 +39,15 @@ int main(int argc, char **argv) {
     ("loglevel", po::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
     ("repo,C", po::value<boost::filesystem::path>(&repo_path)->required(), "location of OSTree repo")
     ("ref,r", po::value<std::string>(&ref)->required(), "OSTree ref to push (or commit refhash)")
+    ("delta-from", po::value<std::string>(&delta_from), "also upload a static delta to the pushed commit from this OSTree ref or commit refhash of the repo, for devices on it to pull")
     ("credentials,j", po::value<boost::filesystem::path>(&credentials_path)->required(), "credentials (json or zip containing json)")
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
     ("repo-manifest", po::value<boost::filesystem::path>(&manifest_path), "manifest describing repository branches used in the image, to be sent as attached metadata")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests")
+    ("congestion-control", po::value<std::string>(&congestion_control_name)->default_value("aimd"), "how to adapt the number of parallel requests: aimd (grows by one request per round-trip, backs off on errors) or latency (grows while round-trip times stay low, suits servers far away with a lot of bandwidth and a higher --jobs)")
+    ("presence-index", po::value<boost::filesystem::path>(&presence_index_dir), "directory keeping an index of the objects known to be on the server between runs, to skip querying them again")
+    ("presence-index-max-age", po::value<int>(&presence_index_max_age)->default_value(168), "number of hours after which the presence index is rebuilt from scratch")
+    ("token-cache", po::value<boost::filesystem::path>(&token_cache), "directory keeping OAuth2 tokens between runs, to only authenticate again once they expire; only accessible to the user")
     ("dry-run,n", "check arguments and authenticate but don't upload")
     ("walk-tree,w", "walk entire tree and upload all missing objects")
     ("disable-integrity-checks", "Don't validate the checksums of objects before uploading them");
@@ -108,6 +118,21 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  CongestionControl congestion_control;
+  if (congestion_control_name == "aimd") {
+    congestion_control = CongestionControl::kAimd;
+  } else if (congestion_control_name == "latency") {
+    congestion_control = CongestionControl::kLatency;
+  } else {
+    LOG_FATAL << "--congestion-control must be aimd or latency";
+    return EXIT_FAILURE;
+  }
+
+  if (presence_index_max_age < 0) {
+    LOG_FATAL << "--presence-index-max-age must not be negative";
+    return EXIT_FAILURE;
+  }
+
   OSTreeRepo::ptr src_repo = std::make_shared<OSTreeDirRepo>(repo_path);
   if (!src_repo->LooksValid()) {
     LOG_FATAL << "The OSTree src repository does not appear to contain a valid OSTree repository";
@@ -130,18 +155,44 @@ int main(int argc, char **argv) {
       is_ref = false;
     }
 
+    std::unique_ptr<OSTreeHash> delta_from_commit;
+    if (!delta_from.empty()) {
+      OSTreeRef delta_from_ref = src_repo->GetRef(delta_from);
+      try {
+        delta_from_commit = std_::make_unique<OSTreeHash>(delta_from_ref.IsValid() ? delta_from_ref.GetHash()
+                                                                                   : OSTreeHash::Parse(delta_from));
+      } catch (const OSTreeCommitParseError &e) {
+        LOG_FATAL << "Ref or commit refhash " << delta_from << " was not found in repository " << repo_path.string();
+        return EXIT_FAILURE;
+      }
+    }
+
     ServerCredentials push_credentials(credentials_path);
     TreehubServer push_server;
-    if (authenticate(cacerts, push_credentials, push_server) != EXIT_SUCCESS) {
+    if (authenticate(cacerts, push_credentials, push_server, token_cache) != EXIT_SUCCESS) {
       LOG_FATAL << "Authentication with push server failed";
       return EXIT_FAILURE;
     }
     bool fsck = vm.count("disable-integrity-checks") == 0;
-    if (!UploadToTreehub(src_repo, push_server, *commit, mode, max_curl_requests, fsck)) {
+    std::unique_ptr<PresenceIndex> presence_index;
+    if (!presence_index_dir.empty()) {
+      presence_index = std_::make_unique<PresenceIndex>(presence_index_dir, push_server.root_url(),
+                                                        std::chrono::hours(presence_index_max_age));
+    }
+    if (!UploadToTreehub(src_repo, push_server, *commit, mode, max_curl_requests, fsck, presence_index.get(),
+                         congestion_control)) {
       LOG_FATAL << "Upload to treehub failed";
       return EXIT_FAILURE;
     }
 
+    // Before the ref is pushed, so that devices moving to the commit find it
+    if (delta_from_commit) {
+      // Devices fall back to pulling objects
+      if (!UploadStaticDelta(src_repo, push_server, *delta_from_commit, *commit, mode)) {
+        LOG_WARNING << "Could not upload a static delta from " << delta_from;
+      }
+    }
+
     if (mode != RunMode::kDryRun) {
       if (is_ref) {
         if (!PushRootRef(push_server, ostree_ref)) {
@@ -66,6 +66,7 @@ AuthenticationResult OAuth2::Authenticate() {
   curlEasySetoptWrapper(curl_handle.get(), CURLOPT_WRITEFUNCTION, &curl_handle_write_sstream);
   curlEasySetoptWrapper(curl_handle.get(), CURLOPT_WRITEDATA, &body);
 
+  const auto requested = std::chrono::system_clock::now();
   curl_easy_perform(curl_handle.get());
 
   long rescode;  // NOLINT(google-runtime-int)
@@ -75,6 +76,8 @@ AuthenticationResult OAuth2::Authenticate() {
     try {
       read_json(body, pt);
       token_ = pt.get("access_token", "");
+      const auto expires_in = pt.get<int64_t>("expires_in", 0);
+      expiry_ = expires_in > 0 ? requested + std::chrono::seconds(expires_in) : std::chrono::system_clock::time_point{};
       LOG_TRACE << "Got OAuth2 access token:" << token_;
       return AuthenticationResult::kSuccess;
     } catch (const json_parser_error &e) {
@@ -1,6 +1,7 @@
 #ifndef SOTA_CLIENT_TOOLS_OAUTH2_H_
 #define SOTA_CLIENT_TOOLS_OAUTH2_H_
 
+#include <chrono>
 #include <string>
 #include <utility>
 
@@ -24,6 +25,12 @@ class OAuth2 {
   AuthenticationResult Authenticate();
 
   std::string token() const { return token_; }
+  // When the token expires, or the epoch if the server didn't tell
+  std::chrono::system_clock::time_point expiry() const { return expiry_; }
+
+  // Tokens are replaced this long before they expire, so that they don't
+  // expire during a request
+  static constexpr std::chrono::seconds kExpiryMargin{60};
 
  private:
   const std::string server_;
@@ -32,6 +39,7 @@ class OAuth2 {
   const std::string scope_;
   const std::string ca_certs_;
   std::string token_;
+  std::chrono::system_clock::time_point expiry_;
 };
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,254 @@
+#include "object_fetcher.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "logging/logging.h"
+
+// Upper bound on how long a new request can wait to be launched while others
+// are running
+static constexpr int kMultiWaitMs = 100;
+
+struct ObjectFetcher::Transfer {
+  boost::filesystem::path path;
+  int fd{-1};
+  RateController::clock::time_point start_time;
+};
+
+static size_t curl_handle_write(void *buffer, size_t size, size_t nmemb, void *userp) {
+  return static_cast<size_t>(write(*static_cast<int *>(userp), buffer, nmemb * size));
+}
+
+ObjectFetcher::ObjectFetcher(const TreehubServer &server, boost::filesystem::path root, const int max_requests)
+    : server_(server), root_(std::move(root)), rate_controller_(max_requests) {
+  multi_ = curl_multi_init();
+  if (multi_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl multi handle");
+  }
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_HTTP1 | CURLPIPE_MULTIPLEX);
+  thread_ = std::thread(&ObjectFetcher::Run, this);
+}
+
+ObjectFetcher::~ObjectFetcher() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  thread_.join();
+  curl_multi_cleanup(multi_);
+}
+
+void ObjectFetcher::Prefetch(const boost::filesystem::path &path) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (states_.count(path) == 0) {
+    Queue(path, false);
+  }
+}
+
+bool ObjectFetcher::Fetch(const boost::filesystem::path &path) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = states_.find(path);
+  if (it != states_.end() && it->second == State::kClaimed) {
+    return true;
+  }
+  if (it == states_.end() || it->second == State::kFailed) {
+    Queue(path, true);
+  } else if (it->second == State::kQueued) {
+    // it is also still in the prefetch queue, and will be skipped there
+    urgent_.push_back(path);
+    work_cv_.notify_one();
+  }
+  it = states_.find(path);
+  done_cv_.wait(lock, [it] { return it->second != State::kQueued && it->second != State::kRunning; });
+
+  if (it->second == State::kFailed) {
+    return false;
+  }
+  it->second = State::kClaimed;
+  return true;
+}
+
+bool ObjectFetcher::Fetched(const boost::filesystem::path &path) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = states_.find(path);
+  if (it == states_.end()) {
+    Queue(path, false);
+    return false;
+  }
+  // failures are left to Fetch()
+  return it->second != State::kQueued && it->second != State::kRunning;
+}
+
+int ObjectFetcher::fetched() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return fetched_;
+}
+
+void ObjectFetcher::Queue(const boost::filesystem::path &path, const bool urgent) {
+  if (server_failed_) {
+    states_[path] = State::kFailed;
+    return;
+  }
+  states_[path] = State::kQueued;
+  if (urgent) {
+    urgent_.push_back(path);
+  } else {
+    queue_.push_back(path);
+  }
+  work_cv_.notify_one();
+}
+
+bool ObjectFetcher::CanLaunch() const {
+  return static_cast<int>(running_.size()) < rate_controller_.MaxConcurrency() && (!urgent_.empty() || !queue_.empty());
+}
+
+void ObjectFetcher::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    while (CanLaunch()) {
+      std::deque<boost::filesystem::path> &from = urgent_.empty() ? queue_ : urgent_;
+      const boost::filesystem::path path = from.front();
+      from.pop_front();
+      // skip what has been launched from the other queue
+      if (states_[path] == State::kQueued) {
+        Launch(path);
+      }
+    }
+    if (running_.empty()) {
+      work_cv_.wait(lock, [this] { return stopping_ || CanLaunch(); });
+      continue;
+    }
+
+    // Write callbacks are called from curl_multi_perform(), don't hold the lock
+    // while they run
+    lock.unlock();
+    int still_running = 0;
+    CURLMcode mc = curl_multi_perform(multi_, &still_running);
+    if (mc != CURLM_OK) {
+      LOG_ERROR << "curl_multi_perform failed: " << curl_multi_strerror(mc);
+    }
+    std::vector<std::pair<CURL *, CURLcode>> finished;
+    int msgs_in_queue;
+    CURLMsg *msg;
+    while ((msg = curl_multi_info_read(multi_, &msgs_in_queue)) != nullptr) {
+      if (msg->msg == CURLMSG_DONE) {
+        finished.emplace_back(msg->easy_handle, msg->data.result);
+      }
+    }
+    if (finished.empty() && still_running > 0) {
+      mc = curl_multi_wait(multi_, nullptr, 0, kMultiWaitMs, nullptr);
+      if (mc != CURLM_OK) {
+        LOG_ERROR << "curl_multi_wait failed: " << curl_multi_strerror(mc);
+      }
+    }
+    lock.lock();
+
+    for (const auto &f : finished) {
+      Done(f.first, f.second);
+    }
+    const auto sleep_time = rate_controller_.GetSleepTime();
+    if (!finished.empty() && !server_failed_ && sleep_time > RateController::clock::duration(0)) {
+      LOG_DEBUG << "Waiting for " << std::chrono::duration_cast<std::chrono::seconds>(sleep_time).count()
+                << " seconds before fetching more objects due to server congestion.";
+      work_cv_.wait_for(lock, sleep_time, [this] { return stopping_; });
+    }
+  }
+
+  // cancel what is left
+  for (auto &t : running_) {
+    curl_multi_remove_handle(multi_, t.first);
+    curl_easy_cleanup(t.first);
+    close(t.second.fd);
+    boost::filesystem::remove(root_ / t.second.path);
+    states_[t.second.path] = State::kFailed;
+  }
+  running_.clear();
+  for (auto &state : states_) {
+    if (state.second == State::kQueued) {
+      state.second = State::kFailed;
+    }
+  }
+  done_cv_.notify_all();
+}
+
+void ObjectFetcher::Launch(const boost::filesystem::path &path) {
+  const boost::filesystem::path filename = root_ / path;
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(filename.parent_path(), ec);
+  const int fd =
+      open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+  CURL *handle = fd != -1 ? curl_easy_init() : nullptr;
+  if (handle == nullptr) {
+    LOG_ERROR << "Failed to open file: " << filename;
+    if (fd != -1) {
+      close(fd);
+    }
+    states_[path] = State::kFailed;
+    done_cv_.notify_all();
+    return;
+  }
+
+  Transfer &transfer = running_[handle];
+  transfer.path = path;
+  transfer.fd = fd;
+  transfer.start_time = RateController::clock::now();
+  curlEasySetoptWrapper(handle, CURLOPT_VERBOSE, get_curlopt_verbose());
+  server_.InjectIntoCurl(path.string(), handle);
+  curlEasySetoptWrapper(handle, CURLOPT_USERAGENT, Utils::getUserAgent());
+  curlEasySetoptWrapper(handle, CURLOPT_FAILONERROR, true);
+  curlEasySetoptWrapper(handle, CURLOPT_WRITEFUNCTION, &curl_handle_write);
+  curlEasySetoptWrapper(handle, CURLOPT_WRITEDATA, &transfer.fd);
+  states_[path] = State::kRunning;
+  const CURLMcode mc = curl_multi_add_handle(multi_, handle);
+  if (mc != CURLM_OK) {
+    LOG_ERROR << "curl_multi_add_handle error:" << curl_multi_strerror(mc);
+    Done(handle, CURLE_FAILED_INIT);
+  }
+}
+
+void ObjectFetcher::Done(CURL *handle, const CURLcode result) {
+  auto it = running_.find(handle);
+  const Transfer transfer = it->second;
+  running_.erase(it);
+  long rescode = 0;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &rescode);
+  curl_multi_remove_handle(multi_, handle);
+  curl_easy_cleanup(handle);
+  close(transfer.fd);
+
+  const bool ok = result == CURLE_OK;
+  if (!ok) {
+    // Missing objects are expected, e.g. detached commit metadata
+    if (result != CURLE_HTTP_RETURNED_ERROR) {
+      LOG_ERROR << "Failed to get object " << transfer.path << ": " << curl_easy_strerror(result);
+    }
+    boost::filesystem::remove(root_ / transfer.path);
+  }
+  // Only server and network errors are a sign of congestion
+  const bool server_ok = ok || (result == CURLE_HTTP_RETURNED_ERROR && rescode < 500);
+  rate_controller_.RequestCompleted(transfer.start_time, RateController::clock::now(), server_ok);
+
+  if (ok) {
+    fetched_++;
+    states_[transfer.path] = State::kFetched;
+  } else {
+    states_[transfer.path] = State::kFailed;
+  }
+
+  if (!server_failed_ && rate_controller_.ServerHasFailed()) {
+    LOG_ERROR << "The server to fetch objects from keeps failing, giving up";
+    server_failed_ = true;
+    for (auto &state : states_) {
+      if (state.second == State::kQueued) {
+        state.second = State::kFailed;
+      }
+    }
+    urgent_.clear();
+    queue_.clear();
+  }
+  done_cv_.notify_all();
+}
@@ -0,0 +1,80 @@
+#ifndef SOTA_CLIENT_TOOLS_OBJECT_FETCHER_H_
+#define SOTA_CLIENT_TOOLS_OBJECT_FETCHER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <curl/curl.h>
+#include <boost/filesystem/path.hpp>
+
+#include "rate_controller.h"
+#include "treehub_server.h"
+
+/**
+ * Fetches files of a remote OSTree repository into a local directory, several
+ * at a time, on a thread of its own.
+ *
+ * Files are fetched in the order they were asked for, with the ones somebody
+ * is waiting for first. The number of parallel requests adapts to the server
+ * like the uploads of a RequestPool.
+ */
+class ObjectFetcher {
+ public:
+  // The server must not be changed while the fetcher is running.
+  ObjectFetcher(const TreehubServer& server, boost::filesystem::path root, int max_requests);
+  ~ObjectFetcher();
+  ObjectFetcher(const ObjectFetcher&) = delete;
+  ObjectFetcher(ObjectFetcher&&) = delete;
+  ObjectFetcher& operator=(const ObjectFetcher&) = delete;
+  ObjectFetcher& operator=(ObjectFetcher&&) = delete;
+
+  /* Start fetching a file, relative to the root of the repository, unless it
+   * has been fetched or asked for before. */
+  void Prefetch(const boost::filesystem::path& path);
+
+  /* Fetch a file ahead of any prefetched ones, or wait for a fetch that is
+   * already running. Returns true once it is on disk, false if it could not
+   * be fetched. Files whose fetch failed are fetched again. */
+  bool Fetch(const boost::filesystem::path& path);
+
+  /* Whether Fetch() would return without waiting. Starts fetching the file if
+   * it has not been asked for before. */
+  bool Fetched(const boost::filesystem::path& path);
+
+  // the number of files fetched so far
+  int fetched() const;
+
+ private:
+  enum class State { kQueued, kRunning, kFetched, kFailed, kClaimed };
+  struct Transfer;
+
+  void Run();
+  // with mutex_ held
+  void Queue(const boost::filesystem::path& path, bool urgent);
+  bool CanLaunch() const;
+  void Launch(const boost::filesystem::path& path);
+  void Done(CURL* handle, CURLcode result);
+
+  const TreehubServer& server_;
+  const boost::filesystem::path root_;
+  CURLM* multi_;
+  // only accessed from the fetcher thread
+  RateController rate_controller_;
+  std::map<CURL*, Transfer> running_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::deque<boost::filesystem::path> urgent_;
+  std::deque<boost::filesystem::path> queue_;
+  std::map<boost::filesystem::path, State> states_;
+  int fetched_{0};
+  bool server_failed_{false};
+  bool stopping_{false};
+  std::thread thread_;
+};
+
+#endif  // SOTA_CLIENT_TOOLS_OBJECT_FETCHER_H_
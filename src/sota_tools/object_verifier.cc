@@ -0,0 +1,164 @@
+#include "object_verifier.h"
+
+#include <glib.h>
+#include <zlib.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+// The header is mostly extended attributes, which are small
+static constexpr uint32_t kMaxHeaderSize = 1024 * 1024;
+static constexpr size_t kInflateBufferSize = 64 * 1024;
+// Size of the header and padding before a variant in the object files
+static constexpr size_t kSizePrefix = 8;
+
+ObjectVerifier::ObjectVerifier(const OSTreeHash& hash, const OstreeObjectType type)
+    : hash_(hash),
+      type_(type),
+      state_(type == OSTREE_OBJECT_TYPE_FILE ? State::kHeaderSize : State::kContent) {
+  if (type_ == OSTREE_OBJECT_TYPE_FILE) {
+    strm_.reset(new z_stream{});
+    // raw deflate, without the zlib header
+    if (inflateInit2(strm_.get(), -MAX_WBITS) != Z_OK) {
+      throw std::runtime_error("Failed to initialize the deflate decompression");
+    }
+  }
+}
+
+ObjectVerifier::~ObjectVerifier() {
+  if (strm_) {
+    inflateEnd(strm_.get());
+  }
+}
+
+bool ObjectVerifier::Update(const uint8_t* data, size_t size) {
+  if (type_ == OSTREE_OBJECT_TYPE_COMMIT_META) {
+    return true;
+  }
+  if (type_ != OSTREE_OBJECT_TYPE_FILE) {
+    hasher_.update(data, size);
+    return true;
+  }
+
+  while (size > 0 && state_ != State::kCorrupt) {
+    switch (state_) {
+      case State::kHeaderSize:
+      case State::kHeader: {
+        const size_t wanted = (state_ == State::kHeaderSize ? kSizePrefix : kSizePrefix + header_size_) - header_.size();
+        const size_t n = std::min(wanted, size);
+        header_.append(reinterpret_cast<const char*>(data), n);
+        data += n;
+        size -= n;
+        if (n == wanted) {
+          if (state_ == State::kHeaderSize) {
+            uint32_t be_size;
+            std::memcpy(&be_size, header_.data(), sizeof(be_size));
+            header_size_ = GUINT32_FROM_BE(be_size);
+            state_ = header_size_ <= kMaxHeaderSize ? State::kHeader : State::kCorrupt;
+          } else {
+            state_ = ParseHeader() ? State::kContent : State::kCorrupt;
+          }
+        }
+        break;
+      }
+      case State::kContent:
+        if (!Inflate(data, size)) {
+          state_ = State::kCorrupt;
+        }
+        size = 0;
+        break;
+      case State::kDone:
+        // trailing data
+        state_ = State::kCorrupt;
+        break;
+      case State::kCorrupt:
+        break;
+    }
+  }
+  return state_ != State::kCorrupt;
+}
+
+// The header of an archive-z2 content object is (tuuuusa(ayay)): the file
+// size, uid, gid, mode, rdev, symlink target and extended attributes, in big
+// endian. The checksum is computed over the same without the size.
+bool ObjectVerifier::ParseHeader() {
+  GBytes* bytes = g_bytes_new(header_.data() + kSizePrefix, header_size_);
+  GVariant* header = g_variant_new_from_bytes(G_VARIANT_TYPE("(tuuuusa(ayay))"), bytes, FALSE);
+  g_variant_ref_sink(header);
+  g_bytes_unref(bytes);
+
+  GVariant* size_variant = g_variant_get_child_value(header, 0);
+  content_size_ = GUINT64_FROM_BE(g_variant_get_uint64(size_variant));
+  g_variant_unref(size_variant);
+
+  std::array<GVariant*, 6> children{};
+  for (size_t i = 0; i < children.size(); i++) {
+    children[i] = g_variant_get_child_value(header, i + 1);
+  }
+  GVariant* bare_header = g_variant_new_tuple(children.data(), children.size());
+  g_variant_ref_sink(bare_header);
+  for (GVariant* child : children) {
+    g_variant_unref(child);
+  }
+  g_variant_unref(header);
+
+  const auto bare_size = static_cast<uint32_t>(g_variant_get_size(bare_header));
+  std::array<uint8_t, kSizePrefix> prefix{};
+  const uint32_t be_size = GUINT32_TO_BE(bare_size);
+  std::memcpy(prefix.data(), &be_size, sizeof(be_size));
+  hasher_.update(prefix.data(), prefix.size());
+  hasher_.update(static_cast<const unsigned char*>(g_variant_get_data(bare_header)), bare_size);
+  g_variant_unref(bare_header);
+
+  header_.clear();
+  header_.shrink_to_fit();
+  return true;
+}
+
+bool ObjectVerifier::Inflate(const uint8_t* data, size_t size) {
+  std::array<uint8_t, kInflateBufferSize> out{};
+  while (size > 0) {
+    const auto n = static_cast<uInt>(std::min<size_t>(size, std::numeric_limits<uInt>::max()));
+    strm_->next_in = const_cast<Bytef*>(data);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    strm_->avail_in = n;
+    data += n;
+    size -= n;
+    do {
+      strm_->next_out = out.data();
+      strm_->avail_out = static_cast<uInt>(out.size());
+      const int r = inflate(strm_.get(), Z_NO_FLUSH);
+      if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+        return false;
+      }
+      const size_t produced = out.size() - strm_->avail_out;
+      hasher_.update(out.data(), produced);
+      inflated_size_ += produced;
+      if (inflated_size_ > content_size_) {
+        return false;
+      }
+      if (r == Z_STREAM_END) {
+        state_ = State::kDone;
+        // anything after the end of the stream
+        return strm_->avail_in == 0 && size == 0;
+      }
+    } while (strm_->avail_out == 0);
+  }
+  return true;
+}
+
+bool ObjectVerifier::Verify() {
+  if (type_ == OSTREE_OBJECT_TYPE_COMMIT_META) {
+    return true;
+  }
+  if (type_ == OSTREE_OBJECT_TYPE_FILE) {
+    // Symlinks have no content after the header
+    const bool complete =
+        state_ == State::kDone || (state_ == State::kContent && strm_->total_in == 0 && content_size_ == 0);
+    if (!complete || inflated_size_ != content_size_) {
+      return false;
+    }
+  }
+  return OSTreeHash::Parse(hasher_.getHexDigest()).bytes() == hash_.bytes();
+}
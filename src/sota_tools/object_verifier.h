@@ -0,0 +1,60 @@
+#ifndef SOTA_CLIENT_TOOLS_OBJECT_VERIFIER_H_
+#define SOTA_CLIENT_TOOLS_OBJECT_VERIFIER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "crypto/crypto.h"
+#include "garage_common.h"
+#include "ostree_hash.h"
+
+struct z_stream_s;
+
+/**
+ * Checks an object of an archive-z2 OSTree repository against its hash, from
+ * the bytes of its file fed piece by piece, e.g. as they are read for an
+ * upload. This is the check done by ostree_repo_fsck_object(), without
+ * reading the file a second time.
+ *
+ * Metadata objects are stored as they are hashed. Content objects (.filez)
+ * are a header followed by the raw deflated file, and are hashed as the
+ * header of a bare repository followed by the uncompressed file.
+ */
+class ObjectVerifier {
+ public:
+  ObjectVerifier(const OSTreeHash& hash, OstreeObjectType type);
+  ~ObjectVerifier();
+  ObjectVerifier(const ObjectVerifier&) = delete;
+  ObjectVerifier(ObjectVerifier&&) = delete;
+  ObjectVerifier& operator=(const ObjectVerifier&) = delete;
+  ObjectVerifier& operator=(ObjectVerifier&&) = delete;
+
+  /* Feed the next piece of the file. Returns false once the object is known
+   * to be corrupt. */
+  bool Update(const uint8_t* data, size_t size);
+  bool Update(const std::string& data) { return Update(reinterpret_cast<const uint8_t*>(data.data()), data.size()); }
+
+  /* Whether the whole file has been fed and matches the hash. To be called
+   * once, at the end. Commitmeta objects can't be checked and always match. */
+  bool Verify();
+
+ private:
+  enum class State { kHeaderSize, kHeader, kContent, kDone, kCorrupt };
+
+  bool ParseHeader();
+  bool Inflate(const uint8_t* data, size_t size);
+
+  const OSTreeHash hash_;
+  const OstreeObjectType type_;
+  MultiPartSHA256Hasher hasher_;
+  State state_;
+  // content objects only
+  std::string header_;
+  uint32_t header_size_{0};
+  uint64_t content_size_{0};
+  uint64_t inflated_size_{0};
+  std::unique_ptr<z_stream_s> strm_;
+};
+
+#endif  // SOTA_CLIENT_TOOLS_OBJECT_VERIFIER_H_
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include <map>
+
+#include <boost/filesystem.hpp>
+
+#include "object_verifier.h"
+#include "ostree_repo.h"
+#include "utilities/utils.h"
+
+static const boost::filesystem::path kRepo = "tests/sota_tools/repo";
+
+static std::string ReadObject(const boost::filesystem::path& repo, const OSTreeHash& hash,
+                              const OstreeObjectType type) {
+  return Utils::readFile(repo / "objects" / OSTreeRepo::GetPathForHash(hash, type));
+}
+
+static bool VerifyPieces(const OSTreeHash& hash, const OstreeObjectType type, const std::string& contents,
+                         const size_t piece_size) {
+  ObjectVerifier verifier(hash, type);
+  for (size_t i = 0; i < contents.size(); i += piece_size) {
+    if (!verifier.Update(contents.substr(i, piece_size))) {
+      return false;
+    }
+  }
+  return verifier.Verify();
+}
+
+/* Every object of a good repository matches its hash, however it is split. */
+TEST(object_verifier, good_objects) {
+  const std::map<std::string, OstreeObjectType> types{{".commit", OSTREE_OBJECT_TYPE_COMMIT},
+                                                      {".dirtree", OSTREE_OBJECT_TYPE_DIR_TREE},
+                                                      {".dirmeta", OSTREE_OBJECT_TYPE_DIR_META},
+                                                      {".filez", OSTREE_OBJECT_TYPE_FILE}};
+  int checked = 0;
+  for (boost::filesystem::recursive_directory_iterator it(kRepo / "objects"), end; it != end; ++it) {
+    const boost::filesystem::path& path = it->path();
+    if (!boost::filesystem::is_regular_file(path)) {
+      continue;
+    }
+    const OstreeObjectType type = types.at(path.extension().string());
+    const OSTreeHash hash = OSTreeHash::Parse(path.parent_path().filename().string() + path.stem().string());
+    const std::string contents = Utils::readFile(path);
+    for (size_t piece_size : {static_cast<size_t>(1), static_cast<size_t>(7), contents.size()}) {
+      EXPECT_TRUE(VerifyPieces(hash, type, contents, piece_size)) << path << " in pieces of " << piece_size;
+    }
+    ++checked;
+  }
+  EXPECT_GE(checked, 4);
+}
+
+/* Corrupt, truncated and extended objects are detected. */
+TEST(object_verifier, bad_objects) {
+  const boost::filesystem::path corrupt_repo = "tests/sota_tools/corrupt-repo";
+  const OSTreeHash corrupt = OSTreeHash::Parse("4145b1a9bade30efb28ff921f7a555ff82ba7d3b7b83b968084436167912fa83");
+  const std::string corrupt_contents = ReadObject(corrupt_repo, corrupt, OSTREE_OBJECT_TYPE_FILE);
+  EXPECT_FALSE(VerifyPieces(corrupt, OSTREE_OBJECT_TYPE_FILE, corrupt_contents, corrupt_contents.size()));
+
+  const OSTreeHash good = OSTreeHash::Parse("2ee758031340b51db1c0229bddd8f64bca4b131728d2bfb20c0c8671b1259a38");
+  const std::string contents = ReadObject(corrupt_repo, good, OSTREE_OBJECT_TYPE_FILE);
+  EXPECT_TRUE(VerifyPieces(good, OSTREE_OBJECT_TYPE_FILE, contents, contents.size()));
+  EXPECT_FALSE(VerifyPieces(good, OSTREE_OBJECT_TYPE_FILE, contents.substr(0, contents.size() - 1), 3));
+  EXPECT_FALSE(VerifyPieces(good, OSTREE_OBJECT_TYPE_FILE, contents + "x", 3));
+  EXPECT_FALSE(VerifyPieces(good, OSTREE_OBJECT_TYPE_DIR_META, contents, contents.size()));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
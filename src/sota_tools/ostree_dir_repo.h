@@ -18,6 +18,7 @@ class OSTreeDirRepo : public OSTreeRepo {
 
   bool LooksValid() const override;
   OSTreeRef GetRef(const std::string& refname) const override;
+  bool IsLocal() const override { return true; }
   boost::filesystem::path root() const override { return root_; }
 
  private:
@@ -52,6 +52,10 @@ bool OSTreeHash::operator<(const OSTreeHash& other) const {
   return memcmp(hash_.data(), other.hash_.data(), hash_.size()) < 0;
 }
 
+bool OSTreeHash::operator==(const OSTreeHash& other) const {
+  return memcmp(hash_.data(), other.hash_.data(), hash_.size()) == 0;
+}
+
 std::ostream& operator<<(std::ostream& os, const OSTreeHash& obj) {
   os << obj.string();
   return os;
@@ -20,8 +20,10 @@ class OSTreeHash {
   explicit OSTreeHash(const std::array<uint8_t, 32>& hash);
 
   std::string string() const;
+  const std::array<uint8_t, 32>& bytes() const { return hash_; }
 
   bool operator<(const OSTreeHash& other) const;
+  bool operator==(const OSTreeHash& other) const;
   friend std::ostream& operator<<(std::ostream& os, const OSTreeHash& obj);
 
  private:
@@ -33,7 +33,58 @@ bool OSTreeHttpRepo::LooksValid() const {
 
 OSTreeRef OSTreeHttpRepo::GetRef(const std::string &refname) const { return OSTreeRef(*server_, refname); }
 
+bool OSTreeHttpRepo::Prefetch(const TreeWalker::ChildList &objects) const {
+  if (!fetcher_) {
+    return true;
+  }
+  bool fetched = true;
+  for (const auto &object : objects) {
+    if (FetchesOnDemand(object.second)) {
+      continue;
+    }
+    // ask for all of them, not just up to the first one still being fetched
+    if (!fetcher_->Fetched(boost::filesystem::path("objects") / GetPathForHash(object.first, object.second))) {
+      fetched = false;
+    }
+  }
+  return fetched;
+}
+
+void OSTreeHttpRepo::FetchContents(const OSTreeHash &hash, const OstreeObjectType type) const {
+  if (!FetchesOnDemand(type)) {
+    return;
+  }
+  const boost::filesystem::path path = boost::filesystem::path("objects") / GetPathForHash(hash, type);
+  // the fetcher knows what it has fetched already
+  if (!fetcher_ && boost::filesystem::exists(root_ / path)) {
+    return;
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (Download(path)) {
+      return;
+    }
+  }
+  throw OSTreeObjectMissing(hash);
+}
+
+void OSTreeHttpRepo::PrefetchContents(const OSTreeHash &hash, const OstreeObjectType type) const {
+  if (FetchesOnDemand(type) && fetcher_) {
+    fetcher_->Prefetch(boost::filesystem::path("objects") / GetPathForHash(hash, type));
+  }
+}
+
 bool OSTreeHttpRepo::FetchObject(const boost::filesystem::path &path) const {
+  if (files_on_demand_ && path.extension() == ".filez") {
+    // see FetchContents()
+    return true;
+  }
+  return Download(path);
+}
+
+bool OSTreeHttpRepo::Download(const boost::filesystem::path &path) const {
+  if (fetcher_) {
+    return fetcher_->Fetch(path);
+  }
   CURLcode err = CURLE_OK;
   server_->InjectIntoCurl(path.string(), easy_handle_.get());
   boost::filesystem::create_directories((root_ / path).parent_path());
@@ -1,9 +1,12 @@
 #ifndef SOTA_CLIENT_TOOLS_OSTREE_HTTP_REPO_H_
 #define SOTA_CLIENT_TOOLS_OSTREE_HTTP_REPO_H_
 
+#include <memory>
+
 #include <boost/filesystem/path.hpp>
 
 #include "logging/logging.h"
+#include "object_fetcher.h"
 #include "ostree_ref.h"
 #include "ostree_repo.h"
 #include "treehub_server.h"
@@ -24,15 +27,35 @@ class OSTreeHttpRepo : public OSTreeRepo {
   bool LooksValid() const override;
   OSTreeRef GetRef(const std::string& refname) const override;
   boost::filesystem::path root() const override { return root_; }
+  bool Prefetch(const TreeWalker::ChildList& objects) const override;
+  void FetchContents(const OSTreeHash& hash, OstreeObjectType type) const override;
+  void PrefetchContents(const OSTreeHash& hash, OstreeObjectType type) const override;
+  bool FetchesOnDemand(OstreeObjectType type) const override {
+    return files_on_demand_ && type == OSTREE_OBJECT_TYPE_FILE;
+  }
+
+  /* Fetch objects with up to max_requests requests in parallel, on a thread
+   * of its own, instead of one at a time when they are asked for. The server
+   * is then used from that thread until the repository is destroyed. */
+  void FetchInParallel(int max_requests) { fetcher_ = std_::make_unique<ObjectFetcher>(*server_, root_, max_requests); }
+
+  /* Only fetch file objects in FetchContents(), when their contents are
+   * needed, rather than in GetObject(). A server that can copy them from this
+   * one directly then never needs them here. */
+  void FetchFilesOnDemand() { files_on_demand_ = true; }
 
  private:
   bool FetchObject(const boost::filesystem::path& path) const override;
+  bool Download(const boost::filesystem::path& path) const;
   static size_t curl_handle_write(void* buffer, size_t size, size_t nmemb, void* userp);
 
   TreehubServer* server_;
   boost::filesystem::path root_;
   const TemporaryDirectory root_tmp_;
   mutable CurlEasyWrapper easy_handle_;
+  bool files_on_demand_{false};
+  // stopped before root_tmp_ is removed
+  std::unique_ptr<ObjectFetcher> fetcher_;
 };
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
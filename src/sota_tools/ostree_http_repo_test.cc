@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/process.hpp>
 
 #include "authenticate.h"
@@ -108,6 +109,76 @@ TEST(http_repo, bad_connection) {
   EXPECT_EQ(result, 0) << "Diff between source and destination repos is nonzero.";
 }
 
+/* Fetch objects in parallel, ahead of the uploads to another server. */
+TEST(http_repo, parallel_fetch) {
+  TemporaryDirectory src_dir, dst_dir;
+  std::string sp = TestUtils::getFreePort();
+
+  boost::process::child server_process("tests/sota_tools/treehub_server.py", std::string("-p"), sp, std::string("-d"),
+                                       src_dir.PathString(), std::string("--create"));
+  TestUtils::waitForServer("http://localhost:" + sp + "/");
+
+  TreehubServer server;
+  server.root_url("http://localhost:" + sp);
+  auto http_repo = std::make_shared<OSTreeHttpRepo>(&server);
+  http_repo->FetchInParallel(4);
+  OSTreeRepo::ptr src_repo = http_repo;
+
+  std::string dp = TestUtils::getFreePort();
+  boost::process::child deploy_server_process("tests/sota_tools/treehub_server.py", std::string("-p"), dp,
+                                              std::string("-d"), dst_dir.PathString());
+  TestUtils::waitForServer("http://localhost:" + dp + "/");
+
+  auto hash = OSTreeHash::Parse("b9ac1e45f9227df8ee191b6e51e09417bd36c6ebbeff999431e3073ac50f0563");
+  TreehubServer push_server;
+  push_server.root_url("http://localhost:" + dp);
+  EXPECT_TRUE(UploadToTreehub(src_repo, push_server, hash, RunMode::kDefault, 4, true));
+
+  std::string diff("diff -r ");
+  std::string src_path((src_dir.Path() / "objects").string() + " ");
+  std::string dst_path((dst_dir.Path() / "objects").string() + " ");
+  EXPECT_EQ(system((diff + src_path + dst_path).c_str()), 0) << "Diff between source and destination repos is nonzero.";
+}
+
+/* Have the destination server copy objects from the source server, without
+ * fetching them. */
+TEST(http_repo, server_copy) {
+  TemporaryDirectory src_dir, dst_dir;
+  std::string sp = TestUtils::getFreePort();
+
+  boost::process::child server_process("tests/sota_tools/treehub_server.py", std::string("-p"), sp, std::string("-d"),
+                                       src_dir.PathString(), std::string("--create"));
+  TestUtils::waitForServer("http://localhost:" + sp + "/");
+
+  TreehubServer server;
+  server.root_url("http://localhost:" + sp);
+  auto http_repo = std::make_shared<OSTreeHttpRepo>(&server);
+  http_repo->FetchInParallel(4);
+  http_repo->FetchFilesOnDemand();
+  OSTreeRepo::ptr src_repo = http_repo;
+
+  std::string dp = TestUtils::getFreePort();
+  boost::process::child deploy_server_process("tests/sota_tools/treehub_server.py", std::string("-p"), dp,
+                                              std::string("-d"), dst_dir.PathString(), std::string("--copy"));
+  TestUtils::waitForServer("http://localhost:" + dp + "/");
+
+  auto hash = OSTreeHash::Parse("b9ac1e45f9227df8ee191b6e51e09417bd36c6ebbeff999431e3073ac50f0563");
+  TreehubServer push_server;
+  push_server.root_url("http://localhost:" + dp);
+  EXPECT_TRUE(UploadToTreehub(src_repo, push_server, hash, RunMode::kDefault, 4, true, nullptr,
+                              CongestionControl::kAimd, &server));
+
+  std::string diff("diff -r ");
+  std::string src_path((src_dir.Path() / "objects").string() + " ");
+  std::string dst_path((dst_dir.Path() / "objects").string() + " ");
+  EXPECT_EQ(system((diff + src_path + dst_path).c_str()), 0) << "Diff between source and destination repos is nonzero.";
+
+  // none of the file objects went through here
+  for (boost::filesystem::recursive_directory_iterator it(src_repo->root()), end; it != end; ++it) {
+    EXPECT_NE(it->path().extension(), ".filez") << it->path();
+  }
+}
+
 TEST(http_repo, root) {
   TreehubServer server;
   server.root_url("http://localhost:" + port);
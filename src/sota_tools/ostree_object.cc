@@ -4,27 +4,123 @@
 #include <ostree.h>
 #include <sys/stat.h>
 #include <boost/filesystem.hpp>
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 
 #include "logging/logging.h"
+#include "object_verifier.h"
 #include "ostree_repo.h"
 #include "request_pool.h"
+#include "tree_walker.h"
 #include "utilities/utils.h"
 
 using std::string;
 
+struct OSTreeObject::UploadState {
+  UploadState() = default;
+  UploadState(const UploadState &) = delete;
+  UploadState &operator=(const UploadState &) = delete;
+  ~UploadState() {
+    if (fd != nullptr) {
+      fclose(fd);
+    }
+  }
+
+  FILE *fd{nullptr};
+  // uploads with verification only
+  std::unique_ptr<ObjectVerifier> verifier;
+  uintmax_t size{0};
+  uintmax_t read{0};
+};
+
+namespace {
+/* Hands out fixed-size slots carved from large blocks, so that the objects of
+ * a big commit don't each carry the overhead of a heap allocation. Blocks are
+ * kept for reuse until the process exits. */
+class ObjectPool {
+ public:
+  explicit ObjectPool(size_t slot_size) : slot_size_(Align(slot_size)) {}
+  ObjectPool(const ObjectPool &) = delete;
+  ObjectPool &operator=(const ObjectPool &) = delete;
+  ~ObjectPool() {
+    for (char *block : blocks_) {
+      ::operator delete(block);
+    }
+  }
+
+  void *Allocate() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (free_ == nullptr) {
+      char *block = static_cast<char *>(::operator new(slot_size_ * kSlotsPerBlock));
+      blocks_.push_back(block);
+      for (size_t i = 0; i < kSlotsPerBlock; ++i) {
+        Release(block + i * slot_size_);
+      }
+    }
+    Slot *slot = free_;
+    free_ = slot->next;
+    return slot;
+  }
+
+  void Free(void *p) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    Release(p);
+  }
+
+ private:
+  struct Slot {
+    Slot *next;
+  };
+  static constexpr size_t kSlotsPerBlock = 1024;
+
+  static size_t Align(size_t size) {
+    const size_t align = alignof(std::max_align_t);
+    size = std::max(size, sizeof(Slot));
+    return (size + align - 1) / align * align;
+  }
+  void Release(void *p) {
+    auto *slot = static_cast<Slot *>(p);
+    slot->next = free_;
+    free_ = slot;
+  }
+
+  const size_t slot_size_;
+  std::mutex mutex_;
+  std::vector<char *> blocks_;
+  Slot *free_{nullptr};
+};
+
+ObjectPool &Pool() {
+  static ObjectPool pool(sizeof(OSTreeObject));
+  return pool;
+}
+}  // namespace
+
+void *OSTreeObject::operator new(size_t size) {
+  assert(size == sizeof(OSTreeObject));
+  (void)size;
+  return Pool().Allocate();
+}
+
+void OSTreeObject::operator delete(void *object) {
+  if (object != nullptr) {
+    Pool().Free(object);
+  }
+}
+
 OSTreeObject::OSTreeObject(const OSTreeRepo &repo, OSTreeHash hash, OstreeObjectType object_type)
     : hash_(hash),
       type_(object_type),
       repo_(repo),
       refcount_(0),
       is_on_server_(PresenceOnServer::kObjectStateUnknown),
-      curl_handle_(nullptr),
-      fd_(nullptr) {
+      curl_handle_(nullptr) {
   auto file_path = PathOnDisk();
-  if (!boost::filesystem::is_regular_file(file_path)) {
+  if (!repo_.FetchesOnDemand(type_) && !boost::filesystem::is_regular_file(file_path)) {
     throw std::runtime_error(file_path.native() + " is not a valid OSTree object.");
   }
 }
@@ -36,152 +132,69 @@ OSTreeObject::~OSTreeObject() {
   }
 }
 
-void OSTreeObject::AddParent(OSTreeObject *parent, std::list<OSTreeObject::ptr>::iterator parent_it) {
-  parentref par;
-
-  par.first = parent;
-  par.second = parent_it;
-  parents_.push_back(par);
-}
-
-void OSTreeObject::ChildNotify(std::list<OSTreeObject::ptr>::iterator child_it) {
-  assert((*child_it)->is_on_server() == PresenceOnServer::kObjectPresent);
-  children_.erase(child_it);
+void OSTreeObject::ChildNotify() {
+  assert(pending_children_ > 0);
+  pending_children_--;
 }
 
 void OSTreeObject::NotifyParents(RequestPool &pool) {
   assert(is_on_server_ == PresenceOnServer::kObjectPresent);
 
-  for (parentref parent : parents_) {
-    parent.first->ChildNotify(parent.second);
-    if (parent.first->children_ready()) {
-      pool.AddUpload(parent.first);
+  // Nobody will wait for this object any more
+  std::vector<OSTreeObject *> parents;
+  parents.swap(parents_);
+  for (OSTreeObject *parent : parents) {
+    parent->ChildNotify();
+    if (parent->children_ready()) {
+      pool.AddUpload(parent);
     }
   }
 }
 
-void OSTreeObject::AppendChild(const OSTreeObject::ptr &child) {
+void OSTreeObject::AppendChild(const OSTreeObject::ptr &child, std::vector<OSTreeObject::ptr> *children) {
   // the child could be already queried/uploaded by another parent
   if (child->is_on_server() == PresenceOnServer::kObjectPresent) {
     return;
   }
 
-  children_.push_back(child);
-  auto last = children_.end();
-  last--;
-  child->AddParent(this, last);
+  pending_children_++;
+  child->parents_.push_back(this);
+  children->push_back(child);
 }
 
 // Can throw OSTreeObjectMissing if the repo is corrupt
-void OSTreeObject::PopulateChildren() {
-  const GVariantType *content_type;
-  bool is_commit;
-
-  if (type_ == OSTREE_OBJECT_TYPE_COMMIT) {
-    content_type = OSTREE_COMMIT_GVARIANT_FORMAT;
-    is_commit = true;
-  } else if (type_ == OSTREE_OBJECT_TYPE_DIR_TREE) {
-    content_type = OSTREE_TREE_GVARIANT_FORMAT;
-    is_commit = false;
-  } else {
-    return;
+bool OSTreeObject::PopulateChildren(RequestPool &pool, std::vector<OSTreeObject::ptr> *children) {
+  if (type_ != OSTREE_OBJECT_TYPE_COMMIT && type_ != OSTREE_OBJECT_TYPE_DIR_TREE) {
+    return true;
   }
 
-  GError *gerror = nullptr;
-  auto file_path = PathOnDisk();
-  GMappedFile *mfile = g_mapped_file_new(file_path.c_str(), FALSE, &gerror);
-
-  if (mfile == nullptr) {
-    throw std::runtime_error("Failed to map metadata file " + file_path.native());
+  const TreeWalker::ChildList parsed = pool.tree_walker() != nullptr ? pool.tree_walker()->Children(hash_, type_)
+                                                                     : TreeWalker::Parse(PathOnDisk(), type_);
+  if (!repo_.Prefetch(parsed)) {
+    return false;
   }
 
-  GVariant *contents =
-      g_variant_new_from_data(content_type, g_mapped_file_get_contents(mfile), g_mapped_file_get_length(mfile), TRUE,
-                              reinterpret_cast<GDestroyNotify>(g_mapped_file_unref), mfile);
-  g_variant_ref_sink(contents);
-
-  if (is_commit) {
+  if (type_ == OSTREE_OBJECT_TYPE_COMMIT) {
     // Detached commit metadata is optional; add it as child only when present.
     try {
       OSTreeObject::ptr cmeta_object;
       cmeta_object = repo_.GetObject(hash_, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT_META);
       LOG_INFO << "Commitmeta object found for commit " << hash_;
-      AppendChild(cmeta_object);
+      AppendChild(cmeta_object, children);
     } catch (const OSTreeObjectMissing &error) {
       LOG_INFO << "No commitmeta object found for commit " << hash_;
     }
+  }
 
-    // * - ay - Root tree contents
-    GVariant *content_csum_variant = nullptr;
-    g_variant_get_child(contents, 6, "@ay", &content_csum_variant);
-
-    gsize n_elts;
-    const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(content_csum_variant, &n_elts, 1));
-    assert(n_elts == 32);
-    AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE));
-
-    // * - ay - Root tree metadata
-    GVariant *meta_csum_variant = nullptr;
-    g_variant_get_child(contents, 7, "@ay", &meta_csum_variant);
-    csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(meta_csum_variant, &n_elts, 1));
-    assert(n_elts == 32);
-    AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META));
-
-    g_variant_unref(meta_csum_variant);
-    g_variant_unref(content_csum_variant);
-  } else {
-    GVariant *files_variant = nullptr;
-    GVariant *dirs_variant = nullptr;
-
-    files_variant = g_variant_get_child_value(contents, 0);
-    dirs_variant = g_variant_get_child_value(contents, 1);
-
-    gsize nfiles = g_variant_n_children(files_variant);
-    gsize ndirs = g_variant_n_children(dirs_variant);
-
-    // * - a(say) - array of (filename, checksum) for files
-    for (gsize i = 0; i < nfiles; i++) {
-      GVariant *csum_variant = nullptr;
-      const char *fname = nullptr;
-
-      g_variant_get_child(files_variant, i, "(&s@ay)", &fname, &csum_variant);
-      gsize n_elts;
-      const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(csum_variant, &n_elts, 1));
-      assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_FILE));
-
-      g_variant_unref(csum_variant);
-    }
-
-    // * - a(sayay) - array of (dirname, tree_checksum, meta_checksum) for directories
-    for (gsize i = 0; i < ndirs; i++) {
-      GVariant *content_csum_variant = nullptr;
-      GVariant *meta_csum_variant = nullptr;
-      const char *fname = nullptr;
-      g_variant_get_child(dirs_variant, i, "(&s@ay@ay)", &fname, &content_csum_variant, &meta_csum_variant);
-      gsize n_elts;
-      // First the .dirtree:
-      const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(content_csum_variant, &n_elts, 1));
-      assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE));
-
-      // Then the .dirmeta:
-      csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(meta_csum_variant, &n_elts, 1));
-      assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META));
-
-      g_variant_unref(meta_csum_variant);
-      g_variant_unref(content_csum_variant);
-    }
-
-    g_variant_unref(dirs_variant);
-    g_variant_unref(files_variant);
+  children->reserve(parsed.size() + children->size());
+  for (const auto &child : parsed) {
+    AppendChild(repo_.GetObject(child.first, child.second), children);
   }
-  g_variant_unref(contents);
+  return true;
 }
 
-void OSTreeObject::QueryChildren(RequestPool &pool) {
-  for (const OSTreeObject::ptr &child : children_) {
+void OSTreeObject::QueryChildren(RequestPool &pool, const std::vector<OSTreeObject::ptr> &children) {
+  for (const OSTreeObject::ptr &child : children) {
     if (child->is_on_server() == PresenceOnServer::kObjectStateUnknown) {
       pool.AddQuery(child);
     }
@@ -201,6 +214,10 @@ boost::filesystem::path OSTreeObject::PathOnDisk() const {
   return path;
 }
 
+void OSTreeObject::FetchContents() const { repo_.FetchContents(hash_, type_); }
+
+void OSTreeObject::PrefetchContents() const { repo_.PrefetchContents(hash_, type_); }
+
 uintmax_t OSTreeObject::GetSize() const { return boost::filesystem::file_size(PathOnDisk()); }
 
 void OSTreeObject::MakeTestRequest(const TreehubServer &push_target, CURLM *curl_multi_handle) {
@@ -219,7 +236,7 @@ void OSTreeObject::MakeTestRequest(const TreehubServer &push_target, CURLM *curl
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEFUNCTION, &OSTreeObject::curl_handle_write);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEDATA, this);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_PRIVATE, this);  // Used by ostree_object_from_curl
-  http_response_.str("");                                      // Empty the response buffer
+  http_response_.clear();                                      // Empty the response buffer
 
   const CURLMcode err = curl_multi_add_handle(curl_multi_handle, curl_handle_);
   if (err != 0) {
@@ -229,7 +246,8 @@ void OSTreeObject::MakeTestRequest(const TreehubServer &push_target, CURLM *curl
   request_start_time_ = std::chrono::steady_clock::now();
 }
 
-void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle, const RunMode mode) {
+void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle, const RunMode mode,
+                          const bool verify) {
   if (mode == RunMode::kDefault || mode == RunMode::kPushTree) {
     LOG_INFO << "Uploading " << *this;
   } else {
@@ -250,20 +268,30 @@ void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle,
   curlEasySetoptWrapper(curl_handle_, CURLOPT_USERAGENT, Utils::getUserAgent());
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEFUNCTION, &OSTreeObject::curl_handle_write);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEDATA, this);
-  http_response_.str("");  // Empty the response buffer
+  http_response_.clear();  // Empty the response buffer
 
   struct stat file_info {};
   auto file_path = PathOnDisk();
-  fd_ = fopen(file_path.c_str(), "rb");
-  if (fd_ == nullptr) {
+  upload_ = std_::make_unique<UploadState>();
+  upload_->fd = fopen(file_path.c_str(), "rb");
+  if (upload_->fd == nullptr) {
     throw std::runtime_error("could not open file to be uploaded");
   } else {
     if (stat(file_path.c_str(), &file_info) < 0) {
       throw std::runtime_error("Could not get file information");
     }
   }
-  curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, fd_);
-  curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDSIZE, file_info.st_size);
+  if (verify) {
+    // Check the object on the same pass as the upload
+    upload_->verifier = std_::make_unique<ObjectVerifier>(hash_, type_);
+    upload_->size = static_cast<uintmax_t>(file_info.st_size);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READFUNCTION, &OSTreeObject::curl_handle_read);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, this);
+  } else {
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, upload_->fd);
+  }
+  corrupt_ = false;
+  curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(file_info.st_size));
   curlEasySetoptWrapper(curl_handle_, CURLOPT_POST, 1);
 
   curlEasySetoptWrapper(curl_handle_, CURLOPT_PRIVATE, this);  // Used by ostree_object_from_curl
@@ -278,14 +306,18 @@ void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle,
 
 void OSTreeObject::CheckChildren(RequestPool &pool, const long rescode) {  // NOLINT(google-runtime-int)
   try {
-    PopulateChildren();
-    LOG_DEBUG << "Children of " << *this << ": " << children_.size();
+    std::vector<OSTreeObject::ptr> children;
+    if (!PopulateChildren(pool, &children)) {
+      pool.WaitForChildren(this, rescode);
+      return;
+    }
+    LOG_DEBUG << "Children of " << *this << ": " << pending_children_;
     if (children_ready()) {
       if (rescode != 200) {
         pool.AddUpload(this);
       }
     } else {
-      QueryChildren(pool);
+      QueryChildren(pool, children);
     }
   } catch (const OSTreeObjectMissing &error) {
     LOG_ERROR << "Source OSTree repo does not contain object " << error.missing_object();
@@ -297,7 +329,7 @@ void OSTreeObject::PresenceError(RequestPool &pool, const int64_t rescode) {
   is_on_server_ = PresenceOnServer::kObjectStateUnknown;
   LOG_WARNING << "OSTree query reported an error code: " << rescode << " retrying...";
   LOG_DEBUG << "Http response code:" << rescode;
-  LOG_DEBUG << http_response_.str();
+  LOG_DEBUG << http_response_;
   last_operation_result_ = ServerResponse::kTemporaryFailure;
   pool.AddQuery(this);
 }
@@ -305,7 +337,7 @@ void OSTreeObject::PresenceError(RequestPool &pool, const int64_t rescode) {
 void OSTreeObject::UploadError(RequestPool &pool, const int64_t rescode) {
   LOG_WARNING << "OSTree upload reported an error code:" << rescode << " retrying...";
   LOG_DEBUG << "Http response code:" << rescode;
-  LOG_DEBUG << http_response_.str();
+  LOG_DEBUG << http_response_;
   is_on_server_ = PresenceOnServer::kObjectMissing;
   last_operation_result_ = ServerResponse::kTemporaryFailure;
   pool.AddUpload(this);
@@ -319,6 +351,10 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
   curl_easy_getinfo(curl_handle_, CURLINFO_EFFECTIVE_URL, &url);
   long rescode = 0;  // NOLINT(google-runtime-int)
   curl_easy_getinfo(curl_handle_, CURLINFO_RESPONSE_CODE, &rescode);
+  // retried like any other error, with a new token
+  if (rescode == 401) {
+    pool.TokenRejected();
+  }
   if (current_operation_ == CurrentOp::kOstreeObjectPresenceCheck) {
     // Sanity-check the handle's URL to make sure it contains the expected
     // object hash.
@@ -326,19 +362,9 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
     if (url == nullptr || strstr(url, OSTreeRepo::GetPathForHash(hash_, type_).c_str()) == nullptr) {
       PresenceError(pool, rescode);
     } else if (rescode == 200) {
-      LOG_INFO << "Already present: " << *this;
-      is_on_server_ = PresenceOnServer::kObjectPresent;
-      last_operation_result_ = ServerResponse::kOk;
-      if (pool.run_mode() == RunMode::kWalkTree || pool.run_mode() == RunMode::kPushTree) {
-        CheckChildren(pool, rescode);
-      } else {
-        NotifyParents(pool);
-      }
+      PresenceChecked(pool, true);
     } else if (rescode == 404) {
-      LOG_DEBUG << "Not present: " << *this;
-      is_on_server_ = PresenceOnServer::kObjectMissing;
-      last_operation_result_ = ServerResponse::kOk;
-      CheckChildren(pool, rescode);
+      PresenceChecked(pool, false);
     } else {
       PresenceError(pool, rescode);
     }
@@ -347,22 +373,21 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
     // Sanity-check the handle's URL to make sure it contains the expected
     // object hash.
     // NOLINTNEXTLINE(bugprone-branch-clone)
-    if (url == nullptr || strstr(url, Url().c_str()) == nullptr) {
+    if (corrupt_) {
+      LOG_ERROR << "Local object " << *this << " is corrupt. Aborting upload.";
+      pool.Abort();
+    } else if (url == nullptr || strstr(url, Url().c_str()) == nullptr) {
       UploadError(pool, rescode);
     } else if (rescode == 204) {
       LOG_TRACE << "OSTree upload successful";
-      is_on_server_ = PresenceOnServer::kObjectPresent;
-      last_operation_result_ = ServerResponse::kOk;
-      NotifyParents(pool);
+      Uploaded(pool);
     } else if (rescode == 409) {
       LOG_DEBUG << "OSTree upload reported a 409 Conflict, possibly due to concurrent uploads";
-      is_on_server_ = PresenceOnServer::kObjectPresent;
-      last_operation_result_ = ServerResponse::kOk;
-      NotifyParents(pool);
+      Uploaded(pool);
     } else {
       UploadError(pool, rescode);
     }
-    fclose(fd_);
+    upload_.reset();
   } else {
     LOG_ERROR << "Unknown operation: " << static_cast<int>(current_operation_);
     assert(0);
@@ -370,14 +395,69 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
   curl_multi_remove_handle(curl_multi_handle, curl_handle_);
   curl_easy_cleanup(curl_handle_);
   curl_handle_ = nullptr;
+  // Don't keep the buffer of each object that ever made a request
+  std::string().swap(http_response_);
+}
+
+void OSTreeObject::PresenceChecked(RequestPool &pool, const bool present) {
+  last_operation_result_ = ServerResponse::kOk;
+  if (present) {
+    LOG_INFO << "Already present: " << *this;
+    is_on_server_ = PresenceOnServer::kObjectPresent;
+    pool.ConfirmPresent(*this);
+    if (pool.run_mode() == RunMode::kWalkTree || pool.run_mode() == RunMode::kPushTree) {
+      CheckChildren(pool, 200);
+    } else {
+      NotifyParents(pool);
+    }
+  } else {
+    LOG_DEBUG << "Not present: " << *this;
+    is_on_server_ = PresenceOnServer::kObjectMissing;
+    CheckChildren(pool, 404);
+  }
+}
+
+void OSTreeObject::PresenceKnown(RequestPool &pool) {
+  LOG_DEBUG << "Known to be present: " << *this;
+  is_on_server_ = PresenceOnServer::kObjectPresent;
+  last_operation_result_ = ServerResponse::kOk;
+  NotifyParents(pool);
+}
+
+void OSTreeObject::Uploaded(RequestPool &pool) {
+  is_on_server_ = PresenceOnServer::kObjectPresent;
+  last_operation_result_ = ServerResponse::kOk;
+  pool.ConfirmPresent(*this);
+  NotifyParents(pool);
 }
 
 size_t OSTreeObject::curl_handle_write(void *buffer, size_t size, size_t nmemb, void *userp) {
   auto *that = static_cast<OSTreeObject *>(userp);
-  that->http_response_.write(static_cast<const char *>(buffer), static_cast<std::streamsize>(size * nmemb));
+  that->http_response_.append(static_cast<const char *>(buffer), size * nmemb);
   return size * nmemb;
 }
 
+size_t OSTreeObject::curl_handle_read(char *buffer, size_t size, size_t nitems, void *userp) {
+  auto *that = static_cast<OSTreeObject *>(userp);
+  UploadState &upload = *that->upload_;
+  const size_t n = fread(buffer, 1, size * nitems, upload.fd);
+  if (n == 0 && ferror(upload.fd) != 0) {
+    return CURL_READFUNC_ABORT;
+  }
+  upload.read += n;
+  bool ok = upload.verifier->Update(reinterpret_cast<const uint8_t *>(buffer), n);
+  // Check the end before handing it over, so that a corrupt object never
+  // reaches the server in full
+  if (ok && (n == 0 || upload.read >= upload.size)) {
+    ok = upload.read == upload.size && upload.verifier->Verify();
+  }
+  if (!ok) {
+    that->corrupt_ = true;
+    return CURL_READFUNC_ABORT;
+  }
+  return n;
+}
+
 OSTreeObject::ptr ostree_object_from_curl(CURL *curlhandle) {
   void *p;
   curl_easy_getinfo(curlhandle, CURLINFO_PRIVATE, &p);
@@ -2,8 +2,11 @@
 #define SOTA_CLIENT_TOOLS_OSTREE_OBJECT_H_
 
 #include <chrono>
+#include <cstdint>
 #include <iostream>
-#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <curl/curl.h>
 #include <boost/filesystem/path.hpp>
@@ -35,6 +38,13 @@ enum class ServerResponse {
   kTemporaryFailure,
 };
 
+/**
+ * An object of the tree being pushed, and its state. A commit can have
+ * hundreds of thousands of them, which live as long as their repository, so
+ * they are kept small: anything only needed while a request is running is
+ * allocated when it is launched, and the objects themselves come from a pool
+ * rather than one allocation each.
+ */
 class OSTreeObject {
  public:
   using ptr = boost::intrusive_ptr<OSTreeObject>;
@@ -46,6 +56,9 @@ class OSTreeObject {
 
   ~OSTreeObject();
 
+  static void* operator new(size_t size);
+  static void operator delete(void* object);
+
   /* This object has been uploaded, notify parents. If parent object has no more
    * children pending upload, add the parent to the upload queue. */
   void NotifyParents(RequestPool& pool);
@@ -54,49 +67,77 @@ class OSTreeObject {
    * present there. */
   void MakeTestRequest(const TreehubServer& push_target, CURLM* curl_multi_handle);
 
-  /* Upload this object to the destination server. */
-  void Upload(TreehubServer& push_target, CURLM* curl_multi_handle, RunMode mode);
+  /* Upload this object to the destination server. With verify, the object
+   * is checked against its hash as it is read for the upload, and the upload
+   * is aborted before its end if it is corrupt, see Corrupt(). */
+  void Upload(TreehubServer& push_target, CURLM* curl_multi_handle, RunMode mode, bool verify = false);
 
   /* Process a completed curl transaction (presence check or upload). */
   void CurlDone(CURLM* curl_multi_handle, RequestPool& pool);
 
+  /* Process the answer to a presence check, made by this object or in a batch
+   * with others. */
+  void PresenceChecked(RequestPool& pool, bool present);
+
+  /* Check for children. If they are all present and this object isn't present,
+   * upload it. If any children are missing, query them. If they are still
+   * being fetched from the source repository, the pool calls this again
+   * later. */
+  void CheckChildren(RequestPool& pool, long rescode);  // NOLINT(google-runtime-int)
+
+  /* The presence index knows this object, and thereby its whole subtree, to
+   * be on the server. Its children are not checked, even when walking the
+   * tree. */
+  void PresenceKnown(RequestPool& pool);
+
+  /* This object has been uploaded, on its own or in a bundle with others. */
+  void Uploaded(RequestPool& pool);
+
+  /* Path of this object on the server, relative to its root URL. */
+  std::string Url() const;
+
   uintmax_t GetSize() const;
+  const OSTreeHash& hash() const { return hash_; }
+  OstreeObjectType type() const { return type_; }
 
   PresenceOnServer is_on_server() const { return is_on_server_; }
   CurrentOp operation() const { return current_operation_; }
-  bool children_ready() const { return children_.empty(); }
+  bool children_ready() const { return pending_children_ == 0; }
   void LaunchNotify() { is_on_server_ = PresenceOnServer::kObjectInProgress; }
   std::chrono::steady_clock::time_point RequestStartTime() const { return request_start_time_; }
   ServerResponse LastOperationResult() const { return last_operation_result_; }
 
   bool Fsck() const;
+  /* The last upload found the local object to be corrupt. */
+  bool Corrupt() const { return corrupt_; }
 
- private:
-  using childiter = std::list<OSTreeObject::ptr>::iterator;
-  using parentref = std::pair<OSTreeObject*, childiter>;
+  /** Full path on disk to this object */
+  boost::filesystem::path PathOnDisk() const;
+
+  /* Make sure this object is at PathOnDisk(), or start fetching it there, see
+   * OSTreeRepo::FetchContents(). */
+  void FetchContents() const;
+  void PrefetchContents() const;
 
-  /* Add parent to this object. */
-  void AddParent(OSTreeObject* parent, std::list<OSTreeObject::ptr>::iterator parent_it);
+ private:
+  // Only allocated while an upload is running
+  struct UploadState;
 
-  /* Child object of this object has been uploaded, remove it from the list. */
-  void ChildNotify(std::list<OSTreeObject::ptr>::iterator child_it);
+  /* Child object of this object has been uploaded, count it off. */
+  void ChildNotify();
 
-  /* If the child has is not already on the server, add it to this object's list
-   * of children and add this object as the parent of the new child. */
-  void AppendChild(const OSTreeObject::ptr& child);
+  /* If the child has is not already on the server, count it as pending and
+   * add this object as the parent of the new child. */
+  void AppendChild(const OSTreeObject::ptr& child, std::vector<OSTreeObject::ptr>* children);
 
-  /* Parse this object for children. */
-  void PopulateChildren();
+  /* Parse this object for children, using the pool's tree walker if any, and
+   * add those that are pending to children. Returns false, without adding
+   * any, if they are still being fetched. */
+  bool PopulateChildren(RequestPool& pool, std::vector<OSTreeObject::ptr>* children);
 
   /* Add queries to the queue for any children whose presence on the server is
    * unknown. */
-  void QueryChildren(RequestPool& pool);
-
-  std::string Url() const;
-
-  /* Check for children. If they are all present and this object isn't present,
-   * upload it. If any children are missing, query them. */
-  void CheckChildren(RequestPool& pool, long rescode);  // NOLINT(google-runtime-int)
+  static void QueryChildren(RequestPool& pool, const std::vector<OSTreeObject::ptr>& children);
 
   /* Handle an error from a presence check. */
   void PresenceError(RequestPool& pool, int64_t rescode);
@@ -105,9 +146,7 @@ class OSTreeObject {
   void UploadError(RequestPool& pool, int64_t rescode);
 
   static size_t curl_handle_write(void* buffer, size_t size, size_t nmemb, void* userp);
-
-  /** Full path on disk to this object */
-  boost::filesystem::path PathOnDisk() const;
+  static size_t curl_handle_read(char* buffer, size_t size, size_t nitems, void* userp);
 
   FRIEND_TEST(OstreeObject, Request);
   FRIEND_TEST(OstreeObject, UploadDryRun);
@@ -127,11 +166,15 @@ class OSTreeObject {
   PresenceOnServer is_on_server_;
   CurrentOp current_operation_{};
 
-  std::stringstream http_response_;
+  std::string http_response_;
   CURL* curl_handle_;
-  FILE* fd_;
-  std::list<parentref> parents_;
-  std::list<OSTreeObject::ptr> children_;
+  std::unique_ptr<UploadState> upload_;
+  bool corrupt_{false};
+  // Parents waiting for this object to be uploaded, and the number of
+  // children this object is waiting for. The parents keep their children
+  // alive as long as they are part of a repository.
+  std::vector<OSTreeObject*> parents_;
+  uint32_t pending_children_{0};
 
   std::chrono::steady_clock::time_point request_start_time_;
   ServerResponse last_operation_result_{ServerResponse::kNoResponse};
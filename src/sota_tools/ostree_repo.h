@@ -1,14 +1,16 @@
 #ifndef SOTA_CLIENT_TOOLS_OSTREE_REPO_H_
 #define SOTA_CLIENT_TOOLS_OSTREE_REPO_H_
 
-#include <map>
+#include <cstring>
 #include <string>
+#include <unordered_map>
 
 #include <boost/filesystem/path.hpp>
 
 #include "garage_common.h"
 #include "ostree_hash.h"
 #include "ostree_object.h"
+#include "tree_walker.h"
 
 class OSTreeRef;
 
@@ -30,6 +32,34 @@ class OSTreeRepo {
   virtual bool LooksValid() const = 0;
   virtual boost::filesystem::path root() const = 0;
   virtual OSTreeRef GetRef(const std::string& refname) const = 0;
+  /* All objects are on the local file system already, so they can be read
+   * from other threads without being fetched first. */
+  virtual bool IsLocal() const { return false; }
+  /* Start fetching objects that are about to be asked for, if they have to
+   * be fetched. Returns whether GetObject() can return all of them without
+   * waiting for a fetch. */
+  virtual bool Prefetch(const TreeWalker::ChildList& objects) const {
+    (void)objects;
+    return true;
+  }
+  /* Make sure the contents of an object returned by GetObject() are on the
+   * local file system. Repositories that only fetch them once they are
+   * needed do it here, and can throw OSTreeObjectMissing. */
+  virtual void FetchContents(const OSTreeHash& hash, OstreeObjectType type) const {
+    (void)hash;
+    (void)type;
+  }
+  /* Whether objects of this type are only on the local file system once
+   * FetchContents() has been called. */
+  virtual bool FetchesOnDemand(OstreeObjectType type) const {
+    (void)type;
+    return false;
+  }
+  /* Start fetching the contents of an object, ahead of FetchContents(). */
+  virtual void PrefetchContents(const OSTreeHash& hash, OstreeObjectType type) const {
+    (void)hash;
+    (void)type;
+  }
 
   OSTreeObject::ptr GetObject(OSTreeHash hash, OstreeObjectType type) const;
   // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
@@ -46,13 +76,23 @@ class OSTreeRepo {
    * server to a temporary directory (if it hasn't already been fetched).
    * In either case, the following post-conditions hold
    * FetchObject() returns false => The object is not available at all
-   * FetchObject() returns true => The object is on the local file system.
+   * FetchObject() returns true => The object is on the local file system,
+   * or will be after FetchContents() if FetchesOnDemand() its type.
    * */
   virtual bool FetchObject(const boost::filesystem::path& path) const = 0;
 
   bool CheckForObject(const OSTreeHash& hash, OstreeObjectType type, OSTreeObject::ptr* object) const;
 
-  using otable = std::map<std::pair<OSTreeHash, OstreeObjectType>, OSTreeObject::ptr>;
+  using okey = std::pair<OSTreeHash, OstreeObjectType>;
+  struct okey_hash {
+    size_t operator()(const okey& key) const {
+      // object hashes are SHA256 sums already, any part of them will do
+      size_t h;
+      memcpy(&h, key.first.bytes().data(), sizeof(h));
+      return h ^ static_cast<size_t>(key.second);
+    }
+  };
+  using otable = std::unordered_map<okey, OSTreeObject::ptr, okey_hash>;
   mutable otable ObjectTable;  // Makes sure that the same commit object is not added twice
 };
 
@@ -0,0 +1,126 @@
+#include "presence_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+
+static constexpr const char* kIndexHeader = "garage-push presence index 1";
+
+PresenceIndex::PresenceIndex(const boost::filesystem::path& dir, std::string server_url,
+                             const std::chrono::seconds max_age)
+    : path_(dir / (Crypto::sha256digestHex(server_url).substr(0, 32) + ".index")),
+      server_url_(std::move(server_url)),
+      created_(std::time(nullptr)) {
+  Load(max_age);
+}
+
+PresenceIndex::Key PresenceIndex::MakeKey(const OSTreeHash& hash, const OstreeObjectType type) {
+  // A commit and its detached metadata have the same hash
+  Key key{};
+  std::memcpy(key.data(), hash.bytes().data(), hash.bytes().size());
+  key.back() = static_cast<uint8_t>(type);
+  return key;
+}
+
+void PresenceIndex::Load(const std::chrono::seconds max_age) {
+  std::ifstream file(path_.string(), std::ios::binary);
+  if (!file) {
+    LOG_DEBUG << "No presence index at " << path_ << ", starting a new one";
+    return;
+  }
+
+  std::string header;
+  std::string url;
+  std::string created;
+  if (!std::getline(file, header) || header != kIndexHeader || !std::getline(file, url) ||
+      !std::getline(file, created)) {
+    LOG_WARNING << "Discarding unreadable presence index " << path_;
+    return;
+  }
+  if (url != server_url_) {
+    LOG_WARNING << "Discarding presence index " << path_ << " written for " << url;
+    return;
+  }
+  std::time_t created_time;
+  try {
+    created_time = static_cast<std::time_t>(std::stoll(created));
+  } catch (const std::exception&) {
+    LOG_WARNING << "Discarding unreadable presence index " << path_;
+    return;
+  }
+  const std::time_t now = std::time(nullptr);
+  if (created_time > now || now - created_time > max_age.count()) {
+    LOG_INFO << "Presence index " << path_ << " has expired, rebuilding it";
+    return;
+  }
+
+  Key key{};
+  while (file.read(reinterpret_cast<char*>(key.data()), static_cast<std::streamsize>(key.size()))) {
+    known_.push_back(key);
+  }
+  if (file.gcount() != 0) {
+    LOG_WARNING << "Discarding truncated presence index " << path_;
+    known_.clear();
+    return;
+  }
+  if (!std::is_sorted(known_.begin(), known_.end())) {
+    std::sort(known_.begin(), known_.end());
+  }
+  created_ = created_time;
+  LOG_INFO << "Using presence index " << path_ << " with " << known_.size() << " objects";
+}
+
+bool PresenceIndex::Contains(const OSTreeHash& hash, const OstreeObjectType type) const {
+  const Key key = MakeKey(hash, type);
+  return std::binary_search(known_.begin(), known_.end(), key) || added_.count(key) != 0;
+}
+
+void PresenceIndex::Add(const OSTreeHash& hash, const OstreeObjectType type) {
+  const Key key = MakeKey(hash, type);
+  if (!std::binary_search(known_.begin(), known_.end(), key)) {
+    added_.insert(key);
+  }
+}
+
+void PresenceIndex::Clear() {
+  known_.clear();
+  added_.clear();
+  created_ = std::time(nullptr);
+}
+
+void PresenceIndex::Save() const {
+  std::vector<Key> all;
+  all.reserve(size());
+  std::merge(known_.begin(), known_.end(), added_.begin(), added_.end(), std::back_inserter(all));
+
+  try {
+    boost::filesystem::create_directories(path_.parent_path());
+    // several pushes may share the directory, the last one to finish wins
+    const boost::filesystem::path tmp_path =
+        path_.parent_path() / boost::filesystem::unique_path(path_.filename().string() + ".%%%%-%%%%");
+    {
+      std::ofstream file(tmp_path.string(), std::ios::binary | std::ios::trunc);
+      file << kIndexHeader << '\n' << server_url_ << '\n' << static_cast<int64_t>(created_) << '\n';
+      for (const Key& key : all) {
+        file.write(reinterpret_cast<const char*>(key.data()), static_cast<std::streamsize>(key.size()));
+      }
+      if (!file.flush()) {
+        boost::filesystem::remove(tmp_path);
+        LOG_WARNING << "Could not write presence index " << path_;
+        return;
+      }
+    }
+    boost::filesystem::rename(tmp_path, path_);
+  } catch (const boost::filesystem::filesystem_error& e) {
+    LOG_WARNING << "Could not write presence index " << path_ << ": " << e.what();
+    return;
+  }
+  LOG_DEBUG << "Saved " << all.size() << " objects to presence index " << path_;
+}
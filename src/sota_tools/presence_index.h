@@ -0,0 +1,59 @@
+#ifndef SOTA_CLIENT_TOOLS_PRESENCE_INDEX_H_
+#define SOTA_CLIENT_TOOLS_PRESENCE_INDEX_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "garage_common.h"
+#include "ostree_hash.h"
+
+/**
+ * Objects that a Treehub server has confirmed to have, kept on disk between
+ * garage-push runs so that they are not queried again.
+ *
+ * There is one index file per server URL in the index directory. Objects are
+ * only added once the server has answered that it has them or has accepted
+ * their upload. As Treehub only gets an object after all of its children, a
+ * known dirtree means that its whole subtree is present as well.
+ *
+ * The index can't learn about objects removed from the server, so it is
+ * discarded and rebuilt from scratch once it is older than its maximum age.
+ * It is also discarded if the file is unreadable or was written for another
+ * server URL, and Clear() drops it when the whole tree is walked anyway.
+ */
+class PresenceIndex {
+ public:
+  PresenceIndex(const boost::filesystem::path& dir, std::string server_url, std::chrono::seconds max_age);
+
+  bool Contains(const OSTreeHash& hash, OstreeObjectType type) const;
+  void Add(const OSTreeHash& hash, OstreeObjectType type);
+  /* Forget all the objects and start a new index. */
+  void Clear();
+  /* Write the index back to disk, replacing the previous file atomically. */
+  void Save() const;
+
+  size_t size() const { return known_.size() + added_.size(); }
+  const boost::filesystem::path& path() const { return path_; }
+
+ private:
+  using Key = std::array<uint8_t, 33>;
+  static Key MakeKey(const OSTreeHash& hash, OstreeObjectType type);
+  void Load(std::chrono::seconds max_age);
+
+  boost::filesystem::path path_;
+  const std::string server_url_;
+  std::time_t created_;
+  // sorted, as read from disk
+  std::vector<Key> known_;
+  // confirmed during this run
+  std::set<Key> added_;
+};
+
+#endif  // SOTA_CLIENT_TOOLS_PRESENCE_INDEX_H_
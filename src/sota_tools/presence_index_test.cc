@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "presence_index.h"
+#include "utilities/utils.h"
+
+static const std::chrono::seconds kWeek = std::chrono::hours(168);
+static const std::string kServer = "https://treehub.example.com/api/v3/";
+
+static OSTreeHash TestHash(const char c) { return OSTreeHash::Parse(std::string(64, c)); }
+
+/* Objects that were added are found again after a reload from disk. */
+TEST(presence_index, save_and_load) {
+  TemporaryDirectory temp_dir;
+  {
+    PresenceIndex index(temp_dir.Path(), kServer, kWeek);
+    EXPECT_EQ(index.size(), 0U);
+    index.Add(TestHash('b'), OSTREE_OBJECT_TYPE_DIR_TREE);
+    index.Add(TestHash('a'), OSTREE_OBJECT_TYPE_FILE);
+    index.Add(TestHash('a'), OSTREE_OBJECT_TYPE_FILE);
+    EXPECT_EQ(index.size(), 2U);
+    index.Save();
+  }
+  PresenceIndex index(temp_dir.Path(), kServer, kWeek);
+  EXPECT_EQ(index.size(), 2U);
+  EXPECT_TRUE(index.Contains(TestHash('a'), OSTREE_OBJECT_TYPE_FILE));
+  EXPECT_TRUE(index.Contains(TestHash('b'), OSTREE_OBJECT_TYPE_DIR_TREE));
+  EXPECT_FALSE(index.Contains(TestHash('c'), OSTREE_OBJECT_TYPE_FILE));
+  // same hash, another object
+  EXPECT_FALSE(index.Contains(TestHash('b'), OSTREE_OBJECT_TYPE_DIR_META));
+
+  index.Add(TestHash('c'), OSTREE_OBJECT_TYPE_COMMIT);
+  index.Save();
+  EXPECT_EQ(PresenceIndex(temp_dir.Path(), kServer, kWeek).size(), 3U);
+}
+
+/* Every server gets its own index. */
+TEST(presence_index, per_server) {
+  TemporaryDirectory temp_dir;
+  PresenceIndex index(temp_dir.Path(), kServer, kWeek);
+  index.Add(TestHash('a'), OSTREE_OBJECT_TYPE_FILE);
+  index.Save();
+
+  PresenceIndex other(temp_dir.Path(), "https://other.example.com/", kWeek);
+  EXPECT_NE(other.path(), index.path());
+  EXPECT_FALSE(other.Contains(TestHash('a'), OSTREE_OBJECT_TYPE_FILE));
+}
+
+/* Expired, unreadable and cleared indexes are rebuilt from scratch. */
+TEST(presence_index, invalidation) {
+  TemporaryDirectory temp_dir;
+  {
+    PresenceIndex index(temp_dir.Path(), kServer, kWeek);
+    index.Add(TestHash('a'), OSTREE_OBJECT_TYPE_FILE);
+    index.Save();
+  }
+  EXPECT_EQ(PresenceIndex(temp_dir.Path(), kServer, std::chrono::seconds(-1)).size(), 0U);
+
+  PresenceIndex index(temp_dir.Path(), kServer, kWeek);
+  EXPECT_EQ(index.size(), 1U);
+  index.Clear();
+  EXPECT_FALSE(index.Contains(TestHash('a'), OSTREE_OBJECT_TYPE_FILE));
+
+  // an incomplete entry
+  Utils::writeFile(index.path(), Utils::readFile(index.path()) + "x");
+  EXPECT_EQ(PresenceIndex(temp_dir.Path(), kServer, kWeek).size(), 0U);
+
+  Utils::writeFile(index.path(), std::string("garbage"));
+  EXPECT_EQ(PresenceIndex(temp_dir.Path(), kServer, kWeek).size(), 0U);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -9,17 +9,31 @@ const RateController::clock::duration RateController::kMaxSleepTime = std::chron
 
 const RateController::clock::duration RateController::kInitialSleepTime = std::chrono::seconds(1);
 
-RateController::RateController(const int concurrency_cap) : concurrency_cap_(concurrency_cap) { CheckInvariants(); }
+constexpr double RateController::kMinQueued;
+constexpr double RateController::kMaxQueued;
+
+RateController::RateController(const int concurrency_cap, const CongestionControl algorithm)
+    : concurrency_cap_(concurrency_cap), algorithm_(algorithm) {
+  CheckInvariants();
+}
 
 void RateController::RequestCompleted(const clock::time_point start_time, const clock::time_point end_time,
                                       const bool succeeded) {
+  if (succeeded && algorithm_ == CongestionControl::kLatency) {
+    min_round_trip_ = std::min(min_round_trip_, end_time - start_time);
+  }
   if (last_concurrency_update_ < start_time) {
     const int prev_concurrency = max_concurrency_;
     last_concurrency_update_ = end_time;
     if (succeeded) {
-      max_concurrency_ = std::min(max_concurrency_ + 1, concurrency_cap_);
+      if (algorithm_ == CongestionControl::kLatency) {
+        UpdateFromLatency(end_time - start_time);
+      } else {
+        max_concurrency_ = std::min(max_concurrency_ + 1, concurrency_cap_);
+      }
       sleep_time_ = clock::duration(0);
     } else {
+      slow_start_ = false;
       if (max_concurrency_ >= 2) {
         max_concurrency_ = max_concurrency_ / 2;
       } else {
@@ -33,6 +47,25 @@ void RateController::RequestCompleted(const clock::time_point start_time, const
   CheckInvariants();
 }
 
+void RateController::UpdateFromLatency(const clock::duration round_trip) {
+  // Requests served at the speed of the shortest round-trip, the others are
+  // waiting somewhere
+  double queued = 0.0;
+  if (round_trip > min_round_trip_) {
+    queued = max_concurrency_ * (1.0 - static_cast<double>(min_round_trip_.count()) /
+                                           static_cast<double>(round_trip.count()));
+  }
+  if (queued < kMinQueued) {
+    max_concurrency_ = slow_start_ ? max_concurrency_ * 2 : max_concurrency_ + 1;
+  } else {
+    slow_start_ = false;
+    if (queued > kMaxQueued) {
+      max_concurrency_ = std::max(max_concurrency_ - 1, 1);
+    }
+  }
+  max_concurrency_ = std::min(max_concurrency_, concurrency_cap_);
+}
+
 int RateController::MaxConcurrency() const {
   CheckInvariants();
   return max_concurrency_;
@@ -10,13 +10,26 @@
  *    MaxConcurrency - The current estimate of the number of parallel requests that can be opened
  *    Sleep() - The number of seconds to sleep before sending the next request. 0.0 if MaxConcurrency is > 1
  *    Failed() - A boolean indicating that the server is broken, and to report an error up to the user.
- * The congestion control is loosely based on the original TCP AIMD scheme. Better performance might be available by
- * Stealing ideas from the later TCP conjection control algorithms
+ * The congestion control is either loosely based on the original TCP AIMD scheme, or on the round-trip times of
+ * requests like TCP Vegas, see CongestionControl.
  */
+enum class CongestionControl {
+  /** Add one request per round-trip, halve the concurrency on errors. This
+   * only backs off once the server fails, and grows slowly on links with a
+   * high bandwidth-delay product. */
+  kAimd,
+  /** Compare the round-trip time with the shortest one seen, which estimates
+   * how many requests are queued rather than being served. Double the
+   * concurrency per round-trip until requests start to queue, then add or
+   * remove one request per round-trip to keep a few of them queued. Errors
+   * halve the concurrency like kAimd. */
+  kLatency,
+};
+
 class RateController {
  public:
   using clock = std::chrono::steady_clock;
-  explicit RateController(int concurrency_cap = 30);
+  explicit RateController(int concurrency_cap = 30, CongestionControl algorithm = CongestionControl::kAimd);
   ~RateController() = default;
   RateController(const RateController&) = delete;
   RateController(RateController&&) = delete;
@@ -44,7 +57,15 @@ class RateController {
    */
   static const clock::duration kInitialSleepTime;
 
+  /**
+   * With kLatency, grow the concurrency while fewer requests than this are
+   * estimated to be queued, and shrink it while more than kMaxQueued are.
+   */
+  static constexpr double kMinQueued = 2.0;
+  static constexpr double kMaxQueued = 6.0;
+
   const int concurrency_cap_;
+  const CongestionControl algorithm_;
   /**
    * After making a change to the system, we wait a full round-trip time to
    * see any effects of the change. This is the last time that an change was
@@ -54,7 +75,11 @@ class RateController {
   clock::time_point last_concurrency_update_;
   int max_concurrency_{1};
   clock::duration sleep_time_{0};
+  // kLatency only
+  clock::duration min_round_trip_{clock::duration::max()};
+  bool slow_start_{true};
 
+  void UpdateFromLatency(clock::duration round_trip);
   void CheckInvariants() const;
 };
 
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "rate_controller.h"
+
+// Simulate pushes through RateController against model servers, and compare
+// the congestion control algorithms.
+//
+// Usage: garage-rate-controller-benchmark [number of requests]
+// The default is 20000 requests. The scenarios follow the ones in
+// rate_controller_test, plus a server with a high bandwidth-delay product.
+//
+// A model server answers in its base round-trip time as long as it has no
+// more than `capacity` requests in flight, and proportionally slower beyond
+// that, as requests get queued. It fails requests when more than `overload`
+// are in flight, and those for which `fails` is true.
+
+using clock_type = RateController::clock;
+
+struct Server {
+  std::string name;
+  clock_type::duration round_trip;
+  int capacity;
+  int overload;
+  std::function<bool(int request)> fails;
+};
+
+struct Result {
+  double seconds{0};
+  int completed{0};
+  int failed{0};
+  double mean_concurrency{0};
+  bool gave_up{false};
+};
+
+struct InFlight {
+  clock_type::time_point start;
+  clock_type::time_point end;
+  bool ok;
+  bool operator>(const InFlight &other) const { return end > other.end; }
+};
+
+static Result simulate(const Server &server, const CongestionControl algorithm, const int jobs, const int requests) {
+  RateController controller(jobs, algorithm);
+  std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>> in_flight;
+  const clock_type::time_point start = clock_type::now();
+  clock_type::time_point now = start;
+  Result result;
+  int launched = 0;
+  double concurrency_sum = 0;
+  int samples = 0;
+
+  while (result.completed < requests) {
+    while (static_cast<int>(in_flight.size()) < controller.MaxConcurrency() && launched - result.failed < requests) {
+      const int load = static_cast<int>(in_flight.size()) + 1;
+      const double slowdown = std::max(1.0, static_cast<double>(load) / server.capacity);
+      const auto latency =
+          std::chrono::duration_cast<clock_type::duration>(server.round_trip * slowdown);
+      const bool ok = load <= server.overload && !server.fails(launched);
+      in_flight.push(InFlight{now, now + latency, ok});
+      launched++;
+    }
+    if (in_flight.empty()) {
+      break;
+    }
+
+    const InFlight done = in_flight.top();
+    in_flight.pop();
+    now = done.end;
+    concurrency_sum += static_cast<double>(in_flight.size() + 1);
+    samples++;
+    controller.RequestCompleted(done.start, done.end, done.ok);
+    if (done.ok) {
+      result.completed++;
+    } else {
+      result.failed++;
+    }
+    if (controller.ServerHasFailed()) {
+      result.gave_up = true;
+      break;
+    }
+    now += controller.GetSleepTime();
+  }
+
+  result.seconds = std::chrono::duration<double>(now - start).count();
+  result.mean_concurrency = samples > 0 ? concurrency_sum / samples : 0;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  const int requests = argc > 1 ? std::atoi(argv[1]) : 20000;
+  if (requests <= 0) {
+    std::cerr << "usage: " << argv[0] << " [number of requests]\n";
+    return EXIT_FAILURE;
+  }
+
+  const std::vector<Server> servers{
+      {"good results (2 s round-trip)", std::chrono::seconds(2), 30, 90, [](int) { return false; }},
+      {"every 30th request fails", std::chrono::seconds(2), 30, 90, [](int i) { return i % 30 == 0; }},
+      {"high bandwidth-delay product (300 ms, 400 requests)", std::chrono::milliseconds(300), 400, 1200,
+       [](int) { return false; }},
+      {"small server (50 ms, 8 requests)", std::chrono::milliseconds(50), 8, 16, [](int) { return false; }},
+      {"server down", std::chrono::seconds(2), 30, 90, [](int) { return true; }},
+  };
+
+  std::cout << std::fixed << std::setprecision(1);
+  for (const Server &server : servers) {
+    std::cout << server.name << "\n";
+    for (const int jobs : {30, 1000}) {
+      for (const auto algorithm : {CongestionControl::kAimd, CongestionControl::kLatency}) {
+        const Result r = simulate(server, algorithm, jobs, requests);
+        std::cout << "  " << std::setw(7) << (algorithm == CongestionControl::kAimd ? "aimd" : "latency")
+                  << " --jobs " << std::setw(4) << jobs << ": ";
+        if (r.gave_up) {
+          std::cout << "gave up after " << r.seconds << " s and " << r.failed << " failed requests\n";
+        } else {
+          std::cout << std::setw(8) << r.seconds << " s, " << std::setw(7) << r.completed / r.seconds
+                    << " requests/s, mean concurrency " << std::setw(6) << r.mean_concurrency << ", " << r.failed
+                    << " failed requests\n";
+        }
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
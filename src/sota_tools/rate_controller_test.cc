@@ -48,6 +48,59 @@ TEST(control, good_results_improve_concurrency) {
   EXPECT_GT(dut.MaxConcurrency(), initial_concurrency);
 }
 
+/* The latency based controller aborts and continues through errors like the
+ * default one. */
+TEST(failure, latency_errors) {
+  RateController dut(30, CongestionControl::kLatency);
+  RateController::clock::time_point t = RateController::clock::now();
+  RateController::clock::duration interval = std::chrono::seconds(2);
+  for (int i = 0; i < 1000; i++) {
+    bool ok = i % 30 != 0;
+    dut.RequestCompleted(t, t + interval, ok);
+    t += interval;
+    EXPECT_FALSE(dut.ServerHasFailed());
+  }
+  for (int i = 0; i < 30; i++) {
+    dut.RequestCompleted(t, t + interval, false);
+    t += interval;
+  }
+  EXPECT_TRUE(dut.ServerHasFailed());
+}
+
+/* With a steady round-trip time the latency based controller grows faster
+ * than the default one. */
+TEST(control, latency_grows_quickly) {
+  RateController aimd(1000);
+  RateController latency(1000, CongestionControl::kLatency);
+  RateController::clock::time_point t = RateController::clock::now();
+  RateController::clock::duration interval = std::chrono::seconds(2);
+  for (int i = 0; i < 10; i++) {
+    aimd.RequestCompleted(t, t + interval, true);
+    latency.RequestCompleted(t, t + interval, true);
+    t += interval;
+  }
+  EXPECT_GT(latency.MaxConcurrency(), aimd.MaxConcurrency());
+}
+
+/* The latency based controller backs off when requests get slower, before
+ * any of them fail. */
+TEST(control, latency_backs_off) {
+  RateController dut(30, CongestionControl::kLatency);
+  RateController::clock::time_point t = RateController::clock::now();
+  RateController::clock::duration interval = std::chrono::seconds(2);
+  for (int i = 0; i < 10; i++) {
+    dut.RequestCompleted(t, t + interval, true);
+    t += interval;
+  }
+  const int concurrency = dut.MaxConcurrency();
+  for (int i = 0; i < 10; i++) {
+    dut.RequestCompleted(t, t + 2 * interval, true);
+    t += 2 * interval;
+  }
+  EXPECT_LT(dut.MaxConcurrency(), concurrency);
+  EXPECT_FALSE(dut.ServerHasFailed());
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -3,14 +3,83 @@
 #include <algorithm>  // min
 #include <chrono>
 #include <exception>
+#include <map>
+#include <set>
+#include <sstream>
 #include <thread>
+#include <vector>
 
 #include "logging/logging.h"
+#include "object_verifier.h"
+#include "ostree_repo.h"
+#include "utilities/utils.h"
 
-RequestPool::RequestPool(TreehubServer& server, const int max_curl_requests, const RunMode mode, bool fsck_on_upload)
-    : rate_controller_(max_curl_requests),
+// Treehub endpoint answering, for a JSON array of object paths as used in
+// HEAD requests, the JSON array of those that are present
+static constexpr const char* kBatchQueryPath = "objects-query";
+static constexpr size_t kMaxBatchQuerySize = 1000;
+
+// Treehub endpoint storing every object of a gzipped tarball, named by its
+// path as used in uploads. Only small objects are bundled, larger ones are
+// uploaded on their own.
+static constexpr const char* kBundleUploadPath = "objects-bundle";
+static constexpr uintmax_t kMaxBundledObjectSize = 64 * 1024;
+static constexpr uintmax_t kMaxBundleSize = 4 * 1024 * 1024;
+static constexpr size_t kMaxBundleObjects = 1000;
+
+// Treehub endpoint copying objects from another server of the same deployment,
+// given its root URL, an access token for it if any, and the paths of the
+// objects. It answers with the JSON array of the paths it has copied.
+static constexpr const char* kCopyPath = "objects-copy";
+static constexpr size_t kMaxCopyObjects = 1000;
+
+// Objects of a remote source repository are fetched once their parent is known
+// to be missing on the server. Don't query more objects while this many are
+// waiting for their children, so that fetches and uploads keep pace.
+static constexpr size_t kMaxWaitingForChildren = 64;
+// How often to check on them while nothing else happens
+static constexpr long kFetchPollMs = 10;  // NOLINT(google-runtime-int)
+
+// A request about several objects at once: a batched presence query, a
+// bundle upload or a copy from another server
+struct RequestPool::BatchRequest {
+  enum class Kind { kQuery, kBundle, kCopy };
+
+  BatchRequest() = default;
+  ~BatchRequest() {
+    curl_slist_free_all(headers);
+    if (handle != nullptr) {
+      curl_easy_cleanup(handle);
+    }
+  }
+  BatchRequest(const BatchRequest&) = delete;
+  BatchRequest(BatchRequest&&) = delete;
+  BatchRequest& operator=(const BatchRequest&) = delete;
+  BatchRequest& operator=(BatchRequest&&) = delete;
+
+  static size_t curl_handle_write(void* buffer, size_t size, size_t nmemb, void* userp) {
+    static_cast<BatchRequest*>(userp)->response.append(static_cast<const char*>(buffer), size * nmemb);
+    return size * nmemb;
+  }
+
+  Kind kind{Kind::kQuery};
+  std::vector<OSTreeObject::ptr> objects;
+  std::string body;
+  std::string response;
+  CURL* handle{nullptr};
+  struct curl_slist* headers{nullptr};
+  RateController::clock::time_point start_time;
+};
+
+RequestPool::RequestPool(TreehubServer& server, const int max_curl_requests, const RunMode mode, bool fsck_on_upload,
+                         PresenceIndex* presence_index, TreeWalker* tree_walker,
+                         const CongestionControl congestion_control, const TreehubServer* copy_source)
+    : rate_controller_(max_curl_requests, congestion_control),
       running_requests_(0),
       server_(server),
+      copy_source_(copy_source),
+      presence_index_(presence_index),
+      tree_walker_(tree_walker),
       mode_(mode),
       fsck_on_upload_(fsck_on_upload),
       stopped_(false) {
@@ -41,36 +110,113 @@ RequestPool::~RequestPool() {
 void RequestPool::AddQuery(const OSTreeObject::ptr& request) {
   request->LaunchNotify();
   if (!stopped_) {
-    query_queue_.push_back(request);
+    if (presence_index_ != nullptr && presence_index_->Contains(request->hash(), request->type())) {
+      indexed_queue_.push_back(request);
+    } else {
+      query_queue_.push_back(request);
+    }
   }
 }
 
 void RequestPool::AddUpload(const OSTreeObject::ptr& request) {
   request->LaunchNotify();
   if (!stopped_) {
+    if (!CanCopy(*request)) {
+      // it will be read from here
+      request->PrefetchContents();
+    }
     upload_queue_.push_back(request);
   }
 }
 
+void RequestPool::WaitForChildren(const OSTreeObject::ptr& object, const long rescode) {  // NOLINT(google-runtime-int)
+  if (!stopped_) {
+    fetch_queue_.emplace_back(object, rescode);
+  }
+}
+
+bool RequestPool::CanCopy(const OSTreeObject& object) const {
+  return copy_source_ != nullptr && copy_supported_ && (mode_ == RunMode::kDefault || mode_ == RunMode::kPushTree) &&
+         not_copied_.count(object.Url()) == 0;
+}
+
+bool RequestPool::FetchContents(const OSTreeObject::ptr& object) {
+  try {
+    object->FetchContents();
+    return true;
+  } catch (const OSTreeObjectMissing& error) {
+    LOG_ERROR << "Source OSTree repo does not contain object " << error.missing_object();
+    Abort();
+    return false;
+  }
+}
+
+bool RequestPool::CanQuery() const {
+  return !query_queue_.empty() && fetch_queue_.size() < kMaxWaitingForChildren;
+}
+
+void RequestPool::ConfirmPresent(const OSTreeObject& object) {
+  if (presence_index_ != nullptr) {
+    presence_index_->Add(object.hash(), object.type());
+  }
+}
+
 void RequestPool::LoopLaunch() {
-  while (running_requests_ < rate_controller_.MaxConcurrency() && (!query_queue_.empty() || !upload_queue_.empty())) {
+  // A push may outlast its OAuth2 token
+  server_.RefreshToken();
+
+  // No need to ask the server about the objects in the presence index. This
+  // doesn't take up a request slot.
+  while (!indexed_queue_.empty()) {
+    OSTreeObject::ptr cur = indexed_queue_.front();
+    indexed_queue_.pop_front();
+    cur->PresenceKnown(*this);
+    indexed_objects_++;
+  }
+
+  // Objects still waiting for their children are queued again
+  std::list<std::pair<OSTreeObject::ptr, long>> waiting;  // NOLINT(google-runtime-int)
+  waiting.swap(fetch_queue_);
+  for (const auto& w : waiting) {
+    w.first->CheckChildren(*this, w.second);
+  }
+
+  while (running_requests_ < rate_controller_.MaxConcurrency() && (CanQuery() || !upload_queue_.empty())) {
     OSTreeObject::ptr cur;
 
     // Queries first, uploads second
-    if (query_queue_.empty()) {
+    if (!CanQuery()) {
       // Uploads
+      if (LaunchCopy()) {
+        running_requests_++;
+        continue;
+      }
+      if (LaunchBundleUpload()) {
+        bundle_uploads_made_++;
+        running_requests_++;
+        continue;
+      }
+      if (upload_queue_.empty()) {
+        // aborted
+        continue;
+      }
       cur = upload_queue_.front();
       upload_queue_.pop_front();
+      if (!FetchContents(cur)) {
+        continue;
+      }
       // Check object's integrity before uploading them, but after we know they
-      // are not present on the server
-      if (fsck_on_upload_) {
+      // are not present on the server. Actual uploads check them on the way,
+      // without reading them twice.
+      const bool uploading = mode_ == RunMode::kDefault || mode_ == RunMode::kPushTree;
+      if (fsck_on_upload_ && !uploading) {
         if (!cur->Fsck()) {
           LOG_ERROR << "Local object " << cur << " is corrupt. Aborting upload.";
           Abort();
           continue;
         }
       }
-      cur->Upload(server_, multi_, mode_);
+      cur->Upload(server_, multi_, mode_, fsck_on_upload_);
       put_requests_made_++;
       total_object_size_ += cur->GetSize();
       if (mode_ == RunMode::kDryRun || mode_ == RunMode::kWalkTree) {
@@ -78,6 +224,9 @@ void RequestPool::LoopLaunch() {
         // acknowledge that the object has been uploaded.
         cur->NotifyParents(*this);
       }
+    } else if (batch_query_supported_ && query_queue_.size() > 1) {
+      LaunchBatchQuery();
+      batch_requests_made_++;
     } else {
       // Queries
       cur = query_queue_.front();
@@ -90,6 +239,253 @@ void RequestPool::LoopLaunch() {
   }
 }
 
+void RequestPool::LaunchBatchQuery() {
+  std::unique_ptr<BatchRequest> query(new BatchRequest);
+  Json::Value paths(Json::arrayValue);
+  while (!query_queue_.empty() && query->objects.size() < kMaxBatchQuerySize) {
+    paths.append(query_queue_.front()->Url());
+    query->objects.push_back(query_queue_.front());
+    query_queue_.pop_front();
+  }
+  query->body = Utils::jsonToCanonicalStr(paths);
+  LOG_DEBUG << "Querying the presence of " << query->objects.size() << " objects";
+  LaunchBatchRequest(std::move(query), kBatchQueryPath, "Content-Type: application/json");
+}
+
+bool RequestPool::LaunchBundleUpload() {
+  if (!bundle_upload_supported_ || (mode_ != RunMode::kDefault && mode_ != RunMode::kPushTree)) {
+    return false;
+  }
+
+  std::vector<std::list<OSTreeObject::ptr>::iterator> small_objects;
+  uintmax_t bundle_size = 0;
+  for (auto it = upload_queue_.begin(); it != upload_queue_.end() && small_objects.size() < kMaxBundleObjects; ++it) {
+    if (!FetchContents(*it)) {
+      return false;
+    }
+    const uintmax_t size = (*it)->GetSize();
+    if (size <= kMaxBundledObjectSize && bundle_size + size <= kMaxBundleSize) {
+      small_objects.push_back(it);
+      bundle_size += size;
+    }
+  }
+  if (small_objects.size() < 2) {
+    return false;
+  }
+
+  std::unique_ptr<BatchRequest> bundle(new BatchRequest);
+  bundle->kind = BatchRequest::Kind::kBundle;
+  std::map<std::string, std::string> entries;
+  for (const auto& it : small_objects) {
+    const OSTreeObject::ptr object = *it;
+    upload_queue_.erase(it);
+    std::string contents = Utils::readFile(object->PathOnDisk());
+    // Check object's integrity before uploading them, but after we know they
+    // are not present on the server
+    if (fsck_on_upload_) {
+      ObjectVerifier verifier(object->hash(), object->type());
+      if (!verifier.Update(contents) || !verifier.Verify()) {
+        LOG_ERROR << "Local object " << object << " is corrupt. Aborting upload.";
+        Abort();
+        return false;
+      }
+    }
+    entries.emplace(object->Url(), std::move(contents));
+    bundle->objects.push_back(object);
+  }
+  std::ostringstream archive;
+  Utils::writeArchive(entries, archive);
+  bundle->body = archive.str();
+  total_object_size_ += bundle_size;
+
+  LOG_INFO << "Uploading a bundle of " << bundle->objects.size() << " objects";
+  LaunchBatchRequest(std::move(bundle), kBundleUploadPath, "Content-Type: application/gzip");
+  return true;
+}
+
+bool RequestPool::LaunchCopy() {
+  std::unique_ptr<BatchRequest> copy(new BatchRequest);
+  copy->kind = BatchRequest::Kind::kCopy;
+  Json::Value paths(Json::arrayValue);
+  for (auto it = upload_queue_.begin(); it != upload_queue_.end() && copy->objects.size() < kMaxCopyObjects;) {
+    if (CanCopy(**it)) {
+      paths.append((*it)->Url());
+      copy->objects.push_back(*it);
+      it = upload_queue_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (copy->objects.empty()) {
+    return false;
+  }
+
+  Json::Value body;
+  body["source"] = copy_source_->root_url();
+  if (!copy_source_->token().empty()) {
+    body["token"] = copy_source_->token();
+  }
+  body["objects"] = paths;
+  copy->body = Utils::jsonToCanonicalStr(body);
+  LOG_INFO << "Asking the server to copy " << copy->objects.size() << " objects";
+  LaunchBatchRequest(std::move(copy), kCopyPath, "Content-Type: application/json");
+  return true;
+}
+
+void RequestPool::LaunchBatchRequest(std::unique_ptr<BatchRequest> request, const char* path,
+                                     const std::string& content_type) {
+  request->handle = curl_easy_init();
+  if (request->handle == nullptr) {
+    throw std::runtime_error("Could not initialize curl handle");
+  }
+  curlEasySetoptWrapper(request->handle, CURLOPT_VERBOSE, get_curlopt_verbose());
+  server_.InjectIntoCurl(path, request->handle);
+  // uploads change the content type of the headers set by the server
+  request->headers = server_.CopyHeaders(content_type);
+  curlEasySetoptWrapper(request->handle, CURLOPT_HTTPHEADER, request->headers);
+  curlEasySetoptWrapper(request->handle, CURLOPT_USERAGENT, Utils::getUserAgent());
+  curlEasySetoptWrapper(request->handle, CURLOPT_POSTFIELDS, request->body.data());
+  curlEasySetoptWrapper(request->handle, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(request->body.size()));
+  curlEasySetoptWrapper(request->handle, CURLOPT_WRITEFUNCTION, &BatchRequest::curl_handle_write);
+  curlEasySetoptWrapper(request->handle, CURLOPT_WRITEDATA, request.get());
+
+  const CURLMcode err = curl_multi_add_handle(multi_, request->handle);
+  if (err != 0) {
+    LOG_ERROR << "curl_multi_add_handle error:" << curl_multi_strerror(err);
+  }
+  request->start_time = RateController::clock::now();
+  batch_requests_.emplace(request->handle, std::move(request));
+}
+
+bool RequestPool::BatchQueryDone(BatchRequest& query, const CURLcode result) {
+  long rescode = 0;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(query.handle, CURLINFO_RESPONSE_CODE, &rescode);
+  curl_multi_remove_handle(multi_, query.handle);
+
+  Json::Value present_paths;
+  if (result == CURLE_OK && rescode == 200) {
+    present_paths = Utils::parseJSON(query.response);
+  }
+  if (present_paths.isArray()) {
+    std::set<std::string> present;
+    for (const auto& path : present_paths) {
+      if (path.isString()) {
+        present.insert(path.asString());
+      }
+    }
+    for (const auto& object : query.objects) {
+      object->PresenceChecked(*this, present.count(object->Url()) != 0);
+    }
+    return true;
+  }
+
+  // anything but a server or a connection failure, or an expired token, means
+  // that the server doesn't know about batched queries
+  if (rescode == 401) {
+    TokenRejected();
+  }
+  const bool temporary_failure =
+      result != CURLE_OK || rescode >= 500 || rescode == 401 || rescode == 408 || rescode == 429;
+  if (temporary_failure) {
+    LOG_WARNING << "OSTree batched query reported an error code: " << rescode << " retrying...";
+    LOG_DEBUG << query.response;
+  } else {
+    LOG_INFO << "Server does not support batched object queries (" << rescode << "), using HEAD requests";
+    batch_query_supported_ = false;
+  }
+  for (const auto& object : query.objects) {
+    AddQuery(object);
+  }
+  return !temporary_failure;
+}
+
+bool RequestPool::BundleUploadDone(BatchRequest& bundle, const CURLcode result) {
+  long rescode = 0;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(bundle.handle, CURLINFO_RESPONSE_CODE, &rescode);
+  curl_multi_remove_handle(multi_, bundle.handle);
+
+  if (result == CURLE_OK && (rescode == 200 || rescode == 204)) {
+    LOG_TRACE << "OSTree bundle upload successful";
+    for (const auto& object : bundle.objects) {
+      object->Uploaded(*this);
+    }
+    return true;
+  }
+
+  // Not Implemented is also how a server can tell that it doesn't know about
+  // bundles
+  if (rescode == 401) {
+    TokenRejected();
+  }
+  const bool temporary_failure = result != CURLE_OK || (rescode >= 500 && rescode != 501) || rescode == 401 ||
+                                 rescode == 408 || rescode == 429;
+  if (temporary_failure) {
+    LOG_WARNING << "OSTree bundle upload reported an error code: " << rescode << " retrying...";
+    LOG_DEBUG << bundle.response;
+  } else {
+    LOG_INFO << "Server does not support bundle uploads (" << rescode << "), uploading objects one by one";
+    bundle_upload_supported_ = false;
+  }
+  for (const auto& object : bundle.objects) {
+    total_object_size_ -= object->GetSize();
+    AddUpload(object);
+  }
+  return !temporary_failure;
+}
+
+bool RequestPool::CopyDone(BatchRequest& copy, const CURLcode result) {
+  long rescode = 0;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(copy.handle, CURLINFO_RESPONSE_CODE, &rescode);
+  curl_multi_remove_handle(multi_, copy.handle);
+
+  Json::Value copied_paths;
+  if (result == CURLE_OK && rescode == 200) {
+    copied_paths = Utils::parseJSON(copy.response);
+  }
+  if (copied_paths.isArray()) {
+    std::set<std::string> copied;
+    for (const auto& path : copied_paths) {
+      if (path.isString()) {
+        copied.insert(path.asString());
+      }
+    }
+    for (const auto& object : copy.objects) {
+      if (copied.count(object->Url()) != 0) {
+        copied_objects_++;
+        object->Uploaded(*this);
+      } else {
+        not_copied_.insert(object->Url());
+        AddUpload(object);
+      }
+    }
+    LOG_DEBUG << "The server copied " << copied.size() << " of " << copy.objects.size() << " objects";
+    return true;
+  }
+
+  // Not Implemented is also how a server can tell that it can't copy objects,
+  // e.g. from another deployment
+  if (rescode == 401) {
+    TokenRejected();
+  }
+  const bool temporary_failure = result != CURLE_OK || (rescode >= 500 && rescode != 501) || rescode == 401 ||
+                                 rescode == 408 || rescode == 429;
+  if (temporary_failure) {
+    LOG_WARNING << "OSTree object copy reported an error code: " << rescode << " retrying...";
+    LOG_DEBUG << copy.response;
+  } else {
+    LOG_INFO << "Server can't copy objects from " << copy_source_->root_url() << " (" << rescode
+             << "), uploading them instead";
+    copy_supported_ = false;
+    for (const auto& object : upload_queue_) {
+      object->PrefetchContents();
+    }
+  }
+  for (const auto& object : copy.objects) {
+    AddUpload(object);
+  }
+  return !temporary_failure;
+}
+
 void RequestPool::LoopListen() {
   // For more information about the timeout logic, read these:
   // https://curl.haxx.se/libcurl/c/curl_multi_timeout.html
@@ -119,7 +515,11 @@ void RequestPool::LoopListen() {
     struct timeval timeout {};
     if (maxfd != -1) {
       // "Wait for activities no longer than the set timeout."
-      if (timeoutms == -1) {
+      if (!fetch_queue_.empty() && (timeoutms == -1 || timeoutms > kFetchPollMs)) {
+        // check on the objects waiting for their children soon
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 1000 * kFetchPollMs;
+      } else if (timeoutms == -1) {
         // "You must not wait too long (more than a few seconds perhaps)".
         timeout.tv_sec = 3;
         timeout.tv_usec = 0;
@@ -130,9 +530,13 @@ void RequestPool::LoopListen() {
       if (select(maxfd + 1, &fdread, &fdwrite, &fdexcept, &timeout) < 0) {
         throw std::runtime_error(std::string("select failed with error: ") + std::strerror(errno));
       }
-    } else if (timeoutms > 0) {
-      // If maxfd == -1, then wait the lesser of timeoutms and 100 ms.
-      long nofd_timeoutms = std::min(timeoutms, static_cast<long>(100));  // NOLINT(google-runtime-int)
+    } else if (timeoutms > 0 || !fetch_queue_.empty()) {
+      // If maxfd == -1, then wait the lesser of timeoutms and 100 ms, or
+      // kFetchPollMs while objects wait for their children.
+      long nofd_timeoutms = fetch_queue_.empty() ? 100 : kFetchPollMs;  // NOLINT(google-runtime-int)
+      if (timeoutms > 0) {
+        nofd_timeoutms = std::min(timeoutms, nofd_timeoutms);
+      }
       LOG_DEBUG << "Waiting " << nofd_timeoutms << " ms for curl";
       timeout.tv_sec = 0;
       timeout.tv_usec = 1000 * (nofd_timeoutms % 1000);
@@ -154,11 +558,32 @@ void RequestPool::LoopListen() {
   do {
     CURLMsg* msg = curl_multi_info_read(multi_, &msgs_in_queue);
     if ((msg != nullptr) && msg->msg == CURLMSG_DONE) {
-      OSTreeObject::ptr completed_object = ostree_object_from_curl(msg->easy_handle);
-      completed_object->CurlDone(multi_, *this);
-      auto start_time = completed_object->RequestStartTime();
+      RateController::clock::time_point start_time;
+      bool server_responded_ok;
+      auto batch = batch_requests_.find(msg->easy_handle);
+      if (batch != batch_requests_.end()) {
+        std::unique_ptr<BatchRequest> request = std::move(batch->second);
+        batch_requests_.erase(batch);
+        start_time = request->start_time;
+        switch (request->kind) {
+          case BatchRequest::Kind::kQuery:
+            server_responded_ok = BatchQueryDone(*request, msg->data.result);
+            break;
+          case BatchRequest::Kind::kBundle:
+            server_responded_ok = BundleUploadDone(*request, msg->data.result);
+            break;
+          case BatchRequest::Kind::kCopy:
+          default:
+            server_responded_ok = CopyDone(*request, msg->data.result);
+            break;
+        }
+      } else {
+        OSTreeObject::ptr completed_object = ostree_object_from_curl(msg->easy_handle);
+        completed_object->CurlDone(multi_, *this);
+        start_time = completed_object->RequestStartTime();
+        server_responded_ok = completed_object->LastOperationResult() == ServerResponse::kOk;
+      }
       auto end_time = RateController::clock::now();
-      bool server_responded_ok = completed_object->LastOperationResult() == ServerResponse::kOk;
       rate_controller_.RequestCompleted(start_time, end_time, server_responded_ok);
 
       if (rate_controller_.ServerHasFailed()) {
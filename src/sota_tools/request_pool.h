@@ -2,16 +2,30 @@
 #define SOTA_CLIENT_TOOLS_REQUEST_POOL_H_
 
 #include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
 
 #include <curl/curl.h>
 
 #include "garage_common.h"
 #include "ostree_object.h"
+#include "presence_index.h"
 #include "rate_controller.h"
+#include "tree_walker.h"
 
 class RequestPool {
  public:
-  RequestPool(TreehubServer& server, int max_curl_requests, RunMode mode, bool fsck_on_upload);
+  // presence_index, if any, is used to skip queries and updated with the
+  // objects found on the server. tree_walker, if any, parses the objects to
+  // query ahead of time. copy_source, if any, is the server the objects come
+  // from, which the server may be able to copy them from directly. They must
+  // all outlive the pool.
+  RequestPool(TreehubServer& server, int max_curl_requests, RunMode mode, bool fsck_on_upload,
+              PresenceIndex* presence_index = nullptr, TreeWalker* tree_walker = nullptr,
+              CongestionControl congestion_control = CongestionControl::kAimd,
+              const TreehubServer* copy_source = nullptr);
   ~RequestPool();
   // Non-Copyable, Non-Movable
   RequestPool(const RequestPool&) = delete;
@@ -21,14 +35,28 @@ class RequestPool {
 
   void AddQuery(const OSTreeObject::ptr& request);
   void AddUpload(const OSTreeObject::ptr& request);
+  /* The children of this object are being fetched from the source repository,
+   * check them again later. */
+  void WaitForChildren(const OSTreeObject::ptr& object, long rescode);  // NOLINT(google-runtime-int)
+  /* The server has confirmed that it has this object. */
+  void ConfirmPresent(const OSTreeObject& object);
+  /* The server has rejected the OAuth2 token, get a new one before the next
+   * requests. */
+  void TokenRejected() { server_.TokenRejected(); }
   void Abort() {
     stopped_ = true;
+    indexed_queue_.clear();
     query_queue_.clear();
     upload_queue_.clear();
+    fetch_queue_.clear();
   };
-  bool is_idle() const { return query_queue_.empty() && upload_queue_.empty() && running_requests_ == 0; }
+  bool is_idle() const {
+    return indexed_queue_.empty() && query_queue_.empty() && upload_queue_.empty() && fetch_queue_.empty() &&
+           running_requests_ == 0;
+  }
   bool is_stopped() const { return stopped_; }
   RunMode run_mode() const { return mode_; }
+  TreeWalker* tree_walker() const { return tree_walker_; }
 
   /**
    * One iteration of request-listen loop, launches multiple requests, then
@@ -41,21 +69,70 @@ class RequestPool {
    */
   int put_requests_made() const { return put_requests_made_; }
   int head_requests_made() const { return head_requests_made_; }
+  // the number of requests that checked the presence of several objects at once
+  int batch_requests_made() const { return batch_requests_made_; }
+  // the number of requests that uploaded several objects at once
+  int bundle_uploads_made() const { return bundle_uploads_made_; }
+  // the number of objects found in the presence index, without any request
+  int indexed_objects() const { return indexed_objects_; }
+  // the number of objects the server copied from copy_source
+  int copied_objects() const { return copied_objects_; }
   uintmax_t total_object_size() const { return total_object_size_; }
 
  private:
   void LoopLaunch();  // launches multiple requests from the queues
   void LoopListen();  // listens to the result of launched requests
+  bool CanQuery() const;
+
+  /* Check the presence of several queued objects with a single POST of their
+   * paths, which the server answers with the paths it has. Servers without
+   * this endpoint get one HEAD request per object. */
+  struct BatchRequest;
+  void LaunchBatchQuery();
+  bool BatchQueryDone(BatchRequest& query, CURLcode result);
+  /* Upload several small objects from the upload queue as one tarball. Servers
+   * without this endpoint get one upload per object. Returns false if there
+   * were not enough small objects to bundle, or if the upload was aborted. */
+  bool LaunchBundleUpload();
+  bool BundleUploadDone(BatchRequest& bundle, CURLcode result);
+  /* Ask the server to copy queued objects from copy_source_, which it answers
+   * with the paths it has copied. The others are uploaded from here. Returns
+   * false if there were no objects to copy. */
+  bool LaunchCopy();
+  bool CopyDone(BatchRequest& copy, CURLcode result);
+  bool CanCopy(const OSTreeObject& object) const;
+  /* Fetch an object from a remote source repository before reading it, and
+   * abort if it's not there. */
+  bool FetchContents(const OSTreeObject::ptr& object);
+  void LaunchBatchRequest(std::unique_ptr<BatchRequest> request, const char* path, const std::string& content_type);
 
   RateController rate_controller_;
   int running_requests_;
   int head_requests_made_{0};
+  int batch_requests_made_{0};
+  int bundle_uploads_made_{0};
+  int indexed_objects_{0};
+  int copied_objects_{0};
   int put_requests_made_{0};
   uintmax_t total_object_size_{0};
   TreehubServer& server_;
   CURLM* multi_;
+  // objects whose presence is known from presence_index_
+  std::list<OSTreeObject::ptr> indexed_queue_;
   std::list<OSTreeObject::ptr> query_queue_;
   std::list<OSTreeObject::ptr> upload_queue_;
+  // objects waiting for their children to be fetched, and the response code
+  // of their own presence check
+  std::list<std::pair<OSTreeObject::ptr, long>> fetch_queue_;  // NOLINT(google-runtime-int)
+  std::map<CURL*, std::unique_ptr<BatchRequest>> batch_requests_;
+  bool batch_query_supported_{true};
+  bool bundle_upload_supported_{true};
+  const TreehubServer* copy_source_;
+  bool copy_supported_{true};
+  // objects the server could not copy, by path
+  std::set<std::string> not_copied_;
+  PresenceIndex* presence_index_;
+  TreeWalker* tree_walker_;
   RunMode mode_;
   bool fsck_on_upload_;
   bool stopped_;
@@ -0,0 +1,102 @@
+#include "token_cache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "oauth2.h"
+#include "utilities/utils.h"
+
+using std::chrono::system_clock;
+
+static std::string CacheKey(const std::string& server, const std::string& client_id, const std::string& scope) {
+  return server + '\n' + client_id + '\n' + scope;
+}
+
+TokenCache::TokenCache(const boost::filesystem::path& dir, const std::string& server, const std::string& client_id,
+                       const std::string& scope)
+    : path_(dir / (Crypto::sha256digestHex(CacheKey(server, client_id, scope)).substr(0, 32) + ".token")) {}
+
+bool TokenCache::PrivateDirectory() const {
+  const boost::filesystem::path dir = path_.parent_path();
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(dir.parent_path(), ec);
+  if (mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+    LOG_WARNING << "Could not create the token cache " << dir << ": " << std::strerror(errno);
+    return false;
+  }
+  struct stat st {};
+  if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    LOG_WARNING << "Token cache " << dir << " is not a directory, not using it";
+    return false;
+  }
+  if (st.st_uid != geteuid() || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+    LOG_WARNING << "Token cache " << dir << " may be accessed by other users, not using it";
+    return false;
+  }
+  return true;
+}
+
+bool TokenCache::Load(std::string* token, system_clock::time_point* expiry) const {
+  if (!PrivateDirectory()) {
+    return false;
+  }
+  std::string contents;
+  try {
+    if (!boost::filesystem::exists(path_)) {
+      return false;
+    }
+    contents = Utils::readFile(path_);
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Could not read cached token " << path_ << ": " << e.what();
+    return false;
+  }
+  const Json::Value json = Utils::parseJSON(contents);
+  if (!json["access_token"].isString() || !json["expires_at"].isInt64()) {
+    LOG_WARNING << "Ignoring malformed cached token " << path_;
+    return false;
+  }
+  const system_clock::time_point expires_at{std::chrono::seconds(json["expires_at"].asInt64())};
+  if (expires_at - system_clock::now() < OAuth2::kExpiryMargin) {
+    LOG_DEBUG << "Cached token " << path_ << " has expired";
+    return false;
+  }
+  *token = json["access_token"].asString();
+  *expiry = expires_at;
+  return true;
+}
+
+void TokenCache::Store(const std::string& token, const system_clock::time_point expiry) const {
+  if (expiry == system_clock::time_point{} || !PrivateDirectory()) {
+    return;
+  }
+  Json::Value json;
+  json["access_token"] = token;
+  json["expires_at"] =
+      static_cast<Json::Int64>(std::chrono::duration_cast<std::chrono::seconds>(expiry.time_since_epoch()).count());
+  const std::string contents = Utils::jsonToCanonicalStr(json);
+
+  // several runs may share the directory, the last one to get a token wins
+  const boost::filesystem::path tmp_path =
+      path_.parent_path() / boost::filesystem::unique_path(path_.filename().string() + ".%%%%-%%%%");
+  const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    LOG_WARNING << "Could not write cached token " << path_ << ": " << std::strerror(errno);
+    return;
+  }
+  const bool written = write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size());
+  close(fd);
+  if (!written || rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    LOG_WARNING << "Could not write cached token " << path_ << ": " << std::strerror(errno);
+    unlink(tmp_path.c_str());
+    return;
+  }
+  LOG_DEBUG << "Cached the OAuth2 token in " << path_;
+}
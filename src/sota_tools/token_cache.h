@@ -0,0 +1,38 @@
+#ifndef SOTA_CLIENT_TOOLS_TOKEN_CACHE_H_
+#define SOTA_CLIENT_TOOLS_TOKEN_CACHE_H_
+
+#include <chrono>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * OAuth2 access tokens kept on disk between runs of the garage tools, so that
+ * each run doesn't have to authenticate again.
+ *
+ * There is one file per auth server, client ID and scope in the cache
+ * directory. Only tokens that the auth server gave an expiry are kept, and
+ * they are only used until OAuth2::kExpiryMargin before they expire. As the
+ * tokens are credentials, the directory is created only accessible to the
+ * user, and it is not used if anybody else may access it.
+ */
+class TokenCache {
+ public:
+  TokenCache(const boost::filesystem::path& dir, const std::string& server, const std::string& client_id,
+             const std::string& scope);
+
+  /* A token that is still valid, if there is one. */
+  bool Load(std::string* token, std::chrono::system_clock::time_point* expiry) const;
+  /* Replace the cached token atomically, unless the token has no expiry. */
+  void Store(const std::string& token, std::chrono::system_clock::time_point expiry) const;
+
+  const boost::filesystem::path& path() const { return path_; }
+
+ private:
+  // Creates the directory if needed; false if it is not private to the user
+  bool PrivateDirectory() const;
+
+  boost::filesystem::path path_;
+};
+
+#endif  // SOTA_CLIENT_TOOLS_TOKEN_CACHE_H_
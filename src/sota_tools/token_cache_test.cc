@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+
+#include "token_cache.h"
+#include "utilities/utils.h"
+
+using std::chrono::system_clock;
+
+static const std::string kServer = "https://auth.example.com/oauth2/token";
+
+/* A token is found again until shortly before it expires, and only for the
+ * same server, client and scope. */
+TEST(token_cache, store_and_load) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path dir = temp_dir / "tokens";
+  const auto expiry = system_clock::now() + std::chrono::hours(1);
+  TokenCache(dir, kServer, "client", "scope").Store("token", expiry);
+
+  std::string token;
+  system_clock::time_point loaded_expiry;
+  EXPECT_TRUE(TokenCache(dir, kServer, "client", "scope").Load(&token, &loaded_expiry));
+  EXPECT_EQ(token, "token");
+  EXPECT_LE(loaded_expiry, expiry);
+  EXPECT_GT(loaded_expiry, expiry - std::chrono::seconds(1));
+  EXPECT_FALSE(TokenCache(dir, kServer, "other_client", "scope").Load(&token, &loaded_expiry));
+  EXPECT_FALSE(TokenCache(dir, kServer, "client", "other_scope").Load(&token, &loaded_expiry));
+
+  struct stat st {};
+  ASSERT_EQ(stat(TokenCache(dir, kServer, "client", "scope").path().c_str(), &st), 0);
+  EXPECT_EQ(st.st_mode & 0777, 0600);
+  ASSERT_EQ(stat(dir.c_str(), &st), 0);
+  EXPECT_EQ(st.st_mode & 0777, 0700);
+
+  // about to expire
+  TokenCache(dir, kServer, "client", "scope").Store("token", system_clock::now() + std::chrono::seconds(10));
+  EXPECT_FALSE(TokenCache(dir, kServer, "client", "scope").Load(&token, &loaded_expiry));
+}
+
+/* Tokens without an expiry are not kept, and a directory that others may
+ * access is not used. */
+TEST(token_cache, not_cached) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path dir = temp_dir / "tokens";
+  TokenCache cache(dir, kServer, "client", "scope");
+  std::string token;
+  system_clock::time_point expiry;
+  cache.Store("token", system_clock::time_point{});
+  EXPECT_FALSE(cache.Load(&token, &expiry));
+
+  cache.Store("token", system_clock::now() + std::chrono::hours(1));
+  ASSERT_EQ(chmod(dir.c_str(), 0755), 0);
+  EXPECT_FALSE(cache.Load(&token, &expiry));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
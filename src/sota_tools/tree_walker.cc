@@ -0,0 +1,211 @@
+#include "tree_walker.h"
+
+#include <glib.h>
+#include <ostree.h>
+#include <cassert>
+#include <stdexcept>
+
+#include "ostree_repo.h"
+
+// Parsed objects that the request loop hasn't asked for yet
+static constexpr size_t kMaxParsedAhead = 4096;
+
+TreeWalker::TreeWalker(boost::filesystem::path repo_root, const unsigned int num_threads)
+    : repo_root_(std::move(repo_root)) {
+  for (unsigned int i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&TreeWalker::Run, this);
+  }
+}
+
+TreeWalker::~TreeWalker() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void TreeWalker::Walk(const OSTreeHash& hash, const OstreeObjectType type) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  Queue(Key(hash, type));
+}
+
+void TreeWalker::Queue(const Key& key) {
+  if (stopping_ || !seen_.insert(key).second) {
+    return;
+  }
+  results_.emplace(key, Result());
+  queue_.push_back(key);
+  work_cv_.notify_one();
+}
+
+TreeWalker::ChildList TreeWalker::Children(const OSTreeHash& hash, const OstreeObjectType type) {
+  const Key key(hash, type);
+  std::unique_lock<std::mutex> lock(mutex_);
+  seen_.insert(key);
+  auto it = results_.emplace(key, Result()).first;
+  if (it->second.state == State::kQueued) {
+    // Don't wait for a worker to get to it
+    it->second.state = State::kParsing;
+    Process(it, lock);
+  } else if (it->second.state == State::kParsing) {
+    done_cv_.wait(lock, [it] { return it->second.state == State::kDone; });
+  }
+
+  Result result = std::move(it->second);
+  results_.erase(it);
+  parsed_ahead_--;
+  lock.unlock();
+  work_cv_.notify_one();
+
+  if (result.error) {
+    std::rethrow_exception(result.error);
+  }
+  return std::move(result.children);
+}
+
+void TreeWalker::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_cv_.wait(lock, [this] { return stopping_ || (!queue_.empty() && parsed_ahead_ < kMaxParsedAhead); });
+    if (stopping_) {
+      return;
+    }
+    const Key key = queue_.front();
+    queue_.pop_front();
+    auto it = results_.find(key);
+    // Children() may have taken it over already
+    if (it != results_.end() && it->second.state == State::kQueued) {
+      it->second.state = State::kParsing;
+      Process(it, lock);
+    }
+  }
+}
+
+void TreeWalker::Process(const std::map<Key, Result>::iterator it, std::unique_lock<std::mutex>& lock) {
+  assert(it->second.state == State::kParsing);
+  const Key key = it->first;
+  lock.unlock();
+
+  ChildList children;
+  std::exception_ptr error;
+  try {
+    children = Parse(repo_root_ / "objects" / OSTreeRepo::GetPathForHash(key.first, key.second), key.second);
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  lock.lock();
+  for (const auto& child : children) {
+    if (child.second == OSTREE_OBJECT_TYPE_DIR_TREE) {
+      Queue(child);
+    }
+  }
+  it->second.children = std::move(children);
+  it->second.error = error;
+  it->second.state = State::kDone;
+  parsed_ahead_++;
+  done_cv_.notify_all();
+}
+
+TreeWalker::ChildList TreeWalker::Parse(const boost::filesystem::path& path, const OstreeObjectType type) {
+  const GVariantType* content_type;
+  bool is_commit;
+
+  if (type == OSTREE_OBJECT_TYPE_COMMIT) {
+    content_type = OSTREE_COMMIT_GVARIANT_FORMAT;
+    is_commit = true;
+  } else if (type == OSTREE_OBJECT_TYPE_DIR_TREE) {
+    content_type = OSTREE_TREE_GVARIANT_FORMAT;
+    is_commit = false;
+  } else {
+    return ChildList();
+  }
+
+  GError* gerror = nullptr;
+  GMappedFile* mfile = g_mapped_file_new(path.c_str(), FALSE, &gerror);
+
+  if (mfile == nullptr) {
+    throw std::runtime_error("Failed to map metadata file " + path.native());
+  }
+
+  GVariant* contents =
+      g_variant_new_from_data(content_type, g_mapped_file_get_contents(mfile), g_mapped_file_get_length(mfile), TRUE,
+                              reinterpret_cast<GDestroyNotify>(g_mapped_file_unref), mfile);
+  g_variant_ref_sink(contents);
+
+  ChildList children;
+  if (is_commit) {
+    // * - ay - Root tree contents
+    GVariant* content_csum_variant = nullptr;
+    g_variant_get_child(contents, 6, "@ay", &content_csum_variant);
+
+    gsize n_elts;
+    const auto* csum = static_cast<const uint8_t*>(g_variant_get_fixed_array(content_csum_variant, &n_elts, 1));
+    assert(n_elts == 32);
+    children.emplace_back(OSTreeHash(csum), OSTREE_OBJECT_TYPE_DIR_TREE);
+
+    // * - ay - Root tree metadata
+    GVariant* meta_csum_variant = nullptr;
+    g_variant_get_child(contents, 7, "@ay", &meta_csum_variant);
+    csum = static_cast<const uint8_t*>(g_variant_get_fixed_array(meta_csum_variant, &n_elts, 1));
+    assert(n_elts == 32);
+    children.emplace_back(OSTreeHash(csum), OSTREE_OBJECT_TYPE_DIR_META);
+
+    g_variant_unref(meta_csum_variant);
+    g_variant_unref(content_csum_variant);
+  } else {
+    GVariant* files_variant = nullptr;
+    GVariant* dirs_variant = nullptr;
+
+    files_variant = g_variant_get_child_value(contents, 0);
+    dirs_variant = g_variant_get_child_value(contents, 1);
+
+    gsize nfiles = g_variant_n_children(files_variant);
+    gsize ndirs = g_variant_n_children(dirs_variant);
+    children.reserve(nfiles + 2 * ndirs);
+
+    // * - a(say) - array of (filename, checksum) for files
+    for (gsize i = 0; i < nfiles; i++) {
+      GVariant* csum_variant = nullptr;
+      const char* fname = nullptr;
+
+      g_variant_get_child(files_variant, i, "(&s@ay)", &fname, &csum_variant);
+      gsize n_elts;
+      const auto* csum = static_cast<const uint8_t*>(g_variant_get_fixed_array(csum_variant, &n_elts, 1));
+      assert(n_elts == 32);
+      children.emplace_back(OSTreeHash(csum), OSTREE_OBJECT_TYPE_FILE);
+
+      g_variant_unref(csum_variant);
+    }
+
+    // * - a(sayay) - array of (dirname, tree_checksum, meta_checksum) for directories
+    for (gsize i = 0; i < ndirs; i++) {
+      GVariant* content_csum_variant = nullptr;
+      GVariant* meta_csum_variant = nullptr;
+      const char* fname = nullptr;
+      g_variant_get_child(dirs_variant, i, "(&s@ay@ay)", &fname, &content_csum_variant, &meta_csum_variant);
+      gsize n_elts;
+      // First the .dirtree:
+      const auto* csum = static_cast<const uint8_t*>(g_variant_get_fixed_array(content_csum_variant, &n_elts, 1));
+      assert(n_elts == 32);
+      children.emplace_back(OSTreeHash(csum), OSTREE_OBJECT_TYPE_DIR_TREE);
+
+      // Then the .dirmeta:
+      csum = static_cast<const uint8_t*>(g_variant_get_fixed_array(meta_csum_variant, &n_elts, 1));
+      assert(n_elts == 32);
+      children.emplace_back(OSTreeHash(csum), OSTREE_OBJECT_TYPE_DIR_META);
+
+      g_variant_unref(meta_csum_variant);
+      g_variant_unref(content_csum_variant);
+    }
+
+    g_variant_unref(dirs_variant);
+    g_variant_unref(files_variant);
+  }
+  g_variant_unref(contents);
+  return children;
+}
@@ -0,0 +1,80 @@
+#ifndef SOTA_CLIENT_TOOLS_TREE_WALKER_H_
+#define SOTA_CLIENT_TOOLS_TREE_WALKER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "garage_common.h"
+#include "ostree_hash.h"
+
+/**
+ * Parses the commit and dirtree objects of a local OSTree repository on
+ * worker threads, ahead of the request loop.
+ *
+ * Walking a commit parses it and then, recursively, every dirtree it refers
+ * to, so that the children of an object are usually ready by the time the
+ * request loop needs them. The number of parsed objects nobody has asked for
+ * yet is bounded.
+ */
+class TreeWalker {
+ public:
+  using ChildList = std::vector<std::pair<OSTreeHash, OstreeObjectType>>;
+
+  TreeWalker(boost::filesystem::path repo_root, unsigned int num_threads);
+  ~TreeWalker();
+  // Non-Copyable, Non-Movable
+  TreeWalker(const TreeWalker&) = delete;
+  TreeWalker(TreeWalker&&) = delete;
+  TreeWalker& operator=(const TreeWalker&) = delete;
+  TreeWalker& operator=(TreeWalker&&) = delete;
+
+  /* Start parsing a commit or dirtree object and the subtrees it refers to. */
+  void Walk(const OSTreeHash& hash, OstreeObjectType type);
+
+  /* The children of a commit or dirtree object. Waits for a worker that is
+   * parsing it, or parses it in the calling thread if none has started yet.
+   * Can throw std::runtime_error if the object can't be read. */
+  ChildList Children(const OSTreeHash& hash, OstreeObjectType type);
+
+  /* Parse a commit or dirtree object. The detached metadata of a commit isn't
+   * referred to by the commit itself and is not part of the list. */
+  static ChildList Parse(const boost::filesystem::path& path, OstreeObjectType type);
+
+ private:
+  using Key = std::pair<OSTreeHash, OstreeObjectType>;
+  enum class State { kQueued, kParsing, kDone };
+  struct Result {
+    State state{State::kQueued};
+    ChildList children;
+    std::exception_ptr error;
+  };
+
+  void Run();
+  // with mutex_ held
+  void Queue(const Key& key);
+  // Parse an object whose state has been set to kParsing, then queue its
+  // subtrees. The lock is released while parsing.
+  void Process(std::map<Key, Result>::iterator it, std::unique_lock<std::mutex>& lock);
+
+  const boost::filesystem::path repo_root_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::deque<Key> queue_;
+  std::map<Key, Result> results_;
+  std::set<Key> seen_;
+  size_t parsed_ahead_{0};
+  bool stopping_{false};
+  std::vector<std::thread> workers_;
+};
+
+#endif  // SOTA_CLIENT_TOOLS_TREE_WALKER_H_
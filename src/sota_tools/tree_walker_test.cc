@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include "ostree_dir_repo.h"
+#include "ostree_ref.h"
+#include "tree_walker.h"
+
+static const boost::filesystem::path kRepo = "tests/sota_tools/repo";
+
+static boost::filesystem::path ObjectPath(const OSTreeHash& hash, const OstreeObjectType type) {
+  return kRepo / "objects" / OSTreeRepo::GetPathForHash(hash, type);
+}
+
+/* Parse the root of a commit. */
+TEST(tree_walker, parse_commit) {
+  OSTreeDirRepo repo(kRepo);
+  const OSTreeHash commit = repo.GetRef("master").GetHash();
+  const TreeWalker::ChildList children = TreeWalker::Parse(ObjectPath(commit, OSTREE_OBJECT_TYPE_COMMIT),
+                                                           OSTREE_OBJECT_TYPE_COMMIT);
+  ASSERT_EQ(children.size(), 2U);
+  EXPECT_EQ(children[0].second, OSTREE_OBJECT_TYPE_DIR_TREE);
+  EXPECT_EQ(children[1].second, OSTREE_OBJECT_TYPE_DIR_META);
+  EXPECT_TRUE(TreeWalker::Parse(ObjectPath(commit, OSTREE_OBJECT_TYPE_FILE), OSTREE_OBJECT_TYPE_FILE).empty());
+}
+
+/* The worker threads find the same children as a walk on a single thread,
+ * whether or not the request loop gets to an object before them. */
+TEST(tree_walker, walk) {
+  OSTreeDirRepo repo(kRepo);
+  const OSTreeHash commit = repo.GetRef("master").GetHash();
+  for (unsigned int threads : {1U, 4U}) {
+    TreeWalker walker(kRepo, threads);
+    walker.Walk(commit, OSTREE_OBJECT_TYPE_COMMIT);
+
+    std::vector<std::pair<OSTreeHash, OstreeObjectType>> pending{{commit, OSTREE_OBJECT_TYPE_COMMIT}};
+    size_t parsed = 0;
+    while (!pending.empty()) {
+      const auto object = pending.back();
+      pending.pop_back();
+      const TreeWalker::ChildList children = walker.Children(object.first, object.second);
+      const TreeWalker::ChildList expected = TreeWalker::Parse(ObjectPath(object.first, object.second), object.second);
+      ASSERT_EQ(children.size(), expected.size());
+      for (size_t i = 0; i < children.size(); ++i) {
+        EXPECT_EQ(children[i].first.string(), expected[i].first.string());
+        EXPECT_EQ(children[i].second, expected[i].second);
+        if (children[i].second == OSTREE_OBJECT_TYPE_DIR_TREE) {
+          pending.push_back(children[i]);
+        }
+      }
+      ++parsed;
+    }
+    EXPECT_GT(parsed, 1U);
+  }
+}
+
+/* Objects that can't be read are reported to the caller. */
+TEST(tree_walker, missing_object) {
+  TreeWalker walker(kRepo, 2);
+  const OSTreeHash missing = OSTreeHash::Parse(std::string(64, '0'));
+  walker.Walk(missing, OSTREE_OBJECT_TYPE_DIR_TREE);
+  EXPECT_THROW(walker.Children(missing, OSTREE_OBJECT_TYPE_DIR_TREE), std::runtime_error);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -2,13 +2,21 @@
 
 #include <cassert>
 #include <iostream>
+#include <utility>
 
 #include <boost/algorithm/string.hpp>
 
+#include "logging/logging.h"
+#include "oauth2.h"
+
 using std::string;
 
+// how often the auth server is asked for a new token at most, for a server
+// that rejects every token
+static constexpr std::chrono::seconds kMinTokenRefreshInterval{60};
+
 TreehubServer::TreehubServer() {
-  auth_header_.data = const_cast<char*>(auth_header_contents_.c_str());
+  auth_header_.data = const_cast<char*>(auth_header_contents_.back().c_str());
   auth_header_.next = &force_header_;
   force_header_contents_ = "x-ats-ostree-force: true";
   force_header_.data = const_cast<char*>(force_header_contents_.c_str());
@@ -22,11 +30,45 @@ void TreehubServer::SetToken(const string& token) {
   assert(force_header_.next == &content_type_header_);
   assert(content_type_header_.next == nullptr);
 
-  auth_header_contents_ = "Authorization: Bearer " + token;
-  auth_header_.data = const_cast<char*>(auth_header_contents_.c_str());
+  token_ = token;
+  auth_header_contents_.push_back("Authorization: Bearer " + token);
+  auth_header_.data = const_cast<char*>(auth_header_contents_.back().c_str());
   method_ = AuthMethod::kOauth2;
 }
 
+void TreehubServer::SetTokenRefresh(const std::chrono::system_clock::time_point expiry, TokenRefresh refresh) {
+  token_expiry_ = expiry;
+  token_refresh_ = std::move(refresh);
+}
+
+void TreehubServer::RefreshToken() {
+  if (!token_refresh_) {
+    return;
+  }
+  const bool expiring = token_expiry_ != std::chrono::system_clock::time_point{} &&
+                        token_expiry_ - std::chrono::system_clock::now() < OAuth2::kExpiryMargin;
+  if (!expiring && !token_rejected_) {
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if (last_token_refresh_ != std::chrono::steady_clock::time_point{} &&
+      now - last_token_refresh_ < kMinTokenRefreshInterval) {
+    return;
+  }
+  last_token_refresh_ = now;
+  token_rejected_ = false;
+
+  LOG_INFO << "Refreshing the OAuth2 token, as it " << (expiring ? "is about to expire" : "was rejected");
+  std::string token;
+  std::chrono::system_clock::time_point expiry;
+  if (!token_refresh_(&token, &expiry)) {
+    LOG_WARNING << "Could not refresh the OAuth2 token";
+    return;
+  }
+  SetToken(token);
+  token_expiry_ = expiry;
+}
+
 void TreehubServer::SetContentType(const string& content_type) {
   assert(auth_header_.next == &force_header_);
   assert(force_header_.next == &content_type_header_);
@@ -86,6 +128,16 @@ void TreehubServer::InjectIntoCurl(const string& url_suffix, CURL* curl_handle,
   }
 }
 
+struct curl_slist* TreehubServer::CopyHeaders(const string& content_type) const {
+  struct curl_slist* headers = nullptr;
+  for (const string* header : {&auth_header_contents_.back(), &force_header_contents_}) {
+    if (!header->empty()) {
+      headers = curl_slist_append(headers, header->c_str());
+    }
+  }
+  return curl_slist_append(headers, content_type.c_str());
+}
+
 // Set the url of the treehub server, this should be something like
 // "https://treehub-staging.atsgarage.com/api/v2/"
 // The trailing slash is optional, and will be appended if required
@@ -1,6 +1,9 @@
 #ifndef SOTA_CLIENT_TOOLS_TREEHUB_SERVER_H_
 #define SOTA_CLIENT_TOOLS_TREEHUB_SERVER_H_
 
+#include <chrono>
+#include <functional>
+#include <list>
 #include <string>
 
 #include <curl/curl.h>
@@ -12,30 +15,51 @@ class TreehubServer {
  public:
   TreehubServer();
   void SetToken(const std::string &token);
+  // Fetches a new OAuth2 token and when it expires, e.g. with OAuth2; false if
+  // it couldn't
+  using TokenRefresh = std::function<bool(std::string *token, std::chrono::system_clock::time_point *expiry)>;
+  // The token set last expires at expiry (the epoch if unknown), refresh
+  // replaces it then
+  void SetTokenRefresh(std::chrono::system_clock::time_point expiry, TokenRefresh refresh);
+  // Replace the token if it is about to expire or the server has rejected it.
+  // Requests already sent keep the token they had.
+  void RefreshToken();
+  void TokenRejected() { token_rejected_ = true; }
   void SetContentType(const std::string &content_type);
   void SetCerts(const std::string &client_p12);
   void SetAuthBasic(const std::string &username, const std::string &password);
 
   void InjectIntoCurl(const std::string &url_suffix, CURL *curl_handle, bool tufrepo = false) const;
+  // A copy of the headers set by InjectIntoCurl() with another content type,
+  // for requests that can't share the one uploads change. Free it with
+  // curl_slist_free_all() once the request has been completed.
+  struct curl_slist *CopyHeaders(const std::string &content_type) const;
 
   void ca_certs(const std::string &cacerts) { ca_certs_ = cacerts; }
   void root_url(const std::string &_root_url);
   void repo_url(const std::string &_repo_url);
-  std::string root_url() { return root_url_; };
+  std::string root_url() const { return root_url_; };
+  // The OAuth2 access token sent with requests, if any
+  std::string token() const { return token_; }
 
  private:
   std::string ca_certs_;
   std::string root_url_;
   std::string repo_url_;
+  std::string token_;
+  std::chrono::system_clock::time_point token_expiry_;
+  TokenRefresh token_refresh_;
+  bool token_rejected_{false};
+  std::chrono::steady_clock::time_point last_token_refresh_;
   std::string username_;
   std::string password_;
   std::string root_cert_;
   TemporaryFile client_p12_path_;
   AuthMethod method_{AuthMethod::kNone};
   struct curl_slist auth_header_ {};
-  // Don't modify auth_header_contents_ without updating the pointer in
-  // auth_header_
-  std::string auth_header_contents_;
+  // The last one is in auth_header_. Earlier ones are kept, as requests in
+  // flight may still refer to them.
+  std::list<std::string> auth_header_contents_{""};
   struct curl_slist force_header_ {};
   // Don't modify force_header_contents_ without updating the pointer in
   // force_header_
@@ -2,6 +2,8 @@
 
 #include <curl/curl.h>
 #include <boost/process.hpp>
+#include <chrono>
+#include <string>
 #include <thread>
 #include "ostree_http_repo.h"
 #include "ostree_ref.h"
@@ -39,6 +41,28 @@ TEST(treehub_server, token_auth) {
   }
 }
 
+/* An OAuth2 token that is about to expire or was rejected is replaced, but
+ * the auth server is not asked again right away. */
+TEST(treehub_server, token_refresh) {
+  TreehubServer server;
+  server.SetToken("old_token");
+  int refreshes = 0;
+  const auto soon = std::chrono::system_clock::now() + std::chrono::seconds(10);
+  server.SetTokenRefresh(soon, [&refreshes](std::string *token, std::chrono::system_clock::time_point *expiry) {
+    *token = "new_token_" + std::to_string(++refreshes);
+    *expiry = std::chrono::system_clock::now() + std::chrono::hours(1);
+    return true;
+  });
+  server.RefreshToken();
+  EXPECT_EQ(server.token(), "new_token_1");
+  server.RefreshToken();
+  EXPECT_EQ(refreshes, 1);
+
+  server.TokenRejected();
+  server.RefreshToken();
+  EXPECT_EQ(server.token(), "new_token_1");
+}
+
 /* Authenticate with username and password (basic auth). */
 TEST(treehub_server, basic_auth) {
   TreehubServer server;
@@ -6,6 +6,10 @@
 
 void DirectorRepo::addTarget(const std::string &target_name, const Json::Value &target, const std::string &hardware_id,
                              const std::string &ecu_serial, const std::string &url, const std::string &expires) {
+  addTargets({Assignment{target_name, target, hardware_id, ecu_serial, url}}, expires);
+}
+
+void DirectorRepo::addTargets(const std::vector<Assignment> &assignments, const std::string &expires) {
   const boost::filesystem::path current = path_ / DirectorRepo::dir / "targets.json";
   const boost::filesystem::path staging = path_ / DirectorRepo::dir / "staging/targets.json";
 
@@ -21,15 +25,18 @@ void DirectorRepo::addTarget(const std::string &target_name, const Json::Value &
   if (!expires.empty()) {
     director_targets["expires"] = expires;
   }
-  director_targets["targets"][target_name] = target;
-  director_targets["targets"][target_name]["custom"].removeMember("hardwareIds");
-  director_targets["targets"][target_name]["custom"]["ecuIdentifiers"][ecu_serial]["hardwareId"] = hardware_id;
-  if (!url.empty()) {
-    director_targets["targets"][target_name]["custom"]["uri"] = url;
-  } else {
-    director_targets["targets"][target_name]["custom"].removeMember("uri");
+  for (const auto &assignment : assignments) {
+    Json::Value &target = director_targets["targets"][assignment.target_name];
+    target = assignment.target;
+    target["custom"].removeMember("hardwareIds");
+    target["custom"]["ecuIdentifiers"][assignment.ecu_serial]["hardwareId"] = assignment.hardware_id;
+    if (!assignment.url.empty()) {
+      target["custom"]["uri"] = assignment.url;
+    } else {
+      target["custom"].removeMember("uri");
+    }
+    target["custom"].removeMember("version");
   }
-  director_targets["targets"][target_name]["custom"].removeMember("version");
   director_targets["version"] = (Utils::parseJSONFile(current)["signed"]["version"].asUInt()) + 1;
   Utils::writeFile(staging, Utils::jsonToCanonicalStr(director_targets));
   updateRepo();
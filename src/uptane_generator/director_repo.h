@@ -1,14 +1,26 @@
 #ifndef DIRECTOR_REPO_H_
 #define DIRECTOR_REPO_H_
 
+#include <vector>
+
 #include "repo.h"
 
 class DirectorRepo : public Repo {
  public:
+  struct Assignment {
+    std::string target_name;
+    Json::Value target;
+    std::string hardware_id;
+    std::string ecu_serial;
+    std::string url;
+  };
+
   DirectorRepo(boost::filesystem::path path, const std::string &expires, std::string correlation_id)
       : Repo(Uptane::RepositoryType::Director(), std::move(path), expires, std::move(correlation_id)) {}
   void addTarget(const std::string &target_name, const Json::Value &target, const std::string &hardware_id,
                  const std::string &ecu_serial, const std::string &url = "", const std::string &expires = "");
+  // stages all of them with a single write
+  void addTargets(const std::vector<Assignment> &assignments, const std::string &expires = "");
   void revokeTargets(const std::vector<std::string> &targets_to_remove);
   void signTargets();
   void emptyTargets();
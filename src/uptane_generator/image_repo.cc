@@ -1,56 +1,192 @@
 #include "image_repo.h"
 
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <map>
+#include <set>
+
 #include <boost/filesystem.hpp>
 
 #include "crypto/crypto.h"
+#include "libaktualizr/packagemanagerinterface.h"
 #include "utilities/utils.h"
 
 void ImageRepo::addImage(const std::string &name, Json::Value &target, const std::string &hardware_id,
                          const Delegation &delegation) {
+  // TODO: support multiple hardware IDs.
+  target["custom"]["hardwareIds"][0] = hardware_id;
+  Json::Value new_targets;
+  new_targets[name] = target;
+  writeTargets(new_targets, delegation);
+  updateRepo();
+}
+
+void ImageRepo::writeTargets(const Json::Value &new_targets, const Delegation &delegation) {
   boost::filesystem::path repo_dir(path_ / ImageRepo::dir);
 
   boost::filesystem::path targets_path =
       delegation ? ((repo_dir / "delegations") / delegation.name).string() + ".json" : repo_dir / "targets.json";
   Json::Value targets = Utils::parseJSONFile(targets_path)["signed"];
-  // TODO: support multiple hardware IDs.
-  target["custom"]["hardwareIds"][0] = hardware_id;
-  targets["targets"][name] = target;
+  for (auto it = new_targets.begin(); it != new_targets.end(); ++it) {
+    targets["targets"][it.key().asString()] = *it;
+  }
   targets["version"] = (targets["version"].asUInt()) + 1;
 
   auto role = delegation ? Uptane::Role(delegation.name, true) : Uptane::Role::Targets();
   std::string signed_targets = Utils::jsonToCanonicalStr(signTuf(role, targets));
   Utils::writeFile(targets_path, signed_targets);
-  updateRepo();
 }
 
 void ImageRepo::addBinaryImage(const boost::filesystem::path &image_path, const boost::filesystem::path &targetname,
                                const std::string &hardware_id, const std::string &url, const int32_t custom_version,
                                const Delegation &delegation, const Json::Value &custom) {
-  boost::filesystem::path repo_dir(path_ / ImageRepo::dir);
-  boost::filesystem::path targets_path = repo_dir / "targets";
+  addBinaryImages({BinaryImage{image_path, targetname, hardware_id, url, custom_version, delegation, custom}}, 1);
+}
+
+// Images at least this large have their two hashes computed in parallel
+static constexpr uint64_t kParallelHashSize = 16 * 1024 * 1024;
 
-  auto targetname_dir = targetname.parent_path();
+struct ImageDigest {
+  uint64_t length{0};
+  std::string sha256;
+  std::string sha512;
+};
+
+// Hash and copy a mapped image, chunk by chunk so that the pages are still
+// cached when they are written.
+static ImageDigest copyMappedImage(const TargetFileView &view, std::ofstream *out) {
+  static constexpr uint64_t kChunkSize = 1 << 20;
+  const unsigned char *data = view.data();
+  const uint64_t length = view.size();
+  std::future<std::string> parallel_sha512;
+  if (length >= kParallelHashSize) {
+    parallel_sha512 = std::async(std::launch::async, [data, length]() {
+      MultiPartSHA512Hasher hasher;
+      hasher.update(data, length);
+      return hasher.getHexDigest();
+    });
+  }
+  MultiPartSHA256Hasher sha256;
+  MultiPartSHA512Hasher sha512;
+  for (uint64_t offset = 0; offset < length; offset += kChunkSize) {
+    const uint64_t size = std::min(kChunkSize, length - offset);
+    sha256.update(data + offset, size);
+    if (!parallel_sha512.valid()) {
+      sha512.update(data + offset, size);
+    }
+    if (out != nullptr) {
+      out->write(reinterpret_cast<const char *>(data + offset), static_cast<std::streamsize>(size));
+    }
+  }
+  return {length, sha256.getHexDigest(), parallel_sha512.valid() ? parallel_sha512.get() : sha512.getHexDigest()};
+}
+
+// Pipes and other files that can't be mapped are read through a buffer.
+// Read errors are left in the state of `in`.
+static ImageDigest copyStreamedImage(std::ifstream &in, std::ofstream *out) {
+  MultiPartSHA256Hasher sha256;
+  MultiPartSHA512Hasher sha512;
+  uint64_t length = 0;
+  std::vector<char> buf(1 << 16);
+  while (in) {
+    in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    const auto read = static_cast<uint64_t>(in.gcount());
+    if (read == 0) {
+      break;
+    }
+    sha256.update(reinterpret_cast<const unsigned char *>(buf.data()), read);
+    sha512.update(reinterpret_cast<const unsigned char *>(buf.data()), read);
+    if (out != nullptr) {
+      out->write(buf.data(), static_cast<std::streamsize>(read));
+    }
+    length += read;
+  }
+  return {length, sha256.getHexDigest(), sha512.getHexDigest()};
+}
+
+// Copy the image into the repo and hash it on the way, in a single read.
+static Json::Value copyBinaryImage(const ImageRepo::BinaryImage &image, const boost::filesystem::path &targets_path) {
+  auto targetname_dir = image.targetname.parent_path();
   boost::filesystem::create_directories(targets_path / targetname_dir);
-  boost::filesystem::copy_file(image_path, targets_path / targetname_dir / targetname.filename(),
-                               boost::filesystem::copy_option::overwrite_if_exists);
+  const boost::filesystem::path dest = targets_path / targetname_dir / image.targetname.filename();
 
-  std::string image = Utils::readFile(image_path);
+  // the image may already be in place, it must not be truncated then
+  const bool in_place = boost::filesystem::exists(dest) && boost::filesystem::equivalent(image.image_path, dest);
+  ImageDigest digest;
+  std::ofstream out;
+  bool read_error = false;
+  if (boost::filesystem::is_regular_file(image.image_path)) {
+    const TargetFileView view(image.image_path.string());
+    if (!in_place) {
+      out.open(dest.string(), std::ios::binary | std::ios::trunc);
+    }
+    digest = copyMappedImage(view, in_place ? nullptr : &out);
+  } else {
+    std::ifstream in(image.image_path.string(), std::ios::binary);
+    if (!in) {
+      throw std::runtime_error("Could not open image " + image.image_path.string());
+    }
+    if (!in_place) {
+      out.open(dest.string(), std::ios::binary | std::ios::trunc);
+    }
+    digest = copyStreamedImage(in, in_place ? nullptr : &out);
+    read_error = in.bad();
+  }
+  if (!in_place) {
+    out.close();
+  }
+  if (read_error || (!in_place && !out)) {
+    throw std::runtime_error("Could not copy image " + image.image_path.string() + " to " + dest.string());
+  }
 
   Json::Value target;
-  target["length"] = Json::UInt64(image.size());
-  target["hashes"]["sha256"] = Crypto::sha256digestHex(image);
-  target["hashes"]["sha512"] = Crypto::sha512digestHex(image);
-  target["custom"] = custom;
+  target["length"] = Json::UInt64(digest.length);
+  target["hashes"]["sha256"] = digest.sha256;
+  target["hashes"]["sha512"] = digest.sha512;
+  target["custom"] = image.custom;
   if (!target["custom"].isMember("targetFormat")) {
     target["custom"]["targetFormat"] = "BINARY";
   }
-  if (!url.empty()) {
-    target["custom"]["uri"] = url;
+  if (!image.url.empty()) {
+    target["custom"]["uri"] = image.url;
   }
-  if (custom_version != 0) {
-    target["custom"]["version"] = custom_version;
+  if (image.custom_version != 0) {
+    target["custom"]["version"] = image.custom_version;
+  }
+  // TODO: support multiple hardware IDs.
+  target["custom"]["hardwareIds"][0] = image.hardware_id;
+  return target;
+}
+
+Json::Value ImageRepo::addBinaryImages(const std::vector<BinaryImage> &images, unsigned jobs) {
+  std::set<std::string> names;
+  for (const auto &image : images) {
+    if (!names.insert(image.targetname.string()).second) {
+      throw std::runtime_error("Target " + image.targetname.string() + " is added more than once");
+    }
+  }
+
+  const boost::filesystem::path targets_path = path_ / ImageRepo::dir / "targets";
+  std::vector<Json::Value> targets(images.size());
+  runJobs(images.size(), jobs, [&](size_t i) { targets[i] = copyBinaryImage(images[i], targets_path); });
+
+  // one signature per targets role, and one snapshot for all of them
+  std::map<std::string, std::pair<Delegation, Json::Value>> by_role;
+  Json::Value result(Json::objectValue);
+  for (size_t i = 0; i < images.size(); ++i) {
+    auto &role = by_role[images[i].delegation.name];
+    role.first = images[i].delegation;
+    role.second[images[i].targetname.string()] = targets[i];
+    result[images[i].targetname.string()] = targets[i];
+  }
+  for (const auto &role : by_role) {
+    writeTargets(role.second.second, role.second.first);
+  }
+  if (!by_role.empty()) {
+    updateRepo();
   }
-  addImage(targetname.string(), target, hardware_id, delegation);
+  return result;
 }
 
 void ImageRepo::addCustomImage(const std::string &name, const Hash &hash, const uint64_t length,
@@ -76,6 +212,24 @@ void ImageRepo::addCustomImage(const std::string &name, const Hash &hash, const
   addImage(name, target, hardware_id, delegation);
 }
 
+void ImageRepo::addGeneratedImages(const std::string &prefix, const uint64_t count, const uint64_t length,
+                                   const std::string &hardware_id, const Delegation &delegation) {
+  Json::Value new_targets(Json::objectValue);
+  for (uint64_t i = 0; i < count; ++i) {
+    const std::string name = prefix + "-" + std::to_string(i);
+    Json::Value target;
+    target["length"] = Json::UInt64(length);
+    // there is no file behind these, any well-formed hash does
+    target["hashes"]["sha256"] = Crypto::sha256digestHex(name);
+    target["custom"]["targetFormat"] = "BINARY";
+    target["custom"]["version"] = Json::UInt64(i);
+    target["custom"]["hardwareIds"][0] = hardware_id;
+    new_targets[name] = target;
+  }
+  writeTargets(new_targets, delegation);
+  updateRepo();
+}
+
 void ImageRepo::addDelegation(const Uptane::Role &name, const Uptane::Role &parent_role, const std::string &path,
                               bool terminating, KeyType key_type) {
   if (keys_.count(name) != 0) {
@@ -1,18 +1,36 @@
 #ifndef IMAGE_REPO_H_
 #define IMAGE_REPO_H_
 
+#include <vector>
+
 #include "repo.h"
 
 class ImageRepo : public Repo {
  public:
+  struct BinaryImage {
+    boost::filesystem::path image_path;
+    boost::filesystem::path targetname;
+    std::string hardware_id;
+    std::string url;
+    int32_t custom_version{0};
+    Delegation delegation;
+    Json::Value custom;
+  };
+
   ImageRepo(boost::filesystem::path path, const std::string &expires, std::string correlation_id)
       : Repo(Uptane::RepositoryType::Image(), std::move(path), expires, std::move(correlation_id)) {}
   void addBinaryImage(const boost::filesystem::path &image_path, const boost::filesystem::path &targetname,
                       const std::string &hardware_id, const std::string &url = "", int32_t custom_version = 0,
                       const Delegation &delegation = {}, const Json::Value &custom = {});
+  // Copy and hash the images with `jobs` threads (0 for one per core), then
+  // sign each targets role once. Returns the new targets by name.
+  Json::Value addBinaryImages(const std::vector<BinaryImage> &images, unsigned jobs = 0);
   void addCustomImage(const std::string &name, const Hash &hash, uint64_t length, const std::string &hardware_id,
                       const std::string &url = "", int32_t custom_version = 0, const Delegation &delegation = {},
                       const Json::Value &custom = {});
+  // count targets named <prefix>-<n> without files, to test with large repos
+  void addGeneratedImages(const std::string &prefix, uint64_t count, uint64_t length, const std::string &hardware_id,
+                          const Delegation &delegation = {});
   void addDelegation(const Uptane::Role &name, const Uptane::Role &parent_role, const std::string &path,
                      bool terminating, KeyType key_type);
   void revokeDelegation(const Uptane::Role &name);
@@ -25,6 +43,8 @@ class ImageRepo : public Repo {
  private:
   void addImage(const std::string &name, Json::Value &target, const std::string &hardware_id,
                 const Delegation &delegation = {});
+  // new_targets: target name -> target, signed at once; the snapshot is left to the caller
+  void writeTargets(const Json::Value &new_targets, const Delegation &delegation);
   void removeDelegationRecursive(const Uptane::Role &name, const Uptane::Role &parent_name);
 };
 
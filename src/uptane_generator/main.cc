@@ -1,10 +1,13 @@
 #include <boost/program_options.hpp>
+#include <ctime>
 #include <fstream>
 #include <iostream>
 #include <istream>
 #include <iterator>
+#include <map>
 #include <ostream>
 #include <string>
+#include <vector>
 
 #include "logging/logging.h"
 #include "uptane_repo.h"
@@ -21,6 +24,48 @@ KeyType parseKeyType(const po::variables_map &vm) {
   return key_type;
 }
 
+// A JSON list of targets, with the same keys as the options of the 'image'
+// command, plus the serial of an ECU to stage it for in the Director repo.
+std::vector<UptaneRepo::BatchImage> parseBatchManifest(const boost::filesystem::path &manifest_path,
+                                                       const boost::filesystem::path &repo_dir) {
+  const Json::Value manifest = Utils::parseJSONFile(manifest_path);
+  if (!manifest.isArray()) {
+    throw std::runtime_error("Batch manifest " + manifest_path.string() + " is not a list");
+  }
+  std::map<std::string, Delegation> delegations;
+  std::vector<UptaneRepo::BatchImage> batch;
+  for (const auto &entry : manifest) {
+    if (!entry.isMember("filename") || !entry.isMember("hwid")) {
+      throw std::runtime_error("Every target of the batch manifest requires filename and hwid");
+    }
+    UptaneRepo::BatchImage image;
+    image.image.image_path = entry["filename"].asString();
+    image.image.targetname = entry.get("targetname", entry["filename"]).asString();
+    image.image.hardware_id = entry["hwid"].asString();
+    image.image.url = entry.get("url", "").asString();
+    image.image.custom_version = entry.get("customversion", 0).asInt();
+    if (entry.isMember("targetcustom")) {
+      image.image.custom = entry["targetcustom"];
+    } else if (entry.isMember("targetformat")) {
+      image.image.custom["targetFormat"] = entry["targetformat"];
+    }
+    if (entry.isMember("dname")) {
+      const std::string dname = entry["dname"].asString();
+      if (delegations.count(dname) == 0) {
+        delegations.emplace(dname, Delegation(repo_dir, dname));
+      }
+      image.image.delegation = delegations[dname];
+      if (!image.image.delegation.isMatched(image.image.targetname)) {
+        throw std::runtime_error("Image path " + image.image.targetname.string() + " doesn't match delegation " +
+                                 dname);
+      }
+    }
+    image.ecu_serial = entry.get("serial", "").asString();
+    batch.push_back(std::move(image));
+  }
+  return batch;
+}
+
 void check_info_options(const po::options_description &description, const po::variables_map &vm) {
   if (vm.count("help") != 0 || (vm.count("command") == 0 && vm.count("version") == 0)) {
     std::cout << description << '\n';
@@ -42,6 +87,8 @@ int main(int argc, char **argv) {
                                           "adddelegation: \tadd a delegated role to the Image repo metadata\n"
                                           "revokedelegation: \tremove delegated role from the Image repo metadata and all signed targets of this role\n"
                                           "image: \tadd a target to the Image repo metadata\n"
+                                          "images: \tadd --count targets without files to the Image repo metadata\n"
+                                          "batch: \tadd the targets of a --manifest to the Image repo, staging them for their ECUs\n"
                                           "addtarget: \tprepare Director Targets metadata for a given device\n"
                                           "signtargets: \tsign the staged Director Targets metadata\n"
                                           "emptytargets: \tclear the staged Director Targets metadata\n"
@@ -49,7 +96,9 @@ int main(int argc, char **argv) {
                                           "sign: \tsign arbitrary metadata with repo keys\n"
                                           "addcampaigns: \tgenerate campaigns json\n"
                                           "refresh: \trefresh a metadata object (bump the version)\n"
-                                          "rotate: \trotate a Root metadata key")
+                                          "refreshexpiring: \tre-sign the metadata expiring --within the time\n"
+                                          "rotate: \trotate a Root metadata key\n"
+                                          "bundle: \twrite the signed metadata and the images of the Director Targets to an offline --bundle")
     ("path", po::value<boost::filesystem::path>(), "path to the repository")
     ("filename", po::value<boost::filesystem::path>(), "path to the image")
     ("hwid", po::value<std::string>(), "target hardware identifier")
@@ -70,7 +119,12 @@ int main(int argc, char **argv) {
     ("dparent", po::value<std::string>()->default_value("targets"), "delegated role parent name")
     ("dpattern", po::value<std::string>(), "delegated file path pattern")
     ("url", po::value<std::string>(), "custom download URL")
-    ("customversion", po::value<int32_t>(), "custom version");
+    ("customversion", po::value<int32_t>(), "custom version")
+    ("count", po::value<uint64_t>(), "number of targets for 'images' command, named <targetname>-<n>")
+    ("manifest", po::value<boost::filesystem::path>(), "JSON list of targets for 'batch' command")
+    ("within", po::value<uint64_t>()->default_value(86400), "seconds before expiration for 'refreshexpiring' command")
+    ("bundle", po::value<boost::filesystem::path>(), "offline bundle file for 'bundle' command")
+    ("jobs,j", po::value<unsigned>()->default_value(0), "threads for 'batch'/'refreshexpiring', 0 for one per core");
   // clang-format on
 
   po::positional_options_description positionalOptions;
@@ -170,6 +224,32 @@ int main(int argc, char **argv) {
                               delegation, custom);
           std::cout << "Added a custom image target " << targetname.string() << std::endl;
         }
+      } else if (command == "images") {
+        if (vm.count("targetname") == 0 || vm.count("hwid") == 0 || vm.count("count") == 0) {
+          std::cerr << "images command requires --targetname, --hwid and --count\n";
+          exit(EXIT_FAILURE);
+        }
+        const std::string prefix = vm["targetname"].as<std::string>();
+        const uint64_t count = vm["count"].as<uint64_t>();
+        const uint64_t length = (vm.count("targetlength") > 0) ? vm["targetlength"].as<uint64_t>() : 1024;
+        Delegation delegation;
+        if (vm.count("dname") != 0) {
+          delegation = Delegation(repo_dir, dname);
+          if (!delegation.isMatched(prefix + "-0")) {
+            std::cerr << "Image path doesn't match delegation!\n";
+            exit(EXIT_FAILURE);
+          }
+        }
+        repo.addGeneratedImages(prefix, count, length, vm["hwid"].as<std::string>(), delegation);
+        std::cout << "Added " << count << " targets " << prefix << "-<n> to the Image repo metadata" << std::endl;
+      } else if (command == "batch") {
+        if (vm.count("manifest") == 0) {
+          std::cerr << "batch command requires --manifest\n";
+          exit(EXIT_FAILURE);
+        }
+        const auto batch = parseBatchManifest(vm["manifest"].as<boost::filesystem::path>(), repo_dir);
+        repo.addImages(batch, vm["jobs"].as<unsigned>(), expiration_time);
+        std::cout << "Added " << batch.size() << " targets to the Image repo metadata" << std::endl;
       } else if (command == "addtarget") {
         if (vm.count("targetname") == 0 || vm.count("hwid") == 0 || vm.count("serial") == 0) {
           std::cerr << "addtarget command requires --targetname, --hwid, and --serial\n";
@@ -244,6 +324,31 @@ int main(int argc, char **argv) {
         }
         repo.refresh(Uptane::RepositoryType(vm["repotype"].as<std::string>()),
                      Uptane::Role(vm["keyname"].as<std::string>()));
+      } else if (command == "refreshexpiring") {
+        time_t threshold_time = std::time(nullptr) + static_cast<time_t>(vm["within"].as<uint64_t>());
+        struct tm threshold_tm {};
+        gmtime_r(&threshold_time, &threshold_tm);
+        std::vector<Uptane::RepositoryType> repo_types{Uptane::RepositoryType::Director(),
+                                                       Uptane::RepositoryType::Image()};
+        if (vm.count("repotype") != 0) {
+          repo_types = {Uptane::RepositoryType(vm["repotype"].as<std::string>())};
+        }
+        for (const auto &repo_type : repo_types) {
+          const auto refreshed = repo.refreshExpiring(repo_type, TimeStamp(threshold_tm), vm["jobs"].as<unsigned>());
+          std::cout << "Refreshed " << refreshed.size() << " roles of the " << repo_type.ToString() << " repo";
+          for (size_t i = 0; i < refreshed.size(); ++i) {
+            std::cout << (i == 0 ? ": " : ", ") << refreshed[i].ToString();
+          }
+          std::cout << std::endl;
+        }
+      } else if (command == "bundle") {
+        if (vm.count("bundle") == 0) {
+          std::cerr << "bundle command requires --bundle\n";
+          exit(EXIT_FAILURE);
+        }
+        const auto bundle = vm["bundle"].as<boost::filesystem::path>();
+        const size_t images = repo.writeBundle(bundle);
+        std::cout << "Wrote the offline bundle " << bundle.string() << " with " << images << " images" << std::endl;
       } else if (command == "rotate") {
         if (vm.count("repotype") == 0) {
           std::cerr << "refresh command requires --repotype\n";
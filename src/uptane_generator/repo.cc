@@ -1,9 +1,15 @@
 #include "repo.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <boost/filesystem.hpp>
 #include <ctime>
+#include <exception>
+#include <mutex>
 #include <regex>
+#include <set>
+#include <thread>
 
 #include "crypto/crypto.h"
 #include "director_repo.h"
@@ -48,11 +54,11 @@ void Repo::addDelegationToSnapshot(Json::Value *snapshot, const Uptane::Role &ro
   }
 }
 
-void Repo::updateRepo() {
+void Repo::updateRepo(const std::string &snapshot_expires, const std::string &timestamp_expires) {
   const Json::Value old_snapshot = Utils::parseJSONFile(repo_dir_ / "snapshot.json")["signed"];
   Json::Value snapshot;
   snapshot["_type"] = "Snapshot";
-  snapshot["expires"] = old_snapshot["expires"];
+  snapshot["expires"] = snapshot_expires.empty() ? old_snapshot["expires"] : Json::Value(snapshot_expires);
   snapshot["version"] = (old_snapshot["version"].asUInt()) + 1;
 
   const Json::Value root = Utils::parseJSONFile(repo_dir_ / "root.json")["signed"];
@@ -65,6 +71,9 @@ void Repo::updateRepo() {
 
   Json::Value timestamp = Utils::parseJSONFile(repo_dir_ / "timestamp.json")["signed"];
   timestamp["version"] = (timestamp["version"].asUInt()) + 1;
+  if (!timestamp_expires.empty()) {
+    timestamp["expires"] = timestamp_expires;
+  }
   timestamp["meta"]["snapshot.json"]["hashes"]["sha256"] = Crypto::sha256digestHex(signed_snapshot);
   timestamp["meta"]["snapshot.json"]["hashes"]["sha512"] = Crypto::sha512digestHex(signed_snapshot);
   timestamp["meta"]["snapshot.json"]["length"] = static_cast<Json::UInt>(signed_snapshot.length());
@@ -73,6 +82,44 @@ void Repo::updateRepo() {
                    Utils::jsonToCanonicalStr(signTuf(Uptane::Role::Timestamp(), timestamp)));
 }
 
+void Repo::runJobs(size_t count, unsigned jobs, const std::function<void(size_t)> &job) {
+  std::atomic<size_t> next{0};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto worker = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      try {
+        job(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> guard(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        next = count;
+      }
+    }
+  };
+
+  if (jobs == 0) {
+    jobs = std::max(1U, std::thread::hardware_concurrency());
+  }
+  jobs = static_cast<unsigned>(std::min<size_t>(jobs, count));
+  if (jobs <= 1) {
+    worker();
+  } else {
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < jobs; ++i) {
+      threads.emplace_back(worker);
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
 Json::Value Repo::signTuf(const Uptane::Role &role, const Json::Value &json) {
   auto key = keys_[role];
   return signTuf(key, json);
@@ -338,6 +385,77 @@ void Repo::refresh(const Uptane::Role &role, const TimeStamp &expiry) {
   updateRepo();
 }
 
+std::vector<Uptane::Role> Repo::refreshExpiring(const TimeStamp &threshold, unsigned jobs) {
+  struct StaleRole {
+    Uptane::Role role;
+    boost::filesystem::path path;
+    Json::Value meta;
+    std::string signed_meta;
+  };
+  std::vector<StaleRole> stale;
+  // a single scan of the Root, and of the Targets and their delegations
+  auto scan = [&](const Uptane::Role &role, const boost::filesystem::path &path) {
+    Json::Value meta = Utils::parseJSONFile(path)["signed"];
+    if (TimeStamp(meta["expires"].asString()).IsExpiredAt(threshold)) {
+      stale.push_back({role, path, meta, ""});
+    }
+    return meta;
+  };
+  scan(Uptane::Role::Root(), repo_dir_ / "root.json");
+  std::vector<Uptane::Role> targets_roles{Uptane::Role::Targets()};
+  std::set<std::string> seen{Uptane::Role::Targets().ToString()};
+  for (size_t i = 0; i < targets_roles.size(); ++i) {
+    const Uptane::Role role = targets_roles[i];
+    const Json::Value meta =
+        scan(role, role.IsDelegation() ? (repo_dir_ / "delegations" / (role.ToString() + ".json"))
+                                       : (repo_dir_ / "targets.json"));
+    for (const auto &delegation : meta["delegations"]["roles"]) {
+      if (seen.insert(delegation["name"].asString()).second) {
+        targets_roles.emplace_back(delegation["name"].asString(), true);
+      }
+    }
+  }
+
+  auto isStale = [&threshold](const boost::filesystem::path &path) {
+    return TimeStamp(Utils::parseJSONFile(path)["signed"]["expires"].asString()).IsExpiredAt(threshold);
+  };
+  const bool snapshot_stale = isStale(repo_dir_ / "snapshot.json");
+  const bool timestamp_stale = isStale(repo_dir_ / "timestamp.json");
+  if (stale.empty() && !snapshot_stale && !timestamp_stale) {
+    return {};
+  }
+
+  // keys_ is not changed while the roles are signed in parallel
+  for (const auto &role : stale) {
+    if (keys_.count(role.role) == 0) {
+      throw std::runtime_error("No key to refresh " + role.role.ToString());
+    }
+  }
+  runJobs(stale.size(), jobs, [&](size_t i) {
+    Json::Value &meta = stale[i].meta;
+    meta["version"] = meta["version"].asUInt() + 1;
+    meta["expires"] = expiration_time_;
+    stale[i].signed_meta = Utils::jsonToCanonicalStr(signTuf(keys_.at(stale[i].role), meta));
+  });
+
+  std::vector<Uptane::Role> refreshed;
+  for (const auto &role : stale) {
+    Utils::writeFile(role.path, role.signed_meta);
+    if (role.role == Uptane::Role::Root()) {
+      Utils::writeFile(repo_dir_ / (std::to_string(role.meta["version"].asUInt()) + ".root.json"), role.signed_meta);
+    }
+    refreshed.push_back(role.role);
+  }
+  updateRepo(snapshot_stale ? expiration_time_ : "", timestamp_stale ? expiration_time_ : "");
+  if (snapshot_stale) {
+    refreshed.push_back(Uptane::Role::Snapshot());
+  }
+  if (timestamp_stale) {
+    refreshed.push_back(Uptane::Role::Timestamp());
+  }
+  return refreshed;
+}
+
 void Repo::rotate(const Uptane::Role &role, KeyType key_type) {
   if (role != Uptane::Role::Root()) {
     throw std::runtime_error("Rotating the " + role.ToString() + " is not currently supported.");
@@ -3,8 +3,10 @@
 
 #include <fnmatch.h>
 #include <boost/filesystem/path.hpp>
+#include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "json/json.h"
 #include "libaktualizr/types.h"
@@ -42,6 +44,13 @@ class Repo {
   Json::Value signTuf(const Uptane::Role &role, const Json::Value &json);
   void generateCampaigns() const;
   void refresh(const Uptane::Role &role, const TimeStamp &expiry);
+  /**
+   * Re-sign every role that expires before `threshold`, including the
+   * delegations, with the expiration time of the repo. The stale roles are
+   * signed with `jobs` threads (0 for one per core), then Snapshot and
+   * Timestamp are written once. Returns the refreshed roles.
+   */
+  std::vector<Uptane::Role> refreshExpiring(const TimeStamp &threshold, unsigned jobs = 0);
   void rotate(const Uptane::Role &role, KeyType key_type = KeyType::kRSA2048);
 
  protected:
@@ -49,7 +58,11 @@ class Repo {
   void generateKeyPair(KeyType key_type, const Uptane::Role &key_name);
   static std::string getExpirationTime(const std::string &expires);
   void readKeys();
-  void updateRepo();
+  // empty expiration times are kept as they are
+  void updateRepo(const std::string &snapshot_expires = "", const std::string &timestamp_expires = "");
+  // job(0) to job(count - 1) with `jobs` threads (0 for one per core); the
+  // first exception is rethrown once they are done, and stops the others
+  static void runJobs(size_t count, unsigned jobs, const std::function<void(size_t)> &job);
   Uptane::RepositoryType repo_type_;
   boost::filesystem::path path_;
   boost::filesystem::path repo_dir_;
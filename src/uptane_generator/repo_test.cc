@@ -140,6 +140,106 @@ TEST(uptane_generator, add_image) {
   check_repo(temp_dir);
 }
 
+/*
+ * Add generated images to the Image repo, and one of them to the Director repo.
+ */
+TEST(uptane_generator, generated_images) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(key_type);
+  repo.addGeneratedImages("scale", 1000, 4096, "test-hw");
+  Json::Value image_targets = Utils::parseJSONFile(temp_dir.Path() / ImageRepo::dir / "targets.json");
+  EXPECT_EQ(image_targets["signed"]["targets"].size(), 1000);
+  // signed once for all of them
+  EXPECT_EQ(image_targets["signed"]["version"].asUInt(), 2);
+  EXPECT_EQ(image_targets["signed"]["targets"]["scale-999"]["length"].asUInt(), 4096);
+  EXPECT_EQ(image_targets["signed"]["targets"]["scale-999"]["custom"]["hardwareIds"][0].asString(), "test-hw");
+  repo.addTarget("scale-42", "test-hw", "test-serial");
+  repo.signTargets();
+  Json::Value director_targets = Utils::parseJSONFile(temp_dir.Path() / DirectorRepo::dir / "targets.json");
+  EXPECT_EQ(director_targets["signed"]["targets"].size(), 1);
+  check_repo(temp_dir);
+}
+
+/*
+ * Add a batch of images with several threads, some of them to a delegation and
+ * some to the Director repo, signing each role once.
+ */
+TEST(uptane_generator, batch_images) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(key_type);
+  repo.addDelegation(Uptane::Role("batch_delegate", true), Uptane::Role::Targets(), "delegated/*", false, key_type);
+
+  std::vector<UptaneRepo::BatchImage> batch;
+  for (int i = 0; i < 20; ++i) {
+    const std::string name = "image-" + std::to_string(i);
+    Utils::writeFile(temp_dir / "images" / name, name + std::string(static_cast<size_t>(i) * 10000, 'x'));
+    UptaneRepo::BatchImage image;
+    image.image.image_path = temp_dir / "images" / name;
+    image.image.targetname = (i < 5) ? "delegated/" + name : name;
+    image.image.hardware_id = "test-hw";
+    if (i < 5) {
+      image.image.delegation = Delegation(temp_dir.Path(), "batch_delegate");
+    }
+    if (i % 10 == 9) {
+      image.ecu_serial = "serial-" + std::to_string(i);
+    }
+    batch.push_back(image);
+  }
+  repo.addImages(batch, 4);
+
+  Json::Value image_targets = Utils::parseJSONFile(temp_dir.Path() / ImageRepo::dir / "targets.json")["signed"];
+  EXPECT_EQ(image_targets["targets"].size(), 15);
+  // signed once when added to, and once when the delegation was
+  EXPECT_EQ(image_targets["version"].asUInt(), 3);
+  const std::string content = Utils::readFile(temp_dir / "images/image-19");
+  EXPECT_EQ(image_targets["targets"]["image-19"]["length"].asUInt64(), content.size());
+  EXPECT_EQ(image_targets["targets"]["image-19"]["hashes"]["sha256"].asString(), Crypto::sha256digestHex(content));
+  EXPECT_EQ(image_targets["targets"]["image-19"]["hashes"]["sha512"].asString(), Crypto::sha512digestHex(content));
+  EXPECT_EQ(Utils::readFile(temp_dir.Path() / ImageRepo::dir / "targets/image-19"), content);
+  Json::Value delegated =
+      Utils::parseJSONFile(temp_dir.Path() / ImageRepo::dir / "delegations/batch_delegate.json")["signed"];
+  EXPECT_EQ(delegated["targets"].size(), 5);
+  EXPECT_EQ(delegated["version"].asUInt(), 2);
+
+  repo.signTargets();
+  Json::Value director_targets = Utils::parseJSONFile(temp_dir.Path() / DirectorRepo::dir / "targets.json");
+  EXPECT_EQ(director_targets["signed"]["targets"].size(), 2);
+  EXPECT_TRUE(director_targets["signed"]["targets"]["image-19"]["custom"]["ecuIdentifiers"].isMember("serial-19"));
+  check_repo(temp_dir);
+
+  // the same target twice is refused before anything is written
+  batch.push_back(batch.back());
+  EXPECT_THROW(repo.addImages(batch), std::runtime_error);
+}
+
+/*
+ * Add an image large enough to be hashed in parallel, and an empty one.
+ */
+TEST(uptane_generator, large_image) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(key_type);
+  std::string content(17 * 1024 * 1024, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>(i * 7 % 251);
+  }
+  Utils::writeFile(temp_dir / "images/large", content);
+  Utils::writeFile(temp_dir / "images/empty", std::string());
+  repo.addImage(temp_dir / "images/large", "large", "test-hw");
+  repo.addImage(temp_dir / "images/empty", "empty", "test-hw");
+
+  Json::Value targets = Utils::parseJSONFile(temp_dir.Path() / ImageRepo::dir / "targets.json")["signed"]["targets"];
+  EXPECT_EQ(targets["large"]["length"].asUInt64(), content.size());
+  EXPECT_EQ(targets["large"]["hashes"]["sha256"].asString(), Crypto::sha256digestHex(content));
+  EXPECT_EQ(targets["large"]["hashes"]["sha512"].asString(), Crypto::sha512digestHex(content));
+  EXPECT_EQ(Utils::readFile(temp_dir.Path() / ImageRepo::dir / "targets/large"), content);
+  EXPECT_EQ(targets["empty"]["length"].asUInt64(), 0);
+  EXPECT_EQ(targets["empty"]["hashes"]["sha256"].asString(), Crypto::sha256digestHex(""));
+  check_repo(temp_dir);
+}
+
 /*
  * Copy an image to the Director repo.
  */
@@ -621,6 +721,40 @@ TEST(uptane_generator, refreshImageTargets) {
   check_repo(temp_dir);
 }
 
+/*
+ * Refresh all the roles that expire soon, including a delegation, and only
+ * them.
+ */
+TEST(uptane_generator, refreshExpiring) {
+  TemporaryDirectory temp_dir;
+  {
+    UptaneRepo repo(temp_dir.Path(), "2040-01-01T00:00:00Z", "");
+    repo.generateRepo(key_type);
+    repo.addDelegation(Uptane::Role("expiring_delegate", true), Uptane::Role::Targets(), "delegated/*", false,
+                       key_type);
+  }
+  checkVersions(temp_dir, 1, 1, 1, 1, 1, 2, 2, 2);
+
+  UptaneRepo repo(temp_dir.Path(), "2050-01-01T00:00:00Z", "");
+  EXPECT_TRUE(repo.refreshExpiring(Uptane::RepositoryType::Image(), TimeStamp("2039-01-01T00:00:00Z"), 2).empty());
+  checkVersions(temp_dir, 1, 1, 1, 1, 1, 2, 2, 2);
+
+  const auto refreshed = repo.refreshExpiring(Uptane::RepositoryType::Image(), TimeStamp("2041-01-01T00:00:00Z"), 2);
+  EXPECT_EQ(refreshed.size(), 5);
+  // Snapshot and Timestamp are written once
+  checkVersions(temp_dir, 1, 1, 1, 1, 2, 3, 3, 3);
+  const Json::Value delegation =
+      Utils::parseJSONFile(temp_dir.Path() / ImageRepo::dir / "delegations/expiring_delegate.json")["signed"];
+  EXPECT_EQ(delegation["version"].asUInt(), 2);
+  EXPECT_EQ(delegation["expires"].asString(), "2050-01-01T00:00:00Z");
+  const Json::Value timestamp = Utils::parseJSONFile(temp_dir.Path() / ImageRepo::dir / "timestamp.json")["signed"];
+  EXPECT_EQ(timestamp["expires"].asString(), "2050-01-01T00:00:00Z");
+  EXPECT_TRUE(boost::filesystem::exists(temp_dir.Path() / ImageRepo::dir / "2.root.json"));
+  check_repo(temp_dir);
+
+  EXPECT_TRUE(repo.refreshExpiring(Uptane::RepositoryType::Image(), TimeStamp("2041-01-01T00:00:00Z")).empty());
+}
+
 void test_rotation(const Uptane::RepositoryType repo_type) {
   TemporaryDirectory temp_dir;
 
@@ -1,9 +1,12 @@
 
 #include "uptane_repo.h"
 
+#include "uptane/offline_bundle.h"
+#include "utilities/utils.h"
+
 UptaneRepo::UptaneRepo(const boost::filesystem::path &path, const std::string &expires,
                        const std::string &correlation_id)
-    : director_repo_(path, expires, correlation_id), image_repo_(path, expires, correlation_id) {}
+    : path_(path), director_repo_(path, expires, correlation_id), image_repo_(path, expires, correlation_id) {}
 
 void UptaneRepo::generateRepo(KeyType key_type) {
   director_repo_.generateRepo(key_type);
@@ -34,11 +37,35 @@ void UptaneRepo::addImage(const boost::filesystem::path &image_path, const boost
                           const Delegation &delegation, const Json::Value &custom) {
   image_repo_.addBinaryImage(image_path, targetname, hardware_id, url, custom_version, delegation, custom);
 }
+void UptaneRepo::addImages(const std::vector<BatchImage> &batch, const unsigned jobs, const std::string &expires) {
+  std::vector<ImageRepo::BinaryImage> images;
+  images.reserve(batch.size());
+  for (const auto &entry : batch) {
+    images.push_back(entry.image);
+  }
+  const Json::Value targets = image_repo_.addBinaryImages(images, jobs);
+
+  std::vector<DirectorRepo::Assignment> assignments;
+  for (const auto &entry : batch) {
+    if (!entry.ecu_serial.empty()) {
+      const std::string name = entry.image.targetname.string();
+      assignments.push_back(
+          DirectorRepo::Assignment{name, targets[name], entry.image.hardware_id, entry.ecu_serial, entry.image.url});
+    }
+  }
+  if (!assignments.empty()) {
+    director_repo_.addTargets(assignments, expires);
+  }
+}
 void UptaneRepo::addCustomImage(const std::string &name, const Hash &hash, uint64_t length,
                                 const std::string &hardware_id, const std::string &url, const int32_t custom_version,
                                 const Delegation &delegation, const Json::Value &custom) {
   image_repo_.addCustomImage(name, hash, length, hardware_id, url, custom_version, delegation, custom);
 }
+void UptaneRepo::addGeneratedImages(const std::string &prefix, const uint64_t count, const uint64_t length,
+                                    const std::string &hardware_id, const Delegation &delegation) {
+  image_repo_.addGeneratedImages(prefix, count, length, hardware_id, delegation);
+}
 
 void UptaneRepo::signTargets() { director_repo_.signTargets(); }
 void UptaneRepo::emptyTargets() { director_repo_.emptyTargets(); }
@@ -53,6 +80,16 @@ void UptaneRepo::refresh(Uptane::RepositoryType repo_type, const Uptane::Role &r
   }
 }
 
+std::vector<Uptane::Role> UptaneRepo::refreshExpiring(Uptane::RepositoryType repo_type, const TimeStamp &threshold,
+                                                      unsigned jobs) {
+  if (repo_type == Uptane::RepositoryType::Director()) {
+    return director_repo_.refreshExpiring(threshold, jobs);
+  } else if (repo_type == Uptane::RepositoryType::Image()) {
+    return image_repo_.refreshExpiring(threshold, jobs);
+  }
+  return {};
+}
+
 void UptaneRepo::rotate(Uptane::RepositoryType repo_type, const Uptane::Role &role, KeyType key_type) {
   if (repo_type == Uptane::RepositoryType::Director()) {
     director_repo_.rotate(role, key_type);
@@ -60,3 +97,47 @@ void UptaneRepo::rotate(Uptane::RepositoryType repo_type, const Uptane::Role &ro
     image_repo_.rotate(role, key_type);
   }
 }
+
+// All the versions of Root, the top-level roles and the delegations
+static void addBundleMetadata(Uptane::OfflineBundleWriter &bundle, Uptane::RepositoryType repo_type,
+                              const boost::filesystem::path &dir) {
+  for (int version = 1;; ++version) {
+    const boost::filesystem::path root = dir / (std::to_string(version) + ".root.json");
+    if (!boost::filesystem::exists(root)) {
+      break;
+    }
+    bundle.addMetadata(repo_type, Uptane::Role::Root(), Utils::readFile(root));
+  }
+  for (const auto &role : {Uptane::Role::Timestamp(), Uptane::Role::Snapshot(), Uptane::Role::Targets()}) {
+    const boost::filesystem::path meta = dir / (role.ToString() + ".json");
+    if (boost::filesystem::exists(meta)) {
+      bundle.addMetadata(repo_type, role, Utils::readFile(meta));
+    }
+  }
+  if (boost::filesystem::is_directory(dir / "delegations")) {
+    for (const auto &entry : boost::filesystem::directory_iterator(dir / "delegations")) {
+      if (entry.path().extension() == ".json") {
+        bundle.addMetadata(repo_type, Uptane::Role::Delegation(entry.path().stem().string()),
+                           Utils::readFile(entry.path()));
+      }
+    }
+  }
+}
+
+size_t UptaneRepo::writeBundle(const boost::filesystem::path &bundle_path) const {
+  Uptane::OfflineBundleWriter bundle(bundle_path);
+  addBundleMetadata(bundle, Uptane::RepositoryType::Director(), path_ / DirectorRepo::dir);
+  addBundleMetadata(bundle, Uptane::RepositoryType::Image(), path_ / ImageRepo::dir);
+
+  const Json::Value targets = Utils::parseJSONFile(path_ / DirectorRepo::dir / "targets.json")["signed"]["targets"];
+  for (auto it = targets.begin(); it != targets.end(); ++it) {
+    const std::string name = it.key().asString();
+    const boost::filesystem::path image = path_ / ImageRepo::dir / "targets" / name;
+    if (!boost::filesystem::is_regular_file(image)) {
+      throw std::runtime_error("No image of Target " + name + " at " + image.string() + " for the bundle");
+    }
+    bundle.addTarget(name, image);
+  }
+  bundle.finish();
+  return targets.size();
+}
@@ -6,6 +6,12 @@
 
 class UptaneRepo {
  public:
+  struct BatchImage {
+    ImageRepo::BinaryImage image;
+    // also staged in the Director Targets metadata for this ECU if not empty
+    std::string ecu_serial;
+  };
+
   UptaneRepo(const boost::filesystem::path &path, const std::string &expires, const std::string &correlation_id);
   void generateRepo(KeyType key_type = KeyType::kRSA2048);
   void addTarget(const std::string &target_name, const std::string &hardware_id, const std::string &ecu_serial,
@@ -16,6 +22,9 @@ class UptaneRepo {
   void addCustomImage(const std::string &name, const Hash &hash, uint64_t length, const std::string &hardware_id,
                       const std::string &url = "", int32_t custom_version = 0, const Delegation &delegation = {},
                       const Json::Value &custom = {});
+  void addImages(const std::vector<BatchImage> &batch, unsigned jobs = 0, const std::string &expires = "");
+  void addGeneratedImages(const std::string &prefix, uint64_t count, uint64_t length, const std::string &hardware_id,
+                          const Delegation &delegation = {});
   void addDelegation(const Uptane::Role &name, const Uptane::Role &parent_role, const std::string &path,
                      bool terminating, KeyType key_type);
   void revokeDelegation(const Uptane::Role &name);
@@ -24,9 +33,18 @@ class UptaneRepo {
   void oldTargets();
   void generateCampaigns();
   void refresh(Uptane::RepositoryType repo_type, const Uptane::Role &role, const TimeStamp &expiry = TimeStamp());
+  std::vector<Uptane::Role> refreshExpiring(Uptane::RepositoryType repo_type, const TimeStamp &threshold,
+                                            unsigned jobs = 0);
   void rotate(Uptane::RepositoryType repo_type, const Uptane::Role &role, KeyType key_type = KeyType::kRSA2048);
+  /**
+   * Write the signed metadata of both repositories and the images of the
+   * Targets signed by the Director to an offline bundle, see
+   * Uptane::OfflineBundle. Returns the number of images.
+   */
+  size_t writeBundle(const boost::filesystem::path &bundle_path) const;
 
  private:
+  boost::filesystem::path path_;
   DirectorRepo director_repo_;
   ImageRepo image_repo_;
 };
@@ -1,9 +1,18 @@
 #include "managedsecondary.h"
 
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <vector>
 
 #include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/filesystem.hpp>
 
 #include "crypto/crypto.h"
@@ -171,6 +180,65 @@ data::InstallationResult ManagedSecondary::sendFirmware(const Uptane::Target &ta
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 }
 
+// Copies the image in the kernel, without going through user space buffers:
+// with copy_file_range, which can share the data on filesystems that support
+// it, or with sendfile when the files are not on the same filesystem.
+static bool copyData(const TargetFileView &image, const int out) {
+  bool copy_range = true;
+  off_t offset = 0;
+  while (static_cast<uint64_t>(offset) < image.size()) {
+    const auto remaining = static_cast<size_t>(image.size() - static_cast<uint64_t>(offset));
+    ssize_t sent;
+    if (copy_range) {
+      loff_t in_offset = offset;
+      sent = copy_file_range(image.fd(), &in_offset, out, nullptr, remaining, 0);
+      if (sent < 0 && offset == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+        copy_range = false;
+        continue;
+      }
+      offset = in_offset;
+    } else {
+      sent = sendfile(out, image.fd(), &offset, remaining);
+    }
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      LOG_ERROR << "Can't write the image: " << (sent < 0 ? std::strerror(errno) : "unexpected end of file");
+      return false;
+    }
+  }
+  return true;
+}
+
+// The image is cloned when the filesystem can (reflink), so that the firmware
+// shares its blocks with the stored image, and copied otherwise. It is
+// written next to the previous firmware, which it then replaces atomically.
+static bool copyImage(const TargetFileView &image, const boost::filesystem::path &path) {
+  const boost::filesystem::path new_path = path.string() + ".new";
+  const int out = open(new_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (out < 0) {
+    LOG_ERROR << "Can't open " << new_path << ": " << std::strerror(errno);
+    return false;
+  }
+  bool ok = image.size() == 0;
+#ifdef FICLONE
+  ok = ok || ioctl(out, FICLONE, image.fd()) == 0;
+#endif
+  ok = ok || copyData(image, out);
+  if (close(out) != 0) {
+    ok = false;
+  }
+  if (ok && rename(new_path.c_str(), path.c_str()) != 0) {
+    LOG_ERROR << "Can't replace " << path << ": " << std::strerror(errno);
+    ok = false;
+  }
+  if (!ok) {
+    unlink(new_path.c_str());
+  }
+  return ok;
+}
+
 data::InstallationResult ManagedSecondary::install(const Uptane::Target &target,
                                                    const api::FlowControlToken *flow_control) {
   if (flow_control != nullptr && flow_control->hasAborted()) {
@@ -178,11 +246,13 @@ data::InstallationResult ManagedSecondary::install(const Uptane::Target &target,
   }
 
   // TODO: check that the target is actually valid.
-  auto str = secondary_provider_->getTargetFileHandle(target);
-  std::ofstream out_file(sconfig.firmware_path.string(), std::ios::binary);
-  out_file << str.rdbuf();
-  str.close();
-  out_file.close();
+  const auto image = secondary_provider_->getTargetFileView(target);
+  // the new file may have the same size and mtime as the old one
+  firmware_hash_ = FirmwareHash();
+  if (!copyImage(image, sconfig.firmware_path)) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                    "Could not write " + sconfig.firmware_path.string());
+  }
 
   Utils::writeFile(sconfig.target_name_path, target.filename());
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
@@ -216,21 +286,66 @@ Uptane::Manifest ManagedSecondary::getManifest() const {
 }
 
 bool ManagedSecondary::getFirmwareInfo(Uptane::InstalledImageInfo &firmware_info) const {
-  std::string content;
-
   if (!boost::filesystem::exists(sconfig.target_name_path) || !boost::filesystem::exists(sconfig.firmware_path)) {
     firmware_info.name = std::string("noimage");
-    content = "";
-  } else {
-    firmware_info.name = Utils::readFile(sconfig.target_name_path.string());
-    content = Utils::readFile(sconfig.firmware_path.string());
+    firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr("");
+    firmware_info.len = 0;
+    return true;
+  }
+  firmware_info.name = Utils::readFile(sconfig.target_name_path.string());
+
+  struct stat st {};
+  if (stat(sconfig.firmware_path.c_str(), &st) != 0) {
+    LOG_ERROR << "Can't stat " << sconfig.firmware_path << ": " << std::strerror(errno);
+    return false;
   }
-  firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr(content);
-  firmware_info.len = content.size();
+  const int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  FirmwareHash &cached = firmware_hash_;
+  if (cached.hash.empty() || cached.device != st.st_dev || cached.inode != st.st_ino ||
+      cached.size != static_cast<uint64_t>(st.st_size) || cached.mtime_ns != mtime_ns) {
+    FirmwareHash current;
+    if (!hashFirmware(sconfig.firmware_path, &current.hash, &current.size)) {
+      return false;
+    }
+    current.device = st.st_dev;
+    current.inode = st.st_ino;
+    current.mtime_ns = mtime_ns;
+    // written meanwhile: good for this manifest, not for the next ones
+    if (current.size != static_cast<uint64_t>(st.st_size)) {
+      current.mtime_ns = -1;
+    }
+    cached = std::move(current);
+  }
+  firmware_info.hash = cached.hash;
+  firmware_info.len = cached.size;
 
   return true;
 }
 
+bool ManagedSecondary::hashFirmware(const boost::filesystem::path &path, std::string *hash, uint64_t *len) {
+  std::ifstream file(path.string(), std::ios::binary);
+  if (!file) {
+    LOG_ERROR << "Can't open " << path;
+    return false;
+  }
+  MultiPartSHA256Hasher hasher;
+  std::vector<char> buf(64 * 1024);
+  *len = 0;
+  while (file) {
+    file.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    const auto read = static_cast<uint64_t>(file.gcount());
+    hasher.update(reinterpret_cast<const unsigned char *>(buf.data()), read);
+    *len += read;
+  }
+  if (file.bad()) {
+    LOG_ERROR << "Can't read " << path;
+    return false;
+  }
+  // think of unifying a hash case, we use both lower and upper cases
+  *hash = boost::algorithm::to_lower_copy(hasher.getHexDigest());
+  return true;
+}
+
 void ManagedSecondary::storeKeys(const std::string &pub_key, const std::string &priv_key) {
   Utils::writeFile((sconfig.full_client_dir / sconfig.ecu_private_key), priv_key);
   Utils::writeFile((sconfig.full_client_dir / sconfig.ecu_public_key), pub_key);
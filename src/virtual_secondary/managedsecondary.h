@@ -87,6 +87,9 @@ class ManagedSecondary : public SecondaryInterface {
 
  private:
   void storeKeys(const std::string& pub_key, const std::string& priv_key);
+  // Streams the firmware through the hasher, so that large images are not
+  // loaded in memory; false if it can't be read
+  static bool hashFirmware(const boost::filesystem::path& path, std::string* hash, uint64_t* len);
 
   int did_store_keys{0};  // For testing
   std::unique_ptr<Uptane::DirectorRepository> director_repo_;
@@ -95,6 +98,15 @@ class ManagedSecondary : public SecondaryInterface {
   std::string private_key;
   StorageConfig storage_config_;
   std::shared_ptr<INvStorage> storage_;
+  // hash of the firmware file, reused for as long as the file doesn't change
+  struct FirmwareHash {
+    uint64_t device{0};
+    uint64_t inode{0};
+    uint64_t size{0};
+    int64_t mtime_ns{-1};
+    std::string hash;
+  };
+  mutable FirmwareHash firmware_hash_;
 };
 
 }  // namespace Primary
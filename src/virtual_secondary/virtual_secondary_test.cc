@@ -3,6 +3,7 @@
 #include "httpfake.h"
 #include "libaktualizr/secondaryinterface.h"
 #include "uptane_repo.h"
+#include "uptane/manifest.h"
 #include "uptane_test_common.h"
 #include "utilities/utils.h"
 #include "virtualsecondary.h"
@@ -124,6 +125,28 @@ TEST_F(VirtualSecondaryTest, GeneratesPublicKey) {
   EXPECT_EQ(old_priv_key, new_priv_key);
 }
 
+/* The manifest reports the hash and length of the firmware file, and follows
+ * changes of the file. */
+TEST_F(VirtualSecondaryTest, FirmwareInfo) {
+  Primary::VirtualSecondary secondary(config_);
+  auto installed_image = [&secondary]() { return secondary.getManifest()["signed"]["installed_image"]; };
+  EXPECT_EQ(installed_image()["filepath"].asString(), "noimage");
+
+  Utils::writeFile(config_.target_name_path, std::string("firmware.bin"));
+  const std::string firmware(300 * 1024, 'a');
+  Utils::writeFile(config_.firmware_path, firmware);
+  EXPECT_EQ(installed_image()["filepath"].asString(), "firmware.bin");
+  EXPECT_EQ(installed_image()["fileinfo"]["length"].asUInt64(), firmware.size());
+  EXPECT_EQ(installed_image()["fileinfo"]["hashes"]["sha256"].asString(),
+            Uptane::ManifestIssuer::generateVersionHashStr(firmware));
+
+  const std::string other_firmware(100, 'b');
+  Utils::writeFile(config_.firmware_path, other_firmware);
+  EXPECT_EQ(installed_image()["fileinfo"]["length"].asUInt64(), other_firmware.size());
+  EXPECT_EQ(installed_image()["fileinfo"]["hashes"]["sha256"].asString(),
+            Uptane::ManifestIssuer::generateVersionHashStr(other_firmware));
+}
+
 #ifdef FIU_ENABLE
 
 #include "utilities/fault_injection.h"
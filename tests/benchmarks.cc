@@ -0,0 +1,284 @@
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "json/json.h"
+
+#include "asn1/asn1_message.h"
+#include "crypto/crypto.h"
+#include "crypto/signaturecache.h"
+#include "http/httprecorder.h"
+#include "http/httpreplay.h"
+#include "httpfake.h"
+#include "libaktualizr/config.h"
+#include "metafake.h"
+#include "primary/sotauptaneclient.h"
+#include "storage/sqlstorage.h"
+#include "uptane/tuf.h"
+#include "utilities/dequeue_buffer.h"
+#include "utilities/utils.h"
+
+// Microbenchmarks of the hot paths of libaktualizr, to follow them across
+// releases. Run with --benchmark_format=json or --benchmark_out=<file> for
+// machine readable results; the aktualizr_benchmarks target does the latter.
+
+static std::string makeTargets(int64_t count) {
+  Json::Value targets(Json::objectValue);
+  for (int64_t i = 0; i < count; i++) {
+    Json::Value target;
+    target["length"] = Json::Int64(1024 * 1024 + i);
+    target["hashes"]["sha256"] = std::string(64, 'a');
+    target["hashes"]["sha512"] = std::string(128, 'b');
+    target["custom"]["name"] = "image";
+    target["custom"]["version"] = std::to_string(i);
+    target["custom"]["hardwareIds"].append("primary_hw");
+    target["custom"]["targetFormat"] = "BINARY";
+    targets["image-" + std::to_string(i)] = target;
+  }
+  Json::Value doc;
+  doc["signed"]["_type"] = "Targets";
+  doc["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  doc["signed"]["version"] = 1;
+  doc["signed"]["targets"] = targets;
+  doc["signatures"] = Json::Value(Json::arrayValue);
+  return Utils::jsonToCanonicalStr(doc);
+}
+
+static void BM_JsonParse(benchmark::State &state) {
+  const std::string doc = makeTargets(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Utils::parseJSON(doc));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(doc.size()));
+}
+BENCHMARK(BM_JsonParse)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+static void BM_JsonCanonicalize(benchmark::State &state) {
+  const Json::Value json = Utils::parseJSON(makeTargets(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Utils::jsonToCanonicalStr(json));
+  }
+}
+BENCHMARK(BM_JsonCanonicalize)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+static void BM_TargetsConstruction(benchmark::State &state) {
+  const Json::Value json = Utils::parseJSON(makeTargets(state.range(0)));
+  for (auto _ : state) {
+    const Uptane::Targets targets(json);
+    benchmark::DoNotOptimize(targets.targets.size());
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_TargetsConstruction)->Arg(1000)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// Director metadata of the fake repository, signed with ED25519 keys
+class FakeRepo : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State &state) override {
+    (void)state;
+    temp_dir_ = std_::make_unique<TemporaryDirectory>();
+    CreateFakeRepoMetaData(temp_dir_->Path());
+    root_json_ = Utils::parseJSONFile(temp_dir_->Path() / "director/root.json");
+    targets_json_ = Utils::parseJSONFile(temp_dir_->Path() / "director/targets_hasupdates.json");
+  }
+  void TearDown(const benchmark::State &state) override {
+    (void)state;
+    temp_dir_.reset();
+  }
+
+ protected:
+  std::unique_ptr<TemporaryDirectory> temp_dir_;
+  Json::Value root_json_;
+  Json::Value targets_json_;
+};
+
+// range(0): whether the good signatures are cached, like when metadata is
+// loaded again from the storage
+BENCHMARK_DEFINE_F(FakeRepo, VerifyTargets)(benchmark::State &state) {
+  const auto root = std::make_shared<Uptane::Root>(Uptane::RepositoryType::Director(), root_json_);
+  const bool cached = state.range(0) != 0;
+  for (auto _ : state) {
+    if (!cached) {
+      SignatureCache::instance().clear();
+    }
+    const Uptane::Targets targets(Uptane::RepositoryType::Director(), Uptane::Role::Targets(), targets_json_, root);
+    benchmark::DoNotOptimize(targets.version());
+  }
+}
+BENCHMARK_REGISTER_F(FakeRepo, VerifyTargets)->Arg(0)->Arg(1);
+
+// range(0): Hash::Type, range(1): HashBackend
+static void BM_MultiPartHasher(benchmark::State &state) {
+  const std::string data(1024 * 1024, 'x');
+  const auto hasher =
+      MultiPartHasher::create(static_cast<Hash::Type>(state.range(0)), static_cast<HashBackend>(state.range(1)));
+  for (auto _ : state) {
+    hasher->reset();
+    hasher->update(reinterpret_cast<const unsigned char *>(data.data()), data.size());
+    benchmark::DoNotOptimize(hasher->getHexDigest());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(data.size()));
+}
+BENCHMARK(BM_MultiPartHasher)
+    ->Args({static_cast<int64_t>(Hash::Type::kSha256), static_cast<int64_t>(HashBackend::kSodium)})
+    ->Args({static_cast<int64_t>(Hash::Type::kSha256), static_cast<int64_t>(HashBackend::kOpenssl)})
+    ->Args({static_cast<int64_t>(Hash::Type::kSha512), static_cast<int64_t>(HashBackend::kSodium)})
+    ->Args({static_cast<int64_t>(Hash::Type::kSha512), static_cast<int64_t>(HashBackend::kOpenssl)});
+
+class Storage : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State &state) override {
+    temp_dir_ = std_::make_unique<TemporaryDirectory>();
+    StorageConfig config;
+    config.path = temp_dir_->Path();
+    storage_ = std_::make_unique<SQLStorage>(config, false);
+    metadata_ = makeTargets(state.range(0));
+    storage_->storeNonRoot(metadata_, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  }
+  void TearDown(const benchmark::State &state) override {
+    (void)state;
+    storage_.reset();
+    temp_dir_.reset();
+  }
+
+ protected:
+  std::unique_ptr<TemporaryDirectory> temp_dir_;
+  std::unique_ptr<SQLStorage> storage_;
+  std::string metadata_;
+};
+
+BENCHMARK_DEFINE_F(Storage, StoreNonRoot)(benchmark::State &state) {
+  for (auto _ : state) {
+    storage_->storeNonRoot(metadata_, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(metadata_.size()));
+}
+BENCHMARK_REGISTER_F(Storage, StoreNonRoot)->Arg(10)->Arg(1000);
+
+BENCHMARK_DEFINE_F(Storage, LoadNonRoot)(benchmark::State &state) {
+  std::string loaded;
+  for (auto _ : state) {
+    storage_->loadNonRoot(&loaded, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(metadata_.size()));
+}
+BENCHMARK_REGISTER_F(Storage, LoadNonRoot)->Arg(10)->Arg(1000);
+
+BENCHMARK_DEFINE_F(Storage, SaveReportEvent)(benchmark::State &state) {
+  Json::Value event;
+  event["id"] = "6b5d6e3c-0b6f-4a5e-8a1e-5e1f4d1e8b4a";
+  event["eventType"]["id"] = "EcuDownloadCompleted";
+  event["event"]["ecu"] = "primary";
+  event["event"]["success"] = true;
+  for (auto _ : state) {
+    storage_->saveReportEvent(event);
+  }
+}
+BENCHMARK_REGISTER_F(Storage, SaveReportEvent)->Arg(0);
+
+// Decoding a firmware chunk sent to a Secondary, of range(0) bytes, from
+// the receive buffer
+static void BM_Asn1Decode(benchmark::State &state) {
+  auto msg = Asn1Message::Empty();
+  msg->present(AKIpUptaneMes_PR_uploadDataReq);
+  const std::string payload(static_cast<size_t>(state.range(0)), 'x');
+  OCTET_STRING_fromBuf(&msg->uploadDataReq()->data, payload.data(), static_cast<int>(payload.size()));
+  std::string encoded;
+  if (!Asn1Encode(msg, &encoded)) {
+    state.SkipWithError("Could not encode the message");
+    return;
+  }
+
+  DequeueBuffer buffer;
+  for (auto _ : state) {
+    buffer.Reserve(encoded.size());
+    std::memcpy(buffer.Tail(), encoded.data(), encoded.size());
+    buffer.HaveEnqueued(encoded.size());
+    Asn1ReceiveStatus status;
+    // the buffered message is decoded without reading from the socket
+    const auto received = Asn1ReceiveMessage(-1, buffer, &status);
+    if (received->present() != AKIpUptaneMes_PR_uploadDataReq) {
+      state.SkipWithError("Could not decode the message");
+      return;
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(encoded.size()));
+}
+BENCHMARK(BM_Asn1Decode)->Arg(1024)->Arg(64 * 1024)->Arg(1024 * 1024);
+
+// A device of the fake server, without Secondaries
+static Config deviceConfig(const boost::filesystem::path &dir, const std::string &url) {
+  Config config("tests/config/basic.toml");
+  config.uptane.director_server = url + "/director";
+  config.uptane.repo_server = url + "/repo";
+  config.provision.server = url;
+  config.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  config.provision.primary_ecu_hardware_id = "primary_hw";
+  config.storage.path = dir;
+  config.pacman.images_path = dir / "images";
+  config.tls.server = url;
+  config.bootloader.reboot_sentinel_dir = dir;
+  return config;
+}
+
+// The metadata update of a provisioned device, over a link with a round trip
+// of 40 ms and 1 MB/s. The session is recorded against the fake server, then
+// replayed with its latency scaled by range(0) percent.
+class ReplayedSession : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State &state) override {
+    temp_dir_ = std_::make_unique<TemporaryDirectory>();
+    const boost::filesystem::path meta_dir = temp_dir_->Path() / "meta";
+    CreateFakeRepoMetaData(meta_dir);
+    boost::filesystem::create_directories(temp_dir_->Path() / "server");
+    const boost::filesystem::path recording = temp_dir_->Path() / "session.jsonl";
+    auto server = std::make_shared<HttpFake>(temp_dir_->Path() / "server", "noupdates", meta_dir);
+    {
+      Config config = deviceConfig(temp_dir_->Path() / "recorded", server->tls_server);
+      SotaUptaneClient client(config, INvStorage::newStorage(config.storage),
+                              std::make_shared<HttpRecorder>(server, recording), nullptr, nullptr);
+      client.initialize();
+      client.fetchMeta();
+    }
+    std::string profiled;
+    std::istringstream in(Utils::readFile(recording));
+    for (std::string line; std::getline(in, line);) {
+      HttpExchange exchange = HttpExchange::fromJson(Utils::parseJSON(line));
+      exchange.latency_ms = 40 + static_cast<double>(exchange.request_size + exchange.response_size) / 1000;
+      profiled += Utils::jsonToCanonicalStr(exchange.toJson()) + "\n";
+    }
+    Utils::writeFile(recording, profiled);
+
+    // the client keeps a reference to it
+    config_ = deviceConfig(temp_dir_->Path() / "replayed", server->tls_server);
+    client_ = std_::make_unique<SotaUptaneClient>(
+        config_, INvStorage::newStorage(config_.storage),
+        std::make_shared<HttpReplay>(recording, static_cast<double>(state.range(0)) / 100), nullptr, nullptr);
+    client_->initialize();
+  }
+  void TearDown(const benchmark::State &state) override {
+    (void)state;
+    client_.reset();
+    temp_dir_.reset();
+  }
+
+ protected:
+  std::unique_ptr<TemporaryDirectory> temp_dir_;
+  Config config_;
+  std::unique_ptr<SotaUptaneClient> client_;
+};
+
+BENCHMARK_DEFINE_F(ReplayedSession, FetchMeta)(benchmark::State &state) {
+  for (auto _ : state) {
+    if (client_->fetchMeta().status == result::UpdateStatus::kError) {
+      state.SkipWithError("Could not update the metadata");
+      return;
+    }
+  }
+}
+BENCHMARK_REGISTER_F(ReplayedSession, FetchMeta)->Arg(0)->Arg(100)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
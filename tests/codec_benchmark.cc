@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <boost/algorithm/hex.hpp>
+#include <boost/archive/iterators/base64_from_binary.hpp>
+#include <boost/archive/iterators/binary_from_base64.hpp>
+#include <boost/archive/iterators/remove_whitespace.hpp>
+#include <boost/archive/iterators/transform_width.hpp>
+
+#include "crypto/crypto.h"
+#include "utilities/utils.h"
+
+// Compare the base64 and hex codecs of Utils with the boost iterators they
+// replaced, on inputs the size of what metadata verification handles: RSA
+// signatures, ED25519 keys and sha256 digests.
+//
+// Usage: aktualizr-codec-benchmark [operations]
+
+using base64_text = boost::archive::iterators::base64_from_binary<
+    boost::archive::iterators::transform_width<std::string::const_iterator, 6, 8> >;
+
+using base64_to_bin = boost::archive::iterators::transform_width<
+    boost::archive::iterators::binary_from_base64<
+        boost::archive::iterators::remove_whitespace<std::string::const_iterator> >,
+    8, 6>;
+
+static std::string boostFromBase64(std::string base64_string) {
+  std::ptrdiff_t paddingChars = std::count(base64_string.begin(), base64_string.end(), '=');
+  std::replace(base64_string.begin(), base64_string.end(), '=', 'A');
+  std::string result(base64_to_bin(base64_string.begin()), base64_to_bin(base64_string.end()));
+  result.erase(result.end() - paddingChars, result.end());
+  return result;
+}
+
+static std::string boostToBase64(const std::string &tob64) {
+  std::string b64sig(base64_text(tob64.begin()), base64_text(tob64.end()));
+  b64sig.append((3 - tob64.length() % 3) % 3, '=');
+  return b64sig;
+}
+
+static double perSecond(unsigned int count, const std::function<bool()> &operation) {
+  const auto start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < count; i++) {
+    if (!operation()) {
+      return -1.;
+    }
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(count) / elapsed.count();
+}
+
+static bool report(const std::string &name, double speed) {
+  std::cout << std::left << std::setw(32) << name;
+  if (speed < 0) {
+    std::cout << "failed\n";
+    return false;
+  }
+  std::cout << std::fixed << std::setprecision(0) << speed << "\n";
+  return true;
+}
+
+int main(int argc, char **argv) {
+  unsigned int count = 100000;
+  if (argc > 1) {
+    count = static_cast<unsigned int>(std::strtoul(argv[1], nullptr, 10));  // NOLINT
+  }
+
+  std::string signature(256, '\0');
+  for (size_t i = 0; i < signature.size(); i++) {
+    signature[i] = static_cast<char>(i * 31 + 7);
+  }
+  const std::string signature_b64 = Utils::toBase64(signature);
+  const std::string digest = Crypto::sha256digest(signature);
+  const std::string digest_hex = Utils::toHex(digest);
+
+  std::cout << std::left << std::setw(32) << "operation"
+            << "per second\n";
+  bool ok = true;
+  ok &= report("base64 decode 256 B, boost",
+               perSecond(count, [&]() { return boostFromBase64(signature_b64) == signature; }));
+  ok &= report("base64 decode 256 B, table",
+               perSecond(count, [&]() { return Utils::fromBase64(signature_b64) == signature; }));
+  ok &= report("base64 encode 256 B, boost",
+               perSecond(count, [&]() { return boostToBase64(signature) == signature_b64; }));
+  ok &= report("base64 encode 256 B, table",
+               perSecond(count, [&]() { return Utils::toBase64(signature) == signature_b64; }));
+  ok &= report("hex decode 32 B, boost",
+               perSecond(count, [&]() { return boost::algorithm::unhex(digest_hex) == digest; }));
+  ok &= report("hex decode 32 B, table", perSecond(count, [&]() { return Utils::fromHex(digest_hex) == digest; }));
+  ok &= report("hex encode 32 B, boost",
+               perSecond(count, [&]() { return boost::algorithm::hex(digest) == digest_hex; }));
+  ok &= report("hex encode 32 B, table", perSecond(count, [&]() { return Utils::toHex(digest) == digest_hex; }));
+
+  const Hash expected(Hash::Type::kSha256, digest_hex);
+  ok &= report("Hash parse and compare", perSecond(count, [&]() {
+                 return Hash(Hash::Type::kSha256, digest_hex) == expected;
+               }));
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,6 +2,7 @@
 
 import argparse
 import contextlib
+import gzip
 import multiprocessing
 import logging
 import os
@@ -37,7 +38,8 @@ class Handler(SimpleHTTPRequestHandler):
     def _serve_simple(self, uri):
         with open(uri, 'rb') as source:
             while True:
-                data = source.read(1024)
+                # large enough for the tens of MB of metadata of the scale test
+                data = source.read(64 * 1024)
                 if not data:
                     break
                 self.wfile.write(data)
@@ -50,6 +52,7 @@ class Handler(SimpleHTTPRequestHandler):
             self.end_headers()
         else:
             self.send_response(200)
+            self.send_header('Content-Length', os.path.getsize(self.server.meta_path + uri))
             self.end_headers()
             self._serve_simple(self.server.meta_path + uri)
 
@@ -92,10 +95,12 @@ class Handler(SimpleHTTPRequestHandler):
             response_size = 100 * chunk_size
             if "Range" in self.headers:
                 r = self.headers["Range"]
-                r_from = int(r.split("=")[1].split("-")[0])
+                r_range = r.split("=")[1].split("-")
+                r_from = int(r_range[0])
+                r_to = int(r_range[1]) if r_range[1] else response_size - 1
                 self.send_response(206)
-                self.send_header('Content-Range', 'bytes %d-%d/%d' % (r_from, response_size-1, response_size))
-                response_size = response_size - r_from
+                self.send_header('Content-Range', 'bytes %d-%d/%d' % (r_from, r_to, response_size))
+                response_size = r_to - r_from + 1
             else:
                 self.send_response(200)
             self.send_header('Content-Type', 'application/json')
@@ -110,6 +115,36 @@ class Handler(SimpleHTTPRequestHandler):
                 self.wfile.write(b'@' * last_chunk)
             except ConnectionResetError:
                 return
+        elif self.path == '/conditional':
+            etag = '"v1"'
+            last_modified = 'Wed, 21 Oct 2015 07:28:00 GMT'
+            if self.headers.get('If-None-Match') == etag or \
+                    self.headers.get('If-Modified-Since') == last_modified:
+                self.send_response(304)
+                self.end_headers()
+                return
+            self.send_response(200)
+            self.send_header('ETag', etag)
+            self.send_header('Last-Modified', last_modified)
+            self.end_headers()
+            self.wfile.write(b'{"version": 1}')
+        elif self.path == '/gzip':
+            # only for clients that take compressed responses
+            if 'gzip' not in self.headers.get('Accept-Encoding', ''):
+                self.send_response(406)
+                self.end_headers()
+                return
+            body = gzip.compress(b'{"data": "' + b'a' * 100000 + b'"}')
+            self.send_response(200)
+            self.send_header('Content-Encoding', 'gzip')
+            self.send_header('Content-Length', len(body))
+            self.end_headers()
+            self.wfile.write(body)
+        elif self.path == '/retry_after':
+            self.send_response(200)
+            self.send_header('Retry-After', '120')
+            self.end_headers()
+            self.wfile.write(b'{}')
         elif self.path == '/slow_file':
             self.send_response(200)
             self.end_headers()
@@ -0,0 +1,73 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "crypto/crypto.h"
+
+// Compare the throughput of the multi part hasher backends.
+//
+// Usage: aktualizr-hash-benchmark [max size in MiB]
+// The default sizes are 1 MiB, 64 MiB and 1 GiB; sizes above the limit are
+// skipped. Data is fed in 1 MiB parts, like downloads are.
+
+static constexpr size_t kPartSize = 1U << 20U;
+
+static std::string backendName(HashBackend backend) {
+  return (backend == HashBackend::kOpenssl) ? "openssl" : "sodium";
+}
+
+static double hashThroughput(Hash::Type type, HashBackend backend, const std::vector<unsigned char> &part,
+                             uint64_t size, std::string *digest) {
+  auto hasher = MultiPartHasher::create(type, backend);
+  const auto start = std::chrono::steady_clock::now();
+  for (uint64_t hashed = 0; hashed < size; hashed += kPartSize) {
+    hasher->update(part.data(), part.size());
+  }
+  *digest = hasher->getHexDigest();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(size) / static_cast<double>(1U << 20U) / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  uint64_t max_mib = 1024;
+  if (argc > 1) {
+    max_mib = std::strtoull(argv[1], nullptr, 10);  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  }
+
+  std::vector<unsigned char> part(kPartSize);
+  for (size_t i = 0; i < part.size(); i++) {
+    part[i] = static_cast<unsigned char>(i * 31 + 7);
+  }
+
+  std::cout << "default backend: sha256 " << backendName(MultiPartHasher::defaultBackend(Hash::Type::kSha256))
+            << ", sha512 " << backendName(MultiPartHasher::defaultBackend(Hash::Type::kSha512)) << "\n\n";
+  std::cout << std::left << std::setw(8) << "hash" << std::setw(10) << "size" << std::setw(10) << "backend"
+            << "MiB/s\n";
+
+  bool ok = true;
+  for (const auto type : {Hash::Type::kSha256, Hash::Type::kSha512}) {
+    for (const uint64_t size_mib : {1U, 64U, 1024U}) {
+      if (size_mib > max_mib) {
+        continue;
+      }
+      std::string reference;
+      for (const auto backend : {HashBackend::kSodium, HashBackend::kOpenssl}) {
+        std::string digest;
+        const double speed = hashThroughput(type, backend, part, size_mib * kPartSize, &digest);
+        std::cout << std::left << std::setw(8) << Hash::TypeString(type) << std::setw(10)
+                  << (std::to_string(size_mib) + " MiB") << std::setw(10) << backendName(backend) << std::fixed
+                  << std::setprecision(1) << speed << "\n";
+        if (reference.empty()) {
+          reference = digest;
+        } else if (digest != reference) {
+          std::cerr << "Hash mismatch between backends for " << Hash::TypeString(type) << "\n";
+          ok = false;
+        }
+      }
+    }
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
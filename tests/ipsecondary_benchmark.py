@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+
+# End-to-end throughput of firmware updates sent by the Primary to IP
+# Secondaries over loopback. For each image size, a fresh Primary and N
+# Secondaries are updated in one `once` run; the transfer time comes from the
+# sendImagesToEcus span of the cycle trace and the RPC time from the metrics
+# file, both written by aktualizr itself (see the [metrics] section).
+
+import argparse
+import json
+import logging
+import resource
+import time
+
+from os import getcwd, chdir, path
+from uuid import uuid4
+
+from test_fixtures import Aktualizr, IPSecondary, KeyStore, UptaneTestRepo
+
+logger = logging.getLogger("IPSecondaryBenchmark")
+
+MB = 1024 * 1024
+
+
+def children_cpu_seconds():
+    usage = resource.getrusage(resource.RUSAGE_CHILDREN)
+    return usage.ru_utime + usage.ru_stime
+
+
+def metric_sum(metrics_file, name):
+    '''Sum of a summary over all its labels, 0 if it was never observed'''
+    total = 0.0
+    if not path.exists(metrics_file):
+        return total
+    with open(metrics_file) as f:
+        for line in f:
+            if line.startswith(name + '_sum'):
+                total += float(line.rsplit(' ', 1)[1])
+    return total
+
+
+def span_seconds(trace_file, name):
+    '''Duration of the longest span with that name, None if there is none'''
+    if not path.exists(trace_file):
+        return None
+    with open(trace_file) as f:
+        events = json.load(f)['traceEvents']
+    durations = [event['dur'] for event in events if event['name'] == name]
+    return max(durations) / 1e6 if durations else None
+
+
+def run_once(repo_manager_exe, size_mb, secondaries_num, timeout):
+    with UptaneTestRepo(repo_manager_exe) as uptane_repo, \
+            uptane_repo.create_generic_server() as uptane_server, \
+            uptane_repo.create_director_repo() as director:
+        secondaries = [IPSecondary(id=('secondary-hw-ID-001', str(uuid4())), output_logs=False)]
+        for _ in range(1, secondaries_num):
+            secondaries.append(IPSecondary(id=('secondary-hw-ID-001', str(uuid4())), output_logs=False,
+                                           primary_port=secondaries[0].primary_port))
+
+        aktualizr = Aktualizr(aktualizr_primary_exe='src/aktualizr_primary/aktualizr',
+                              aktualizr_info_exe='src/aktualizr_info/aktualizr-info',
+                              id=('primary-hw-ID-001', str(uuid4())), uptane_server=uptane_server,
+                              director=director, primary_port=secondaries[0].primary_port,
+                              secondaries=secondaries, output_logs=False)
+        metrics_file = path.join(path.dirname(aktualizr._config_file), 'metrics.prom')
+        trace_file = path.join(path.dirname(aktualizr._config_file), 'trace.json')
+        with open(aktualizr._config_file, 'a') as config_file:
+            config_file.write('[metrics]\npath = "{}"\ntrace_path = "{}"\ntrace_sample = 1\n'
+                              .format(metrics_file, trace_file))
+
+        # one image per Secondary, so that each of them gets its own transfer
+        for i, secondary in enumerate(secondaries):
+            uptane_repo.add_image(id=secondary.id, image_filename='image-{}.img'.format(i),
+                                  image_size=size_mb * MB)
+
+        # the image generation above runs in children too
+        cpu_start = children_cpu_seconds()
+        start = time.monotonic()
+        with aktualizr:
+            for secondary in secondaries:
+                secondary.__enter__()
+            try:
+                aktualizr.wait_for_completion(timeout)
+                elapsed = time.monotonic() - start
+            finally:
+                for secondary in secondaries:
+                    secondary.__exit__(None, None, None)
+        cpu = children_cpu_seconds() - cpu_start
+
+        total_mb = size_mb * secondaries_num
+        transfer = span_seconds(trace_file, 'sendImagesToEcus')
+        return {
+            'image_size_mb': size_mb,
+            'secondaries': secondaries_num,
+            'success': bool(director.get_install_result()),
+            'end_to_end_seconds': elapsed,
+            'download_seconds': metric_sum(metrics_file, 'aktualizr_image_fetch_seconds'),
+            'transfer_seconds': transfer,
+            'secondary_rpc_seconds': metric_sum(metrics_file, 'aktualizr_secondary_rpc_seconds'),
+            'throughput_mb_per_second': total_mb / transfer if transfer else None,
+            # of the Primary and all the Secondaries together
+            'cpu_seconds_per_mb': cpu / total_mb,
+        }
+
+
+def print_results(results):
+    print('{:>8} {:>4} {:>8} {:>10} {:>10} {:>10} {:>10} {:>8}'.format(
+          'size MB', 'ECUs', 'result', 'total s', 'download s', 'transfer s', 'MB/s', 'CPU s/MB'))
+    for r in results:
+        print('{:>8} {:>4} {:>8} {:>10.2f} {:>10.2f} {:>10} {:>10} {:>8.3f}'.format(
+              r['image_size_mb'], r['secondaries'], 'ok' if r['success'] else 'FAILED',
+              r['end_to_end_seconds'], r['download_seconds'],
+              '-' if r['transfer_seconds'] is None else '{:.2f}'.format(r['transfer_seconds']),
+              '-' if r['throughput_mb_per_second'] is None else '{:.1f}'.format(r['throughput_mb_per_second']),
+              r['cpu_seconds_per_mb']))
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+
+    parser = argparse.ArgumentParser(description='Benchmark firmware transfers to IP Secondaries')
+    parser.add_argument('-b', '--build-dir', help='build directory', default='build')
+    parser.add_argument('-s', '--src-dir', help='source directory', default='.')
+    parser.add_argument('-n', '--secondaries', help='number of Secondaries', type=int, default=1)
+    parser.add_argument('--sizes', help='comma separated image sizes in MB', default='1,10,100,1000')
+    parser.add_argument('-o', '--output', help='file to write the results to as JSON')
+    parser.add_argument('--timeout', help='timeout of each run in seconds', type=int, default=1800)
+
+    input_params = parser.parse_args()
+
+    KeyStore.base_dir = path.abspath(input_params.src_dir)
+    output = path.abspath(input_params.output) if input_params.output else None
+    repo_manager_exe = path.abspath(path.join(input_params.build_dir, 'src/uptane_generator/uptane-generator'))
+    initial_cwd = getcwd()
+    chdir(input_params.build_dir)
+
+    results = []
+    for size in [int(s) for s in input_params.sizes.split(',')]:
+        logger.info('Sending {} MB images to {} Secondaries'.format(size, input_params.secondaries))
+        results.append(run_once(repo_manager_exe, size, input_params.secondaries, input_params.timeout))
+
+    chdir(initial_cwd)
+    print_results(results)
+    if output:
+        with open(output, 'w') as f:
+            json.dump(results, f, indent=2)
+    exit(0 if all(r['success'] for r in results) else 1)
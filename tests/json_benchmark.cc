@@ -0,0 +1,93 @@
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "json/json.h"
+
+#include "uptane/tuf.h"
+#include "utilities/utils.h"
+
+// Measure how long parsing large Image repo Targets metadata takes.
+//
+// Usage: aktualizr-json-benchmark [number of targets]
+// The default is 40000 targets. The stream based parser is the one
+// Utils::parseJSON() used to go through.
+
+static std::string makeTargets(unsigned int count) {
+  Json::Value targets(Json::objectValue);
+  for (unsigned int i = 0; i < count; i++) {
+    Json::Value target;
+    target["length"] = 1024 * 1024 + i;
+    target["hashes"]["sha256"] = std::string(64, 'a');
+    target["hashes"]["sha512"] = std::string(128, 'b');
+    target["custom"]["name"] = "image";
+    target["custom"]["version"] = std::to_string(i);
+    target["custom"]["hardwareIds"].append("primary_hw");
+    target["custom"]["targetFormat"] = "BINARY";
+    target["custom"]["createdAt"] = "2020-10-27T10:00:00Z";
+    target["custom"]["updatedAt"] = "2020-10-27T10:00:00Z";
+    targets["image-" + std::to_string(i)] = target;
+  }
+  Json::Value doc;
+  doc["signed"]["_type"] = "Targets";
+  doc["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  doc["signed"]["version"] = 1;
+  doc["signed"]["targets"] = targets;
+  doc["signatures"] = Json::Value(Json::arrayValue);
+  return Utils::jsonToCanonicalStr(doc);
+}
+
+static Json::Value parseWithStream(const std::string &json_str) {
+  std::istringstream strs(json_str);
+  Json::Value json_value;
+  parseFromStream(Json::CharReaderBuilder(), strs, &json_value, nullptr);
+  return json_value;
+}
+
+// peak resident memory of the process so far, in MiB
+static double peakMemory() {
+  struct rusage usage {};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_maxrss) / 1024.;
+}
+
+template <typename F>
+static double measure(F f) {
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() * 1000.;
+}
+
+int main(int argc, char **argv) {
+  unsigned int count = 40000;
+  if (argc > 1) {
+    count = static_cast<unsigned int>(std::strtoul(argv[1], nullptr, 10));  // NOLINT
+  }
+
+  const std::string doc = makeTargets(count);
+  std::cout << count << " targets, " << std::fixed << std::setprecision(1)
+            << static_cast<double>(doc.size()) / (1024. * 1024.) << " MiB\n";
+  std::cout << "peak memory before parsing: " << peakMemory() << " MiB\n\n";
+
+  size_t parsed_targets = 0;
+  const double stream_ms = measure([&doc]() { parseWithStream(doc); });
+  const double parse_ms = measure([&doc]() { Utils::parseJSON(doc); });
+  const Json::Value json = Utils::parseJSON(doc);
+  const double targets_ms = measure([&json, &parsed_targets]() {
+    const Uptane::Targets targets(json);
+    parsed_targets = targets.targets.size();
+  });
+  const double canonical_ms = measure([&json]() { Utils::jsonToCanonicalStr(json); });
+
+  std::cout << std::left << std::setw(28) << "stream parser" << stream_ms << " ms\n";
+  std::cout << std::left << std::setw(28) << "Utils::parseJSON" << parse_ms << " ms\n";
+  std::cout << std::left << std::setw(28) << "Uptane::Targets" << targets_ms << " ms\n";
+  std::cout << std::left << std::setw(28) << "Utils::jsonToCanonicalStr" << canonical_ms << " ms\n";
+  std::cout << "\npeak memory: " << peakMemory() << " MiB\n";
+  return (parsed_targets == count) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+
+# Metadata update of a Primary with many Secondaries against a large Image
+# repo: 100k targets, a chain of delegations and 50 virtual Secondaries by
+# default. Each run of `aktualizr check` (fetchMeta and checkUpdates) reports
+# its duration, peak RSS and the size of the storage afterwards, the first run
+# with an empty storage and the next ones with the metadata already stored.
+# The metadata fetch times come from the [metrics] file of aktualizr.
+
+import argparse
+import json
+import logging
+import os
+import subprocess
+import time
+
+from os import getcwd, chdir, path
+from uuid import uuid4
+
+from test_fixtures import Aktualizr, KeyStore, UptaneTestRepo
+
+logger = logging.getLogger("ScaleTest")
+
+HW_ID = 'scale-hw-ID-001'
+
+
+def generate_repo(uptane_repo, targets_num, depth, delegated_num):
+    def run(*args):
+        subprocess.run([uptane_repo._repo_manager_exe, '--path', uptane_repo.root_dir] + list(args),
+                       check=True, stdout=subprocess.DEVNULL)
+
+    run('--command', 'images', '--targetname', 'scale', '--count', str(targets_num), '--hwid', HW_ID)
+
+    # each level delegates the same paths to the next one, so that the targets
+    # of the last level are only found after going through all of them
+    parent = 'targets'
+    for level in range(depth):
+        name = 'level-{}'.format(level)
+        run('--command', 'adddelegation', '--dname', name, '--dparent', parent, '--dpattern', 'deep/*',
+            '--keytype', 'ED25519')
+        parent = name
+    if depth > 0:
+        run('--command', 'images', '--targetname', 'deep/scale', '--count', str(delegated_num), '--hwid', HW_ID,
+            '--dname', parent)
+
+
+def add_secondaries(aktualizr, uptane_repo, ecus_num, targets_num, depth, delegated_num):
+    '''Virtual Secondaries, each with a target of the top-level or of the last delegation'''
+    storage_dir = path.dirname(aktualizr._config_file)
+    secondaries = []
+    for i in range(ecus_num):
+        serial = str(uuid4())
+        client_dir = path.join(storage_dir, 'secondary-{}'.format(i))
+        secondaries.append({
+            'partial_verifying': False,
+            'ecu_serial': serial,
+            'ecu_hardware_id': HW_ID,
+            'full_client_dir': client_dir,
+            'ecu_private_key': 'sec.private',
+            'ecu_public_key': 'sec.public',
+            'firmware_path': path.join(client_dir, 'firmware.bin'),
+            'target_name_path': path.join(client_dir, 'target_name'),
+            'metadata_path': path.join(client_dir, 'metadata'),
+        })
+        if depth > 0 and delegated_num > 0 and i % 2:
+            target_name = 'deep/scale-{}'.format(i % delegated_num)
+        else:
+            target_name = 'scale-{}'.format(i % targets_num)
+        subprocess.run([uptane_repo._repo_manager_exe, '--path', uptane_repo.root_dir, '--command', 'addtarget',
+                        '--targetname', target_name, '--hwid', HW_ID, '--serial', serial],
+                       check=True, stdout=subprocess.DEVNULL)
+    subprocess.run([uptane_repo._repo_manager_exe, '--path', uptane_repo.root_dir, '--command', 'signtargets'],
+                   check=True, stdout=subprocess.DEVNULL)
+
+    with open(aktualizr._secondary_config_file, 'w') as config_file:
+        json.dump({'virtual': secondaries}, config_file)
+
+
+def fetch_seconds(metrics_file):
+    '''Metadata fetch time by repo and role, from the summaries of the metrics file'''
+    res = {}
+    if not path.exists(metrics_file):
+        return res
+    with open(metrics_file) as f:
+        for line in f:
+            if line.startswith('aktualizr_metadata_fetch_seconds_sum'):
+                labels, value = line.rsplit(' ', 1)
+                res[labels[labels.index('{') + 1:labels.index('}')]] = float(value)
+    return res
+
+
+def run_check(aktualizr, metrics_file, timeout):
+    start = time.monotonic()
+    process = subprocess.Popen([aktualizr._aktualizr_primary_exe, '-c', aktualizr._config_file, '--run-mode', 'check'],
+                               stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    deadline = start + timeout
+    while True:
+        # wait4 rather than wait, for the peak RSS of this process only
+        pid, status, usage = os.wait4(process.pid, os.WNOHANG)
+        if pid != 0:
+            break
+        if time.monotonic() > deadline:
+            process.kill()
+            pid, status, usage = os.wait4(process.pid, 0)
+            break
+        time.sleep(0.05)
+    elapsed = time.monotonic() - start
+    # reaped already, which Popen has to know
+    process.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+
+    storage_dir = path.dirname(aktualizr._config_file)
+    # large metadata is kept in files next to the database
+    meta_dir = path.join(storage_dir, 'sql.db-meta')
+    storage_bytes = path.getsize(path.join(storage_dir, 'sql.db'))
+    if path.isdir(meta_dir):
+        storage_bytes += sum(path.getsize(path.join(meta_dir, name)) for name in os.listdir(meta_dir))
+    return {
+        'success': process.returncode == 0,
+        'seconds': elapsed,
+        'cpu_seconds': usage.ru_utime + usage.ru_stime,
+        'peak_rss_mb': usage.ru_maxrss / 1024,
+        'storage_mb': storage_bytes / (1024 * 1024),
+        'fetch_seconds': fetch_seconds(metrics_file),
+    }
+
+
+def run_scale_test(repo_manager_exe, targets_num, depth, delegated_num, ecus_num, runs, timeout):
+    with UptaneTestRepo(repo_manager_exe) as uptane_repo, uptane_repo.create_generic_server() as uptane_server:
+        logger.info('Generating {} targets, {} levels of delegations with {} targets and {} ECUs'.format(
+                    targets_num, depth, delegated_num, ecus_num))
+        generate_repo(uptane_repo, targets_num, depth, delegated_num)
+        aktualizr = Aktualizr(aktualizr_primary_exe=path.abspath('src/aktualizr_primary/aktualizr'),
+                              aktualizr_info_exe=path.abspath('src/aktualizr_info/aktualizr-info'),
+                              id=('primary-hw-ID-001', str(uuid4())), uptane_server=uptane_server,
+                              output_logs=False)
+        add_secondaries(aktualizr, uptane_repo, ecus_num, targets_num, depth, delegated_num)
+        targets_mb = path.getsize(uptane_repo.target_file) / (1024 * 1024)
+
+        metrics_file = path.join(path.dirname(aktualizr._config_file), 'metrics.prom')
+        with open(aktualizr._config_file, 'a') as config_file:
+            config_file.write('[metrics]\npath = "{}"\n'.format(metrics_file))
+
+        results = []
+        for i in range(runs):
+            result = run_check(aktualizr, metrics_file, timeout)
+            result.update({'run': i, 'targets': targets_num, 'targets_json_mb': targets_mb,
+                           'delegation_depth': depth, 'delegated_targets': delegated_num, 'ecus': ecus_num})
+            results.append(result)
+        return results
+
+
+def print_results(results):
+    print('{:>4} {:>8} {:>10} {:>10} {:>12} {:>11}  {}'.format(
+          'run', 'result', 'total s', 'CPU s', 'peak RSS MB', 'storage MB', 'metadata fetch s'))
+    for r in results:
+        print('{:>4} {:>8} {:>10.2f} {:>10.2f} {:>12.1f} {:>11.1f}  {}'.format(
+              r['run'], 'ok' if r['success'] else 'FAILED', r['seconds'], r['cpu_seconds'], r['peak_rss_mb'],
+              r['storage_mb'], ', '.join('{}: {:.2f}'.format(k, v) for k, v in sorted(r['fetch_seconds'].items()))))
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+
+    parser = argparse.ArgumentParser(description='Test aktualizr with a large repo and many ECUs')
+    parser.add_argument('-b', '--build-dir', help='build directory', default='build')
+    parser.add_argument('-s', '--src-dir', help='source directory', default='.')
+    parser.add_argument('--targets', help='number of top-level Image repo targets', type=int, default=100000)
+    parser.add_argument('--depth', help='levels of delegations', type=int, default=8)
+    parser.add_argument('--delegated-targets', help='number of targets of the last delegation', type=int,
+                        default=10000)
+    parser.add_argument('--ecus', help='number of Secondaries', type=int, default=50)
+    parser.add_argument('--runs', help='number of metadata updates', type=int, default=2)
+    parser.add_argument('--timeout', help='timeout of each run in seconds', type=int, default=600)
+    parser.add_argument('-o', '--output', help='file to write the results to as JSON')
+
+    input_params = parser.parse_args()
+
+    KeyStore.base_dir = path.abspath(input_params.src_dir)
+    output = path.abspath(input_params.output) if input_params.output else None
+    initial_cwd = getcwd()
+    chdir(input_params.build_dir)
+
+    results = run_scale_test(path.abspath('src/uptane_generator/uptane-generator'), input_params.targets,
+                             input_params.depth, input_params.delegated_targets, input_params.ecus,
+                             input_params.runs, input_params.timeout)
+
+    chdir(initial_cwd)
+    print_results(results)
+    if output:
+        with open(output, 'w') as f:
+            json.dump(results, f, indent=2)
+    exit(0 if all(r['success'] for r in results) else 1)
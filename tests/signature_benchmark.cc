@@ -0,0 +1,104 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <boost/algorithm/hex.hpp>
+
+#include "crypto/crypto.h"
+#include "utilities/utils.h"
+
+// Compare signing and verification with the key parsed from its PEM on every
+// call against a key parsed once, like PublicKey and KeyManager keep it.
+//
+// Usage: aktualizr-signature-benchmark [operations]
+// Every message is different, so that no signature is looked up in the
+// signature cache.
+
+static double perSecond(unsigned int count, const std::function<bool(unsigned int)> &operation) {
+  const auto start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < count; i++) {
+    if (!operation(i)) {
+      return -1.;
+    }
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(count) / elapsed.count();
+}
+
+static bool report(const std::string &name, double speed) {
+  std::cout << std::left << std::setw(28) << name;
+  if (speed < 0) {
+    std::cout << "failed\n";
+    return false;
+  }
+  std::cout << std::fixed << std::setprecision(0) << speed << "\n";
+  return true;
+}
+
+static std::string message(unsigned int i) { return "{\"signed\":{\"version\":" + std::to_string(i) + "}}"; }
+
+int main(int argc, char **argv) {
+  unsigned int count = 1000;
+  if (argc > 1) {
+    count = static_cast<unsigned int>(std::strtoul(argv[1], nullptr, 10));  // NOLINT
+  }
+
+  std::cout << std::left << std::setw(28) << "operation"
+            << "per second\n";
+  bool ok = true;
+
+  std::string rsa_public;
+  std::string rsa_private;
+  if (!Crypto::generateKeyPair(KeyType::kRSA2048, &rsa_public, &rsa_private)) {
+    std::cerr << "Could not generate an RSA key\n";
+    return EXIT_FAILURE;
+  }
+  const auto rsa_signing = Crypto::parseRSAPrivateKey(rsa_private);
+  const std::string rsa_signature = Crypto::RSAPSSSign(rsa_signing.get(), message(0));
+
+  ok &= report("rsa2048 sign, parse PEM", perSecond(count, [&](unsigned int i) {
+                 return !Crypto::RSAPSSSign(nullptr, rsa_private, message(i)).empty();
+               }));
+  ok &= report("rsa2048 sign, cached", perSecond(count, [&](unsigned int i) {
+                 return !Crypto::RSAPSSSign(rsa_signing.get(), message(i)).empty();
+               }));
+
+  // the same signature over different messages: every verification fails
+  // after the full amount of work
+  const auto rsa_verifying = Crypto::parseRSAPublicKey(rsa_public);
+  ok &= report("rsa2048 verify, parse PEM", perSecond(count, [&](unsigned int i) {
+                 return !Crypto::RSAPSSVerify(rsa_public, rsa_signature, message(i + 1));
+               }));
+  ok &= report("rsa2048 verify, cached", perSecond(count, [&](unsigned int i) {
+                 return !Crypto::RSAPSSVerify(rsa_verifying.get(), rsa_signature, message(i + 1));
+               }));
+  const PublicKey rsa_key(rsa_public, KeyType::kRSA2048);
+  ok &= report("rsa2048 PublicKey verify", perSecond(count, [&](unsigned int i) {
+                 return !rsa_key.VerifySignature(Utils::toBase64(rsa_signature), message(i + 1));
+               }));
+
+  std::string ed_public;
+  std::string ed_private;
+  if (!Crypto::generateKeyPair(KeyType::kED25519, &ed_public, &ed_private)) {
+    std::cerr << "Could not generate an ED25519 key\n";
+    return EXIT_FAILURE;
+  }
+  const std::string ed_private_bin = boost::algorithm::unhex(ed_private);
+  const std::string ed_public_bin = boost::algorithm::unhex(ed_public);
+  const std::string ed_signature = Crypto::ED25519Sign(ed_private_bin, message(0));
+  ok &= report("ed25519 sign", perSecond(count, [&](unsigned int i) {
+                 return !Crypto::ED25519Sign(ed_private_bin, message(i)).empty();
+               }));
+  ok &= report("ed25519 verify", perSecond(count, [&](unsigned int i) {
+                 return !Crypto::ED25519Verify(ed_public_bin, ed_signature, message(i + 1));
+               }));
+  const PublicKey ed_key(ed_public, KeyType::kED25519);
+  ok &= report("ed25519 PublicKey verify", perSecond(count, [&](unsigned int i) {
+                 return !ed_key.VerifySignature(Utils::toBase64(ed_signature), message(i + 1));
+               }));
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,315 @@
+#!/usr/bin/env python3
+
+# Throughput of garage-push against a Treehub mock that adds a round-trip time
+# to each request, shares a link of limited bandwidth between the uploads and
+# fails requests at random. A synthetic OSTree repository is generated for each
+# size and number of files. The mock counts the requests by kind and samples
+# the number of them in flight, which RequestPool keeps at the limit set by its
+# RateController as long as it has objects to check or upload.
+
+import argparse
+import io
+import json
+import logging
+import random
+import re
+import subprocess
+import tarfile
+import threading
+import time
+
+from collections import Counter
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from os import makedirs, path
+from tempfile import TemporaryDirectory
+
+logger = logging.getLogger("GaragePushBenchmark")
+
+MB = 1024 * 1024
+FILES_PER_DIRECTORY = 256
+
+
+def create_repo(repo_dir, files, size_mb, seed):
+    '''OSTree repository with one commit on master of `files` random files
+    totalling size_mb, in directories of FILES_PER_DIRECTORY files'''
+    rng = random.Random(seed)
+    tree = path.join(repo_dir, 'tree')
+    file_size = max(1, size_mb * MB // files)
+    for i in range(files):
+        directory = path.join(tree, 'd{:04d}'.format(i // FILES_PER_DIRECTORY))
+        makedirs(directory, exist_ok=True)
+        with open(path.join(directory, 'f{:06d}.bin'.format(i)), 'wb') as f:
+            f.write(rng.getrandbits(8 * file_size).to_bytes(file_size, 'little'))
+
+    repo = path.join(repo_dir, 'repo')
+    subprocess.run(['ostree', 'init', '--mode=archive-z2', '--repo={}'.format(repo)], check=True)
+    subprocess.run(['ostree', '--repo={}'.format(repo), 'commit', '--consume', '--branch=master',
+                    '--owner-uid=0', '--owner-gid=0', '--no-xattrs',
+                    '--timestamp=1970-01-01 00:00:00 +0000', tree],
+                   check=True, stdout=subprocess.DEVNULL)
+    return repo
+
+
+class MockTreehub(object):
+    '''State of the mock, shared by the threads serving the requests'''
+
+    def __init__(self, rtt, bandwidth, error_rate, batch, bundle, seed):
+        self.rtt = rtt
+        # bytes per second, 0 for unlimited
+        self.bandwidth = bandwidth
+        self.error_rate = error_rate
+        self.batch = batch
+        self.bundle = bundle
+        self.objects = set()
+        self.requests = Counter()
+        self.errors = 0
+        self.bytes_received = 0
+        self.in_flight = 0
+        self.first_request = None
+        self.last_response = None
+        self._link_free_at = 0.0
+        self._random = random.Random(seed)
+        self._lock = threading.Lock()
+
+    def begin(self, kind):
+        with self._lock:
+            self.requests[kind] += 1
+            self.in_flight += 1
+            if self.first_request is None and kind != 'ref':
+                self.first_request = time.monotonic()
+
+    def end(self, kind):
+        with self._lock:
+            self.in_flight -= 1
+            if kind != 'ref':
+                self.last_response = time.monotonic()
+
+    def receive(self, length):
+        '''Wait for `length` bytes to go through the link, after the ones
+        already sent by other requests'''
+        if self.bandwidth <= 0:
+            return
+        with self._lock:
+            self.bytes_received += length
+            now = time.monotonic()
+            self._link_free_at = max(now, self._link_free_at) + length / self.bandwidth
+            wait = self._link_free_at - now
+        time.sleep(wait)
+
+    def fails(self):
+        with self._lock:
+            failed = self._random.random() < self.error_rate
+            if failed:
+                self.errors += 1
+            return failed
+
+    def add(self, paths):
+        with self._lock:
+            self.objects.update(paths)
+
+    def present(self, paths):
+        with self._lock:
+            return [p for p in paths if p in self.objects]
+
+
+class MockTreehubHandler(BaseHTTPRequestHandler):
+    # keep the connections open, as Treehub does
+    protocol_version = 'HTTP/1.1'
+    treehub = None
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_HEAD(self):
+        self._serve('query', lambda name, body: (200 if self.treehub.present([name]) else 404, b''))
+
+    def do_POST(self):
+        name = self._name()
+        if name == 'objects-query':
+            self._serve('batch-query', self._batch_query)
+        elif name == 'objects-bundle':
+            self._serve('bundle', self._bundle)
+        elif name.startswith('objects/'):
+            self._serve('upload', self._upload)
+        elif name.startswith('refs/'):
+            self._serve('ref', lambda name, body: (200, b''))
+        else:
+            self._serve('other', lambda name, body: (400, b''))
+
+    do_PUT = do_POST
+
+    def _name(self):
+        return self.path.lstrip('/')
+
+    def _serve(self, kind, respond):
+        self.treehub.begin(kind)
+        try:
+            length = int(self.headers.get('Content-Length', 0))
+            self.treehub.receive(length)
+            body = self.rfile.read(length)
+            time.sleep(self.treehub.rtt)
+            if kind != 'ref' and self.treehub.fails():
+                code, response = 503, b'Service unavailable'
+            else:
+                code, response = respond(self._name(), body)
+            self.send_response(code)
+            self.send_header('Content-Length', str(len(response)))
+            self.end_headers()
+            if self.command != 'HEAD':
+                self.wfile.write(response)
+        finally:
+            self.treehub.end(kind)
+
+    def _upload(self, name, body):
+        self.treehub.add([name])
+        return 204, b''
+
+    def _batch_query(self, name, body):
+        if not self.treehub.batch:
+            return 404, b''
+        return 200, json.dumps(self.treehub.present(json.loads(body))).encode('utf-8')
+
+    def _bundle(self, name, body):
+        if not self.treehub.bundle:
+            return 404, b''
+        with tarfile.open(fileobj=io.BytesIO(body), mode='r:*') as archive:
+            self.treehub.add([m.name for m in archive.getmembers() if m.isfile()])
+        return 204, b''
+
+
+class MockTreehubServer(ThreadingHTTPServer):
+    daemon_threads = True
+    # garage-push may open up to --jobs connections at once
+    request_queue_size = 1024
+
+
+def sample_concurrency(treehub, interval, stop, timeline):
+    start = time.monotonic()
+    while not stop.wait(interval):
+        timeline.append((round(time.monotonic() - start, 3), treehub.in_flight))
+
+
+def client_requests(output):
+    '''The counts of the summary garage-push logs at the end of the upload'''
+    match = re.search(r'after (\d+) HEAD requests, (\d+) batched queries, (\d+) PUT requests and (\d+) bundle uploads',
+                      output)
+    if not match:
+        return None
+    return dict(zip(['head', 'batch_query', 'put', 'bundle'], [int(g) for g in match.groups()]))
+
+
+def run_once(args, repo, files, size_mb, congestion_control):
+    treehub = MockTreehub(args.rtt_ms / 1000, args.bandwidth_mbit * 1000 * 1000 / 8, args.error_rate,
+                          not args.no_batch, not args.no_bundle, args.seed)
+    handler = type('Handler', (MockTreehubHandler,), {'treehub': treehub})
+    httpd = MockTreehubServer(('localhost', 0), handler)
+    server = threading.Thread(target=httpd.serve_forever, daemon=True)
+    server.start()
+
+    timeline = []
+    stop = threading.Event()
+    sampler = threading.Thread(target=sample_concurrency,
+                               args=(treehub, args.sample_ms / 1000, stop, timeline), daemon=True)
+
+    with TemporaryDirectory(prefix='garage-push-benchmark-') as tmp_dir:
+        credentials = path.join(tmp_dir, 'credentials.json')
+        with open(credentials, 'w') as f:
+            json.dump({'ostree': {'server': 'http://localhost:{}/'.format(httpd.server_address[1])}}, f)
+
+        sampler.start()
+        start = time.monotonic()
+        try:
+            push = subprocess.run([args.garage_push, '--repo', repo, '--ref', 'master', '--credentials', credentials,
+                                   '--jobs', str(args.jobs), '--congestion-control', congestion_control],
+                                  stdout=subprocess.PIPE, stderr=subprocess.STDOUT, timeout=args.timeout)
+            success = push.returncode == 0
+            output = push.stdout.decode('utf-8', errors='replace')
+        except subprocess.TimeoutExpired:
+            success = False
+            output = ''
+        elapsed = time.monotonic() - start
+        stop.set()
+        sampler.join()
+    httpd.shutdown()
+    httpd.server_close()
+
+    if not success:
+        logger.error('garage-push failed:\n{}'.format(output))
+    upload = None
+    if treehub.first_request is not None:
+        upload = treehub.last_response - treehub.first_request
+    busy = [n for _, n in timeline if n > 0]
+    return {
+        'files': files,
+        'size_mb': size_mb,
+        'congestion_control': congestion_control,
+        'jobs': args.jobs,
+        'rtt_ms': args.rtt_ms,
+        'bandwidth_mbit': args.bandwidth_mbit,
+        'error_rate': args.error_rate,
+        'success': success,
+        'push_seconds': elapsed,
+        # from the first request about an object to the last response
+        'upload_seconds': upload,
+        'server_requests': dict(treehub.requests),
+        'client_requests': client_requests(output),
+        'injected_errors': treehub.errors,
+        'objects_stored': len(treehub.objects),
+        'mean_concurrency': sum(busy) / len(busy) if busy else 0,
+        'max_concurrency': max(busy) if busy else 0,
+        # (seconds since the start, requests in flight)
+        'concurrency': timeline,
+    }
+
+
+def print_results(results):
+    print('{:>7} {:>7} {:>8} {:>7} {:>9} {:>9} {:>9} {:>7} {:>7} {:>6} {:>6}'.format(
+          'files', 'size MB', 'control', 'result', 'push s', 'upload s', 'requests', 'errors', 'mean c',
+          'max c', 'MB/s'))
+    for r in results:
+        print('{:>7} {:>7} {:>8} {:>7} {:>9.2f} {:>9} {:>9} {:>7} {:>7.1f} {:>6} {:>6}'.format(
+              r['files'], r['size_mb'], r['congestion_control'], 'ok' if r['success'] else 'FAILED',
+              r['push_seconds'], '-' if r['upload_seconds'] is None else '{:.2f}'.format(r['upload_seconds']),
+              sum(r['server_requests'].values()), r['injected_errors'], r['mean_concurrency'],
+              r['max_concurrency'],
+              '{:.1f}'.format(r['size_mb'] / r['upload_seconds']) if r['upload_seconds'] else '-'))
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+
+    parser = argparse.ArgumentParser(description='Benchmark garage-push against a Treehub mock')
+    parser.add_argument('--garage-push', help='garage-push executable', default='build/src/sota_tools/garage-push')
+    parser.add_argument('--repos', help='comma separated repositories to push, as number of files:size in MB',
+                        default='1000:10,10000:100')
+    parser.add_argument('--congestion-control', help='comma separated congestion control algorithms',
+                        default='aimd,latency')
+    parser.add_argument('--jobs', help='maximum number of parallel requests', type=int, default=30)
+    parser.add_argument('--rtt-ms', help='round-trip time added to each request', type=float, default=50)
+    parser.add_argument('--bandwidth-mbit', help='bandwidth of the uploads in Mbit/s, 0 for unlimited',
+                        type=float, default=100)
+    parser.add_argument('--error-rate', help='share of the requests failing with 503', type=float, default=0.01)
+    parser.add_argument('--no-batch', help='the mock does not support batched queries', action='store_true')
+    parser.add_argument('--no-bundle', help='the mock does not support bundle uploads', action='store_true')
+    parser.add_argument('--sample-ms', help='interval between samples of the concurrency', type=float, default=100)
+    parser.add_argument('--seed', help='seed of the repository contents and of the errors', type=int, default=0)
+    parser.add_argument('-o', '--output', help='file to write the results to as JSON')
+    parser.add_argument('--timeout', help='timeout of each push in seconds', type=int, default=1800)
+
+    args = parser.parse_args()
+
+    results = []
+    for repo_spec in args.repos.split(','):
+        files, size_mb = [int(n) for n in repo_spec.split(':')]
+        with TemporaryDirectory(prefix='garage-push-benchmark-repo-') as repo_dir:
+            logger.info('Generating a repository of {} files and {} MB'.format(files, size_mb))
+            repo = create_repo(repo_dir, files, size_mb, args.seed)
+            for congestion_control in args.congestion_control.split(','):
+                logger.info('Pushing {} files and {} MB with {}'.format(files, size_mb, congestion_control))
+                results.append(run_once(args, repo, files, size_mb, congestion_control))
+
+    print_results(results)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2)
+    exit(0 if all(r['success'] for r in results) else 1)
@@ -21,6 +21,11 @@ class TreehubServer(BaseHTTPRequestHandler):
         if self.path == '/token':
             self._respond({'access_token': "dummytoken123"})
         elif obj:
+            # Like a real server, only store objects that were sent in full
+            length = int(self.headers.get('Content-Length', 0))
+            if len(self.rfile.read(length)) < length:
+                self.close_connection = True
+                return
             code = self._ostree_repo.upload(obj)
             self.send_response_only(code)
             self.end_headers()
@@ -9,6 +9,10 @@ import subprocess
 import sys
 import time
 import hashlib
+import io
+import json
+import tarfile
+import urllib.request
 from contextlib import ExitStack
 from http.server import BaseHTTPRequestHandler, HTTPServer
 from random import seed, randrange
@@ -55,7 +59,71 @@ class TreehubServerHandler(BaseHTTPRequestHandler):
     def do_POST(self):
         ctype, pdict = cgi.parse_header(self.headers['Content-Type'])
         print("Upload type: {}".format(ctype))
-        if ctype == 'multipart/form-data':
+        if ctype == 'application/json' and self.path.rstrip('/').endswith('/objects-query'):
+            if self.drop_check():
+                print("Dropping batched query %s" % self.path)
+                return
+            length = int(self.headers['content-length'])
+            paths = json.loads(self.rfile.read(length))
+            print("Processing batched query of %d objects" % len(paths))
+            present = [p for p in paths if os.path.exists(os.path.join(repo_path, p))]
+            body = json.dumps(present).encode('utf-8')
+            self.send_response_only(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+        elif ctype == 'application/gzip' and self.path.rstrip('/').endswith('/objects-bundle'):
+            if self.drop_check():
+                print("Dropping bundle upload %s" % self.path)
+                return
+            length = int(self.headers['content-length'])
+            with tarfile.open(fileobj=io.BytesIO(self.rfile.read(length)), mode='r:gz') as bundle:
+                for member in bundle.getmembers():
+                    if not member.isfile() or not member.name.startswith('objects/') or '..' in member.name:
+                        continue
+                    print("Storing bundled object %s" % member.name)
+                    full_path = os.path.join(repo_path, member.name)
+                    os.makedirs(os.path.dirname(full_path), exist_ok=True)
+                    with open(full_path, "wb") as f:
+                        f.write(bundle.extractfile(member).read())
+            self.send_response_only(204)
+            self.end_headers()
+            return
+        elif ctype == 'application/json' and self.path.rstrip('/').endswith('/objects-copy') and args.copy:
+            if self.drop_check():
+                print("Dropping object copy %s" % self.path)
+                return
+            length = int(self.headers['content-length'])
+            request = json.loads(self.rfile.read(length))
+            copied = []
+            for p in request['objects']:
+                if not p.startswith('objects/') or '..' in p:
+                    continue
+                source = urllib.request.Request(request['source'] + p)
+                if 'token' in request:
+                    source.add_header('Authorization', 'Bearer ' + request['token'])
+                try:
+                    with urllib.request.urlopen(source) as response:
+                        data = response.read()
+                except OSError:
+                    print("Could not copy object %s" % p)
+                    continue
+                print("Storing copied object %s" % p)
+                full_path = os.path.join(repo_path, p)
+                os.makedirs(os.path.dirname(full_path), exist_ok=True)
+                with open(full_path, "wb") as f:
+                    f.write(data)
+                copied.append(p)
+            body = json.dumps(copied).encode('utf-8')
+            self.send_response_only(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            return
+        elif ctype == 'multipart/form-data':
             pdict['boundary'] = bytes(pdict['boundary'], 'utf-8')
             fields = cgi.parse_multipart(self.rfile, pdict)
             if "file" in fields:
@@ -167,6 +235,8 @@ if __name__ == "__main__":
                         help='sleep for n.n seconds for every GET request')
     parser.add_argument('-t', '--tls', action='store_true',
                         help='require TLS from clients')
+    parser.add_argument('--copy', action='store_true',
+                        help='copy objects from other servers on request')
     args = parser.parse_args()
 
     signal.signal(signal.SIGTERM, sig_handler)
@@ -787,7 +787,9 @@ class UptaneTestRepo:
         targetname = target_name if target_name else image_filename
 
         with open(path.join(self.image_dir, image_filename), 'wb') as image_file:
-            image_file.write(urandom(image_size))
+            # in chunks, as benchmarks use images of up to a few GB
+            for offset in range(0, image_size, 1024 * 1024):
+                image_file.write(urandom(min(1024 * 1024, image_size - offset)))
 
         image_creation_cmdline = [self._repo_manager_exe, '--path', self.root_dir,
                                   '--command', 'image', '--filename', image_filename, '--targetname', targetname, '--hwid', id[0]]